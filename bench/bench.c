@@ -0,0 +1,326 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include <sodium.h>
+
+#include "common/buffer.h"
+#include "common/json.h"
+
+#include "core/transaction.h"
+
+#include "bench.h"
+
+static const char *g_bench_filter = NULL;
+static const char *g_bench_json_filename = NULL;
+static uint64_t g_bench_min_sample_time_ms = BENCH_DEFAULT_MIN_SAMPLE_TIME_MS;
+static uint32_t g_bench_num_samples = BENCH_DEFAULT_NUM_SAMPLES;
+
+static bench_result_t g_bench_results[BENCH_MAX_NUM_RESULTS];
+static uint32_t g_bench_num_results = 0;
+
+static _Thread_local uint64_t g_bench_num_allocations = 0;
+static _Thread_local uint64_t g_bench_allocated_bytes = 0;
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+// the bench is linked with --wrap for each of these, every call to them
+// from the vulkan libraries and the benchmarks resolves to the wrappers...
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void *ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+  g_bench_num_allocations++;
+  g_bench_allocated_bytes += size;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+  g_bench_num_allocations++;
+  g_bench_allocated_bytes += num * size;
+  return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void *ptr, size_t size)
+{
+  g_bench_num_allocations++;
+  g_bench_allocated_bytes += size;
+  return __real_realloc(ptr, size);
+}
+#endif
+
+static uint64_t get_bench_time_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void set_bench_filter(const char *filter)
+{
+  g_bench_filter = filter;
+}
+
+void set_bench_json_filename(const char *json_filename)
+{
+  g_bench_json_filename = json_filename;
+}
+
+void set_bench_min_sample_time_ms(uint64_t min_sample_time_ms)
+{
+  g_bench_min_sample_time_ms = min_sample_time_ms;
+}
+
+void set_bench_num_samples(uint32_t num_samples)
+{
+  assert(num_samples > 0 && num_samples <= BENCH_MAX_NUM_SAMPLES);
+  g_bench_num_samples = num_samples;
+}
+
+void bench_start_timer(bench_state_t *state)
+{
+  assert(state != NULL);
+  if (state->timer_running)
+  {
+    return;
+  }
+
+  state->start_num_allocations = g_bench_num_allocations;
+  state->start_allocated_bytes = g_bench_allocated_bytes;
+  state->timer_running = 1;
+  state->start_time = get_bench_time_ns();
+}
+
+void bench_stop_timer(bench_state_t *state)
+{
+  assert(state != NULL);
+  if (state->timer_running == 0)
+  {
+    return;
+  }
+
+  state->elapsed_time += get_bench_time_ns() - state->start_time;
+  state->num_allocations += g_bench_num_allocations - state->start_num_allocations;
+  state->allocated_bytes += g_bench_allocated_bytes - state->start_allocated_bytes;
+  state->timer_running = 0;
+}
+
+static void run_bench_sample(bench_state_t *state, uint64_t num_iterations, bench_func_t func, void *arg)
+{
+  assert(state != NULL);
+  assert(func != NULL);
+  memset(state, 0, sizeof(bench_state_t));
+  state->num_iterations = num_iterations;
+
+  bench_start_timer(state);
+  func(state, arg);
+  bench_stop_timer(state);
+}
+
+static int compare_bench_samples(const void *a, const void *b)
+{
+  const bench_state_t *sample = (const bench_state_t*)a;
+  const bench_state_t *other_sample = (const bench_state_t*)b;
+  if (sample->elapsed_time == other_sample->elapsed_time)
+  {
+    return 0;
+  }
+
+  return sample->elapsed_time < other_sample->elapsed_time ? -1 : 1;
+}
+
+static uint64_t calibrate_benchmark(bench_func_t func, void *arg)
+{
+  assert(func != NULL);
+  uint64_t min_sample_time = g_bench_min_sample_time_ms * 1000000ULL;
+  uint64_t num_iterations = 1;
+
+  bench_state_t state;
+  while (num_iterations < BENCH_MAX_NUM_ITERATIONS)
+  {
+    run_bench_sample(&state, num_iterations, func, arg);
+    if (state.elapsed_time >= min_sample_time)
+    {
+      break;
+    }
+
+    // grow towards the iterations expected to fill the sample time with some headroom,
+    // but never by more than 100x at once in case the first iterations were cheap...
+    uint64_t next_num_iterations = num_iterations * 100;
+    if (state.elapsed_time > 0)
+    {
+      double expected_num_iterations = (double)num_iterations * 1.2 * (double)min_sample_time / (double)state.elapsed_time;
+      if (expected_num_iterations < (double)next_num_iterations)
+      {
+        next_num_iterations = (uint64_t)expected_num_iterations;
+      }
+    }
+
+    if (next_num_iterations <= num_iterations)
+    {
+      next_num_iterations = num_iterations + 1;
+    }
+
+    num_iterations = next_num_iterations < BENCH_MAX_NUM_ITERATIONS ? next_num_iterations : BENCH_MAX_NUM_ITERATIONS;
+  }
+
+  return num_iterations;
+}
+
+int run_benchmark(const char *name, bench_func_t func, void *arg)
+{
+  assert(name != NULL);
+  assert(func != NULL);
+  if (g_bench_filter != NULL && strstr(name, g_bench_filter) == NULL)
+  {
+    return 0;
+  }
+
+  if (g_bench_num_results >= BENCH_MAX_NUM_RESULTS)
+  {
+    fprintf(stderr, "Too many benchmarks, cannot run benchmark: %s!\n", name);
+    return 1;
+  }
+
+  uint64_t num_iterations = calibrate_benchmark(func, arg);
+  bench_state_t samples[BENCH_MAX_NUM_SAMPLES];
+  for (uint32_t i = 0; i < g_bench_num_samples; i++)
+  {
+    run_bench_sample(&samples[i], num_iterations, func, arg);
+  }
+
+  qsort(samples, g_bench_num_samples, sizeof(bench_state_t), compare_bench_samples);
+  bench_state_t *median_sample = &samples[g_bench_num_samples / 2];
+
+  bench_result_t *result = &g_bench_results[g_bench_num_results++];
+  snprintf(result->name, sizeof(result->name), "%s", name);
+  result->num_iterations = num_iterations;
+  result->ns_per_op = (double)median_sample->elapsed_time / (double)num_iterations;
+  result->allocs_per_op = (double)median_sample->num_allocations / (double)num_iterations;
+  result->bytes_per_op = (double)median_sample->allocated_bytes / (double)num_iterations;
+
+  printf("%-40s %12llu %14.1f ns/op %10.2f allocs/op %12.1f B/op\n", result->name,
+    (unsigned long long)result->num_iterations, result->ns_per_op, result->allocs_per_op, result->bytes_per_op);
+
+  fflush(stdout);
+  return 0;
+}
+
+transaction_t* make_bench_tx(uint32_t num_txins, uint32_t num_txouts)
+{
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  if (num_txins > 0)
+  {
+    crypto_sign_keypair(public_key, secret_key);
+  }
+
+  transaction_t *tx = make_transaction();
+  for (uint32_t i = 0; i < num_txouts; i++)
+  {
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    randombytes_buf(txout->address, ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, i);
+  }
+
+  for (uint32_t i = 0; i < num_txins; i++)
+  {
+    input_transaction_t *txin = make_txin();
+    randombytes_buf(txin->transaction, HASH_SIZE);
+    txin->txout_index = i;
+    add_txin_to_transaction(tx, txin, i);
+
+    int r = sign_txin(txin, tx, public_key, secret_key);
+    assert(r == 0);
+  }
+
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+static int write_bench_results(const char *filename)
+{
+  assert(filename != NULL);
+  buffer_t *buffer = buffer_init();
+  json_write_format(buffer, "{\"min_sample_time_ms\":%llu,\"num_samples\":%u,", (unsigned long long)g_bench_min_sample_time_ms, g_bench_num_samples);
+#ifdef BENCH_COUNT_ALLOCATIONS
+  json_write_format(buffer, "\"allocations_counted\":true,");
+#else
+  json_write_format(buffer, "\"allocations_counted\":false,");
+#endif
+  json_write_format(buffer, "\"benchmarks\":[");
+  for (uint32_t i = 0; i < g_bench_num_results; i++)
+  {
+    bench_result_t *result = &g_bench_results[i];
+    json_write_format(buffer, "%s{\"name\":", i > 0 ? "," : "");
+    json_write_string(buffer, result->name, strlen(result->name));
+    json_write_format(buffer, ",\"iterations\":%llu,\"ns_per_op\":%.3f,\"allocs_per_op\":%.3f,\"bytes_per_op\":%.3f}",
+      (unsigned long long)result->num_iterations, result->ns_per_op, result->allocs_per_op, result->bytes_per_op);
+  }
+
+  json_write_format(buffer, "]}\n");
+
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Failed to open benchmark results file: %s!\n", filename);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  size_t size = buffer_get_size(buffer);
+  int failed = fwrite(buffer_get_data(buffer), 1, size, file) != size;
+  fclose(file);
+  buffer_free(buffer);
+  if (failed)
+  {
+    fprintf(stderr, "Failed to write benchmark results file: %s!\n", filename);
+    return 1;
+  }
+
+  return 0;
+}
+
+int finish_benchmarks(void)
+{
+#ifndef BENCH_COUNT_ALLOCATIONS
+  printf("\nAllocations were not counted, the allocator could not be wrapped on this platform.\n");
+#endif
+  if (g_bench_json_filename != NULL)
+  {
+    return write_bench_results(g_bench_json_filename);
+  }
+
+  return 0;
+}
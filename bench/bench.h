@@ -0,0 +1,104 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+#include "core/transaction.h"
+
+VULKAN_BEGIN_DECL
+
+/*
+ * Every benchmark is calibrated until a sample of it runs for the minimum sample
+ * time then sampled a number of times, the median sample is reported. A benchmark
+ * runs state->num_iterations of the operation it measures, work which should not be
+ * measured can be excluded by stopping the timer around it...
+ *
+ * Allocations are only counted when the bench is linked with the allocator wrapped,
+ * and only the allocations the thread running the benchmark makes from statically
+ * linked code are counted, allocations inside shared libraries are not seen.
+ */
+#define BENCH_DEFAULT_MIN_SAMPLE_TIME_MS 100
+#define BENCH_DEFAULT_NUM_SAMPLES 5
+#define BENCH_MAX_NUM_ITERATIONS 1000000000
+#define BENCH_MAX_NUM_SAMPLES 64
+#define BENCH_MAX_NUM_RESULTS 256
+#define BENCH_MAX_NAME_SIZE 64
+
+typedef struct BenchState
+{
+  uint64_t num_iterations;
+
+  int timer_running;
+  uint64_t start_time;
+  uint64_t elapsed_time;
+
+  uint64_t start_num_allocations;
+  uint64_t num_allocations;
+  uint64_t start_allocated_bytes;
+  uint64_t allocated_bytes;
+} bench_state_t;
+
+typedef struct BenchResult
+{
+  char name[BENCH_MAX_NAME_SIZE];
+  uint64_t num_iterations;
+  double ns_per_op;
+  double allocs_per_op;
+  double bytes_per_op;
+} bench_result_t;
+
+typedef void (*bench_func_t)(bench_state_t *state, void *arg);
+
+#if defined(__GNUC__)
+#define BENCH_DO_NOT_OPTIMIZE(value) __asm__ __volatile__("" : : "g"(value) : "memory")
+#else
+#define BENCH_DO_NOT_OPTIMIZE(value) do { volatile const void *bench_value = (const void*)(uintptr_t)(value); (void)bench_value; } while (0)
+#endif
+
+VULKAN_API void set_bench_filter(const char *filter);
+VULKAN_API void set_bench_json_filename(const char *json_filename);
+VULKAN_API void set_bench_min_sample_time_ms(uint64_t min_sample_time_ms);
+VULKAN_API void set_bench_num_samples(uint32_t num_samples);
+
+VULKAN_API int finish_benchmarks(void);
+
+VULKAN_API void bench_start_timer(bench_state_t *state);
+VULKAN_API void bench_stop_timer(bench_state_t *state);
+
+VULKAN_API int run_benchmark(const char *name, bench_func_t func, void *arg);
+
+VULKAN_API transaction_t* make_bench_tx(uint32_t num_txins, uint32_t num_txouts);
+
+VULKAN_API void run_block_benchmarks(void);
+VULKAN_API void run_common_benchmarks(void);
+VULKAN_API void run_crypto_benchmarks(void);
+VULKAN_API void run_mempool_benchmarks(void);
+
+VULKAN_END_DECL
@@ -0,0 +1,168 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "common/buffer_iterator.h"
+#include "common/buffer.h"
+
+#include "core/block.h"
+#include "core/transaction.h"
+
+#include "bench.h"
+
+static const uint32_t g_block_bench_tx_counts[] = {1, 16, 256, 2048};
+
+#define NUM_BLOCK_BENCH_TX_COUNTS (sizeof(g_block_bench_tx_counts) / sizeof(uint32_t))
+
+typedef struct BlockBenchArg
+{
+  block_t *block;
+  buffer_t *buffer;
+} block_bench_arg_t;
+
+static block_t* make_bench_block(uint32_t num_txs)
+{
+  block_t *block = make_block();
+  for (uint32_t i = 0; i < num_txs; i++)
+  {
+    transaction_t *tx = make_bench_tx(1, 2);
+    int r = add_transaction_to_block(block, tx, i);
+    assert(r == 0);
+  }
+
+  compute_merkle_root(block->merkle_root, block);
+  return block;
+}
+
+static void bench_serialize_block(bench_state_t *state, void *arg)
+{
+  block_bench_arg_t *bench_arg = (block_bench_arg_t*)arg;
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    buffer_reset(bench_arg->buffer);
+    serialize_block(bench_arg->buffer, bench_arg->block);
+    serialize_transactions_from_block(bench_arg->buffer, bench_arg->block);
+    BENCH_DO_NOT_OPTIMIZE(buffer_get_data(bench_arg->buffer));
+  }
+}
+
+static void bench_deserialize_block(bench_state_t *state, void *arg)
+{
+  block_bench_arg_t *bench_arg = (block_bench_arg_t*)arg;
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(bench_arg->buffer);
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    buffer_iterator_set_offset(buffer_iterator, 0);
+    block_t *block = NULL;
+    int r = deserialize_block(buffer_iterator, &block);
+    assert(r == 0);
+    r = deserialize_transactions_to_block(buffer_iterator, block);
+    assert(r == 0);
+    free_block(block);
+  }
+
+  buffer_iterator_free(buffer_iterator);
+}
+
+static void bench_deserialize_block_in_arena(bench_state_t *state, void *arg)
+{
+  block_bench_arg_t *bench_arg = (block_bench_arg_t*)arg;
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(bench_arg->buffer);
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    buffer_iterator_set_offset(buffer_iterator, 0);
+    block_t *block = NULL;
+    int r = deserialize_block(buffer_iterator, &block);
+    assert(r == 0);
+    r = deserialize_transactions_to_block_in_arena(buffer_iterator, block);
+    assert(r == 0);
+    free_block(block);
+  }
+
+  buffer_iterator_free(buffer_iterator);
+}
+
+static void bench_compute_block_hash(bench_state_t *state, void *arg)
+{
+  block_bench_arg_t *bench_arg = (block_bench_arg_t*)arg;
+  uint8_t hash[HASH_SIZE];
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    bench_arg->block->nonce = (uint32_t)i;
+    compute_block_hash(hash, bench_arg->block);
+    BENCH_DO_NOT_OPTIMIZE(hash);
+  }
+}
+
+static void bench_compute_merkle_root(bench_state_t *state, void *arg)
+{
+  block_bench_arg_t *bench_arg = (block_bench_arg_t*)arg;
+  uint8_t merkle_root[HASH_SIZE];
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    compute_merkle_root(merkle_root, bench_arg->block);
+    BENCH_DO_NOT_OPTIMIZE(merkle_root);
+  }
+}
+
+void run_block_benchmarks(void)
+{
+  char name[BENCH_MAX_NAME_SIZE];
+  for (uint32_t i = 0; i < NUM_BLOCK_BENCH_TX_COUNTS; i++)
+  {
+    uint32_t num_txs = g_block_bench_tx_counts[i];
+
+    block_bench_arg_t bench_arg;
+    bench_arg.block = make_bench_block(num_txs);
+    bench_arg.buffer = buffer_init();
+    serialize_block(bench_arg.buffer, bench_arg.block);
+    serialize_transactions_from_block(bench_arg.buffer, bench_arg.block);
+
+    snprintf(name, sizeof(name), "serialize_block/%u", num_txs);
+    run_benchmark(name, bench_serialize_block, &bench_arg);
+
+    snprintf(name, sizeof(name), "deserialize_block/%u", num_txs);
+    run_benchmark(name, bench_deserialize_block, &bench_arg);
+
+    snprintf(name, sizeof(name), "deserialize_block_in_arena/%u", num_txs);
+    run_benchmark(name, bench_deserialize_block_in_arena, &bench_arg);
+
+    snprintf(name, sizeof(name), "compute_merkle_root/%u", num_txs);
+    run_benchmark(name, bench_compute_merkle_root, &bench_arg);
+
+    // the block hash only covers the header, it does not depend on the number of txs
+    if (i == 0)
+    {
+      run_benchmark("compute_block_hash", bench_compute_block_hash, &bench_arg);
+    }
+
+    buffer_free(bench_arg.buffer);
+    free_block(bench_arg.block);
+  }
+}
@@ -0,0 +1,926 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+#include <sodium.h>
+
+#include "common/argparse.h"
+#include "common/buffer.h"
+#include "common/json.h"
+#include "common/task.h"
+#include "common/util.h"
+
+#include "core/block.h"
+#include "core/blockchain.h"
+#include "core/mempool.h"
+#include "core/net.h"
+#include "core/p2p.h"
+#include "core/parameters.h"
+#include "core/pow.h"
+#include "core/storage.h"
+#include "core/transaction.h"
+#include "core/transaction_builder.h"
+#include "core/validator.h"
+
+#include "miner/miner.h"
+
+#include "wallet/wallet.h"
+
+/*
+ * The chain bench generates a synthetic chain at the trivial difficulty and measures how
+ * quickly it's blocks are validated and connected, how quickly balances are queried from
+ * the resulting unspent txs and how quickly blocks are rolled back. The chain can also be
+ * synced to a second node over loopback, that node runs in a child process since all of
+ * the blockchain state is global to the process...
+ *
+ * The db bytes written are the key and value bytes put to the blockchain database while
+ * the blocks are connected, not the bytes the storage engine writes to disk for them.
+ */
+#define CHAIN_BENCH_DEFAULT_DATA_DIR "chain_bench"
+#define CHAIN_BENCH_DEFAULT_HEIGHT 1000
+#define CHAIN_BENCH_DEFAULT_TXS_PER_BLOCK 16
+#define CHAIN_BENCH_DEFAULT_ROLLBACK_BLOCKS 100
+#define CHAIN_BENCH_DEFAULT_BALANCE_QUERIES 1000
+#define CHAIN_BENCH_DEFAULT_SYNC_PORT 18899
+#define CHAIN_BENCH_DEFAULT_SYNC_TIMEOUT 600
+
+#define CHAIN_BENCH_MIN_NUM_WALLETS 16
+#define CHAIN_BENCH_NUM_SINK_WALLETS 8
+#define CHAIN_BENCH_TX_AMOUNT 1000
+#define CHAIN_BENCH_SYNC_CHECK_DELAY 0.05
+#define CHAIN_BENCH_MAX_PATH_SIZE 256
+
+typedef struct ChainBenchResults
+{
+  uint32_t num_blocks;
+  uint64_t num_txs;
+  uint64_t connect_time_us;
+  uint64_t db_bytes_written;
+
+  uint32_t num_balance_queries;
+  uint64_t balance_queries_time_us;
+
+  int synced;
+  double sync_time;
+
+  uint32_t num_rollback_blocks;
+  uint64_t rollback_time_us;
+
+  uint64_t peak_rss_bytes;
+} chain_bench_results_t;
+
+enum
+{
+  CMD_ARG_HELP = 0,
+  CMD_ARG_DATA_DIR,
+  CMD_ARG_HEIGHT,
+  CMD_ARG_TXS_PER_BLOCK,
+  CMD_ARG_ROLLBACK_BLOCKS,
+  CMD_ARG_BALANCE_QUERIES,
+  CMD_ARG_BLOCKCHAIN_DURABILITY,
+  CMD_ARG_SYNC,
+  CMD_ARG_SYNC_PORT,
+  CMD_ARG_SYNC_TIMEOUT,
+  CMD_ARG_JSON,
+  CMD_ARG_SYNC_PEER_PORT,
+  CMD_ARG_SYNC_RESULT
+};
+
+static const argument_map_t g_arguments_map[] = {
+  {"help", CMD_ARG_HELP, "Shows the help information", "", 0},
+  {"data-dir", CMD_ARG_DATA_DIR, "Sets the directory the generated blockchain is stored in, it is removed first", "<data_dir>", 1},
+  {"height", CMD_ARG_HEIGHT, "Sets the number of blocks generated on top of the genesis block", "<height>", 1},
+  {"txs-per-block", CMD_ARG_TXS_PER_BLOCK, "Sets the number of spend txs in every generated block", "<num_txs>", 1},
+  {"rollback-blocks", CMD_ARG_ROLLBACK_BLOCKS, "Sets the number of blocks rolled back at the end of the bench", "<num_blocks>", 1},
+  {"balance-queries", CMD_ARG_BALANCE_QUERIES, "Sets the number of balance queries made against the generated chain", "<num_queries>", 1},
+  {"blockchain-durability", CMD_ARG_BLOCKCHAIN_DURABILITY, "Sets how durable block commits are: none, batch or sync", "<durability>", 1},
+  {"sync", CMD_ARG_SYNC, "Syncs the generated chain to a second node over loopback", "", 0},
+  {"sync-port", CMD_ARG_SYNC_PORT, "Sets the loopback port the generated chain is served on when syncing", "<port>", 1},
+  {"sync-timeout", CMD_ARG_SYNC_TIMEOUT, "Sets the number of seconds the second node has to sync the generated chain", "<seconds>", 1},
+  {"json", CMD_ARG_JSON, "Writes the bench results as json to a file", "<filename>", 1},
+  {"sync-peer-port", CMD_ARG_SYNC_PEER_PORT, "Runs as the syncing node connecting to the loopback port, used internally", "<port>", 1},
+  {"sync-result", CMD_ARG_SYNC_RESULT, "Sets the file the syncing node writes it's sync time to, used internally", "<filename>", 1}
+};
+
+#define NUM_ARGUMENTS (sizeof(g_arguments_map) / sizeof(argument_map_t))
+
+static const char *g_chain_bench_program_path = NULL;
+static const char *g_chain_bench_data_dir = CHAIN_BENCH_DEFAULT_DATA_DIR;
+static uint32_t g_chain_bench_height = CHAIN_BENCH_DEFAULT_HEIGHT;
+static uint32_t g_chain_bench_txs_per_block = CHAIN_BENCH_DEFAULT_TXS_PER_BLOCK;
+static uint32_t g_chain_bench_rollback_blocks = CHAIN_BENCH_DEFAULT_ROLLBACK_BLOCKS;
+static uint32_t g_chain_bench_balance_queries = CHAIN_BENCH_DEFAULT_BALANCE_QUERIES;
+static int g_chain_bench_sync = 0;
+static uint16_t g_chain_bench_sync_port = CHAIN_BENCH_DEFAULT_SYNC_PORT;
+static uint32_t g_chain_bench_sync_timeout = CHAIN_BENCH_DEFAULT_SYNC_TIMEOUT;
+static const char *g_chain_bench_json_filename = NULL;
+static uint16_t g_chain_bench_sync_peer_port = 0;
+static const char *g_chain_bench_sync_result_filename = NULL;
+
+static char g_chain_bench_p2p_storage_filename[CHAIN_BENCH_MAX_PATH_SIZE];
+
+static wallet_t **g_chain_bench_wallets = NULL;
+static uint32_t g_chain_bench_num_wallets = 0;
+static wallet_t *g_chain_bench_sink_wallets[CHAIN_BENCH_NUM_SINK_WALLETS];
+
+#ifndef _WIN32
+extern char **environ;
+
+static pid_t g_chain_bench_sync_child_pid = 0;
+static int g_chain_bench_sync_child_exited = 0;
+static int g_chain_bench_sync_child_status = 0;
+static uint64_t g_chain_bench_sync_start_time = 0;
+static int g_chain_bench_sync_timed_out = 0;
+#endif
+
+static int parse_commandline_args(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    int16_t arg_type = argparse_get_argument_with_prefix_from_str((argument_map_t*)&g_arguments_map, NUM_ARGUMENTS, argv[i]);
+    argument_map_t *argument_map = argparse_get_argument_map_from_type((argument_map_t*)&g_arguments_map, NUM_ARGUMENTS, arg_type);
+    if (argument_map == NULL)
+    {
+      fprintf(stderr, "Unknown command line argument: %s\n", argv[i]);
+      return 1;
+    }
+
+    int num_args = (argc - 1) - i;
+    if (num_args < argument_map->num_args)
+    {
+      fprintf(stderr, "Usage: -%s, --%s: %s\n", argument_map->name, argument_map->name, argument_map->usage);
+      return 1;
+    }
+
+    switch (arg_type)
+    {
+      case CMD_ARG_HELP:
+        printf("Usage:\n");
+        printf("  vulkan_chain_bench [command-line options]\n");
+        printf("\n");
+        printf("Command-line Options:\n");
+        for (int i = 0; i < NUM_ARGUMENTS; i++)
+        {
+          argument_map_t *argument_map = (argument_map_t*)&g_arguments_map[i];
+          printf("  -%s, --%s: %s\n", argument_map->name, argument_map->name, argument_map->help);
+        }
+
+        printf("\n");
+        return 1;
+      case CMD_ARG_DATA_DIR:
+        i++;
+        g_chain_bench_data_dir = (const char*)argv[i];
+        break;
+      case CMD_ARG_HEIGHT:
+        i++;
+        g_chain_bench_height = (uint32_t)atoi(argv[i]);
+        if (g_chain_bench_height == 0)
+        {
+          fprintf(stderr, "The height must be greater than 0!\n");
+          return 1;
+        }
+
+        break;
+      case CMD_ARG_TXS_PER_BLOCK:
+        i++;
+        g_chain_bench_txs_per_block = (uint32_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_ROLLBACK_BLOCKS:
+        i++;
+        g_chain_bench_rollback_blocks = (uint32_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_BALANCE_QUERIES:
+        i++;
+        g_chain_bench_balance_queries = (uint32_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DURABILITY:
+        i++;
+        const char *durability_str = (const char*)argv[i];
+        int durability = get_blockchain_durability_from_str(durability_str);
+        if (durability < 0)
+        {
+          fprintf(stderr, "Unknown blockchain durability: %s!\n", durability_str);
+          return 1;
+        }
+
+        set_blockchain_durability(durability);
+        break;
+      case CMD_ARG_SYNC:
+        g_chain_bench_sync = 1;
+        break;
+      case CMD_ARG_SYNC_PORT:
+        i++;
+        g_chain_bench_sync_port = (uint16_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_SYNC_TIMEOUT:
+        i++;
+        g_chain_bench_sync_timeout = (uint32_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_JSON:
+        i++;
+        g_chain_bench_json_filename = (const char*)argv[i];
+        break;
+      case CMD_ARG_SYNC_PEER_PORT:
+        i++;
+        g_chain_bench_sync_peer_port = (uint16_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_SYNC_RESULT:
+        i++;
+        g_chain_bench_sync_result_filename = (const char*)argv[i];
+        break;
+      default:
+        fprintf(stderr, "Unknown command line argument: %s\n", argv[i]);
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+static uint64_t get_peak_rss_bytes(void)
+{
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    // linux reports the max resident set size in kilobytes, macos in bytes
+  #ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+  #else
+    return (uint64_t)usage.ru_maxrss * 1024;
+  #endif
+  }
+#endif
+  return 0;
+}
+
+static double get_per_second(uint64_t count, uint64_t time_us)
+{
+  return time_us > 0 ? ((double)count * 1000000.0) / (double)time_us : 0.0;
+}
+
+static int init_bench_node(const char *blockchain_dir)
+{
+  assert(blockchain_dir != NULL);
+  parameters_set_use_testnet(1);
+  parameters_set_use_trivial_difficulty(1);
+
+  // the blockchain is generated from scratch every time the bench is run
+  snprintf(g_chain_bench_p2p_storage_filename, CHAIN_BENCH_MAX_PATH_SIZE, "%s-p2p", blockchain_dir);
+  set_p2p_storage_filename(g_chain_bench_p2p_storage_filename);
+  remove_blockchain(blockchain_dir);
+
+  if (taskmgr_init())
+  {
+    return 1;
+  }
+
+  if (start_mempool())
+  {
+    return 1;
+  }
+
+  if (start_validator())
+  {
+    return 1;
+  }
+
+  if (init_blockchain(blockchain_dir, 1))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int deinit_bench_node(void)
+{
+  if (stop_mempool())
+  {
+    return 1;
+  }
+
+  if (stop_validator())
+  {
+    return 1;
+  }
+
+  if (close_blockchain())
+  {
+    return 1;
+  }
+
+  if (taskmgr_shutdown())
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+static wallet_t* make_bench_wallet(void)
+{
+  wallet_t *wallet = make_wallet();
+  assert(wallet != NULL);
+  crypto_sign_keypair(wallet->public_key, wallet->secret_key);
+  assert(public_key_to_address(wallet->address, wallet->public_key) == 0);
+  return wallet;
+}
+
+static void init_bench_wallets(void)
+{
+  // every wallet spends at most once per block, so that no block spends an output twice,
+  // there are enough wallets that each block has txs from wallets funded by coinbases...
+  g_chain_bench_num_wallets = MAX((g_chain_bench_txs_per_block * 2) + 1, CHAIN_BENCH_MIN_NUM_WALLETS);
+  g_chain_bench_wallets = malloc(sizeof(wallet_t*) * g_chain_bench_num_wallets);
+  assert(g_chain_bench_wallets != NULL);
+  for (uint32_t i = 0; i < g_chain_bench_num_wallets; i++)
+  {
+    g_chain_bench_wallets[i] = make_bench_wallet();
+  }
+
+  for (uint32_t i = 0; i < CHAIN_BENCH_NUM_SINK_WALLETS; i++)
+  {
+    g_chain_bench_sink_wallets[i] = make_bench_wallet();
+  }
+}
+
+static void free_bench_wallets(void)
+{
+  for (uint32_t i = 0; i < g_chain_bench_num_wallets; i++)
+  {
+    free_wallet(g_chain_bench_wallets[i]);
+  }
+
+  for (uint32_t i = 0; i < CHAIN_BENCH_NUM_SINK_WALLETS; i++)
+  {
+    free_wallet(g_chain_bench_sink_wallets[i]);
+  }
+
+  free(g_chain_bench_wallets);
+  g_chain_bench_wallets = NULL;
+  g_chain_bench_num_wallets = 0;
+}
+
+static int add_spend_txs_to_mempool(uint32_t block_index)
+{
+  uint32_t num_txs = 0;
+  for (uint32_t i = 0; i < g_chain_bench_num_wallets && num_txs < g_chain_bench_txs_per_block; i++)
+  {
+    wallet_t *wallet = g_chain_bench_wallets[(block_index + i) % g_chain_bench_num_wallets];
+    assert(wallet != NULL);
+    if (get_wallet_balance(wallet) < CHAIN_BENCH_TX_AMOUNT)
+    {
+      continue;
+    }
+
+    // the sinks collect many small unspent txs for the balance queries
+    wallet_t *sink_wallet = g_chain_bench_sink_wallets[((block_index * g_chain_bench_txs_per_block) + num_txs) % CHAIN_BENCH_NUM_SINK_WALLETS];
+    transaction_entry_t transaction_entry;
+    memcpy(transaction_entry.address, sink_wallet->address, ADDRESS_SIZE);
+    transaction_entry.amount = CHAIN_BENCH_TX_AMOUNT;
+
+    transaction_entries_t transaction_entries;
+    transaction_entries.num_entries = 1;
+    transaction_entries.entries[0] = &transaction_entry;
+
+    transaction_t *tx = NULL;
+    if (construct_spend_tx(&tx, wallet, 1, transaction_entries))
+    {
+      return 1;
+    }
+
+    assert(tx != NULL);
+    if (add_tx_to_mempool(tx))
+    {
+      free_transaction(tx);
+      return 1;
+    }
+
+    num_txs++;
+  }
+
+  return 0;
+}
+
+static block_t* construct_next_block(wallet_t *wallet)
+{
+  assert(wallet != NULL);
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  if (tip == NULL)
+  {
+    return NULL;
+  }
+
+  block_t *previous_block = get_block_header_from_hash_at_tip(tip, tip->hash);
+  if (previous_block == NULL)
+  {
+    release_blockchain_tip(tip);
+    return NULL;
+  }
+
+  // the timestamps are spaced out from the genesis block's timestamp instead of
+  // the current time, so that the blocks pass the median timestamp check...
+  block_t *block = construct_computable_block(wallet, tip, previous_block);
+  assert(block != NULL);
+  block->timestamp = previous_block->timestamp + POW_TARGET_SPACING;
+  free_block(previous_block);
+  release_blockchain_tip(tip);
+
+  if (compute_block(NULL, block) != COMPUTE_BLOCK_FOUND)
+  {
+    free_block(block);
+    return NULL;
+  }
+
+  return block;
+}
+
+static int connect_block_to_bench_wallets(block_t *block)
+{
+  assert(block != NULL);
+  for (uint32_t i = 0; i < g_chain_bench_num_wallets; i++)
+  {
+    if (connect_block_to_wallet(g_chain_bench_wallets[i], block))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int run_connect_bench(chain_bench_results_t *results)
+{
+  assert(results != NULL);
+  for (uint32_t i = 0; i < g_chain_bench_height; i++)
+  {
+    if (add_spend_txs_to_mempool(i))
+    {
+      fprintf(stderr, "Failed to construct the spend txs of block: %u!\n", i + 1);
+      return 1;
+    }
+
+    block_t *block = construct_next_block(g_chain_bench_wallets[i % g_chain_bench_num_wallets]);
+    if (block == NULL)
+    {
+      fprintf(stderr, "Failed to construct block: %u!\n", i + 1);
+      return 1;
+    }
+
+    // only the generated block's validation and connection is timed
+    uint64_t start_db_bytes_written = get_storage_put_bytes();
+    uint64_t start_time = get_monotonic_time_us();
+    int result = validate_and_insert_block(block);
+    results->connect_time_us += get_monotonic_time_us() - start_time;
+    results->db_bytes_written += get_storage_put_bytes() - start_db_bytes_written;
+    if (result)
+    {
+      fprintf(stderr, "Failed to validate and insert block: %u!\n", i + 1);
+      free_block(block);
+      return 1;
+    }
+
+    results->num_blocks++;
+    results->num_txs += block->transaction_count;
+    if (connect_block_to_bench_wallets(block))
+    {
+      free_block(block);
+      return 1;
+    }
+
+    free_block(block);
+  }
+
+  return 0;
+}
+
+static void run_balance_queries_bench(chain_bench_results_t *results)
+{
+  assert(results != NULL);
+  uint64_t total_balance = 0;
+  uint64_t start_time = get_monotonic_time_us();
+  for (uint32_t i = 0; i < g_chain_bench_balance_queries; i++)
+  {
+    wallet_t *sink_wallet = g_chain_bench_sink_wallets[i % CHAIN_BENCH_NUM_SINK_WALLETS];
+    total_balance += get_balance_for_address(sink_wallet->address);
+  }
+
+  results->balance_queries_time_us = get_monotonic_time_us() - start_time;
+  results->num_balance_queries = g_chain_bench_balance_queries;
+  if (total_balance == 0 && g_chain_bench_balance_queries > 0 && results->num_txs > results->num_blocks)
+  {
+    fprintf(stderr, "The balance queries unexpectedly found no unspent txs!\n");
+  }
+}
+
+static int run_rollback_bench(chain_bench_results_t *results)
+{
+  assert(results != NULL);
+  uint32_t current_block_height = get_block_height();
+  uint32_t num_rollback_blocks = MIN(g_chain_bench_rollback_blocks, current_block_height);
+  if (num_rollback_blocks == 0)
+  {
+    return 0;
+  }
+
+  uint64_t start_time = get_monotonic_time_us();
+  if (rollback_blockchain(current_block_height - num_rollback_blocks))
+  {
+    fprintf(stderr, "Failed to rollback the blockchain to height: %u!\n", current_block_height - num_rollback_blocks);
+    return 1;
+  }
+
+  results->rollback_time_us = get_monotonic_time_us() - start_time;
+  results->num_rollback_blocks = num_rollback_blocks;
+  return 0;
+}
+
+#ifndef _WIN32
+static task_result_t wait_for_sync_child(task_t *task, va_list args)
+{
+  assert(task != NULL);
+  if (g_chain_bench_sync_child_exited)
+  {
+    return TASK_RESULT_WAIT;
+  }
+
+  int status = 0;
+  pid_t pid = waitpid(g_chain_bench_sync_child_pid, &status, WNOHANG);
+  if (pid == 0)
+  {
+    return TASK_RESULT_WAIT;
+  }
+
+  g_chain_bench_sync_child_exited = 1;
+  g_chain_bench_sync_child_status = pid == g_chain_bench_sync_child_pid ? status : -1;
+  stop_net_run();
+  return TASK_RESULT_WAIT;
+}
+
+static int read_sync_time(const char *filename, double *sync_time)
+{
+  assert(filename != NULL);
+  assert(sync_time != NULL);
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL)
+  {
+    return 1;
+  }
+
+  int result = fscanf(file, "%lf", sync_time) == 1 ? 0 : 1;
+  fclose(file);
+  return result;
+}
+
+static int run_sync_bench(chain_bench_results_t *results)
+{
+  assert(results != NULL);
+  char sync_data_dir[CHAIN_BENCH_MAX_PATH_SIZE];
+  char sync_result_filename[CHAIN_BENCH_MAX_PATH_SIZE];
+  char height_str[16];
+  char port_str[8];
+  char timeout_str[16];
+  snprintf(sync_data_dir, CHAIN_BENCH_MAX_PATH_SIZE, "%s-sync", g_chain_bench_data_dir);
+  snprintf(sync_result_filename, CHAIN_BENCH_MAX_PATH_SIZE, "%s-sync.result", g_chain_bench_data_dir);
+  snprintf(height_str, sizeof(height_str), "%u", get_block_height());
+  snprintf(port_str, sizeof(port_str), "%hu", g_chain_bench_sync_port);
+  snprintf(timeout_str, sizeof(timeout_str), "%u", g_chain_bench_sync_timeout);
+  remove(sync_result_filename);
+
+  // the generated chain is served on loopback only, and no other peers are looked for
+  set_net_host_address("127.0.0.1");
+  set_net_host_port(g_chain_bench_sync_port);
+  set_net_disable_port_mapping(1);
+  set_net_target_outbound_peers(0);
+  if (init_p2p())
+  {
+    return 1;
+  }
+
+  connection_entries_t connection_entries;
+  connection_entries.num_entries = 0;
+  if (init_net(connection_entries))
+  {
+    deinit_p2p();
+    return 1;
+  }
+
+  char *child_argv[] = {
+    (char*)g_chain_bench_program_path,
+    "--data-dir", sync_data_dir,
+    "--height", height_str,
+    "--sync-peer-port", port_str,
+    "--sync-timeout", timeout_str,
+    "--sync-result", sync_result_filename,
+    NULL
+  };
+
+  g_chain_bench_sync_child_exited = 0;
+  if (posix_spawnp(&g_chain_bench_sync_child_pid, g_chain_bench_program_path, NULL, NULL, child_argv, environ) != 0)
+  {
+    fprintf(stderr, "Failed to start the syncing node: %s!\n", g_chain_bench_program_path);
+    deinit_p2p();
+    deinit_net();
+    return 1;
+  }
+
+  task_t *wait_task = add_task(wait_for_sync_child, CHAIN_BENCH_SYNC_CHECK_DELAY);
+  int result = net_run();
+  remove_task(wait_task);
+  if (deinit_p2p() || deinit_net())
+  {
+    return 1;
+  }
+
+  if (result || WIFEXITED(g_chain_bench_sync_child_status) == 0 || WEXITSTATUS(g_chain_bench_sync_child_status) != 0)
+  {
+    fprintf(stderr, "The syncing node failed to sync the generated chain!\n");
+    return 1;
+  }
+
+  if (read_sync_time(sync_result_filename, &results->sync_time))
+  {
+    fprintf(stderr, "Failed to read the sync result file: %s!\n", sync_result_filename);
+    return 1;
+  }
+
+  remove(sync_result_filename);
+  results->synced = 1;
+  return 0;
+}
+
+static task_result_t check_sync_progress(task_t *task, va_list args)
+{
+  assert(task != NULL);
+  if (get_block_height() >= g_chain_bench_height)
+  {
+    stop_net_run();
+    return TASK_RESULT_WAIT;
+  }
+
+  if (get_monotonic_time_ms() - g_chain_bench_sync_start_time > (uint64_t)g_chain_bench_sync_timeout * 1000)
+  {
+    g_chain_bench_sync_timed_out = 1;
+    stop_net_run();
+  }
+
+  return TASK_RESULT_WAIT;
+}
+
+static int run_sync_node(void)
+{
+  if (init_bench_node(g_chain_bench_data_dir))
+  {
+    return 1;
+  }
+
+  // a port other than the serving node's port is listened on, the
+  // serving node is connected to manually since it's a local address...
+  set_net_host_address("127.0.0.1");
+  set_net_host_port((uint32_t)g_chain_bench_sync_peer_port + 1);
+  set_net_disable_port_mapping(1);
+  set_net_target_outbound_peers(0);
+  if (init_p2p())
+  {
+    return 1;
+  }
+
+  connection_entries_t connection_entries;
+  connection_entries.num_entries = 1;
+  connection_entries.entries[0].address = strdup("127.0.0.1");
+  connection_entries.entries[0].port = g_chain_bench_sync_peer_port;
+
+  g_chain_bench_sync_start_time = get_monotonic_time_ms();
+  if (init_net(connection_entries))
+  {
+    return 1;
+  }
+
+  task_t *check_task = add_task(check_sync_progress, CHAIN_BENCH_SYNC_CHECK_DELAY);
+  int result = net_run();
+  double sync_time = (double)(get_monotonic_time_ms() - g_chain_bench_sync_start_time) / 1000.0;
+  remove_task(check_task);
+  if (deinit_p2p() || deinit_net())
+  {
+    return 1;
+  }
+
+  if (result || g_chain_bench_sync_timed_out)
+  {
+    fprintf(stderr, "Timed out syncing to height: %u, synced to height: %u!\n", g_chain_bench_height, get_block_height());
+    deinit_bench_node();
+    return 1;
+  }
+
+  if (deinit_bench_node())
+  {
+    return 1;
+  }
+
+  FILE *file = fopen(g_chain_bench_sync_result_filename, "wb");
+  if (file == NULL)
+  {
+    return 1;
+  }
+
+  fprintf(file, "%.6f\n", sync_time);
+  fclose(file);
+  remove_blockchain(g_chain_bench_data_dir);
+  return 0;
+}
+#endif
+
+static void print_bench_results(chain_bench_results_t *results)
+{
+  assert(results != NULL);
+  printf("Storage backend:     %s\n", get_storage_backend_str());
+  printf("Durability:          %s\n", get_blockchain_durability_str(get_blockchain_durability()));
+  printf("\n");
+  printf("Connect:             %u blocks, %llu txs in %.3f s\n", results->num_blocks,
+    (unsigned long long)results->num_txs, (double)results->connect_time_us / 1000000.0);
+  printf("                     %.1f blocks/s, %.1f txs/s\n", get_per_second(results->num_blocks, results->connect_time_us),
+    get_per_second(results->num_txs, results->connect_time_us));
+  printf("DB bytes written:    %llu (%.1f per block)\n", (unsigned long long)results->db_bytes_written,
+    results->num_blocks > 0 ? (double)results->db_bytes_written / (double)results->num_blocks : 0.0);
+  printf("Balance queries:     %u in %.3f s, %.1f queries/s\n", results->num_balance_queries,
+    (double)results->balance_queries_time_us / 1000000.0, get_per_second(results->num_balance_queries, results->balance_queries_time_us));
+  if (results->synced)
+  {
+    printf("Sync:                %u blocks in %.3f s, %.1f blocks/s, %.1f txs/s\n", results->num_blocks, results->sync_time,
+      results->sync_time > 0 ? (double)results->num_blocks / results->sync_time : 0.0,
+      results->sync_time > 0 ? (double)results->num_txs / results->sync_time : 0.0);
+  }
+
+  printf("Rollback:            %u blocks in %.3f s, %.1f blocks/s\n", results->num_rollback_blocks,
+    (double)results->rollback_time_us / 1000000.0, get_per_second(results->num_rollback_blocks, results->rollback_time_us));
+  printf("Peak RSS:            %.1f MiB\n", (double)results->peak_rss_bytes / (1024.0 * 1024.0));
+}
+
+static int write_bench_results(const char *filename, chain_bench_results_t *results)
+{
+  assert(filename != NULL);
+  assert(results != NULL);
+  buffer_t *buffer = buffer_init();
+  json_write_format(buffer, "{\"storage_backend\":");
+  json_write_string(buffer, get_storage_backend_str(), strlen(get_storage_backend_str()));
+  json_write_format(buffer, ",\"blocks\":%u,\"txs\":%llu,\"connect_seconds\":%.6f,\"blocks_per_second\":%.3f,\"txs_per_second\":%.3f,",
+    results->num_blocks, (unsigned long long)results->num_txs, (double)results->connect_time_us / 1000000.0,
+    get_per_second(results->num_blocks, results->connect_time_us), get_per_second(results->num_txs, results->connect_time_us));
+  json_write_format(buffer, "\"db_bytes_written\":%llu,\"balance_queries\":%u,\"balance_queries_per_second\":%.3f,",
+    (unsigned long long)results->db_bytes_written, results->num_balance_queries,
+    get_per_second(results->num_balance_queries, results->balance_queries_time_us));
+  if (results->synced)
+  {
+    json_write_format(buffer, "\"sync_seconds\":%.6f,", results->sync_time);
+  }
+
+  json_write_format(buffer, "\"rollback_blocks\":%u,\"rollback_blocks_per_second\":%.3f,\"peak_rss_bytes\":%llu}\n",
+    results->num_rollback_blocks, get_per_second(results->num_rollback_blocks, results->rollback_time_us),
+    (unsigned long long)results->peak_rss_bytes);
+
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Failed to open bench results file: %s!\n", filename);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  size_t size = buffer_get_size(buffer);
+  int failed = fwrite(buffer_get_data(buffer), 1, size, file) != size;
+  fclose(file);
+  buffer_free(buffer);
+  if (failed)
+  {
+    fprintf(stderr, "Failed to write bench results file: %s!\n", filename);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int run_chain_bench(void)
+{
+  chain_bench_results_t results;
+  memset(&results, 0, sizeof(chain_bench_results_t));
+
+  if (init_bench_node(g_chain_bench_data_dir))
+  {
+    return 1;
+  }
+
+  init_bench_wallets();
+  int result = run_connect_bench(&results);
+  if (result == 0)
+  {
+    run_balance_queries_bench(&results);
+  }
+
+  if (result == 0 && g_chain_bench_sync)
+  {
+  #ifdef _WIN32
+    fprintf(stderr, "Syncing the generated chain is not supported on this platform!\n");
+  #else
+    result = run_sync_bench(&results);
+  #endif
+  }
+
+  if (result == 0)
+  {
+    result = run_rollback_bench(&results);
+  }
+
+  results.peak_rss_bytes = get_peak_rss_bytes();
+  free_bench_wallets();
+  if (deinit_bench_node())
+  {
+    return 1;
+  }
+
+  if (result)
+  {
+    return 1;
+  }
+
+  print_bench_results(&results);
+  if (g_chain_bench_json_filename != NULL)
+  {
+    return write_bench_results(g_chain_bench_json_filename, &results);
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  g_chain_bench_program_path = argv[0];
+  if (parse_commandline_args(argc, argv))
+  {
+    return 1;
+  }
+
+  if (sodium_init() == -1)
+  {
+    return 1;
+  }
+
+  if (init_pow())
+  {
+    return 1;
+  }
+
+  int result = 0;
+  if (g_chain_bench_sync_peer_port > 0)
+  {
+  #ifdef _WIN32
+    result = 1;
+  #else
+    result = g_chain_bench_sync_result_filename != NULL ? run_sync_node() : 1;
+  #endif
+  }
+  else
+  {
+    result = run_chain_bench();
+  }
+
+  if (deinit_pow())
+  {
+    return 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <sodium.h>
+
+#include "common/buffer_iterator.h"
+#include "common/buffer.h"
+
+#include "bench.h"
+
+#define BUFFER_BENCH_DATA_SIZE (1024 * 64)
+#define BUFFER_BENCH_BYTES_SIZE 32
+
+static void bench_buffer_read_uint32(bench_state_t *state, void *arg)
+{
+  buffer_iterator_t *buffer_iterator = (buffer_iterator_t*)arg;
+  buffer_iterator_set_offset(buffer_iterator, 0);
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    if (buffer_get_remaining_size(buffer_iterator) < sizeof(uint32_t))
+    {
+      buffer_iterator_set_offset(buffer_iterator, 0);
+    }
+
+    uint32_t value = 0;
+    buffer_read_uint32(buffer_iterator, &value);
+    BENCH_DO_NOT_OPTIMIZE(value);
+  }
+}
+
+static void bench_buffer_read_uint64(bench_state_t *state, void *arg)
+{
+  buffer_iterator_t *buffer_iterator = (buffer_iterator_t*)arg;
+  buffer_iterator_set_offset(buffer_iterator, 0);
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    if (buffer_get_remaining_size(buffer_iterator) < sizeof(uint64_t))
+    {
+      buffer_iterator_set_offset(buffer_iterator, 0);
+    }
+
+    uint64_t value = 0;
+    buffer_read_uint64(buffer_iterator, &value);
+    BENCH_DO_NOT_OPTIMIZE(value);
+  }
+}
+
+static void bench_buffer_read_bytes(bench_state_t *state, void *arg)
+{
+  buffer_iterator_t *buffer_iterator = (buffer_iterator_t*)arg;
+  buffer_iterator_set_offset(buffer_iterator, 0);
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    if (buffer_get_remaining_size(buffer_iterator) < BUFFER_BENCH_BYTES_SIZE)
+    {
+      buffer_iterator_set_offset(buffer_iterator, 0);
+    }
+
+    uint8_t *bytes = NULL;
+    buffer_read(buffer_iterator, BUFFER_BENCH_BYTES_SIZE, &bytes);
+    BENCH_DO_NOT_OPTIMIZE(bytes);
+    free(bytes);
+  }
+}
+
+void run_common_benchmarks(void)
+{
+  uint8_t *data = malloc(BUFFER_BENCH_DATA_SIZE);
+  assert(data != NULL);
+  randombytes_buf(data, BUFFER_BENCH_DATA_SIZE);
+
+  buffer_t *buffer = buffer_init_data(0, data, BUFFER_BENCH_DATA_SIZE);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  free(data);
+
+  run_benchmark("buffer_read_uint32", bench_buffer_read_uint32, buffer_iterator);
+  run_benchmark("buffer_read_uint64", bench_buffer_read_uint64, buffer_iterator);
+  run_benchmark("buffer_read/32", bench_buffer_read_bytes, buffer_iterator);
+
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+}
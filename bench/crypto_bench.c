@@ -0,0 +1,98 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <sodium.h>
+
+#include "core/transaction.h"
+
+#include "crypto/sha256d.h"
+
+#include "bench.h"
+
+static const size_t g_sha256d_bench_input_sizes[] = {32, 80, 1024, 65536};
+static const uint32_t g_signature_bench_txin_counts[] = {1, 16};
+
+#define NUM_SHA256D_BENCH_INPUT_SIZES (sizeof(g_sha256d_bench_input_sizes) / sizeof(size_t))
+#define NUM_SIGNATURE_BENCH_TXIN_COUNTS (sizeof(g_signature_bench_txin_counts) / sizeof(uint32_t))
+
+typedef struct Sha256dBenchArg
+{
+  uint8_t *data;
+  size_t size;
+} sha256d_bench_arg_t;
+
+static void bench_crypto_hash_sha256d(bench_state_t *state, void *arg)
+{
+  sha256d_bench_arg_t *bench_arg = (sha256d_bench_arg_t*)arg;
+  uint8_t hash[crypto_hash_sha256_BYTES];
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    crypto_hash_sha256d(hash, bench_arg->data, bench_arg->size);
+    BENCH_DO_NOT_OPTIMIZE(hash);
+  }
+}
+
+static void bench_validate_tx_signatures(bench_state_t *state, void *arg)
+{
+  transaction_t *tx = (transaction_t*)arg;
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    int r = validate_tx_signatures(tx);
+    assert(r == 0);
+    BENCH_DO_NOT_OPTIMIZE(r);
+  }
+}
+
+void run_crypto_benchmarks(void)
+{
+  char name[BENCH_MAX_NAME_SIZE];
+  for (uint32_t i = 0; i < NUM_SHA256D_BENCH_INPUT_SIZES; i++)
+  {
+    sha256d_bench_arg_t bench_arg;
+    bench_arg.size = g_sha256d_bench_input_sizes[i];
+    bench_arg.data = malloc(bench_arg.size);
+    assert(bench_arg.data != NULL);
+    randombytes_buf(bench_arg.data, bench_arg.size);
+
+    snprintf(name, sizeof(name), "crypto_hash_sha256d/%zu", bench_arg.size);
+    run_benchmark(name, bench_crypto_hash_sha256d, &bench_arg);
+    free(bench_arg.data);
+  }
+
+  for (uint32_t i = 0; i < NUM_SIGNATURE_BENCH_TXIN_COUNTS; i++)
+  {
+    uint32_t num_txins = g_signature_bench_txin_counts[i];
+    transaction_t *tx = make_bench_tx(num_txins, 2);
+
+    snprintf(name, sizeof(name), "validate_tx_signatures/%u", num_txins);
+    run_benchmark(name, bench_validate_tx_signatures, tx);
+    free_transaction(tx);
+  }
+}
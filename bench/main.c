@@ -0,0 +1,169 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <sodium.h>
+
+#include "common/argparse.h"
+#include "common/task.h"
+
+#include "core/mempool.h"
+
+#include "bench.h"
+
+enum
+{
+  CMD_ARG_HELP = 0,
+  CMD_ARG_FILTER,
+  CMD_ARG_JSON,
+  CMD_ARG_MIN_SAMPLE_TIME,
+  CMD_ARG_NUM_SAMPLES
+};
+
+static const argument_map_t g_arguments_map[] = {
+  {"help", CMD_ARG_HELP, "Shows the help information", "", 0},
+  {"filter", CMD_ARG_FILTER, "Only runs the benchmarks whose name contains the filter", "<filter>", 1},
+  {"json", CMD_ARG_JSON, "Writes the benchmark results as json to a file", "<filename>", 1},
+  {"min-sample-time", CMD_ARG_MIN_SAMPLE_TIME, "Sets the minimum number of milliseconds each benchmark sample runs for", "<milliseconds>", 1},
+  {"num-samples", CMD_ARG_NUM_SAMPLES, "Sets the number of samples taken of each benchmark, the median sample is reported", "<num_samples>", 1}
+};
+
+#define NUM_ARGUMENTS (sizeof(g_arguments_map) / sizeof(argument_map_t))
+
+static int parse_commandline_args(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    int16_t arg_type = argparse_get_argument_with_prefix_from_str((argument_map_t*)&g_arguments_map, NUM_ARGUMENTS, argv[i]);
+    argument_map_t *argument_map = argparse_get_argument_map_from_type((argument_map_t*)&g_arguments_map, NUM_ARGUMENTS, arg_type);
+    if (argument_map == NULL)
+    {
+      fprintf(stderr, "Unknown command line argument: %s\n", argv[i]);
+      return 1;
+    }
+
+    int num_args = (argc - 1) - i;
+    if (num_args < argument_map->num_args)
+    {
+      fprintf(stderr, "Usage: -%s, --%s: %s\n", argument_map->name, argument_map->name, argument_map->usage);
+      return 1;
+    }
+
+    switch (arg_type)
+    {
+      case CMD_ARG_HELP:
+        printf("Usage:\n");
+        printf("  vulkan_bench [command-line options]\n");
+        printf("\n");
+        printf("Command-line Options:\n");
+        for (int i = 0; i < NUM_ARGUMENTS; i++)
+        {
+          argument_map_t *argument_map = (argument_map_t*)&g_arguments_map[i];
+          printf("  -%s, --%s: %s\n", argument_map->name, argument_map->name, argument_map->help);
+        }
+
+        printf("\n");
+        return 1;
+      case CMD_ARG_FILTER:
+        i++;
+        set_bench_filter((const char*)argv[i]);
+        break;
+      case CMD_ARG_JSON:
+        i++;
+        set_bench_json_filename((const char*)argv[i]);
+        break;
+      case CMD_ARG_MIN_SAMPLE_TIME:
+        i++;
+        uint64_t min_sample_time_ms = (uint64_t)atol(argv[i]);
+        set_bench_min_sample_time_ms(min_sample_time_ms);
+        break;
+      case CMD_ARG_NUM_SAMPLES:
+        i++;
+        uint32_t num_samples = (uint32_t)atoi(argv[i]);
+        if (num_samples == 0 || num_samples > BENCH_MAX_NUM_SAMPLES)
+        {
+          fprintf(stderr, "The number of samples must be between 1 and %u!\n", BENCH_MAX_NUM_SAMPLES);
+          return 1;
+        }
+
+        set_bench_num_samples(num_samples);
+        break;
+      default:
+        fprintf(stderr, "Unknown command line argument: %s\n", argv[i]);
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (parse_commandline_args(argc, argv))
+  {
+    return 1;
+  }
+
+  if (sodium_init() == -1)
+  {
+    return 1;
+  }
+
+  if (taskmgr_init())
+  {
+    return 1;
+  }
+
+  if (start_mempool())
+  {
+    return 1;
+  }
+
+  // Utilities:
+  run_common_benchmarks();
+  run_crypto_benchmarks();
+
+  // Blocks:
+  run_block_benchmarks();
+
+  // Transactions:
+  run_mempool_benchmarks();
+
+  int result = finish_benchmarks();
+  if (stop_mempool())
+  {
+    return 1;
+  }
+
+  if (taskmgr_shutdown())
+  {
+    return 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,155 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include "core/mempool.h"
+#include "core/transaction.h"
+
+#include "bench.h"
+
+// the txs have no txins so their fees are computed without reading the utxo set,
+// the benchmarks measure the mempool's index and not the blockchain database...
+static const uint32_t g_mempool_bench_num_resident_txs[] = {1000, 50000};
+
+#define NUM_MEMPOOL_BENCH_SIZES (sizeof(g_mempool_bench_num_resident_txs) / sizeof(uint32_t))
+#define MEMPOOL_BENCH_NUM_BATCH_TXS 1024
+
+typedef struct MempoolBenchArg
+{
+  transaction_t **resident_txs;
+  uint32_t num_resident_txs;
+  transaction_t *batch_txs[MEMPOOL_BENCH_NUM_BATCH_TXS];
+} mempool_bench_arg_t;
+
+static void add_bench_txs_to_mempool(transaction_t **txs, uint32_t num_txs)
+{
+  for (uint32_t i = 0; i < num_txs; i++)
+  {
+    int r = add_tx_to_mempool(txs[i]);
+    assert(r == 0);
+  }
+}
+
+static void remove_bench_txs_from_mempool(transaction_t **txs, uint32_t num_txs)
+{
+  for (uint32_t i = 0; i < num_txs; i++)
+  {
+    int r = remove_tx_from_mempool(txs[i]);
+    assert(r == 0);
+  }
+}
+
+static void bench_mempool_add(bench_state_t *state, void *arg)
+{
+  mempool_bench_arg_t *bench_arg = (mempool_bench_arg_t*)arg;
+  uint64_t num_iterations = state->num_iterations;
+  while (num_iterations > 0)
+  {
+    uint32_t num_txs = num_iterations < MEMPOOL_BENCH_NUM_BATCH_TXS ? (uint32_t)num_iterations : MEMPOOL_BENCH_NUM_BATCH_TXS;
+    add_bench_txs_to_mempool(bench_arg->batch_txs, num_txs);
+
+    bench_stop_timer(state);
+    remove_bench_txs_from_mempool(bench_arg->batch_txs, num_txs);
+    bench_start_timer(state);
+    num_iterations -= num_txs;
+  }
+}
+
+static void bench_mempool_lookup(bench_state_t *state, void *arg)
+{
+  mempool_bench_arg_t *bench_arg = (mempool_bench_arg_t*)arg;
+  for (uint64_t i = 0; i < state->num_iterations; i++)
+  {
+    transaction_t *tx = bench_arg->resident_txs[i % bench_arg->num_resident_txs];
+    transaction_t *mempool_tx = get_tx_from_mempool(tx->id);
+    assert(mempool_tx == tx);
+    BENCH_DO_NOT_OPTIMIZE(mempool_tx);
+  }
+}
+
+static void bench_mempool_remove(bench_state_t *state, void *arg)
+{
+  mempool_bench_arg_t *bench_arg = (mempool_bench_arg_t*)arg;
+  uint64_t num_iterations = state->num_iterations;
+  while (num_iterations > 0)
+  {
+    uint32_t num_txs = num_iterations < MEMPOOL_BENCH_NUM_BATCH_TXS ? (uint32_t)num_iterations : MEMPOOL_BENCH_NUM_BATCH_TXS;
+    bench_stop_timer(state);
+    add_bench_txs_to_mempool(bench_arg->batch_txs, num_txs);
+    bench_start_timer(state);
+
+    remove_bench_txs_from_mempool(bench_arg->batch_txs, num_txs);
+    num_iterations -= num_txs;
+  }
+}
+
+void run_mempool_benchmarks(void)
+{
+  mempool_bench_arg_t bench_arg;
+  for (uint32_t i = 0; i < MEMPOOL_BENCH_NUM_BATCH_TXS; i++)
+  {
+    bench_arg.batch_txs[i] = make_bench_tx(0, 1);
+  }
+
+  char name[BENCH_MAX_NAME_SIZE];
+  for (uint32_t i = 0; i < NUM_MEMPOOL_BENCH_SIZES; i++)
+  {
+    bench_arg.num_resident_txs = g_mempool_bench_num_resident_txs[i];
+    bench_arg.resident_txs = malloc(sizeof(transaction_t*) * bench_arg.num_resident_txs);
+    assert(bench_arg.resident_txs != NULL);
+    for (uint32_t j = 0; j < bench_arg.num_resident_txs; j++)
+    {
+      bench_arg.resident_txs[j] = make_bench_tx(0, 1);
+    }
+
+    add_bench_txs_to_mempool(bench_arg.resident_txs, bench_arg.num_resident_txs);
+
+    snprintf(name, sizeof(name), "mempool_add/%u", bench_arg.num_resident_txs);
+    run_benchmark(name, bench_mempool_add, &bench_arg);
+
+    snprintf(name, sizeof(name), "mempool_lookup/%u", bench_arg.num_resident_txs);
+    run_benchmark(name, bench_mempool_lookup, &bench_arg);
+
+    snprintf(name, sizeof(name), "mempool_remove/%u", bench_arg.num_resident_txs);
+    run_benchmark(name, bench_mempool_remove, &bench_arg);
+
+    remove_bench_txs_from_mempool(bench_arg.resident_txs, bench_arg.num_resident_txs);
+    for (uint32_t j = 0; j < bench_arg.num_resident_txs; j++)
+    {
+      free_transaction(bench_arg.resident_txs[j]);
+    }
+
+    free(bench_arg.resident_txs);
+  }
+
+  for (uint32_t i = 0; i < MEMPOOL_BENCH_NUM_BATCH_TXS; i++)
+  {
+    free_transaction(bench_arg.batch_txs[i]);
+  }
+}
@@ -0,0 +1,1531 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <sodium.h>
+
+#include "common/argparse.h"
+#include "common/buffer.h"
+#include "common/buffer_iterator.h"
+#include "common/json.h"
+#include "common/tinycthread.h"
+#include "common/util.h"
+
+#include "core/net.h"
+#include "core/parameters.h"
+#include "core/protocol.h"
+#include "core/transaction.h"
+
+/*
+ * The net load generator opens many peer connections to a running node and replays a
+ * weighted mix of requests on them, every packet is framed the same way the node frames
+ * it's own packets. Each connection establishes itself as a peer and then keeps a single
+ * request in flight at a time, the latency of a request is the time until the node's
+ * response to it arrives. Txs and fuzzed packets are never answered, the next request
+ * on the connection is sent as soon as they have been written to the socket...
+ *
+ * Fuzzed packets are copies of valid packets with a few of their payload bytes flipped,
+ * the headers are left intact so the node keeps reading the connection's packets.
+ */
+#define NET_LOAD_DEFAULT_ADDRESS "127.0.0.1"
+#define NET_LOAD_DEFAULT_NUM_CONNECTIONS 1000
+#define NET_LOAD_DEFAULT_NUM_THREADS 4
+#define NET_LOAD_DEFAULT_DURATION 30
+#define NET_LOAD_DEFAULT_CONNECT_RATE 500
+#define NET_LOAD_DEFAULT_REQUEST_TIMEOUT_MS 5000
+#define NET_LOAD_DEFAULT_BASE_HOST_PORT 20000
+
+#define NET_LOAD_MAX_NUM_THREADS 64
+#define NET_LOAD_POLL_DELAY_MS 10
+#define NET_LOAD_RECONNECT_DELAY_US 1000000
+#define NET_LOAD_RECV_BUFFER_SIZE (64 * 1024)
+#define NET_LOAD_PAYLOAD_PREFIX_SIZE 8
+#define NET_LOAD_NUM_TX_FRAMES 64
+#define NET_LOAD_MAX_FUZZED_BYTES 4
+
+typedef enum NetLoadTrafficType
+{
+  NET_LOAD_TRAFFIC_PING = 0,
+  NET_LOAD_TRAFFIC_BLOCK_HEIGHT,
+  NET_LOAD_TRAFFIC_BLOCK_BY_HEIGHT,
+  NET_LOAD_TRAFFIC_BLOCK_HEADERS,
+  NET_LOAD_TRAFFIC_MEMPOOL_TX,
+  NET_LOAD_TRAFFIC_FUZZ,
+  NET_LOAD_NUM_TRAFFIC_TYPES
+} net_load_traffic_type_t;
+
+static const char *g_net_load_traffic_names[NET_LOAD_NUM_TRAFFIC_TYPES] = {
+  "ping",
+  "block_height",
+  "block_by_height",
+  "block_headers",
+  "mempool_tx",
+  "fuzz"
+};
+
+typedef enum NetLoadConnectionState
+{
+  NET_LOAD_CONNECTION_CLOSED = 0,
+  NET_LOAD_CONNECTION_CONNECTING,
+  NET_LOAD_CONNECTION_ESTABLISHING,
+  NET_LOAD_CONNECTION_RUNNING
+} net_load_connection_state_t;
+
+typedef struct NetLoadFrame
+{
+  uint8_t *data;
+  size_t size;
+} net_load_frame_t;
+
+typedef struct NetLoadLatencies
+{
+  uint32_t *samples;
+  size_t num_samples;
+  size_t capacity;
+} net_load_latencies_t;
+
+typedef struct NetLoadStats
+{
+  uint64_t num_sent[NET_LOAD_NUM_TRAFFIC_TYPES];
+  uint64_t num_responses[NET_LOAD_NUM_TRAFFIC_TYPES];
+  uint64_t num_timeouts[NET_LOAD_NUM_TRAFFIC_TYPES];
+  net_load_latencies_t latencies[NET_LOAD_NUM_TRAFFIC_TYPES];
+  net_load_latencies_t handshake_latencies;
+
+  uint64_t num_connects;
+  uint64_t num_connect_failures;
+  uint64_t num_disconnects;
+  uint64_t num_unsolicited_packets;
+
+  uint64_t num_packets_sent;
+  uint64_t num_packets_received;
+  uint64_t num_bytes_sent;
+  uint64_t num_bytes_received;
+} net_load_stats_t;
+
+typedef struct NetLoadConnection
+{
+  int fd;
+  net_load_connection_state_t state;
+  uint16_t host_port;
+  uint64_t state_ts;
+
+  // the frames queued to be written, they are written in the order they were queued
+  uint8_t *send_data;
+  size_t send_size;
+  size_t send_offset;
+  size_t send_capacity;
+
+  // the packet currently being read, only the start of it's payload is kept
+  uint8_t header[PACKET_HEADER_SIZE];
+  size_t header_size;
+  uint32_t packet_id;
+  uint32_t packet_size;
+  uint32_t payload_offset;
+  uint8_t payload_prefix[NET_LOAD_PAYLOAD_PREFIX_SIZE];
+
+  int request_pending;
+  net_load_traffic_type_t request_type;
+  uint32_t expected_packet_id;
+  uint64_t request_ts;
+} net_load_connection_t;
+
+typedef struct NetLoadThread
+{
+  thrd_t thread;
+  uint32_t index;
+  uint32_t num_connections;
+  uint32_t num_opened_connections;
+  net_load_connection_t *connections;
+  struct pollfd *poll_fds;
+  uint32_t *poll_connections;
+  uint8_t *recv_buffer;
+  net_load_stats_t stats;
+} net_load_thread_t;
+
+enum
+{
+  CMD_ARG_HELP = 0,
+  CMD_ARG_ADDRESS,
+  CMD_ARG_PORT,
+  CMD_ARG_TESTNET,
+  CMD_ARG_CONNECTIONS,
+  CMD_ARG_THREADS,
+  CMD_ARG_DURATION,
+  CMD_ARG_CONNECT_RATE,
+  CMD_ARG_MIX,
+  CMD_ARG_REQUEST_TIMEOUT,
+  CMD_ARG_BASE_HOST_PORT,
+  CMD_ARG_SERVER_PID,
+  CMD_ARG_JSON
+};
+
+static const argument_map_t g_arguments_map[] = {
+  {"help", CMD_ARG_HELP, "Shows the help information", "", 0},
+  {"address", CMD_ARG_ADDRESS, "Sets the address of the node the load is generated against", "<address>", 1},
+  {"port", CMD_ARG_PORT, "Sets the p2p port of the node, defaults to the network's p2p port", "<port>", 1},
+  {"testnet", CMD_ARG_TESTNET, "Connects to the node as a Testnet peer", "", 0},
+  {"connections", CMD_ARG_CONNECTIONS, "Sets the number of connections kept open to the node", "<num_connections>", 1},
+  {"threads", CMD_ARG_THREADS, "Sets the number of threads the connections are spread across", "<num_threads>", 1},
+  {"duration", CMD_ARG_DURATION, "Sets the number of seconds the load is generated for", "<seconds>", 1},
+  {"connect-rate", CMD_ARG_CONNECT_RATE, "Sets the number of connections opened per second while ramping up", "<connections_per_second>", 1},
+  {"mix", CMD_ARG_MIX, "Sets the weights of the traffic mix, e.g. ping=40,block_height=10,block_by_height=20,block_headers=10,mempool_tx=20,fuzz=0", "<mix>", 1},
+  {"request-timeout", CMD_ARG_REQUEST_TIMEOUT, "Sets the number of milliseconds a request waits for it's response", "<milliseconds>", 1},
+  {"base-host-port", CMD_ARG_BASE_HOST_PORT, "Sets the first of the host ports the connections advertise, each connection advertises it's own", "<port>", 1},
+  {"server-pid", CMD_ARG_SERVER_PID, "Measures the cpu time used by the node with the process id, linux only", "<pid>", 1},
+  {"json", CMD_ARG_JSON, "Writes the results as json to a file", "<filename>", 1}
+};
+
+#define NUM_ARGUMENTS (sizeof(g_arguments_map) / sizeof(argument_map_t))
+
+static const char *g_net_load_address = NET_LOAD_DEFAULT_ADDRESS;
+static uint16_t g_net_load_port = 0;
+static uint32_t g_net_load_num_connections = NET_LOAD_DEFAULT_NUM_CONNECTIONS;
+static uint32_t g_net_load_num_threads = NET_LOAD_DEFAULT_NUM_THREADS;
+static uint32_t g_net_load_duration = NET_LOAD_DEFAULT_DURATION;
+static uint32_t g_net_load_connect_rate = NET_LOAD_DEFAULT_CONNECT_RATE;
+static uint32_t g_net_load_request_timeout_ms = NET_LOAD_DEFAULT_REQUEST_TIMEOUT_MS;
+static uint16_t g_net_load_base_host_port = NET_LOAD_DEFAULT_BASE_HOST_PORT;
+static int g_net_load_server_pid = 0;
+static const char *g_net_load_json_filename = NULL;
+
+static uint32_t g_net_load_traffic_weights[NET_LOAD_NUM_TRAFFIC_TYPES] = {40, 10, 20, 10, 20, 0};
+static uint32_t g_net_load_total_traffic_weight = 100;
+
+static struct sockaddr_in g_net_load_server_addr;
+static net_load_frame_t g_net_load_tx_frames[NET_LOAD_NUM_TX_FRAMES];
+
+static atomic_int g_net_load_running = 0;
+static atomic_uint g_net_load_server_height = 0;
+static atomic_uint g_net_load_next_host_port = 0;
+static atomic_uint g_net_load_num_established = 0;
+static uint64_t g_net_load_start_time = 0;
+
+static int parse_traffic_mix(const char *mix_str)
+{
+  assert(mix_str != NULL);
+  uint32_t traffic_weights[NET_LOAD_NUM_TRAFFIC_TYPES] = {0};
+  char *mix = strdup(mix_str);
+  assert(mix != NULL);
+
+  char *save_ptr = NULL;
+  for (char *entry = strtok_r(mix, ",", &save_ptr); entry != NULL; entry = strtok_r(NULL, ",", &save_ptr))
+  {
+    char *separator = strchr(entry, '=');
+    int found = 0;
+    if (separator != NULL)
+    {
+      *separator = '\0';
+      for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+      {
+        if (strcmp(entry, g_net_load_traffic_names[i]) == 0)
+        {
+          traffic_weights[i] = (uint32_t)atoi(separator + 1);
+          found = 1;
+          break;
+        }
+      }
+    }
+
+    if (found == 0)
+    {
+      fprintf(stderr, "Unknown traffic mix entry: %s!\n", entry);
+      free(mix);
+      return 1;
+    }
+  }
+
+  free(mix);
+  uint32_t total_traffic_weight = 0;
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    total_traffic_weight += traffic_weights[i];
+  }
+
+  if (total_traffic_weight == 0)
+  {
+    fprintf(stderr, "The traffic mix must have at least one weight greater than 0!\n");
+    return 1;
+  }
+
+  memcpy(g_net_load_traffic_weights, traffic_weights, sizeof(traffic_weights));
+  g_net_load_total_traffic_weight = total_traffic_weight;
+  return 0;
+}
+
+static int parse_commandline_args(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    int16_t arg_type = argparse_get_argument_with_prefix_from_str((argument_map_t*)&g_arguments_map, NUM_ARGUMENTS, argv[i]);
+    argument_map_t *argument_map = argparse_get_argument_map_from_type((argument_map_t*)&g_arguments_map, NUM_ARGUMENTS, arg_type);
+    if (argument_map == NULL)
+    {
+      fprintf(stderr, "Unknown command line argument: %s\n", argv[i]);
+      return 1;
+    }
+
+    int num_args = (argc - 1) - i;
+    if (num_args < argument_map->num_args)
+    {
+      fprintf(stderr, "Usage: -%s, --%s: %s\n", argument_map->name, argument_map->name, argument_map->usage);
+      return 1;
+    }
+
+    switch (arg_type)
+    {
+      case CMD_ARG_HELP:
+        printf("Usage:\n");
+        printf("  vulkan_net_load [command-line options]\n");
+        printf("\n");
+        printf("Command-line Options:\n");
+        for (int i = 0; i < NUM_ARGUMENTS; i++)
+        {
+          argument_map_t *argument_map = (argument_map_t*)&g_arguments_map[i];
+          printf("  -%s, --%s: %s\n", argument_map->name, argument_map->name, argument_map->help);
+        }
+
+        printf("\n");
+        return 1;
+      case CMD_ARG_ADDRESS:
+        i++;
+        g_net_load_address = (const char*)argv[i];
+        break;
+      case CMD_ARG_PORT:
+        i++;
+        g_net_load_port = (uint16_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_TESTNET:
+        parameters_set_use_testnet(1);
+        break;
+      case CMD_ARG_CONNECTIONS:
+        i++;
+        g_net_load_num_connections = (uint32_t)atoi(argv[i]);
+        if (g_net_load_num_connections == 0)
+        {
+          fprintf(stderr, "The number of connections must be greater than 0!\n");
+          return 1;
+        }
+
+        break;
+      case CMD_ARG_THREADS:
+        i++;
+        g_net_load_num_threads = (uint32_t)atoi(argv[i]);
+        if (g_net_load_num_threads == 0 || g_net_load_num_threads > NET_LOAD_MAX_NUM_THREADS)
+        {
+          fprintf(stderr, "The number of threads must be between 1 and %u!\n", NET_LOAD_MAX_NUM_THREADS);
+          return 1;
+        }
+
+        break;
+      case CMD_ARG_DURATION:
+        i++;
+        g_net_load_duration = (uint32_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_CONNECT_RATE:
+        i++;
+        g_net_load_connect_rate = (uint32_t)atoi(argv[i]);
+        if (g_net_load_connect_rate == 0)
+        {
+          fprintf(stderr, "The connect rate must be greater than 0!\n");
+          return 1;
+        }
+
+        break;
+      case CMD_ARG_MIX:
+        i++;
+        if (parse_traffic_mix((const char*)argv[i]))
+        {
+          return 1;
+        }
+
+        break;
+      case CMD_ARG_REQUEST_TIMEOUT:
+        i++;
+        g_net_load_request_timeout_ms = (uint32_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_BASE_HOST_PORT:
+        i++;
+        g_net_load_base_host_port = (uint16_t)atoi(argv[i]);
+        break;
+      case CMD_ARG_SERVER_PID:
+        i++;
+        g_net_load_server_pid = atoi(argv[i]);
+        break;
+      case CMD_ARG_JSON:
+        i++;
+        g_net_load_json_filename = (const char*)argv[i];
+        break;
+      default:
+        fprintf(stderr, "Unknown command line argument: %s\n", argv[i]);
+        return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int add_latency_sample(net_load_latencies_t *latencies, uint64_t latency_us)
+{
+  assert(latencies != NULL);
+  if (latencies->num_samples == latencies->capacity)
+  {
+    size_t capacity = latencies->capacity > 0 ? latencies->capacity * 2 : 1024;
+    uint32_t *samples = realloc(latencies->samples, sizeof(uint32_t) * capacity);
+    if (samples == NULL)
+    {
+      return 1;
+    }
+
+    latencies->samples = samples;
+    latencies->capacity = capacity;
+  }
+
+  latencies->samples[latencies->num_samples++] = (uint32_t)MIN(latency_us, (uint64_t)UINT32_MAX);
+  return 0;
+}
+
+static int merge_latencies(net_load_latencies_t *latencies, net_load_latencies_t *other_latencies)
+{
+  assert(latencies != NULL);
+  assert(other_latencies != NULL);
+  for (size_t i = 0; i < other_latencies->num_samples; i++)
+  {
+    if (add_latency_sample(latencies, other_latencies->samples[i]))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void free_latencies(net_load_latencies_t *latencies)
+{
+  assert(latencies != NULL);
+  free(latencies->samples);
+  latencies->samples = NULL;
+  latencies->num_samples = 0;
+  latencies->capacity = 0;
+}
+
+static int compare_latency_samples(const void *a, const void *b)
+{
+  uint32_t sample_a = *(const uint32_t*)a;
+  uint32_t sample_b = *(const uint32_t*)b;
+  return (sample_a > sample_b) - (sample_a < sample_b);
+}
+
+static double get_latency_percentile_ms(net_load_latencies_t *latencies, double percentile)
+{
+  assert(latencies != NULL);
+  if (latencies->num_samples == 0)
+  {
+    return 0.0;
+  }
+
+  // the samples have been sorted, the percentile is the nearest ranked sample
+  size_t rank = (size_t)((percentile / 100.0) * (double)latencies->num_samples + 0.999999);
+  size_t index = rank > 0 ? MIN(rank - 1, latencies->num_samples - 1) : 0;
+  return (double)latencies->samples[index] / 1000.0;
+}
+
+static net_load_frame_t make_load_frame(uint32_t packet_id, ...)
+{
+  net_load_frame_t frame = {NULL, 0};
+  packet_t *packet = NULL;
+
+  va_list args;
+  va_start(args, packet_id);
+  int result = serialize_message(&packet, packet_id, args);
+  va_end(args);
+  if (result)
+  {
+    return frame;
+  }
+
+  assert(packet != NULL);
+  buffer_t *buffer = buffer_init();
+  if (serialize_packet(buffer, packet) == 0)
+  {
+    frame.size = buffer_get_size(buffer);
+    frame.data = malloc(frame.size);
+    assert(frame.data != NULL);
+    memcpy(frame.data, buffer_get_data(buffer), frame.size);
+  }
+
+  buffer_free(buffer);
+  free_packet(packet);
+  return frame;
+}
+
+static transaction_t* make_load_tx(void)
+{
+  // the txs are signed but spend txs which do not exist, so the node
+  // validates them all the way to the lookup of the unspent txs...
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  transaction_t *tx = make_transaction();
+  output_transaction_t *txout = make_txout();
+  txout->amount = randombytes_random();
+  randombytes_buf(txout->address, ADDRESS_SIZE);
+  assert(add_txout_to_transaction(tx, txout, 0) == 0);
+
+  input_transaction_t *txin = make_txin();
+  randombytes_buf(txin->transaction, HASH_SIZE);
+  txin->txout_index = 0;
+  assert(add_txin_to_transaction(tx, txin, 0) == 0);
+  assert(sign_txin(txin, tx, public_key, secret_key) == 0);
+
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+static int init_tx_frames(void)
+{
+  for (uint32_t i = 0; i < NET_LOAD_NUM_TX_FRAMES; i++)
+  {
+    transaction_t *tx = make_load_tx();
+    g_net_load_tx_frames[i] = make_load_frame(PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION, tx);
+    free_transaction(tx);
+    if (g_net_load_tx_frames[i].data == NULL)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void free_tx_frames(void)
+{
+  for (uint32_t i = 0; i < NET_LOAD_NUM_TX_FRAMES; i++)
+  {
+    free(g_net_load_tx_frames[i].data);
+    g_net_load_tx_frames[i].data = NULL;
+    g_net_load_tx_frames[i].size = 0;
+  }
+}
+
+static int queue_load_data(net_load_connection_t *connection, const uint8_t *data, size_t size)
+{
+  assert(connection != NULL);
+  assert(data != NULL);
+  if (connection->send_offset == connection->send_size)
+  {
+    connection->send_offset = 0;
+    connection->send_size = 0;
+  }
+
+  if (connection->send_size + size > connection->send_capacity)
+  {
+    size_t capacity = MAX(connection->send_capacity * 2, connection->send_size + size);
+    uint8_t *send_data = realloc(connection->send_data, capacity);
+    if (send_data == NULL)
+    {
+      return 1;
+    }
+
+    connection->send_data = send_data;
+    connection->send_capacity = capacity;
+  }
+
+  memcpy(connection->send_data + connection->send_size, data, size);
+  connection->send_size += size;
+  return 0;
+}
+
+static int queue_load_frame(net_load_thread_t *thread, net_load_connection_t *connection, net_load_frame_t frame)
+{
+  assert(thread != NULL);
+  if (frame.data == NULL)
+  {
+    return 1;
+  }
+
+  int result = queue_load_data(connection, frame.data, frame.size);
+  if (result == 0)
+  {
+    thread->stats.num_packets_sent++;
+  }
+
+  return result;
+}
+
+static void close_load_connection(net_load_thread_t *thread, net_load_connection_t *connection, int disconnected)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  if (connection->fd >= 0)
+  {
+    close(connection->fd);
+    connection->fd = -1;
+  }
+
+  if (connection->state == NET_LOAD_CONNECTION_RUNNING)
+  {
+    atomic_fetch_sub(&g_net_load_num_established, 1);
+  }
+
+  if (disconnected)
+  {
+    thread->stats.num_disconnects++;
+  }
+
+  connection->state = NET_LOAD_CONNECTION_CLOSED;
+  connection->state_ts = get_monotonic_time_us();
+  connection->send_offset = 0;
+  connection->send_size = 0;
+  connection->header_size = 0;
+  connection->payload_offset = 0;
+  connection->request_pending = 0;
+}
+
+static uint64_t get_elapsed_time_us(uint64_t current_time, uint64_t timestamp)
+{
+  // timestamps taken while a loop iteration is processed can be later than it's current time
+  return current_time > timestamp ? current_time - timestamp : 0;
+}
+
+static uint16_t get_next_host_port(void)
+{
+  // every connection advertises it's own host port, the node identifies
+  // it's peers by their address and the host port they advertise...
+  uint32_t num_host_ports = 65536 - (uint32_t)g_net_load_base_host_port;
+  uint32_t offset = atomic_fetch_add(&g_net_load_next_host_port, 1) % MAX(num_host_ports, 1);
+  return (uint16_t)(g_net_load_base_host_port + offset);
+}
+
+static int open_load_connection(net_load_thread_t *thread, net_load_connection_t *connection)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    thread->stats.num_connect_failures++;
+    return 1;
+  }
+
+  int no_delay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  if (connect(fd, (struct sockaddr*)&g_net_load_server_addr, sizeof(g_net_load_server_addr)) && errno != EINPROGRESS)
+  {
+    close(fd);
+    thread->stats.num_connect_failures++;
+    return 1;
+  }
+
+  connection->fd = fd;
+  connection->state = NET_LOAD_CONNECTION_CONNECTING;
+  connection->state_ts = get_monotonic_time_us();
+  connection->host_port = get_next_host_port();
+  return 0;
+}
+
+static int connection_established(net_load_thread_t *thread, net_load_connection_t *connection)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  int error = 0;
+  socklen_t error_size = sizeof(error);
+  if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &error_size) || error != 0)
+  {
+    thread->stats.num_connect_failures++;
+    close_load_connection(thread, connection, 0);
+    return 1;
+  }
+
+  thread->stats.num_connects++;
+  connection->state = NET_LOAD_CONNECTION_ESTABLISHING;
+  net_load_frame_t frame = make_load_frame(PKT_TYPE_CONNECT_ESTABLISH_REQ, (uint32_t)connection->host_port, (int)parameters_get_use_testnet());
+  int result = queue_load_frame(thread, connection, frame);
+  free(frame.data);
+  return result;
+}
+
+static net_load_traffic_type_t pick_traffic_type(void)
+{
+  uint32_t value = randombytes_uniform(g_net_load_total_traffic_weight);
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    if (value < g_net_load_traffic_weights[i])
+    {
+      return (net_load_traffic_type_t)i;
+    }
+
+    value -= g_net_load_traffic_weights[i];
+  }
+
+  return NET_LOAD_TRAFFIC_PING;
+}
+
+static uint32_t pick_block_height(void)
+{
+  uint32_t server_height = atomic_load(&g_net_load_server_height);
+  return server_height > 0 ? 1 + randombytes_uniform(server_height) : 0;
+}
+
+static net_load_frame_t make_fuzzed_frame(void)
+{
+  // the frame which is fuzzed is picked from the request types which carry a payload
+  net_load_frame_t frame = {NULL, 0};
+  switch (randombytes_uniform(3))
+  {
+    case 0:
+      {
+        net_load_frame_t tx_frame = g_net_load_tx_frames[randombytes_uniform(NET_LOAD_NUM_TX_FRAMES)];
+        frame.data = malloc(tx_frame.size);
+        assert(frame.data != NULL);
+        memcpy(frame.data, tx_frame.data, tx_frame.size);
+        frame.size = tx_frame.size;
+      }
+      break;
+    case 1:
+      frame = make_load_frame(PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ, pick_block_height());
+      break;
+    default:
+      frame = make_load_frame(PKT_TYPE_CONNECT_PING_REQ, (uint64_t)randombytes_random());
+      break;
+  }
+
+  if (frame.data == NULL || frame.size <= PACKET_HEADER_SIZE)
+  {
+    return frame;
+  }
+
+  uint32_t num_fuzzed_bytes = 1 + randombytes_uniform(NET_LOAD_MAX_FUZZED_BYTES);
+  for (uint32_t i = 0; i < num_fuzzed_bytes; i++)
+  {
+    size_t offset = PACKET_HEADER_SIZE + randombytes_uniform((uint32_t)(frame.size - PACKET_HEADER_SIZE));
+    frame.data[offset] ^= (uint8_t)(1 + randombytes_uniform(255));
+  }
+
+  return frame;
+}
+
+static int send_next_request(net_load_thread_t *thread, net_load_connection_t *connection)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  net_load_traffic_type_t traffic_type = pick_traffic_type();
+  if ((traffic_type == NET_LOAD_TRAFFIC_BLOCK_BY_HEIGHT || traffic_type == NET_LOAD_TRAFFIC_BLOCK_HEADERS) &&
+      atomic_load(&g_net_load_server_height) == 0)
+  {
+    // the node only has it's genesis block, which is never served by height
+    traffic_type = NET_LOAD_TRAFFIC_BLOCK_HEIGHT;
+  }
+
+  net_load_frame_t frame = {NULL, 0};
+  uint32_t expected_packet_id = PKT_TYPE_UNKNOWN;
+  int owns_frame = 1;
+  switch (traffic_type)
+  {
+    case NET_LOAD_TRAFFIC_PING:
+      frame = make_load_frame(PKT_TYPE_CONNECT_PING_REQ, (uint64_t)randombytes_random());
+      expected_packet_id = PKT_TYPE_CONNECT_PING_RESP;
+      break;
+    case NET_LOAD_TRAFFIC_BLOCK_HEIGHT:
+      frame = make_load_frame(PKT_TYPE_GET_BLOCK_HEIGHT_REQ);
+      expected_packet_id = PKT_TYPE_GET_BLOCK_HEIGHT_RESP;
+      break;
+    case NET_LOAD_TRAFFIC_BLOCK_BY_HEIGHT:
+      frame = make_load_frame(PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ, pick_block_height());
+      expected_packet_id = PKT_TYPE_GET_BLOCK_BY_HEIGHT_RESP;
+      break;
+    case NET_LOAD_TRAFFIC_BLOCK_HEADERS:
+      frame = make_load_frame(PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ, pick_block_height());
+      expected_packet_id = PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP;
+      break;
+    case NET_LOAD_TRAFFIC_MEMPOOL_TX:
+      frame = g_net_load_tx_frames[randombytes_uniform(NET_LOAD_NUM_TX_FRAMES)];
+      owns_frame = 0;
+      break;
+    case NET_LOAD_TRAFFIC_FUZZ:
+    default:
+      frame = make_fuzzed_frame();
+      break;
+  }
+
+  int result = queue_load_frame(thread, connection, frame);
+  if (owns_frame)
+  {
+    free(frame.data);
+  }
+
+  if (result)
+  {
+    return 1;
+  }
+
+  thread->stats.num_sent[traffic_type]++;
+  connection->request_type = traffic_type;
+  connection->request_pending = expected_packet_id != PKT_TYPE_UNKNOWN;
+  connection->expected_packet_id = expected_packet_id;
+  connection->request_ts = get_monotonic_time_us();
+  return 0;
+}
+
+static int load_packet_received(net_load_thread_t *thread, net_load_connection_t *connection)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  thread->stats.num_packets_received++;
+
+  buffer_t prefix_buffer = {connection->payload_prefix, MIN(connection->packet_size, NET_LOAD_PAYLOAD_PREFIX_SIZE), 0};
+  buffer_iterator_t prefix_iterator = {&prefix_buffer, 0};
+
+  // the id of a compressed packet's original packet leads it's payload,
+  // the rest of the payload is never needed so it's not decompressed...
+  uint32_t packet_id = connection->packet_id;
+  if (packet_id == PKT_TYPE_COMPRESSED_PACKET && buffer_read_uint32(&prefix_iterator, &packet_id))
+  {
+    return 1;
+  }
+
+  uint64_t current_time = get_monotonic_time_us();
+  switch (packet_id)
+  {
+    case PKT_TYPE_CONNECT_ESTABLISH_RESP:
+      if (connection->state != NET_LOAD_CONNECTION_ESTABLISHING)
+      {
+        break;
+      }
+
+      add_latency_sample(&thread->stats.handshake_latencies, get_elapsed_time_us(current_time, connection->state_ts));
+      connection->state = NET_LOAD_CONNECTION_RUNNING;
+      atomic_fetch_add(&g_net_load_num_established, 1);
+      return 0;
+    case PKT_TYPE_CONNECT_PING_REQ:
+      {
+        // the node measures it's peers ping times, answer it as every peer does
+        uint64_t nonce = 0;
+        if (buffer_read_uint64(&prefix_iterator, &nonce))
+        {
+          return 1;
+        }
+
+        net_load_frame_t frame = make_load_frame(PKT_TYPE_CONNECT_PING_RESP, nonce);
+        int result = queue_load_frame(thread, connection, frame);
+        free(frame.data);
+        return result;
+      }
+    case PKT_TYPE_GET_BLOCK_HEIGHT_RESP:
+      {
+        uint32_t height = 0;
+        if (buffer_read_uint32(&prefix_iterator, &height) == 0)
+        {
+          uint32_t server_height = atomic_load(&g_net_load_server_height);
+          while (height > server_height && atomic_compare_exchange_weak(&g_net_load_server_height, &server_height, height) == 0);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+
+  if (connection->request_pending && packet_id == connection->expected_packet_id)
+  {
+    thread->stats.num_responses[connection->request_type]++;
+    add_latency_sample(&thread->stats.latencies[connection->request_type], get_elapsed_time_us(current_time, connection->request_ts));
+    connection->request_pending = 0;
+    return 0;
+  }
+
+  thread->stats.num_unsolicited_packets++;
+  return 0;
+}
+
+/*
+ * Frames the received data into packets the same way the node's packet framer does,
+ * the header is read byte by byte until it's complete and the payload is skipped over
+ * except for it's first bytes, which hold everything the load generator looks at.
+ */
+static int load_data_received(net_load_thread_t *thread, net_load_connection_t *connection, const uint8_t *data, size_t size)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  size_t offset = 0;
+  while (offset < size)
+  {
+    if (connection->header_size < PACKET_HEADER_MIN_SIZE ||
+        (connection->packet_size > 0 && connection->header_size < PACKET_HEADER_SIZE))
+    {
+      connection->header[connection->header_size++] = data[offset++];
+      if (connection->header_size < PACKET_HEADER_MIN_SIZE)
+      {
+        continue;
+      }
+
+      packet_t packet = {0, 0, NULL};
+      if (deserialize_packet_header(&packet, connection->header, connection->header_size))
+      {
+        return 1;
+      }
+
+      connection->packet_id = packet.id;
+      connection->packet_size = packet.size;
+      connection->payload_offset = 0;
+      if (packet.size > 0 && connection->header_size < PACKET_HEADER_SIZE)
+      {
+        continue;
+      }
+    }
+
+    size_t payload_size = MIN(size - offset, (size_t)(connection->packet_size - connection->payload_offset));
+    if (connection->payload_offset < NET_LOAD_PAYLOAD_PREFIX_SIZE)
+    {
+      size_t prefix_size = MIN(payload_size, (size_t)(NET_LOAD_PAYLOAD_PREFIX_SIZE - connection->payload_offset));
+      memcpy(connection->payload_prefix + connection->payload_offset, data + offset, prefix_size);
+    }
+
+    connection->payload_offset += (uint32_t)payload_size;
+    offset += payload_size;
+    if (connection->payload_offset == connection->packet_size)
+    {
+      if (load_packet_received(thread, connection))
+      {
+        return 1;
+      }
+
+      connection->header_size = 0;
+      connection->packet_size = 0;
+      connection->payload_offset = 0;
+    }
+  }
+
+  return 0;
+}
+
+static int read_load_connection(net_load_thread_t *thread, net_load_connection_t *connection)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  while (1)
+  {
+    ssize_t num_read = recv(connection->fd, thread->recv_buffer, NET_LOAD_RECV_BUFFER_SIZE, 0);
+    if (num_read > 0)
+    {
+      thread->stats.num_bytes_received += (uint64_t)num_read;
+      if (load_data_received(thread, connection, thread->recv_buffer, (size_t)num_read))
+      {
+        return 1;
+      }
+
+      continue;
+    }
+
+    if (num_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+      return 0;
+    }
+
+    return 1;
+  }
+}
+
+static int write_load_connection(net_load_thread_t *thread, net_load_connection_t *connection)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  while (connection->send_offset < connection->send_size)
+  {
+    ssize_t num_written = send(connection->fd, connection->send_data + connection->send_offset,
+      connection->send_size - connection->send_offset, MSG_NOSIGNAL);
+    if (num_written > 0)
+    {
+      thread->stats.num_bytes_sent += (uint64_t)num_written;
+      connection->send_offset += (size_t)num_written;
+      continue;
+    }
+
+    if (num_written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+      return 0;
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+static void update_load_connection(net_load_thread_t *thread, net_load_connection_t *connection, uint64_t current_time)
+{
+  assert(thread != NULL);
+  assert(connection != NULL);
+  if (connection->state != NET_LOAD_CONNECTION_RUNNING)
+  {
+    // a connection the node did not establish within the timeout is retried
+    if (connection->state != NET_LOAD_CONNECTION_CLOSED &&
+        get_elapsed_time_us(current_time, connection->state_ts) > (uint64_t)g_net_load_request_timeout_ms * 1000)
+    {
+      thread->stats.num_connect_failures++;
+      close_load_connection(thread, connection, 0);
+    }
+
+    return;
+  }
+
+  if (connection->request_pending)
+  {
+    if (get_elapsed_time_us(current_time, connection->request_ts) <= (uint64_t)g_net_load_request_timeout_ms * 1000)
+    {
+      return;
+    }
+
+    // a late response is counted as unsolicited once it arrives
+    thread->stats.num_timeouts[connection->request_type]++;
+    connection->request_pending = 0;
+  }
+
+  // requests which are never answered are followed up as soon as they have been written
+  if (connection->send_offset == connection->send_size)
+  {
+    if (send_next_request(thread, connection))
+    {
+      close_load_connection(thread, connection, 1);
+    }
+  }
+}
+
+static int run_load_thread(void *arg)
+{
+  net_load_thread_t *thread = (net_load_thread_t*)arg;
+  assert(thread != NULL);
+
+  // the connect rate is shared evenly by the threads
+  double connect_rate = MAX((double)g_net_load_connect_rate / (double)g_net_load_num_threads, 1.0);
+  while (atomic_load(&g_net_load_running))
+  {
+    uint64_t current_time = get_monotonic_time_us();
+    uint32_t num_ramped_connections = (uint32_t)MIN((double)thread->num_connections,
+      ((double)(current_time - g_net_load_start_time) / 1000000.0) * connect_rate + 1.0);
+
+    uint32_t num_poll_fds = 0;
+    for (uint32_t i = 0; i < thread->num_connections; i++)
+    {
+      net_load_connection_t *connection = &thread->connections[i];
+      if (connection->state == NET_LOAD_CONNECTION_CLOSED)
+      {
+        int reconnect = i < thread->num_opened_connections && get_elapsed_time_us(current_time, connection->state_ts) >= NET_LOAD_RECONNECT_DELAY_US;
+        int ramp_up = i == thread->num_opened_connections && i < num_ramped_connections;
+        if (reconnect == 0 && ramp_up == 0)
+        {
+          continue;
+        }
+
+        if (ramp_up)
+        {
+          thread->num_opened_connections++;
+        }
+
+        if (open_load_connection(thread, connection))
+        {
+          connection->state_ts = current_time;
+          continue;
+        }
+      }
+
+      update_load_connection(thread, connection, current_time);
+      if (connection->state == NET_LOAD_CONNECTION_CLOSED)
+      {
+        continue;
+      }
+
+      struct pollfd *poll_fd = &thread->poll_fds[num_poll_fds];
+      poll_fd->fd = connection->fd;
+      poll_fd->events = POLLIN;
+      poll_fd->revents = 0;
+      if (connection->state == NET_LOAD_CONNECTION_CONNECTING || connection->send_offset < connection->send_size)
+      {
+        poll_fd->events |= POLLOUT;
+      }
+
+      thread->poll_connections[num_poll_fds] = i;
+      num_poll_fds++;
+    }
+
+    if (num_poll_fds == 0)
+    {
+      thrd_sleep(&(struct timespec){.tv_sec = 0, .tv_nsec = NET_LOAD_POLL_DELAY_MS * 1000000}, NULL);
+      continue;
+    }
+
+    int num_ready = poll(thread->poll_fds, num_poll_fds, NET_LOAD_POLL_DELAY_MS);
+    if (num_ready <= 0)
+    {
+      continue;
+    }
+
+    for (uint32_t i = 0; i < num_poll_fds; i++)
+    {
+      struct pollfd *poll_fd = &thread->poll_fds[i];
+      if (poll_fd->revents == 0)
+      {
+        continue;
+      }
+
+      net_load_connection_t *connection = &thread->connections[thread->poll_connections[i]];
+      if (connection->state == NET_LOAD_CONNECTION_CONNECTING)
+      {
+        if ((poll_fd->revents & (POLLOUT | POLLERR | POLLHUP)) && connection_established(thread, connection))
+        {
+          continue;
+        }
+
+        if ((poll_fd->revents & POLLOUT) == 0)
+        {
+          continue;
+        }
+      }
+
+      if ((poll_fd->revents & POLLIN) && read_load_connection(thread, connection))
+      {
+        close_load_connection(thread, connection, 1);
+        continue;
+      }
+
+      if ((poll_fd->revents & (POLLERR | POLLHUP)) && (poll_fd->revents & POLLIN) == 0)
+      {
+        close_load_connection(thread, connection, 1);
+        continue;
+      }
+
+      if (write_load_connection(thread, connection))
+      {
+        close_load_connection(thread, connection, 1);
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < thread->num_connections; i++)
+  {
+    if (thread->connections[i].state != NET_LOAD_CONNECTION_CLOSED)
+    {
+      close_load_connection(thread, &thread->connections[i], 0);
+    }
+  }
+
+  return 0;
+}
+
+static int init_load_thread(net_load_thread_t *thread, uint32_t index, uint32_t num_connections)
+{
+  assert(thread != NULL);
+  memset(thread, 0, sizeof(net_load_thread_t));
+  thread->index = index;
+  thread->num_connections = num_connections;
+  thread->connections = calloc(MAX(num_connections, 1), sizeof(net_load_connection_t));
+  thread->poll_fds = calloc(MAX(num_connections, 1), sizeof(struct pollfd));
+  thread->poll_connections = calloc(MAX(num_connections, 1), sizeof(uint32_t));
+  thread->recv_buffer = malloc(NET_LOAD_RECV_BUFFER_SIZE);
+  if (thread->connections == NULL || thread->poll_fds == NULL || thread->poll_connections == NULL || thread->recv_buffer == NULL)
+  {
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < num_connections; i++)
+  {
+    thread->connections[i].fd = -1;
+  }
+
+  return 0;
+}
+
+static void free_load_thread(net_load_thread_t *thread)
+{
+  assert(thread != NULL);
+  for (uint32_t i = 0; i < thread->num_connections; i++)
+  {
+    free(thread->connections[i].send_data);
+  }
+
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    free_latencies(&thread->stats.latencies[i]);
+  }
+
+  free_latencies(&thread->stats.handshake_latencies);
+  free(thread->connections);
+  free(thread->poll_fds);
+  free(thread->poll_connections);
+  free(thread->recv_buffer);
+}
+
+static int merge_load_stats(net_load_stats_t *stats, net_load_stats_t *other_stats)
+{
+  assert(stats != NULL);
+  assert(other_stats != NULL);
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    stats->num_sent[i] += other_stats->num_sent[i];
+    stats->num_responses[i] += other_stats->num_responses[i];
+    stats->num_timeouts[i] += other_stats->num_timeouts[i];
+    if (merge_latencies(&stats->latencies[i], &other_stats->latencies[i]))
+    {
+      return 1;
+    }
+  }
+
+  stats->num_connects += other_stats->num_connects;
+  stats->num_connect_failures += other_stats->num_connect_failures;
+  stats->num_disconnects += other_stats->num_disconnects;
+  stats->num_unsolicited_packets += other_stats->num_unsolicited_packets;
+  stats->num_packets_sent += other_stats->num_packets_sent;
+  stats->num_packets_received += other_stats->num_packets_received;
+  stats->num_bytes_sent += other_stats->num_bytes_sent;
+  stats->num_bytes_received += other_stats->num_bytes_received;
+  return merge_latencies(&stats->handshake_latencies, &other_stats->handshake_latencies);
+}
+
+/*
+ * Reads the user and system cpu time of the process in seconds from procfs,
+ * returns a negative time when the process could not be read.
+ */
+static double get_process_cpu_time(int pid)
+{
+  char stat_filename[64];
+  snprintf(stat_filename, sizeof(stat_filename), "/proc/%d/stat", pid);
+  FILE *file = fopen(stat_filename, "rb");
+  if (file == NULL)
+  {
+    return -1.0;
+  }
+
+  char stat[1024];
+  size_t stat_size = fread(stat, 1, sizeof(stat) - 1, file);
+  fclose(file);
+  stat[stat_size] = '\0';
+
+  // the process name may hold spaces, the fields are counted from the end of it
+  char *fields = strrchr(stat, ')');
+  unsigned long long user_time = 0;
+  unsigned long long system_time = 0;
+  if (fields == NULL || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &user_time, &system_time) != 2)
+  {
+    return -1.0;
+  }
+
+  long clock_ticks = sysconf(_SC_CLK_TCK);
+  return clock_ticks > 0 ? (double)(user_time + system_time) / (double)clock_ticks : -1.0;
+}
+
+static double get_own_cpu_time(void)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage))
+  {
+    return 0.0;
+  }
+
+  return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1000000.0 +
+    (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1000000.0;
+}
+
+static void sort_load_latencies(net_load_stats_t *stats)
+{
+  assert(stats != NULL);
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    qsort(stats->latencies[i].samples, stats->latencies[i].num_samples, sizeof(uint32_t), compare_latency_samples);
+  }
+
+  qsort(stats->handshake_latencies.samples, stats->handshake_latencies.num_samples, sizeof(uint32_t), compare_latency_samples);
+}
+
+static void print_latencies(const char *name, uint64_t num_sent, uint64_t num_responses, uint64_t num_timeouts, net_load_latencies_t *latencies)
+{
+  assert(name != NULL);
+  assert(latencies != NULL);
+  printf("%-16s %10llu %10llu %9llu %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, (unsigned long long)num_sent,
+    (unsigned long long)num_responses, (unsigned long long)num_timeouts,
+    get_latency_percentile_ms(latencies, 50.0), get_latency_percentile_ms(latencies, 90.0),
+    get_latency_percentile_ms(latencies, 99.0), get_latency_percentile_ms(latencies, 99.9),
+    get_latency_percentile_ms(latencies, 100.0));
+}
+
+static void print_load_results(net_load_stats_t *stats, double elapsed_time, double server_cpu_time, double own_cpu_time)
+{
+  assert(stats != NULL);
+  uint64_t num_requests = 0;
+  uint64_t num_responses = 0;
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    num_requests += stats->num_sent[i];
+    num_responses += stats->num_responses[i];
+  }
+
+  printf("\n%-16s %10s %10s %9s %9s %9s %9s %9s %9s\n", "traffic", "sent", "answered", "timeouts", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    if (g_net_load_traffic_weights[i] == 0)
+    {
+      continue;
+    }
+
+    print_latencies(g_net_load_traffic_names[i], stats->num_sent[i], stats->num_responses[i], stats->num_timeouts[i], &stats->latencies[i]);
+  }
+
+  print_latencies("handshake", stats->num_connects, stats->handshake_latencies.num_samples, 0, &stats->handshake_latencies);
+  printf("\n");
+  printf("Requests:        %.1f/s sent, %.1f/s answered\n", (double)num_requests / elapsed_time, (double)num_responses / elapsed_time);
+  printf("Packets:         %.1f/s sent, %.1f/s received, %llu unsolicited\n", (double)stats->num_packets_sent / elapsed_time,
+    (double)stats->num_packets_received / elapsed_time, (unsigned long long)stats->num_unsolicited_packets);
+  printf("Bytes:           %.1f KiB/s sent, %.1f KiB/s received\n", (double)stats->num_bytes_sent / elapsed_time / 1024.0,
+    (double)stats->num_bytes_received / elapsed_time / 1024.0);
+  printf("Connections:     %llu established, %llu failed, %llu disconnected\n", (unsigned long long)stats->num_connects,
+    (unsigned long long)stats->num_connect_failures, (unsigned long long)stats->num_disconnects);
+  if (server_cpu_time >= 0.0)
+  {
+    printf("Server cpu:      %.1f%% of a core\n", (server_cpu_time / elapsed_time) * 100.0);
+  }
+
+  printf("Generator cpu:   %.1f%% of a core\n", (own_cpu_time / elapsed_time) * 100.0);
+}
+
+static void write_latencies(buffer_t *buffer, net_load_latencies_t *latencies)
+{
+  assert(buffer != NULL);
+  assert(latencies != NULL);
+  json_write_format(buffer, "\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_ms\":%.3f",
+    get_latency_percentile_ms(latencies, 50.0), get_latency_percentile_ms(latencies, 90.0),
+    get_latency_percentile_ms(latencies, 99.0), get_latency_percentile_ms(latencies, 99.9),
+    get_latency_percentile_ms(latencies, 100.0));
+}
+
+static int write_load_results(const char *filename, net_load_stats_t *stats, double elapsed_time, double server_cpu_time, double own_cpu_time)
+{
+  assert(filename != NULL);
+  assert(stats != NULL);
+  buffer_t *buffer = buffer_init();
+  json_write_format(buffer, "{\"connections\":%u,\"threads\":%u,\"seconds\":%.3f,\"traffic\":[",
+    g_net_load_num_connections, g_net_load_num_threads, elapsed_time);
+
+  int num_written = 0;
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    if (g_net_load_traffic_weights[i] == 0)
+    {
+      continue;
+    }
+
+    json_write_format(buffer, "%s{\"name\":", num_written > 0 ? "," : "");
+    json_write_string(buffer, g_net_load_traffic_names[i], strlen(g_net_load_traffic_names[i]));
+    json_write_format(buffer, ",\"weight\":%u,\"sent\":%llu,\"answered\":%llu,\"timeouts\":%llu,", g_net_load_traffic_weights[i],
+      (unsigned long long)stats->num_sent[i], (unsigned long long)stats->num_responses[i], (unsigned long long)stats->num_timeouts[i]);
+    write_latencies(buffer, &stats->latencies[i]);
+    json_write_format(buffer, "}");
+    num_written++;
+  }
+
+  json_write_format(buffer, "],\"handshake\":{\"established\":%llu,", (unsigned long long)stats->num_connects);
+  write_latencies(buffer, &stats->handshake_latencies);
+  json_write_format(buffer, "},\"connect_failures\":%llu,\"disconnects\":%llu,\"unsolicited_packets\":%llu,",
+    (unsigned long long)stats->num_connect_failures, (unsigned long long)stats->num_disconnects,
+    (unsigned long long)stats->num_unsolicited_packets);
+  json_write_format(buffer, "\"packets_sent\":%llu,\"packets_received\":%llu,\"bytes_sent\":%llu,\"bytes_received\":%llu,",
+    (unsigned long long)stats->num_packets_sent, (unsigned long long)stats->num_packets_received,
+    (unsigned long long)stats->num_bytes_sent, (unsigned long long)stats->num_bytes_received);
+  if (server_cpu_time >= 0.0)
+  {
+    json_write_format(buffer, "\"server_cpu_seconds\":%.3f,", server_cpu_time);
+  }
+
+  json_write_format(buffer, "\"generator_cpu_seconds\":%.3f}\n", own_cpu_time);
+
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Failed to open results file: %s!\n", filename);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  size_t size = buffer_get_size(buffer);
+  int failed = fwrite(buffer_get_data(buffer), 1, size, file) != size;
+  fclose(file);
+  buffer_free(buffer);
+  if (failed)
+  {
+    fprintf(stderr, "Failed to write results file: %s!\n", filename);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int resolve_server_address(void)
+{
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  struct addrinfo *addresses = NULL;
+  if (getaddrinfo(g_net_load_address, NULL, &hints, &addresses) || addresses == NULL)
+  {
+    fprintf(stderr, "Failed to resolve address: %s!\n", g_net_load_address);
+    return 1;
+  }
+
+  memcpy(&g_net_load_server_addr, addresses->ai_addr, sizeof(struct sockaddr_in));
+  g_net_load_server_addr.sin_port = htons(g_net_load_port > 0 ? g_net_load_port : parameters_get_p2p_port());
+  freeaddrinfo(addresses);
+  return 0;
+}
+
+static int run_net_load(void)
+{
+  net_load_thread_t *threads = calloc(g_net_load_num_threads, sizeof(net_load_thread_t));
+  assert(threads != NULL);
+
+  int result = 0;
+  uint32_t num_started_threads = 0;
+  g_net_load_start_time = get_monotonic_time_us();
+  atomic_store(&g_net_load_running, 1);
+
+  double start_server_cpu_time = g_net_load_server_pid > 0 ? get_process_cpu_time(g_net_load_server_pid) : -1.0;
+  double start_own_cpu_time = get_own_cpu_time();
+  for (uint32_t i = 0; i < g_net_load_num_threads; i++)
+  {
+    // the connections are spread as evenly as they can be
+    uint32_t num_connections = (g_net_load_num_connections / g_net_load_num_threads) +
+      (i < (g_net_load_num_connections % g_net_load_num_threads) ? 1 : 0);
+    if (init_load_thread(&threads[i], i, num_connections) ||
+        thrd_create(&threads[i].thread, run_load_thread, &threads[i]) != thrd_success)
+    {
+      fprintf(stderr, "Failed to start load thread: %u!\n", i);
+      result = 1;
+      break;
+    }
+
+    num_started_threads++;
+  }
+
+  for (uint32_t second = 0; result == 0 && second < g_net_load_duration; second++)
+  {
+    thrd_sleep(&(struct timespec){.tv_sec = 1, .tv_nsec = 0}, NULL);
+    fprintf(stderr, "[%u/%us] %u connections established, node height: %u\n", second + 1, g_net_load_duration,
+      atomic_load(&g_net_load_num_established), atomic_load(&g_net_load_server_height));
+  }
+
+  atomic_store(&g_net_load_running, 0);
+  for (uint32_t i = 0; i < num_started_threads; i++)
+  {
+    thrd_join(threads[i].thread, NULL);
+  }
+
+  double elapsed_time = MAX((double)(get_monotonic_time_us() - g_net_load_start_time) / 1000000.0, 0.001);
+  double server_cpu_time = -1.0;
+  if (start_server_cpu_time >= 0.0)
+  {
+    double end_server_cpu_time = get_process_cpu_time(g_net_load_server_pid);
+    server_cpu_time = end_server_cpu_time >= 0.0 ? end_server_cpu_time - start_server_cpu_time : -1.0;
+  }
+
+  double own_cpu_time = get_own_cpu_time() - start_own_cpu_time;
+  net_load_stats_t stats;
+  memset(&stats, 0, sizeof(net_load_stats_t));
+  for (uint32_t i = 0; i < g_net_load_num_threads; i++)
+  {
+    if (result == 0 && merge_load_stats(&stats, &threads[i].stats))
+    {
+      result = 1;
+    }
+
+    free_load_thread(&threads[i]);
+  }
+
+  free(threads);
+  if (result == 0)
+  {
+    sort_load_latencies(&stats);
+    print_load_results(&stats, elapsed_time, server_cpu_time, own_cpu_time);
+    if (g_net_load_json_filename != NULL)
+    {
+      result = write_load_results(g_net_load_json_filename, &stats, elapsed_time, server_cpu_time, own_cpu_time);
+    }
+  }
+
+  for (int i = 0; i < NET_LOAD_NUM_TRAFFIC_TYPES; i++)
+  {
+    free_latencies(&stats.latencies[i]);
+  }
+
+  free_latencies(&stats.handshake_latencies);
+  return result;
+}
+
+int main(int argc, char **argv)
+{
+  if (parse_commandline_args(argc, argv))
+  {
+    return 1;
+  }
+
+  if (sodium_init() == -1)
+  {
+    return 1;
+  }
+
+  // thousands of connections need more descriptors than the default soft limit
+  struct rlimit descriptor_limit;
+  if (getrlimit(RLIMIT_NOFILE, &descriptor_limit) == 0 && descriptor_limit.rlim_cur < descriptor_limit.rlim_max)
+  {
+    descriptor_limit.rlim_cur = descriptor_limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &descriptor_limit);
+  }
+
+  if (resolve_server_address() || init_tx_frames())
+  {
+    return 1;
+  }
+
+  int result = run_net_load();
+  free_tx_frames();
+  return result;
+}
@@ -0,0 +1,376 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#ifdef __linux__
+ #ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+ #endif
+
+ #include <sched.h>
+ #include <dirent.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "affinity.h"
+#include "logger.h"
+
+typedef struct AffinityCpu
+{
+  uint16_t id;
+  uint16_t node;
+} affinity_cpu_t;
+
+static int g_thread_affinity_enabled = 0;
+static int g_thread_affinity_initialized = 0;
+static uint16_t g_num_reserved_cpus = 0;
+static const char *g_thread_affinity_sysfs_root = AFFINITY_SYSFS_ROOT;
+
+// the cpus the process may run on, ordered by numa node then by id
+static affinity_cpu_t g_affinity_cpus[MAX_NUM_AFFINITY_CPUS];
+static uint16_t g_num_affinity_cpus = 0;
+static uint16_t g_num_numa_nodes = 0;
+
+void set_thread_affinity_enabled(int enabled)
+{
+  g_thread_affinity_enabled = enabled;
+}
+
+int get_thread_affinity_enabled(void)
+{
+  return g_thread_affinity_enabled;
+}
+
+void set_num_reserved_cpus(uint16_t num_reserved_cpus)
+{
+  g_num_reserved_cpus = num_reserved_cpus;
+}
+
+uint16_t get_num_reserved_cpus(void)
+{
+  return g_num_reserved_cpus;
+}
+
+void set_thread_affinity_sysfs_root(const char *sysfs_root)
+{
+  g_thread_affinity_sysfs_root = sysfs_root;
+}
+
+const char* get_thread_affinity_sysfs_root(void)
+{
+  return g_thread_affinity_sysfs_root;
+}
+
+uint16_t get_num_affinity_cpus(void)
+{
+  return g_num_affinity_cpus;
+}
+
+uint16_t get_num_numa_nodes(void)
+{
+  return g_num_numa_nodes;
+}
+
+/*
+ * Parses a cpu list as found in sysfs such as "0-3,8,10-11" into the ids of the cpus it lists,
+ * an empty list is valid since a numa node may have memory but no cpus of it's own.
+ */
+int parse_affinity_cpu_list(const char *cpu_list, uint16_t *cpus, uint16_t max_cpus, uint16_t *num_cpus_out)
+{
+  assert(cpu_list != NULL);
+  assert(cpus != NULL);
+  assert(num_cpus_out != NULL);
+
+  uint16_t num_cpus = 0;
+  const char *position = cpu_list;
+  while (*position != '\0' && *position != '\n')
+  {
+    char *end = NULL;
+    unsigned long first_cpu = strtoul(position, &end, 10);
+    if (end == position || first_cpu >= UINT16_MAX)
+    {
+      return 1;
+    }
+
+    unsigned long last_cpu = first_cpu;
+    position = end;
+    if (*position == '-')
+    {
+      position++;
+      last_cpu = strtoul(position, &end, 10);
+      if (end == position || last_cpu >= UINT16_MAX || last_cpu < first_cpu)
+      {
+        return 1;
+      }
+
+      position = end;
+    }
+
+    for (unsigned long cpu = first_cpu; cpu <= last_cpu; cpu++)
+    {
+      if (num_cpus >= max_cpus)
+      {
+        return 1;
+      }
+
+      cpus[num_cpus++] = (uint16_t)cpu;
+    }
+
+    if (*position == ',')
+    {
+      position++;
+    }
+    else if (*position != '\0' && *position != '\n')
+    {
+      return 1;
+    }
+  }
+
+  *num_cpus_out = num_cpus;
+  return 0;
+}
+
+#ifdef __linux__
+static int read_numa_node_cpu_list(const char *node_path, char *cpu_list, size_t cpu_list_size)
+{
+  char path[MAX_AFFINITY_PATH_SIZE];
+  snprintf(path, sizeof(path), "%s/cpulist", node_path);
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL)
+  {
+    return 1;
+  }
+
+  int result = fgets(cpu_list, cpu_list_size, fp) == NULL ? 1 : 0;
+  fclose(fp);
+  return result;
+}
+
+/*
+ * Assigns the cpus the process may run on to the numa nodes whose cpu lists name them,
+ * the cpus are left on the first node when none of the lists do.
+ */
+static int read_numa_nodes(void)
+{
+  char nodes_path[MAX_AFFINITY_PATH_SIZE];
+  snprintf(nodes_path, sizeof(nodes_path), "%s/node", g_thread_affinity_sysfs_root);
+  DIR *dir = opendir(nodes_path);
+  if (dir == NULL)
+  {
+    return 1;
+  }
+
+  struct dirent *entry = NULL;
+  while ((entry = readdir(dir)) != NULL)
+  {
+    unsigned int node_id = 0;
+    char trailing = 0;
+    if (sscanf(entry->d_name, "node%u%c", &node_id, &trailing) != 1)
+    {
+      continue;
+    }
+
+    char node_path[MAX_AFFINITY_PATH_SIZE];
+    snprintf(node_path, sizeof(node_path), "%s/%s", nodes_path, entry->d_name);
+
+    char cpu_list[MAX_AFFINITY_CPU_LIST_SIZE];
+    uint16_t cpus[MAX_NUM_AFFINITY_CPUS];
+    uint16_t num_cpus = 0;
+    if (read_numa_node_cpu_list(node_path, cpu_list, sizeof(cpu_list)) ||
+        parse_affinity_cpu_list(cpu_list, cpus, MAX_NUM_AFFINITY_CPUS, &num_cpus))
+    {
+      LOG_WARNING("Failed to read the cpus of numa node: %u!", node_id);
+      continue;
+    }
+
+    for (uint16_t i = 0; i < num_cpus; i++)
+    {
+      for (uint16_t j = 0; j < g_num_affinity_cpus; j++)
+      {
+        if (g_affinity_cpus[j].id == cpus[i])
+        {
+          g_affinity_cpus[j].node = (uint16_t)node_id;
+          break;
+        }
+      }
+    }
+  }
+
+  closedir(dir);
+  return 0;
+}
+
+static int compare_affinity_cpus(const void *a, const void *b)
+{
+  const affinity_cpu_t *cpu = (const affinity_cpu_t*)a;
+  const affinity_cpu_t *other_cpu = (const affinity_cpu_t*)b;
+  if (cpu->node != other_cpu->node)
+  {
+    return cpu->node < other_cpu->node ? -1 : 1;
+  }
+
+  return cpu->id < other_cpu->id ? -1 : (cpu->id > other_cpu->id);
+}
+#endif
+
+/*
+ * Reads the cpus the process may run on along with their numa nodes, this must be called
+ * from the main thread before any thread is pinned, since pinned threads narrow it down.
+ */
+int init_thread_affinity(void)
+{
+  if (g_thread_affinity_enabled == 0 || g_thread_affinity_initialized)
+  {
+    return 0;
+  }
+
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &cpu_set))
+  {
+    LOG_ERROR("Failed to read the cpus the process may run on!");
+    return 1;
+  }
+
+  g_num_affinity_cpus = 0;
+  for (uint16_t cpu = 0; cpu < CPU_SETSIZE && g_num_affinity_cpus < MAX_NUM_AFFINITY_CPUS; cpu++)
+  {
+    if (CPU_ISSET(cpu, &cpu_set) == 0)
+    {
+      continue;
+    }
+
+    affinity_cpu_t *affinity_cpu = &g_affinity_cpus[g_num_affinity_cpus++];
+    affinity_cpu->id = cpu;
+    affinity_cpu->node = 0;
+  }
+
+  if (g_num_affinity_cpus == 0)
+  {
+    LOG_ERROR("Failed to find any cpus to pin threads to!");
+    return 1;
+  }
+
+  if (read_numa_nodes())
+  {
+    LOG_WARNING("Failed to read the numa nodes from: %s, threads will not be pinned!", g_thread_affinity_sysfs_root);
+    g_num_affinity_cpus = 0;
+    g_thread_affinity_enabled = 0;
+    return 0;
+  }
+
+  qsort(g_affinity_cpus, g_num_affinity_cpus, sizeof(affinity_cpu_t), compare_affinity_cpus);
+
+  g_num_numa_nodes = 1;
+  for (uint16_t i = 1; i < g_num_affinity_cpus; i++)
+  {
+    if (g_affinity_cpus[i].node != g_affinity_cpus[i - 1].node)
+    {
+      g_num_numa_nodes++;
+    }
+  }
+
+  if (g_num_reserved_cpus >= g_num_affinity_cpus)
+  {
+    LOG_WARNING("Reserved all of the %hu cpus for the critical path, miner workers will share them!", g_num_affinity_cpus);
+  }
+
+  LOG_INFO("Pinning threads across %hu cpus on %hu numa nodes, %hu reserved for the critical path...",
+    g_num_affinity_cpus, g_num_numa_nodes, MIN(g_num_reserved_cpus, g_num_affinity_cpus));
+
+  g_thread_affinity_initialized = 1;
+  return 0;
+#else
+  LOG_WARNING("Thread affinity is not supported on this platform!");
+  g_thread_affinity_enabled = 0;
+  return 0;
+#endif
+}
+
+void deinit_thread_affinity(void)
+{
+  g_num_affinity_cpus = 0;
+  g_num_numa_nodes = 0;
+  g_thread_affinity_initialized = 0;
+}
+
+/*
+ * Pins the calling thread to the cpus of it's role, the index spreads threads
+ * of the same role across the cpus. Does nothing unless affinity is enabled.
+ */
+int set_current_thread_affinity(thread_affinity_t affinity, uint32_t index)
+{
+  if (g_thread_affinity_enabled == 0 || g_thread_affinity_initialized == 0)
+  {
+    return 0;
+  }
+
+#ifdef __linux__
+  assert(g_num_affinity_cpus > 0);
+  uint16_t num_reserved_cpus = MIN(g_num_reserved_cpus, g_num_affinity_cpus);
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  switch (affinity)
+  {
+    case THREAD_AFFINITY_NET_LOOP:
+      CPU_SET(g_affinity_cpus[0].id, &cpu_set);
+      break;
+    case THREAD_AFFINITY_CRITICAL:
+      {
+        // the rest of the reserved cpus, or the network loop's cpu if it's the only one
+        uint16_t start = num_reserved_cpus > 1 ? 1 : 0;
+        uint16_t end = num_reserved_cpus > 0 ? num_reserved_cpus : g_num_affinity_cpus;
+        for (uint16_t i = start; i < end; i++)
+        {
+          CPU_SET(g_affinity_cpus[i].id, &cpu_set);
+        }
+      }
+      break;
+    case THREAD_AFFINITY_MINER:
+      {
+        uint16_t start = num_reserved_cpus < g_num_affinity_cpus ? num_reserved_cpus : 0;
+        uint16_t num_cpus = g_num_affinity_cpus - start;
+        CPU_SET(g_affinity_cpus[start + (index % num_cpus)].id, &cpu_set);
+      }
+      break;
+    default:
+      return 1;
+  }
+
+  if (sched_setaffinity(0, sizeof(cpu_set_t), &cpu_set))
+  {
+    LOG_WARNING("Failed to set the affinity of thread: %u!", index);
+    return 1;
+  }
+#endif
+
+  return 0;
+}
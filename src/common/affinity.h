@@ -0,0 +1,78 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+#define MAX_NUM_AFFINITY_CPUS 1024
+
+// the numa nodes and the cpus that belong to them are read from the node directories
+// under the sysfs root, threads are not pinned when the node directories are missing...
+#define AFFINITY_SYSFS_ROOT "/sys/devices/system"
+#define MAX_AFFINITY_PATH_SIZE 256
+#define MAX_AFFINITY_CPU_LIST_SIZE 4096
+
+/*
+ * Threads are pinned to the cpus the process may run on, ordered by numa node so
+ * neighbouring indices share a socket. The first reserved cpus are kept for the node's
+ * critical path: the network loop is pinned to the first of them and the network io
+ * and validation threads may run on the rest. Miner workers are each pinned to one of
+ * the remaining cpus, or to any cpu when none are reserved...
+ *
+ * Memory is placed on the node of the thread that first touches it, so threads are
+ * pinned on start before they allocate anything of their own.
+ */
+typedef enum ThreadAffinity
+{
+  THREAD_AFFINITY_NET_LOOP = 0,
+  THREAD_AFFINITY_CRITICAL,
+  THREAD_AFFINITY_MINER
+} thread_affinity_t;
+
+VULKAN_API void set_thread_affinity_enabled(int enabled);
+VULKAN_API int get_thread_affinity_enabled(void);
+
+VULKAN_API void set_num_reserved_cpus(uint16_t num_reserved_cpus);
+VULKAN_API uint16_t get_num_reserved_cpus(void);
+
+VULKAN_API void set_thread_affinity_sysfs_root(const char *sysfs_root);
+VULKAN_API const char* get_thread_affinity_sysfs_root(void);
+
+VULKAN_API uint16_t get_num_affinity_cpus(void);
+VULKAN_API uint16_t get_num_numa_nodes(void);
+
+VULKAN_API int parse_affinity_cpu_list(const char *cpu_list, uint16_t *cpus, uint16_t max_cpus, uint16_t *num_cpus_out);
+
+VULKAN_API int init_thread_affinity(void);
+VULKAN_API void deinit_thread_affinity(void);
+VULKAN_API int set_current_thread_affinity(thread_affinity_t affinity, uint32_t index);
+
+VULKAN_END_DECL
@@ -0,0 +1,141 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+// every allocation is aligned the same as malloc would align it
+#define ARENA_ALIGNMENT (_Alignof(max_align_t))
+#define ARENA_ALIGN(size) (((size) + (ARENA_ALIGNMENT - 1)) & ~(ARENA_ALIGNMENT - 1))
+#define ARENA_CHUNK_HEADER_SIZE ARENA_ALIGN(sizeof(arena_chunk_t))
+
+static arena_chunk_t* add_arena_chunk(arena_t *arena, size_t size)
+{
+  assert(arena != NULL);
+  size_t chunk_size = arena->chunk_size;
+  if (chunk_size < size)
+  {
+    chunk_size = size;
+  }
+
+  arena_chunk_t *chunk = malloc(ARENA_CHUNK_HEADER_SIZE + chunk_size);
+  if (chunk == NULL)
+  {
+    return NULL;
+  }
+
+  chunk->next = arena->chunk;
+  chunk->size = chunk_size;
+  chunk->used = 0;
+  arena->chunk = chunk;
+
+  if (arena->chunk_size < ARENA_MAX_CHUNK_SIZE)
+  {
+    arena->chunk_size *= 2;
+  }
+
+  return chunk;
+}
+
+arena_t* arena_init(size_t chunk_size)
+{
+  arena_t *arena = malloc(sizeof(arena_t));
+  if (arena == NULL)
+  {
+    return NULL;
+  }
+
+  arena->chunk = NULL;
+  arena->chunk_size = chunk_size > 0 ? ARENA_ALIGN(chunk_size) : ARENA_DEFAULT_CHUNK_SIZE;
+  arena->num_bytes = 0;
+  return arena;
+}
+
+/*
+ * Allocates memory out of the arena, the memory is only ever
+ * given back when the whole arena is free'd with arena_free.
+ */
+void* arena_alloc(arena_t *arena, size_t size)
+{
+  assert(arena != NULL);
+  size_t aligned_size = ARENA_ALIGN(size > 0 ? size : 1);
+  arena_chunk_t *chunk = arena->chunk;
+  if (chunk == NULL || chunk->size - chunk->used < aligned_size)
+  {
+    chunk = add_arena_chunk(arena, aligned_size);
+    if (chunk == NULL)
+    {
+      return NULL;
+    }
+  }
+
+  void *data = (uint8_t*)chunk + ARENA_CHUNK_HEADER_SIZE + chunk->used;
+  chunk->used += aligned_size;
+  arena->num_bytes += aligned_size;
+  return data;
+}
+
+void* arena_calloc(arena_t *arena, size_t num, size_t size)
+{
+  assert(arena != NULL);
+  if (size > 0 && num > SIZE_MAX / size)
+  {
+    return NULL;
+  }
+
+  void *data = arena_alloc(arena, num * size);
+  if (data == NULL)
+  {
+    return NULL;
+  }
+
+  memset(data, 0, num * size);
+  return data;
+}
+
+size_t arena_get_size(arena_t *arena)
+{
+  assert(arena != NULL);
+  return arena->num_bytes;
+}
+
+void arena_free(arena_t *arena)
+{
+  assert(arena != NULL);
+  arena_chunk_t *chunk = arena->chunk;
+  while (chunk != NULL)
+  {
+    arena_chunk_t *next_chunk = chunk->next;
+    free(chunk);
+    chunk = next_chunk;
+  }
+
+  free(arena);
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+// an arena hands out memory from a list of chunks which are all free'd at once, each
+// new chunk is twice the size of the last one up to the max chunk size. Allocations
+// bigger than a chunk get a chunk of their own...
+#define ARENA_DEFAULT_CHUNK_SIZE (16 * 1024)
+#define ARENA_MAX_CHUNK_SIZE (1024 * 1024)
+
+typedef struct ArenaChunk
+{
+  struct ArenaChunk *next;
+  size_t size;
+  size_t used;
+} arena_chunk_t;
+
+typedef struct Arena
+{
+  arena_chunk_t *chunk;
+  size_t chunk_size;
+  size_t num_bytes;
+} arena_t;
+
+VULKAN_API arena_t* arena_init(size_t chunk_size);
+VULKAN_API void* arena_alloc(arena_t *arena, size_t size);
+VULKAN_API void* arena_calloc(arena_t *arena, size_t num, size_t size);
+VULKAN_API size_t arena_get_size(arena_t *arena);
+VULKAN_API void arena_free(arena_t *arena);
+
+VULKAN_END_DECL
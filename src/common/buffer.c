@@ -31,6 +31,52 @@
 
 #include "byteorder.h"
 #include "buffer.h"
+#include "tinycthread.h"
+
+typedef struct BufferScratch
+{
+  buffer_t *buffers[BUFFER_MAX_SCRATCH_BUFFERS];
+  int num_buffers;
+} buffer_scratch_t;
+
+static tss_t g_buffer_scratch_key;
+static once_flag g_buffer_scratch_once = ONCE_FLAG_INIT;
+
+static void free_buffer_scratch(void *val)
+{
+  buffer_scratch_t *buffer_scratch = (buffer_scratch_t*)val;
+  if (buffer_scratch == NULL)
+  {
+    return;
+  }
+
+  for (int i = 0; i < buffer_scratch->num_buffers; i++)
+  {
+    buffer_free(buffer_scratch->buffers[i]);
+  }
+
+  free(buffer_scratch);
+}
+
+static void init_buffer_scratch_key(void)
+{
+  int r = tss_create(&g_buffer_scratch_key, free_buffer_scratch);
+  assert(r == thrd_success);
+}
+
+static buffer_scratch_t* get_buffer_scratch(void)
+{
+  call_once(&g_buffer_scratch_once, init_buffer_scratch_key);
+  buffer_scratch_t *buffer_scratch = (buffer_scratch_t*)tss_get(g_buffer_scratch_key);
+  if (buffer_scratch == NULL)
+  {
+    buffer_scratch = calloc(1, sizeof(buffer_scratch_t));
+    assert(buffer_scratch != NULL);
+    tss_set(g_buffer_scratch_key, buffer_scratch);
+  }
+
+  return buffer_scratch;
+}
 
 buffer_t* buffer_make(void)
 {
@@ -43,6 +89,7 @@ buffer_t* buffer_make(void)
   buffer->data = NULL;
   buffer->size = 0;
   buffer->offset = 0;
+  buffer->capacity = 0;
   return buffer;
 }
 
@@ -97,7 +144,7 @@ int buffer_set_data(buffer_t *buffer, const uint8_t *data, size_t size)
   assert(buffer != NULL);
   assert(data != NULL);
   assert(size > 0);
-  buffer_clear(buffer);
+  buffer_reset(buffer);
   return buffer_write(buffer, data, size);
 }
 
@@ -164,6 +211,18 @@ void buffer_clear(buffer_t *buffer)
 
   buffer->size = 0;
   buffer->offset = 0;
+  buffer->capacity = 0;
+}
+
+/*
+ * Empties the buffer but keeps it's allocation around, so the buffer
+ * can be written to again without having to grow it from scratch.
+ */
+void buffer_reset(buffer_t *buffer)
+{
+  assert(buffer != NULL);
+  buffer->size = 0;
+  buffer->offset = 0;
 }
 
 void buffer_free(buffer_t *buffer)
@@ -173,6 +232,68 @@ void buffer_free(buffer_t *buffer)
   free(buffer);
 }
 
+/*
+ * Returns an empty buffer from the current thread's scratch buffers, or a new buffer
+ * if there are none left. The buffer must be given back with buffer_release_scratch.
+ */
+buffer_t* buffer_acquire_scratch(void)
+{
+  buffer_scratch_t *buffer_scratch = get_buffer_scratch();
+  if (buffer_scratch->num_buffers == 0)
+  {
+    return buffer_init();
+  }
+
+  buffer_scratch->num_buffers--;
+  buffer_t *buffer = buffer_scratch->buffers[buffer_scratch->num_buffers];
+  buffer_scratch->buffers[buffer_scratch->num_buffers] = NULL;
+  return buffer;
+}
+
+void buffer_release_scratch(buffer_t *buffer)
+{
+  assert(buffer != NULL);
+  buffer_scratch_t *buffer_scratch = get_buffer_scratch();
+  if (buffer_scratch->num_buffers == BUFFER_MAX_SCRATCH_BUFFERS || buffer->capacity > BUFFER_MAX_SCRATCH_CAPACITY)
+  {
+    buffer_free(buffer);
+    return;
+  }
+
+  buffer_reset(buffer);
+  buffer_scratch->buffers[buffer_scratch->num_buffers] = buffer;
+  buffer_scratch->num_buffers++;
+}
+
+/*
+ * Makes sure the buffer's allocation can hold at least capacity bytes
+ * without changing the size of the buffer.
+ */
+int buffer_reserve(buffer_t *buffer, size_t capacity)
+{
+  assert(buffer != NULL);
+  if (buffer->capacity >= capacity)
+  {
+    return 0;
+  }
+
+  uint8_t *data = realloc(buffer->data, capacity);
+  if (data == NULL)
+  {
+    return 1;
+  }
+
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return 0;
+}
+
+size_t buffer_get_capacity(buffer_t *buffer)
+{
+  assert(buffer != NULL);
+  return buffer->capacity;
+}
+
 int buffer_resize(buffer_t *buffer, size_t size)
 {
   assert(buffer != NULL);
@@ -183,13 +304,24 @@ int buffer_resize(buffer_t *buffer, size_t size)
     return 0;
   }
 
-  buffer->data = realloc(buffer->data, buffer->size + size);
-  if (buffer->data == NULL)
+  // grow the allocation geometrically so that a series of small writes
+  // only reallocates the buffer a logarithmic number of times...
+  size_t new_size = buffer->size + size;
+  if (new_size > buffer->capacity)
   {
-    return 1;
+    size_t new_capacity = buffer->capacity > 0 ? buffer->capacity * 2 : BUFFER_MIN_CAPACITY;
+    if (new_capacity < new_size)
+    {
+      new_capacity = new_size;
+    }
+
+    if (buffer_reserve(buffer, new_capacity))
+    {
+      return 1;
+    }
   }
 
-  buffer->size += size;
+  buffer->size = new_size;
   return 0;
 }
 
@@ -322,6 +454,31 @@ int buffer_write_int64(buffer_t *buffer, int64_t value)
   return 0;
 }
 
+/*
+ * Writes the value 7 bits at a time starting with the lowest bits, the high bit of
+ * each byte is set when more bytes follow. Values below 128 take up a single byte...
+ */
+int buffer_write_varint(buffer_t *buffer, uint64_t value)
+{
+  assert(buffer != NULL);
+  uint8_t data[BUFFER_MAX_VARINT_SIZE];
+  size_t size = 0;
+  do
+  {
+    data[size] = (uint8_t)(value & 0x7f);
+    value >>= 7;
+    if (value > 0)
+    {
+      data[size] |= 0x80;
+    }
+
+    size++;
+  }
+  while (value > 0);
+
+  return buffer_write(buffer, data, size);
+}
+
 int buffer_write_bytes8(buffer_t *buffer, const uint8_t *bytes, uint8_t size)
 {
   assert(buffer != NULL);
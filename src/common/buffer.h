@@ -42,11 +42,21 @@ typedef enum BufferStringTypes
   BUFFER_STRING64
 } buffer_string_type_t;
 
+// the allocation of a buffer grows geometrically starting at the min capacity, scratch
+// buffers are kept per thread for reuse unless they grew past the max scratch capacity...
+#define BUFFER_MIN_CAPACITY 64
+#define BUFFER_MAX_SCRATCH_BUFFERS 4
+#define BUFFER_MAX_SCRATCH_CAPACITY (4 * 1024 * 1024)
+
+// the most bytes a 64 bit value takes up when written as a varint
+#define BUFFER_MAX_VARINT_SIZE 10
+
 typedef struct Buffer
 {
   uint8_t *data;
   size_t size;
   size_t offset;
+  size_t capacity;
 } buffer_t;
 
 VULKAN_API buffer_t* buffer_make(void);
@@ -68,8 +78,14 @@ VULKAN_API size_t buffer_get_offset(buffer_t *buffer);
 VULKAN_API int buffer_copy(buffer_t *buffer, buffer_t *other_buffer);
 VULKAN_API int buffer_compare(buffer_t *buffer, buffer_t *other_buffer);
 VULKAN_API void buffer_clear(buffer_t *buffer);
+VULKAN_API void buffer_reset(buffer_t *buffer);
 VULKAN_API void buffer_free(buffer_t *buffer);
 
+VULKAN_API buffer_t* buffer_acquire_scratch(void);
+VULKAN_API void buffer_release_scratch(buffer_t *buffer);
+
+VULKAN_API int buffer_reserve(buffer_t *buffer, size_t capacity);
+VULKAN_API size_t buffer_get_capacity(buffer_t *buffer);
 VULKAN_API int buffer_resize(buffer_t *buffer, size_t size);
 VULKAN_API int buffer_write(buffer_t *buffer, const uint8_t *data, size_t size);
 VULKAN_API int buffer_pad_data(buffer_t *buffer, size_t size);
@@ -86,6 +102,8 @@ VULKAN_API int buffer_write_int32(buffer_t *buffer, int32_t value);
 VULKAN_API int buffer_write_uint64(buffer_t *buffer, uint64_t value);
 VULKAN_API int buffer_write_int64(buffer_t *buffer, int64_t value);
 
+VULKAN_API int buffer_write_varint(buffer_t *buffer, uint64_t value);
+
 VULKAN_API int buffer_write_bytes8(buffer_t *buffer, const uint8_t *bytes, uint8_t size);
 VULKAN_API int buffer_write_string8(buffer_t *buffer, const char *string, uint8_t size);
 
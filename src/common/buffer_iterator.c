@@ -126,6 +126,25 @@ int buffer_read(buffer_iterator_t *buffer_iterator, size_t size, uint8_t **bytes
   return 0;
 }
 
+/*
+ * Same as buffer_read but copies the bytes into storage provided by the caller,
+ * used for reading fixed size fields without allocating them...
+ */
+int buffer_read_fixed(buffer_iterator_t *buffer_iterator, uint8_t *bytes, size_t size)
+{
+  assert(buffer_iterator != NULL);
+  assert(buffer_iterator->buffer != NULL);
+  assert(bytes != NULL);
+  if (buffer_get_remaining_size(buffer_iterator) < size)
+  {
+    return 1;
+  }
+
+  memcpy(bytes, buffer_iterator->buffer->data + buffer_iterator->offset, size);
+  buffer_iterator->offset += size;
+  return 0;
+}
+
 size_t buffer_get_remaining_size(buffer_iterator_t *buffer_iterator)
 {
   assert(buffer_iterator != NULL);
@@ -312,6 +331,49 @@ int buffer_read_int64(buffer_iterator_t *buffer_iterator, int64_t *value)
   return 0;
 }
 
+/*
+ * Reads a value written by buffer_write_varint, fails if the value is truncated, does
+ * not fit in 64 bits or has trailing zero groups so that every value has one encoding.
+ */
+int buffer_read_varint(buffer_iterator_t *buffer_iterator, uint64_t *value)
+{
+  assert(buffer_iterator != NULL);
+  assert(buffer_iterator->buffer != NULL);
+
+  const buffer_t *buffer = buffer_iterator->buffer;
+  size_t offset = buffer_iterator->offset;
+  uint64_t result = 0;
+  for (size_t i = 0; i < BUFFER_MAX_VARINT_SIZE; i++)
+  {
+    if (offset + i >= buffer->size)
+    {
+      return 1;
+    }
+
+    uint8_t byte = buffer->data[offset + i];
+    uint64_t group = byte & 0x7f;
+    if (i == BUFFER_MAX_VARINT_SIZE - 1 && group > 1)
+    {
+      return 1;
+    }
+
+    result |= group << (7 * i);
+    if ((byte & 0x80) == 0)
+    {
+      if (i > 0 && group == 0)
+      {
+        return 1;
+      }
+
+      buffer_iterator->offset = offset + i + 1;
+      *value = result;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
 int buffer_read_bytes8(buffer_iterator_t *buffer_iterator, uint8_t **bytes)
 {
   assert(buffer_iterator != NULL);
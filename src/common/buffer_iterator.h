@@ -54,6 +54,7 @@ VULKAN_API int buffer_iterator_compare(buffer_iterator_t *buffer_iterator, buffe
 VULKAN_API void buffer_iterator_clear(buffer_iterator_t *buffer_iterator);
 
 VULKAN_API int buffer_read(buffer_iterator_t *buffer_iterator, size_t size, uint8_t **bytes);
+VULKAN_API int buffer_read_fixed(buffer_iterator_t *buffer_iterator, uint8_t *bytes, size_t size);
 VULKAN_API size_t buffer_get_remaining_size(buffer_iterator_t *buffer_iterator);
 VULKAN_API const uint8_t* buffer_get_remaining_data(buffer_iterator_t *buffer_iterator);
 
@@ -69,6 +70,8 @@ VULKAN_API int buffer_read_int32(buffer_iterator_t *buffer_iterator, int32_t *va
 VULKAN_API uint64_t buffer_read_uint64(buffer_iterator_t *buffer_iterator, uint64_t *value);
 VULKAN_API int buffer_read_int64(buffer_iterator_t *buffer_iterator, int64_t *value);
 
+VULKAN_API int buffer_read_varint(buffer_iterator_t *buffer_iterator, uint64_t *value);
+
 VULKAN_API int buffer_read_bytes8(buffer_iterator_t *buffer_iterator, uint8_t **bytes);
 VULKAN_API int buffer_read_string8(buffer_iterator_t *buffer_iterator, char **string);
 
@@ -0,0 +1,174 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "buffer_pool.h"
+#include "tinycthread.h"
+
+// every allocation is prefixed with it's size class, so it can be released
+// without knowing it's size, the header keeps the data aligned for any type...
+typedef union BufferPoolHeader
+{
+  uint32_t size_class;
+  max_align_t align;
+} buffer_pool_header_t;
+
+static int g_buffer_pool_initialized = 0;
+static mtx_t g_buffer_pool_lock;
+
+static uint8_t *g_buffer_pool_free[BUFFER_POOL_NUM_CLASSES][BUFFER_POOL_MAX_FREE_PER_CLASS];
+static uint32_t g_buffer_pool_num_free[BUFFER_POOL_NUM_CLASSES];
+
+static uint32_t get_size_class(size_t size)
+{
+  uint32_t size_class = 0;
+  size_t class_size = BUFFER_POOL_MIN_CLASS_SIZE;
+  while (class_size < size && size_class < BUFFER_POOL_NUM_CLASSES)
+  {
+    class_size <<= 1;
+    size_class++;
+  }
+
+  return size_class;
+}
+
+int init_buffer_pool(void)
+{
+  if (g_buffer_pool_initialized)
+  {
+    return 1;
+  }
+
+  mtx_init(&g_buffer_pool_lock, mtx_plain);
+  memset(g_buffer_pool_num_free, 0, sizeof(g_buffer_pool_num_free));
+  g_buffer_pool_initialized = 1;
+  return 0;
+}
+
+int deinit_buffer_pool(void)
+{
+  if (g_buffer_pool_initialized == 0)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_buffer_pool_lock);
+  g_buffer_pool_initialized = 0;
+  for (uint32_t i = 0; i < BUFFER_POOL_NUM_CLASSES; i++)
+  {
+    for (uint32_t j = 0; j < g_buffer_pool_num_free[i]; j++)
+    {
+      free(g_buffer_pool_free[i][j]);
+    }
+
+    g_buffer_pool_num_free[i] = 0;
+  }
+
+  mtx_unlock(&g_buffer_pool_lock);
+  mtx_destroy(&g_buffer_pool_lock);
+  return 0;
+}
+
+/*
+ * Returns a buffer of at least size bytes, reusing a previously released buffer
+ * of the same size class when one is available. The buffer's contents are undefined.
+ */
+uint8_t* buffer_pool_acquire(size_t size)
+{
+  uint32_t size_class = get_size_class(size);
+  uint8_t *block = NULL;
+  if (g_buffer_pool_initialized && size_class < BUFFER_POOL_NUM_CLASSES)
+  {
+    mtx_lock(&g_buffer_pool_lock);
+    if (g_buffer_pool_num_free[size_class] > 0)
+    {
+      block = g_buffer_pool_free[size_class][--g_buffer_pool_num_free[size_class]];
+    }
+
+    mtx_unlock(&g_buffer_pool_lock);
+  }
+
+  if (block == NULL)
+  {
+    size_t block_size = size;
+    if (size_class < BUFFER_POOL_NUM_CLASSES)
+    {
+      block_size = (size_t)BUFFER_POOL_MIN_CLASS_SIZE << size_class;
+    }
+
+    block = malloc(sizeof(buffer_pool_header_t) + block_size);
+    assert(block != NULL);
+    ((buffer_pool_header_t*)block)->size_class = size_class;
+  }
+
+  return block + sizeof(buffer_pool_header_t);
+}
+
+void buffer_pool_release(uint8_t *data)
+{
+  if (data == NULL)
+  {
+    return;
+  }
+
+  uint8_t *block = data - sizeof(buffer_pool_header_t);
+  uint32_t size_class = ((buffer_pool_header_t*)block)->size_class;
+  if (g_buffer_pool_initialized && size_class < BUFFER_POOL_NUM_CLASSES)
+  {
+    mtx_lock(&g_buffer_pool_lock);
+    if (g_buffer_pool_num_free[size_class] < BUFFER_POOL_MAX_FREE_PER_CLASS)
+    {
+      g_buffer_pool_free[size_class][g_buffer_pool_num_free[size_class]++] = block;
+      block = NULL;
+    }
+
+    mtx_unlock(&g_buffer_pool_lock);
+  }
+
+  free(block);
+}
+
+size_t get_buffer_pool_num_free(void)
+{
+  size_t num_free = 0;
+  if (g_buffer_pool_initialized == 0)
+  {
+    return 0;
+  }
+
+  mtx_lock(&g_buffer_pool_lock);
+  for (uint32_t i = 0; i < BUFFER_POOL_NUM_CLASSES; i++)
+  {
+    num_free += g_buffer_pool_num_free[i];
+  }
+
+  mtx_unlock(&g_buffer_pool_lock);
+  return num_free;
+}
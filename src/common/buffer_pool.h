@@ -0,0 +1,50 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+// size classes are powers of two from the min class size up to the max class size,
+// larger allocations are never kept in the pool and go straight to the allocator...
+#define BUFFER_POOL_MIN_CLASS_SIZE 64
+#define BUFFER_POOL_NUM_CLASSES 16
+#define BUFFER_POOL_MAX_CLASS_SIZE (BUFFER_POOL_MIN_CLASS_SIZE << (BUFFER_POOL_NUM_CLASSES - 1))
+#define BUFFER_POOL_MAX_FREE_PER_CLASS 32
+
+VULKAN_API int init_buffer_pool(void);
+VULKAN_API int deinit_buffer_pool(void);
+
+VULKAN_API uint8_t* buffer_pool_acquire(size_t size);
+VULKAN_API void buffer_pool_release(uint8_t *data);
+
+VULKAN_API size_t get_buffer_pool_num_free(void);
+
+VULKAN_END_DECL
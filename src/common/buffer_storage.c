@@ -66,6 +66,18 @@ const char* buffer_storage_get_mode(buffer_storage_t *buffer_storage)
 
 buffer_storage_t* buffer_storage_open(const char *filepath, char **err)
 {
+  return buffer_storage_open_mode(filepath, "ab+", err);
+}
+
+/*
+ * Opens the buffer database with the given fopen mode, files which are
+ * rewritten as a whole should be opened with "wb" since appending
+ * writes ignore the seek done before writing the buffer...
+ */
+buffer_storage_t* buffer_storage_open_mode(const char *filepath, const char *mode, char **err)
+{
+  assert(filepath != NULL);
+  assert(mode != NULL);
   buffer_storage_t *buffer_storage = buffer_storage_make();
   if (buffer_storage == NULL)
   {
@@ -74,9 +86,11 @@ buffer_storage_t* buffer_storage_open(const char *filepath, char **err)
   }
 
   // open the file for reading and writing bytes
+  buffer_storage_set_mode(buffer_storage, mode);
   buffer_storage->fp = fopen(filepath, buffer_storage->mode);
   if (buffer_storage->fp == NULL)
   {
+    buffer_storage_free(buffer_storage);
     *err = "Failed to open buffer database!";
     return NULL;
   }
@@ -160,16 +174,25 @@ int buffer_storage_read_buffer(buffer_storage_t *buffer_storage, buffer_t **buff
   size_t data_len = ftell(buffer_storage->fp);
   fseek(buffer_storage->fp, 0L, SEEK_SET);
 
-  // read the bytes from disk and place them into a buffer
-  uint8_t data[data_len];
+  // read the bytes from disk and place them into a buffer, the bytes are read
+  // onto the heap since the database can be far larger than the stack...
+  uint8_t *data = malloc(data_len > 0 ? data_len : 1);
+  if (data == NULL)
+  {
+    *err = "Failed to read buffer database, could not allocate sufficient memory!";
+    return 1;
+  }
+
   size_t bytes_read = fread(data, 1, data_len, buffer_storage->fp);
   if (bytes_read != data_len)
   {
+    free(data);
     *err = "Failed to read buffer database, did not read all bytes!";
     return 1;
   }
 
   fseek(buffer_storage->fp, 0L, SEEK_SET);
   *buffer_out = buffer_init_data(0, data, data_len);
+  free(data);
   return 0;
 }
@@ -49,6 +49,7 @@ VULKAN_API void buffer_storage_set_mode(buffer_storage_t *buffer_storage, const
 VULKAN_API const char* buffer_storage_get_mode(buffer_storage_t *buffer_storage);
 
 VULKAN_API buffer_storage_t* buffer_storage_open(const char *filepath, char **err);
+VULKAN_API buffer_storage_t* buffer_storage_open_mode(const char *filepath, const char *mode, char **err);
 VULKAN_API int buffer_storage_close(buffer_storage_t *buffer_storage);
 VULKAN_API int buffer_storage_remove(const char *filepath, char **err);
 
@@ -0,0 +1,165 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef USE_NET_COMPRESSION
+#include <zlib.h>
+#endif
+
+#include "buffer_pool.h"
+#include "compression.h"
+
+int get_compression_supported(void)
+{
+#ifdef USE_NET_COMPRESSION
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+size_t get_compress_bound(size_t size)
+{
+#ifdef USE_NET_COMPRESSION
+  return compressBound(size);
+#else
+  return size;
+#endif
+}
+
+/*
+ * Compresses the data into out, which must be at least get_compress_bound(size) bytes,
+ * out_size is set to the size of the compressed data.
+ */
+int compress_data(uint8_t *out, size_t *out_size, const uint8_t *data, size_t size)
+{
+  assert(out != NULL);
+  assert(out_size != NULL);
+  assert(data != NULL);
+#ifdef USE_NET_COMPRESSION
+  uLongf compressed_size = compressBound(size);
+  if (compress2(out, &compressed_size, data, size, Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    return 1;
+  }
+
+  *out_size = compressed_size;
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+/*
+ * Decompresses the data into out, the data must decompress
+ * to exactly out_size bytes for it to be considered valid.
+ */
+int decompress_data(uint8_t *out, size_t out_size, const uint8_t *data, size_t size)
+{
+  assert(out != NULL);
+  assert(data != NULL);
+#ifdef USE_NET_COMPRESSION
+  uLongf decompressed_size = out_size;
+  if (uncompress(out, &decompressed_size, data, size) != Z_OK || decompressed_size != out_size)
+  {
+    return 1;
+  }
+
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+/*
+ * Same as decompress_data, but decompresses into a buffer acquired from the buffer pool,
+ * which starts small and grows as the data inflates instead of being allocated by out_size.
+ * Data which claims a large decompressed size but never inflates to it is rejected before
+ * that size is ever allocated, the buffer is released with buffer_pool_release.
+ */
+int decompress_data_pooled(uint8_t **out, size_t out_size, const uint8_t *data, size_t size)
+{
+  assert(out != NULL);
+  assert(data != NULL);
+#ifdef USE_NET_COMPRESSION
+  if (out_size == 0)
+  {
+    return 1;
+  }
+
+  z_stream stream = {0};
+  if (inflateInit(&stream) != Z_OK)
+  {
+    return 1;
+  }
+
+  size_t capacity = out_size < DECOMPRESS_INITIAL_SIZE ? out_size : DECOMPRESS_INITIAL_SIZE;
+  uint8_t *out_data = buffer_pool_acquire(capacity);
+  stream.next_in = (Bytef*)data;
+  stream.avail_in = size;
+  stream.next_out = out_data;
+  stream.avail_out = capacity;
+
+  int result = Z_OK;
+  while ((result = inflate(&stream, Z_NO_FLUSH)) != Z_STREAM_END)
+  {
+    // the data either ran out before the end of the stream, or inflates past out_size
+    if ((result != Z_OK && result != Z_BUF_ERROR) || stream.avail_out > 0 || capacity == out_size)
+    {
+      goto decompress_fail;
+    }
+
+    size_t new_capacity = capacity * 2 < out_size ? capacity * 2 : out_size;
+    uint8_t *new_out_data = buffer_pool_acquire(new_capacity);
+    memcpy(new_out_data, out_data, capacity);
+    buffer_pool_release(out_data);
+
+    out_data = new_out_data;
+    stream.next_out = out_data + capacity;
+    stream.avail_out = new_capacity - capacity;
+    capacity = new_capacity;
+  }
+
+  if (stream.total_out != out_size)
+  {
+    goto decompress_fail;
+  }
+
+  inflateEnd(&stream);
+  *out = out_data;
+  return 0;
+
+decompress_fail:
+  inflateEnd(&stream);
+  buffer_pool_release(out_data);
+  return 1;
+#else
+  return 1;
+#endif
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+// the size a pooled decompression buffer starts at before it grows with the data
+#define DECOMPRESS_INITIAL_SIZE (1024 * 64)
+
+// the most a deflate stream can expand it's data by, see zlib's technical details
+#define DECOMPRESS_MAX_RATIO 1032
+
+// compression is only available when built with zlib, see WITH_NET_COMPRESSION
+VULKAN_API int get_compression_supported(void);
+
+VULKAN_API size_t get_compress_bound(size_t size);
+VULKAN_API int compress_data(uint8_t *out, size_t *out_size, const uint8_t *data, size_t size);
+VULKAN_API int decompress_data(uint8_t *out, size_t out_size, const uint8_t *data, size_t size);
+VULKAN_API int decompress_data_pooled(uint8_t **out, size_t out_size, const uint8_t *data, size_t size);
+
+VULKAN_END_DECL
@@ -0,0 +1,684 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "json.h"
+
+typedef struct JsonParser
+{
+  const char *data;
+  size_t size;
+  size_t offset;
+  int depth;
+} json_parser_t;
+
+static json_value_t* parse_json_value(json_parser_t *parser);
+
+static json_value_t* make_json_value(json_type_t type)
+{
+  json_value_t *value = malloc(sizeof(json_value_t));
+  assert(value != NULL);
+  value->type = type;
+  value->boolean = 0;
+  value->string = NULL;
+  value->string_size = 0;
+  value->values = NULL;
+  value->keys = NULL;
+  value->num_values = 0;
+  return value;
+}
+
+void free_json_value(json_value_t *value)
+{
+  if (value == NULL)
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < value->num_values; i++)
+  {
+    free_json_value(value->values[i]);
+    if (value->keys != NULL)
+    {
+      free(value->keys[i]);
+    }
+  }
+
+  free(value->values);
+  free(value->keys);
+  free(value->string);
+  free(value);
+}
+
+static void skip_json_whitespace(json_parser_t *parser)
+{
+  while (parser->offset < parser->size)
+  {
+    char c = parser->data[parser->offset];
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+    {
+      break;
+    }
+
+    parser->offset++;
+  }
+}
+
+static int consume_json_literal(json_parser_t *parser, const char *literal)
+{
+  size_t literal_size = strlen(literal);
+  if (parser->size - parser->offset < literal_size || memcmp(parser->data + parser->offset, literal, literal_size) != 0)
+  {
+    return 1;
+  }
+
+  parser->offset += literal_size;
+  return 0;
+}
+
+static int parse_json_hex4(json_parser_t *parser, uint32_t *code_point)
+{
+  if (parser->size - parser->offset < 4)
+  {
+    return 1;
+  }
+
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    char c = parser->data[parser->offset++];
+    value <<= 4;
+    if (c >= '0' && c <= '9')
+    {
+      value |= (uint32_t)(c - '0');
+    }
+    else if (c >= 'a' && c <= 'f')
+    {
+      value |= (uint32_t)(c - 'a' + 10);
+    }
+    else if (c >= 'A' && c <= 'F')
+    {
+      value |= (uint32_t)(c - 'A' + 10);
+    }
+    else
+    {
+      return 1;
+    }
+  }
+
+  *code_point = value;
+  return 0;
+}
+
+static size_t encode_utf8(char *output, uint32_t code_point)
+{
+  if (code_point < 0x80)
+  {
+    output[0] = (char)code_point;
+    return 1;
+  }
+  else if (code_point < 0x800)
+  {
+    output[0] = (char)(0xC0 | (code_point >> 6));
+    output[1] = (char)(0x80 | (code_point & 0x3F));
+    return 2;
+  }
+  else if (code_point < 0x10000)
+  {
+    output[0] = (char)(0xE0 | (code_point >> 12));
+    output[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+    output[2] = (char)(0x80 | (code_point & 0x3F));
+    return 3;
+  }
+
+  output[0] = (char)(0xF0 | (code_point >> 18));
+  output[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+  output[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+  output[3] = (char)(0x80 | (code_point & 0x3F));
+  return 4;
+}
+
+/*
+ * Parses a string starting at it's opening quote, the unescaped string is never longer
+ * than it's escaped form so it's decoded into an allocation of that size.
+ */
+static char* parse_json_string(json_parser_t *parser, size_t *string_size)
+{
+  assert(parser->data[parser->offset] == '"');
+  parser->offset++;
+
+  size_t start = parser->offset;
+  while (parser->offset < parser->size && parser->data[parser->offset] != '"')
+  {
+    parser->offset += parser->data[parser->offset] == '\\' ? 2 : 1;
+  }
+
+  if (parser->offset >= parser->size)
+  {
+    return NULL;
+  }
+
+  size_t end = parser->offset;
+  parser->offset = start;
+
+  char *string = malloc(end - start + 1);
+  assert(string != NULL);
+  size_t size = 0;
+  while (parser->offset < end)
+  {
+    char c = parser->data[parser->offset++];
+    if ((unsigned char)c < 0x20)
+    {
+      goto parse_string_fail;
+    }
+
+    if (c != '\\')
+    {
+      string[size++] = c;
+      continue;
+    }
+
+    char escape = parser->data[parser->offset++];
+    switch (escape)
+    {
+      case '"': string[size++] = '"'; break;
+      case '\\': string[size++] = '\\'; break;
+      case '/': string[size++] = '/'; break;
+      case 'b': string[size++] = '\b'; break;
+      case 'f': string[size++] = '\f'; break;
+      case 'n': string[size++] = '\n'; break;
+      case 'r': string[size++] = '\r'; break;
+      case 't': string[size++] = '\t'; break;
+      case 'u':
+        {
+          uint32_t code_point = 0;
+          if (parse_json_hex4(parser, &code_point))
+          {
+            goto parse_string_fail;
+          }
+
+          // combine surrogate pairs, a lone surrogate is kept as is
+          if (code_point >= 0xD800 && code_point <= 0xDBFF && end - parser->offset >= 6 &&
+            parser->data[parser->offset] == '\\' && parser->data[parser->offset + 1] == 'u')
+          {
+            size_t offset = parser->offset;
+            uint32_t low_surrogate = 0;
+            parser->offset += 2;
+            if (parse_json_hex4(parser, &low_surrogate) == 0 && low_surrogate >= 0xDC00 && low_surrogate <= 0xDFFF)
+            {
+              code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low_surrogate - 0xDC00);
+            }
+            else
+            {
+              parser->offset = offset;
+            }
+          }
+
+          // every escape is at least as long as the code point it encodes
+          size += encode_utf8(string + size, code_point);
+        }
+        break;
+      default:
+        goto parse_string_fail;
+    }
+  }
+
+  // skip the closing quote
+  parser->offset = end + 1;
+  string[size] = '\0';
+  *string_size = size;
+  return string;
+
+parse_string_fail:
+  free(string);
+  return NULL;
+}
+
+static json_value_t* parse_json_number(json_parser_t *parser)
+{
+  size_t start = parser->offset;
+  if (parser->offset < parser->size && parser->data[parser->offset] == '-')
+  {
+    parser->offset++;
+  }
+
+  size_t num_digits = 0;
+  while (parser->offset < parser->size)
+  {
+    char c = parser->data[parser->offset];
+    if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+    {
+      num_digits += (c >= '0' && c <= '9');
+      parser->offset++;
+      continue;
+    }
+
+    break;
+  }
+
+  size_t size = parser->offset - start;
+  char first = parser->data[start];
+  if (num_digits == 0 || (first != '-' && (first < '0' || first > '9')))
+  {
+    return NULL;
+  }
+
+  json_value_t *value = make_json_value(JSON_TYPE_NUMBER);
+  value->string = malloc(size + 1);
+  assert(value->string != NULL);
+  memcpy(value->string, parser->data + start, size);
+  value->string[size] = '\0';
+  value->string_size = size;
+
+  // the characters were only gathered loosely, make sure they form a single number
+  char *end = NULL;
+  strtod(value->string, &end);
+  if (end != value->string + size)
+  {
+    free_json_value(value);
+    return NULL;
+  }
+
+  return value;
+}
+
+static int add_json_value(json_value_t *parent, json_value_t *value, char *key)
+{
+  parent->values = realloc(parent->values, sizeof(json_value_t*) * (parent->num_values + 1));
+  assert(parent->values != NULL);
+  if (parent->type == JSON_TYPE_OBJECT)
+  {
+    parent->keys = realloc(parent->keys, sizeof(char*) * (parent->num_values + 1));
+    assert(parent->keys != NULL);
+    parent->keys[parent->num_values] = key;
+  }
+
+  parent->values[parent->num_values++] = value;
+  return 0;
+}
+
+static json_value_t* parse_json_container(json_parser_t *parser, json_type_t type)
+{
+  char closing = type == JSON_TYPE_ARRAY ? ']' : '}';
+  parser->offset++;
+  if (++parser->depth > JSON_MAX_DEPTH)
+  {
+    return NULL;
+  }
+
+  json_value_t *container = make_json_value(type);
+  skip_json_whitespace(parser);
+  if (parser->offset < parser->size && parser->data[parser->offset] == closing)
+  {
+    parser->offset++;
+    parser->depth--;
+    return container;
+  }
+
+  while (1)
+  {
+    char *key = NULL;
+    if (type == JSON_TYPE_OBJECT)
+    {
+      skip_json_whitespace(parser);
+      size_t key_size = 0;
+      if (parser->offset >= parser->size || parser->data[parser->offset] != '"' ||
+        (key = parse_json_string(parser, &key_size)) == NULL)
+      {
+        goto parse_container_fail;
+      }
+
+      skip_json_whitespace(parser);
+      if (parser->offset >= parser->size || parser->data[parser->offset] != ':')
+      {
+        free(key);
+        goto parse_container_fail;
+      }
+
+      parser->offset++;
+    }
+
+    json_value_t *value = parse_json_value(parser);
+    if (value == NULL)
+    {
+      free(key);
+      goto parse_container_fail;
+    }
+
+    add_json_value(container, value, key);
+    skip_json_whitespace(parser);
+    if (parser->offset >= parser->size)
+    {
+      goto parse_container_fail;
+    }
+
+    char c = parser->data[parser->offset++];
+    if (c == closing)
+    {
+      break;
+    }
+    else if (c != ',')
+    {
+      goto parse_container_fail;
+    }
+  }
+
+  parser->depth--;
+  return container;
+
+parse_container_fail:
+  free_json_value(container);
+  return NULL;
+}
+
+static json_value_t* parse_json_value(json_parser_t *parser)
+{
+  skip_json_whitespace(parser);
+  if (parser->offset >= parser->size)
+  {
+    return NULL;
+  }
+
+  char c = parser->data[parser->offset];
+  switch (c)
+  {
+    case '{':
+      return parse_json_container(parser, JSON_TYPE_OBJECT);
+    case '[':
+      return parse_json_container(parser, JSON_TYPE_ARRAY);
+    case '"':
+      {
+        size_t string_size = 0;
+        char *string = parse_json_string(parser, &string_size);
+        if (string == NULL)
+        {
+          return NULL;
+        }
+
+        json_value_t *value = make_json_value(JSON_TYPE_STRING);
+        value->string = string;
+        value->string_size = string_size;
+        return value;
+      }
+    case 't':
+    case 'f':
+      {
+        int boolean = c == 't';
+        if (consume_json_literal(parser, boolean ? "true" : "false"))
+        {
+          return NULL;
+        }
+
+        json_value_t *value = make_json_value(JSON_TYPE_BOOL);
+        value->boolean = boolean;
+        return value;
+      }
+    case 'n':
+      if (consume_json_literal(parser, "null"))
+      {
+        return NULL;
+      }
+
+      return make_json_value(JSON_TYPE_NULL);
+    default:
+      return parse_json_number(parser);
+  }
+}
+
+/*
+ * Parses a single json document, returns NULL if the data is not valid json
+ * or has anything but whitespace after the document. Later to be free'd with `free_json_value`.
+ */
+json_value_t* parse_json(const char *data, size_t data_size)
+{
+  assert(data != NULL);
+  json_parser_t parser;
+  parser.data = data;
+  parser.size = data_size;
+  parser.offset = 0;
+  parser.depth = 0;
+
+  json_value_t *value = parse_json_value(&parser);
+  if (value == NULL)
+  {
+    return NULL;
+  }
+
+  skip_json_whitespace(&parser);
+  if (parser.offset != parser.size)
+  {
+    free_json_value(value);
+    return NULL;
+  }
+
+  return value;
+}
+
+json_value_t* get_json_object_value(json_value_t *object, const char *key)
+{
+  assert(key != NULL);
+  if (object == NULL || object->type != JSON_TYPE_OBJECT)
+  {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < object->num_values; i++)
+  {
+    if (strcmp(object->keys[i], key) == 0)
+    {
+      return object->values[i];
+    }
+  }
+
+  return NULL;
+}
+
+int get_json_uint64(json_value_t *value, uint64_t *result)
+{
+  assert(result != NULL);
+  if (value == NULL || value->type != JSON_TYPE_NUMBER || value->string_size == 0 || value->string_size > 20)
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < value->string_size; i++)
+  {
+    if (value->string[i] < '0' || value->string[i] > '9')
+    {
+      return 1;
+    }
+  }
+
+  // twenty digits still overflow past the max uint64, which strtoull clamps to
+  char *end = NULL;
+  errno = 0;
+  unsigned long long number = strtoull(value->string, &end, 10);
+  if (errno == ERANGE || end != value->string + value->string_size)
+  {
+    return 1;
+  }
+
+  *result = (uint64_t)number;
+  return 0;
+}
+
+int json_write_raw(buffer_t *buffer, const char *data, size_t size)
+{
+  assert(buffer != NULL);
+  if (size == 0)
+  {
+    return 0;
+  }
+
+  return buffer_write(buffer, (const uint8_t*)data, size);
+}
+
+int json_write_format(buffer_t *buffer, const char *format, ...)
+{
+  assert(buffer != NULL);
+  char data[256];
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(data, sizeof(data), format, args);
+  va_end(args);
+  if (size < 0 || size >= (int)sizeof(data))
+  {
+    return 1;
+  }
+
+  return json_write_raw(buffer, data, (size_t)size);
+}
+
+int json_write_string(buffer_t *buffer, const char *string, size_t size)
+{
+  assert(buffer != NULL);
+  assert(string != NULL);
+  if (json_write_raw(buffer, "\"", 1))
+  {
+    return 1;
+  }
+
+  size_t start = 0;
+  for (size_t i = 0; i < size; i++)
+  {
+    unsigned char c = (unsigned char)string[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+    {
+      continue;
+    }
+
+    if (json_write_raw(buffer, string + start, i - start))
+    {
+      return 1;
+    }
+
+    char escape[8];
+    int escape_size = 0;
+    switch (c)
+    {
+      case '"': escape_size = snprintf(escape, sizeof(escape), "\\\""); break;
+      case '\\': escape_size = snprintf(escape, sizeof(escape), "\\\\"); break;
+      case '\n': escape_size = snprintf(escape, sizeof(escape), "\\n"); break;
+      case '\r': escape_size = snprintf(escape, sizeof(escape), "\\r"); break;
+      case '\t': escape_size = snprintf(escape, sizeof(escape), "\\t"); break;
+      default: escape_size = snprintf(escape, sizeof(escape), "\\u%04x", c); break;
+    }
+
+    if (json_write_raw(buffer, escape, (size_t)escape_size))
+    {
+      return 1;
+    }
+
+    start = i + 1;
+  }
+
+  if (json_write_raw(buffer, string + start, size - start))
+  {
+    return 1;
+  }
+
+  return json_write_raw(buffer, "\"", 1);
+}
+
+int json_write_hex(buffer_t *buffer, const uint8_t *data, size_t size)
+{
+  assert(buffer != NULL);
+  static const char hex_digits[] = "0123456789abcdef";
+  if (json_write_raw(buffer, "\"", 1))
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < size; i++)
+  {
+    char digits[2] = {hex_digits[data[i] >> 4], hex_digits[data[i] & 0x0F]};
+    if (json_write_raw(buffer, digits, 2))
+    {
+      return 1;
+    }
+  }
+
+  return json_write_raw(buffer, "\"", 1);
+}
+
+int json_write_value(buffer_t *buffer, json_value_t *value)
+{
+  assert(buffer != NULL);
+  if (value == NULL)
+  {
+    return json_write_raw(buffer, "null", 4);
+  }
+
+  switch (value->type)
+  {
+    case JSON_TYPE_NULL:
+      return json_write_raw(buffer, "null", 4);
+    case JSON_TYPE_BOOL:
+      return value->boolean ? json_write_raw(buffer, "true", 4) : json_write_raw(buffer, "false", 5);
+    case JSON_TYPE_NUMBER:
+      return json_write_raw(buffer, value->string, value->string_size);
+    case JSON_TYPE_STRING:
+      return json_write_string(buffer, value->string, value->string_size);
+    case JSON_TYPE_ARRAY:
+    case JSON_TYPE_OBJECT:
+      {
+        int is_object = value->type == JSON_TYPE_OBJECT;
+        if (json_write_raw(buffer, is_object ? "{" : "[", 1))
+        {
+          return 1;
+        }
+
+        for (size_t i = 0; i < value->num_values; i++)
+        {
+          if (i > 0 && json_write_raw(buffer, ",", 1))
+          {
+            return 1;
+          }
+
+          if (is_object && (json_write_string(buffer, value->keys[i], strlen(value->keys[i])) || json_write_raw(buffer, ":", 1)))
+          {
+            return 1;
+          }
+
+          if (json_write_value(buffer, value->values[i]))
+          {
+            return 1;
+          }
+        }
+
+        return json_write_raw(buffer, is_object ? "}" : "]", 1);
+      }
+    default:
+      return 1;
+  }
+}
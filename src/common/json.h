@@ -0,0 +1,77 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "buffer.h"
+#include "vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+#define JSON_MAX_DEPTH 32
+
+typedef enum JsonType
+{
+  JSON_TYPE_NULL = 0,
+  JSON_TYPE_BOOL,
+  JSON_TYPE_NUMBER,
+  JSON_TYPE_STRING,
+  JSON_TYPE_ARRAY,
+  JSON_TYPE_OBJECT
+} json_type_t;
+
+/*
+ * A parsed json value, numbers keep their text as it was written so
+ * they can be written back out unchanged and read without rounding.
+ */
+typedef struct JsonValue
+{
+  json_type_t type;
+  int boolean;
+  char *string;
+  size_t string_size;
+
+  // the values of an array, or the values of an object along with their keys
+  struct JsonValue **values;
+  char **keys;
+  size_t num_values;
+} json_value_t;
+
+VULKAN_API json_value_t* parse_json(const char *data, size_t data_size);
+VULKAN_API void free_json_value(json_value_t *value);
+
+VULKAN_API json_value_t* get_json_object_value(json_value_t *object, const char *key);
+VULKAN_API int get_json_uint64(json_value_t *value, uint64_t *result);
+
+VULKAN_API int json_write_raw(buffer_t *buffer, const char *data, size_t size);
+VULKAN_API int json_write_format(buffer_t *buffer, const char *format, ...);
+VULKAN_API int json_write_string(buffer_t *buffer, const char *string, size_t size);
+VULKAN_API int json_write_hex(buffer_t *buffer, const uint8_t *data, size_t size);
+VULKAN_API int json_write_value(buffer_t *buffer, json_value_t *value);
+
+VULKAN_END_DECL
@@ -23,20 +23,259 @@
 // You should have received a copy of the MIT License
 // along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <stdatomic.h>
 
 #include "tinycthread.h"
 #include "logger.h"
 
+typedef struct LoggerMessage
+{
+  atomic_size_t sequence;
+  logger_level_t level;
+  uint8_t quiet;
+  time_t timestamp;
+  const char *file;
+  int line;
+  char message[LOGGER_MAX_MESSAGE_SIZE];
+} logger_message_t;
+
 static int g_logger_is_open = 0;
-static logger_t g_logger;
+static logger_t g_logger = {.level = LOG_LEVEL_FATAL};
 static const char* g_logger_log_filename = NULL;
 
+// the module levels are meant to be set while starting up, they are read without the
+// logger lock. The most verbose level of the logger and all modules lets a message
+// be skipped without looking up the module it is logged from...
+static logger_module_t g_logger_modules[LOGGER_MAX_MODULES];
+static int g_logger_num_modules = 0;
+static logger_level_t g_logger_max_level = LOG_LEVEL_FATAL;
+
+// a bounded multi-producer ring of log messages, producers claim a slot by moving
+// the tail forward and publish it by bumping the slot's sequence, the messages are
+// consumed from the head by whoever holds the logger lock...
+static logger_message_t *g_logger_ring = NULL;
+static atomic_size_t g_logger_ring_tail;
+static atomic_size_t g_logger_ring_head;
+static atomic_uint_fast64_t g_logger_num_dropped_messages;
+static uint64_t g_logger_num_reported_dropped_messages = 0;
+
+static thrd_t g_logger_async_thread;
+static mtx_t g_logger_async_lock;
+static cnd_t g_logger_async_cond;
+static int g_logger_async_running = 0;
+
+static void write_log_message(logger_level_t level, uint8_t quiet, time_t timestamp, const char *file, int line, const char *message)
+{
+  struct tm *lt = localtime(&timestamp);
+  if (quiet == 0)
+  {
+    char buf[16];
+    buf[strftime(buf, sizeof(buf), "%H:%M:%S", lt)] = '\0';
+#ifdef LOG_USE_COLOR
+    fprintf(stderr, "%s %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m %s\n", buf, LOGGING_LEVEL_COLORS[level], LOGGING_LEVEL_NAMES[level], file, line, message);
+#else
+    fprintf(stderr, "%s %-5s %s:%d: %s\n", buf, LOGGING_LEVEL_NAMES[level], file, line, message);
+#endif
+  }
+
+  if (g_logger.fp)
+  {
+    char buf[32];
+    buf[strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", lt)] = '\0';
+    fprintf(g_logger.fp, "%s %-5s %s:%d: %s\n", buf, LOGGING_LEVEL_NAMES[level], file, line, message);
+  }
+}
+
+static int push_log_message(logger_level_t level, uint8_t quiet, const char *file, int line, const char *fmt, va_list args)
+{
+  size_t position = atomic_load_explicit(&g_logger_ring_tail, memory_order_relaxed);
+  logger_message_t *logger_message = NULL;
+  while (1)
+  {
+    logger_message = &g_logger_ring[position & (LOGGER_ASYNC_RING_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&logger_message->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&g_logger_ring_tail, &position, position + 1,
+        memory_order_relaxed, memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (diff < 0)
+    {
+      // the ring is full, drop the message rather than block the caller
+      atomic_fetch_add_explicit(&g_logger_num_dropped_messages, 1, memory_order_relaxed);
+      return 1;
+    }
+    else
+    {
+      position = atomic_load_explicit(&g_logger_ring_tail, memory_order_relaxed);
+    }
+  }
+
+  logger_message->level = level;
+  logger_message->quiet = quiet;
+  logger_message->timestamp = time(NULL);
+  logger_message->file = file;
+  logger_message->line = line;
+  vsnprintf(logger_message->message, sizeof(logger_message->message), fmt, args);
+  atomic_store_explicit(&logger_message->sequence, position + 1, memory_order_release);
+
+  // wake up the logger thread early once the ring is half full
+  size_t head = atomic_load_explicit(&g_logger_ring_head, memory_order_relaxed);
+  if (position - head >= LOGGER_ASYNC_RING_SIZE / 2)
+  {
+    cnd_signal(&g_logger_async_cond);
+  }
+
+  return 0;
+}
+
+/*
+ * Writes out the published messages on the ring along with a warning if any messages
+ * were dropped since the last time, then flushes the outputs. The caller must hold the
+ * logger lock so there is only ever one consumer of the ring...
+ */
+static int drain_log_messages_nolock(void)
+{
+  int num_messages = 0;
+  size_t head = atomic_load_explicit(&g_logger_ring_head, memory_order_relaxed);
+  while (1)
+  {
+    logger_message_t *logger_message = &g_logger_ring[head & (LOGGER_ASYNC_RING_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&logger_message->sequence, memory_order_acquire);
+    if (sequence != head + 1)
+    {
+      break;
+    }
+
+    write_log_message(logger_message->level, logger_message->quiet, logger_message->timestamp,
+      logger_message->file, logger_message->line, logger_message->message);
+
+    atomic_store_explicit(&logger_message->sequence, head + LOGGER_ASYNC_RING_SIZE, memory_order_release);
+    head++;
+    atomic_store_explicit(&g_logger_ring_head, head, memory_order_relaxed);
+    num_messages++;
+  }
+
+  uint64_t num_dropped_messages = atomic_load_explicit(&g_logger_num_dropped_messages, memory_order_relaxed);
+  if (num_dropped_messages > g_logger_num_reported_dropped_messages)
+  {
+    char message[64];
+    snprintf(message, sizeof(message), "Dropped %llu log messages, the log ring was full!",
+      (unsigned long long)(num_dropped_messages - g_logger_num_reported_dropped_messages));
+
+    write_log_message(LOG_LEVEL_WARNING, g_logger.quiet, time(NULL), __FILE__, __LINE__, message);
+    g_logger_num_reported_dropped_messages = num_dropped_messages;
+    num_messages++;
+  }
+
+  if (num_messages > 0)
+  {
+    fflush(stderr);
+    if (g_logger.fp)
+    {
+      fflush(g_logger.fp);
+    }
+  }
+
+  return num_messages;
+}
+
+static int logger_async_thread(void *arg)
+{
+  while (1)
+  {
+    mtx_lock(&g_logger.lock);
+    drain_log_messages_nolock();
+    mtx_unlock(&g_logger.lock);
+
+    mtx_lock(&g_logger_async_lock);
+    if (g_logger_async_running == 0)
+    {
+      mtx_unlock(&g_logger_async_lock);
+      break;
+    }
+
+    struct timespec wait_ts;
+    timespec_get(&wait_ts, TIME_UTC);
+    wait_ts.tv_nsec += (long)LOGGER_ASYNC_FLUSH_DELAY * 1000000;
+    if (wait_ts.tv_nsec >= 1000000000)
+    {
+      wait_ts.tv_sec++;
+      wait_ts.tv_nsec -= 1000000000;
+    }
+
+    cnd_timedwait(&g_logger_async_cond, &g_logger_async_lock, &wait_ts);
+    mtx_unlock(&g_logger_async_lock);
+  }
+
+  return 0;
+}
+
+static int start_logger_async(void)
+{
+  g_logger_ring = calloc(LOGGER_ASYNC_RING_SIZE, sizeof(logger_message_t));
+  if (g_logger_ring == NULL)
+  {
+    return 1;
+  }
+
+  for (size_t i = 0; i < LOGGER_ASYNC_RING_SIZE; i++)
+  {
+    atomic_init(&g_logger_ring[i].sequence, i);
+  }
+
+  atomic_init(&g_logger_ring_tail, 0);
+  atomic_init(&g_logger_ring_head, 0);
+  atomic_init(&g_logger_num_dropped_messages, 0);
+  g_logger_num_reported_dropped_messages = 0;
+
+  mtx_init(&g_logger_async_lock, mtx_plain);
+  cnd_init(&g_logger_async_cond);
+  g_logger_async_running = 1;
+  if (thrd_create(&g_logger_async_thread, logger_async_thread, NULL) != thrd_success)
+  {
+    g_logger_async_running = 0;
+    cnd_destroy(&g_logger_async_cond);
+    mtx_destroy(&g_logger_async_lock);
+    free(g_logger_ring);
+    g_logger_ring = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+static void stop_logger_async(void)
+{
+  mtx_lock(&g_logger_async_lock);
+  g_logger_async_running = 0;
+  cnd_signal(&g_logger_async_cond);
+  mtx_unlock(&g_logger_async_lock);
+  thrd_join(g_logger_async_thread, NULL);
+
+  // write out anything logged while the thread was stopping
+  mtx_lock(&g_logger.lock);
+  drain_log_messages_nolock();
+  mtx_unlock(&g_logger.lock);
+
+  cnd_destroy(&g_logger_async_cond);
+  mtx_destroy(&g_logger_async_lock);
+  free(g_logger_ring);
+  g_logger_ring = NULL;
+}
+
 void logger_set_log_filename(const char* log_filename)
 {
   g_logger_log_filename = log_filename;
@@ -57,9 +296,50 @@ FILE* logget_get_fp(void)
   return g_logger.fp;
 }
 
+static void update_logger_max_level(void)
+{
+  g_logger_max_level = g_logger.level;
+  for (int i = 0; i < g_logger_num_modules; i++)
+  {
+    if (g_logger_modules[i].level > g_logger_max_level)
+    {
+      g_logger_max_level = g_logger_modules[i].level;
+    }
+  }
+}
+
+static logger_module_t* get_logger_module(const char *module, size_t module_len)
+{
+  for (int i = 0; i < g_logger_num_modules; i++)
+  {
+    logger_module_t *logger_module = &g_logger_modules[i];
+    if (strlen(logger_module->name) == module_len && strncmp(logger_module->name, module, module_len) == 0)
+    {
+      return logger_module;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Looks up the module of the source file, the file name is taken from the
+ * end of the path and everything from it's first dot on is left out...
+ */
+static logger_module_t* get_logger_module_from_file(const char *file)
+{
+  const char *name = strrchr(file, '/');
+  name = name != NULL ? name + 1 : file;
+
+  const char *ext = strchr(name, '.');
+  size_t name_len = ext != NULL ? (size_t)(ext - name) : strlen(name);
+  return get_logger_module(name, name_len);
+}
+
 void log_set_level(logger_level_t level)
 {
   g_logger.level = level;
+  update_logger_max_level();
 }
 
 logger_level_t logger_get_level(void)
@@ -67,6 +347,86 @@ logger_level_t logger_get_level(void)
   return g_logger.level;
 }
 
+int logger_get_level_from_str(const char *level_str, logger_level_t *level_out)
+{
+  assert(level_str != NULL);
+  assert(level_out != NULL);
+  for (int i = LOG_LEVEL_INFO; i <= LOG_LEVEL_FATAL; i++)
+  {
+    if (strcasecmp(level_str, LOGGING_LEVEL_NAMES[i]) == 0)
+    {
+      *level_out = (logger_level_t)i;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int logger_set_module_level(const char *module, logger_level_t level)
+{
+  assert(module != NULL);
+  size_t module_len = strlen(module);
+  if (module_len == 0 || module_len >= LOGGER_MAX_MODULE_NAME_SIZE)
+  {
+    return 1;
+  }
+
+  logger_module_t *logger_module = get_logger_module(module, module_len);
+  if (logger_module == NULL)
+  {
+    if (g_logger_num_modules >= LOGGER_MAX_MODULES)
+    {
+      return 1;
+    }
+
+    logger_module = &g_logger_modules[g_logger_num_modules];
+    memcpy(logger_module->name, module, module_len + 1);
+    g_logger_num_modules++;
+  }
+
+  logger_module->level = level;
+  update_logger_max_level();
+  return 0;
+}
+
+int logger_get_module_level(const char *module, logger_level_t *level_out)
+{
+  assert(module != NULL);
+  assert(level_out != NULL);
+  logger_module_t *logger_module = get_logger_module(module, strlen(module));
+  *level_out = logger_module != NULL ? logger_module->level : g_logger.level;
+  return logger_module == NULL;
+}
+
+int logger_is_enabled(logger_level_t level, const char *file)
+{
+  if (g_logger_is_open == 0)
+  {
+    return 0;
+  }
+
+  if (level == LOG_LEVEL_ERROR || level == LOG_LEVEL_FATAL)
+  {
+    return 1;
+  }
+
+  // most messages are decided here without looking up their module
+  if (level > g_logger_max_level)
+  {
+    return 0;
+  }
+
+  if (g_logger_num_modules == 0)
+  {
+    return 1;
+  }
+
+  assert(file != NULL);
+  logger_module_t *logger_module = get_logger_module_from_file(file);
+  return level <= (logger_module != NULL ? logger_module->level : g_logger.level);
+}
+
 void logger_set_quiet(uint8_t enable)
 {
   g_logger.quiet = enable ? 1 : 0;
@@ -77,6 +437,27 @@ uint8_t logger_get_quiet(void)
   return g_logger.quiet;
 }
 
+void logger_set_async(uint8_t enable)
+{
+  assert(g_logger_is_open == 0);
+  g_logger.async = enable ? 1 : 0;
+}
+
+uint8_t logger_get_async(void)
+{
+  return g_logger.async;
+}
+
+uint64_t logger_get_num_dropped_messages(void)
+{
+  if (g_logger_ring == NULL)
+  {
+    return 0;
+  }
+
+  return atomic_load_explicit(&g_logger_num_dropped_messages, memory_order_relaxed);
+}
+
 int logger_log(logger_level_t level, const char *file, int line, const char *fmt, ...)
 {
   if (g_logger_is_open == 0)
@@ -85,13 +466,24 @@ int logger_log(logger_level_t level, const char *file, int line, const char *fmt
   }
 
   uint8_t quiet = g_logger.quiet;
-  if (level > g_logger.level)
+  if (g_logger_ring != NULL && level != LOG_LEVEL_ERROR && level != LOG_LEVEL_FATAL)
   {
-    quiet = 1;
+    va_list args;
+    va_start(args, fmt);
+    int result = push_log_message(level, quiet, file, line, fmt, args);
+    va_end(args);
+    return result;
   }
 
   mtx_lock(&g_logger.lock);
 
+  // write out the messages still on the ring first so that
+  // an error shows up after everything logged before it...
+  if (g_logger_ring != NULL)
+  {
+    drain_log_messages_nolock();
+  }
+
   time_t t = time(NULL);
   struct tm *lt = localtime(&t);
 
@@ -130,6 +522,32 @@ int logger_log(logger_level_t level, const char *file, int line, const char *fmt
   return 0;
 }
 
+/*
+ * Writes out and flushes all of the log messages on the ring right away.
+ */
+int logger_flush(void)
+{
+  if (g_logger_is_open == 0)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_logger.lock);
+  if (g_logger_ring != NULL)
+  {
+    drain_log_messages_nolock();
+  }
+
+  fflush(stderr);
+  if (g_logger.fp)
+  {
+    fflush(g_logger.fp);
+  }
+
+  mtx_unlock(&g_logger.lock);
+  return 0;
+}
+
 int logger_open(void)
 {
   if (g_logger_is_open)
@@ -146,7 +564,14 @@ int logger_open(void)
 
   mtx_init(&g_logger.lock, mtx_plain);
   g_logger.fp = logging_file;
-  g_logger.level = LOG_LEVEL_FATAL;
+  if (g_logger.async && start_logger_async())
+  {
+    fclose(logging_file);
+    g_logger.fp = NULL;
+    mtx_destroy(&g_logger.lock);
+    return 1;
+  }
+
   g_logger_is_open = 1;
 
   LOG_INFO("Successfully opened log file: %s", g_logger_log_filename);
@@ -160,6 +585,11 @@ int logger_close(void)
     return 1;
   }
 
+  if (g_logger_ring != NULL)
+  {
+    stop_logger_async();
+  }
+
   fclose(g_logger.fp);
   g_logger.fp = NULL;
 
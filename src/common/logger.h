@@ -65,20 +65,43 @@ static const char *LOGGING_LEVEL_COLORS[] = {
   "\x1b[35m"
 };
 
+// in async mode log messages are put on a ring which is written out and flushed by a
+// background thread, the message is dropped if the ring is full. Error messages are
+// always written and flushed right away after the messages already on the ring...
+#define LOGGER_ASYNC_RING_SIZE 1024
+#define LOGGER_MAX_MESSAGE_SIZE 512
+#define LOGGER_ASYNC_FLUSH_DELAY 50
+
 typedef struct Logger
 {
   FILE *fp;
   logger_level_t level;
   uint8_t quiet;
+  uint8_t async;
   mtx_t lock;
 } logger_t;
 
-#define LOG_TRACE(...) logger_log(LOG_LEVEL_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_DEBUG(...) logger_log(LOG_LEVEL_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_INFO(...)  logger_log(LOG_LEVEL_INFO,  __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_WARNING(...)  logger_log(LOG_LEVEL_WARNING,  __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERROR(...) logger_log(LOG_LEVEL_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_FATAL(...) logger_log(LOG_LEVEL_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+// a module is the name of the source file a message is logged from without it's extension,
+// e.g. "protocol" for protocol.c. Modules without a level of their own use the logger level...
+#define LOGGER_MAX_MODULES 16
+#define LOGGER_MAX_MODULE_NAME_SIZE 32
+
+typedef struct LoggerModule
+{
+  char name[LOGGER_MAX_MODULE_NAME_SIZE];
+  logger_level_t level;
+} logger_module_t;
+
+// the arguments of a message are only evaluated when it's level is enabled for the
+// module it is logged from, so formatting a disabled message costs nothing...
+#define LOG_AT_LEVEL(level, ...) (logger_is_enabled(level, __FILE__) ? logger_log(level, __FILE__, __LINE__, __VA_ARGS__) : 0)
+
+#define LOG_TRACE(...) LOG_AT_LEVEL(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT_LEVEL(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...)  LOG_AT_LEVEL(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT_LEVEL(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_FATAL(...) LOG_AT_LEVEL(LOG_LEVEL_FATAL, __VA_ARGS__)
 
 void logger_set_log_filename(const char* log_filename);
 const char* logger_get_log_filename(void);
@@ -86,13 +109,26 @@ const char* logger_get_log_filename(void);
 void logger_set_fp(FILE *fp);
 FILE* logget_get_fp(void);
 
+// the levels are ordered by verbosity, a message is only logged when it's level is at
+// or below the level of it's module. Errors and fatal messages are always logged...
 void log_set_level(logger_level_t level);
 logger_level_t logger_get_level(void);
+int logger_get_level_from_str(const char *level_str, logger_level_t *level_out);
+
+int logger_set_module_level(const char *module, logger_level_t level);
+int logger_get_module_level(const char *module, logger_level_t *level_out);
+int logger_is_enabled(logger_level_t level, const char *file);
 
 void logger_set_quiet(uint8_t enable);
 uint8_t logger_get_quiet(void);
 
+void logger_set_async(uint8_t enable);
+uint8_t logger_get_async(void);
+
+uint64_t logger_get_num_dropped_messages(void);
+
 int logger_log(logger_level_t level, const char *file, int line, const char *fmt, ...);
+int logger_flush(void);
 
 int logger_open(void);
 int logger_close(void);
@@ -0,0 +1,398 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#include "metrics.h"
+#include "tinycthread.h"
+
+#define METRICS_CACHE_LINE_SIZE 64
+#define METRICS_SLOTS_PER_CACHE_LINE (METRICS_CACHE_LINE_SIZE / sizeof(atomic_uint_fast64_t))
+
+// a histogram series is it's buckets, the last one being +Inf, followed by it's sum
+#define METRICS_HISTOGRAM_NUM_SLOTS (METRICS_NUM_HISTOGRAM_BUCKETS + 2)
+#define METRICS_HISTOGRAM_SUM_SLOT (METRICS_NUM_HISTOGRAM_BUCKETS + 1)
+
+static const uint64_t g_metrics_histogram_bounds_us[METRICS_NUM_HISTOGRAM_BUCKETS] = {
+  10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000
+};
+
+static once_flag g_metrics_once = ONCE_FLAG_INIT;
+static mtx_t g_metrics_lock;
+
+static metric_t *g_metrics[METRICS_MAX_NUM_METRICS];
+static uint32_t g_num_metrics = 0;
+static metrics_collector_func_t g_metrics_collectors[METRICS_MAX_NUM_COLLECTORS];
+static uint32_t g_num_metrics_collectors = 0;
+
+// every thread is handed the next shard the first time it records anything,
+// the index is offset by one so that 0 means no shard was handed out yet...
+static atomic_uint g_metrics_next_shard_index = 0;
+static _Thread_local uint32_t g_metrics_shard_index = 0;
+
+static void init_metrics_lock(void)
+{
+  mtx_init(&g_metrics_lock, mtx_plain);
+}
+
+static uint32_t get_metrics_shard_index(void)
+{
+  if (g_metrics_shard_index == 0)
+  {
+    g_metrics_shard_index = (atomic_fetch_add_explicit(&g_metrics_next_shard_index, 1, memory_order_relaxed) % METRICS_NUM_SHARDS) + 1;
+  }
+
+  return g_metrics_shard_index - 1;
+}
+
+/*
+ * Registers the metric so it is recorded and scraped, registering a metric
+ * which was already registered does nothing. A metric stays registered until
+ * the metrics are free'd, as the threads recording it may still be running.
+ */
+int register_metric(metric_t *metric)
+{
+  assert(metric != NULL);
+  assert(metric->num_series > 0);
+  call_once(&g_metrics_once, init_metrics_lock);
+  mtx_lock(&g_metrics_lock);
+  if (metric->slots != NULL)
+  {
+    mtx_unlock(&g_metrics_lock);
+    return 0;
+  }
+
+  if (g_num_metrics >= METRICS_MAX_NUM_METRICS)
+  {
+    mtx_unlock(&g_metrics_lock);
+    return 1;
+  }
+
+  // every shard starts on it's own cache line
+  metric->num_series_slots = metric->type == METRIC_TYPE_HISTOGRAM ? METRICS_HISTOGRAM_NUM_SLOTS : 1;
+  size_t shard_size = metric->num_series * metric->num_series_slots;
+  metric->shard_size = ((shard_size + METRICS_SLOTS_PER_CACHE_LINE - 1) / METRICS_SLOTS_PER_CACHE_LINE) * METRICS_SLOTS_PER_CACHE_LINE;
+
+  size_t num_slots = metric->shard_size * METRICS_NUM_SHARDS;
+  metric->slots_data = calloc(1, (num_slots * sizeof(atomic_uint_fast64_t)) + METRICS_CACHE_LINE_SIZE);
+  assert(metric->slots_data != NULL);
+
+  uintptr_t slots_address = (uintptr_t)metric->slots_data;
+  slots_address = (slots_address + METRICS_CACHE_LINE_SIZE - 1) & ~((uintptr_t)METRICS_CACHE_LINE_SIZE - 1);
+  atomic_uint_fast64_t *slots = (atomic_uint_fast64_t*)slots_address;
+  for (size_t i = 0; i < num_slots; i++)
+  {
+    atomic_init(&slots[i], 0);
+  }
+
+  metric->slots = slots;
+  g_metrics[g_num_metrics++] = metric;
+  mtx_unlock(&g_metrics_lock);
+  return 0;
+}
+
+int register_metrics_collector(metrics_collector_func_t collector)
+{
+  assert(collector != NULL);
+  call_once(&g_metrics_once, init_metrics_lock);
+  mtx_lock(&g_metrics_lock);
+  for (uint32_t i = 0; i < g_num_metrics_collectors; i++)
+  {
+    if (g_metrics_collectors[i] == collector)
+    {
+      mtx_unlock(&g_metrics_lock);
+      return 0;
+    }
+  }
+
+  if (g_num_metrics_collectors >= METRICS_MAX_NUM_COLLECTORS)
+  {
+    mtx_unlock(&g_metrics_lock);
+    return 1;
+  }
+
+  g_metrics_collectors[g_num_metrics_collectors++] = collector;
+  mtx_unlock(&g_metrics_lock);
+  return 0;
+}
+
+int unregister_metrics_collector(metrics_collector_func_t collector)
+{
+  assert(collector != NULL);
+  call_once(&g_metrics_once, init_metrics_lock);
+  mtx_lock(&g_metrics_lock);
+  for (uint32_t i = 0; i < g_num_metrics_collectors; i++)
+  {
+    if (g_metrics_collectors[i] == collector)
+    {
+      g_num_metrics_collectors--;
+      memmove(&g_metrics_collectors[i], &g_metrics_collectors[i + 1],
+        sizeof(metrics_collector_func_t) * (g_num_metrics_collectors - i));
+
+      mtx_unlock(&g_metrics_lock);
+      return 0;
+    }
+  }
+
+  mtx_unlock(&g_metrics_lock);
+  return 1;
+}
+
+static atomic_uint_fast64_t* get_metric_shard_slots(metric_t *metric, uint32_t shard_index, uint32_t series)
+{
+  assert(series < metric->num_series);
+  return &metric->slots[(shard_index * metric->shard_size) + (series * metric->num_series_slots)];
+}
+
+void metric_counter_add(metric_t *metric, uint32_t series, uint64_t value)
+{
+  assert(metric != NULL);
+  if (metric->slots == NULL)
+  {
+    return;
+  }
+
+  assert(metric->type == METRIC_TYPE_COUNTER);
+  atomic_uint_fast64_t *slots = get_metric_shard_slots(metric, get_metrics_shard_index(), series);
+  atomic_fetch_add_explicit(&slots[0], value, memory_order_relaxed);
+}
+
+void metric_histogram_observe(metric_t *metric, uint32_t series, uint64_t value_us)
+{
+  assert(metric != NULL);
+  if (metric->slots == NULL)
+  {
+    return;
+  }
+
+  assert(metric->type == METRIC_TYPE_HISTOGRAM);
+  uint32_t bucket = 0;
+  while (bucket < METRICS_NUM_HISTOGRAM_BUCKETS && value_us > g_metrics_histogram_bounds_us[bucket])
+  {
+    bucket++;
+  }
+
+  atomic_uint_fast64_t *slots = get_metric_shard_slots(metric, get_metrics_shard_index(), series);
+  atomic_fetch_add_explicit(&slots[bucket], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&slots[METRICS_HISTOGRAM_SUM_SLOT], value_us, memory_order_relaxed);
+}
+
+static uint64_t sum_metric_slot(metric_t *metric, uint32_t series, uint32_t slot)
+{
+  uint64_t value = 0;
+  for (uint32_t i = 0; i < METRICS_NUM_SHARDS; i++)
+  {
+    atomic_uint_fast64_t *slots = get_metric_shard_slots(metric, i, series);
+    value += atomic_load_explicit(&slots[slot], memory_order_relaxed);
+  }
+
+  return value;
+}
+
+uint64_t get_metric_counter_value(metric_t *metric, uint32_t series)
+{
+  assert(metric != NULL);
+  if (metric->slots == NULL)
+  {
+    return 0;
+  }
+
+  assert(metric->type == METRIC_TYPE_COUNTER);
+  return sum_metric_slot(metric, series, 0);
+}
+
+uint64_t get_metric_histogram_count(metric_t *metric, uint32_t series)
+{
+  assert(metric != NULL);
+  if (metric->slots == NULL)
+  {
+    return 0;
+  }
+
+  assert(metric->type == METRIC_TYPE_HISTOGRAM);
+  uint64_t count = 0;
+  for (uint32_t i = 0; i <= METRICS_NUM_HISTOGRAM_BUCKETS; i++)
+  {
+    count += sum_metric_slot(metric, series, i);
+  }
+
+  return count;
+}
+
+static void metrics_write_format(buffer_t *buffer, const char *format, ...)
+{
+  char data[512];
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(data, sizeof(data), format, args);
+  va_end(args);
+
+  assert(size > 0);
+  if ((size_t)size >= sizeof(data))
+  {
+    size = sizeof(data) - 1;
+  }
+
+  buffer_write(buffer, (const uint8_t*)data, (size_t)size);
+}
+
+void write_metric_header(buffer_t *buffer, const char *name, const char *help, const char *type)
+{
+  assert(buffer != NULL);
+  metrics_write_format(buffer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void write_metric_value(buffer_t *buffer, const char *name, const char *label_name, const char *label_value, double value)
+{
+  assert(buffer != NULL);
+  if (label_name != NULL)
+  {
+    metrics_write_format(buffer, "%s{%s=\"%s\"} %.17g\n", name, label_name, label_value, value);
+  }
+  else
+  {
+    metrics_write_format(buffer, "%s %.17g\n", name, value);
+  }
+}
+
+static const char* get_metric_label_value(metric_t *metric, uint32_t series, char *label_value, size_t label_value_size)
+{
+  if (metric->label_values != NULL)
+  {
+    return metric->label_values[series];
+  }
+
+  snprintf(label_value, label_value_size, "%u", series);
+  return label_value;
+}
+
+static void write_metric_histogram(buffer_t *buffer, metric_t *metric, uint32_t series, const char *label_value)
+{
+  char labels[128] = "";
+  if (metric->label_name != NULL)
+  {
+    snprintf(labels, sizeof(labels), "%s=\"%s\",", metric->label_name, label_value);
+  }
+
+  uint64_t count = 0;
+  for (uint32_t i = 0; i <= METRICS_NUM_HISTOGRAM_BUCKETS; i++)
+  {
+    count += sum_metric_slot(metric, series, i);
+    if (i < METRICS_NUM_HISTOGRAM_BUCKETS)
+    {
+      metrics_write_format(buffer, "%s_bucket{%sle=\"%g\"} %llu\n", metric->name, labels,
+        (double)g_metrics_histogram_bounds_us[i] / 1000000.0, (unsigned long long)count);
+    }
+    else
+    {
+      metrics_write_format(buffer, "%s_bucket{%sle=\"+Inf\"} %llu\n", metric->name, labels, (unsigned long long)count);
+    }
+  }
+
+  // the sum and the count only carry the metric's own label
+  size_t labels_size = strlen(labels);
+  if (labels_size > 0)
+  {
+    labels[labels_size - 1] = '\0';
+  }
+
+  uint64_t sum = sum_metric_slot(metric, series, METRICS_HISTOGRAM_SUM_SLOT);
+  metrics_write_format(buffer, "%s_sum%s%s%s %.6f\n", metric->name, labels_size > 0 ? "{" : "", labels,
+    labels_size > 0 ? "}" : "", (double)sum / 1000000.0);
+  metrics_write_format(buffer, "%s_count%s%s%s %llu\n", metric->name, labels_size > 0 ? "{" : "", labels,
+    labels_size > 0 ? "}" : "", (unsigned long long)count);
+}
+
+/*
+ * Writes every registered metric followed by the collected values
+ * in the Prometheus text exposition format.
+ */
+int write_metrics(buffer_t *buffer)
+{
+  assert(buffer != NULL);
+  call_once(&g_metrics_once, init_metrics_lock);
+  mtx_lock(&g_metrics_lock);
+  for (uint32_t i = 0; i < g_num_metrics; i++)
+  {
+    metric_t *metric = g_metrics[i];
+    assert(metric != NULL);
+    write_metric_header(buffer, metric->name, metric->help,
+      metric->type == METRIC_TYPE_HISTOGRAM ? "histogram" : "counter");
+
+    for (uint32_t series = 0; series < metric->num_series; series++)
+    {
+      char label_value[16];
+      const char *value = get_metric_label_value(metric, series, label_value, sizeof(label_value));
+      if (metric->type == METRIC_TYPE_HISTOGRAM)
+      {
+        write_metric_histogram(buffer, metric, series, value);
+      }
+      else
+      {
+        write_metric_value(buffer, metric->name, metric->label_name, value,
+          (double)sum_metric_slot(metric, series, 0));
+      }
+    }
+  }
+
+  // the collectors are copied so they can take their own module's locks without the metrics lock held
+  metrics_collector_func_t collectors[METRICS_MAX_NUM_COLLECTORS];
+  uint32_t num_collectors = g_num_metrics_collectors;
+  memcpy(collectors, g_metrics_collectors, sizeof(metrics_collector_func_t) * num_collectors);
+  mtx_unlock(&g_metrics_lock);
+
+  for (uint32_t i = 0; i < num_collectors; i++)
+  {
+    collectors[i](buffer);
+  }
+
+  return 0;
+}
+
+/*
+ * Unregisters every metric and collector, only once no thread records metrics anymore.
+ */
+void free_metrics(void)
+{
+  call_once(&g_metrics_once, init_metrics_lock);
+  mtx_lock(&g_metrics_lock);
+  for (uint32_t i = 0; i < g_num_metrics; i++)
+  {
+    metric_t *metric = g_metrics[i];
+    assert(metric != NULL);
+    free(metric->slots_data);
+    metric->slots_data = NULL;
+    metric->slots = NULL;
+    g_metrics[i] = NULL;
+  }
+
+  g_num_metrics = 0;
+  g_num_metrics_collectors = 0;
+  mtx_unlock(&g_metrics_lock);
+}
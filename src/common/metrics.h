@@ -0,0 +1,104 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "buffer.h"
+#include "vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+/*
+ * Metrics are defined statically by the module they measure and registered when the
+ * module is initialized, recording into a metric which was never registered does nothing.
+ * Every thread records into one of the metric's shards so hot paths on different threads
+ * do not contend on the same cache lines, the shards are only summed when scraped...
+ *
+ * Values which are cheaper to read when scraped than to track, like queue sizes, are
+ * written by collectors the modules register instead.
+ */
+#define METRICS_NUM_SHARDS 16
+#define METRICS_MAX_NUM_METRICS 64
+#define METRICS_MAX_NUM_COLLECTORS 16
+
+// histograms are observed in microseconds and exposed in seconds
+#define METRICS_NUM_HISTOGRAM_BUCKETS 16
+
+#define METRIC_COUNTER_INIT(name, help) \
+  {name, help, METRIC_TYPE_COUNTER, NULL, NULL, 1, 0, 0, NULL, NULL}
+#define METRIC_LABELED_COUNTER_INIT(name, help, label_name, label_values, num_series) \
+  {name, help, METRIC_TYPE_COUNTER, label_name, label_values, num_series, 0, 0, NULL, NULL}
+#define METRIC_HISTOGRAM_INIT(name, help) \
+  {name, help, METRIC_TYPE_HISTOGRAM, NULL, NULL, 1, 0, 0, NULL, NULL}
+#define METRIC_LABELED_HISTOGRAM_INIT(name, help, label_name, label_values, num_series) \
+  {name, help, METRIC_TYPE_HISTOGRAM, label_name, label_values, num_series, 0, 0, NULL, NULL}
+
+typedef enum MetricType
+{
+  METRIC_TYPE_COUNTER = 0,
+  METRIC_TYPE_HISTOGRAM
+} metric_type_t;
+
+typedef struct Metric
+{
+  const char *name;
+  const char *help;
+  metric_type_t type;
+
+  // a labeled metric has one series per label value, the series of a metric
+  // without label values are labeled by their index...
+  const char *label_name;
+  const char **label_values;
+  uint32_t num_series;
+
+  uint32_t num_series_slots;
+  size_t shard_size;
+  atomic_uint_fast64_t *slots;
+  void *slots_data;
+} metric_t;
+
+typedef void (*metrics_collector_func_t)(buffer_t *buffer);
+
+VULKAN_API int register_metric(metric_t *metric);
+VULKAN_API int register_metrics_collector(metrics_collector_func_t collector);
+VULKAN_API int unregister_metrics_collector(metrics_collector_func_t collector);
+
+VULKAN_API void metric_counter_add(metric_t *metric, uint32_t series, uint64_t value);
+VULKAN_API void metric_histogram_observe(metric_t *metric, uint32_t series, uint64_t value_us);
+
+VULKAN_API uint64_t get_metric_counter_value(metric_t *metric, uint32_t series);
+VULKAN_API uint64_t get_metric_histogram_count(metric_t *metric, uint32_t series);
+
+VULKAN_API void write_metric_header(buffer_t *buffer, const char *name, const char *help, const char *type);
+VULKAN_API void write_metric_value(buffer_t *buffer, const char *name, const char *label_name, const char *label_value, double value);
+VULKAN_API int write_metrics(buffer_t *buffer);
+
+VULKAN_API void free_metrics(void);
+
+VULKAN_END_DECL
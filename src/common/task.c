@@ -27,29 +27,311 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
+#include <inttypes.h>
 
 #include <deque.h>
 
+#include "metrics.h"
 #include "task.h"
 #include "tinycthread.h"
+#include "trace.h"
 #include "util.h"
 
+#define TASKMGR_INITIAL_TASKS_CAPACITY 16
+#define TASKMGR_MAX_TASKS_PER_TICK 64
+
 static int g_taskmgr_next_task_id = -1;
 static int g_taskmgr_next_scheduler_id = -1;
 
-static Deque *g_taskmgr_tasks = NULL;
+static mtx_t g_taskmgr_lock;
+static cnd_t g_taskmgr_cond;
+
+// a binary min-heap of the scheduled tasks ordered by their deadline
+static task_t **g_taskmgr_tasks = NULL;
+static int g_taskmgr_num_tasks = 0;
+static int g_taskmgr_tasks_capacity = 0;
+
+static uint16_t g_taskmgr_num_schedulers = TASKMGR_DEFAULT_NUM_SCHEDULERS;
+static size_t g_taskmgr_next_scheduler_index = 0;
+
+static mtx_t g_taskmgr_schedulers_lock;
 static Deque *g_taskmgr_schedulers = NULL;
 
+// the number of jobs queued across all of the schedulers,
+// idle schedulers sleep on the jobs cond until a job is added...
+static mtx_t g_taskmgr_jobs_lock;
+static cnd_t g_taskmgr_jobs_cond;
+static int g_taskmgr_num_queued_jobs = 0;
+
+// the scheduler the current thread belongs to, if any
+static _Thread_local task_scheduler_t *g_taskmgr_current_scheduler = NULL;
+
+// how long past their deadline tasks were run, the tasks share the main thread
+// with the network loop so a slow task or packet handler delays every task after it...
+static metric_t g_taskmgr_lag_metric = METRIC_HISTOGRAM_INIT("vulkan_task_lag_seconds",
+  "Time tasks were run past their deadline");
+
 static int g_taskmgr_running = 0;
 
-int taskmgr_init(void)
+static int is_task_before(task_t *task, task_t *other_task)
 {
-  if (g_taskmgr_running)
+  if (task->deadline != other_task->deadline)
   {
-    return 1;
+    return task->deadline < other_task->deadline;
+  }
+
+  return task->id < other_task->id;
+}
+
+static void swap_tasks(int index, int other_index)
+{
+  task_t *task = g_taskmgr_tasks[index];
+  g_taskmgr_tasks[index] = g_taskmgr_tasks[other_index];
+  g_taskmgr_tasks[other_index] = task;
+
+  g_taskmgr_tasks[index]->heap_index = index;
+  g_taskmgr_tasks[other_index]->heap_index = other_index;
+}
+
+static void sift_task_up(int index)
+{
+  while (index > 0)
+  {
+    int parent_index = (index - 1) / 2;
+    if (is_task_before(g_taskmgr_tasks[index], g_taskmgr_tasks[parent_index]) == 0)
+    {
+      break;
+    }
+
+    swap_tasks(index, parent_index);
+    index = parent_index;
   }
+}
 
-  if (deque_new(&g_taskmgr_tasks) != CC_OK)
+static void sift_task_down(int index)
+{
+  while (1)
+  {
+    int first_index = index;
+    int left_index = (index * 2) + 1;
+    int right_index = left_index + 1;
+    if (left_index < g_taskmgr_num_tasks && is_task_before(g_taskmgr_tasks[left_index], g_taskmgr_tasks[first_index]))
+    {
+      first_index = left_index;
+    }
+
+    if (right_index < g_taskmgr_num_tasks && is_task_before(g_taskmgr_tasks[right_index], g_taskmgr_tasks[first_index]))
+    {
+      first_index = right_index;
+    }
+
+    if (first_index == index)
+    {
+      break;
+    }
+
+    swap_tasks(index, first_index);
+    index = first_index;
+  }
+}
+
+static void push_task_nolock(task_t *task)
+{
+  assert(task != NULL);
+  if (g_taskmgr_num_tasks == g_taskmgr_tasks_capacity)
+  {
+    g_taskmgr_tasks_capacity = g_taskmgr_tasks_capacity > 0 ? g_taskmgr_tasks_capacity * 2 : TASKMGR_INITIAL_TASKS_CAPACITY;
+    g_taskmgr_tasks = realloc(g_taskmgr_tasks, sizeof(task_t*) * g_taskmgr_tasks_capacity);
+    assert(g_taskmgr_tasks != NULL);
+  }
+
+  task->heap_index = g_taskmgr_num_tasks;
+  g_taskmgr_tasks[g_taskmgr_num_tasks] = task;
+  g_taskmgr_num_tasks++;
+  sift_task_up(task->heap_index);
+}
+
+static task_t* remove_task_at_nolock(int index)
+{
+  assert(index >= 0 && index < g_taskmgr_num_tasks);
+  task_t *task = g_taskmgr_tasks[index];
+  g_taskmgr_num_tasks--;
+  if (index != g_taskmgr_num_tasks)
+  {
+    g_taskmgr_tasks[index] = g_taskmgr_tasks[g_taskmgr_num_tasks];
+    g_taskmgr_tasks[index]->heap_index = index;
+    sift_task_down(index);
+    sift_task_up(index);
+  }
+
+  task->heap_index = -1;
+  return task;
+}
+
+static void schedule_task_nolock(task_t *task, uint64_t current_time)
+{
+  assert(task != NULL);
+  task->timestamp = current_time;
+  task->deadline = current_time;
+  if (task->delayable)
+  {
+    task->deadline += (uint64_t)(task->delay * 1000);
+  }
+
+  push_task_nolock(task);
+}
+
+static void get_wait_timespec(struct timespec *wait_ts, uint32_t delay)
+{
+  assert(wait_ts != NULL);
+  timespec_get(wait_ts, TIME_UTC);
+  wait_ts->tv_sec += delay / 1000;
+  wait_ts->tv_nsec += (long)(delay % 1000) * 1000000;
+  if (wait_ts->tv_nsec >= 1000000000)
+  {
+    wait_ts->tv_sec++;
+    wait_ts->tv_nsec -= 1000000000;
+  }
+}
+
+static uint32_t get_next_task_delay_nolock(uint32_t max_delay)
+{
+  if (g_taskmgr_num_tasks == 0)
+  {
+    return max_delay;
+  }
+
+  uint64_t current_time = get_monotonic_time_ms();
+  uint64_t deadline = g_taskmgr_tasks[0]->deadline;
+  if (deadline <= current_time)
+  {
+    return 0;
+  }
+
+  return (uint32_t)MIN(deadline - current_time, (uint64_t)max_delay);
+}
+
+// pushes a job onto the back of the deque of a scheduler, the caller must either
+// be the scheduler itself or hold the schedulers lock so the scheduler stays around...
+static void push_job(task_scheduler_t *task_scheduler, job_t *job)
+{
+  assert(task_scheduler != NULL);
+  assert(job != NULL);
+
+  // count the job before it is queued so that a scheduler which steals
+  // the job right away never takes the queued jobs count below zero...
+  mtx_lock(&g_taskmgr_jobs_lock);
+  g_taskmgr_num_queued_jobs++;
+  mtx_unlock(&g_taskmgr_jobs_lock);
+
+  mtx_lock(&task_scheduler->lock);
+  int r = deque_add_last(task_scheduler->jobs, job);
+  assert(r == CC_OK);
+  mtx_unlock(&task_scheduler->lock);
+  cnd_signal(&g_taskmgr_jobs_cond);
+}
+
+static void take_queued_job(void)
+{
+  mtx_lock(&g_taskmgr_jobs_lock);
+  assert(g_taskmgr_num_queued_jobs > 0);
+  g_taskmgr_num_queued_jobs--;
+  mtx_unlock(&g_taskmgr_jobs_lock);
+}
+
+// pops the most recently queued job off the back of the scheduler's own deque
+static job_t* pop_job(task_scheduler_t *task_scheduler)
+{
+  assert(task_scheduler != NULL);
+  void *val = NULL;
+  mtx_lock(&task_scheduler->lock);
+  if (deque_size(task_scheduler->jobs) > 0)
+  {
+    deque_remove_last(task_scheduler->jobs, &val);
+  }
+
+  mtx_unlock(&task_scheduler->lock);
+  if (val != NULL)
+  {
+    take_queued_job();
+  }
+
+  return (job_t*)val;
+}
+
+// steals the oldest job off the front of the deque of any other scheduler,
+// the thief may be NULL when a thread outside of the schedulers is stealing...
+static job_t* steal_job(task_scheduler_t *thief)
+{
+  void *val = NULL;
+  mtx_lock(&g_taskmgr_schedulers_lock);
+  size_t num_schedulers = deque_size(g_taskmgr_schedulers);
+  size_t start_index = thief != NULL ? (size_t)thief->id : 0;
+  for (size_t i = 0; i < num_schedulers && val == NULL; i++)
+  {
+    void *victim_val = NULL;
+    deque_get_at(g_taskmgr_schedulers, (start_index + i) % num_schedulers, &victim_val);
+    task_scheduler_t *victim = (task_scheduler_t*)victim_val;
+    assert(victim != NULL);
+    if (victim == thief)
+    {
+      continue;
+    }
+
+    mtx_lock(&victim->lock);
+    if (deque_size(victim->jobs) > 0)
+    {
+      deque_remove_first(victim->jobs, &val);
+    }
+
+    mtx_unlock(&victim->lock);
+  }
+
+  mtx_unlock(&g_taskmgr_schedulers_lock);
+  if (val != NULL)
+  {
+    take_queued_job();
+  }
+
+  return (job_t*)val;
+}
+
+static void run_job(job_t *job)
+{
+  assert(job != NULL);
+  job->func(job->arg);
+
+  job_group_t *job_group = job->group;
+  if (job_group != NULL)
+  {
+    mtx_lock(&job_group->lock);
+    assert(job_group->num_pending_jobs > 0);
+    job_group->num_pending_jobs--;
+    if (job_group->num_pending_jobs == 0)
+    {
+      cnd_broadcast(&job_group->cond);
+    }
+
+    mtx_unlock(&job_group->lock);
+  }
+
+  free(job);
+}
+
+void set_num_task_schedulers(uint16_t num_task_schedulers)
+{
+  assert(num_task_schedulers <= (uint16_t)MAX_NUM_TASK_SCHEDULERS);
+  g_taskmgr_num_schedulers = num_task_schedulers;
+}
+
+uint16_t get_num_task_schedulers(void)
+{
+  return g_taskmgr_num_schedulers;
+}
+
+int taskmgr_init(void)
+{
+  if (g_taskmgr_running)
   {
     return 1;
   }
@@ -59,30 +341,51 @@ int taskmgr_init(void)
     return 1;
   }
 
+  mtx_init(&g_taskmgr_lock, mtx_plain);
+  cnd_init(&g_taskmgr_cond);
+  mtx_init(&g_taskmgr_schedulers_lock, mtx_plain);
+  mtx_init(&g_taskmgr_jobs_lock, mtx_plain);
+  cnd_init(&g_taskmgr_jobs_cond);
+  register_metric(&g_taskmgr_lag_metric);
   g_taskmgr_running = 1;
+
+  for (uint16_t i = 0; i < g_taskmgr_num_schedulers; i++)
+  {
+    if (add_scheduler() == NULL)
+    {
+      return 1;
+    }
+  }
+
   return 0;
 }
 
+/*
+ * Runs the tasks which are due, the due tasks are taken off the heap before any of them
+ * are run so that a task which asks to continue right away is only run once per tick,
+ * and any task may add or remove tasks while it runs...
+ */
 int taskmgr_tick(void)
 {
-  if (deque_size(g_taskmgr_tasks) > 0)
-  {
-    void *val = NULL;
-    int r = deque_remove_first(g_taskmgr_tasks, &val);
-    assert(r == CC_OK);
-    task_t *task = (task_t*)val;
-    assert(task != NULL);
+  task_t *due_tasks[TASKMGR_MAX_TASKS_PER_TICK];
+  int num_due_tasks = 0;
 
-    if (task->delayable)
-    {
-      if (get_current_time() - task->timestamp < task->delay)
-      {
-        r = deque_add_last(g_taskmgr_tasks, task);
-        assert(r == CC_OK);
-        return 0;
-      }
-    }
+  mtx_lock(&g_taskmgr_lock);
+  uint64_t current_time = get_monotonic_time_ms();
+  while (num_due_tasks < TASKMGR_MAX_TASKS_PER_TICK && g_taskmgr_num_tasks > 0 &&
+         g_taskmgr_tasks[0]->deadline <= current_time)
+  {
+    task_t *task = remove_task_at_nolock(0);
+    task->running = 1;
+    metric_histogram_observe(&g_taskmgr_lag_metric, 0, (current_time - task->deadline) * 1000);
+    due_tasks[num_due_tasks] = task;
+    num_due_tasks++;
+  }
 
+  mtx_unlock(&g_taskmgr_lock);
+  for (int i = 0; i < num_due_tasks; i++)
+  {
+    task_t *task = due_tasks[i];
     mtx_lock(&task->lock);
     va_list args;
     va_copy(args, *task->args);
@@ -92,33 +395,69 @@ int taskmgr_tick(void)
 
     // process the task result and determine what the
     // task should do next...
+    mtx_lock(&g_taskmgr_lock);
+    task->running = 0;
+    if (task->removed)
+    {
+      result = TASK_RESULT_DONE;
+    }
+
     switch (result)
     {
       case TASK_RESULT_CONT:
         {
           task->delayable = 0;
-          r = deque_add_last(g_taskmgr_tasks, task);
-          assert(r == CC_OK);
+          schedule_task_nolock(task, get_monotonic_time_ms());
         }
         break;
       case TASK_RESULT_WAIT:
         {
           task->delayable = 1;
-          task->timestamp = get_current_time();
-          r = deque_add_last(g_taskmgr_tasks, task);
-          assert(r == CC_OK);
+          schedule_task_nolock(task, get_monotonic_time_ms());
         }
         break;
       case TASK_RESULT_DONE:
       default:
+        mtx_unlock(&g_taskmgr_lock);
         free_task(task);
-        break;
+        continue;
     }
+
+    mtx_unlock(&g_taskmgr_lock);
   }
 
   return 0;
 }
 
+/*
+ * Returns the number of milliseconds until the next task is due, at most max delay.
+ */
+uint32_t taskmgr_get_next_task_delay(uint32_t max_delay)
+{
+  mtx_lock(&g_taskmgr_lock);
+  uint32_t delay = get_next_task_delay_nolock(max_delay);
+  mtx_unlock(&g_taskmgr_lock);
+  return delay;
+}
+
+/*
+ * Sleeps until the next task is due, a new task is added or the task manager is shut down.
+ */
+int taskmgr_wait(void)
+{
+  mtx_lock(&g_taskmgr_lock);
+  uint32_t delay = get_next_task_delay_nolock(TASKMGR_MAX_WAIT_DELAY);
+  if (g_taskmgr_running && delay > 0)
+  {
+    struct timespec wait_ts;
+    get_wait_timespec(&wait_ts, delay);
+    cnd_timedwait(&g_taskmgr_cond, &g_taskmgr_lock, &wait_ts);
+  }
+
+  mtx_unlock(&g_taskmgr_lock);
+  return 0;
+}
+
 int taskmgr_run(void)
 {
   if (g_taskmgr_running)
@@ -134,28 +473,56 @@ int taskmgr_run(void)
       return 1;
     }
 
-    // call yield and give another thread a chance
-    // to use the CPU resources for other tasks...
-    thrd_yield();
+    // sleep until there is something to do instead of
+    // spinning on the tasks which are not due yet...
+    taskmgr_wait();
   }
 
   return 0;
 }
 
-int taskmgr_scheduler_run()
+/*
+ * Runs the jobs queued on a scheduler, stealing jobs from the other schedulers
+ * once its own deque is empty and sleeping when there are no jobs left at all.
+ * A scheduler which is being removed runs what is left in its own deque and exits...
+ */
+int taskmgr_scheduler_run(void *arg)
 {
-  while (g_taskmgr_running)
+  task_scheduler_t *task_scheduler = (task_scheduler_t*)arg;
+  assert(task_scheduler != NULL);
+  g_taskmgr_current_scheduler = task_scheduler;
+  set_trace_thread_name("task scheduler");
+
+  while (1)
   {
-    if (taskmgr_tick())
+    job_t *job = pop_job(task_scheduler);
+    if (job == NULL && task_scheduler->running)
     {
-      return 1;
+      job = steal_job(task_scheduler);
+    }
+
+    if (job != NULL)
+    {
+      run_job(job);
+      continue;
     }
 
-    // call yield and give another thread a chance
-    // to use the CPU resources for other tasks...
-    thrd_yield();
+    mtx_lock(&g_taskmgr_jobs_lock);
+    if (task_scheduler->running == 0)
+    {
+      mtx_unlock(&g_taskmgr_jobs_lock);
+      break;
+    }
+
+    if (g_taskmgr_num_queued_jobs == 0)
+    {
+      cnd_wait(&g_taskmgr_jobs_cond, &g_taskmgr_jobs_lock);
+    }
+
+    mtx_unlock(&g_taskmgr_jobs_lock);
   }
 
+  g_taskmgr_current_scheduler = NULL;
   return 0;
 }
 
@@ -166,16 +533,60 @@ int taskmgr_shutdown(void)
     return 1;
   }
 
-  deque_destroy(g_taskmgr_tasks);
-  deque_destroy(g_taskmgr_schedulers);
+  // stop the schedulers once they have run all of their queued jobs
+  while (1)
+  {
+    void *val = NULL;
+    mtx_lock(&g_taskmgr_schedulers_lock);
+    if (deque_size(g_taskmgr_schedulers) > 0)
+    {
+      deque_get_first(g_taskmgr_schedulers, &val);
+    }
 
+    mtx_unlock(&g_taskmgr_schedulers_lock);
+    if (val == NULL)
+    {
+      break;
+    }
+
+    remove_scheduler((task_scheduler_t*)val);
+  }
+
+  // wake up anything waiting on the next task so it notices the shutdown
+  mtx_lock(&g_taskmgr_lock);
   g_taskmgr_running = 0;
+  cnd_broadcast(&g_taskmgr_cond);
+  mtx_unlock(&g_taskmgr_lock);
+
+  free(g_taskmgr_tasks);
+  g_taskmgr_tasks = NULL;
+  g_taskmgr_num_tasks = 0;
+  g_taskmgr_tasks_capacity = 0;
+  deque_destroy(g_taskmgr_schedulers);
+  g_taskmgr_schedulers = NULL;
+
+  cnd_destroy(&g_taskmgr_jobs_cond);
+  mtx_destroy(&g_taskmgr_jobs_lock);
+  mtx_destroy(&g_taskmgr_schedulers_lock);
+  cnd_destroy(&g_taskmgr_cond);
+  mtx_destroy(&g_taskmgr_lock);
   return 0;
 }
 
 int has_task(task_t *task)
 {
-  return deque_contains(g_taskmgr_tasks, task) > 0;
+  mtx_lock(&g_taskmgr_lock);
+  for (int i = 0; i < g_taskmgr_num_tasks; i++)
+  {
+    if (g_taskmgr_tasks[i] == task)
+    {
+      mtx_unlock(&g_taskmgr_lock);
+      return 1;
+    }
+  }
+
+  mtx_unlock(&g_taskmgr_lock);
+  return 0;
 }
 
 int has_task_by_id(int id)
@@ -188,60 +599,88 @@ task_t* add_task(callable_func_t func, double delay, ...)
   va_list args;
   va_start(args, delay);
 
-  g_taskmgr_next_task_id++;
-
   task_t* task = malloc(sizeof(task_t));
+  assert(task != NULL);
+
+  mtx_lock(&g_taskmgr_lock);
+  g_taskmgr_next_task_id++;
   task->id = g_taskmgr_next_task_id;
   task->func = func;
   task->args = &args;
   task->delayable = 1;
   task->delay = delay;
-  task->timestamp = get_current_time();
+  task->heap_index = -1;
+  task->running = 0;
+  task->removed = 0;
   mtx_init(&task->lock, mtx_recursive);
 
-  int r = deque_add_last(g_taskmgr_tasks, task);
-  assert(r == CC_OK);
+  // wake up anything waiting on the next task, this task may be due sooner
+  schedule_task_nolock(task, get_monotonic_time_ms());
+  cnd_broadcast(&g_taskmgr_cond);
+  mtx_unlock(&g_taskmgr_lock);
   return task;
 }
 
 task_t* get_task_by_id(int id)
 {
-  void *val = NULL;
-  DEQUE_FOREACH(val, g_taskmgr_tasks,
+  mtx_lock(&g_taskmgr_lock);
+  for (int i = 0; i < g_taskmgr_num_tasks; i++)
   {
-    task_t *task = (task_t*)val;
+    task_t *task = g_taskmgr_tasks[i];
     assert(task != NULL);
 
     if (task->id == id)
     {
+      mtx_unlock(&g_taskmgr_lock);
       return task;
     }
-  })
+  }
 
+  mtx_unlock(&g_taskmgr_lock);
   return NULL;
 }
 
 void print_task(task_t *task)
 {
-  printf("Task: id=%u, delayable=%u, delay=%.6f, timestamp=%u\n", task->id, task->delayable, task->delay, task->timestamp);
+  printf("Task: id=%u, delayable=%u, delay=%.6f, timestamp=%" PRIu64 ", deadline=%" PRIu64 "\n",
+    task->id, task->delayable, task->delay, task->timestamp, task->deadline);
 }
 
 void print_tasks(void)
 {
-  void *val = NULL;
-  DEQUE_FOREACH(val, g_taskmgr_tasks,
+  mtx_lock(&g_taskmgr_lock);
+  for (int i = 0; i < g_taskmgr_num_tasks; i++)
   {
-    task_t *task = (task_t*)val;
+    task_t *task = g_taskmgr_tasks[i];
     assert(task != NULL);
     print_task(task);
-  })
+  }
+
+  mtx_unlock(&g_taskmgr_lock);
 }
 
 int remove_task(task_t *task)
 {
-  int r = deque_remove(g_taskmgr_tasks, task, NULL);
+  assert(task != NULL);
+  mtx_lock(&g_taskmgr_lock);
+
+  // a task that is running right now is free'd once it returns
+  if (task->running)
+  {
+    task->removed = 1;
+    mtx_unlock(&g_taskmgr_lock);
+    return 1;
+  }
+
+  int was_scheduled = task->heap_index >= 0;
+  if (was_scheduled)
+  {
+    remove_task_at_nolock(task->heap_index);
+  }
+
+  mtx_unlock(&g_taskmgr_lock);
   free_task(task);
-  return r == CC_OK;
+  return was_scheduled;
 }
 
 int remove_task_by_id(int id)
@@ -264,6 +703,7 @@ void free_task(task_t *task)
   task->delayable = 0;
   task->delay = 0;
   task->timestamp = 0;
+  task->deadline = 0;
 
   mtx_destroy(&task->lock);
   free(task);
@@ -276,9 +716,131 @@ void free_task_by_id(int id)
   free_task(task);
 }
 
+int init_job_group(job_group_t *job_group)
+{
+  assert(job_group != NULL);
+  job_group->num_pending_jobs = 0;
+  mtx_init(&job_group->lock, mtx_plain);
+  cnd_init(&job_group->cond);
+  return 0;
+}
+
+/*
+ * Waits for all of the jobs added to the job group to complete. The waiting thread runs
+ * queued jobs itself in the mean time, so a scheduler waiting on the jobs it added
+ * does not stall the pool and waiting works even when there are no schedulers...
+ */
+int wait_job_group(job_group_t *job_group)
+{
+  assert(job_group != NULL);
+  while (1)
+  {
+    mtx_lock(&job_group->lock);
+    int num_pending_jobs = job_group->num_pending_jobs;
+    mtx_unlock(&job_group->lock);
+    if (num_pending_jobs == 0)
+    {
+      break;
+    }
+
+    job_t *job = NULL;
+    if (g_taskmgr_current_scheduler != NULL)
+    {
+      job = pop_job(g_taskmgr_current_scheduler);
+    }
+
+    if (job == NULL && g_taskmgr_running)
+    {
+      job = steal_job(g_taskmgr_current_scheduler);
+    }
+
+    if (job != NULL)
+    {
+      run_job(job);
+      continue;
+    }
+
+    // the remaining jobs are being run by other schedulers, wait on them
+    // for a little while and then look for queued jobs to run again...
+    mtx_lock(&job_group->lock);
+    if (job_group->num_pending_jobs > 0)
+    {
+      struct timespec wait_ts;
+      get_wait_timespec(&wait_ts, TASKMGR_JOB_GROUP_WAIT_DELAY);
+      cnd_timedwait(&job_group->cond, &job_group->lock, &wait_ts);
+    }
+
+    mtx_unlock(&job_group->lock);
+  }
+
+  return 0;
+}
+
+void free_job_group(job_group_t *job_group)
+{
+  assert(job_group != NULL);
+  assert(job_group->num_pending_jobs == 0);
+  cnd_destroy(&job_group->cond);
+  mtx_destroy(&job_group->lock);
+}
+
+/*
+ * Adds a one-shot job to run on the schedulers, a job added by a scheduler is queued on
+ * its own deque and any other job is spread across the schedulers. When there are no
+ * schedulers the job is run right away. If a job group is given the job is counted
+ * as pending in the group until it has run.
+ */
+int add_job(job_func_t func, void *arg, job_group_t *job_group)
+{
+  assert(func != NULL);
+  job_t *job = malloc(sizeof(job_t));
+  assert(job != NULL);
+  job->func = func;
+  job->arg = arg;
+  job->group = job_group;
+
+  if (job_group != NULL)
+  {
+    mtx_lock(&job_group->lock);
+    job_group->num_pending_jobs++;
+    mtx_unlock(&job_group->lock);
+  }
+
+  if (g_taskmgr_running == 0)
+  {
+    run_job(job);
+    return 0;
+  }
+
+  if (g_taskmgr_current_scheduler != NULL)
+  {
+    push_job(g_taskmgr_current_scheduler, job);
+    return 0;
+  }
+
+  mtx_lock(&g_taskmgr_schedulers_lock);
+  size_t num_schedulers = deque_size(g_taskmgr_schedulers);
+  if (num_schedulers == 0)
+  {
+    mtx_unlock(&g_taskmgr_schedulers_lock);
+    run_job(job);
+    return 0;
+  }
+
+  void *val = NULL;
+  deque_get_at(g_taskmgr_schedulers, g_taskmgr_next_scheduler_index % num_schedulers, &val);
+  g_taskmgr_next_scheduler_index++;
+  push_job((task_scheduler_t*)val, job);
+  mtx_unlock(&g_taskmgr_schedulers_lock);
+  return 0;
+}
+
 int has_scheduler(task_scheduler_t *task_scheduler)
 {
-  return deque_contains(g_taskmgr_schedulers, task_scheduler) > 0;
+  mtx_lock(&g_taskmgr_schedulers_lock);
+  int result = deque_contains(g_taskmgr_schedulers, task_scheduler) > 0;
+  mtx_unlock(&g_taskmgr_schedulers_lock);
+  return result;
 }
 
 int has_scheduler_by_id(int id)
@@ -288,24 +850,36 @@ int has_scheduler_by_id(int id)
 
 task_scheduler_t* add_scheduler(void)
 {
-  g_taskmgr_next_scheduler_id++;
-
   task_scheduler_t* task_scheduler = malloc(sizeof(task_scheduler_t));
+  assert(task_scheduler != NULL);
+
+  mtx_lock(&g_taskmgr_schedulers_lock);
+  g_taskmgr_next_scheduler_id++;
   task_scheduler->id = g_taskmgr_next_scheduler_id;
+  task_scheduler->running = 1;
+
+  int r = deque_new(&task_scheduler->jobs);
+  assert(r == CC_OK);
+  mtx_init(&task_scheduler->lock, mtx_plain);
 
-  if (thrd_create(&task_scheduler->thread, taskmgr_scheduler_run, NULL) != thrd_success)
+  if (thrd_create(&task_scheduler->thread, taskmgr_scheduler_run, task_scheduler) != thrd_success)
   {
-    fprintf(stderr, "Failed to initialize thread: %d!\n", g_taskmgr_next_scheduler_id);
+    mtx_unlock(&g_taskmgr_schedulers_lock);
+    fprintf(stderr, "Failed to initialize thread: %d!\n", task_scheduler->id);
+    free_scheduler(task_scheduler);
     return NULL;
   }
 
-  int r = deque_add_last(g_taskmgr_schedulers, task_scheduler);
+  r = deque_add_last(g_taskmgr_schedulers, task_scheduler);
   assert(r == CC_OK);
+  mtx_unlock(&g_taskmgr_schedulers_lock);
   return task_scheduler;
 }
 
 task_scheduler_t* get_scheduler_by_id(int id)
 {
+  task_scheduler_t *found_task_scheduler = NULL;
+  mtx_lock(&g_taskmgr_schedulers_lock);
 
   void *val = NULL;
   DEQUE_FOREACH(val, g_taskmgr_schedulers,
@@ -315,18 +889,40 @@ task_scheduler_t* get_scheduler_by_id(int id)
 
     if (task_scheduler->id == id)
     {
-      return task_scheduler;
+      found_task_scheduler = task_scheduler;
+      break;
     }
   })
 
-  return NULL;
+  mtx_unlock(&g_taskmgr_schedulers_lock);
+  return found_task_scheduler;
 }
 
+/*
+ * Removes a scheduler so that no more jobs are queued on it, then waits for it
+ * to run the jobs left in its deque and exit. A scheduler cannot remove itself.
+ */
 int remove_scheduler(task_scheduler_t *task_scheduler)
 {
+  assert(task_scheduler != NULL);
+  assert(task_scheduler != g_taskmgr_current_scheduler);
+
+  mtx_lock(&g_taskmgr_schedulers_lock);
   int r = deque_remove(g_taskmgr_schedulers, task_scheduler, NULL);
+  mtx_unlock(&g_taskmgr_schedulers_lock);
+  if (r != CC_OK)
+  {
+    return 0;
+  }
+
+  mtx_lock(&g_taskmgr_jobs_lock);
+  task_scheduler->running = 0;
+  cnd_broadcast(&g_taskmgr_jobs_cond);
+  mtx_unlock(&g_taskmgr_jobs_lock);
+
+  thrd_join(task_scheduler->thread, NULL);
   free_scheduler(task_scheduler);
-  return r == CC_OK;
+  return 1;
 }
 
 int remove_scheduler_by_id(int id)
@@ -343,6 +939,8 @@ int remove_scheduler_by_id(int id)
 void free_scheduler(task_scheduler_t *task_scheduler)
 {
   assert(task_scheduler != NULL);
+  deque_destroy(task_scheduler->jobs);
+  mtx_destroy(&task_scheduler->lock);
   free(task_scheduler);
 }
 
@@ -30,6 +30,8 @@
 #include <stdarg.h>
 #include <time.h>
 
+#include <deque.h>
+
 #include "queue.h"
 #include "tinycthread.h"
 
@@ -42,6 +44,19 @@ typedef enum TaskResult
 
 typedef task_result_t (*callable_func_t)();
 
+// the longest the task manager sleeps for when waiting on the next
+// task, so that a shutdown is noticed even if no task wakes it up...
+#define TASKMGR_MAX_WAIT_DELAY 1000
+
+// the number of scheduler threads started by the task manager to run jobs on,
+// with no schedulers jobs are run right away by the thread which adds them...
+#define TASKMGR_DEFAULT_NUM_SCHEDULERS 2
+#define MAX_NUM_TASK_SCHEDULERS 64
+
+// how long in milliseconds a thread waiting on a job group sleeps
+// before it tries to steal the remaining jobs of the group again...
+#define TASKMGR_JOB_GROUP_WAIT_DELAY 1
+
 typedef struct Task
 {
   int id;
@@ -49,20 +64,54 @@ typedef struct Task
   va_list *args;
   int delayable;
   double delay;
-  uint32_t timestamp;
+
+  // the monotonic time in milliseconds the task was last scheduled at, and the time
+  // it is due to run at. Tasks are kept in a min-heap ordered by their deadline...
+  uint64_t timestamp;
+  uint64_t deadline;
+  int heap_index;
+  int running;
+  int removed;
   mtx_t lock;
 } task_t;
 
+typedef void (*job_func_t)(void *arg);
+
+typedef struct JobGroup
+{
+  int num_pending_jobs;
+  mtx_t lock;
+  cnd_t cond;
+} job_group_t;
+
+typedef struct Job
+{
+  job_func_t func;
+  void *arg;
+  job_group_t *group;
+} job_t;
+
 typedef struct TaskScheduler
 {
   int id;
   thrd_t thread;
+  int running;
+
+  // the jobs queued on this scheduler, the scheduler takes jobs from the back
+  // of its own deque and idle schedulers steal jobs from the front...
+  Deque *jobs;
+  mtx_t lock;
 } task_scheduler_t;
 
+void set_num_task_schedulers(uint16_t num_task_schedulers);
+uint16_t get_num_task_schedulers(void);
+
 int taskmgr_init(void);
 int taskmgr_tick(void);
+uint32_t taskmgr_get_next_task_delay(uint32_t max_delay);
+int taskmgr_wait(void);
 int taskmgr_run(void);
-int taskmgr_scheduler_run();
+int taskmgr_scheduler_run(void *arg);
 int taskmgr_shutdown(void);
 
 int has_task(task_t *task);
@@ -81,6 +130,12 @@ int remove_task_by_id(int id);
 void free_task(task_t *task);
 void free_task_by_id(int id);
 
+int init_job_group(job_group_t *job_group);
+int wait_job_group(job_group_t *job_group);
+void free_job_group(job_group_t *job_group);
+
+int add_job(job_func_t func, void *arg, job_group_t *job_group);
+
 int has_scheduler(task_scheduler_t *task_scheduler);
 int has_scheduler_by_id(int id);
 
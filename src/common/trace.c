@@ -0,0 +1,303 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "buffer.h"
+#include "json.h"
+#include "logger.h"
+#include "tinycthread.h"
+#include "trace.h"
+#include "util.h"
+
+typedef struct TraceEvent
+{
+  const char *name;
+  uint64_t start_time;
+  uint64_t duration;
+} trace_event_t;
+
+typedef struct TraceRing
+{
+  uint32_t thread_id;
+  char thread_name[TRACE_MAX_THREAD_NAME_SIZE];
+
+  // the number of spans ever written, the ring only holds the last TRACE_RING_SIZE of them
+  atomic_uint_fast64_t num_events;
+  trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static int g_tracing_enabled = 1;
+
+static once_flag g_trace_once = ONCE_FLAG_INIT;
+static mtx_t g_trace_lock;
+static trace_ring_t *g_trace_rings[TRACE_MAX_NUM_THREADS];
+static uint32_t g_trace_num_rings = 0;
+
+// the rings are handed out to threads as they record their first span, the threads
+// started after every ring was handed out do not record any spans...
+static _Thread_local trace_ring_t *g_trace_ring = NULL;
+static _Thread_local int g_trace_ring_unavailable = 0;
+
+void set_tracing_enabled(int enabled)
+{
+  g_tracing_enabled = enabled;
+}
+
+int get_tracing_enabled(void)
+{
+#ifdef TRACING_ENABLED
+  return g_tracing_enabled;
+#else
+  return 0;
+#endif
+}
+
+static void init_trace_lock(void)
+{
+  mtx_init(&g_trace_lock, mtx_plain);
+}
+
+static trace_ring_t* get_trace_ring(void)
+{
+  if (g_trace_ring != NULL || g_trace_ring_unavailable)
+  {
+    return g_trace_ring;
+  }
+
+  call_once(&g_trace_once, init_trace_lock);
+  mtx_lock(&g_trace_lock);
+  if (g_trace_num_rings >= TRACE_MAX_NUM_THREADS)
+  {
+    mtx_unlock(&g_trace_lock);
+    g_trace_ring_unavailable = 1;
+    return NULL;
+  }
+
+  trace_ring_t *ring = malloc(sizeof(trace_ring_t));
+  assert(ring != NULL);
+  ring->thread_id = g_trace_num_rings + 1;
+  snprintf(ring->thread_name, sizeof(ring->thread_name), "thread %u", ring->thread_id);
+  atomic_init(&ring->num_events, 0);
+
+  g_trace_rings[g_trace_num_rings++] = ring;
+  mtx_unlock(&g_trace_lock);
+
+  g_trace_ring = ring;
+  return ring;
+}
+
+void set_trace_thread_name(const char *name)
+{
+  assert(name != NULL);
+  if (get_tracing_enabled() == 0)
+  {
+    return;
+  }
+
+  trace_ring_t *ring = get_trace_ring();
+  if (ring == NULL)
+  {
+    return;
+  }
+
+  mtx_lock(&g_trace_lock);
+  snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+  mtx_unlock(&g_trace_lock);
+}
+
+trace_span_t begin_trace_span(const char *name)
+{
+  trace_span_t span;
+  span.name = name;
+  span.start_time = get_tracing_enabled() ? get_monotonic_time_us() : 0;
+  return span;
+}
+
+void end_trace_span(trace_span_t *span)
+{
+  assert(span != NULL);
+  if (span->start_time == 0)
+  {
+    return;
+  }
+
+  trace_ring_t *ring = get_trace_ring();
+  if (ring == NULL)
+  {
+    return;
+  }
+
+  // only the owning thread writes to it's ring, the span is published once written
+  uint64_t num_events = atomic_load_explicit(&ring->num_events, memory_order_relaxed);
+  trace_event_t *event = &ring->events[num_events & (TRACE_RING_SIZE - 1)];
+  event->name = span->name;
+  event->start_time = span->start_time;
+  event->duration = get_monotonic_time_us() - span->start_time;
+  atomic_store_explicit(&ring->num_events, num_events + 1, memory_order_release);
+}
+
+/*
+ * Copies the spans held by the ring, leaving out those which the owning
+ * thread may have overwritten while they were copied.
+ */
+static uint32_t copy_trace_ring_events(trace_ring_t *ring, trace_event_t *events)
+{
+  uint64_t end_index = atomic_load_explicit(&ring->num_events, memory_order_acquire);
+  uint64_t start_index = end_index > TRACE_RING_SIZE ? end_index - TRACE_RING_SIZE : 0;
+  for (uint64_t i = start_index; i < end_index; i++)
+  {
+    events[i - start_index] = ring->events[i & (TRACE_RING_SIZE - 1)];
+  }
+
+  uint64_t written_index = atomic_load_explicit(&ring->num_events, memory_order_acquire);
+  uint64_t first_valid_index = written_index >= TRACE_RING_SIZE ? written_index - TRACE_RING_SIZE + 1 : 0;
+  if (first_valid_index <= start_index)
+  {
+    return (uint32_t)(end_index - start_index);
+  }
+
+  if (first_valid_index >= end_index)
+  {
+    return 0;
+  }
+
+  uint32_t num_skipped = (uint32_t)(first_valid_index - start_index);
+  memmove(events, events + num_skipped, sizeof(trace_event_t) * (end_index - first_valid_index));
+  return (uint32_t)(end_index - first_valid_index);
+}
+
+static void write_trace_event(buffer_t *buffer, int *num_written, const char *format, ...)
+{
+  if (*num_written > 0)
+  {
+    json_write_raw(buffer, ",\n", 2);
+  }
+
+  char data[256];
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(data, sizeof(data), format, args);
+  va_end(args);
+
+  assert(size > 0 && (size_t)size < sizeof(data));
+  json_write_raw(buffer, data, (size_t)size);
+  (*num_written)++;
+}
+
+/*
+ * Writes the spans of every thread to the file as a Chrome trace, the
+ * threads keep recording spans while their rings are copied.
+ */
+int dump_trace(const char *filename)
+{
+  assert(filename != NULL);
+  if (get_tracing_enabled() == 0)
+  {
+    LOG_ERROR("Cannot dump trace, tracing is disabled!");
+    return 1;
+  }
+
+  trace_event_t *events = malloc(sizeof(trace_event_t) * TRACE_RING_SIZE);
+  assert(events != NULL);
+
+  buffer_t *buffer = buffer_init();
+  json_write_raw(buffer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", 40);
+
+  int num_written = 0;
+  uint32_t num_spans = 0;
+  call_once(&g_trace_once, init_trace_lock);
+  mtx_lock(&g_trace_lock);
+  for (uint32_t i = 0; i < g_trace_num_rings; i++)
+  {
+    trace_ring_t *ring = g_trace_rings[i];
+    assert(ring != NULL);
+
+    // the names are written as they are, none of them contain characters which need escaping
+    write_trace_event(buffer, &num_written,
+      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+      ring->thread_id, ring->thread_name);
+
+    uint32_t num_events = copy_trace_ring_events(ring, events);
+    for (uint32_t j = 0; j < num_events; j++)
+    {
+      trace_event_t *event = &events[j];
+      write_trace_event(buffer, &num_written,
+        "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu}",
+        event->name, ring->thread_id, (unsigned long long)event->start_time, (unsigned long long)event->duration);
+    }
+
+    num_spans += num_events;
+  }
+
+  mtx_unlock(&g_trace_lock);
+  json_write_raw(buffer, "\n]}\n", 4);
+  free(events);
+
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL)
+  {
+    LOG_ERROR("Failed to open trace file: %s!", filename);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  size_t size = buffer_get_size(buffer);
+  int failed = fwrite(buffer_get_data(buffer), 1, size, file) != size;
+  fclose(file);
+  buffer_free(buffer);
+  if (failed)
+  {
+    LOG_ERROR("Failed to write trace file: %s!", filename);
+    return 1;
+  }
+
+  LOG_INFO("Dumped %u trace spans to: %s.", num_spans, filename);
+  return 0;
+}
+
+/*
+ * Frees the rings of every thread and disables tracing, only once
+ * no other thread records spans anymore.
+ */
+void free_tracing(void)
+{
+  call_once(&g_trace_once, init_trace_lock);
+  mtx_lock(&g_trace_lock);
+  for (uint32_t i = 0; i < g_trace_num_rings; i++)
+  {
+    free(g_trace_rings[i]);
+    g_trace_rings[i] = NULL;
+  }
+
+  g_trace_num_rings = 0;
+  g_tracing_enabled = 0;
+  mtx_unlock(&g_trace_lock);
+}
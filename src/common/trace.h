@@ -0,0 +1,78 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+/*
+ * Trace spans time a scope, from where the span is declared until the scope is left,
+ * and are written into a ring owned by the thread they were recorded on. Every ring
+ * keeps the most recent spans of it's thread, the rings are dumped on demand in the
+ * Chrome trace event format which both chrome://tracing and Perfetto open...
+ *
+ * The spans are removed at compile time when built without tracing, they rely on
+ * GCC's cleanup attribute to end when their scope is left through any return.
+ */
+#if defined(USE_TRACING) && defined(__GNUC__)
+#define TRACING_ENABLED 1
+#endif
+
+#define TRACE_RING_SIZE (1024 * 32) // spans, must be a power of two
+#define TRACE_MAX_NUM_THREADS 64
+#define TRACE_MAX_THREAD_NAME_SIZE 32
+
+typedef struct TraceSpan
+{
+  const char *name;
+  uint64_t start_time;
+} trace_span_t;
+
+#ifdef TRACING_ENABLED
+#define TRACE_CONCAT_INTERNAL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INTERNAL(a, b)
+#define TRACE_SPAN(name) \
+  trace_span_t TRACE_CONCAT(trace_span_, __LINE__) __attribute__((cleanup(end_trace_span))) = begin_trace_span(name)
+#else
+#define TRACE_SPAN(name) do {} while (0)
+#endif
+
+VULKAN_API void set_tracing_enabled(int enabled);
+VULKAN_API int get_tracing_enabled(void);
+
+VULKAN_API void set_trace_thread_name(const char *name);
+
+VULKAN_API trace_span_t begin_trace_span(const char *name);
+VULKAN_API void end_trace_span(trace_span_t *span);
+
+VULKAN_API int dump_trace(const char *filename);
+VULKAN_API void free_tracing(void);
+
+VULKAN_END_DECL
@@ -137,6 +137,23 @@ char* bin2hex(uint8_t *bin, size_t bin_size)
   return hex;
 }
 
+/*
+ * Writes the hex string of bin into hex, which must have room for
+ * (bin_size * 2) + 1 chars. Returns hex so it can be used in place...
+ */
+char* bin2hex_str(const uint8_t *bin, size_t bin_size, char *hex)
+{
+  static const char hex_chars[] = "0123456789abcdef";
+  for (size_t i = 0; i < bin_size; i++)
+  {
+    hex[i * 2] = hex_chars[bin[i] >> 4];
+    hex[(i * 2) + 1] = hex_chars[bin[i] & 0x0f];
+  }
+
+  hex[bin_size * 2] = '\0';
+  return hex;
+}
+
 uint8_t* hex2bin(const char *hexstr, size_t *size)
 {
   size_t hexstr_len = strlen(hexstr);
@@ -165,6 +182,43 @@ uint32_t get_current_time(void)
   return (uint32_t)time(NULL);
 }
 
+uint64_t get_current_time_ms(void)
+{
+  struct timespec current_ts;
+  timespec_get(&current_ts, TIME_UTC);
+  return ((uint64_t)current_ts.tv_sec * 1000) + ((uint64_t)current_ts.tv_nsec / 1000000);
+}
+
+/*
+ * Returns a millisecond timestamp which never goes backwards when the
+ * wall clock is adjusted, only intervals between two readings are meaningful.
+ */
+uint64_t get_monotonic_time_ms(void)
+{
+#ifdef _WIN32
+  return GetTickCount64();
+#else
+  struct timespec current_ts;
+  clock_gettime(CLOCK_MONOTONIC, &current_ts);
+  return ((uint64_t)current_ts.tv_sec * 1000) + ((uint64_t)current_ts.tv_nsec / 1000000);
+#endif
+}
+
+uint64_t get_monotonic_time_us(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((counter.QuadPart * 1000000) / frequency.QuadPart);
+#else
+  struct timespec current_ts;
+  clock_gettime(CLOCK_MONOTONIC, &current_ts);
+  return ((uint64_t)current_ts.tv_sec * 1000000) + ((uint64_t)current_ts.tv_nsec / 1000);
+#endif
+}
+
 char* get_current_time_str(void)
 {
   time_t current_time;
@@ -309,7 +363,9 @@ uint32_t convert_str_to_ip(const char* address)
 
 char* convert_to_addr_str(const char* address, uint32_t port)
 {
-  char *out = malloc(strlen(address) + sizeof(port) + 1);
-  sprintf(out, "%s:%u", address, port);
+  // the separator and up to 10 digits of the port, followed by the terminator
+  size_t size = strlen(address) + 12;
+  char *out = malloc(size);
+  snprintf(out, size, "%s:%u", address, port);
   return out;
 }
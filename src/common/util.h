@@ -33,6 +33,12 @@
 
 VULKAN_BEGIN_DECL
 
+// formats the hex string into a buffer on the caller's stack which lives until the end of the
+// enclosing block, so hashes can be passed straight to a log message without a malloc and free.
+// The size must be a constant expression...
+#define BIN2HEX_STR(bin, bin_size) bin2hex_str((const uint8_t*)(bin), (bin_size), (char[((bin_size) * 2) + 1]){0})
+#define HASH2HEX_STR(hash) BIN2HEX_STR(hash, HASH_SIZE)
+
 VULKAN_API unsigned concatenate(unsigned x, unsigned y);
 
 VULKAN_API uint16_t get_num_logical_cores(void);
@@ -45,9 +51,13 @@ VULKAN_API const char* string_copy(const char *string, const char *other_string)
 
 VULKAN_API int make_hash(char *digest, unsigned char *string);
 VULKAN_API char* bin2hex(uint8_t *bin, size_t bin_size);
+VULKAN_API char* bin2hex_str(const uint8_t *bin, size_t bin_size, char *hex);
 VULKAN_API uint8_t* hex2bin(const char *hexstr, size_t *size);
 
 VULKAN_API uint32_t get_current_time(void);
+VULKAN_API uint64_t get_current_time_ms(void);
+VULKAN_API uint64_t get_monotonic_time_ms(void);
+VULKAN_API uint64_t get_monotonic_time_us(void);
 VULKAN_API char* get_current_time_str(void);
 VULKAN_API int cmp_least_greatest(const void *a, const void *b);
 
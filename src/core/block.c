@@ -36,11 +36,13 @@
 #include "common/logger.h"
 #include "common/buffer_iterator.h"
 #include "common/buffer.h"
+#include "common/trace.h"
 #include "common/util.h"
 
 #include "block.h"
 #include "genesis.h"
 #include "blockchain.h"
+#include "flat_transactions.h"
 #include "parameters.h"
 #include "pow.h"
 #include "merkle.h"
@@ -71,6 +73,8 @@ block_t* make_block(void)
   memset(block->merkle_root, 0, HASH_SIZE);
   block->transaction_count = 0;
   block->transactions = NULL;
+  block->arena = NULL;
+  block->header_size = 0;
   return block;
 }
 
@@ -80,17 +84,17 @@ int valid_block_timestamp(block_t *block)
   return block->timestamp <= (get_current_time() + MAX_FUTURE_BLOCK_TIME);
 }
 
-// Block is valid if:
+// Block structure is valid if:
 // - Timestamp is stamped for a 2 hour drift
 // - The first TX is a generational TX
 // - TXs don't share any hash IDs
 // - TXs don't have any same TXINs referencing the same txout + id
-// - TXs TXINs reference UXTOs
 // - The block hash is valid
 // - The merkle root is valid
 //
+// None of these checks depend on the state of the blockchain.
 // Returns 0 if invalid, 1 is valid.
-int valid_block(block_t *block)
+int valid_block_structure(block_t *block)
 {
   assert(block != NULL);
 
@@ -130,12 +134,6 @@ int valid_block(block_t *block)
       return 0;
     }
 
-    // check to see if this is a valid transaction
-    if (valid_transaction(first_tx) == 0)
-    {
-      return 0;
-    }
-
     // check to see if we have more than one generational transaction
     if (first_tx_index != 0 && is_coinbase_tx(first_tx))
     {
@@ -211,6 +209,89 @@ int valid_block(block_t *block)
   return 1;
 }
 
+static int valid_block_txs_internal(block_t *block, uint32_t start_tx_index, uint32_t end_tx_index, int check_signatures)
+{
+  assert(block != NULL);
+  assert(start_tx_index <= end_tx_index);
+  assert(end_tx_index <= block->transaction_count);
+
+  // flatten the range once so that both the header and signature
+  // checks are linear scans over the txins and txouts...
+  uint32_t num_txs = end_tx_index - start_tx_index;
+  flat_transactions_t *flat_txs = flatten_transactions(block->transactions + start_tx_index, num_txs);
+  int result = 1;
+  for (uint32_t tx_index = 0; tx_index < num_txs; tx_index++)
+  {
+    if (valid_flat_transaction_header(flat_txs, tx_index) == 0)
+    {
+      result = 0;
+      break;
+    }
+  }
+
+  if (result && check_signatures && validate_flat_transaction_signatures(flat_txs, 0, num_txs))
+  {
+    result = 0;
+  }
+
+  free_flat_transactions(flat_txs);
+  return result;
+}
+
+/*
+ * Checks the headers and the txin signatures of the txs in the range
+ * [start_tx_index, end_tx_index), neither depend on the state of the blockchain
+ * so separate ranges of the same block can be checked concurrently.
+ * Returns 0 if invalid, 1 is valid.
+ */
+int valid_block_txs(block_t *block, uint32_t start_tx_index, uint32_t end_tx_index)
+{
+  return valid_block_txs_internal(block, start_tx_index, end_tx_index, 1);
+}
+
+/*
+ * Checks only the headers of the txs in the range [start_tx_index, end_tx_index),
+ * used for blocks assumed valid where the txin signatures are not checked.
+ * Returns 0 if invalid, 1 is valid.
+ */
+int valid_block_tx_headers(block_t *block, uint32_t start_tx_index, uint32_t end_tx_index)
+{
+  return valid_block_txs_internal(block, start_tx_index, end_tx_index, 0);
+}
+
+/*
+ * Checks that the txins of every tx in the block reference unspent txouts,
+ * must be called while holding the blockchain lock.
+ * Returns 0 if invalid, 1 is valid.
+ */
+int valid_block_txins(block_t *block)
+{
+  assert(block != NULL);
+  return valid_transactions_txins(block->transactions, block->transaction_count);
+}
+
+// Block is valid if:
+// - Its structure is valid
+// - Its TXs headers and signatures are valid
+// - TXs TXINs reference UXTOs
+//
+// Returns 0 if invalid, 1 is valid.
+int valid_block(block_t *block)
+{
+  assert(block != NULL);
+  if (valid_block_structure(block) == 0)
+  {
+    return 0;
+  }
+
+  if (valid_block_txs(block, 0, block->transaction_count) == 0)
+  {
+    return 0;
+  }
+
+  return valid_block_txins(block);
+}
+
 int valid_merkle_root(block_t *block)
 {
   assert(block != NULL);
@@ -240,15 +321,82 @@ int compute_merkle_root(uint8_t *merkle_root, block_t *block)
     }
   }
 
-  merkle_tree_t *tree = construct_merkle_tree_from_leaves(hashes, block->transaction_count);
-  assert(tree != NULL);
-  memcpy(merkle_root, tree->root->hash, HASH_SIZE);
+  if (compute_merkle_root_from_hashes(merkle_root, hashes, block->transaction_count))
+  {
+    free(hashes);
+    return 1;
+  }
 
-  free_merkle_tree(tree);
   free(hashes);
   return 0;
 }
 
+int compute_block_merkle_branch(uint8_t *branch, uint32_t *branch_length, block_t *block, uint32_t tx_index)
+{
+  assert(block != NULL);
+  if (tx_index >= block->transaction_count)
+  {
+    return 1;
+  }
+
+  uint8_t *hashes = malloc(HASH_SIZE * block->transaction_count);
+  assert(hashes != NULL);
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
+
+    if (compute_tx_id(&hashes[HASH_SIZE * i], tx))
+    {
+      free(hashes);
+      return 1;
+    }
+  }
+
+  if (compute_merkle_branch_from_hashes(branch, branch_length, hashes, block->transaction_count, tx_index))
+  {
+    free(hashes);
+    return 1;
+  }
+
+  free(hashes);
+  return 0;
+}
+
+/*
+ * Checks that the tx is included in the block at the given index using only the block's
+ * header and the tx's merkle branch, the branch must be exactly as long as the tree
+ * of the block's txs is deep.
+ */
+int valid_block_merkle_branch(block_t *block, transaction_t *tx, uint32_t tx_index, uint8_t *branch, uint32_t branch_length)
+{
+  assert(block != NULL);
+  assert(tx != NULL);
+  if (tx_index >= block->transaction_count)
+  {
+    return 0;
+  }
+
+  uint32_t expected_branch_length = 0;
+  for (uint32_t num_of_nodes = block->transaction_count; num_of_nodes > 1; num_of_nodes = (num_of_nodes + 1) / 2)
+  {
+    expected_branch_length++;
+  }
+
+  if (branch_length != expected_branch_length)
+  {
+    return 0;
+  }
+
+  uint8_t tx_id[HASH_SIZE];
+  if (compute_tx_id(tx_id, tx) || compare_hash(tx_id, tx->id) == 0)
+  {
+    return 0;
+  }
+
+  return valid_merkle_branch(block->merkle_root, tx_id, branch, branch_length, tx_index);
+}
+
 void print_block(block_t *block)
 {
   assert(block != NULL);
@@ -307,38 +455,59 @@ int valid_block_hash(block_t *block)
           check_proof_of_work(block->hash, block->bits));
 }
 
+/*
+ * Verifies the txin signatures of the txs in the range [start_tx_index, end_tx_index)
+ * against a flattened copy of the range.
+ */
+int validate_block_signatures_range(block_t *block, uint32_t start_tx_index, uint32_t end_tx_index)
+{
+  assert(block != NULL);
+  assert(start_tx_index <= end_tx_index);
+  assert(end_tx_index <= block->transaction_count);
+
+  uint32_t num_txs = end_tx_index - start_tx_index;
+  flat_transactions_t *flat_txs = flatten_transactions(block->transactions + start_tx_index, num_txs);
+  int result = validate_flat_transaction_signatures(flat_txs, 0, num_txs);
+  free_flat_transactions(flat_txs);
+  return result;
+}
+
 int validate_block_signatures(block_t *block)
 {
   assert(block != NULL);
-  for (uint32_t tx_index = 0; tx_index < block->transaction_count; tx_index++)
-  {
-    transaction_t *tx = block->transactions[tx_index];
-    assert(tx != NULL);
+  return validate_block_signatures_range(block, 0, block->transaction_count);
+}
 
-    if (validate_tx_signatures(tx))
-    {
-      return 1;
-    }
+
+int get_block_header_data(uint8_t *header, block_t *block)
+{
+  assert(header != NULL);
+  assert(block != NULL);
+  buffer_t *buffer = buffer_acquire_scratch();
+  if (serialize_block_header(buffer, block))
+  {
+    buffer_release_scratch(buffer);
+    return 1;
   }
 
+  // the serialized header is zero padded up to the full header size
+  size_t header_size = buffer_get_size(buffer);
+  assert(header_size <= BLOCK_HEADER_SIZE);
+  memset(header, 0, BLOCK_HEADER_SIZE);
+  memcpy(header, buffer->data, header_size);
+  buffer_release_scratch(buffer);
   return 0;
 }
 
-
 int compute_block_hash(uint8_t *hash, block_t *block)
 {
   assert(block != NULL);
-  buffer_t *buffer = buffer_init_size(0, BLOCK_HEADER_SIZE);
-  if (serialize_block_header(buffer, block))
+  uint8_t header[BLOCK_HEADER_SIZE];
+  if (get_block_header_data(header, block))
   {
-    buffer_free(buffer);
     return 1;
   }
 
-  uint8_t header[BLOCK_HEADER_SIZE];
-  memcpy(header, buffer->data, BLOCK_HEADER_SIZE);
-
-  buffer_free(buffer);
   crypto_hash_sha256d(hash, header, BLOCK_HEADER_SIZE);
   return 0;
 }
@@ -346,6 +515,11 @@ int compute_block_hash(uint8_t *hash, block_t *block)
 uint32_t get_block_header_size(block_t *block)
 {
   assert(block != NULL);
+  if (block->header_size > 0)
+  {
+    return block->header_size;
+  }
+
   uint32_t block_header_size = BLOCK_HEADER_SIZE;
   for (uint32_t i = 0; i < block->transaction_count; i++)
   {
@@ -355,6 +529,7 @@ uint32_t get_block_header_size(block_t *block)
     block_header_size += get_tx_header_size(tx);
   }
 
+  block->header_size = block_header_size;
   return block_header_size;
 }
 
@@ -436,10 +611,41 @@ int serialize_block_header(buffer_t *buffer, block_t *block)
 }
 
 int serialize_block(buffer_t *buffer, block_t *block)
+{
+  return serialize_block_encoded(buffer, block, ENCODING_VERSION_1);
+}
+
+static int serialize_block_v2(buffer_t *buffer, block_t *block)
+{
+  assert(block != NULL);
+  assert(buffer != NULL);
+
+  if (buffer_write_varint(buffer, block->version) ||
+      buffer_write(buffer, block->previous_hash, HASH_SIZE) ||
+      buffer_write(buffer, block->hash, HASH_SIZE) ||
+      buffer_write_uint32(buffer, block->timestamp) ||
+      buffer_write_uint32(buffer, block->nonce) ||
+      buffer_write_uint32(buffer, block->bits) ||
+      buffer_write_uint64(buffer, block->cumulative_emission) ||
+      buffer_write(buffer, block->merkle_root, HASH_SIZE) ||
+      buffer_write_varint(buffer, block->transaction_count))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+int serialize_block_encoded(buffer_t *buffer, block_t *block, encoding_version_t encoding_version)
 {
   assert(block != NULL);
   assert(buffer != NULL);
 
+  if (encoding_version == ENCODING_VERSION_2)
+  {
+    return serialize_block_v2(buffer, block);
+  }
+
   if (buffer_write_uint32(buffer, block->version) ||
       buffer_write_bytes32(buffer, block->previous_hash, HASH_SIZE) ||
       buffer_write_bytes32(buffer, block->hash, HASH_SIZE) ||
@@ -457,11 +663,53 @@ int serialize_block(buffer_t *buffer, block_t *block)
 }
 
 int deserialize_block(buffer_iterator_t *buffer_iterator, block_t **block_out)
+{
+  return deserialize_block_encoded(buffer_iterator, ENCODING_VERSION_1, block_out);
+}
+
+static int deserialize_block_v2(buffer_iterator_t *buffer_iterator, block_t *block)
+{
+  assert(buffer_iterator != NULL);
+  assert(block != NULL);
+
+  uint64_t version = 0;
+  uint64_t transaction_count = 0;
+  if (buffer_read_varint(buffer_iterator, &version) || version > UINT32_MAX ||
+      buffer_read_fixed(buffer_iterator, block->previous_hash, HASH_SIZE) ||
+      buffer_read_fixed(buffer_iterator, block->hash, HASH_SIZE) ||
+      buffer_read_uint32(buffer_iterator, &block->timestamp) ||
+      buffer_read_uint32(buffer_iterator, &block->nonce) ||
+      buffer_read_uint32(buffer_iterator, &block->bits) ||
+      buffer_read_uint64(buffer_iterator, &block->cumulative_emission) ||
+      buffer_read_fixed(buffer_iterator, block->merkle_root, HASH_SIZE) ||
+      buffer_read_varint(buffer_iterator, &transaction_count) || transaction_count > UINT32_MAX)
+  {
+    return 1;
+  }
+
+  block->version = (uint32_t)version;
+  block->transaction_count = (uint32_t)transaction_count;
+  return 0;
+}
+
+int deserialize_block_encoded(buffer_iterator_t *buffer_iterator, encoding_version_t encoding_version, block_t **block_out)
 {
   assert(buffer_iterator != NULL);
+  TRACE_SPAN("deserialize_block");
   block_t *block = make_block();
   assert(block != NULL);
 
+  if (encoding_version == ENCODING_VERSION_2)
+  {
+    if (deserialize_block_v2(buffer_iterator, block))
+    {
+      goto deserialize_fail;
+    }
+
+    *block_out = block;
+    return 0;
+  }
+
   if (buffer_read_uint32(buffer_iterator, &block->version))
   {
     goto deserialize_fail;
@@ -530,10 +778,10 @@ deserialize_fail:
 int block_to_serialized(uint8_t **data, uint32_t *data_len, block_t *block)
 {
   assert(block != NULL);
-  buffer_t *buffer = buffer_init();
+  buffer_t *buffer = buffer_acquire_scratch();
   if (serialize_block(buffer, block))
   {
-    buffer_free(buffer);
+    buffer_release_scratch(buffer);
     return 1;
   }
 
@@ -541,7 +789,7 @@ int block_to_serialized(uint8_t **data, uint32_t *data_len, block_t *block)
   *data = malloc(*data_len);
   assert(*data != NULL);
   memcpy(*data, buffer->data, *data_len);
-  buffer_free(buffer);
+  buffer_release_scratch(buffer);
   return 0;
 }
 
@@ -587,6 +835,7 @@ int deserialize_transactions_to_block(buffer_iterator_t *buffer_iterator, block_
 {
   assert(buffer_iterator != NULL);
   assert(block != NULL);
+  block->header_size = 0;
 
   if (block->transaction_count > 0)
   {
@@ -599,6 +848,9 @@ int deserialize_transactions_to_block(buffer_iterator_t *buffer_iterator, block_
       transaction_t *tx = NULL;
       if (deserialize_transaction(buffer_iterator, &tx))
       {
+        // only count the txs that were deserialized,
+        // so that the block can be free'd safely...
+        block->transaction_count = i;
         return 1;
       }
 
@@ -610,10 +862,62 @@ int deserialize_transactions_to_block(buffer_iterator_t *buffer_iterator, block_
   return 0;
 }
 
+/*
+ * Deserializes the block's transactions into an arena owned by the block, rather than
+ * making several small heap allocations for every transaction, txin and txout. The block
+ * must not have any transactions added to it afterwards, the arena is free'd all at once
+ * along with the transactions in `free_block_transactions`.
+ */
+int deserialize_transactions_to_block_in_arena(buffer_iterator_t *buffer_iterator, block_t *block)
+{
+  assert(buffer_iterator != NULL);
+  assert(block != NULL);
+  assert(block->transactions == NULL);
+  assert(block->arena == NULL);
+  block->header_size = 0;
+
+  if (block->transaction_count == 0)
+  {
+    return 0;
+  }
+
+  // every tx takes up at least a byte, so don't allocate more tx pointers
+  // than there is data left to deserialize...
+  size_t remaining_size = buffer_get_remaining_size(buffer_iterator);
+  if (block->transaction_count > remaining_size)
+  {
+    block->transaction_count = 0;
+    return 1;
+  }
+
+  // the deserialized txs take up at least as much memory as the serialized data,
+  // so start with a chunk size close to it to keep the number of chunks down...
+  size_t chunk_size = MIN(MAX(remaining_size, ARENA_DEFAULT_CHUNK_SIZE), ARENA_MAX_CHUNK_SIZE);
+  block->arena = arena_init(chunk_size);
+  block->transactions = arena_alloc(block->arena, sizeof(transaction_t*) * block->transaction_count);
+  assert(block->transactions != NULL);
+
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = NULL;
+    if (deserialize_transaction_in_arena(buffer_iterator, block->arena, &tx))
+    {
+      block->transaction_count = i;
+      return 1;
+    }
+
+    assert(tx != NULL);
+    block->transactions[i] = tx;
+  }
+
+  return 0;
+}
+
 int add_transaction_to_block(block_t *block, transaction_t *tx, uint32_t tx_index)
 {
   assert(block != NULL);
   assert(tx != NULL);
+  assert(block->arena == NULL);
 
   block->transaction_count++;
   assert(tx_index == block->transaction_count - 1);
@@ -622,6 +926,11 @@ int add_transaction_to_block(block_t *block, transaction_t *tx, uint32_t tx_inde
   assert(block->transactions != NULL);
 
   block->transactions[tx_index] = tx;
+  if (block->header_size > 0)
+  {
+    block->header_size += get_tx_header_size(tx);
+  }
+
   return 0;
 }
 
@@ -692,24 +1001,22 @@ int copy_block_transactions(block_t *block, block_t *other_block)
   free_block_transactions(other_block);
   if (block->transaction_count > 0 && block->transactions != NULL)
   {
-    // copy the transactions
+    other_block->transactions = malloc(sizeof(transaction_t*) * block->transaction_count);
+    assert(other_block->transactions != NULL);
+
+    // copy the transactions, the copies are owned by the other block
     for (uint32_t i = 0; i < block->transaction_count; i++)
     {
       transaction_t *tx = block->transactions[i];
       assert(tx != NULL);
 
-      transaction_t *other_tx = NULL;
+      transaction_t *other_tx = make_transaction();
+      other_block->transactions[i] = other_tx;
+      other_block->transaction_count++;
       if (copy_transaction(tx, other_tx))
       {
         return 1;
       }
-
-      assert(other_tx != NULL);
-      other_block->transaction_count++;
-      other_block->transactions = realloc(other_block->transactions, sizeof(transaction_t) * block->transaction_count);
-
-      assert(other_block->transactions != NULL);
-      other_block->transactions[i] = other_tx;
     }
   }
 
@@ -732,7 +1039,6 @@ int copy_block(block_t *block, block_t *other_block)
   other_block->cumulative_emission = block->cumulative_emission;
 
   memcpy(other_block->merkle_root, block->merkle_root, HASH_SIZE);
-  other_block->transaction_count = block->transaction_count;
   if (copy_block_transactions(block, other_block))
   {
     return 1;
@@ -750,7 +1056,16 @@ int copy_block(block_t *block, block_t *other_block)
 void free_block_transactions(block_t *block)
 {
   assert(block != NULL);
-  if (block->transaction_count > 0 && block->transactions != NULL)
+  block->header_size = 0;
+  if (block->arena != NULL)
+  {
+    // the txs were all allocated from the arena
+    arena_free(block->arena);
+    block->arena = NULL;
+    block->transaction_count = 0;
+    block->transactions = NULL;
+  }
+  else if (block->transactions != NULL)
   {
     for (uint32_t i = 0; i < block->transaction_count; i++)
     {
@@ -766,6 +1081,31 @@ void free_block_transactions(block_t *block)
   }
 }
 
+/*
+ * Returns the memory used by the block and it's txs, blocks which were
+ * deserialized into an arena are counted by the size of their arena.
+ */
+size_t get_block_memory_size(block_t *block)
+{
+  assert(block != NULL);
+  size_t memory_size = sizeof(block_t);
+  if (block->arena != NULL)
+  {
+    // the txs were all allocated from the arena
+    return memory_size + arena_get_size(block->arena);
+  }
+
+  memory_size += block->transaction_count * sizeof(transaction_t*);
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
+    memory_size += get_tx_memory_size(tx);
+  }
+
+  return memory_size;
+}
+
 /*
  * Frees an allocated block, and its corresponding TXs.
  */
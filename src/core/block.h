@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "common/arena.h"
 #include "common/buffer_iterator.h"
 #include "common/buffer.h"
 #include "common/util.h"
@@ -41,6 +42,10 @@ VULKAN_BEGIN_DECL
 
 #define BLOCK_HEADER_SIZE (HASH_SIZE + HASH_SIZE + 8 + 8 + 8 + 4 + 4 + 4)
 
+// offsets of the fields that change while searching for a nonce in the serialized header
+#define BLOCK_HEADER_TIMESTAMP_OFFSET 4
+#define BLOCK_HEADER_NONCE_OFFSET 8
+
 typedef struct Block
 {
   uint32_t version;
@@ -56,6 +61,15 @@ typedef struct Block
   uint8_t merkle_root[HASH_SIZE];
   uint32_t transaction_count;
   transaction_t **transactions;
+
+  // the arena the transactions were deserialized into, NULL when
+  // the transactions were allocated on the heap...
+  arena_t *arena;
+
+  // the memoized size of the block's header and it's txs headers, 0 until it is
+  // first computed. It is kept up to date by add_transaction_to_block and reset by
+  // the other calls that replace the block's txs...
+  uint32_t header_size;
 } block_t;
 
 VULKAN_API block_t* make_block(void);
@@ -63,31 +77,42 @@ VULKAN_API block_t* make_block(void);
 VULKAN_API uint32_t get_block_header_size(block_t *block);
 
 VULKAN_API int valid_block_hash(block_t *block);
+VULKAN_API int validate_block_signatures_range(block_t *block, uint32_t start_tx_index, uint32_t end_tx_index);
 VULKAN_API int validate_block_signatures(block_t *block);
 
 VULKAN_API int compare_block(block_t *block, block_t *other_block);
 VULKAN_API int compare_with_genesis_block(block_t *block);
 
 VULKAN_API int valid_block_timestamp(block_t *block);
+VULKAN_API int valid_block_structure(block_t *block);
+VULKAN_API int valid_block_txs(block_t *block, uint32_t start_tx_index, uint32_t end_tx_index);
+VULKAN_API int valid_block_tx_headers(block_t *block, uint32_t start_tx_index, uint32_t end_tx_index);
+VULKAN_API int valid_block_txins(block_t *block);
 VULKAN_API int valid_block(block_t *block);
 VULKAN_API int valid_merkle_root(block_t *block);
 
 VULKAN_API int compute_merkle_root(uint8_t *merkle_root, block_t *block);
+VULKAN_API int compute_block_merkle_branch(uint8_t *branch, uint32_t *branch_length, block_t *block, uint32_t tx_index);
+VULKAN_API int valid_block_merkle_branch(block_t *block, transaction_t *tx, uint32_t tx_index, uint8_t *branch, uint32_t branch_length);
 
 VULKAN_API void print_block(block_t *block);
 VULKAN_API void print_block_transactions(block_t *block);
 
+VULKAN_API int get_block_header_data(uint8_t *header, block_t *block);
 VULKAN_API int compute_block_hash(uint8_t *hash, block_t *block);
 
 VULKAN_API int serialize_block_header(buffer_t *buffer, block_t *block);
 VULKAN_API int serialize_block(buffer_t *buffer, block_t *block);
 VULKAN_API int deserialize_block(buffer_iterator_t *buffer_iterator, block_t **block_out);
+VULKAN_API int serialize_block_encoded(buffer_t *buffer, block_t *block, encoding_version_t encoding_version);
+VULKAN_API int deserialize_block_encoded(buffer_iterator_t *buffer_iterator, encoding_version_t encoding_version, block_t **block_out);
 
 VULKAN_API int block_to_serialized(uint8_t **data, uint32_t *data_len, block_t *block);
 VULKAN_API block_t* block_from_serialized(uint8_t *data, uint32_t data_len);
 
 VULKAN_API int serialize_transactions_from_block(buffer_t *buffer, block_t *block);
 VULKAN_API int deserialize_transactions_to_block(buffer_iterator_t *buffer_iterator, block_t *block);
+VULKAN_API int deserialize_transactions_to_block_in_arena(buffer_iterator_t *buffer_iterator, block_t *block);
 
 VULKAN_API int add_transaction_to_block(block_t *block, transaction_t *tx, uint32_t tx_index);
 VULKAN_API int add_transactions_to_block(block_t *block, transaction_t **transactions, uint32_t num_transactions);
@@ -97,6 +122,8 @@ VULKAN_API int32_t get_tx_index_from_tx_in_block(block_t *block, transaction_t *
 VULKAN_API int copy_block_transactions(block_t *block, block_t *other_block);
 VULKAN_API int copy_block(block_t *block, block_t *other_block);
 
+VULKAN_API size_t get_block_memory_size(block_t *block);
+
 VULKAN_API void free_block_transactions(block_t *block);
 VULKAN_API void free_block(block_t *block);
 
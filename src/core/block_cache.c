@@ -0,0 +1,377 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <hashtable.h>
+
+#include "block.h"
+#include "block_cache.h"
+#include "parameters.h"
+#include "transaction.h"
+
+// the block cache is not locked on it's own, it is only ever
+// accessed by the blockchain while holding the blockchain lock...
+static int g_block_cache_initialized = 0;
+static HashTable *g_block_cache_table = NULL;
+
+// the most recently used entry is at the head of the list and the least
+// recently used entry is at it's tail, the evicted list holds the entries
+// which were removed from the cache while they were still referenced...
+static block_cache_entry_t *g_block_cache_head = NULL;
+static block_cache_entry_t *g_block_cache_tail = NULL;
+static block_cache_entry_t *g_block_cache_evicted = NULL;
+
+static size_t g_block_cache_max_memory_size = DEFAULT_BLOCK_CACHE_MAX_MEMORY_SIZE;
+static size_t g_block_cache_memory_size = 0;
+
+static uint64_t g_block_cache_num_hits = 0;
+static uint64_t g_block_cache_num_misses = 0;
+
+static int compare_block_cache_hash(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, HASH_SIZE);
+}
+
+static size_t get_block_cache_entry_memory_size(block_t *block)
+{
+  assert(block != NULL);
+  return sizeof(block_cache_entry_t) + sizeof(TableEntry) + get_block_memory_size(block);
+}
+
+static block_cache_entry_t* get_block_cache_entry(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  assert(g_block_cache_table != NULL);
+
+  void *val = NULL;
+  if (hashtable_get(g_block_cache_table, block_hash, &val) != CC_OK)
+  {
+    return NULL;
+  }
+
+  return (block_cache_entry_t*)val;
+}
+
+static void unlink_block_cache_entry(block_cache_entry_t *entry)
+{
+  assert(entry != NULL);
+  if (entry->prev != NULL)
+  {
+    entry->prev->next = entry->next;
+  }
+  else if (entry->evicted)
+  {
+    g_block_cache_evicted = entry->next;
+  }
+  else
+  {
+    g_block_cache_head = entry->next;
+  }
+
+  if (entry->next != NULL)
+  {
+    entry->next->prev = entry->prev;
+  }
+  else if (entry->evicted == 0)
+  {
+    g_block_cache_tail = entry->prev;
+  }
+
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static void link_block_cache_entry(block_cache_entry_t *entry)
+{
+  assert(entry != NULL);
+  block_cache_entry_t **head = entry->evicted ? &g_block_cache_evicted : &g_block_cache_head;
+  entry->prev = NULL;
+  entry->next = *head;
+  if (*head != NULL)
+  {
+    (*head)->prev = entry;
+  }
+  else if (entry->evicted == 0)
+  {
+    g_block_cache_tail = entry;
+  }
+
+  *head = entry;
+}
+
+static void free_block_cache_entry(block_cache_entry_t *entry)
+{
+  assert(entry != NULL);
+  free_block(entry->block);
+  free(entry);
+}
+
+/* Removes the entry from the cache, it must already have been removed from the table.
+ * Entries that are still referenced are free'd once they are last released...
+ */
+static void evict_block_cache_entry(block_cache_entry_t *entry)
+{
+  assert(entry != NULL);
+  assert(entry->evicted == 0);
+  unlink_block_cache_entry(entry);
+  g_block_cache_memory_size -= entry->memory_size;
+  if (entry->refcount == 0)
+  {
+    free_block_cache_entry(entry);
+    return;
+  }
+
+  entry->evicted = 1;
+  link_block_cache_entry(entry);
+}
+
+void set_block_cache_max_memory_size(size_t max_memory_size)
+{
+  g_block_cache_max_memory_size = max_memory_size;
+}
+
+size_t get_block_cache_max_memory_size(void)
+{
+  return g_block_cache_max_memory_size;
+}
+
+size_t get_block_cache_memory_size(void)
+{
+  return g_block_cache_memory_size;
+}
+
+size_t get_block_cache_num_entries(void)
+{
+  if (g_block_cache_table == NULL)
+  {
+    return 0;
+  }
+
+  return hashtable_size(g_block_cache_table);
+}
+
+uint64_t get_block_cache_num_hits(void)
+{
+  return g_block_cache_num_hits;
+}
+
+uint64_t get_block_cache_num_misses(void)
+{
+  return g_block_cache_num_misses;
+}
+
+/* Returns the cached block with a new reference held on it, or NULL
+ * if the block is not cached...
+ */
+block_t* acquire_block_from_block_cache(uint8_t *block_hash)
+{
+  block_cache_entry_t *entry = get_block_cache_entry(block_hash);
+  if (entry == NULL)
+  {
+    g_block_cache_num_misses++;
+    return NULL;
+  }
+
+  g_block_cache_num_hits++;
+  entry->refcount++;
+
+  // this is now the most recently used entry
+  unlink_block_cache_entry(entry);
+  link_block_cache_entry(entry);
+  return entry->block;
+}
+
+/* The block cache takes ownership of the block and returns it with a reference held on it,
+ * if the block is already cached the given block is free'd and the cached block is returned
+ * in it's place...
+ */
+block_t* add_block_to_block_cache(block_t *block)
+{
+  assert(block != NULL);
+  block_cache_entry_t *entry = get_block_cache_entry(block->hash);
+  if (entry != NULL)
+  {
+    free_block(block);
+    entry->refcount++;
+    unlink_block_cache_entry(entry);
+    link_block_cache_entry(entry);
+    return entry->block;
+  }
+
+  entry = malloc(sizeof(block_cache_entry_t));
+  assert(entry != NULL);
+  memcpy(entry->hash, block->hash, HASH_SIZE);
+  entry->block = block;
+  entry->memory_size = get_block_cache_entry_memory_size(block);
+  entry->refcount = 1;
+  entry->evicted = 0;
+  entry->prev = NULL;
+  entry->next = NULL;
+
+  assert(hashtable_add(g_block_cache_table, entry->hash, entry) == CC_OK);
+  link_block_cache_entry(entry);
+  g_block_cache_memory_size += entry->memory_size;
+  trim_block_cache();
+  return block;
+}
+
+void release_block_from_block_cache(block_t *block)
+{
+  assert(block != NULL);
+  block_cache_entry_t *entry = get_block_cache_entry(block->hash);
+  if (entry == NULL || entry->block != block)
+  {
+    // the block must have been evicted while it was still referenced
+    entry = g_block_cache_evicted;
+    while (entry != NULL && entry->block != block)
+    {
+      entry = entry->next;
+    }
+
+    assert(entry != NULL);
+  }
+
+  assert(entry->refcount > 0);
+  entry->refcount--;
+  if (entry->refcount > 0)
+  {
+    return;
+  }
+
+  if (entry->evicted)
+  {
+    unlink_block_cache_entry(entry);
+    free_block_cache_entry(entry);
+    return;
+  }
+
+  trim_block_cache();
+}
+
+/* Invalidates the cached block, called whenever the block is removed from the blockchain.
+ * Callers still holding the block keep it until they release it...
+ */
+int remove_block_from_block_cache(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  assert(g_block_cache_table != NULL);
+
+  void *val = NULL;
+  if (hashtable_remove(g_block_cache_table, block_hash, &val) != CC_OK)
+  {
+    return 1;
+  }
+
+  evict_block_cache_entry((block_cache_entry_t*)val);
+  return 0;
+}
+
+/* Evicts the least recently used entries that are no longer referenced
+ * until the cache fits within it's memory budget...
+ */
+void trim_block_cache(void)
+{
+  assert(g_block_cache_table != NULL);
+  block_cache_entry_t *entry = g_block_cache_tail;
+  while (g_block_cache_memory_size > g_block_cache_max_memory_size && entry != NULL)
+  {
+    block_cache_entry_t *prev_entry = entry->prev;
+    if (entry->refcount == 0)
+    {
+      assert(hashtable_remove(g_block_cache_table, entry->hash, NULL) == CC_OK);
+      evict_block_cache_entry(entry);
+    }
+
+    entry = prev_entry;
+  }
+}
+
+void clear_block_cache(void)
+{
+  assert(g_block_cache_table != NULL);
+  while (g_block_cache_head != NULL)
+  {
+    block_cache_entry_t *entry = g_block_cache_head;
+    assert(hashtable_remove(g_block_cache_table, entry->hash, NULL) == CC_OK);
+    evict_block_cache_entry(entry);
+  }
+
+  assert(hashtable_size(g_block_cache_table) == 0);
+  g_block_cache_memory_size = 0;
+}
+
+int init_block_cache(void)
+{
+  if (g_block_cache_initialized)
+  {
+    return 1;
+  }
+
+  HashTableConf block_cache_conf;
+  hashtable_conf_init(&block_cache_conf);
+  block_cache_conf.key_length = HASH_SIZE;
+  block_cache_conf.hash = GENERAL_HASH;
+  block_cache_conf.key_compare = compare_block_cache_hash;
+  if (hashtable_new_conf(&block_cache_conf, &g_block_cache_table) != CC_OK)
+  {
+    return 1;
+  }
+
+  g_block_cache_head = NULL;
+  g_block_cache_tail = NULL;
+  g_block_cache_evicted = NULL;
+  g_block_cache_memory_size = 0;
+  g_block_cache_num_hits = 0;
+  g_block_cache_num_misses = 0;
+  g_block_cache_initialized = 1;
+  return 0;
+}
+
+int deinit_block_cache(void)
+{
+  if (g_block_cache_initialized == 0)
+  {
+    return 1;
+  }
+
+  clear_block_cache();
+
+  // anything still referenced at this point can no longer be released
+  while (g_block_cache_evicted != NULL)
+  {
+    block_cache_entry_t *entry = g_block_cache_evicted;
+    unlink_block_cache_entry(entry);
+    free_block_cache_entry(entry);
+  }
+
+  hashtable_destroy(g_block_cache_table);
+  g_block_cache_table = NULL;
+  g_block_cache_initialized = 0;
+  return 0;
+}
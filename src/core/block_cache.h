@@ -0,0 +1,71 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+#include "block.h"
+
+VULKAN_BEGIN_DECL
+
+// the block cache holds recently used blocks along with their txs, the blocks are shared
+// with the callers that acquired them and must be treated as read only. Entries are kept
+// in least recently used order and are only ever evicted once no longer referenced...
+typedef struct BlockCacheEntry
+{
+  uint8_t hash[HASH_SIZE];
+  block_t *block;
+  size_t memory_size;
+  uint32_t refcount;
+  uint8_t evicted; // removed from the cache while still referenced
+
+  struct BlockCacheEntry *prev;
+  struct BlockCacheEntry *next;
+} block_cache_entry_t;
+
+VULKAN_API void set_block_cache_max_memory_size(size_t max_memory_size);
+VULKAN_API size_t get_block_cache_max_memory_size(void);
+
+VULKAN_API size_t get_block_cache_memory_size(void);
+VULKAN_API size_t get_block_cache_num_entries(void);
+VULKAN_API uint64_t get_block_cache_num_hits(void);
+VULKAN_API uint64_t get_block_cache_num_misses(void);
+
+VULKAN_API block_t* acquire_block_from_block_cache(uint8_t *block_hash);
+VULKAN_API block_t* add_block_to_block_cache(block_t *block);
+VULKAN_API void release_block_from_block_cache(block_t *block);
+VULKAN_API int remove_block_from_block_cache(uint8_t *block_hash);
+
+VULKAN_API void trim_block_cache(void);
+VULKAN_API void clear_block_cache(void);
+
+VULKAN_API int init_block_cache(void);
+VULKAN_API int deinit_block_cache(void);
+
+VULKAN_END_DECL
@@ -0,0 +1,452 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common/buffer_iterator.h"
+#include "common/buffer.h"
+#include "common/logger.h"
+#include "common/util.h"
+
+#include "block.h"
+#include "block_file.h"
+#include "blockchain.h"
+#include "checkpoint.h"
+#include "parameters.h"
+#include "validator.h"
+
+int export_blocks_to_file(const char *filename)
+{
+  assert(filename != NULL);
+
+  // every block from the genesis block up is needed to import the blocks again
+  uint32_t pruned_height = get_blockchain_pruned_height();
+  if (pruned_height > 0)
+  {
+    LOG_ERROR("Could not export blocks, the blocks up to height: %u have been pruned!", pruned_height);
+    return 1;
+  }
+
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL)
+  {
+    LOG_ERROR("Could not open block file: %s for writing!", filename);
+    return 1;
+  }
+
+  uint32_t top_height = get_block_height();
+  LOG_INFO("Exporting blocks up to height: %u into block file: %s...", top_height, filename);
+  for (uint32_t height = 0; height <= top_height; height++)
+  {
+    block_t *block = get_block_from_height(height);
+    if (block == NULL)
+    {
+      LOG_ERROR("Could not export blocks, unknown block at height: %u!", height);
+      goto export_fail;
+    }
+
+    buffer_t *buffer = buffer_acquire_scratch();
+    int result = serialize_block(buffer, block) || serialize_transactions_from_block(buffer, block);
+    free_block(block);
+    if (result)
+    {
+      LOG_ERROR("Could not export blocks, failed to serialize block at height: %u!", height);
+      buffer_release_scratch(buffer);
+      goto export_fail;
+    }
+
+    uint32_t data_len = buffer_get_size(buffer);
+    uint8_t size_data[sizeof(uint32_t)];
+    size_data[0] = (uint8_t)(data_len >> 24);
+    size_data[1] = (uint8_t)(data_len >> 16);
+    size_data[2] = (uint8_t)(data_len >> 8);
+    size_data[3] = (uint8_t)data_len;
+
+    result = fwrite(size_data, 1, sizeof(size_data), file) != sizeof(size_data) ||
+      fwrite(buffer_get_data(buffer), 1, data_len, file) != data_len;
+
+    buffer_release_scratch(buffer);
+    if (result)
+    {
+      LOG_ERROR("Could not export blocks, failed to write block at height: %u!", height);
+      goto export_fail;
+    }
+
+    if (height > 0 && height % BLOCK_FILE_LOG_INTERVAL == 0)
+    {
+      LOG_INFO("Exported blocks up to height: %u...", height);
+    }
+  }
+
+  if (fclose(file) != 0)
+  {
+    LOG_ERROR("Could not export blocks, failed to close block file: %s!", filename);
+    return 1;
+  }
+
+  LOG_INFO("Successfully exported %u blocks into block file: %s.", top_height + 1, filename);
+  return 0;
+
+export_fail:
+  fclose(file);
+  return 1;
+}
+
+/*
+ * Reads the size of the next block of a block file, the size is 0 once the end of
+ * the file was reached in between two blocks...
+ */
+static int read_block_size_from_file(FILE *file, uint32_t *data_len_out)
+{
+  assert(file != NULL);
+  assert(data_len_out != NULL);
+  *data_len_out = 0;
+
+  uint8_t size_data[sizeof(uint32_t)];
+  size_t bytes_read = fread(size_data, 1, sizeof(size_data), file);
+  if (bytes_read == 0 && feof(file))
+  {
+    return 0;
+  }
+
+  if (bytes_read != sizeof(size_data))
+  {
+    return 1;
+  }
+
+  uint32_t data_len = ((uint32_t)size_data[0] << 24) | ((uint32_t)size_data[1] << 16) |
+    ((uint32_t)size_data[2] << 8) | (uint32_t)size_data[3];
+
+  if (data_len == 0 || data_len > MAX_BLOCK_SIZE)
+  {
+    return 1;
+  }
+
+  *data_len_out = data_len;
+  return 0;
+}
+
+/*
+ * Reads the next block of a block file, returns 0 with a NULL block once the end of
+ * the file was reached in between two blocks...
+ */
+static int read_block_from_file(FILE *file, uint8_t **data, size_t *data_capacity, block_t **block_out)
+{
+  assert(file != NULL);
+  assert(block_out != NULL);
+  *block_out = NULL;
+
+  uint32_t data_len = 0;
+  if (read_block_size_from_file(file, &data_len))
+  {
+    return 1;
+  }
+
+  if (data_len == 0)
+  {
+    return 0;
+  }
+
+  // the read buffer is reused for every block and only ever grows
+  if (data_len > *data_capacity)
+  {
+    *data = realloc(*data, data_len);
+    assert(*data != NULL);
+    *data_capacity = data_len;
+  }
+
+  if (fread(*data, 1, data_len, file) != data_len)
+  {
+    return 1;
+  }
+
+  buffer_t *buffer = buffer_init_data(0, *data, data_len);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+  block_t *block = NULL;
+  int result = deserialize_block(buffer_iterator, &block) ||
+    deserialize_transactions_to_block_in_arena(buffer_iterator, block) ||
+    buffer_get_remaining_size(buffer_iterator) > 0;
+
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  if (result)
+  {
+    if (block != NULL)
+    {
+      free_block(block);
+    }
+
+    return 1;
+  }
+
+  *block_out = block;
+  return 0;
+}
+
+/*
+ * Reads only the header of the next block of a block file and seeks past
+ * the block's transactions, the header is NULL at the end of the file...
+ */
+static int read_block_header_from_file(FILE *file, block_t **header_out)
+{
+  assert(file != NULL);
+  assert(header_out != NULL);
+  *header_out = NULL;
+
+  uint32_t data_len = 0;
+  if (read_block_size_from_file(file, &data_len))
+  {
+    return 1;
+  }
+
+  if (data_len == 0)
+  {
+    return 0;
+  }
+
+  uint8_t data[BLOCK_FILE_MAX_HEADER_DATA_SIZE];
+  uint32_t header_data_len = MIN(data_len, (uint32_t)sizeof(data));
+  if (fread(data, 1, header_data_len, file) != header_data_len)
+  {
+    return 1;
+  }
+
+  buffer_t *buffer = buffer_init_data(0, data, header_data_len);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+  block_t *header = NULL;
+  int result = deserialize_block(buffer_iterator, &header);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  if (result)
+  {
+    if (header != NULL)
+    {
+      free_block(header);
+    }
+
+    return 1;
+  }
+
+  if (fseek(file, (long)(data_len - header_data_len), SEEK_CUR) != 0)
+  {
+    free_block(header);
+    return 1;
+  }
+
+  *header_out = header;
+  return 0;
+}
+
+/*
+ * Scans the headers at the start of a block file for the last checkpointed block they
+ * lead up to, the headers must each build on top of the previous one so every block up
+ * to the checkpointed block is one of it's ancestors and can be assumed valid.
+ * Returns the number of blocks at the start of the file which can be assumed valid.
+ */
+static uint32_t get_block_file_num_assume_valid_blocks(FILE *file)
+{
+  assert(file != NULL);
+  uint32_t num_assume_valid_blocks = 0;
+  uint32_t num_headers = 0;
+  uint32_t height = 0;
+  uint8_t previous_hash[HASH_SIZE];
+
+  while (1)
+  {
+    block_t *header = NULL;
+    if (read_block_header_from_file(file, &header) || header == NULL)
+    {
+      break;
+    }
+
+    // the height of the first block is only known when it's the genesis block
+    // or when it builds on top of one of our blocks...
+    int valid_header = 1;
+    if (num_headers == 0)
+    {
+      if (is_genesis_block(header->hash))
+      {
+        height = 0;
+      }
+      else
+      {
+        int32_t previous_height = get_block_height_from_hash(header->previous_hash);
+        valid_header = previous_height >= 0;
+        height = (uint32_t)(previous_height + 1);
+      }
+    }
+    else
+    {
+      valid_header = compare_hash(header->previous_hash, previous_hash);
+      height++;
+    }
+
+    if (valid_header && has_checkpoint_hash_by_height(height))
+    {
+      uint8_t *checkpoint_hash = NULL;
+      assert(get_checkpoint_hash_from_height(height, &checkpoint_hash) == 0);
+      valid_header = compare_hash(header->hash, checkpoint_hash);
+      if (valid_header)
+      {
+        num_assume_valid_blocks = num_headers + 1;
+      }
+    }
+
+    memcpy(previous_hash, header->hash, HASH_SIZE);
+    free_block(header);
+    if (valid_header == 0)
+    {
+      break;
+    }
+
+    num_headers++;
+  }
+
+  return num_assume_valid_blocks;
+}
+
+/*
+ * Imports the blocks of a block file on top of our blockchain, the blocks we already
+ * have are skipped so an interrupted import can be picked up again. Each block goes
+ * through full validation with it's transactions checked across the validation threads,
+ * only the txin signatures of the blocks leading up to a checkpoint are assumed valid,
+ * the blocks are committed without any durability until the import ends and then flushed...
+ */
+int import_blocks_from_file(const char *filename)
+{
+  assert(filename != NULL);
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL)
+  {
+    LOG_ERROR("Could not open block file: %s for reading!", filename);
+    return 1;
+  }
+
+  // the headers are scanned first to find the blocks which lead up to a checkpoint
+  uint32_t num_assume_valid_blocks = 0;
+  if (get_assume_valid())
+  {
+    num_assume_valid_blocks = get_block_file_num_assume_valid_blocks(file);
+    if (fseek(file, 0, SEEK_SET) != 0)
+    {
+      LOG_ERROR("Could not import blocks, failed to rewind block file: %s!", filename);
+      fclose(file);
+      return 1;
+    }
+
+    LOG_INFO("Assuming the first %u blocks of block file: %s are valid up to the last checkpoint.",
+      num_assume_valid_blocks, filename);
+  }
+
+  LOG_INFO("Importing blocks from block file: %s...", filename);
+  int durability = get_blockchain_durability();
+  if (set_blockchain_durability(BLOCKCHAIN_DURABILITY_NONE))
+  {
+    fclose(file);
+    return 1;
+  }
+
+  uint8_t *data = NULL;
+  size_t data_capacity = 0;
+  uint32_t num_imported_blocks = 0;
+  uint32_t num_skipped_blocks = 0;
+  int result = 0;
+
+  while (1)
+  {
+    block_t *block = NULL;
+    if (read_block_from_file(file, &data, &data_capacity, &block))
+    {
+      LOG_ERROR("Could not import blocks, invalid block after %u blocks in block file: %s!",
+        num_imported_blocks + num_skipped_blocks, filename);
+      result = 1;
+      break;
+    }
+
+    if (block == NULL)
+    {
+      break;
+    }
+
+    uint32_t block_index = num_imported_blocks + num_skipped_blocks;
+    if (has_block_by_hash(block->hash))
+    {
+      free_block(block);
+      num_skipped_blocks++;
+      continue;
+    }
+
+    int insert_result = 0;
+    if (block_index < num_assume_valid_blocks)
+    {
+      insert_result = validate_and_insert_block_assume_valid(block);
+    }
+    else
+    {
+      insert_result = validate_and_insert_block(block);
+    }
+
+    if (insert_result)
+    {
+      char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
+      LOG_ERROR("Could not import blocks, failed to insert block: %s on top of height: %u!",
+        block_hash_str, get_block_height());
+      free(block_hash_str);
+      free_block(block);
+      result = 1;
+      break;
+    }
+
+    free_block(block);
+    num_imported_blocks++;
+    if (num_imported_blocks % BLOCK_FILE_LOG_INTERVAL == 0)
+    {
+      LOG_INFO("Imported blocks up to height: %u...", get_block_height());
+    }
+  }
+
+  free(data);
+  fclose(file);
+
+  // the blocks imported so far are kept even when the import failed part way
+  if (set_blockchain_durability(durability) || flush_blockchain())
+  {
+    return 1;
+  }
+
+  if (result == 0)
+  {
+    LOG_INFO("Successfully imported %u blocks from block file: %s, skipped %u blocks we already had.",
+      num_imported_blocks, filename, num_skipped_blocks);
+  }
+
+  return result;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+#include "block.h"
+
+VULKAN_BEGIN_DECL
+
+// a progress message is logged every this many blocks imported or exported
+#define BLOCK_FILE_LOG_INTERVAL 10000
+
+// enough of a block's data to hold it's serialized header, the rest is skipped when
+// scanning the headers of a block file...
+#define BLOCK_FILE_MAX_HEADER_DATA_SIZE (BLOCK_HEADER_SIZE * 2)
+
+/* A block file is a flat stream of the main chain's blocks in height order starting at
+ * the genesis block, each block is prefixed by the size of it's serialized header and
+ * transactions as a big endian uint32. Block files can be concatenated as long as the
+ * blocks keep building on top of each other...
+ */
+VULKAN_API int export_blocks_to_file(const char *filename);
+VULKAN_API int import_blocks_from_file(const char *filename);
+
+VULKAN_END_DECL
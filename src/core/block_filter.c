@@ -0,0 +1,380 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sodium.h>
+
+#include "common/buffer.h"
+#include "common/byteorder.h"
+#include "common/util.h"
+
+#include "block.h"
+#include "block_filter.h"
+#include "transaction.h"
+
+/*
+ * The items of a block filter are hashed with a key taken from the block's hash and
+ * mapped onto the range [0, num_values * BLOCK_FILTER_M) once duplicates are dropped, the
+ * sorted values are then written as golomb-rice coded deltas. A filter is the number of items it holds
+ * followed by the coded deltas, the last byte is padded with zero bits...
+ */
+typedef struct BitWriter
+{
+  buffer_t *buffer;
+  uint8_t byte;
+  uint8_t num_bits;
+} bit_writer_t;
+
+typedef struct BitReader
+{
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+  uint8_t num_bits;
+} bit_reader_t;
+
+static uint64_t mul_high_64(uint64_t a, uint64_t b)
+{
+  uint64_t a_lo = (uint32_t)a;
+  uint64_t a_hi = a >> 32;
+  uint64_t b_lo = (uint32_t)b;
+  uint64_t b_hi = b >> 32;
+
+  uint64_t lo_lo = a_lo * b_lo;
+  uint64_t hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi;
+  uint64_t hi_hi = a_hi * b_hi;
+
+  uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+  return hi_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+static uint64_t hash_block_filter_item(const uint8_t *key, const uint8_t *data, size_t size)
+{
+  uint8_t hash[crypto_shorthash_BYTES];
+  crypto_shorthash(hash, data, size, key);
+
+  uint64_t value = 0;
+  for (int i = crypto_shorthash_BYTES - 1; i >= 0; i--)
+  {
+    value = (value << 8) | hash[i];
+  }
+
+  return value;
+}
+
+static int compare_block_filter_values(const void *a, const void *b)
+{
+  uint64_t value = *(const uint64_t*)a;
+  uint64_t other_value = *(const uint64_t*)b;
+  return (value > other_value) - (value < other_value);
+}
+
+static int write_bits(bit_writer_t *writer, uint64_t value, uint32_t num_bits)
+{
+  assert(writer != NULL);
+  for (uint32_t i = num_bits; i > 0; i--)
+  {
+    writer->byte = (uint8_t)((writer->byte << 1) | ((value >> (i - 1)) & 1));
+    writer->num_bits++;
+    if (writer->num_bits == 8)
+    {
+      if (buffer_write_uint8(writer->buffer, writer->byte))
+      {
+        return 1;
+      }
+
+      writer->byte = 0;
+      writer->num_bits = 0;
+    }
+  }
+
+  return 0;
+}
+
+static int flush_bits(bit_writer_t *writer)
+{
+  assert(writer != NULL);
+  if (writer->num_bits == 0)
+  {
+    return 0;
+  }
+
+  return write_bits(writer, 0, 8 - writer->num_bits);
+}
+
+static int read_bit(bit_reader_t *reader, uint8_t *bit)
+{
+  assert(reader != NULL);
+  assert(bit != NULL);
+  if (reader->offset >= reader->size)
+  {
+    return 1;
+  }
+
+  *bit = (reader->data[reader->offset] >> (7 - reader->num_bits)) & 1;
+  reader->num_bits++;
+  if (reader->num_bits == 8)
+  {
+    reader->offset++;
+    reader->num_bits = 0;
+  }
+
+  return 0;
+}
+
+static int write_golomb_rice(bit_writer_t *writer, uint64_t delta)
+{
+  assert(writer != NULL);
+  for (uint64_t quotient = delta >> BLOCK_FILTER_P; quotient > 0; quotient--)
+  {
+    if (write_bits(writer, 1, 1))
+    {
+      return 1;
+    }
+  }
+
+  return write_bits(writer, 0, 1) || write_bits(writer, delta, BLOCK_FILTER_P);
+}
+
+static int read_golomb_rice(bit_reader_t *reader, uint64_t *delta)
+{
+  assert(reader != NULL);
+  assert(delta != NULL);
+
+  uint64_t quotient = 0;
+  uint8_t bit = 0;
+  for (;;)
+  {
+    if (read_bit(reader, &bit))
+    {
+      return 1;
+    }
+
+    if (bit == 0)
+    {
+      break;
+    }
+
+    quotient++;
+  }
+
+  uint64_t remainder = 0;
+  for (uint32_t i = 0; i < BLOCK_FILTER_P; i++)
+  {
+    if (read_bit(reader, &bit))
+    {
+      return 1;
+    }
+
+    remainder = (remainder << 1) | bit;
+  }
+
+  *delta = (quotient << BLOCK_FILTER_P) | remainder;
+  return 0;
+}
+
+void get_block_filter_outpoint(uint8_t *outpoint, const uint8_t *tx_id, uint32_t txout_index)
+{
+  assert(outpoint != NULL);
+  assert(tx_id != NULL);
+  uint32_t index = swap_le(txout_index);
+  memcpy(outpoint, tx_id, HASH_SIZE);
+  memcpy(outpoint + HASH_SIZE, &index, sizeof(uint32_t));
+}
+
+/*
+ * Builds the filter of a block over the addresses paid by it's txouts and the
+ * outpoints spent by it's txins, duplicate items are only written once.
+ */
+int serialize_block_filter(buffer_t *buffer, block_t *block)
+{
+  assert(buffer != NULL);
+  assert(block != NULL);
+
+  uint64_t num_items = 0;
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
+    num_items += tx->txin_count + tx->txout_count;
+  }
+
+  uint64_t *values = NULL;
+  if (num_items > 0)
+  {
+    values = malloc(sizeof(uint64_t) * num_items);
+    assert(values != NULL);
+  }
+
+  const uint8_t *key = block->hash;
+  uint64_t value_index = 0;
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
+    {
+      input_transaction_t *txin = tx->txins[txin_index];
+      assert(txin != NULL);
+
+      uint8_t outpoint[BLOCK_FILTER_OUTPOINT_SIZE];
+      get_block_filter_outpoint(outpoint, txin->transaction, txin->txout_index);
+      values[value_index++] = hash_block_filter_item(key, outpoint, sizeof(outpoint));
+    }
+
+    for (uint32_t txout_index = 0; txout_index < tx->txout_count; txout_index++)
+    {
+      output_transaction_t *txout = tx->txouts[txout_index];
+      assert(txout != NULL);
+      values[value_index++] = hash_block_filter_item(key, txout->address, ADDRESS_SIZE);
+    }
+  }
+
+  assert(value_index == num_items);
+  if (num_items > 0)
+  {
+    qsort(values, num_items, sizeof(uint64_t), compare_block_filter_values);
+  }
+
+  // the same address is often paid more than once within a block, the hashes
+  // are wide enough that two different items sharing a hash does not matter
+  uint64_t num_values = 0;
+  for (uint64_t i = 0; i < num_items; i++)
+  {
+    if (num_values == 0 || values[num_values - 1] != values[i])
+    {
+      values[num_values++] = values[i];
+    }
+  }
+
+  if (buffer_write_uint32(buffer, (uint32_t)num_values))
+  {
+    goto serialize_filter_fail;
+  }
+
+  // mapping the hashes onto the range keeps them sorted, two hashes may
+  // map onto the same value in which case a delta of zero is written
+  bit_writer_t writer = {buffer, 0, 0};
+  uint64_t range = num_values * BLOCK_FILTER_M;
+  uint64_t last_value = 0;
+  for (uint64_t i = 0; i < num_values; i++)
+  {
+    uint64_t value = mul_high_64(values[i], range);
+    if (write_golomb_rice(&writer, value - last_value))
+    {
+      goto serialize_filter_fail;
+    }
+
+    last_value = value;
+  }
+
+  if (flush_bits(&writer))
+  {
+    goto serialize_filter_fail;
+  }
+
+  free(values);
+  return 0;
+
+serialize_filter_fail:
+  free(values);
+  return 1;
+}
+
+/*
+ * Checks whether any of the items may be in the block, a filter can
+ * only tell that an item is definitely not in the block. Filters that cannot be
+ * decoded are treated as matching so that the caller falls back to the block itself.
+ */
+int match_block_filter(const uint8_t *block_hash, const uint8_t *filter, size_t filter_size, block_filter_item_t *items, uint32_t num_items)
+{
+  assert(block_hash != NULL);
+  assert(filter != NULL);
+  if (num_items == 0)
+  {
+    return 0;
+  }
+
+  assert(items != NULL);
+  if (filter_size < sizeof(uint32_t))
+  {
+    return 1;
+  }
+
+  uint32_t num_filter_items = 0;
+  memcpy(&num_filter_items, filter, sizeof(uint32_t));
+  num_filter_items = swap_le(num_filter_items);
+  if (num_filter_items == 0)
+  {
+    return 0;
+  }
+
+  uint64_t range = (uint64_t)num_filter_items * BLOCK_FILTER_M;
+  uint64_t *values = malloc(sizeof(uint64_t) * num_items);
+  assert(values != NULL);
+
+  for (uint32_t i = 0; i < num_items; i++)
+  {
+    assert(items[i].data != NULL);
+    values[i] = mul_high_64(hash_block_filter_item(block_hash, items[i].data, items[i].size), range);
+  }
+
+  qsort(values, num_items, sizeof(uint64_t), compare_block_filter_values);
+
+  // both the filter's values and the items are sorted, so they are
+  // merged with a single pass over each of them...
+  bit_reader_t reader = {filter + sizeof(uint32_t), filter_size - sizeof(uint32_t), 0, 0};
+  uint64_t filter_value = 0;
+  uint32_t value_index = 0;
+  int matched = 0;
+  for (uint32_t i = 0; i < num_filter_items && value_index < num_items; i++)
+  {
+    uint64_t delta = 0;
+    if (read_golomb_rice(&reader, &delta))
+    {
+      matched = 1;
+      break;
+    }
+
+    filter_value += delta;
+    while (value_index < num_items && values[value_index] < filter_value)
+    {
+      value_index++;
+    }
+
+    if (value_index < num_items && values[value_index] == filter_value)
+    {
+      matched = 1;
+      break;
+    }
+  }
+
+  free(values);
+  return matched;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/buffer.h"
+#include "common/util.h"
+#include "common/vulkan.h"
+
+#include "block.h"
+#include "parameters.h"
+
+VULKAN_BEGIN_DECL
+
+// the golomb-rice parameter and false positive rate of the block filters, an item which
+// is not in a block matches it's filter with a probability of 1 / BLOCK_FILTER_M...
+#define BLOCK_FILTER_P 19
+#define BLOCK_FILTER_M 784931
+
+#define BLOCK_FILTER_OUTPOINT_SIZE (HASH_SIZE + sizeof(uint32_t))
+
+// filters larger than a block are never built, so this also bounds the filters read from peers
+#define MAX_BLOCK_FILTER_SIZE MAX_BLOCK_SIZE
+
+/*
+ * An item matched against a block filter, either an address paid by one of the
+ * block's txouts or an outpoint spent by one of it's txins.
+ */
+typedef struct BlockFilterItem
+{
+  const uint8_t *data;
+  size_t size;
+} block_filter_item_t;
+
+VULKAN_API void get_block_filter_outpoint(uint8_t *outpoint, const uint8_t *tx_id, uint32_t txout_index);
+
+VULKAN_API int serialize_block_filter(buffer_t *buffer, block_t *block);
+VULKAN_API int match_block_filter(const uint8_t *block_hash, const uint8_t *filter, size_t filter_size, block_filter_item_t *items, uint32_t num_items);
+
+VULKAN_END_DECL
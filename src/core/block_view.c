@@ -0,0 +1,188 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "common/buffer_iterator.h"
+#include "common/buffer.h"
+#include "common/util.h"
+
+#include "crypto/cryptoutil.h"
+
+#include "block_view.h"
+
+/*
+ * Points the bytes at the length prefixed field the iterator is at, when an expected
+ * size is given the field must be exactly that size.
+ */
+static int read_view_bytes32(buffer_iterator_t *buffer_iterator, uint32_t expected_size, const uint8_t **bytes)
+{
+  uint32_t size = 0;
+  if (buffer_read_uint32(buffer_iterator, &size))
+  {
+    return 1;
+  }
+
+  if ((expected_size > 0 && size != expected_size) || buffer_get_remaining_size(buffer_iterator) < size)
+  {
+    return 1;
+  }
+
+  if (bytes != NULL)
+  {
+    *bytes = buffer_get_remaining_data(buffer_iterator);
+  }
+
+  buffer_iterator_set_offset(buffer_iterator, buffer_iterator_get_offset(buffer_iterator) + size);
+  return 0;
+}
+
+/*
+ * Initializes a view over a block header as written by `serialize_block`, any data
+ * following the header such as inline transactions is not part of the view.
+ */
+int init_block_view(block_view_t *block_view, const uint8_t *data, size_t size)
+{
+  assert(block_view != NULL);
+  assert(data != NULL || size == 0);
+
+  buffer_t buffer = {(uint8_t*)data, size, 0};
+  buffer_iterator_t buffer_iterator = {&buffer, 0};
+  if (buffer_read_uint32(&buffer_iterator, &block_view->version) ||
+      read_view_bytes32(&buffer_iterator, HASH_SIZE, &block_view->previous_hash) ||
+      read_view_bytes32(&buffer_iterator, HASH_SIZE, &block_view->hash) ||
+      buffer_read_uint32(&buffer_iterator, &block_view->timestamp) ||
+      buffer_read_uint32(&buffer_iterator, &block_view->nonce) ||
+      buffer_read_uint32(&buffer_iterator, &block_view->bits) ||
+      buffer_read_uint64(&buffer_iterator, &block_view->cumulative_emission) ||
+      read_view_bytes32(&buffer_iterator, HASH_SIZE, &block_view->merkle_root) ||
+      buffer_read_uint32(&buffer_iterator, &block_view->transaction_count))
+  {
+    return 1;
+  }
+
+  block_view->data = data;
+  block_view->size = buffer_iterator_get_offset(&buffer_iterator);
+  return 0;
+}
+
+/*
+ * Initializes a view over the transaction at the start of the data as written by
+ * `serialize_transaction`, the size of the view is the size of the serialized tx.
+ */
+int init_transaction_view(transaction_view_t *tx_view, const uint8_t *data, size_t size)
+{
+  assert(tx_view != NULL);
+  assert(data != NULL || size == 0);
+
+  buffer_t buffer = {(uint8_t*)data, size, 0};
+  buffer_iterator_t buffer_iterator = {&buffer, 0};
+  if (read_view_bytes32(&buffer_iterator, HASH_SIZE, &tx_view->id) ||
+      buffer_read_uint32(&buffer_iterator, &tx_view->txin_count) ||
+      buffer_read_uint32(&buffer_iterator, &tx_view->txout_count))
+  {
+    return 1;
+  }
+
+  // skip over the txins, each is the previous tx id, the txout index,
+  // the signature and the public key...
+  for (uint32_t i = 0; i < tx_view->txin_count; i++)
+  {
+    uint32_t txout_index = 0;
+    if (read_view_bytes32(&buffer_iterator, 0, NULL) ||
+        buffer_read_uint32(&buffer_iterator, &txout_index) ||
+        read_view_bytes32(&buffer_iterator, 0, NULL) ||
+        read_view_bytes32(&buffer_iterator, 0, NULL))
+    {
+      return 1;
+    }
+  }
+
+  // and then the txouts, which are the amount and the address
+  for (uint32_t i = 0; i < tx_view->txout_count; i++)
+  {
+    uint64_t amount = 0;
+    if (buffer_read_uint64(&buffer_iterator, &amount) ||
+        read_view_bytes32(&buffer_iterator, 0, NULL))
+    {
+      return 1;
+    }
+  }
+
+  tx_view->data = data;
+  tx_view->size = buffer_iterator_get_offset(&buffer_iterator);
+  return 0;
+}
+
+/*
+ * Fills in the offset of each of the serialized transactions in the data, the
+ * offsets array must have room for the transaction count plus one entry, the
+ * last of which is set to the end of the last transaction.
+ */
+int get_transaction_view_offsets(size_t *offsets, const uint8_t *data, size_t size, uint32_t transaction_count)
+{
+  assert(offsets != NULL);
+  assert(data != NULL || size == 0);
+
+  size_t offset = 0;
+  for (uint32_t i = 0; i < transaction_count; i++)
+  {
+    transaction_view_t tx_view;
+    if (init_transaction_view(&tx_view, data + offset, size - offset))
+    {
+      return 1;
+    }
+
+    offsets[i] = offset;
+    offset += tx_view.size;
+  }
+
+  offsets[transaction_count] = offset;
+  return 0;
+}
+
+/*
+ * Finds the serialized transaction at the index by skipping over the ones before it.
+ */
+int get_transaction_view_at(transaction_view_t *tx_view, const uint8_t *data, size_t size, uint32_t tx_index)
+{
+  assert(tx_view != NULL);
+  assert(data != NULL || size == 0);
+
+  size_t offset = 0;
+  for (uint32_t i = 0; i <= tx_index; i++)
+  {
+    if (init_transaction_view(tx_view, data + offset, size - offset))
+    {
+      return 1;
+    }
+
+    offset += tx_view->size;
+  }
+
+  return 0;
+}
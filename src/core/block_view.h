@@ -0,0 +1,73 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+/*
+ * Read-only views over serialized blocks and transactions, the fields are read in place
+ * from the serialized data and the hashes point into it, so a view is only valid for as
+ * long as the data it was initialized from. Views are never allocated, they live on the
+ * stack of the caller or inside of the structure holding the data...
+ */
+typedef struct BlockView
+{
+  const uint8_t *data;
+  size_t size;
+
+  uint32_t version;
+  const uint8_t *previous_hash;
+  const uint8_t *hash;
+  uint32_t timestamp;
+  uint32_t nonce;
+  uint32_t bits;
+  uint64_t cumulative_emission;
+  const uint8_t *merkle_root;
+  uint32_t transaction_count;
+} block_view_t;
+
+typedef struct TransactionView
+{
+  const uint8_t *data;
+  size_t size;
+
+  const uint8_t *id;
+  uint32_t txin_count;
+  uint32_t txout_count;
+} transaction_view_t;
+
+VULKAN_API int init_block_view(block_view_t *block_view, const uint8_t *data, size_t size);
+VULKAN_API int init_transaction_view(transaction_view_t *tx_view, const uint8_t *data, size_t size);
+
+VULKAN_API int get_transaction_view_offsets(size_t *offsets, const uint8_t *data, size_t size, uint32_t transaction_count);
+VULKAN_API int get_transaction_view_at(transaction_view_t *tx_view, const uint8_t *data, size_t size, uint32_t tx_index);
+
+VULKAN_END_DECL
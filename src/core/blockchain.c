@@ -32,28 +32,36 @@
 #include <inttypes.h>
 
 #include <openssl/bn.h>
-
-#ifdef USE_LEVELDB
-#include <leveldb/c.h>
-#else
-#include <rocksdb/c.h>
-#endif
+#include <sodium.h>
 
 #include "common/buffer_iterator.h"
 #include "common/buffer.h"
 #include "common/logger.h"
+#include "common/metrics.h"
+#include "common/task.h"
 #include "common/tinycthread.h"
+#include "common/trace.h"
 #include "common/util.h"
 #include "common/vec.h"
 
 #include "block.h"
+#include "block_cache.h"
+#include "block_filter.h"
+#include "checkpoint.h"
 #include "genesis.h"
 #include "blockchain.h"
+#include "header_index.h"
 #include "mempool.h"
+#include "orphan_pool.h"
 #include "pow.h"
+#include "storage.h"
+#include "utxo_cache.h"
+#include "utxo_snapshot.h"
+#include "validator.h"
 
 #include "crypto/bignum_util.h"
 #include "crypto/cryptoutil.h"
+#include "crypto/muhash.h"
 
 #include "wallet/wallet.h"
 
@@ -70,124 +78,96 @@ static uint8_t g_blockchain_current_block_hash[HASH_SIZE] = {
   0x00, 0x00, 0x00, 0x00
 };
 
+static uint32_t g_blockchain_current_block_height = 0;
+
+// the height of the top block who's unspent tx changes have all been
+// written to the unspent index, anything above this lives in the utxo cache
+static uint32_t g_blockchain_top_unspent_tx_height = 0;
+
 static const char *g_blockchain_dir = NULL;
 static const char *g_blockchain_backup_dir = "_backup";
 
 static int g_blockchain_want_compression = 1;
 
-static int g_blockchain_is_open = 0;
-static int g_blockchain_backup_is_open = 0;
+static size_t g_blockchain_db_cache_size = DEFAULT_BLOCKCHAIN_DB_CACHE_SIZE;
+static uint32_t g_blockchain_db_bloom_bits_per_key = DEFAULT_BLOCKCHAIN_DB_BLOOM_BITS_PER_KEY;
+static size_t g_blockchain_db_prefix_length = 0;
+static uint32_t g_blockchain_db_num_background_jobs = 0;
+static size_t g_blockchain_db_write_buffer_size = 0;
 
-#ifdef USE_LEVELDB
-static int g_blockchain_compression_type = leveldb_snappy_compression;
-static leveldb_t *g_blockchain_db = NULL;
-static leveldb_t *g_blockchain_backup_db = NULL;
-#else
-static int g_blockchain_compression_type = rocksdb_lz4_compression;
-static rocksdb_t *g_blockchain_db = NULL;
-static rocksdb_backup_engine_t *g_blockchain_backup_db = NULL;
-#endif
+// blocks inserted while the block filters are disabled are left without a filter
+static int g_blockchain_block_filters_enabled = 0;
 
-int valid_compression_type(int compression_type)
-{
-  switch (compression_type)
-  {
-  #ifdef USE_LEVELDB
-    case leveldb_snappy_compression:
-      return 1;
-    case leveldb_no_compression:
-    default:
-      return 0;
-  #else
-    case rocksdb_snappy_compression:
-    case rocksdb_zlib_compression:
-    case rocksdb_bz2_compression:
-    case rocksdb_lz4_compression:
-    case rocksdb_lz4hc_compression:
-    case rocksdb_xpress_compression:
-    case rocksdb_zstd_compression:
-      return 1;
-    case rocksdb_no_compression:
-    default:
-      return 0;
-  #endif
-  }
-}
+// every block below the tx index height has it's txs in the tx index, the txs of
+// blocks inserted while the tx index is disabled are indexed in the background later
+static int g_blockchain_tx_index_enabled = 0;
+static uint32_t g_blockchain_tx_index_height = 0;
+static task_t *g_blockchain_tx_index_backfill_task = NULL;
 
-const char* get_compression_type_str(int compression_type)
-{
-  switch (compression_type)
-  {
-  #ifdef USE_LEVELDB
-    case leveldb_snappy_compression:
-      return "snappy";
-    case leveldb_no_compression:
-    default:
-      return "unknown";
-  #else
-    case rocksdb_snappy_compression:
-      return "snappy";
-    case rocksdb_zlib_compression:
-      return "zlib";
-    case rocksdb_bz2_compression:
-      return "bz2";
-    case rocksdb_lz4_compression:
-      return "lz4";
-    case rocksdb_lz4hc_compression:
-      return "lz4hc";
-    case rocksdb_xpress_compression:
-      return "xpress";
-    case rocksdb_zstd_compression:
-      return "zstandard";
-    case rocksdb_no_compression:
-    default:
-      return "unknown";
-  #endif
-  }
-}
+// the unspent txs spent by downloaded blocks are read into the utxo cache by
+// jobs on the task schedulers while the blocks wait to be connected...
+static int g_blockchain_utxo_prefetch_running = 0;
+static job_group_t g_blockchain_utxo_prefetch_job_group;
+
+static int g_blockchain_is_open = 0;
+static int g_blockchain_backup_is_open = 0;
 
-int get_compression_type_from_str(const char *compression_type_str)
+// a compression type of -1 selects the storage backend's own default
+static int g_blockchain_compression_type = -1;
+static storage_t *g_blockchain_db = NULL;
+static storage_backup_t *g_blockchain_backup_db = NULL;
+
+static uint32_t g_blockchain_prune_depth = 0;
+static uint64_t g_blockchain_prune_target_size = 0;
+static uint32_t g_blockchain_pruned_height = 0;
+static uint64_t g_blockchain_stored_blocks_size = 0;
+
+// the multiset hash of every unspent txout as of our top block, including the
+// unspent tx changes which are still only held by the utxo cache
+static muhash_t g_blockchain_utxo_commitment;
+static int g_blockchain_stored_blocks_size_loaded = 0;
+
+static int g_blockchain_durability = BLOCKCHAIN_DURABILITY_BATCH;
+static uint32_t g_blockchain_durability_batch_blocks = DEFAULT_BLOCKCHAIN_DURABILITY_BATCH_BLOCKS;
+static uint32_t g_blockchain_durability_batch_interval_ms = DEFAULT_BLOCKCHAIN_DURABILITY_BATCH_INTERVAL_MS;
+static uint32_t g_blockchain_num_unsynced_block_commits = 0;
+static uint64_t g_blockchain_last_sync_ms = 0;
+
+// the tip is swapped in by the writers holding the blockchain lock, readers count
+// themselves in while they take a reference to it so a writer knows when the
+// previous tip can no longer be picked up...
+static _Atomic(blockchain_tip_t*) g_blockchain_tip = NULL;
+static atomic_uint g_blockchain_tip_num_acquiring = 0;
+
+static int g_blockchain_reorg_active = 0;
+
+// the wallet who's outputs are updated as blocks are connected and disconnected
+static wallet_t *g_blockchain_wallet = NULL;
+static uint32_t g_blockchain_reorg_fork_height = 0;
+static vec_void_t g_blockchain_reorg_blocks;
+
+typedef enum BlockValidationStage
 {
-#ifdef USE_LEVELDB
-  if (string_equals(compression_type_str, "snappy"))
-  {
-    return leveldb_snappy_compression;
-  }
+  BLOCK_VALIDATION_STAGE_SIGNATURES = 0,
+  BLOCK_VALIDATION_STAGE_TXINS,
+  BLOCK_VALIDATION_STAGE_UTXO,
+  BLOCK_VALIDATION_STAGE_DB_WRITE,
+  BLOCK_VALIDATION_STAGE_TOTAL,
+  NUM_BLOCK_VALIDATION_STAGES
+} block_validation_stage_t;
+
+static const char *g_block_validation_stages[NUM_BLOCK_VALIDATION_STAGES] = {
+  "signatures", "txins", "utxo", "db_write", "total"
+};
 
-  return leveldb_no_compression;
-#else
-  if (string_equals(compression_type_str, "snappy"))
-  {
-    return rocksdb_snappy_compression;
-  }
-  else if (string_equals(compression_type_str, "zlib"))
-  {
-    return rocksdb_zlib_compression;
-  }
-  else if (string_equals(compression_type_str, "bz2"))
-  {
-    return rocksdb_bz2_compression;
-  }
-  else if (string_equals(compression_type_str, "lz4"))
-  {
-    return rocksdb_lz4_compression;
-  }
-  else if (string_equals(compression_type_str, "lz4hc"))
-  {
-    return rocksdb_lz4hc_compression;
-  }
-  else if (string_equals(compression_type_str, "xpress"))
-  {
-    return rocksdb_xpress_compression;
-  }
-  else if (string_equals(compression_type_str, "zstandard"))
-  {
-    return rocksdb_zstd_compression;
-  }
+static const char *g_block_read_results[] = {"hit", "miss"};
 
-  return rocksdb_no_compression;
-#endif
-}
+// the signatures stage covers every stateless tx check, which the signatures dominate,
+// and the total covers a block from it's stateless checks until it is inserted...
+static metric_t g_block_validation_metric = METRIC_LABELED_HISTOGRAM_INIT("vulkan_block_validation_seconds",
+  "Time spent validating and inserting blocks by stage", "stage", g_block_validation_stages, NUM_BLOCK_VALIDATION_STAGES);
+static metric_t g_block_reads_metric = METRIC_LABELED_COUNTER_INIT("vulkan_block_reads_total",
+  "Full block reads from the database by whether the block was found", "result", g_block_read_results, 2);
 
 void set_want_blockchain_compression(int want_blockchain_compression)
 {
@@ -207,9 +187,102 @@ void set_blockchain_compression_type(int compression_type)
 
 int get_blockchain_compression_type(void)
 {
+  if (g_blockchain_compression_type < 0)
+  {
+    return get_default_compression_type();
+  }
+
   return g_blockchain_compression_type;
 }
 
+void set_blockchain_db_cache_size(size_t cache_size)
+{
+  g_blockchain_db_cache_size = cache_size;
+}
+
+size_t get_blockchain_db_cache_size(void)
+{
+  return g_blockchain_db_cache_size;
+}
+
+void set_blockchain_db_bloom_bits_per_key(uint32_t bloom_bits_per_key)
+{
+  g_blockchain_db_bloom_bits_per_key = bloom_bits_per_key;
+}
+
+uint32_t get_blockchain_db_bloom_bits_per_key(void)
+{
+  return g_blockchain_db_bloom_bits_per_key;
+}
+
+void set_blockchain_db_prefix_length(size_t prefix_length)
+{
+  g_blockchain_db_prefix_length = prefix_length;
+}
+
+size_t get_blockchain_db_prefix_length(void)
+{
+  return g_blockchain_db_prefix_length;
+}
+
+void set_blockchain_db_num_background_jobs(uint32_t num_background_jobs)
+{
+  g_blockchain_db_num_background_jobs = num_background_jobs;
+}
+
+uint32_t get_blockchain_db_num_background_jobs(void)
+{
+  return g_blockchain_db_num_background_jobs;
+}
+
+void set_blockchain_db_write_buffer_size(size_t write_buffer_size)
+{
+  g_blockchain_db_write_buffer_size = write_buffer_size;
+}
+
+size_t get_blockchain_db_write_buffer_size(void)
+{
+  return g_blockchain_db_write_buffer_size;
+}
+
+void set_blockchain_block_filters_enabled(int block_filters_enabled)
+{
+  g_blockchain_block_filters_enabled = block_filters_enabled;
+}
+
+int get_blockchain_block_filters_enabled(void)
+{
+  return g_blockchain_block_filters_enabled;
+}
+
+void set_blockchain_tx_index_enabled(int tx_index_enabled)
+{
+  g_blockchain_tx_index_enabled = tx_index_enabled;
+}
+
+int get_blockchain_tx_index_enabled(void)
+{
+  return g_blockchain_tx_index_enabled;
+}
+
+/*
+ * Fills in the options both the blockchain and it's backup are opened with. A cache size,
+ * bloom bits per key, background job count or write buffer size of 0 leaves the database's
+ * own default in place. The fixed prefix extractor is only supported by rocksdb...
+ */
+static void get_blockchain_storage_options(storage_options_t *options)
+{
+  assert(options != NULL);
+  init_storage_options(options);
+  options->want_compression = g_blockchain_want_compression;
+  options->compression_type = get_blockchain_compression_type();
+  options->cache_size = g_blockchain_db_cache_size;
+  options->bloom_bits_per_key = g_blockchain_db_bloom_bits_per_key;
+  options->prefix_length = g_blockchain_db_prefix_length;
+  options->num_background_jobs = g_blockchain_db_num_background_jobs;
+  options->write_buffer_size = g_blockchain_db_write_buffer_size;
+}
+
 const char* get_blockchain_dir(void)
 {
   return g_blockchain_dir;
@@ -229,41 +302,14 @@ int repair_blockchain(const char *blockchain_dir)
   }
 
   char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_options_t *options = leveldb_options_create();
-  leveldb_options_set_create_if_missing(options, 1);
-#else
-  rocksdb_options_t *options = rocksdb_options_create();
-  rocksdb_options_set_create_if_missing(options, 1);
-#endif
-
-#ifdef USE_LEVELDB
-  leveldb_repair_db(options, blockchain_dir, &err);
-#else
-  rocksdb_repair_db(options, blockchain_dir, &err);
-#endif
-
+  storage_repair(blockchain_dir, &err);
   if (err != NULL)
   {
     LOG_ERROR("Could not repair blockchain database: %s, error occurred: %s!", blockchain_dir, err);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_options_destroy(options);
-  #else
-    rocksdb_free(err);
-    rocksdb_options_destroy(options);
-  #endif
+    storage_free(err);
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_options_destroy(options);
-#else
-  rocksdb_free(err);
-  rocksdb_options_destroy(options);
-#endif
   LOG_INFO("Successfully repaired blockchain database: %s!", blockchain_dir);
   return 0;
 }
@@ -282,13 +328,25 @@ int load_blockchain_top_block(void)
     LOG_INFO("Initializing blockchain for Mainnet...");
   }
 
+  // the header index already holds every block up to the top block once the blockchain
+  // was opened, so neither the genesis block nor the top block have to be read
+  mtx_lock(&g_blockchain_lock);
+  header_index_entry_t *top_entry = get_header_index_top_entry();
+  if (top_entry != NULL && compare_hash(get_header_index_entry(0)->hash, genesis_block->hash))
+  {
+    set_current_block_hash(top_entry->hash);
+    publish_blockchain_tip_nolock();
+    LOG_INFO("Loaded blockchain top block: %s at height: %u", HASH2HEX_STR(top_entry->hash), get_block_height_nolock());
+    mtx_unlock(&g_blockchain_lock);
+    return 0;
+  }
+
+  mtx_unlock(&g_blockchain_lock);
   if (has_block_by_hash(genesis_block->hash) == 0)
   {
     if (validate_and_insert_block(genesis_block))
     {
-      char *genesis_block_hash_str = bin2hex(genesis_block->hash, HASH_SIZE);
-      LOG_ERROR("Could not insert genesis block into blockchain: %s", genesis_block_hash_str);
-      free(genesis_block_hash_str);
+      LOG_ERROR("Could not insert genesis block into blockchain: %s", HASH2HEX_STR(genesis_block->hash));
 
       printf("\n");
       print_block(genesis_block);
@@ -297,9 +355,7 @@ int load_blockchain_top_block(void)
       return 1;
     }
 
-    char *genesis_block_hash_str = bin2hex(genesis_block->hash, HASH_SIZE);
-    LOG_INFO("Loaded blockchain genesis block: %s", genesis_block_hash_str);
-    free(genesis_block_hash_str);
+    LOG_INFO("Loaded blockchain genesis block: %s", HASH2HEX_STR(genesis_block->hash));
   }
   else
   {
@@ -310,85 +366,114 @@ int load_blockchain_top_block(void)
       return 1;
     }
 
-    set_current_block(top_block);
-    free_block(top_block);
+    // the top block height was already loaded when the blockchain was opened
+    mtx_lock(&g_blockchain_lock);
+    set_current_block_hash(top_block->hash);
+    publish_blockchain_tip_nolock();
+    mtx_unlock(&g_blockchain_lock);
 
-    char *top_block_hash_str = bin2hex(top_block->hash, HASH_SIZE);
-    LOG_INFO("Loaded blockchain top block: %s", top_block_hash_str);
-    free(top_block_hash_str);
+    LOG_INFO("Loaded blockchain top block: %s at height: %u", HASH2HEX_STR(top_block->hash), get_block_height());
+    free_block(top_block);
   }
 
   return 0;
 }
 
-int open_blockchain(const char *blockchain_dir, int load_top_block)
+/*
+ * Loads the state kept in memory alongside the blockchain database,
+ * this is done once it's opened and again after it's been restored...
+ */
+static int load_blockchain_state_nolock(const char *blockchain_dir)
 {
-  char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_options_t *options = leveldb_options_create();
-  leveldb_options_set_create_if_missing(options, 1);
-#else
-  rocksdb_options_t *options = rocksdb_options_create();
+  if (load_top_block_height_nolock())
+  {
+    LOG_ERROR("Could not open blockchain database: %s, failed to load top block height!", blockchain_dir);
+    return 1;
+  }
+
+  // blockchain databases created before the height index existed need to
+  // have it rebuilt once from the top block before it can be queried...
+  if (backfill_block_height_index_nolock())
+  {
+    LOG_ERROR("Could not open blockchain database: %s, failed to backfill block height index!", blockchain_dir);
+    return 1;
+  }
+
+  // a blockchain which was closed cleanly left a manifest of it's chain state behind,
+  // otherwise the header index is loaded from the headers of every block...
+  int loaded_manifest = load_chain_state_manifest_nolock() == 0;
+  if (loaded_manifest == 0)
+  {
+    if (load_header_index_nolock())
+    {
+      LOG_ERROR("Could not open blockchain database: %s, failed to load header index!", blockchain_dir);
+      return 1;
+    }
 
-  // set the parallelism based on the number of logical cores available:
-  int total_threads = MIN(get_num_logical_cores(), 1);
-  total_threads = total_threads > 1 ? total_threads / 2 : total_threads;
-  rocksdb_options_increase_parallelism(options, total_threads);
+    if (load_utxo_commitment_nolock())
+    {
+      LOG_ERROR("Could not open blockchain database: %s, failed to load UTXO set commitment!", blockchain_dir);
+      return 1;
+    }
 
-  rocksdb_options_optimize_level_style_compaction(options, DEFAULT_COMPACTION_MEMTABLE_MEMORY_BUDGET);
-  rocksdb_options_set_create_if_missing(options, 1);
-#endif
+    if (load_top_unspent_tx_height_nolock())
+    {
+      LOG_ERROR("Could not open blockchain database: %s, failed to load unspent transactions!", blockchain_dir);
+      return 1;
+    }
+  }
 
-  if (g_blockchain_want_compression)
+  if (backfill_address_index_nolock())
   {
-  #ifdef USE_LEVELDB
-    leveldb_options_set_compression(options, g_blockchain_compression_type);
-  #else
-    rocksdb_options_set_compression(options, g_blockchain_compression_type);
-  #endif
+    LOG_ERROR("Could not open blockchain database: %s, failed to backfill address index!", blockchain_dir);
+    return 1;
   }
 
-#ifdef USE_LEVELDB
-  g_blockchain_db = leveldb_open(options, blockchain_dir, &err);
-#else
-  g_blockchain_db = rocksdb_open(options, blockchain_dir, &err);
-#endif
+  if (loaded_manifest == 0 && load_blockchain_pruned_height_nolock())
+  {
+    LOG_ERROR("Could not open blockchain database: %s, failed to load pruned height!", blockchain_dir);
+    return 1;
+  }
 
-  if (err != NULL)
+  if (prune_blockchain_nolock())
   {
-    LOG_ERROR("Could not open blockchain database: %s: %s", blockchain_dir, err);
+    LOG_ERROR("Could not open blockchain database: %s, failed to prune blockchain!", blockchain_dir);
+    return 1;
+  }
 
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_options_destroy(options);
-  #else
-    rocksdb_free(err);
-    rocksdb_options_destroy(options);
-  #endif
+  if (loaded_manifest == 0 && load_blockchain_tx_index_height_nolock())
+  {
+    LOG_ERROR("Could not open blockchain database: %s, failed to load tx index height!", blockchain_dir);
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_options_destroy(options);
-#else
-  rocksdb_free(err);
-  rocksdb_options_destroy(options);
-#endif
   return 0;
 }
 
-int remove_blockchain(const char *blockchain_dir)
+int open_blockchain(const char *blockchain_dir, int load_top_block)
 {
   char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_options_t *options = leveldb_options_create();
-  leveldb_destroy_db(options, blockchain_dir, &err);
-#else
-  rocksdb_options_t *options = rocksdb_options_create();
-  rocksdb_destroy_db(options, blockchain_dir, &err);
-#endif
+  storage_options_t options;
+  get_blockchain_storage_options(&options);
+
+  g_blockchain_db = storage_open(blockchain_dir, &options, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not open blockchain database: %s: %s", blockchain_dir, err);
+    storage_free(err);
+    return 1;
+  }
+
+  apply_blockchain_durability_nolock();
+  g_blockchain_num_unsynced_block_commits = 0;
+  g_blockchain_last_sync_ms = get_current_time_ms();
+  return load_blockchain_state_nolock(blockchain_dir);
+}
 
+int remove_blockchain(const char *blockchain_dir)
+{
+  char *err = NULL;
+  storage_destroy(blockchain_dir, &err);
   if (err != NULL)
   {
     LOG_ERROR("Failed to remove blockchain database: %s!", err);
@@ -396,387 +481,388 @@ int remove_blockchain(const char *blockchain_dir)
   }
 
   const char *blockchain_backup_dir = get_blockchain_backup_dir(blockchain_dir);
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_destroy_db(options, blockchain_backup_dir, &err);
-#else
-  rocksdb_free(err);
-  rocksdb_destroy_db(options, blockchain_backup_dir, &err);
-#endif
-
+  storage_backup_destroy(blockchain_backup_dir, &err);
   if (err != NULL)
   {
     LOG_ERROR("Failed to remove blockchain backup database: %s!", err);
     goto remove_db_fail;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_options_destroy(options);
-#else
-  rocksdb_free(err);
-  rocksdb_options_destroy(options);
-#endif
+  const char *manifest_filename = get_chain_state_manifest_filename(blockchain_dir);
+  remove(manifest_filename);
+  free((char*)manifest_filename);
+
   return 0;
 
 remove_db_fail:
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_options_destroy(options);
-#else
-  rocksdb_free(err);
-  rocksdb_options_destroy(options);
-#endif
+  storage_free(err);
   return 1;
 }
 
-int close_blockchain(void)
+static void swap_blockchain_tip(blockchain_tip_t *tip)
 {
-  if (g_blockchain_is_open == 0)
+  blockchain_tip_t *previous_tip = atomic_exchange(&g_blockchain_tip, tip);
+
+  // wait out the readers that may have loaded the previous tip but
+  // not yet taken their reference to it, then drop our own reference...
+  while (atomic_load(&g_blockchain_tip_num_acquiring) > 0)
   {
-    return 1;
+    thrd_yield();
   }
 
-#ifdef USE_LEVELDB
-  leveldb_close(g_blockchain_db);
-#else
-  rocksdb_close(g_blockchain_db);
-#endif
-
-  mtx_destroy(&g_blockchain_lock);
-  if (close_backup_blockchain())
+  if (previous_tip != NULL)
   {
-    return 1;
+    release_blockchain_tip(previous_tip);
   }
-
-  g_blockchain_is_open = 0;
-  return 0;
 }
 
-int open_backup_blockchain(const char *blockchain_backup_dir)
+/*
+ * Publishes our current top block as the new tip for the lock free readers, the
+ * intermediate top blocks of a reorg are never published, only where it ends up...
+ */
+void publish_blockchain_tip_nolock(void)
 {
-  char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_options_t *options = leveldb_options_create();
-  leveldb_options_set_create_if_missing(options, 1);
-#else
-  rocksdb_options_t *options = rocksdb_options_create();
-
-  // set the parallelism based on the number of logical cores available:
-  int total_threads = MIN(get_num_logical_cores(), 1);
-  total_threads = total_threads > 1 ? total_threads / 2 : total_threads;
-  rocksdb_options_increase_parallelism(options, total_threads);
-
-  rocksdb_options_optimize_level_style_compaction(options, DEFAULT_COMPACTION_MEMTABLE_MEMORY_BUDGET);
-  rocksdb_options_set_create_if_missing(options, 1);
-#endif
-
-  if (g_blockchain_want_compression)
+  if (g_blockchain_db == NULL || g_blockchain_reorg_active)
   {
-  #ifdef USE_LEVELDB
-    leveldb_options_set_compression(options, g_blockchain_compression_type);
-  #else
-    rocksdb_options_set_compression(options, g_blockchain_compression_type);
-  #endif
+    return;
   }
 
-#ifdef USE_LEVELDB
-  g_blockchain_backup_db = leveldb_open(options, blockchain_backup_dir, &err);
-#else
-  g_blockchain_backup_db = rocksdb_backup_engine_open(options, blockchain_backup_dir, &err);
-#endif
+  blockchain_tip_t *tip = malloc(sizeof(blockchain_tip_t));
+  assert(tip != NULL);
+  memcpy(tip->hash, g_blockchain_current_block_hash, HASH_SIZE);
+  tip->height = g_blockchain_current_block_height;
+  tip->pruned_height = g_blockchain_pruned_height;
+  tip->unspent_height = g_blockchain_top_unspent_tx_height;
 
-  if (err != NULL)
+  // an empty blockchain expects the genesis block next
+  if (get_header_index_entry_from_hash(tip->hash) != NULL)
   {
-    LOG_ERROR("Could not open backup blockchain database: %s: %s", blockchain_backup_dir, err);
+    tip->next_work_required = get_next_work_required_nolock(tip->hash);
+  }
+  else
+  {
+    tip->next_work_required = get_next_work_required_nolock(NULL);
+  }
 
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_options_destroy(options);
-  #else
-    rocksdb_free(err);
-    rocksdb_options_destroy(options);
-  #endif
-    return 1;
+  tip->storage = g_blockchain_db;
+  tip->snapshot = storage_snapshot_create(g_blockchain_db);
+  if (tip->snapshot == NULL)
+  {
+    LOG_WARNING("Could not create blockchain storage snapshot, the tip at height: %u is read without one!", tip->height);
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_options_destroy(options);
-#else
-  rocksdb_free(err);
-  rocksdb_options_destroy(options);
-#endif
-  return 0;
+  atomic_init(&tip->refcount, 1);
+  swap_blockchain_tip(tip);
 }
 
-int close_backup_blockchain(void)
+blockchain_tip_t* acquire_blockchain_tip(void)
 {
-  if (g_blockchain_backup_is_open == 0)
+  atomic_fetch_add(&g_blockchain_tip_num_acquiring, 1);
+  blockchain_tip_t *tip = atomic_load(&g_blockchain_tip);
+  if (tip != NULL)
   {
-    return 1;
+    atomic_fetch_add(&tip->refcount, 1);
   }
 
-  #ifdef USE_LEVELDB
-    leveldb_close(g_blockchain_backup_db);
-  #else
-    rocksdb_backup_engine_close(g_blockchain_backup_db);
-  #endif
-
-  g_blockchain_backup_is_open = 0;
-  return 0;
+  atomic_fetch_sub(&g_blockchain_tip_num_acquiring, 1);
+  return tip;
 }
 
-int init_blockchain(const char *blockchain_dir, int load_top_block)
+void release_blockchain_tip(blockchain_tip_t *tip)
 {
-  g_blockchain_dir = blockchain_dir;
-  g_blockchain_backup_dir = get_blockchain_backup_dir(g_blockchain_dir);
-  if (g_blockchain_is_open)
+  if (tip == NULL)
   {
-    LOG_ERROR("Cannot initialize blockchain: %s, blockchain is already open!", g_blockchain_dir);
-    return 1;
+    return;
   }
 
-  if (g_blockchain_backup_is_open)
+  if (atomic_fetch_sub(&tip->refcount, 1) == 1)
   {
-    LOG_ERROR("Cannot initialize backup blockchain: %s, backup blockchain is already open!", g_blockchain_backup_dir);
-    return 1;
-  }
+    if (tip->snapshot != NULL)
+    {
+      storage_snapshot_release(tip->storage, tip->snapshot);
+    }
 
-  mtx_init(&g_blockchain_lock, mtx_recursive);
-  if (g_blockchain_want_compression)
-  {
-    LOG_INFO("Blockchain storage compression is enabled, using the `%s` compression algorithm",
-      get_compression_type_str(g_blockchain_compression_type));
-  }
-  else
-  {
-    LOG_INFO("Blockchain storage compression is disabled");
+    free(tip);
   }
+}
 
-  if (open_blockchain(g_blockchain_dir, load_top_block))
+/*
+ * Reads a value of the blockchain database as it currently is, or as it was
+ * when the tip was published when reading at a tip...
+ */
+static uint8_t *get_blockchain_value(blockchain_tip_t *tip, const uint8_t *key, size_t key_size, size_t *value_size, char **err)
+{
+  if (tip != NULL && tip->snapshot != NULL)
   {
-    return 1;
+    return storage_snapshot_get(tip->storage, tip->snapshot, key, key_size, value_size, err);
   }
 
-  if (open_backup_blockchain(g_blockchain_backup_dir))
+  return storage_get(g_blockchain_db, key, key_size, value_size, err);
+}
+
+/*
+ * Same as get_blockchain_value for iterating the blockchain database.
+ */
+static storage_iterator_t* create_blockchain_iterator(blockchain_tip_t *tip)
+{
+  if (tip != NULL && tip->snapshot != NULL)
   {
-    return 1;
+    return storage_snapshot_iterator_create(tip->storage, tip->snapshot);
   }
 
-  if (load_top_block)
+  return storage_iterator_create(g_blockchain_db);
+}
+
+/*
+ * Gives the wallet to the blockchain so that it's outputs follow the blocks connected
+ * and disconnected from then on, the wallet is rescanned once if it was last synced
+ * to a different top block than ours. Passing NULL stops updating the previous wallet.
+ */
+int set_blockchain_wallet(wallet_t *wallet)
+{
+  mtx_lock(&g_blockchain_lock);
+  if (wallet != NULL && compare_hash(wallet->synced_block_hash, g_blockchain_current_block_hash) == 0)
   {
-    if (load_blockchain_top_block())
+    // a wallet that fell behind only has to read the blocks which concern it
+    // when their filters are available, otherwise the wallet is rescanned
+    if (g_blockchain_block_filters_enabled && sync_wallet_from_block_filters_nolock(wallet) == 0)
+    {
+      g_blockchain_wallet = wallet;
+      mtx_unlock(&g_blockchain_lock);
+      return 0;
+    }
+
+    if (rescan_wallet_nolock(wallet))
     {
+      LOG_ERROR("Could not set blockchain wallet, failed to rescan wallet!");
+      mtx_unlock(&g_blockchain_lock);
       return 1;
     }
   }
 
-  LOG_INFO("Successfully initialized blockchain");
-  g_blockchain_is_open = 1;
-  g_blockchain_backup_is_open = 1;
+  g_blockchain_wallet = wallet;
+  mtx_unlock(&g_blockchain_lock);
   return 0;
 }
 
-#ifdef USE_LEVELDB
-int purge_all_entries_from_database(leveldb_t *db)
-#else
-int purge_all_entries_from_database(rocksdb_t *db)
-#endif
+wallet_t* get_blockchain_wallet(void)
 {
-  assert(db != NULL);
+  return g_blockchain_wallet;
+}
 
-  char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  leveldb_iterator_t *iterator = leveldb_create_iterator(db, roptions);
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_writebatch_t *write_batch = leveldb_writebatch_create();
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  rocksdb_iterator_t *iterator = rocksdb_create_iterator(db, roptions);
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_writebatch_t *write_batch = rocksdb_writebatch_create();
-#endif
-
-#ifdef USE_LEVELDB
-  for (leveldb_iter_seek_to_first(iterator);
-    leveldb_iter_valid(iterator); leveldb_iter_next(iterator))
-#else
-  for (rocksdb_iter_seek_to_first(iterator);
-    rocksdb_iter_valid(iterator); rocksdb_iter_next(iterator))
-#endif
+static void rescan_blockchain_wallet_nolock(void)
+{
+  if (g_blockchain_wallet != NULL && rescan_wallet_nolock(g_blockchain_wallet))
   {
-    size_t key_length;
-  #ifdef USE_LEVELDB
-    uint8_t *key = (uint8_t*)leveldb_iter_key(iterator, &key_length);
-    assert(key != NULL);
+    LOG_WARNING("Could not rescan blockchain wallet, it's outputs may be out of date!");
+  }
+}
 
-    leveldb_writebatch_delete(write_batch, (char*)key, key_length);
-  #else
-    uint8_t *key = (uint8_t*)rocksdb_iter_key(iterator, &key_length);
-    assert(key != NULL);
+static void write_block_cache_metrics(buffer_t *buffer)
+{
+  mtx_lock(&g_blockchain_lock);
+  size_t num_entries = get_block_cache_num_entries();
+  size_t memory_size = get_block_cache_memory_size();
+  uint64_t num_hits = get_block_cache_num_hits();
+  uint64_t num_misses = get_block_cache_num_misses();
+  size_t utxo_cache_num_entries = get_utxo_cache_num_entries();
+  size_t utxo_cache_memory_size = get_utxo_cache_memory_size();
+  uint32_t block_height = g_blockchain_current_block_height;
+  mtx_unlock(&g_blockchain_lock);
 
-    rocksdb_writebatch_delete(write_batch, (char*)key, key_length);
-  #endif
-  }
+  write_metric_header(buffer, "vulkan_block_height", "Height of the top block", "gauge");
+  write_metric_value(buffer, "vulkan_block_height", NULL, NULL, block_height);
+  write_metric_header(buffer, "vulkan_block_cache_entries", "Blocks held by the block cache", "gauge");
+  write_metric_value(buffer, "vulkan_block_cache_entries", NULL, NULL, num_entries);
+  write_metric_header(buffer, "vulkan_block_cache_bytes", "Memory used by the block cache", "gauge");
+  write_metric_value(buffer, "vulkan_block_cache_bytes", NULL, NULL, memory_size);
+  write_metric_header(buffer, "vulkan_block_cache_lookups_total", "Block cache lookups by whether the block was cached", "counter");
+  write_metric_value(buffer, "vulkan_block_cache_lookups_total", "result", "hit", num_hits);
+  write_metric_value(buffer, "vulkan_block_cache_lookups_total", "result", "miss", num_misses);
+  write_metric_header(buffer, "vulkan_utxo_cache_entries", "Unspent txs held by the utxo cache", "gauge");
+  write_metric_value(buffer, "vulkan_utxo_cache_entries", NULL, NULL, utxo_cache_num_entries);
+  write_metric_header(buffer, "vulkan_utxo_cache_bytes", "Memory used by the utxo cache", "gauge");
+  write_metric_value(buffer, "vulkan_utxo_cache_bytes", NULL, NULL, utxo_cache_memory_size);
+}
 
-#ifdef USE_LEVELDB
-  leveldb_write(db, woptions, write_batch, &err);
-#else
-  rocksdb_write(db, woptions, write_batch, &err);
-#endif
-  if (err != NULL)
+int close_blockchain(void)
+{
+  if (g_blockchain_is_open == 0)
   {
-    LOG_ERROR("Failed to purge all entries from database: %s", err);
+    return 1;
+  }
 
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_readoptions_destroy(roptions);
-    leveldb_iter_destroy(iterator);
-    leveldb_writeoptions_destroy(woptions);
-    leveldb_writebatch_clear(write_batch);
-    leveldb_writebatch_destroy(write_batch);
-  #else
-    rocksdb_free(err);
-    rocksdb_readoptions_destroy(roptions);
-    rocksdb_iter_destroy(iterator);
-    rocksdb_writeoptions_destroy(woptions);
-    rocksdb_writebatch_clear(write_batch);
-    rocksdb_writebatch_destroy(write_batch);
-  #endif
-    return 1;
-  }
-
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_iter_destroy(iterator);
-  leveldb_writeoptions_destroy(woptions);
-  leveldb_writebatch_clear(write_batch);
-  leveldb_writebatch_destroy(write_batch);
-#else
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_iter_destroy(iterator);
-  rocksdb_writeoptions_destroy(woptions);
-  rocksdb_writebatch_clear(write_batch);
-  rocksdb_writebatch_destroy(write_batch);
-#endif
-  return 0;
-}
-
-#ifdef USE_LEVELDB
-int copy_all_entries_to_database(leveldb_t *from_db, leveldb_t *to_db)
-#else
-int copy_all_entries_to_database(rocksdb_t *from_db, rocksdb_t *to_db)
-#endif
+  // the block commits which were not synced yet are synced along with the utxo cache,
+  // only then does the database match the chain state manifest written for it
+  if (flush_blockchain_nolock())
+  {
+    LOG_ERROR("Failed to flush blockchain while closing blockchain: %s!", g_blockchain_dir);
+  }
+  else if (write_chain_state_manifest_nolock())
+  {
+    LOG_WARNING("Could not write chain state manifest while closing blockchain: %s!", g_blockchain_dir);
+  }
+
+  unregister_metrics_collector(write_block_cache_metrics);
+  swap_blockchain_tip(NULL);
+  storage_close(g_blockchain_db);
+  g_blockchain_db = NULL;
+
+  deinit_block_cache();
+  deinit_orphan_pool();
+  deinit_utxo_cache();
+  deinit_header_index();
+  muhash_free(&g_blockchain_utxo_commitment);
+  mtx_destroy(&g_blockchain_lock);
+  if (close_backup_blockchain())
+  {
+    return 1;
+  }
+
+  g_blockchain_is_open = 0;
+  return 0;
+}
+
+int open_backup_blockchain(const char *blockchain_backup_dir)
+{
+  char *err = NULL;
+  storage_options_t options;
+  get_blockchain_storage_options(&options);
+
+  g_blockchain_backup_db = storage_backup_open(blockchain_backup_dir, &options, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not open backup blockchain database: %s: %s", blockchain_backup_dir, err);
+    storage_free(err);
+    return 1;
+  }
+
+  return 0;
+}
+
+int close_backup_blockchain(void)
+{
+  if (g_blockchain_backup_is_open == 0)
+  {
+    return 1;
+  }
+
+  storage_backup_close(g_blockchain_backup_db);
+  g_blockchain_backup_db = NULL;
+  g_blockchain_backup_is_open = 0;
+  return 0;
+}
+
+int init_blockchain(const char *blockchain_dir, int load_top_block)
+{
+  g_blockchain_dir = blockchain_dir;
+  g_blockchain_backup_dir = get_blockchain_backup_dir(g_blockchain_dir);
+  if (g_blockchain_is_open)
+  {
+    LOG_ERROR("Cannot initialize blockchain: %s, blockchain is already open!", g_blockchain_dir);
+    return 1;
+  }
+
+  if (g_blockchain_backup_is_open)
+  {
+    LOG_ERROR("Cannot initialize backup blockchain: %s, backup blockchain is already open!", g_blockchain_backup_dir);
+    return 1;
+  }
+
+  mtx_init(&g_blockchain_lock, mtx_recursive);
+  muhash_init(&g_blockchain_utxo_commitment);
+  if (init_utxo_cache())
+  {
+    LOG_ERROR("Cannot initialize blockchain: %s, failed to initialize utxo cache!", g_blockchain_dir);
+    return 1;
+  }
+
+  if (init_block_cache())
+  {
+    LOG_ERROR("Cannot initialize blockchain: %s, failed to initialize block cache!", g_blockchain_dir);
+    return 1;
+  }
+
+  if (init_orphan_pool())
+  {
+    LOG_ERROR("Cannot initialize blockchain: %s, failed to initialize orphan pool!", g_blockchain_dir);
+    return 1;
+  }
+
+  if (init_header_index())
+  {
+    LOG_ERROR("Cannot initialize blockchain: %s, failed to initialize header index!", g_blockchain_dir);
+    return 1;
+  }
+
+  if (g_blockchain_want_compression)
+  {
+    LOG_INFO("Blockchain storage compression is enabled, using the `%s` compression algorithm",
+      get_compression_type_str(get_blockchain_compression_type()));
+  }
+  else
+  {
+    LOG_INFO("Blockchain storage compression is disabled");
+  }
+
+  if (open_blockchain(g_blockchain_dir, load_top_block))
+  {
+    return 1;
+  }
+
+  if (open_backup_blockchain(g_blockchain_backup_dir))
+  {
+    return 1;
+  }
+
+  if (load_top_block)
+  {
+    if (load_blockchain_top_block())
+    {
+      return 1;
+    }
+  }
+
+  register_storage_metrics();
+  register_metric(&g_block_validation_metric);
+  register_metric(&g_block_reads_metric);
+  register_metrics_collector(write_block_cache_metrics);
+
+  LOG_INFO("Successfully initialized blockchain");
+  g_blockchain_is_open = 1;
+  g_blockchain_backup_is_open = 1;
+  return 0;
+}
+
+int purge_all_entries_from_database(storage_t *db)
+{
+  assert(db != NULL);
+
+  char *err = NULL;
+  if (storage_purge(db, &err))
+  {
+    LOG_ERROR("Failed to purge all entries from database: %s", err);
+    storage_free(err);
+    return 1;
+  }
+
+  return 0;
+}
+
+int copy_all_entries_to_database(storage_t *from_db, storage_t *to_db)
 {
   assert(from_db != NULL);
   assert(to_db != NULL);
 
   char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  leveldb_iterator_t *iterator = leveldb_create_iterator(from_db, roptions);
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_writebatch_t *write_batch = leveldb_writebatch_create();
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  rocksdb_iterator_t *iterator = rocksdb_create_iterator(from_db, roptions);
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_writebatch_t *write_batch = rocksdb_writebatch_create();
-#endif
-
-#ifdef USE_LEVELDB
-  for (leveldb_iter_seek_to_first(iterator);
-    leveldb_iter_valid(iterator); leveldb_iter_next(iterator))
-#else
-  for (rocksdb_iter_seek_to_first(iterator);
-    rocksdb_iter_valid(iterator); rocksdb_iter_next(iterator))
-#endif
-  {
-    size_t key_length;
-  #ifdef USE_LEVELDB
-    uint8_t *key = (uint8_t*)leveldb_iter_key(iterator, &key_length);
-    assert(key != NULL);
-  #else
-    uint8_t *key = (uint8_t*)rocksdb_iter_key(iterator, &key_length);
-    assert(key != NULL);
-  #endif
-
-    size_t read_len;
-  #ifdef USE_LEVELDB
-    uint8_t *value = (uint8_t*)leveldb_get(from_db, roptions, (char*)key, key_length, &read_len, &err);
-  #else
-    uint8_t *value = (uint8_t*)rocksdb_get(from_db, roptions, (char*)key, key_length, &read_len, &err);
-  #endif
-    if (err != NULL || value == NULL)
-    {
-      LOG_ERROR("Failed to retrieve value from key: %s in database: %s", key, err);
-
-    #ifdef USE_LEVELDB
-      leveldb_free(key);
-      leveldb_free(value);
-    #else
-      rocksdb_free(key);
-      rocksdb_free(value);
-    #endif
-      goto copy_entries_fail;
-    }
-
-  #ifdef USE_LEVELDB
-    leveldb_writebatch_put(write_batch, (char*)key, key_length, (char*)value, read_len);
-  #else
-    rocksdb_writebatch_put(write_batch, (char*)key, key_length, (char*)value, read_len);
-  #endif
-  }
-
-#ifdef USE_LEVELDB
-  leveldb_write(to_db, woptions, write_batch, &err);
-#else
-  rocksdb_write(to_db, woptions, write_batch, &err);
-#endif
-  if (err != NULL)
+  if (storage_copy(from_db, to_db, &err))
   {
     LOG_ERROR("Failed to copy entries to database: %s", err);
-    goto copy_entries_fail;
-  }
-
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_iter_destroy(iterator);
-  leveldb_writeoptions_destroy(woptions);
-  leveldb_writebatch_clear(write_batch);
-  leveldb_writebatch_destroy(write_batch);
-#else
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_iter_destroy(iterator);
-  rocksdb_writeoptions_destroy(woptions);
-  rocksdb_writebatch_clear(write_batch);
-  rocksdb_writebatch_destroy(write_batch);
-#endif
-  return 0;
-
-copy_entries_fail:
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_iter_destroy(iterator);
-  leveldb_writeoptions_destroy(woptions);
-  leveldb_writebatch_clear(write_batch);
-  leveldb_writebatch_destroy(write_batch);
-#else
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_iter_destroy(iterator);
-  rocksdb_writeoptions_destroy(woptions);
-  rocksdb_writebatch_clear(write_batch);
-  rocksdb_writebatch_destroy(write_batch);
-#endif
-  return 1;
+    storage_free(err);
+    return 1;
+  }
+
+  return 0;
 }
 
 int reset_blockchain_nolock(void)
@@ -788,7 +874,24 @@ int reset_blockchain_nolock(void)
   }
 
   assert(g_blockchain_db != NULL);
-  return purge_all_entries_from_database(g_blockchain_db);
+  clear_utxo_cache();
+  clear_block_cache();
+  if (purge_all_entries_from_database(g_blockchain_db))
+  {
+    return 1;
+  }
+
+  clear_header_index();
+  g_blockchain_current_block_height = 0;
+  g_blockchain_top_unspent_tx_height = 0;
+  g_blockchain_pruned_height = 0;
+  g_blockchain_tx_index_height = 0;
+  g_blockchain_stored_blocks_size_loaded = 0;
+  muhash_free(&g_blockchain_utxo_commitment);
+  muhash_init(&g_blockchain_utxo_commitment);
+  publish_blockchain_tip_nolock();
+  rescan_blockchain_wallet_nolock();
+  return 0;
 }
 
 int reset_blockchain(void)
@@ -806,39 +909,20 @@ int backup_blockchain_nolock(void)
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  if (purge_all_entries_from_database(g_blockchain_backup_db))
+  // the backup should include the unspent tx changes held by the utxo cache
+  if (flush_utxo_cache_nolock())
   {
-    LOG_ERROR("Could not backup blockchain database, failed to purge old backups!");
     return 1;
   }
 
-  if (copy_all_entries_to_database(g_blockchain_db, g_blockchain_backup_db))
-  {
-    LOG_ERROR("Could not backup blockchain database, failed to copy entries to backup database!");
-    return 1;
-  }
-#else
   char *err = NULL;
-  rocksdb_backup_engine_purge_old_backups(g_blockchain_backup_db, 0, &err);
-  if (err != NULL)
-  {
-    LOG_ERROR("Could not backup blockchain database, failed to purge old backups: %s!", err);
-    rocksdb_free(err);
-    return 1;
-  }
-
-  rocksdb_backup_engine_create_new_backup(g_blockchain_backup_db, g_blockchain_db, &err);
-  if (err != NULL)
+  if (storage_backup_create(g_blockchain_backup_db, g_blockchain_db, &err))
   {
     LOG_ERROR("Could not backup blockchain database, failed to create new backup: %s!", err);
-    rocksdb_free(err);
+    storage_free(err);
     return 1;
   }
 
-  rocksdb_free(err);
-#endif
-
   LOG_INFO("Successfully backed up blockchain database!");
   return 0;
 }
@@ -861,53 +945,34 @@ int restore_blockchain_nolock(void)
   assert(g_blockchain_db != NULL);
   assert(g_blockchain_backup_db != NULL);
 
-#ifdef USE_LEVELDB
-  if (purge_all_entries_from_database(g_blockchain_db))
-  {
-    LOG_ERROR("Could not restore blockchain database from backup, failed to purge blockchain database!");
-    return 1;
-  }
+  // the utxo and block caches hold changes newer than the backup being restored
+  clear_utxo_cache();
+  clear_block_cache();
 
-  if (copy_all_entries_to_database(g_blockchain_backup_db, g_blockchain_db))
+  char *err = NULL;
+  if (storage_backup_restore(g_blockchain_backup_db, g_blockchain_db, &err))
   {
-    LOG_ERROR("Could not backup blockchain database, failed to copy entires from backup database!");
+    LOG_ERROR("Could not restore blockchain database from backup: %s", err);
+    storage_free(err);
     return 1;
   }
 
-  return 0;
-#else
-  // close the main blockchain so we can restore the backup to it
-  rocksdb_close(g_blockchain_db);
-
-  char *err = NULL;
-  rocksdb_restore_options_t *restore_options = rocksdb_restore_options_create();
-  rocksdb_backup_engine_restore_db_from_latest_backup(g_blockchain_backup_db, g_blockchain_dir,
-    g_blockchain_dir, restore_options, &err);
-
-  if (err != NULL)
+  if (load_blockchain_state_nolock(g_blockchain_dir))
   {
-    LOG_ERROR("Could not restore blockchain database from backup: %s", err);
-    goto restore_blockchain_fail;
+    return 1;
   }
 
-  // now that we've successfully restored the backup, reload the main blockchain db
-  if (open_blockchain(g_blockchain_dir, 1))
+  // readers must not keep seeing the top block that was just rolled back
+  uint8_t *top_block_hash = get_top_block_hash();
+  if (top_block_hash != NULL)
   {
-    goto restore_blockchain_fail;
+    set_current_block_hash(top_block_hash);
+    free(top_block_hash);
   }
 
-  assert(g_blockchain_db != NULL);
-  assert(g_blockchain_backup_db != NULL);
-
-  rocksdb_free(err);
-  rocksdb_restore_options_destroy(restore_options);
+  publish_blockchain_tip_nolock();
+  rescan_blockchain_wallet_nolock();
   return 0;
-
-restore_blockchain_fail:
-  rocksdb_free(err);
-  rocksdb_restore_options_destroy(restore_options);
-  return 1;
-#endif
 }
 
 int restore_blockchain(void)
@@ -918,789 +983,4296 @@ int restore_blockchain(void)
   return result;
 }
 
-int rollback_blockchain_nolock(uint32_t rollback_height)
+int get_blockchain_durability_from_str(const char *durability_str)
 {
-  uint32_t current_block_height = get_block_height_nolock();
-  if (rollback_height > current_block_height)
-  {
-    LOG_WARNING("Could not rollback blockchain to height: %u, current blockchain top block height is: %u!", rollback_height, current_block_height);
-    return 1;
-  }
-
-  if (current_block_height == rollback_height)
+  assert(durability_str != NULL);
+  if (string_equals(durability_str, "sync"))
   {
-    LOG_INFO("Blockchain already at rollback height: %u, nothing to rollback!", rollback_height);
-    return 1;
+    return BLOCKCHAIN_DURABILITY_SYNC;
   }
-
-  // get the new top block after we rollback the blockchain
-  block_t *new_top_block = NULL;
-  if (rollback_height == 0)
+  else if (string_equals(durability_str, "batch"))
   {
-    block_t *genesis_block = get_genesis_block();
-    assert(genesis_block != NULL);
-
-    new_top_block = get_block_from_hash_nolock(genesis_block->hash);
-    assert(new_top_block != NULL);
+    return BLOCKCHAIN_DURABILITY_BATCH;
   }
-  else
+  else if (string_equals(durability_str, "none"))
   {
-    new_top_block = get_block_from_height_nolock(rollback_height - 1);
-    assert(new_top_block != NULL);
+    return BLOCKCHAIN_DURABILITY_NONE;
   }
 
-  char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  leveldb_iterator_t *iterator = leveldb_create_iterator(g_blockchain_db, roptions);
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_writebatch_t *write_batch = leveldb_writebatch_create();
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  rocksdb_iterator_t *iterator = rocksdb_create_iterator(g_blockchain_db, roptions);
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_writebatch_t *write_batch = rocksdb_writebatch_create();
-#endif
-  for (uint32_t i = current_block_height; i > 0; i--)
-  {
-    if (i == rollback_height)
-    {
-      break;
-    }
-
-    block_t *block = get_block_from_height_nolock(i);
-    if (block == NULL)
-    {
-      LOG_ERROR("Could not rollback blockchain, unknown block at height: %u!", i);
-      goto rollback_fail;
-    }
+  return -1;
+}
 
-    uint8_t block_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
-    get_block_key(block_key, block->hash);
+const char* get_blockchain_durability_str(int durability)
+{
+  switch (durability)
+  {
+    case BLOCKCHAIN_DURABILITY_SYNC:
+      return "sync";
+    case BLOCKCHAIN_DURABILITY_BATCH:
+      return "batch";
+    case BLOCKCHAIN_DURABILITY_NONE:
+      return "none";
+    default:
+      return "unknown";
+  }
+}
 
-  #ifdef USE_LEVELDB
-    leveldb_writebatch_delete(write_batch, (char*)block_key, sizeof(block_key));
-  #else
-    rocksdb_writebatch_delete(write_batch, (char*)block_key, sizeof(block_key));
-  #endif
+void apply_blockchain_durability_nolock(void)
+{
+  assert(g_blockchain_db != NULL);
+  storage_set_sync(g_blockchain_db, g_blockchain_durability == BLOCKCHAIN_DURABILITY_SYNC);
+  storage_set_write_ahead_log(g_blockchain_db, g_blockchain_durability != BLOCKCHAIN_DURABILITY_NONE);
+}
 
-    // now delete the block's transactions including the unspent transactions...
-    for (uint32_t i = 0; i < block->transaction_count; i++)
+/*
+ * Changes the durability of the block commits, what was written under the previous
+ * durability is synced to disk first so that switching to a stricter durability also
+ * covers the blocks committed before the switch...
+ */
+int set_blockchain_durability_nolock(int durability)
+{
+  assert(durability >= BLOCKCHAIN_DURABILITY_SYNC && durability <= BLOCKCHAIN_DURABILITY_NONE);
+  if (g_blockchain_db != NULL && g_blockchain_durability != BLOCKCHAIN_DURABILITY_SYNC &&
+    durability != g_blockchain_durability)
+  {
+    if (g_blockchain_durability == BLOCKCHAIN_DURABILITY_NONE ? flush_blockchain_nolock() : sync_blockchain_nolock())
     {
-      transaction_t *tx = block->transactions[i];
-      assert(tx != NULL);
-
-      uint8_t tx_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
-      uint8_t unspent_tx_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
-
-      get_tx_key(tx_key, tx->id);
-      get_unspent_tx_key(unspent_tx_key, tx->id);
-
-    #ifdef USE_LEVELDB
-      leveldb_writebatch_delete(write_batch, (char*)tx_key, sizeof(tx_key));
-      leveldb_writebatch_delete(write_batch, (char*)unspent_tx_key, sizeof(unspent_tx_key));
-    #else
-      rocksdb_writebatch_delete(write_batch, (char*)tx_key, sizeof(tx_key));
-      rocksdb_writebatch_delete(write_batch, (char*)unspent_tx_key, sizeof(unspent_tx_key));
-    #endif
+      return 1;
     }
-
-    free_block(block);
   }
 
-#ifdef USE_LEVELDB
-  leveldb_write(g_blockchain_db, woptions, write_batch, &err);
-#else
-  rocksdb_write(g_blockchain_db, woptions, write_batch, &err);
-#endif
-  if (err != NULL)
+  g_blockchain_durability = durability;
+  if (g_blockchain_db != NULL)
   {
-    LOG_ERROR("Failed to rollback blockchain, error occurred: %s!", err);
-    goto rollback_fail;
+    apply_blockchain_durability_nolock();
   }
 
-  // finally set the new top block provided above
-  set_current_block(new_top_block);
-  free_block(new_top_block);
-
-  LOG_INFO("Successfully rolled back blockchain to height: %u!", rollback_height);
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_iter_destroy(iterator);
-  leveldb_writeoptions_destroy(woptions);
-  leveldb_writebatch_clear(write_batch);
-  leveldb_writebatch_destroy(write_batch);
-#else
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_iter_destroy(iterator);
-  rocksdb_writeoptions_destroy(woptions);
-  rocksdb_writebatch_clear(write_batch);
-  rocksdb_writebatch_destroy(write_batch);
-#endif
-  return 0;
-
-rollback_fail:
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_iter_destroy(iterator);
-  leveldb_writeoptions_destroy(woptions);
-  leveldb_writebatch_clear(write_batch);
-  leveldb_writebatch_destroy(write_batch);
-#else
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_iter_destroy(iterator);
-  rocksdb_writeoptions_destroy(woptions);
-  rocksdb_writebatch_clear(write_batch);
-  rocksdb_writebatch_destroy(write_batch);
-#endif
-  return 1;
+  return 0;
 }
 
-int rollback_blockchain(uint32_t rollback_height)
+int set_blockchain_durability(int durability)
 {
   mtx_lock(&g_blockchain_lock);
-  int result = rollback_blockchain_nolock(rollback_height);
+  int result = set_blockchain_durability_nolock(durability);
   mtx_unlock(&g_blockchain_lock);
   return result;
 }
 
-uint64_t get_cumulative_emission(void)
+int get_blockchain_durability(void)
 {
-  block_t *current_block = get_current_block();
-  assert(current_block != NULL);
-  uint64_t cumulative_emission = current_block->cumulative_emission;
-  free_block(current_block);
-  return cumulative_emission;
+  return g_blockchain_durability;
 }
 
-uint64_t get_block_reward(uint32_t block_height, uint64_t cumulative_emission)
+void set_blockchain_durability_batch_blocks(uint32_t batch_blocks)
 {
-  uint64_t block_reward = (MAX_MONEY - cumulative_emission) >> BLOCK_REWARD_EMISSION_FACTOR;
-  uint64_t genesis_reward = parameters_get_genesis_reward();
-  if (cumulative_emission == 0 && genesis_reward > 0)
-  {
-    block_reward = genesis_reward;
-  }
+  assert(batch_blocks > 0);
+  g_blockchain_durability_batch_blocks = batch_blocks;
+}
 
-  return block_reward;
+uint32_t get_blockchain_durability_batch_blocks(void)
+{
+  return g_blockchain_durability_batch_blocks;
 }
 
-uint32_t get_next_work_required_nolock(uint8_t *previous_hash)
+void set_blockchain_durability_batch_interval(uint32_t batch_interval_ms)
 {
-  if (previous_hash == NULL)
+  g_blockchain_durability_batch_interval_ms = batch_interval_ms;
+}
+
+uint32_t get_blockchain_durability_batch_interval(void)
+{
+  return g_blockchain_durability_batch_interval_ms;
+}
+
+/*
+ * Syncs the block commits written so far to disk, with the sync durability
+ * they already are while the none durability needs a full flush instead...
+ */
+int sync_blockchain_nolock(void)
+{
+  assert(g_blockchain_db != NULL);
+  char *err = NULL;
+  if (storage_sync(g_blockchain_db, &err))
   {
-    return parameters_get_pow_initial_difficulty_bits();
+    LOG_ERROR("Could not sync blockchain database: %s!", err);
+    storage_free(err);
+    return 1;
   }
 
-  block_t *previous_block = get_block_from_hash(previous_hash);
-  assert(previous_block != NULL);
+  g_blockchain_num_unsynced_block_commits = 0;
+  g_blockchain_last_sync_ms = get_current_time_ms();
+  return 0;
+}
 
-  int32_t previous_height = get_block_height_from_block(previous_block);
-  assert(previous_height >= 0);
+// group commit, the batch durability syncs once enough commits or time piled up
+static int sync_block_commits_nolock(void)
+{
+  if (g_blockchain_durability != BLOCKCHAIN_DURABILITY_BATCH)
+  {
+    return 0;
+  }
 
-  if ((previous_height + 1) % parameters_get_difficulty_adjustment_interval() != 0)
+  g_blockchain_num_unsynced_block_commits++;
+  if (g_blockchain_num_unsynced_block_commits < g_blockchain_durability_batch_blocks &&
+    get_current_time_ms() - g_blockchain_last_sync_ms < g_blockchain_durability_batch_interval_ms)
   {
-    return previous_block->bits;
+    return 0;
   }
 
-  uint32_t period_start_block_height = previous_height - (parameters_get_difficulty_adjustment_interval() - 1);
-  period_start_block_height = MAX(period_start_block_height, 0);
+  return sync_blockchain_nolock();
+}
 
-  block_t *period_start_block = get_block_from_height(period_start_block_height);
-  assert(period_start_block != NULL);
-
-  uint32_t actual_time_taken = previous_block->timestamp - period_start_block->timestamp;
-
-  free(previous_block);
-  free(period_start_block);
-
-  if (actual_time_taken < parameters_get_pow_target_timespan())
+/*
+ * Writes the utxo cache to the unspent index and then everything written to the
+ * blockchain database to disk, including what was written without the log...
+ */
+int flush_blockchain_nolock(void)
+{
+  assert(g_blockchain_db != NULL);
+  if (flush_utxo_cache_nolock())
   {
-    return previous_block->bits + 1;
+    return 1;
   }
-  else if (actual_time_taken > parameters_get_pow_target_timespan())
+
+  char *err = NULL;
+  if (storage_flush(g_blockchain_db, &err))
   {
-    return previous_block->bits - 1;
+    LOG_ERROR("Could not flush blockchain database: %s!", err);
+    storage_free(err);
+    return 1;
   }
 
-  return previous_block->bits;
+  g_blockchain_num_unsynced_block_commits = 0;
+  g_blockchain_last_sync_ms = get_current_time_ms();
+  return 0;
 }
 
-uint32_t get_next_work_required(uint8_t *previous_hash)
+int flush_blockchain(void)
 {
   mtx_lock(&g_blockchain_lock);
-  uint32_t next_work_required = get_next_work_required_nolock(previous_hash);
+  int result = flush_blockchain_nolock();
   mtx_unlock(&g_blockchain_lock);
-  return next_work_required;
+  return result;
 }
 
-int valid_block_median_timestamp(block_t *block)
+void write_batch_put_height(storage_batch_t *write_batch, uint8_t *key, size_t key_size, uint32_t height)
 {
-  assert(block != NULL);
-  uint32_t current_block_height = get_block_height();
-  if (current_block_height < TIMESTAMP_CHECK_WINDOW)
-  {
-    return 1;
-  }
+  assert(write_batch != NULL);
+  assert(key != NULL);
+
+  uint8_t height_data[sizeof(uint32_t)];
+  height_data[0] = (uint8_t)(height >> 24);
+  height_data[1] = (uint8_t)(height >> 16);
+  height_data[2] = (uint8_t)(height >> 8);
+  height_data[3] = (uint8_t)height;
+  storage_batch_put(write_batch, key, key_size, height_data, sizeof(height_data));
+}
+
+void write_batch_put_top_block(storage_batch_t *write_batch, uint8_t *block_hash, uint32_t block_height)
+{
+  assert(write_batch != NULL);
+  assert(block_hash != NULL);
 
-  block_t *median_block = get_block_from_height(current_block_height - (TIMESTAMP_CHECK_WINDOW / 2));
-  assert(median_block != NULL);
+  uint8_t top_block_key[DB_KEY_PREFIX_SIZE_TOP_BLOCK];
+  get_top_block_key(top_block_key);
 
-  uint32_t median_timestamp = median_block->timestamp;
-  free_block(median_block);
+  uint8_t top_block_height_key[DB_KEY_PREFIX_SIZE_TOP_BLOCK_HEIGHT];
+  get_top_block_height_key(top_block_height_key);
 
-  return block->timestamp > median_timestamp;
+  storage_batch_put(write_batch, top_block_key, sizeof(top_block_key), block_hash, HASH_SIZE);
+  write_batch_put_height(write_batch, top_block_height_key, sizeof(top_block_height_key), block_height);
 }
 
-int valid_block_emission(block_t *block)
+void write_batch_put_top_unspent_tx_height(storage_batch_t *write_batch, uint32_t block_height)
 {
-  assert(block != NULL);
-  block_t *genesis_block = get_genesis_block();
-  assert(genesis_block != NULL);
-
-  transaction_t *tx = block->transactions[0];
-  assert(tx != NULL);
-
-  output_transaction_t *txout = tx->txouts[0];
-  assert(txout != NULL);
+  assert(write_batch != NULL);
+  uint8_t key[DB_KEY_PREFIX_SIZE_TOP_UNSPENT_TX_HEIGHT];
+  get_top_unspent_tx_height_key(key);
+  write_batch_put_height(write_batch, key, sizeof(key), block_height);
+}
 
-  uint64_t expected_block_reward = 0;
-  uint64_t expected_cumulative_emission = 0;
+static void get_utxo_commitment_element(uint8_t *buffer, unspent_transaction_t *unspent_tx, uint32_t txout_index)
+{
+  assert(buffer != NULL);
+  assert(unspent_tx != NULL);
+  unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[txout_index];
+  assert(unspent_txout != NULL);
 
-  if (compare_block(block, genesis_block))
+  size_t offset = 0;
+  memcpy(buffer, unspent_tx->id, HASH_SIZE);
+  offset += HASH_SIZE;
+  for (int i = 0; i < sizeof(uint32_t); i++)
   {
-    expected_block_reward = get_block_reward(0, 0);
-    expected_cumulative_emission = expected_block_reward;
+    buffer[offset++] = (uint8_t)(txout_index >> (8 * (sizeof(uint32_t) - 1 - i)));
   }
-  else
-  {
-    block_t *previous_block = get_block_from_hash(block->previous_hash);
-    assert(previous_block != NULL);
 
-    int32_t previous_height = get_block_height_from_block(previous_block);
-    assert(previous_height >= 0);
-
-    expected_block_reward = get_block_reward(previous_height, previous_block->cumulative_emission);
-    expected_cumulative_emission = previous_block->cumulative_emission + expected_block_reward;
-    free_block(previous_block);
+  buffer[offset++] = unspent_tx->coinbase;
+  for (int i = 0; i < sizeof(uint64_t); i++)
+  {
+    buffer[offset++] = (uint8_t)(unspent_txout->amount >> (8 * (sizeof(uint64_t) - 1 - i)));
   }
 
-  return (txout->amount == expected_block_reward && block->cumulative_emission == expected_cumulative_emission);
+  memcpy(buffer + offset, unspent_txout->address, ADDRESS_SIZE);
 }
 
-int update_unspent_transaction(uint8_t *block_hash, transaction_t *tx)
+static void insert_unspent_txout_into_utxo_commitment(muhash_t *utxo_commitment, unspent_transaction_t *unspent_tx, uint32_t txout_index)
 {
-  assert(tx != NULL);
-  if (insert_tx_into_index_nolock(block_hash, tx))
-  {
-    return 1;
-  }
+  uint8_t element[UTXO_COMMITMENT_ELEMENT_SIZE];
+  get_utxo_commitment_element(element, unspent_tx, txout_index);
+  muhash_insert(utxo_commitment, element, sizeof(element));
+}
 
-  if (insert_tx_into_unspent_index_nolock(tx))
-  {
-    assert(delete_tx_from_index_nolock(tx->id) == 0);
-    return 1;
-  }
+static void remove_unspent_txout_from_utxo_commitment(muhash_t *utxo_commitment, unspent_transaction_t *unspent_tx, uint32_t txout_index)
+{
+  uint8_t element[UTXO_COMMITMENT_ELEMENT_SIZE];
+  get_utxo_commitment_element(element, unspent_tx, txout_index);
+  muhash_remove(utxo_commitment, element, sizeof(element));
+}
 
-  if (is_coinbase_tx(tx))
+void insert_unspent_tx_into_utxo_commitment(muhash_t *utxo_commitment, unspent_transaction_t *unspent_tx)
+{
+  assert(utxo_commitment != NULL);
+  assert(unspent_tx != NULL);
+  for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
   {
-    return 0;
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+    if (unspent_txout != NULL && unspent_txout->spent == 0)
+    {
+      insert_unspent_txout_into_utxo_commitment(utxo_commitment, unspent_tx, i);
+    }
   }
+}
 
-  // mark unspent txouts as spent for current txins
-  for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
+void remove_unspent_tx_from_utxo_commitment(muhash_t *utxo_commitment, unspent_transaction_t *unspent_tx)
+{
+  assert(utxo_commitment != NULL);
+  assert(unspent_tx != NULL);
+  for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
   {
-    input_transaction_t *txin = tx->txins[txin_index];
-    assert(txin != NULL);
-
-    unspent_transaction_t *unspent_tx = get_unspent_tx_from_index_nolock(txin->transaction);
-    assert(unspent_tx != NULL);
-
-    if (((unspent_tx->unspent_txout_count - 1) < txin->txout_index) ||
-      unspent_tx->unspent_txouts[txin->txout_index] == NULL)
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+    if (unspent_txout != NULL && unspent_txout->spent == 0)
     {
-      char *unspent_tx_hash_str = bin2hex(unspent_tx->id, HASH_SIZE);
-      LOG_DEBUG("A txin tried to mark a unspent txout: %s as spent, but it was not found!", unspent_tx_hash_str);
-      free(unspent_tx_hash_str);
-      free_unspent_transaction(unspent_tx);
-      continue;
+      remove_unspent_txout_from_utxo_commitment(utxo_commitment, unspent_tx, i);
     }
-    else
-    {
-      unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[txin->txout_index];
-      assert(unspent_txout != NULL);
-
-      if (unspent_txout->spent == 1)
-      {
-        char *unspent_tx_hash_str = bin2hex(unspent_tx->id, HASH_SIZE);
-        LOG_DEBUG("A txin tried to mark a unspent txout: %s as spent, but it was already spent!", unspent_tx_hash_str);
-        free(unspent_tx_hash_str);
-        free_unspent_transaction(unspent_tx);
-        continue;
-      }
-
-      unspent_txout->spent = 1;
-
-      // update the unspent txs
-      uint32_t spent_txs = 0;
-      for (uint32_t unspent_txout_index = 0; unspent_txout_index < unspent_tx->unspent_txout_count; unspent_txout_index++)
-      {
-        if (unspent_txout->spent == 1)
-        {
-          spent_txs++;
-        }
-      }
+  }
+}
 
-      if (spent_txs == unspent_tx->unspent_txout_count)
-      {
-        if (delete_unspent_tx_from_index_nolock(unspent_tx->id))
-        {
-          goto update_unspent_tx_fail;
-        }
-      }
-      else
-      {
-        if (insert_unspent_tx_into_index_nolock(unspent_tx))
-        {
-          goto update_unspent_tx_fail;
-        }
-      }
+static int write_batch_put_utxo_commitment(storage_batch_t *write_batch, muhash_t *utxo_commitment)
+{
+  assert(write_batch != NULL);
+  assert(utxo_commitment != NULL);
 
-      free_unspent_transaction(unspent_tx);
-    }
+  uint8_t data[MUHASH_SIZE];
+  if (muhash_to_bytes(utxo_commitment, data))
+  {
+    LOG_ERROR("Could not serialize the UTXO set commitment!");
+    return 1;
   }
 
+  uint8_t key[DB_KEY_PREFIX_SIZE_UTXO_COMMITMENT];
+  get_utxo_commitment_key(key);
+  storage_batch_put(write_batch, key, sizeof(key), data, sizeof(data));
   return 0;
-
-update_unspent_tx_fail:
-  assert(delete_tx_from_index_nolock(tx->id) == 0);
-  assert(delete_unspent_tx_from_index_nolock(tx->id) == 0);
-  return 1;
 }
 
-int update_unspent_transactions(block_t *block)
+/*
+ * Computes the utxo commitment of the unspent index from scratch, the utxo
+ * cache must have been flushed for the unspent index to be up to date...
+ */
+int compute_utxo_commitment_nolock(muhash_t *utxo_commitment)
 {
-  assert(block != NULL);
-  for (uint32_t i = 0; i < block->transaction_count; i++)
+  assert(utxo_commitment != NULL);
+  storage_iterator_t *iterator = storage_iterator_create(g_blockchain_db);
+  for (storage_iterator_seek(iterator, (uint8_t*)DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
   {
-    transaction_t *transaction = block->transactions[i];
-    assert(transaction != NULL);
+    size_t key_length;
+    size_t data_len;
+    const uint8_t *key = storage_iterator_key(iterator, &key_length);
+    const uint8_t *data = storage_iterator_value(iterator, &data_len);
+
+    if (key_length != DB_KEY_PREFIX_SIZE_UNSPENT_TX + HASH_SIZE ||
+      memcmp(key, DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX) != 0)
+    {
+      break;
+    }
+
+    buffer_t *buffer = buffer_init_data(0, data, data_len);
+    buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
 
-    if (update_unspent_transaction(block->hash, transaction))
+    unspent_transaction_t *unspent_tx = NULL;
+    int result = deserialize_unspent_transaction(buffer_iterator, &unspent_tx);
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+    if (result)
     {
+      LOG_ERROR("Could not compute UTXO set commitment, failed to read unspent tx!");
+      storage_iterator_destroy(iterator);
       return 1;
     }
+
+    insert_unspent_tx_into_utxo_commitment(utxo_commitment, unspent_tx);
+    free_unspent_transaction(unspent_tx);
   }
 
+  storage_iterator_destroy(iterator);
   return 0;
 }
 
-/* After we insert block into blockchain
- * Mark unspent txouts as spent for current txins
- * Add current TX w/ unspent txouts to unspent index
+/*
+ * Loads the utxo commitment of the unspent index as it was last flushed, blockchain
+ * databases stored before the utxo commitment existed have it computed once...
  */
-int insert_block_nolock(block_t *block, int update_unspent_txs)
+int load_utxo_commitment_nolock(void)
 {
-  assert(block != NULL);
-  char *err = NULL;
-  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
-  get_block_key(key, block->hash);
+  uint8_t key[DB_KEY_PREFIX_SIZE_UTXO_COMMITMENT];
+  get_utxo_commitment_key(key);
 
-  buffer_t *buffer = buffer_init();
-  if (serialize_block(buffer, block))
+  char *err = NULL;
+  size_t read_len = 0;
+  uint8_t *data = storage_get(g_blockchain_db, key, sizeof(key), &read_len, &err);
+  if (err == NULL && data != NULL && read_len == MUHASH_SIZE &&
+    muhash_from_bytes(&g_blockchain_utxo_commitment, data) == 0)
   {
-    char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
-    LOG_ERROR("Failed to insert block: %s into blockchain, could not serialize block!", block_hash_str);
-    free(block_hash_str);
-    buffer_free(buffer);
-    return 1;
+    storage_free(data);
+    return 0;
   }
 
-  if (serialize_transactions_from_block(buffer, block))
+  storage_free(data);
+  storage_free(err);
+
+  LOG_INFO("Computing the UTXO set commitment from the unspent index...");
+  muhash_free(&g_blockchain_utxo_commitment);
+  muhash_init(&g_blockchain_utxo_commitment);
+  if (compute_utxo_commitment_nolock(&g_blockchain_utxo_commitment))
   {
-    char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
-    LOG_ERROR("Failed to insert block: %s into blockchain, could not serialize block transactions!", block_hash_str);
-    free(block_hash_str);
-    buffer_free(buffer);
     return 1;
   }
 
-  const uint8_t *data = buffer_get_data(buffer);
-  uint32_t data_len = buffer_get_size(buffer);
-
-  // attempt to update the unspent and spent txs
-  if (update_unspent_txs)
+  storage_batch_t *write_batch = storage_batch_create();
+  if (write_batch_put_utxo_commitment(write_batch, &g_blockchain_utxo_commitment))
   {
-    if (update_unspent_transactions(block))
-    {
-      char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
-      LOG_ERROR("Failed to insert block: %s into blockchain, could not update unspent transactions!", block_hash_str);
-      free(block_hash_str);
-      buffer_free(buffer);
-      return 1;
-    }
+    storage_batch_destroy(write_batch);
+    return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#endif
-  buffer_free(buffer);
-
+  storage_write(g_blockchain_db, write_batch, &err);
+  storage_batch_destroy(write_batch);
   if (err != NULL)
   {
-    char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
-    LOG_ERROR("Could not insert block: %s into blockchain storage: %s!", block_hash_str, err);
-    free(block_hash_str);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
+    LOG_ERROR("Could not write UTXO set commitment: %s!", err);
+    storage_free(err);
     return 1;
   }
 
-  // update our current top block hash in the blockchain
-  set_current_block(block);
-
-  // clear the block's transactions from the mempool if any are
-  // currently in our mempool, this prevents us from adding transactions
-  // to another block that have already been used...
-  assert(clear_txs_in_mempool_from_block(block) == 0);
-
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
   return 0;
 }
 
-int insert_block(block_t *block, int update_unspent_txs)
+int get_utxo_commitment(uint8_t *digest, uint32_t *block_height)
 {
-  assert(block != NULL);
+  assert(digest != NULL);
   mtx_lock(&g_blockchain_lock);
-  int result = insert_block_nolock(block, update_unspent_txs);
+  int result = muhash_finalize(&g_blockchain_utxo_commitment, digest);
+  if (block_height != NULL)
+  {
+    *block_height = get_block_height_nolock();
+  }
+
   mtx_unlock(&g_blockchain_lock);
   return result;
 }
 
-int validate_and_insert_block_nolock(block_t *block)
+/*
+ * Checks the utxo commitment against one computed from the whole unspent
+ * index, which catches an unspent index that was left corrupted...
+ */
+int verify_utxo_commitment(void)
 {
-  assert(block != NULL);
-
-  // verify the block, ensure the block is not an orphan or stale,
-  // if the block is the genesis, then we do not need to validate it...
-  uint32_t current_block_height = get_block_height_nolock();
-  if (!valid_block(block))
+  mtx_lock(&g_blockchain_lock);
+  if (flush_utxo_cache_nolock())
   {
+    mtx_unlock(&g_blockchain_lock);
     return 1;
   }
 
-  // ensure we are not adding a block that already exists in the blockchain...
-  if (has_block_by_hash(block->hash))
+  muhash_t utxo_commitment;
+  muhash_init(&utxo_commitment);
+
+  uint8_t digest[MUHASH_DIGEST_SIZE];
+  uint8_t expected_digest[MUHASH_DIGEST_SIZE];
+  int result = compute_utxo_commitment_nolock(&utxo_commitment) ||
+    muhash_finalize(&utxo_commitment, digest) ||
+    muhash_finalize(&g_blockchain_utxo_commitment, expected_digest) ||
+    memcmp(digest, expected_digest, MUHASH_DIGEST_SIZE) != 0;
+
+  muhash_free(&utxo_commitment);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+/*
+ * Writes the unspent txs of a block's undo record back to the unspent index, the
+ * undo record holds each unspent tx the block spent from as it was before the block.
+ * The txouts the block spent are inserted into the utxo commitment again...
+ */
+static int write_batch_put_block_undo(storage_batch_t *write_batch, muhash_t *utxo_commitment, const uint8_t *undo_data, size_t undo_data_size)
+{
+  assert(write_batch != NULL);
+  assert(utxo_commitment != NULL);
+  assert(undo_data != NULL);
+
+  buffer_t *buffer = buffer_init_data(0, undo_data, undo_data_size);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+  uint32_t undo_unspent_tx_count = 0;
+  if (buffer_read_uint32(buffer_iterator, &undo_unspent_tx_count))
   {
-    return 1;
+    goto put_block_undo_fail;
   }
 
-  // check this blocks previous has against our current top block hash
-  block_t *current_block = get_current_block();
-  if (current_block_height > 0)
+  for (uint32_t i = 0; i < undo_unspent_tx_count; i++)
   {
-    assert(current_block != NULL);
-    if (compare_hash(block->previous_hash, current_block->hash) == 0)
+    unspent_transaction_t *unspent_tx = NULL;
+    if (deserialize_unspent_transaction(buffer_iterator, &unspent_tx))
     {
-      goto validate_block_fail;
+      goto put_block_undo_fail;
     }
-  }
 
-  // check to see if this block's timestamp is greater than the
-  // last median TIMESTAMP_CHECK_WINDOW / 2 block's timestamp...
-  if (!valid_block_median_timestamp(block))
-  {
-    LOG_DEBUG("Could not insert block into blockchain, block has expired timestamp: %u!", block->timestamp);
-    goto validate_block_fail;
+    // the unspent index has been flushed, so it holds the unspent tx as the block left it
+    unspent_transaction_t *spent_unspent_tx = get_unspent_tx_from_storage_nolock(unspent_tx->id);
+    for (uint32_t j = 0; j < unspent_tx->unspent_txout_count; j++)
+    {
+      unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[j];
+      if (unspent_txout == NULL || unspent_txout->spent)
+      {
+        continue;
+      }
+
+      if (spent_unspent_tx == NULL || j >= spent_unspent_tx->unspent_txout_count ||
+        spent_unspent_tx->unspent_txouts[j] == NULL || spent_unspent_tx->unspent_txouts[j]->spent)
+      {
+        insert_unspent_txout_into_utxo_commitment(utxo_commitment, unspent_tx, j);
+      }
+    }
+
+    if (spent_unspent_tx != NULL)
+    {
+      free_unspent_transaction(spent_unspent_tx);
+    }
+
+    int result = write_batch_put_unspent_tx(write_batch, unspent_tx);
+    free_unspent_transaction(unspent_tx);
+    if (result)
+    {
+      goto put_block_undo_fail;
+    }
   }
 
-  // validate the block's generation transaction
-  if (!valid_block_emission(block))
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  return 0;
+
+put_block_undo_fail:
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  return 1;
+}
+
+/*
+ * Disconnects our current top block using a single write batch, the block's txs are
+ * removed from the tx and unspent indexes and the unspent txs it spent from are restored
+ * from it's undo record. The disconnected block is handed to the caller when block_out
+ * is provided, otherwise it is freed...
+ */
+int disconnect_top_block_nolock(block_t **block_out)
+{
+  uint32_t block_height = get_block_height_nolock();
+  if (block_height == 0)
   {
-    LOG_DEBUG("Could not insert block into blockchain, block has invalid generation transaction!");
-    goto validate_block_fail;
+    LOG_WARNING("Could not disconnect top block, the genesis block cannot be disconnected!");
+    return 1;
   }
 
-  // check the block's difficulty against it's expected value, also check the block's
-  // hash to see if it's difficulty is valid...
-  uint32_t expected_difficulty = 0;
-  if (current_block != NULL)
+  if (block_height <= g_blockchain_pruned_height)
   {
-    expected_difficulty = get_next_work_required(current_block->hash);
+    LOG_WARNING("Could not disconnect top block at height: %u, the block has been pruned!", block_height);
+    return 1;
   }
-  else
+
+  // write out any pending unspent tx changes and drop the utxo cache,
+  // the disconnect below operates directly on the unspent index
+  if (flush_utxo_cache_nolock())
   {
-    expected_difficulty = get_next_work_required(NULL);
+    LOG_ERROR("Could not disconnect top block, failed to flush utxo cache!");
+    return 1;
   }
 
-  assert(expected_difficulty > 0);
-  if (block->bits != expected_difficulty)
+  clear_utxo_cache();
+
+  block_t *block = get_block_from_height_nolock(block_height);
+  if (block == NULL)
   {
-    LOG_DEBUG("Could not insert block into blockchain, block has invalid difficulty: %u expected: %u!", block->bits, expected_difficulty);
-    goto validate_block_fail;
+    LOG_ERROR("Could not disconnect top block, unknown block at height: %u!", block_height);
+    return 1;
   }
 
-  if (check_proof_of_work(block->hash, expected_difficulty) == 0)
+  char *err = NULL;
+  storage_batch_t *write_batch = storage_batch_create();
+
+  // the utxo commitment as of the block's previous block
+  muhash_t utxo_commitment;
+  muhash_init(&utxo_commitment);
+  muhash_copy(&utxo_commitment, &g_blockchain_utxo_commitment);
+
+  uint8_t undo_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_UNDO];
+  get_block_undo_key(undo_key, block->hash);
+
+  size_t undo_data_size = 0;
+  uint8_t *undo_data = storage_get(g_blockchain_db, undo_key, sizeof(undo_key), &undo_data_size, &err);
+  if (err != NULL)
   {
-    LOG_ERROR("Could not insert block into blockchain, block does not have enough PoW: %u expected: %u!", block->bits, expected_difficulty);
-    goto validate_block_fail;
+    LOG_ERROR("Could not disconnect top block, failed to read undo record: %s!", err);
+    goto disconnect_block_fail;
   }
 
-  // as an extra measure, ensure that the block hash is that of
-  // what we were expecting provided it's contents...
-  assert(valid_block_hash(block) == 1);
-  if (current_block != NULL)
+  // every block inserted gets an undo record, a block without one cannot have the txouts
+  // it spent restored, so disconnecting it would corrupt the unspent index...
+  if (undo_data == NULL)
   {
-    free_block(current_block);
+    LOG_ERROR("Could not disconnect block: %s, the block has no undo record!", HASH2HEX_STR(block->hash));
+    goto disconnect_block_fail;
   }
 
-  return insert_block_nolock(block, 1);
+  // now delete the block's transactions including the unspent transactions,
+  // the block's txs are only in the tx index if it is below the tx index height...
+  int indexed_txs = block_height < g_blockchain_tx_index_height;
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
 
-validate_block_fail:
-  print_block(current_block);
-  printf("\n");
-  if (current_block != NULL)
+    if (indexed_txs)
+    {
+      uint8_t tx_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
+      get_tx_key(tx_key, tx->id);
+
+      storage_batch_delete(write_batch, tx_key, sizeof(tx_key));
+    }
+
+    unspent_transaction_t *created_unspent_tx = get_unspent_tx_from_storage_nolock(tx->id);
+    if (created_unspent_tx != NULL)
+    {
+      remove_unspent_tx_from_utxo_commitment(&utxo_commitment, created_unspent_tx);
+      free_unspent_transaction(created_unspent_tx);
+    }
+
+    // removes the unspent tx along with the address index entries of it's txouts
+    unspent_transaction_t *unspent_tx = transaction_to_unspent_transaction(tx);
+    write_batch_delete_unspent_tx(write_batch, unspent_tx);
+    free_unspent_transaction(unspent_tx);
+  }
+
+  if (write_batch_put_block_undo(write_batch, &utxo_commitment, undo_data, undo_data_size))
   {
-    free_block(current_block);
+    LOG_ERROR("Could not disconnect block: %s, failed to read undo record!", HASH2HEX_STR(block->hash));
+    goto disconnect_block_fail;
+  }
+
+  uint8_t block_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+  get_block_key(block_key, block->hash);
+
+  uint8_t block_txs_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS];
+  get_block_transactions_key(block_txs_key, block->hash);
+
+  uint8_t block_height_key[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + sizeof(uint32_t)];
+  get_block_height_key(block_height_key, block_height);
+
+  storage_batch_delete(write_batch, block_key, sizeof(block_key));
+  storage_batch_delete(write_batch, block_txs_key, sizeof(block_txs_key));
+  storage_batch_delete(write_batch, block_height_key, sizeof(block_height_key));
+  storage_batch_delete(write_batch, undo_key, sizeof(undo_key));
+
+  uint8_t filter_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_FILTER];
+  get_block_filter_key(filter_key, block->hash);
+  storage_batch_delete(write_batch, filter_key, sizeof(filter_key));
+
+  // the block's previous block becomes the new top block in the same write batch,
+  // so the top block and it's height never disagree with the blocks stored
+  write_batch_put_top_block(write_batch, block->previous_hash, block_height - 1);
+  write_batch_put_top_unspent_tx_height(write_batch, block_height - 1);
+  if (write_batch_put_utxo_commitment(write_batch, &utxo_commitment))
+  {
+    goto disconnect_block_fail;
+  }
+
+  if (indexed_txs)
+  {
+    uint8_t tx_index_height_key[DB_KEY_PREFIX_SIZE_TX_INDEX_HEIGHT];
+    get_tx_index_height_key(tx_index_height_key);
+    write_batch_put_height(write_batch, tx_index_height_key, sizeof(tx_index_height_key), block_height);
+  }
+
+  storage_write(g_blockchain_db, write_batch, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Failed to disconnect top block, error occurred: %s!", err);
+    goto disconnect_block_fail;
+  }
+
+  if (indexed_txs)
+  {
+    g_blockchain_tx_index_height = block_height;
+  }
+
+  muhash_copy(&g_blockchain_utxo_commitment, &utxo_commitment);
+  muhash_free(&utxo_commitment);
+
+  remove_block_from_block_cache(block->hash);
+  set_current_block_hash(block->previous_hash);
+  g_blockchain_current_block_height = block_height - 1;
+  g_blockchain_stored_blocks_size_loaded = 0;
+  g_blockchain_top_unspent_tx_height = block_height - 1;
+  truncate_header_index(block_height - 1);
+  publish_blockchain_tip_nolock();
+
+  if (g_blockchain_wallet != NULL && disconnect_block_from_wallet(g_blockchain_wallet, block))
+  {
+    LOG_WARNING("Could not disconnect block from blockchain wallet, the wallet will be rescanned when next loaded!");
+  }
+
+  if (block_out != NULL)
+  {
+    *block_out = block;
+  }
+  else
+  {
+    free_block(block);
   }
 
+  storage_free(undo_data);
+  storage_free(err);
+  storage_batch_destroy(write_batch);
+  return 0;
+
+disconnect_block_fail:
+  muhash_free(&utxo_commitment);
+  free_block(block);
+  storage_free(undo_data);
+  storage_free(err);
+  storage_batch_destroy(write_batch);
   return 1;
 }
 
-int validate_and_insert_block(block_t *block)
+int disconnect_top_block(block_t **block_out)
 {
-  assert(block != NULL);
   mtx_lock(&g_blockchain_lock);
-  int result = validate_and_insert_block_nolock(block);
+  int result = disconnect_top_block_nolock(block_out);
   mtx_unlock(&g_blockchain_lock);
   return result;
 }
 
-int is_genesis_block(uint8_t *block_hash)
+int rollback_blockchain_nolock(uint32_t rollback_height)
 {
-  assert(block_hash != NULL);
+  uint32_t current_block_height = get_block_height_nolock();
+  if (rollback_height > current_block_height)
+  {
+    LOG_WARNING("Could not rollback blockchain to height: %u, current blockchain top block height is: %u!", rollback_height, current_block_height);
+    return 1;
+  }
 
-  block_t *genesis_block = get_genesis_block();
-  assert(genesis_block != NULL);
+  if (current_block_height == rollback_height)
+  {
+    LOG_INFO("Blockchain already at rollback height: %u, nothing to rollback!", rollback_height);
+    return 1;
+  }
 
-  return compare_hash(block_hash, genesis_block->hash);
+  if (rollback_height < g_blockchain_pruned_height)
+  {
+    LOG_WARNING("Could not rollback blockchain to height: %u, blocks up to height: %u have been pruned!", rollback_height, g_blockchain_pruned_height);
+    return 1;
+  }
+
+  // each block is disconnected on it's own, so a failure part way
+  // through leaves the blockchain at the last block disconnected...
+  while (get_block_height_nolock() > rollback_height)
+  {
+    if (disconnect_top_block_nolock(NULL))
+    {
+      LOG_ERROR("Failed to rollback blockchain, could not disconnect block at height: %u!", get_block_height_nolock());
+      return 1;
+    }
+  }
+
+  LOG_INFO("Successfully rolled back blockchain to height: %u!", rollback_height);
+  return 0;
 }
 
-block_t *get_block_from_hash_nolock(uint8_t *block_hash)
+int rollback_blockchain(uint32_t rollback_height)
 {
-  assert(block_hash != NULL);
-  char *err = NULL;
-  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
-  get_block_key(key, block_hash);
-
-  size_t read_len;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  uint8_t *serialized_block = (uint8_t*)leveldb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  uint8_t *serialized_block = (uint8_t*)rocksdb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#endif
+  mtx_lock(&g_blockchain_lock);
+  int result = rollback_blockchain_nolock(rollback_height);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
 
-  if (err != NULL || serialized_block == NULL)
+/*
+ * A reorg disconnects our blocks down to the fork height and keeps the disconnected
+ * blocks around, if connecting the new branch fails the new branch is disconnected again
+ * and our blocks are reconnected instead of restoring the blockchain from a backup...
+ */
+int begin_blockchain_reorg_nolock(uint32_t fork_height)
+{
+  if (g_blockchain_reorg_active)
   {
-    goto block_retrieval_fail;
+    LOG_WARNING("Could not begin blockchain reorg, a reorg is already in progress!");
+    return 1;
   }
 
-  buffer_t *buffer = buffer_init_data(0, serialized_block, read_len);
-  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
-
-  // deserialize the block
-  block_t *block = NULL;
-  if (deserialize_block(buffer_iterator, &block))
+  uint32_t current_block_height = get_block_height_nolock();
+  if (fork_height > current_block_height)
   {
-    char *block_hash_str = bin2hex(block_hash, HASH_SIZE);
-    LOG_ERROR("Failed to deserialize block: %s", block_hash_str);
-    free(block_hash_str);
-
-    buffer_iterator_free(buffer_iterator);
-    buffer_free(buffer);
-    goto block_retrieval_fail;
+    LOG_WARNING("Could not begin blockchain reorg at fork height: %u, current blockchain top block height is: %u!", fork_height, current_block_height);
+    return 1;
   }
 
-  // deserialize the block's transactions
-  if (deserialize_transactions_to_block(buffer_iterator, block))
+  if (fork_height < g_blockchain_pruned_height)
   {
-    char *block_hash_str = bin2hex(block_hash, HASH_SIZE);
-    LOG_ERROR("Failed to deserialize transactions for block: %s, block has no serialized transactions!", block_hash_str);
-    free(block_hash_str);
+    LOG_WARNING("Could not begin blockchain reorg at fork height: %u, blocks up to height: %u have been pruned!", fork_height, g_blockchain_pruned_height);
+    return 1;
+  }
 
-    buffer_iterator_free(buffer_iterator);
-    buffer_free(buffer);
-    goto block_retrieval_fail;
+  if (current_block_height - fork_height > MAX_REORG_BLOCK_DEPTH)
+  {
+    LOG_WARNING("Could not begin blockchain reorg at fork height: %u, the fork is deeper than: %u blocks!", fork_height, MAX_REORG_BLOCK_DEPTH);
+    return 1;
   }
 
-  buffer_iterator_free(buffer_iterator);
-  buffer_free(buffer);
+  vec_init(&g_blockchain_reorg_blocks);
+  g_blockchain_reorg_fork_height = fork_height;
+  g_blockchain_reorg_active = 1;
 
-#ifdef USE_LEVELDB
-  leveldb_free(serialized_block);
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-#else
-  rocksdb_free(serialized_block);
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-#endif
-  return block;
+  while (get_block_height_nolock() > fork_height)
+  {
+    block_t *block = NULL;
+    if (disconnect_top_block_nolock(&block))
+    {
+      LOG_ERROR("Failed to begin blockchain reorg, could not disconnect block at height: %u!", get_block_height_nolock());
+      abort_blockchain_reorg_nolock();
+      return 1;
+    }
 
-block_retrieval_fail:
-#ifdef USE_LEVELDB
-  leveldb_free(serialized_block);
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-#else
-  rocksdb_free(serialized_block);
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-#endif
-  return NULL;
+    assert(vec_push(&g_blockchain_reorg_blocks, block) == 0);
+  }
+
+  LOG_INFO("Began blockchain reorg at fork height: %u, disconnected %u blocks.", fork_height, g_blockchain_reorg_blocks.length);
+  return 0;
 }
 
-block_t *get_block_from_hash(uint8_t *block_hash)
+int begin_blockchain_reorg(uint32_t fork_height)
 {
-  assert(block_hash != NULL);
   mtx_lock(&g_blockchain_lock);
-  block_t *block = get_block_from_hash_nolock(block_hash);
+  int result = begin_blockchain_reorg_nolock(fork_height);
   mtx_unlock(&g_blockchain_lock);
-  return block;
+  return result;
 }
 
-block_t *get_block_from_height_nolock(uint32_t height)
+static void free_blockchain_reorg_blocks(void)
 {
-  uint32_t current_block_height = get_block_height_nolock();
-  if (height > current_block_height)
+  void *val = NULL;
+  int i = 0;
+  vec_foreach(&g_blockchain_reorg_blocks, val, i)
   {
-    return NULL;
+    block_t *block = (block_t*)val;
+    assert(block != NULL);
+    free_block(block);
   }
 
-  if (height == 0)
-  {
-    block_t *genesis_block = get_genesis_block();
-    assert(genesis_block != NULL);
+  vec_deinit(&g_blockchain_reorg_blocks);
+  g_blockchain_reorg_active = 0;
+  publish_blockchain_tip_nolock();
+}
 
-    return get_block_from_hash_nolock(genesis_block->hash);
+int commit_blockchain_reorg_nolock(void)
+{
+  if (g_blockchain_reorg_active == 0)
+  {
+    return 1;
   }
 
-  block_t *block = get_current_block();
-  assert(block != NULL);
+  free_blockchain_reorg_blocks();
+  return 0;
+}
+
+int commit_blockchain_reorg(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = commit_blockchain_reorg_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+int abort_blockchain_reorg_nolock(void)
+{
+  if (g_blockchain_reorg_active == 0)
+  {
+    return 1;
+  }
 
-  for (uint32_t i = current_block_height; i > 0; i--)
+  // disconnect whatever part of the new branch was connected
+  int result = 0;
+  while (get_block_height_nolock() > g_blockchain_reorg_fork_height)
   {
-    if (i == height)
+    if (disconnect_top_block_nolock(NULL))
     {
-      break;
+      LOG_ERROR("Failed to abort blockchain reorg, could not disconnect block at height: %u!", get_block_height_nolock());
+      result = 1;
+      goto abort_reorg_done;
     }
+  }
+
+  // the disconnected blocks were pushed top first, so they are reconnected
+  // starting from the last one, these blocks were already validated before...
+  while (g_blockchain_reorg_blocks.length > 0)
+  {
+    block_t *block = vec_pop(&g_blockchain_reorg_blocks);
+    assert(block != NULL);
 
-    block_t *previous_block = get_block_from_hash_nolock(block->previous_hash);
-    if (previous_block == NULL)
+    if (insert_block_nolock(block, 1))
     {
+      LOG_ERROR("Failed to abort blockchain reorg, could not reconnect block: %s!", HASH2HEX_STR(block->hash));
       free_block(block);
-      return NULL;
+      result = 1;
+      goto abort_reorg_done;
     }
 
     free_block(block);
-    block = previous_block;
   }
 
-  return block;
+  LOG_INFO("Aborted blockchain reorg, reconnected blocks back to height: %u.", get_block_height_nolock());
+
+abort_reorg_done:
+  free_blockchain_reorg_blocks();
+  return result;
 }
 
-block_t *get_block_from_height(uint32_t height)
+int abort_blockchain_reorg(void)
 {
   mtx_lock(&g_blockchain_lock);
-  block_t *block = get_block_from_height_nolock(height);
+  int result = abort_blockchain_reorg_nolock();
   mtx_unlock(&g_blockchain_lock);
-  return block;
+  return result;
 }
 
-int32_t get_block_height_from_hash_nolock(uint8_t *block_hash)
+int get_blockchain_reorg_active(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int reorg_active = g_blockchain_reorg_active;
+  mtx_unlock(&g_blockchain_lock);
+  return reorg_active;
+}
+
+/*
+ * Switches our blockchain over to a new branch forking off at the fork height, the
+ * new branch's blocks are validated as they are connected and our own blocks are
+ * reconnected if any of them turns out to be invalid...
+ */
+int reorganize_blockchain_nolock(uint32_t fork_height, block_t **blocks, uint32_t num_blocks)
+{
+  assert(blocks != NULL);
+  if (begin_blockchain_reorg_nolock(fork_height))
+  {
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < num_blocks; i++)
+  {
+    block_t *block = blocks[i];
+    assert(block != NULL);
+
+    if (validate_and_insert_block_nolock(block))
+    {
+      LOG_WARNING("Could not reorganize blockchain, block: %s of the new branch is invalid!", HASH2HEX_STR(block->hash));
+      abort_blockchain_reorg_nolock();
+      return 1;
+    }
+  }
+
+  return commit_blockchain_reorg_nolock();
+}
+
+int reorganize_blockchain(uint32_t fork_height, block_t **blocks, uint32_t num_blocks)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = reorganize_blockchain_nolock(fork_height, blocks, num_blocks);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+void set_blockchain_prune_depth(uint32_t prune_depth)
+{
+  g_blockchain_prune_depth = prune_depth;
+}
+
+uint32_t get_blockchain_prune_depth(void)
+{
+  return g_blockchain_prune_depth;
+}
+
+void set_blockchain_prune_target_size(uint64_t prune_target_size)
+{
+  g_blockchain_prune_target_size = prune_target_size;
+}
+
+uint64_t get_blockchain_prune_target_size(void)
+{
+  return g_blockchain_prune_target_size;
+}
+
+int get_blockchain_prune_enabled(void)
+{
+  return g_blockchain_prune_depth > 0 || g_blockchain_prune_target_size > 0;
+}
+
+uint32_t get_blockchain_pruned_height(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  uint32_t pruned_height = g_blockchain_pruned_height;
+  mtx_unlock(&g_blockchain_lock);
+  return pruned_height;
+}
+
+int is_block_pruned_nolock(uint8_t *block_hash)
 {
   assert(block_hash != NULL);
-  uint32_t current_block_height = get_block_height_nolock();
+  if (g_blockchain_pruned_height == 0)
+  {
+    return 0;
+  }
+
+  header_index_entry_t *entry = get_header_index_entry_from_hash(block_hash);
+  return entry != NULL && entry->height > 0 && entry->height <= g_blockchain_pruned_height;
+}
+
+int is_block_pruned(uint8_t *block_hash)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = is_block_pruned_nolock(block_hash);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+int load_blockchain_pruned_height_nolock(void)
+{
+  uint8_t key[DB_KEY_PREFIX_SIZE_PRUNED_HEIGHT];
+  get_pruned_height_key(key);
+
+  // a blockchain that was never pruned has no pruned height stored
+  uint32_t pruned_height = 0;
+  if (get_height_from_key_nolock(key, sizeof(key), &pruned_height))
+  {
+    pruned_height = 0;
+  }
+
+  g_blockchain_pruned_height = pruned_height;
+  g_blockchain_stored_blocks_size_loaded = 0;
+  return 0;
+}
+
+/*
+ * Gets the size of a block's transactions and undo record as stored, the block
+ * value holds the transactions of blocks stored before they were split out...
+ */
+static int get_block_stored_size_nolock(uint8_t *block_hash, uint64_t *stored_size, int *inline_transactions)
+{
+  assert(block_hash != NULL);
+  assert(stored_size != NULL);
+  assert(inline_transactions != NULL);
+
+  char *err = NULL;
+  uint8_t txs_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS];
+  get_block_transactions_key(txs_key, block_hash);
+
+  size_t txs_size = 0;
+  uint8_t *txs_value = storage_get(g_blockchain_db, txs_key, sizeof(txs_key), &txs_size, &err);
+  if (err != NULL)
+  {
+    goto stored_size_fail;
+  }
+
+  *inline_transactions = 0;
+  if (txs_value == NULL)
+  {
+    uint8_t block_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+    get_block_key(block_key, block_hash);
+
+    txs_value = storage_get(g_blockchain_db, block_key, sizeof(block_key), &txs_size, &err);
+    if (err != NULL || txs_value == NULL)
+    {
+      goto stored_size_fail;
+    }
+
+    *inline_transactions = 1;
+  }
+
+  storage_free(txs_value);
+
+  uint8_t undo_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_UNDO];
+  get_block_undo_key(undo_key, block_hash);
+
+  size_t undo_size = 0;
+  uint8_t *undo_value = storage_get(g_blockchain_db, undo_key, sizeof(undo_key), &undo_size, &err);
+  if (err != NULL)
+  {
+    goto stored_size_fail;
+  }
+
+  if (undo_value == NULL)
+  {
+    undo_size = 0;
+  }
+
+  storage_free(undo_value);
+  *stored_size = txs_size + undo_size;
+  return 0;
+
+stored_size_fail:
+  storage_free(err);
+  return 1;
+}
+
+/*
+ * Counts the stored size of every block that has not been pruned yet, this is only
+ * needed when pruning to a target size and is kept up to date as blocks are inserted...
+ */
+static int load_blockchain_stored_blocks_size_nolock(void)
+{
+  uint64_t stored_blocks_size = 0;
+  uint32_t block_height = get_block_height_nolock();
+  for (uint32_t i = g_blockchain_pruned_height + 1; i <= block_height; i++)
+  {
+    header_index_entry_t *entry = get_header_index_entry(i);
+    assert(entry != NULL);
+
+    uint64_t stored_size = 0;
+    int inline_transactions = 0;
+    if (get_block_stored_size_nolock(entry->hash, &stored_size, &inline_transactions))
+    {
+      LOG_ERROR("Could not count stored size of block at height: %u!", i);
+      return 1;
+    }
+
+    stored_blocks_size += stored_size;
+  }
+
+  g_blockchain_stored_blocks_size = stored_blocks_size;
+  g_blockchain_stored_blocks_size_loaded = 1;
+  return 0;
+}
+
+/*
+ * Deletes a block's transactions, it's tx index entries and it's undo record, only
+ * the block's header is kept. Blocks stored with their transactions inline have
+ * their block value rewritten with the header alone...
+ */
+static int prune_block_nolock(storage_batch_t *write_batch, uint32_t block_height, uint64_t *stored_size_out)
+{
+  assert(write_batch != NULL);
+  assert(stored_size_out != NULL);
+
+  header_index_entry_t *entry = get_header_index_entry(block_height);
+  assert(entry != NULL);
+
+  uint64_t stored_size = 0;
+  int inline_transactions = 0;
+  if (get_block_stored_size_nolock(entry->hash, &stored_size, &inline_transactions))
+  {
+    return 1;
+  }
+
+  block_t *block = get_block_from_hash_nolock(entry->hash);
+  if (block == NULL)
+  {
+    return 1;
+  }
+
+  // a pruned block's txs cannot be read anymore, so they are dropped from the tx index
+  for (uint32_t i = 0; i < block->transaction_count && block_height < g_blockchain_tx_index_height; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
+
+    uint8_t tx_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
+    get_tx_key(tx_key, tx->id);
+
+    storage_batch_delete(write_batch, tx_key, sizeof(tx_key));
+  }
+
+  if (inline_transactions)
+  {
+    buffer_t *buffer = buffer_acquire_scratch();
+    if (serialize_block(buffer, block))
+    {
+      buffer_release_scratch(buffer);
+      free_block(block);
+      return 1;
+    }
+
+    uint8_t block_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+    get_block_key(block_key, block->hash);
+
+    storage_batch_put(write_batch, block_key, sizeof(block_key), buffer_get_data(buffer), buffer_get_size(buffer));
+    buffer_release_scratch(buffer);
+  }
+
+  uint8_t txs_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS];
+  get_block_transactions_key(txs_key, block->hash);
+
+  uint8_t undo_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_UNDO];
+  get_block_undo_key(undo_key, block->hash);
+
+  storage_batch_delete(write_batch, txs_key, sizeof(txs_key));
+  storage_batch_delete(write_batch, undo_key, sizeof(undo_key));
+
+  remove_block_from_block_cache(block->hash);
+  free_block(block);
+
+  *stored_size_out = stored_size;
+  return 0;
+}
+
+static int write_pruned_blocks_nolock(storage_batch_t *write_batch, uint32_t pruned_height)
+{
+  assert(write_batch != NULL);
+  uint8_t key[DB_KEY_PREFIX_SIZE_PRUNED_HEIGHT];
+  get_pruned_height_key(key);
+  write_batch_put_height(write_batch, key, sizeof(key), pruned_height);
+
+  char *err = NULL;
+  storage_write(g_blockchain_db, write_batch, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not write pruned blocks into blockchain storage: %s!", err);
+    storage_free(err);
+    return 1;
+  }
+
+  storage_batch_clear(write_batch);
+  g_blockchain_pruned_height = pruned_height;
+  publish_blockchain_tip_nolock();
+  return 0;
+}
+
+/*
+ * Prunes the oldest blocks until the blocks left are within the prune depth or fit
+ * the prune target size. The blocks within PRUNE_MIN_BLOCK_DEPTH of our top block and
+ * the blocks the unspent index has not caught up with are never pruned, so a reorg can
+ * still disconnect them and they can be reapplied after a crash...
+ */
+int prune_blockchain_nolock(void)
+{
+  if (get_blockchain_prune_enabled() == 0)
+  {
+    return 0;
+  }
+
+  uint32_t block_height = get_block_height_nolock();
+  if (block_height <= PRUNE_MIN_BLOCK_DEPTH)
+  {
+    return 0;
+  }
+
+  uint32_t max_prune_height = MIN(block_height - PRUNE_MIN_BLOCK_DEPTH, g_blockchain_top_unspent_tx_height);
+  uint32_t prune_height = 0;
+  if (g_blockchain_prune_depth > 0)
+  {
+    // a blockchain which is not yet deeper than the prune depth has nothing to prune by depth
+    uint32_t prune_depth = MAX(g_blockchain_prune_depth, PRUNE_MIN_BLOCK_DEPTH);
+    if (block_height <= prune_depth && g_blockchain_prune_target_size == 0)
+    {
+      return 0;
+    }
+
+    prune_height = block_height > prune_depth ? block_height - prune_depth : 0;
+  }
+
+  if (g_blockchain_prune_target_size > 0 && g_blockchain_stored_blocks_size_loaded == 0)
+  {
+    if (load_blockchain_stored_blocks_size_nolock())
+    {
+      return 1;
+    }
+  }
+
+  uint32_t pruned_height = g_blockchain_pruned_height;
+  uint32_t num_batched_blocks = 0;
+  storage_batch_t *write_batch = storage_batch_create();
+  while (pruned_height < max_prune_height)
+  {
+    int within_prune_depth = pruned_height >= prune_height;
+    int within_target_size = g_blockchain_prune_target_size == 0 ||
+      g_blockchain_stored_blocks_size <= g_blockchain_prune_target_size;
+
+    if (within_prune_depth && within_target_size)
+    {
+      break;
+    }
+
+    uint64_t stored_size = 0;
+    if (prune_block_nolock(write_batch, pruned_height + 1, &stored_size))
+    {
+      LOG_ERROR("Could not prune block at height: %u!", pruned_height + 1);
+      goto prune_blockchain_fail;
+    }
+
+    pruned_height++;
+    g_blockchain_stored_blocks_size -= MIN(stored_size, g_blockchain_stored_blocks_size);
+
+    // large prunes are written out in parts, so that pruning a blockchain
+    // for the first time does not build up a single enormous write batch...
+    num_batched_blocks++;
+    if (num_batched_blocks == PRUNE_MAX_BLOCKS_PER_WRITE_BATCH)
+    {
+      if (write_pruned_blocks_nolock(write_batch, pruned_height))
+      {
+        goto prune_blockchain_fail;
+      }
+
+      LOG_INFO("Pruned blockchain blocks up to height: %u...", pruned_height);
+      num_batched_blocks = 0;
+    }
+  }
+
+  if (num_batched_blocks > 0 && write_pruned_blocks_nolock(write_batch, pruned_height))
+  {
+    goto prune_blockchain_fail;
+  }
+
+  storage_batch_destroy(write_batch);
+  return 0;
+
+prune_blockchain_fail:
+  // the stored size counted no longer matches what is stored, count it again next time
+  g_blockchain_stored_blocks_size_loaded = 0;
+  storage_batch_destroy(write_batch);
+  return 1;
+}
+
+int prune_blockchain(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = prune_blockchain_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+uint32_t get_blockchain_tx_index_height(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  uint32_t tx_index_height = g_blockchain_tx_index_height;
+  mtx_unlock(&g_blockchain_lock);
+  return tx_index_height;
+}
+
+static int write_tx_index_height_nolock(uint32_t tx_index_height)
+{
+  uint8_t key[DB_KEY_PREFIX_SIZE_TX_INDEX_HEIGHT];
+  get_tx_index_height_key(key);
+
+  char *err = NULL;
+  storage_batch_t *write_batch = storage_batch_create();
+  write_batch_put_height(write_batch, key, sizeof(key), tx_index_height);
+  storage_write(g_blockchain_db, write_batch, &err);
+  storage_batch_destroy(write_batch);
+
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not write tx index height: %u: %s!", tx_index_height, err);
+    storage_free(err);
+    return 1;
+  }
+
+  g_blockchain_tx_index_height = tx_index_height;
+  return 0;
+}
+
+int load_blockchain_tx_index_height_nolock(void)
+{
+  uint8_t key[DB_KEY_PREFIX_SIZE_TX_INDEX_HEIGHT];
+  get_tx_index_height_key(key);
+
+  uint32_t block_height = get_block_height_nolock();
+  uint32_t tx_index_height = 0;
+  if (get_height_from_key_nolock(key, sizeof(key), &tx_index_height) == 0)
+  {
+    // blocks committed without syncing may have been lost along with
+    // the top block, the tx index never reaches past the top block...
+    if (tx_index_height > block_height + 1)
+    {
+      tx_index_height = block_height + 1;
+    }
+
+    g_blockchain_tx_index_height = tx_index_height;
+    return 0;
+  }
+
+  // blockchains stored before the tx index could be disabled have every tx
+  // indexed, which shows by the genesis block's txs being in the tx index...
+  g_blockchain_tx_index_height = 0;
+  block_t *genesis_block = get_block_from_height_nolock(0);
+  if (genesis_block == NULL)
+  {
+    return 0;
+  }
+
+  int indexed_txs = 0;
+  if (genesis_block->transaction_count > 0)
+  {
+    uint8_t *block_hash = get_block_hash_from_tx_id_nolock(genesis_block->transactions[0]->id);
+    if (block_hash != NULL)
+    {
+      indexed_txs = compare_hash(block_hash, genesis_block->hash);
+      free(block_hash);
+    }
+  }
+
+  free_block(genesis_block);
+  if (indexed_txs == 0)
+  {
+    return 0;
+  }
+
+  return write_tx_index_height_nolock(block_height + 1);
+}
+
+/*
+ * Adds the txs of up to max_blocks blocks from the tx index height up to the top
+ * block to the tx index, pruned blocks are skipped since their txs are gone...
+ */
+int backfill_tx_index_nolock(uint32_t max_blocks)
+{
+  uint32_t block_height = get_block_height_nolock();
+  uint32_t tx_index_height = g_blockchain_tx_index_height;
+  if (g_blockchain_tx_index_enabled == 0 || tx_index_height > block_height)
+  {
+    return 0;
+  }
+
+  storage_batch_t *write_batch = storage_batch_create();
+  for (uint32_t i = 0; i < max_blocks && tx_index_height <= block_height; i++)
+  {
+    if (tx_index_height > 0 && tx_index_height <= g_blockchain_pruned_height)
+    {
+      tx_index_height = g_blockchain_pruned_height + 1;
+      continue;
+    }
+
+    block_t *block = get_block_from_height_nolock(tx_index_height);
+    if (block == NULL)
+    {
+      LOG_ERROR("Could not build tx index, unknown block at height: %u!", tx_index_height);
+      storage_batch_destroy(write_batch);
+      return 1;
+    }
+
+    for (uint32_t j = 0; j < block->transaction_count; j++)
+    {
+      transaction_t *tx = block->transactions[j];
+      assert(tx != NULL);
+
+      uint8_t tx_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
+      get_tx_key(tx_key, tx->id);
+
+      storage_batch_put(write_batch, tx_key, sizeof(tx_key), block->hash, HASH_SIZE);
+    }
+
+    free_block(block);
+    tx_index_height++;
+  }
+
+  // the tx index height is written with the txs, so the tx index
+  // can never claim a block who's txs did not make it to disk
+  uint8_t key[DB_KEY_PREFIX_SIZE_TX_INDEX_HEIGHT];
+  get_tx_index_height_key(key);
+  write_batch_put_height(write_batch, key, sizeof(key), tx_index_height);
+
+  char *err = NULL;
+  storage_write(g_blockchain_db, write_batch, &err);
+  storage_batch_destroy(write_batch);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not build tx index up to height: %u: %s!", tx_index_height, err);
+    storage_free(err);
+    return 1;
+  }
+
+  g_blockchain_tx_index_height = tx_index_height;
+  return 0;
+}
+
+int backfill_tx_index(uint32_t max_blocks)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = backfill_tx_index_nolock(max_blocks);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+static task_result_t backfill_tx_index_task(task_t *task, va_list args)
+{
+  mtx_lock(&g_blockchain_lock);
+  if (backfill_tx_index_nolock(TX_INDEX_BACKFILL_BLOCKS_PER_TASK))
+  {
+    LOG_ERROR("Could not build the tx index, it only includes the txs of blocks below height: %u!", g_blockchain_tx_index_height);
+    mtx_unlock(&g_blockchain_lock);
+    g_blockchain_tx_index_backfill_task = NULL;
+    return TASK_RESULT_DONE;
+  }
+
+  // once it has caught up with the top block the
+  // tx index is kept up to date as blocks are inserted
+  uint32_t tx_index_height = g_blockchain_tx_index_height;
+  int caught_up = tx_index_height > get_block_height_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  if (caught_up == 0)
+  {
+    return TASK_RESULT_WAIT;
+  }
+
+  LOG_INFO("Finished building the tx index up to height: %u.", tx_index_height - 1);
+  g_blockchain_tx_index_backfill_task = NULL;
+  return TASK_RESULT_DONE;
+}
+
+int start_tx_index_backfill(void)
+{
+  if (g_blockchain_tx_index_backfill_task != NULL)
+  {
+    return 1;
+  }
+
+  if (g_blockchain_tx_index_enabled == 0)
+  {
+    return 0;
+  }
+
+  uint32_t tx_index_height = get_blockchain_tx_index_height();
+  if (tx_index_height > get_block_height())
+  {
+    return 0;
+  }
+
+  LOG_INFO("Building the tx index from height: %u in the background...", tx_index_height);
+  g_blockchain_tx_index_backfill_task = add_task(backfill_tx_index_task, TX_INDEX_BACKFILL_TASK_DELAY);
+  return 0;
+}
+
+int stop_tx_index_backfill(void)
+{
+  if (g_blockchain_tx_index_backfill_task == NULL)
+  {
+    return 0;
+  }
+
+  remove_task(g_blockchain_tx_index_backfill_task);
+  g_blockchain_tx_index_backfill_task = NULL;
+  return 0;
+}
+
+/*
+ * Writes the block headers up to the snapshot height and every unspent tx in the
+ * unspent index into a UTXO snapshot, our top block must be at the snapshot height...
+ */
+static int write_utxo_snapshot_nolock(const char *filename, uint32_t snapshot_height, uint8_t *snapshot_hash)
+{
+  assert(filename != NULL);
+  assert(snapshot_hash != NULL);
+  assert(get_block_height_nolock() == snapshot_height);
+
+  // the unspent index is read directly, so the utxo cache must be written to it first
+  if (flush_utxo_cache_nolock())
+  {
+    return 1;
+  }
+
+  uint8_t *block_hash = get_block_hash_from_height_nolock(snapshot_height);
+  if (block_hash == NULL)
+  {
+    LOG_ERROR("Could not export UTXO snapshot, unknown block at height: %u!", snapshot_height);
+    return 1;
+  }
+
+  uint8_t *checkpoint_hash = NULL;
+  assert(get_checkpoint_hash_from_height(snapshot_height, &checkpoint_hash) == 0);
+  if (compare_hash(block_hash, checkpoint_hash) == 0)
+  {
+    LOG_ERROR("Could not export UTXO snapshot, our block at height: %u does not match the checkpoint!", snapshot_height);
+    free(block_hash);
+    return 1;
+  }
+
+  utxo_snapshot_writer_t *writer = utxo_snapshot_writer_open(filename, snapshot_height, block_hash);
+  free(block_hash);
+  if (writer == NULL)
+  {
+    return 1;
+  }
+
+  for (uint32_t height = 0; height <= snapshot_height; height++)
+  {
+    block_t *block = get_block_header_from_height_nolock(height);
+    if (block == NULL)
+    {
+      LOG_ERROR("Could not export UTXO snapshot, unknown block at height: %u!", height);
+      goto export_fail;
+    }
+
+    buffer_t *buffer = buffer_acquire_scratch();
+    int result = serialize_block(buffer, block) ||
+      utxo_snapshot_write_entry(writer, UTXO_SNAPSHOT_ENTRY_HEADER, buffer_get_data(buffer), buffer_get_size(buffer));
+
+    buffer_release_scratch(buffer);
+    free_block(block);
+    if (result)
+    {
+      LOG_ERROR("Could not export UTXO snapshot, failed to write block header at height: %u!", height);
+      goto export_fail;
+    }
+  }
+
+  // the unspent txs are written in key order, which is the order they are bulk loaded in,
+  // the unspent txs written are checked against our utxo commitment along the way...
+  uint64_t num_unspent_txs = 0;
+  muhash_t utxo_commitment;
+  muhash_init(&utxo_commitment);
+
+  storage_iterator_t *iterator = storage_iterator_create(g_blockchain_db);
+  for (storage_iterator_seek(iterator, (uint8_t*)DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
+  {
+    size_t key_length;
+    size_t data_len;
+    const uint8_t *key = storage_iterator_key(iterator, &key_length);
+    const uint8_t *data = storage_iterator_value(iterator, &data_len);
+
+    if (key_length != DB_KEY_PREFIX_SIZE_UNSPENT_TX + HASH_SIZE ||
+      memcmp(key, DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX) != 0)
+    {
+      break;
+    }
+
+    buffer_t *buffer = buffer_init_data(0, data, data_len);
+    buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+    unspent_transaction_t *unspent_tx = NULL;
+    int result = deserialize_unspent_transaction(buffer_iterator, &unspent_tx);
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+    if (result)
+    {
+      LOG_ERROR("Could not export UTXO snapshot, failed to read unspent tx!");
+      storage_iterator_destroy(iterator);
+      muhash_free(&utxo_commitment);
+      goto export_fail;
+    }
+
+    insert_unspent_tx_into_utxo_commitment(&utxo_commitment, unspent_tx);
+    free_unspent_transaction(unspent_tx);
+
+    if (utxo_snapshot_write_entry(writer, UTXO_SNAPSHOT_ENTRY_UNSPENT_TX, data, (uint32_t)data_len))
+    {
+      LOG_ERROR("Could not export UTXO snapshot, failed to write unspent tx!");
+      storage_iterator_destroy(iterator);
+      muhash_free(&utxo_commitment);
+      goto export_fail;
+    }
+
+    num_unspent_txs++;
+  }
+
+  storage_iterator_destroy(iterator);
+
+  uint8_t digest[MUHASH_DIGEST_SIZE];
+  uint8_t expected_digest[MUHASH_DIGEST_SIZE];
+  int commitment_mismatch = muhash_finalize(&utxo_commitment, digest) ||
+    muhash_finalize(&g_blockchain_utxo_commitment, expected_digest) ||
+    memcmp(digest, expected_digest, MUHASH_DIGEST_SIZE) != 0;
+
+  muhash_free(&utxo_commitment);
+  if (commitment_mismatch)
+  {
+    LOG_ERROR("Could not export UTXO snapshot, the unspent index does not match our UTXO set commitment!");
+    goto export_fail;
+  }
+
+  if (utxo_snapshot_writer_finish(writer, snapshot_hash))
+  {
+    goto export_fail;
+  }
+
+  utxo_snapshot_writer_close(writer);
+  LOG_INFO("Exported %" PRIu64 " unspent transactions into UTXO snapshot: %s with UTXO set commitment: %s.", num_unspent_txs, filename, BIN2HEX_STR(digest, MUHASH_DIGEST_SIZE));
+  return 0;
+
+export_fail:
+  utxo_snapshot_writer_close(writer);
+  remove(filename);
+  return 1;
+}
+
+/*
+ * Exports a UTXO snapshot at the last checkpoint at or below our top block, the blocks
+ * above the checkpoint are disconnected while the snapshot is written and reconnected
+ * afterwards, so the snapshot always holds the UTXO set at the checkpoint...
+ */
+int export_utxo_snapshot_nolock(const char *filename)
+{
+  assert(filename != NULL);
+  if (g_blockchain_reorg_active)
+  {
+    LOG_ERROR("Could not export UTXO snapshot, a blockchain reorg is in progress!");
+    return 1;
+  }
+
+  uint32_t top_height = get_block_height_nolock();
+  uint32_t snapshot_height = 0;
+  if (get_last_checkpoint_height(top_height, &snapshot_height) || snapshot_height == 0)
+  {
+    LOG_ERROR("Could not export UTXO snapshot, no checkpoint at or below our top block height: %u!", top_height);
+    return 1;
+  }
+
+  int did_begin_reorg = 0;
+  if (snapshot_height < top_height)
+  {
+    if (begin_blockchain_reorg_nolock(snapshot_height))
+    {
+      LOG_ERROR("Could not export UTXO snapshot, failed to disconnect blocks down to checkpoint height: %u!", snapshot_height);
+      return 1;
+    }
+
+    did_begin_reorg = 1;
+  }
+
+  uint8_t snapshot_hash[HASH_SIZE];
+  int result = write_utxo_snapshot_nolock(filename, snapshot_height, snapshot_hash);
+  if (did_begin_reorg && abort_blockchain_reorg_nolock())
+  {
+    LOG_ERROR("Could not reconnect blocks above checkpoint height: %u after exporting UTXO snapshot!", snapshot_height);
+    return 1;
+  }
+
+  if (result == 0)
+  {
+    LOG_INFO("Exported UTXO snapshot at height: %u with snapshot hash: %s", snapshot_height, HASH2HEX_STR(snapshot_hash));
+  }
+
+  return result;
+}
+
+int export_utxo_snapshot(const char *filename)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = export_utxo_snapshot_nolock(filename);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+/*
+ * Imports a UTXO snapshot into a blockchain that has nothing above it's genesis block.
+ * The snapshot must be at a checkpoint and match the checkpoint's snapshot hash, the
+ * unspent txs are bulk loaded and the block headers are stored without their bodies,
+ * the blocks up to the snapshot height are then treated as pruned...
+ */
+int import_utxo_snapshot_nolock(const char *filename)
+{
+  assert(filename != NULL);
+  if (get_block_height_nolock() > 0)
+  {
+    LOG_ERROR("Could not import UTXO snapshot, the blockchain already has blocks above the genesis block!");
+    return 1;
+  }
+
+  uint32_t snapshot_height = 0;
+  uint8_t block_hash[HASH_SIZE];
+  utxo_snapshot_reader_t *reader = utxo_snapshot_reader_open(filename, &snapshot_height, block_hash);
+  if (reader == NULL)
+  {
+    return 1;
+  }
+
+  uint8_t *checkpoint_hash = NULL;
+  uint8_t *checkpoint_snapshot_hash = NULL;
+  if (snapshot_height == 0 || get_checkpoint_hash_from_height(snapshot_height, &checkpoint_hash) ||
+    compare_hash(block_hash, checkpoint_hash) == 0)
+  {
+    LOG_ERROR("Could not import UTXO snapshot, snapshot at height: %u does not match a checkpoint!", snapshot_height);
+    utxo_snapshot_reader_close(reader);
+    return 1;
+  }
+
+  if (get_checkpoint_utxo_snapshot_hash_from_height(snapshot_height, &checkpoint_snapshot_hash))
+  {
+    LOG_ERROR("Could not import UTXO snapshot, no snapshot hash is known for the checkpoint at height: %u!", snapshot_height);
+    utxo_snapshot_reader_close(reader);
+    return 1;
+  }
+
+  if (reset_blockchain_nolock())
+  {
+    utxo_snapshot_reader_close(reader);
+    return 1;
+  }
+
+  LOG_INFO("Importing UTXO snapshot: %s at height: %u...", filename, snapshot_height);
+  char *err = NULL;
+  storage_bulk_load_t *bulk_load = storage_bulk_load_create(g_blockchain_db, &err);
+  if (bulk_load == NULL)
+  {
+    LOG_ERROR("Could not import UTXO snapshot, failed to begin bulk load: %s!", err);
+    storage_free(err);
+    utxo_snapshot_reader_close(reader);
+    goto import_reset;
+  }
+
+  storage_batch_t *write_batch = storage_batch_create();
+  uint8_t previous_hash[HASH_SIZE];
+  uint8_t previous_tx_id[HASH_SIZE];
+  uint32_t num_headers = 0;
+  uint32_t num_batch_headers = 0;
+  uint64_t num_unspent_txs = 0;
+
+  while (1)
+  {
+    utxo_snapshot_entry_type_t entry_type = UTXO_SNAPSHOT_ENTRY_END;
+    const uint8_t *data = NULL;
+    uint32_t data_size = 0;
+    if (utxo_snapshot_read_entry(reader, &entry_type, &data, &data_size))
+    {
+      goto import_fail;
+    }
+
+    if (entry_type == UTXO_SNAPSHOT_ENTRY_END)
+    {
+      break;
+    }
+
+    buffer_t *buffer = buffer_init_data(0, data, data_size);
+    buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+    if (entry_type == UTXO_SNAPSHOT_ENTRY_HEADER)
+    {
+      // the headers come first and must form a chain starting at the genesis block
+      block_t *block = NULL;
+      int result = num_unspent_txs > 0 || num_headers > snapshot_height ||
+        deserialize_block(buffer_iterator, &block);
+
+      buffer_iterator_free(buffer_iterator);
+      buffer_free(buffer);
+      if (result || (num_headers == 0 ? is_genesis_block(block->hash) == 0 :
+        compare_hash(block->previous_hash, previous_hash) == 0))
+      {
+        LOG_ERROR("Could not import UTXO snapshot, invalid block header at height: %u!", num_headers);
+        if (block != NULL)
+        {
+          free_block(block);
+        }
+
+        goto import_fail;
+      }
+
+      uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+      get_block_key(key, block->hash);
+
+      uint8_t height_key[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + sizeof(uint32_t)];
+      get_block_height_key(height_key, num_headers);
+
+      storage_batch_put(write_batch, key, sizeof(key), data, data_size);
+      storage_batch_put(write_batch, height_key, sizeof(height_key), block->hash, HASH_SIZE);
+      memcpy(previous_hash, block->hash, HASH_SIZE);
+      free_block(block);
+
+      num_headers++;
+      num_batch_headers++;
+      if (num_batch_headers >= UTXO_SNAPSHOT_MAX_HEADERS_PER_WRITE_BATCH)
+      {
+        storage_write(g_blockchain_db, write_batch, &err);
+        if (err != NULL)
+        {
+          LOG_ERROR("Could not import UTXO snapshot, failed to write block headers: %s!", err);
+          storage_free(err);
+          goto import_fail;
+        }
+
+        storage_batch_clear(write_batch);
+        num_batch_headers = 0;
+      }
+    }
+    else
+    {
+      // the unspent txs follow every header and must be in strictly ascending key order
+      unspent_transaction_t *unspent_tx = NULL;
+      int result = num_headers != snapshot_height + 1 ||
+        deserialize_unspent_transaction(buffer_iterator, &unspent_tx);
+
+      buffer_iterator_free(buffer_iterator);
+      buffer_free(buffer);
+      if (result || (num_unspent_txs > 0 && memcmp(unspent_tx->id, previous_tx_id, HASH_SIZE) <= 0))
+      {
+        LOG_ERROR("Could not import UTXO snapshot, invalid unspent tx!");
+        if (unspent_tx != NULL)
+        {
+          free_unspent_transaction(unspent_tx);
+        }
+
+        goto import_fail;
+      }
+
+      // the blockchain was reset, so the utxo commitment starts out empty
+      insert_unspent_tx_into_utxo_commitment(&g_blockchain_utxo_commitment, unspent_tx);
+
+      uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
+      get_unspent_tx_key(key, unspent_tx->id);
+      memcpy(previous_tx_id, unspent_tx->id, HASH_SIZE);
+      free_unspent_transaction(unspent_tx);
+
+      storage_bulk_load_put(bulk_load, key, sizeof(key), data, data_size, &err);
+      if (err != NULL)
+      {
+        LOG_ERROR("Could not import UTXO snapshot, failed to load unspent tx: %s!", err);
+        storage_free(err);
+        goto import_fail;
+      }
+
+      num_unspent_txs++;
+    }
+  }
+
+  // nothing is made visible until the whole snapshot has been read and matches the checkpoint
+  uint8_t snapshot_hash[HASH_SIZE];
+  if (num_headers != snapshot_height + 1 || compare_hash(previous_hash, block_hash) == 0 ||
+    utxo_snapshot_reader_get_hash(reader, snapshot_hash) || compare_hash(snapshot_hash, checkpoint_snapshot_hash) == 0)
+  {
+    LOG_ERROR("Could not import UTXO snapshot, snapshot does not match the checkpoint at height: %u!", snapshot_height);
+    goto import_fail;
+  }
+
+  if (storage_bulk_load_finish(bulk_load, &err))
+  {
+    LOG_ERROR("Could not import UTXO snapshot, failed to finish bulk load: %s!", err);
+    storage_free(err);
+    goto import_fail;
+  }
+
+  // the bodies of the blocks up to the snapshot height are not stored, so they count as
+  // pruned. The address index has not been built, it is rebuilt from the unspent index
+  // when the blockchain state is loaded...
+  uint8_t pruned_height_key[DB_KEY_PREFIX_SIZE_PRUNED_HEIGHT];
+  get_pruned_height_key(pruned_height_key);
+
+  uint8_t snapshot_height_key[DB_KEY_PREFIX_SIZE_UTXO_SNAPSHOT_HEIGHT];
+  get_utxo_snapshot_height_key(snapshot_height_key);
+
+  write_batch_put_top_block(write_batch, block_hash, snapshot_height);
+  write_batch_put_top_unspent_tx_height(write_batch, snapshot_height);
+  if (write_batch_put_utxo_commitment(write_batch, &g_blockchain_utxo_commitment))
+  {
+    goto import_fail;
+  }
+
+  write_batch_put_height(write_batch, pruned_height_key, sizeof(pruned_height_key), snapshot_height);
+  write_batch_put_height(write_batch, snapshot_height_key, sizeof(snapshot_height_key), snapshot_height);
+  storage_write(g_blockchain_db, write_batch, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not import UTXO snapshot, failed to write top block: %s!", err);
+    storage_free(err);
+    goto import_fail;
+  }
+
+  storage_batch_destroy(write_batch);
+  storage_bulk_load_destroy(bulk_load);
+  utxo_snapshot_reader_close(reader);
+  if (load_blockchain_state_nolock(g_blockchain_dir))
+  {
+    goto import_reset;
+  }
+
+  set_current_block_hash(block_hash);
+  publish_blockchain_tip_nolock();
+  rescan_blockchain_wallet_nolock();
+  LOG_INFO("Imported %" PRIu64 " unspent transactions and %u block headers from UTXO snapshot: %s.",
+    num_unspent_txs, num_headers, filename);
+  return 0;
+
+import_fail:
+  storage_batch_destroy(write_batch);
+  storage_bulk_load_destroy(bulk_load);
+  utxo_snapshot_reader_close(reader);
+
+import_reset:
+  // a failed import leaves an empty blockchain with only the genesis block behind
+  if (reset_blockchain_nolock() == 0)
+  {
+    load_blockchain_top_block();
+  }
+
+  return 1;
+}
+
+int import_utxo_snapshot(const char *filename)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = import_utxo_snapshot_nolock(filename);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+uint32_t get_utxo_snapshot_height(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  uint8_t key[DB_KEY_PREFIX_SIZE_UTXO_SNAPSHOT_HEIGHT];
+  get_utxo_snapshot_height_key(key);
+
+  // the snapshot height is only stored until the snapshot has been verified
+  uint32_t snapshot_height = 0;
+  if (get_height_from_key_nolock(key, sizeof(key), &snapshot_height))
+  {
+    snapshot_height = 0;
+  }
+
+  mtx_unlock(&g_blockchain_lock);
+  return snapshot_height;
+}
+
+int set_utxo_snapshot_verified_nolock(void)
+{
+  uint8_t key[DB_KEY_PREFIX_SIZE_UTXO_SNAPSHOT_HEIGHT];
+  get_utxo_snapshot_height_key(key);
+
+  char *err = NULL;
+  storage_delete(g_blockchain_db, key, sizeof(key), &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not delete UTXO snapshot height: %s!", err);
+    storage_free(err);
+    return 1;
+  }
+
+  return 0;
+}
+
+int set_utxo_snapshot_verified(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = set_utxo_snapshot_verified_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+uint64_t get_cumulative_emission(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  header_index_entry_t *entry = get_header_index_entry_from_hash(g_blockchain_current_block_hash);
+  if (entry != NULL)
+  {
+    uint64_t cumulative_emission = entry->cumulative_emission;
+    mtx_unlock(&g_blockchain_lock);
+    return cumulative_emission;
+  }
+
+  mtx_unlock(&g_blockchain_lock);
+  block_t *current_block = get_current_block();
+  assert(current_block != NULL);
+  uint64_t cumulative_emission = current_block->cumulative_emission;
+  free_block(current_block);
+  return cumulative_emission;
+}
+
+uint64_t get_block_reward(uint32_t block_height, uint64_t cumulative_emission)
+{
+  uint64_t block_reward = (MAX_MONEY - cumulative_emission) >> BLOCK_REWARD_EMISSION_FACTOR;
+  uint64_t genesis_reward = parameters_get_genesis_reward();
+  if (cumulative_emission == 0 && genesis_reward > 0)
+  {
+    block_reward = genesis_reward;
+  }
+
+  return block_reward;
+}
+
+/*
+ * Loads the header of every main chain block into the header index, only the headers
+ * are read from storage. From then on the index is kept up to date as blocks are
+ * inserted and rolled back, so chain queries do not have to read blocks...
+ */
+int load_header_index_nolock(void)
+{
+  clear_header_index();
+
+  uint32_t current_block_height = get_block_height_nolock();
+  for (uint32_t height = 0; height <= current_block_height; height++)
+  {
+    uint8_t *block_hash = get_block_hash_from_height_nolock(height);
+    if (block_hash == NULL)
+    {
+      // nothing has been inserted into the blockchain yet
+      if (current_block_height == 0)
+      {
+        return 0;
+      }
+
+      LOG_ERROR("Could not load header index, unknown block at height: %u!", height);
+      clear_header_index();
+      return 1;
+    }
+
+    block_t *block = get_block_header_from_hash_nolock(block_hash);
+    free(block_hash);
+    if (block == NULL || push_header_index_entry(height, block))
+    {
+      LOG_ERROR("Could not load header index, invalid block at height: %u!", height);
+      if (block != NULL)
+      {
+        free_block(block);
+      }
+
+      clear_header_index();
+      return 1;
+    }
+
+    free_block(block);
+  }
+
+  LOG_INFO("Loaded header index with %u block headers using %zu kb of memory",
+    get_header_index_num_entries(), get_header_index_memory_size() / 1024);
+  return 0;
+}
+
+int load_header_index(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = load_header_index_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+const char* get_chain_state_manifest_filename(const char *blockchain_dir)
+{
+  return string_copy(blockchain_dir, CHAIN_STATE_MANIFEST_SUFFIX);
+}
+
+static void write_chain_state_manifest_header(buffer_t *buffer, header_index_entry_t *top_entry)
+{
+  assert(buffer != NULL);
+  assert(top_entry != NULL);
+
+  // the header index entries follow the header as they are laid out in memory
+  uint32_t byte_order_mark = CHAIN_STATE_MANIFEST_BYTE_ORDER_MARK;
+  buffer_write_uint32(buffer, CHAIN_STATE_MANIFEST_MAGIC);
+  buffer_write_uint32(buffer, CHAIN_STATE_MANIFEST_VERSION);
+  buffer_write_uint32(buffer, HEADER_INDEX_ENTRY_SIZE);
+  buffer_write(buffer, (uint8_t*)&byte_order_mark, sizeof(uint32_t));
+
+  buffer_write(buffer, g_blockchain_current_block_hash, HASH_SIZE);
+  buffer_write_uint32(buffer, g_blockchain_current_block_height);
+  buffer_write_uint64(buffer, top_entry->cumulative_emission);
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    buffer_write_uint32(buffer, top_entry->cumulative_work.words[i]);
+  }
+
+  buffer_write_uint32(buffer, g_blockchain_top_unspent_tx_height);
+  buffer_write_uint32(buffer, g_blockchain_pruned_height);
+  buffer_write_uint32(buffer, g_blockchain_tx_index_height);
+  buffer_write_uint64(buffer, g_blockchain_stored_blocks_size);
+  buffer_write_uint8(buffer, (uint8_t)g_blockchain_stored_blocks_size_loaded);
+}
+
+/*
+ * Writes the chain state manifest for the blockchain as it is now, this must only be
+ * done once the utxo cache was flushed and nothing else is written to the blockchain,
+ * since the manifest is trusted over the database on the next startup...
+ */
+int write_chain_state_manifest_nolock(void)
+{
+  header_index_entry_t *top_entry = get_header_index_top_entry();
+  if (g_blockchain_db == NULL || top_entry == NULL ||
+    compare_hash(top_entry->hash, g_blockchain_current_block_hash) == 0 ||
+    g_blockchain_top_unspent_tx_height != g_blockchain_current_block_height)
+  {
+    return 1;
+  }
+
+  uint8_t utxo_commitment[MUHASH_SIZE];
+  if (muhash_to_bytes(&g_blockchain_utxo_commitment, utxo_commitment))
+  {
+    LOG_ERROR("Could not write chain state manifest, failed to serialize the UTXO set commitment!");
+    return 1;
+  }
+
+  buffer_t *buffer = buffer_make();
+  write_chain_state_manifest_header(buffer, top_entry);
+  buffer_write(buffer, utxo_commitment, MUHASH_SIZE);
+
+  uint32_t num_entries = get_header_index_num_entries();
+  buffer_write_uint32(buffer, num_entries);
+  assert(buffer_get_size(buffer) == CHAIN_STATE_MANIFEST_HEADER_SIZE);
+
+  const uint8_t *entries_data = (const uint8_t*)get_header_index_entries();
+  size_t entries_size = (size_t)num_entries * HEADER_INDEX_ENTRY_SIZE;
+
+  uint8_t checksum[crypto_hash_sha256_BYTES];
+  crypto_hash_sha256_state checksum_state;
+  crypto_hash_sha256_init(&checksum_state);
+  crypto_hash_sha256_update(&checksum_state, buffer_get_data(buffer), buffer_get_size(buffer));
+  crypto_hash_sha256_update(&checksum_state, entries_data, entries_size);
+  crypto_hash_sha256_final(&checksum_state, checksum);
+
+  const char *manifest_filename = get_chain_state_manifest_filename(g_blockchain_dir);
+  char temp_filename[FILENAME_MAX];
+  snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", manifest_filename);
+
+  int result = 1;
+  FILE *fp = fopen(temp_filename, "wb");
+  if (fp == NULL)
+  {
+    LOG_ERROR("Could not open chain state manifest: %s for writing!", temp_filename);
+    goto write_manifest_done;
+  }
+
+  if (fwrite(buffer_get_data(buffer), 1, buffer_get_size(buffer), fp) != buffer_get_size(buffer) ||
+    fwrite(entries_data, 1, entries_size, fp) != entries_size ||
+    fwrite(checksum, 1, sizeof(checksum), fp) != sizeof(checksum))
+  {
+    fclose(fp);
+    LOG_ERROR("Could not write chain state manifest: %s!", temp_filename);
+    remove(temp_filename);
+    goto write_manifest_done;
+  }
+
+  // the manifest is written next to it's file and renamed over it,
+  // so a crash while writing never leaves a torn manifest behind...
+  if (fclose(fp) != 0 || rename(temp_filename, manifest_filename) != 0)
+  {
+    LOG_ERROR("Could not write chain state manifest: %s!", manifest_filename);
+    remove(temp_filename);
+    goto write_manifest_done;
+  }
+
+  result = 0;
+
+write_manifest_done:
+  free((char*)manifest_filename);
+  buffer_free(buffer);
+  return result;
+}
+
+int write_chain_state_manifest(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = write_chain_state_manifest_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+/*
+ * Reads the chain state manifest and restores the header index, the utxo commitment
+ * and the heights of the indexes from it. The manifest must match the top block of the
+ * database, otherwise it is stale and 1 is returned so that everything is loaded from
+ * the database instead. The manifest is always removed once read, so that a crash
+ * after opening the blockchain never leaves one behind that is out of date...
+ */
+int load_chain_state_manifest_nolock(void)
+{
+  const char *manifest_filename = get_chain_state_manifest_filename(g_blockchain_dir);
+  FILE *fp = fopen(manifest_filename, "rb");
+  if (fp == NULL)
+  {
+    free((char*)manifest_filename);
+    return 1;
+  }
+
+  int result = 1;
+  int reserved_entries = 0;
+  buffer_t *buffer = NULL;
+  buffer_iterator_t *buffer_iterator = NULL;
+  uint8_t *top_block_hash = get_top_block_hash_noblock();
+
+  uint8_t header[CHAIN_STATE_MANIFEST_HEADER_SIZE];
+  if (top_block_hash == NULL || fread(header, 1, sizeof(header), fp) != sizeof(header))
+  {
+    goto load_manifest_done;
+  }
+
+  buffer = buffer_init_data(0, header, sizeof(header));
+  buffer_iterator = buffer_iterator_init(buffer);
+
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint32_t entry_size = 0;
+  uint32_t byte_order_mark = 0;
+  uint8_t tip_hash[HASH_SIZE];
+  uint32_t tip_height = 0;
+  uint64_t cumulative_emission = 0;
+  uint256_t cumulative_work;
+  if (buffer_read_uint32(buffer_iterator, &magic) ||
+    buffer_read_uint32(buffer_iterator, &version) ||
+    buffer_read_uint32(buffer_iterator, &entry_size) ||
+    buffer_read_fixed(buffer_iterator, (uint8_t*)&byte_order_mark, sizeof(uint32_t)) ||
+    magic != CHAIN_STATE_MANIFEST_MAGIC || version != CHAIN_STATE_MANIFEST_VERSION ||
+    entry_size != HEADER_INDEX_ENTRY_SIZE || byte_order_mark != CHAIN_STATE_MANIFEST_BYTE_ORDER_MARK)
+  {
+    LOG_INFO("Discarding incompatible chain state manifest: %s...", manifest_filename);
+    goto load_manifest_done;
+  }
+
+  if (buffer_read_fixed(buffer_iterator, tip_hash, HASH_SIZE) ||
+    buffer_read_uint32(buffer_iterator, &tip_height) ||
+    buffer_read_uint64(buffer_iterator, &cumulative_emission))
+  {
+    goto load_manifest_done;
+  }
+
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    if (buffer_read_uint32(buffer_iterator, &cumulative_work.words[i]))
+    {
+      goto load_manifest_done;
+    }
+  }
+
+  uint32_t top_unspent_tx_height = 0;
+  uint32_t pruned_height = 0;
+  uint32_t tx_index_height = 0;
+  uint64_t stored_blocks_size = 0;
+  uint8_t stored_blocks_size_loaded = 0;
+  uint8_t utxo_commitment[MUHASH_SIZE];
+  uint32_t num_entries = 0;
+  if (buffer_read_uint32(buffer_iterator, &top_unspent_tx_height) ||
+    buffer_read_uint32(buffer_iterator, &pruned_height) ||
+    buffer_read_uint32(buffer_iterator, &tx_index_height) ||
+    buffer_read_uint64(buffer_iterator, &stored_blocks_size) ||
+    buffer_read_uint8(buffer_iterator, &stored_blocks_size_loaded) ||
+    buffer_read_fixed(buffer_iterator, utxo_commitment, MUHASH_SIZE) ||
+    buffer_read_uint32(buffer_iterator, &num_entries))
+  {
+    goto load_manifest_done;
+  }
+
+  // the manifest is stale if the blockchain was written to after it
+  if (compare_hash(tip_hash, top_block_hash) == 0 || tip_height != g_blockchain_current_block_height ||
+    num_entries != tip_height + 1 || top_unspent_tx_height != tip_height || pruned_height > tip_height)
+  {
+    LOG_INFO("Discarding stale chain state manifest: %s...", manifest_filename);
+    goto load_manifest_done;
+  }
+
+  // the entries are read straight into the header index
+  size_t entries_size = (size_t)num_entries * HEADER_INDEX_ENTRY_SIZE;
+  uint8_t *entries_data = (uint8_t*)reserve_header_index_entries(num_entries);
+  reserved_entries = 1;
+  uint8_t checksum[crypto_hash_sha256_BYTES];
+  uint8_t expected_checksum[crypto_hash_sha256_BYTES];
+  if (fread(entries_data, 1, entries_size, fp) != entries_size ||
+    fread(expected_checksum, 1, sizeof(expected_checksum), fp) != sizeof(expected_checksum))
+  {
+    LOG_INFO("Discarding truncated chain state manifest: %s...", manifest_filename);
+    goto load_manifest_done;
+  }
+
+  crypto_hash_sha256_state checksum_state;
+  crypto_hash_sha256_init(&checksum_state);
+  crypto_hash_sha256_update(&checksum_state, header, sizeof(header));
+  crypto_hash_sha256_update(&checksum_state, entries_data, entries_size);
+  crypto_hash_sha256_final(&checksum_state, checksum);
+  if (memcmp(checksum, expected_checksum, sizeof(checksum)) != 0)
+  {
+    LOG_INFO("Discarding corrupt chain state manifest: %s...", manifest_filename);
+    goto load_manifest_done;
+  }
+
+  if (restore_header_index_entries(num_entries))
+  {
+    LOG_INFO("Discarding chain state manifest: %s, invalid header index!", manifest_filename);
+    goto load_manifest_done;
+  }
+
+  header_index_entry_t *top_entry = get_header_index_top_entry();
+  if (compare_hash(top_entry->hash, tip_hash) == 0 || top_entry->cumulative_emission != cumulative_emission ||
+    uint256_compare(&top_entry->cumulative_work, &cumulative_work) != 0)
+  {
+    LOG_INFO("Discarding chain state manifest: %s, header index does not match the tip!", manifest_filename);
+    goto load_manifest_done;
+  }
+
+  muhash_t commitment;
+  muhash_init(&commitment);
+  if (muhash_from_bytes(&commitment, utxo_commitment))
+  {
+    muhash_free(&commitment);
+    goto load_manifest_done;
+  }
+
+  muhash_free(&g_blockchain_utxo_commitment);
+  g_blockchain_utxo_commitment = commitment;
+  g_blockchain_top_unspent_tx_height = top_unspent_tx_height;
+  g_blockchain_pruned_height = pruned_height;
+  g_blockchain_tx_index_height = MIN(tx_index_height, tip_height + 1);
+  g_blockchain_stored_blocks_size = stored_blocks_size;
+  g_blockchain_stored_blocks_size_loaded = stored_blocks_size_loaded != 0;
+  result = 0;
+
+  LOG_INFO("Loaded chain state manifest with %u block headers using %zu kb of memory",
+    get_header_index_num_entries(), get_header_index_memory_size() / 1024);
+
+load_manifest_done:
+  if (result && reserved_entries)
+  {
+    clear_header_index();
+  }
+
+  if (buffer_iterator != NULL)
+  {
+    buffer_iterator_free(buffer_iterator);
+  }
+
+  if (buffer != NULL)
+  {
+    buffer_free(buffer);
+  }
+
+  free(top_block_hash);
+  fclose(fp);
+  remove(manifest_filename);
+  free((char*)manifest_filename);
+  return result;
+}
+
+int load_chain_state_manifest(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = load_chain_state_manifest_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+uint32_t get_next_work_required_nolock(uint8_t *previous_hash)
+{
+  if (previous_hash == NULL)
+  {
+    return parameters_get_pow_initial_difficulty_bits();
+  }
+
+  // every block after the genesis block has the trivial difficulty, it is never retargeted
+  if (parameters_get_use_trivial_difficulty())
+  {
+    return POW_TRIVIAL_DIFFICULTY_BITS;
+  }
+
+  header_index_entry_t *previous_entry = get_header_index_entry_from_hash(previous_hash);
+  assert(previous_entry != NULL);
+
+  if ((previous_entry->height + 1) % parameters_get_difficulty_adjustment_interval() != 0)
+  {
+    return previous_entry->bits;
+  }
+
+  uint32_t period_start_block_height = 0;
+  if (previous_entry->height >= parameters_get_difficulty_adjustment_interval() - 1)
+  {
+    period_start_block_height = previous_entry->height - (parameters_get_difficulty_adjustment_interval() - 1);
+  }
+
+  header_index_entry_t *period_start_entry = get_header_index_entry(period_start_block_height);
+  assert(period_start_entry != NULL);
+
+  uint32_t actual_time_taken = previous_entry->timestamp - period_start_entry->timestamp;
+  if (actual_time_taken < parameters_get_pow_target_timespan())
+  {
+    return previous_entry->bits + 1;
+  }
+  else if (actual_time_taken > parameters_get_pow_target_timespan())
+  {
+    return previous_entry->bits - 1;
+  }
+
+  return previous_entry->bits;
+}
+
+uint32_t get_next_work_required(uint8_t *previous_hash)
+{
+  mtx_lock(&g_blockchain_lock);
+  uint32_t next_work_required = get_next_work_required_nolock(previous_hash);
+  mtx_unlock(&g_blockchain_lock);
+  return next_work_required;
+}
+
+int valid_block_median_timestamp(block_t *block)
+{
+  assert(block != NULL);
+  uint32_t current_block_height = get_block_height();
+  if (current_block_height < TIMESTAMP_CHECK_WINDOW)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_blockchain_lock);
+  header_index_entry_t *median_entry = get_header_index_entry(current_block_height - (TIMESTAMP_CHECK_WINDOW / 2));
+  assert(median_entry != NULL);
+  uint32_t median_timestamp = median_entry->timestamp;
+  mtx_unlock(&g_blockchain_lock);
+
+  return block->timestamp > median_timestamp;
+}
+
+int valid_block_emission(block_t *block)
+{
+  assert(block != NULL);
+  block_t *genesis_block = get_genesis_block();
+  assert(genesis_block != NULL);
+
+  transaction_t *tx = block->transactions[0];
+  assert(tx != NULL);
+
+  output_transaction_t *txout = tx->txouts[0];
+  assert(txout != NULL);
+
+  uint64_t expected_block_reward = 0;
+  uint64_t expected_cumulative_emission = 0;
+
+  if (compare_block(block, genesis_block))
+  {
+    expected_block_reward = get_block_reward(0, 0);
+    expected_cumulative_emission = expected_block_reward;
+  }
+  else
+  {
+    block_t *previous_block = get_block_header_from_hash(block->previous_hash);
+    assert(previous_block != NULL);
+
+    int32_t previous_height = get_block_height_from_block(previous_block);
+    assert(previous_height >= 0);
+
+    expected_block_reward = get_block_reward(previous_height, previous_block->cumulative_emission);
+    expected_cumulative_emission = previous_block->cumulative_emission + expected_block_reward;
+    free_block(previous_block);
+  }
+
+  return (txout->amount == expected_block_reward && block->cumulative_emission == expected_cumulative_emission);
+}
+
+static int compare_block_commit_unspent_tx_id(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, HASH_SIZE);
+}
+
+block_commit_t* init_block_commit(void)
+{
+  block_commit_t *block_commit = malloc(sizeof(block_commit_t));
+  assert(block_commit != NULL);
+
+  block_commit->write_batch = storage_batch_create();
+  block_commit->undo_buffer = buffer_init();
+  block_commit->undo_unspent_tx_count = 0;
+  block_commit->index_txs = 0;
+  muhash_init(&block_commit->utxo_commitment);
+
+  // staged unspent txs are keyed by their raw tx id
+  HashTableConf unspent_txs_conf;
+  hashtable_conf_init(&unspent_txs_conf);
+  unspent_txs_conf.key_length = HASH_SIZE;
+  unspent_txs_conf.hash = GENERAL_HASH;
+  unspent_txs_conf.key_compare = compare_block_commit_unspent_tx_id;
+  assert(hashtable_new_conf(&unspent_txs_conf, &block_commit->unspent_txs) == CC_OK);
+  return block_commit;
+}
+
+void free_block_commit(block_commit_t *block_commit)
+{
+  assert(block_commit != NULL);
+  void *val = NULL;
+  HASHTABLE_FOREACH(val, block_commit->unspent_txs,
+  {
+    block_commit_unspent_tx_t *commit_unspent_tx = *(block_commit_unspent_tx_t**)val;
+    assert(commit_unspent_tx != NULL);
+    if (commit_unspent_tx->unspent_tx != NULL)
+    {
+      free_unspent_transaction(commit_unspent_tx->unspent_tx);
+    }
+
+    free(commit_unspent_tx);
+  });
+
+  hashtable_destroy(block_commit->unspent_txs);
+  storage_batch_destroy(block_commit->write_batch);
+  buffer_free(block_commit->undo_buffer);
+  muhash_free(&block_commit->utxo_commitment);
+  free(block_commit);
+}
+
+static block_commit_unspent_tx_t* get_block_commit_unspent_tx(block_commit_t *block_commit, uint8_t *tx_id)
+{
+  void *val = NULL;
+  if (hashtable_get(block_commit->unspent_txs, tx_id, &val) != CC_OK)
+  {
+    return NULL;
+  }
+
+  return (block_commit_unspent_tx_t*)val;
+}
+
+static block_commit_unspent_tx_t* add_block_commit_unspent_tx(block_commit_t *block_commit, uint8_t *tx_id)
+{
+  block_commit_unspent_tx_t *commit_unspent_tx = get_block_commit_unspent_tx(block_commit, tx_id);
+  if (commit_unspent_tx != NULL)
+  {
+    return commit_unspent_tx;
+  }
+
+  commit_unspent_tx = malloc(sizeof(block_commit_unspent_tx_t));
+  assert(commit_unspent_tx != NULL);
+  memcpy(commit_unspent_tx->id, tx_id, HASH_SIZE);
+  commit_unspent_tx->unspent_tx = NULL;
+
+  assert(hashtable_add(block_commit->unspent_txs, commit_unspent_tx->id, commit_unspent_tx) == CC_OK);
+  return commit_unspent_tx;
+}
+
+/* Returns the unspent tx as staged by the block commit, loading it from the
+ * unspent index the first time it is referenced. The unspent tx is owned by the
+ * block commit and any changes made to it are written out with the block commit.
+ */
+unspent_transaction_t* get_unspent_tx_from_block_commit_nolock(block_commit_t *block_commit, uint8_t *tx_id)
+{
+  assert(block_commit != NULL);
+  assert(tx_id != NULL);
+
+  block_commit_unspent_tx_t *commit_unspent_tx = get_block_commit_unspent_tx(block_commit, tx_id);
+  if (commit_unspent_tx != NULL)
+  {
+    return commit_unspent_tx->unspent_tx;
+  }
+
+  unspent_transaction_t *unspent_tx = get_unspent_tx_from_index_nolock(tx_id);
+  if (unspent_tx == NULL)
+  {
+    return NULL;
+  }
+
+  // this is the unspent tx as it was before the block, keep it for the undo record
+  assert(serialize_unspent_transaction(block_commit->undo_buffer, unspent_tx) == 0);
+  block_commit->undo_unspent_tx_count++;
+
+  commit_unspent_tx = add_block_commit_unspent_tx(block_commit, tx_id);
+  commit_unspent_tx->unspent_tx = unspent_tx;
+  return unspent_tx;
+}
+
+int stage_unspent_tx_in_block_commit(block_commit_t *block_commit, unspent_transaction_t *unspent_tx)
+{
+  assert(block_commit != NULL);
+  assert(unspent_tx != NULL);
+
+  block_commit_unspent_tx_t *commit_unspent_tx = add_block_commit_unspent_tx(block_commit, unspent_tx->id);
+  if (commit_unspent_tx->unspent_tx != NULL && commit_unspent_tx->unspent_tx != unspent_tx)
+  {
+    free_unspent_transaction(commit_unspent_tx->unspent_tx);
+  }
+
+  commit_unspent_tx->unspent_tx = unspent_tx;
+  return 0;
+}
+
+int stage_unspent_tx_deletion_in_block_commit(block_commit_t *block_commit, uint8_t *tx_id)
+{
+  assert(block_commit != NULL);
+  assert(tx_id != NULL);
+
+  block_commit_unspent_tx_t *commit_unspent_tx = add_block_commit_unspent_tx(block_commit, tx_id);
+  if (commit_unspent_tx->unspent_tx != NULL)
+  {
+    free_unspent_transaction(commit_unspent_tx->unspent_tx);
+    commit_unspent_tx->unspent_tx = NULL;
+  }
+
+  return 0;
+}
+
+int stage_tx_index_in_block_commit(block_commit_t *block_commit, uint8_t *block_hash, transaction_t *tx)
+{
+  assert(block_commit != NULL);
+  assert(block_hash != NULL);
+  assert(tx != NULL);
+
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
+  get_tx_key(key, tx->id);
+
+  storage_batch_put(block_commit->write_batch, key, sizeof(key), block_hash, HASH_SIZE);
+  return 0;
+}
+
+void write_batch_delete_unspent_tx(storage_batch_t *write_batch, unspent_transaction_t *unspent_tx)
+{
+  assert(write_batch != NULL);
+  assert(unspent_tx != NULL);
+
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
+  get_unspent_tx_key(key, unspent_tx->id);
+
+  storage_batch_delete(write_batch, key, sizeof(key));
+
+  for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
+  {
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+    assert(unspent_txout != NULL);
+
+    uint8_t address_key[DB_KEY_SIZE_ADDRESS_UNSPENT_TXOUT];
+    get_address_unspent_txout_key(address_key, unspent_txout->address, unspent_tx->id, i);
+
+    storage_batch_delete(write_batch, address_key, sizeof(address_key));
+  }
+}
+
+/* Writes the unspent tx along with an address index entry for each of its
+ * unspent txouts, an unspent tx whose txouts are all spent is deleted instead...
+ */
+int write_batch_put_unspent_tx(storage_batch_t *write_batch, unspent_transaction_t *unspent_tx)
+{
+  assert(write_batch != NULL);
+  assert(unspent_tx != NULL);
+
+  if (is_unspent_tx_spent(unspent_tx))
+  {
+    write_batch_delete_unspent_tx(write_batch, unspent_tx);
+    return 0;
+  }
+
+  buffer_t *buffer = buffer_init();
+  if (serialize_unspent_transaction(buffer, unspent_tx))
+  {
+    buffer_free(buffer);
+    return 1;
+  }
+
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
+  get_unspent_tx_key(key, unspent_tx->id);
+
+  const uint8_t *data = buffer_get_data(buffer);
+  uint32_t data_len = buffer_get_size(buffer);
+
+  storage_batch_put(write_batch, key, sizeof(key), data, data_len);
+  buffer_free(buffer);
+
+  for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
+  {
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+    assert(unspent_txout != NULL);
+
+    uint8_t address_key[DB_KEY_SIZE_ADDRESS_UNSPENT_TXOUT];
+    get_address_unspent_txout_key(address_key, unspent_txout->address, unspent_tx->id, i);
+
+    if (unspent_txout->spent)
+    {
+      storage_batch_delete(write_batch, address_key, sizeof(address_key));
+      continue;
+    }
+
+    // the txout amount is stored so balances can be summed from the index alone
+    uint8_t amount[sizeof(uint64_t)];
+    for (int j = 0; j < sizeof(uint64_t); j++)
+    {
+      amount[j] = (uint8_t)(unspent_txout->amount >> (8 * (sizeof(uint64_t) - 1 - j)));
+    }
+
+    storage_batch_put(write_batch, address_key, sizeof(address_key), amount, sizeof(amount));
+  }
+
+  return 0;
+}
+
+/* Writes the block commit using a single write batch, the staged unspent txs are
+ * then handed over to the utxo cache as dirty entries and are written to the unspent
+ * index the next time the utxo cache is flushed...
+ */
+int write_block_commit_nolock(block_commit_t *block_commit)
+{
+  assert(block_commit != NULL);
+  char *err = NULL;
+  storage_write(g_blockchain_db, block_commit->write_batch, &err);
+
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not write block commit into blockchain storage: %s!", err);
+
+    storage_free(err);
+    return 1;
+  }
+
+  // the block is written either way, a failed sync is retried with the next commit
+  if (sync_block_commits_nolock())
+  {
+    LOG_WARNING("Could not sync block commits to disk, retrying with the next block commit!");
+  }
+
+  muhash_combine(&g_blockchain_utxo_commitment, &block_commit->utxo_commitment);
+
+  void *val = NULL;
+  HASHTABLE_FOREACH(val, block_commit->unspent_txs,
+  {
+    block_commit_unspent_tx_t *commit_unspent_tx = *(block_commit_unspent_tx_t**)val;
+    assert(commit_unspent_tx != NULL);
+    if (commit_unspent_tx->unspent_tx == NULL)
+    {
+      assert(add_spent_tx_to_utxo_cache(commit_unspent_tx->id) == 0);
+    }
+    else
+    {
+      // the utxo cache now owns the staged unspent tx
+      assert(add_unspent_tx_to_utxo_cache(commit_unspent_tx->unspent_tx, 1) == 0);
+      commit_unspent_tx->unspent_tx = NULL;
+    }
+  });
+
+  storage_free(err);
+  return 0;
+}
+
+int flush_utxo_cache_nolock(void)
+{
+  uint32_t block_height = get_block_height_nolock();
+  if (get_utxo_cache_num_dirty_entries() == 0 && g_blockchain_top_unspent_tx_height == block_height)
+  {
+    return 0;
+  }
+
+  char *err = NULL;
+  storage_batch_t *write_batch = storage_batch_create();
+
+  if (write_utxo_cache_to_write_batch(write_batch))
+  {
+    goto flush_utxo_cache_fail;
+  }
+
+  // the unspent index and the height it reflects are written together,
+  // so after a crash we know exactly which blocks have to be reapplied
+  write_batch_put_top_unspent_tx_height(write_batch, block_height);
+  if (write_batch_put_utxo_commitment(write_batch, &g_blockchain_utxo_commitment))
+  {
+    goto flush_utxo_cache_fail;
+  }
+
+  storage_write(g_blockchain_db, write_batch, &err);
+
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not flush utxo cache into blockchain storage: %s!", err);
+    goto flush_utxo_cache_fail;
+  }
+
+  mark_utxo_cache_clean();
+  trim_utxo_cache();
+  g_blockchain_top_unspent_tx_height = block_height;
+
+  // the tip's snapshot now trails the indexes, republish it so the readers see them
+  publish_blockchain_tip_nolock();
+
+  storage_free(err);
+  storage_batch_destroy(write_batch);
+  return 0;
+
+flush_utxo_cache_fail:
+  storage_free(err);
+  storage_batch_destroy(write_batch);
+  return 1;
+}
+
+int flush_utxo_cache(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = flush_utxo_cache_nolock();
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+static int should_flush_utxo_cache_nolock(void)
+{
+  if (get_utxo_cache_memory_size() > get_utxo_cache_max_memory_size())
+  {
+    return 1;
+  }
+
+  uint32_t flush_interval = get_utxo_cache_flush_interval();
+  uint32_t block_height = get_block_height_nolock();
+  return (flush_interval == 0 ||
+    block_height < g_blockchain_top_unspent_tx_height ||
+    block_height - g_blockchain_top_unspent_tx_height >= flush_interval);
+}
+
+/* Loads the height the unspent index was last flushed at and reapplies the
+ * unspent tx changes of every block above it, these were only ever held in
+ * the utxo cache when the blockchain was last closed...
+ */
+int load_top_unspent_tx_height_nolock(void)
+{
+  uint32_t block_height = get_block_height_nolock();
+  uint8_t key[DB_KEY_PREFIX_SIZE_TOP_UNSPENT_TX_HEIGHT];
+  get_top_unspent_tx_height_key(key);
+
+  uint32_t top_unspent_tx_height = 0;
+  if (get_height_from_key_nolock(key, sizeof(key), &top_unspent_tx_height))
+  {
+    g_blockchain_top_unspent_tx_height = block_height;
+    uint8_t *top_block_hash = get_top_block_hash_noblock();
+    if (top_block_hash == NULL)
+    {
+      // nothing has been inserted into the blockchain yet, the
+      // genesis block always flushes the utxo cache once inserted
+      return 0;
+    }
+
+    // blockchain databases created before the utxo cache always wrote
+    // unspent tx changes together with their block, so they are up to date
+    free(top_block_hash);
+    return write_top_unspent_tx_height_nolock(block_height);
+  }
+
+  g_blockchain_top_unspent_tx_height = top_unspent_tx_height;
+  if (top_unspent_tx_height >= block_height)
+  {
+    g_blockchain_top_unspent_tx_height = block_height;
+    return 0;
+  }
+
+  LOG_INFO("Reapplying unspent transactions from height: %u to height: %u...", top_unspent_tx_height + 1, block_height);
+  for (uint32_t i = top_unspent_tx_height + 1; i <= block_height; i++)
+  {
+    block_t *block = get_block_from_height_nolock(i);
+    if (block == NULL)
+    {
+      LOG_ERROR("Could not reapply unspent transactions, unknown block at height: %u!", i);
+      return 1;
+    }
+
+    block_commit_t *block_commit = init_block_commit();
+    if (update_unspent_transactions(block_commit, block) || write_block_commit_nolock(block_commit))
+    {
+      LOG_ERROR("Could not reapply unspent transactions for block at height: %u!", i);
+      free_block_commit(block_commit);
+      free_block(block);
+      return 1;
+    }
+
+    free_block_commit(block_commit);
+    free_block(block);
+  }
+
+  return flush_utxo_cache_nolock();
+}
+
+int write_top_unspent_tx_height_nolock(uint32_t block_height)
+{
+  char *err = NULL;
+  storage_batch_t *write_batch = storage_batch_create();
+  write_batch_put_top_unspent_tx_height(write_batch, block_height);
+  if (write_batch_put_utxo_commitment(write_batch, &g_blockchain_utxo_commitment))
+  {
+    storage_batch_destroy(write_batch);
+    return 1;
+  }
+
+  storage_write(g_blockchain_db, write_batch, &err);
+  storage_batch_destroy(write_batch);
+
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not write top unspent tx height: %u: %s!", block_height, err);
+
+    storage_free(err);
+    return 1;
+  }
+
+  g_blockchain_top_unspent_tx_height = block_height;
+
+  storage_free(err);
+  return 0;
+}
+
+uint32_t get_top_unspent_tx_height(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  uint32_t top_unspent_tx_height = g_blockchain_top_unspent_tx_height;
+  mtx_unlock(&g_blockchain_lock);
+  return top_unspent_tx_height;
+}
+
+int update_unspent_transaction(block_commit_t *block_commit, uint8_t *block_hash, transaction_t *tx)
+{
+  assert(block_commit != NULL);
+  assert(tx != NULL);
+  if (block_commit->index_txs && stage_tx_index_in_block_commit(block_commit, block_hash, tx))
+  {
+    return 1;
+  }
+
+  unspent_transaction_t *new_unspent_tx = transaction_to_unspent_transaction(tx);
+  insert_unspent_tx_into_utxo_commitment(&block_commit->utxo_commitment, new_unspent_tx);
+  if (stage_unspent_tx_in_block_commit(block_commit, new_unspent_tx))
+  {
+    return 1;
+  }
+
+  if (is_coinbase_tx(tx))
+  {
+    return 0;
+  }
+
+  // mark unspent txouts as spent for current txins
+  for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
+  {
+    input_transaction_t *txin = tx->txins[txin_index];
+    assert(txin != NULL);
+
+    unspent_transaction_t *unspent_tx = get_unspent_tx_from_block_commit_nolock(block_commit, txin->transaction);
+    assert(unspent_tx != NULL);
+
+    if (((unspent_tx->unspent_txout_count - 1) < txin->txout_index) ||
+      unspent_tx->unspent_txouts[txin->txout_index] == NULL)
+    {
+      LOG_DEBUG("A txin tried to mark a unspent txout: %s as spent, but it was not found!", HASH2HEX_STR(unspent_tx->id));
+      continue;
+    }
+
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[txin->txout_index];
+    assert(unspent_txout != NULL);
+
+    if (unspent_txout->spent == 1)
+    {
+      LOG_DEBUG("A txin tried to mark a unspent txout: %s as spent, but it was already spent!", HASH2HEX_STR(unspent_tx->id));
+      continue;
+    }
+
+    // the unspent tx is kept around once all of it's txouts are spent, so the
+    // address index entries of it's txouts can be removed when it is written
+    remove_unspent_txout_from_utxo_commitment(&block_commit->utxo_commitment, unspent_tx, txin->txout_index);
+    unspent_txout->spent = 1;
+  }
+
+  return 0;
+}
+
+int update_unspent_transactions(block_commit_t *block_commit, block_t *block)
+{
+  assert(block_commit != NULL);
+  assert(block != NULL);
+  TRACE_SPAN("update_unspent_transactions");
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *transaction = block->transactions[i];
+    assert(transaction != NULL);
+
+    if (update_unspent_transaction(block_commit, block->hash, transaction))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* After we insert block into blockchain
+ * Mark unspent txouts as spent for current txins
+ * Add current TX w/ unspent txouts to unspent index
+ */
+int insert_block_nolock(block_t *block, int update_unspent_txs)
+{
+  assert(block != NULL);
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+  get_block_key(key, block->hash);
+
+  // blocks are always inserted on top of our current top block,
+  // with the exception of the genesis block which starts the chain...
+  uint32_t block_height = 0;
+  if (is_genesis_block(block->hash) == 0)
+  {
+    block_height = get_block_height_nolock() + 1;
+  }
+
+  // the block must extend our top block, this is checked before anything
+  // is written so the stored blocks and the header index never disagree...
+  if (can_push_header_index_entry(block_height, block) == 0)
+  {
+    LOG_ERROR("Failed to insert block: %s into blockchain, it does not extend our top block!", HASH2HEX_STR(block->hash));
+    return 1;
+  }
+
+  buffer_t *buffer = buffer_acquire_scratch();
+  if (serialize_block(buffer, block))
+  {
+    LOG_ERROR("Failed to insert block: %s into blockchain, could not serialize block!", HASH2HEX_STR(block->hash));
+    buffer_release_scratch(buffer);
+    return 1;
+  }
+
+  // the block's transactions are stored under their own key, so that
+  // reading a block header never has to read it's transactions too...
+  buffer_t *txs_buffer = buffer_acquire_scratch();
+  if (serialize_transactions_from_block(txs_buffer, block))
+  {
+    LOG_ERROR("Failed to insert block: %s into blockchain, could not serialize block transactions!", HASH2HEX_STR(block->hash));
+    buffer_release_scratch(txs_buffer);
+    buffer_release_scratch(buffer);
+    return 1;
+  }
+
+  uint8_t txs_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS];
+  get_block_transactions_key(txs_key, block->hash);
+
+  const uint8_t *data = buffer_get_data(buffer);
+  uint32_t data_len = buffer_get_size(buffer);
+  const uint8_t *txs_data = buffer_get_data(txs_buffer);
+  uint32_t txs_data_len = buffer_get_size(txs_buffer);
+
+  // everything the block touches is written with a single write batch, so a
+  // failure or crash part way through never leaves the block half applied...
+  block_commit_t *block_commit = init_block_commit();
+
+  // the block's txs are only indexed once every block below it is, blocks
+  // skipped while the tx index is disabled are indexed in the background...
+  block_commit->index_txs = g_blockchain_tx_index_enabled && g_blockchain_tx_index_height == block_height;
+
+  // attempt to update the unspent and spent txs
+  if (update_unspent_txs)
+  {
+    uint64_t utxo_start_time = get_monotonic_time_us();
+    int update_failed = update_unspent_transactions(block_commit, block);
+    metric_histogram_observe(&g_block_validation_metric, BLOCK_VALIDATION_STAGE_UTXO, get_monotonic_time_us() - utxo_start_time);
+    if (update_failed)
+    {
+      LOG_ERROR("Failed to insert block: %s into blockchain, could not update unspent transactions!", HASH2HEX_STR(block->hash));
+      free_block_commit(block_commit);
+      buffer_release_scratch(txs_buffer);
+      buffer_release_scratch(buffer);
+      return 1;
+    }
+  }
+  else
+  {
+    // this block has no unspent tx changes, so once the utxo cache is
+    // flushed the unspent index is also up to date with this block
+    if (flush_utxo_cache_nolock())
+    {
+      free_block_commit(block_commit);
+      buffer_release_scratch(txs_buffer);
+      buffer_release_scratch(buffer);
+      return 1;
+    }
+
+    write_batch_put_top_unspent_tx_height(block_commit->write_batch, block_height);
+    if (write_batch_put_utxo_commitment(block_commit->write_batch, &g_blockchain_utxo_commitment))
+    {
+      free_block_commit(block_commit);
+      buffer_release_scratch(txs_buffer);
+      buffer_release_scratch(buffer);
+      return 1;
+    }
+  }
+
+  // write the block, it's height index entry and the new top block
+  // together so the stored top block height always matches the blocks stored
+  uint8_t block_height_key[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + sizeof(uint32_t)];
+  get_block_height_key(block_height_key, block_height);
+
+  storage_batch_put(block_commit->write_batch, key, sizeof(key), data, data_len);
+  storage_batch_put(block_commit->write_batch, txs_key, sizeof(txs_key), txs_data, txs_data_len);
+  storage_batch_put(block_commit->write_batch, block_height_key, sizeof(block_height_key),
+    block->hash, HASH_SIZE);
+  write_batch_put_top_block(block_commit->write_batch, block->hash, block_height);
+
+  // the undo record is what lets the block be disconnected again later,
+  // a block which spends nothing still gets an empty undo record
+  uint8_t undo_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_UNDO];
+  get_block_undo_key(undo_key, block->hash);
+
+  buffer_t *undo_buffer = buffer_acquire_scratch();
+  buffer_write_uint32(undo_buffer, block_commit->undo_unspent_tx_count);
+  if (block_commit->undo_unspent_tx_count > 0)
+  {
+    buffer_write(undo_buffer, buffer_get_data(block_commit->undo_buffer), buffer_get_size(block_commit->undo_buffer));
+  }
+
+  storage_batch_put(block_commit->write_batch, undo_key, sizeof(undo_key),
+    buffer_get_data(undo_buffer), buffer_get_size(undo_buffer));
+  uint64_t stored_size = txs_data_len + buffer_get_size(undo_buffer);
+  buffer_release_scratch(undo_buffer);
+
+  if (block_commit->index_txs)
+  {
+    // the txs were staged along with the unspent txs unless those were skipped
+    for (uint32_t i = 0; i < block->transaction_count && update_unspent_txs == 0; i++)
+    {
+      stage_tx_index_in_block_commit(block_commit, block->hash, block->transactions[i]);
+    }
+
+    uint8_t tx_index_height_key[DB_KEY_PREFIX_SIZE_TX_INDEX_HEIGHT];
+    get_tx_index_height_key(tx_index_height_key);
+    write_batch_put_height(block_commit->write_batch, tx_index_height_key, sizeof(tx_index_height_key), block_height + 1);
+  }
+
+  // the filter is kept once the block is pruned, so that wallets can
+  // still skip the blocks which do not concern them...
+  if (g_blockchain_block_filters_enabled)
+  {
+    uint8_t filter_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_FILTER];
+    get_block_filter_key(filter_key, block->hash);
+
+    buffer_t *filter_buffer = buffer_acquire_scratch();
+    if (serialize_block_filter(filter_buffer, block) == 0)
+    {
+      storage_batch_put(block_commit->write_batch, filter_key, sizeof(filter_key),
+        buffer_get_data(filter_buffer), buffer_get_size(filter_buffer));
+    }
+    else
+    {
+      LOG_WARNING("Could not build filter for block: %s!", HASH2HEX_STR(block->hash));
+    }
+
+    buffer_release_scratch(filter_buffer);
+  }
+  buffer_release_scratch(txs_buffer);
+  buffer_release_scratch(buffer);
+
+  uint64_t db_write_start_time = get_monotonic_time_us();
+  int write_failed = write_block_commit_nolock(block_commit);
+  metric_histogram_observe(&g_block_validation_metric, BLOCK_VALIDATION_STAGE_DB_WRITE, get_monotonic_time_us() - db_write_start_time);
+  if (write_failed)
+  {
+    LOG_ERROR("Could not insert block: %s into blockchain storage!", HASH2HEX_STR(block->hash));
+    free_block_commit(block_commit);
+    return 1;
+  }
+
+  if (block_commit->index_txs)
+  {
+    g_blockchain_tx_index_height = block_height + 1;
+  }
+
+  free_block_commit(block_commit);
+
+  // update our current top block hash and height in memory
+  set_current_block_hash(block->hash);
+  g_blockchain_current_block_height = block_height;
+  if (push_header_index_entry(block_height, block))
+  {
+    LOG_ERROR("Could not add block: %s to the header index!", HASH2HEX_STR(block->hash));
+    return 1;
+  }
+  if (update_unspent_txs == 0)
+  {
+    g_blockchain_top_unspent_tx_height = block_height;
+  }
+
+  // the genesis block is always flushed, there would otherwise
+  // be no height to reapply it's unspent txs from after a crash...
+  if (block_height == 0 || should_flush_utxo_cache_nolock())
+  {
+    if (flush_utxo_cache_nolock())
+    {
+      LOG_ERROR("Could not flush utxo cache after inserting block: %s!", HASH2HEX_STR(block->hash));
+      return 1;
+    }
+  }
+
+  // the oldest blocks are pruned as new blocks push them past the prune depth,
+  // a failure to prune only leaves the blocks around until the next block...
+  if (g_blockchain_stored_blocks_size_loaded)
+  {
+    g_blockchain_stored_blocks_size += stored_size;
+  }
+
+  if (prune_blockchain_nolock())
+  {
+    LOG_WARNING("Could not prune blockchain after inserting block at height: %u!", block_height);
+  }
+
+  publish_blockchain_tip_nolock();
+  if (g_blockchain_wallet != NULL && connect_block_to_wallet(g_blockchain_wallet, block))
+  {
+    LOG_WARNING("Could not connect block to blockchain wallet, the wallet will be rescanned when next loaded!");
+  }
+
+  // clear the block's transactions from the mempool if any are
+  // currently in our mempool, this prevents us from adding transactions
+  // to another block that have already been used...
+  assert(clear_txs_in_mempool_from_block(block) == 0);
+  return 0;
+}
+
+int insert_block(block_t *block, int update_unspent_txs)
+{
+  assert(block != NULL);
+  mtx_lock(&g_blockchain_lock);
+  int result = insert_block_nolock(block, update_unspent_txs);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+static int validate_and_insert_block_internal_nolock(block_t *block, int stateless_checks_passed)
+{
+  assert(block != NULL);
+  TRACE_SPAN("validate_and_insert_block");
+
+  // verify the block, ensure the block is not an orphan or stale,
+  // if the block is the genesis, then we do not need to validate it,
+  // when the stateless checks were already done outside of the blockchain lock
+  // only the block's txins need to be checked against the UTXO set...
+  uint32_t current_block_height = get_block_height_nolock();
+  if (stateless_checks_passed)
+  {
+    uint64_t txins_start_time = get_monotonic_time_us();
+    int txins_valid = valid_block_txins(block);
+    metric_histogram_observe(&g_block_validation_metric, BLOCK_VALIDATION_STAGE_TXINS, get_monotonic_time_us() - txins_start_time);
+    if (!txins_valid)
+    {
+      return 1;
+    }
+  }
+  else if (!valid_block(block))
+  {
+    return 1;
+  }
+
+  // ensure we are not adding a block that already exists in the blockchain...
+  if (has_block_by_hash(block->hash))
+  {
+    return 1;
+  }
+
+  // check this blocks previous has against our current top block hash
+  // only the header of our current block is needed, it's body may not be stored
+  block_t *current_block = get_block_header_from_hash_nolock(get_current_block_hash());
+  if (current_block_height > 0)
+  {
+    assert(current_block != NULL);
+    if (compare_hash(block->previous_hash, current_block->hash) == 0)
+    {
+      goto validate_block_fail;
+    }
+  }
+
+  // check to see if this block's timestamp is greater than the
+  // last median TIMESTAMP_CHECK_WINDOW / 2 block's timestamp...
+  if (!valid_block_median_timestamp(block))
+  {
+    LOG_DEBUG("Could not insert block into blockchain, block has expired timestamp: %u!", block->timestamp);
+    goto validate_block_fail;
+  }
+
+  // validate the block's generation transaction
+  if (!valid_block_emission(block))
+  {
+    LOG_DEBUG("Could not insert block into blockchain, block has invalid generation transaction!");
+    goto validate_block_fail;
+  }
+
+  // check the block's difficulty against it's expected value, also check the block's
+  // hash to see if it's difficulty is valid...
+  uint32_t expected_difficulty = 0;
+  if (current_block != NULL)
+  {
+    expected_difficulty = get_next_work_required(current_block->hash);
+  }
+  else
+  {
+    expected_difficulty = get_next_work_required(NULL);
+  }
+
+  assert(expected_difficulty > 0);
+  if (block->bits != expected_difficulty)
+  {
+    LOG_DEBUG("Could not insert block into blockchain, block has invalid difficulty: %u expected: %u!", block->bits, expected_difficulty);
+    goto validate_block_fail;
+  }
+
+  if (check_proof_of_work(block->hash, expected_difficulty) == 0)
+  {
+    LOG_ERROR("Could not insert block into blockchain, block does not have enough PoW: %u expected: %u!", block->bits, expected_difficulty);
+    goto validate_block_fail;
+  }
+
+  // as an extra measure, ensure that the block hash is that of
+  // what we were expecting provided it's contents...
+  assert(valid_block_hash(block) == 1);
+  if (current_block != NULL)
+  {
+    free_block(current_block);
+  }
+
+  return insert_block_nolock(block, 1);
+
+validate_block_fail:
+  print_block(current_block);
+  printf("\n");
+  if (current_block != NULL)
+  {
+    free_block(current_block);
+  }
+
+  return 1;
+}
+
+int validate_and_insert_block_nolock(block_t *block)
+{
+  return validate_and_insert_block_internal_nolock(block, 0);
+}
+
+/*
+ * Connects the orphan blocks which were waiting on the block that was just inserted, every
+ * orphan which connects may have orphans waiting on it in turn so they connect in a chain.
+ * The stateless checks of each orphan are split across the validation threads before the
+ * blockchain lock is taken for it, like any other block. Orphans waiting on the same block
+ * are tried until one connects, the siblings of that orphan stay in the pool until they expire.
+ */
+static uint32_t connect_orphan_blocks(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, block_hash, HASH_SIZE);
+
+  uint32_t num_connected_blocks = 0;
+  block_t *orphan_block = NULL;
+  while ((orphan_block = take_orphan_block_from_previous_hash(previous_hash)) != NULL)
+  {
+    int result = 1;
+    if (valid_block_stateless(orphan_block, 1))
+    {
+      mtx_lock(&g_blockchain_lock);
+      result = validate_and_insert_block_internal_nolock(orphan_block, 1);
+      mtx_unlock(&g_blockchain_lock);
+    }
+
+    if (result == 0)
+    {
+      memcpy(previous_hash, orphan_block->hash, HASH_SIZE);
+      num_connected_blocks++;
+    }
+    else
+    {
+      LOG_DEBUG("Dropping orphan block: %s, it could not be connected!", HASH2HEX_STR(orphan_block->hash));
+    }
+
+    free_block(orphan_block);
+  }
+
+  if (num_connected_blocks > 0)
+  {
+    LOG_INFO("Connected %u orphan blocks up to height: %u.", num_connected_blocks, get_block_height());
+  }
+
+  return num_connected_blocks;
+}
+
+static int validate_and_insert_block_internal(block_t *block, int check_signatures)
+{
+  assert(block != NULL);
+
+  // the checks which do not depend on the state of the blockchain are
+  // split across the validation threads before taking the blockchain lock...
+  uint64_t start_time = get_monotonic_time_us();
+  int stateless_valid = valid_block_stateless(block, check_signatures);
+  metric_histogram_observe(&g_block_validation_metric, BLOCK_VALIDATION_STAGE_SIGNATURES, get_monotonic_time_us() - start_time);
+  if (!stateless_valid)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_blockchain_lock);
+  int result = validate_and_insert_block_internal_nolock(block, 1);
+  mtx_unlock(&g_blockchain_lock);
+  if (result == 0)
+  {
+    metric_histogram_observe(&g_block_validation_metric, BLOCK_VALIDATION_STAGE_TOTAL, get_monotonic_time_us() - start_time);
+    connect_orphan_blocks(block->hash);
+  }
+
+  return result;
+}
+
+int validate_and_insert_block(block_t *block)
+{
+  return validate_and_insert_block_internal(block, 1);
+}
+
+/*
+ * Validates and inserts a block known to be an ancestor of a checkpointed block, the
+ * checkpoint vouches for the block's txs so their txin signatures are not checked,
+ * every other check including the UTXO set checks still runs...
+ */
+int validate_and_insert_block_assume_valid(block_t *block)
+{
+  return validate_and_insert_block_internal(block, 0);
+}
+
+int is_genesis_block(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+
+  block_t *genesis_block = get_genesis_block();
+  assert(genesis_block != NULL);
+
+  return compare_hash(block_hash, genesis_block->hash);
+}
+
+static block_t *read_block_header(blockchain_tip_t *tip, uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  char *err = NULL;
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+  get_block_key(key, block_hash);
+
+  size_t read_len;
+  uint8_t *serialized_block = get_blockchain_value(tip, key, sizeof(key), &read_len, &err);
+
+  if (err != NULL || serialized_block == NULL)
+  {
+    goto block_retrieval_fail;
+  }
+
+  buffer_t *buffer = buffer_init_data(0, serialized_block, read_len);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+  // deserialize the block header, blocks stored before the transactions were
+  // split out still carry them after the header, those are left unread here...
+  block_t *block = NULL;
+  if (deserialize_block(buffer_iterator, &block))
+  {
+    LOG_ERROR("Failed to deserialize block: %s", HASH2HEX_STR(block_hash));
+
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+    goto block_retrieval_fail;
+  }
+
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+
+  storage_free(serialized_block);
+  storage_free(err);
+  return block;
+
+block_retrieval_fail:
+  storage_free(serialized_block);
+  storage_free(err);
+  return NULL;
+}
+
+/*
+ * Reads only the header of the block, it's transactions are stored
+ * separately and can be loaded on demand with load_block_transactions_nolock.
+ */
+block_t *get_block_header_from_hash_nolock(uint8_t *block_hash)
+{
+  return read_block_header(NULL, block_hash);
+}
+
+block_t *get_block_header_from_hash(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  mtx_lock(&g_blockchain_lock);
+  block_t *block = get_block_header_from_hash_nolock(block_hash);
+  mtx_unlock(&g_blockchain_lock);
+  return block;
+}
+
+static int read_block_transactions(blockchain_tip_t *tip, block_t *block)
+{
+  assert(block != NULL);
+  assert(block->transactions == NULL);
+  if (block->transaction_count == 0)
+  {
+    return 0;
+  }
+
+  // only the header of a pruned block is still stored, reading at a tip
+  // finds nothing after the header instead...
+  if (tip == NULL && is_block_pruned_nolock(block->hash))
+  {
+    return 1;
+  }
+
+  char *err = NULL;
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS];
+  get_block_transactions_key(key, block->hash);
+
+  size_t read_len;
+  int inline_transactions = 0;
+  uint8_t *serialized_txs = get_blockchain_value(tip, key, sizeof(key), &read_len, &err);
+
+  if (err != NULL)
+  {
+    goto load_transactions_fail;
+  }
+
+  if (serialized_txs == NULL)
+  {
+    uint8_t block_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+    get_block_key(block_key, block->hash);
+
+    serialized_txs = get_blockchain_value(tip, block_key, sizeof(block_key), &read_len, &err);
+    if (err != NULL || serialized_txs == NULL)
+    {
+      goto load_transactions_fail;
+    }
+
+    inline_transactions = 1;
+  }
+
+  buffer_t *buffer = buffer_init_data(0, serialized_txs, read_len);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+  // skip over the header that precedes the inline transactions
+  if (inline_transactions)
+  {
+    block_t *header_block = NULL;
+    if (deserialize_block(buffer_iterator, &header_block))
+    {
+      buffer_iterator_free(buffer_iterator);
+      buffer_free(buffer);
+      goto load_transactions_fail;
+    }
+
+    free_block(header_block);
+    if (tip != NULL && buffer_get_remaining_size(buffer_iterator) == 0)
+    {
+      buffer_iterator_free(buffer_iterator);
+      buffer_free(buffer);
+      goto load_transactions_fail;
+    }
+  }
+
+  if (deserialize_transactions_to_block_in_arena(buffer_iterator, block))
+  {
+    LOG_ERROR("Failed to deserialize transactions for block: %s, block has no serialized transactions!", HASH2HEX_STR(block->hash));
+
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+    goto load_transactions_fail;
+  }
+
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+
+  storage_free(serialized_txs);
+  storage_free(err);
+  return 0;
+
+load_transactions_fail:
+  storage_free(serialized_txs);
+  storage_free(err);
+  return 1;
+}
+
+/*
+ * Loads the transactions of a block previously read with get_block_header_from_hash_nolock,
+ * the transactions are read from the block's transactions key, falling back to the
+ * transactions stored inline after the header for blocks written before they were split out.
+ * The transactions are deserialized into an arena owned by the block, blocks read from storage
+ * are only ever read from and free'd, never added to.
+ */
+int load_block_transactions_nolock(block_t *block)
+{
+  return read_block_transactions(NULL, block);
+}
+
+int load_block_transactions(block_t *block)
+{
+  assert(block != NULL);
+  mtx_lock(&g_blockchain_lock);
+  int result = load_block_transactions_nolock(block);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+static block_t *read_block(blockchain_tip_t *tip, uint8_t *block_hash)
+{
+  block_t *block = read_block_header(tip, block_hash);
+  if (block == NULL)
+  {
+    return NULL;
+  }
+
+  if (read_block_transactions(tip, block))
+  {
+    free_block(block);
+    return NULL;
+  }
+
+  return block;
+}
+
+block_t *get_block_from_hash_nolock(uint8_t *block_hash)
+{
+  block_t *block = read_block(NULL, block_hash);
+  metric_counter_add(&g_block_reads_metric, block != NULL ? 0 : 1, 1);
+  return block;
+}
+
+block_t *get_block_from_hash(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  mtx_lock(&g_blockchain_lock);
+  block_t *block = get_block_from_hash_nolock(block_hash);
+  mtx_unlock(&g_blockchain_lock);
+  return block;
+}
+
+/*
+ * Gets the block along with it's transactions through the block cache, the block is
+ * shared with the cache and any other callers holding it so it must not be modified.
+ * Later to be released with `release_block`.
+ */
+block_t *acquire_block_from_hash_nolock(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  block_t *block = acquire_block_from_block_cache(block_hash);
+  if (block != NULL)
+  {
+    return block;
+  }
+
+  block = get_block_from_hash_nolock(block_hash);
+  if (block == NULL)
+  {
+    return NULL;
+  }
+
+  return add_block_to_block_cache(block);
+}
+
+block_t *acquire_block_from_hash(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  mtx_lock(&g_blockchain_lock);
+  block_t *block = acquire_block_from_hash_nolock(block_hash);
+  mtx_unlock(&g_blockchain_lock);
+  return block;
+}
+
+void release_block_nolock(block_t *block)
+{
+  assert(block != NULL);
+  release_block_from_block_cache(block);
+}
+
+void release_block(block_t *block)
+{
+  assert(block != NULL);
+  mtx_lock(&g_blockchain_lock);
+  release_block_nolock(block);
+  mtx_unlock(&g_blockchain_lock);
+}
+
+void print_block_cache_stats(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  LOG_INFO("Block cache: %zu blocks, %zu/%zu bytes, %llu hits, %llu misses.", get_block_cache_num_entries(),
+    get_block_cache_memory_size(), get_block_cache_max_memory_size(),
+    (unsigned long long)get_block_cache_num_hits(), (unsigned long long)get_block_cache_num_misses());
+  LOG_INFO("Utxo cache: %zu entries (%zu dirty), %zu/%zu bytes.", get_utxo_cache_num_entries(),
+    get_utxo_cache_num_dirty_entries(), get_utxo_cache_memory_size(), get_utxo_cache_max_memory_size());
+  mtx_unlock(&g_blockchain_lock);
+}
+
+static stored_block_t *read_stored_block(blockchain_tip_t *tip, uint8_t *block_hash, int include_transactions)
+{
+  assert(block_hash != NULL);
+  char *err = NULL;
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
+  get_block_key(key, block_hash);
+
+  stored_block_t *stored_block = malloc(sizeof(stored_block_t));
+  assert(stored_block != NULL);
+  stored_block->txs_data = NULL;
+  stored_block->txs_size = 0;
+  stored_block->txs_value = NULL;
+
+  size_t read_len;
+  stored_block->block_value = get_blockchain_value(tip, key, sizeof(key), &read_len, &err);
+
+  if (err != NULL || stored_block->block_value == NULL)
+  {
+    goto stored_block_retrieval_fail;
+  }
+
+  if (init_block_view(&stored_block->view, stored_block->block_value, read_len))
+  {
+    LOG_ERROR("Failed to read stored block: %s", HASH2HEX_STR(block_hash));
+    goto stored_block_retrieval_fail;
+  }
+
+  if (include_transactions && stored_block->view.transaction_count > 0)
+  {
+    if (tip == NULL && is_block_pruned_nolock(block_hash))
+    {
+      goto stored_block_retrieval_fail;
+    }
+
+    uint8_t txs_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS];
+    get_block_transactions_key(txs_key, block_hash);
+
+    size_t txs_read_len;
+    stored_block->txs_value = get_blockchain_value(tip, txs_key, sizeof(txs_key), &txs_read_len, &err);
+    if (err != NULL)
+    {
+      goto stored_block_retrieval_fail;
+    }
+
+    if (stored_block->txs_value != NULL)
+    {
+      stored_block->txs_data = stored_block->txs_value;
+      stored_block->txs_size = txs_read_len;
+    }
+    else
+    {
+      stored_block->txs_data = stored_block->block_value + stored_block->view.size;
+      stored_block->txs_size = read_len - stored_block->view.size;
+    }
+
+    if (stored_block->txs_size == 0)
+    {
+      // blocks pruned since the tip was published are expected to be missing them
+      if (tip == NULL || tip->pruned_height == 0)
+      {
+        LOG_ERROR("Failed to read stored block: %s, block has no stored transactions!", HASH2HEX_STR(block_hash));
+      }
+
+      goto stored_block_retrieval_fail;
+    }
+  }
+
+  return stored_block;
+
+stored_block_retrieval_fail:
+  storage_free(err);
+  free_stored_block(stored_block);
+  return NULL;
+}
+
+/*
+ * Reads the block as it is stored without deserializing it, when include_transactions
+ * is set the block's serialized transactions are read along with it's header.
+ * Later to be free'd with `free_stored_block`.
+ */
+stored_block_t *get_stored_block_from_hash_nolock(uint8_t *block_hash, int include_transactions)
+{
+  return read_stored_block(NULL, block_hash, include_transactions);
+}
+
+stored_block_t *get_stored_block_from_hash(uint8_t *block_hash, int include_transactions)
+{
+  assert(block_hash != NULL);
+  mtx_lock(&g_blockchain_lock);
+  stored_block_t *stored_block = get_stored_block_from_hash_nolock(block_hash, include_transactions);
+  mtx_unlock(&g_blockchain_lock);
+  return stored_block;
+}
+
+void free_stored_block(stored_block_t *stored_block)
+{
+  assert(stored_block != NULL);
+  storage_free(stored_block->block_value);
+  storage_free(stored_block->txs_value);
+  free(stored_block);
+}
+
+block_t *get_block_from_height_nolock(uint32_t height)
+{
+  uint8_t *block_hash = get_block_hash_from_height_nolock(height);
+  if (block_hash == NULL)
+  {
+    return NULL;
+  }
+
+  block_t *block = get_block_from_hash_nolock(block_hash);
+  free(block_hash);
+  return block;
+}
+
+block_t *get_block_from_height(uint32_t height)
+{
+  mtx_lock(&g_blockchain_lock);
+  block_t *block = get_block_from_height_nolock(height);
+  mtx_unlock(&g_blockchain_lock);
+  return block;
+}
+
+block_t *get_block_header_from_height_nolock(uint32_t height)
+{
+  uint8_t *block_hash = get_block_hash_from_height_nolock(height);
+  if (block_hash == NULL)
+  {
+    return NULL;
+  }
+
+  block_t *block = get_block_header_from_hash_nolock(block_hash);
+  free(block_hash);
+  return block;
+}
+
+block_t *get_block_header_from_height(uint32_t height)
+{
+  mtx_lock(&g_blockchain_lock);
+  block_t *block = get_block_header_from_height_nolock(height);
+  mtx_unlock(&g_blockchain_lock);
+  return block;
+}
+
+int32_t get_block_height_from_hash_nolock(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  header_index_entry_t *entry = get_header_index_entry_from_hash(block_hash);
+  if (entry == NULL)
+  {
+    return -1;
+  }
+
+  return (int32_t)entry->height;
+}
+
+int32_t get_block_height_from_hash(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  mtx_lock(&g_blockchain_lock);
+  int32_t block_height = get_block_height_from_hash_nolock(block_hash);
+  mtx_unlock(&g_blockchain_lock);
+  return block_height;
+}
+
+int32_t get_block_height_from_block(block_t *block)
+{
+  assert(block != NULL);
+  return get_block_height_from_hash(block->hash);
+}
+
+static uint8_t *read_block_hash_from_height(blockchain_tip_t *tip, uint32_t height)
+{
+  char *err = NULL;
+  uint8_t key[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + sizeof(uint32_t)];
+  get_block_height_key(key, height);
+
+  size_t read_len;
+  uint8_t *indexed_block_hash = get_blockchain_value(tip, key, sizeof(key), &read_len, &err);
+
+  if (err != NULL || indexed_block_hash == NULL || read_len != HASH_SIZE)
+  {
+    storage_free(indexed_block_hash);
+    storage_free(err);
+    return NULL;
+  }
+
+  uint8_t *block_hash = malloc(HASH_SIZE);
+  assert(block_hash != NULL);
+  memcpy(block_hash, indexed_block_hash, HASH_SIZE);
+
+  storage_free(indexed_block_hash);
+  storage_free(err);
+  return block_hash;
+}
+
+uint8_t *get_block_hash_from_height_nolock(uint32_t height)
+{
+  return read_block_hash_from_height(NULL, height);
+}
+
+uint8_t *get_block_hash_from_height(uint32_t height)
+{
+  mtx_lock(&g_blockchain_lock);
+  uint8_t *block_hash = get_block_hash_from_height_nolock(height);
+  mtx_unlock(&g_blockchain_lock);
+  return block_hash;
+}
+
+/*
+ * Reads the filter stored for a block, returns NULL for blocks inserted
+ * while the block filters were disabled. The filter is freed by the caller.
+ */
+static uint8_t *read_block_filter(blockchain_tip_t *tip, uint8_t *block_hash, size_t *filter_size)
+{
+  assert(block_hash != NULL);
+  assert(filter_size != NULL);
+
+  char *err = NULL;
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_FILTER];
+  get_block_filter_key(key, block_hash);
+
+  size_t read_len = 0;
+  uint8_t *stored_filter = get_blockchain_value(tip, key, sizeof(key), &read_len, &err);
+  if (err != NULL || stored_filter == NULL || read_len == 0)
+  {
+    storage_free(stored_filter);
+    storage_free(err);
+    return NULL;
+  }
+
+  uint8_t *filter = malloc(read_len);
+  assert(filter != NULL);
+  memcpy(filter, stored_filter, read_len);
+  *filter_size = read_len;
+
+  storage_free(stored_filter);
+  return filter;
+}
+
+uint8_t *get_block_filter_nolock(uint8_t *block_hash, size_t *filter_size)
+{
+  return read_block_filter(NULL, block_hash, filter_size);
+}
+
+uint8_t *get_block_filter(uint8_t *block_hash, size_t *filter_size)
+{
+  mtx_lock(&g_blockchain_lock);
+  uint8_t *filter = get_block_filter_nolock(block_hash, filter_size);
+  mtx_unlock(&g_blockchain_lock);
+  return filter;
+}
+
+/*
+ * Stores a filter received from a peer for a block we have no filter of our own for. The
+ * filter is checked against the block while it's txs are still stored, the filters of pruned
+ * blocks can not be checked and are trusted. Returns 1 if the filter does not match the block.
+ */
+int store_block_filter_nolock(uint8_t *block_hash, const uint8_t *filter, size_t filter_size)
+{
+  assert(block_hash != NULL);
+  assert(filter != NULL);
+  if (get_block_height_from_hash_nolock(block_hash) < 0)
+  {
+    return 1;
+  }
+
+  size_t stored_filter_size = 0;
+  uint8_t *stored_filter = get_block_filter_nolock(block_hash, &stored_filter_size);
+  if (stored_filter != NULL)
+  {
+    int result = stored_filter_size != filter_size || memcmp(stored_filter, filter, filter_size) != 0;
+    free(stored_filter);
+    return result;
+  }
+
+  block_t *block = is_block_pruned_nolock(block_hash) ? NULL : get_block_from_hash_nolock(block_hash);
+  if (block != NULL && block->transaction_count > 0)
+  {
+    buffer_t *filter_buffer = buffer_init();
+    int result = (
+      serialize_block_filter(filter_buffer, block) ||
+      buffer_get_size(filter_buffer) != filter_size ||
+      memcmp(buffer_get_data(filter_buffer), filter, filter_size) != 0);
+
+    buffer_free(filter_buffer);
+    if (result)
+    {
+      free_block(block);
+      return 1;
+    }
+  }
+
+  if (block != NULL)
+  {
+    free_block(block);
+  }
+
+  char *err = NULL;
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_FILTER];
+  get_block_filter_key(key, block_hash);
+  storage_put(g_blockchain_db, key, sizeof(key), filter, filter_size, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not store filter for block: %s: %s", HASH2HEX_STR(block_hash), err);
+    storage_free(err);
+    return 1;
+  }
+
+  return 0;
+}
+
+int store_block_filter(uint8_t *block_hash, const uint8_t *filter, size_t filter_size)
+{
+  mtx_lock(&g_blockchain_lock);
+  int result = store_block_filter_nolock(block_hash, filter, filter_size);
+  mtx_unlock(&g_blockchain_lock);
+  return result;
+}
+
+/*
+ * The readers below read the blockchain as it was when the tip was published without taking
+ * the blockchain lock, heights above the tip are not part of it even if already stored...
+ */
+uint8_t *get_block_hash_from_height_at_tip(blockchain_tip_t *tip, uint32_t height)
+{
+  assert(tip != NULL);
+  if (height > tip->height)
+  {
+    return NULL;
+  }
+
+  return read_block_hash_from_height(tip, height);
+}
+
+uint8_t *get_block_filter_at_tip(blockchain_tip_t *tip, uint8_t *block_hash, size_t *filter_size)
+{
+  assert(tip != NULL);
+  return read_block_filter(tip, block_hash, filter_size);
+}
+
+block_t *get_block_header_from_hash_at_tip(blockchain_tip_t *tip, uint8_t *block_hash)
+{
+  assert(tip != NULL);
+  return read_block_header(tip, block_hash);
+}
+
+block_t *get_block_from_hash_at_tip(blockchain_tip_t *tip, uint8_t *block_hash)
+{
+  assert(tip != NULL);
+  return read_block(tip, block_hash);
+}
+
+block_t *get_block_header_from_height_at_tip(blockchain_tip_t *tip, uint32_t height)
+{
+  uint8_t *block_hash = get_block_hash_from_height_at_tip(tip, height);
+  if (block_hash == NULL)
+  {
+    return NULL;
+  }
+
+  block_t *block = read_block_header(tip, block_hash);
+  free(block_hash);
+  return block;
+}
+
+block_t *get_block_from_height_at_tip(blockchain_tip_t *tip, uint32_t height)
+{
+  uint8_t *block_hash = get_block_hash_from_height_at_tip(tip, height);
+  if (block_hash == NULL)
+  {
+    return NULL;
+  }
+
+  block_t *block = read_block(tip, block_hash);
+  free(block_hash);
+  return block;
+}
+
+stored_block_t *get_stored_block_from_hash_at_tip(blockchain_tip_t *tip, uint8_t *block_hash, int include_transactions)
+{
+  assert(tip != NULL);
+  return read_stored_block(tip, block_hash, include_transactions);
+}
+
+int insert_block_hash_into_height_index_nolock(uint32_t height, uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  char *err = NULL;
+  uint8_t key[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + sizeof(uint32_t)];
+  get_block_height_key(key, height);
+
+  storage_put(g_blockchain_db, key, sizeof(key), block_hash, HASH_SIZE, &err);
+
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not insert block: %s into block height index at height: %u: %s", HASH2HEX_STR(block_hash), height, err);
+
+    storage_free(err);
+    return 1;
+  }
+
+  storage_free(err);
+  return 0;
+}
+
+int delete_block_hash_from_height_index_nolock(uint32_t height)
+{
+  char *err = NULL;
+  uint8_t key[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + sizeof(uint32_t)];
+  get_block_height_key(key, height);
+
+  storage_delete(g_blockchain_db, key, sizeof(key), &err);
+
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not delete block at height: %u from block height index: %s", height, err);
+
+    storage_free(err);
+    return 1;
+  }
+
+  storage_free(err);
+  return 0;
+}
+
+/*
+ * Rebuilds the height index for blockchain databases that were created
+ * before the index existed, walking back from the top block to the genesis block.
+ */
+int backfill_block_height_index_nolock(void)
+{
+  uint8_t *top_block_hash = get_top_block_hash_noblock();
+  if (top_block_hash == NULL)
+  {
+    // nothing has been inserted into the blockchain yet
+    return 0;
+  }
+
+  uint32_t top_block_height = get_block_height_nolock();
+  uint8_t *indexed_block_hash = get_block_hash_from_height_nolock(top_block_height);
+  if (indexed_block_hash != NULL)
+  {
+    int already_indexed = compare_hash(indexed_block_hash, top_block_hash);
+    free(indexed_block_hash);
+    if (already_indexed)
+    {
+      free(top_block_hash);
+      return 0;
+    }
+  }
+
+  LOG_INFO("Rebuilding block height index up to height: %u...", top_block_height);
+  uint8_t block_hash[HASH_SIZE];
+  memcpy(block_hash, top_block_hash, HASH_SIZE);
+  free(top_block_hash);
+
+  char *err = NULL;
+  storage_batch_t *write_batch = storage_batch_create();
+
+  uint32_t block_height = top_block_height;
+  while (1)
+  {
+    block_t *block = get_block_header_from_hash_nolock(block_hash);
+    if (block == NULL)
+    {
+      LOG_ERROR("Could not rebuild block height index, unknown block at height: %u!", block_height);
+      goto backfill_fail;
+    }
+
+    uint8_t key[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + sizeof(uint32_t)];
+    get_block_height_key(key, block_height);
+
+    storage_batch_put(write_batch, key, sizeof(key), block_hash, HASH_SIZE);
+
+    memcpy(block_hash, block->previous_hash, HASH_SIZE);
+    free_block(block);
+
+    if (block_height == 0)
+    {
+      break;
+    }
+
+    block_height--;
+  }
+
+  storage_write(g_blockchain_db, write_batch, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Failed to rebuild block height index, error occurred: %s!", err);
+    goto backfill_fail;
+  }
+
+  LOG_INFO("Successfully rebuilt block height index.");
+  storage_free(err);
+  storage_batch_destroy(write_batch);
+  return 0;
+
+backfill_fail:
+  storage_free(err);
+  storage_batch_destroy(write_batch);
+  return 1;
+}
+
+/* Builds the address index from the unspent index for blockchain databases
+ * created before the address index existed, this only happens once...
+ */
+int backfill_address_index_nolock(void)
+{
+  char *err = NULL;
+  uint8_t has_index_key[DB_KEY_PREFIX_SIZE_HAS_ADDRESS_INDEX];
+  get_has_address_index_key(has_index_key);
+
+  size_t read_len;
+  uint8_t *has_index = storage_get(g_blockchain_db, has_index_key, sizeof(has_index_key), &read_len, &err);
+
+  if (err != NULL || has_index != NULL)
+  {
+    storage_free(has_index);
+    storage_free(err);
+    return err != NULL;
+  }
 
-  block_t *block = NULL;
-  int32_t block_height = -1;
+  LOG_INFO("Rebuilding address index from unspent index...");
+  uint32_t num_unspent_txs = 0;
+
+  storage_batch_t *write_batch = storage_batch_create();
+  storage_iterator_t *iterator = storage_iterator_create(g_blockchain_db);
 
-  for (uint32_t i = 0; i <= current_block_height; i++)
+  for (storage_iterator_seek(iterator, (uint8_t*)DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
   {
-    block = get_block_from_height_nolock(i);
-    if (block == NULL)
-    {
-      break;
-    }
+    size_t key_length;
+    size_t data_len;
+    char *key = (char*)storage_iterator_key(iterator, &key_length);
+    uint8_t *data = (uint8_t*)storage_iterator_value(iterator, &data_len);
 
-    if (compare_hash(block->hash, block_hash))
+    if (key_length != DB_KEY_PREFIX_SIZE_UNSPENT_TX + HASH_SIZE ||
+      memcmp(key, DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX) != 0)
     {
-      block_height = i;
-      free_block(block);
       break;
     }
 
-    free_block(block);
-  }
+    buffer_t *buffer = buffer_init_data(0, data, data_len);
+    buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
 
-  return block_height;
-}
+    unspent_transaction_t *unspent_tx = NULL;
+    int result = deserialize_unspent_transaction(buffer_iterator, &unspent_tx);
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
 
-int32_t get_block_height_from_hash(uint8_t *block_hash)
-{
-  assert(block_hash != NULL);
-  mtx_lock(&g_blockchain_lock);
-  int32_t block_height = get_block_height_from_hash_nolock(block_hash);
-  mtx_unlock(&g_blockchain_lock);
-  return block_height;
-}
+    if (result || write_batch_put_unspent_tx(write_batch, unspent_tx))
+    {
+      LOG_ERROR("Could not rebuild address index, failed to index unspent tx!");
+      if (unspent_tx != NULL)
+      {
+        free_unspent_transaction(unspent_tx);
+      }
 
-int32_t get_block_height_from_block(block_t *block)
-{
-  assert(block != NULL);
-  return get_block_height_from_hash(block->hash);
-}
+      goto backfill_fail;
+    }
 
-uint8_t *get_block_hash_from_height(uint32_t height)
-{
-  block_t *block = get_block_from_height(height);
-  if (block == NULL)
+    free_unspent_transaction(unspent_tx);
+    num_unspent_txs++;
+  }
+
+  uint8_t has_index_value = 1;
+  storage_batch_put(write_batch, has_index_key, sizeof(has_index_key), &has_index_value, 1);
+  storage_write(g_blockchain_db, write_batch, &err);
+  if (err != NULL)
   {
-    return NULL;
+    LOG_ERROR("Failed to rebuild address index, error occurred: %s!", err);
+    goto backfill_fail;
   }
 
-  uint8_t *block_hash = malloc(HASH_SIZE);
-  assert(block_hash != NULL);
-  memcpy(block_hash, block->hash, HASH_SIZE);
-  free_block(block);
-  return block_hash;
+  LOG_INFO("Successfully rebuilt address index for %u unspent transactions.", num_unspent_txs);
+  storage_free(err);
+  storage_iterator_destroy(iterator);
+  storage_batch_destroy(write_batch);
+  return 0;
+
+backfill_fail:
+  storage_free(err);
+  storage_iterator_destroy(iterator);
+  storage_batch_destroy(write_batch);
+  return 1;
 }
 
 int has_block_by_hash(uint8_t *block_hash)
 {
-  block_t *block = get_block_from_hash(block_hash);
+  // only the header is looked up, which is still stored for pruned blocks
+  block_t *block = get_block_header_from_hash(block_hash);
   if (block == NULL)
   {
     return 0;
@@ -1712,13 +5284,13 @@ int has_block_by_hash(uint8_t *block_hash)
 
 int has_block_by_height(uint32_t height)
 {
-  block_t *block = get_block_from_height(height);
-  if (block == NULL)
+  uint8_t *block_hash = get_block_hash_from_height(height);
+  if (block_hash == NULL)
   {
     return 0;
   }
 
-  free_block(block);
+  free(block_hash);
   return 1;
 }
 
@@ -1731,39 +5303,17 @@ int insert_tx_into_index_nolock(uint8_t *block_hash, transaction_t *tx)
   uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
   get_tx_key(key, tx->id);
 
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)block_hash, HASH_SIZE, &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)block_hash, HASH_SIZE, &err);
-#endif
+  storage_put(g_blockchain_db, key, sizeof(key), block_hash, HASH_SIZE, &err);
 
   if (err != NULL)
   {
-    char *block_hash_str = bin2hex(block_hash, HASH_SIZE);
-    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-    LOG_ERROR("Could not insert tx: %s into blockchain with block hash: %s: %s", tx_hash_str, block_hash_str, err);
-    free(block_hash_str);
-    free(tx_hash_str);
+    LOG_ERROR("Could not insert tx: %s into blockchain with block hash: %s: %s", HASH2HEX_STR(tx->id), HASH2HEX_STR(block_hash), err);
 
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
+    storage_free(err);
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
+  storage_free(err);
   return 0;
 }
 
@@ -1772,7 +5322,7 @@ int insert_tx_into_index(uint8_t *block_hash, transaction_t *tx)
   assert(block_hash != NULL);
   assert(tx != NULL);
   mtx_lock(&g_blockchain_lock);
-  int result = insert_tx_into_index(block_hash, tx);
+  int result = insert_tx_into_index_nolock(block_hash, tx);
   mtx_unlock(&g_blockchain_lock);
   return result;
 }
@@ -1780,59 +5330,10 @@ int insert_tx_into_index(uint8_t *block_hash, transaction_t *tx)
 int insert_tx_into_unspent_index_nolock(transaction_t *tx)
 {
   assert(tx != NULL);
-  char *err = NULL;
-  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
-  get_unspent_tx_key(key, tx->id);
-
-  buffer_t *buffer = buffer_init();
   unspent_transaction_t *unspent_tx = transaction_to_unspent_transaction(tx);
-  if (serialize_unspent_transaction(buffer, unspent_tx))
-  {
-    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-    LOG_ERROR("Could not insert tx: %s into blockchain: %s, failed to serialize tx!", tx_hash_str, err);
-    free(tx_hash_str);
-    buffer_free(buffer);
-    return 1;
-  }
-
+  int result = insert_unspent_tx_into_index_nolock(unspent_tx);
   free_unspent_transaction(unspent_tx);
-
-  const uint8_t *data = buffer_get_data(buffer);
-  uint32_t data_len = buffer_get_size(buffer);
-
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#endif
-  buffer_free(buffer);
-
-  if (err != NULL)
-  {
-    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-    LOG_ERROR("Could not insert tx: %s into blockchain: %s!", tx_hash_str, err);
-    free(tx_hash_str);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
-    return 1;
-  }
-
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
-  return 0;
+  return result;
 }
 
 int insert_tx_into_unspent_index(transaction_t *tx)
@@ -1848,55 +5349,34 @@ int insert_unspent_tx_into_index_nolock(unspent_transaction_t *unspent_tx)
 {
   assert(unspent_tx != NULL);
   char *err = NULL;
-  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
-  get_unspent_tx_key(key, unspent_tx->id);
 
-  buffer_t *buffer = buffer_init();
-  if (serialize_unspent_transaction(buffer, unspent_tx))
+  storage_batch_t *write_batch = storage_batch_create();
+
+  if (write_batch_put_unspent_tx(write_batch, unspent_tx))
   {
-    char *unspent_tx_hash_str = bin2hex(unspent_tx->id, HASH_SIZE);
-    LOG_ERROR("Could not insert unspent tx: %s into blockchain: %s, could not serialize unspent tx!", unspent_tx_hash_str, err);
-    free(unspent_tx_hash_str);
-    buffer_free(buffer);
-    return 1;
+    LOG_ERROR("Could not insert unspent tx: %s into blockchain, could not serialize unspent tx!", HASH2HEX_STR(unspent_tx->id));
+    goto insert_unspent_tx_fail;
   }
 
-  const uint8_t *data = buffer_get_data(buffer);
-  uint32_t data_len = buffer_get_size(buffer);
-
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#endif
-  buffer_free(buffer);
+  storage_write(g_blockchain_db, write_batch, &err);
 
   if (err != NULL)
   {
-    char *unspent_tx_hash_str = bin2hex(unspent_tx->id, HASH_SIZE);
-    LOG_ERROR("Could not insert unspent tx: %s into blockchain: %s!", unspent_tx_hash_str, err);
-    free(unspent_tx_hash_str);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
-    return 1;
+    LOG_ERROR("Could not insert unspent tx: %s into blockchain: %s!", HASH2HEX_STR(unspent_tx->id), err);
+    goto insert_unspent_tx_fail;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
+  // the unspent index now holds a newer version than the utxo cache
+  remove_tx_from_utxo_cache(unspent_tx->id);
+
+  storage_free(err);
+  storage_batch_destroy(write_batch);
   return 0;
+
+insert_unspent_tx_fail:
+  storage_free(err);
+  storage_batch_destroy(write_batch);
+  return 1;
 }
 
 int insert_unspent_tx_into_index(unspent_transaction_t *unspent_tx)
@@ -1908,7 +5388,28 @@ int insert_unspent_tx_into_index(unspent_transaction_t *unspent_tx)
   return result;
 }
 
-unspent_transaction_t *get_unspent_tx_from_index_nolock(uint8_t *tx_id)
+static unspent_transaction_t* deserialize_unspent_tx_from_storage(uint8_t *tx_id, uint8_t *serialized_unspent_tx, size_t read_len)
+{
+  assert(tx_id != NULL);
+  assert(serialized_unspent_tx != NULL);
+  assert(read_len > 0);
+  buffer_t *buffer = buffer_init_data(0, serialized_unspent_tx, read_len);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+  // deserialize the unspent tx
+  unspent_transaction_t *unspent_tx = NULL;
+  if (deserialize_unspent_transaction(buffer_iterator, &unspent_tx))
+  {
+    LOG_ERROR("Failed to deserialize unspent tx when trying to retrieve unspent tx from index with tx id: %s", HASH2HEX_STR(tx_id));
+    unspent_tx = NULL;
+  }
+
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  return unspent_tx;
+}
+
+unspent_transaction_t *get_unspent_tx_from_storage_nolock(uint8_t *tx_id)
 {
   assert(tx_id != NULL);
   char *err = NULL;
@@ -1916,111 +5417,347 @@ unspent_transaction_t *get_unspent_tx_from_index_nolock(uint8_t *tx_id)
   get_unspent_tx_key(key, tx_id);
 
   size_t read_len;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  uint8_t *serialized_unspent_tx = (uint8_t*)leveldb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  uint8_t *serialized_unspent_tx = (uint8_t*)rocksdb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#endif
+  uint8_t *serialized_unspent_tx = (uint8_t*)storage_get(g_blockchain_db, key, sizeof(key), &read_len, &err);
+
+  unspent_transaction_t *unspent_tx = NULL;
+  if (err == NULL && serialized_unspent_tx != NULL)
+  {
+    unspent_tx = deserialize_unspent_tx_from_storage(tx_id, serialized_unspent_tx, read_len);
+  }
+
+  storage_free(serialized_unspent_tx);
+  storage_free(err);
+  return unspent_tx;
+}
+
+unspent_transaction_t *get_unspent_tx_from_index_nolock(uint8_t *tx_id)
+{
+  assert(tx_id != NULL);
+  utxo_cache_entry_t *entry = get_utxo_cache_entry(tx_id);
+  if (entry == NULL)
+  {
+    unspent_transaction_t *unspent_tx = get_unspent_tx_from_storage_nolock(tx_id);
+    if (unspent_tx == NULL)
+    {
+      return NULL;
+    }
+
+    // keep a clean copy of the unspent tx around for the next lookup
+    unspent_transaction_t *cached_unspent_tx = make_unspent_transaction();
+    assert(copy_unspent_transaction(unspent_tx, cached_unspent_tx) == 0);
+    assert(add_unspent_tx_to_utxo_cache(cached_unspent_tx, 0) == 0);
+    trim_utxo_cache();
+    return unspent_tx;
+  }
+
+  if (entry->unspent_tx == NULL || is_unspent_tx_spent(entry->unspent_tx))
+  {
+    // every txout of this unspent tx has been spent
+    return NULL;
+  }
+
+  unspent_transaction_t *unspent_tx = make_unspent_transaction();
+  assert(copy_unspent_transaction(entry->unspent_tx, unspent_tx) == 0);
+  return unspent_tx;
+}
+
+unspent_transaction_t *get_unspent_tx_from_index(uint8_t *tx_id)
+{
+  assert(tx_id != NULL);
+  mtx_lock(&g_blockchain_lock);
+  unspent_transaction_t *unspent_tx = get_unspent_tx_from_index_nolock(tx_id);
+  mtx_unlock(&g_blockchain_lock);
+  return unspent_tx;
+}
+
+/*
+ * Reads the unspent txs of the tx ids which are not in the utxo cache yet with a single
+ * multi get and adds them to the cache as clean entries. The blockchain lock is only held
+ * while looking up and adding the cache entries, not while the unspent index is read, so
+ * the unspent txs read are dropped if the unspent index may have changed in the mean time...
+ */
+int prefetch_unspent_txs(uint8_t *tx_ids, uint32_t num_tx_ids)
+{
+  assert(tx_ids != NULL);
+  if (num_tx_ids == 0)
+  {
+    return 0;
+  }
+
+  const size_t key_size = HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX;
+  uint8_t *keys = malloc(key_size * num_tx_ids);
+  const uint8_t **key_ptrs = malloc(sizeof(uint8_t*) * num_tx_ids);
+  size_t *key_sizes = malloc(sizeof(size_t) * num_tx_ids);
+  uint8_t **values = malloc(sizeof(uint8_t*) * num_tx_ids);
+  size_t *value_sizes = malloc(sizeof(size_t) * num_tx_ids);
+  uint8_t **missing_tx_ids = malloc(sizeof(uint8_t*) * num_tx_ids);
+  unspent_transaction_t **unspent_txs = malloc(sizeof(unspent_transaction_t*) * num_tx_ids);
+  assert(keys != NULL && key_ptrs != NULL && key_sizes != NULL && values != NULL &&
+    value_sizes != NULL && missing_tx_ids != NULL && unspent_txs != NULL);
+
+  int result = 1;
+  mtx_lock(&g_blockchain_lock);
+  if (g_blockchain_is_open == 0)
+  {
+    mtx_unlock(&g_blockchain_lock);
+    goto prefetch_unspent_txs_fail;
+  }
+
+  storage_t *db = g_blockchain_db;
+  uint64_t utxo_cache_generation = get_utxo_cache_generation();
+  uint32_t num_missing = 0;
+  for (uint32_t i = 0; i < num_tx_ids; i++)
+  {
+    uint8_t *tx_id = tx_ids + (i * HASH_SIZE);
+    if (get_utxo_cache_entry(tx_id) != NULL)
+    {
+      continue;
+    }
+
+    uint8_t *key = keys + (num_missing * key_size);
+    get_unspent_tx_key(key, tx_id);
+    key_ptrs[num_missing] = key;
+    key_sizes[num_missing] = key_size;
+    missing_tx_ids[num_missing] = tx_id;
+    num_missing++;
+  }
+
+  mtx_unlock(&g_blockchain_lock);
+  if (num_missing == 0)
+  {
+    goto prefetch_unspent_txs_done;
+  }
+
+  char *err = NULL;
+  if (storage_multi_get(db, num_missing, key_ptrs, key_sizes, values, value_sizes, &err))
+  {
+    LOG_DEBUG("Failed to prefetch some unspent txs from the unspent index: %s!", err);
+  }
+
+  storage_free(err);
+  for (uint32_t i = 0; i < num_missing; i++)
+  {
+    unspent_txs[i] = NULL;
+    if (values[i] != NULL)
+    {
+      unspent_txs[i] = deserialize_unspent_tx_from_storage(missing_tx_ids[i], values[i], value_sizes[i]);
+      storage_free(values[i]);
+    }
+  }
+
+  mtx_lock(&g_blockchain_lock);
+  if (g_blockchain_is_open && get_utxo_cache_generation() == utxo_cache_generation)
+  {
+    for (uint32_t i = 0; i < num_missing; i++)
+    {
+      // a connecting block may have looked the unspent tx up itself by now
+      if (unspent_txs[i] == NULL || get_utxo_cache_entry(missing_tx_ids[i]) != NULL)
+      {
+        continue;
+      }
+
+      assert(add_unspent_tx_to_utxo_cache(unspent_txs[i], 0) == 0);
+      unspent_txs[i] = NULL;
+    }
+
+    trim_utxo_cache();
+  }
+
+  mtx_unlock(&g_blockchain_lock);
+  for (uint32_t i = 0; i < num_missing; i++)
+  {
+    if (unspent_txs[i] != NULL)
+    {
+      free_unspent_transaction(unspent_txs[i]);
+    }
+  }
+
+prefetch_unspent_txs_done:
+  result = 0;
+
+prefetch_unspent_txs_fail:
+  free(keys);
+  free(key_ptrs);
+  free(key_sizes);
+  free(values);
+  free(value_sizes);
+  free(missing_tx_ids);
+  free(unspent_txs);
+  return result;
+}
+
+static void prefetch_block_unspent_txs(void *arg)
+{
+  utxo_prefetch_job_t *job = (utxo_prefetch_job_t*)arg;
+  assert(job != NULL);
+
+  mtx_lock(&g_blockchain_lock);
+  int utxo_prefetch_running = g_blockchain_utxo_prefetch_running;
+  mtx_unlock(&g_blockchain_lock);
+
+  if (utxo_prefetch_running)
+  {
+    prefetch_unspent_txs(job->tx_ids, job->num_tx_ids);
+  }
+
+  free(job->tx_ids);
+  free(job);
+}
+
+/*
+ * Queues a job which reads the unspent txs spent by the block's txins into the utxo cache,
+ * so the block connects mostly from memory once it's turn comes. With no task schedulers
+ * the reads could not overlap with anything else, so no job is queued...
+ */
+int queue_block_utxo_prefetch(block_t *block)
+{
+  assert(block != NULL);
+  mtx_lock(&g_blockchain_lock);
+  int utxo_prefetch_running = g_blockchain_utxo_prefetch_running;
+  mtx_unlock(&g_blockchain_lock);
+  if (utxo_prefetch_running == 0)
+  {
+    return 1;
+  }
+
+  if (get_num_task_schedulers() == 0)
+  {
+    return 0;
+  }
+
+  uint32_t num_tx_ids = 0;
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
+    if (is_coinbase_tx(tx) == 0)
+    {
+      num_tx_ids += tx->txin_count;
+    }
+  }
+
+  if (num_tx_ids == 0)
+  {
+    return 0;
+  }
+
+  utxo_prefetch_job_t *job = malloc(sizeof(utxo_prefetch_job_t));
+  assert(job != NULL);
+  job->tx_ids = malloc(HASH_SIZE * num_tx_ids);
+  assert(job->tx_ids != NULL);
+  job->num_tx_ids = 0;
+
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    if (is_coinbase_tx(tx))
+    {
+      continue;
+    }
+
+    for (uint32_t j = 0; j < tx->txin_count; j++)
+    {
+      input_transaction_t *txin = tx->txins[j];
+      assert(txin != NULL);
+      memcpy(job->tx_ids + (job->num_tx_ids * HASH_SIZE), txin->transaction, HASH_SIZE);
+      job->num_tx_ids++;
+    }
+  }
+
+  assert(add_job(prefetch_block_unspent_txs, job, &g_blockchain_utxo_prefetch_job_group) == 0);
+  return 0;
+}
+
+int get_is_utxo_prefetch_running(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  int utxo_prefetch_running = g_blockchain_utxo_prefetch_running;
+  mtx_unlock(&g_blockchain_lock);
+  return utxo_prefetch_running;
+}
 
-  if (err != NULL || serialized_unspent_tx == NULL)
+int start_utxo_prefetch(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  if (g_blockchain_utxo_prefetch_running)
   {
-    goto deserialize_unspent_tx_fail;
+    mtx_unlock(&g_blockchain_lock);
+    return 1;
   }
 
-  assert(read_len > 0);
-  buffer_t *buffer = buffer_init_data(0, serialized_unspent_tx, read_len);
-  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  init_job_group(&g_blockchain_utxo_prefetch_job_group);
+  g_blockchain_utxo_prefetch_running = 1;
+  mtx_unlock(&g_blockchain_lock);
+  return 0;
+}
 
-  // deserialize the unspent tx
-  unspent_transaction_t *unspent_tx = NULL;
-  if (deserialize_unspent_transaction(buffer_iterator, &unspent_tx))
+int stop_utxo_prefetch(void)
+{
+  mtx_lock(&g_blockchain_lock);
+  if (g_blockchain_utxo_prefetch_running == 0)
   {
-    char *tx_id_str = bin2hex(tx_id, HASH_SIZE);
-    LOG_ERROR("Failed to deserialize unspent tx when trying to retrieve unspent tx from index with tx id: %s", tx_id_str);
-    free(tx_id_str);
-
-    buffer_iterator_free(buffer_iterator);
-    buffer_free(buffer);
-    goto deserialize_unspent_tx_fail;
+    mtx_unlock(&g_blockchain_lock);
+    return 1;
   }
 
-  buffer_iterator_free(buffer_iterator);
-  buffer_free(buffer);
-
-#ifdef USE_LEVELDB
-  leveldb_free(serialized_unspent_tx);
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-#else
-  rocksdb_free(serialized_unspent_tx);
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-#endif
-  return unspent_tx;
+  // the queued jobs see that the prefetch stopped and only free their tx ids
+  g_blockchain_utxo_prefetch_running = 0;
+  mtx_unlock(&g_blockchain_lock);
 
-deserialize_unspent_tx_fail:
-#ifdef USE_LEVELDB
-  leveldb_free(serialized_unspent_tx);
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-#else
-  rocksdb_free(serialized_unspent_tx);
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-#endif
-  return NULL;
+  wait_job_group(&g_blockchain_utxo_prefetch_job_group);
+  free_job_group(&g_blockchain_utxo_prefetch_job_group);
+  return 0;
 }
 
-unspent_transaction_t *get_unspent_tx_from_index(uint8_t *tx_id)
+uint8_t *get_block_hash_from_tx_id_nolock(uint8_t *tx_id)
 {
   assert(tx_id != NULL);
-  mtx_lock(&g_blockchain_lock);
-  unspent_transaction_t *unspent_tx = get_unspent_tx_from_index_nolock(tx_id);
-  mtx_unlock(&g_blockchain_lock);
-  return unspent_tx;
+  char *err = NULL;
+  uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
+  get_tx_key(key, tx_id);
+
+  size_t read_len;
+  uint8_t *value = (uint8_t*)storage_get(g_blockchain_db, key, sizeof(key), &read_len, &err);
+
+  if (err != NULL || value == NULL || read_len < HASH_SIZE)
+  {
+    storage_free(value);
+    storage_free(err);
+    return NULL;
+  }
+
+  uint8_t *block_hash = malloc(HASH_SIZE);
+  assert(block_hash != NULL);
+  memcpy(block_hash, value, HASH_SIZE);
+  storage_free(value);
+  return block_hash;
 }
 
-uint8_t *get_block_hash_from_tx_id_nolock(uint8_t *tx_id)
+/*
+ * Looks the tx up in the tx index as of the tip, the block hash is
+ * copied out of the tip's snapshot. Later to be free'd with `free`.
+ */
+uint8_t *get_block_hash_from_tx_id_at_tip(blockchain_tip_t *tip, uint8_t *tx_id)
 {
+  assert(tip != NULL);
   assert(tx_id != NULL);
   char *err = NULL;
   uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
   get_tx_key(key, tx_id);
 
   size_t read_len;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  uint8_t *block_hash = (uint8_t*)leveldb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  uint8_t *block_hash = (uint8_t*)rocksdb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#endif
-
-  if (err != NULL || block_hash == NULL)
+  uint8_t *value = get_blockchain_value(tip, key, sizeof(key), &read_len, &err);
+  if (err != NULL || value == NULL || read_len < HASH_SIZE)
   {
-  #ifdef USE_LEVELDB
-    leveldb_free(block_hash);
-    leveldb_free(err);
-    leveldb_readoptions_destroy(roptions);
-  #else
-    rocksdb_free(block_hash);
-    rocksdb_free(err);
-    rocksdb_readoptions_destroy(roptions);
-  #endif
+    storage_free(value);
+    storage_free(err);
     return NULL;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(block_hash);
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-#else
-  rocksdb_free(block_hash);
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-#endif
+  uint8_t *block_hash = malloc(HASH_SIZE);
+  assert(block_hash != NULL);
+  memcpy(block_hash, value, HASH_SIZE);
+  storage_free(value);
   return block_hash;
 }
 
@@ -2053,44 +5790,26 @@ block_t *get_block_from_tx_id(uint8_t *tx_id)
  *
  * For the sake of dev time, only blocks in the g_blockchain_db are valid + main chain.
  */
-uint32_t get_block_height_nolock(void)
+uint32_t get_block_height_from_block_count_nolock(void)
 {
   int32_t block_height = -1;
 
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  leveldb_iterator_t *iterator = leveldb_create_iterator(g_blockchain_db, roptions);
+  storage_iterator_t *iterator = storage_iterator_create(g_blockchain_db);
 
-  for (leveldb_iter_seek(iterator, DB_KEY_PREFIX_BLOCK, DB_KEY_PREFIX_SIZE_BLOCK);
-    leveldb_iter_valid(iterator); leveldb_iter_next(iterator))
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  rocksdb_iterator_t *iterator = rocksdb_create_iterator(g_blockchain_db, roptions);
-
-  for (rocksdb_iter_seek(iterator, DB_KEY_PREFIX_BLOCK, DB_KEY_PREFIX_SIZE_BLOCK);
-    rocksdb_iter_valid(iterator); rocksdb_iter_next(iterator))
-#endif
+  for (storage_iterator_seek(iterator, (uint8_t*)DB_KEY_PREFIX_BLOCK, DB_KEY_PREFIX_SIZE_BLOCK);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
   {
     size_t key_length;
-  #ifdef USE_LEVELDB
-    uint8_t *key = (uint8_t*)leveldb_iter_key(iterator, &key_length);
-  #else
-    uint8_t *key = (uint8_t*)rocksdb_iter_key(iterator, &key_length);
-  #endif
+    uint8_t *key = (uint8_t*)storage_iterator_key(iterator, &key_length);
     assert(key != NULL);
-    if (key_length > 0 && key[0] == (char)*DB_KEY_PREFIX_BLOCK)
+    if (key_length == HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK &&
+        memcmp(key, DB_KEY_PREFIX_BLOCK, DB_KEY_PREFIX_SIZE_BLOCK) == 0)
     {
       block_height++;
     }
   }
 
-#ifdef USE_LEVELDB
-  leveldb_readoptions_destroy(roptions);
-  leveldb_iter_destroy(iterator);
-#else
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_iter_destroy(iterator);
-#endif
+  storage_iterator_destroy(iterator);
 
   if (block_height < 0)
   {
@@ -2100,6 +5819,11 @@ uint32_t get_block_height_nolock(void)
   return block_height;
 }
 
+uint32_t get_block_height_nolock(void)
+{
+  return g_blockchain_current_block_height;
+}
+
 uint32_t get_block_height(void)
 {
   mtx_lock(&g_blockchain_lock);
@@ -2116,15 +5840,16 @@ int delete_block_from_blockchain_nolock(uint8_t *block_hash)
 
   if (compare_hash(block_hash, genesis_block->hash))
   {
-    char *genesis_block_hash_str = bin2hex(genesis_block->hash, HASH_SIZE);
-    LOG_ERROR("Cannot delete genesis block with hash: %s from blockchain!", genesis_block_hash_str);
-    free(genesis_block_hash_str);
+    LOG_ERROR("Cannot delete genesis block with hash: %s from blockchain!", HASH2HEX_STR(genesis_block->hash));
     return 1;
   }
 
   block_t *block = get_block_from_hash(block_hash);
   assert(block != NULL);
 
+  // the cached block is dropped first, callers still holding it keep their reference
+  remove_block_from_block_cache(block_hash);
+
   // delete the block's transactions including the unspent transactions
   for (uint32_t i = 0; i < block->transaction_count; i++)
   {
@@ -2133,62 +5858,55 @@ int delete_block_from_blockchain_nolock(uint8_t *block_hash)
 
     if (delete_tx_from_index_nolock(tx->id))
     {
-      char *block_hash_str = bin2hex(block_hash, HASH_SIZE);
-      char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-      LOG_ERROR("Could not delete block: %s from blockchain storage, could not remove unknown tx: %s from index!", block_hash_str, tx_hash_str);
-      free(block_hash_str);
-      free(tx_hash_str);
+      LOG_ERROR("Could not delete block: %s from blockchain storage, could not remove unknown tx: %s from index!", HASH2HEX_STR(block_hash), HASH2HEX_STR(tx->id));
       return 1;
     }
 
     if (delete_unspent_tx_from_index_nolock(tx->id))
     {
-      char *block_hash_str = bin2hex(block_hash, HASH_SIZE);
-      char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-      LOG_ERROR("Could not delete block: %s from blockchain storage, could not remove unknown tx: %s from unspent index!", block_hash_str, tx_hash_str);
-      free(block_hash_str);
-      free(tx_hash_str);
+      LOG_ERROR("Could not delete block: %s from blockchain storage, could not remove unknown tx: %s from unspent index!", HASH2HEX_STR(block_hash), HASH2HEX_STR(tx->id));
       return 1;
     }
   }
 
+  // only remove the height index entry if it still refers to this block
+  int32_t block_height = get_block_height_from_hash_nolock(block_hash);
+  if (block_height >= 0)
+  {
+    // the genesis block is never deleted, so the block is always above height 0
+    truncate_header_index((uint32_t)block_height - 1);
+    if (delete_block_hash_from_height_index_nolock((uint32_t)block_height))
+    {
+      free_block(block);
+      return 0;
+    }
+  }
+
   char *err = NULL;
   uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK];
   get_block_key(key, block_hash);
 
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_delete(g_blockchain_db, woptions, (char*)key, sizeof(key), &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_delete(g_blockchain_db, woptions, (char*)key, sizeof(key), &err);
-#endif
+  uint8_t txs_key[HASH_SIZE + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS];
+  get_block_transactions_key(txs_key, block_hash);
+
+  // the block header and it's transactions are removed together
+  storage_batch_t *write_batch = storage_batch_create();
+  storage_batch_delete(write_batch, key, sizeof(key));
+  storage_batch_delete(write_batch, txs_key, sizeof(txs_key));
+  storage_write(g_blockchain_db, write_batch, &err);
+  storage_batch_destroy(write_batch);
 
   if (err != NULL)
   {
-    char *block_hash_str = bin2hex(block_hash, HASH_SIZE);
-    LOG_ERROR("Could not delete block: %s from blockchain storage!", block_hash_str);
-    free(block_hash_str);
+    LOG_ERROR("Could not delete block: %s from blockchain storage!", HASH2HEX_STR(block_hash));
 
     free_block(block);
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
+    storage_free(err);
     return 0;
   }
 
   free_block(block);
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
+  storage_free(err);
   return 1;
 }
 
@@ -2208,37 +5926,17 @@ int delete_tx_from_index_nolock(uint8_t *tx_id)
   uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_TX];
   get_tx_key(key, tx_id);
 
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_delete(g_blockchain_db, woptions, (char*)key, sizeof(key), &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_delete(g_blockchain_db, woptions, (char*)key, sizeof(key), &err);
-#endif
+  storage_delete(g_blockchain_db, key, sizeof(key), &err);
 
   if (err != NULL)
   {
-    char *tx_hash_str = bin2hex(tx_id, HASH_SIZE);
-    LOG_ERROR("Could not delete tx: %s from index!", tx_hash_str);
-    free(tx_hash_str);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
+    LOG_ERROR("Could not delete tx: %s from index!", HASH2HEX_STR(tx_id));
+
+    storage_free(err);
     return 0;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
+  storage_free(err);
   return 1;
 }
 
@@ -2258,37 +5956,31 @@ int delete_unspent_tx_from_index_nolock(uint8_t *tx_id)
   uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
   get_unspent_tx_key(key, tx_id);
 
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_delete(g_blockchain_db, woptions, (char*)key, sizeof(key), &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_delete(g_blockchain_db, woptions, (char*)key, sizeof(key), &err);
-#endif
+  storage_batch_t *write_batch = storage_batch_create();
+  storage_batch_delete(write_batch, key, sizeof(key));
+
+  // remove the address index entries of the stored unspent tx as well
+  unspent_transaction_t *unspent_tx = get_unspent_tx_from_storage_nolock(tx_id);
+  if (unspent_tx != NULL)
+  {
+    write_batch_delete_unspent_tx(write_batch, unspent_tx);
+    free_unspent_transaction(unspent_tx);
+  }
+
+  storage_write(g_blockchain_db, write_batch, &err);
+  storage_batch_destroy(write_batch);
 
   if (err != NULL)
   {
-    char *unspent_tx_hash_str = bin2hex(tx_id, HASH_SIZE);
-    LOG_ERROR("Could not delete unspent tx: %s from unspent index!", unspent_tx_hash_str);
-    free(unspent_tx_hash_str);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
+    LOG_ERROR("Could not delete unspent tx: %s from unspent index!", HASH2HEX_STR(tx_id));
+
+    storage_free(err);
     return 0;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
+  remove_tx_from_utxo_cache(tx_id);
+
+  storage_free(err);
   return 1;
 }
 
@@ -2301,52 +5993,35 @@ int delete_unspent_tx_from_index(uint8_t *tx_id)
   return result;
 }
 
-int set_top_block_hash_noblock(uint8_t *block_hash)
+int set_top_block_hash_noblock(uint8_t *block_hash, uint32_t block_height)
 {
   assert(block_hash != NULL);
   char *err = NULL;
-  uint8_t key[DB_KEY_PREFIX_SIZE_TOP_BLOCK];
-  get_top_block_key(key);
 
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)block_hash, HASH_SIZE, &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_put(g_blockchain_db, woptions, (char*)key, sizeof(key), (char*)block_hash, HASH_SIZE, &err);
-#endif
+  storage_batch_t *write_batch = storage_batch_create();
+  write_batch_put_top_block(write_batch, block_hash, block_height);
+  storage_write(g_blockchain_db, write_batch, &err);
+  storage_batch_destroy(write_batch);
 
   if (err != NULL)
   {
-    char *block_hash_str = bin2hex(block_hash, HASH_SIZE);
-    LOG_ERROR("Failed to set top block hash: %s, failed to save entry: %s", block_hash_str, err);
-    free(block_hash_str);
+    LOG_ERROR("Failed to set top block hash: %s, failed to save entry: %s", HASH2HEX_STR(block_hash), err);
 
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_writeoptions_destroy(woptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_writeoptions_destroy(woptions);
-  #endif
+    storage_free(err);
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_writeoptions_destroy(woptions);
-#else
-  rocksdb_free(err);
-  rocksdb_writeoptions_destroy(woptions);
-#endif
+  g_blockchain_current_block_height = block_height;
+
+  storage_free(err);
   return 0;
 }
 
-int set_top_block_hash(uint8_t *block_hash)
+int set_top_block_hash(uint8_t *block_hash, uint32_t block_height)
 {
   assert(block_hash != NULL);
   mtx_lock(&g_blockchain_lock);
-  int result = set_top_block_hash_noblock(block_hash);
+  int result = set_top_block_hash_noblock(block_hash, block_height);
   mtx_unlock(&g_blockchain_lock);
   return result;
 }
@@ -2358,33 +6033,15 @@ uint8_t* get_top_block_hash_noblock(void)
   get_top_block_key(key);
 
   size_t read_len;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  uint8_t *block_hash = (uint8_t*)leveldb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  uint8_t *block_hash = (uint8_t*)rocksdb_get(g_blockchain_db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#endif
+  uint8_t *block_hash = (uint8_t*)storage_get(g_blockchain_db, key, sizeof(key), &read_len, &err);
 
   if (err != NULL || block_hash == NULL)
   {
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_readoptions_destroy(roptions);
-  #else
-    rocksdb_free(err);
-    rocksdb_readoptions_destroy(roptions);
-  #endif
+    storage_free(err);
     return NULL;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-#else
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-#endif
+  storage_free(err);
   return block_hash;
 }
 
@@ -2396,12 +6053,75 @@ uint8_t* get_top_block_hash(void)
   return block_hash;
 }
 
-int set_top_block(block_t *block)
+int get_height_from_key_nolock(uint8_t *key, size_t key_size, uint32_t *height)
+{
+  assert(key != NULL);
+  assert(height != NULL);
+  char *err = NULL;
+
+  size_t read_len;
+  uint8_t *height_data = (uint8_t*)storage_get(g_blockchain_db, key, key_size, &read_len, &err);
+
+  if (err != NULL || height_data == NULL || read_len != sizeof(uint32_t))
+  {
+    storage_free(err);
+    storage_free(height_data);
+    return 1;
+  }
+
+  *height = ((uint32_t)height_data[0] << 24) | ((uint32_t)height_data[1] << 16) |
+    ((uint32_t)height_data[2] << 8) | (uint32_t)height_data[3];
+
+  storage_free(err);
+  storage_free(height_data);
+  return 0;
+}
+
+int get_top_block_height_noblock(uint32_t *block_height)
+{
+  assert(block_height != NULL);
+  uint8_t key[DB_KEY_PREFIX_SIZE_TOP_BLOCK_HEIGHT];
+  get_top_block_height_key(key);
+  return get_height_from_key_nolock(key, sizeof(key), block_height);
+}
+
+int load_top_block_height_nolock(void)
+{
+  uint32_t block_height = 0;
+  if (get_top_block_height_noblock(&block_height) == 0)
+  {
+    g_blockchain_current_block_height = block_height;
+    return 0;
+  }
+
+  uint8_t *top_block_hash = get_top_block_hash_noblock();
+  if (top_block_hash == NULL)
+  {
+    // nothing has been inserted into the blockchain yet
+    g_blockchain_current_block_height = 0;
+    return 0;
+  }
+
+  // blockchain databases created before the top block height was stored
+  // need it counted once from the stored blocks and saved next to the top block...
+  block_height = get_block_height_from_block_count_nolock();
+  LOG_INFO("Storing blockchain top block height: %u...", block_height);
+
+  int result = set_top_block_hash_noblock(top_block_hash, block_height);
+  free(top_block_hash);
+  return result;
+}
+
+int set_top_block(block_t *block, uint32_t block_height)
 {
   assert(block != NULL);
-  return set_top_block_hash(block->hash);
+  return set_top_block_hash(block->hash, block_height);
 }
 
+/*
+ * Only the header of the top block is read, the body of the top block is not
+ * stored when the blockchain was bootstrapped from a UTXO snapshot...
+ */
 block_t *get_top_block(void)
 {
   uint8_t *block_hash = get_top_block_hash();
@@ -2410,7 +6130,7 @@ block_t *get_top_block(void)
     return NULL;
   }
 
-  block_t *block = get_block_from_hash(block_hash);
+  block_t *block = get_block_header_from_hash(block_hash);
   free(block_hash);
   return block;
 }
@@ -2427,28 +6147,27 @@ uint8_t *get_current_block_hash(void)
   return g_blockchain_current_block_hash;
 }
 
-int set_current_block(block_t *block)
+int set_current_block(block_t *block, uint32_t block_height)
 {
   assert(block != NULL);
-  set_top_block(block);
+  mtx_lock(&g_blockchain_lock);
+  set_top_block(block, block_height);
   set_current_block_hash(block->hash);
+  publish_blockchain_tip_nolock();
+  mtx_unlock(&g_blockchain_lock);
   return 0;
 }
 
 block_t *get_current_block(void)
 {
-  return get_block_from_hash(get_current_block_hash());
+  return get_block_header_from_hash(get_current_block_hash());
 }
 
 uint32_t get_blocks_since_hash(uint8_t *block_hash)
 {
   assert(block_hash != NULL);
-  block_t *block = get_block_from_hash(block_hash);
-  assert(block != NULL);
-
   int32_t block_height = get_block_height_from_hash(block_hash);
   assert(block_height >= 0);
-  free_block(block);
 
   uint32_t current_block_height = get_block_height();
   if (current_block_height > block_height)
@@ -2489,97 +6208,218 @@ void get_block_key(uint8_t *buffer, uint8_t *block_hash)
   memcpy(buffer + DB_KEY_PREFIX_SIZE_BLOCK, block_hash, HASH_SIZE);
 }
 
+void get_block_transactions_key(uint8_t *buffer, uint8_t *block_hash)
+{
+  assert(buffer != NULL);
+  assert(block_hash != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_BLOCK_TRANSACTIONS, DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS);
+  memcpy(buffer + DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS, block_hash, HASH_SIZE);
+}
+
+void get_block_undo_key(uint8_t *buffer, uint8_t *block_hash)
+{
+  assert(buffer != NULL);
+  assert(block_hash != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_BLOCK_UNDO, DB_KEY_PREFIX_SIZE_BLOCK_UNDO);
+  memcpy(buffer + DB_KEY_PREFIX_SIZE_BLOCK_UNDO, block_hash, HASH_SIZE);
+}
+
+void get_block_filter_key(uint8_t *buffer, uint8_t *block_hash)
+{
+  assert(buffer != NULL);
+  assert(block_hash != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_BLOCK_FILTER, DB_KEY_PREFIX_SIZE_BLOCK_FILTER);
+  memcpy(buffer + DB_KEY_PREFIX_SIZE_BLOCK_FILTER, block_hash, HASH_SIZE);
+}
+
+void get_pruned_height_key(uint8_t *buffer)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_PRUNED_HEIGHT, DB_KEY_PREFIX_SIZE_PRUNED_HEIGHT);
+}
+
+void get_tx_index_height_key(uint8_t *buffer)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_TX_INDEX_HEIGHT, DB_KEY_PREFIX_SIZE_TX_INDEX_HEIGHT);
+}
+
+void get_utxo_commitment_key(uint8_t *buffer)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_UTXO_COMMITMENT, DB_KEY_PREFIX_SIZE_UTXO_COMMITMENT);
+}
+
+void get_utxo_snapshot_height_key(uint8_t *buffer)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_UTXO_SNAPSHOT_HEIGHT, DB_KEY_PREFIX_SIZE_UTXO_SNAPSHOT_HEIGHT);
+}
+
 void get_top_block_key(uint8_t *buffer)
 {
   assert(buffer != NULL);
   memcpy(buffer, DB_KEY_PREFIX_TOP_BLOCK, DB_KEY_PREFIX_SIZE_TOP_BLOCK);
 }
 
+void get_top_block_height_key(uint8_t *buffer)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_TOP_BLOCK_HEIGHT, DB_KEY_PREFIX_SIZE_TOP_BLOCK_HEIGHT);
+}
+
+void get_top_unspent_tx_height_key(uint8_t *buffer)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_TOP_UNSPENT_TX_HEIGHT, DB_KEY_PREFIX_SIZE_TOP_UNSPENT_TX_HEIGHT);
+}
+
+void get_address_unspent_txout_key(uint8_t *buffer, uint8_t *address, uint8_t *tx_id, uint32_t txout_index)
+{
+  assert(buffer != NULL);
+  assert(address != NULL);
+  assert(tx_id != NULL);
+
+  // keyed by address first so every txout of an address can be found with a prefix seek
+  memcpy(buffer, DB_KEY_PREFIX_ADDRESS_UNSPENT_TXOUT, DB_KEY_PREFIX_SIZE_ADDRESS_UNSPENT_TXOUT);
+  buffer += DB_KEY_PREFIX_SIZE_ADDRESS_UNSPENT_TXOUT;
+  memcpy(buffer, address, ADDRESS_SIZE);
+  buffer += ADDRESS_SIZE;
+  memcpy(buffer, tx_id, HASH_SIZE);
+  buffer += HASH_SIZE;
+
+  buffer[0] = (uint8_t)(txout_index >> 24);
+  buffer[1] = (uint8_t)(txout_index >> 16);
+  buffer[2] = (uint8_t)(txout_index >> 8);
+  buffer[3] = (uint8_t)txout_index;
+}
+
+void get_has_address_index_key(uint8_t *buffer)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_HAS_ADDRESS_INDEX, DB_KEY_PREFIX_SIZE_HAS_ADDRESS_INDEX);
+}
+
+void get_block_height_key(uint8_t *buffer, uint32_t height)
+{
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_BLOCK_HEIGHT, DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT);
+
+  // store the height big endian so that the index iterates in height order
+  buffer[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + 0] = (uint8_t)(height >> 24);
+  buffer[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + 1] = (uint8_t)(height >> 16);
+  buffer[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + 2] = (uint8_t)(height >> 8);
+  buffer[DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT + 3] = (uint8_t)height;
+}
+
+/*
+ * Adds the amounts of the unspent tx's unspent txouts to the address onto balance when
+ * it is provided, returns the number of those txouts.
+ */
+static uint32_t get_unspent_tx_balance_for_address(unspent_transaction_t *unspent_tx, uint8_t *address, uint64_t *balance)
+{
+  assert(unspent_tx != NULL);
+  assert(address != NULL);
+  uint32_t num_txouts = 0;
+  for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
+  {
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+    assert(unspent_txout != NULL);
+    if (unspent_txout->spent || memcmp(unspent_txout->address, address, ADDRESS_SIZE) != 0)
+    {
+      continue;
+    }
+
+    if (balance != NULL)
+    {
+      *balance += unspent_txout->amount;
+    }
+
+    num_txouts++;
+  }
+
+  return num_txouts;
+}
+
 int get_unspent_transactions_for_address_nolock(uint8_t *address, vec_void_t *unspent_txs, uint32_t *num_unspent_txs)
 {
   assert(address != NULL);
   assert(unspent_txs != NULL);
 
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  leveldb_iterator_t *iterator = leveldb_create_iterator(g_blockchain_db, roptions);
+  // the address index is only updated once the utxo cache is flushed, the txs of
+  // the dirty cache entries are read from the cache instead of the address index...
+  uint8_t key_prefix[DB_KEY_SIZE_ADDRESS_UNSPENT_TXOUT];
+  uint8_t empty_tx_id[HASH_SIZE] = {};
+  get_address_unspent_txout_key(key_prefix, address, empty_tx_id, 0);
+  size_t key_prefix_size = DB_KEY_PREFIX_SIZE_ADDRESS_UNSPENT_TXOUT + ADDRESS_SIZE;
 
-  for (leveldb_iter_seek(iterator, DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX);
-    leveldb_iter_valid(iterator); leveldb_iter_next(iterator))
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  rocksdb_iterator_t *iterator = rocksdb_create_iterator(g_blockchain_db, roptions);
+  uint8_t last_tx_id[HASH_SIZE];
+  int has_last_tx_id = 0;
 
-  for (rocksdb_iter_seek(iterator, DB_KEY_PREFIX_UNSPENT_TX, DB_KEY_PREFIX_SIZE_UNSPENT_TX);
-    rocksdb_iter_valid(iterator); rocksdb_iter_next(iterator))
-#endif
+  storage_iterator_t *iterator = storage_iterator_create(g_blockchain_db);
+
+  for (storage_iterator_seek(iterator, key_prefix, key_prefix_size);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
   {
     size_t key_length;
-  #ifdef USE_LEVELDB
-    char *key = (char*)leveldb_iter_key(iterator, &key_length);
-    assert(key != NULL);
-  #else
-    char *key = (char*)rocksdb_iter_key(iterator, &key_length);
+    uint8_t *key = (uint8_t*)storage_iterator_key(iterator, &key_length);
     assert(key != NULL);
-  #endif
 
-    if (key_length > 0 && key[0] == (char)*DB_KEY_PREFIX_UNSPENT_TX)
+    if (key_length != DB_KEY_SIZE_ADDRESS_UNSPENT_TXOUT || memcmp(key, key_prefix, key_prefix_size) != 0)
+    {
+      break;
+    }
+
+    // entries are ordered by tx id, so txouts of the same tx are adjacent
+    uint8_t *tx_id = key + key_prefix_size;
+    if (has_last_tx_id && compare_hash(last_tx_id, tx_id))
     {
-      size_t data_len;
-    #ifdef USE_LEVELDB
-      uint8_t *data = (uint8_t*)leveldb_iter_value(iterator, &data_len);
-      assert(data != NULL);
-    #else
-      uint8_t *data = (uint8_t*)rocksdb_iter_value(iterator, &data_len);
-      assert(data != NULL);
-    #endif
+      continue;
+    }
 
-      unspent_transaction_t *unspent_tx = unspent_transaction_from_serialized(data, data_len);
-      assert(unspent_tx != NULL);
+    memcpy(last_tx_id, tx_id, HASH_SIZE);
+    has_last_tx_id = 1;
 
-      int has_unspent_txout = 0;
-      for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
-      {
-        unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
-        assert(unspent_txout != NULL);
+    utxo_cache_entry_t *entry = get_utxo_cache_entry(tx_id);
+    if (entry != NULL && entry->dirty)
+    {
+      continue;
+    }
 
-        if (compare_address(unspent_txout->address, address) == 0)
-        {
-          continue;
-        }
+    unspent_transaction_t *unspent_tx = get_unspent_tx_from_index_nolock(tx_id);
+    if (unspent_tx == NULL)
+    {
+      LOG_WARNING("Address index references unknown unspent tx: %s!", HASH2HEX_STR(tx_id));
+      continue;
+    }
 
-        if (unspent_txout->spent == 1)
-        {
-          continue;
-        }
+    assert(vec_push(unspent_txs, unspent_tx) == 0);
+    *num_unspent_txs += 1;
+  }
 
-        has_unspent_txout = 1;
-        break;
-      }
+  storage_iterator_destroy(iterator);
 
-      if (has_unspent_txout)
-      {
-        assert(vec_push(unspent_txs, unspent_tx) == 0);
-        *num_unspent_txs += 1;
-      }
-      else
-      {
-        // free the unspent transaction since this transaction was not
-        // relevant to the address we are looking for and/or this transaction
-        // does not have any unspent transaction outputs...
-        free_unspent_transaction(unspent_tx);
-      }
+  vec_void_t dirty_entries;
+  vec_init(&dirty_entries);
+  get_utxo_cache_dirty_entries(&dirty_entries);
+
+  void *val = NULL;
+  int i = 0;
+  vec_foreach(&dirty_entries, val, i)
+  {
+    utxo_cache_entry_t *entry = (utxo_cache_entry_t*)val;
+    if (entry->unspent_tx == NULL || get_unspent_tx_balance_for_address(entry->unspent_tx, address, NULL) == 0)
+    {
+      continue;
     }
-  }
 
-#ifdef USE_LEVELDB
-  leveldb_readoptions_destroy(roptions);
-  leveldb_iter_destroy(iterator);
-#else
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_iter_destroy(iterator);
-#endif
+    unspent_transaction_t *unspent_tx = make_unspent_transaction();
+    assert(copy_unspent_transaction(entry->unspent_tx, unspent_tx) == 0);
+    assert(vec_push(unspent_txs, unspent_tx) == 0);
+    *num_unspent_txs += 1;
+  }
 
+  vec_deinit(&dirty_entries);
   return 0;
 }
 
@@ -2591,49 +6431,98 @@ int get_unspent_transactions_for_address(uint8_t *address, vec_void_t *unspent_t
   return result;
 }
 
-uint64_t get_balance_for_address_nolock(uint8_t *address)
+/*
+ * Sums the amounts of the address index entries of the address, the entries of the txs
+ * which have dirty utxo cache entries are skipped when skip_dirty_txs is set.
+ */
+static uint64_t get_address_index_balance(blockchain_tip_t *tip, uint8_t *address, int skip_dirty_txs)
 {
   assert(address != NULL);
   uint64_t balance = 0;
 
-  vec_void_t unspent_txs;
-  vec_init(&unspent_txs);
+  uint8_t key_prefix[DB_KEY_SIZE_ADDRESS_UNSPENT_TXOUT];
+  uint8_t empty_tx_id[HASH_SIZE] = {};
+  get_address_unspent_txout_key(key_prefix, address, empty_tx_id, 0);
+  size_t key_prefix_size = DB_KEY_PREFIX_SIZE_ADDRESS_UNSPENT_TXOUT + ADDRESS_SIZE;
 
-  uint32_t num_unspent_txs = 0;
-  assert(get_unspent_transactions_for_address_nolock(address, &unspent_txs, &num_unspent_txs) == 0);
+  storage_iterator_t *iterator = create_blockchain_iterator(tip);
 
-  void *value = NULL;
-  int index = 0;
-  vec_foreach(&unspent_txs, value, index)
+  for (storage_iterator_seek(iterator, key_prefix, key_prefix_size);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
   {
-    unspent_transaction_t *unspent_tx = (unspent_transaction_t*)value;
-    assert(unspent_tx != NULL);
+    size_t key_length;
+    size_t data_len;
+    uint8_t *key = (uint8_t*)storage_iterator_key(iterator, &key_length);
+    uint8_t *data = (uint8_t*)storage_iterator_value(iterator, &data_len);
+    assert(key != NULL);
 
-    for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
+    if (key_length != DB_KEY_SIZE_ADDRESS_UNSPENT_TXOUT || memcmp(key, key_prefix, key_prefix_size) != 0)
     {
-      unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
-      assert(unspent_txout != NULL);
-
-      if (compare_address(unspent_txout->address, address) == 0)
-      {
-        continue;
-      }
+      break;
+    }
 
-      if (unspent_txout->spent == 1)
+    if (skip_dirty_txs)
+    {
+      utxo_cache_entry_t *entry = get_utxo_cache_entry(key + key_prefix_size);
+      if (entry != NULL && entry->dirty)
       {
         continue;
       }
+    }
 
-      balance += unspent_txout->amount;
+    // each address index entry holds the amount of an unspent txout
+    assert(data != NULL && data_len == sizeof(uint64_t));
+    uint64_t amount = 0;
+    for (int i = 0; i < sizeof(uint64_t); i++)
+    {
+      amount = (amount << 8) | data[i];
     }
 
-    free_unspent_transaction(unspent_tx);
+    balance += amount;
+  }
+
+  storage_iterator_destroy(iterator);
+  return balance;
+}
+
+uint64_t get_balance_for_address_nolock(uint8_t *address)
+{
+  assert(address != NULL);
+
+  // the address index is only updated once the utxo cache is flushed, the txouts of
+  // the dirty cache entries are counted from the cache instead of the address index...
+  uint64_t balance = get_address_index_balance(NULL, address, 1);
+
+  vec_void_t dirty_entries;
+  vec_init(&dirty_entries);
+  get_utxo_cache_dirty_entries(&dirty_entries);
+
+  void *val = NULL;
+  int i = 0;
+  vec_foreach(&dirty_entries, val, i)
+  {
+    utxo_cache_entry_t *entry = (utxo_cache_entry_t*)val;
+    if (entry->unspent_tx != NULL)
+    {
+      get_unspent_tx_balance_for_address(entry->unspent_tx, address, &balance);
+    }
   }
 
-  vec_deinit(&unspent_txs);
+  vec_deinit(&dirty_entries);
   return balance;
 }
 
+/*
+ * Reads the balance of the address from the tip's snapshot without taking the blockchain
+ * lock, the balance is as of the tip's unspent height which trails the tip's height by
+ * the changes the utxo cache had not flushed yet when the tip was published.
+ */
+uint64_t get_balance_for_address_at_tip(blockchain_tip_t *tip, uint8_t *address)
+{
+  assert(tip != NULL);
+  return get_address_index_balance(tip, address, 0);
+}
+
 uint64_t get_balance_for_address(uint8_t *address)
 {
   mtx_lock(&g_blockchain_lock);
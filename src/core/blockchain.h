@@ -27,35 +27,178 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
-#ifdef USE_LEVELDB
-#include <leveldb/c.h>
-#else
-#include <rocksdb/c.h>
-#endif
+#include <hashtable.h>
 
 #include "common/util.h"
 #include "common/vec.h"
 #include "common/vulkan.h"
 
 #include "block.h"
+#include "block_view.h"
+#include "storage.h"
 #include "transaction.h"
 
+#include "crypto/muhash.h"
+
+#include "wallet/wallet.h"
+
 VULKAN_BEGIN_DECL
 
+// the blocks within this depth of our top block are never pruned, so a reorg
+// can always disconnect back to a fork point within this many blocks...
+#define PRUNE_MIN_BLOCK_DEPTH 288
+#define PRUNE_MAX_BLOCKS_PER_WRITE_BATCH 1000
+
+// the blocks a reorg disconnects are held in memory until it is committed or aborted,
+// a fork point deeper than the blocks which are never pruned is not reorged to...
+#define MAX_REORG_BLOCK_DEPTH PRUNE_MIN_BLOCK_DEPTH
+
+#define UTXO_SNAPSHOT_MAX_HEADERS_PER_WRITE_BATCH 1000
+
+// the tx index of blocks inserted while it was disabled is built in the
+// background, this many blocks at a time so the blockchain lock is not held for long...
+#define TX_INDEX_BACKFILL_BLOCKS_PER_TASK 100
+#define TX_INDEX_BACKFILL_TASK_DELAY 0.1
+
+// with the batch durability the block commits are synced to disk together once
+// this many blocks were committed or this many milliseconds have passed...
+#define DEFAULT_BLOCKCHAIN_DURABILITY_BATCH_BLOCKS 100
+#define DEFAULT_BLOCKCHAIN_DURABILITY_BATCH_INTERVAL_MS 1000
+
+// the chain state manifest is written next to the blockchain database on a clean
+// shutdown, so the next startup can restore the header index and the tip without
+// scanning the database. It is removed again once read...
+#define CHAIN_STATE_MANIFEST_SUFFIX "_chainstate"
+#define CHAIN_STATE_MANIFEST_MAGIC 0x564b4353
+#define CHAIN_STATE_MANIFEST_VERSION 1
+#define CHAIN_STATE_MANIFEST_BYTE_ORDER_MARK 0x01020304
+#define CHAIN_STATE_MANIFEST_HEADER_SIZE ((sizeof(uint32_t) * 4) + HASH_SIZE + sizeof(uint32_t) + sizeof(uint64_t) + \
+  UINT256_SIZE + (sizeof(uint32_t) * 3) + sizeof(uint64_t) + 1 + MUHASH_SIZE + sizeof(uint32_t))
+
 #define DB_KEY_PREFIX_TX "tx"
 #define DB_KEY_PREFIX_UNSPENT_TX "utx"
 #define DB_KEY_PREFIX_BLOCK "bk"
+#define DB_KEY_PREFIX_BLOCK_TRANSACTIONS "bt"
 #define DB_KEY_PREFIX_TOP_BLOCK "tbk"
+#define DB_KEY_PREFIX_BLOCK_HEIGHT "hbk"
+#define DB_KEY_PREFIX_TOP_BLOCK_HEIGHT "tbh"
+#define DB_KEY_PREFIX_TOP_UNSPENT_TX_HEIGHT "tuh"
+#define DB_KEY_PREFIX_ADDRESS_UNSPENT_TXOUT "adr"
+#define DB_KEY_PREFIX_HAS_ADDRESS_INDEX "tai"
+#define DB_KEY_PREFIX_BLOCK_UNDO "bu"
+#define DB_KEY_PREFIX_PRUNED_HEIGHT "tph"
+#define DB_KEY_PREFIX_UTXO_SNAPSHOT_HEIGHT "tsh"
+#define DB_KEY_PREFIX_BLOCK_FILTER "bf"
+#define DB_KEY_PREFIX_TX_INDEX_HEIGHT "tih"
+#define DB_KEY_PREFIX_UTXO_COMMITMENT "tuc"
 
 #define DB_KEY_PREFIX_SIZE_TX 2
 #define DB_KEY_PREFIX_SIZE_UNSPENT_TX 3
 #define DB_KEY_PREFIX_SIZE_BLOCK 2
+#define DB_KEY_PREFIX_SIZE_BLOCK_TRANSACTIONS 2
 #define DB_KEY_PREFIX_SIZE_TOP_BLOCK 3
-
-VULKAN_API int valid_compression_type(int compression_type);
-VULKAN_API const char* get_compression_type_str(int compression_type);
-VULKAN_API int get_compression_type_from_str(const char *compression_type_str);
+#define DB_KEY_PREFIX_SIZE_BLOCK_HEIGHT 3
+#define DB_KEY_PREFIX_SIZE_TOP_BLOCK_HEIGHT 3
+#define DB_KEY_PREFIX_SIZE_TOP_UNSPENT_TX_HEIGHT 3
+#define DB_KEY_PREFIX_SIZE_ADDRESS_UNSPENT_TXOUT 3
+#define DB_KEY_PREFIX_SIZE_HAS_ADDRESS_INDEX 3
+#define DB_KEY_PREFIX_SIZE_BLOCK_UNDO 2
+#define DB_KEY_PREFIX_SIZE_PRUNED_HEIGHT 3
+#define DB_KEY_PREFIX_SIZE_UTXO_SNAPSHOT_HEIGHT 3
+#define DB_KEY_PREFIX_SIZE_BLOCK_FILTER 2
+#define DB_KEY_PREFIX_SIZE_TX_INDEX_HEIGHT 3
+#define DB_KEY_PREFIX_SIZE_UTXO_COMMITMENT 3
+
+#define DB_KEY_SIZE_ADDRESS_UNSPENT_TXOUT (DB_KEY_PREFIX_SIZE_ADDRESS_UNSPENT_TXOUT + ADDRESS_SIZE + HASH_SIZE + sizeof(uint32_t))
+
+// every unspent txout is hashed into the utxo commitment as it's tx id, txout index,
+// whether it's tx is a coinbase tx, it's amount and it's address
+#define UTXO_COMMITMENT_ELEMENT_SIZE (HASH_SIZE + sizeof(uint32_t) + 1 + sizeof(uint64_t) + ADDRESS_SIZE)
+
+// the tx ids spent by the txins of a downloaded block, their unspent txs
+// are read into the utxo cache before the block is connected...
+typedef struct UtxoPrefetchJob
+{
+  uint8_t *tx_ids;
+  uint32_t num_tx_ids;
+} utxo_prefetch_job_t;
+
+typedef struct BlockCommitUnspentTransaction
+{
+  uint8_t id[HASH_SIZE];
+  unspent_transaction_t *unspent_tx; // NULL once the unspent tx is staged for deletion
+} block_commit_unspent_tx_t;
+
+// everything a block touches is staged here and written with a single write batch,
+// unspent txs are kept in memory so later txs in the block see earlier changes
+typedef struct BlockCommit
+{
+  storage_batch_t *write_batch;
+  HashTable *unspent_txs;
+
+  // the unspent txs the block spends from as they were before the block,
+  // written as the block's undo record so the block can be disconnected
+  buffer_t *undo_buffer;
+  uint32_t undo_unspent_tx_count;
+
+  // whether the block's txs are written to the tx index
+  int index_txs;
+
+  // the unspent txouts the block created and spent, combined
+  // into the utxo commitment once the block commit is written
+  muhash_t utxo_commitment;
+} block_commit_t;
+
+/*
+ * How durable the block commits are, every block commit is written with a single write
+ * batch that includes the new top block, so after a crash the blockchain always restarts
+ * from the last top block that made it to disk. The sync durability syncs every block
+ * commit, batch syncs several commits at once and none skips the database log entirely
+ * until the blockchain is flushed, which is meant for imports and the initial sync.
+ */
+typedef enum BlockchainDurability
+{
+  BLOCKCHAIN_DURABILITY_SYNC = 0,
+  BLOCKCHAIN_DURABILITY_BATCH,
+  BLOCKCHAIN_DURABILITY_NONE
+} blockchain_durability_t;
+
+/*
+ * An immutable view of our top block published after every change to it, readers acquire
+ * the current tip without taking the blockchain lock and read the blockchain database
+ * through the tip's storage snapshot, so their reads stay consistent with the tip while
+ * blocks keep being inserted or rolled back. Later to be released with `release_blockchain_tip`.
+ */
+typedef struct BlockchainTip
+{
+  uint8_t hash[HASH_SIZE];
+  uint32_t height;
+  uint32_t pruned_height;
+  uint32_t next_work_required; // the bits expected of the block built on top of this tip
+  uint32_t unspent_height; // the height the unspent and address indexes of the snapshot are flushed up to
+
+  storage_t *storage;
+  storage_snapshot_t *snapshot; // NULL reads the database as it currently is
+  atomic_uint refcount;
+} blockchain_tip_t;
+
+/*
+ * A block as it is stored, the views point into the values read from storage so
+ * that the stored bytes can be forwarded without deserializing the block. The txs data
+ * is either the block's transactions value or the transactions following the header
+ * for blocks stored before their transactions were split out.
+ */
+typedef struct StoredBlock
+{
+  block_view_t view;
+  const uint8_t *txs_data;
+  size_t txs_size;
+
+  uint8_t *block_value;
+  uint8_t *txs_value;
+} stored_block_t;
 
 VULKAN_API void set_want_blockchain_compression(int want_blockchain_compression);
 VULKAN_API int get_want_blockchain_compression(void);
@@ -63,8 +206,36 @@ VULKAN_API int get_want_blockchain_compression(void);
 VULKAN_API void set_blockchain_compression_type(int compression_type);
 VULKAN_API int get_blockchain_compression_type(void);
 
+VULKAN_API void set_blockchain_db_cache_size(size_t cache_size);
+VULKAN_API size_t get_blockchain_db_cache_size(void);
+
+VULKAN_API void set_blockchain_db_bloom_bits_per_key(uint32_t bloom_bits_per_key);
+VULKAN_API uint32_t get_blockchain_db_bloom_bits_per_key(void);
+
+VULKAN_API void set_blockchain_db_prefix_length(size_t prefix_length);
+VULKAN_API size_t get_blockchain_db_prefix_length(void);
+
+VULKAN_API void set_blockchain_db_num_background_jobs(uint32_t num_background_jobs);
+VULKAN_API uint32_t get_blockchain_db_num_background_jobs(void);
+
+VULKAN_API void set_blockchain_db_write_buffer_size(size_t write_buffer_size);
+VULKAN_API size_t get_blockchain_db_write_buffer_size(void);
+
+VULKAN_API void set_blockchain_block_filters_enabled(int block_filters_enabled);
+VULKAN_API int get_blockchain_block_filters_enabled(void);
+
+VULKAN_API void set_blockchain_tx_index_enabled(int tx_index_enabled);
+VULKAN_API int get_blockchain_tx_index_enabled(void);
+VULKAN_API uint32_t get_blockchain_tx_index_height(void);
+VULKAN_API int load_blockchain_tx_index_height_nolock(void);
+VULKAN_API int backfill_tx_index_nolock(uint32_t max_blocks);
+VULKAN_API int backfill_tx_index(uint32_t max_blocks);
+VULKAN_API int start_tx_index_backfill(void);
+VULKAN_API int stop_tx_index_backfill(void);
+
 VULKAN_API const char* get_blockchain_dir(void);
 VULKAN_API const char* get_blockchain_backup_dir(const char *blockchain_dir);
+VULKAN_API const char* get_chain_state_manifest_filename(const char *blockchain_dir);
 
 VULKAN_API int repair_blockchain(const char *blockchain_dir);
 VULKAN_API int load_blockchain_top_block(void);
@@ -77,17 +248,9 @@ VULKAN_API int close_backup_blockchain(void);
 VULKAN_API int init_blockchain(const char *blockchain_dir, int load_top_block);
 VULKAN_API int remove_blockchain(const char *blockchain_dir);
 
-#ifdef USE_LEVELDB
-VULKAN_API int purge_all_entries_from_database(leveldb_t *db);
-#else
-VULKAN_API int purge_all_entries_from_database(rocksdb_t *db);
-#endif
+VULKAN_API int purge_all_entries_from_database(storage_t *db);
 
-#ifdef USE_LEVELDB
-VULKAN_API int copy_all_entries_to_database(leveldb_t *from_db, leveldb_t *to_db);
-#else
-VULKAN_API int copy_all_entries_to_database(rocksdb_t *from_db, rocksdb_t *to_db);
-#endif
+VULKAN_API int copy_all_entries_to_database(storage_t *from_db, storage_t *to_db);
 
 VULKAN_API int reset_blockchain_nolock(void);
 VULKAN_API int reset_blockchain(void);
@@ -98,44 +261,173 @@ VULKAN_API int backup_blockchain(void);
 VULKAN_API int restore_blockchain_nolock(void);
 VULKAN_API int restore_blockchain(void);
 
+VULKAN_API int get_blockchain_durability_from_str(const char *durability_str);
+VULKAN_API const char* get_blockchain_durability_str(int durability);
+VULKAN_API int set_blockchain_durability_nolock(int durability);
+VULKAN_API int set_blockchain_durability(int durability);
+VULKAN_API int get_blockchain_durability(void);
+VULKAN_API void apply_blockchain_durability_nolock(void);
+VULKAN_API void set_blockchain_durability_batch_blocks(uint32_t batch_blocks);
+VULKAN_API uint32_t get_blockchain_durability_batch_blocks(void);
+VULKAN_API void set_blockchain_durability_batch_interval(uint32_t batch_interval_ms);
+VULKAN_API uint32_t get_blockchain_durability_batch_interval(void);
+VULKAN_API int sync_blockchain_nolock(void);
+VULKAN_API int flush_blockchain_nolock(void);
+VULKAN_API int flush_blockchain(void);
+
+VULKAN_API int set_blockchain_wallet(wallet_t *wallet);
+VULKAN_API wallet_t* get_blockchain_wallet(void);
+
+VULKAN_API void publish_blockchain_tip_nolock(void);
+VULKAN_API blockchain_tip_t* acquire_blockchain_tip(void);
+VULKAN_API void release_blockchain_tip(blockchain_tip_t *tip);
+
+VULKAN_API uint8_t *get_block_hash_from_height_at_tip(blockchain_tip_t *tip, uint32_t height);
+VULKAN_API uint8_t *get_block_filter_at_tip(blockchain_tip_t *tip, uint8_t *block_hash, size_t *filter_size);
+VULKAN_API block_t *get_block_header_from_hash_at_tip(blockchain_tip_t *tip, uint8_t *block_hash);
+VULKAN_API block_t *get_block_from_hash_at_tip(blockchain_tip_t *tip, uint8_t *block_hash);
+VULKAN_API block_t *get_block_header_from_height_at_tip(blockchain_tip_t *tip, uint32_t height);
+VULKAN_API block_t *get_block_from_height_at_tip(blockchain_tip_t *tip, uint32_t height);
+VULKAN_API stored_block_t *get_stored_block_from_hash_at_tip(blockchain_tip_t *tip, uint8_t *block_hash, int include_transactions);
+VULKAN_API uint8_t *get_block_hash_from_tx_id_at_tip(blockchain_tip_t *tip, uint8_t *tx_id);
+VULKAN_API uint64_t get_balance_for_address_at_tip(blockchain_tip_t *tip, uint8_t *address);
+
+VULKAN_API int disconnect_top_block_nolock(block_t **block_out);
+VULKAN_API int disconnect_top_block(block_t **block_out);
+
 VULKAN_API int rollback_blockchain_nolock(uint32_t rollback_height);
 VULKAN_API int rollback_blockchain(uint32_t rollback_height);
 
+VULKAN_API int begin_blockchain_reorg_nolock(uint32_t fork_height);
+VULKAN_API int begin_blockchain_reorg(uint32_t fork_height);
+VULKAN_API int commit_blockchain_reorg_nolock(void);
+VULKAN_API int commit_blockchain_reorg(void);
+VULKAN_API int abort_blockchain_reorg_nolock(void);
+VULKAN_API int abort_blockchain_reorg(void);
+VULKAN_API int get_blockchain_reorg_active(void);
+
+VULKAN_API void set_blockchain_prune_depth(uint32_t prune_depth);
+VULKAN_API uint32_t get_blockchain_prune_depth(void);
+VULKAN_API void set_blockchain_prune_target_size(uint64_t prune_target_size);
+VULKAN_API uint64_t get_blockchain_prune_target_size(void);
+VULKAN_API int get_blockchain_prune_enabled(void);
+VULKAN_API uint32_t get_blockchain_pruned_height(void);
+
+VULKAN_API int is_block_pruned_nolock(uint8_t *block_hash);
+VULKAN_API int is_block_pruned(uint8_t *block_hash);
+VULKAN_API int load_blockchain_pruned_height_nolock(void);
+VULKAN_API int prune_blockchain_nolock(void);
+VULKAN_API int prune_blockchain(void);
+
+VULKAN_API int export_utxo_snapshot_nolock(const char *filename);
+VULKAN_API int export_utxo_snapshot(const char *filename);
+VULKAN_API int import_utxo_snapshot_nolock(const char *filename);
+VULKAN_API int import_utxo_snapshot(const char *filename);
+VULKAN_API uint32_t get_utxo_snapshot_height(void);
+VULKAN_API int set_utxo_snapshot_verified_nolock(void);
+VULKAN_API int set_utxo_snapshot_verified(void);
+
+VULKAN_API int reorganize_blockchain_nolock(uint32_t fork_height, block_t **blocks, uint32_t num_blocks);
+VULKAN_API int reorganize_blockchain(uint32_t fork_height, block_t **blocks, uint32_t num_blocks);
+
+VULKAN_API uint32_t get_block_height_from_block_count_nolock(void);
 VULKAN_API uint32_t get_block_height_nolock(void);
 VULKAN_API uint32_t get_block_height(void);
 
 VULKAN_API uint64_t get_cumulative_emission(void);
 VULKAN_API uint64_t get_block_reward(uint32_t block_height, uint64_t cumulative_emission);
 
+VULKAN_API int load_header_index_nolock(void);
+VULKAN_API int load_header_index(void);
+
+VULKAN_API int write_chain_state_manifest_nolock(void);
+VULKAN_API int write_chain_state_manifest(void);
+VULKAN_API int load_chain_state_manifest_nolock(void);
+VULKAN_API int load_chain_state_manifest(void);
+
 VULKAN_API uint32_t get_next_work_required_nolock(uint8_t *previous_hash);
 VULKAN_API uint32_t get_next_work_required(uint8_t *previous_hash);
 
 VULKAN_API int valid_block_median_timestamp(block_t *block);
 VULKAN_API int valid_block_emission(block_t *block);
 
-VULKAN_API int update_unspent_transaction(uint8_t *block_hash, transaction_t *tx);
-VULKAN_API int update_unspent_transactions(block_t *block);
+VULKAN_API block_commit_t* init_block_commit(void);
+VULKAN_API void free_block_commit(block_commit_t *block_commit);
+
+VULKAN_API unspent_transaction_t* get_unspent_tx_from_block_commit_nolock(block_commit_t *block_commit, uint8_t *tx_id);
+VULKAN_API int stage_unspent_tx_in_block_commit(block_commit_t *block_commit, unspent_transaction_t *unspent_tx);
+VULKAN_API int stage_unspent_tx_deletion_in_block_commit(block_commit_t *block_commit, uint8_t *tx_id);
+VULKAN_API int stage_tx_index_in_block_commit(block_commit_t *block_commit, uint8_t *block_hash, transaction_t *tx);
+VULKAN_API int write_block_commit_nolock(block_commit_t *block_commit);
+
+VULKAN_API int write_batch_put_unspent_tx(storage_batch_t *write_batch, unspent_transaction_t *unspent_tx);
+VULKAN_API void write_batch_delete_unspent_tx(storage_batch_t *write_batch, unspent_transaction_t *unspent_tx);
+VULKAN_API int backfill_address_index_nolock(void);
+
+VULKAN_API int flush_utxo_cache_nolock(void);
+VULKAN_API int flush_utxo_cache(void);
+VULKAN_API int write_top_unspent_tx_height_nolock(uint32_t block_height);
+VULKAN_API int load_top_unspent_tx_height_nolock(void);
+VULKAN_API uint32_t get_top_unspent_tx_height(void);
+
+VULKAN_API void insert_unspent_tx_into_utxo_commitment(muhash_t *utxo_commitment, unspent_transaction_t *unspent_tx);
+VULKAN_API void remove_unspent_tx_from_utxo_commitment(muhash_t *utxo_commitment, unspent_transaction_t *unspent_tx);
+VULKAN_API int compute_utxo_commitment_nolock(muhash_t *utxo_commitment);
+VULKAN_API int load_utxo_commitment_nolock(void);
+VULKAN_API int get_utxo_commitment(uint8_t *digest, uint32_t *block_height);
+VULKAN_API int verify_utxo_commitment(void);
+
+VULKAN_API int update_unspent_transaction(block_commit_t *block_commit, uint8_t *block_hash, transaction_t *tx);
+VULKAN_API int update_unspent_transactions(block_commit_t *block_commit, block_t *block);
 
 VULKAN_API int insert_block_nolock(block_t *block, int update_unspent_txs);
 VULKAN_API int insert_block(block_t *block, int update_unspent_txs);
 
 VULKAN_API int validate_and_insert_block_nolock(block_t *block);
 VULKAN_API int validate_and_insert_block(block_t *block);
+VULKAN_API int validate_and_insert_block_assume_valid(block_t *block);
 
 VULKAN_API int is_genesis_block(uint8_t *block_hash);
 
 VULKAN_API block_t *get_block_from_hash_nolock(uint8_t *block_hash);
+VULKAN_API block_t *get_block_header_from_hash_nolock(uint8_t *block_hash);
+VULKAN_API block_t *get_block_header_from_hash(uint8_t *block_hash);
+VULKAN_API int load_block_transactions_nolock(block_t *block);
+VULKAN_API int load_block_transactions(block_t *block);
 VULKAN_API block_t *get_block_from_hash(uint8_t *block_hash);
 
+VULKAN_API block_t *acquire_block_from_hash_nolock(uint8_t *block_hash);
+VULKAN_API block_t *acquire_block_from_hash(uint8_t *block_hash);
+VULKAN_API void release_block_nolock(block_t *block);
+VULKAN_API void release_block(block_t *block);
+VULKAN_API void print_block_cache_stats(void);
+
+VULKAN_API stored_block_t *get_stored_block_from_hash_nolock(uint8_t *block_hash, int include_transactions);
+VULKAN_API stored_block_t *get_stored_block_from_hash(uint8_t *block_hash, int include_transactions);
+VULKAN_API void free_stored_block(stored_block_t *stored_block);
+
 VULKAN_API block_t *get_block_from_height_nolock(uint32_t height);
 VULKAN_API block_t *get_block_from_height(uint32_t height);
+VULKAN_API block_t *get_block_header_from_height_nolock(uint32_t height);
+VULKAN_API block_t *get_block_header_from_height(uint32_t height);
 
 VULKAN_API int32_t get_block_height_from_hash_nolock(uint8_t *block_hash);
 VULKAN_API int32_t get_block_height_from_hash(uint8_t *block_hash);
 
 VULKAN_API int32_t get_block_height_from_block(block_t *block);
+
+VULKAN_API uint8_t *get_block_hash_from_height_nolock(uint32_t height);
 VULKAN_API uint8_t *get_block_hash_from_height(uint32_t height);
 
+VULKAN_API uint8_t *get_block_filter_nolock(uint8_t *block_hash, size_t *filter_size);
+VULKAN_API uint8_t *get_block_filter(uint8_t *block_hash, size_t *filter_size);
+VULKAN_API int store_block_filter_nolock(uint8_t *block_hash, const uint8_t *filter, size_t filter_size);
+VULKAN_API int store_block_filter(uint8_t *block_hash, const uint8_t *filter, size_t filter_size);
+
+VULKAN_API int insert_block_hash_into_height_index_nolock(uint32_t height, uint8_t *block_hash);
+VULKAN_API int delete_block_hash_from_height_index_nolock(uint32_t height);
+VULKAN_API int backfill_block_height_index_nolock(void);
+
 VULKAN_API int has_block_by_hash(uint8_t *block_hash);
 VULKAN_API int has_block_by_height(uint32_t height);
 
@@ -148,9 +440,16 @@ VULKAN_API int insert_tx_into_unspent_index(transaction_t *tx);
 VULKAN_API int insert_unspent_tx_into_index_nolock(unspent_transaction_t *unspent_tx);
 VULKAN_API int insert_unspent_tx_into_index(unspent_transaction_t *unspent_tx);
 
+VULKAN_API unspent_transaction_t *get_unspent_tx_from_storage_nolock(uint8_t *tx_id);
 VULKAN_API unspent_transaction_t *get_unspent_tx_from_index_nolock(uint8_t *tx_id);
 VULKAN_API unspent_transaction_t *get_unspent_tx_from_index(uint8_t *tx_id);
 
+VULKAN_API int prefetch_unspent_txs(uint8_t *tx_ids, uint32_t num_tx_ids);
+VULKAN_API int queue_block_utxo_prefetch(block_t *block);
+VULKAN_API int get_is_utxo_prefetch_running(void);
+VULKAN_API int start_utxo_prefetch(void);
+VULKAN_API int stop_utxo_prefetch(void);
+
 VULKAN_API uint8_t *get_block_hash_from_tx_id_nolock(uint8_t *tx_id);
 VULKAN_API uint8_t *get_block_hash_from_tx_id(uint8_t *tx_id);
 
@@ -165,19 +464,23 @@ VULKAN_API int delete_tx_from_index(uint8_t *tx_id);
 VULKAN_API int delete_unspent_tx_from_index_nolock(uint8_t *tx_id);
 VULKAN_API int delete_unspent_tx_from_index(uint8_t *tx_id);
 
-VULKAN_API int set_top_block_hash_noblock(uint8_t *block_hash);
-VULKAN_API int set_top_block_hash(uint8_t *block_hash);
+VULKAN_API int set_top_block_hash_noblock(uint8_t *block_hash, uint32_t block_height);
+VULKAN_API int set_top_block_hash(uint8_t *block_hash, uint32_t block_height);
 
 VULKAN_API uint8_t* get_top_block_hash_noblock(void);
 VULKAN_API uint8_t* get_top_block_hash(void);
 
-VULKAN_API int set_top_block(block_t *block);
+VULKAN_API int get_height_from_key_nolock(uint8_t *key, size_t key_size, uint32_t *height);
+VULKAN_API int get_top_block_height_noblock(uint32_t *block_height);
+VULKAN_API int load_top_block_height_nolock(void);
+
+VULKAN_API int set_top_block(block_t *block, uint32_t block_height);
 VULKAN_API block_t *get_top_block(void);
 
 VULKAN_API int set_current_block_hash(uint8_t *hash);
 VULKAN_API uint8_t *get_current_block_hash(void);
 
-VULKAN_API int set_current_block(block_t *block);
+VULKAN_API int set_current_block(block_t *block, uint32_t block_height);
 VULKAN_API block_t *get_current_block(void);
 
 VULKAN_API uint32_t get_blocks_since_hash(uint8_t *block_hash);
@@ -186,7 +489,19 @@ VULKAN_API uint32_t get_blocks_since_block(block_t *block);
 VULKAN_API void get_tx_key(uint8_t *buffer, uint8_t *tx_id);
 VULKAN_API void get_unspent_tx_key(uint8_t *buffer, uint8_t *tx_id);
 VULKAN_API void get_block_key(uint8_t *buffer, uint8_t *block_hash);
+VULKAN_API void get_block_transactions_key(uint8_t *buffer, uint8_t *block_hash);
+VULKAN_API void get_block_undo_key(uint8_t *buffer, uint8_t *block_hash);
+VULKAN_API void get_block_filter_key(uint8_t *buffer, uint8_t *block_hash);
+VULKAN_API void get_pruned_height_key(uint8_t *buffer);
+VULKAN_API void get_tx_index_height_key(uint8_t *buffer);
+VULKAN_API void get_utxo_commitment_key(uint8_t *buffer);
+VULKAN_API void get_utxo_snapshot_height_key(uint8_t *buffer);
 VULKAN_API void get_top_block_key(uint8_t *buffer);
+VULKAN_API void get_top_block_height_key(uint8_t *buffer);
+VULKAN_API void get_top_unspent_tx_height_key(uint8_t *buffer);
+VULKAN_API void get_address_unspent_txout_key(uint8_t *buffer, uint8_t *address, uint8_t *tx_id, uint32_t txout_index);
+VULKAN_API void get_has_address_index_key(uint8_t *buffer);
+VULKAN_API void get_block_height_key(uint8_t *buffer, uint32_t height);
 
 VULKAN_API int get_unspent_transactions_for_address_nolock(uint8_t *address, vec_void_t *unspent_txs, uint32_t *num_unspent_txs);
 VULKAN_API int get_unspent_transactions_for_address(uint8_t *address, vec_void_t *unspent_txs, uint32_t *num_unspent_txs);
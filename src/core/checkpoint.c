@@ -25,6 +25,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include <hashtable.h>
@@ -38,19 +39,43 @@
 
 #include "crypto/cryptoutil.h"
 
+typedef struct Checkpoint
+{
+  uint32_t height;
+  uint8_t hash[HASH_SIZE];
+  int has_utxo_snapshot_hash;
+  uint8_t utxo_snapshot_hash[HASH_SIZE];
+} checkpoint_t;
+
 static int g_checkpoints_initialized = 0;
 static HashTable *g_checkpoints_table = NULL;
 static int g_num_checkpoints = 0;
 
-int get_checkpoint_hash_from_height(uint32_t height, uint8_t **hash_out)
+static int compare_checkpoint_height(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, sizeof(uint32_t));
+}
+
+static checkpoint_t* get_checkpoint_from_height(uint32_t height)
 {
   void *val = NULL;
   if (hashtable_get(g_checkpoints_table, &height, &val) != CC_OK)
+  {
+    return NULL;
+  }
+
+  return (checkpoint_t*)val;
+}
+
+int get_checkpoint_hash_from_height(uint32_t height, uint8_t **hash_out)
+{
+  checkpoint_t *checkpoint = get_checkpoint_from_height(height);
+  if (checkpoint == NULL)
   {
     return 1;
   }
 
-  *hash_out = val;
+  *hash_out = checkpoint->hash;
   return 0;
 }
 
@@ -60,24 +85,99 @@ int has_checkpoint_hash_by_height(uint32_t height)
   return get_checkpoint_hash_from_height(height, &checkpoint_hash) == 0;
 }
 
+int get_checkpoint_utxo_snapshot_hash_from_height(uint32_t height, uint8_t **utxo_snapshot_hash_out)
+{
+  checkpoint_t *checkpoint = get_checkpoint_from_height(height);
+  if (checkpoint == NULL || checkpoint->has_utxo_snapshot_hash == 0)
+  {
+    return 1;
+  }
+
+  *utxo_snapshot_hash_out = checkpoint->utxo_snapshot_hash;
+  return 0;
+}
+
+int get_last_checkpoint_height(uint32_t max_height, uint32_t *height_out)
+{
+  int found_checkpoint = 0;
+  uint32_t last_checkpoint_height = 0;
+
+  HashTableIter iter;
+  hashtable_iter_init(&iter, g_checkpoints_table);
+  TableEntry *entry = NULL;
+  while (hashtable_iter_next(&iter, &entry) != CC_ITER_END)
+  {
+    checkpoint_t *checkpoint = (checkpoint_t*)entry->value;
+    assert(checkpoint != NULL);
+    if (checkpoint->height > max_height)
+    {
+      continue;
+    }
+
+    if (found_checkpoint == 0 || checkpoint->height > last_checkpoint_height)
+    {
+      last_checkpoint_height = checkpoint->height;
+      found_checkpoint = 1;
+    }
+  }
+
+  if (found_checkpoint == 0)
+  {
+    return 1;
+  }
+
+  *height_out = last_checkpoint_height;
+  return 0;
+}
+
 int add_checkpoint(uint32_t height, uint8_t *hash)
 {
-  if (hashtable_add(g_checkpoints_table, &height, (void*)hash) != CC_OK)
+  assert(hash != NULL);
+  if (get_checkpoint_from_height(height) != NULL)
   {
     return 1;
   }
 
+  // the table entry is keyed by the height stored in the checkpoint itself
+  checkpoint_t *checkpoint = malloc(sizeof(checkpoint_t));
+  assert(checkpoint != NULL);
+  checkpoint->height = height;
+  memcpy(checkpoint->hash, hash, HASH_SIZE);
+  checkpoint->has_utxo_snapshot_hash = 0;
+  memset(checkpoint->utxo_snapshot_hash, 0, HASH_SIZE);
+  if (hashtable_add(g_checkpoints_table, &checkpoint->height, checkpoint) != CC_OK)
+  {
+    free(checkpoint);
+    return 1;
+  }
+
   g_num_checkpoints++;
   return 0;
 }
 
+int set_checkpoint_utxo_snapshot_hash(uint32_t height, uint8_t *utxo_snapshot_hash)
+{
+  assert(utxo_snapshot_hash != NULL);
+  checkpoint_t *checkpoint = get_checkpoint_from_height(height);
+  if (checkpoint == NULL)
+  {
+    return 1;
+  }
+
+  memcpy(checkpoint->utxo_snapshot_hash, utxo_snapshot_hash, HASH_SIZE);
+  checkpoint->has_utxo_snapshot_hash = 1;
+  return 0;
+}
+
 int remove_checkpoint(uint32_t height)
 {
-  if (hashtable_remove(g_checkpoints_table, &height, NULL) != CC_OK)
+  void *val = NULL;
+  if (hashtable_remove(g_checkpoints_table, &height, &val) != CC_OK)
   {
     return 1;
   }
 
+  free(val);
   g_num_checkpoints--;
   return 0;
 }
@@ -92,9 +192,20 @@ static int load_checkpoint(checkpoint_entry_t checkpoint_entry)
   // add hash as to checkpoint at height
   if (add_checkpoint(checkpoint_entry.height, hash))
   {
+    free(hash);
     return 1;
   }
 
+  free(hash);
+  if (checkpoint_entry.utxo_snapshot_hash != NULL)
+  {
+    size_t utxo_snapshot_hash_size = 0;
+    uint8_t *utxo_snapshot_hash = hex2bin(checkpoint_entry.utxo_snapshot_hash, &utxo_snapshot_hash_size);
+    assert(utxo_snapshot_hash_size == HASH_SIZE);
+    assert(set_checkpoint_utxo_snapshot_hash(checkpoint_entry.height, utxo_snapshot_hash) == 0);
+    free(utxo_snapshot_hash);
+  }
+
   LOG_INFO("Loaded checkpoint: %s at block height: %u", checkpoint_entry.block_hash, checkpoint_entry.height);
   return 0;
 }
@@ -106,7 +217,12 @@ int init_checkpoints(void)
     return 1;
   }
 
-  assert(hashtable_new(&g_checkpoints_table) == CC_OK);
+  HashTableConf checkpoints_conf;
+  hashtable_conf_init(&checkpoints_conf);
+  checkpoints_conf.key_length = sizeof(uint32_t);
+  checkpoints_conf.hash = GENERAL_HASH;
+  checkpoints_conf.key_compare = compare_checkpoint_height;
+  assert(hashtable_new_conf(&checkpoints_conf, &g_checkpoints_table) == CC_OK);
   if (parameters_get_use_testnet())
   {
     for (int i = 0; i < NUM_TESTNET_CHECKPOINTS; i++)
@@ -124,7 +240,7 @@ int init_checkpoints(void)
     }
   }
 
-  g_checkpoints_initialized = 0;
+  g_checkpoints_initialized = 1;
   return 0;
 }
 
@@ -135,7 +251,17 @@ int deinit_checkpoints(void)
     return 1;
   }
 
+  HashTableIter iter;
+  hashtable_iter_init(&iter, g_checkpoints_table);
+  TableEntry *entry = NULL;
+  while (hashtable_iter_next(&iter, &entry) != CC_ITER_END)
+  {
+    free(entry->value);
+  }
+
   hashtable_destroy(g_checkpoints_table);
+  g_checkpoints_table = NULL;
+  g_num_checkpoints = 0;
   g_checkpoints_initialized = 0;
   return 0;
 }
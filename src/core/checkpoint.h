@@ -36,12 +36,16 @@ typedef struct CheckpointEntry
 {
   uint32_t height;
   const char *block_hash;
+  const char *utxo_snapshot_hash; // optional, the hash of the UTXO set snapshot at this height
 } checkpoint_entry_t;
 
 VULKAN_API int get_checkpoint_hash_from_height(uint32_t height, uint8_t **hash_out);
 VULKAN_API int has_checkpoint_hash_by_height(uint32_t height);
+VULKAN_API int get_checkpoint_utxo_snapshot_hash_from_height(uint32_t height, uint8_t **utxo_snapshot_hash_out);
+VULKAN_API int get_last_checkpoint_height(uint32_t max_height, uint32_t *height_out);
 
 VULKAN_API int add_checkpoint(uint32_t height, uint8_t *hash);
+VULKAN_API int set_checkpoint_utxo_snapshot_hash(uint32_t height, uint8_t *utxo_snapshot_hash);
 VULKAN_API int remove_checkpoint(uint32_t height);
 
 VULKAN_API int init_checkpoints(void);
@@ -32,6 +32,7 @@
 #include "common/argparse.h"
 #include "common/util.h"
 #include "common/logger.h"
+#include "common/trace.h"
 
 #include "block.h"
 #include "blockchain.h"
@@ -56,7 +57,13 @@ enum
   CMD_ARG_START_MINING,
   CMD_ARG_STOP_MINING,
   CMD_ARG_XFER,
-  CMD_ARG_PRINT_PEERLIST
+  CMD_ARG_PRINT_PEERLIST,
+  CMD_ARG_PRINT_CACHE_STATS,
+  CMD_ARG_PRINT_MINING_STATS,
+  CMD_ARG_PRINT_MEMPOOL_STATS,
+  CMD_ARG_DUMP_TRACE,
+  CMD_ARG_UTXO_COMMITMENT,
+  CMD_ARG_VERIFY_UTXO_COMMITMENT
 };
 
 static argument_map_t g_arguments_map[] = {
@@ -68,7 +75,13 @@ static argument_map_t g_arguments_map[] = {
   {"start_mining", CMD_ARG_START_MINING, "Resumes all mining threads", "", 0},
   {"stop_mining", CMD_ARG_STOP_MINING, "Pauses all mining threads", "", 0},
   {"xfer", CMD_ARG_XFER, "Xfer money to another wallet from the currently opened wallet", "<address, amount>", 2},
-  {"print_pl", CMD_ARG_PRINT_PEERLIST, "Prints all of our connected peers in the peerlist", "", 0}
+  {"print_pl", CMD_ARG_PRINT_PEERLIST, "Prints all of our connected peers in the peerlist", "", 0},
+  {"cache_stats", CMD_ARG_PRINT_CACHE_STATS, "Prints the usage and hit rates of the blockchain caches", "", 0},
+  {"mining_stats", CMD_ARG_PRINT_MINING_STATS, "Prints the hashrates, found blocks and stale work of the miner workers", "", 0},
+  {"mempool_stats", CMD_ARG_PRINT_MEMPOOL_STATS, "Prints the memory usage, peak memory usage and evicted transactions of the mempool", "", 0},
+  {"dump_trace", CMD_ARG_DUMP_TRACE, "Writes the recorded trace spans to a Chrome/Perfetto trace file", "<filename>", 1},
+  {"utxo_commitment", CMD_ARG_UTXO_COMMITMENT, "Prints the commitment to the UTXO set at the current blockchain top block", "", 0},
+  {"verify_utxo_commitment", CMD_ARG_VERIFY_UTXO_COMMITMENT, "Recomputes the UTXO set commitment from the whole unspent index and checks it against the current one", "", 0}
 };
 
 #define NUM_ARGUMENTS (sizeof(g_arguments_map) / sizeof(argument_map_t))
@@ -123,12 +136,18 @@ static int parse_console_args(int argc, char **argv)
           uint32_t start_height = (uint32_t)atol(argv[i]);
           i++;
           uint32_t end_height = (uint32_t)atol(argv[i]);
-          uint32_t current_block_height = get_block_height();
+          blockchain_tip_t *tip = acquire_blockchain_tip();
+          if (tip == NULL)
+          {
+            return 1;
+          }
 
+          uint32_t current_block_height = tip->height;
           start_height = MIN(start_height, current_block_height);
           end_height = MIN(end_height, current_block_height);
           if (start_height == end_height)
           {
+            release_blockchain_tip(tip);
             return 1;
           }
 
@@ -136,18 +155,32 @@ static int parse_console_args(int argc, char **argv)
           for (uint32_t i = start_height; i <= end_height; i++)
           {
             LOG_INFO("Printing block at height: %llu", i);
-            block_t *block = get_block_from_height(i);
+            block_t *block = get_block_from_height_at_tip(tip, i);
+            if (block == NULL)
+            {
+              LOG_INFO("Block at height: %llu has been pruned!", i);
+              continue;
+            }
+
             print_block(block);
             print_block_transactions(block);
+            free_block(block);
           }
 
+          release_blockchain_tip(tip);
           printf("\n");
         }
         break;
       case CMD_ARG_HEIGHT:
         {
-          uint32_t current_block_height = get_block_height();
-          LOG_INFO("Current blockchain top block height: %llu", current_block_height);
+          blockchain_tip_t *tip = acquire_blockchain_tip();
+          if (tip == NULL)
+          {
+            return 1;
+          }
+
+          LOG_INFO("Current blockchain top block height: %llu", tip->height);
+          release_blockchain_tip(tip);
         }
         break;
       case CMD_ARG_PRINT_WALLET:
@@ -220,6 +253,47 @@ static int parse_console_args(int argc, char **argv)
       case CMD_ARG_PRINT_PEERLIST:
         print_p2p_list();
         break;
+      case CMD_ARG_PRINT_CACHE_STATS:
+        print_block_cache_stats();
+        break;
+      case CMD_ARG_PRINT_MINING_STATS:
+        print_miner_stats();
+        break;
+      case CMD_ARG_PRINT_MEMPOOL_STATS:
+        print_mempool_stats();
+        break;
+      case CMD_ARG_DUMP_TRACE:
+        i++;
+        if (dump_trace(argv[i]))
+        {
+          LOG_INFO("Failed to dump trace spans to file: %s!", argv[i]);
+        }
+        break;
+      case CMD_ARG_UTXO_COMMITMENT:
+        {
+          uint8_t utxo_commitment[MUHASH_DIGEST_SIZE];
+          uint32_t block_height = 0;
+          if (get_utxo_commitment(utxo_commitment, &block_height))
+          {
+            LOG_INFO("Failed to compute the UTXO set commitment!");
+            return 1;
+          }
+
+          char *utxo_commitment_str = bin2hex(utxo_commitment, MUHASH_DIGEST_SIZE);
+          LOG_INFO("UTXO set commitment at height: %u: %s", block_height, utxo_commitment_str);
+          free(utxo_commitment_str);
+        }
+        break;
+      case CMD_ARG_VERIFY_UTXO_COMMITMENT:
+        if (verify_utxo_commitment())
+        {
+          LOG_INFO("The unspent index does not match the UTXO set commitment!");
+        }
+        else
+        {
+          LOG_INFO("The unspent index matches the UTXO set commitment.");
+        }
+        break;
       default:
         break;
     }
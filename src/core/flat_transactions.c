@@ -0,0 +1,349 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "common/logger.h"
+#include "common/util.h"
+
+#include "blockchain.h"
+#include "flat_transactions.h"
+#include "transaction.h"
+
+#include "wallet/wallet.h"
+
+/*
+ * Copies the transactions into a flattened layout, the fixed size arrays are all carved out
+ * of a single allocation ordered by their alignment so that no padding is needed between them.
+ * Later to be free'd with `free_flat_transactions`.
+ */
+flat_transactions_t* flatten_transactions(transaction_t **transactions, uint32_t transaction_count)
+{
+  assert(transactions != NULL || transaction_count == 0);
+  flat_transactions_t *flat_txs = malloc(sizeof(flat_transactions_t));
+  assert(flat_txs != NULL);
+
+  uint32_t txin_count = 0;
+  uint32_t txout_count = 0;
+  for (uint32_t i = 0; i < transaction_count; i++)
+  {
+    transaction_t *tx = transactions[i];
+    assert(tx != NULL);
+
+    txin_count += tx->txin_count;
+    txout_count += tx->txout_count;
+  }
+
+  size_t data_size = (
+    (sizeof(uint64_t) * txout_count) +
+    (sizeof(uint32_t) * (transaction_count + 1) * 2) +
+    (sizeof(uint32_t) * txin_count) +
+    (HASH_SIZE * (size_t)transaction_count) +
+    ((HASH_SIZE + crypto_sign_BYTES + crypto_sign_PUBLICKEYBYTES) * (size_t)txin_count) +
+    (ADDRESS_SIZE * (size_t)txout_count));
+
+  uint8_t *data = malloc(data_size);
+  assert(data != NULL);
+
+  flat_txs->transaction_count = transaction_count;
+  flat_txs->txin_count = txin_count;
+  flat_txs->txout_count = txout_count;
+
+  flat_txs->txout_amounts = (uint64_t*)data;
+  data += sizeof(uint64_t) * txout_count;
+  flat_txs->txin_offsets = (uint32_t*)data;
+  data += sizeof(uint32_t) * (transaction_count + 1);
+  flat_txs->txout_offsets = (uint32_t*)data;
+  data += sizeof(uint32_t) * (transaction_count + 1);
+  flat_txs->txin_txout_indexes = (uint32_t*)data;
+  data += sizeof(uint32_t) * txin_count;
+  flat_txs->ids = (uint8_t(*)[HASH_SIZE])data;
+  data += HASH_SIZE * (size_t)transaction_count;
+  flat_txs->txin_transactions = (uint8_t(*)[HASH_SIZE])data;
+  data += HASH_SIZE * (size_t)txin_count;
+  flat_txs->txin_signatures = (uint8_t(*)[crypto_sign_BYTES])data;
+  data += crypto_sign_BYTES * (size_t)txin_count;
+  flat_txs->txin_public_keys = (uint8_t(*)[crypto_sign_PUBLICKEYBYTES])data;
+  data += crypto_sign_PUBLICKEYBYTES * (size_t)txin_count;
+  flat_txs->txout_addresses = (uint8_t(*)[ADDRESS_SIZE])data;
+
+  uint32_t txin_index = 0;
+  uint32_t txout_index = 0;
+  for (uint32_t i = 0; i < transaction_count; i++)
+  {
+    transaction_t *tx = transactions[i];
+    memcpy(flat_txs->ids[i], tx->id, HASH_SIZE);
+    flat_txs->txin_offsets[i] = txin_index;
+    flat_txs->txout_offsets[i] = txout_index;
+
+    for (uint32_t j = 0; j < tx->txin_count; j++)
+    {
+      input_transaction_t *txin = tx->txins[j];
+      assert(txin != NULL);
+
+      memcpy(flat_txs->txin_transactions[txin_index], txin->transaction, HASH_SIZE);
+      flat_txs->txin_txout_indexes[txin_index] = txin->txout_index;
+      memcpy(flat_txs->txin_signatures[txin_index], txin->signature, crypto_sign_BYTES);
+      memcpy(flat_txs->txin_public_keys[txin_index], txin->public_key, crypto_sign_PUBLICKEYBYTES);
+      txin_index++;
+    }
+
+    for (uint32_t j = 0; j < tx->txout_count; j++)
+    {
+      output_transaction_t *txout = tx->txouts[j];
+      assert(txout != NULL);
+
+      flat_txs->txout_amounts[txout_index] = txout->amount;
+      memcpy(flat_txs->txout_addresses[txout_index], txout->address, ADDRESS_SIZE);
+      txout_index++;
+    }
+  }
+
+  flat_txs->txin_offsets[transaction_count] = txin_index;
+  flat_txs->txout_offsets[transaction_count] = txout_index;
+  return flat_txs;
+}
+
+/*
+ * Copies the flattened tx at the index back into a transaction,
+ * later to be free'd with `free_transaction`.
+ */
+transaction_t* unflatten_transaction(flat_transactions_t *flat_txs, uint32_t tx_index)
+{
+  assert(flat_txs != NULL);
+  assert(tx_index < flat_txs->transaction_count);
+
+  transaction_t *tx = make_transaction();
+  memcpy(tx->id, flat_txs->ids[tx_index], HASH_SIZE);
+
+  uint32_t txin_offset = flat_txs->txin_offsets[tx_index];
+  for (uint32_t i = 0; i < get_flat_tx_txin_count(flat_txs, tx_index); i++)
+  {
+    input_transaction_t *txin = make_txin();
+    memcpy(txin->transaction, flat_txs->txin_transactions[txin_offset + i], HASH_SIZE);
+    txin->txout_index = flat_txs->txin_txout_indexes[txin_offset + i];
+    memcpy(txin->signature, flat_txs->txin_signatures[txin_offset + i], crypto_sign_BYTES);
+    memcpy(txin->public_key, flat_txs->txin_public_keys[txin_offset + i], crypto_sign_PUBLICKEYBYTES);
+    add_txin_to_transaction(tx, txin, i);
+  }
+
+  uint32_t txout_offset = flat_txs->txout_offsets[tx_index];
+  for (uint32_t i = 0; i < get_flat_tx_txout_count(flat_txs, tx_index); i++)
+  {
+    output_transaction_t *txout = make_txout();
+    txout->amount = flat_txs->txout_amounts[txout_offset + i];
+    memcpy(txout->address, flat_txs->txout_addresses[txout_offset + i], ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, i);
+  }
+
+  return tx;
+}
+
+void free_flat_transactions(flat_transactions_t *flat_txs)
+{
+  assert(flat_txs != NULL);
+
+  // the txout amounts are at the start of the allocation
+  free(flat_txs->txout_amounts);
+  free(flat_txs);
+}
+
+uint32_t get_flat_tx_txin_count(flat_transactions_t *flat_txs, uint32_t tx_index)
+{
+  assert(flat_txs != NULL);
+  assert(tx_index < flat_txs->transaction_count);
+  return flat_txs->txin_offsets[tx_index + 1] - flat_txs->txin_offsets[tx_index];
+}
+
+uint32_t get_flat_tx_txout_count(flat_transactions_t *flat_txs, uint32_t tx_index)
+{
+  assert(flat_txs != NULL);
+  assert(tx_index < flat_txs->transaction_count);
+  return flat_txs->txout_offsets[tx_index + 1] - flat_txs->txout_offsets[tx_index];
+}
+
+int is_flat_coinbase_tx(flat_transactions_t *flat_txs, uint32_t tx_index)
+{
+  return (get_flat_tx_txin_count(flat_txs, tx_index) == 0 && get_flat_tx_txout_count(flat_txs, tx_index) == 1);
+}
+
+int valid_flat_transaction_header(flat_transactions_t *flat_txs, uint32_t tx_index)
+{
+  assert(flat_txs != NULL);
+  uint32_t txin_count = get_flat_tx_txin_count(flat_txs, tx_index);
+  uint32_t txout_count = get_flat_tx_txout_count(flat_txs, tx_index);
+
+  // we only check the txout count because if this transaction is a coinbase
+  // transaction, we can expect it to have zero tx inputs
+  if (txout_count == 0)
+  {
+    char *tx_hash_str = bin2hex(flat_txs->ids[tx_index], HASH_SIZE);
+    LOG_DEBUG("Failed to validate transaction: %s, transaction has no txouts!", tx_hash_str);
+    free(tx_hash_str);
+    return 0;
+  }
+
+  uint32_t tx_header_size = (TXIN_HEADER_SIZE * txin_count) + (TXOUT_HEADER_SIZE * txout_count);
+  if (tx_header_size > MAX_TX_SIZE)
+  {
+    char *tx_hash_str = bin2hex(flat_txs->ids[tx_index], HASH_SIZE);
+    LOG_DEBUG("Failed to validate transaction: %s, transaction has too big header blob size: %u!", tx_hash_str, tx_header_size);
+    free(tx_hash_str);
+    return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Verifies the txin signatures of the txs in the range [start_tx_index, end_tx_index),
+ * the signed message is the txin header followed by the sign header of it's tx, which
+ * is built once per tx from the tx's txouts and reused for all of it's txins.
+ * Returns 0 if all of the signatures are valid.
+ */
+int validate_flat_transaction_signatures(flat_transactions_t *flat_txs, uint32_t start_tx_index, uint32_t end_tx_index)
+{
+  assert(flat_txs != NULL);
+  assert(start_tx_index <= end_tx_index);
+  assert(end_tx_index <= flat_txs->transaction_count);
+
+  uint32_t max_txout_count = 0;
+  for (uint32_t tx_index = start_tx_index; tx_index < end_tx_index; tx_index++)
+  {
+    max_txout_count = MAX(max_txout_count, get_flat_tx_txout_count(flat_txs, tx_index));
+  }
+
+  uint8_t *header = malloc(TXIN_HEADER_SIZE + (TXOUT_HEADER_SIZE * (size_t)max_txout_count));
+  assert(header != NULL);
+
+  for (uint32_t tx_index = start_tx_index; tx_index < end_tx_index; tx_index++)
+  {
+    uint32_t txin_offset = flat_txs->txin_offsets[tx_index];
+    uint32_t txin_end = flat_txs->txin_offsets[tx_index + 1];
+    if (txin_offset == txin_end)
+    {
+      continue;
+    }
+
+    uint32_t txout_offset = flat_txs->txout_offsets[tx_index];
+    uint32_t txout_count = get_flat_tx_txout_count(flat_txs, tx_index);
+    uint8_t *sign_header = header + TXIN_HEADER_SIZE;
+    for (uint32_t i = 0; i < txout_count; i++)
+    {
+      uint8_t *txout_header = sign_header + (TXOUT_HEADER_SIZE * i);
+      memcpy(txout_header, &flat_txs->txout_amounts[txout_offset + i], 8);
+      memcpy(txout_header + 8, flat_txs->txout_addresses[txout_offset + i], ADDRESS_SIZE);
+    }
+
+    uint32_t header_size = TXIN_HEADER_SIZE + (TXOUT_HEADER_SIZE * txout_count);
+    for (uint32_t txin_index = txin_offset; txin_index < txin_end; txin_index++)
+    {
+      memcpy(header, flat_txs->txin_transactions[txin_index], HASH_SIZE);
+      memcpy(header + HASH_SIZE, &flat_txs->txin_txout_indexes[txin_index], 4);
+      if (crypto_sign_verify_detached(flat_txs->txin_signatures[txin_index], header, header_size,
+        flat_txs->txin_public_keys[txin_index]) != 0)
+      {
+        char *tx_hash_str = bin2hex(flat_txs->ids[tx_index], HASH_SIZE);
+        char *public_key_str = bin2hex(flat_txs->txin_public_keys[txin_index], crypto_sign_PUBLICKEYBYTES);
+        LOG_ERROR("Failed to verify signature for transaction: %s with public key: %s!", tx_hash_str, public_key_str);
+        free(tx_hash_str);
+        free(public_key_str);
+        free(header);
+        return 1;
+      }
+    }
+  }
+
+  free(header);
+  return 0;
+}
+
+int do_flat_txins_reference_unspent_txouts(flat_transactions_t *flat_txs, uint32_t tx_index)
+{
+  assert(flat_txs != NULL);
+  uint32_t txin_count = get_flat_tx_txin_count(flat_txs, tx_index);
+  if (is_flat_coinbase_tx(flat_txs, tx_index))
+  {
+    return 1;
+  }
+
+  uint32_t valid_txins = 0;
+  uint64_t input_money = 0;
+  uint64_t required_money = 0;
+
+  uint32_t txin_offset = flat_txs->txin_offsets[tx_index];
+  for (uint32_t i = txin_offset; i < txin_offset + txin_count; i++)
+  {
+    uint32_t txout_index = flat_txs->txin_txout_indexes[i];
+    unspent_transaction_t *unspent_tx = get_unspent_tx_from_index(flat_txs->txin_transactions[i]);
+    if (unspent_tx != NULL)
+    {
+      if (((unspent_tx->unspent_txout_count - 1) < txout_index) ||
+          (unspent_tx->unspent_txouts[txout_index] == NULL))
+      {
+        char *tx_hash_str = bin2hex(unspent_tx->id, HASH_SIZE);
+        LOG_ERROR("Failed to validate txin referencing invalid unspent tx: %s with txout at index: %u!", tx_hash_str, txout_index);
+        free(tx_hash_str);
+        free_unspent_transaction(unspent_tx);
+        return 0;
+      }
+      else
+      {
+        unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[txout_index];
+        assert(unspent_txout != NULL);
+
+        if (unspent_txout->spent == 0)
+        {
+          input_money += unspent_txout->amount;
+          valid_txins++;
+        }
+      }
+
+      free_unspent_transaction(unspent_tx);
+    }
+  }
+
+  uint32_t txout_offset = flat_txs->txout_offsets[tx_index];
+  uint32_t txout_end = flat_txs->txout_offsets[tx_index + 1];
+  for (uint32_t i = txout_offset; i < txout_end; i++)
+  {
+    if (valid_address(flat_txs->txout_addresses[i]) == 0)
+    {
+      char *tx_hash_str = bin2hex(flat_txs->ids[tx_index], HASH_SIZE);
+      LOG_ERROR("Failed to validate txin: %s invalid txout address at index: %u", tx_hash_str, i - txout_offset);
+      free(tx_hash_str);
+      return 0;
+    }
+
+    required_money += flat_txs->txout_amounts[i];
+  }
+
+  return (valid_txins == txin_count) && (input_money == required_money);
+}
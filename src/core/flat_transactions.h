@@ -0,0 +1,77 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <sodium.h>
+
+#include "common/util.h"
+#include "common/vulkan.h"
+
+#include "transaction.h"
+
+VULKAN_BEGIN_DECL
+
+/*
+ * A flattened copy of a range of transactions used for validation, the txins and txouts
+ * of every tx are stored back to back in one allocation with each of their fields grouped
+ * into it's own array. The txins of the tx at index i are at [txin_offsets[i], txin_offsets[i + 1])
+ * and it's txouts at [txout_offsets[i], txout_offsets[i + 1]), so checking every txin or txout
+ * is a linear scan over contiguous memory rather than a chase through the txin and txout pointers.
+ */
+typedef struct FlatTransactions
+{
+  uint32_t transaction_count;
+  uint32_t txin_count;
+  uint32_t txout_count;
+
+  uint8_t (*ids)[HASH_SIZE];
+  uint32_t *txin_offsets;
+  uint32_t *txout_offsets;
+
+  uint8_t (*txin_transactions)[HASH_SIZE];
+  uint32_t *txin_txout_indexes;
+  uint8_t (*txin_signatures)[crypto_sign_BYTES];
+  uint8_t (*txin_public_keys)[crypto_sign_PUBLICKEYBYTES];
+
+  uint64_t *txout_amounts;
+  uint8_t (*txout_addresses)[ADDRESS_SIZE];
+} flat_transactions_t;
+
+VULKAN_API flat_transactions_t* flatten_transactions(transaction_t **transactions, uint32_t transaction_count);
+VULKAN_API transaction_t* unflatten_transaction(flat_transactions_t *flat_txs, uint32_t tx_index);
+VULKAN_API void free_flat_transactions(flat_transactions_t *flat_txs);
+
+VULKAN_API uint32_t get_flat_tx_txin_count(flat_transactions_t *flat_txs, uint32_t tx_index);
+VULKAN_API uint32_t get_flat_tx_txout_count(flat_transactions_t *flat_txs, uint32_t tx_index);
+VULKAN_API int is_flat_coinbase_tx(flat_transactions_t *flat_txs, uint32_t tx_index);
+
+VULKAN_API int valid_flat_transaction_header(flat_transactions_t *flat_txs, uint32_t tx_index);
+VULKAN_API int validate_flat_transaction_signatures(flat_transactions_t *flat_txs, uint32_t start_tx_index, uint32_t end_tx_index);
+VULKAN_API int do_flat_txins_reference_unspent_txouts(flat_transactions_t *flat_txs, uint32_t tx_index);
+
+VULKAN_END_DECL
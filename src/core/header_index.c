@@ -0,0 +1,371 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common/logger.h"
+#include "common/util.h"
+
+#include "crypto/bignum_util.h"
+
+#include "block.h"
+#include "header_index.h"
+#include "pow.h"
+
+#define HEADER_INDEX_MIN_CAPACITY 1024
+
+_Static_assert(sizeof(header_index_entry_t) == HEADER_INDEX_ENTRY_SIZE, "header index entries must be fixed size");
+
+// the header index is not locked on it's own, it is only ever
+// accessed by the blockchain while holding the blockchain lock...
+static int g_header_index_initialized = 0;
+
+static header_index_entry_t *g_header_index_entries = NULL;
+static uint32_t g_header_index_num_entries = 0;
+static uint32_t g_header_index_capacity = 0;
+
+/* Open addressed table of heights keyed by block hash, a slot holds the height
+ * of it's entry plus one so that zero marks an empty slot. The table is kept
+ * at most half full so that probe sequences stay short...
+ */
+static uint32_t *g_header_index_slots = NULL;
+static uint32_t g_header_index_num_slots = 0;
+
+/*
+ * Block hashes are prefixed with zeros by their proof-of-work,
+ * so the slot is taken from the end of the hash instead.
+ */
+static uint32_t get_header_index_slot(const uint8_t *block_hash)
+{
+  uint32_t value = 0;
+  memcpy(&value, block_hash + (HASH_SIZE - sizeof(uint32_t)), sizeof(uint32_t));
+  return value & (g_header_index_num_slots - 1);
+}
+
+static void insert_header_index_slot(uint32_t height)
+{
+  uint32_t slot = get_header_index_slot(g_header_index_entries[height].hash);
+  while (g_header_index_slots[slot] != 0)
+  {
+    slot = (slot + 1) & (g_header_index_num_slots - 1);
+  }
+
+  g_header_index_slots[slot] = height + 1;
+}
+
+/*
+ * Removes the slot of an entry, later slots of the same probe sequence
+ * are shifted back into the gap so lookups never stop at it early.
+ */
+static void remove_header_index_slot(uint32_t height)
+{
+  uint32_t mask = g_header_index_num_slots - 1;
+  uint32_t slot = get_header_index_slot(g_header_index_entries[height].hash);
+  while (g_header_index_slots[slot] != height + 1)
+  {
+    assert(g_header_index_slots[slot] != 0);
+    slot = (slot + 1) & mask;
+  }
+
+  uint32_t next_slot = slot;
+  for (;;)
+  {
+    g_header_index_slots[slot] = 0;
+    for (;;)
+    {
+      next_slot = (next_slot + 1) & mask;
+      if (g_header_index_slots[next_slot] == 0)
+      {
+        return;
+      }
+
+      // move the next slot back only if the gap lies between it's ideal slot and itself
+      uint32_t ideal_slot = get_header_index_slot(g_header_index_entries[g_header_index_slots[next_slot] - 1].hash);
+      if (((next_slot - ideal_slot) & mask) >= ((next_slot - slot) & mask))
+      {
+        break;
+      }
+    }
+
+    g_header_index_slots[slot] = g_header_index_slots[next_slot];
+    slot = next_slot;
+  }
+}
+
+static void grow_header_index(void)
+{
+  uint32_t capacity = g_header_index_capacity * 2;
+  header_index_entry_t *entries = realloc(g_header_index_entries, sizeof(header_index_entry_t) * capacity);
+  assert(entries != NULL);
+  g_header_index_entries = entries;
+  g_header_index_capacity = capacity;
+
+  free(g_header_index_slots);
+  g_header_index_num_slots = capacity * 2;
+  g_header_index_slots = calloc(g_header_index_num_slots, sizeof(uint32_t));
+  assert(g_header_index_slots != NULL);
+
+  for (uint32_t height = 0; height < g_header_index_num_entries; height++)
+  {
+    insert_header_index_slot(height);
+  }
+}
+
+int init_header_index(void)
+{
+  if (g_header_index_initialized)
+  {
+    return 1;
+  }
+
+  g_header_index_capacity = HEADER_INDEX_MIN_CAPACITY;
+  g_header_index_entries = malloc(sizeof(header_index_entry_t) * g_header_index_capacity);
+  assert(g_header_index_entries != NULL);
+
+  g_header_index_num_slots = g_header_index_capacity * 2;
+  g_header_index_slots = calloc(g_header_index_num_slots, sizeof(uint32_t));
+  assert(g_header_index_slots != NULL);
+
+  g_header_index_num_entries = 0;
+  g_header_index_initialized = 1;
+  return 0;
+}
+
+int deinit_header_index(void)
+{
+  if (g_header_index_initialized == 0)
+  {
+    return 1;
+  }
+
+  free(g_header_index_entries);
+  free(g_header_index_slots);
+  g_header_index_entries = NULL;
+  g_header_index_slots = NULL;
+  g_header_index_num_entries = 0;
+  g_header_index_capacity = 0;
+  g_header_index_num_slots = 0;
+  g_header_index_initialized = 0;
+  return 0;
+}
+
+void clear_header_index(void)
+{
+  if (g_header_index_initialized == 0)
+  {
+    return;
+  }
+
+  memset(g_header_index_slots, 0, sizeof(uint32_t) * g_header_index_num_slots);
+  g_header_index_num_entries = 0;
+}
+
+uint32_t get_header_index_num_entries(void)
+{
+  return g_header_index_num_entries;
+}
+
+size_t get_header_index_memory_size(void)
+{
+  return (sizeof(header_index_entry_t) * g_header_index_capacity) + (sizeof(uint32_t) * g_header_index_num_slots);
+}
+
+/*
+ * Appends the block at the given height to the index, blocks are always
+ * appended on top of the chain so a block at a height that is already indexed
+ * replaces the entries from that height upwards...
+ */
+/*
+ * Returns 1 if the block can be pushed at the given height, which is only the
+ * case when it extends the entry below it. Returns 0 otherwise.
+ */
+int can_push_header_index_entry(uint32_t height, block_t *block)
+{
+  assert(g_header_index_initialized);
+  assert(block != NULL);
+  if (height > g_header_index_num_entries)
+  {
+    return 0;
+  }
+
+  return height == 0 || compare_hash(g_header_index_entries[height - 1].hash, block->previous_hash);
+}
+
+int push_header_index_entry(uint32_t height, block_t *block)
+{
+  // the linkage is checked before any entry is replaced, so a block
+  // which does not extend the previous entry leaves the index untouched...
+  if (can_push_header_index_entry(height, block) == 0)
+  {
+    return 1;
+  }
+
+  if (height < g_header_index_num_entries)
+  {
+    truncate_header_index(height);
+    g_header_index_num_entries--;
+    remove_header_index_slot(height);
+  }
+
+  uint256_t work;
+  if (get_proof_of_work(&work, block->bits))
+  {
+    uint256_set_zero(&work);
+  }
+
+  if (height > 0)
+  {
+    uint256_add(&work, &g_header_index_entries[height - 1].cumulative_work);
+  }
+
+  if (g_header_index_num_entries == g_header_index_capacity)
+  {
+    grow_header_index();
+  }
+
+  header_index_entry_t *entry = &g_header_index_entries[height];
+  memset(entry, 0, sizeof(header_index_entry_t));
+  memcpy(entry->hash, block->hash, HASH_SIZE);
+  memcpy(entry->previous_hash, block->previous_hash, HASH_SIZE);
+  entry->cumulative_work = work;
+  entry->height = height;
+  entry->timestamp = block->timestamp;
+  entry->bits = block->bits;
+  entry->transaction_count = block->transaction_count;
+  entry->cumulative_emission = block->cumulative_emission;
+
+  g_header_index_num_entries++;
+  insert_header_index_slot(height);
+  return 0;
+}
+
+/*
+ * Drops every entry above the given height, such as after rolling back the chain.
+ */
+void truncate_header_index(uint32_t height)
+{
+  while (g_header_index_num_entries > height + 1)
+  {
+    g_header_index_num_entries--;
+    remove_header_index_slot(g_header_index_num_entries);
+  }
+}
+
+/*
+ * Clears the index and makes room for the given number of entries, the entries
+ * are then written straight into the returned storage, such as when they are
+ * read back from a file, and put in place with restore_header_index_entries...
+ */
+header_index_entry_t* reserve_header_index_entries(uint32_t num_entries)
+{
+  assert(g_header_index_initialized);
+  clear_header_index();
+  while (g_header_index_capacity < num_entries)
+  {
+    grow_header_index();
+  }
+
+  return g_header_index_entries;
+}
+
+int restore_header_index_entries(uint32_t num_entries)
+{
+  assert(g_header_index_initialized);
+  assert(g_header_index_num_entries == 0);
+  if (num_entries > g_header_index_capacity)
+  {
+    return 1;
+  }
+
+  // the entries must still form a chain, otherwise nothing is restored
+  for (uint32_t height = 0; height < num_entries; height++)
+  {
+    header_index_entry_t *entry = &g_header_index_entries[height];
+    if (entry->height != height ||
+      (height > 0 && compare_hash(entry->previous_hash, g_header_index_entries[height - 1].hash) == 0))
+    {
+      return 1;
+    }
+  }
+
+  for (uint32_t height = 0; height < num_entries; height++)
+  {
+    insert_header_index_slot(height);
+  }
+
+  g_header_index_num_entries = num_entries;
+  return 0;
+}
+
+const header_index_entry_t* get_header_index_entries(void)
+{
+  return g_header_index_entries;
+}
+
+header_index_entry_t* get_header_index_entry(uint32_t height)
+{
+  if (height >= g_header_index_num_entries)
+  {
+    return NULL;
+  }
+
+  return &g_header_index_entries[height];
+}
+
+header_index_entry_t* get_header_index_entry_from_hash(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  if (g_header_index_num_entries == 0)
+  {
+    return NULL;
+  }
+
+  uint32_t slot = get_header_index_slot(block_hash);
+  while (g_header_index_slots[slot] != 0)
+  {
+    header_index_entry_t *entry = &g_header_index_entries[g_header_index_slots[slot] - 1];
+    if (compare_hash(entry->hash, block_hash))
+    {
+      return entry;
+    }
+
+    slot = (slot + 1) & (g_header_index_num_slots - 1);
+  }
+
+  return NULL;
+}
+
+header_index_entry_t* get_header_index_top_entry(void)
+{
+  if (g_header_index_num_entries == 0)
+  {
+    return NULL;
+  }
+
+  return &g_header_index_entries[g_header_index_num_entries - 1];
+}
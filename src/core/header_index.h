@@ -0,0 +1,78 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/util.h"
+#include "common/vulkan.h"
+
+#include "crypto/bignum_util.h"
+
+#include "block.h"
+
+VULKAN_BEGIN_DECL
+
+#define HEADER_INDEX_ENTRY_SIZE 128
+
+/* Compact fixed size record of a main chain block's header, the records of
+ * the whole chain are kept in memory ordered by height and each one spans
+ * exactly two cache lines...
+ */
+typedef struct HeaderIndexEntry
+{
+  uint8_t hash[HASH_SIZE];
+  uint8_t previous_hash[HASH_SIZE];
+  uint256_t cumulative_work;
+  uint32_t height;
+  uint32_t timestamp;
+  uint32_t bits;
+  uint32_t transaction_count;
+  uint64_t cumulative_emission;
+  uint8_t reserved[HEADER_INDEX_ENTRY_SIZE - ((HASH_SIZE * 2) + UINT256_SIZE + 24)];
+} header_index_entry_t;
+
+VULKAN_API int init_header_index(void);
+VULKAN_API int deinit_header_index(void);
+
+VULKAN_API void clear_header_index(void);
+VULKAN_API uint32_t get_header_index_num_entries(void);
+VULKAN_API size_t get_header_index_memory_size(void);
+
+VULKAN_API int can_push_header_index_entry(uint32_t height, block_t *block);
+VULKAN_API int push_header_index_entry(uint32_t height, block_t *block);
+VULKAN_API void truncate_header_index(uint32_t height);
+
+VULKAN_API header_index_entry_t* reserve_header_index_entries(uint32_t num_entries);
+VULKAN_API int restore_header_index_entries(uint32_t num_entries);
+VULKAN_API const header_index_entry_t* get_header_index_entries(void);
+
+VULKAN_API header_index_entry_t* get_header_index_entry(uint32_t height);
+VULKAN_API header_index_entry_t* get_header_index_entry_from_hash(uint8_t *block_hash);
+VULKAN_API header_index_entry_t* get_header_index_top_entry(void);
+
+VULKAN_END_DECL
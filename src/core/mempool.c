@@ -26,11 +26,17 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <string.h>
+#include <stdatomic.h>
 #include <time.h>
 
-#include <array.h>
+#include <hashtable.h>
 
+#include "common/buffer.h"
+#include "common/buffer_iterator.h"
+#include "common/buffer_storage.h"
 #include "common/logger.h"
+#include "common/metrics.h"
 #include "common/task.h"
 #include "common/tinycthread.h"
 #include "common/util.h"
@@ -42,46 +48,485 @@
 static mtx_t g_mempool_lock;
 static int g_mempool_initialized = 0;
 
-static Array *g_mempool_transactions = NULL;
+// mempool entries are indexed by tx id and linked in the order
+// they were received in for popping and expiring txs...
+static HashTable *g_mempool_transactions = NULL;
+static mempool_entry_t *g_mempool_head_entry = NULL;
+static mempool_entry_t *g_mempool_tail_entry = NULL;
 static int g_mempool_num_transactions = 0;
 
+// the memory held by the mempool's entries and their txs, once it would grow past
+// the max memory size the txs paying the lowest fee rate are evicted first...
+static size_t g_mempool_max_memory_size = DEFAULT_MEMPOOL_MAX_MEMORY_SIZE;
+static size_t g_mempool_memory_size = 0;
+static size_t g_mempool_peak_memory_size = 0;
+static uint64_t g_mempool_num_evicted_txs = 0;
+
+// a binary min heap of the entries in the order they are evicted in, the lowest fee rate
+// first and then the oldest, entries received in the same second are ordered by sequence...
+static mempool_entry_t **g_mempool_eviction_heap = NULL;
+static uint32_t g_mempool_eviction_heap_size = 0;
+static uint32_t g_mempool_eviction_heap_capacity = 0;
+static uint64_t g_mempool_next_sequence = 0;
+
+// every outpoint spent by a mempool tx maps to the entry spending it, so
+// double spends are found without walking the mempool...
+static HashTable *g_mempool_outpoints = NULL;
+
+// bumped whenever a tx is added to or removed from the mempool, the generations are
+// only bumped under the mempool lock but are read without it by the miners and the ingress...
+static atomic_uint_fast64_t g_mempool_generation = 0;
+
+// bumped whenever the txs of a block are cleared from the mempool, txs validated
+// against an older generation are validated again before they are added...
+static atomic_uint_fast64_t g_mempool_block_generation = 0;
+
 static task_t *g_mempool_flush_task = NULL;
 
+static const char *g_mempool_storage_filename = "mempool_storage.dat";
+static task_t *g_mempool_save_task = NULL;
+static task_t *g_mempool_reload_task = NULL;
+
+// the mempool is only saved once it has been reloaded, otherwise a partially
+// reloaded mempool would overwrite the txs which were not reloaded yet...
+static job_group_t g_mempool_reload_job_group;
+static volatile int g_mempool_reload_cancelled = 0;
+static volatile int g_mempool_reloaded = 0;
+
+void set_mempool_storage_filename(const char *storage_filename)
+{
+  g_mempool_storage_filename = storage_filename;
+}
+
+const char* get_mempool_storage_filename(void)
+{
+  return g_mempool_storage_filename;
+}
+
 mempool_entry_t* init_mempool_entry(void)
 {
   mempool_entry_t *mempool_entry = malloc(sizeof(mempool_entry_t));
   assert(mempool_entry != NULL);
   mempool_entry->tx = NULL;
   mempool_entry->received_ts = 0;
+  mempool_entry->fee = 0;
+  mempool_entry->tx_size = 0;
+  mempool_entry->fee_rate = 0;
+  mempool_entry->memory_size = 0;
+  mempool_entry->sequence = 0;
+  mempool_entry->eviction_index = 0;
+  mempool_entry->outpoints = NULL;
+  mempool_entry->num_outpoints = 0;
+  mempool_entry->prev = NULL;
+  mempool_entry->next = NULL;
   return mempool_entry;
 }
 
 void free_mempool_entry(mempool_entry_t *mempool_entry)
 {
   assert(mempool_entry != NULL);
+  if (mempool_entry->outpoints != NULL)
+  {
+    free(mempool_entry->outpoints);
+  }
+
   free(mempool_entry);
 }
 
+static size_t get_mempool_entry_memory_size(transaction_t *tx)
+{
+  assert(tx != NULL);
+  size_t memory_size = sizeof(mempool_entry_t) + sizeof(TableEntry) + get_tx_memory_size(tx);
+  memory_size += tx->txin_count * (MEMPOOL_OUTPOINT_SIZE + sizeof(TableEntry));
+  return memory_size;
+}
+
+/*
+ * Returns a negative value if the entry is evicted before the other entry.
+ */
+static int compare_mempool_eviction_entries(mempool_entry_t *mempool_entry, mempool_entry_t *other_mempool_entry)
+{
+  if (mempool_entry->fee_rate != other_mempool_entry->fee_rate)
+  {
+    return mempool_entry->fee_rate < other_mempool_entry->fee_rate ? -1 : 1;
+  }
+
+  if (mempool_entry->received_ts != other_mempool_entry->received_ts)
+  {
+    return mempool_entry->received_ts < other_mempool_entry->received_ts ? -1 : 1;
+  }
+
+  if (mempool_entry->sequence != other_mempool_entry->sequence)
+  {
+    return mempool_entry->sequence < other_mempool_entry->sequence ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static void set_mempool_eviction_heap_entry(uint32_t index, mempool_entry_t *mempool_entry)
+{
+  assert(index < g_mempool_eviction_heap_size);
+  g_mempool_eviction_heap[index] = mempool_entry;
+  mempool_entry->eviction_index = index;
+}
+
+static void sift_up_mempool_eviction_entry(uint32_t index)
+{
+  mempool_entry_t *mempool_entry = g_mempool_eviction_heap[index];
+  while (index > 0)
+  {
+    uint32_t parent_index = (index - 1) / 2;
+    mempool_entry_t *parent_mempool_entry = g_mempool_eviction_heap[parent_index];
+    if (compare_mempool_eviction_entries(parent_mempool_entry, mempool_entry) <= 0)
+    {
+      break;
+    }
+
+    set_mempool_eviction_heap_entry(index, parent_mempool_entry);
+    index = parent_index;
+  }
+
+  set_mempool_eviction_heap_entry(index, mempool_entry);
+}
+
+static void sift_down_mempool_eviction_entry(uint32_t index)
+{
+  mempool_entry_t *mempool_entry = g_mempool_eviction_heap[index];
+  for (;;)
+  {
+    uint32_t child_index = (index * 2) + 1;
+    if (child_index >= g_mempool_eviction_heap_size)
+    {
+      break;
+    }
+
+    if (child_index + 1 < g_mempool_eviction_heap_size &&
+      compare_mempool_eviction_entries(g_mempool_eviction_heap[child_index + 1], g_mempool_eviction_heap[child_index]) < 0)
+    {
+      child_index++;
+    }
+
+    mempool_entry_t *child_mempool_entry = g_mempool_eviction_heap[child_index];
+    if (compare_mempool_eviction_entries(mempool_entry, child_mempool_entry) <= 0)
+    {
+      break;
+    }
+
+    set_mempool_eviction_heap_entry(index, child_mempool_entry);
+    index = child_index;
+  }
+
+  set_mempool_eviction_heap_entry(index, mempool_entry);
+}
+
+static void push_mempool_eviction_entry(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  if (g_mempool_eviction_heap_size == g_mempool_eviction_heap_capacity)
+  {
+    g_mempool_eviction_heap_capacity = g_mempool_eviction_heap_capacity > 0 ? g_mempool_eviction_heap_capacity * 2 : 64;
+    g_mempool_eviction_heap = realloc(g_mempool_eviction_heap, sizeof(mempool_entry_t*) * g_mempool_eviction_heap_capacity);
+    assert(g_mempool_eviction_heap != NULL);
+  }
+
+  g_mempool_eviction_heap_size++;
+  set_mempool_eviction_heap_entry(g_mempool_eviction_heap_size - 1, mempool_entry);
+  sift_up_mempool_eviction_entry(g_mempool_eviction_heap_size - 1);
+}
+
+static void remove_mempool_eviction_entry(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  uint32_t index = mempool_entry->eviction_index;
+  assert(index < g_mempool_eviction_heap_size);
+  assert(g_mempool_eviction_heap[index] == mempool_entry);
+
+  // move the last entry into the removed entry's place and restore the heap order around it
+  g_mempool_eviction_heap_size--;
+  if (index == g_mempool_eviction_heap_size)
+  {
+    return;
+  }
+
+  mempool_entry_t *last_mempool_entry = g_mempool_eviction_heap[g_mempool_eviction_heap_size];
+  set_mempool_eviction_heap_entry(index, last_mempool_entry);
+  sift_up_mempool_eviction_entry(index);
+  if (last_mempool_entry->eviction_index == index)
+  {
+    sift_down_mempool_eviction_entry(index);
+  }
+}
+
+/*
+ * Moves the entry to it's place in the eviction order after it's received time was changed.
+ */
+static void update_mempool_eviction_entry(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  uint32_t index = mempool_entry->eviction_index;
+  sift_up_mempool_eviction_entry(index);
+  if (mempool_entry->eviction_index == index)
+  {
+    sift_down_mempool_eviction_entry(index);
+  }
+}
+
+static int compare_mempool_tx_id(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, HASH_SIZE);
+}
+
+static int compare_mempool_outpoint(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, MEMPOOL_OUTPOINT_SIZE);
+}
+
+static void write_mempool_outpoint(uint8_t *outpoint, uint8_t *tx_hash, uint32_t txout_index)
+{
+  assert(outpoint != NULL);
+  assert(tx_hash != NULL);
+  memcpy(outpoint, tx_hash, HASH_SIZE);
+  memcpy(outpoint + HASH_SIZE, &txout_index, sizeof(uint32_t));
+}
+
+static int compare_compact_short_id(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, COMPACT_BLOCK_SHORT_ID_SIZE);
+}
+
+static void link_mempool_entry(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  mempool_entry->prev = g_mempool_tail_entry;
+  mempool_entry->next = NULL;
+
+  if (g_mempool_tail_entry != NULL)
+  {
+    g_mempool_tail_entry->next = mempool_entry;
+  }
+  else
+  {
+    g_mempool_head_entry = mempool_entry;
+  }
+
+  g_mempool_tail_entry = mempool_entry;
+}
+
+static void unlink_mempool_entry(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  if (mempool_entry->prev != NULL)
+  {
+    mempool_entry->prev->next = mempool_entry->next;
+  }
+  else
+  {
+    g_mempool_head_entry = mempool_entry->next;
+  }
+
+  if (mempool_entry->next != NULL)
+  {
+    mempool_entry->next->prev = mempool_entry->prev;
+  }
+  else
+  {
+    g_mempool_tail_entry = mempool_entry->prev;
+  }
+
+  mempool_entry->prev = NULL;
+  mempool_entry->next = NULL;
+}
+
+static void index_mempool_entry_outpoints(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  transaction_t *tx = mempool_entry->tx;
+  assert(tx != NULL);
+  if (tx->txin_count == 0)
+  {
+    return;
+  }
+
+  // the outpoints are kept on the entry since the index only stores pointers to it's keys
+  mempool_entry->outpoints = malloc(MEMPOOL_OUTPOINT_SIZE * tx->txin_count);
+  assert(mempool_entry->outpoints != NULL);
+  mempool_entry->num_outpoints = tx->txin_count;
+
+  for (uint32_t i = 0; i < tx->txin_count; i++)
+  {
+    input_transaction_t *txin = tx->txins[i];
+    assert(txin != NULL);
+
+    uint8_t *outpoint = mempool_entry->outpoints + (i * MEMPOOL_OUTPOINT_SIZE);
+    write_mempool_outpoint(outpoint, txin->transaction, txin->txout_index);
+    hashtable_add(g_mempool_outpoints, outpoint, mempool_entry);
+  }
+}
+
+static void unindex_mempool_entry_outpoints(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  for (uint32_t i = 0; i < mempool_entry->num_outpoints; i++)
+  {
+    uint8_t *outpoint = mempool_entry->outpoints + (i * MEMPOOL_OUTPOINT_SIZE);
+    void *val = NULL;
+    if (hashtable_get(g_mempool_outpoints, outpoint, &val) == CC_OK && val == mempool_entry)
+    {
+      hashtable_remove(g_mempool_outpoints, outpoint, NULL);
+    }
+  }
+}
+
+static void remove_mempool_entry(mempool_entry_t *mempool_entry)
+{
+  assert(mempool_entry != NULL);
+  assert(hashtable_remove(g_mempool_transactions, mempool_entry->tx->id, NULL) == CC_OK);
+  unindex_mempool_entry_outpoints(mempool_entry);
+  unlink_mempool_entry(mempool_entry);
+  remove_mempool_eviction_entry(mempool_entry);
+
+  assert(g_mempool_memory_size >= mempool_entry->memory_size);
+  g_mempool_memory_size -= mempool_entry->memory_size;
+  g_mempool_num_transactions--;
+  atomic_fetch_add_explicit(&g_mempool_generation, 1, memory_order_release);
+  free_mempool_entry(mempool_entry);
+}
+
 mempool_entry_t* get_mempool_entry_from_mempool(uint8_t *tx_hash)
 {
+  assert(tx_hash != NULL);
   void *val = NULL;
-  ARRAY_FOREACH(val, g_mempool_transactions,
+  if (hashtable_get(g_mempool_transactions, tx_hash, &val) != CC_OK)
   {
-    mempool_entry_t *mempool_entry = (mempool_entry_t*)val;
-    assert(mempool_entry != NULL);
+    return NULL;
+  }
 
-    transaction_t *tx = mempool_entry->tx;
-    assert(tx != NULL);
+  return (mempool_entry_t*)val;
+}
 
-    if (compare_hash(tx->id, tx_hash))
+/*
+ * Returns the mempool entry whose tx spends the txout at txout index of the tx
+ * with the given hash, or NULL when no tx in the mempool spends it.
+ */
+mempool_entry_t* get_mempool_entry_from_outpoint(uint8_t *tx_hash, uint32_t txout_index)
+{
+  assert(tx_hash != NULL);
+  uint8_t outpoint[MEMPOOL_OUTPOINT_SIZE];
+  write_mempool_outpoint(outpoint, tx_hash, txout_index);
+
+  void *val = NULL;
+  if (hashtable_get(g_mempool_outpoints, outpoint, &val) != CC_OK)
+  {
+    return NULL;
+  }
+
+  return (mempool_entry_t*)val;
+}
+
+static int is_tx_conflicting_with_mempool_nolock(transaction_t *tx)
+{
+  assert(tx != NULL);
+  for (uint32_t i = 0; i < tx->txin_count; i++)
+  {
+    input_transaction_t *txin = tx->txins[i];
+    assert(txin != NULL);
+    if (get_mempool_entry_from_outpoint(txin->transaction, txin->txout_index) != NULL)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Collects the distinct mempool entries which spend any of the txouts spent by the tx,
+ * returns 1 if the tx conflicts with more than max conflicts entries.
+ */
+static int get_conflicting_mempool_entries(transaction_t *tx, mempool_entry_t **conflicts,
+  uint32_t max_conflicts, uint32_t *num_conflicts_out)
+{
+  assert(tx != NULL);
+  assert(conflicts != NULL);
+  assert(num_conflicts_out != NULL);
+
+  uint32_t num_conflicts = 0;
+  for (uint32_t i = 0; i < tx->txin_count; i++)
+  {
+    input_transaction_t *txin = tx->txins[i];
+    assert(txin != NULL);
+
+    mempool_entry_t *mempool_entry = get_mempool_entry_from_outpoint(txin->transaction, txin->txout_index);
+    if (mempool_entry == NULL)
+    {
+      continue;
+    }
+
+    // a tx may spend several txouts which are spent by the same conflicting tx
+    int already_collected = 0;
+    for (uint32_t j = 0; j < num_conflicts; j++)
+    {
+      if (conflicts[j] == mempool_entry)
+      {
+        already_collected = 1;
+        break;
+      }
+    }
+
+    if (already_collected)
+    {
+      continue;
+    }
+
+    if (num_conflicts == max_conflicts)
+    {
+      return 1;
+    }
+
+    conflicts[num_conflicts] = mempool_entry;
+    num_conflicts++;
+  }
+
+  *num_conflicts_out = num_conflicts;
+  return 0;
+}
+
+/*
+ * A tx can only replace the txs it conflicts with if it pays a higher fee rate than
+ * each of them and a higher fee than all of them combined, otherwise the same
+ * txouts could be used to replace txs in the mempool over and over for free...
+ */
+static int can_replace_mempool_entries(transaction_t *tx, mempool_entry_t **conflicts, uint32_t num_conflicts)
+{
+  assert(tx != NULL);
+  assert(conflicts != NULL);
+
+  uint64_t fee = get_tx_fee(tx);
+  uint32_t tx_size = get_tx_header_size(tx);
+  uint64_t fee_rate = tx_size > 0 ? fee / tx_size : 0;
+
+  uint64_t conflicts_fee = 0;
+  for (uint32_t i = 0; i < num_conflicts; i++)
+  {
+    mempool_entry_t *mempool_entry = conflicts[i];
+    assert(mempool_entry != NULL);
+    if (fee_rate <= mempool_entry->fee_rate)
     {
-      return mempool_entry;
+      return 0;
     }
-  })
 
-  return NULL;
+    conflicts_fee += mempool_entry->fee;
+  }
+
+  return fee > conflicts_fee;
 }
 
+/*
+ * The tx is owned by the mempool and is free'd once it is mined, replaced or evicted,
+ * so it can only be read while holding the mempool lock. Blocks built from the mempool
+ * hold copies of it's txs, see `copy_tx_from_mempool` for reading a tx without the lock.
+ */
 transaction_t* get_tx_from_mempool(uint8_t *tx_hash)
 {
   mempool_entry_t *mempool_entry = get_mempool_entry_from_mempool(tx_hash);
@@ -93,6 +538,48 @@ transaction_t* get_tx_from_mempool(uint8_t *tx_hash)
   return mempool_entry->tx;
 }
 
+/*
+ * Copies the tx out of the mempool so it can be read after the mempool lock
+ * is released. Later to be free'd with `free_transaction`.
+ */
+transaction_t* copy_tx_from_mempool(uint8_t *tx_hash)
+{
+  assert(tx_hash != NULL);
+  mtx_lock(&g_mempool_lock);
+  transaction_t *tx = get_tx_from_mempool(tx_hash);
+  if (tx == NULL)
+  {
+    mtx_unlock(&g_mempool_lock);
+    return NULL;
+  }
+
+  transaction_t *tx_copy = make_transaction();
+  assert(copy_transaction(tx, tx_copy) == 0);
+  mtx_unlock(&g_mempool_lock);
+  return tx_copy;
+}
+
+/*
+ * Copies the ids of up to max tx ids of the mempool's txs in the
+ * order they were received in, returns the number of ids copied.
+ */
+uint32_t get_mempool_tx_ids(uint8_t *tx_ids, uint32_t max_tx_ids)
+{
+  assert(tx_ids != NULL);
+  uint32_t num_tx_ids = 0;
+  mtx_lock(&g_mempool_lock);
+  for (mempool_entry_t *mempool_entry = g_mempool_head_entry; mempool_entry != NULL && num_tx_ids < max_tx_ids;
+    mempool_entry = mempool_entry->next)
+  {
+    assert(mempool_entry->tx != NULL);
+    memcpy(tx_ids + (num_tx_ids * HASH_SIZE), mempool_entry->tx->id, HASH_SIZE);
+    num_tx_ids++;
+  }
+
+  mtx_unlock(&g_mempool_lock);
+  return num_tx_ids;
+}
+
 int is_tx_in_mempool_nolock(transaction_t *tx)
 {
   assert(tx != NULL);
@@ -107,23 +594,193 @@ int is_tx_in_mempool(transaction_t *tx)
   return result;
 }
 
-int add_tx_to_mempool_nolock(transaction_t *tx)
+int is_tx_id_in_mempool(uint8_t *tx_hash)
+{
+  assert(tx_hash != NULL);
+  mtx_lock(&g_mempool_lock);
+  int result = get_tx_from_mempool(tx_hash) != NULL;
+  mtx_unlock(&g_mempool_lock);
+  return result;
+}
+
+static int is_replaced_mempool_entry(mempool_entry_t *mempool_entry, mempool_entry_t **replaced_entries,
+  uint32_t num_replaced_entries)
+{
+  for (uint32_t i = 0; i < num_replaced_entries; i++)
+  {
+    if (replaced_entries[i] == mempool_entry)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Evicts txs in the eviction order, lowest fee rate and then oldest first, until the entry
+ * fits into the mempool's max memory size. The entry is treated as the newest tx, so it only
+ * evicts txs paying the same or a lower fee rate. The memory of the replaced entries is counted
+ * as free'd already, they are left for the caller to remove. Returns 1 without evicting any
+ * txs if the entry would not fit even after evicting all of them.
+ */
+static int make_room_for_mempool_entry(mempool_entry_t *new_mempool_entry, mempool_entry_t **replaced_entries,
+  uint32_t num_replaced_entries)
+{
+  assert(new_mempool_entry != NULL);
+  size_t memory_size = g_mempool_memory_size;
+  for (uint32_t i = 0; i < num_replaced_entries; i++)
+  {
+    assert(memory_size >= replaced_entries[i]->memory_size);
+    memory_size -= replaced_entries[i]->memory_size;
+  }
+
+  if (memory_size + new_mempool_entry->memory_size <= g_mempool_max_memory_size)
+  {
+    return 0;
+  }
+
+  if (new_mempool_entry->memory_size > g_mempool_max_memory_size)
+  {
+    return 1;
+  }
+
+  // take entries off the top of the eviction heap until enough memory would be free'd,
+  // they are all pushed back before the ones which make room are removed for real...
+  mempool_entry_t **evicted_entries = NULL;
+  uint32_t num_evicted_entries = 0;
+  while (memory_size + new_mempool_entry->memory_size > g_mempool_max_memory_size && g_mempool_eviction_heap_size > 0)
+  {
+    mempool_entry_t *mempool_entry = g_mempool_eviction_heap[0];
+    if (mempool_entry->fee_rate > new_mempool_entry->fee_rate)
+    {
+      break;
+    }
+
+    remove_mempool_eviction_entry(mempool_entry);
+    evicted_entries = realloc(evicted_entries, sizeof(mempool_entry_t*) * (num_evicted_entries + 1));
+    assert(evicted_entries != NULL);
+    evicted_entries[num_evicted_entries++] = mempool_entry;
+
+    if (is_replaced_mempool_entry(mempool_entry, replaced_entries, num_replaced_entries) == 0)
+    {
+      memory_size -= mempool_entry->memory_size;
+    }
+  }
+
+  for (uint32_t i = 0; i < num_evicted_entries; i++)
+  {
+    push_mempool_eviction_entry(evicted_entries[i]);
+  }
+
+  int result = 1;
+  if (memory_size + new_mempool_entry->memory_size > g_mempool_max_memory_size)
+  {
+    goto make_room_fail;
+  }
+
+  for (uint32_t i = 0; i < num_evicted_entries; i++)
+  {
+    mempool_entry_t *mempool_entry = evicted_entries[i];
+    if (is_replaced_mempool_entry(mempool_entry, replaced_entries, num_replaced_entries))
+    {
+      continue;
+    }
+
+    transaction_t *tx = mempool_entry->tx;
+    assert(tx != NULL);
+
+    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
+    LOG_DEBUG("Evicting transaction: %s from mempool, the mempool is full!", tx_hash_str);
+    free(tx_hash_str);
+
+    remove_mempool_entry(mempool_entry);
+    free_transaction(tx);
+    g_mempool_num_evicted_txs++;
+  }
+
+  result = 0;
+
+make_room_fail:
+  free(evicted_entries);
+  return result;
+}
+
+/*
+ * Adds the tx in place of the replaced entries, which are only removed and free'd
+ * along with their txs once the tx is known to fit into the mempool.
+ */
+static int add_mempool_entry_nolock(transaction_t *tx, mempool_entry_t **replaced_entries, uint32_t num_replaced_entries)
 {
   assert(tx != NULL);
   mempool_entry_t *mempool_entry = init_mempool_entry();
   mempool_entry->tx = tx;
   mempool_entry->received_ts = get_current_time();
+  mempool_entry->sequence = g_mempool_next_sequence++;
+
+  // the fee rate is the fee paid per byte of block space the tx takes up
+  mempool_entry->fee = get_tx_fee(tx);
+  mempool_entry->tx_size = get_tx_header_size(tx);
+  mempool_entry->fee_rate = mempool_entry->tx_size > 0 ? mempool_entry->fee / mempool_entry->tx_size : 0;
+  mempool_entry->memory_size = get_mempool_entry_memory_size(tx);
 
-  if (array_add(g_mempool_transactions, mempool_entry) != CC_OK)
+  // a full mempool only takes in txs paying at least as much as the txs it evicts for them
+  if (make_room_for_mempool_entry(mempool_entry, replaced_entries, num_replaced_entries))
   {
     free_mempool_entry(mempool_entry);
     return 1;
   }
 
+  for (uint32_t i = 0; i < num_replaced_entries; i++)
+  {
+    transaction_t *replaced_tx = replaced_entries[i]->tx;
+    assert(replaced_tx != NULL);
+
+    char *tx_hash_str = bin2hex(replaced_tx->id, HASH_SIZE);
+    LOG_DEBUG("Replacing transaction: %s in mempool with a higher fee double spend!", tx_hash_str);
+    free(tx_hash_str);
+
+    // nothing outside of the mempool points at it's txs, so the replaced tx is free'd right away
+    remove_mempool_entry(replaced_entries[i]);
+    free_transaction(replaced_tx);
+  }
+
+  // the entry is keyed by the id of the tx it holds
+  if (hashtable_add(g_mempool_transactions, tx->id, mempool_entry) != CC_OK)
+  {
+    free_mempool_entry(mempool_entry);
+    return 1;
+  }
+
+  index_mempool_entry_outpoints(mempool_entry);
+  link_mempool_entry(mempool_entry);
+  push_mempool_eviction_entry(mempool_entry);
+
+  g_mempool_memory_size += mempool_entry->memory_size;
+  g_mempool_peak_memory_size = MAX(g_mempool_peak_memory_size, g_mempool_memory_size);
   g_mempool_num_transactions++;
+  atomic_fetch_add_explicit(&g_mempool_generation, 1, memory_order_release);
   return 0;
 }
 
+int add_tx_to_mempool_nolock(transaction_t *tx)
+{
+  assert(tx != NULL);
+  if (is_tx_in_mempool_nolock(tx))
+  {
+    return 1;
+  }
+
+  // double spends of txouts already spent in the mempool are never added,
+  // conflicting txs have to be replaced by validating the tx first...
+  if (is_tx_conflicting_with_mempool_nolock(tx))
+  {
+    return 1;
+  }
+
+  return add_mempool_entry_nolock(tx, NULL, 0);
+}
+
 int add_tx_to_mempool(transaction_t *tx)
 {
   mtx_lock(&g_mempool_lock);
@@ -132,6 +789,52 @@ int add_tx_to_mempool(transaction_t *tx)
   return result;
 }
 
+/*
+ * Adds a tx which was validated outside of the mempool lock, replacing any of the txs it
+ * conflicts with. If a block was connected since the tx was validated the txouts it
+ * spends might have been spent by that block, so the tx is validated again...
+ */
+int add_validated_tx_to_mempool_nolock(transaction_t *tx, uint64_t block_generation)
+{
+  assert(tx != NULL);
+  if (block_generation != get_mempool_block_generation() && valid_transaction(tx) == 0)
+  {
+    return 1;
+  }
+
+  if (is_coinbase_tx(tx))
+  {
+    return 1;
+  }
+
+  if (is_tx_in_mempool_nolock(tx))
+  {
+    return 1;
+  }
+
+  mempool_entry_t *conflicts[MEMPOOL_MAX_REPLACED_TXS];
+  uint32_t num_conflicts = 0;
+  if (get_conflicting_mempool_entries(tx, conflicts, MEMPOOL_MAX_REPLACED_TXS, &num_conflicts))
+  {
+    return 1;
+  }
+
+  if (num_conflicts > 0 && can_replace_mempool_entries(tx, conflicts, num_conflicts) == 0)
+  {
+    return 1;
+  }
+
+  return add_mempool_entry_nolock(tx, conflicts, num_conflicts);
+}
+
+int add_validated_tx_to_mempool(transaction_t *tx, uint64_t block_generation)
+{
+  mtx_lock(&g_mempool_lock);
+  int result = add_validated_tx_to_mempool_nolock(tx, block_generation);
+  mtx_unlock(&g_mempool_lock);
+  return result;
+}
+
 int validate_and_add_tx_to_mempool_nolock(transaction_t *tx)
 {
   assert(tx != NULL);
@@ -140,126 +843,296 @@ int validate_and_add_tx_to_mempool_nolock(transaction_t *tx)
     return 1;
   }
 
-  if (is_coinbase_tx(tx))
+  return add_validated_tx_to_mempool_nolock(tx, get_mempool_block_generation());
+}
+
+int validate_and_add_tx_to_mempool(transaction_t *tx)
+{
+  mtx_lock(&g_mempool_lock);
+  int result = validate_and_add_tx_to_mempool_nolock(tx);
+  mtx_unlock(&g_mempool_lock);
+  return result;
+}
+
+int remove_tx_from_mempool_nolock(transaction_t *tx)
+{
+  assert(tx != NULL);
+  mempool_entry_t *mempool_entry = get_mempool_entry_from_mempool(tx->id);
+  if (mempool_entry == NULL)
+  {
+    return 1;
+  }
+
+  remove_mempool_entry(mempool_entry);
+  return 0;
+}
+
+int remove_tx_from_mempool(transaction_t *tx)
+{
+  mtx_lock(&g_mempool_lock);
+  int result = remove_tx_from_mempool_nolock(tx);
+  mtx_unlock(&g_mempool_lock);
+  return result;
+}
+
+transaction_t* pop_tx_from_mempool_nolock(void)
+{
+  mempool_entry_t *mempool_entry = g_mempool_head_entry;
+  assert(mempool_entry != NULL);
+
+  transaction_t *tx = mempool_entry->tx;
+  assert(tx != NULL);
+
+  remove_mempool_entry(mempool_entry);
+  return tx;
+}
+
+transaction_t* pop_tx_from_mempool(void)
+{
+  mtx_lock(&g_mempool_lock);
+  transaction_t *tx = pop_tx_from_mempool_nolock();
+  mtx_unlock(&g_mempool_lock);
+  return tx;
+}
+
+uint64_t get_num_txs_in_mempool(void)
+{
+  return g_mempool_num_transactions;
+}
+
+void set_mempool_max_memory_size(size_t max_memory_size)
+{
+  g_mempool_max_memory_size = max_memory_size;
+}
+
+size_t get_mempool_max_memory_size(void)
+{
+  return g_mempool_max_memory_size;
+}
+
+size_t get_mempool_memory_size(void)
+{
+  return g_mempool_memory_size;
+}
+
+size_t get_mempool_peak_memory_size(void)
+{
+  return g_mempool_peak_memory_size;
+}
+
+uint64_t get_mempool_num_evicted_txs(void)
+{
+  return g_mempool_num_evicted_txs;
+}
+
+void print_mempool_stats(void)
+{
+  mtx_lock(&g_mempool_lock);
+  LOG_INFO("Mempool: %d transactions, %zu/%zu bytes (peak %zu bytes), %llu evicted.", g_mempool_num_transactions,
+    g_mempool_memory_size, g_mempool_max_memory_size, g_mempool_peak_memory_size,
+    (unsigned long long)g_mempool_num_evicted_txs);
+  mtx_unlock(&g_mempool_lock);
+}
+
+uint64_t get_mempool_generation(void)
+{
+  return atomic_load_explicit(&g_mempool_generation, memory_order_acquire);
+}
+
+uint64_t get_mempool_block_generation(void)
+{
+  return atomic_load_explicit(&g_mempool_block_generation, memory_order_acquire);
+}
+
+typedef struct MempoolTemplateEntry
+{
+  mempool_entry_t *mempool_entry;
+  uint32_t index;
+} mempool_template_entry_t;
+
+static int compare_mempool_template_entries(const void *a, const void *b)
+{
+  const mempool_template_entry_t *entry = (const mempool_template_entry_t*)a;
+  const mempool_template_entry_t *other_entry = (const mempool_template_entry_t*)b;
+
+  // highest fee rate first, then highest fee, then the order the txs were received in
+  uint64_t fee_rate = entry->mempool_entry->fee_rate;
+  uint64_t other_fee_rate = other_entry->mempool_entry->fee_rate;
+  if (fee_rate != other_fee_rate)
   {
-    return 1;
+    return fee_rate > other_fee_rate ? -1 : 1;
   }
 
-  if (is_tx_in_mempool_nolock(tx))
+  uint64_t fee = entry->mempool_entry->fee;
+  uint64_t other_fee = other_entry->mempool_entry->fee;
+  if (fee != other_fee)
   {
-    return 1;
+    return fee > other_fee ? -1 : 1;
   }
 
-  return add_tx_to_mempool_nolock(tx);
-}
-
-int validate_and_add_tx_to_mempool(transaction_t *tx)
-{
-  mtx_lock(&g_mempool_lock);
-  int result = validate_and_add_tx_to_mempool_nolock(tx);
-  mtx_unlock(&g_mempool_lock);
-  return result;
+  return entry->index < other_entry->index ? -1 : 1;
 }
 
-int remove_tx_from_mempool_nolock(transaction_t *tx)
+/* Fills the block with copies of the highest fee rate txs in the mempool that fit,
+ * the block owns the copies so it outlives any of the txs being replaced or removed.
+ * Txs in the mempool only ever spend txouts that are already in the unspent
+ * index, so they can be added to the block in any order...
+ */
+int fill_block_with_txs_from_mempool_nolock(block_t *block)
 {
-  assert(tx != NULL);
-  if (is_tx_in_mempool_nolock(tx) == 0)
+  assert(block != NULL);
+  if (g_mempool_num_transactions == 0)
   {
-    return 1;
+    return 0;
   }
 
-  mempool_entry_t *mempool_entry = get_mempool_entry_from_mempool(tx->id);
-  assert(mempool_entry != NULL);
+  mempool_template_entry_t *template_entries = malloc(sizeof(mempool_template_entry_t) * g_mempool_num_transactions);
+  assert(template_entries != NULL);
 
-  if (array_remove(g_mempool_transactions, mempool_entry, NULL) != CC_OK)
+  uint32_t num_template_entries = 0;
+  for (mempool_entry_t *mempool_entry = g_mempool_head_entry;
+    mempool_entry != NULL; mempool_entry = mempool_entry->next)
   {
-    return 1;
+    template_entries[num_template_entries].mempool_entry = mempool_entry;
+    template_entries[num_template_entries].index = num_template_entries;
+    num_template_entries++;
   }
 
-  g_mempool_num_transactions--;
-  free_mempool_entry(mempool_entry);
-  return 0;
-}
+  qsort(template_entries, num_template_entries, sizeof(mempool_template_entry_t), compare_mempool_template_entries);
 
-int remove_tx_from_mempool(transaction_t *tx)
-{
-  mtx_lock(&g_mempool_lock);
-  int result = remove_tx_from_mempool_nolock(tx);
-  mtx_unlock(&g_mempool_lock);
-  return result;
-}
+  // skip over the generation tx
+  uint32_t tx_index = block->transaction_count;
+  uint32_t block_header_size = get_block_header_size(block);
 
-transaction_t* pop_tx_from_mempool_nolock(void)
-{
-  void *val = NULL;
-  int r = array_remove_at(g_mempool_transactions, 0, &val);
-  assert(r == CC_OK);
+  for (uint32_t i = 0; i < num_template_entries; i++)
+  {
+    mempool_entry_t *mempool_entry = template_entries[i].mempool_entry;
+    transaction_t *tx = mempool_entry->tx;
+    assert(tx != NULL);
 
-  mempool_entry_t *mempool_entry = (mempool_entry_t*)val;
-  assert(mempool_entry != NULL);
+    // skip txs that would exceed the max block size, a smaller tx might still fit
+    if (block_header_size + mempool_entry->tx_size >= MAX_BLOCK_SIZE)
+    {
+      continue;
+    }
 
-  transaction_t *tx = mempool_entry->tx;
-  assert(tx != NULL);
+    transaction_t *block_tx = make_transaction();
+    int r = copy_transaction(tx, block_tx);
+    assert(r == 0);
+    r = add_transaction_to_block(block, block_tx, tx_index);
+    assert(r == 0);
 
-  g_mempool_num_transactions--;
-  free_mempool_entry(mempool_entry);
-  return tx;
+    block_header_size += mempool_entry->tx_size;
+    tx_index++;
+  }
+
+  free(template_entries);
+  return 0;
 }
 
-transaction_t* pop_tx_from_mempool(void)
+int fill_block_with_txs_from_mempool(block_t *block)
 {
+  assert(block != NULL);
   mtx_lock(&g_mempool_lock);
-  transaction_t *tx = pop_tx_from_mempool_nolock();
+  int result = fill_block_with_txs_from_mempool_nolock(block);
   mtx_unlock(&g_mempool_lock);
-  return tx;
-}
-
-uint64_t get_num_txs_in_mempool(void)
-{
-  return g_mempool_num_transactions;
+  return result;
 }
 
-int fill_block_with_txs_from_mempool_nolock(block_t *block)
+/*
+ * Fills in the missing txs of a compact block with copies of the matching txs in our mempool,
+ * every tx after the generation tx is identified by it's short id. The short ids are indexed
+ * once so that the mempool only has to be walked a single time. Returns the number of txs
+ * which could not be found, their slots in the block are left NULL.
+ */
+uint32_t fill_compact_block_txs_from_mempool_nolock(block_t *block, const uint8_t *short_ids)
 {
   assert(block != NULL);
+  assert(block->transactions != NULL);
+  if (block->transaction_count <= 1)
+  {
+    return 0;
+  }
 
-  // skip over the generation tx
-  uint32_t tx_index = 1;
+  assert(short_ids != NULL);
+  HashTableConf short_ids_conf;
+  hashtable_conf_init(&short_ids_conf);
+  short_ids_conf.key_length = COMPACT_BLOCK_SHORT_ID_SIZE;
+  short_ids_conf.hash = GENERAL_HASH;
+  short_ids_conf.key_compare = compare_compact_short_id;
+  short_ids_conf.initial_capacity = block->transaction_count;
 
-  void *val = NULL;
-  ARRAY_FOREACH(val, g_mempool_transactions,
+  HashTable *short_ids_table = NULL;
+  int r = hashtable_new_conf(&short_ids_conf, &short_ids_table);
+  assert(r == CC_OK);
+
+  for (uint32_t i = 1; i < block->transaction_count; i++)
   {
-    mempool_entry_t *mempool_entry = (mempool_entry_t*)val;
-    assert(mempool_entry != NULL);
+    if (block->transactions[i] != NULL)
+    {
+      continue;
+    }
+
+    // the short id points back into the short ids list, so it's
+    // offset in that list gives us the index of the tx in the block...
+    const uint8_t *short_id = short_ids + ((i - 1) * COMPACT_BLOCK_SHORT_ID_SIZE);
+    hashtable_add(short_ids_table, (void*)short_id, (void*)short_id);
+  }
 
+  for (mempool_entry_t *mempool_entry = g_mempool_head_entry;
+    mempool_entry != NULL && hashtable_size(short_ids_table) > 0; mempool_entry = mempool_entry->next)
+  {
     transaction_t *tx = mempool_entry->tx;
     assert(tx != NULL);
 
-    // check the new block header size
-    uint32_t block_header_size = get_block_header_size(block) + get_tx_header_size(tx);
-    if (block_header_size >= MAX_BLOCK_SIZE)
+    void *val = NULL;
+    if (hashtable_remove(short_ids_table, tx->id, &val) != CC_OK)
     {
-      break;
+      continue;
     }
 
-    int r = add_transaction_to_block(block, tx, tx_index);
-    assert(r == 0);
-    tx_index++;
-  })
+    uint32_t tx_index = (uint32_t)(((const uint8_t*)val - short_ids) / COMPACT_BLOCK_SHORT_ID_SIZE) + 1;
+    assert(tx_index < block->transaction_count);
+    assert(block->transactions[tx_index] == NULL);
 
-  return 0;
+    transaction_t *block_tx = make_transaction();
+    if (copy_transaction(tx, block_tx))
+    {
+      free_transaction(block_tx);
+      continue;
+    }
+
+    block->transactions[tx_index] = block_tx;
+  }
+
+  hashtable_destroy(short_ids_table);
+
+  // colliding short ids are left missing and requested from the peer
+  uint32_t num_missing_txs = 0;
+  for (uint32_t i = 1; i < block->transaction_count; i++)
+  {
+    if (block->transactions[i] == NULL)
+    {
+      num_missing_txs++;
+    }
+  }
+
+  return num_missing_txs;
 }
 
-int fill_block_with_txs_from_mempool(block_t *block)
+uint32_t fill_compact_block_txs_from_mempool(block_t *block, const uint8_t *short_ids)
 {
   assert(block != NULL);
   mtx_lock(&g_mempool_lock);
-  int result = fill_block_with_txs_from_mempool_nolock(block);
+  uint32_t num_missing_txs = fill_compact_block_txs_from_mempool_nolock(block, short_ids);
   mtx_unlock(&g_mempool_lock);
-  return result;
+  return num_missing_txs;
 }
 
+/*
+ * Clears the block's txs from the mempool along with the mempool txs which double spend
+ * any of the txouts the block's txs spend, those can never be included in a block now.
+ */
 int clear_txs_in_mempool_from_block_nolock(block_t *block)
 {
   assert(block != NULL);
@@ -268,9 +1141,42 @@ int clear_txs_in_mempool_from_block_nolock(block_t *block)
     transaction_t *tx = block->transactions[i];
     assert(tx != NULL);
 
-    remove_tx_from_mempool_nolock(tx);
+    // the block's own txs are owned by the block, only the mempool's copy is free'd
+    mempool_entry_t *block_mempool_entry = get_mempool_entry_from_mempool(tx->id);
+    if (block_mempool_entry != NULL)
+    {
+      transaction_t *mempool_tx = block_mempool_entry->tx;
+      remove_mempool_entry(block_mempool_entry);
+      if (mempool_tx != tx)
+      {
+        free_transaction(mempool_tx);
+      }
+    }
+
+    for (uint32_t j = 0; j < tx->txin_count; j++)
+    {
+      input_transaction_t *txin = tx->txins[j];
+      assert(txin != NULL);
+
+      mempool_entry_t *mempool_entry = get_mempool_entry_from_outpoint(txin->transaction, txin->txout_index);
+      if (mempool_entry == NULL)
+      {
+        continue;
+      }
+
+      transaction_t *conflicting_tx = mempool_entry->tx;
+      assert(conflicting_tx != NULL);
+
+      char *tx_hash_str = bin2hex(conflicting_tx->id, HASH_SIZE);
+      LOG_DEBUG("Removing transaction: %s from mempool due to a double spend in a block!", tx_hash_str);
+      free(tx_hash_str);
+
+      remove_mempool_entry(mempool_entry);
+      free_transaction(conflicting_tx);
+    }
   }
 
+  atomic_fetch_add_explicit(&g_mempool_block_generation, 1, memory_order_release);
   return 0;
 }
 
@@ -285,16 +1191,10 @@ int clear_txs_in_mempool_from_block(block_t *block)
 
 int clear_expired_txs_in_mempool_nolock(void)
 {
-  Array *txs_to_remove;
-  int r = array_new(&txs_to_remove);
-  assert(r == CC_OK);
-
-  void *val = NULL;
-  ARRAY_FOREACH(val, g_mempool_transactions,
+  mempool_entry_t *mempool_entry = g_mempool_head_entry;
+  while (mempool_entry != NULL)
   {
-    mempool_entry_t *mempool_entry = (mempool_entry_t*)val;
-    assert(mempool_entry != NULL);
-
+    mempool_entry_t *next_mempool_entry = mempool_entry->next;
     transaction_t *tx = mempool_entry->tx;
     assert(tx != NULL);
 
@@ -314,23 +1214,13 @@ int clear_expired_txs_in_mempool_nolock(void)
 
     if (remove_tx)
     {
-      r = array_add(txs_to_remove, tx);
-      assert(r == CC_OK);
+      remove_mempool_entry(mempool_entry);
+      free_transaction(tx);
     }
-  })
-
-  val = NULL;
-  ARRAY_FOREACH(val, txs_to_remove,
-  {
-    transaction_t *tx = (transaction_t*)val;
-    assert(tx != NULL);
 
-    r = remove_tx_from_mempool_nolock(tx);
-    assert(r == 0);
-    free_transaction(tx);
-  })
+    mempool_entry = next_mempool_entry;
+  }
 
-  array_destroy(txs_to_remove);
   return 0;
 }
 
@@ -354,6 +1244,232 @@ int clear_expired_txs_in_mempool(void)
   return result;
 }
 
+/*
+ * Writes the mempool's txs in the order they were received in, along with
+ * the time each one was received at so their age carries over a restart.
+ */
+static int serialize_mempool_nolock(buffer_t *buffer)
+{
+  assert(buffer != NULL);
+  if (buffer_write_uint32(buffer, MEMPOOL_STORAGE_VERSION) ||
+      buffer_write_uint32(buffer, (uint32_t)g_mempool_num_transactions))
+  {
+    return 1;
+  }
+
+  for (mempool_entry_t *mempool_entry = g_mempool_head_entry; mempool_entry != NULL;
+    mempool_entry = mempool_entry->next)
+  {
+    assert(mempool_entry->tx != NULL);
+    if (buffer_write_uint32(buffer, mempool_entry->received_ts) ||
+        serialize_transaction(buffer, mempool_entry->tx))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int serialize_mempool(buffer_t *buffer)
+{
+  mtx_lock(&g_mempool_lock);
+  int result = serialize_mempool_nolock(buffer);
+  mtx_unlock(&g_mempool_lock);
+  return result;
+}
+
+/*
+ * Adds the tx read back from storage keeping the time it was first received at,
+ * the tx is validated against the current UTXO set before taking the mempool lock.
+ */
+static int add_stored_tx_to_mempool(transaction_t *tx, uint32_t received_ts)
+{
+  assert(tx != NULL);
+  if (get_current_time() - received_ts > MEMPOOL_TX_EXPIRE_TIME)
+  {
+    return 1;
+  }
+
+  uint64_t block_generation = get_mempool_block_generation();
+  if (valid_transaction(tx) == 0)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_mempool_lock);
+  if (add_validated_tx_to_mempool_nolock(tx, block_generation))
+  {
+    mtx_unlock(&g_mempool_lock);
+    return 1;
+  }
+
+  mempool_entry_t *mempool_entry = get_mempool_entry_from_mempool(tx->id);
+  assert(mempool_entry != NULL);
+  mempool_entry->received_ts = received_ts;
+  update_mempool_eviction_entry(mempool_entry);
+  mtx_unlock(&g_mempool_lock);
+  return 0;
+}
+
+/*
+ * Reads txs written by `serialize_mempool` back into the mempool, txs which have since
+ * been mined, double spent or expired are dropped. Returns 1 if the data is malformed,
+ * the txs read before the malformed tx are kept.
+ */
+int deserialize_mempool(buffer_iterator_t *buffer_iterator, uint32_t *num_loaded_txs_out)
+{
+  assert(buffer_iterator != NULL);
+  uint32_t version = 0;
+  uint32_t num_txs = 0;
+  if (buffer_read_uint32(buffer_iterator, &version) ||
+      buffer_read_uint32(buffer_iterator, &num_txs))
+  {
+    return 1;
+  }
+
+  if (version != MEMPOOL_STORAGE_VERSION)
+  {
+    LOG_WARNING("Unknown mempool storage version: %u!", version);
+    return 1;
+  }
+
+  uint32_t num_loaded_txs = 0;
+  int result = 0;
+  for (uint32_t i = 0; i < num_txs && g_mempool_reload_cancelled == 0; i++)
+  {
+    uint32_t received_ts = 0;
+    transaction_t *tx = NULL;
+    if (buffer_read_uint32(buffer_iterator, &received_ts) ||
+        deserialize_transaction(buffer_iterator, &tx))
+    {
+      result = 1;
+      break;
+    }
+
+    if (add_stored_tx_to_mempool(tx, received_ts))
+    {
+      free_transaction(tx);
+      continue;
+    }
+
+    num_loaded_txs++;
+  }
+
+  if (num_loaded_txs_out != NULL)
+  {
+    *num_loaded_txs_out = num_loaded_txs;
+  }
+
+  return result;
+}
+
+/*
+ * Saves the mempool to it's storage file, the mempool is serialized under the lock
+ * and written out without it. The file is written next to the storage file and then
+ * renamed over it, so a crash while saving never leaves a truncated mempool behind.
+ */
+int save_mempool_storage(void)
+{
+  buffer_t *buffer = buffer_make();
+  if (serialize_mempool(buffer))
+  {
+    buffer_free(buffer);
+    return 1;
+  }
+
+  char temp_filename[FILENAME_MAX];
+  snprintf(temp_filename, sizeof(temp_filename), "%s.tmp", g_mempool_storage_filename);
+
+  char *err = NULL;
+  buffer_storage_t *buffer_storage = buffer_storage_open_mode(temp_filename, "wb", &err);
+  if (buffer_storage == NULL)
+  {
+    LOG_ERROR("Failed to save mempool storage: %s", err);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  int result = buffer_storage_write_buffer(buffer_storage, buffer, &err);
+  if (buffer_storage_close(buffer_storage))
+  {
+    result = 1;
+  }
+
+  buffer_storage_free(buffer_storage);
+  buffer_free(buffer);
+  if (result || rename(temp_filename, g_mempool_storage_filename) != 0)
+  {
+    LOG_ERROR("Failed to save mempool storage: %s", g_mempool_storage_filename);
+    remove(temp_filename);
+    return 1;
+  }
+
+  return 0;
+}
+
+int load_mempool_storage(void)
+{
+  // a node which never saved it's mempool has nothing to reload
+  char *err = NULL;
+  buffer_storage_t *buffer_storage = buffer_storage_open_mode(g_mempool_storage_filename, "rb", &err);
+  if (buffer_storage == NULL)
+  {
+    return 0;
+  }
+
+  buffer_t *buffer = NULL;
+  int result = buffer_storage_read_buffer(buffer_storage, &buffer, &err);
+  buffer_storage_close(buffer_storage);
+  buffer_storage_free(buffer_storage);
+  if (result)
+  {
+    LOG_ERROR("Failed to load mempool storage: %s", err);
+    return 1;
+  }
+
+  uint32_t num_loaded_txs = 0;
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  result = deserialize_mempool(buffer_iterator, &num_loaded_txs);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  if (result)
+  {
+    LOG_WARNING("Mempool storage: %s is malformed, stopped reloading it!", g_mempool_storage_filename);
+  }
+
+  LOG_INFO("Reloaded [%u] transactions into the mempool from storage.", num_loaded_txs);
+  return result;
+}
+
+static void reload_mempool_storage(void *arg)
+{
+  load_mempool_storage();
+  g_mempool_reloaded = g_mempool_reload_cancelled == 0;
+}
+
+/*
+ * The mempool is started before the blockchain is opened, so the txs are reloaded from
+ * the first task manager tick onwards and validated on the task schedulers without
+ * holding up the network thread.
+ */
+static task_result_t reload_mempool(task_t *task, va_list args)
+{
+  g_mempool_reload_task = NULL;
+  assert(add_job(reload_mempool_storage, NULL, &g_mempool_reload_job_group) == 0);
+  return TASK_RESULT_DONE;
+}
+
+static task_result_t save_mempool(task_t *task, va_list args)
+{
+  if (g_mempool_reloaded)
+  {
+    save_mempool_storage();
+  }
+
+  return TASK_RESULT_WAIT;
+}
+
 static task_result_t flush_mempool(task_t *task, va_list args)
 {
   int r = clear_expired_txs_in_mempool_noblock();
@@ -361,6 +1477,18 @@ static task_result_t flush_mempool(task_t *task, va_list args)
   return TASK_RESULT_WAIT;
 }
 
+static void write_mempool_metrics(buffer_t *buffer)
+{
+  write_metric_header(buffer, "vulkan_mempool_transactions", "Transactions waiting in the mempool", "gauge");
+  write_metric_value(buffer, "vulkan_mempool_transactions", NULL, NULL, get_num_txs_in_mempool());
+
+  write_metric_header(buffer, "vulkan_mempool_memory_bytes", "Memory held by the mempool's transactions", "gauge");
+  write_metric_value(buffer, "vulkan_mempool_memory_bytes", NULL, NULL, get_mempool_memory_size());
+
+  write_metric_header(buffer, "vulkan_mempool_evicted_transactions_total", "Transactions evicted from the full mempool", "counter");
+  write_metric_value(buffer, "vulkan_mempool_evicted_transactions_total", NULL, NULL, get_mempool_num_evicted_txs());
+}
+
 int start_mempool(void)
 {
   if (g_mempool_initialized)
@@ -370,11 +1498,39 @@ int start_mempool(void)
 
   mtx_init(&g_mempool_lock, mtx_recursive);
 
-  int r = array_new(&g_mempool_transactions);
+  HashTableConf mempool_conf;
+  hashtable_conf_init(&mempool_conf);
+  mempool_conf.key_length = HASH_SIZE;
+  mempool_conf.hash = GENERAL_HASH;
+  mempool_conf.key_compare = compare_mempool_tx_id;
+
+  int r = hashtable_new_conf(&mempool_conf, &g_mempool_transactions);
+  assert(r == CC_OK);
+
+  HashTableConf outpoints_conf;
+  hashtable_conf_init(&outpoints_conf);
+  outpoints_conf.key_length = MEMPOOL_OUTPOINT_SIZE;
+  outpoints_conf.hash = GENERAL_HASH;
+  outpoints_conf.key_compare = compare_mempool_outpoint;
+
+  r = hashtable_new_conf(&outpoints_conf, &g_mempool_outpoints);
   assert(r == CC_OK);
 
+  g_mempool_head_entry = NULL;
+  g_mempool_tail_entry = NULL;
   g_mempool_num_transactions = 0;
+  g_mempool_memory_size = 0;
+  g_mempool_peak_memory_size = 0;
+  g_mempool_num_evicted_txs = 0;
+  atomic_store_explicit(&g_mempool_block_generation, 0, memory_order_release);
   g_mempool_flush_task = add_task(flush_mempool, FLUSH_MEMPOOL_TASK_DELAY);
+
+  init_job_group(&g_mempool_reload_job_group);
+  g_mempool_reload_cancelled = 0;
+  g_mempool_reloaded = 0;
+  g_mempool_reload_task = add_task(reload_mempool, 0);
+  g_mempool_save_task = add_task(save_mempool, SAVE_MEMPOOL_STORAGE_DELAY);
+  register_metrics_collector(write_mempool_metrics);
   g_mempool_initialized = 1;
   return 0;
 }
@@ -387,11 +1543,51 @@ int stop_mempool(void)
   }
 
   remove_task(g_mempool_flush_task);
+  remove_task(g_mempool_save_task);
+  if (g_mempool_reload_task != NULL)
+  {
+    remove_task(g_mempool_reload_task);
+    g_mempool_reload_task = NULL;
+  }
+
+  // stop reloading the mempool, the storage file is left as it is if the reload never finished
+  g_mempool_reload_cancelled = 1;
+  wait_job_group(&g_mempool_reload_job_group);
+  free_job_group(&g_mempool_reload_job_group);
+  if (g_mempool_reloaded)
+  {
+    save_mempool_storage();
+  }
+
+  unregister_metrics_collector(write_mempool_metrics);
   mtx_destroy(&g_mempool_lock);
-  array_destroy(g_mempool_transactions);
 
+  mempool_entry_t *mempool_entry = g_mempool_head_entry;
+  while (mempool_entry != NULL)
+  {
+    mempool_entry_t *next_mempool_entry = mempool_entry->next;
+    free_mempool_entry(mempool_entry);
+    mempool_entry = next_mempool_entry;
+  }
+
+  hashtable_destroy(g_mempool_transactions);
+  g_mempool_transactions = NULL;
+
+  hashtable_destroy(g_mempool_outpoints);
+  g_mempool_outpoints = NULL;
+
+  free(g_mempool_eviction_heap);
+  g_mempool_eviction_heap = NULL;
+  g_mempool_eviction_heap_size = 0;
+  g_mempool_eviction_heap_capacity = 0;
+
+  g_mempool_head_entry = NULL;
+  g_mempool_tail_entry = NULL;
   g_mempool_num_transactions = 0;
+  g_mempool_memory_size = 0;
   g_mempool_flush_task = NULL;
+  g_mempool_save_task = NULL;
+  g_mempool_reloaded = 0;
   g_mempool_initialized = 0;
   return 0;
 }
@@ -28,6 +28,8 @@
 #include <stdint.h>
 #include <time.h>
 
+#include "common/buffer.h"
+#include "common/buffer_iterator.h"
 #include "common/task.h"
 #include "common/vulkan.h"
 
@@ -39,24 +41,62 @@ VULKAN_BEGIN_DECL
 
 #define FLUSH_MEMPOOL_TASK_DELAY 60
 
+// the mempool is saved to it's storage file on this interval and on shutdown,
+// and reloaded in the background once the node has started...
+#define SAVE_MEMPOOL_STORAGE_DELAY (60 * 5)
+#define MEMPOOL_STORAGE_VERSION 1
+
+// compact blocks identify their txs by this many leading bytes of the tx id
+#define COMPACT_BLOCK_SHORT_ID_SIZE 8
+
+// a spent outpoint is the previous tx id followed by the txout index it spends
+#define MEMPOOL_OUTPOINT_SIZE (HASH_SIZE + sizeof(uint32_t))
+
 typedef struct MempoolEntry
 {
   transaction_t *tx;
   uint32_t received_ts;
+
+  // computed once when the tx is added to the mempool
+  uint64_t fee;
+  uint32_t tx_size;
+  uint64_t fee_rate;
+
+  // the memory held by the entry, it's tx and the index entries pointing at it
+  size_t memory_size;
+
+  // orders entries received in the same second, and the entry's place in the eviction heap
+  uint64_t sequence;
+  uint32_t eviction_index;
+
+  // the outpoints spent by the tx's txins, used as the keys of the spent outpoint index
+  uint8_t *outpoints;
+  uint32_t num_outpoints;
+
+  // entries are linked in the order they were received in
+  struct MempoolEntry *prev;
+  struct MempoolEntry *next;
 } mempool_entry_t;
 
 VULKAN_API mempool_entry_t* init_mempool_entry(void);
 VULKAN_API void free_mempool_entry(mempool_entry_t *mempool_entry);
 
 VULKAN_API mempool_entry_t* get_mempool_entry_from_mempool(uint8_t *tx_hash);
+VULKAN_API mempool_entry_t* get_mempool_entry_from_outpoint(uint8_t *tx_hash, uint32_t txout_index);
 VULKAN_API transaction_t* get_tx_from_mempool(uint8_t *tx_hash);
+VULKAN_API transaction_t* copy_tx_from_mempool(uint8_t *tx_hash);
+VULKAN_API uint32_t get_mempool_tx_ids(uint8_t *tx_ids, uint32_t max_tx_ids);
 
 VULKAN_API int is_tx_in_mempool_nolock(transaction_t *tx);
 VULKAN_API int is_tx_in_mempool(transaction_t *tx);
+VULKAN_API int is_tx_id_in_mempool(uint8_t *tx_hash);
 
 VULKAN_API int add_tx_to_mempool_nolock(transaction_t *tx);
 VULKAN_API int add_tx_to_mempool(transaction_t *tx);
 
+VULKAN_API int add_validated_tx_to_mempool_nolock(transaction_t *tx, uint64_t block_generation);
+VULKAN_API int add_validated_tx_to_mempool(transaction_t *tx, uint64_t block_generation);
+
 VULKAN_API int validate_and_add_tx_to_mempool_nolock(transaction_t *tx);
 VULKAN_API int validate_and_add_tx_to_mempool(transaction_t *tx);
 
@@ -68,9 +108,23 @@ VULKAN_API transaction_t* pop_tx_from_mempool(void);
 
 VULKAN_API uint64_t get_num_txs_in_mempool(void);
 
+VULKAN_API void set_mempool_max_memory_size(size_t max_memory_size);
+VULKAN_API size_t get_mempool_max_memory_size(void);
+
+VULKAN_API size_t get_mempool_memory_size(void);
+VULKAN_API size_t get_mempool_peak_memory_size(void);
+VULKAN_API uint64_t get_mempool_num_evicted_txs(void);
+VULKAN_API void print_mempool_stats(void);
+
+VULKAN_API uint64_t get_mempool_generation(void);
+VULKAN_API uint64_t get_mempool_block_generation(void);
+
 VULKAN_API int fill_block_with_txs_from_mempool_nolock(block_t *block);
 VULKAN_API int fill_block_with_txs_from_mempool(block_t *block);
 
+VULKAN_API uint32_t fill_compact_block_txs_from_mempool_nolock(block_t *block, const uint8_t *short_ids);
+VULKAN_API uint32_t fill_compact_block_txs_from_mempool(block_t *block, const uint8_t *short_ids);
+
 VULKAN_API int clear_txs_in_mempool_from_block_nolock(block_t *block);
 VULKAN_API int clear_txs_in_mempool_from_block(block_t *block);
 
@@ -78,6 +132,15 @@ VULKAN_API int clear_expired_txs_in_mempool_nolock(void);
 VULKAN_API int clear_expired_txs_in_mempool_noblock(void);
 VULKAN_API int clear_expired_txs_in_mempool(void);
 
+VULKAN_API void set_mempool_storage_filename(const char *storage_filename);
+VULKAN_API const char* get_mempool_storage_filename(void);
+
+VULKAN_API int serialize_mempool(buffer_t *buffer);
+VULKAN_API int deserialize_mempool(buffer_iterator_t *buffer_iterator, uint32_t *num_loaded_txs_out);
+
+VULKAN_API int save_mempool_storage(void);
+VULKAN_API int load_mempool_storage(void);
+
 VULKAN_API int start_mempool(void);
 VULKAN_API int stop_mempool(void);
 
@@ -0,0 +1,505 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <hashtable.h>
+
+#include "common/logger.h"
+#include "common/task.h"
+#include "common/tinycthread.h"
+
+#include "mempool.h"
+#include "mempool_ingress.h"
+#include "transaction.h"
+
+// txs are deduplicated by their id as soon as they arrive, only the final insertion
+// into the mempool happens under the mempool lock. The ingress queue is locked on
+// it's own so the network thread never waits on a tx being validated...
+static int g_mempool_ingress_running = 0;
+static int g_mempool_ingress_paused = 0;
+static mtx_t g_mempool_ingress_lock;
+static job_group_t g_mempool_ingress_job_group;
+static uint32_t g_mempool_ingress_num_running_jobs = 0;
+
+// every queued, validating and admitted tx has an entry in the tx ids table
+static HashTable *g_mempool_ingress_tx_ids = NULL;
+static uint32_t g_mempool_ingress_num_entries = 0;
+static uint32_t g_mempool_ingress_num_queued_txs = 0;
+
+static HashTable *g_mempool_ingress_sources = NULL;
+static mempool_ingress_source_t *g_mempool_ingress_next_source = NULL;
+
+// the txs which made it into the mempool, waiting to be announced to our peers
+static mempool_ingress_entry_t *g_mempool_ingress_admitted_head = NULL;
+static mempool_ingress_entry_t *g_mempool_ingress_admitted_tail = NULL;
+
+static int compare_mempool_ingress_tx_id(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, HASH_SIZE);
+}
+
+static int compare_mempool_ingress_source(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, sizeof(const void*));
+}
+
+int get_is_mempool_ingress_running(void)
+{
+  return g_mempool_ingress_running;
+}
+
+uint32_t get_num_queued_mempool_ingress_txs(void)
+{
+  mtx_lock(&g_mempool_ingress_lock);
+  uint32_t num_queued_txs = g_mempool_ingress_num_queued_txs;
+  mtx_unlock(&g_mempool_ingress_lock);
+  return num_queued_txs;
+}
+
+static mempool_ingress_source_t* get_mempool_ingress_source_nolock(const void *source)
+{
+  void *val = NULL;
+  if (hashtable_get(g_mempool_ingress_sources, &source, &val) != CC_OK)
+  {
+    return NULL;
+  }
+
+  return (mempool_ingress_source_t*)val;
+}
+
+static mempool_ingress_source_t* add_mempool_ingress_source_nolock(const void *source)
+{
+  mempool_ingress_source_t *ingress_source = malloc(sizeof(mempool_ingress_source_t));
+  assert(ingress_source != NULL);
+  ingress_source->source = source;
+  ingress_source->num_queued_txs = 0;
+  ingress_source->head_entry = NULL;
+  ingress_source->tail_entry = NULL;
+
+  // the source is linked in right before the next source, so it gets it's turn last
+  if (g_mempool_ingress_next_source == NULL)
+  {
+    ingress_source->prev = ingress_source;
+    ingress_source->next = ingress_source;
+    g_mempool_ingress_next_source = ingress_source;
+  }
+  else
+  {
+    ingress_source->next = g_mempool_ingress_next_source;
+    ingress_source->prev = g_mempool_ingress_next_source->prev;
+    ingress_source->prev->next = ingress_source;
+    g_mempool_ingress_next_source->prev = ingress_source;
+  }
+
+  // the key points at the source stored in the entry itself
+  assert(hashtable_add(g_mempool_ingress_sources, &ingress_source->source, ingress_source) == CC_OK);
+  return ingress_source;
+}
+
+static void remove_mempool_ingress_source_nolock(mempool_ingress_source_t *ingress_source)
+{
+  assert(ingress_source != NULL);
+  assert(hashtable_remove(g_mempool_ingress_sources, &ingress_source->source, NULL) == CC_OK);
+  if (ingress_source->next == ingress_source)
+  {
+    g_mempool_ingress_next_source = NULL;
+  }
+  else
+  {
+    ingress_source->prev->next = ingress_source->next;
+    ingress_source->next->prev = ingress_source->prev;
+    if (g_mempool_ingress_next_source == ingress_source)
+    {
+      g_mempool_ingress_next_source = ingress_source->next;
+    }
+  }
+
+  free(ingress_source);
+}
+
+static void free_mempool_ingress_entry_nolock(mempool_ingress_entry_t *entry)
+{
+  assert(entry != NULL);
+  assert(hashtable_remove(g_mempool_ingress_tx_ids, entry->tx_id, NULL) == CC_OK);
+  if (entry->tx != NULL)
+  {
+    free_transaction(entry->tx);
+  }
+
+  g_mempool_ingress_num_entries--;
+  free(entry);
+}
+
+/*
+ * Takes the oldest queued tx of the next source in turn, so that every source with
+ * queued txs gets one of it's txs validated before any source gets a second one.
+ */
+static mempool_ingress_entry_t* take_next_mempool_ingress_entry_nolock(void)
+{
+  mempool_ingress_source_t *ingress_source = g_mempool_ingress_next_source;
+  if (ingress_source == NULL)
+  {
+    return NULL;
+  }
+
+  mempool_ingress_entry_t *entry = ingress_source->head_entry;
+  assert(entry != NULL);
+  ingress_source->head_entry = entry->next;
+  if (ingress_source->head_entry == NULL)
+  {
+    ingress_source->tail_entry = NULL;
+  }
+
+  entry->next = NULL;
+  ingress_source->num_queued_txs--;
+  g_mempool_ingress_num_queued_txs--;
+
+  g_mempool_ingress_next_source = ingress_source->next;
+  if (ingress_source->num_queued_txs == 0)
+  {
+    remove_mempool_ingress_source_nolock(ingress_source);
+  }
+
+  return entry;
+}
+
+static void admit_mempool_ingress_txs(void *arg)
+{
+  mtx_lock(&g_mempool_ingress_lock);
+  mempool_ingress_entry_t *entry = NULL;
+  while (g_mempool_ingress_running && g_mempool_ingress_paused == 0 &&
+         (entry = take_next_mempool_ingress_entry_nolock()) != NULL)
+  {
+    mtx_unlock(&g_mempool_ingress_lock);
+
+    // the signatures and txins are checked without holding either lock, the mempool
+    // validates the tx again on insertion if a block connected in the mean time...
+    transaction_t *tx = entry->tx;
+    assert(tx != NULL);
+    uint64_t block_generation = get_mempool_block_generation();
+    int result = 1;
+    if (is_coinbase_tx(tx) == 0 && valid_transaction(tx))
+    {
+      result = add_validated_tx_to_mempool(tx, block_generation);
+    }
+
+    mtx_lock(&g_mempool_ingress_lock);
+    if (result)
+    {
+      free_mempool_ingress_entry_nolock(entry);
+      continue;
+    }
+
+    // the mempool owns the tx now, only it's id is kept to announce it
+    entry->tx = NULL;
+    if (g_mempool_ingress_admitted_tail != NULL)
+    {
+      g_mempool_ingress_admitted_tail->next = entry;
+    }
+    else
+    {
+      g_mempool_ingress_admitted_head = entry;
+    }
+
+    g_mempool_ingress_admitted_tail = entry;
+  }
+
+  g_mempool_ingress_num_running_jobs--;
+  mtx_unlock(&g_mempool_ingress_lock);
+}
+
+/*
+ * Queues the tx received from the source to be validated and added to the mempool, the
+ * source is only used to keep the queue fair and is never dereferenced. Takes ownership
+ * of the tx and returns 0 if it was queued, returns 1 if the tx is already queued or in
+ * the mempool, or if the source or the queue are full.
+ */
+int queue_mempool_ingress_tx(const void *source, transaction_t *tx)
+{
+  assert(tx != NULL);
+  if (g_mempool_ingress_running == 0)
+  {
+    return 1;
+  }
+
+  if (is_tx_in_mempool(tx))
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_mempool_ingress_lock);
+  if (hashtable_contains_key(g_mempool_ingress_tx_ids, tx->id))
+  {
+    mtx_unlock(&g_mempool_ingress_lock);
+    return 1;
+  }
+
+  if (g_mempool_ingress_num_entries >= MEMPOOL_INGRESS_MAX_QUEUED_TXS)
+  {
+    mtx_unlock(&g_mempool_ingress_lock);
+    LOG_DEBUG("Dropping incoming transaction, the mempool ingress queue is full!");
+    return 1;
+  }
+
+  mempool_ingress_source_t *ingress_source = get_mempool_ingress_source_nolock(source);
+  if (ingress_source != NULL && ingress_source->num_queued_txs >= MEMPOOL_INGRESS_MAX_QUEUED_TXS_PER_SOURCE)
+  {
+    mtx_unlock(&g_mempool_ingress_lock);
+    return 1;
+  }
+
+  if (ingress_source == NULL)
+  {
+    ingress_source = add_mempool_ingress_source_nolock(source);
+  }
+
+  mempool_ingress_entry_t *entry = malloc(sizeof(mempool_ingress_entry_t));
+  assert(entry != NULL);
+  memcpy(entry->tx_id, tx->id, HASH_SIZE);
+  entry->tx = tx;
+  entry->source = source;
+  entry->next = NULL;
+
+  assert(hashtable_add(g_mempool_ingress_tx_ids, entry->tx_id, entry) == CC_OK);
+  if (ingress_source->tail_entry != NULL)
+  {
+    ingress_source->tail_entry->next = entry;
+  }
+  else
+  {
+    ingress_source->head_entry = entry;
+  }
+
+  ingress_source->tail_entry = entry;
+  ingress_source->num_queued_txs++;
+  g_mempool_ingress_num_queued_txs++;
+  g_mempool_ingress_num_entries++;
+
+  // each admission job drains the queue until it is empty, so only start another
+  // job if there are fewer running than there are schedulers to run them on...
+  uint32_t max_running_jobs = get_num_task_schedulers() > 0 ? get_num_task_schedulers() : 1;
+  int start_job = g_mempool_ingress_paused == 0 && g_mempool_ingress_num_running_jobs < max_running_jobs;
+  if (start_job)
+  {
+    g_mempool_ingress_num_running_jobs++;
+  }
+
+  mtx_unlock(&g_mempool_ingress_lock);
+  if (start_job)
+  {
+    assert(add_job(admit_mempool_ingress_txs, NULL, &g_mempool_ingress_job_group) == 0);
+  }
+
+  return 0;
+}
+
+/*
+ * Copies the ids and sources of up to max txs which were admitted into the mempool since
+ * the last call, in the order they were admitted in. Returns the number of txs copied.
+ */
+uint32_t take_admitted_mempool_ingress_txs(uint8_t *tx_ids, const void **sources, uint32_t max_txs)
+{
+  assert(tx_ids != NULL);
+  assert(sources != NULL);
+  if (g_mempool_ingress_running == 0)
+  {
+    return 0;
+  }
+
+  uint32_t num_txs = 0;
+  mtx_lock(&g_mempool_ingress_lock);
+  while (g_mempool_ingress_admitted_head != NULL && num_txs < max_txs)
+  {
+    mempool_ingress_entry_t *entry = g_mempool_ingress_admitted_head;
+    g_mempool_ingress_admitted_head = entry->next;
+    if (g_mempool_ingress_admitted_head == NULL)
+    {
+      g_mempool_ingress_admitted_tail = NULL;
+    }
+
+    memcpy(tx_ids + (num_txs * HASH_SIZE), entry->tx_id, HASH_SIZE);
+    sources[num_txs] = entry->source;
+    num_txs++;
+
+    free_mempool_ingress_entry_nolock(entry);
+  }
+
+  mtx_unlock(&g_mempool_ingress_lock);
+  return num_txs;
+}
+
+/*
+ * Stops the admission jobs from taking queued txs, the txs queued while paused wait
+ * in the queue until it is resumed. Waits for the tx being validated to be admitted.
+ */
+int pause_mempool_ingress(void)
+{
+  if (g_mempool_ingress_running == 0 || g_mempool_ingress_paused)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_mempool_ingress_lock);
+  g_mempool_ingress_paused = 1;
+  mtx_unlock(&g_mempool_ingress_lock);
+  wait_job_group(&g_mempool_ingress_job_group);
+  return 0;
+}
+
+/*
+ * Resumes taking queued txs, a single admission job is started to drain the txs queued
+ * while paused, so they are admitted in the order the sources take turns in...
+ */
+int resume_mempool_ingress(void)
+{
+  if (g_mempool_ingress_running == 0 || g_mempool_ingress_paused == 0)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_mempool_ingress_lock);
+  g_mempool_ingress_paused = 0;
+  int start_job = g_mempool_ingress_num_queued_txs > 0 && g_mempool_ingress_num_running_jobs == 0;
+  if (start_job)
+  {
+    g_mempool_ingress_num_running_jobs++;
+  }
+
+  mtx_unlock(&g_mempool_ingress_lock);
+  if (start_job)
+  {
+    assert(add_job(admit_mempool_ingress_txs, NULL, &g_mempool_ingress_job_group) == 0);
+  }
+
+  return 0;
+}
+
+/*
+ * Waits until the running admission jobs have drained the queue.
+ */
+int wait_mempool_ingress(void)
+{
+  if (g_mempool_ingress_running == 0)
+  {
+    return 1;
+  }
+
+  wait_job_group(&g_mempool_ingress_job_group);
+  return 0;
+}
+
+int start_mempool_ingress(void)
+{
+  if (g_mempool_ingress_running)
+  {
+    return 1;
+  }
+
+  mtx_init(&g_mempool_ingress_lock, mtx_plain);
+  init_job_group(&g_mempool_ingress_job_group);
+
+  HashTableConf tx_ids_conf;
+  hashtable_conf_init(&tx_ids_conf);
+  tx_ids_conf.key_length = HASH_SIZE;
+  tx_ids_conf.hash = GENERAL_HASH;
+  tx_ids_conf.key_compare = compare_mempool_ingress_tx_id;
+
+  int r = hashtable_new_conf(&tx_ids_conf, &g_mempool_ingress_tx_ids);
+  assert(r == CC_OK);
+
+  HashTableConf sources_conf;
+  hashtable_conf_init(&sources_conf);
+  sources_conf.key_length = sizeof(const void*);
+  sources_conf.hash = GENERAL_HASH;
+  sources_conf.key_compare = compare_mempool_ingress_source;
+
+  r = hashtable_new_conf(&sources_conf, &g_mempool_ingress_sources);
+  assert(r == CC_OK);
+
+  g_mempool_ingress_num_running_jobs = 0;
+  g_mempool_ingress_num_entries = 0;
+  g_mempool_ingress_num_queued_txs = 0;
+  g_mempool_ingress_next_source = NULL;
+  g_mempool_ingress_admitted_head = NULL;
+  g_mempool_ingress_admitted_tail = NULL;
+  g_mempool_ingress_paused = 0;
+  g_mempool_ingress_running = 1;
+  return 0;
+}
+
+int stop_mempool_ingress(void)
+{
+  if (g_mempool_ingress_running == 0)
+  {
+    return 1;
+  }
+
+  // the running jobs finish the tx they are validating and then stop
+  mtx_lock(&g_mempool_ingress_lock);
+  g_mempool_ingress_running = 0;
+  mtx_unlock(&g_mempool_ingress_lock);
+  wait_job_group(&g_mempool_ingress_job_group);
+
+  mtx_lock(&g_mempool_ingress_lock);
+  while (g_mempool_ingress_next_source != NULL)
+  {
+    mempool_ingress_source_t *ingress_source = g_mempool_ingress_next_source;
+    mempool_ingress_entry_t *entry = ingress_source->head_entry;
+    while (entry != NULL)
+    {
+      mempool_ingress_entry_t *next_entry = entry->next;
+      free_mempool_ingress_entry_nolock(entry);
+      entry = next_entry;
+    }
+
+    remove_mempool_ingress_source_nolock(ingress_source);
+  }
+
+  mempool_ingress_entry_t *entry = g_mempool_ingress_admitted_head;
+  while (entry != NULL)
+  {
+    mempool_ingress_entry_t *next_entry = entry->next;
+    free_mempool_ingress_entry_nolock(entry);
+    entry = next_entry;
+  }
+
+  assert(g_mempool_ingress_num_entries == 0);
+  hashtable_destroy(g_mempool_ingress_tx_ids);
+  hashtable_destroy(g_mempool_ingress_sources);
+  g_mempool_ingress_tx_ids = NULL;
+  g_mempool_ingress_sources = NULL;
+  g_mempool_ingress_admitted_head = NULL;
+  g_mempool_ingress_admitted_tail = NULL;
+  g_mempool_ingress_num_queued_txs = 0;
+  mtx_unlock(&g_mempool_ingress_lock);
+
+  free_job_group(&g_mempool_ingress_job_group);
+  mtx_destroy(&g_mempool_ingress_lock);
+  return 0;
+}
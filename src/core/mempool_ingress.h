@@ -0,0 +1,75 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+#include "transaction.h"
+
+VULKAN_BEGIN_DECL
+
+// incoming txs wait in the ingress queue while they are validated on the task schedulers,
+// the queue is bounded overall and per source so one chatty peer can't starve the others...
+#define MEMPOOL_INGRESS_MAX_QUEUED_TXS 4096
+#define MEMPOOL_INGRESS_MAX_QUEUED_TXS_PER_SOURCE 256
+
+typedef struct MempoolIngressEntry
+{
+  uint8_t tx_id[HASH_SIZE];
+  transaction_t *tx;
+  const void *source;
+  struct MempoolIngressEntry *next;
+} mempool_ingress_entry_t;
+
+// the txs queued by a single source, sources with queued txs are
+// linked in a ring which the admission jobs take txs from in turn
+typedef struct MempoolIngressSource
+{
+  const void *source;
+  uint32_t num_queued_txs;
+  mempool_ingress_entry_t *head_entry;
+  mempool_ingress_entry_t *tail_entry;
+
+  struct MempoolIngressSource *prev;
+  struct MempoolIngressSource *next;
+} mempool_ingress_source_t;
+
+VULKAN_API int get_is_mempool_ingress_running(void);
+VULKAN_API uint32_t get_num_queued_mempool_ingress_txs(void);
+
+VULKAN_API int queue_mempool_ingress_tx(const void *source, transaction_t *tx);
+VULKAN_API uint32_t take_admitted_mempool_ingress_txs(uint8_t *tx_ids, const void **sources, uint32_t max_txs);
+
+VULKAN_API int pause_mempool_ingress(void);
+VULKAN_API int resume_mempool_ingress(void);
+VULKAN_API int wait_mempool_ingress(void);
+
+VULKAN_API int start_mempool_ingress(void);
+VULKAN_API int stop_mempool_ingress(void);
+
+VULKAN_END_DECL
@@ -37,6 +37,168 @@
 #include "crypto/cryptoutil.h"
 #include "crypto/sha256d.h"
 
+/*
+ * Collapses a level of 32 byte hashes (non-separated) in place into it's parent hashes.
+ * Pairs of hashes are adjacent in the buffer and are hashed directly from it in batches
+ * of the widest sha256d backend, returns the number of parent hashes.
+ */
+static uint32_t collapse_merkle_hashes(uint8_t *hashes, uint32_t num_of_hashes)
+{
+  const unsigned char *messages[SHA256D_MAX_LANES];
+  size_t message_sizes[SHA256D_MAX_LANES];
+  uint8_t parent_hashes[HASH_SIZE * SHA256D_MAX_LANES];
+  uint8_t odd_pair[HASH_SIZE * 2];
+
+  uint32_t num_of_parents = (num_of_hashes + 1) / 2;
+  for (uint32_t i = 0; i < num_of_parents; i += SHA256D_MAX_LANES)
+  {
+    uint32_t num_of_messages = num_of_parents - i;
+    if (num_of_messages > SHA256D_MAX_LANES)
+    {
+      num_of_messages = SHA256D_MAX_LANES;
+    }
+
+    for (uint32_t j = 0; j < num_of_messages; j++)
+    {
+      uint32_t left_index = (i + j) * 2;
+      messages[j] = &hashes[left_index * HASH_SIZE];
+      message_sizes[j] = HASH_SIZE * 2;
+
+      // an odd node at the end of the level is paired with itself
+      if (left_index + 1 == num_of_hashes)
+      {
+        memcpy(odd_pair, &hashes[left_index * HASH_SIZE], HASH_SIZE);
+        memcpy(odd_pair + HASH_SIZE, &hashes[left_index * HASH_SIZE], HASH_SIZE);
+        messages[j] = odd_pair;
+      }
+    }
+
+    // the parents are written behind the pairs that are still to be read
+    crypto_hash_sha256d_multi(parent_hashes, messages, message_sizes, num_of_messages);
+    memcpy(&hashes[i * HASH_SIZE], parent_hashes, HASH_SIZE * num_of_messages);
+  }
+
+  return num_of_parents;
+}
+
+/*
+ * Computes only the merkle root of a series of 32 byte hashes (non-separated), without
+ * constructing the tree. Each level is collapsed in place over the hashes buffer, so it's
+ * contents are overwritten.
+ */
+int compute_merkle_root_from_hashes(uint8_t *merkle_root, uint8_t *hashes, uint32_t num_of_hashes)
+{
+  assert(merkle_root != NULL);
+  assert(hashes != NULL);
+  if (num_of_hashes < 1)
+  {
+    return 1;
+  }
+
+  uint32_t num_of_nodes = num_of_hashes;
+  while (num_of_nodes > 1)
+  {
+    num_of_nodes = collapse_merkle_hashes(hashes, num_of_nodes);
+  }
+
+  memcpy(merkle_root, hashes, HASH_SIZE);
+  return 0;
+}
+
+/*
+ * Computes the merkle branch of the hash at the given index, which is the sibling hash
+ * at each level of the tree from the leaf up to the root. The branch buffer must fit
+ * MAX_MERKLE_BRANCH_LENGTH hashes, the hashes buffer is overwritten the same way
+ * as when computing only the merkle root.
+ */
+int compute_merkle_branch_from_hashes(uint8_t *branch, uint32_t *branch_length, uint8_t *hashes, uint32_t num_of_hashes, uint32_t index)
+{
+  assert(branch != NULL);
+  assert(branch_length != NULL);
+  assert(hashes != NULL);
+  if (index >= num_of_hashes)
+  {
+    return 1;
+  }
+
+  uint32_t length = 0;
+  uint32_t num_of_nodes = num_of_hashes;
+  while (num_of_nodes > 1)
+  {
+    assert(length < MAX_MERKLE_BRANCH_LENGTH);
+    uint32_t sibling_index = index ^ 1;
+    if (sibling_index >= num_of_nodes)
+    {
+      sibling_index = index;
+    }
+
+    memcpy(&branch[length * HASH_SIZE], &hashes[sibling_index * HASH_SIZE], HASH_SIZE);
+    length++;
+
+    num_of_nodes = collapse_merkle_hashes(hashes, num_of_nodes);
+    index >>= 1;
+  }
+
+  *branch_length = length;
+  return 0;
+}
+
+/*
+ * Folds a leaf hash up through it's merkle branch, the bits of the leaf's index
+ * determine on which side the sibling hash is at each level of the tree.
+ */
+int compute_merkle_root_from_branch(uint8_t *merkle_root, uint8_t *leaf_hash, uint8_t *branch, uint32_t branch_length, uint32_t index)
+{
+  assert(merkle_root != NULL);
+  assert(leaf_hash != NULL);
+  if (branch_length > MAX_MERKLE_BRANCH_LENGTH)
+  {
+    return 1;
+  }
+
+  uint8_t combined_hash[HASH_SIZE * 2];
+  uint8_t node_hash[HASH_SIZE];
+  memcpy(node_hash, leaf_hash, HASH_SIZE);
+  for (uint32_t i = 0; i < branch_length; i++)
+  {
+    assert(branch != NULL);
+    if (index & 1)
+    {
+      memcpy(combined_hash, &branch[i * HASH_SIZE], HASH_SIZE);
+      memcpy(combined_hash + HASH_SIZE, node_hash, HASH_SIZE);
+    }
+    else
+    {
+      memcpy(combined_hash, node_hash, HASH_SIZE);
+      memcpy(combined_hash + HASH_SIZE, &branch[i * HASH_SIZE], HASH_SIZE);
+    }
+
+    crypto_hash_sha256d(node_hash, combined_hash, HASH_SIZE * 2);
+    index >>= 1;
+  }
+
+  // an index that does not fit the branch does not belong to the tree
+  if (index != 0)
+  {
+    return 1;
+  }
+
+  memcpy(merkle_root, node_hash, HASH_SIZE);
+  return 0;
+}
+
+int valid_merkle_branch(uint8_t *merkle_root, uint8_t *leaf_hash, uint8_t *branch, uint32_t branch_length, uint32_t index)
+{
+  assert(merkle_root != NULL);
+  uint8_t expected_merkle_root[HASH_SIZE];
+  if (compute_merkle_root_from_branch(expected_merkle_root, leaf_hash, branch, branch_length, index))
+  {
+    return 0;
+  }
+
+  return compare_hash(expected_merkle_root, merkle_root);
+}
+
 /*
  * Constructing a Merkle Tree requires passing a large allocated uint8_t that contains
  * a series of 32 byte hashes. (non-separated). A second parameter determines the number
@@ -89,33 +251,57 @@ int construct_merkle_leaves_from_hashes(merkle_node_t **nodes, uint32_t *num_of_
 
 /*
  * Collapses the list of nodes into a smaller list of parent nodes that are hashes of 2 child nodes.
+ * All of the parent hashes of a level are computed in a single batch.
  */
 int collapse_merkle_nodes(merkle_node_t **nodes, uint32_t *num_of_nodes)
 {
   assert(nodes != NULL);
-  uint32_t current_node_idx = 0;
-  merkle_node_t **temp_nodes = malloc(sizeof(merkle_node_t) * (*num_of_nodes));
-  assert(temp_nodes != NULL);
+  uint32_t num_of_parents = (*num_of_nodes + 1) / 2;
 
-  for (uint32_t i = 0; i < (*num_of_nodes - 1); i += 2)
-  {
-    temp_nodes[current_node_idx] = construct_merkle_node(nodes[i], nodes[i + 1]);
-    current_node_idx++;
-  }
+  uint8_t *combined_hashes = malloc(HASH_SIZE * 2 * num_of_parents);
+  assert(combined_hashes != NULL);
+  const unsigned char **messages = malloc(sizeof(unsigned char*) * num_of_parents);
+  assert(messages != NULL);
+  size_t *message_sizes = malloc(sizeof(size_t) * num_of_parents);
+  assert(message_sizes != NULL);
+  uint8_t *parent_hashes = malloc(HASH_SIZE * num_of_parents);
+  assert(parent_hashes != NULL);
 
-  if (*num_of_nodes % 2 != 0)
+  // an odd node at the end of the level is paired with itself
+  for (uint32_t i = 0; i < num_of_parents; i++)
   {
-    temp_nodes[current_node_idx] = construct_merkle_node(nodes[*num_of_nodes - 1], nodes[*num_of_nodes - 1]);
-    current_node_idx++;
+    merkle_node_t *left = nodes[i * 2];
+    merkle_node_t *right = (i * 2) + 1 < *num_of_nodes ? nodes[(i * 2) + 1] : left;
+
+    uint8_t *combined_hash = combined_hashes + (i * HASH_SIZE * 2);
+    memcpy(combined_hash, left->hash, HASH_SIZE);
+    memcpy(combined_hash + HASH_SIZE, right->hash, HASH_SIZE);
+
+    messages[i] = combined_hash;
+    message_sizes[i] = HASH_SIZE * 2;
   }
 
-  for (uint32_t i = 0; i < current_node_idx; i++)
+  crypto_hash_sha256d_multi(parent_hashes, messages, message_sizes, num_of_parents);
+
+  for (uint32_t i = 0; i < num_of_parents; i++)
   {
-    nodes[i] = temp_nodes[i];
+    merkle_node_t *left = nodes[i * 2];
+    merkle_node_t *right = (i * 2) + 1 < *num_of_nodes ? nodes[(i * 2) + 1] : left;
+
+    merkle_node_t *node = malloc(sizeof(merkle_node_t));
+    assert(node != NULL);
+    memcpy(node->hash, parent_hashes + (i * HASH_SIZE), HASH_SIZE);
+    node->left = left;
+    node->right = right;
+    nodes[i] = node;
   }
 
-  *num_of_nodes = current_node_idx;
-  free(temp_nodes);
+  *num_of_nodes = num_of_parents;
+
+  free(combined_hashes);
+  free(messages);
+  free(message_sizes);
+  free(parent_hashes);
   return 0;
 }
 
@@ -32,6 +32,9 @@
 
 VULKAN_BEGIN_DECL
 
+// a tree of up to 2^32 leaves is at most this many levels deep
+#define MAX_MERKLE_BRANCH_LENGTH 32
+
 typedef struct MerkleNode merkle_node_t;
 typedef struct MerkleNode
 {
@@ -45,6 +48,11 @@ typedef struct MerkleTree
   merkle_node_t *root;
 } merkle_tree_t;
 
+VULKAN_API int compute_merkle_root_from_hashes(uint8_t *merkle_root, uint8_t *hashes, uint32_t num_of_hashes);
+VULKAN_API int compute_merkle_branch_from_hashes(uint8_t *branch, uint32_t *branch_length, uint8_t *hashes, uint32_t num_of_hashes, uint32_t index);
+VULKAN_API int compute_merkle_root_from_branch(uint8_t *merkle_root, uint8_t *leaf_hash, uint8_t *branch, uint32_t branch_length, uint32_t index);
+VULKAN_API int valid_merkle_branch(uint8_t *merkle_root, uint8_t *leaf_hash, uint8_t *branch, uint32_t branch_length, uint32_t index);
+
 VULKAN_API merkle_tree_t *construct_merkle_tree_from_leaves(uint8_t *hashes, uint32_t num_of_hashes);
 VULKAN_API merkle_node_t *construct_merkle_node(merkle_node_t *left, merkle_node_t *right);
 
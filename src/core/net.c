@@ -31,17 +31,21 @@
 #include <assert.h>
 #include <inttypes.h>
 
+#include <deque.h>
 #include <mongoose.h>
 
 #include <miniupnpc.h>
 #include <upnpcommands.h>
 #include <upnperrors.h>
 
+#include "common/affinity.h"
 #include "common/buffer_iterator.h"
 #include "common/buffer.h"
+#include "common/buffer_pool.h"
 #include "common/logger.h"
 #include "common/task.h"
 #include "common/tinycthread.h"
+#include "common/trace.h"
 #include "common/util.h"
 #include "common/vec.h"
 
@@ -49,11 +53,13 @@
 #include "net.h"
 #include "p2p.h"
 #include "parameters.h"
+#include "peer_table.h"
 #include "protocol.h"
 #include "seed_nodes.h"
 #include "version.h"
 
 static int g_net_initialized = 0;
+static volatile int g_net_run_stopped = 0;
 static mtx_t g_net_lock;
 static struct mg_mgr g_net_mgr;
 
@@ -63,11 +69,56 @@ static const char *g_net_external_address = "";
 static int g_net_disable_port_mapping = 0;
 
 static task_t *g_net_resync_chain_task = NULL;
-static task_t *g_net_reconnect_seeds_task = NULL;
+static task_t *g_net_relay_inventory_task = NULL;
+static task_t *g_net_request_block_filters_task = NULL;
+static task_t *g_net_ping_peers_task = NULL;
+static task_t *g_net_manage_connections_task = NULL;
 static task_t *g_net_flush_connections_task = NULL;
 static net_connection_t *g_net_connection = NULL;
 
 static vec_void_t g_net_connections;
+
+typedef struct NetIOThread
+{
+  struct mg_mgr mgr;
+  mtx_t lock;
+  thrd_t thread;
+
+  // sockets accepted by the main loop waiting to be adopted by this thread
+  vec_void_t pending_sockets;
+  vec_void_t connections;
+} net_io_thread_t;
+
+typedef struct NetPendingSocket
+{
+  sock_t sock;
+  union socket_address sa;
+} net_pending_socket_t;
+
+// a packet received on an io thread, the packet is NULL
+// once the io thread has closed the connection...
+typedef struct NetDispatchEntry
+{
+  net_connection_t *net_connection;
+  packet_t *packet;
+} net_dispatch_entry_t;
+
+static uint16_t g_net_num_io_threads = 0;
+static uint16_t g_net_num_started_io_threads = 0;
+static int g_net_io_threads_running = 0;
+static net_io_thread_t g_net_io_threads[MAX_NUM_NET_IO_THREADS];
+
+static mtx_t g_net_dispatch_lock;
+static Deque *g_net_dispatch_queue = NULL;
+
+static mtx_t g_net_payload_lock;
+
+static size_t g_net_send_queue_high_watermark = NET_SEND_QUEUE_HIGH_WATERMARK;
+static size_t g_net_send_queue_low_watermark = NET_SEND_QUEUE_LOW_WATERMARK;
+static uint32_t g_net_send_queue_stall_timeout = NET_SEND_QUEUE_STALL_TIMEOUT;
+static uint16_t g_net_target_outbound_peers = NET_TARGET_OUTBOUND_PEERS;
+static task_t *g_net_check_send_queues_task = NULL;
+
 static int g_num_connections = 0;
 
 void set_net_host_address(const char *host_address)
@@ -105,6 +156,66 @@ int get_net_disable_port_mapping(void)
   return g_net_disable_port_mapping;
 }
 
+void set_net_num_io_threads(uint16_t num_io_threads)
+{
+  assert(num_io_threads <= MAX_NUM_NET_IO_THREADS);
+  g_net_num_io_threads = num_io_threads;
+}
+
+uint16_t get_net_num_io_threads(void)
+{
+  return g_net_num_io_threads;
+}
+
+void set_net_send_queue_high_watermark(size_t high_watermark)
+{
+  g_net_send_queue_high_watermark = high_watermark;
+}
+
+size_t get_net_send_queue_high_watermark(void)
+{
+  return g_net_send_queue_high_watermark;
+}
+
+void set_net_send_queue_low_watermark(size_t low_watermark)
+{
+  g_net_send_queue_low_watermark = low_watermark;
+}
+
+size_t get_net_send_queue_low_watermark(void)
+{
+  return g_net_send_queue_low_watermark;
+}
+
+void set_net_send_queue_stall_timeout(uint32_t stall_timeout)
+{
+  g_net_send_queue_stall_timeout = stall_timeout;
+}
+
+uint32_t get_net_send_queue_stall_timeout(void)
+{
+  return g_net_send_queue_stall_timeout;
+}
+
+void set_net_target_outbound_peers(uint16_t target_outbound_peers)
+{
+  g_net_target_outbound_peers = MIN(target_outbound_peers, MAX_P2P_PEERS_COUNT);
+}
+
+uint16_t get_net_target_outbound_peers(void)
+{
+  return g_net_target_outbound_peers;
+}
+
+/*
+ * The mongoose manager polled by the main network loop, other listeners
+ * bound to it have their events handled on the same thread as the peers.
+ */
+struct mg_mgr* get_net_mgr(void)
+{
+  return &g_net_mgr;
+}
+
 net_connection_t* init_net_connection(struct mg_connection *connection)
 {
   assert(connection != NULL);
@@ -113,46 +224,108 @@ net_connection_t* init_net_connection(struct mg_connection *connection)
   net_connection->connection = connection;
   vec_init(&net_connection->send_queue);
   net_connection->send_queue_size = 0;
+  net_connection->send_buffer_size = 0;
+  atomic_init(&net_connection->send_paused, 0);
+  net_connection->send_paused_ts = 0;
+  vec_init(&net_connection->deferred_packets);
 
-  net_connection->is_receiving_data = 0;
-  net_connection->expected_receiving_len = 0;
-  net_connection->receiving_buffer = NULL;
+  net_connection->io_thread = NULL;
+  net_connection->close_requested = 0;
+  net_connection->remote_ip = ntohl(*(uint32_t*)&connection->sa.sin.sin_addr);
+
+  net_connection->receiving_header_size = 0;
+  net_connection->receiving_packet = NULL;
+  net_connection->receiving_payload_size = 0;
+  net_connection->receiving_payload_capacity = 0;
 
   net_connection->host_port = 0;
   net_connection->anonymous = 1;
+  net_connection->outbound = 0;
+  net_connection->dial_ts = 0;
+  net_connection->inventory = NULL;
+  net_connection->grouped_blocks_budget_size = 0;
+  net_connection->capabilities = 0;
+  net_connection->peer_capabilities = 0;
   return net_connection;
 }
 
 void free_net_connection(net_connection_t *net_connection)
 {
   assert(net_connection != NULL);
+
+  // release any payloads that were queued but never flushed
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&net_connection->send_queue, value, index)
+  {
+    release_net_payload((net_payload_t*)value);
+  }
+
   vec_deinit(&net_connection->send_queue);
-  if (net_connection->receiving_buffer != NULL)
+  vec_foreach(&net_connection->deferred_packets, value, index)
+  {
+    free_packet((packet_t*)value);
+  }
+
+  vec_deinit(&net_connection->deferred_packets);
+  if (net_connection->receiving_packet != NULL)
+  {
+    free_packet(net_connection->receiving_packet);
+    net_connection->receiving_packet = NULL;
+  }
+
+  if (net_connection->inventory != NULL)
   {
-    buffer_free(net_connection->receiving_buffer);
-    net_connection->receiving_buffer = NULL;
+    free_inventory(net_connection->inventory);
+    net_connection->inventory = NULL;
   }
 
   free(net_connection);
 }
 
-net_connection_t* get_net_connection_nolock(struct mg_connection *connection)
+size_t get_net_connection_pending_send_size(net_connection_t *net_connection)
 {
-  assert(connection != NULL);
-  void *value = NULL;
-  int index = 0;
-  vec_foreach(&g_net_connections, value, index)
-  {
-    net_connection_t *net_connection = (net_connection_t*)value;
-    assert(net_connection != NULL);
+  assert(net_connection != NULL);
+  return net_connection->send_queue_size + net_connection->send_buffer_size;
+}
 
-    if (net_connection->connection == connection)
-    {
-      return net_connection;
-    }
+int is_net_connection_send_paused(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  return atomic_load_explicit(&net_connection->send_paused, memory_order_acquire);
+}
+
+/*
+ * Pauses the connection once it's pending bytes go above the high watermark and resumes
+ * it once they drain below the low watermark, must be called by the connection's owning thread.
+ */
+static void update_net_connection_send_paused(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  size_t pending_send_size = get_net_connection_pending_send_size(net_connection);
+  int send_paused = atomic_load_explicit(&net_connection->send_paused, memory_order_relaxed);
+  if (send_paused == 0 && pending_send_size > g_net_send_queue_high_watermark)
+  {
+    LOG_DEBUG("Pausing connection with %zu bytes waiting to be sent.", pending_send_size);
+    net_connection->send_paused_ts = get_current_time();
+    atomic_store_explicit(&net_connection->send_paused, 1, memory_order_release);
+  }
+  else if (send_paused && pending_send_size <= g_net_send_queue_low_watermark)
+  {
+    LOG_DEBUG("Resuming connection with %zu bytes waiting to be sent.", pending_send_size);
+    net_connection->send_paused_ts = 0;
+    atomic_store_explicit(&net_connection->send_paused, 0, memory_order_release);
   }
+}
 
-  return NULL;
+/*
+ * A net connection is stored in it's mongoose connection's user data slot while it is
+ * added, connections which were never added or were handed off to an io thread have none.
+ */
+net_connection_t* get_net_connection_nolock(struct mg_connection *connection)
+{
+  assert(connection != NULL);
+  return (net_connection_t*)connection->user_data;
 }
 
 net_connection_t* get_net_connection(struct mg_connection *connection)
@@ -186,6 +359,7 @@ int add_net_connection_nolock(net_connection_t *net_connection)
   }
 
   assert(vec_push(&g_net_connections, net_connection) == 0);
+  net_connection->connection->user_data = net_connection;
   g_num_connections++;
   return 0;
 }
@@ -201,12 +375,22 @@ int add_net_connection(net_connection_t *net_connection)
 int remove_net_connection_nolock(net_connection_t *net_connection)
 {
   assert(net_connection != NULL);
-  if (has_net_connection(net_connection->connection) == 0)
+
+  // looked up by the net connection itself, connections closed by
+  // an io thread no longer have a mongoose connection...
+  int index = 0;
+  vec_find(&g_net_connections, net_connection, index);
+  if (index == -1)
   {
     return 1;
   }
 
-  vec_remove(&g_net_connections, net_connection);
+  vec_splice(&g_net_connections, index, 1);
+  if (net_connection->connection != NULL && net_connection->connection->user_data == net_connection)
+  {
+    net_connection->connection->user_data = NULL;
+  }
+
   g_num_connections--;
   return 0;
 }
@@ -219,10 +403,28 @@ int remove_net_connection(net_connection_t *net_connection)
   return result;
 }
 
+int get_num_net_connections(void)
+{
+  mtx_lock(&g_net_lock);
+  int num_connections = g_num_connections;
+  mtx_unlock(&g_net_lock);
+  return num_connections;
+}
+
 int close_net_connection(net_connection_t *net_connection)
 {
   assert(net_connection != NULL);
 
+  // connections owned by an io thread are closed by that thread
+  net_io_thread_t *io_thread = net_connection->io_thread;
+  if (io_thread != NULL)
+  {
+    mtx_lock(&io_thread->lock);
+    net_connection->close_requested = 1;
+    mtx_unlock(&io_thread->lock);
+    return 0;
+  }
+
   struct mg_connection *connection = net_connection->connection;
   assert(connection != NULL);
 
@@ -230,136 +432,604 @@ int close_net_connection(net_connection_t *net_connection)
   return 0;
 }
 
-int broadcast_data(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
+/*
+ * Takes ownership of the buffer, the payload starts out with a single
+ * reference which belongs to the caller. Payloads are shared across the
+ * io threads, so the reference count has a lock of it's own.
+ */
+net_payload_t* make_net_payload(buffer_t *buffer)
+{
+  assert(buffer != NULL);
+  net_payload_t *payload = malloc(sizeof(net_payload_t));
+  assert(payload != NULL);
+  payload->buffer = buffer;
+  payload->refcount = 1;
+  return payload;
+}
+
+net_payload_t* retain_net_payload(net_payload_t *payload)
+{
+  assert(payload != NULL);
+  mtx_lock(&g_net_payload_lock);
+  assert(payload->refcount > 0);
+  payload->refcount++;
+  mtx_unlock(&g_net_payload_lock);
+  return payload;
+}
+
+void release_net_payload(net_payload_t *payload)
+{
+  assert(payload != NULL);
+  mtx_lock(&g_net_payload_lock);
+  assert(payload->refcount > 0);
+  payload->refcount--;
+  int should_free = payload->refcount == 0;
+  mtx_unlock(&g_net_payload_lock);
+
+  if (should_free)
+  {
+    buffer_free(payload->buffer);
+    free(payload);
+  }
+}
+
+int broadcast_payload(net_connection_t *net_connection, net_payload_t *payload)
 {
   assert(g_net_connection != NULL);
-  return broadcast_data_to_peers(g_net_connection, data, data_len);
+  return broadcast_payload_to_peers(g_net_connection, payload);
 }
 
-int send_data(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
+/*
+ * Queues a reference to the payload rather than a copy of it, so one
+ * serialized packet can be shared by the send queues of all of our peers.
+ */
+int send_payload(net_connection_t *net_connection, net_payload_t *payload)
 {
   assert(net_connection != NULL);
+  assert(payload != NULL);
+
+  // connections owned by an io thread are only ever written to by that
+  // thread, the payload is queued until the thread flushes the connection...
+  net_io_thread_t *io_thread = net_connection->io_thread;
+  if (io_thread != NULL)
+  {
+    mtx_lock(&io_thread->lock);
+    if (net_connection->connection != NULL)
+    {
+      vec_push(&net_connection->send_queue, retain_net_payload(payload));
+      net_connection->send_queue_size += buffer_get_size(payload->buffer);
+      update_net_connection_send_paused(net_connection);
+    }
+
+    mtx_unlock(&io_thread->lock);
+    return 0;
+  }
+
   mtx_lock(&g_net_lock);
 #ifdef USE_NET_QUEUE
-  buffer_t *buffer = buffer_init_data(0, data, data_len);
-  vec_push(&net_connection->send_queue, buffer);
-  net_connection->send_queue_size++;
+  vec_push(&net_connection->send_queue, retain_net_payload(payload));
+  net_connection->send_queue_size += buffer_get_size(payload->buffer);
 #else
-  mg_send(net_connection->connection, data, data_len);
+  mg_send(net_connection->connection, buffer_get_data(payload->buffer), buffer_get_size(payload->buffer));
+  net_connection->send_buffer_size = net_connection->connection->send_mbuf.len;
 #endif
+  update_net_connection_send_paused(net_connection);
   mtx_unlock(&g_net_lock);
   return 0;
 }
 
-static int process_packet(net_connection_t *net_connection, buffer_iterator_t *buffer_iterator)
+int broadcast_data(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
+{
+  net_payload_t *payload = make_net_payload(buffer_init_data(0, data, data_len));
+  int result = broadcast_payload(net_connection, payload);
+  release_net_payload(payload);
+  return result;
+}
+
+int send_data(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
 {
   assert(net_connection != NULL);
-  assert(buffer_iterator != NULL);
+  net_payload_t *payload = make_net_payload(buffer_init_data(0, data, data_len));
+  int result = send_payload(net_connection, payload);
+  release_net_payload(payload);
+  return result;
+}
 
-  packet_t *packet = make_packet();
-  if (deserialize_packet(packet, buffer_iterator))
-  {
-    LOG_DEBUG("Failed to deserialize incoming packet!");
-    free_packet(packet);
-    return 1;
-  }
+static void queue_net_dispatch_entry(net_connection_t *net_connection, packet_t *packet)
+{
+  assert(net_connection != NULL);
+  net_dispatch_entry_t *entry = malloc(sizeof(net_dispatch_entry_t));
+  assert(entry != NULL);
+  entry->net_connection = net_connection;
+  entry->packet = packet;
+
+  mtx_lock(&g_net_dispatch_lock);
+  assert(deque_add_last(g_net_dispatch_queue, entry) == CC_OK);
+  mtx_unlock(&g_net_dispatch_lock);
+}
 
+static void run_net_packet(net_connection_t *net_connection, packet_t *packet)
+{
+  assert(net_connection != NULL);
+  assert(packet != NULL);
   if (handle_receive_packet(net_connection, packet))
   {
     LOG_DEBUG("Failed to handle incoming packet with id: %u!", packet->id);
-    free_packet(packet);
-    return 1;
   }
 
   free_packet(packet);
-  return 0;
 }
 
-static void process_incoming_packet(net_connection_t *net_connection, buffer_iterator_t *buffer_iterator)
+/*
+ * Runs the data requests that were deferred while the connection was paused in the order
+ * they were received, stopping early if answering them pauses the connection again.
+ */
+static void replay_deferred_net_packets(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  if (net_connection->deferred_packets.length > 0 && is_net_connection_send_paused(net_connection) == 0)
+  {
+    LOG_DEBUG("Replaying %d deferred requests from resumed connection.", net_connection->deferred_packets.length);
+  }
+
+  while (net_connection->deferred_packets.length > 0 && is_net_connection_send_paused(net_connection) == 0)
+  {
+    packet_t *packet = (packet_t*)net_connection->deferred_packets.data[0];
+    vec_splice(&net_connection->deferred_packets, 0, 1);
+    run_net_packet(net_connection, packet);
+  }
+}
+
+/*
+ * Handles a packet on the main thread, the data requests of a paused connection are
+ * deferred until it has drained, along with any that arrive while others are still waiting
+ * so they are answered in order. The peer re-requests anything dropped past the max...
+ */
+static void receive_net_packet(net_connection_t *net_connection, packet_t *packet)
 {
   assert(net_connection != NULL);
-  assert(buffer_iterator != NULL);
+  assert(packet != NULL);
 
-  if (process_packet(net_connection, buffer_iterator))
+  replay_deferred_net_packets(net_connection);
+  if (is_data_request_packet(packet->id) &&
+    (net_connection->deferred_packets.length > 0 || is_net_connection_send_paused(net_connection)))
   {
-    //assert(close_net_connection(net_connection) == 0);
+    if (net_connection->deferred_packets.length >= NET_MAX_DEFERRED_PACKETS)
+    {
+      LOG_DEBUG("Dropping request with packet id: %u from peer with too many deferred requests.", packet->id);
+      free_packet(packet);
+      return;
+    }
+
+    assert(vec_push(&net_connection->deferred_packets, packet) == 0);
     return;
   }
 
-  // check to see if we have any remaining data in the buffer,
-  // sometimes data for several packets can be combined in attempt to
-  // reduce overhead when trying to send multiple packets...
-  size_t remaining_data_len = buffer_get_remaining_size(buffer_iterator);
-  if (remaining_data_len > 0)
+  run_net_packet(net_connection, packet);
+}
+
+static void process_packet(net_connection_t *net_connection, packet_t *packet)
+{
+  assert(net_connection != NULL);
+  assert(packet != NULL);
+
+  // packets received on an io thread are handed to the main thread,
+  // the protocol handlers are only ever run on the main thread...
+  if (net_connection->io_thread != NULL)
   {
-    const uint8_t *remaining_data = buffer_get_remaining_data(buffer_iterator);
-    data_received(net_connection, remaining_data, remaining_data_len);
+    queue_net_dispatch_entry(net_connection, packet);
+    return;
   }
+
+  receive_net_packet(net_connection, packet);
 }
 
+/*
+ * Grows the payload buffer of the packet being received to hold at least the
+ * wanted size, the buffer doubles in size up to the size of the packet.
+ */
+static void grow_receiving_payload(net_connection_t *net_connection, size_t wanted_size)
+{
+  assert(net_connection != NULL);
+  packet_t *packet = net_connection->receiving_packet;
+  assert(packet != NULL);
+  assert(wanted_size <= packet->size);
+
+  size_t capacity = net_connection->receiving_payload_capacity;
+  while (capacity < wanted_size)
+  {
+    capacity = MIN(capacity * 2, (size_t)packet->size);
+  }
+
+  uint8_t *data = buffer_pool_acquire(capacity);
+  memcpy(data, packet->data, net_connection->receiving_payload_size);
+  buffer_pool_release(packet->data);
+  packet->data = data;
+  net_connection->receiving_payload_capacity = capacity;
+}
+
+/*
+ * Streams the received data through the connection's packet framer, the data may
+ * hold any number of packets and partial packets are continued by the next call.
+ * The payload of a packet is copied straight into it's pooled payload buffer, which
+ * grows as the payload arrives instead of being allocated by the announced size.
+ */
 void data_received(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
 {
   assert(net_connection != NULL);
   assert(data != NULL);
-  assert(data_len > 0);
 
-  buffer_t *buffer = buffer_init_data(0, data, data_len);
-  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
-  if (net_connection->is_receiving_data)
+  while (data_len > 0)
   {
-    buffer_t *receiving_buffer = net_connection->receiving_buffer;
-    assert(receiving_buffer != NULL);
+    packet_t *packet = net_connection->receiving_packet;
+    if (packet == NULL)
+    {
+      // the size of the payload is only sent again when there is a payload
+      size_t header_size = net_connection->receiving_header_size;
+      size_t wanted_header_size = header_size < PACKET_HEADER_MIN_SIZE ? PACKET_HEADER_MIN_SIZE : PACKET_HEADER_SIZE;
+      size_t copy_size = MIN(wanted_header_size - header_size, data_len);
+      memcpy(net_connection->receiving_header + header_size, data, copy_size);
+      net_connection->receiving_header_size += copy_size;
+      data += copy_size;
+      data_len -= copy_size;
+
+      if (net_connection->receiving_header_size < wanted_header_size)
+      {
+        break;
+      }
+
+      packet_t header_packet;
+      if (deserialize_packet_header(&header_packet, net_connection->receiving_header, wanted_header_size))
+      {
+        LOG_DEBUG("Failed to deserialize incoming packet header!");
+        net_connection->receiving_header_size = 0;
+        assert(close_net_connection(net_connection) == 0);
+        return;
+      }
+
+      if (header_packet.size > 0 && wanted_header_size < PACKET_HEADER_SIZE)
+      {
+        continue;
+      }
+
+      net_connection->receiving_header_size = 0;
+      if (net_connection->anonymous && header_packet.size > NET_MAX_ANONYMOUS_PACKET_SIZE)
+      {
+        LOG_DEBUG("Received packet with id: %u and size: %u before the connection was established!",
+          header_packet.id, header_packet.size);
+        assert(close_net_connection(net_connection) == 0);
+        return;
+      }
 
-    if (buffer_write(receiving_buffer, data, data_len))
+      packet = make_packet();
+      packet->id = header_packet.id;
+      packet->size = header_packet.size;
+      if (packet->size > 0)
+      {
+        net_connection->receiving_payload_capacity = MIN((size_t)packet->size, NET_RECEIVE_PAYLOAD_INITIAL_SIZE);
+        packet->data = buffer_pool_acquire(net_connection->receiving_payload_capacity);
+        net_connection->receiving_packet = packet;
+        net_connection->receiving_payload_size = 0;
+        continue;
+      }
+    }
+    else
     {
-      buffer_iterator_free(buffer_iterator);
-      buffer_free(buffer);
-      return;
+      size_t payload_size = net_connection->receiving_payload_size;
+      size_t copy_size = MIN(packet->size - payload_size, data_len);
+      if (payload_size + copy_size > net_connection->receiving_payload_capacity)
+      {
+        grow_receiving_payload(net_connection, payload_size + copy_size);
+      }
+
+      memcpy(packet->data + payload_size, data, copy_size);
+      net_connection->receiving_payload_size += copy_size;
+      data += copy_size;
+      data_len -= copy_size;
+
+      if (net_connection->receiving_payload_size < packet->size)
+      {
+        break;
+      }
+
+      net_connection->receiving_packet = NULL;
+      net_connection->receiving_payload_size = 0;
+      net_connection->receiving_payload_capacity = 0;
     }
 
-    if (buffer_get_size(receiving_buffer) >= net_connection->expected_receiving_len)
+    process_packet(net_connection, packet);
+  }
+}
+
+static void net_connection_closed(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  peer_t *peer = get_peer_from_net_connection(net_connection);
+  if (peer != NULL)
+  {
+    // check to see if we are trying to sync to the connection
+    // that was just closed by the remote host...
+    if (get_sync_initiated() && get_sync_net_connection() == net_connection)
     {
-      buffer_iterator_t *receiving_buffer_iterator = buffer_iterator_init(receiving_buffer);
-      process_incoming_packet(net_connection, receiving_buffer_iterator);
-      buffer_iterator_free(receiving_buffer_iterator);
+      char *address_str = convert_ip_to_str(net_connection->remote_ip);
+      LOG_INFO("Connection closed during syncronization with peer %s:%u, continuing anyways...", address_str, net_connection->host_port);
+      free(address_str);
+
+      // forcefully end syncronization, since the connection we tried to sync to
+      // has been closed, let's assume we have the top block so that we don't
+      // restore the blockchain to the point before we started syncronizing...
+      if (check_sync_status(1))
+      {
+        assert(clear_sync_request(0) == 0);
+      }
+    }
 
-      net_connection->is_receiving_data = 0;
-      net_connection->expected_receiving_len = 0;
+    assert(remove_peer(peer) == 0);
+    free_peer(peer);
 
-      assert(net_connection->receiving_buffer != NULL);
-      buffer_free(net_connection->receiving_buffer);
-      net_connection->receiving_buffer = NULL;
+    // hand any blocks we were downloading from this peer to our sync peer
+    if (get_sync_initiated())
+    {
+      handle_sync_peer_closed(net_connection);
     }
   }
-  else
+
+  assert(remove_net_connection(net_connection) == 0);
+  free_net_connection(net_connection);
+}
+
+/*
+ * Runs the packets received on the io threads, along with the teardown of
+ * the connections they closed, in the order they were received. Must be called
+ * on the main network thread...
+ */
+int dispatch_net_packets(void)
+{
+  while (1)
   {
-    packet_t *packet = make_packet();
-    if (deserialize_packet(packet, buffer_iterator))
+    void *value = NULL;
+    mtx_lock(&g_net_dispatch_lock);
+    int r = deque_remove_first(g_net_dispatch_queue, &value);
+    mtx_unlock(&g_net_dispatch_lock);
+    if (r != CC_OK)
+    {
+      break;
+    }
+
+    net_dispatch_entry_t *entry = (net_dispatch_entry_t*)value;
+    assert(entry != NULL);
+
+    if (entry->packet != NULL)
     {
-      assert(close_net_connection(net_connection) == 0);
+      receive_net_packet(entry->net_connection, entry->packet);
     }
     else
     {
-      if (data_len < packet->size)
-      {
-        net_connection->is_receiving_data = 1;
-        net_connection->expected_receiving_len = packet->size;
+      net_connection_closed(entry->net_connection);
+    }
+
+    free(entry);
+  }
+
+  return 0;
+}
 
-        buffer_t *receiving_buffer = buffer_init_data(0, data, data_len);
-        net_connection->receiving_buffer = receiving_buffer;
+static void io_thread_ev_handler(struct mg_connection *connection, int ev, void *p)
+{
+  assert(connection != NULL);
+  net_connection_t *net_connection = (net_connection_t*)connection->user_data;
+  assert(net_connection != NULL);
+
+  net_io_thread_t *io_thread = net_connection->io_thread;
+  assert(io_thread != NULL);
+  switch (ev)
+  {
+    case MG_EV_RECV:
+      {
+        struct mbuf *io = &connection->recv_mbuf;
+        data_received(net_connection, (uint8_t*)io->buf, io->len);
+        mbuf_remove(io, io->len);
       }
-      else
+      break;
+    case MG_EV_CLOSE:
       {
-        buffer_iterator_set_offset(buffer_iterator, 0);
-        process_incoming_packet(net_connection, buffer_iterator);
+        mtx_lock(&io_thread->lock);
+        vec_remove(&io_thread->connections, net_connection);
+
+        mtx_lock(&g_net_lock);
+        net_connection->connection = NULL;
+        mtx_unlock(&g_net_lock);
+        mtx_unlock(&io_thread->lock);
+
+        // the rest of the teardown is done on the main thread, after
+        // every packet that was received on the connection...
+        queue_net_dispatch_entry(net_connection, NULL);
       }
+      break;
+    default:
+      break;
+  }
+}
+
+static void adopt_net_io_thread_sockets(net_io_thread_t *io_thread)
+{
+  assert(io_thread != NULL);
+  mtx_lock(&io_thread->lock);
+
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&io_thread->pending_sockets, value, index)
+  {
+    net_pending_socket_t *pending_socket = (net_pending_socket_t*)value;
+    assert(pending_socket != NULL);
+
+    struct mg_connection *connection = mg_add_sock(&io_thread->mgr, pending_socket->sock, io_thread_ev_handler);
+    if (connection == NULL)
+    {
+      LOG_WARNING("Failed to add accepted connection to network io thread!");
+      closesocket(pending_socket->sock);
+      free(pending_socket);
+      continue;
+    }
+
+    connection->sa = pending_socket->sa;
+    net_connection_t *net_connection = init_net_connection(connection);
+    net_connection->io_thread = io_thread;
+
+    assert(vec_push(&io_thread->connections, net_connection) == 0);
+    assert(add_net_connection(net_connection) == 0);
+    free(pending_socket);
+  }
+
+  vec_clear(&io_thread->pending_sockets);
+  mtx_unlock(&io_thread->lock);
+}
+
+static void flush_net_io_thread_connections(net_io_thread_t *io_thread)
+{
+  assert(io_thread != NULL);
+  mtx_lock(&io_thread->lock);
+
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&io_thread->connections, value, index)
+  {
+    net_connection_t *net_connection = (net_connection_t*)value;
+    assert(net_connection != NULL);
+
+    if (net_connection->close_requested)
+    {
+      net_connection->connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+    }
+
+    assert(flush_send_queue(net_connection) == 0);
+  }
+
+  mtx_unlock(&io_thread->lock);
+}
+
+static int net_io_thread(void *arg)
+{
+  net_io_thread_t *io_thread = (net_io_thread_t*)arg;
+  assert(io_thread != NULL);
+  set_current_thread_affinity(THREAD_AFFINITY_CRITICAL, 0);
+  set_trace_thread_name("net io");
+
+  while (g_net_io_threads_running)
+  {
+    adopt_net_io_thread_sockets(io_thread);
+    mg_mgr_poll(&io_thread->mgr, NET_IO_THREAD_POLL_DELAY);
+    flush_net_io_thread_connections(io_thread);
+  }
+
+  return 0;
+}
+
+/*
+ * Hands a connection accepted by the main loop to the io thread with the least
+ * connections, the main loop then drops the connection without closing it's socket.
+ */
+void hand_off_net_connection(struct mg_connection *connection)
+{
+  assert(connection != NULL);
+  assert(g_net_num_started_io_threads > 0);
+
+  net_io_thread_t *io_thread = NULL;
+  int io_thread_num_connections = 0;
+  for (uint16_t i = 0; i < g_net_num_started_io_threads; i++)
+  {
+    net_io_thread_t *candidate_io_thread = &g_net_io_threads[i];
+    mtx_lock(&candidate_io_thread->lock);
+    int num_connections = candidate_io_thread->connections.length + candidate_io_thread->pending_sockets.length;
+    mtx_unlock(&candidate_io_thread->lock);
+
+    if (io_thread == NULL || num_connections < io_thread_num_connections)
+    {
+      io_thread = candidate_io_thread;
+      io_thread_num_connections = num_connections;
+    }
+  }
+
+  net_pending_socket_t *pending_socket = malloc(sizeof(net_pending_socket_t));
+  assert(pending_socket != NULL);
+  pending_socket->sock = connection->sock;
+  pending_socket->sa = connection->sa;
+
+  mtx_lock(&io_thread->lock);
+  assert(vec_push(&io_thread->pending_sockets, pending_socket) == 0);
+  mtx_unlock(&io_thread->lock);
+
+  connection->sock = INVALID_SOCKET;
+  connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+}
+
+static void stop_net_io_threads(void)
+{
+  g_net_io_threads_running = 0;
+  for (uint16_t i = 0; i < g_net_num_started_io_threads; i++)
+  {
+    thrd_join(g_net_io_threads[i].thread, NULL);
+  }
+
+  for (uint16_t i = 0; i < g_net_num_started_io_threads; i++)
+  {
+    net_io_thread_t *io_thread = &g_net_io_threads[i];
+
+    // closes the remaining connections, queueing their teardown
+    mg_mgr_free(&io_thread->mgr);
+
+    void *value = NULL;
+    int index = 0;
+    vec_foreach(&io_thread->pending_sockets, value, index)
+    {
+      net_pending_socket_t *pending_socket = (net_pending_socket_t*)value;
+      closesocket(pending_socket->sock);
+      free(pending_socket);
     }
 
-    free_packet(packet);
+    vec_deinit(&io_thread->pending_sockets);
+    vec_deinit(&io_thread->connections);
+    mtx_destroy(&io_thread->lock);
   }
 
-  buffer_iterator_free(buffer_iterator);
-  buffer_free(buffer);
+  g_net_num_started_io_threads = 0;
+  assert(dispatch_net_packets() == 0);
+  deque_destroy(g_net_dispatch_queue);
+  g_net_dispatch_queue = NULL;
+  mtx_destroy(&g_net_dispatch_lock);
+}
+
+static int start_net_io_threads(void)
+{
+  mtx_init(&g_net_dispatch_lock, mtx_plain);
+  assert(deque_new(&g_net_dispatch_queue) == CC_OK);
+
+  g_net_io_threads_running = 1;
+  g_net_num_started_io_threads = 0;
+  for (uint16_t i = 0; i < g_net_num_io_threads; i++)
+  {
+    net_io_thread_t *io_thread = &g_net_io_threads[i];
+    mg_mgr_init(&io_thread->mgr, NULL);
+    mtx_init(&io_thread->lock, mtx_recursive);
+    vec_init(&io_thread->pending_sockets);
+    vec_init(&io_thread->connections);
+
+    if (thrd_create(&io_thread->thread, net_io_thread, io_thread) != thrd_success)
+    {
+      LOG_ERROR("Failed to start network io thread: %hu!", i);
+      mg_mgr_free(&io_thread->mgr);
+      vec_deinit(&io_thread->pending_sockets);
+      vec_deinit(&io_thread->connections);
+      mtx_destroy(&io_thread->lock);
+      stop_net_io_threads();
+      return 1;
+    }
+
+    g_net_num_started_io_threads++;
+  }
+
+  LOG_INFO("Started network io on [%hu] threads...", g_net_num_io_threads);
+  return 0;
 }
 
 static void ev_handler(struct mg_connection *connection, int ev, void *p)
@@ -371,6 +1041,15 @@ static void ev_handler(struct mg_connection *connection, int ev, void *p)
   {
     case MG_EV_ACCEPT:
       {
+        // accepted connections inherit the listener's user data,
+        // which holds the listener's own net connection...
+        connection->user_data = NULL;
+        if (g_net_io_threads_running)
+        {
+          hand_off_net_connection(connection);
+          break;
+        }
+
         net_connection_t *net_connection = init_net_connection(connection);
         assert(add_net_connection(net_connection) == 0);
       }
@@ -380,6 +1059,9 @@ static void ev_handler(struct mg_connection *connection, int ev, void *p)
         net_connection_t *net_connection = get_net_connection(connection);
         assert(net_connection != NULL);
 
+        // the remote address may have only been resolved once connected
+        net_connection->remote_ip = ntohl(*(uint32_t*)&connection->sa.sin.sin_addr);
+
         uint8_t use_testnet = parameters_get_use_testnet();
         assert(handle_packet_sendto(net_connection, PKT_TYPE_CONNECT_ESTABLISH_REQ, g_net_host_port, use_testnet) == 0);
       }
@@ -394,36 +1076,12 @@ static void ev_handler(struct mg_connection *connection, int ev, void *p)
       break;
     case MG_EV_CLOSE:
       {
+        // connections handed off to an io thread have no net connection here
         net_connection_t *net_connection = get_net_connection(connection);
-        assert(net_connection != NULL);
-
-        peer_t *peer = get_peer_from_net_connection(net_connection);
-        if (peer != NULL)
+        if (net_connection != NULL)
         {
-          // check to see if we are trying to sync to the connection
-          // that was just closed by the remote host...
-          if (get_sync_initiated() && get_sync_net_connection() == net_connection)
-          {
-            uint32_t remote_ip = ntohl(*(uint32_t*)&connection->sa.sin.sin_addr);
-            char *address_str = convert_ip_to_str(remote_ip);
-            LOG_INFO("Connection closed during syncronization with peer %s:%u, continuing anyways...", address_str, net_connection->host_port);
-            free(address_str);
-
-            // forcefully end syncronization, since the connection we tried to sync to
-            // has been closed, let's assume we have the top block so that we don't
-            // restore the blockchain to the point before we started syncronizing...
-            if (check_sync_status(1))
-            {
-              assert(clear_sync_request(0) == 0);
-            }
-          }
-
-          assert(remove_peer(peer) == 0);
-          free_peer(peer);
+          net_connection_closed(net_connection);
         }
-
-        assert(remove_net_connection(net_connection) == 0);
-        free_net_connection(net_connection);
       }
       break;
     default:
@@ -505,15 +1163,35 @@ void setup_net_port_mapping(uint16_t port)
 
 int net_run(void)
 {
-  while (g_net_initialized)
+  set_current_thread_affinity(THREAD_AFFINITY_NET_LOOP, 0);
+  set_trace_thread_name("net loop");
+  while (g_net_initialized && g_net_run_stopped == 0)
   {
-    mg_mgr_poll(&g_net_mgr, NET_MGR_POLL_DELAY);
+    // poll more often when packets received on the io threads are waiting,
+    // the poll never blocks past the time the next task is due...
+    if (g_net_io_threads_running)
+    {
+      mg_mgr_poll(&g_net_mgr, taskmgr_get_next_task_delay(NET_IO_THREADS_MGR_POLL_DELAY));
+      assert(dispatch_net_packets() == 0);
+    }
+    else
+    {
+      mg_mgr_poll(&g_net_mgr, taskmgr_get_next_task_delay(NET_MGR_POLL_DELAY));
+    }
+
     assert(taskmgr_tick() == 0);
   }
 
   return 0;
 }
 
+void stop_net_run(void)
+{
+  // the net loop exits once the current poll and task tick returns,
+  // the caller is still responsible for calling deinit_net...
+  g_net_run_stopped = 1;
+}
+
 int connect_net_to_peer(const char *address, uint16_t port)
 {
   char *bind_address = convert_to_addr_str(address, port);
@@ -525,8 +1203,12 @@ int connect_net_to_peer(const char *address, uint16_t port)
   }
 
   free(bind_address);
+  mark_peer_address_attempt(convert_str_to_ip(address), port);
+
   net_connection_t *net_connection = init_net_connection(connection);
   net_connection->host_port = port;
+  net_connection->outbound = 1;
+  net_connection->dial_ts = get_current_time();
   assert(add_net_connection(net_connection) == 0);
 
   uint32_t remote_ip = ntohl(*(uint32_t*)&connection->sa.sin.sin_addr);
@@ -572,70 +1254,132 @@ int connect_seed_node(seed_node_entry_t seed_node_entry)
   return 0;
 }
 
+static void add_seed_nodes_to_peer_table(const seed_node_entry_t *seed_nodes, int num_seed_nodes)
+{
+  for (int i = 0; i < num_seed_nodes; i++)
+  {
+    add_peer_address(convert_str_to_ip(seed_nodes[i].address), seed_nodes[i].port);
+  }
+}
+
+/*
+ * The seed nodes are added to the peer table alongside the peers we have heard of,
+ * so they are dialed by the connection manager with the same backoff as any other
+ * address. The first round of dials is started right away instead of on the next tick...
+ */
 int connect_net_to_seeds(void)
 {
   if (parameters_get_use_testnet())
   {
-    for (int i = 0; i < NUM_TESTNET_SEED_NODES; i++)
+    add_seed_nodes_to_peer_table(TESTNET_SEED_NODES, NUM_TESTNET_SEED_NODES);
+  }
+  else
+  {
+    add_seed_nodes_to_peer_table(SEED_NODES, NUM_SEED_NODES);
+  }
+
+  return manage_net_connections();
+}
+
+/*
+ * Keeps dialing addresses from our peer table until we have the target number of outbound
+ * peers, the dials are all in flight at once. Dials which have not completed their handshake
+ * in time are closed, the peer table backs off the addresses which keep failing...
+ */
+int manage_net_connections(void)
+{
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+
+  uint32_t current_time = get_current_time();
+  uint16_t num_outbound_peers = 0;
+  uint16_t num_pending_dials = 0;
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    net_connection_t *net_connection = net_connections[i];
+    assert(net_connection != NULL);
+    if (net_connection->outbound == 0)
     {
-      seed_node_entry_t seed_node_entry = TESTNET_SEED_NODES[i];
-      if (connect_seed_node(seed_node_entry))
+      continue;
+    }
+
+    num_outbound_peers++;
+    if (net_connection->anonymous)
+    {
+      num_pending_dials++;
+      if (current_time - net_connection->dial_ts > NET_DIAL_TIMEOUT)
       {
-        LOG_WARNING("Failed to connect to testnet seed node on address: %s%u!", seed_node_entry.address, seed_node_entry.port);
+        char *address_str = convert_ip_to_str(net_connection->remote_ip);
+        LOG_DEBUG("Timed out when dialing peer on address: %s:%u!", address_str, net_connection->host_port);
+        free(address_str);
+        close_net_connection(net_connection);
       }
     }
   }
-  else
+
+  if (num_outbound_peers >= g_net_target_outbound_peers || num_pending_dials >= NET_MAX_PENDING_DIALS)
+  {
+    return 0;
+  }
+
+  uint16_t num_dials = MIN(g_net_target_outbound_peers - num_outbound_peers, NET_MAX_PENDING_DIALS - num_pending_dials);
+  peer_address_t addresses[MAX_P2P_PEERS_COUNT];
+  uint16_t num_addresses = select_peer_addresses(addresses, MAX_P2P_PEERS_COUNT);
+  for (uint16_t i = 0; i < num_addresses && num_dials > 0; i++)
   {
-    for (int i = 0; i < NUM_SEED_NODES; i++)
+    uint16_t num_peers = get_num_peers();
+    if (num_peers >= MAX_P2P_PEERS_COUNT)
     {
-      seed_node_entry_t seed_node_entry = SEED_NODES[i];
-      if (connect_seed_node(seed_node_entry))
-      {
-        LOG_WARNING("Failed to connect to seed node on address: %s%u!", seed_node_entry.address, seed_node_entry.port);
-      }
+      break;
+    }
+
+    char *address_str = convert_ip_to_str(addresses[i].ip);
+    seed_node_entry_t peer_entry = {address_str, addresses[i].port};
+    if (connect_seed_node(peer_entry))
+    {
+      LOG_DEBUG("Failed to dial peer on address: %s:%u!", address_str, addresses[i].port);
     }
+
+    // our own address and the peers we are already connected to are skipped
+    if (get_num_peers() > num_peers)
+    {
+      num_dials--;
+    }
+
+    free(address_str);
   }
 
   return 0;
 }
 
+/*
+ * Hands every queued payload straight to the connection's send buffer,
+ * mongoose has no scatter/gather send so it's copy into the connection's
+ * send buffer is the only copy a queued payload goes through.
+ */
 int flush_send_queue(net_connection_t *net_connection)
 {
   assert(net_connection != NULL);
-  if (net_connection->send_queue_size > 0)
+  TRACE_SPAN("flush_send_queue");
+  if (net_connection->send_queue.length > 0)
   {
     void *value = NULL;
     int index = 0;
-
-    buffer_t *buffer = buffer_init();
     vec_foreach(&net_connection->send_queue, value, index)
     {
-      buffer_t *queued_buffer = (buffer_t*)value;
-      assert(queued_buffer != NULL);
+      net_payload_t *payload = (net_payload_t*)value;
+      assert(payload != NULL);
 
-      uint8_t *data = buffer_get_data(queued_buffer);
-      size_t data_len = buffer_get_size(queued_buffer);
-
-      if (buffer_write(buffer, data, data_len))
-      {
-        buffer_free(buffer);
-        return 1;
-      }
-
-      buffer_free(queued_buffer);
+      mg_send(net_connection->connection, buffer_get_data(payload->buffer), buffer_get_size(payload->buffer));
+      release_net_payload(payload);
     }
 
-    vec_splice(&net_connection->send_queue, 0, net_connection->send_queue_size);
+    vec_clear(&net_connection->send_queue);
     net_connection->send_queue_size = 0;
-
-    uint8_t *data = buffer_get_data(buffer);
-    size_t data_len = buffer_get_size(buffer);
-
-    mg_send(net_connection->connection, data, data_len);
-    buffer_free(buffer);
   }
 
+  net_connection->send_buffer_size = net_connection->connection->send_mbuf.len;
+  update_net_connection_send_paused(net_connection);
   return 0;
 }
 
@@ -648,6 +1392,12 @@ int flush_all_connections_nolock(void)
     net_connection_t *net_connection = (net_connection_t*)value;
     assert(net_connection != NULL);
 
+    // connections owned by an io thread are flushed by that thread
+    if (net_connection->io_thread != NULL)
+    {
+      continue;
+    }
+
     if (flush_send_queue(net_connection))
     {
       return 1;
@@ -677,10 +1427,10 @@ int flush_all_connections_noblock(void)
   return result;
 }
 
-static task_result_t reconnect_seeds(task_t *task, va_list args)
+static task_result_t manage_connections(task_t *task, va_list args)
 {
   assert(task != NULL);
-  assert(connect_net_to_seeds() == 0);
+  assert(manage_net_connections() == 0);
   return TASK_RESULT_WAIT;
 }
 
@@ -691,6 +1441,89 @@ static task_result_t flush_connections(task_t *task, va_list args)
   return TASK_RESULT_WAIT;
 }
 
+int get_net_connection_num_deferred_packets(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  return net_connection->deferred_packets.length;
+}
+
+/*
+ * Disconnects the peers which have been paused for longer than the stall timeout and replays
+ * the deferred requests of the ones that have resumed, the send buffers of the main loop's connections
+ * drain without being flushed so their paused state is refreshed here. The io threads refresh their own
+ * connections, this must be called on the main network thread...
+ */
+int check_net_send_queues(void)
+{
+  uint32_t current_time = get_current_time();
+
+  // the io threads take the net lock while holding their own lock, so the
+  // connections are gathered first and checked once the net lock is released...
+  vec_void_t net_connections;
+  vec_init(&net_connections);
+
+  mtx_lock(&g_net_lock);
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&g_net_connections, value, index)
+  {
+    net_connection_t *net_connection = (net_connection_t*)value;
+    assert(net_connection != NULL);
+
+    if (net_connection->io_thread == NULL)
+    {
+      net_connection->send_buffer_size = net_connection->connection->send_mbuf.len;
+      update_net_connection_send_paused(net_connection);
+    }
+
+    assert(vec_push(&net_connections, net_connection) == 0);
+  }
+
+  mtx_unlock(&g_net_lock);
+
+  vec_foreach(&net_connections, value, index)
+  {
+    net_connection_t *net_connection = (net_connection_t*)value;
+    net_io_thread_t *io_thread = net_connection->io_thread;
+    if (io_thread != NULL)
+    {
+      mtx_lock(&io_thread->lock);
+    }
+
+    int send_stalled = is_net_connection_send_paused(net_connection) &&
+      current_time - net_connection->send_paused_ts > g_net_send_queue_stall_timeout;
+    size_t pending_send_size = get_net_connection_pending_send_size(net_connection);
+    int closed = net_connection->connection == NULL || net_connection->close_requested ||
+      (io_thread == NULL && (net_connection->connection->flags & MG_F_CLOSE_IMMEDIATELY));
+
+    if (io_thread != NULL)
+    {
+      mtx_unlock(&io_thread->lock);
+    }
+
+    if (send_stalled)
+    {
+      LOG_INFO("Disconnecting peer with %zu bytes waiting to be sent for over %u seconds.",
+        pending_send_size, g_net_send_queue_stall_timeout);
+      close_net_connection(net_connection);
+    }
+    else if (closed == 0)
+    {
+      replay_deferred_net_packets(net_connection);
+    }
+  }
+
+  vec_deinit(&net_connections);
+  return 0;
+}
+
+static task_result_t check_send_queues(task_t *task, va_list args)
+{
+  assert(task != NULL);
+  assert(check_net_send_queues() == 0);
+  return TASK_RESULT_WAIT;
+}
+
 int init_net(connection_entries_t connection_entries)
 {
   if (g_net_initialized)
@@ -700,8 +1533,18 @@ int init_net(connection_entries_t connection_entries)
 
   vec_init(&g_net_connections);
   mtx_init(&g_net_lock, mtx_recursive);
+  mtx_init(&g_net_payload_lock, mtx_plain);
   mg_mgr_init(&g_net_mgr, NULL);
 
+  // received packet payloads are drawn from the buffer pool
+  init_buffer_pool();
+
+  if (g_net_send_queue_low_watermark > g_net_send_queue_high_watermark)
+  {
+    LOG_WARNING("Send queue low watermark is above the high watermark, using the high watermark for both!");
+    g_net_send_queue_low_watermark = g_net_send_queue_high_watermark;
+  }
+
   if (g_net_host_port == 0)
   {
     g_net_host_port = parameters_get_p2p_port();
@@ -733,6 +1576,13 @@ int init_net(connection_entries_t connection_entries)
   g_net_connection->host_port = g_net_host_port;
   assert(add_net_connection(g_net_connection) == 0);
 
+  // accepted connections are handed off to the io threads when enabled,
+  // outbound connections and the listener stay on the main network loop...
+  if (g_net_num_io_threads > 0 && start_net_io_threads())
+  {
+    return 1;
+  }
+
   // connect to the peers in the seeds list
   assert(connect_net_to_seeds() == 0);
 
@@ -752,10 +1602,15 @@ int init_net(connection_entries_t connection_entries)
   }
 
   g_net_resync_chain_task = add_task(resync_chain, RESYNC_CHAIN_TASK_DELAY);
-  g_net_reconnect_seeds_task = add_task(reconnect_seeds, NET_RECONNECT_SEEDS_TASK_DELAY);
+  g_net_relay_inventory_task = add_task(relay_inventory, RELAY_INVENTORY_TASK_DELAY);
+  g_net_request_block_filters_task = add_task(request_missing_block_filters, REQUEST_BLOCK_FILTERS_TASK_DELAY);
+  g_net_ping_peers_task = add_task(ping_peers, PEER_PING_TASK_DELAY);
+  g_net_check_send_queues_task = add_task(check_send_queues, NET_CHECK_SEND_QUEUES_TASK_DELAY);
+  g_net_manage_connections_task = add_task(manage_connections, NET_MANAGE_CONNECTIONS_TASK_DELAY);
 #ifdef USE_NET_QUEUE
   g_net_flush_connections_task = add_task(flush_connections, NET_FLUSH_CONNECTIONS_TASK_DELAY);
 #endif
+  g_net_run_stopped = 0;
   g_net_initialized = 1;
   return 0;
 }
@@ -772,16 +1627,33 @@ int deinit_net(void)
     return 1;
   }
 
+  if (g_net_io_threads_running)
+  {
+    stop_net_io_threads();
+  }
+
   mg_mgr_free(&g_net_mgr);
   vec_deinit(&g_net_connections);
   remove_task(g_net_resync_chain_task);
-  remove_task(g_net_reconnect_seeds_task);
+  remove_task(g_net_relay_inventory_task);
+  clear_requested_transaction_ids();
+  remove_task(g_net_request_block_filters_task);
+  clear_block_filters_request();
+  remove_task(g_net_ping_peers_task);
+  remove_task(g_net_check_send_queues_task);
+  remove_task(g_net_manage_connections_task);
 #ifdef USE_NET_QUEUE
   remove_task(g_net_flush_connections_task);
 #endif
+  mtx_destroy(&g_net_payload_lock);
   mtx_destroy(&g_net_lock);
+  deinit_buffer_pool();
 
   g_net_resync_chain_task = NULL;
+  g_net_relay_inventory_task = NULL;
+  g_net_request_block_filters_task = NULL;
+  g_net_ping_peers_task = NULL;
+  g_net_check_send_queues_task = NULL;
   g_num_connections = 0;
   g_net_initialized = 0;
   return 0;
@@ -27,6 +27,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include <mongoose.h>
 
@@ -42,21 +43,100 @@ VULKAN_BEGIN_DECL
 
 #define NET_MAX_NUM_CONNECTION_ENTRIES 1024
 #define NET_MGR_POLL_DELAY 1000
-#define NET_RECONNECT_SEEDS_TASK_DELAY 10
 #define NET_FLUSH_CONNECTIONS_TASK_DELAY 0.01
 
+// the connection manager keeps dialing peers until we have the target number of
+// outbound peers, up to the max pending dials at once. Dials which have not completed
+// their handshake by the dial timeout are closed, and the address is backed off...
+#define NET_TARGET_OUTBOUND_PEERS 8
+#define NET_MAX_PENDING_DIALS 8
+#define NET_DIAL_TIMEOUT 5
+#define NET_MANAGE_CONNECTIONS_TASK_DELAY 0.5
+
+// a packet starts with it's id and size, followed by the size of
+// the payload again for packets that have a payload...
+#define PACKET_HEADER_MIN_SIZE 8
+#define PACKET_HEADER_SIZE 12
+
+// the payload buffer of a packet starts out at the initial size and grows as the payload
+// arrives, so a peer can not make us allocate much more than it actually sends. Connections
+// which have not completed their handshake are closed on any packet over the anonymous size...
+#define NET_RECEIVE_PAYLOAD_INITIAL_SIZE (64 * 1024)
+#define NET_MAX_ANONYMOUS_PACKET_SIZE (1024 * 1024)
+
+#define MAX_NUM_NET_IO_THREADS 16
+#define NET_IO_THREAD_POLL_DELAY 10
+#define NET_IO_THREADS_MGR_POLL_DELAY 10
+
+// a connection with more than the high watermark of bytes waiting to be sent is paused,
+// relays to the peer are skipped and it's data requests are deferred, up to the max number
+// of deferred packets, until it drains below the low watermark. Peers which stay paused
+// for longer than the stall timeout are disconnected...
+#define NET_SEND_QUEUE_HIGH_WATERMARK (64 * 1024 * 1024)
+#define NET_SEND_QUEUE_LOW_WATERMARK (16 * 1024 * 1024)
+#define NET_SEND_QUEUE_STALL_TIMEOUT 60
+#define NET_CHECK_SEND_QUEUES_TASK_DELAY 1
+#define NET_MAX_DEFERRED_PACKETS 64
+
+// an immutable serialized packet shared by every send queue it is queued in,
+// the payload is free'd once the last reference to it has been released...
+typedef struct NetPayload
+{
+  buffer_t *buffer;
+  uint32_t refcount;
+} net_payload_t;
+
 typedef struct NetConnection
 {
   struct mg_connection *connection;
   vec_void_t send_queue;
-  size_t send_queue_size;
 
-  int is_receiving_data;
-  size_t expected_receiving_len;
-  buffer_t *receiving_buffer;
+  // the bytes waiting in the send queue, and in the connection's send buffer
+  // as of the last time the connection was flushed by it's owning thread. The paused
+  // state is written by the owning thread and read by the main thread without a lock...
+  size_t send_queue_size;
+  size_t send_buffer_size;
+  atomic_int send_paused;
+  uint32_t send_paused_ts;
+
+  // the data requests received while the connection was paused, replayed
+  // in order by the main thread once the connection has been resumed...
+  vec_void_t deferred_packets;
+
+  // the io thread that owns the connection, NULL when the connection
+  // belongs to the main network loop. Once the io thread has closed the
+  // connection, connection is set to NULL until the main thread tears it down...
+  struct NetIOThread *io_thread;
+  int close_requested;
+  uint32_t remote_ip;
+
+  // the streaming packet framer, a packet's header is gathered first after
+  // which it's payload is received straight into the packet's payload buffer...
+  uint8_t receiving_header[PACKET_HEADER_SIZE];
+  size_t receiving_header_size;
+  struct Packet *receiving_packet;
+  size_t receiving_payload_size;
+  size_t receiving_payload_capacity;
 
   uint32_t host_port;
   int anonymous;
+
+  // connections we dialed ourselves, a dial is pending until the
+  // peer answers our handshake and the connection is no longer anonymous...
+  int outbound;
+  uint32_t dial_ts;
+
+  // the tx ids this peer is known to have and the tx ids waiting to be
+  // announced to it, created once the first tx is relayed to or from the peer...
+  struct Inventory *inventory;
+
+  // the byte budget of a grouped blocks response including full blocks,
+  // negotiated with the peer when establishing the connection...
+  uint32_t grouped_blocks_budget_size;
+  uint32_t capabilities;
+
+  // the capabilities as advertised by the peer, including the ones we do not use
+  uint32_t peer_capabilities;
 } net_connection_t;
 
 typedef struct ConnectionEntry
@@ -82,11 +162,30 @@ VULKAN_API const char* get_net_external_address(void);
 VULKAN_API void set_net_disable_port_mapping(int disable_port_mapping);
 VULKAN_API int get_net_disable_port_mapping(void);
 
+VULKAN_API void set_net_num_io_threads(uint16_t num_io_threads);
+VULKAN_API uint16_t get_net_num_io_threads(void);
+
+VULKAN_API void set_net_send_queue_high_watermark(size_t high_watermark);
+VULKAN_API size_t get_net_send_queue_high_watermark(void);
+
+VULKAN_API void set_net_send_queue_low_watermark(size_t low_watermark);
+VULKAN_API size_t get_net_send_queue_low_watermark(void);
+
+VULKAN_API void set_net_send_queue_stall_timeout(uint32_t stall_timeout);
+VULKAN_API uint32_t get_net_send_queue_stall_timeout(void);
+
+VULKAN_API void set_net_target_outbound_peers(uint16_t target_outbound_peers);
+VULKAN_API uint16_t get_net_target_outbound_peers(void);
+
 VULKAN_API const char* get_net_bind_address(void);
+VULKAN_API struct mg_mgr* get_net_mgr(void);
 
 VULKAN_API net_connection_t* init_net_connection(struct mg_connection *connection);
 VULKAN_API void free_net_connection(net_connection_t *net_connection);
 
+VULKAN_API size_t get_net_connection_pending_send_size(net_connection_t *net_connection);
+VULKAN_API int is_net_connection_send_paused(net_connection_t *net_connection);
+
 VULKAN_API net_connection_t* get_net_connection_nolock(struct mg_connection *connection);
 VULKAN_API net_connection_t* get_net_connection(struct mg_connection *connection);
 
@@ -98,10 +197,18 @@ VULKAN_API int add_net_connection(net_connection_t *net_connection);
 
 VULKAN_API int remove_net_connection_nolock(net_connection_t *net_connection);
 VULKAN_API int remove_net_connection(net_connection_t *net_connection);
+VULKAN_API int get_num_net_connections(void);
 
 VULKAN_API int close_net_connection(net_connection_t *net_connection);
 VULKAN_API int connect_net_to_seeds(void);
 
+VULKAN_API net_payload_t* make_net_payload(buffer_t *buffer);
+VULKAN_API net_payload_t* retain_net_payload(net_payload_t *payload);
+VULKAN_API void release_net_payload(net_payload_t *payload);
+
+VULKAN_API int broadcast_payload(net_connection_t *net_connection, net_payload_t *payload);
+VULKAN_API int send_payload(net_connection_t *net_connection, net_payload_t *payload);
+
 VULKAN_API int broadcast_data(net_connection_t *net_connection, const uint8_t *data, size_t data_len);
 VULKAN_API int send_data(net_connection_t *net_connection, const uint8_t *data, size_t data_len);
 VULKAN_API void data_received(net_connection_t *net_connection, const uint8_t *data, size_t data_len);
@@ -111,13 +218,21 @@ VULKAN_API int connect_net_to_peer(const char *address, uint16_t port);
 
 VULKAN_API int connect_seed_node(seed_node_entry_t seed_node_entry);
 VULKAN_API int connect_net_to_seeds(void);
+VULKAN_API int manage_net_connections(void);
+
+VULKAN_API void hand_off_net_connection(struct mg_connection *connection);
+VULKAN_API int dispatch_net_packets(void);
 
 VULKAN_API int flush_send_queue(net_connection_t *net_connection);
 VULKAN_API int flush_all_connections_nolock(void);
 VULKAN_API int flush_all_connections(void);
 VULKAN_API int flush_all_connections_noblock(void);
 
+VULKAN_API int get_net_connection_num_deferred_packets(net_connection_t *net_connection);
+VULKAN_API int check_net_send_queues(void);
+
 VULKAN_API int net_run(void);
+VULKAN_API void stop_net_run(void);
 VULKAN_API int init_net(connection_entries_t connection_entries);
 VULKAN_API int deinit_net(void);
 
@@ -0,0 +1,356 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <hashtable.h>
+
+#include "common/tinycthread.h"
+#include "common/util.h"
+
+#include "block.h"
+#include "orphan_pool.h"
+#include "parameters.h"
+
+// the orphan pool is filled by the sync and drained by the blockchain as blocks
+// connect, so unlike the block cache it is locked on it's own...
+static int g_orphan_pool_initialized = 0;
+static mtx_t g_orphan_pool_lock;
+static HashTable *g_orphan_pool_table = NULL;
+static HashTable *g_orphan_pool_previous_table = NULL;
+
+// the orphans in the order they were added, oldest first
+static orphan_block_entry_t *g_orphan_pool_head = NULL;
+static orphan_block_entry_t *g_orphan_pool_tail = NULL;
+
+static size_t g_orphan_pool_max_memory_size = DEFAULT_ORPHAN_POOL_MAX_MEMORY_SIZE;
+static size_t g_orphan_pool_memory_size = 0;
+
+static int compare_orphan_block_hash(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, HASH_SIZE);
+}
+
+static orphan_block_entry_t* get_orphan_block_entry(HashTable *table, uint8_t *block_hash)
+{
+  assert(table != NULL);
+  assert(block_hash != NULL);
+
+  void *val = NULL;
+  if (hashtable_get(table, block_hash, &val) != CC_OK)
+  {
+    return NULL;
+  }
+
+  return (orphan_block_entry_t*)val;
+}
+
+/*
+ * Removes the entry from both of the pool's indexes and it's order, the entry's block
+ * is left for the caller. The previous hash index is keyed by the first of the entries
+ * waiting on a block, so the next sibling takes over the key when the first is removed.
+ */
+static void unlink_orphan_block_entry(orphan_block_entry_t *entry)
+{
+  assert(entry != NULL);
+  assert(hashtable_remove(g_orphan_pool_table, entry->hash, NULL) == CC_OK);
+
+  orphan_block_entry_t *first_sibling = get_orphan_block_entry(g_orphan_pool_previous_table, entry->previous_hash);
+  assert(first_sibling != NULL);
+  if (first_sibling == entry)
+  {
+    assert(hashtable_remove(g_orphan_pool_previous_table, entry->previous_hash, NULL) == CC_OK);
+    if (entry->next_sibling != NULL)
+    {
+      assert(hashtable_add(g_orphan_pool_previous_table, entry->next_sibling->previous_hash, entry->next_sibling) == CC_OK);
+    }
+  }
+  else
+  {
+    orphan_block_entry_t *sibling = first_sibling;
+    while (sibling->next_sibling != entry)
+    {
+      sibling = sibling->next_sibling;
+      assert(sibling != NULL);
+    }
+
+    sibling->next_sibling = entry->next_sibling;
+  }
+
+  if (entry->prev != NULL)
+  {
+    entry->prev->next = entry->next;
+  }
+  else
+  {
+    g_orphan_pool_head = entry->next;
+  }
+
+  if (entry->next != NULL)
+  {
+    entry->next->prev = entry->prev;
+  }
+  else
+  {
+    g_orphan_pool_tail = entry->prev;
+  }
+
+  g_orphan_pool_memory_size -= entry->memory_size;
+  entry->next_sibling = NULL;
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static block_t* take_orphan_block_entry(orphan_block_entry_t *entry)
+{
+  assert(entry != NULL);
+  unlink_orphan_block_entry(entry);
+  block_t *block = entry->block;
+  free(entry);
+  return block;
+}
+
+static void evict_orphan_block_entry(orphan_block_entry_t *entry)
+{
+  assert(entry != NULL);
+  free_block(take_orphan_block_entry(entry));
+}
+
+void set_orphan_pool_max_memory_size(size_t max_memory_size)
+{
+  g_orphan_pool_max_memory_size = max_memory_size;
+}
+
+size_t get_orphan_pool_max_memory_size(void)
+{
+  return g_orphan_pool_max_memory_size;
+}
+
+size_t get_orphan_pool_memory_size(void)
+{
+  mtx_lock(&g_orphan_pool_lock);
+  size_t memory_size = g_orphan_pool_memory_size;
+  mtx_unlock(&g_orphan_pool_lock);
+  return memory_size;
+}
+
+size_t get_num_orphan_blocks(void)
+{
+  if (g_orphan_pool_table == NULL)
+  {
+    return 0;
+  }
+
+  mtx_lock(&g_orphan_pool_lock);
+  size_t num_orphan_blocks = hashtable_size(g_orphan_pool_table);
+  mtx_unlock(&g_orphan_pool_lock);
+  return num_orphan_blocks;
+}
+
+int has_orphan_block(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  mtx_lock(&g_orphan_pool_lock);
+  int result = get_orphan_block_entry(g_orphan_pool_table, block_hash) != NULL;
+  mtx_unlock(&g_orphan_pool_lock);
+  return result;
+}
+
+/*
+ * The orphan pool takes ownership of the block unless it could not be added, a block
+ * already in the pool or larger than the whole pool's memory budget is not added. The
+ * expired orphans and then the oldest orphans are evicted to make room for the block...
+ */
+int add_orphan_block(block_t *block)
+{
+  assert(block != NULL);
+  assert(g_orphan_pool_table != NULL);
+  size_t memory_size = sizeof(orphan_block_entry_t) + (sizeof(TableEntry) * 2) + get_block_memory_size(block);
+
+  mtx_lock(&g_orphan_pool_lock);
+  if (get_orphan_block_entry(g_orphan_pool_table, block->hash) != NULL || memory_size > g_orphan_pool_max_memory_size)
+  {
+    mtx_unlock(&g_orphan_pool_lock);
+    return 1;
+  }
+
+  // the orphans which have expired are evicted along the way
+  uint32_t current_time = get_current_time();
+  while (g_orphan_pool_head != NULL &&
+         (hashtable_size(g_orphan_pool_table) >= ORPHAN_POOL_MAX_BLOCKS ||
+          g_orphan_pool_memory_size + memory_size > g_orphan_pool_max_memory_size ||
+          current_time - g_orphan_pool_head->received_ts > ORPHAN_BLOCK_EXPIRE_TIME))
+  {
+    evict_orphan_block_entry(g_orphan_pool_head);
+  }
+
+  orphan_block_entry_t *entry = malloc(sizeof(orphan_block_entry_t));
+  assert(entry != NULL);
+  memcpy(entry->hash, block->hash, HASH_SIZE);
+  memcpy(entry->previous_hash, block->previous_hash, HASH_SIZE);
+  entry->block = block;
+  entry->memory_size = memory_size;
+  entry->received_ts = current_time;
+  entry->next_sibling = NULL;
+  entry->prev = g_orphan_pool_tail;
+  entry->next = NULL;
+
+  assert(hashtable_add(g_orphan_pool_table, entry->hash, entry) == CC_OK);
+  orphan_block_entry_t *first_sibling = get_orphan_block_entry(g_orphan_pool_previous_table, entry->previous_hash);
+  if (first_sibling != NULL)
+  {
+    entry->next_sibling = first_sibling->next_sibling;
+    first_sibling->next_sibling = entry;
+  }
+  else
+  {
+    assert(hashtable_add(g_orphan_pool_previous_table, entry->previous_hash, entry) == CC_OK);
+  }
+
+  if (g_orphan_pool_tail != NULL)
+  {
+    g_orphan_pool_tail->next = entry;
+  }
+  else
+  {
+    g_orphan_pool_head = entry;
+  }
+
+  g_orphan_pool_tail = entry;
+  g_orphan_pool_memory_size += memory_size;
+  mtx_unlock(&g_orphan_pool_lock);
+  return 0;
+}
+
+/*
+ * Removes the orphan block from the pool and hands it's ownership to the caller,
+ * returns NULL when the block is not in the pool.
+ */
+block_t* take_orphan_block(uint8_t *block_hash)
+{
+  assert(block_hash != NULL);
+  mtx_lock(&g_orphan_pool_lock);
+  orphan_block_entry_t *entry = get_orphan_block_entry(g_orphan_pool_table, block_hash);
+  block_t *block = entry != NULL ? take_orphan_block_entry(entry) : NULL;
+  mtx_unlock(&g_orphan_pool_lock);
+  return block;
+}
+
+/*
+ * Removes one of the orphan blocks waiting on the previous block from the pool and hands
+ * it's ownership to the caller, returns NULL once no orphans are waiting on the block.
+ */
+block_t* take_orphan_block_from_previous_hash(uint8_t *previous_hash)
+{
+  assert(previous_hash != NULL);
+  mtx_lock(&g_orphan_pool_lock);
+  orphan_block_entry_t *entry = get_orphan_block_entry(g_orphan_pool_previous_table, previous_hash);
+  block_t *block = entry != NULL ? take_orphan_block_entry(entry) : NULL;
+  mtx_unlock(&g_orphan_pool_lock);
+  return block;
+}
+
+/*
+ * Evicts the orphans which have been waiting for longer than ORPHAN_BLOCK_EXPIRE_TIME
+ * as of the current time, returns the number of orphans which expired.
+ */
+uint32_t expire_orphan_blocks(uint32_t current_time)
+{
+  uint32_t num_expired = 0;
+  mtx_lock(&g_orphan_pool_lock);
+  while (g_orphan_pool_head != NULL && current_time - g_orphan_pool_head->received_ts > ORPHAN_BLOCK_EXPIRE_TIME)
+  {
+    evict_orphan_block_entry(g_orphan_pool_head);
+    num_expired++;
+  }
+
+  mtx_unlock(&g_orphan_pool_lock);
+  return num_expired;
+}
+
+void clear_orphan_pool(void)
+{
+  mtx_lock(&g_orphan_pool_lock);
+  while (g_orphan_pool_head != NULL)
+  {
+    evict_orphan_block_entry(g_orphan_pool_head);
+  }
+
+  assert(hashtable_size(g_orphan_pool_table) == 0);
+  assert(hashtable_size(g_orphan_pool_previous_table) == 0);
+  g_orphan_pool_memory_size = 0;
+  mtx_unlock(&g_orphan_pool_lock);
+}
+
+int init_orphan_pool(void)
+{
+  if (g_orphan_pool_initialized)
+  {
+    return 1;
+  }
+
+  HashTableConf orphan_pool_conf;
+  hashtable_conf_init(&orphan_pool_conf);
+  orphan_pool_conf.key_length = HASH_SIZE;
+  orphan_pool_conf.hash = GENERAL_HASH;
+  orphan_pool_conf.key_compare = compare_orphan_block_hash;
+  if (hashtable_new_conf(&orphan_pool_conf, &g_orphan_pool_table) != CC_OK)
+  {
+    return 1;
+  }
+
+  if (hashtable_new_conf(&orphan_pool_conf, &g_orphan_pool_previous_table) != CC_OK)
+  {
+    hashtable_destroy(g_orphan_pool_table);
+    g_orphan_pool_table = NULL;
+    return 1;
+  }
+
+  mtx_init(&g_orphan_pool_lock, mtx_plain);
+  g_orphan_pool_head = NULL;
+  g_orphan_pool_tail = NULL;
+  g_orphan_pool_memory_size = 0;
+  g_orphan_pool_initialized = 1;
+  return 0;
+}
+
+void deinit_orphan_pool(void)
+{
+  if (g_orphan_pool_initialized == 0)
+  {
+    return;
+  }
+
+  clear_orphan_pool();
+  hashtable_destroy(g_orphan_pool_table);
+  hashtable_destroy(g_orphan_pool_previous_table);
+  g_orphan_pool_table = NULL;
+  g_orphan_pool_previous_table = NULL;
+  mtx_destroy(&g_orphan_pool_lock);
+  g_orphan_pool_initialized = 0;
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+#include "block.h"
+
+VULKAN_BEGIN_DECL
+
+// the orphan pool holds blocks which arrived before the block they build on top of, the
+// blocks are indexed by their hash and by their previous hash so that the orphans waiting
+// on a block are found once it connects. Orphans are evicted oldest first once the pool
+// is over it's limits, and expire after ORPHAN_BLOCK_EXPIRE_TIME seconds...
+typedef struct OrphanBlockEntry
+{
+  uint8_t hash[HASH_SIZE];
+  uint8_t previous_hash[HASH_SIZE];
+  block_t *block;
+  size_t memory_size;
+  uint32_t received_ts;
+
+  // the other orphans waiting on the same previous block
+  struct OrphanBlockEntry *next_sibling;
+
+  struct OrphanBlockEntry *prev;
+  struct OrphanBlockEntry *next;
+} orphan_block_entry_t;
+
+VULKAN_API void set_orphan_pool_max_memory_size(size_t max_memory_size);
+VULKAN_API size_t get_orphan_pool_max_memory_size(void);
+
+VULKAN_API size_t get_orphan_pool_memory_size(void);
+VULKAN_API size_t get_num_orphan_blocks(void);
+
+VULKAN_API int has_orphan_block(uint8_t *block_hash);
+VULKAN_API int add_orphan_block(block_t *block);
+VULKAN_API block_t* take_orphan_block(uint8_t *block_hash);
+VULKAN_API block_t* take_orphan_block_from_previous_hash(uint8_t *previous_hash);
+
+VULKAN_API uint32_t expire_orphan_blocks(uint32_t current_time);
+VULKAN_API void clear_orphan_pool(void);
+
+VULKAN_API int init_orphan_pool(void);
+VULKAN_API void deinit_orphan_pool(void);
+
+VULKAN_END_DECL
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
 #include <hashtable.h>
@@ -33,21 +34,25 @@
 #include "common/task.h"
 #include "common/buffer.h"
 #include "common/buffer_iterator.h"
-#include "common/buffer_storage.h"
 #include "common/util.h"
 #include "common/logger.h"
+#include "common/metrics.h"
 
 #include "net.h"
 #include "p2p.h"
 #include "parameters.h"
+#include "peer_table.h"
+#include "protocol.h"
 
 static int g_p2p_initialized = 0;
 static mtx_t g_p2p_lock;
 
 static const char *g_p2p_storage_filename = "p2p_peerlist_storage.dat";
-static buffer_storage_t *g_p2p_storage_db = NULL;
 
+// the peers are indexed by their id and by their net connection, both
+// tables hold the same peers and are only changed together...
 static HashTable* g_p2p_peerlist_table = NULL;
+static HashTable* g_p2p_connection_table = NULL;
 static int g_num_peers = 0;
 static task_t *g_p2p_storage_save_task = NULL;
 
@@ -61,6 +66,16 @@ const char *get_p2p_storage_filename(void)
   return g_p2p_storage_filename;
 }
 
+static int compare_peer_id(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, sizeof(uint64_t));
+}
+
+static int compare_peer_net_connection(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, sizeof(net_connection_t*));
+}
+
 peer_t* init_peer(uint64_t peer_id, net_connection_t *net_connection)
 {
   assert(net_connection != NULL);
@@ -68,6 +83,20 @@ peer_t* init_peer(uint64_t peer_id, net_connection_t *net_connection)
   assert(peer != NULL);
   peer->id = peer_id;
   peer->net_connection = net_connection;
+
+  peer->score = PEER_INITIAL_SCORE;
+  peer->num_failures = 0;
+  peer->num_misbehaviors = 0;
+
+  peer->rtt_ms = 0;
+  peer->block_delivery_ms = 0;
+
+  peer->ping_nonce = 0;
+  peer->ping_ts_ms = 0;
+  peer->ping_pending = 0;
+
+  peer->block_height = 0;
+  peer->block_height_ts = 0;
   return peer;
 }
 
@@ -77,21 +106,92 @@ void free_peer(peer_t *peer)
   free(peer);
 }
 
+/*
+ * Returns the expected time in milliseconds for the peer to answer a block request,
+ * the measured block delivery time is preferred over the round trip time of our pings.
+ */
+uint32_t get_peer_latency(peer_t *peer)
+{
+  assert(peer != NULL);
+  if (peer->block_delivery_ms > 0)
+  {
+    return peer->block_delivery_ms;
+  }
+
+  if (peer->rtt_ms > 0)
+  {
+    return peer->rtt_ms;
+  }
+
+  return PEER_DEFAULT_LATENCY_MS;
+}
+
+// measurements are smoothed with an exponential moving average of 1/8th
+static uint32_t smooth_peer_measurement(uint32_t average, uint32_t measurement)
+{
+  // a measurement of 0 would read as unmeasured
+  measurement = MAX(measurement, 1);
+  if (average == 0)
+  {
+    return measurement;
+  }
+
+  return (uint32_t)((((uint64_t)average * 7) + measurement) / 8);
+}
+
+static void adjust_peer_score(peer_t *peer, int32_t adjustment)
+{
+  assert(peer != NULL);
+  int32_t previous_score = peer->score;
+  peer->score = MIN(peer->score + adjustment, PEER_MAX_SCORE);
+
+  // the connection is closed asynchronously, only close it once
+  if (peer->score < PEER_MIN_SCORE && previous_score >= PEER_MIN_SCORE)
+  {
+    char *address_str = convert_ip_to_str(peer->net_connection->remote_ip);
+    LOG_INFO("Disconnecting peer %s:%u with score: %d, failures: %u, misbehaviors: %u.", address_str,
+      peer->net_connection->host_port, peer->score, peer->num_failures, peer->num_misbehaviors);
+    free(address_str);
+    close_net_connection(peer->net_connection);
+  }
+}
+
+void record_peer_rtt(peer_t *peer, uint32_t rtt_ms)
+{
+  assert(peer != NULL);
+  peer->rtt_ms = smooth_peer_measurement(peer->rtt_ms, rtt_ms);
+}
+
+void record_peer_block_delivery(peer_t *peer, uint32_t delivery_ms)
+{
+  assert(peer != NULL);
+  peer->block_delivery_ms = smooth_peer_measurement(peer->block_delivery_ms, delivery_ms);
+  adjust_peer_score(peer, PEER_DELIVERY_REWARD);
+}
+
+void record_peer_failure(peer_t *peer)
+{
+  assert(peer != NULL);
+  peer->num_failures++;
+  adjust_peer_score(peer, -PEER_TIMEOUT_PENALTY);
+}
+
+void record_peer_misbehavior(peer_t *peer)
+{
+  assert(peer != NULL);
+  peer->num_misbehaviors++;
+  adjust_peer_score(peer, -PEER_MISBEHAVIOR_PENALTY);
+}
+
 peer_t* get_peer_nolock(uint64_t peer_id)
 {
   void *val = NULL;
-  HASHTABLE_FOREACH(val, g_p2p_peerlist_table,
+  if (hashtable_get(g_p2p_peerlist_table, &peer_id, &val) != CC_OK)
   {
-    peer_t *peer = *(peer_t**)val;
-    assert(peer != NULL);
-
-    if (peer->id == peer_id)
-    {
-      return peer;
-    }
-  })
+    return NULL;
+  }
 
-  return NULL;
+  return (peer_t*)val;
 }
 
 peer_t* get_peer(uint64_t peer_id)
@@ -106,18 +206,12 @@ peer_t* get_peer_from_net_connection_nolock(net_connection_t *net_connection)
 {
   assert(net_connection != NULL);
   void *val = NULL;
-  HASHTABLE_FOREACH(val, g_p2p_peerlist_table,
+  if (hashtable_get(g_p2p_connection_table, &net_connection, &val) != CC_OK)
   {
-    peer_t *peer = *(peer_t**)val;
-    assert(peer != NULL);
-
-    if (peer->net_connection == net_connection)
-    {
-      return peer;
-    }
-  })
+    return NULL;
+  }
 
-  return NULL;
+  return (peer_t*)val;
 }
 
 peer_t* get_peer_from_net_connection(net_connection_t *net_connection)
@@ -146,6 +240,74 @@ uint16_t get_num_peers(void)
   return g_num_peers;
 }
 
+uint16_t get_peer_net_connections_nolock(net_connection_t **net_connections, uint16_t max_net_connections)
+{
+  assert(net_connections != NULL);
+  uint16_t num_net_connections = 0;
+  void *val = NULL;
+  HASHTABLE_FOREACH(val, g_p2p_peerlist_table,
+  {
+    peer_t *peer = *(peer_t**)val;
+    assert(peer != NULL);
+
+    if (num_net_connections >= max_net_connections)
+    {
+      break;
+    }
+
+    net_connections[num_net_connections] = peer->net_connection;
+    num_net_connections++;
+  })
+
+  return num_net_connections;
+}
+
+uint16_t get_peer_net_connections(net_connection_t **net_connections, uint16_t max_net_connections)
+{
+  mtx_lock(&g_p2p_lock);
+  uint16_t num_net_connections = get_peer_net_connections_nolock(net_connections, max_net_connections);
+  mtx_unlock(&g_p2p_lock);
+  return num_net_connections;
+}
+
+uint16_t get_peer_infos_nolock(peer_info_t *peer_infos, uint16_t max_peer_infos)
+{
+  assert(peer_infos != NULL);
+  uint16_t num_peer_infos = 0;
+  void *val = NULL;
+  HASHTABLE_FOREACH(val, g_p2p_peerlist_table,
+  {
+    peer_t *peer = *(peer_t**)val;
+    assert(peer != NULL);
+
+    if (num_peer_infos >= max_peer_infos)
+    {
+      break;
+    }
+
+    peer_info_t *peer_info = &peer_infos[num_peer_infos];
+    peer_info->id = peer->id;
+    peer_info->remote_ip = peer->net_connection != NULL ? peer->net_connection->remote_ip : 0;
+    peer_info->host_port = peer->net_connection != NULL ? peer->net_connection->host_port : 0;
+    peer_info->score = peer->score;
+    peer_info->rtt_ms = peer->rtt_ms;
+    peer_info->block_height = peer->block_height;
+    peer_info->pending_send_size = peer->net_connection != NULL ?
+      get_net_connection_pending_send_size(peer->net_connection) : 0;
+    num_peer_infos++;
+  })
+
+  return num_peer_infos;
+}
+
+uint16_t get_peer_infos(peer_info_t *peer_infos, uint16_t max_peer_infos)
+{
+  mtx_lock(&g_p2p_lock);
+  uint16_t num_peer_infos = get_peer_infos_nolock(peer_infos, max_peer_infos);
+  mtx_unlock(&g_p2p_lock);
+  return num_peer_infos;
+}
+
 int add_peer_nolock(peer_t *peer)
 {
   assert(peer != NULL);
@@ -160,6 +322,7 @@ int add_peer_nolock(peer_t *peer)
   }
 
   assert(hashtable_add(g_p2p_peerlist_table, &peer->id, peer) == CC_OK);
+  assert(hashtable_add(g_p2p_connection_table, &peer->net_connection, peer) == CC_OK);
   g_num_peers++;
   return 0;
 }
@@ -181,6 +344,7 @@ int remove_peer_nolock(peer_t *peer)
   }
 
   assert(hashtable_remove(g_p2p_peerlist_table, &peer->id, NULL) == CC_OK);
+  assert(hashtable_remove(g_p2p_connection_table, &peer->net_connection, NULL) == CC_OK);
   g_num_peers--;
   return 0;
 }
@@ -210,11 +374,7 @@ int serialize_peerlist_nolock(buffer_t *buffer)
     net_connection_t *net_connection = peer->net_connection;
     assert(net_connection != NULL);
 
-    struct mg_connection *connection = net_connection->connection;
-    assert(connection != NULL);
-
-    uint32_t remote_ip = ntohl(*(uint32_t*)&connection->sa.sin.sin_addr);
-    if (buffer_write_uint32(buffer, remote_ip))
+    if (buffer_write_uint32(buffer, net_connection->remote_ip))
     {
       return 1;
     }
@@ -273,20 +433,20 @@ int deserialize_peerlist_noblock(buffer_iterator_t *buffer_iterator)
       continue;
     }
 
-    char *bind_address = convert_ip_to_str(remote_ip);
+    // every address we hear of is remembered, even when we have
+    // no room to connect to it right now...
+    add_peer_address(remote_ip, host_port);
+
     uint64_t peer_id = concatenate(remote_ip, host_port);
-    if (has_peer(peer_id))
+    if (has_peer(peer_id) || g_num_peers >= MAX_P2P_PEERS_COUNT)
     {
       continue;
     }
 
-    if (g_num_peers >= MAX_P2P_PEERS_COUNT)
-    {
-      break;
-    }
-
+    char *bind_address = convert_ip_to_str(remote_ip);
     if (connect_net_to_peer(bind_address, host_port))
     {
+      free(bind_address);
       return 1;
     }
 
@@ -305,43 +465,23 @@ int deserialize_peerlist(buffer_iterator_t *buffer_iterator)
   return result;
 }
 
-int deserialize_peerlist_from_storage(buffer_t *buffer)
-{
-  assert(buffer != NULL);
-  if (buffer_get_size(buffer) == 0)
-  {
-    return 1;
-  }
-
-  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
-  assert(buffer_iterator != NULL);
-
-  if (deserialize_peerlist(buffer_iterator))
-  {
-    buffer_iterator_free(buffer_iterator);
-    return 1;
-  }
-
-  buffer_iterator_free(buffer_iterator);
-  return 0;
-}
-
-int broadcast_data_to_peers_nolock(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
+int broadcast_payload_to_peers_nolock(net_connection_t *net_connection, net_payload_t *payload)
 {
   assert(net_connection != NULL);
-  assert(data != NULL);
+  assert(payload != NULL);
   void *val = NULL;
   HASHTABLE_FOREACH(val, g_p2p_peerlist_table,
   {
     peer_t *peer = *(peer_t**)val;
     assert(peer != NULL);
 
-    if (peer->net_connection == net_connection)
+    // peers with a paused send queue are skipped, they would only fall further behind
+    if (peer->net_connection == net_connection || is_net_connection_send_paused(peer->net_connection))
     {
       continue;
     }
 
-    if (send_data(peer->net_connection, data, data_len))
+    if (send_payload(peer->net_connection, payload))
     {
       return 1;
     }
@@ -350,6 +490,26 @@ int broadcast_data_to_peers_nolock(net_connection_t *net_connection, const uint8
   return 0;
 }
 
+int broadcast_payload_to_peers(net_connection_t *net_connection, net_payload_t *payload)
+{
+  mtx_lock(&g_p2p_lock);
+  int result = broadcast_payload_to_peers_nolock(net_connection, payload);
+  mtx_unlock(&g_p2p_lock);
+  return result;
+}
+
+int broadcast_data_to_peers_nolock(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
+{
+  assert(net_connection != NULL);
+  assert(data != NULL);
+
+  // the data is copied once and shared by every peer it is sent to
+  net_payload_t *payload = make_net_payload(buffer_init_data(0, data, data_len));
+  int result = broadcast_payload_to_peers_nolock(net_connection, payload);
+  release_net_payload(payload);
+  return result;
+}
+
 int broadcast_data_to_peers(net_connection_t *net_connection, const uint8_t *data, size_t data_len)
 {
   mtx_lock(&g_p2p_lock);
@@ -360,21 +520,13 @@ int broadcast_data_to_peers(net_connection_t *net_connection, const uint8_t *dat
 
 static task_result_t save_peerlist_storage(task_t *task)
 {
-  LOG_INFO("Saving peerlist data...");
-  buffer_t *buffer = buffer_init();
-  if (serialize_peerlist(buffer))
-  {
-    perror("Failed to save P2P peerlist data, could not serialize peerlist to buffer!");
-  }
-
-  // write the serialized peer list data to the storage db
-  char *err = NULL;
-  if (buffer_storage_write_buffer(g_p2p_storage_db, buffer, &err))
+  // the peer table writes every change as it happens, so only buffered
+  // records need to be flushed out to the storage db here...
+  if (flush_peer_table())
   {
-    perror(err);
+    LOG_ERROR("Failed to save P2P peer table data!");
   }
 
-  LOG_INFO("Successfully saved peerlist data.");
   return TASK_RESULT_WAIT;
 }
 
@@ -387,16 +539,30 @@ void print_p2p_list(void)
     peer_t *peer = *(peer_t**)val;
     assert(peer != NULL);
 
-    net_connection_t *net_connection = peer->net_connection;
-    assert(net_connection != NULL);
-
-    struct mg_connection *connection = net_connection->connection;
-    assert(connection != NULL);
-
     printf("Peer: %llu\n", peer->id);
   })
 }
 
+/*
+ * Writes the number of peers and the bytes waiting to be sent to each of them,
+ * the send queues of peers owned by the io threads are read as of their last flush.
+ */
+static void write_p2p_metrics(buffer_t *buffer)
+{
+  peer_info_t peer_infos[MAX_P2P_PEERS_COUNT];
+  uint16_t num_peer_infos = get_peer_infos(peer_infos, MAX_P2P_PEERS_COUNT);
+
+  write_metric_header(buffer, "vulkan_peers", "Connected peers", "gauge");
+  write_metric_value(buffer, "vulkan_peers", NULL, NULL, num_peer_infos);
+  write_metric_header(buffer, "vulkan_peer_send_queue_bytes", "Bytes waiting to be sent to each peer", "gauge");
+  for (uint16_t i = 0; i < num_peer_infos; i++)
+  {
+    char peer_id[24];
+    snprintf(peer_id, sizeof(peer_id), "%llu", (unsigned long long)peer_infos[i].id);
+    write_metric_value(buffer, "vulkan_peer_send_queue_bytes", "peer", peer_id, peer_infos[i].pending_send_size);
+  }
+}
+
 int init_p2p(void)
 {
   if (g_p2p_initialized)
@@ -405,30 +571,34 @@ int init_p2p(void)
   }
 
   mtx_init(&g_p2p_lock, mtx_recursive);
-  assert(hashtable_new(&g_p2p_peerlist_table) == CC_OK);
-
-  char *err = NULL;
-  g_p2p_storage_db = buffer_storage_open(g_p2p_storage_filename, &err);
-  if (err != NULL)
-  {
-    LOG_ERROR("Failed to initialize P2P storage db: %s", err);
-    return 1;
-  }
 
-  buffer_t *buffer = NULL;
-  if (buffer_storage_read_buffer(g_p2p_storage_db, &buffer, &err))
+  HashTableConf peerlist_conf;
+  hashtable_conf_init(&peerlist_conf);
+  peerlist_conf.key_length = sizeof(uint64_t);
+  peerlist_conf.hash = GENERAL_HASH;
+  peerlist_conf.key_compare = compare_peer_id;
+  assert(hashtable_new_conf(&peerlist_conf, &g_p2p_peerlist_table) == CC_OK);
+
+  HashTableConf connection_conf;
+  hashtable_conf_init(&connection_conf);
+  connection_conf.key_length = sizeof(net_connection_t*);
+  connection_conf.hash = GENERAL_HASH;
+  connection_conf.key_compare = compare_peer_net_connection;
+  assert(hashtable_new_conf(&connection_conf, &g_p2p_connection_table) == CC_OK);
+
+  // the known peer addresses are reconnected to once the network is up
+  if (init_peer_table(g_p2p_storage_filename))
   {
-    LOG_ERROR("Failed to deserialize initialize P2P storage db: %s", err);
+    LOG_ERROR("Failed to initialize P2P storage db: %s", g_p2p_storage_filename);
     return 1;
   }
 
-  // attempt to load the peer list data
-  deserialize_peerlist_from_storage(buffer);
-  buffer_free(buffer);
   LOG_INFO("Successfully opened p2p storage db: %s", g_p2p_storage_filename);
 
   // setup a new task for saving the peer list data on an interval
   g_p2p_storage_save_task = add_task(save_peerlist_storage, SAVE_PEER_LIST_STORAGE_DELAY);
+  register_protocol_metrics();
+  register_metrics_collector(write_p2p_metrics);
   g_p2p_initialized = 1;
   return 0;
 }
@@ -441,10 +611,12 @@ int deinit_p2p(void)
   }
 
   remove_task(g_p2p_storage_save_task);
+  unregister_metrics_collector(write_p2p_metrics);
   hashtable_destroy(g_p2p_peerlist_table);
+  hashtable_destroy(g_p2p_connection_table);
   mtx_destroy(&g_p2p_lock);
 
-  if (buffer_storage_close(g_p2p_storage_db))
+  if (deinit_peer_table())
   {
     LOG_ERROR("Failed to close P2P storage db!");
     return 1;
@@ -37,12 +37,59 @@
 
 VULKAN_BEGIN_DECL
 
+// every peer starts out with the initial score, the score is raised for every block the peer
+// delivers and lowered for every request it fails to answer or invalid data it sends us.
+// Peers which fall below the min score are disconnected...
+#define PEER_INITIAL_SCORE 100
+#define PEER_MAX_SCORE 200
+#define PEER_MIN_SCORE 0
+#define PEER_SYNC_MIN_SCORE 50
+
+#define PEER_DELIVERY_REWARD 1
+#define PEER_TIMEOUT_PENALTY 25
+#define PEER_MISBEHAVIOR_PENALTY 50
+
+// the latency assumed for peers which have not been measured yet
+#define PEER_DEFAULT_LATENCY_MS 1000
+
+#define PEER_PING_TASK_DELAY 10
+#define PEER_PING_TIMEOUT 20
+
 typedef struct Peer
 {
   uint64_t id;
   net_connection_t *net_connection;
+
+  int32_t score;
+  uint32_t num_failures;
+  uint32_t num_misbehaviors;
+
+  // the smoothed round trip time of our pings and the smoothed time the peer
+  // took to deliver the blocks we requested, 0 until they have been measured...
+  uint32_t rtt_ms;
+  uint32_t block_delivery_ms;
+
+  uint64_t ping_nonce;
+  uint64_t ping_ts_ms;
+  int ping_pending;
+
+  // the height the peer last reported to us, and when it reported it
+  uint32_t block_height;
+  uint32_t block_height_ts;
 } peer_t;
 
+// a copy of a peer's details, which stays valid after the peer is removed
+typedef struct PeerInfo
+{
+  uint64_t id;
+  uint32_t remote_ip;
+  uint32_t host_port;
+  int32_t score;
+  uint32_t rtt_ms;
+  uint32_t block_height;
+  size_t pending_send_size;
+} peer_info_t;
+
 #define SAVE_PEER_LIST_STORAGE_DELAY 60
 
 VULKAN_API void set_p2p_storage_filename(const char *storage_filename);
@@ -51,6 +98,12 @@ VULKAN_API const char *get_p2p_storage_filename(void);
 VULKAN_API peer_t* init_peer(uint64_t peer_id, net_connection_t *net_connection);
 VULKAN_API void free_peer(peer_t *peer);
 
+VULKAN_API uint32_t get_peer_latency(peer_t *peer);
+VULKAN_API void record_peer_rtt(peer_t *peer, uint32_t rtt_ms);
+VULKAN_API void record_peer_block_delivery(peer_t *peer, uint32_t delivery_ms);
+VULKAN_API void record_peer_failure(peer_t *peer);
+VULKAN_API void record_peer_misbehavior(peer_t *peer);
+
 VULKAN_API peer_t* get_peer_nolock(uint64_t peer_id);
 VULKAN_API peer_t* get_peer(uint64_t peer_id);
 
@@ -62,6 +115,12 @@ VULKAN_API int has_peer(uint64_t peer_id);
 
 VULKAN_API uint16_t get_num_peers(void);
 
+VULKAN_API uint16_t get_peer_net_connections_nolock(net_connection_t **net_connections, uint16_t max_net_connections);
+VULKAN_API uint16_t get_peer_net_connections(net_connection_t **net_connections, uint16_t max_net_connections);
+
+VULKAN_API uint16_t get_peer_infos_nolock(peer_info_t *peer_infos, uint16_t max_peer_infos);
+VULKAN_API uint16_t get_peer_infos(peer_info_t *peer_infos, uint16_t max_peer_infos);
+
 VULKAN_API int add_peer_nolock(peer_t *peer);
 VULKAN_API int add_peer(peer_t *peer);
 
@@ -74,8 +133,9 @@ VULKAN_API int serialize_peerlist(buffer_t *buffer);
 VULKAN_API int deserialize_peerlist_noblock(buffer_iterator_t *buffer_iterator);
 VULKAN_API int deserialize_peerlist(buffer_iterator_t *buffer_iterator);
 
-VULKAN_API int deserialize_peerlist_from_storage(buffer_t *buffer);
 
+VULKAN_API int broadcast_payload_to_peers_nolock(net_connection_t *net_connection, net_payload_t *payload);
+VULKAN_API int broadcast_payload_to_peers(net_connection_t *net_connection, net_payload_t *payload);
 VULKAN_API int broadcast_data_to_peers_nolock(net_connection_t *net_connection, const uint8_t *data, size_t data_len);
 VULKAN_API int broadcast_data_to_peers(net_connection_t *net_connection, const uint8_t *data, size_t data_len);
 
@@ -29,6 +29,7 @@
 #include "parameters.h"
 
 static int g_parameters_use_testnet = 0;
+static int g_parameters_use_trivial_difficulty = 0;
 
 void parameters_set_use_testnet(int use_testnet)
 {
@@ -40,6 +41,20 @@ const int parameters_get_use_testnet(void)
   return g_parameters_use_testnet;
 }
 
+/*
+ * Only meant for generating synthetic blockchains in benchmarks, blocks can then be
+ * computed in a couple of hashes. A node using it only syncs with nodes which use it too.
+ */
+void parameters_set_use_trivial_difficulty(int use_trivial_difficulty)
+{
+  g_parameters_use_trivial_difficulty = use_trivial_difficulty;
+}
+
+const int parameters_get_use_trivial_difficulty(void)
+{
+  return g_parameters_use_trivial_difficulty;
+}
+
 const uint8_t parameters_get_address_id(void)
 {
   return g_parameters_use_testnet ? TESTNET_ADDRESS_ID : MAINNET_ADDRESS_ID;
@@ -99,3 +114,8 @@ const uint16_t parameters_get_rpc_port(void)
 {
   return g_parameters_use_testnet ? TESTNET_RPC_PORT : RPC_PORT;
 }
+
+const uint16_t parameters_get_mining_port(void)
+{
+  return g_parameters_use_testnet ? TESTNET_MINING_PORT : MINING_PORT;
+}
@@ -57,26 +57,54 @@ VULKAN_BEGIN_DECL
 
 #define MEMPOOL_TX_EXPIRE_TIME (60 * 60 * 24)
 
+// the most mempool txs a single incoming tx may replace by double spending their txouts
+#define MEMPOOL_MAX_REPLACED_TXS 32
+
+#define DEFAULT_MEMPOOL_MAX_MEMORY_SIZE (1024 * 1024 * 300) // 300mb
+
 #define POW_TARGET_TIMESPAN (60 * 60 * 10)
 #define POW_TARGET_SPACING (1 * 60)
 #define POW_INITIAL_DIFFICULTY_BITS 0x1d00ffff
 
+// the bits every block after the genesis block is expected to have when the trivial
+// difficulty is used, about every other hash is at or below it's target...
+#define POW_TRIVIAL_DIFFICULTY_BITS 0x207fffff
+
 #define BLOCK_REWARD_EMISSION_FACTOR 20
 
 #define P2P_PORT 9899
 #define RPC_PORT 9898
+#define MINING_PORT 9897
 
 #define TESTNET_P2P_PORT 8899
 #define TESTNET_RPC_PORT 8898
+#define TESTNET_MINING_PORT 8897
 
 #define MAX_P2P_PEERS_COUNT 16
 #define MAX_GROUPED_BLOCKS_COUNT 6
+#define MAX_GROUPED_FULL_BLOCKS_COUNT 256
+#define DEFAULT_GROUPED_BLOCKS_BUDGET_SIZE (1024 * 1024 * 4) // 4mb
+#define MAX_BLOCK_HEADERS_COUNT 512
 
 #define DEFAULT_COMPACTION_MEMTABLE_MEMORY_BUDGET (1024 * 1024 * 512) // 512mb
+#define DEFAULT_BLOCKCHAIN_DB_CACHE_SIZE (1024 * 1024 * 128) // 128mb
+#define DEFAULT_BLOCKCHAIN_DB_BLOOM_BITS_PER_KEY 10
+
+#define DEFAULT_UTXO_CACHE_MAX_MEMORY_SIZE (1024 * 1024 * 256) // 256mb
+#define DEFAULT_UTXO_CACHE_FLUSH_INTERVAL 1000
+
+#define DEFAULT_BLOCK_CACHE_MAX_MEMORY_SIZE (1024 * 1024 * 64) // 64mb
+
+#define DEFAULT_ORPHAN_POOL_MAX_MEMORY_SIZE (1024 * 1024 * 32) // 32mb
+#define ORPHAN_POOL_MAX_BLOCKS 1024
+#define ORPHAN_BLOCK_EXPIRE_TIME (60 * 20) // 20 minutes
 
 VULKAN_API void parameters_set_use_testnet(int use_testnet);
 VULKAN_API const int parameters_get_use_testnet(void);
 
+VULKAN_API void parameters_set_use_trivial_difficulty(int use_trivial_difficulty);
+VULKAN_API const int parameters_get_use_trivial_difficulty(void);
+
 VULKAN_API const uint8_t parameters_get_address_id(void);
 
 VULKAN_API const uint32_t parameters_get_genesis_nonce(void);
@@ -91,6 +119,7 @@ VULKAN_API const uint32_t parameters_get_pow_initial_difficulty_bits(void);
 
 VULKAN_API const uint16_t parameters_get_p2p_port(void);
 VULKAN_API const uint16_t parameters_get_rpc_port(void);
+VULKAN_API const uint16_t parameters_get_mining_port(void);
 
 VULKAN_API const int parameters_get_allow_min_difficulty_blocks(void);
 
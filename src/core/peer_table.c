@@ -0,0 +1,779 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sodium.h>
+
+#include "common/buffer.h"
+#include "common/buffer_iterator.h"
+#include "common/logger.h"
+#include "common/tinycthread.h"
+#include "common/util.h"
+
+#include "peer_table.h"
+
+static int g_peer_table_initialized = 0;
+static mtx_t g_peer_table_lock;
+
+static const char *g_peer_table_filename = NULL;
+static FILE *g_peer_table_fp = NULL;
+static uint64_t g_peer_table_bucket_key = 0;
+
+static peer_address_t g_peer_table_new_buckets[PEER_TABLE_NUM_NEW_BUCKETS][PEER_TABLE_BUCKET_SIZE];
+static peer_address_t g_peer_table_tried_buckets[PEER_TABLE_NUM_TRIED_BUCKETS][PEER_TABLE_BUCKET_SIZE];
+static uint32_t g_peer_table_num_addresses = 0;
+static uint32_t g_peer_table_num_records = 0;
+
+/*
+ * The network group of the address is mixed with our secret bucket key, so that
+ * other nodes cannot predict which bucket an address they send us will land in.
+ */
+static peer_address_t* get_peer_address_bucket(uint32_t ip, uint8_t tried)
+{
+  uint64_t hash = g_peer_table_bucket_key ^ (((uint64_t)(ip >> 16) << 1) | tried);
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+
+  if (tried)
+  {
+    return g_peer_table_tried_buckets[hash % PEER_TABLE_NUM_TRIED_BUCKETS];
+  }
+
+  return g_peer_table_new_buckets[hash % PEER_TABLE_NUM_NEW_BUCKETS];
+}
+
+static int is_peer_address_slot_empty(const peer_address_t *address)
+{
+  assert(address != NULL);
+  return address->ip == 0 && address->port == 0;
+}
+
+static peer_address_t* find_peer_address(uint32_t ip, uint16_t port)
+{
+  for (uint8_t tried = 0; tried <= 1; tried++)
+  {
+    peer_address_t *bucket = get_peer_address_bucket(ip, tried);
+    for (uint32_t i = 0; i < PEER_TABLE_BUCKET_SIZE; i++)
+    {
+      if (bucket[i].ip == ip && bucket[i].port == port)
+      {
+        return &bucket[i];
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Tried addresses are ranked by when we last connected to them, the addresses we have only
+ * heard of are ranked by when we last heard of them and how often we failed to connect.
+ * The ranking only depends on the stored timestamps, so replaying the table's file
+ * always evicts the same addresses as were evicted when the records were written...
+ */
+static int is_peer_address_worse(const peer_address_t *address, const peer_address_t *other_address)
+{
+  assert(address != NULL);
+  assert(other_address != NULL);
+  if (address->tried)
+  {
+    return address->last_success < other_address->last_success;
+  }
+
+  if (address->last_seen != other_address->last_seen)
+  {
+    return address->last_seen < other_address->last_seen;
+  }
+
+  return address->num_attempts > other_address->num_attempts;
+}
+
+static void insert_peer_address(const peer_address_t *address)
+{
+  assert(address != NULL);
+  peer_address_t *bucket = get_peer_address_bucket(address->ip, address->tried);
+  g_peer_table_num_addresses++;
+  for (uint32_t i = 0; i < PEER_TABLE_BUCKET_SIZE; i++)
+  {
+    if (is_peer_address_slot_empty(&bucket[i]))
+    {
+      bucket[i] = *address;
+      return;
+    }
+  }
+
+  // the bucket is full, the worst address either in the bucket or the one being
+  // inserted is evicted. Tried addresses are moved back to the new buckets...
+  peer_address_t *worst_address = &bucket[0];
+  for (uint32_t i = 1; i < PEER_TABLE_BUCKET_SIZE; i++)
+  {
+    if (is_peer_address_worse(&bucket[i], worst_address))
+    {
+      worst_address = &bucket[i];
+    }
+  }
+
+  peer_address_t evicted_address = *address;
+  if (is_peer_address_worse(worst_address, address))
+  {
+    evicted_address = *worst_address;
+    *worst_address = *address;
+  }
+
+  g_peer_table_num_addresses--;
+  if (evicted_address.tried)
+  {
+    evicted_address.tried = 0;
+    insert_peer_address(&evicted_address);
+  }
+}
+
+static void update_peer_address(const peer_address_t *address)
+{
+  assert(address != NULL);
+  peer_address_t *existing_address = find_peer_address(address->ip, address->port);
+  if (existing_address != NULL)
+  {
+    if (existing_address->tried == address->tried)
+    {
+      *existing_address = *address;
+      return;
+    }
+
+    memset(existing_address, 0, sizeof(peer_address_t));
+    g_peer_table_num_addresses--;
+  }
+
+  insert_peer_address(address);
+}
+
+static int serialize_peer_address(buffer_t *buffer, const peer_address_t *address)
+{
+  assert(buffer != NULL);
+  assert(address != NULL);
+  if (buffer_write_uint32(buffer, address->ip))
+  {
+    return 1;
+  }
+
+  if (buffer_write_uint16(buffer, address->port))
+  {
+    return 1;
+  }
+
+  if (buffer_write_uint8(buffer, address->tried))
+  {
+    return 1;
+  }
+
+  if (buffer_write_uint32(buffer, address->last_seen))
+  {
+    return 1;
+  }
+
+  if (buffer_write_uint32(buffer, address->last_success))
+  {
+    return 1;
+  }
+
+  if (buffer_write_uint32(buffer, address->last_attempt))
+  {
+    return 1;
+  }
+
+  if (buffer_write_uint16(buffer, address->num_attempts))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int deserialize_peer_address(buffer_iterator_t *buffer_iterator, peer_address_t *address)
+{
+  assert(buffer_iterator != NULL);
+  assert(address != NULL);
+  if (buffer_read_uint32(buffer_iterator, &address->ip))
+  {
+    return 1;
+  }
+
+  if (buffer_read_uint16(buffer_iterator, &address->port))
+  {
+    return 1;
+  }
+
+  if (buffer_read_uint8(buffer_iterator, &address->tried))
+  {
+    return 1;
+  }
+
+  if (buffer_read_uint32(buffer_iterator, &address->last_seen))
+  {
+    return 1;
+  }
+
+  if (buffer_read_uint32(buffer_iterator, &address->last_success))
+  {
+    return 1;
+  }
+
+  if (buffer_read_uint32(buffer_iterator, &address->last_attempt))
+  {
+    return 1;
+  }
+
+  if (buffer_read_uint16(buffer_iterator, &address->num_attempts))
+  {
+    return 1;
+  }
+
+  address->tried = address->tried ? 1 : 0;
+  return 0;
+}
+
+static int write_peer_table_buffer(FILE *fp, buffer_t *buffer)
+{
+  assert(fp != NULL);
+  assert(buffer != NULL);
+  size_t data_len = buffer_get_size(buffer);
+  if (fwrite(buffer_get_data(buffer), 1, data_len, fp) != data_len)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Appends the new state of an address to the table's file, the records are replayed
+ * in order when the table is loaded so the last record of an address wins.
+ */
+static int append_peer_address(const peer_address_t *address)
+{
+  assert(address != NULL);
+  if (g_peer_table_fp == NULL)
+  {
+    return 1;
+  }
+
+  buffer_t *buffer = buffer_init();
+  if (serialize_peer_address(buffer, address) || write_peer_table_buffer(g_peer_table_fp, buffer))
+  {
+    LOG_ERROR("Failed to append peer address to peer table: %s!", g_peer_table_filename);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  buffer_free(buffer);
+  g_peer_table_num_records++;
+  return 0;
+}
+
+/*
+ * Rewrites the table's file with a single record for every address in the table, the
+ * records are written to a temporary file first which then replaces the table's file,
+ * so that failing part of the way through leaves the previous file intact...
+ */
+static int compact_peer_table(void)
+{
+  size_t filename_len = strlen(g_peer_table_filename) + 5;
+  char *temp_filename = malloc(filename_len);
+  assert(temp_filename != NULL);
+  snprintf(temp_filename, filename_len, "%s.tmp", g_peer_table_filename);
+
+  buffer_t *buffer = buffer_init();
+  if (buffer_write_uint32(buffer, PEER_TABLE_MAGIC) ||
+      buffer_write_uint32(buffer, PEER_TABLE_VERSION) ||
+      buffer_write_uint64(buffer, g_peer_table_bucket_key))
+  {
+    goto compact_peer_table_fail;
+  }
+
+  for (uint32_t i = 0; i < PEER_TABLE_NUM_NEW_BUCKETS * PEER_TABLE_BUCKET_SIZE; i++)
+  {
+    peer_address_t *address = &g_peer_table_new_buckets[0][0] + i;
+    if (is_peer_address_slot_empty(address) == 0 && serialize_peer_address(buffer, address))
+    {
+      goto compact_peer_table_fail;
+    }
+  }
+
+  for (uint32_t i = 0; i < PEER_TABLE_NUM_TRIED_BUCKETS * PEER_TABLE_BUCKET_SIZE; i++)
+  {
+    peer_address_t *address = &g_peer_table_tried_buckets[0][0] + i;
+    if (is_peer_address_slot_empty(address) == 0 && serialize_peer_address(buffer, address))
+    {
+      goto compact_peer_table_fail;
+    }
+  }
+
+  FILE *fp = fopen(temp_filename, "wb");
+  if (fp == NULL)
+  {
+    goto compact_peer_table_fail;
+  }
+
+  if (write_peer_table_buffer(fp, buffer))
+  {
+    fclose(fp);
+    goto compact_peer_table_fail;
+  }
+
+  if (fclose(fp) != 0)
+  {
+    goto compact_peer_table_fail;
+  }
+
+  if (g_peer_table_fp != NULL)
+  {
+    fclose(g_peer_table_fp);
+    g_peer_table_fp = NULL;
+  }
+
+  if (rename(temp_filename, g_peer_table_filename) != 0)
+  {
+    goto compact_peer_table_fail;
+  }
+
+  g_peer_table_num_records = g_peer_table_num_addresses;
+  buffer_free(buffer);
+  free(temp_filename);
+  return 0;
+
+compact_peer_table_fail:
+  LOG_ERROR("Failed to compact peer table: %s!", g_peer_table_filename);
+  buffer_free(buffer);
+  free(temp_filename);
+  return 1;
+}
+
+static int open_peer_table_file(void)
+{
+  if (g_peer_table_fp != NULL)
+  {
+    return 0;
+  }
+
+  g_peer_table_fp = fopen(g_peer_table_filename, "ab");
+  if (g_peer_table_fp == NULL)
+  {
+    LOG_ERROR("Failed to open peer table: %s!", g_peer_table_filename);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int should_compact_peer_table(void)
+{
+  uint32_t num_addresses = g_peer_table_num_addresses > PEER_TABLE_BUCKET_SIZE ? g_peer_table_num_addresses : PEER_TABLE_BUCKET_SIZE;
+  return g_peer_table_num_records > num_addresses * PEER_TABLE_COMPACT_RATIO;
+}
+
+/*
+ * Replays the records of the table's file, returns 1 if the file must be rewritten
+ * because it is missing, was written by an incompatible version or ends part of the
+ * way through a record, so that new records are never appended to a torn record...
+ */
+static int load_peer_table(void)
+{
+  FILE *fp = fopen(g_peer_table_filename, "rb");
+  if (fp == NULL)
+  {
+    return 1;
+  }
+
+  fseek(fp, 0L, SEEK_END);
+  long data_len = ftell(fp);
+  fseek(fp, 0L, SEEK_SET);
+  if (data_len < PEER_TABLE_HEADER_SIZE)
+  {
+    fclose(fp);
+    return 1;
+  }
+
+  uint8_t *data = malloc(data_len);
+  assert(data != NULL);
+  if (fread(data, 1, data_len, fp) != (size_t)data_len)
+  {
+    free(data);
+    fclose(fp);
+    return 1;
+  }
+
+  fclose(fp);
+  buffer_t *buffer = buffer_init_data(0, data, data_len);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  free(data);
+
+  int needs_rewrite = 0;
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint64_t bucket_key = 0;
+  if (buffer_read_uint32(buffer_iterator, &magic) ||
+      buffer_read_uint32(buffer_iterator, &version) ||
+      buffer_read_uint64(buffer_iterator, &bucket_key) ||
+      magic != PEER_TABLE_MAGIC || version != PEER_TABLE_VERSION)
+  {
+    LOG_INFO("Discarding incompatible peer table: %s...", g_peer_table_filename);
+    needs_rewrite = 1;
+    goto load_peer_table_done;
+  }
+
+  g_peer_table_bucket_key = bucket_key;
+  while (buffer_get_remaining_size(buffer_iterator) >= PEER_TABLE_RECORD_SIZE)
+  {
+    peer_address_t address;
+    assert(deserialize_peer_address(buffer_iterator, &address) == 0);
+    g_peer_table_num_records++;
+    if (is_peer_address_slot_empty(&address) == 0)
+    {
+      update_peer_address(&address);
+    }
+  }
+
+  needs_rewrite = buffer_get_remaining_size(buffer_iterator) > 0;
+
+load_peer_table_done:
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  return needs_rewrite;
+}
+
+int add_peer_address_nolock(uint32_t ip, uint16_t port)
+{
+  if (ip == 0 || port == 0)
+  {
+    return 1;
+  }
+
+  uint32_t current_time = get_current_time();
+  peer_address_t address;
+  peer_address_t *existing_address = find_peer_address(ip, port);
+  if (existing_address != NULL)
+  {
+    // addresses we hear of often are only written out every once in a while
+    if (current_time - existing_address->last_seen < PEER_TABLE_SEEN_UPDATE_INTERVAL)
+    {
+      return 0;
+    }
+
+    address = *existing_address;
+  }
+  else
+  {
+    memset(&address, 0, sizeof(peer_address_t));
+    address.ip = ip;
+    address.port = port;
+  }
+
+  address.last_seen = current_time;
+  update_peer_address(&address);
+  append_peer_address(&address);
+  return 0;
+}
+
+int add_peer_address(uint32_t ip, uint16_t port)
+{
+  mtx_lock(&g_peer_table_lock);
+  int result = add_peer_address_nolock(ip, port);
+  mtx_unlock(&g_peer_table_lock);
+  return result;
+}
+
+int mark_peer_address_attempt_nolock(uint32_t ip, uint16_t port)
+{
+  peer_address_t *existing_address = find_peer_address(ip, port);
+  if (existing_address == NULL)
+  {
+    return 1;
+  }
+
+  peer_address_t address = *existing_address;
+  address.last_attempt = get_current_time();
+  if (address.num_attempts < UINT16_MAX)
+  {
+    address.num_attempts++;
+  }
+
+  update_peer_address(&address);
+  append_peer_address(&address);
+  return 0;
+}
+
+int mark_peer_address_attempt(uint32_t ip, uint16_t port)
+{
+  mtx_lock(&g_peer_table_lock);
+  int result = mark_peer_address_attempt_nolock(ip, port);
+  mtx_unlock(&g_peer_table_lock);
+  return result;
+}
+
+int mark_peer_address_success_nolock(uint32_t ip, uint16_t port)
+{
+  if (ip == 0 || port == 0)
+  {
+    return 1;
+  }
+
+  peer_address_t address;
+  peer_address_t *existing_address = find_peer_address(ip, port);
+  if (existing_address != NULL)
+  {
+    address = *existing_address;
+  }
+  else
+  {
+    memset(&address, 0, sizeof(peer_address_t));
+    address.ip = ip;
+    address.port = port;
+  }
+
+  uint32_t current_time = get_current_time();
+  address.tried = 1;
+  address.last_seen = current_time;
+  address.last_success = current_time;
+  address.num_attempts = 0;
+
+  update_peer_address(&address);
+  append_peer_address(&address);
+  return 0;
+}
+
+int mark_peer_address_success(uint32_t ip, uint16_t port)
+{
+  mtx_lock(&g_peer_table_lock);
+  int result = mark_peer_address_success_nolock(ip, port);
+  mtx_unlock(&g_peer_table_lock);
+  return result;
+}
+
+int get_peer_address(uint32_t ip, uint16_t port, peer_address_t *address_out)
+{
+  assert(address_out != NULL);
+  mtx_lock(&g_peer_table_lock);
+  peer_address_t *address = find_peer_address(ip, port);
+  if (address == NULL)
+  {
+    mtx_unlock(&g_peer_table_lock);
+    return 1;
+  }
+
+  *address_out = *address;
+  mtx_unlock(&g_peer_table_lock);
+  return 0;
+}
+
+uint32_t get_num_peer_addresses(void)
+{
+  mtx_lock(&g_peer_table_lock);
+  uint32_t num_addresses = g_peer_table_num_addresses;
+  mtx_unlock(&g_peer_table_lock);
+  return num_addresses;
+}
+
+static uint32_t get_peer_address_retry_delay(const peer_address_t *address)
+{
+  assert(address != NULL);
+  if (address->last_attempt == 0)
+  {
+    return 0;
+  }
+
+  uint32_t backoff_shift = address->num_attempts > 1 ? MIN(address->num_attempts - 1, 16) : 0;
+  return MIN((uint32_t)PEER_TABLE_RETRY_DELAY << backoff_shift, PEER_TABLE_MAX_RETRY_DELAY);
+}
+
+static int compare_peer_address_preference(const void *address1, const void *address2)
+{
+  const peer_address_t *peer_address1 = (const peer_address_t*)address1;
+  const peer_address_t *peer_address2 = (const peer_address_t*)address2;
+  if (peer_address1->tried != peer_address2->tried)
+  {
+    return peer_address1->tried ? -1 : 1;
+  }
+
+  if (is_peer_address_worse(peer_address2, peer_address1))
+  {
+    return -1;
+  }
+
+  if (is_peer_address_worse(peer_address1, peer_address2))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Picks the addresses to connect to, the addresses we have connected to most recently
+ * come first followed by the addresses we have heard of most recently. Addresses which
+ * are still backed off after a failed attempt are left out...
+ */
+uint16_t select_peer_addresses(peer_address_t *addresses, uint16_t max_addresses)
+{
+  assert(addresses != NULL);
+  mtx_lock(&g_peer_table_lock);
+  if (g_peer_table_num_addresses == 0 || max_addresses == 0)
+  {
+    mtx_unlock(&g_peer_table_lock);
+    return 0;
+  }
+
+  peer_address_t *candidates = malloc(sizeof(peer_address_t) * g_peer_table_num_addresses);
+  assert(candidates != NULL);
+
+  uint32_t num_candidates = 0;
+  uint32_t current_time = get_current_time();
+  uint32_t num_slots = (PEER_TABLE_NUM_NEW_BUCKETS + PEER_TABLE_NUM_TRIED_BUCKETS) * PEER_TABLE_BUCKET_SIZE;
+  for (uint32_t i = 0; i < num_slots; i++)
+  {
+    peer_address_t *address = NULL;
+    if (i < PEER_TABLE_NUM_NEW_BUCKETS * PEER_TABLE_BUCKET_SIZE)
+    {
+      address = &g_peer_table_new_buckets[0][0] + i;
+    }
+    else
+    {
+      address = &g_peer_table_tried_buckets[0][0] + (i - PEER_TABLE_NUM_NEW_BUCKETS * PEER_TABLE_BUCKET_SIZE);
+    }
+
+    if (is_peer_address_slot_empty(address))
+    {
+      continue;
+    }
+
+    if (address->tried == 0 && address->num_attempts >= PEER_TABLE_MAX_FAILED_ATTEMPTS)
+    {
+      continue;
+    }
+
+    if (current_time - address->last_attempt < get_peer_address_retry_delay(address))
+    {
+      continue;
+    }
+
+    assert(num_candidates < g_peer_table_num_addresses);
+    candidates[num_candidates] = *address;
+    num_candidates++;
+  }
+
+  mtx_unlock(&g_peer_table_lock);
+  qsort(candidates, num_candidates, sizeof(peer_address_t), compare_peer_address_preference);
+
+  uint16_t num_addresses = num_candidates < max_addresses ? num_candidates : max_addresses;
+  memcpy(addresses, candidates, sizeof(peer_address_t) * num_addresses);
+  free(candidates);
+  return num_addresses;
+}
+
+int flush_peer_table(void)
+{
+  mtx_lock(&g_peer_table_lock);
+  if (g_peer_table_fp != NULL && fflush(g_peer_table_fp) != 0)
+  {
+    LOG_ERROR("Failed to flush peer table: %s!", g_peer_table_filename);
+  }
+
+  int result = 0;
+  if (should_compact_peer_table())
+  {
+    // the file may have been closed before the compaction failed,
+    // it is reopened either way so new records keep being appended...
+    int compact_failed = compact_peer_table();
+    result = open_peer_table_file() || compact_failed;
+  }
+
+  mtx_unlock(&g_peer_table_lock);
+  return result;
+}
+
+int init_peer_table(const char *filename)
+{
+  assert(filename != NULL);
+  if (g_peer_table_initialized)
+  {
+    return 1;
+  }
+
+  mtx_init(&g_peer_table_lock, mtx_plain);
+  g_peer_table_filename = filename;
+  randombytes_buf(&g_peer_table_bucket_key, sizeof(uint64_t));
+
+  if (load_peer_table() || should_compact_peer_table())
+  {
+    if (compact_peer_table())
+    {
+      mtx_destroy(&g_peer_table_lock);
+      return 1;
+    }
+  }
+
+  if (open_peer_table_file())
+  {
+    mtx_destroy(&g_peer_table_lock);
+    return 1;
+  }
+
+  LOG_INFO("Loaded %u peer addresses from peer table: %s", g_peer_table_num_addresses, g_peer_table_filename);
+  g_peer_table_initialized = 1;
+  return 0;
+}
+
+int deinit_peer_table(void)
+{
+  if (g_peer_table_initialized == 0)
+  {
+    return 1;
+  }
+
+  int result = 0;
+  if (g_peer_table_fp != NULL && fclose(g_peer_table_fp) != 0)
+  {
+    LOG_ERROR("Failed to close peer table: %s!", g_peer_table_filename);
+    result = 1;
+  }
+
+  g_peer_table_fp = NULL;
+  memset(g_peer_table_new_buckets, 0, sizeof(g_peer_table_new_buckets));
+  memset(g_peer_table_tried_buckets, 0, sizeof(g_peer_table_tried_buckets));
+  g_peer_table_num_addresses = 0;
+  g_peer_table_num_records = 0;
+  g_peer_table_filename = NULL;
+
+  mtx_destroy(&g_peer_table_lock);
+  g_peer_table_initialized = 0;
+  return result;
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+// the peer table is a persistent table of the peer addresses we know about. Addresses we have
+// only heard of are kept in the new buckets and addresses we have connected to successfully in the
+// tried buckets, an address is assigned to a bucket by it's /16 network group so that a single
+// network cannot push out all of the other addresses...
+#define PEER_TABLE_NUM_NEW_BUCKETS 64
+#define PEER_TABLE_NUM_TRIED_BUCKETS 16
+#define PEER_TABLE_BUCKET_SIZE 64
+
+#define PEER_TABLE_MAGIC 0x564b5054
+#define PEER_TABLE_VERSION 1
+#define PEER_TABLE_HEADER_SIZE 16
+#define PEER_TABLE_RECORD_SIZE 21
+
+// every change to an address is appended to the table's file, the file is
+// compacted once it holds this many records for every address in the table...
+#define PEER_TABLE_COMPACT_RATIO 4
+
+#define PEER_TABLE_SEEN_UPDATE_INTERVAL (60 * 20)
+
+// an address is retried after the retry delay, which doubles with every failed
+// attempt up to the max retry delay. Addresses we have never connected to
+// successfully are given up on after the max failed attempts...
+#define PEER_TABLE_RETRY_DELAY 5
+#define PEER_TABLE_MAX_RETRY_DELAY (60 * 60)
+#define PEER_TABLE_MAX_FAILED_ATTEMPTS 10
+
+typedef struct PeerAddress
+{
+  uint32_t ip;
+  uint16_t port;
+  uint8_t tried;
+
+  uint32_t last_seen;
+  uint32_t last_success;
+  uint32_t last_attempt;
+
+  // the failed connection attempts since the last successful connection
+  uint16_t num_attempts;
+} peer_address_t;
+
+VULKAN_API int add_peer_address_nolock(uint32_t ip, uint16_t port);
+VULKAN_API int add_peer_address(uint32_t ip, uint16_t port);
+
+VULKAN_API int mark_peer_address_attempt_nolock(uint32_t ip, uint16_t port);
+VULKAN_API int mark_peer_address_attempt(uint32_t ip, uint16_t port);
+
+VULKAN_API int mark_peer_address_success_nolock(uint32_t ip, uint16_t port);
+VULKAN_API int mark_peer_address_success(uint32_t ip, uint16_t port);
+
+VULKAN_API int get_peer_address(uint32_t ip, uint16_t port, peer_address_t *address_out);
+VULKAN_API uint32_t get_num_peer_addresses(void);
+
+VULKAN_API uint16_t select_peer_addresses(peer_address_t *addresses, uint16_t max_addresses);
+
+VULKAN_API int flush_peer_table(void);
+
+VULKAN_API int init_peer_table(const char *filename);
+VULKAN_API int deinit_peer_table(void);
+
+VULKAN_END_DECL
@@ -27,22 +27,26 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdint.h>
-
-#include <openssl/bn.h>
+#include <string.h>
 
 #include "common/util.h"
 
+#include "parameters.h"
 #include "pow.h"
 
 #include "crypto/bignum_util.h"
 #include "crypto/cryptoutil.h"
 
 static const char *g_pow_limit_str = "00000000ffffffffffffffffffffffffffffffffffffffffffffffffffffffff";
-BIGNUM *g_pow_limit_bn = NULL;
+static uint256_t g_pow_limit = {{0}};
+
+// the limit of the targets when the trivial difficulty is used
+static const char *g_trivial_pow_limit_str = "7fffff0000000000000000000000000000000000000000000000000000000000";
+static uint256_t g_trivial_pow_limit = {{0}};
 
 int init_pow(void)
 {
-  if (g_pow_limit_bn != NULL)
+  if (uint256_is_zero(&g_pow_limit) == 0)
   {
     return 1;
   }
@@ -51,53 +55,124 @@ int init_pow(void)
   uint8_t *pow_limit_bin = hex2bin(g_pow_limit_str, &out_size);
   assert(out_size == HASH_SIZE);
 
-  g_pow_limit_bn = BN_new();
-  BN_bin2bn(pow_limit_bin, HASH_SIZE, g_pow_limit_bn);
-  assert(!BN_is_zero(g_pow_limit_bn));
+  uint256_from_bytes(&g_pow_limit, pow_limit_bin);
+  assert(uint256_is_zero(&g_pow_limit) == 0);
   free(pow_limit_bin);
+
+  uint8_t *trivial_pow_limit_bin = hex2bin(g_trivial_pow_limit_str, &out_size);
+  assert(out_size == HASH_SIZE);
+
+  uint256_from_bytes(&g_trivial_pow_limit, trivial_pow_limit_bin);
+  assert(uint256_is_zero(&g_trivial_pow_limit) == 0);
+  free(trivial_pow_limit_bin);
   return 0;
 }
 
 int deinit_pow(void)
 {
-  if (g_pow_limit_bn == NULL)
+  if (uint256_is_zero(&g_pow_limit))
   {
     return 1;
   }
 
-  BN_clear_free(g_pow_limit_bn);
-  g_pow_limit_bn = NULL;
+  uint256_set_zero(&g_pow_limit);
+  uint256_set_zero(&g_trivial_pow_limit);
   return 0;
 }
 
-int check_proof_of_work(const uint8_t *hash, uint32_t bits)
+/* Decodes the compact difficulty bits into a target and checks that it is within
+ * the range of the proof-of-work limit, this is done with fixed width stack
+ * integers since it runs for every hash that is checked...
+ */
+static int get_proof_of_work_target_uint256(uint256_t *target, uint32_t bits)
 {
-  assert(!BN_is_zero(g_pow_limit_bn));
+  assert(uint256_is_zero(&g_pow_limit) == 0);
 
-  BIGNUM *bn_target = BN_new();
-  bignum_set_compact(bn_target, bits);
-
-  BIGNUM *hash_target = BN_new();
-  BN_bin2bn(hash, HASH_SIZE, hash_target);
+  int is_negative = 0;
+  int is_overflow = 0;
+  uint256_set_compact(target, bits, &is_negative, &is_overflow);
 
   // check range
-  if (BN_is_zero(bn_target) || BN_cmp(bn_target, g_pow_limit_bn) == 1)
+  uint256_t *pow_limit = parameters_get_use_trivial_difficulty() ? &g_trivial_pow_limit : &g_pow_limit;
+  if (is_negative || is_overflow || uint256_is_zero(target) || uint256_compare(target, pow_limit) > 0)
   {
-    goto pow_check_fail;
+    return 1;
+  }
+
+  return 0;
+}
+
+int check_proof_of_work(const uint8_t *hash, uint32_t bits)
+{
+  assert(hash != NULL);
+
+  uint256_t target;
+  if (get_proof_of_work_target_uint256(&target, bits))
+  {
+    return 0;
   }
 
   // check proof of work
-  if (BN_cmp(hash_target, bn_target) == 1)
+  uint256_t hash_target;
+  uint256_from_bytes(&hash_target, hash);
+  return uint256_compare(&hash_target, &target) <= 0;
+}
+
+/* The expected number of hashes needed to find a hash at or below the target of the
+ * compact difficulty bits, which is 2^256 / (target + 1). Since 2^256 does not fit
+ * into 256 bits this is computed as (~target / (target + 1)) + 1 instead...
+ */
+int get_proof_of_work(uint256_t *work, uint32_t bits)
+{
+  assert(work != NULL);
+
+  uint256_t target;
+  if (get_proof_of_work_target_uint256(&target, bits))
   {
-    goto pow_check_fail;
+    return 1;
+  }
+
+  uint256_t inverse_target;
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    inverse_target.words[i] = ~target.words[i];
+  }
+
+  uint256_t one;
+  uint256_set_zero(&one);
+  one.words[0] = 1;
+
+  uint256_t divisor = target;
+  uint256_add(&divisor, &one);
+  if (uint256_divide(work, &inverse_target, &divisor))
+  {
+    return 1;
   }
 
-  BN_clear_free(bn_target);
-  BN_clear_free(hash_target);
-  return 1;
+  uint256_add(work, &one);
+  return 0;
+}
+
+/* Expands the compact difficulty bits into a 32 byte big endian target so
+ * that hashes can be checked with a single memcmp...
+ */
+int get_proof_of_work_target(uint8_t *target, uint32_t bits)
+{
+  assert(target != NULL);
+
+  uint256_t target_uint256;
+  if (get_proof_of_work_target_uint256(&target_uint256, bits))
+  {
+    return 1;
+  }
 
-pow_check_fail:
-  BN_clear_free(bn_target);
-  BN_clear_free(hash_target);
+  uint256_to_bytes(target, &target_uint256);
   return 0;
 }
+
+int check_proof_of_work_target(const uint8_t *hash, const uint8_t *target)
+{
+  assert(hash != NULL);
+  assert(target != NULL);
+  return memcmp(hash, target, HASH_SIZE) <= 0;
+}
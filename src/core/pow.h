@@ -38,4 +38,9 @@ VULKAN_API int init_pow(void);
 VULKAN_API int deinit_pow(void);
 VULKAN_API int check_proof_of_work(const uint8_t *hash, uint32_t bits);
 
+VULKAN_API int get_proof_of_work_target(uint8_t *target, uint32_t bits);
+VULKAN_API int check_proof_of_work_target(const uint8_t *hash, const uint8_t *target);
+
+VULKAN_API int get_proof_of_work(uint256_t *work, uint32_t bits);
+
 VULKAN_END_DECL
@@ -37,16 +37,28 @@
 #include <mongoose.h>
 
 #include "common/buffer.h"
+#include "common/buffer_pool.h"
+#include "common/byteorder.h"
+#include "common/compression.h"
 #include "common/logger.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 #include "common/util.h"
 
+#include "block_filter.h"
 #include "blockchain.h"
 #include "checkpoint.h"
 #include "mempool.h"
+#include "mempool_ingress.h"
+#include "merkle.h"
 #include "net.h"
+#include "orphan_pool.h"
 #include "p2p.h"
 #include "parameters.h"
+#include "peer_table.h"
+#include "pow.h"
 #include "protocol.h"
+#include "validator.h"
 #include "version.h"
 
 #include "crypto/cryptoutil.h"
@@ -54,7 +66,35 @@
 #include "miner/miner.h"
 
 static sync_entry_t g_protocol_sync_entry;
+
+// the tx ids we have requested from our peers, kept in an inventory ring along with
+// when each was requested so the oldest requests are forgotten first...
+static inventory_t *g_protocol_requested_tx_ids = NULL;
+static uint64_t g_protocol_requested_tx_ids_ts_ms[MAX_KNOWN_INVENTORY_SIZE];
+
+// the block filters request which is awaiting a response, the connection is only
+// compared against the sender of a response and might be gone by the time it times out...
+static net_connection_t *g_protocol_block_filters_net_connection = NULL;
+static uint32_t g_protocol_block_filters_height = 0;
+static uint32_t g_protocol_block_filters_request_ts = 0;
+static uint16_t g_protocol_block_filters_peer_index = 0;
+
 static int g_protocol_force_version_check = 0;
+static int g_protocol_header_first_sync = 1;
+static uint32_t g_protocol_grouped_blocks_budget_size = DEFAULT_GROUPED_BLOCKS_BUDGET_SIZE;
+static int g_protocol_packet_compression = 1;
+static int g_protocol_compact_encoding = 1;
+
+// the packets are labeled by their packet id, a compressed packet is counted as it
+// is received and again once decompressed, a broadcast is counted once...
+static metric_t g_protocol_packets_received_metric = METRIC_LABELED_COUNTER_INIT("vulkan_packets_received_total",
+  "Packets received from peers by packet id", "type", NULL, NUM_PKT_TYPES);
+static metric_t g_protocol_packet_received_bytes_metric = METRIC_LABELED_COUNTER_INIT("vulkan_packet_received_bytes_total",
+  "Bytes of the packets received from peers by packet id", "type", NULL, NUM_PKT_TYPES);
+static metric_t g_protocol_packets_sent_metric = METRIC_LABELED_COUNTER_INIT("vulkan_packets_sent_total",
+  "Packets sent to peers by packet id", "type", NULL, NUM_PKT_TYPES);
+static metric_t g_protocol_packet_sent_bytes_metric = METRIC_LABELED_COUNTER_INIT("vulkan_packet_sent_bytes_total",
+  "Bytes of the packets sent to peers by packet id before compression", "type", NULL, NUM_PKT_TYPES);
 
 void set_force_version_check(int force_version_check)
 {
@@ -66,6 +106,121 @@ int get_force_version_check(void)
   return g_protocol_force_version_check;
 }
 
+void set_header_first_sync(int header_first_sync)
+{
+  g_protocol_header_first_sync = header_first_sync;
+}
+
+int get_header_first_sync(void)
+{
+  return g_protocol_header_first_sync;
+}
+
+void set_grouped_blocks_budget_size(uint32_t grouped_blocks_budget_size)
+{
+  g_protocol_grouped_blocks_budget_size = grouped_blocks_budget_size;
+}
+
+uint32_t get_grouped_blocks_budget_size(void)
+{
+  return g_protocol_grouped_blocks_budget_size;
+}
+
+void register_protocol_metrics(void)
+{
+  register_metric(&g_protocol_packets_received_metric);
+  register_metric(&g_protocol_packet_received_bytes_metric);
+  register_metric(&g_protocol_packets_sent_metric);
+  register_metric(&g_protocol_packet_sent_bytes_metric);
+}
+
+static void record_packet_metrics(metric_t *packets_metric, metric_t *bytes_metric, uint32_t packet_id, uint32_t packet_size)
+{
+  uint32_t packet_type = packet_id < NUM_PKT_TYPES ? packet_id : PKT_TYPE_UNKNOWN;
+  metric_counter_add(packets_metric, packet_type, 1);
+  metric_counter_add(bytes_metric, packet_type, PACKET_HEADER_SIZE + packet_size);
+}
+
+void set_packet_compression(int packet_compression)
+{
+  g_protocol_packet_compression = packet_compression;
+}
+
+int get_packet_compression(void)
+{
+  return g_protocol_packet_compression;
+}
+
+void set_compact_encoding(int compact_encoding)
+{
+  g_protocol_compact_encoding = compact_encoding;
+}
+
+int get_compact_encoding(void)
+{
+  return g_protocol_compact_encoding;
+}
+
+/*
+ * Compares two dotted version numbers, e.g. "1.0.0" and "1.1.0", component by component,
+ * returns a negative, zero or positive value like strcmp does.
+ */
+int compare_version_numbers(const char *version_number, const char *other_version_number)
+{
+  assert(version_number != NULL);
+  assert(other_version_number != NULL);
+  uint32_t components[3] = {0, 0, 0};
+  uint32_t other_components[3] = {0, 0, 0};
+  sscanf(version_number, "%u.%u.%u", &components[0], &components[1], &components[2]);
+  sscanf(other_version_number, "%u.%u.%u", &other_components[0], &other_components[1], &other_components[2]);
+  for (int i = 0; i < 3; i++)
+  {
+    if (components[i] != other_components[i])
+    {
+      return components[i] < other_components[i] ? -1 : 1;
+    }
+  }
+
+  return 0;
+}
+
+uint32_t get_protocol_capabilities(void)
+{
+  uint32_t capabilities = PROTOCOL_CAPABILITY_PING | PROTOCOL_CAPABILITY_TX_INVENTORY;
+  if (g_protocol_packet_compression && get_compression_supported())
+  {
+    capabilities |= PROTOCOL_CAPABILITY_COMPRESSION;
+  }
+
+  // historical blocks are not served once any of them have been pruned
+  if (get_blockchain_prune_enabled() || get_blockchain_pruned_height() > 0)
+  {
+    capabilities |= PROTOCOL_CAPABILITY_PRUNED;
+  }
+
+  if (get_blockchain_block_filters_enabled())
+  {
+    capabilities |= PROTOCOL_CAPABILITY_BLOCK_FILTERS;
+  }
+
+  if (g_protocol_compact_encoding)
+  {
+    capabilities |= PROTOCOL_CAPABILITY_ENCODING_V2;
+  }
+
+  return capabilities;
+}
+
+encoding_version_t get_net_connection_encoding_version(net_connection_t *net_connection)
+{
+  if (net_connection != NULL && (net_connection->capabilities & PROTOCOL_CAPABILITY_ENCODING_V2))
+  {
+    return ENCODING_VERSION_2;
+  }
+
+  return ENCODING_VERSION_1;
+}
+
 packet_t* make_packet(void)
 {
   packet_t *packet = malloc(sizeof(packet_t));
@@ -111,16 +266,53 @@ int deserialize_packet(packet_t *packet, buffer_iterator_t *buffer_iterator)
 
   if (packet->size > 0)
   {
-    uint8_t *data = NULL;
-    if (buffer_read_bytes32(buffer_iterator, &data))
+    // the payload is copied straight into a pooled buffer
+    uint32_t data_size = 0;
+    if (buffer_read_uint32(buffer_iterator, &data_size) || data_size != packet->size ||
+        buffer_get_remaining_size(buffer_iterator) < data_size)
     {
       return 1;
     }
 
-    packet->data = malloc(packet->size);
-    assert(packet->data != NULL);
-    memcpy(packet->data, data, packet->size);
-    free(data);
+    packet->data = buffer_pool_acquire(packet->size);
+    memcpy(packet->data, buffer_get_remaining_data(buffer_iterator), packet->size);
+    buffer_iterator_set_offset(buffer_iterator, buffer_iterator_get_offset(buffer_iterator) + packet->size);
+  }
+
+  return 0;
+}
+
+/*
+ * Reads the id and size of a packet from the first header_size bytes of it's header,
+ * the size of the payload following the size is only checked once the full header
+ * of PACKET_HEADER_SIZE bytes has been read, packets without a payload do not have it.
+ */
+int deserialize_packet_header(packet_t *packet, const uint8_t *header, size_t header_size)
+{
+  assert(packet != NULL);
+  assert(header != NULL);
+  assert(header_size >= PACKET_HEADER_MIN_SIZE && header_size <= PACKET_HEADER_SIZE);
+
+  buffer_t header_buffer = {(uint8_t*)header, header_size, 0};
+  buffer_iterator_t header_iterator = {&header_buffer, 0};
+  if (buffer_read_uint32(&header_iterator, &packet->id) ||
+      buffer_read_uint32(&header_iterator, &packet->size))
+  {
+    return 1;
+  }
+
+  if (packet->size > MAX_PACKET_SIZE)
+  {
+    return 1;
+  }
+
+  if (packet->size > 0 && header_size == PACKET_HEADER_SIZE)
+  {
+    uint32_t data_size = 0;
+    if (buffer_read_uint32(&header_iterator, &data_size) || data_size != packet->size)
+    {
+      return 1;
+    }
   }
 
   return 0;
@@ -134,26 +326,147 @@ void free_packet(packet_t *packet)
 
   if (packet->data != NULL)
   {
-    free(packet->data);
+    buffer_pool_release(packet->data);
     packet->data = NULL;
   }
 
   free(packet);
 }
 
-int deserialize_message(packet_t *packet, void **message)
+/*
+ * Compresses the payload of a packet into data following the header of the compressed
+ * packet, fails if compressing the payload would not make the packet any smaller.
+ */
+static int compress_packet_data(uint32_t packet_id, const uint8_t *packet_data, uint32_t packet_size, uint8_t *data, size_t *data_size)
+{
+  size_t compressed_size = 0;
+  if (compress_data(data + COMPRESSED_PACKET_HEADER_SIZE, &compressed_size, packet_data, packet_size) ||
+      COMPRESSED_PACKET_HEADER_SIZE + compressed_size >= packet_size)
+  {
+    return 1;
+  }
+
+  uint32_t le_packet_id = swap_le(packet_id);
+  uint32_t le_packet_size = swap_le(packet_size);
+  memcpy(data, &le_packet_id, sizeof(uint32_t));
+  memcpy(data + sizeof(uint32_t), &le_packet_size, sizeof(uint32_t));
+  *data_size = COMPRESSED_PACKET_HEADER_SIZE + compressed_size;
+  return 0;
+}
+
+/*
+ * Wraps the packet's payload in a compressed packet, fails if compressing
+ * the payload would not make the packet any smaller than it already is.
+ */
+int compress_packet(packet_t *packet, packet_t **compressed_packet_out)
 {
   assert(packet != NULL);
-  buffer_t *buffer = NULL;
-  if (packet->size > 0)
+  assert(packet->size > 0);
+  assert(packet->id != PKT_TYPE_COMPRESSED_PACKET);
+
+  uint8_t *data = buffer_pool_acquire(COMPRESSED_PACKET_HEADER_SIZE + get_compress_bound(packet->size));
+  size_t data_size = 0;
+  if (compress_packet_data(packet->id, packet->data, packet->size, data, &data_size))
   {
-    buffer = buffer_init_data(0, (const uint8_t*)packet->data, packet->size);
+    buffer_pool_release(data);
+    return 1;
   }
-  else
+
+  packet_t *compressed_packet = make_packet();
+  compressed_packet->id = PKT_TYPE_COMPRESSED_PACKET;
+  compressed_packet->size = data_size;
+  compressed_packet->data = data;
+  *compressed_packet_out = compressed_packet;
+  return 0;
+}
+
+/*
+ * Same as compress_packet for a packet encoded in place by init_packet_buffer,
+ * the compressed packet is written straight into a packet buffer of it's own.
+ */
+static int compress_packet_buffer(buffer_t *buffer, uint32_t packet_id, uint32_t packet_size, buffer_t **compressed_buffer_out)
+{
+  assert(buffer != NULL);
+  assert(packet_size > 0);
+  assert(packet_id != PKT_TYPE_COMPRESSED_PACKET);
+
+  buffer_t *compressed_buffer = init_packet_buffer(PKT_TYPE_COMPRESSED_PACKET);
+  if (compressed_buffer == NULL)
+  {
+    return 1;
+  }
+
+  size_t data_size = 0;
+  if (buffer_reserve(compressed_buffer, PACKET_HEADER_SIZE + COMPRESSED_PACKET_HEADER_SIZE + get_compress_bound(packet_size)) ||
+      compress_packet_data(packet_id, buffer_get_data(buffer) + PACKET_HEADER_SIZE, packet_size,
+        buffer_get_data(compressed_buffer) + PACKET_HEADER_SIZE, &data_size))
+  {
+    buffer_free(compressed_buffer);
+    return 1;
+  }
+
+  buffer_set_size(compressed_buffer, PACKET_HEADER_SIZE + data_size);
+  buffer_set_offset(compressed_buffer, PACKET_HEADER_SIZE + data_size);
+  if (finish_packet_buffer(compressed_buffer))
+  {
+    buffer_free(compressed_buffer);
+    return 1;
+  }
+
+  *compressed_buffer_out = compressed_buffer;
+  return 0;
+}
+
+int decompress_packet(packet_t *compressed_packet, packet_t **packet_out)
+{
+  assert(compressed_packet != NULL);
+  assert(compressed_packet->id == PKT_TYPE_COMPRESSED_PACKET);
+
+  buffer_t header_buffer = {compressed_packet->data, compressed_packet->size, 0};
+  buffer_iterator_t header_iterator = {&header_buffer, 0};
+
+  uint32_t packet_id = 0;
+  uint32_t packet_size = 0;
+  if (buffer_read_uint32(&header_iterator, &packet_id) ||
+      buffer_read_uint32(&header_iterator, &packet_size))
+  {
+    return 1;
+  }
+
+  // compressed packets cannot be nested, and must not expand past the max packet size
+  // or past what their compressed payload could possibly inflate to...
+  size_t compressed_size = compressed_packet->size - COMPRESSED_PACKET_HEADER_SIZE;
+  if (packet_id == PKT_TYPE_COMPRESSED_PACKET || packet_size == 0 || packet_size > MAX_PACKET_SIZE ||
+      packet_size > compressed_size * DECOMPRESS_MAX_RATIO)
+  {
+    return 1;
+  }
+
+  // the payload is inflated into a buffer which grows with it, rather than
+  // allocating the declared size of the packet up front...
+  uint8_t *data = NULL;
+  if (decompress_data_pooled(&data, packet_size, compressed_packet->data + COMPRESSED_PACKET_HEADER_SIZE, compressed_size))
   {
-    buffer = buffer_init();
+    return 1;
   }
 
+  packet_t *packet = make_packet();
+  packet->id = packet_id;
+  packet->size = packet_size;
+  packet->data = data;
+  *packet_out = packet;
+  return 0;
+}
+
+int decode_message(packet_t *packet, encoding_version_t encoding_version, protocol_message_t *message)
+{
+  assert(packet != NULL);
+  assert(message != NULL);
+
+  // the message is read straight from the packet's payload, without copying it
+  buffer_t packet_buffer = {packet->data, packet->size, 0};
+  buffer_t *buffer = &packet_buffer;
+
   buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
   switch (packet->id)
   {
@@ -186,29 +499,76 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        connect_establish_req_t *packed_message = malloc(sizeof(connect_establish_req_t));
-        assert(packed_message != NULL);
+        // only peers running the handshake extensions version send their
+        // grouped blocks budget and capabilities, older peers send neither...
+        uint32_t grouped_blocks_budget_size = 0;
+        uint32_t capabilities = 0;
+        if (compare_version_numbers(version_number, PROTOCOL_HANDSHAKE_EXTENSIONS_VERSION) >= 0)
+        {
+          if (buffer_read_uint32(buffer_iterator, &grouped_blocks_budget_size) ||
+              buffer_read_uint32(buffer_iterator, &capabilities))
+          {
+            free(version_number);
+            free(version_name);
+            goto packet_deserialize_fail;
+          }
+        }
+
+        connect_establish_req_t *packed_message = (connect_establish_req_t*)message;
         packed_message->host_port = host_port;
         packed_message->version_number = version_number;
         packed_message->version_name = version_name;
         packed_message->use_testnet = use_testnet;
-        *message = packed_message;
+        packed_message->grouped_blocks_budget_size = grouped_blocks_budget_size;
+        packed_message->capabilities = capabilities;
       }
       break;
     case PKT_TYPE_CONNECT_ESTABLISH_RESP:
       {
-        connect_establish_resp_t *packed_message = malloc(sizeof(connect_establish_resp_t));
-        assert(packed_message != NULL);
-        *message = packed_message;
+        // the extensions are only sent back to peers which sent them,
+        // so a response without them is from a legacy peer...
+        uint32_t grouped_blocks_budget_size = 0;
+        uint32_t capabilities = 0;
+        if (buffer_get_remaining_size(buffer_iterator) > 0)
+        {
+          if (buffer_read_uint32(buffer_iterator, &grouped_blocks_budget_size) ||
+              buffer_read_uint32(buffer_iterator, &capabilities))
+          {
+            goto packet_deserialize_fail;
+          }
+        }
+
+        connect_establish_resp_t *packed_message = (connect_establish_resp_t*)message;
+        packed_message->grouped_blocks_budget_size = grouped_blocks_budget_size;
+        packed_message->capabilities = capabilities;
+      }
+      break;
+    case PKT_TYPE_CONNECT_PING_REQ:
+      {
+        uint64_t nonce = 0;
+        if (buffer_read_uint64(buffer_iterator, &nonce))
+        {
+          goto packet_deserialize_fail;
+        }
+
+        connect_ping_req_t *packed_message = (connect_ping_req_t*)message;
+        packed_message->nonce = nonce;
       }
       break;
-    case PKT_TYPE_GET_PEERLIST_REQ:
+    case PKT_TYPE_CONNECT_PING_RESP:
       {
-        get_peerlist_req_t *packed_message = malloc(sizeof(get_peerlist_req_t));
-        assert(packed_message != NULL);
-        *message = packed_message;
+        uint64_t nonce = 0;
+        if (buffer_read_uint64(buffer_iterator, &nonce))
+        {
+          goto packet_deserialize_fail;
+        }
+
+        connect_ping_resp_t *packed_message = (connect_ping_resp_t*)message;
+        packed_message->nonce = nonce;
       }
       break;
+    case PKT_TYPE_GET_PEERLIST_REQ:
+      break;
     case PKT_TYPE_GET_PEERLIST_RESP:
       {
         uint32_t peerlist_data_size = 0;
@@ -223,19 +583,12 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_peerlist_resp_t *packed_message = malloc(sizeof(get_peerlist_resp_t));
-        assert(packed_message != NULL);
+        get_peerlist_resp_t *packed_message = (get_peerlist_resp_t*)message;
         packed_message->peerlist_data_size = peerlist_data_size;
         packed_message->peerlist_data = peerlist_data;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_HEIGHT_REQ:
-      {
-        get_block_height_request_t *packed_message = malloc(sizeof(get_block_height_request_t));
-        assert(packed_message != NULL);
-        *message = packed_message;
-      }
       break;
     case PKT_TYPE_GET_BLOCK_HEIGHT_RESP:
       {
@@ -251,11 +604,9 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_height_response_t *packed_message = malloc(sizeof(get_block_height_response_t));
-        assert(packed_message != NULL);
+        get_block_height_response_t *packed_message = (get_block_height_response_t*)message;
         packed_message->height = height;
         packed_message->hash = hash;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HASH_REQ:
@@ -266,10 +617,8 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_by_hash_request_t *packed_message = malloc(sizeof(get_block_by_hash_request_t));
-        assert(packed_message != NULL);
+        get_block_by_hash_request_t *packed_message = (get_block_by_hash_request_t*)message;
         packed_message->hash = hash;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HASH_RESP:
@@ -286,11 +635,9 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_by_hash_response_t *packed_message = malloc(sizeof(get_block_by_hash_response_t));
-        assert(packed_message != NULL);
+        get_block_by_hash_response_t *packed_message = (get_block_by_hash_response_t*)message;
         packed_message->height = height;
         packed_message->block = block;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ:
@@ -301,10 +648,8 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_by_height_request_t *packed_message = malloc(sizeof(get_block_by_height_request_t));
-        assert(packed_message != NULL);
+        get_block_by_height_request_t *packed_message = (get_block_by_height_request_t*)message;
         packed_message->height = height;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HEIGHT_RESP:
@@ -322,23 +667,58 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_by_height_response_t *packed_message = malloc(sizeof(get_block_by_height_response_t));
-        assert(packed_message != NULL);
+        get_block_by_height_response_t *packed_message = (get_block_by_height_response_t*)message;
         packed_message->hash = hash;
         packed_message->block = block;
-        *message = packed_message;
       }
       break;
-    /*case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
       {
+        uint8_t *hash = NULL;
+        if (buffer_read_bytes32(buffer_iterator, &hash))
+        {
+          goto packet_deserialize_fail;
+        }
+
+        uint8_t include_transactions = 0;
+        if (buffer_read_uint8(buffer_iterator, &include_transactions))
+        {
+          free(hash);
+          goto packet_deserialize_fail;
+        }
 
+        get_grouped_blocks_from_hash_request_t *packed_message = (get_grouped_blocks_from_hash_request_t*)message;
+        packed_message->hash = hash;
+        packed_message->include_transactions = include_transactions;
       }
       break;
     case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
       {
+        uint32_t block_data_size = 0;
+        if (buffer_read_uint32(buffer_iterator, &block_data_size))
+        {
+          goto packet_deserialize_fail;
+        }
+
+        // the block data is read by it's own length prefix, which has to match the
+        // block data size the handler reads it by or it would read past the data...
+        uint32_t block_data_length = 0;
+        if (buffer_read_uint32(buffer_iterator, &block_data_length) || block_data_length != block_data_size)
+        {
+          goto packet_deserialize_fail;
+        }
 
+        uint8_t *block_data = NULL;
+        if (buffer_read(buffer_iterator, block_data_length, &block_data))
+        {
+          goto packet_deserialize_fail;
+        }
+
+        get_grouped_blocks_from_hash_response_t *packed_message = (get_grouped_blocks_from_hash_response_t*)message;
+        packed_message->block_data_size = block_data_size;
+        packed_message->block_data = block_data;
       }
-      break;*/
+      break;
     case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
       {
         uint32_t height = 0;
@@ -347,10 +727,20 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_grouped_blocks_from_height_request_t *packed_message = malloc(sizeof(get_grouped_blocks_from_height_request_t));
-        assert(packed_message != NULL);
+        // header only requests leave out the include transactions flag,
+        // which keeps them compatible with peers that do not know about it...
+        uint8_t include_transactions = 0;
+        if (buffer_get_remaining_size(buffer_iterator) > 0)
+        {
+          if (buffer_read_uint8(buffer_iterator, &include_transactions))
+          {
+            goto packet_deserialize_fail;
+          }
+        }
+
+        get_grouped_blocks_from_height_request_t *packed_message = (get_grouped_blocks_from_height_request_t*)message;
         packed_message->height = height;
-        *message = packed_message;
+        packed_message->include_transactions = include_transactions;
       }
       break;
     case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
@@ -361,17 +751,23 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
+        // the block data is read by it's own length prefix, which has to match the
+        // block data size the handler reads it by or it would read past the data...
+        uint32_t block_data_length = 0;
+        if (buffer_read_uint32(buffer_iterator, &block_data_length) || block_data_length != block_data_size)
+        {
+          goto packet_deserialize_fail;
+        }
+
         uint8_t *block_data = NULL;
-        if (buffer_read_bytes32(buffer_iterator, &block_data))
+        if (buffer_read(buffer_iterator, block_data_length, &block_data))
         {
           goto packet_deserialize_fail;
         }
 
-        get_grouped_blocks_from_height_response_t *packed_message = malloc(sizeof(get_grouped_blocks_from_height_response_t));
-        assert(packed_message != NULL);
+        get_grouped_blocks_from_height_response_t *packed_message = (get_grouped_blocks_from_height_response_t*)message;
         packed_message->block_data_size = block_data_size;
         packed_message->block_data = block_data;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ:
@@ -382,10 +778,8 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_num_transactions_request_t *packed_message = malloc(sizeof(get_block_num_transactions_request_t));
-        assert(packed_message != NULL);
+        get_block_num_transactions_request_t *packed_message = (get_block_num_transactions_request_t*)message;
         packed_message->hash = hash;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_RESP:
@@ -403,11 +797,9 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_num_transactions_response_t *packed_message = malloc(sizeof(get_block_num_transactions_response_t));
-        assert(packed_message != NULL);
+        get_block_num_transactions_response_t *packed_message = (get_block_num_transactions_response_t*)message;
         packed_message->hash = hash;
         packed_message->num_transactions = num_transactions;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ:
@@ -425,11 +817,9 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_transaction_by_hash_request_t *packed_message = malloc(sizeof(get_block_transaction_by_hash_request_t));
-        assert(packed_message != NULL);
+        get_block_transaction_by_hash_request_t *packed_message = (get_block_transaction_by_hash_request_t*)message;
         packed_message->block_hash = block_hash;
         packed_message->tx_hash = tx_hash;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_RESP:
@@ -454,12 +844,10 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_transaction_by_hash_response_t *packed_message = malloc(sizeof(get_block_transaction_by_hash_response_t));
-        assert(packed_message != NULL);
+        get_block_transaction_by_hash_response_t *packed_message = (get_block_transaction_by_hash_response_t*)message;
         packed_message->block_hash = block_hash;
         packed_message->tx_index = tx_index;
         packed_message->transaction = transaction;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ:
@@ -477,11 +865,9 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_transaction_by_index_request_t *packed_message = malloc(sizeof(get_block_transaction_by_index_request_t));
-        assert(packed_message != NULL);
+        get_block_transaction_by_index_request_t *packed_message = (get_block_transaction_by_index_request_t*)message;
         packed_message->block_hash = block_hash;
         packed_message->tx_index = tx_index;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP:
@@ -506,1078 +892,3720 @@ int deserialize_message(packet_t *packet, void **message)
           goto packet_deserialize_fail;
         }
 
-        get_block_transaction_by_index_response_t *packed_message = malloc(sizeof(get_block_transaction_by_index_response_t));
-        assert(packed_message != NULL);
+        get_block_transaction_by_index_response_t *packed_message = (get_block_transaction_by_index_response_t*)message;
         packed_message->block_hash = block_hash;
         packed_message->tx_index = tx_index;
         packed_message->transaction = transaction;
-        *message = packed_message;
       }
       break;
     case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
       {
         transaction_t *transaction = NULL;
-        if (deserialize_transaction(buffer_iterator, &transaction))
+        if (deserialize_transaction_encoded(buffer_iterator, encoding_version, &transaction))
         {
           goto packet_deserialize_fail;
         }
 
-        incoming_mempool_transaction_t *packed_message = malloc(sizeof(incoming_mempool_transaction_t));
-        assert(packed_message != NULL);
+        incoming_mempool_transaction_t *packed_message = (incoming_mempool_transaction_t*)message;
         packed_message->transaction = transaction;
-        *message = packed_message;
       }
       break;
-    default:
-      LOG_DEBUG("Could not deserialize packet with unknown packet id: %u!", packet->id);
-      goto packet_deserialize_fail;
-  }
-
-  // check to see if there is any extraneous data in the buffer
-  uint32_t remaining_size = buffer_get_remaining_size(buffer_iterator);
-  if (remaining_size > 0)
-  {
-    LOG_ERROR("Could not deserialize packet with id: %u, packet has extraneous data of size: %u!", packet->id, remaining_size);
-    free_message(packet->id, 1, *message);
-    goto packet_deserialize_fail;
-  }
-
-  buffer_iterator_free(buffer_iterator);
-  buffer_free(buffer);
-  return 0;
-
-packet_deserialize_fail:
-  buffer_iterator_free(buffer_iterator);
-  buffer_free(buffer);
-  return 1;
-}
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ:
+      {
+        uint32_t height = 0;
+        if (buffer_read_uint32(buffer_iterator, &height))
+        {
+          goto packet_deserialize_fail;
+        }
 
-int serialize_message(packet_t **packet, uint32_t packet_id, va_list args)
-{
-  buffer_t *buffer = buffer_init();
-  switch (packet_id)
-  {
-    case PKT_TYPE_CONNECT_ESTABLISH_REQ:
+        get_block_headers_from_height_request_t *packed_message = (get_block_headers_from_height_request_t*)message;
+        packed_message->height = height;
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP:
       {
-        uint32_t host_port = va_arg(args, uint32_t);
-        uint8_t use_testnet = va_arg(args, int);
-        if (buffer_write_uint32(buffer, host_port))
+        uint32_t height = 0;
+        if (buffer_read_uint32(buffer_iterator, &height))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_string32(buffer, APPLICATION_VERSION, strlen(APPLICATION_VERSION)))
+        uint32_t headers_count = 0;
+        if (buffer_read_uint32(buffer_iterator, &headers_count))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_string32(buffer, APPLICATION_RELEASE_NAME, strlen(APPLICATION_RELEASE_NAME)))
+        uint32_t header_data_size = 0;
+        if (buffer_read_uint32(buffer_iterator, &header_data_size))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_uint8(buffer, use_testnet))
+        // the header data is read by it's own length prefix, which has to match the
+        // header data size the handler reads it by or it would read past the data...
+        uint32_t header_data_length = 0;
+        if (buffer_read_uint32(buffer_iterator, &header_data_length) || header_data_length != header_data_size)
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
-      }
-      break;
-    case PKT_TYPE_CONNECT_ESTABLISH_RESP:
-      {
 
-      }
-      break;
-    case PKT_TYPE_GET_PEERLIST_REQ:
-      {
-
-      }
-      break;
-    case PKT_TYPE_GET_PEERLIST_RESP:
-      {
-        buffer_t *peerlist_buffer = va_arg(args, buffer_t*);
-        assert(peerlist_buffer != NULL);
-
-        uint32_t peerlist_data_size = buffer_get_size(peerlist_buffer);
-        assert(peerlist_data_size <= UINT32_MAX);
-
-        uint8_t *peerlist_data = buffer_get_data(peerlist_buffer);
-        assert(peerlist_data != NULL);
-
-        if (buffer_write_uint32(buffer, peerlist_data_size))
+        uint8_t *header_data = NULL;
+        if (buffer_read(buffer_iterator, header_data_length, &header_data))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_bytes32(buffer, peerlist_data, peerlist_data_size))
-        {
-          goto serialize_message_fail;
-        }
+        get_block_headers_from_height_response_t *packed_message = (get_block_headers_from_height_response_t*)message;
+        packed_message->height = height;
+        packed_message->headers_count = headers_count;
+        packed_message->header_data_size = header_data_size;
+        packed_message->header_data = header_data;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_HEIGHT_REQ:
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ:
       {
+        uint8_t *hash = NULL;
+        if (buffer_read_bytes32(buffer_iterator, &hash))
+        {
+          goto packet_deserialize_fail;
+        }
 
+        get_full_block_by_hash_request_t *packed_message = (get_full_block_by_hash_request_t*)message;
+        packed_message->hash = hash;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_HEIGHT_RESP:
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP:
       {
-        uint32_t height = va_arg(args, uint32_t);
-        uint8_t *hash = va_arg(args, uint8_t*);
-        assert(hash != NULL);
-
-        if (buffer_write_uint32(buffer, height))
+        block_t *block = NULL;
+        if (deserialize_block(buffer_iterator, &block))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        if (deserialize_transactions_to_block_in_arena(buffer_iterator, block))
         {
-          goto serialize_message_fail;
+          free_block(block);
+          goto packet_deserialize_fail;
         }
+
+        get_full_block_by_hash_response_t *packed_message = (get_full_block_by_hash_response_t*)message;
+        packed_message->block = block;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_BY_HASH_REQ:
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_REQ:
       {
-        uint8_t *hash = va_arg(args, uint8_t*);
-        assert(hash != NULL);
-
-        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        uint8_t *tx_id = NULL;
+        if (buffer_read_bytes32(buffer_iterator, &tx_id))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
+
+        get_transaction_merkle_branch_request_t *packed_message = (get_transaction_merkle_branch_request_t*)message;
+        packed_message->tx_id = tx_id;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_BY_HASH_RESP:
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP:
       {
-        uint32_t height = va_arg(args, uint32_t);
-        block_t *block = va_arg(args, block_t*);
-        assert(block != NULL);
-
-        if (buffer_write_uint32(buffer, height))
+        block_t *block = NULL;
+        if (deserialize_block(buffer_iterator, &block))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (serialize_block(buffer, block))
+        uint32_t tx_index = 0;
+        if (buffer_read_uint32(buffer_iterator, &tx_index))
         {
-          goto serialize_message_fail;
+          free_block(block);
+          goto packet_deserialize_fail;
         }
-      }
-      break;
-    case PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ:
-      {
-        uint32_t height = va_arg(args, uint32_t);
-        if (buffer_write_uint32(buffer, height))
+
+        transaction_t *transaction = NULL;
+        if (deserialize_transaction(buffer_iterator, &transaction))
         {
-          goto serialize_message_fail;
+          free_block(block);
+          goto packet_deserialize_fail;
         }
-      }
-      break;
-    case PKT_TYPE_GET_BLOCK_BY_HEIGHT_RESP:
-      {
-        uint8_t *hash = va_arg(args, uint8_t*);
-        block_t *block = va_arg(args, block_t*);
-
-        assert(hash != NULL);
-        assert(block != NULL);
 
-        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        uint32_t branch_length = 0;
+        if (buffer_read_uint32(buffer_iterator, &branch_length) || branch_length > MAX_MERKLE_BRANCH_LENGTH)
         {
-          goto serialize_message_fail;
+          free_block(block);
+          free_transaction(transaction);
+          goto packet_deserialize_fail;
         }
 
-        if (serialize_block(buffer, block))
+        // the branch of a block with a single tx is empty
+        uint8_t *branch = NULL;
+        if (branch_length > 0 && buffer_read(buffer_iterator, branch_length * HASH_SIZE, &branch))
         {
-          goto serialize_message_fail;
+          free_block(block);
+          free_transaction(transaction);
+          goto packet_deserialize_fail;
         }
-      }
-      break;
-    /*case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
-      {
 
+        get_transaction_merkle_branch_response_t *packed_message = (get_transaction_merkle_branch_response_t*)message;
+        packed_message->block = block;
+        packed_message->tx_index = tx_index;
+        packed_message->transaction = transaction;
+        packed_message->branch_length = branch_length;
+        packed_message->branch = branch;
       }
       break;
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
-      {
-
-      }
-      break;*/
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ:
       {
-        uint32_t height = va_arg(args, uint32_t);
-        if (buffer_write_uint32(buffer, height))
+        uint8_t *hash = NULL;
+        if (buffer_read_bytes32(buffer_iterator, &hash))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
+
+        get_compact_block_by_hash_request_t *packed_message = (get_compact_block_by_hash_request_t*)message;
+        packed_message->hash = hash;
       }
       break;
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP:
       {
-        buffer_t *block_data_buffer = va_arg(args, buffer_t*);
-        assert(block_data_buffer != NULL);
-
-        uint32_t block_data_size = buffer_get_size(block_data_buffer);
-        assert(block_data_size <= UINT32_MAX);
-
-        uint8_t *block_data = buffer_get_data(block_data_buffer);
-        assert(block_data != NULL);
-
-        if (buffer_write_uint32(buffer, block_data_size))
+        block_t *block = NULL;
+        if (deserialize_block_encoded(buffer_iterator, encoding_version, &block))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_bytes32(buffer, block_data, block_data_size))
+        // every block has at least the generation tx, which is always sent in full
+        transaction_t *generation_tx = NULL;
+        if (block->transaction_count == 0 || deserialize_transaction_encoded(buffer_iterator, encoding_version, &generation_tx))
         {
-          goto serialize_message_fail;
+          free_block(block);
+          goto packet_deserialize_fail;
         }
-      }
-      break;
-    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ:
-      {
-        uint8_t *hash = va_arg(args, uint8_t*);
-        assert(hash != NULL);
 
-        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        uint8_t *short_ids = NULL;
+        uint64_t short_ids_size = (uint64_t)(block->transaction_count - 1) * COMPACT_BLOCK_SHORT_ID_SIZE;
+        if (short_ids_size > 0 && buffer_read(buffer_iterator, short_ids_size, &short_ids))
         {
-          goto serialize_message_fail;
+          free_block(block);
+          free_transaction(generation_tx);
+          goto packet_deserialize_fail;
         }
+
+        // the remaining txs are filled in later from the short ids, until
+        // then the block only holds it's generation tx...
+        block->transactions = malloc(sizeof(transaction_t*));
+        assert(block->transactions != NULL);
+        block->transactions[0] = generation_tx;
+
+        get_compact_block_by_hash_response_t *packed_message = (get_compact_block_by_hash_response_t*)message;
+        packed_message->block = block;
+        packed_message->short_ids = short_ids;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_RESP:
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ:
       {
-        uint8_t *hash = va_arg(args, uint8_t*);
-        uint64_t num_transactions = va_arg(args, uint64_t);
-        assert(hash != NULL);
-
-        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        uint8_t *hash = NULL;
+        if (buffer_read_bytes32(buffer_iterator, &hash))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_uint64(buffer, num_transactions))
+        uint32_t tx_indexes_count = 0;
+        if (buffer_read_uint32(buffer_iterator, &tx_indexes_count) || tx_indexes_count == 0 ||
+            buffer_get_remaining_size(buffer_iterator) < (uint64_t)tx_indexes_count * sizeof(uint32_t))
         {
-          goto serialize_message_fail;
+          free(hash);
+          goto packet_deserialize_fail;
         }
-      }
-      break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ:
-      {
-        uint8_t *block_hash = va_arg(args, uint8_t*);
-        uint8_t *tx_hash = va_arg(args, uint8_t*);
-
-        assert(block_hash != NULL);
-        assert(tx_hash != NULL);
 
-        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        uint32_t *tx_indexes = malloc(sizeof(uint32_t) * tx_indexes_count);
+        assert(tx_indexes != NULL);
+        for (uint32_t i = 0; i < tx_indexes_count; i++)
         {
-          goto serialize_message_fail;
+          if (buffer_read_uint32(buffer_iterator, &tx_indexes[i]))
+          {
+            free(hash);
+            free(tx_indexes);
+            goto packet_deserialize_fail;
+          }
         }
 
-        if (buffer_write_bytes32(buffer, tx_hash, HASH_SIZE))
-        {
-          goto serialize_message_fail;
-        }
+        get_compact_block_transactions_request_t *packed_message = (get_compact_block_transactions_request_t*)message;
+        packed_message->hash = hash;
+        packed_message->tx_indexes_count = tx_indexes_count;
+        packed_message->tx_indexes = tx_indexes;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_RESP:
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_RESP:
       {
-        uint8_t *block_hash = va_arg(args, uint8_t*);
-        uint32_t tx_index = va_arg(args, uint32_t);
-        transaction_t *transaction = va_arg(args, transaction_t*);
-
-        assert(block_hash != NULL);
-        assert(transaction != NULL);
-
-        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        uint8_t *hash = NULL;
+        if (buffer_read_bytes32(buffer_iterator, &hash))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_uint32(buffer, tx_index))
+        // each tx takes up more than a single byte, so the count can
+        // be checked against the remaining size before allocating...
+        uint32_t transactions_count = 0;
+        if (buffer_read_uint32(buffer_iterator, &transactions_count) || transactions_count == 0 ||
+            buffer_get_remaining_size(buffer_iterator) < transactions_count)
         {
-          goto serialize_message_fail;
+          free(hash);
+          goto packet_deserialize_fail;
         }
 
-        if (serialize_transaction(buffer, transaction))
+        transaction_t **transactions = malloc(sizeof(transaction_t*) * transactions_count);
+        assert(transactions != NULL);
+        for (uint32_t i = 0; i < transactions_count; i++)
         {
-          goto serialize_message_fail;
+          if (deserialize_transaction_encoded(buffer_iterator, encoding_version, &transactions[i]))
+          {
+            for (uint32_t j = 0; j < i; j++)
+            {
+              free_transaction(transactions[j]);
+            }
+
+            free(hash);
+            free(transactions);
+            goto packet_deserialize_fail;
+          }
         }
+
+        get_compact_block_transactions_response_t *packed_message = (get_compact_block_transactions_response_t*)message;
+        packed_message->hash = hash;
+        packed_message->transactions_count = transactions_count;
+        packed_message->transactions = transactions;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ:
+    case PKT_TYPE_TRANSACTION_INVENTORY:
       {
-        uint8_t *block_hash = va_arg(args, uint8_t*);
-        uint32_t tx_index = va_arg(args, uint32_t);
-        assert(block_hash != NULL);
-
-        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        uint32_t tx_ids_count = 0;
+        if (buffer_read_uint32(buffer_iterator, &tx_ids_count) ||
+            tx_ids_count == 0 || tx_ids_count > MAX_INVENTORY_TX_IDS_COUNT)
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_uint32(buffer, tx_index))
+        uint8_t *tx_ids = NULL;
+        if (buffer_read(buffer_iterator, tx_ids_count * HASH_SIZE, &tx_ids))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
+
+        transaction_inventory_t *packed_message = (transaction_inventory_t*)message;
+        packed_message->tx_ids_count = tx_ids_count;
+        packed_message->tx_ids = tx_ids;
       }
       break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP:
+    case PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ:
       {
-        uint8_t *block_hash = va_arg(args, uint8_t*);
-        uint32_t tx_index = va_arg(args, uint32_t);
-        transaction_t *transaction = va_arg(args, transaction_t*);
-
-        assert(block_hash != NULL);
-        assert(transaction != NULL);
-
-        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        uint32_t tx_ids_count = 0;
+        if (buffer_read_uint32(buffer_iterator, &tx_ids_count) ||
+            tx_ids_count == 0 || tx_ids_count > MAX_INVENTORY_TX_IDS_COUNT)
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (buffer_write_uint32(buffer, tx_index))
+        uint8_t *tx_ids = NULL;
+        if (buffer_read(buffer_iterator, tx_ids_count * HASH_SIZE, &tx_ids))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
 
-        if (serialize_transaction(buffer, transaction))
+        get_transactions_by_id_request_t *packed_message = (get_transactions_by_id_request_t*)message;
+        packed_message->tx_ids_count = tx_ids_count;
+        packed_message->tx_ids = tx_ids;
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_FILTERS_REQ:
+      {
+        uint32_t height = 0;
+        uint32_t count = 0;
+        if (buffer_read_uint32(buffer_iterator, &height) ||
+            buffer_read_uint32(buffer_iterator, &count) ||
+            count == 0 || count > MAX_BLOCK_FILTERS_COUNT)
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
+
+        get_block_filters_request_t *packed_message = (get_block_filters_request_t*)message;
+        packed_message->height = height;
+        packed_message->count = count;
       }
       break;
-    case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
+    case PKT_TYPE_GET_BLOCK_FILTERS_RESP:
       {
-        transaction_t *transaction = va_arg(args, transaction_t*);
-        assert(transaction != NULL);
+        uint32_t height = 0;
+        uint32_t filters_count = 0;
+        uint32_t filter_data_size = 0;
+        if (buffer_read_uint32(buffer_iterator, &height) ||
+            buffer_read_uint32(buffer_iterator, &filters_count) ||
+            buffer_read_uint32(buffer_iterator, &filter_data_size) ||
+            filters_count == 0 || filters_count > MAX_BLOCK_FILTERS_COUNT)
+        {
+          goto packet_deserialize_fail;
+        }
 
-        if (serialize_transaction(buffer, transaction))
+        uint8_t *filter_data = NULL;
+        if (buffer_read(buffer_iterator, filter_data_size, &filter_data))
         {
-          goto serialize_message_fail;
+          goto packet_deserialize_fail;
         }
+
+        get_block_filters_response_t *packed_message = (get_block_filters_response_t*)message;
+        packed_message->height = height;
+        packed_message->filters_count = filters_count;
+        packed_message->filter_data_size = filter_data_size;
+        packed_message->filter_data = filter_data;
       }
       break;
     default:
-      LOG_DEBUG("Could not serialize packet with unknown packet id: %u!", packet_id);
-      return 1;
+      LOG_DEBUG("Could not deserialize packet with unknown packet id: %u!", packet->id);
+      goto packet_deserialize_fail;
   }
 
-  const uint8_t *data = buffer_get_data(buffer);
-  uint32_t data_len = buffer_get_size(buffer);
-
-  packet_t *serialized_packet = make_packet();
-  serialized_packet->id = packet_id;
-  serialized_packet->size = data_len;
-  if (data_len > 0)
+  // check to see if there is any extraneous data in the buffer
+  uint32_t remaining_size = buffer_get_remaining_size(buffer_iterator);
+  if (remaining_size > 0)
   {
-    serialized_packet->data = malloc(data_len);
-    assert(serialized_packet->data != NULL);
-    memcpy(serialized_packet->data, data, data_len);
+    LOG_ERROR("Could not deserialize packet with id: %u, packet has extraneous data of size: %u!", packet->id, remaining_size);
+    release_message(packet->id, 1, message);
+    goto packet_deserialize_fail;
   }
 
-  *packet = serialized_packet;
-  buffer_free(buffer);
+  buffer_iterator_free(buffer_iterator);
   return 0;
 
-serialize_message_fail:
-  buffer_free(buffer);
+packet_deserialize_fail:
+  buffer_iterator_free(buffer_iterator);
   return 1;
 }
 
-void free_message(uint32_t packet_id, int did_packet_fail, void *message_object)
+int deserialize_message(packet_t *packet, void **message)
 {
-  assert(message_object != NULL);
+  protocol_message_t *packed_message = malloc(sizeof(protocol_message_t));
+  assert(packed_message != NULL);
+  if (decode_message(packet, ENCODING_VERSION_1, packed_message))
+  {
+    free(packed_message);
+    return 1;
+  }
+
+  *message = packed_message;
+  return 0;
+}
+
+/*
+ * Starts a packet which is encoded in place, the header is reserved up front and
+ * filled in by finish_packet_buffer once the size of the message is known, so the
+ * message is written once straight into the buffer that ends up on the wire...
+ */
+buffer_t* init_packet_buffer(uint32_t packet_id)
+{
+  buffer_t *buffer = buffer_init();
+  if (buffer_write_uint32(buffer, packet_id) ||
+      buffer_write_uint32(buffer, 0) ||
+      buffer_write_uint32(buffer, 0))
+  {
+    buffer_free(buffer);
+    return NULL;
+  }
+
+  return buffer;
+}
+
+int finish_packet_buffer(buffer_t *buffer)
+{
+  assert(buffer != NULL);
+  assert(buffer_get_size(buffer) >= PACKET_HEADER_SIZE);
+
+  size_t packet_size = buffer_get_size(buffer) - PACKET_HEADER_SIZE;
+  if (packet_size > UINT32_MAX)
+  {
+    return 1;
+  }
+
+  // packets without a payload do not have the size of the payload in their header
+  uint32_t size = swap_le((uint32_t)packet_size);
+  memcpy(buffer_get_data(buffer) + sizeof(uint32_t), &size, sizeof(uint32_t));
+  if (packet_size > 0)
+  {
+    memcpy(buffer_get_data(buffer) + PACKET_HEADER_MIN_SIZE, &size, sizeof(uint32_t));
+  }
+  else
+  {
+    buffer_set_size(buffer, PACKET_HEADER_MIN_SIZE);
+    buffer_set_offset(buffer, PACKET_HEADER_MIN_SIZE);
+  }
+
+  return 0;
+}
+
+int encode_ping_message(buffer_t *buffer, uint64_t nonce)
+{
+  assert(buffer != NULL);
+  return buffer_write_uint64(buffer, nonce);
+}
+
+int encode_hash_message(buffer_t *buffer, const uint8_t *hash)
+{
+  assert(buffer != NULL);
+  assert(hash != NULL);
+  return buffer_write_bytes32(buffer, hash, HASH_SIZE);
+}
+
+int encode_tx_ids_message(buffer_t *buffer, uint32_t tx_ids_count, const uint8_t *tx_ids)
+{
+  assert(buffer != NULL);
+  assert(tx_ids_count > 0 && tx_ids_count <= MAX_INVENTORY_TX_IDS_COUNT);
+  assert(tx_ids != NULL);
+
+  if (buffer_write_uint32(buffer, tx_ids_count) ||
+      buffer_write(buffer, tx_ids, tx_ids_count * HASH_SIZE))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+int encode_message(buffer_t *buffer, encoding_version_t encoding_version, uint32_t packet_id, va_list args)
+{
+  assert(buffer != NULL);
   switch (packet_id)
   {
     case PKT_TYPE_CONNECT_ESTABLISH_REQ:
       {
-        connect_establish_req_t *message = (connect_establish_req_t*)message_object;
-        free(message->version_number);
-        free(message->version_name);
-        free(message);
+        uint32_t host_port = va_arg(args, uint32_t);
+        uint8_t use_testnet = va_arg(args, int);
+        if (buffer_write_uint32(buffer, host_port))
+        {
+          return 1;
+        }
+
+        if (buffer_write_string32(buffer, APPLICATION_VERSION, strlen(APPLICATION_VERSION)))
+        {
+          return 1;
+        }
+
+        if (buffer_write_string32(buffer, APPLICATION_RELEASE_NAME, strlen(APPLICATION_RELEASE_NAME)))
+        {
+          return 1;
+        }
+
+        if (buffer_write_uint8(buffer, use_testnet))
+        {
+          return 1;
+        }
+
+        // the handshake extensions are implied by our version number, which is
+        // at least PROTOCOL_HANDSHAKE_EXTENSIONS_VERSION...
+        if (buffer_write_uint32(buffer, g_protocol_grouped_blocks_budget_size))
+        {
+          return 1;
+        }
+
+        if (buffer_write_uint32(buffer, get_protocol_capabilities()))
+        {
+          return 1;
+        }
       }
       break;
     case PKT_TYPE_CONNECT_ESTABLISH_RESP:
       {
-        connect_establish_resp_t *message = (connect_establish_resp_t*)message_object;
-        free(message);
+        // legacy peers reject a response with any data in it, so the
+        // extensions are only sent to peers which sent theirs...
+        int send_handshake_extensions = va_arg(args, int);
+        if (send_handshake_extensions)
+        {
+          if (buffer_write_uint32(buffer, g_protocol_grouped_blocks_budget_size))
+          {
+            return 1;
+          }
+
+          if (buffer_write_uint32(buffer, get_protocol_capabilities()))
+          {
+            return 1;
+          }
+        }
+      }
+      break;
+    case PKT_TYPE_CONNECT_PING_REQ:
+    case PKT_TYPE_CONNECT_PING_RESP:
+      {
+        uint64_t nonce = va_arg(args, uint64_t);
+        if (encode_ping_message(buffer, nonce))
+        {
+          return 1;
+        }
       }
       break;
     case PKT_TYPE_GET_PEERLIST_REQ:
       {
-        get_peerlist_req_t *message = (get_peerlist_req_t*)message_object;
-        free(message);
+
       }
       break;
     case PKT_TYPE_GET_PEERLIST_RESP:
       {
-        get_peerlist_resp_t *message = (get_peerlist_resp_t*)message_object;
-        free(message->peerlist_data);
-        free(message);
+        buffer_t *peerlist_buffer = va_arg(args, buffer_t*);
+        assert(peerlist_buffer != NULL);
+
+        uint32_t peerlist_data_size = buffer_get_size(peerlist_buffer);
+        assert(peerlist_data_size <= UINT32_MAX);
+
+        uint8_t *peerlist_data = buffer_get_data(peerlist_buffer);
+        assert(peerlist_data != NULL);
+
+        if (buffer_write_uint32(buffer, peerlist_data_size))
+        {
+          return 1;
+        }
+
+        if (buffer_write_bytes32(buffer, peerlist_data, peerlist_data_size))
+        {
+          return 1;
+        }
       }
       break;
     case PKT_TYPE_GET_BLOCK_HEIGHT_REQ:
       {
-        get_block_height_request_t *message = (get_block_height_request_t*)message_object;
-        free(message);
+
       }
       break;
     case PKT_TYPE_GET_BLOCK_HEIGHT_RESP:
       {
-        get_block_height_response_t *message = (get_block_height_response_t*)message_object;
-        free(message->hash);
-        free(message);
+        uint32_t height = va_arg(args, uint32_t);
+        uint8_t *hash = va_arg(args, uint8_t*);
+        assert(hash != NULL);
+
+        if (buffer_write_uint32(buffer, height))
+        {
+          return 1;
+        }
+
+        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        {
+          return 1;
+        }
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HASH_REQ:
       {
-        get_block_by_hash_request_t *message = (get_block_by_hash_request_t*)message_object;
-        free(message->hash);
-        free(message);
+        uint8_t *hash = va_arg(args, uint8_t*);
+        if (encode_hash_message(buffer, hash))
+        {
+          return 1;
+        }
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HASH_RESP:
       {
-        get_block_by_hash_response_t *message = (get_block_by_hash_response_t*)message_object;
-        if (did_packet_fail)
+        uint32_t height = va_arg(args, uint32_t);
+        block_t *block = va_arg(args, block_t*);
+        assert(block != NULL);
+
+        if (buffer_write_uint32(buffer, height))
         {
-          free_block(message->block);
+          return 1;
         }
 
-        free(message);
+        if (serialize_block(buffer, block))
+        {
+          return 1;
+        }
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ:
       {
-        get_block_by_height_request_t *message = (get_block_by_height_request_t*)message_object;
-        free(message);
+        uint32_t height = va_arg(args, uint32_t);
+        if (buffer_write_uint32(buffer, height))
+        {
+          return 1;
+        }
       }
       break;
     case PKT_TYPE_GET_BLOCK_BY_HEIGHT_RESP:
       {
-        get_block_by_height_response_t *message = (get_block_by_height_response_t*)message_object;
-        free(message->hash);
-        if (did_packet_fail)
+        uint8_t *hash = va_arg(args, uint8_t*);
+        block_t *block = va_arg(args, block_t*);
+
+        assert(hash != NULL);
+        assert(block != NULL);
+
+        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
         {
-          free_block(message->block);
+          return 1;
+        }
+
+        if (serialize_block(buffer, block))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
+      {
+        uint8_t *hash = va_arg(args, uint8_t*);
+        uint8_t include_transactions = va_arg(args, int);
+        assert(hash != NULL);
+
+        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        {
+          return 1;
+        }
+
+        if (buffer_write_uint8(buffer, include_transactions))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
+      {
+        buffer_t *block_data_buffer = va_arg(args, buffer_t*);
+        assert(block_data_buffer != NULL);
+
+        uint32_t block_data_size = buffer_get_size(block_data_buffer);
+        assert(block_data_size <= UINT32_MAX);
+
+        uint8_t *block_data = buffer_get_data(block_data_buffer);
+        assert(block_data != NULL);
+
+        if (buffer_write_uint32(buffer, block_data_size))
+        {
+          return 1;
+        }
+
+        if (buffer_write_bytes32(buffer, block_data, block_data_size))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
+      {
+        uint32_t height = va_arg(args, uint32_t);
+        uint8_t include_transactions = va_arg(args, int);
+        if (buffer_write_uint32(buffer, height))
+        {
+          return 1;
+        }
+
+        if (include_transactions)
+        {
+          if (buffer_write_uint8(buffer, include_transactions))
+          {
+            return 1;
+          }
+        }
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
+      {
+        buffer_t *block_data_buffer = va_arg(args, buffer_t*);
+        assert(block_data_buffer != NULL);
+
+        uint32_t block_data_size = buffer_get_size(block_data_buffer);
+        assert(block_data_size <= UINT32_MAX);
+
+        uint8_t *block_data = buffer_get_data(block_data_buffer);
+        assert(block_data != NULL);
+
+        if (buffer_write_uint32(buffer, block_data_size))
+        {
+          return 1;
+        }
+
+        if (buffer_write_bytes32(buffer, block_data, block_data_size))
+        {
+          return 1;
         }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ:
+      {
+        uint8_t *hash = va_arg(args, uint8_t*);
+        if (encode_hash_message(buffer, hash))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_RESP:
+      {
+        uint8_t *hash = va_arg(args, uint8_t*);
+        uint64_t num_transactions = va_arg(args, uint64_t);
+        assert(hash != NULL);
+
+        if (buffer_write_bytes32(buffer, hash, HASH_SIZE))
+        {
+          return 1;
+        }
+
+        if (buffer_write_uint64(buffer, num_transactions))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ:
+      {
+        uint8_t *block_hash = va_arg(args, uint8_t*);
+        uint8_t *tx_hash = va_arg(args, uint8_t*);
+
+        assert(block_hash != NULL);
+        assert(tx_hash != NULL);
+
+        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        {
+          return 1;
+        }
+
+        if (buffer_write_bytes32(buffer, tx_hash, HASH_SIZE))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_RESP:
+      {
+        uint8_t *block_hash = va_arg(args, uint8_t*);
+        uint32_t tx_index = va_arg(args, uint32_t);
+        transaction_t *transaction = va_arg(args, transaction_t*);
+
+        assert(block_hash != NULL);
+        assert(transaction != NULL);
+
+        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        {
+          return 1;
+        }
+
+        if (buffer_write_uint32(buffer, tx_index))
+        {
+          return 1;
+        }
+
+        if (serialize_transaction(buffer, transaction))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ:
+      {
+        uint8_t *block_hash = va_arg(args, uint8_t*);
+        uint32_t tx_index = va_arg(args, uint32_t);
+        assert(block_hash != NULL);
+
+        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        {
+          return 1;
+        }
+
+        if (buffer_write_uint32(buffer, tx_index))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP:
+      {
+        uint8_t *block_hash = va_arg(args, uint8_t*);
+        uint32_t tx_index = va_arg(args, uint32_t);
+        transaction_t *transaction = va_arg(args, transaction_t*);
+
+        assert(block_hash != NULL);
+        assert(transaction != NULL);
+
+        if (buffer_write_bytes32(buffer, block_hash, HASH_SIZE))
+        {
+          return 1;
+        }
+
+        if (buffer_write_uint32(buffer, tx_index))
+        {
+          return 1;
+        }
+
+        if (serialize_transaction(buffer, transaction))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
+      {
+        transaction_t *transaction = va_arg(args, transaction_t*);
+        assert(transaction != NULL);
+
+        if (serialize_transaction_encoded(buffer, transaction, encoding_version))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ:
+      {
+        uint32_t height = va_arg(args, uint32_t);
+        if (buffer_write_uint32(buffer, height))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP:
+      {
+        uint32_t height = va_arg(args, uint32_t);
+        uint32_t headers_count = va_arg(args, uint32_t);
+        buffer_t *header_data_buffer = va_arg(args, buffer_t*);
+        assert(header_data_buffer != NULL);
+
+        uint32_t header_data_size = buffer_get_size(header_data_buffer);
+        assert(header_data_size <= UINT32_MAX);
+
+        uint8_t *header_data = buffer_get_data(header_data_buffer);
+        assert(header_data != NULL);
+
+        if (buffer_write_uint32(buffer, height) ||
+            buffer_write_uint32(buffer, headers_count) ||
+            buffer_write_uint32(buffer, header_data_size))
+        {
+          return 1;
+        }
+
+        if (buffer_write_bytes32(buffer, header_data, header_data_size))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ:
+      {
+        uint8_t *hash = va_arg(args, uint8_t*);
+        if (encode_hash_message(buffer, hash))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP:
+      {
+        block_t *block = va_arg(args, block_t*);
+        assert(block != NULL);
+
+        if (serialize_block(buffer, block))
+        {
+          return 1;
+        }
+
+        if (serialize_transactions_from_block(buffer, block))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_REQ:
+      {
+        uint8_t *tx_id = va_arg(args, uint8_t*);
+        assert(tx_id != NULL);
+
+        if (buffer_write_bytes32(buffer, tx_id, HASH_SIZE))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP:
+      {
+        block_t *block = va_arg(args, block_t*);
+        uint32_t tx_index = va_arg(args, uint32_t);
+        transaction_t *transaction = va_arg(args, transaction_t*);
+        uint32_t branch_length = va_arg(args, uint32_t);
+        uint8_t *branch = va_arg(args, uint8_t*);
+
+        assert(block != NULL);
+        assert(transaction != NULL);
+        assert(branch_length <= MAX_MERKLE_BRANCH_LENGTH);
+
+        // only the block's header is sent, the tx is proven to be
+        // included in the block by it's merkle branch...
+        if (serialize_block(buffer, block) ||
+            buffer_write_uint32(buffer, tx_index) ||
+            serialize_transaction(buffer, transaction) ||
+            buffer_write_uint32(buffer, branch_length))
+        {
+          return 1;
+        }
+
+        if (branch_length > 0)
+        {
+          assert(branch != NULL);
+          if (buffer_write(buffer, branch, branch_length * HASH_SIZE))
+          {
+            return 1;
+          }
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ:
+      {
+        uint8_t *hash = va_arg(args, uint8_t*);
+        if (encode_hash_message(buffer, hash))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP:
+      {
+        block_t *block = va_arg(args, block_t*);
+        assert(block != NULL);
+        assert(block->transaction_count > 0);
+
+        // the generation tx is sent in full, every other tx is
+        // sent as a short id for the receiver to find in it's mempool...
+        if (serialize_block_encoded(buffer, block, encoding_version) ||
+            serialize_transaction_encoded(buffer, block->transactions[0], encoding_version))
+        {
+          return 1;
+        }
+
+        for (uint32_t i = 1; i < block->transaction_count; i++)
+        {
+          transaction_t *tx = block->transactions[i];
+          assert(tx != NULL);
+          if (buffer_write(buffer, tx->id, COMPACT_BLOCK_SHORT_ID_SIZE))
+          {
+            return 1;
+          }
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ:
+      {
+        uint8_t *hash = va_arg(args, uint8_t*);
+        uint32_t tx_indexes_count = va_arg(args, uint32_t);
+        uint32_t *tx_indexes = va_arg(args, uint32_t*);
+
+        assert(hash != NULL);
+        assert(tx_indexes_count > 0);
+        assert(tx_indexes != NULL);
+
+        if (buffer_write_bytes32(buffer, hash, HASH_SIZE) ||
+            buffer_write_uint32(buffer, tx_indexes_count))
+        {
+          return 1;
+        }
+
+        for (uint32_t i = 0; i < tx_indexes_count; i++)
+        {
+          if (buffer_write_uint32(buffer, tx_indexes[i]))
+          {
+            return 1;
+          }
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_RESP:
+      {
+        block_t *block = va_arg(args, block_t*);
+        uint32_t tx_indexes_count = va_arg(args, uint32_t);
+        uint32_t *tx_indexes = va_arg(args, uint32_t*);
+
+        assert(block != NULL);
+        assert(tx_indexes_count > 0);
+        assert(tx_indexes != NULL);
+
+        if (buffer_write_bytes32(buffer, block->hash, HASH_SIZE) ||
+            buffer_write_uint32(buffer, tx_indexes_count))
+        {
+          return 1;
+        }
+
+        for (uint32_t i = 0; i < tx_indexes_count; i++)
+        {
+          assert(tx_indexes[i] < block->transaction_count);
+          if (serialize_transaction_encoded(buffer, block->transactions[tx_indexes[i]], encoding_version))
+          {
+            return 1;
+          }
+        }
+      }
+      break;
+    case PKT_TYPE_TRANSACTION_INVENTORY:
+    case PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ:
+      {
+        uint32_t tx_ids_count = va_arg(args, uint32_t);
+        uint8_t *tx_ids = va_arg(args, uint8_t*);
+        if (encode_tx_ids_message(buffer, tx_ids_count, tx_ids))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_FILTERS_REQ:
+      {
+        uint32_t height = va_arg(args, uint32_t);
+        uint32_t count = va_arg(args, uint32_t);
+        assert(count > 0 && count <= MAX_BLOCK_FILTERS_COUNT);
+
+        if (buffer_write_uint32(buffer, height) ||
+            buffer_write_uint32(buffer, count))
+        {
+          return 1;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_FILTERS_RESP:
+      {
+        uint32_t height = va_arg(args, uint32_t);
+        uint32_t filters_count = va_arg(args, uint32_t);
+        buffer_t *filter_data_buffer = va_arg(args, buffer_t*);
+
+        assert(filters_count > 0 && filters_count <= MAX_BLOCK_FILTERS_COUNT);
+        assert(filter_data_buffer != NULL);
+
+        uint32_t filter_data_size = buffer_get_size(filter_data_buffer);
+        if (buffer_write_uint32(buffer, height) ||
+            buffer_write_uint32(buffer, filters_count) ||
+            buffer_write_uint32(buffer, filter_data_size) ||
+            buffer_write(buffer, buffer_get_data(filter_data_buffer), filter_data_size))
+        {
+          return 1;
+        }
+      }
+      break;
+    default:
+      LOG_DEBUG("Could not serialize packet with unknown packet id: %u!", packet_id);
+      return 1;
+  }
+
+  return 0;
+}
+
+int serialize_message(packet_t **packet, uint32_t packet_id, va_list args)
+{
+  buffer_t *buffer = buffer_acquire_scratch();
+  if (encode_message(buffer, ENCODING_VERSION_1, packet_id, args))
+  {
+    buffer_release_scratch(buffer);
+    return 1;
+  }
+
+  const uint8_t *data = buffer_get_data(buffer);
+  uint32_t data_len = buffer_get_size(buffer);
+
+  packet_t *serialized_packet = make_packet();
+  serialized_packet->id = packet_id;
+  serialized_packet->size = data_len;
+  if (data_len > 0)
+  {
+    serialized_packet->data = buffer_pool_acquire(data_len);
+    memcpy(serialized_packet->data, data, data_len);
+  }
+
+  *packet = serialized_packet;
+  buffer_release_scratch(buffer);
+  return 0;
+}
+
+void release_message(uint32_t packet_id, int did_packet_fail, protocol_message_t *message_object)
+{
+  assert(message_object != NULL);
+  switch (packet_id)
+  {
+    case PKT_TYPE_CONNECT_ESTABLISH_REQ:
+      {
+        connect_establish_req_t *message = (connect_establish_req_t*)message_object;
+        free(message->version_number);
+        free(message->version_name);
+      }
+      break;
+    case PKT_TYPE_CONNECT_ESTABLISH_RESP:
+      break;
+    case PKT_TYPE_CONNECT_PING_REQ:
+      break;
+    case PKT_TYPE_CONNECT_PING_RESP:
+      break;
+    case PKT_TYPE_GET_PEERLIST_REQ:
+      break;
+    case PKT_TYPE_GET_PEERLIST_RESP:
+      {
+        get_peerlist_resp_t *message = (get_peerlist_resp_t*)message_object;
+        free(message->peerlist_data);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_HEIGHT_REQ:
+      break;
+    case PKT_TYPE_GET_BLOCK_HEIGHT_RESP:
+      {
+        get_block_height_response_t *message = (get_block_height_response_t*)message_object;
+        free(message->hash);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_BY_HASH_REQ:
+      {
+        get_block_by_hash_request_t *message = (get_block_by_hash_request_t*)message_object;
+        free(message->hash);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_BY_HASH_RESP:
+      {
+        get_block_by_hash_response_t *message = (get_block_by_hash_response_t*)message_object;
+        if (did_packet_fail)
+        {
+          free_block(message->block);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ:
+      break;
+    case PKT_TYPE_GET_BLOCK_BY_HEIGHT_RESP:
+      {
+        get_block_by_height_response_t *message = (get_block_by_height_response_t*)message_object;
+        free(message->hash);
+        if (did_packet_fail)
+        {
+          free_block(message->block);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
+      {
+        get_grouped_blocks_from_hash_request_t *message = (get_grouped_blocks_from_hash_request_t*)message_object;
+        free(message->hash);
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
+      {
+        get_grouped_blocks_from_hash_response_t *message = (get_grouped_blocks_from_hash_response_t*)message_object;
+        free(message->block_data);
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
+      {
+        get_grouped_blocks_from_height_response_t *message = (get_grouped_blocks_from_height_response_t*)message_object;
+        free(message->block_data);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ:
+      {
+        get_block_num_transactions_request_t *message = (get_block_num_transactions_request_t*)message_object;
+        free(message->hash);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_RESP:
+      {
+        get_block_num_transactions_response_t *message = (get_block_num_transactions_response_t*)message_object;
+        free(message->hash);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ:
+      {
+        get_block_transaction_by_hash_request_t *message = (get_block_transaction_by_hash_request_t*)message_object;
+        free(message->block_hash);
+        free(message->tx_hash);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_RESP:
+      {
+        get_block_transaction_by_hash_response_t *message = (get_block_transaction_by_hash_response_t*)message_object;
+        free(message->block_hash);
+        if (did_packet_fail)
+        {
+          free_transaction(message->transaction);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ:
+      {
+        get_block_transaction_by_index_request_t *message = (get_block_transaction_by_index_request_t*)message_object;
+        free(message->block_hash);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP:
+      {
+        get_block_transaction_by_index_response_t *message = (get_block_transaction_by_index_response_t*)message_object;
+        free(message->block_hash);
+        if (did_packet_fail)
+        {
+          free_transaction(message->transaction);
+        }
+      }
+      break;
+    case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
+      {
+        incoming_mempool_transaction_t *message = (incoming_mempool_transaction_t*)message_object;
+        if (message->transaction != NULL)
+        {
+          free_transaction(message->transaction);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ:
+      break;
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP:
+      {
+        get_block_headers_from_height_response_t *message = (get_block_headers_from_height_response_t*)message_object;
+        free(message->header_data);
+      }
+      break;
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ:
+      {
+        get_full_block_by_hash_request_t *message = (get_full_block_by_hash_request_t*)message_object;
+        free(message->hash);
+      }
+      break;
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP:
+      {
+        get_full_block_by_hash_response_t *message = (get_full_block_by_hash_response_t*)message_object;
+        if (did_packet_fail)
+        {
+          free_block(message->block);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_REQ:
+      {
+        get_transaction_merkle_branch_request_t *message = (get_transaction_merkle_branch_request_t*)message_object;
+        free(message->tx_id);
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP:
+      {
+        get_transaction_merkle_branch_response_t *message = (get_transaction_merkle_branch_response_t*)message_object;
+        free_block(message->block);
+        free_transaction(message->transaction);
+        if (message->branch != NULL)
+        {
+          free(message->branch);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ:
+      {
+        get_compact_block_by_hash_request_t *message = (get_compact_block_by_hash_request_t*)message_object;
+        free(message->hash);
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP:
+      {
+        // the block is handed off to the download window once received, the
+        // block's txs other than the generation tx have not been filled in yet...
+        get_compact_block_by_hash_response_t *message = (get_compact_block_by_hash_response_t*)message_object;
+        if (did_packet_fail)
+        {
+          message->block->transaction_count = 1;
+          free_block(message->block);
+        }
+
+        if (message->short_ids != NULL)
+        {
+          free(message->short_ids);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ:
+      {
+        get_compact_block_transactions_request_t *message = (get_compact_block_transactions_request_t*)message_object;
+        free(message->hash);
+        free(message->tx_indexes);
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_RESP:
+      {
+        // the txs are moved into the compact block once received
+        get_compact_block_transactions_response_t *message = (get_compact_block_transactions_response_t*)message_object;
+        for (uint32_t i = 0; i < message->transactions_count; i++)
+        {
+          if (message->transactions[i] != NULL)
+          {
+            free_transaction(message->transactions[i]);
+          }
+        }
+
+        free(message->hash);
+        free(message->transactions);
+      }
+      break;
+    case PKT_TYPE_TRANSACTION_INVENTORY:
+      {
+        transaction_inventory_t *message = (transaction_inventory_t*)message_object;
+        free(message->tx_ids);
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ:
+      {
+        get_transactions_by_id_request_t *message = (get_transactions_by_id_request_t*)message_object;
+        free(message->tx_ids);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_FILTERS_REQ:
+      break;
+    case PKT_TYPE_GET_BLOCK_FILTERS_RESP:
+      {
+        get_block_filters_response_t *message = (get_block_filters_response_t*)message_object;
+        free(message->filter_data);
+      }
+      break;
+    default:
+      LOG_DEBUG("Could not free packet with unknown packet id: %u!", packet_id);
+      break;
+  }
+}
+
+void free_message(uint32_t packet_id, int did_packet_fail, void *message_object)
+{
+  assert(message_object != NULL);
+  release_message(packet_id, did_packet_fail, (protocol_message_t*)message_object);
+  free(message_object);
+}
+
+net_connection_t* get_sync_net_connection(void)
+{
+  return g_protocol_sync_entry.net_connection;
+}
+
+int get_sync_initiated(void)
+{
+  return g_protocol_sync_entry.sync_initiated;
+}
+
+int init_sync_request(int height, net_connection_t *net_connection)
+{
+  if (g_protocol_sync_entry.sync_initiated)
+  {
+    return 1;
+  }
+
+  g_protocol_sync_entry.net_connection = net_connection;
+
+  g_protocol_sync_entry.sync_initiated = 1;
+  g_protocol_sync_entry.sync_did_begin_reorg = 0;
+  g_protocol_sync_entry.sync_finding_top_block = 0;
+  g_protocol_sync_entry.sync_pending_block = NULL;
+  g_protocol_sync_entry.sync_height = height;
+  g_protocol_sync_entry.sync_start_height = -1;
+
+  g_protocol_sync_entry.is_syncing_grouped_blocks = 0;
+
+  int r = deque_new(&g_protocol_sync_entry.sync_pending_blocks);
+  assert(r == CC_OK);
+
+  g_protocol_sync_entry.sync_pending_blocks_count = 0;
+
+  g_protocol_sync_entry.last_sync_height = 0;
+  g_protocol_sync_entry.last_sync_ts = 0;
+  g_protocol_sync_entry.last_sync_tries = 0;
+
+  g_protocol_sync_entry.tx_sync_initiated = 0;
+  g_protocol_sync_entry.tx_sync_num_txs = 0;
+  g_protocol_sync_entry.last_tx_sync_index = -1;
+  g_protocol_sync_entry.last_tx_sync_ts = 0;
+  g_protocol_sync_entry.last_tx_sync_tries = 0;
+
+  g_protocol_sync_entry.is_header_first_sync = g_protocol_header_first_sync;
+  g_protocol_sync_entry.sync_header_height = 0;
+  g_protocol_sync_entry.sync_assume_valid_height = 0;
+  memset(g_protocol_sync_entry.sync_header_hash, 0, HASH_SIZE);
+  g_protocol_sync_entry.sync_headers_requested = 0;
+  g_protocol_sync_entry.last_sync_headers_ts = 0;
+  g_protocol_sync_entry.last_sync_headers_tries = 0;
+
+  memset(g_protocol_sync_entry.sync_download_window, 0, sizeof(g_protocol_sync_entry.sync_download_window));
+  g_protocol_sync_entry.sync_download_window_start = 0;
+  g_protocol_sync_entry.sync_download_window_count = 0;
+  return 0;
+}
+
+static void free_sync_pending_blocks(void)
+{
+  void *val = NULL;
+  while (deque_remove_first(g_protocol_sync_entry.sync_pending_blocks, &val) == CC_OK)
+  {
+    block_t *pending_block = (block_t*)val;
+    assert(pending_block != NULL);
+    free_block(pending_block);
+  }
+
+  g_protocol_sync_entry.sync_pending_blocks_count = 0;
+}
+
+static sync_block_download_t* get_sync_download(uint32_t window_index)
+{
+  assert(window_index < g_protocol_sync_entry.sync_download_window_count);
+  uint32_t download_index = (g_protocol_sync_entry.sync_download_window_start + window_index) % SYNC_BLOCK_DOWNLOAD_WINDOW_SIZE;
+  return &g_protocol_sync_entry.sync_download_window[download_index];
+}
+
+/*
+ * Frees the compact block of a download, the txs which are still
+ * missing from the compact block are stored as NULL...
+ */
+static void free_sync_compact_block(sync_block_download_t *download)
+{
+  assert(download != NULL);
+  block_t *compact_block = download->compact_block;
+  if (compact_block == NULL)
+  {
+    return;
+  }
+
+  for (uint32_t i = 0; i < compact_block->transaction_count; i++)
+  {
+    if (compact_block->transactions[i] != NULL)
+    {
+      free_transaction(compact_block->transactions[i]);
+    }
+  }
+
+  free(compact_block->transactions);
+  free(compact_block);
+  download->compact_block = NULL;
+  download->compact_block_num_missing_txs = 0;
+}
+
+static void clear_sync_download_window(void)
+{
+  for (uint32_t i = 0; i < g_protocol_sync_entry.sync_download_window_count; i++)
+  {
+    sync_block_download_t *download = get_sync_download(i);
+    assert(download->block != NULL);
+
+    // the blocks which were downloaded but not committed yet are kept as
+    // orphans, so they are not downloaded again once the sync restarts...
+    if (download->received == 0 || has_block_by_hash(download->block->hash) || add_orphan_block(download->block))
+    {
+      free_block(download->block);
+    }
+
+    free_sync_compact_block(download);
+  }
+
+  memset(g_protocol_sync_entry.sync_download_window, 0, sizeof(g_protocol_sync_entry.sync_download_window));
+  g_protocol_sync_entry.sync_download_window_start = 0;
+  g_protocol_sync_entry.sync_download_window_count = 0;
+}
+
+int clear_sync_request(int sync_success)
+{
+  if (g_protocol_sync_entry.sync_initiated == 0)
+  {
+    return 1;
+  }
+
+  if (g_protocol_sync_entry.sync_did_begin_reorg)
+  {
+    if (sync_success)
+    {
+      assert(commit_blockchain_reorg() == 0);
+    }
+    else if (abort_blockchain_reorg() == 0)
+    {
+      LOG_INFO("Successfully reconnected blockchain.");
+    }
+    else
+    {
+      LOG_WARNING("Could not reconnect blockchain after sync to alternative blockchain failed!");
+    }
+  }
+
+  g_protocol_sync_entry.net_connection = NULL;
+
+  g_protocol_sync_entry.sync_initiated = 0;
+  g_protocol_sync_entry.sync_did_begin_reorg = 0;
+  g_protocol_sync_entry.sync_finding_top_block = 0;
+
+  g_protocol_sync_entry.sync_height = 0;
+  g_protocol_sync_entry.sync_start_height = -1;
+
+  g_protocol_sync_entry.is_syncing_grouped_blocks = 0;
+  free_sync_pending_blocks();
+  deque_destroy(g_protocol_sync_entry.sync_pending_blocks);
+  g_protocol_sync_entry.sync_pending_blocks_count = 0;
+
+  g_protocol_sync_entry.last_sync_height = 0;
+  g_protocol_sync_entry.last_sync_ts = 0;
+  g_protocol_sync_entry.last_sync_tries = 0;
+
+  g_protocol_sync_entry.tx_sync_initiated = 0;
+  g_protocol_sync_entry.tx_sync_num_txs = 0;
+  g_protocol_sync_entry.last_tx_sync_index = -1;
+  g_protocol_sync_entry.last_tx_sync_ts = 0;
+  g_protocol_sync_entry.last_tx_sync_tries = 0;
+
+  g_protocol_sync_entry.is_header_first_sync = 0;
+  g_protocol_sync_entry.sync_header_height = 0;
+  g_protocol_sync_entry.sync_assume_valid_height = 0;
+  g_protocol_sync_entry.sync_headers_requested = 0;
+  g_protocol_sync_entry.last_sync_headers_ts = 0;
+  g_protocol_sync_entry.last_sync_headers_tries = 0;
+
+  clear_sync_download_window();
+
+  handle_sync_stopped();
+  return 0;
+}
+
+int clear_tx_sync_request(void)
+{
+  if (g_protocol_sync_entry.sync_initiated == 0 || g_protocol_sync_entry.tx_sync_initiated == 0)
+  {
+    return 1;
+  }
+
+  g_protocol_sync_entry.tx_sync_initiated = 0;
+  g_protocol_sync_entry.tx_sync_num_txs = 0;
+  g_protocol_sync_entry.last_tx_sync_index = -1;
+  g_protocol_sync_entry.last_tx_sync_ts = 0;
+  g_protocol_sync_entry.last_tx_sync_tries = 0;
+  return 0;
+}
+
+int clear_grouped_sync_request(void)
+{
+  if (g_protocol_sync_entry.sync_initiated == 0)
+  {
+    return 1;
+  }
+
+  g_protocol_sync_entry.sync_pending_block = NULL;
+  g_protocol_sync_entry.is_syncing_grouped_blocks = 0;
+
+  free_sync_pending_blocks();
+  deque_destroy(g_protocol_sync_entry.sync_pending_blocks);
+
+  int r = deque_new(&g_protocol_sync_entry.sync_pending_blocks);
+  assert(r == CC_OK);
+
+  g_protocol_sync_entry.sync_pending_blocks_count = 0;
+  return 0;
+}
+
+void handle_sync_started(void)
+{
+  if (get_is_miner_initialized())
+  {
+    LOG_INFO("Synchronization in progress, pausing miner worker threads...");
+    set_workers_paused(1);
+  }
+}
+
+void handle_sync_added_block(void)
+{
+  float sync_progress_percentage = ((float)g_protocol_sync_entry.last_sync_height / (float)g_protocol_sync_entry.sync_height) * 100;
+  LOG_INFO("Received block at height: %u/%u block(s) remaining (%.2f%% complete)", g_protocol_sync_entry.last_sync_height, g_protocol_sync_entry.sync_height, sync_progress_percentage);
+}
+
+void handle_sync_stopped(void)
+{
+
+}
+
+void handle_sync_completed(void)
+{
+  if (get_workers_paused())
+  {
+    LOG_INFO("Synchronization completed, resuming miner worker threads...");
+    set_workers_paused(0);
+  }
+}
+
+int check_sync_status(int force_sync_complete)
+{
+  uint32_t current_block_height = get_block_height();
+  if (current_block_height > 0 && (current_block_height >= g_protocol_sync_entry.sync_height || force_sync_complete))
+  {
+    if (clear_sync_request(1) == 0)
+    {
+      LOG_INFO("Successfully synchronized blockchain at block height: %u", current_block_height);
+      handle_sync_completed();
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+int request_sync_block(net_connection_t *net_connection, uint32_t height, uint8_t *hash)
+{
+  int32_t sync_height = height;
+  if (hash != NULL)
+  {
+    sync_height = get_block_height_from_hash(hash);
+  }
+
+  if (sync_height < 0)
+  {
+    LOG_ERROR("Could not request block at an unknown sync height!");
+    return 1;
+  }
+
+  if (g_protocol_sync_entry.last_sync_tries > RESYNC_BLOCK_MAX_TRIES)
+  {
+    assert(clear_sync_request(0) == 0);
+    LOG_WARNING("Timed out when trying to request block at height: %u!", sync_height);
+    return 1;
+  }
+
+  if (hash != NULL)
+  {
+    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_BY_HASH_REQ, hash))
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ, height))
+    {
+      return 1;
+    }
+  }
+
+  if (sync_height == g_protocol_sync_entry.last_sync_height)
+  {
+    g_protocol_sync_entry.last_sync_tries++;
+  }
+  else
+  {
+    g_protocol_sync_entry.last_sync_tries = 0;
+    g_protocol_sync_entry.last_sync_height = sync_height;
+  }
+
+  g_protocol_sync_entry.last_sync_ts = get_current_time();
+  return 0;
+}
+
+int request_sync_next_block(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  uint32_t block_height = g_protocol_sync_entry.last_sync_height;
+  if (has_block_by_height(block_height) == 0)
+  {
+    LOG_ERROR("Cannot request next block when previous block at height: %u, was not found in the blockchain!", block_height);
+    return 1;
+  }
+
+  uint32_t sync_height = g_protocol_sync_entry.last_sync_height + 1;
+  if (sync_height == g_protocol_sync_entry.last_sync_height)
+  {
+    g_protocol_sync_entry.last_sync_tries++;
+  }
+  else
+  {
+    g_protocol_sync_entry.last_sync_tries = 0;
+    g_protocol_sync_entry.last_sync_height = sync_height;
+  }
+
+  g_protocol_sync_entry.last_sync_ts = get_current_time();
+  if (g_protocol_sync_entry.sync_pending_blocks_count == 0)
+  {
+    if (request_sync_grouped_blocks(net_connection, sync_height))
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    void *val = NULL;
+    int r = deque_remove_last(g_protocol_sync_entry.sync_pending_blocks, &val);
+    assert(r == CC_OK);
+    block_t *pending_block = (block_t*)val;
+    assert(pending_block != NULL);
+
+    g_protocol_sync_entry.sync_pending_blocks_count--;
+    return block_header_received(net_connection, pending_block);
+  }
+
+  return 0;
+}
+
+/*
+ * Peers which negotiated a grouped blocks budget are asked for full blocks following our
+ * top block by it's hash, so that the blocks always build on top of our chain even after
+ * rolling back to an alternative chain's starting block. Other peers only send headers.
+ */
+int request_sync_grouped_blocks(net_connection_t *net_connection, uint32_t height)
+{
+  assert(net_connection != NULL);
+  if (net_connection->grouped_blocks_budget_size > 0)
+  {
+    g_protocol_sync_entry.sync_grouped_blocks_include_transactions = 1;
+    return handle_packet_sendto(net_connection, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ, get_current_block_hash(), 1);
+  }
+
+  g_protocol_sync_entry.sync_grouped_blocks_include_transactions = 0;
+  return handle_packet_sendto(net_connection, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ, height, 0);
+}
+
+int request_sync_transaction(net_connection_t *net_connection, uint8_t *block_hash, uint32_t tx_index, uint8_t *tx_hash)
+{
+  assert(net_connection != NULL);
+  assert(block_hash != NULL);
+
+  if (tx_hash != NULL)
+  {
+    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ, block_hash, tx_hash))
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ, block_hash, tx_index))
+    {
+      return 1;
+    }
+  }
+
+  if (tx_index == g_protocol_sync_entry.last_tx_sync_index)
+  {
+    g_protocol_sync_entry.last_tx_sync_tries++;
+  }
+  else
+  {
+    g_protocol_sync_entry.last_tx_sync_tries = 0;
+    g_protocol_sync_entry.last_tx_sync_index = tx_index;
+  }
+
+  g_protocol_sync_entry.last_tx_sync_ts = get_current_time();
+  return 0;
+}
+
+int request_sync_next_transaction(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  block_t *pending_block = g_protocol_sync_entry.sync_pending_block;
+  assert(pending_block != NULL);
+
+  uint32_t tx_sync_index = g_protocol_sync_entry.last_tx_sync_index + 1;
+  if (tx_sync_index > pending_block->transaction_count)
+  {
+    return 1;
+  }
+
+  return request_sync_transaction(net_connection, pending_block->hash, tx_sync_index, NULL);
+}
+
+int request_sync_previous_block(net_connection_t *net_connection)
+{
+  uint32_t sync_height = g_protocol_sync_entry.last_sync_height - 1;
+  return request_sync_block(net_connection, sync_height, NULL);
+}
+
+static int valid_sync_checkpoint(uint32_t height, uint8_t *hash)
+{
+  assert(hash != NULL);
+  if (has_checkpoint_hash_by_height(height) == 0)
+  {
+    return 1;
+  }
+
+  uint8_t *checkpoint_hash = NULL;
+  assert(get_checkpoint_hash_from_height(height, &checkpoint_hash) == 0);
+  assert(checkpoint_hash != NULL);
+
+  if (compare_hash(hash, checkpoint_hash) == 0)
+  {
+    LOG_ERROR("Failed to receive block header, found checkpoint at height: %u, block received: %s "
+      "does not match checkpoint hash: %s!", height, HASH2HEX_STR(hash), HASH2HEX_STR(checkpoint_hash));
+
+    return 0;
+  }
+
+  return 1;
+}
+
+int block_header_received(net_connection_t *net_connection, block_t *block)
+{
+  assert(net_connection != NULL);
+  assert(block != NULL);
+  if (g_protocol_sync_entry.sync_initiated)
+  {
+    if (valid_sync_checkpoint(g_protocol_sync_entry.last_sync_height, block->hash) == 0)
+    {
+      // since we failed to get the correct hash corresponding to the
+      // predefined checkpoint hash, clear this sync request...
+      assert(clear_sync_request(0) == 0);
+      return 1;
+    }
+
+    if (g_protocol_sync_entry.sync_start_height == -1)
+    {
+      if (g_protocol_sync_entry.sync_finding_top_block == 0)
+      {
+        g_protocol_sync_entry.last_sync_height = get_block_height();
+        g_protocol_sync_entry.sync_finding_top_block = 1;
+      }
+
+      int found_starting_block = has_block_by_hash(block->hash);
+      int can_rollback_and_resync = 0;
+      if (found_starting_block)
+      {
+        // check the block's actual height in our blockchain to make sure
+        // the height corresponds with the last sync height we've counted...
+        /*uint32_t actual_height = get_block_height_from_hash(block->hash);
+        if (actual_height != g_protocol_sync_entry.last_sync_height)
+        {
+          LOG_ERROR("Failed to receive block header, found starting block: %s with unexpected height: %u, expected block at height: %u!",
+            HASH2HEX_STR(block->hash), actual_height, g_protocol_sync_entry.last_sync_height);
+
+          assert(clear_sync_request(0) == 0);
+          return 1;
+        }*/
+
+        LOG_INFO("Found sync starting block at height: %u!", g_protocol_sync_entry.last_sync_height);
+        g_protocol_sync_entry.sync_start_height = g_protocol_sync_entry.last_sync_height;
+        can_rollback_and_resync = 1;
+      }
+      else if (g_protocol_sync_entry.last_sync_height <= 1)
+      {
+        LOG_WARNING("Unable to find sync starting height, continuing anyway...");
+        g_protocol_sync_entry.sync_start_height = 0;
+        can_rollback_and_resync = 1;
+      }
+      else
+      {
+        if (request_sync_previous_block(net_connection))
+        {
+          assert(clear_sync_request(0) == 0);
+          return 1;
+        }
+      }
+
+      if (can_rollback_and_resync)
+      {
+        g_protocol_sync_entry.sync_finding_top_block = 0;
+        if (begin_blockchain_reorg_for_resync())
+        {
+          // if by some way we fail to rollback and resync and we
+          // fail to clear our sync request, then throw an assertion,
+          // this should never happen...
+          assert(clear_sync_request(0) == 0);
+          return 1;
+        }
+
+        assert(clear_grouped_sync_request() == 0);
+        if (request_sync_from_start_height(g_protocol_sync_entry.net_connection))
+        {
+          return 1;
+        }
+      }
+    }
+    else if (g_protocol_sync_entry.is_header_first_sync)
+    {
+      // blocks are downloaded through the download window once the
+      // sync starting block was found, this is a late response...
+      return 1;
+    }
+    else if (g_protocol_sync_entry.tx_sync_initiated == 0 && block->transactions != NULL)
+    {
+      // the block was sent along with all of it's txs in a grouped blocks
+      // response, so it can be inserted without requesting it's txs...
+      if (valid_merkle_root(block) == 0)
+      {
+        free_block(block);
+        assert(clear_sync_request(0) == 0);
+        return 1;
+      }
+
+      int result = block_header_sync_complete(net_connection, block);
+      free_block(block);
+      if (result)
+      {
+        clear_sync_request(0);
+        return 1;
+      }
+    }
+    else if (g_protocol_sync_entry.tx_sync_initiated == 0)
+    {
+      block->transaction_count = 0;
+      block->transactions = NULL;
+      if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ, block->hash))
+      {
+        // we failed to request transactions for this block header,
+        // clear the sync request in attempt to resync this block later...
+        assert(clear_sync_request(0) == 0);
+        return 1;
+      }
+
+      g_protocol_sync_entry.sync_pending_block = block;
+    }
+  }
+
+  return 0;
+}
+
+int block_header_sync_complete(net_connection_t *net_connection, block_t *block)
+{
+  assert(net_connection != NULL);
+  assert(block != NULL);
+  if (validate_and_insert_block(block) == 0)
+  {
+    handle_sync_added_block();
+    if (check_sync_status(0))
+    {
+      if (request_sync_next_block(g_protocol_sync_entry.net_connection))
+      {
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  return 1;
+}
+
+int send_grouped_blocks(net_connection_t *net_connection, uint32_t packet_id, uint32_t start_height, int include_transactions)
+{
+  assert(net_connection != NULL);
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  if (tip == NULL)
+  {
+    return 1;
+  }
+
+  uint32_t current_block_height = tip->height;
+  if (start_height == 0 || start_height > current_block_height)
+  {
+    release_blockchain_tip(tip);
+    return 1;
+  }
+
+  // full blocks are only sent to peers that negotiated a budget for them,
+  // the budget bounds the size of the response rather than it's block count...
+  uint32_t budget_size = net_connection->grouped_blocks_budget_size;
+  if (budget_size == 0)
+  {
+    include_transactions = 0;
+  }
+
+  uint32_t max_blocks_count = include_transactions ? MAX_GROUPED_FULL_BLOCKS_COUNT : MAX_GROUPED_BLOCKS_COUNT;
+  buffer_t *block_data_buffer = buffer_init();
+  uint32_t blocks_count = 0;
+  for (uint32_t height = start_height; height <= current_block_height && blocks_count < max_blocks_count; height++)
+  {
+    block_t *block = include_transactions ? get_block_from_height_at_tip(tip, height) :
+      get_block_header_from_height_at_tip(tip, height);
+
+    if (block == NULL)
+    {
+      release_blockchain_tip(tip);
+      buffer_free(block_data_buffer);
+      return 1;
+    }
+
+    buffer_t *block_buffer = buffer_init();
+    if (serialize_block(block_buffer, block) ||
+        (include_transactions && serialize_transactions_from_block(block_buffer, block)))
+    {
+      release_blockchain_tip(tip);
+      free_block(block);
+      buffer_free(block_buffer);
+      buffer_free(block_data_buffer);
+      return 1;
+    }
+
+    free_block(block);
+
+    // always send at least one block, even if it alone exceeds the budget
+    size_t block_size = buffer_get_size(block_buffer);
+    if (include_transactions && blocks_count > 0 && buffer_get_size(block_data_buffer) + block_size > budget_size)
+    {
+      buffer_free(block_buffer);
+      break;
+    }
+
+    if (buffer_write(block_data_buffer, buffer_get_data(block_buffer), block_size))
+    {
+      release_blockchain_tip(tip);
+      buffer_free(block_buffer);
+      buffer_free(block_data_buffer);
+      return 1;
+    }
+
+    buffer_free(block_buffer);
+    blocks_count++;
+  }
+
+  release_blockchain_tip(tip);
+  uint8_t *block_data = buffer_get_data(block_data_buffer);
+  size_t block_data_size = buffer_get_size(block_data_buffer);
+
+  buffer_t *buffer = buffer_init();
+  if (buffer_write_uint32(buffer, blocks_count) ||
+      buffer_write(buffer, block_data, block_data_size))
+  {
+    buffer_free(block_data_buffer);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  if (handle_packet_sendto(net_connection, packet_id, buffer))
+  {
+    buffer_free(block_data_buffer);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  buffer_free(block_data_buffer);
+  buffer_free(buffer);
+  return 0;
+}
+
+int grouped_blocks_received(net_connection_t *net_connection, uint8_t *block_data, uint32_t block_data_size)
+{
+  assert(net_connection != NULL);
+  assert(block_data != NULL);
+
+  int include_transactions = g_protocol_sync_entry.sync_grouped_blocks_include_transactions;
+  uint32_t max_blocks_count = include_transactions ? MAX_GROUPED_FULL_BLOCKS_COUNT : MAX_GROUPED_BLOCKS_COUNT;
+
+  buffer_t *buffer = buffer_init_data(0, block_data, block_data_size);
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  uint32_t blocks_count = 0;
+  if (buffer_read_uint32(buffer_iterator, &blocks_count))
+  {
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  if (blocks_count == 0)
+  {
+    LOG_DEBUG("Got grouped block response with no blocks!");
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+    return 1;
+  }
+  else if (blocks_count > max_blocks_count)
+  {
+    LOG_DEBUG("Got grouped block response with blocks count: %u greater than allowed: %u!", blocks_count, max_blocks_count);
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+    return 1;
+  }
+
+  // every block must build on top of the block before it, starting
+  // with our current top block...
+  Deque *pending_blocks;
+  int r = deque_new(&pending_blocks);
+  assert(r == CC_OK);
+
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, get_current_block_hash(), HASH_SIZE);
+  for (uint32_t i = 0; i < blocks_count; i++)
+  {
+    block_t *block = NULL;
+    if (deserialize_block(buffer_iterator, &block))
+    {
+      goto grouped_blocks_received_fail;
+    }
+
+    assert(block != NULL);
+    if (include_transactions && deserialize_transactions_to_block_in_arena(buffer_iterator, block))
+    {
+      free_block(block);
+      goto grouped_blocks_received_fail;
+    }
+
+    if (compare_hash(previous_hash, block->previous_hash) == 0)
+    {
+      free_block(block);
+      goto grouped_blocks_received_fail;
+    }
+
+    r = deque_add_last(pending_blocks, block);
+    assert(r == CC_OK);
+    memcpy(previous_hash, block->hash, HASH_SIZE);
+  }
+
+  // the blocks are pulled from the back of the synchronization entry queue,
+  // so push them onto the front of it in order...
+  void *val = NULL;
+  DEQUE_FOREACH(val, pending_blocks,
+  {
+    block_t *pending_block = (block_t*)val;
+    assert(pending_block != NULL);
+
+    r = deque_add_first(g_protocol_sync_entry.sync_pending_blocks, pending_block);
+    assert(r == CC_OK);
+    g_protocol_sync_entry.sync_pending_blocks_count++;
+  })
+
+  deque_destroy(pending_blocks);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+
+  // pull the first block off the queue and begin synchronizing it:
+  r = deque_remove_last(g_protocol_sync_entry.sync_pending_blocks, &val);
+  assert(r == CC_OK);
+  block_t *pending_block = (block_t*)val;
+  assert(pending_block != NULL);
+
+  g_protocol_sync_entry.sync_pending_blocks_count--;
+  return block_header_received(net_connection, pending_block);
+
+grouped_blocks_received_fail:
+  while (deque_remove_first(pending_blocks, &val) == CC_OK)
+  {
+    free_block((block_t*)val);
+  }
+
+  deque_destroy(pending_blocks);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  return 1;
+}
+
+int send_transaction_merkle_branch(net_connection_t *net_connection, block_t *block, uint8_t *tx_id)
+{
+  assert(net_connection != NULL);
+  assert(block != NULL);
+  assert(tx_id != NULL);
+
+  // the tx is owned by the block, which the caller frees
+  transaction_t *transaction = get_tx_by_hash_from_block(block, tx_id);
+  if (transaction == NULL)
+  {
+    return 1;
+  }
+
+  int32_t tx_index = get_tx_index_from_tx_in_block(block, transaction);
+  if (tx_index < 0)
+  {
+    return 1;
+  }
+
+  uint8_t branch[HASH_SIZE * MAX_MERKLE_BRANCH_LENGTH];
+  uint32_t branch_length = 0;
+  if (compute_block_merkle_branch(branch, &branch_length, block, (uint32_t)tx_index))
+  {
+    return 1;
+  }
+
+  if (handle_packet_sendto(net_connection, PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP,
+    block, (uint32_t)tx_index, transaction, branch_length, branch))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Confirms a tx using only a block header and the tx's merkle branch, so that light
+ * clients do not have to download the whole block just to confirm a single tx.
+ */
+int transaction_merkle_branch_received(net_connection_t *net_connection, block_t *block, transaction_t *transaction, uint32_t tx_index, uint8_t *branch, uint32_t branch_length)
+{
+  assert(net_connection != NULL);
+  assert(block != NULL);
+  assert(transaction != NULL);
+
+  if (valid_block_hash(block) == 0 || valid_block_merkle_branch(block, transaction, tx_index, branch, branch_length) == 0)
+  {
+    LOG_DEBUG("Received invalid merkle branch for transaction: %s in block: %s!", HASH2HEX_STR(transaction->id), HASH2HEX_STR(block->hash));
+    return 1;
+  }
+
+  LOG_INFO("Confirmed transaction: %s in block: %s.", HASH2HEX_STR(transaction->id), HASH2HEX_STR(block->hash));
+  return 0;
+}
+
+/*
+ * Requests the filters of the blocks we have no filter for from the next peer in turn which
+ * serves them, starting at the lowest height without a filter. Only one request is awaiting a
+ * response at a time. Returns 1 if none of our peers serve block filters.
+ */
+int request_block_filters(void)
+{
+  if (get_blockchain_block_filters_enabled() == 0)
+  {
+    return 0;
+  }
+
+  if (g_protocol_block_filters_net_connection != NULL &&
+      get_current_time() - g_protocol_block_filters_request_ts <= BLOCK_FILTERS_REQUEST_TIMEOUT)
+  {
+    return 0;
+  }
+
+  g_protocol_block_filters_net_connection = NULL;
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  if (tip == NULL)
+  {
+    return 0;
+  }
+
+  // skip past the blocks which already have a filter, at most a response worth of them per call
+  int has_missing_filter = 0;
+  uint32_t max_height = MIN(tip->height, g_protocol_block_filters_height + MAX_BLOCK_FILTERS_COUNT);
+  while (g_protocol_block_filters_height <= max_height)
+  {
+    uint8_t *block_hash = get_block_hash_from_height_at_tip(tip, g_protocol_block_filters_height);
+    if (block_hash == NULL)
+    {
+      break;
+    }
+
+    size_t filter_size = 0;
+    uint8_t *filter = get_block_filter_at_tip(tip, block_hash, &filter_size);
+    free(block_hash);
+    if (filter == NULL)
+    {
+      has_missing_filter = 1;
+      break;
+    }
+
+    free(filter);
+    g_protocol_block_filters_height++;
+  }
+
+  release_blockchain_tip(tip);
+  if (has_missing_filter == 0)
+  {
+    return 0;
+  }
+
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    uint16_t peer_index = (g_protocol_block_filters_peer_index + i) % num_net_connections;
+    net_connection_t *net_connection = net_connections[peer_index];
+    assert(net_connection != NULL);
+    if (is_net_connection_send_paused(net_connection) ||
+        (net_connection->capabilities & PROTOCOL_CAPABILITY_BLOCK_FILTERS) == 0)
+    {
+      continue;
+    }
+
+    g_protocol_block_filters_peer_index = peer_index + 1;
+    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_FILTERS_REQ, g_protocol_block_filters_height, MAX_BLOCK_FILTERS_COUNT))
+    {
+      return 1;
+    }
+
+    g_protocol_block_filters_net_connection = net_connection;
+    g_protocol_block_filters_request_ts = get_current_time();
+    return 0;
+  }
+
+  return 1;
+}
+
+void clear_block_filters_request(void)
+{
+  g_protocol_block_filters_net_connection = NULL;
+  g_protocol_block_filters_height = 0;
+  g_protocol_block_filters_request_ts = 0;
+  g_protocol_block_filters_peer_index = 0;
+}
+
+/*
+ * Sends the filters of the blocks starting at the given height, the response ends at
+ * the first block which has no filter or once the filters reach the response size budget.
+ */
+int send_block_filters(net_connection_t *net_connection, uint32_t height, uint32_t count)
+{
+  assert(net_connection != NULL);
+  if (get_blockchain_block_filters_enabled() == 0)
+  {
+    return 1;
+  }
+
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  if (tip == NULL)
+  {
+    return 0;
+  }
+
+  if (height > tip->height)
+  {
+    release_blockchain_tip(tip);
+    return 0;
+  }
+
+  buffer_t *filter_data_buffer = buffer_init();
+  uint32_t filters_count = 0;
+  uint32_t top_block_height = MIN(height + count - 1, tip->height);
+  for (uint32_t i = height; i <= top_block_height; i++)
+  {
+    if (buffer_get_size(filter_data_buffer) >= MAX_BLOCK_FILTERS_RESPONSE_SIZE)
+    {
+      break;
+    }
+
+    uint8_t *block_hash = get_block_hash_from_height_at_tip(tip, i);
+    if (block_hash == NULL)
+    {
+      break;
+    }
+
+    size_t filter_size = 0;
+    uint8_t *filter = get_block_filter_at_tip(tip, block_hash, &filter_size);
+    if (filter == NULL)
+    {
+      free(block_hash);
+      break;
+    }
+
+    if (buffer_write(filter_data_buffer, block_hash, HASH_SIZE) ||
+        buffer_write_bytes32(filter_data_buffer, filter, (uint32_t)filter_size))
+    {
+      free(filter);
+      free(block_hash);
+      release_blockchain_tip(tip);
+      buffer_free(filter_data_buffer);
+      return 1;
+    }
+
+    filters_count++;
+    free(filter);
+    free(block_hash);
+  }
+
+  release_blockchain_tip(tip);
+  if (filters_count == 0)
+  {
+    buffer_free(filter_data_buffer);
+    return 0;
+  }
+
+  int result = handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_FILTERS_RESP, height, filters_count, filter_data_buffer);
+  buffer_free(filter_data_buffer);
+  return result;
+}
+
+/*
+ * Stores the filters received in response to our block filters request, a filter is keyed by
+ * it's block's hash so a filter for a block we do not know of is of no use to us. A filter which
+ * does not match it's block fails the whole response, the filters stored before it are kept.
+ */
+int block_filters_received(net_connection_t *net_connection, uint32_t height, uint32_t filters_count, buffer_iterator_t *buffer_iterator)
+{
+  assert(net_connection != NULL);
+  assert(buffer_iterator != NULL);
+
+  if (g_protocol_block_filters_net_connection != net_connection || height != g_protocol_block_filters_height)
+  {
+    LOG_DEBUG("Received block filters starting at height: %u which were not requested!", height);
+    return 1;
+  }
+
+  g_protocol_block_filters_net_connection = NULL;
+  for (uint32_t i = 0; i < filters_count; i++)
+  {
+    uint8_t *block_hash = NULL;
+    if (buffer_read(buffer_iterator, HASH_SIZE, &block_hash))
+    {
+      return 1;
+    }
+
+    int32_t block_height = get_block_height_from_hash(block_hash);
+    if (block_height < 0 || (uint32_t)block_height != height + i)
+    {
+      LOG_DEBUG("Received block filter for unknown block at height: %u!", height + i);
+      free(block_hash);
+      return 1;
+    }
+
+    uint32_t filter_size = 0;
+    uint8_t *filter = NULL;
+    if (buffer_read_uint32(buffer_iterator, &filter_size) || filter_size > MAX_BLOCK_FILTER_SIZE ||
+        buffer_read(buffer_iterator, filter_size, &filter))
+    {
+      free(block_hash);
+      return 1;
+    }
+
+    int result = store_block_filter(block_hash, filter, filter_size);
+    free(filter);
+    free(block_hash);
+    if (result)
+    {
+      LOG_DEBUG("Received block filter which does not match it's block at height: %u!", height + i);
+      return 1;
+    }
+
+    g_protocol_block_filters_height = height + i + 1;
+  }
+
+  if (buffer_get_remaining_size(buffer_iterator) > 0)
+  {
+    return 1;
+  }
+
+  LOG_DEBUG("Received %u block filters starting at height: %u.", filters_count, height);
+  return 0;
+}
+
+int transaction_received(net_connection_t *net_connection, transaction_t *transaction, uint32_t tx_index)
+{
+  assert(net_connection != NULL);
+  assert(transaction != NULL);
+
+  if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.tx_sync_initiated)
+  {
+    block_t *pending_block = g_protocol_sync_entry.sync_pending_block;
+    assert(pending_block != NULL);
+
+    assert(add_transaction_to_block(pending_block, transaction, tx_index) == 0);
+    if (tx_index + 1 < g_protocol_sync_entry.tx_sync_num_txs)
+    {
+      if (request_sync_next_transaction(net_connection))
+      {
+        assert(clear_sync_request(0) == 0);
+        return 1;
+      }
+    }
+    else
+    {
+      // compute the block's merkle root again and compare it against
+      // the block's currently defined merkle root to see if
+      // this block does infact have the correct transactions it requires...
+      if (valid_merkle_root(pending_block))
+      {
+        // must clear the tx sync entry cache before calling block_header_sync_complete,
+        // otherwise the entire sync entry cache will be cleared and this assertion will fail...
+        assert(clear_tx_sync_request() == 0);
+        if (block_header_sync_complete(net_connection, pending_block))
+        {
+          // we failed to add this block when trying to switch to it's
+          // alternative chain, restore our previous working chain instead.
+          assert(clear_sync_request(0) == 0);
+          return 1;
+        }
+      }
+      else
+      {
+        assert(clear_sync_request(0) == 0);
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Begins downloading blocks on top of the sync starting block, with a header-first
+ * sync the header chain is fetched from our sync peer ahead of the blocks, which
+ * are then downloaded from all of our peers at once through the download window.
+ */
+int request_sync_from_start_height(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  assert(g_protocol_sync_entry.sync_start_height >= 0);
+  g_protocol_sync_entry.last_sync_height = g_protocol_sync_entry.sync_start_height;
+  if (g_protocol_sync_entry.is_header_first_sync == 0)
+  {
+    return request_sync_next_block(net_connection);
+  }
+
+  // the blockchain was rolled back to the sync starting block,
+  // so the first header we request must build on top of it...
+  g_protocol_sync_entry.sync_header_height = g_protocol_sync_entry.sync_start_height;
+  g_protocol_sync_entry.sync_assume_valid_height = 0;
+  memcpy(g_protocol_sync_entry.sync_header_hash, get_current_block_hash(), HASH_SIZE);
+  return request_sync_headers();
+}
+
+int request_sync_headers(void)
+{
+  net_connection_t *net_connection = g_protocol_sync_entry.net_connection;
+  assert(net_connection != NULL);
+
+  uint32_t header_height = g_protocol_sync_entry.sync_header_height + 1;
+  if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ, header_height))
+  {
+    return 1;
+  }
+
+  if (g_protocol_sync_entry.sync_headers_requested)
+  {
+    g_protocol_sync_entry.last_sync_headers_tries++;
+  }
+  else
+  {
+    g_protocol_sync_entry.last_sync_headers_tries = 0;
+    g_protocol_sync_entry.sync_headers_requested = 1;
+  }
+
+  g_protocol_sync_entry.last_sync_headers_ts = get_current_time();
+  return 0;
+}
+
+static void penalize_misbehaving_peer(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  peer_t *peer = get_peer_from_net_connection(net_connection);
+  if (peer != NULL)
+  {
+    record_peer_misbehavior(peer);
+  }
+}
+
+static uint32_t get_num_sync_downloads_in_flight(net_connection_t *net_connection)
+{
+  assert(net_connection != NULL);
+  uint32_t num_downloads = 0;
+  for (uint32_t i = 0; i < g_protocol_sync_entry.sync_download_window_count; i++)
+  {
+    sync_block_download_t *download = get_sync_download(i);
+    if (download->received == 0 && download->net_connection == net_connection)
+    {
+      num_downloads++;
+    }
+  }
+
+  return num_downloads;
+}
+
+/*
+ * Picks the peer to download the next block from, every peer is expected to answer
+ * it's outstanding requests one after another, so the peer which is expected to deliver
+ * the block the soonest is picked. Peers with a poor score are left out, unless they
+ * are the peer we are syncing from...
+ */
+static net_connection_t* get_next_sync_download_net_connection(void)
+{
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+
+  net_connection_t *best_net_connection = g_protocol_sync_entry.net_connection;
+  uint64_t best_cost = UINT64_MAX;
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    net_connection_t *net_connection = net_connections[i];
+    assert(net_connection != NULL);
+
+    peer_t *peer = get_peer_from_net_connection(net_connection);
+    if (peer == NULL || is_net_connection_send_paused(net_connection))
+    {
+      continue;
+    }
+
+    if (net_connection != g_protocol_sync_entry.net_connection && peer->score < PEER_SYNC_MIN_SCORE)
+    {
+      continue;
+    }
+
+    uint64_t cost = (uint64_t)(get_num_sync_downloads_in_flight(net_connection) + 1) * get_peer_latency(peer);
+    if (cost < best_cost)
+    {
+      best_net_connection = net_connection;
+      best_cost = cost;
+    }
+  }
+
+  return best_net_connection;
+}
+
+/*
+ * The requests sent most often during a sync are encoded with their typed encoders
+ * straight into the packet buffer, rather than through handle_packet_sendto...
+ */
+static int send_hash_request(net_connection_t *net_connection, uint32_t packet_id, const uint8_t *hash)
+{
+  buffer_t *buffer = init_packet_buffer(packet_id);
+  if (buffer == NULL)
+  {
+    return 1;
+  }
+
+  if (encode_hash_message(buffer, hash))
+  {
+    buffer_free(buffer);
+    return 1;
+  }
+
+  return handle_packet_sendto_buffer(net_connection, buffer);
+}
+
+static int send_tx_ids_message(net_connection_t *net_connection, uint32_t packet_id, uint32_t tx_ids_count, const uint8_t *tx_ids)
+{
+  buffer_t *buffer = init_packet_buffer(packet_id);
+  if (buffer == NULL)
+  {
+    return 1;
+  }
+
+  if (encode_tx_ids_message(buffer, tx_ids_count, tx_ids))
+  {
+    buffer_free(buffer);
+    return 1;
+  }
+
+  return handle_packet_sendto_buffer(net_connection, buffer);
+}
+
+static int send_ping_request(net_connection_t *net_connection, uint64_t nonce)
+{
+  buffer_t *buffer = init_packet_buffer(PKT_TYPE_CONNECT_PING_REQ);
+  if (buffer == NULL)
+  {
+    return 1;
+  }
+
+  if (encode_ping_message(buffer, nonce))
+  {
+    buffer_free(buffer);
+    return 1;
+  }
+
+  return handle_packet_sendto_buffer(net_connection, buffer);
+}
+
+int request_sync_full_block(sync_block_download_t *download, net_connection_t *net_connection)
+{
+  assert(download != NULL);
+  assert(download->block != NULL);
+  assert(net_connection != NULL);
+
+  // the download is assigned to the peer even if sending the request fails,
+  // the request will be retried once it times out...
+  if (download->net_connection != NULL)
+  {
+    download->request_tries++;
+  }
+
+  download->net_connection = net_connection;
+  download->request_ts = get_current_time();
+  download->request_ts_ms = get_current_time_ms();
+  free_sync_compact_block(download);
+
+  // blocks near the sync height are first requested as compact blocks, since their
+  // txs are likely to be in our mempool already. If that request fails or times out
+  // the block is requested again in full...
+  if (download->request_tries == 0 && get_num_txs_in_mempool() > 0 &&
+      download->height + COMPACT_BLOCK_MAX_SYNC_DISTANCE >= g_protocol_sync_entry.sync_height)
+  {
+    return send_hash_request(net_connection, PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ, download->block->hash);
+  }
+
+  return send_hash_request(net_connection, PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ, download->block->hash);
+}
+
+/*
+ * Moves queued headers into the download window and requests their full blocks,
+ * once the header queue runs low the next headers are requested ahead of time.
+ */
+int fill_sync_download_window(void)
+{
+  while (g_protocol_sync_entry.sync_download_window_count < SYNC_BLOCK_DOWNLOAD_WINDOW_SIZE &&
+         g_protocol_sync_entry.sync_pending_blocks_count > 0)
+  {
+    void *val = NULL;
+    int r = deque_remove_first(g_protocol_sync_entry.sync_pending_blocks, &val);
+    assert(r == CC_OK);
+    block_t *header = (block_t*)val;
+    assert(header != NULL);
+    g_protocol_sync_entry.sync_pending_blocks_count--;
+
+    uint32_t window_index = g_protocol_sync_entry.sync_download_window_count;
+    g_protocol_sync_entry.sync_download_window_count++;
+
+    sync_block_download_t *download = get_sync_download(window_index);
+    download->block = header;
+    download->height = g_protocol_sync_entry.last_sync_height + window_index + 1;
+    download->received = 0;
+    download->net_connection = NULL;
+    download->request_ts = 0;
+    download->request_ts_ms = 0;
+    download->request_tries = 0;
+    download->compact_block = NULL;
+    download->compact_block_num_missing_txs = 0;
+
+    // blocks which arrived ahead of their turn are taken from the orphan pool
+    // rather than requested again, they are committed along with the window...
+    block_t *orphan_block = take_orphan_block(header->hash);
+    if (orphan_block != NULL)
+    {
+      free_block(header);
+      download->block = orphan_block;
+      download->received = 1;
+      continue;
+    }
+    else if (has_block_by_hash(header->hash))
+    {
+      // the block already connected as an orphan waiting on an earlier block
+      download->received = 1;
+      continue;
+    }
 
-        free(message);
-      }
-      break;
-    /*case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
-      {
+    if (request_sync_full_block(download, get_next_sync_download_net_connection()))
+    {
+      LOG_DEBUG("Failed to request block at height: %u, retrying later...", download->height);
+    }
+  }
 
-      }
-      break;
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
-      {
+  if (g_protocol_sync_entry.sync_headers_requested == 0 &&
+      g_protocol_sync_entry.sync_pending_blocks_count < SYNC_PENDING_HEADERS_LOW_WATERMARK &&
+      g_protocol_sync_entry.sync_header_height < g_protocol_sync_entry.sync_height)
+  {
+    return request_sync_headers();
+  }
 
-      }
-      break;*/
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
-      {
-        get_grouped_blocks_from_height_request_t *message = (get_grouped_blocks_from_height_request_t*)message_object;
-        free(message);
-      }
-      break;
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
+  return 0;
+}
+
+/*
+ * Validates and inserts the downloaded blocks at the front of the download window in
+ * order, the blocks behind them keep downloading while the front blocks are committed.
+ * The window is refilled as it is committed, blocks taken from the orphan pool while
+ * refilling it are received right away and are committed in the same pass...
+ */
+int commit_sync_download_window(void)
+{
+  while (1)
+  {
+    while (g_protocol_sync_entry.sync_download_window_count > 0)
+    {
+      sync_block_download_t *download = get_sync_download(0);
+      if (download->received == 0)
       {
-        get_grouped_blocks_from_height_response_t *message = (get_grouped_blocks_from_height_response_t*)message_object;
-        free(message->block_data);
-        free(message);
+        break;
       }
-      break;
-    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ:
+
+      block_t *block = download->block;
+      uint32_t block_height = download->height;
+      memset(download, 0, sizeof(sync_block_download_t));
+      g_protocol_sync_entry.sync_download_window_start = (g_protocol_sync_entry.sync_download_window_start + 1) % SYNC_BLOCK_DOWNLOAD_WINDOW_SIZE;
+      g_protocol_sync_entry.sync_download_window_count--;
+
+      // the downloaded blocks match our headers, so the blocks at or below a checkpoint
+      // the headers lead to are ancestors of the checkpointed block. Blocks which already
+      // connected as orphans waiting on an earlier block are only counted...
+      int result = 0;
+      if (has_block_by_hash(block->hash))
       {
-        get_block_num_transactions_request_t *message = (get_block_num_transactions_request_t*)message_object;
-        free(message->hash);
-        free(message);
+        result = 0;
       }
-      break;
-    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_RESP:
+      else if (get_assume_valid() && block_height <= g_protocol_sync_entry.sync_assume_valid_height)
       {
-        get_block_num_transactions_response_t *message = (get_block_num_transactions_response_t*)message_object;
-        free(message->hash);
-        free(message);
+        result = validate_and_insert_block_assume_valid(block);
       }
-      break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ:
+      else
       {
-        get_block_transaction_by_hash_request_t *message = (get_block_transaction_by_hash_request_t*)message_object;
-        free(message->block_hash);
-        free(message->tx_hash);
-        free(message);
+        result = validate_and_insert_block(block);
       }
-      break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_RESP:
-      {
-        get_block_transaction_by_hash_response_t *message = (get_block_transaction_by_hash_response_t*)message_object;
-        free(message->block_hash);
-        if (did_packet_fail)
-        {
-          free_transaction(message->transaction);
-        }
 
-        free(message);
-      }
-      break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ:
-      {
-        get_block_transaction_by_index_request_t *message = (get_block_transaction_by_index_request_t*)message_object;
-        free(message->block_hash);
-        free(message);
-      }
-      break;
-    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP:
+      if (result)
       {
-        get_block_transaction_by_index_response_t *message = (get_block_transaction_by_index_response_t*)message_object;
-        free(message->block_hash);
-        if (did_packet_fail)
-        {
-          free_transaction(message->transaction);
-        }
+        LOG_ERROR("Failed to insert block: %s at height: %u during synchronization!", HASH2HEX_STR(block->hash), block_height);
+        free_block(block);
 
-        free(message);
+        assert(clear_sync_request(0) == 0);
+        return 1;
       }
-      break;
-    case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
+
+      free_block(block);
+      g_protocol_sync_entry.last_sync_height = block_height;
+      handle_sync_added_block();
+      if (check_sync_status(0) == 0)
       {
-        incoming_mempool_transaction_t *message = (incoming_mempool_transaction_t*)message_object;
-        free_transaction(message->transaction);
-        free(message);
+        return 0;
       }
-      break;
-    default:
-      LOG_DEBUG("Could not free packet with unknown packet id: %u!", packet_id);
-      break;
+    }
+
+    int fill_result = fill_sync_download_window();
+    if (fill_result || g_protocol_sync_entry.sync_download_window_count == 0 || get_sync_download(0)->received == 0)
+    {
+      return fill_result;
+    }
   }
 }
 
-net_connection_t* get_sync_net_connection(void)
+/*
+ * Lowers the score of the peers which did not answer our requests in time, each
+ * peer is only penalized once no matter how many of it's requests timed out...
+ */
+static void penalize_timed_out_peers(net_connection_t **net_connections, uint16_t num_net_connections)
 {
-  return g_protocol_sync_entry.net_connection;
-}
+  assert(net_connections != NULL);
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    if (net_connections[i] == NULL)
+    {
+      continue;
+    }
 
-int get_sync_initiated(void)
-{
-  return g_protocol_sync_entry.sync_initiated;
+    peer_t *peer = get_peer_from_net_connection(net_connections[i]);
+    if (peer != NULL)
+    {
+      record_peer_failure(peer);
+    }
+  }
 }
 
-int init_sync_request(int height, net_connection_t *net_connection)
+static uint16_t add_timed_out_net_connection(net_connection_t **net_connections, uint16_t num_net_connections, net_connection_t *net_connection)
 {
-  if (g_protocol_sync_entry.sync_initiated)
+  assert(net_connections != NULL);
+  if (net_connection == NULL)
   {
-    return 1;
+    return num_net_connections;
   }
 
-  g_protocol_sync_entry.net_connection = net_connection;
-
-  g_protocol_sync_entry.sync_initiated = 1;
-  g_protocol_sync_entry.sync_did_backup_blockchain = 0;
-  g_protocol_sync_entry.sync_finding_top_block = 0;
-  g_protocol_sync_entry.sync_pending_block = NULL;
-  g_protocol_sync_entry.sync_height = height;
-  g_protocol_sync_entry.sync_start_height = -1;
-
-  g_protocol_sync_entry.is_syncing_grouped_blocks = 0;
-
-  int r = deque_new(&g_protocol_sync_entry.sync_pending_blocks);
-  assert(r == CC_OK);
-
-  g_protocol_sync_entry.sync_pending_blocks_count = 0;
-
-  g_protocol_sync_entry.last_sync_height = 0;
-  g_protocol_sync_entry.last_sync_ts = 0;
-  g_protocol_sync_entry.last_sync_tries = 0;
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    if (net_connections[i] == net_connection)
+    {
+      return num_net_connections;
+    }
+  }
 
-  g_protocol_sync_entry.tx_sync_initiated = 0;
-  g_protocol_sync_entry.tx_sync_num_txs = 0;
-  g_protocol_sync_entry.last_tx_sync_index = -1;
-  g_protocol_sync_entry.last_tx_sync_ts = 0;
-  g_protocol_sync_entry.last_tx_sync_tries = 0;
-  return 0;
+  net_connections[num_net_connections] = net_connection;
+  return num_net_connections + 1;
 }
 
-int clear_sync_request(int sync_success)
+/*
+ * Retries the header and block requests which have timed out, the blocks are requested
+ * again from our sync peer since other peers might not have the blocks we are syncing.
+ */
+int resync_download_window(void)
 {
-  if (g_protocol_sync_entry.sync_initiated == 0)
+  net_connection_t *timed_out_net_connections[SYNC_BLOCK_DOWNLOAD_WINDOW_SIZE + 1];
+  uint16_t num_timed_out_net_connections = 0;
+
+  // orphans which never connected are dropped once they expire
+  uint32_t current_time = get_current_time();
+  expire_orphan_blocks(current_time);
+  if (g_protocol_sync_entry.sync_headers_requested &&
+      current_time - g_protocol_sync_entry.last_sync_headers_ts > RESYNC_BLOCK_REQUEST_DELAY)
   {
-    return 1;
+    if (g_protocol_sync_entry.last_sync_headers_tries >= RESYNC_BLOCK_MAX_TRIES)
+    {
+      LOG_WARNING("Timed out when trying to request block headers at height: %u!", g_protocol_sync_entry.sync_header_height + 1);
+      assert(clear_sync_request(0) == 0);
+      return 1;
+    }
+
+    num_timed_out_net_connections = add_timed_out_net_connection(timed_out_net_connections,
+      num_timed_out_net_connections, g_protocol_sync_entry.net_connection);
+    request_sync_headers();
   }
 
-  if (sync_success == 0 && g_protocol_sync_entry.sync_did_backup_blockchain)
+  for (uint32_t i = 0; i < g_protocol_sync_entry.sync_download_window_count; i++)
   {
-    if (restore_blockchain() == 0)
+    sync_block_download_t *download = get_sync_download(i);
+    if (download->received || current_time - download->request_ts <= RESYNC_BLOCK_REQUEST_DELAY)
     {
-      LOG_INFO("Successfully restored blockchain.");
+      continue;
     }
-    else
+
+    if (download->request_tries >= RESYNC_BLOCK_MAX_TRIES)
     {
-      LOG_WARNING("Could not restore blockchain after sync to alternative blockchain failed!");
+      LOG_WARNING("Timed out when trying to request block at height: %u!", download->height);
+      penalize_timed_out_peers(&download->net_connection, 1);
+      assert(clear_sync_request(0) == 0);
+      return 1;
     }
-  }
-
-  g_protocol_sync_entry.net_connection = NULL;
-
-  g_protocol_sync_entry.sync_initiated = 0;
-  g_protocol_sync_entry.sync_did_backup_blockchain = 0;
-  g_protocol_sync_entry.sync_finding_top_block = 0;
 
-  g_protocol_sync_entry.sync_height = 0;
-  g_protocol_sync_entry.sync_start_height = -1;
+    num_timed_out_net_connections = add_timed_out_net_connection(timed_out_net_connections,
+      num_timed_out_net_connections, download->net_connection);
+    request_sync_full_block(download, g_protocol_sync_entry.net_connection);
+  }
 
-  g_protocol_sync_entry.is_syncing_grouped_blocks = 0;
-  deque_destroy(g_protocol_sync_entry.sync_pending_blocks);
-  g_protocol_sync_entry.sync_pending_blocks_count = 0;
+  penalize_timed_out_peers(timed_out_net_connections, num_timed_out_net_connections);
 
-  g_protocol_sync_entry.last_sync_height = 0;
-  g_protocol_sync_entry.last_sync_ts = 0;
-  g_protocol_sync_entry.last_sync_tries = 0;
+  // a sync peer which keeps failing to answer would stall the sync until all of it's
+  // retries run out, instead give up on it early so we can sync from a better peer...
+  peer_t *sync_peer = NULL;
+  if (g_protocol_sync_entry.net_connection != NULL)
+  {
+    sync_peer = get_peer_from_net_connection(g_protocol_sync_entry.net_connection);
+  }
 
-  g_protocol_sync_entry.tx_sync_initiated = 0;
-  g_protocol_sync_entry.tx_sync_num_txs = 0;
-  g_protocol_sync_entry.last_tx_sync_index = -1;
-  g_protocol_sync_entry.last_tx_sync_ts = 0;
-  g_protocol_sync_entry.last_tx_sync_tries = 0;
+  if (sync_peer != NULL && sync_peer->score < PEER_SYNC_MIN_SCORE)
+  {
+    LOG_WARNING("Sync peer score dropped to: %d, abandoning synchronization...", sync_peer->score);
+    assert(clear_sync_request(0) == 0);
+    return 1;
+  }
 
-  handle_sync_stopped();
   return 0;
 }
 
-int clear_tx_sync_request(void)
+void handle_sync_peer_closed(net_connection_t *net_connection)
 {
-  if (g_protocol_sync_entry.sync_initiated == 0 || g_protocol_sync_entry.tx_sync_initiated == 0)
+  assert(net_connection != NULL);
+  if (g_protocol_sync_entry.sync_initiated == 0 || g_protocol_sync_entry.is_header_first_sync == 0 ||
+      g_protocol_sync_entry.net_connection == net_connection)
   {
-    return 1;
+    return;
   }
 
-  g_protocol_sync_entry.tx_sync_initiated = 0;
-  g_protocol_sync_entry.tx_sync_num_txs = 0;
-  g_protocol_sync_entry.last_tx_sync_index = -1;
-  g_protocol_sync_entry.last_tx_sync_ts = 0;
-  g_protocol_sync_entry.last_tx_sync_tries = 0;
-  return 0;
+  for (uint32_t i = 0; i < g_protocol_sync_entry.sync_download_window_count; i++)
+  {
+    sync_block_download_t *download = get_sync_download(i);
+    if (download->received == 0 && download->net_connection == net_connection)
+    {
+      request_sync_full_block(download, g_protocol_sync_entry.net_connection);
+    }
+  }
 }
 
-int clear_grouped_sync_request(void)
+int block_headers_received(net_connection_t *net_connection, uint32_t height, uint32_t headers_count, buffer_iterator_t *buffer_iterator)
 {
-  if (g_protocol_sync_entry.sync_initiated == 0)
+  assert(net_connection != NULL);
+  assert(buffer_iterator != NULL);
+  if (g_protocol_sync_entry.sync_headers_requested == 0 || height != g_protocol_sync_entry.sync_header_height + 1)
   {
+    LOG_DEBUG("Got unexpected block headers response at height: %u!", height);
     return 1;
   }
 
-  g_protocol_sync_entry.sync_pending_block = NULL;
-  g_protocol_sync_entry.is_syncing_grouped_blocks = 0;
+  if (headers_count == 0 || headers_count > MAX_BLOCK_HEADERS_COUNT)
+  {
+    LOG_DEBUG("Got block headers response with headers count: %u, allowed: %u!", headers_count, MAX_BLOCK_HEADERS_COUNT);
+    penalize_misbehaving_peer(net_connection);
+    return 1;
+  }
 
-  int r = deque_new(&g_protocol_sync_entry.sync_pending_blocks);
-  assert(r == CC_OK);
+  // every header is checked before any of them are queued, each header must
+  // build on top of the previous one, have a valid hash and match our checkpoints...
+  block_t **headers = malloc(sizeof(block_t*) * headers_count);
+  assert(headers != NULL);
 
-  g_protocol_sync_entry.sync_pending_blocks_count = 0;
-  return 0;
-}
+  uint32_t num_headers = 0;
+  uint8_t *previous_hash = g_protocol_sync_entry.sync_header_hash;
+  for (uint32_t i = 0; i < headers_count; i++)
+  {
+    block_t *header = NULL;
+    if (deserialize_block(buffer_iterator, &header))
+    {
+      goto block_headers_received_fail;
+    }
 
-void handle_sync_started(void)
-{
-  if (get_is_miner_initialized())
+    assert(header != NULL);
+    headers[num_headers] = header;
+    num_headers++;
+
+    if (compare_hash(header->previous_hash, previous_hash) == 0 || valid_block_hash(header) == 0)
+    {
+      LOG_DEBUG("Got invalid block header: %s at height: %u!", HASH2HEX_STR(header->hash), height + i);
+      penalize_misbehaving_peer(net_connection);
+      goto block_headers_received_fail;
+    }
+
+    if (valid_sync_checkpoint(height + i, header->hash) == 0)
+    {
+      for (uint32_t j = 0; j < num_headers; j++)
+      {
+        free_block(headers[j]);
+      }
+
+      free(headers);
+      assert(clear_sync_request(0) == 0);
+      return 1;
+    }
+
+    // every block up to a checkpoint the headers lead to can be assumed valid
+    if (has_checkpoint_hash_by_height(height + i))
+    {
+      g_protocol_sync_entry.sync_assume_valid_height = height + i;
+    }
+
+    previous_hash = header->hash;
+  }
+
+  for (uint32_t i = 0; i < num_headers; i++)
   {
-    LOG_INFO("Synchronization in progress, pausing miner worker threads...");
-    set_workers_paused(1);
+    int r = deque_add_last(g_protocol_sync_entry.sync_pending_blocks, headers[i]);
+    assert(r == CC_OK);
+    g_protocol_sync_entry.sync_pending_blocks_count++;
   }
-}
 
-void handle_sync_added_block(void)
-{
-  float sync_progress_percentage = ((float)g_protocol_sync_entry.last_sync_height / (float)g_protocol_sync_entry.sync_height) * 100;
-  LOG_INFO("Received block at height: %u/%u block(s) remaining (%.2f%% complete)", g_protocol_sync_entry.last_sync_height, g_protocol_sync_entry.sync_height, sync_progress_percentage);
-}
+  memcpy(g_protocol_sync_entry.sync_header_hash, headers[num_headers - 1]->hash, HASH_SIZE);
+  g_protocol_sync_entry.sync_header_height += num_headers;
+  g_protocol_sync_entry.sync_headers_requested = 0;
+  g_protocol_sync_entry.last_sync_headers_tries = 0;
+  free(headers);
 
-void handle_sync_stopped(void)
-{
+  LOG_INFO("Received block headers up to height: %u", g_protocol_sync_entry.sync_header_height);
+  return commit_sync_download_window();
+
+block_headers_received_fail:
+  for (uint32_t i = 0; i < num_headers; i++)
+  {
+    free_block(headers[i]);
+  }
 
+  free(headers);
+  return 1;
 }
 
-void handle_sync_completed(void)
+/*
+ * Returns the header our sync peer sent us for the block hash, from either the download
+ * window or the queue of headers waiting on it, NULL if we were never sent the header.
+ */
+static block_t* get_sync_header_from_hash(uint8_t *block_hash)
 {
-  if (get_workers_paused())
+  assert(block_hash != NULL);
+  for (uint32_t i = 0; i < g_protocol_sync_entry.sync_download_window_count; i++)
   {
-    LOG_INFO("Synchronization completed, resuming miner worker threads...");
-    set_workers_paused(0);
+    sync_block_download_t *download = get_sync_download(i);
+    if (compare_hash(download->block->hash, block_hash))
+    {
+      return download->block;
+    }
   }
-}
 
-int check_sync_status(int force_sync_complete)
-{
-  uint32_t current_block_height = get_block_height();
-  if (current_block_height > 0 && (current_block_height >= g_protocol_sync_entry.sync_height || force_sync_complete))
+  block_t *header = NULL;
+  void *val = NULL;
+  DEQUE_FOREACH(val, g_protocol_sync_entry.sync_pending_blocks,
   {
-    if (clear_sync_request(1) == 0)
+    block_t *pending_block = (block_t*)val;
+    assert(pending_block != NULL);
+    if (header == NULL && compare_hash(pending_block->hash, block_hash))
     {
-      LOG_INFO("Successfully synchronized blockchain at block height: %u", current_block_height);
-      handle_sync_completed();
-      return 0;
+      header = pending_block;
     }
+  })
+
+  return header;
+}
+
+/*
+ * Adds a block we have no download for to the orphan pool, the pool takes ownership of the
+ * block when it is added. Only blocks of the headers our sync peer sent us are kept, so the
+ * pool cannot be filled with blocks of a chain we are not syncing. The parent of the block
+ * may not be known yet, so only the block's own hash, txs and proof of work are checked
+ * against it's header here, the rest is checked once it connects.
+ */
+static int add_sync_orphan_block(block_t *block)
+{
+  assert(block != NULL);
+  if (has_block_by_hash(block->hash) || has_orphan_block(block->hash))
+  {
+    return 1;
+  }
+
+  // the header's proof of work was checked when it was received, the block's header
+  // must be the same one or the block could claim easier work than it's header...
+  block_t *header = get_sync_header_from_hash(block->hash);
+  if (header == NULL || block->bits != header->bits || compare_hash(block->merkle_root, header->merkle_root) == 0 ||
+      valid_block_hash(block) == 0 || valid_merkle_root(block) == 0 || check_proof_of_work(block->hash, block->bits) == 0)
+  {
+    return 1;
   }
 
-  return 1;
+  return add_orphan_block(block);
 }
 
-int request_sync_block(net_connection_t *net_connection, uint32_t height, uint8_t *hash)
+int full_block_received(net_connection_t *net_connection, block_t *block)
 {
-  int32_t sync_height = height;
-  if (hash != NULL)
+  assert(net_connection != NULL);
+  assert(block != NULL);
+
+  sync_block_download_t *download = NULL;
+  for (uint32_t i = 0; i < g_protocol_sync_entry.sync_download_window_count; i++)
   {
-    sync_height = get_block_height_from_hash(hash);
+    sync_block_download_t *pending_download = get_sync_download(i);
+    if (pending_download->received == 0 && compare_hash(pending_download->block->hash, block->hash))
+    {
+      download = pending_download;
+      break;
+    }
   }
 
-  if (sync_height < 0)
+  if (download == NULL)
   {
-    LOG_ERROR("Could not request block at an unknown sync height!");
-    return 1;
+    // a block which arrives after it's download was reset or handed to another
+    // peer is kept as an orphan, so it is not requested again once it's turn comes...
+    return add_sync_orphan_block(block);
   }
 
-  if (g_protocol_sync_entry.last_sync_tries > RESYNC_BLOCK_MAX_TRIES)
+  // the block must match the header we were given by our sync peer,
+  // and it's txs must match the merkle root of that header...
+  block_t *header = download->block;
+  if (compare_hash(block->merkle_root, header->merkle_root) == 0 ||
+      block->transaction_count != header->transaction_count ||
+      valid_block_hash(block) == 0 || valid_merkle_root(block) == 0)
   {
-    assert(clear_sync_request(0) == 0);
-    LOG_WARNING("Timed out when trying to request block at height: %u!", sync_height);
+    LOG_DEBUG("Got invalid block at height: %u, requesting it again...", download->height);
+    penalize_misbehaving_peer(net_connection);
+    request_sync_full_block(download, g_protocol_sync_entry.net_connection);
     return 1;
   }
 
-  if (hash != NULL)
+  // only the peer we requested the block from is credited with delivering it
+  if (download->net_connection == net_connection)
   {
-    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_BY_HASH_REQ, hash))
+    peer_t *peer = get_peer_from_net_connection(net_connection);
+    if (peer != NULL)
     {
-      return 1;
+      record_peer_block_delivery(peer, (uint32_t)(get_current_time_ms() - download->request_ts_ms));
     }
   }
-  else
+
+  free_block(header);
+  download->block = block;
+  download->received = 1;
+
+  // a block behind the front of the window waits for the blocks ahead of it,
+  // read the unspent txs it spends into the utxo cache in the mean time...
+  if (download != get_sync_download(0))
   {
-    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ, height))
+    queue_block_utxo_prefetch(block);
+  }
+
+  // the block is now owned by the download window, so a failure to commit
+  // the window must not be reported back as a failure of this packet...
+  commit_sync_download_window();
+  return 0;
+}
+
+int send_compact_block_transactions(net_connection_t *net_connection, block_t *block, uint32_t tx_indexes_count, uint32_t *tx_indexes)
+{
+  assert(net_connection != NULL);
+  assert(block != NULL);
+  assert(tx_indexes != NULL);
+
+  // the generation tx is always sent along with the compact block
+  for (uint32_t i = 0; i < tx_indexes_count; i++)
+  {
+    if (tx_indexes[i] == 0 || tx_indexes[i] >= block->transaction_count)
     {
+      LOG_DEBUG("Got compact block transactions request with invalid tx index: %u!", tx_indexes[i]);
       return 1;
     }
   }
 
-  if (sync_height == g_protocol_sync_entry.last_sync_height)
+  return handle_packet_sendto(net_connection, PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_RESP, block, tx_indexes_count, tx_indexes);
+}
+
+static sync_block_download_t* get_sync_download_from_hash(uint8_t *hash)
+{
+  assert(hash != NULL);
+  for (uint32_t i = 0; i < g_protocol_sync_entry.sync_download_window_count; i++)
   {
-    g_protocol_sync_entry.last_sync_tries++;
+    sync_block_download_t *download = get_sync_download(i);
+    if (download->received == 0 && compare_hash(download->block->hash, hash))
+    {
+      return download;
+    }
   }
-  else
+
+  return NULL;
+}
+
+/*
+ * Hands a compact block with all of it's txs filled in to the download window,
+ * the block is checked against it's header the same way as a full block is...
+ */
+static int complete_sync_compact_block(net_connection_t *net_connection, sync_block_download_t *download)
+{
+  assert(download != NULL);
+  assert(download->compact_block != NULL);
+  assert(download->compact_block_num_missing_txs == 0);
+
+  block_t *block = download->compact_block;
+  download->compact_block = NULL;
+  if (full_block_received(net_connection, block))
   {
-    g_protocol_sync_entry.last_sync_tries = 0;
-    g_protocol_sync_entry.last_sync_height = sync_height;
+    free_block(block);
+    return 1;
   }
 
-  g_protocol_sync_entry.last_sync_ts = get_current_time();
   return 0;
 }
 
-int request_sync_next_block(net_connection_t *net_connection)
+/*
+ * Rebuilds a block from the short ids of it's txs using the txs in our mempool,
+ * the txs we do not have are requested from the peer which sent us the block.
+ */
+int compact_block_received(net_connection_t *net_connection, block_t *block, uint8_t *short_ids)
 {
   assert(net_connection != NULL);
-  uint32_t block_height = g_protocol_sync_entry.last_sync_height;
-  if (has_block_by_height(block_height) == 0)
+  assert(block != NULL);
+
+  sync_block_download_t *download = get_sync_download_from_hash(block->hash);
+  if (download == NULL || download->compact_block != NULL)
   {
-    LOG_ERROR("Cannot request next block when previous block at height: %u, was not found in the blockchain!", block_height);
     return 1;
   }
 
-  uint32_t sync_height = g_protocol_sync_entry.last_sync_height + 1;
-  if (sync_height == g_protocol_sync_entry.last_sync_height)
+  if (block->transaction_count != download->block->transaction_count)
   {
-    g_protocol_sync_entry.last_sync_tries++;
+    LOG_DEBUG("Got invalid compact block at height: %u, requesting it again...", download->height);
+    penalize_misbehaving_peer(net_connection);
+    request_sync_full_block(download, g_protocol_sync_entry.net_connection);
+    return 1;
   }
-  else
+
+  // the block is owned by the download from here on, the
+  // slots of the txs we have not found yet are left NULL...
+  block->transactions = realloc(block->transactions, sizeof(transaction_t*) * block->transaction_count);
+  assert(block->transactions != NULL);
+  for (uint32_t i = 1; i < block->transaction_count; i++)
   {
-    g_protocol_sync_entry.last_sync_tries = 0;
-    g_protocol_sync_entry.last_sync_height = sync_height;
+    block->transactions[i] = NULL;
   }
 
-  g_protocol_sync_entry.last_sync_ts = get_current_time();
-  if (g_protocol_sync_entry.sync_pending_blocks_count == 0)
+  download->compact_block = block;
+  download->compact_block_num_missing_txs = fill_compact_block_txs_from_mempool(block, short_ids);
+  if (download->compact_block_num_missing_txs == 0)
+  {
+    complete_sync_compact_block(net_connection, download);
+    return 0;
+  }
+
+  uint32_t tx_indexes_count = 0;
+  uint32_t *tx_indexes = malloc(sizeof(uint32_t) * download->compact_block_num_missing_txs);
+  assert(tx_indexes != NULL);
+  for (uint32_t i = 1; i < block->transaction_count; i++)
   {
-    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ, sync_height))
+    if (block->transactions[i] == NULL)
     {
-      return 1;
+      tx_indexes[tx_indexes_count] = i;
+      tx_indexes_count++;
     }
   }
-  else
-  {
-    void *val = NULL;
-    int r = deque_remove_last(g_protocol_sync_entry.sync_pending_blocks, &val);
-    assert(r == CC_OK);
-    block_t *pending_block = (block_t*)val;
-    assert(pending_block != NULL);
 
-    g_protocol_sync_entry.sync_pending_blocks_count--;
-    return block_header_received(net_connection, pending_block);
-  }
+  assert(tx_indexes_count == download->compact_block_num_missing_txs);
+  LOG_DEBUG("Requesting %u missing transactions of compact block at height: %u", tx_indexes_count, download->height);
 
+  // a failed request is retried in full once the download times out
+  handle_packet_sendto(net_connection, PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ, block->hash, tx_indexes_count, tx_indexes);
+  free(tx_indexes);
   return 0;
 }
 
-int request_sync_transaction(net_connection_t *net_connection, uint8_t *block_hash, uint32_t tx_index, uint8_t *tx_hash)
+int compact_block_transactions_received(net_connection_t *net_connection, uint8_t *hash, uint32_t transactions_count, transaction_t **transactions)
 {
   assert(net_connection != NULL);
-  assert(block_hash != NULL);
+  assert(hash != NULL);
+  assert(transactions != NULL);
 
-  if (tx_hash != NULL)
+  sync_block_download_t *download = get_sync_download_from_hash(hash);
+  if (download == NULL || download->compact_block == NULL)
   {
-    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ, block_hash, tx_hash))
-    {
-      return 1;
-    }
+    return 1;
   }
-  else
+
+  if (transactions_count != download->compact_block_num_missing_txs)
   {
-    if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ, block_hash, tx_index))
+    LOG_DEBUG("Got invalid compact block transactions at height: %u, requesting the block again...", download->height);
+    penalize_misbehaving_peer(net_connection);
+    request_sync_full_block(download, g_protocol_sync_entry.net_connection);
+    return 1;
+  }
+
+  // the txs are sent in the order that we requested them in,
+  // which is the order of the missing slots in the block...
+  block_t *block = download->compact_block;
+  uint32_t tx_index = 0;
+  for (uint32_t i = 1; i < block->transaction_count; i++)
+  {
+    if (block->transactions[i] == NULL)
     {
-      return 1;
+      assert(tx_index < transactions_count);
+      block->transactions[i] = transactions[tx_index];
+      transactions[tx_index] = NULL;
+      tx_index++;
     }
   }
 
-  if (tx_index == g_protocol_sync_entry.last_tx_sync_index)
+  download->compact_block_num_missing_txs = 0;
+  complete_sync_compact_block(net_connection, download);
+  return 0;
+}
+
+static int compare_inventory_tx_id(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, HASH_SIZE);
+}
+
+inventory_t* make_inventory(void)
+{
+  inventory_t *inventory = malloc(sizeof(inventory_t));
+  assert(inventory != NULL);
+
+  HashTableConf known_tx_ids_conf;
+  hashtable_conf_init(&known_tx_ids_conf);
+  known_tx_ids_conf.key_length = HASH_SIZE;
+  known_tx_ids_conf.hash = GENERAL_HASH;
+  known_tx_ids_conf.key_compare = compare_inventory_tx_id;
+
+  int r = hashtable_new_conf(&known_tx_ids_conf, &inventory->known_tx_ids);
+  assert(r == CC_OK);
+
+  inventory->known_tx_ids_ring = malloc(MAX_KNOWN_INVENTORY_SIZE * HASH_SIZE);
+  assert(inventory->known_tx_ids_ring != NULL);
+  inventory->known_tx_ids_next = 0;
+  inventory->known_tx_ids_count = 0;
+
+  inventory->pending_tx_ids = malloc(MAX_INVENTORY_TX_IDS_COUNT * HASH_SIZE);
+  assert(inventory->pending_tx_ids != NULL);
+  inventory->pending_tx_ids_count = 0;
+  return inventory;
+}
+
+void free_inventory(inventory_t *inventory)
+{
+  assert(inventory != NULL);
+  hashtable_destroy(inventory->known_tx_ids);
+  free(inventory->known_tx_ids_ring);
+  free(inventory->pending_tx_ids);
+  free(inventory);
+}
+
+int has_known_inventory(inventory_t *inventory, const uint8_t *tx_id)
+{
+  assert(inventory != NULL);
+  assert(tx_id != NULL);
+  return hashtable_contains_key(inventory->known_tx_ids, (void*)tx_id);
+}
+
+/*
+ * Remembers a tx id as known by the peer, once the ring is full
+ * the oldest tx id is evicted to make room for the new one.
+ */
+int add_known_inventory(inventory_t *inventory, const uint8_t *tx_id)
+{
+  assert(inventory != NULL);
+  assert(tx_id != NULL);
+  if (has_known_inventory(inventory, tx_id))
   {
-    g_protocol_sync_entry.last_tx_sync_tries++;
+    return 1;
+  }
+
+  uint8_t *slot = inventory->known_tx_ids_ring + (inventory->known_tx_ids_next * HASH_SIZE);
+  if (inventory->known_tx_ids_count == MAX_KNOWN_INVENTORY_SIZE)
+  {
+    int r = hashtable_remove(inventory->known_tx_ids, slot, NULL);
+    assert(r == CC_OK);
   }
   else
   {
-    g_protocol_sync_entry.last_tx_sync_tries = 0;
-    g_protocol_sync_entry.last_tx_sync_index = tx_index;
+    inventory->known_tx_ids_count++;
   }
 
-  g_protocol_sync_entry.last_tx_sync_ts = get_current_time();
+  memcpy(slot, tx_id, HASH_SIZE);
+  int r = hashtable_add(inventory->known_tx_ids, slot, slot);
+  assert(r == CC_OK);
+
+  inventory->known_tx_ids_next = (inventory->known_tx_ids_next + 1) % MAX_KNOWN_INVENTORY_SIZE;
   return 0;
 }
 
-int request_sync_next_transaction(net_connection_t *net_connection)
+static inventory_t* get_net_connection_inventory(net_connection_t *net_connection)
 {
   assert(net_connection != NULL);
-  block_t *pending_block = g_protocol_sync_entry.sync_pending_block;
-  assert(pending_block != NULL);
-
-  uint32_t tx_sync_index = g_protocol_sync_entry.last_tx_sync_index + 1;
-  if (tx_sync_index > pending_block->transaction_count)
+  if (net_connection->inventory == NULL)
   {
-    return 1;
+    net_connection->inventory = make_inventory();
   }
 
-  return request_sync_transaction(net_connection, pending_block->hash, tx_sync_index, NULL);
+  return net_connection->inventory;
 }
 
-int request_sync_previous_block(net_connection_t *net_connection)
+int flush_inventory(net_connection_t *net_connection)
 {
-  uint32_t sync_height = g_protocol_sync_entry.last_sync_height - 1;
-  return request_sync_block(net_connection, sync_height, NULL);
+  assert(net_connection != NULL);
+  inventory_t *inventory = net_connection->inventory;
+  if (inventory == NULL || inventory->pending_tx_ids_count == 0)
+  {
+    return 0;
+  }
+
+  uint32_t tx_ids_count = inventory->pending_tx_ids_count;
+  inventory->pending_tx_ids_count = 0;
+  return send_tx_ids_message(net_connection, PKT_TYPE_TRANSACTION_INVENTORY, tx_ids_count, inventory->pending_tx_ids);
 }
 
-int block_header_received(net_connection_t *net_connection, block_t *block)
+/*
+ * Queues the tx's id to be announced to every peer which does not already know about it,
+ * the announcements are sent in batches by the relay inventory task. Peers which predate
+ * inventories are sent the tx in full right away, as they would have been before.
+ */
+int announce_transaction_id(net_connection_t *net_connection, uint8_t *tx_id)
 {
-  assert(net_connection != NULL);
-  assert(block != NULL);
-  if (g_protocol_sync_entry.sync_initiated)
+  assert(tx_id != NULL);
+  transaction_t *tx = NULL;
+
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+  for (uint16_t i = 0; i < num_net_connections; i++)
   {
-    int has_checkpoint = has_checkpoint_hash_by_height(g_protocol_sync_entry.last_sync_height);
-    if (has_checkpoint)
+    net_connection_t *peer_net_connection = net_connections[i];
+    assert(peer_net_connection != NULL);
+    if (peer_net_connection == net_connection || is_net_connection_send_paused(peer_net_connection))
     {
-      uint8_t *checkpoint_hash = NULL;
-      assert(get_checkpoint_hash_from_height(g_protocol_sync_entry.last_sync_height, &checkpoint_hash) == 0);
-      assert(checkpoint_hash != NULL);
-
-      if (compare_hash(block->hash, checkpoint_hash) == 0)
-      {
-        char *checkpoint_hash_str = bin2hex(checkpoint_hash, HASH_SIZE);
-        char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
-        LOG_ERROR("Failed to receive block header, found checkpoint at height: %u, block received: %s "
-          "does not match checkpoint hash: %s!", g_protocol_sync_entry.last_sync_height, checkpoint_hash_str, block_hash_str);
-
-        free(checkpoint_hash_str);
-        free(block_hash_str);
+      continue;
+    }
 
-        // since we failed to get the correct hash corresponding to the
-        // predefined checkpoint hash, clear this sync request...
-        assert(clear_sync_request(0) == 0);
-        return 1;
-      }
+    inventory_t *inventory = get_net_connection_inventory(peer_net_connection);
+    if (add_known_inventory(inventory, tx_id))
+    {
+      continue;
     }
 
-    if (g_protocol_sync_entry.sync_start_height == -1)
+    if ((peer_net_connection->capabilities & PROTOCOL_CAPABILITY_TX_INVENTORY) == 0)
     {
-      if (g_protocol_sync_entry.sync_finding_top_block == 0)
+      // the tx may have already left our mempool, in which case there is nothing to flood
+      if (tx == NULL && (tx = copy_tx_from_mempool(tx_id)) == NULL)
       {
-        g_protocol_sync_entry.last_sync_height = get_block_height();
-        g_protocol_sync_entry.sync_finding_top_block = 1;
+        continue;
       }
 
-      int found_starting_block = has_block_by_hash(block->hash);
-      int can_rollback_and_resync = 0;
-      if (found_starting_block)
-      {
-        // check the block's actual height in our blockchain to make sure
-        // the height corresponds with the last sync height we've counted...
-        /*uint32_t actual_height = get_block_height_from_hash(block->hash);
-        if (actual_height != g_protocol_sync_entry.last_sync_height)
-        {
-          char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
-          LOG_ERROR("Failed to receive block header, found starting block: %s with unexpected height: %u, expected block at height: %u!",
-            block_hash_str, actual_height, g_protocol_sync_entry.last_sync_height);
+      handle_packet_sendto(peer_net_connection, PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION, tx);
+      continue;
+    }
 
-          free(block_hash_str);
-          assert(clear_sync_request(0) == 0);
-          return 1;
-        }*/
+    memcpy(inventory->pending_tx_ids + (inventory->pending_tx_ids_count * HASH_SIZE), tx_id, HASH_SIZE);
+    inventory->pending_tx_ids_count++;
+    if (inventory->pending_tx_ids_count == MAX_INVENTORY_TX_IDS_COUNT)
+    {
+      flush_inventory(peer_net_connection);
+    }
+  }
 
-        LOG_INFO("Found sync starting block at height: %u!", g_protocol_sync_entry.last_sync_height);
-        g_protocol_sync_entry.sync_start_height = g_protocol_sync_entry.last_sync_height;
-        can_rollback_and_resync = 1;
-      }
-      else if (g_protocol_sync_entry.last_sync_height <= 1)
-      {
-        LOG_WARNING("Unable to find sync starting height, continuing anyway...");
-        g_protocol_sync_entry.sync_start_height = 0;
-        can_rollback_and_resync = 1;
-      }
-      else
-      {
-        if (request_sync_previous_block(net_connection))
-        {
-          assert(clear_sync_request(0) == 0);
-          return 1;
-        }
-      }
+  if (tx != NULL)
+  {
+    free_transaction(tx);
+  }
 
-      if (can_rollback_and_resync)
-      {
-        g_protocol_sync_entry.sync_finding_top_block = 0;
-        if (backup_blockchain_and_rollback())
-        {
-          // if by some way we fail to rollback and resync and we
-          // fail to clear our sync request, then throw an assertion,
-          // this should never happen...
-          assert(clear_sync_request(0) == 0);
-          return 1;
-        }
+  return 0;
+}
 
-        assert(clear_grouped_sync_request() == 0);
-        g_protocol_sync_entry.last_sync_height = g_protocol_sync_entry.sync_start_height;
-        if (request_sync_next_block(g_protocol_sync_entry.net_connection))
-        {
-          return 1;
-        }
-      }
-    }
-    else if (g_protocol_sync_entry.tx_sync_initiated == 0)
-    {
-      block->transaction_count = 0;
-      block->transactions = NULL;
-      if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ, block->hash))
-      {
-        // we failed to request transactions for this block header,
-        // clear the sync request in attempt to resync this block later...
-        assert(clear_sync_request(0) == 0);
-        return 1;
-      }
+int announce_transaction(net_connection_t *net_connection, transaction_t *transaction)
+{
+  assert(transaction != NULL);
+  return announce_transaction_id(net_connection, transaction->id);
+}
 
-      g_protocol_sync_entry.sync_pending_block = block;
+/*
+ * Records that the tx is about to be requested, returns 1 if it is already
+ * in flight from another peer and that request has not yet timed out.
+ */
+int request_transaction_id(const uint8_t *tx_id, uint64_t current_time_ms)
+{
+  assert(tx_id != NULL);
+  if (g_protocol_requested_tx_ids == NULL)
+  {
+    g_protocol_requested_tx_ids = make_inventory();
+  }
+
+  inventory_t *inventory = g_protocol_requested_tx_ids;
+  void *val = NULL;
+  if (hashtable_get(inventory->known_tx_ids, (void*)tx_id, &val) == CC_OK)
+  {
+    size_t slot_index = ((uint8_t*)val - inventory->known_tx_ids_ring) / HASH_SIZE;
+    if (current_time_ms - g_protocol_requested_tx_ids_ts_ms[slot_index] <= (uint64_t)TX_INVENTORY_REQUEST_TIMEOUT * 1000)
+    {
+      return 1;
     }
+
+    g_protocol_requested_tx_ids_ts_ms[slot_index] = current_time_ms;
+    return 0;
   }
 
+  // the tx id is added to the slot the next id of the ring is written to
+  size_t slot_index = inventory->known_tx_ids_next;
+  assert(add_known_inventory(inventory, tx_id) == 0);
+  g_protocol_requested_tx_ids_ts_ms[slot_index] = current_time_ms;
   return 0;
 }
 
-int block_header_sync_complete(net_connection_t *net_connection, block_t *block)
+void clear_requested_transaction_ids(void)
+{
+  if (g_protocol_requested_tx_ids != NULL)
+  {
+    free_inventory(g_protocol_requested_tx_ids);
+    g_protocol_requested_tx_ids = NULL;
+  }
+}
+
+/*
+ * Requests the bodies of the announced txs which are not in our mempool and not already
+ * requested from another peer, every announced tx id is remembered so that we never
+ * announce it back to the peer.
+ */
+int transaction_inventory_received(net_connection_t *net_connection, uint32_t tx_ids_count, uint8_t *tx_ids)
 {
   assert(net_connection != NULL);
-  assert(block != NULL);
-  if (validate_and_insert_block(block) == 0)
+  assert(tx_ids != NULL);
+  assert(tx_ids_count <= MAX_INVENTORY_TX_IDS_COUNT);
+
+  inventory_t *inventory = get_net_connection_inventory(net_connection);
+  uint8_t *missing_tx_ids = malloc(tx_ids_count * HASH_SIZE);
+  assert(missing_tx_ids != NULL);
+
+  uint64_t current_time_ms = get_current_time_ms();
+  uint32_t missing_tx_ids_count = 0;
+  for (uint32_t i = 0; i < tx_ids_count; i++)
   {
-    handle_sync_added_block();
-    if (check_sync_status(0))
+    uint8_t *tx_id = tx_ids + (i * HASH_SIZE);
+    add_known_inventory(inventory, tx_id);
+    if (is_tx_id_in_mempool(tx_id) || request_transaction_id(tx_id, current_time_ms))
     {
-      if (request_sync_next_block(g_protocol_sync_entry.net_connection))
-      {
-        return 1;
-      }
+      continue;
     }
 
-    return 0;
+    memcpy(missing_tx_ids + (missing_tx_ids_count * HASH_SIZE), tx_id, HASH_SIZE);
+    missing_tx_ids_count++;
   }
 
-  return 1;
+  int result = 0;
+  if (missing_tx_ids_count > 0)
+  {
+    result = send_tx_ids_message(net_connection, PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ, missing_tx_ids_count, missing_tx_ids);
+  }
+
+  free(missing_tx_ids);
+  return result;
 }
 
-int transaction_received(net_connection_t *net_connection, transaction_t *transaction, uint32_t tx_index)
+int send_transactions_by_id(net_connection_t *net_connection, uint32_t tx_ids_count, uint8_t *tx_ids)
 {
   assert(net_connection != NULL);
-  assert(transaction != NULL);
+  assert(tx_ids != NULL);
 
-  if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.tx_sync_initiated)
+  // txs which have left our mempool since they were announced are skipped
+  inventory_t *inventory = get_net_connection_inventory(net_connection);
+  for (uint32_t i = 0; i < tx_ids_count; i++)
   {
-    block_t *pending_block = g_protocol_sync_entry.sync_pending_block;
-    assert(pending_block != NULL);
-
-    assert(add_transaction_to_block(pending_block, transaction, tx_index) == 0);
-    if (tx_index + 1 < g_protocol_sync_entry.tx_sync_num_txs)
+    uint8_t *tx_id = tx_ids + (i * HASH_SIZE);
+    transaction_t *tx = copy_tx_from_mempool(tx_id);
+    if (tx == NULL)
     {
-      if (request_sync_next_transaction(net_connection))
-      {
-        assert(clear_sync_request(0) == 0);
-        return 1;
-      }
+      continue;
     }
-    else
+
+    add_known_inventory(inventory, tx_id);
+    int result = handle_packet_sendto(net_connection, PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION, tx);
+    free_transaction(tx);
+    if (result)
     {
-      // compute the block's merkle root again and compare it against
-      // the block's currently defined merkle root to see if
-      // this block does infact have the correct transactions it requires...
-      if (valid_merkle_root(pending_block))
-      {
-        // must clear the tx sync entry cache before calling block_header_sync_complete,
-        // otherwise the entire sync entry cache will be cleared and this assertion will fail...
-        assert(clear_tx_sync_request() == 0);
-        if (block_header_sync_complete(net_connection, pending_block))
-        {
-          // we failed to add this block when trying to switch to it's
-          // alternative chain, restore our previous working chain instead.
-          assert(clear_sync_request(0) == 0);
-          return 1;
-        }
-      }
-      else
-      {
-        assert(clear_sync_request(0) == 0);
-        return 1;
-      }
+      return 1;
     }
   }
 
   return 0;
 }
 
-int backup_blockchain_and_rollback(void)
+int begin_blockchain_reorg_for_resync(void)
 {
   uint32_t current_block_height = get_block_height();
   if (current_block_height > 0)
   {
-    LOG_INFO("Backing up blockchain in preparation for resync...");
-    if (backup_blockchain())
+    // our blocks above the sync starting height are disconnected and kept
+    // around, they are reconnected if the sync to the alternative blockchain fails
+    LOG_INFO("Disconnecting blockchain back to height: %u in preparation for resync...", g_protocol_sync_entry.sync_start_height);
+    if (begin_blockchain_reorg(g_protocol_sync_entry.sync_start_height))
     {
       return 1;
     }
 
-    g_protocol_sync_entry.sync_did_backup_blockchain = 1;
-    if (current_block_height > g_protocol_sync_entry.sync_start_height)
+    g_protocol_sync_entry.sync_did_begin_reorg = 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Requests which are answered with data from our blockchain or mempool, these are
+ * deferred by the network layer for peers whose send queue is paused until the peer has caught up.
+ */
+int is_data_request_packet(uint32_t packet_id)
+{
+  switch (packet_id)
+  {
+    case PKT_TYPE_GET_PEERLIST_REQ:
+    case PKT_TYPE_GET_BLOCK_BY_HASH_REQ:
+    case PKT_TYPE_GET_BLOCK_BY_HEIGHT_REQ:
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
+    case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ:
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ:
+    case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ:
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ:
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ:
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_REQ:
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ:
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ:
+    case PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ:
+    case PKT_TYPE_GET_BLOCK_FILTERS_REQ:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * A peer is only synced from if it has a good enough score and there is no faster peer,
+ * which recently reported at least the same height, that we could sync from instead.
+ * The sync peer of a sync in progress is preferred over switching to another peer...
+ */
+/*
+ * A pruned peer only serves it's most recent blocks, so it can only be
+ * synced from when we are within PRUNE_MIN_BLOCK_DEPTH of it's top block...
+ */
+static int can_peer_serve_sync(net_connection_t *net_connection, uint32_t current_block_height, uint32_t height)
+{
+  assert(net_connection != NULL);
+  if ((net_connection->peer_capabilities & PROTOCOL_CAPABILITY_PRUNED) == 0)
+  {
+    return 1;
+  }
+
+  return height <= current_block_height + PRUNE_MIN_BLOCK_DEPTH;
+}
+
+static int is_preferred_sync_peer(net_connection_t *net_connection, uint32_t height)
+{
+  assert(net_connection != NULL);
+  peer_t *peer = get_peer_from_net_connection(net_connection);
+  if (peer == NULL || peer->score < PEER_SYNC_MIN_SCORE)
+  {
+    return 0;
+  }
+
+  uint32_t current_block_height = get_block_height();
+  if (can_peer_serve_sync(net_connection, current_block_height, height) == 0)
+  {
+    return 0;
+  }
+
+  uint32_t current_time = get_current_time();
+  uint32_t latency = get_peer_latency(peer);
+
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    if (net_connections[i] == net_connection)
+    {
+      continue;
+    }
+
+    peer_t *other_peer = get_peer_from_net_connection(net_connections[i]);
+    if (other_peer == NULL || other_peer->score < PEER_SYNC_MIN_SCORE || other_peer->block_height < height ||
+        current_time - other_peer->block_height_ts > SYNC_PEER_BLOCK_HEIGHT_TIMEOUT ||
+        can_peer_serve_sync(net_connections[i], current_block_height, other_peer->block_height) == 0)
     {
-      LOG_INFO("Rolling blockchain back to height: %u...", g_protocol_sync_entry.sync_start_height);
-      if (rollback_blockchain(g_protocol_sync_entry.sync_start_height))
-      {
-        return 1;
-      }
+      continue;
+    }
+
+    if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.net_connection == net_connections[i])
+    {
+      return 0;
+    }
+
+    if (get_peer_latency(other_peer) < latency)
+    {
+      return 0;
     }
   }
 
-  return 0;
+  return 1;
 }
 
 int can_packet_be_processed(net_connection_t *net_connection, uint32_t packet_id)
@@ -1589,6 +4617,10 @@ int can_packet_be_processed(net_connection_t *net_connection, uint32_t packet_id
     case PKT_TYPE_CONNECT_ESTABLISH_RESP:
       return 1;
 
+    case PKT_TYPE_CONNECT_PING_REQ:
+    case PKT_TYPE_CONNECT_PING_RESP:
+      return 1;
+
     case PKT_TYPE_GET_BLOCK_HEIGHT_REQ:
     case PKT_TYPE_GET_BLOCK_HEIGHT_RESP:
       return 1;
@@ -1605,6 +4637,12 @@ int can_packet_be_processed(net_connection_t *net_connection, uint32_t packet_id
       check_sender = 1;
       break;
 
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
+      return 1;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
+      check_sender = 1;
+      break;
+
     case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
       return 1;
     case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
@@ -1631,6 +4669,37 @@ int can_packet_be_processed(net_connection_t *net_connection, uint32_t packet_id
 
     case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
       return 1;
+
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ:
+      return 1;
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP:
+      check_sender = 1;
+      break;
+
+    // full blocks are downloaded from all of our peers, the received
+    // blocks are checked against the headers we got from our sync peer...
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ:
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP:
+      return 1;
+
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_REQ:
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP:
+      return 1;
+
+    // compact blocks are downloaded the same way as full blocks
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ:
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP:
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ:
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_RESP:
+      return 1;
+
+    case PKT_TYPE_TRANSACTION_INVENTORY:
+    case PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ:
+      return 1;
+
+    case PKT_TYPE_GET_BLOCK_FILTERS_REQ:
+    case PKT_TYPE_GET_BLOCK_FILTERS_RESP:
+      return 1;
     default:
       break;
   }
@@ -1660,11 +4729,7 @@ int handle_packet_anonymous(net_connection_t *net_connection, uint32_t packet_id
         net_connection->host_port = message->host_port;
         net_connection->anonymous = 0;
 
-        struct mg_connection *connection = net_connection->connection;
-        assert(connection != NULL);
-
-        uint32_t remote_ip = ntohl(*(uint32_t*)&connection->sa.sin.sin_addr);
-        uint64_t peer_id = concatenate(remote_ip, message->host_port);
+        uint64_t peer_id = concatenate(net_connection->remote_ip, message->host_port);
         if (has_peer(peer_id))
         {
           LOG_DEBUG("Cannot add an already existant peer with id: %u!", peer_id);
@@ -1693,10 +4758,15 @@ int handle_packet_anonymous(net_connection_t *net_connection, uint32_t packet_id
           return 1;
         }
 
+        net_connection->grouped_blocks_budget_size = MIN(message->grouped_blocks_budget_size, g_protocol_grouped_blocks_budget_size);
+        net_connection->capabilities = message->capabilities & get_protocol_capabilities();
+        net_connection->peer_capabilities = message->capabilities;
+
         peer_t *peer = init_peer(peer_id, net_connection);
         assert(add_peer(peer) == 0);
 
-        if (handle_packet_sendto(net_connection, PKT_TYPE_CONNECT_ESTABLISH_RESP))
+        int send_handshake_extensions = compare_version_numbers(message->version_number, PROTOCOL_HANDSHAKE_EXTENSIONS_VERSION) >= 0;
+        if (handle_packet_sendto(net_connection, PKT_TYPE_CONNECT_ESTABLISH_RESP, send_handshake_extensions))
         {
           free_peer(peer);
           return 1;
@@ -1709,6 +4779,12 @@ int handle_packet_anonymous(net_connection_t *net_connection, uint32_t packet_id
       {
         connect_establish_resp_t *message = (connect_establish_resp_t*)message_object;
         net_connection->anonymous = 0;
+
+        // we connected to this peer ourselves, so it's address is known to be reachable
+        mark_peer_address_success(net_connection->remote_ip, net_connection->host_port);
+        net_connection->grouped_blocks_budget_size = MIN(message->grouped_blocks_budget_size, g_protocol_grouped_blocks_budget_size);
+        net_connection->capabilities = message->capabilities & get_protocol_capabilities();
+        net_connection->peer_capabilities = message->capabilities;
         return 0;
       }
       break;
@@ -1724,8 +4800,39 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
 {
   assert(net_connection != NULL);
   assert(message_object != NULL);
+  TRACE_SPAN("handle_packet");
   switch (packet_id)
   {
+    case PKT_TYPE_CONNECT_PING_REQ:
+      {
+        connect_ping_req_t *message = (connect_ping_req_t*)message_object;
+        if (handle_packet_sendto(net_connection, PKT_TYPE_CONNECT_PING_RESP, message->nonce))
+        {
+          return 1;
+        }
+
+        return 0;
+      }
+      break;
+    case PKT_TYPE_CONNECT_PING_RESP:
+      {
+        connect_ping_resp_t *message = (connect_ping_resp_t*)message_object;
+        peer_t *peer = get_peer_from_net_connection(net_connection);
+        if (peer == NULL)
+        {
+          return 1;
+        }
+
+        // late responses to a ping which already timed out are ignored
+        if (peer->ping_pending && message->nonce == peer->ping_nonce)
+        {
+          record_peer_rtt(peer, (uint32_t)(get_current_time_ms() - peer->ping_ts_ms));
+          peer->ping_pending = 0;
+        }
+
+        return 0;
+      }
+      break;
     case PKT_TYPE_GET_PEERLIST_REQ:
       {
         get_peerlist_req_t *message = (get_peerlist_req_t*)message_object;
@@ -1766,18 +4873,27 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
     case PKT_TYPE_GET_BLOCK_HEIGHT_REQ:
       {
         get_block_height_request_t *message = (get_block_height_request_t*)message_object;
-        if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_HEIGHT_RESP,
-          get_block_height(), get_current_block_hash()))
+        blockchain_tip_t *tip = acquire_blockchain_tip();
+        if (tip == NULL)
         {
-          return 1;
+          return 0;
         }
 
-        return 0;
+        int result = handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_HEIGHT_RESP, tip->height, tip->hash);
+        release_blockchain_tip(tip);
+        return result;
       }
       break;
     case PKT_TYPE_GET_BLOCK_HEIGHT_RESP:
       {
         get_block_height_response_t *message = (get_block_height_response_t*)message_object;
+        peer_t *peer = get_peer_from_net_connection(net_connection);
+        if (peer != NULL)
+        {
+          peer->block_height = message->height;
+          peer->block_height_ts = get_current_time();
+        }
+
         int can_initiate_sync = 1;
         uint32_t current_block_height = get_block_height();
         if (message->height > current_block_height)
@@ -1795,12 +4911,17 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
               can_initiate_sync = 0;
             }
 
-            if (g_protocol_sync_entry.sync_did_backup_blockchain)
+            if (g_protocol_sync_entry.sync_did_begin_reorg)
             {
               can_initiate_sync = 0;
             }
           }
 
+          if (can_initiate_sync && is_preferred_sync_peer(net_connection, message->height) == 0)
+          {
+            can_initiate_sync = 0;
+          }
+
           if (can_initiate_sync)
           {
             LOG_INFO("Found potential alternative blockchain at height: %u", message->height);
@@ -1823,7 +4944,7 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
               {
                 g_protocol_sync_entry.sync_start_height = 0;
                 LOG_INFO("Beginning sync with presumed top block: %u...", message->height);
-                if (request_sync_next_block(net_connection))
+                if (request_sync_from_start_height(net_connection))
                 {
                   LOG_ERROR("Failed to request next block when looking for synchronization starting height!");
                   assert(clear_sync_request(0) == 0);
@@ -1842,20 +4963,36 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
     case PKT_TYPE_GET_BLOCK_BY_HASH_REQ:
       {
         get_block_by_hash_request_t *message = (get_block_by_hash_request_t*)message_object;
-        block_t *block = get_block_from_hash(message->hash);
-        if (block != NULL)
+        blockchain_tip_t *tip = acquire_blockchain_tip();
+        if (tip == NULL)
+        {
+          return 0;
+        }
+
+        stored_block_t *stored_block = get_stored_block_from_hash_at_tip(tip, message->hash, 0);
+        release_blockchain_tip(tip);
+        if (stored_block != NULL)
         {
-          uint32_t block_height = get_block_height_from_block(block);
+          // the response is the block's height followed by the stored block header
+          int32_t block_height = get_block_height_from_hash(message->hash);
           if (block_height > 0)
           {
-            if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_BY_HASH_RESP, block_height, block))
+            buffer_t *buffer = buffer_acquire_scratch();
+            int result = (
+              buffer_write_uint32(buffer, (uint32_t)block_height) ||
+              buffer_write(buffer, stored_block->view.data, stored_block->view.size) ||
+              handle_packet_sendto_serialized(net_connection, PKT_TYPE_GET_BLOCK_BY_HASH_RESP,
+                buffer_get_data(buffer), buffer_get_size(buffer)));
+
+            buffer_release_scratch(buffer);
+            if (result)
             {
-              free_block(block);
+              free_stored_block(stored_block);
               return 1;
             }
           }
 
-          free_block(block);
+          free_stored_block(stored_block);
         }
 
         return 0;
@@ -1880,7 +5017,14 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
         get_block_by_height_request_t *message = (get_block_by_height_request_t*)message_object;
         if (message->height > 0)
         {
-          block_t *block = get_block_from_height(message->height);
+          blockchain_tip_t *tip = acquire_blockchain_tip();
+          if (tip == NULL)
+          {
+            return 0;
+          }
+
+          block_t *block = get_block_header_from_height_at_tip(tip, message->height);
+          release_blockchain_tip(tip);
           if (block != NULL)
           {
             if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_BY_HEIGHT_RESP, block->hash, block))
@@ -1910,182 +5054,54 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
         }
       }
       break;
-    /*case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
-      {
-
-      }
-      break;
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
-      {
-
-      }
-      break;*/
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
-      {
-        get_grouped_blocks_from_height_request_t *message = (get_grouped_blocks_from_height_request_t*)message_object;
-        uint32_t current_block_height = get_block_height();
-        if (message->height <= current_block_height)
-        {
-          buffer_t *block_data_buffer = buffer_init();
-          uint32_t blocks_count = 0;
-          uint32_t top_block_height = MIN(message->height + MAX_GROUPED_BLOCKS_COUNT, current_block_height);
-          for (uint32_t i = message->height; i < top_block_height; i++)
-          {
-            block_t *block = get_block_from_height(i);
-            assert(block != NULL);
-
-            if (serialize_block(block_data_buffer, block))
-            {
-              buffer_free(block_data_buffer);
-              return 1;
-            }
-
-            blocks_count++;
-            free_block(block);
-          }
-
-          if (blocks_count == 0)
-          {
-            buffer_free(block_data_buffer);
-            return 1;
-          }
-
-          uint8_t *block_data = buffer_get_data(block_data_buffer);
-          size_t block_data_size = buffer_get_size(block_data_buffer);
-
-          buffer_t *buffer = buffer_init();
-          if (buffer_write_uint32(buffer, blocks_count))
-          {
-            buffer_free(block_data_buffer);
-            buffer_free(buffer);
-            return 1;
-          }
-
-          if (buffer_write(buffer, block_data, block_data_size))
-          {
-            buffer_free(block_data_buffer);
-            buffer_free(buffer);
-            return 1;
-          }
-
-          if (handle_packet_sendto(net_connection, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP, buffer))
-          {
-            buffer_free(block_data_buffer);
-            buffer_free(buffer);
-            return 1;
-          }
-
-          buffer_free(block_data_buffer);
-          buffer_free(buffer);
-          return 0;
-        }
-      }
-      break;
-    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
-      {
-        get_grouped_blocks_from_height_response_t *message = (get_grouped_blocks_from_height_response_t*)message_object;
-        if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.sync_pending_blocks_count == 0)
-        {
-          buffer_t *buffer = buffer_init_data(0, message->block_data, message->block_data_size);
-          buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
-          uint32_t blocks_count = 0;
-          if (buffer_read_uint32(buffer_iterator, &blocks_count))
-          {
-            buffer_free(buffer);
-            buffer_iterator_free(buffer_iterator);
-            return 1;
-          }
-
-          if (blocks_count == 0)
-          {
-            LOG_DEBUG("Got grouped block response with no blocks!");
-            buffer_free(buffer);
-            buffer_iterator_free(buffer_iterator);
-            return 1;
-          }
-          else if (blocks_count > MAX_GROUPED_BLOCKS_COUNT)
-          {
-            LOG_DEBUG("Got grouped block response with blocks count: %u greater than allowed: %u!", blocks_count, MAX_GROUPED_BLOCKS_COUNT);
-            buffer_free(buffer);
-            buffer_iterator_free(buffer_iterator);
-            return 1;
-          }
-
-          // blocks are sent in the reverse order and deserialized, placed in the
-          // queue in the correct order pushing the last block right and pulling
-          // the blocks from the queue left to right until the queue is empty...
-          Deque *pending_blocks;
-          size_t pending_blocks_count = 0;
-          int r = deque_new(&pending_blocks);
-          assert(r == CC_OK);
-
-          block_t *last_block = get_current_block();
-          for (uint32_t i = 0; i < blocks_count; i++)
-          {
-            block_t *block = NULL;
-            if (deserialize_block(buffer_iterator, &block))
-            {
-              buffer_free(buffer);
-              buffer_iterator_free(buffer_iterator);
-              deque_destroy(pending_blocks);
-              return 1;
-            }
-
-            if (!compare_hash(last_block->hash, block->previous_hash))
-            {
-              buffer_free(buffer);
-              buffer_iterator_free(buffer_iterator);
-              deque_destroy(pending_blocks);
-              return 1;
-            }
-
-            assert(block != NULL);
-            int r = deque_add_first(pending_blocks, block);
-            assert(r == CC_OK);
-            pending_blocks_count++;
-            last_block = block;
-          }
-
-          // pull all of our pending blocks from the queue and place them
-          // in the synchronization entry queue:
-          void *val = NULL;
-          DEQUE_FOREACH(val, pending_blocks,
-          {
-            block_t *pending_block = (block_t*)val;
-            assert(pending_block != NULL);
-
-            r = deque_add_last(g_protocol_sync_entry.sync_pending_blocks, pending_block);
-            assert(r == CC_OK);
-            g_protocol_sync_entry.sync_pending_blocks_count++;
-          })
-
-          // destroy our pending blocks queue
-          deque_destroy(pending_blocks);
-
-          // pull the first block off the queue and begin synchronizing it:
-          r = deque_remove_last(g_protocol_sync_entry.sync_pending_blocks, &val);
-          assert(r == CC_OK);
-          block_t *pending_block = (block_t*)val;
-          assert(pending_block != NULL);
-
-          g_protocol_sync_entry.sync_pending_blocks_count--;
-          if (block_header_received(net_connection, pending_block))
-          {
-            buffer_free(buffer);
-            buffer_iterator_free(buffer_iterator);
-            return 1;
-          }
-
-          buffer_free(buffer);
-          buffer_iterator_free(buffer_iterator);
-          return 0;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ:
+      {
+        get_grouped_blocks_from_hash_request_t *message = (get_grouped_blocks_from_hash_request_t*)message_object;
+        int32_t block_height = get_block_height_from_hash(message->hash);
+        if (block_height >= 0)
+        {
+          // send the blocks that follow the requested block...
+          return send_grouped_blocks(net_connection, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP,
+            (uint32_t)block_height + 1, message->include_transactions);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP:
+      {
+        get_grouped_blocks_from_hash_response_t *message = (get_grouped_blocks_from_hash_response_t*)message_object;
+        if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.sync_pending_blocks_count == 0)
+        {
+          return grouped_blocks_received(net_connection, message->block_data, message->block_data_size);
+        }
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_REQ:
+      {
+        get_grouped_blocks_from_height_request_t *message = (get_grouped_blocks_from_height_request_t*)message_object;
+        return send_grouped_blocks(net_connection, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP,
+          message->height, message->include_transactions);
+      }
+      break;
+    case PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP:
+      {
+        get_grouped_blocks_from_height_response_t *message = (get_grouped_blocks_from_height_response_t*)message_object;
+        if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.sync_pending_blocks_count == 0)
+        {
+          return grouped_blocks_received(net_connection, message->block_data, message->block_data_size);
         }
       }
       break;
     case PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_REQ:
       {
         get_block_num_transactions_request_t *message = (get_block_num_transactions_request_t*)message_object;
-        block_t *block = get_block_from_hash(message->hash);
+        blockchain_tip_t *tip = acquire_blockchain_tip();
+        if (tip == NULL)
+        {
+          return 0;
+        }
+
+        block_t *block = get_block_header_from_hash_at_tip(tip, message->hash);
+        release_blockchain_tip(tip);
         if (block != NULL)
         {
           if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_NUM_TRANSACTIONS_RESP,
@@ -2133,34 +5149,32 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
     case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_REQ:
       {
         get_block_transaction_by_hash_request_t *message = (get_block_transaction_by_hash_request_t*)message_object;
-        block_t *block = get_block_from_hash(message->block_hash);
+        block_t *block = acquire_block_from_hash(message->block_hash);
         if (block != NULL)
         {
           transaction_t *transaction = get_tx_by_hash_from_block(block, message->tx_hash);
           if (transaction == NULL)
           {
-            free_block(block);
+            release_block(block);
             return 1;
           }
 
           int32_t tx_index = get_tx_index_from_tx_in_block(block, transaction);
+          // the transaction is owned by the block and is released along with it
           if (tx_index < 0)
           {
-            free_block(block);
-            free_transaction(transaction);
+            release_block(block);
             return 1;
           }
 
           if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_TRANSACTION_BY_HASH_RESP,
             message->block_hash, tx_index, transaction))
           {
-            free_block(block);
-            free_transaction(transaction);
+            release_block(block);
             return 1;
           }
 
-          free_block(block);
-          free_transaction(transaction);
+          release_block(block);
           return 0;
         }
       }
@@ -2193,26 +5207,35 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
     case PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_REQ:
       {
         get_block_transaction_by_index_request_t *message = (get_block_transaction_by_index_request_t*)message_object;
-        block_t *block = get_block_from_hash(message->block_hash);
-        if (block != NULL)
+        blockchain_tip_t *tip = acquire_blockchain_tip();
+        if (tip == NULL)
         {
-          if (message->tx_index <= block->transaction_count)
-          {
-            transaction_t *transaction = block->transactions[message->tx_index];
-            assert(transaction != NULL);
-
-            if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP,
-              message->block_hash, message->tx_index, transaction))
-            {
-              free_block(block);
-              return 1;
-            }
+          return 0;
+        }
 
-            free_block(block);
-            return 0;
+        stored_block_t *stored_block = get_stored_block_from_hash_at_tip(tip, message->block_hash, 1);
+        release_blockchain_tip(tip);
+        if (stored_block != NULL)
+        {
+          transaction_view_t tx_view;
+          if (message->tx_index < stored_block->view.transaction_count &&
+              get_transaction_view_at(&tx_view, stored_block->txs_data, stored_block->txs_size, message->tx_index) == 0)
+          {
+            // the response is the block hash and tx index followed by the stored tx
+            buffer_t *buffer = buffer_acquire_scratch();
+            int result = (
+              buffer_write_bytes32(buffer, message->block_hash, HASH_SIZE) ||
+              buffer_write_uint32(buffer, message->tx_index) ||
+              buffer_write(buffer, tx_view.data, tx_view.size) ||
+              handle_packet_sendto_serialized(net_connection, PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP,
+                buffer_get_data(buffer), buffer_get_size(buffer)));
+
+            buffer_release_scratch(buffer);
+            free_stored_block(stored_block);
+            return result;
           }
 
-          free_block(block);
+          free_stored_block(stored_block);
           return 1;
         }
       }
@@ -2242,20 +5265,224 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
         }
       }
       break;
-    case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ:
       {
-        incoming_mempool_transaction_t *message = (incoming_mempool_transaction_t*)message_object;
-        if (validate_and_add_tx_to_mempool(message->transaction) == 0)
+        get_block_headers_from_height_request_t *message = (get_block_headers_from_height_request_t*)message_object;
+        blockchain_tip_t *tip = acquire_blockchain_tip();
+        if (tip == NULL)
+        {
+          return 0;
+        }
+
+        uint32_t current_block_height = tip->height;
+        if (message->height > 0 && message->height <= current_block_height)
         {
-          // relay this incoming mempool transaction to our peers only if we do not already
-          // know about the transaction, assuming our peers (or most of them) do not either...
-          if (handle_packet_broadcast(PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION, message->transaction))
+          buffer_t *header_data_buffer = buffer_init();
+          uint32_t headers_count = 0;
+          uint32_t top_block_height = MIN(message->height + MAX_BLOCK_HEADERS_COUNT - 1, current_block_height);
+          for (uint32_t i = message->height; i <= top_block_height; i++)
+          {
+            block_t *block = get_block_header_from_height_at_tip(tip, i);
+            if (block == NULL || serialize_block(header_data_buffer, block))
+            {
+              release_blockchain_tip(tip);
+              if (block != NULL)
+              {
+                free_block(block);
+              }
+
+              buffer_free(header_data_buffer);
+              return 1;
+            }
+
+            headers_count++;
+            free_block(block);
+          }
+
+          release_blockchain_tip(tip);
+          if (handle_packet_sendto(net_connection, PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP,
+            message->height, headers_count, header_data_buffer))
           {
+            buffer_free(header_data_buffer);
             return 1;
           }
 
+          buffer_free(header_data_buffer);
           return 0;
         }
+
+        release_blockchain_tip(tip);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP:
+      {
+        get_block_headers_from_height_response_t *message = (get_block_headers_from_height_response_t*)message_object;
+        if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.is_header_first_sync)
+        {
+          buffer_t *buffer = buffer_init_data(0, message->header_data, message->header_data_size);
+          buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+          int result = block_headers_received(net_connection, message->height, message->headers_count, buffer_iterator);
+          buffer_iterator_free(buffer_iterator);
+          buffer_free(buffer);
+          return result;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ:
+      {
+        get_full_block_by_hash_request_t *message = (get_full_block_by_hash_request_t*)message_object;
+        stored_block_t *stored_block = get_stored_block_from_hash(message->hash, 1);
+        if (stored_block != NULL)
+        {
+          // the response is the stored block header followed by the stored txs
+          buffer_t *buffer = buffer_acquire_scratch();
+          int result = (
+            buffer_write(buffer, stored_block->view.data, stored_block->view.size) ||
+            (stored_block->txs_size > 0 && buffer_write(buffer, stored_block->txs_data, stored_block->txs_size)) ||
+            handle_packet_sendto_serialized(net_connection, PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP,
+              buffer_get_data(buffer), buffer_get_size(buffer)));
+
+          buffer_release_scratch(buffer);
+          free_stored_block(stored_block);
+          return result;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP:
+      {
+        get_full_block_by_hash_response_t *message = (get_full_block_by_hash_response_t*)message_object;
+        if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.is_header_first_sync)
+        {
+          return full_block_received(net_connection, message->block);
+        }
+
+        // the block is only taken by a sync, otherwise the failure releases it
+        return 1;
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_REQ:
+      {
+        get_transaction_merkle_branch_request_t *message = (get_transaction_merkle_branch_request_t*)message_object;
+        block_t *block = get_block_from_tx_id(message->tx_id);
+        if (block != NULL)
+        {
+          int result = send_transaction_merkle_branch(net_connection, block, message->tx_id);
+          free_block(block);
+          return result;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP:
+      {
+        get_transaction_merkle_branch_response_t *message = (get_transaction_merkle_branch_response_t*)message_object;
+        return transaction_merkle_branch_received(net_connection, message->block, message->transaction,
+          message->tx_index, message->branch, message->branch_length);
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ:
+      {
+        get_compact_block_by_hash_request_t *message = (get_compact_block_by_hash_request_t*)message_object;
+        block_t *block = acquire_block_from_hash(message->hash);
+        if (block != NULL)
+        {
+          int result = handle_packet_sendto(net_connection, PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP, block);
+          release_block(block);
+          return result;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP:
+      {
+        get_compact_block_by_hash_response_t *message = (get_compact_block_by_hash_response_t*)message_object;
+        if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.is_header_first_sync)
+        {
+          return compact_block_received(net_connection, message->block, message->short_ids);
+        }
+
+        // the block is only taken by a sync, otherwise the failure releases it
+        return 1;
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ:
+      {
+        get_compact_block_transactions_request_t *message = (get_compact_block_transactions_request_t*)message_object;
+        block_t *block = acquire_block_from_hash(message->hash);
+        if (block != NULL)
+        {
+          int result = send_compact_block_transactions(net_connection, block, message->tx_indexes_count, message->tx_indexes);
+          release_block(block);
+          return result;
+        }
+      }
+      break;
+    case PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_RESP:
+      {
+        get_compact_block_transactions_response_t *message = (get_compact_block_transactions_response_t*)message_object;
+        if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.is_header_first_sync)
+        {
+          return compact_block_transactions_received(net_connection, message->hash,
+            message->transactions_count, message->transactions);
+        }
+      }
+      break;
+    case PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION:
+      {
+        incoming_mempool_transaction_t *message = (incoming_mempool_transaction_t*)message_object;
+        transaction_t *tx = message->transaction;
+        add_known_inventory(get_net_connection_inventory(net_connection), tx->id);
+
+        // the tx is validated on the task schedulers and announced by the
+        // relay inventory task once it has been added to our mempool...
+        if (get_is_mempool_ingress_running())
+        {
+          if (queue_mempool_ingress_tx(net_connection, tx) == 0)
+          {
+            message->transaction = NULL;
+          }
+
+          break;
+        }
+
+        // the mempool owns the tx once it is added and may free it as soon as it is replaced,
+        // so the tx is announced by it's id which is copied beforehand...
+        uint8_t tx_id[HASH_SIZE];
+        memcpy(tx_id, tx->id, HASH_SIZE);
+        if (validate_and_add_tx_to_mempool(tx) == 0)
+        {
+          // announce this incoming mempool transaction to our peers only if we did not
+          // already know about it, the peers which do not have it will ask us for it...
+          message->transaction = NULL;
+          return announce_transaction_id(net_connection, tx_id);
+        }
+      }
+      break;
+    case PKT_TYPE_TRANSACTION_INVENTORY:
+      {
+        transaction_inventory_t *message = (transaction_inventory_t*)message_object;
+        return transaction_inventory_received(net_connection, message->tx_ids_count, message->tx_ids);
+      }
+      break;
+    case PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ:
+      {
+        get_transactions_by_id_request_t *message = (get_transactions_by_id_request_t*)message_object;
+        return send_transactions_by_id(net_connection, message->tx_ids_count, message->tx_ids);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_FILTERS_REQ:
+      {
+        get_block_filters_request_t *message = (get_block_filters_request_t*)message_object;
+        return send_block_filters(net_connection, message->height, message->count);
+      }
+      break;
+    case PKT_TYPE_GET_BLOCK_FILTERS_RESP:
+      {
+        get_block_filters_response_t *message = (get_block_filters_response_t*)message_object;
+        buffer_t *buffer = buffer_init_data(0, message->filter_data, message->filter_data_size);
+        buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+        int result = block_filters_received(net_connection, message->height, message->filters_count, buffer_iterator);
+        buffer_iterator_free(buffer_iterator);
+        buffer_free(buffer);
+        return result;
       }
       break;
     default:
@@ -2268,68 +5495,162 @@ int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *me
 
 int handle_receive_packet(net_connection_t *net_connection, packet_t *packet)
 {
-  void *message = NULL;
-  if (deserialize_message(packet, &message))
+  record_packet_metrics(&g_protocol_packets_received_metric, &g_protocol_packet_received_bytes_metric, packet->id, packet->size);
+  if (packet->id == PKT_TYPE_COMPRESSED_PACKET)
+  {
+    if ((net_connection->capabilities & PROTOCOL_CAPABILITY_COMPRESSION) == 0)
+    {
+      LOG_DEBUG("Got compressed packet from peer which did not negotiate compression!");
+      return 1;
+    }
+
+    packet_t *decompressed_packet = NULL;
+    if (decompress_packet(packet, &decompressed_packet))
+    {
+      LOG_DEBUG("Failed to decompress packet of size: %u!", packet->size);
+      return 1;
+    }
+
+    int result = handle_receive_packet(net_connection, decompressed_packet);
+    free_packet(decompressed_packet);
+    return result;
+  }
+
+  // the message is decoded onto the stack, only the data it points to is allocated
+  protocol_message_t message;
+  if (decode_message(packet, get_net_connection_encoding_version(net_connection), &message))
   {
     return 1;
   }
 
-  assert(message != NULL);
   if (can_packet_be_processed(net_connection, packet->id) == 0)
   {
-    free_message(packet->id, 1, message);
+    release_message(packet->id, 1, &message);
     return 1;
   }
 
   int result = 0;
   if (net_connection->anonymous)
   {
-    result = handle_packet_anonymous(net_connection, packet->id, message);
+    result = handle_packet_anonymous(net_connection, packet->id, &message);
   }
   else
   {
-    result = handle_packet(net_connection, packet->id, message);
+    result = handle_packet(net_connection, packet->id, &message);
   }
 
-  free_message(packet->id, result, message);
+  release_message(packet->id, result, &message);
   return result;
 }
 
-int handle_send_packet(net_connection_t *net_connection, int broadcast, uint32_t packet_id, va_list args)
+/*
+ * Sends a packet encoded in place into the buffer, the buffer becomes the payload
+ * of the send queues it ends up in and is owned by them from here on, even on failure.
+ */
+static int send_packet_buffer(net_connection_t *net_connection, int broadcast, buffer_t *buffer)
 {
-  packet_t *packet = NULL;
-  if (serialize_message(&packet, packet_id, args))
-  {
-    return 1;
-  }
+  assert(buffer != NULL);
+  assert(buffer_get_size(buffer) >= PACKET_HEADER_SIZE);
 
-  assert(packet != NULL);
-  buffer_t *buffer = buffer_init();
-  if (serialize_packet(buffer, packet))
+  uint32_t packet_id = 0;
+  memcpy(&packet_id, buffer_get_data(buffer), sizeof(uint32_t));
+  packet_id = swap_le(packet_id);
+
+  uint32_t packet_size = (uint32_t)(buffer_get_size(buffer) - PACKET_HEADER_SIZE);
+  if (finish_packet_buffer(buffer))
   {
-    free_packet(packet);
     buffer_free(buffer);
     return 1;
   }
 
-  free_packet(packet);
-  const uint8_t *data = buffer_get_data(buffer);
-  size_t data_len = buffer_get_size(buffer);
+  record_packet_metrics(&g_protocol_packets_sent_metric, &g_protocol_packet_sent_bytes_metric, packet_id, packet_size);
+
+  // large packets are compressed for peers which negotiated compression, a broadcast
+  // is shared by the send queues of all of our peers so it's always sent as is...
+  if (broadcast == 0 && packet_size >= COMPRESSED_PACKET_MIN_SIZE &&
+      (net_connection->capabilities & PROTOCOL_CAPABILITY_COMPRESSION))
+  {
+    buffer_t *compressed_buffer = NULL;
+    if (compress_packet_buffer(buffer, packet_id, packet_size, &compressed_buffer) == 0)
+    {
+      buffer_free(buffer);
+      buffer = compressed_buffer;
+    }
+  }
 
+  // the packet is serialized once, every send queue it ends up in shares it
+  net_payload_t *payload = make_net_payload(buffer);
   int result = 0;
   if (broadcast)
   {
-    result = broadcast_data(net_connection, data, data_len);
+    result = broadcast_payload(net_connection, payload);
   }
   else
   {
-    result = send_data(net_connection, data, data_len);
+    result = send_payload(net_connection, payload);
   }
 
-  buffer_free(buffer);
+  release_net_payload(payload);
   return result;
 }
 
+int handle_send_packet(net_connection_t *net_connection, int broadcast, uint32_t packet_id, va_list args)
+{
+  buffer_t *buffer = init_packet_buffer(packet_id);
+  if (buffer == NULL)
+  {
+    return 1;
+  }
+
+  if (encode_message(buffer, broadcast ? ENCODING_VERSION_1 : get_net_connection_encoding_version(net_connection), packet_id, args))
+  {
+    buffer_free(buffer);
+    return 1;
+  }
+
+  return send_packet_buffer(net_connection, broadcast, buffer);
+}
+
+/*
+ * Sends a message that was already serialized by the caller, used for forwarding
+ * stored data as is rather than deserializing it only to serialize it again.
+ */
+int handle_packet_sendto_serialized(net_connection_t *net_connection, uint32_t packet_id, const uint8_t *data, size_t size)
+{
+  assert(net_connection != NULL);
+  assert(data != NULL || size == 0);
+  assert(size <= UINT32_MAX);
+
+  buffer_t *buffer = init_packet_buffer(packet_id);
+  if (buffer == NULL)
+  {
+    return 1;
+  }
+
+  if (size > 0 && buffer_write(buffer, data, size))
+  {
+    buffer_free(buffer);
+    return 1;
+  }
+
+  return send_packet_buffer(net_connection, 0, buffer);
+}
+
+/*
+ * Sends a packet started with init_packet_buffer and encoded by one of
+ * the typed encoders, the buffer is owned by the send from here on.
+ */
+int handle_packet_sendto_buffer(net_connection_t *net_connection, buffer_t *buffer)
+{
+  assert(net_connection != NULL);
+  return send_packet_buffer(net_connection, 0, buffer);
+}
+
+int handle_packet_broadcast_buffer(buffer_t *buffer)
+{
+  return send_packet_buffer(NULL, 1, buffer);
+}
+
 int handle_packet_sendto(net_connection_t *net_connection, uint32_t packet_id, ...)
 {
   assert(net_connection != NULL);
@@ -2362,7 +5683,12 @@ int handle_packet_broadcast(uint32_t packet_id, ...)
 task_result_t resync_chain(task_t *task, va_list args)
 {
   assert(task != NULL);
-  if (g_protocol_sync_entry.sync_initiated)
+  if (g_protocol_sync_entry.sync_initiated && g_protocol_sync_entry.is_header_first_sync &&
+      g_protocol_sync_entry.sync_start_height != -1)
+  {
+    resync_download_window();
+  }
+  else if (g_protocol_sync_entry.sync_initiated)
   {
     uint32_t current_time = get_current_time();
     if (current_time - g_protocol_sync_entry.last_sync_ts > RESYNC_BLOCK_REQUEST_DELAY)
@@ -2376,3 +5702,92 @@ task_result_t resync_chain(task_t *task, va_list args)
   assert(handle_packet_broadcast(PKT_TYPE_GET_BLOCK_HEIGHT_REQ) == 0);
   return TASK_RESULT_WAIT;
 }
+
+/*
+ * Measures the round trip time of each of our peers which answer pings, a peer which
+ * does not answer our ping in time is penalized the same way as a timed out request.
+ */
+task_result_t ping_peers(task_t *task, va_list args)
+{
+  assert(task != NULL);
+  uint64_t current_time_ms = get_current_time_ms();
+
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    // the ping of a paused peer would only measure the time spent in it's send queue
+    assert(net_connections[i] != NULL);
+    peer_t *peer = get_peer_from_net_connection(net_connections[i]);
+    if (peer == NULL || is_net_connection_send_paused(net_connections[i]) ||
+        (net_connections[i]->capabilities & PROTOCOL_CAPABILITY_PING) == 0)
+    {
+      continue;
+    }
+
+    if (peer->ping_pending)
+    {
+      if (current_time_ms - peer->ping_ts_ms <= (uint64_t)PEER_PING_TIMEOUT * 1000)
+      {
+        continue;
+      }
+
+      peer->ping_pending = 0;
+      record_peer_failure(peer);
+    }
+
+    peer->ping_nonce++;
+    peer->ping_ts_ms = current_time_ms;
+    if (send_ping_request(net_connections[i], peer->ping_nonce) == 0)
+    {
+      peer->ping_pending = 1;
+    }
+  }
+
+  return TASK_RESULT_WAIT;
+}
+
+task_result_t relay_inventory(task_t *task, va_list args)
+{
+  assert(task != NULL);
+
+  // the txs admitted by the mempool ingress are announced to every peer but the one
+  // which sent it to us, that peer's connection might be gone by now so it is only compared...
+  uint8_t tx_ids[MAX_INVENTORY_TX_IDS_COUNT * HASH_SIZE];
+  const void *sources[MAX_INVENTORY_TX_IDS_COUNT];
+  uint32_t num_tx_ids = 0;
+  while ((num_tx_ids = take_admitted_mempool_ingress_txs(tx_ids, sources, MAX_INVENTORY_TX_IDS_COUNT)) > 0)
+  {
+    for (uint32_t i = 0; i < num_tx_ids; i++)
+    {
+      announce_transaction_id((net_connection_t*)sources[i], tx_ids + (i * HASH_SIZE));
+    }
+  }
+
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    // the announcements for a paused peer stay queued until it resumes
+    assert(net_connections[i] != NULL);
+    if (is_net_connection_send_paused(net_connections[i]) == 0)
+    {
+      flush_inventory(net_connections[i]);
+    }
+  }
+
+  return TASK_RESULT_WAIT;
+}
+
+task_result_t request_missing_block_filters(task_t *task, va_list args)
+{
+  assert(task != NULL);
+
+  // the filters of the blocks we are still syncing are built as they are inserted
+  if (g_protocol_sync_entry.sync_initiated == 0)
+  {
+    request_block_filters();
+  }
+
+  return TASK_RESULT_WAIT;
+}
@@ -30,6 +30,7 @@
 #include <stdarg.h>
 
 #include <deque.h>
+#include <hashtable.h>
 
 #include "common/task.h"
 #include "common/vulkan.h"
@@ -37,13 +38,85 @@
 #include "block.h"
 #include "transaction.h"
 #include "net.h"
+#include "parameters.h"
 
 VULKAN_BEGIN_DECL
 
+#define MAX_PACKET_SIZE (MAX_BLOCK_SIZE + (1024 * 1024))
+
 #define RESYNC_CHAIN_TASK_DELAY 2
 #define RESYNC_BLOCK_REQUEST_DELAY 10
 #define RESYNC_BLOCK_MAX_TRIES 5
 
+// the block heights reported by our peers are only considered when picking
+// a peer to sync from if they were reported within this many seconds...
+#define SYNC_PEER_BLOCK_HEIGHT_TIMEOUT (RESYNC_CHAIN_TASK_DELAY * 5)
+
+// the number of full blocks requested ahead of the block being committed
+// during a header-first sync, requests are spread across all of our peers...
+#define SYNC_BLOCK_DOWNLOAD_WINDOW_SIZE 32
+
+// more headers are requested once fewer than this many are queued
+#define SYNC_PENDING_HEADERS_LOW_WATERMARK (SYNC_BLOCK_DOWNLOAD_WINDOW_SIZE * 4)
+
+// blocks this close to the sync height are requested as compact blocks first,
+// older blocks are unlikely to have any of their txs left in our mempool...
+#define COMPACT_BLOCK_MAX_SYNC_DISTANCE 16
+
+// txs are announced to our peers by id in batches, the bodies
+// are only sent to the peers which ask for them...
+#define RELAY_INVENTORY_TASK_DELAY 0.1
+#define MAX_INVENTORY_TX_IDS_COUNT 512
+
+// the filters of the blocks we have no filter for are requested from one peer at a
+// time, a request which was not answered in time is sent to the next peer instead...
+#define REQUEST_BLOCK_FILTERS_TASK_DELAY 5
+#define BLOCK_FILTERS_REQUEST_TIMEOUT 30
+
+// the number of tx ids remembered per peer, the oldest are forgotten first
+#define MAX_KNOWN_INVENTORY_SIZE 4096
+
+// an announced tx is only requested from one peer at a time, the next peer announcing
+// it is asked for it once the request has been in flight for this long in seconds...
+#define TX_INVENTORY_REQUEST_TIMEOUT 10
+
+// peers running at least this version send their grouped blocks budget and capabilities
+// when establishing the connection, legacy peers reject a handshake with them...
+#define PROTOCOL_HANDSHAKE_EXTENSIONS_VERSION "1.1.0"
+
+// optional features negotiated with the peer when establishing the connection,
+// a feature is only used when both sides of the connection support it...
+#define PROTOCOL_CAPABILITY_COMPRESSION (1 << 0)
+
+// advertised by pruned peers, a pruned peer only serves the blocks within
+// PRUNE_MIN_BLOCK_DEPTH of it's top block and is not negotiated...
+#define PROTOCOL_CAPABILITY_PRUNED (1 << 1)
+
+// advertised by peers which build block filters, the filters of blocks inserted
+// before the peer enabled them are not served...
+#define PROTOCOL_CAPABILITY_BLOCK_FILTERS (1 << 2)
+
+// the txs and blocks of mempool tx and compact block messages are sent in the v2
+// encoding, blocks forwarded as they are stored are always sent in the v1 encoding...
+#define PROTOCOL_CAPABILITY_ENCODING_V2 (1 << 3)
+
+// advertised by peers which answer ping requests, the peers which do not advertise it
+// predate pings and are never pinged or penalized for not answering one...
+#define PROTOCOL_CAPABILITY_PING (1 << 4)
+
+// advertised by peers which announce txs by their id, the peers which do not
+// advertise it predate inventories and are still sent every tx in full...
+#define PROTOCOL_CAPABILITY_TX_INVENTORY (1 << 5)
+
+// a block filters response stops early once it's filters reach the size budget
+#define MAX_BLOCK_FILTERS_COUNT 1000
+#define MAX_BLOCK_FILTERS_RESPONSE_SIZE (1024 * 1024 * 4)
+
+// packets sent to a single peer at least this large are compressed, a compressed
+// packet holds the id and size of the original packet ahead of it's compressed payload...
+#define COMPRESSED_PACKET_MIN_SIZE 1024
+#define COMPRESSED_PACKET_HEADER_SIZE 8
+
 enum
 {
   PKT_TYPE_UNKNOWN = 0,
@@ -86,9 +159,43 @@ enum
   PKT_TYPE_GET_BLOCK_TRANSACTION_BY_INDEX_RESP,
 
   PKT_TYPE_INCOMING_MEMPOOL_TRANSACTION,
+
+  /* Header-first sync: */
+  PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_REQ,
+  PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP,
+
+  PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ,
+  PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP,
+
+  /* Light clients: */
+  PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_REQ,
+  PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP,
+
+  /* Compact blocks: */
+  PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_REQ,
+  PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP,
+
+  PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_REQ,
+  PKT_TYPE_GET_COMPACT_BLOCK_TRANSACTIONS_RESP,
+
+  /* Transaction relay: */
+  PKT_TYPE_TRANSACTION_INVENTORY,
+  PKT_TYPE_GET_TRANSACTIONS_BY_ID_REQ,
+
+  /* Compression: */
+  PKT_TYPE_COMPRESSED_PACKET,
+
+  // the packet ids are sent on the wire, new packet types are always
+  // appended here so the ids of the existing packet types never change...
+
+  /* Block filters: */
+  PKT_TYPE_GET_BLOCK_FILTERS_REQ,
+  PKT_TYPE_GET_BLOCK_FILTERS_RESP,
 };
 
-typedef struct
+#define NUM_PKT_TYPES (PKT_TYPE_GET_BLOCK_FILTERS_RESP + 1)
+
+typedef struct Packet
 {
   uint32_t id;
   uint32_t size;
@@ -101,21 +208,24 @@ typedef struct
   char *version_number;
   char *version_name;
   uint8_t use_testnet;
+  uint32_t grouped_blocks_budget_size;
+  uint32_t capabilities;
 } connect_establish_req_t;
 
 typedef struct
 {
-
+  uint32_t grouped_blocks_budget_size;
+  uint32_t capabilities;
 } connect_establish_resp_t;
 
 typedef struct
 {
-
+  uint64_t nonce;
 } connect_ping_req_t;
 
 typedef struct
 {
-
+  uint64_t nonce;
 } connect_ping_resp_t;
 
 typedef struct
@@ -172,9 +282,22 @@ typedef struct
   block_t *block;
 } get_block_by_height_response_t;
 
+typedef struct
+{
+  uint8_t *hash;
+  uint8_t include_transactions;
+} get_grouped_blocks_from_hash_request_t;
+
+typedef struct
+{
+  uint32_t block_data_size;
+  uint8_t *block_data;
+} get_grouped_blocks_from_hash_response_t;
+
 typedef struct
 {
   uint32_t height;
+  uint8_t include_transactions;
 } get_grouped_blocks_from_height_request_t;
 
 typedef struct
@@ -220,18 +343,181 @@ typedef struct
   transaction_t *transaction;
 } get_block_transaction_by_index_response_t;
 
+typedef struct
+{
+  uint32_t height;
+} get_block_headers_from_height_request_t;
+
+typedef struct
+{
+  uint32_t height;
+  uint32_t headers_count;
+  uint32_t header_data_size;
+  uint8_t *header_data;
+} get_block_headers_from_height_response_t;
+
+typedef struct
+{
+  uint8_t *hash;
+} get_full_block_by_hash_request_t;
+
+typedef struct
+{
+  block_t *block;
+} get_full_block_by_hash_response_t;
+
+typedef struct
+{
+  uint8_t *tx_id;
+} get_transaction_merkle_branch_request_t;
+
+typedef struct
+{
+  block_t *block;
+  uint32_t tx_index;
+  transaction_t *transaction;
+  uint32_t branch_length;
+  uint8_t *branch;
+} get_transaction_merkle_branch_response_t;
+
+typedef struct
+{
+  uint32_t height;
+  uint32_t count;
+} get_block_filters_request_t;
+
+// the filter data is the hash of each block followed by it's filter
+typedef struct
+{
+  uint32_t height;
+  uint32_t filters_count;
+  uint32_t filter_data_size;
+  uint8_t *filter_data;
+} get_block_filters_response_t;
+
+typedef struct
+{
+  uint8_t *hash;
+} get_compact_block_by_hash_request_t;
+
+typedef struct
+{
+  block_t *block;
+  uint8_t *short_ids;
+} get_compact_block_by_hash_response_t;
+
+typedef struct
+{
+  uint8_t *hash;
+  uint32_t tx_indexes_count;
+  uint32_t *tx_indexes;
+} get_compact_block_transactions_request_t;
+
+typedef struct
+{
+  uint8_t *hash;
+  uint32_t transactions_count;
+  transaction_t **transactions;
+} get_compact_block_transactions_response_t;
+
+typedef struct
+{
+  uint32_t tx_ids_count;
+  uint8_t *tx_ids;
+} transaction_inventory_t;
+
+typedef struct
+{
+  uint32_t tx_ids_count;
+  uint8_t *tx_ids;
+} get_transactions_by_id_request_t;
+
+// a received message is decoded into storage provided by the caller, large enough
+// to hold any of the messages above so that decoding does not allocate the message...
+typedef union
+{
+  connect_establish_req_t connect_establish_req;
+  connect_establish_resp_t connect_establish_resp;
+  connect_ping_req_t connect_ping_req;
+  connect_ping_resp_t connect_ping_resp;
+  get_peerlist_req_t get_peerlist_req;
+  get_peerlist_resp_t get_peerlist_resp;
+  incoming_mempool_transaction_t incoming_mempool_transaction;
+  get_block_height_request_t get_block_height_request;
+  get_block_height_response_t get_block_height_response;
+  get_block_by_hash_request_t get_block_by_hash_request;
+  get_block_by_hash_response_t get_block_by_hash_response;
+  get_block_by_height_request_t get_block_by_height_request;
+  get_block_by_height_response_t get_block_by_height_response;
+  get_grouped_blocks_from_hash_request_t get_grouped_blocks_from_hash_request;
+  get_grouped_blocks_from_hash_response_t get_grouped_blocks_from_hash_response;
+  get_grouped_blocks_from_height_request_t get_grouped_blocks_from_height_request;
+  get_grouped_blocks_from_height_response_t get_grouped_blocks_from_height_response;
+  get_block_num_transactions_request_t get_block_num_transactions_request;
+  get_block_num_transactions_response_t get_block_num_transactions_response;
+  get_block_transaction_by_hash_request_t get_block_transaction_by_hash_request;
+  get_block_transaction_by_hash_response_t get_block_transaction_by_hash_response;
+  get_block_transaction_by_index_request_t get_block_transaction_by_index_request;
+  get_block_transaction_by_index_response_t get_block_transaction_by_index_response;
+  get_block_headers_from_height_request_t get_block_headers_from_height_request;
+  get_block_headers_from_height_response_t get_block_headers_from_height_response;
+  get_full_block_by_hash_request_t get_full_block_by_hash_request;
+  get_full_block_by_hash_response_t get_full_block_by_hash_response;
+  get_transaction_merkle_branch_request_t get_transaction_merkle_branch_request;
+  get_transaction_merkle_branch_response_t get_transaction_merkle_branch_response;
+  get_block_filters_request_t get_block_filters_request;
+  get_block_filters_response_t get_block_filters_response;
+  get_compact_block_by_hash_request_t get_compact_block_by_hash_request;
+  get_compact_block_by_hash_response_t get_compact_block_by_hash_response;
+  get_compact_block_transactions_request_t get_compact_block_transactions_request;
+  get_compact_block_transactions_response_t get_compact_block_transactions_response;
+  transaction_inventory_t transaction_inventory;
+  get_transactions_by_id_request_t get_transactions_by_id_request;
+} protocol_message_t;
+
+typedef struct Inventory
+{
+  // the known tx ids are stored in a ring, the table's keys
+  // point into the ring so the oldest id can be evicted in place...
+  HashTable *known_tx_ids;
+  uint8_t *known_tx_ids_ring;
+  uint32_t known_tx_ids_next;
+  uint32_t known_tx_ids_count;
+
+  uint8_t *pending_tx_ids;
+  uint32_t pending_tx_ids_count;
+} inventory_t;
+
+typedef struct SyncBlockDownload
+{
+  block_t *block;
+  uint32_t height;
+  int received;
+
+  net_connection_t *net_connection;
+  uint32_t request_ts;
+  uint64_t request_ts_ms;
+  uint8_t request_tries;
+
+  // a compact block waiting on the txs we could not find in our mempool,
+  // the missing txs are stored as NULL until they are received...
+  block_t *compact_block;
+  uint32_t compact_block_num_missing_txs;
+} sync_block_download_t;
+
 typedef struct SyncEntry
 {
   net_connection_t *net_connection;
 
   int sync_initiated;
-  int sync_did_backup_blockchain;
+  int sync_did_begin_reorg;
   int sync_finding_top_block;
   block_t *sync_pending_block;
   uint32_t sync_height;
   int32_t sync_start_height;
 
   int is_syncing_grouped_blocks;
+  int sync_grouped_blocks_include_transactions;
   Deque *sync_pending_blocks;
   size_t sync_pending_blocks_count;
 
@@ -244,16 +530,61 @@ typedef struct SyncEntry
   int32_t last_tx_sync_index;
   uint32_t last_tx_sync_ts;
   uint8_t last_tx_sync_tries;
+
+  // header-first sync, headers are queued in sync_pending_blocks
+  // and moved into the download window as it frees up...
+  int is_header_first_sync;
+  uint32_t sync_header_height;
+  uint8_t sync_header_hash[HASH_SIZE];
+  uint32_t sync_assume_valid_height; // the highest checkpoint our received headers lead up to
+  int sync_headers_requested;
+  uint32_t last_sync_headers_ts;
+  uint8_t last_sync_headers_tries;
+
+  sync_block_download_t sync_download_window[SYNC_BLOCK_DOWNLOAD_WINDOW_SIZE];
+  uint32_t sync_download_window_start;
+  uint32_t sync_download_window_count;
 } sync_entry_t;
 
 VULKAN_API void set_force_version_check(int force_version_check);
 VULKAN_API int get_force_version_check(void);
 
+VULKAN_API void set_header_first_sync(int header_first_sync);
+VULKAN_API int get_header_first_sync(void);
+
+VULKAN_API void set_grouped_blocks_budget_size(uint32_t grouped_blocks_budget_size);
+VULKAN_API uint32_t get_grouped_blocks_budget_size(void);
+
+VULKAN_API void register_protocol_metrics(void);
+
+VULKAN_API void set_packet_compression(int packet_compression);
+VULKAN_API int get_packet_compression(void);
+VULKAN_API void set_compact_encoding(int compact_encoding);
+VULKAN_API int get_compact_encoding(void);
+VULKAN_API int compare_version_numbers(const char *version_number, const char *other_version_number);
+VULKAN_API uint32_t get_protocol_capabilities(void);
+VULKAN_API encoding_version_t get_net_connection_encoding_version(net_connection_t *net_connection);
+
 VULKAN_API packet_t* make_packet(void);
 VULKAN_API int serialize_packet(buffer_t *buffer, packet_t *packet);
 VULKAN_API int deserialize_packet(packet_t *packet, buffer_iterator_t *buffer_iterator);
+VULKAN_API int deserialize_packet_header(packet_t *packet, const uint8_t *header, size_t header_size);
 VULKAN_API void free_packet(packet_t *packet);
 
+VULKAN_API int compress_packet(packet_t *packet, packet_t **compressed_packet_out);
+VULKAN_API int decompress_packet(packet_t *compressed_packet, packet_t **packet_out);
+
+VULKAN_API buffer_t* init_packet_buffer(uint32_t packet_id);
+VULKAN_API int finish_packet_buffer(buffer_t *buffer);
+
+VULKAN_API int encode_ping_message(buffer_t *buffer, uint64_t nonce);
+VULKAN_API int encode_hash_message(buffer_t *buffer, const uint8_t *hash);
+VULKAN_API int encode_tx_ids_message(buffer_t *buffer, uint32_t tx_ids_count, const uint8_t *tx_ids);
+VULKAN_API int encode_message(buffer_t *buffer, encoding_version_t encoding_version, uint32_t packet_id, va_list args);
+
+VULKAN_API int decode_message(packet_t *packet, encoding_version_t encoding_version, protocol_message_t *message);
+VULKAN_API void release_message(uint32_t packet_id, int did_packet_fail, protocol_message_t *message_object);
+
 VULKAN_API int serialize_message(packet_t **packet, uint32_t packet_id, va_list args);
 VULKAN_API int deserialize_message(packet_t *packet, void **message);
 VULKAN_API void free_message(uint32_t packet_id, int did_packet_fail, void *message_object);
@@ -275,24 +606,67 @@ VULKAN_API int check_sync_status(int force_sync_complete);
 VULKAN_API int request_sync_block(net_connection_t *net_connection, uint32_t height, uint8_t *hash);
 VULKAN_API int request_sync_next_block(net_connection_t *net_connection);
 VULKAN_API int request_sync_previous_block(net_connection_t *net_connection);
+VULKAN_API int request_sync_grouped_blocks(net_connection_t *net_connection, uint32_t height);
 
 VULKAN_API int request_sync_transaction(net_connection_t *net_connection, uint8_t *block_hash, uint32_t tx_index, uint8_t *tx_hash);
 VULKAN_API int request_sync_next_transaction(net_connection_t *net_connection);
 
+VULKAN_API int request_sync_from_start_height(net_connection_t *net_connection);
+VULKAN_API int request_sync_headers(void);
+VULKAN_API int request_sync_full_block(sync_block_download_t *download, net_connection_t *net_connection);
+VULKAN_API int fill_sync_download_window(void);
+VULKAN_API int commit_sync_download_window(void);
+VULKAN_API int resync_download_window(void);
+VULKAN_API void handle_sync_peer_closed(net_connection_t *net_connection);
+
+VULKAN_API int block_headers_received(net_connection_t *net_connection, uint32_t height, uint32_t headers_count, buffer_iterator_t *buffer_iterator);
+VULKAN_API int full_block_received(net_connection_t *net_connection, block_t *block);
+VULKAN_API int send_compact_block_transactions(net_connection_t *net_connection, block_t *block, uint32_t tx_indexes_count, uint32_t *tx_indexes);
+VULKAN_API int compact_block_received(net_connection_t *net_connection, block_t *block, uint8_t *short_ids);
+VULKAN_API int compact_block_transactions_received(net_connection_t *net_connection, uint8_t *hash, uint32_t transactions_count, transaction_t **transactions);
+
 VULKAN_API int block_header_received(net_connection_t *net_connection, block_t *block);
 VULKAN_API int block_header_sync_complete(net_connection_t *net_connection, block_t *block);
+VULKAN_API int send_grouped_blocks(net_connection_t *net_connection, uint32_t packet_id, uint32_t start_height, int include_transactions);
+VULKAN_API int grouped_blocks_received(net_connection_t *net_connection, uint8_t *block_data, uint32_t block_data_size);
+VULKAN_API int send_transaction_merkle_branch(net_connection_t *net_connection, block_t *block, uint8_t *tx_id);
+VULKAN_API int transaction_merkle_branch_received(net_connection_t *net_connection, block_t *block, transaction_t *transaction, uint32_t tx_index, uint8_t *branch, uint32_t branch_length);
+VULKAN_API int request_block_filters(void);
+VULKAN_API void clear_block_filters_request(void);
+VULKAN_API int send_block_filters(net_connection_t *net_connection, uint32_t height, uint32_t count);
+VULKAN_API int block_filters_received(net_connection_t *net_connection, uint32_t height, uint32_t filters_count, buffer_iterator_t *buffer_iterator);
 VULKAN_API int transaction_received(net_connection_t *net_connection, transaction_t *transaction, uint32_t tx_index);
-VULKAN_API int backup_blockchain_and_rollback(void);
-
+VULKAN_API int begin_blockchain_reorg_for_resync(void);
+
+VULKAN_API inventory_t* make_inventory(void);
+VULKAN_API void free_inventory(inventory_t *inventory);
+VULKAN_API int has_known_inventory(inventory_t *inventory, const uint8_t *tx_id);
+VULKAN_API int add_known_inventory(inventory_t *inventory, const uint8_t *tx_id);
+
+VULKAN_API int flush_inventory(net_connection_t *net_connection);
+VULKAN_API int announce_transaction_id(net_connection_t *net_connection, uint8_t *tx_id);
+VULKAN_API int announce_transaction(net_connection_t *net_connection, transaction_t *transaction);
+VULKAN_API int request_transaction_id(const uint8_t *tx_id, uint64_t current_time_ms);
+VULKAN_API void clear_requested_transaction_ids(void);
+VULKAN_API int transaction_inventory_received(net_connection_t *net_connection, uint32_t tx_ids_count, uint8_t *tx_ids);
+VULKAN_API int send_transactions_by_id(net_connection_t *net_connection, uint32_t tx_ids_count, uint8_t *tx_ids);
+
+VULKAN_API int is_data_request_packet(uint32_t packet_id);
 VULKAN_API int can_packet_be_processed(net_connection_t *net_connection, uint32_t packet_id);
 VULKAN_API int handle_packet_anonymous(net_connection_t *net_connection, uint32_t packet_id, void *message_object);
 VULKAN_API int handle_packet(net_connection_t *net_connection, uint32_t packet_id, void *message_object);
 VULKAN_API int handle_receive_packet(net_connection_t *net_connection, packet_t *packet);
 
 VULKAN_API int handle_send_packet(net_connection_t *net_connection, int broadcast, uint32_t packet_id, va_list args);
+VULKAN_API int handle_packet_sendto_buffer(net_connection_t *net_connection, buffer_t *buffer);
+VULKAN_API int handle_packet_broadcast_buffer(buffer_t *buffer);
+VULKAN_API int handle_packet_sendto_serialized(net_connection_t *net_connection, uint32_t packet_id, const uint8_t *data, size_t size);
 VULKAN_API int handle_packet_sendto(net_connection_t *net_connection, uint32_t packet_id, ...);
 VULKAN_API int handle_packet_broadcast(uint32_t packet_id, ...);
 
 task_result_t resync_chain(task_t *task, va_list args);
+task_result_t relay_inventory(task_t *task, va_list args);
+task_result_t request_missing_block_filters(task_t *task, va_list args);
+task_result_t ping_peers(task_t *task, va_list args);
 
 VULKAN_END_DECL
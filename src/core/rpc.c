@@ -0,0 +1,1022 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "common/buffer.h"
+#include "common/json.h"
+#include "common/logger.h"
+#include "common/metrics.h"
+#include "common/task.h"
+#include "common/tinycthread.h"
+#include "common/util.h"
+#include "common/vec.h"
+
+#include "block.h"
+#include "blockchain.h"
+#include "mempool.h"
+#include "net.h"
+#include "p2p.h"
+#include "parameters.h"
+#include "rpc.h"
+#include "transaction.h"
+
+typedef struct RpcError
+{
+  int code;
+  const char *message;
+} rpc_error_t;
+
+typedef int (*rpc_method_func_t)(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+
+typedef struct RpcMethod
+{
+  const char *name;
+  rpc_method_func_t func;
+} rpc_method_t;
+
+static int g_rpc_server_running = 0;
+static const char *g_rpc_bind_address = RPC_DEFAULT_BIND_ADDRESS;
+static uint16_t g_rpc_port = 0;
+static struct mg_connection *g_rpc_listener = NULL;
+
+// the jobs wake the network loop up through a socket pair once they complete, so their
+// responses are sent right away instead of on the loop's next poll. At most one wake up
+// is ever pending, so writing it can never block the job...
+static sock_t g_rpc_wake_socks[2] = {INVALID_SOCKET, INVALID_SOCKET};
+static struct mg_connection *g_rpc_wake_connection = NULL;
+static atomic_int g_rpc_wake_pending = 0;
+
+// the clients are only touched on the main network loop, the requests handled
+// on the schedulers are handed back through the completed requests...
+static vec_void_t g_rpc_clients;
+static vec_void_t g_rpc_completed_requests;
+static mtx_t g_rpc_lock;
+static job_group_t g_rpc_job_group;
+
+static int rpc_get_height(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+static int rpc_get_block(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+static int rpc_get_transaction(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+static int rpc_get_balance(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+static int rpc_get_mempool(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+static int rpc_get_peers(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+static int rpc_get_utxo_commitment(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error);
+
+static const rpc_method_t g_rpc_methods[] = {
+  {"get_height", rpc_get_height},
+  {"get_block", rpc_get_block},
+  {"get_transaction", rpc_get_transaction},
+  {"get_balance", rpc_get_balance},
+  {"get_mempool", rpc_get_mempool},
+  {"get_peers", rpc_get_peers},
+  {"get_utxo_commitment", rpc_get_utxo_commitment}
+};
+
+#define NUM_RPC_METHODS (sizeof(g_rpc_methods) / sizeof(rpc_method_t))
+
+void set_rpc_bind_address(const char *bind_address)
+{
+  g_rpc_bind_address = bind_address;
+}
+
+const char* get_rpc_bind_address(void)
+{
+  return g_rpc_bind_address;
+}
+
+void set_rpc_port(uint16_t port)
+{
+  g_rpc_port = port;
+}
+
+uint16_t get_rpc_port(void)
+{
+  return g_rpc_port;
+}
+
+int get_is_rpc_server_running(void)
+{
+  return g_rpc_server_running;
+}
+
+uint32_t get_rpc_server_num_clients(void)
+{
+  return g_rpc_server_running ? (uint32_t)g_rpc_clients.length : 0;
+}
+
+static int set_rpc_error(rpc_error_t *error, int code, const char *message)
+{
+  assert(error != NULL);
+  error->code = code;
+  error->message = message;
+  return 1;
+}
+
+/*
+ * Returns the param at the index of positional params, or the named param of named params.
+ */
+static json_value_t* get_rpc_param(json_value_t *params, size_t index, const char *name)
+{
+  if (params == NULL)
+  {
+    return NULL;
+  }
+
+  if (params->type == JSON_TYPE_ARRAY)
+  {
+    return index < params->num_values ? params->values[index] : NULL;
+  }
+
+  return get_json_object_value(params, name);
+}
+
+static int get_rpc_hash_param(json_value_t *param, uint8_t *hash, size_t hash_size)
+{
+  if (param == NULL || param->type != JSON_TYPE_STRING || param->string_size != hash_size * 2)
+  {
+    return 1;
+  }
+
+  size_t size = 0;
+  uint8_t *data = hex2bin(param->string, &size);
+  if (data == NULL || size != hash_size)
+  {
+    free(data);
+    return 1;
+  }
+
+  memcpy(hash, data, hash_size);
+  free(data);
+  return 0;
+}
+
+static int write_rpc_transaction(buffer_t *buffer, transaction_t *tx)
+{
+  assert(tx != NULL);
+  json_write_raw(buffer, "{\"id\":", 6);
+  json_write_hex(buffer, tx->id, HASH_SIZE);
+  json_write_raw(buffer, ",\"txins\":[", 10);
+  for (uint32_t i = 0; i < tx->txin_count; i++)
+  {
+    input_transaction_t *txin = tx->txins[i];
+    assert(txin != NULL);
+    if (i > 0)
+    {
+      json_write_raw(buffer, ",", 1);
+    }
+
+    json_write_raw(buffer, "{\"transaction\":", 15);
+    json_write_hex(buffer, txin->transaction, HASH_SIZE);
+    json_write_format(buffer, ",\"txout_index\":%u,\"public_key\":", txin->txout_index);
+    json_write_hex(buffer, txin->public_key, crypto_sign_PUBLICKEYBYTES);
+    json_write_raw(buffer, ",\"signature\":", 13);
+    json_write_hex(buffer, txin->signature, crypto_sign_BYTES);
+    json_write_raw(buffer, "}", 1);
+  }
+
+  json_write_raw(buffer, "],\"txouts\":[", 12);
+  for (uint32_t i = 0; i < tx->txout_count; i++)
+  {
+    output_transaction_t *txout = tx->txouts[i];
+    assert(txout != NULL);
+    if (i > 0)
+    {
+      json_write_raw(buffer, ",", 1);
+    }
+
+    json_write_format(buffer, "{\"amount\":%llu,\"address\":", (unsigned long long)txout->amount);
+    json_write_hex(buffer, txout->address, ADDRESS_SIZE);
+    json_write_raw(buffer, "}", 1);
+  }
+
+  return json_write_raw(buffer, "]}", 2);
+}
+
+static int write_rpc_block(buffer_t *buffer, block_t *block, int include_transactions)
+{
+  assert(block != NULL);
+  json_write_raw(buffer, "{\"hash\":", 8);
+  json_write_hex(buffer, block->hash, HASH_SIZE);
+  json_write_raw(buffer, ",\"previous_hash\":", 17);
+  json_write_hex(buffer, block->previous_hash, HASH_SIZE);
+  json_write_raw(buffer, ",\"merkle_root\":", 15);
+  json_write_hex(buffer, block->merkle_root, HASH_SIZE);
+  json_write_format(buffer, ",\"version\":%u,\"timestamp\":%u,\"nonce\":%u,\"bits\":%u,\"cumulative_emission\":%llu",
+    block->version, block->timestamp, block->nonce, block->bits, (unsigned long long)block->cumulative_emission);
+  json_write_format(buffer, ",\"transaction_count\":%u,\"transactions\":[", block->transaction_count);
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
+    if (i > 0)
+    {
+      json_write_raw(buffer, ",", 1);
+    }
+
+    if (include_transactions)
+    {
+      write_rpc_transaction(buffer, tx);
+    }
+    else
+    {
+      json_write_hex(buffer, tx->id, HASH_SIZE);
+    }
+  }
+
+  return json_write_raw(buffer, "]}", 2);
+}
+
+static int rpc_get_height(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error)
+{
+  json_write_format(result, "{\"height\":%u,\"hash\":", tip->height);
+  json_write_hex(result, tip->hash, HASH_SIZE);
+  return json_write_raw(result, "}", 1);
+}
+
+/*
+ * params: [height or hash, include full transactions]
+ */
+static int rpc_get_block(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error)
+{
+  json_value_t *block_param = get_rpc_param(params, 0, "block");
+  json_value_t *verbose_param = get_rpc_param(params, 1, "verbose");
+  int include_transactions = verbose_param != NULL && verbose_param->type == JSON_TYPE_BOOL && verbose_param->boolean;
+
+  block_t *block = NULL;
+  uint64_t height = 0;
+  uint8_t block_hash[HASH_SIZE];
+  if (get_json_uint64(block_param, &height) == 0)
+  {
+    if (height > tip->height)
+    {
+      return set_rpc_error(error, RPC_ERROR_NOT_FOUND, "Block not found");
+    }
+
+    block = get_block_from_height_at_tip(tip, (uint32_t)height);
+  }
+  else if (get_rpc_hash_param(block_param, block_hash, HASH_SIZE) == 0)
+  {
+    block = get_block_from_hash_at_tip(tip, block_hash);
+  }
+  else
+  {
+    return set_rpc_error(error, RPC_ERROR_INVALID_PARAMS, "Expected a block height or hash");
+  }
+
+  if (block == NULL)
+  {
+    return set_rpc_error(error, RPC_ERROR_NOT_FOUND, "Block not found");
+  }
+
+  write_rpc_block(result, block, include_transactions);
+  free_block(block);
+  return 0;
+}
+
+/*
+ * params: [tx id]
+ */
+static int rpc_get_transaction(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error)
+{
+  uint8_t tx_id[HASH_SIZE];
+  if (get_rpc_hash_param(get_rpc_param(params, 0, "id"), tx_id, HASH_SIZE))
+  {
+    return set_rpc_error(error, RPC_ERROR_INVALID_PARAMS, "Expected a tx id");
+  }
+
+  transaction_t *mempool_tx = copy_tx_from_mempool(tx_id);
+  if (mempool_tx != NULL)
+  {
+    json_write_raw(result, "{\"confirmed\":false,\"transaction\":", 33);
+    write_rpc_transaction(result, mempool_tx);
+    free_transaction(mempool_tx);
+    return json_write_raw(result, "}", 1);
+  }
+
+  uint8_t *block_hash = get_block_hash_from_tx_id_at_tip(tip, tx_id);
+  if (block_hash == NULL)
+  {
+    return set_rpc_error(error, RPC_ERROR_NOT_FOUND, "Transaction not found");
+  }
+
+  block_t *block = get_block_from_hash_at_tip(tip, block_hash);
+  free(block_hash);
+  if (block == NULL)
+  {
+    return set_rpc_error(error, RPC_ERROR_NOT_FOUND, "Transaction not found");
+  }
+
+  transaction_t *tx = NULL;
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    if (compare_hash(block->transactions[i]->id, tx_id))
+    {
+      tx = block->transactions[i];
+      break;
+    }
+  }
+
+  if (tx == NULL)
+  {
+    free_block(block);
+    return set_rpc_error(error, RPC_ERROR_NOT_FOUND, "Transaction not found");
+  }
+
+  json_write_raw(result, "{\"confirmed\":true,\"block_hash\":", 31);
+  json_write_hex(result, block->hash, HASH_SIZE);
+  json_write_raw(result, ",\"transaction\":", 15);
+  write_rpc_transaction(result, tx);
+  free_block(block);
+  return json_write_raw(result, "}", 1);
+}
+
+/*
+ * params: [address]. The balance is read from the tip's snapshot, the address index
+ * trails the utxo cache so the height the balance is as of is returned along with it.
+ */
+static int rpc_get_balance(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error)
+{
+  uint8_t address[ADDRESS_SIZE];
+  if (get_rpc_hash_param(get_rpc_param(params, 0, "address"), address, ADDRESS_SIZE))
+  {
+    return set_rpc_error(error, RPC_ERROR_INVALID_PARAMS, "Expected an address");
+  }
+
+  uint64_t balance = get_balance_for_address_at_tip(tip, address);
+  return json_write_format(result, "{\"balance\":%llu,\"height\":%u}", (unsigned long long)balance, tip->unspent_height);
+}
+
+static int rpc_get_mempool(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error)
+{
+  uint8_t *tx_ids = malloc(HASH_SIZE * RPC_MAX_NUM_MEMPOOL_TX_IDS);
+  assert(tx_ids != NULL);
+  uint32_t num_tx_ids = get_mempool_tx_ids(tx_ids, RPC_MAX_NUM_MEMPOOL_TX_IDS);
+
+  json_write_format(result, "{\"num_txs\":%llu,\"tx_ids\":[", (unsigned long long)get_num_txs_in_mempool());
+  for (uint32_t i = 0; i < num_tx_ids; i++)
+  {
+    if (i > 0)
+    {
+      json_write_raw(result, ",", 1);
+    }
+
+    json_write_hex(result, tx_ids + (i * HASH_SIZE), HASH_SIZE);
+  }
+
+  free(tx_ids);
+  return json_write_raw(result, "]}", 2);
+}
+
+static int rpc_get_peers(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error)
+{
+  peer_info_t peer_infos[RPC_MAX_NUM_PEERS];
+  uint16_t num_peer_infos = get_peer_infos(peer_infos, RPC_MAX_NUM_PEERS);
+
+  json_write_format(result, "{\"num_peers\":%hu,\"peers\":[", num_peer_infos);
+  for (uint16_t i = 0; i < num_peer_infos; i++)
+  {
+    peer_info_t *peer_info = &peer_infos[i];
+    uint32_t ip = peer_info->remote_ip;
+    json_write_format(result, "%s{\"id\":%llu,\"address\":\"%u.%u.%u.%u:%u\",\"score\":%d,\"rtt_ms\":%u,\"block_height\":%u}",
+      i > 0 ? "," : "", (unsigned long long)peer_info->id, (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF,
+      peer_info->host_port, peer_info->score, peer_info->rtt_ms, peer_info->block_height);
+  }
+
+  return json_write_raw(result, "]}", 2);
+}
+
+/*
+ * The commitment is read from the blockchain rather than the tip, it is
+ * reported along with the height of the top block it was read at.
+ */
+static int rpc_get_utxo_commitment(blockchain_tip_t *tip, json_value_t *params, buffer_t *result, rpc_error_t *error)
+{
+  uint8_t utxo_commitment[MUHASH_DIGEST_SIZE];
+  uint32_t block_height = 0;
+  if (get_utxo_commitment(utxo_commitment, &block_height))
+  {
+    return set_rpc_error(error, RPC_ERROR_INTERNAL, "Could not compute UTXO set commitment");
+  }
+
+  json_write_format(result, "{\"height\":%u,\"utxo_commitment\":", block_height);
+  json_write_hex(result, utxo_commitment, MUHASH_DIGEST_SIZE);
+  return json_write_raw(result, "}", 1);
+}
+
+static void write_rpc_error(buffer_t *response, json_value_t *id, int code, const char *message)
+{
+  json_write_raw(response, "{\"jsonrpc\":\"2.0\",\"id\":", 22);
+  json_write_value(response, id);
+  json_write_format(response, ",\"error\":{\"code\":%d,\"message\":", code);
+  json_write_string(response, message, strlen(message));
+  json_write_raw(response, "}}", 2);
+}
+
+/*
+ * Handles a single call, returns 1 if a response was written. Notifications,
+ * calls without an id, are run without being answered.
+ */
+static int handle_rpc_call(blockchain_tip_t *tip, json_value_t *call, buffer_t *response)
+{
+  assert(call != NULL);
+  json_value_t *id = get_json_object_value(call, "id");
+  json_value_t *method = get_json_object_value(call, "method");
+  json_value_t *params = get_json_object_value(call, "params");
+  if (call->type != JSON_TYPE_OBJECT || method == NULL || method->type != JSON_TYPE_STRING ||
+    (params != NULL && params->type != JSON_TYPE_ARRAY && params->type != JSON_TYPE_OBJECT))
+  {
+    write_rpc_error(response, id, RPC_ERROR_INVALID_REQUEST, "Invalid request");
+    return 1;
+  }
+
+  const rpc_method_t *rpc_method = NULL;
+  for (size_t i = 0; i < NUM_RPC_METHODS; i++)
+  {
+    if (strcmp(g_rpc_methods[i].name, method->string) == 0)
+    {
+      rpc_method = &g_rpc_methods[i];
+      break;
+    }
+  }
+
+  if (rpc_method == NULL)
+  {
+    if (id == NULL)
+    {
+      return 0;
+    }
+
+    write_rpc_error(response, id, RPC_ERROR_METHOD_NOT_FOUND, "Method not found");
+    return 1;
+  }
+
+  buffer_t *result = buffer_init();
+  rpc_error_t error;
+  set_rpc_error(&error, RPC_ERROR_INTERNAL, "Internal error");
+  int failed = rpc_method->func(tip, params, result, &error);
+  if (id == NULL)
+  {
+    buffer_free(result);
+    return 0;
+  }
+
+  if (failed)
+  {
+    write_rpc_error(response, id, error.code, error.message);
+  }
+  else
+  {
+    json_write_raw(response, "{\"jsonrpc\":\"2.0\",\"id\":", 22);
+    json_write_value(response, id);
+    json_write_raw(response, ",\"result\":", 10);
+    json_write_raw(response, (const char*)buffer_get_data(result), buffer_get_size(result));
+    json_write_raw(response, "}", 1);
+  }
+
+  buffer_free(result);
+  return 1;
+}
+
+/*
+ * Handles a JSON-RPC request body, single or batched, the response is left empty if
+ * nothing needs to be answered. Every call is handled against the same tip.
+ */
+int handle_rpc_request(const char *body, size_t body_size, buffer_t *response)
+{
+  assert(body != NULL);
+  assert(response != NULL);
+  json_value_t *request = parse_json(body, body_size);
+  if (request == NULL)
+  {
+    write_rpc_error(response, NULL, RPC_ERROR_PARSE, "Parse error");
+    return 0;
+  }
+
+  if (request->type == JSON_TYPE_ARRAY && (request->num_values == 0 || request->num_values > RPC_MAX_BATCH_SIZE))
+  {
+    write_rpc_error(response, NULL, RPC_ERROR_INVALID_REQUEST, "Invalid request");
+    free_json_value(request);
+    return 0;
+  }
+
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  if (tip == NULL)
+  {
+    write_rpc_error(response, NULL, RPC_ERROR_INTERNAL, "Blockchain is not loaded");
+    free_json_value(request);
+    return 0;
+  }
+
+  if (request->type == JSON_TYPE_ARRAY)
+  {
+    size_t num_responses = 0;
+    json_write_raw(response, "[", 1);
+    for (size_t i = 0; i < request->num_values; i++)
+    {
+      if (num_responses > 0)
+      {
+        json_write_raw(response, ",", 1);
+      }
+
+      size_t response_size = buffer_get_size(response);
+      if (handle_rpc_call(tip, request->values[i], response))
+      {
+        num_responses++;
+      }
+      else if (num_responses > 0)
+      {
+        // drop the separator written for the unanswered notification
+        buffer_set_size(response, response_size - 1);
+        buffer_set_offset(response, response_size - 1);
+      }
+    }
+
+    if (num_responses > 0)
+    {
+      json_write_raw(response, "]", 1);
+    }
+    else
+    {
+      buffer_set_size(response, 0);
+      buffer_set_offset(response, 0);
+    }
+  }
+  else
+  {
+    handle_rpc_call(tip, request, response);
+  }
+
+  release_blockchain_tip(tip);
+  free_json_value(request);
+  return 0;
+}
+
+static const char* find_rpc_headers_end(const char *data, size_t size)
+{
+  for (size_t i = 0; i + 4 <= size; i++)
+  {
+    if (memcmp(data + i, "\r\n\r\n", 4) == 0)
+    {
+      return data + i;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Returns the value of the header of the given name, headers are
+ * matched without regard to case. The value is not NUL terminated.
+ */
+static const char* get_rpc_header_value(const char *headers, size_t headers_size, const char *name, size_t *value_size)
+{
+  size_t name_size = strlen(name);
+  const char *line = headers;
+  const char *headers_end = headers + headers_size;
+  while (line < headers_end)
+  {
+    const char *line_end = line;
+    while (line_end + 1 < headers_end && !(line_end[0] == '\r' && line_end[1] == '\n'))
+    {
+      line_end++;
+    }
+
+    if (line_end + 1 >= headers_end)
+    {
+      line_end = headers_end;
+    }
+
+    size_t line_size = (size_t)(line_end - line);
+    if (line_size > name_size && line[name_size] == ':' && strncasecmp(line, name, name_size) == 0)
+    {
+      const char *value = line + name_size + 1;
+      while (value < line_end && (*value == ' ' || *value == '\t'))
+      {
+        value++;
+      }
+
+      *value_size = (size_t)(line_end - value);
+      return value;
+    }
+
+    line = line_end + 2;
+  }
+
+  return NULL;
+}
+
+static void send_rpc_http_response(struct mg_connection *connection, const char *status, const char *content_type,
+  const char *body, size_t body_size, int keep_alive)
+{
+  assert(connection != NULL);
+  char headers[256];
+  int headers_size = snprintf(headers, sizeof(headers),
+    "HTTP/1.1 %s\r\n"
+    "Content-Type: %s\r\n"
+    "Content-Length: %zu\r\n"
+    "Connection: %s\r\n\r\n",
+    status, content_type, body_size, keep_alive ? "keep-alive" : "close");
+
+  mg_send(connection, headers, headers_size);
+  if (body_size > 0)
+  {
+    mg_send(connection, body, (int)body_size);
+  }
+
+  if (keep_alive == 0)
+  {
+    connection->flags |= MG_F_SEND_AND_CLOSE;
+  }
+}
+
+static void run_rpc_request_job(void *arg)
+{
+  rpc_request_t *request = (rpc_request_t*)arg;
+  assert(request != NULL);
+  if (request->metrics)
+  {
+    if (write_metrics(request->response))
+    {
+      LOG_WARNING("Failed to write metrics!");
+    }
+  }
+  else if (handle_rpc_request(request->body, request->body_size, request->response))
+  {
+    LOG_WARNING("Failed to handle rpc request!");
+  }
+
+  mtx_lock(&g_rpc_lock);
+  assert(vec_push(&g_rpc_completed_requests, request) == 0);
+  mtx_unlock(&g_rpc_lock);
+
+  if (atomic_exchange(&g_rpc_wake_pending, 1) == 0)
+  {
+    char wake = 1;
+    if (send(g_rpc_wake_socks[0], &wake, 1, 0) != 1)
+    {
+      LOG_WARNING("Failed to wake the network loop for rpc responses!");
+    }
+  }
+}
+
+static void free_rpc_request(rpc_request_t *request)
+{
+  assert(request != NULL);
+  buffer_free(request->response);
+  free(request->body);
+  free(request);
+}
+
+/*
+ * Parses the next request buffered by the client, unless it is still waiting on a
+ * response. Requests are only read once complete, pipelined requests are left
+ * buffered until the response of the request before them has been sent.
+ */
+static void rpc_client_process(rpc_client_t *client)
+{
+  assert(client != NULL);
+  struct mg_connection *connection = client->connection;
+  assert(connection != NULL);
+  if (g_rpc_server_running == 0 || client->request_pending || (connection->flags & (MG_F_SEND_AND_CLOSE | MG_F_CLOSE_IMMEDIATELY)))
+  {
+    return;
+  }
+
+  struct mbuf *io = &connection->recv_mbuf;
+  const char *headers_end = find_rpc_headers_end(io->buf, io->len);
+  if (headers_end == NULL)
+  {
+    if (io->len > RPC_MAX_HEADERS_SIZE)
+    {
+      send_rpc_http_response(connection, "431 Request Header Fields Too Large", RPC_JSON_CONTENT_TYPE, NULL, 0, 0);
+    }
+
+    return;
+  }
+
+  size_t headers_size = (size_t)(headers_end - io->buf);
+  if (headers_size > RPC_MAX_HEADERS_SIZE)
+  {
+    send_rpc_http_response(connection, "431 Request Header Fields Too Large", RPC_JSON_CONTENT_TYPE, NULL, 0, 0);
+    return;
+  }
+
+  // the metrics are scraped with a GET of the metrics path, everything else is a POSTed call
+  int metrics = headers_size >= 13 && strncmp(io->buf, "GET /metrics", 12) == 0 &&
+    (io->buf[12] == ' ' || io->buf[12] == '?');
+  if (metrics == 0 && (headers_size < 5 || strncmp(io->buf, "POST ", 5) != 0))
+  {
+    send_rpc_http_response(connection, "405 Method Not Allowed", RPC_JSON_CONTENT_TYPE, NULL, 0, 0);
+    return;
+  }
+
+  const char *request_line_end = memchr(io->buf, '\r', headers_size);
+  if (request_line_end == NULL)
+  {
+    request_line_end = headers_end;
+  }
+
+  // HTTP/1.1 connections are kept alive unless asked otherwise, HTTP/1.0 connections are closed
+  size_t request_line_size = (size_t)(request_line_end - io->buf);
+  int keep_alive = request_line_size >= 8 && strncmp(request_line_end - 8, "HTTP/1.1", 8) == 0;
+
+  size_t value_size = 0;
+  const char *value = get_rpc_header_value(io->buf, headers_size, "Connection", &value_size);
+  if (value != NULL)
+  {
+    if (value_size == 5 && strncasecmp(value, "close", 5) == 0)
+    {
+      keep_alive = 0;
+    }
+    else if (value_size == 10 && strncasecmp(value, "keep-alive", 10) == 0)
+    {
+      keep_alive = 1;
+    }
+  }
+
+  value = get_rpc_header_value(io->buf, headers_size, "Content-Length", &value_size);
+  if (metrics && value == NULL)
+  {
+    value = "0";
+    value_size = 1;
+  }
+
+  if (value == NULL || value_size == 0 || value_size > 16)
+  {
+    send_rpc_http_response(connection, "411 Length Required", RPC_JSON_CONTENT_TYPE, NULL, 0, 0);
+    return;
+  }
+
+  size_t body_size = 0;
+  for (size_t i = 0; i < value_size; i++)
+  {
+    if (value[i] < '0' || value[i] > '9')
+    {
+      send_rpc_http_response(connection, "411 Length Required", RPC_JSON_CONTENT_TYPE, NULL, 0, 0);
+      return;
+    }
+
+    body_size = (body_size * 10) + (size_t)(value[i] - '0');
+  }
+
+  if (body_size > RPC_MAX_REQUEST_SIZE)
+  {
+    send_rpc_http_response(connection, "413 Payload Too Large", RPC_JSON_CONTENT_TYPE, NULL, 0, 0);
+    return;
+  }
+
+  size_t request_size = headers_size + 4 + body_size;
+  if (io->len < request_size)
+  {
+    return;
+  }
+
+  rpc_request_t *request = malloc(sizeof(rpc_request_t));
+  assert(request != NULL);
+  request->client = client;
+  request->body_size = body_size;
+  request->body = malloc(body_size + 1);
+  assert(request->body != NULL);
+  memcpy(request->body, io->buf + headers_size + 4, body_size);
+  request->body[body_size] = '\0';
+  request->keep_alive = keep_alive;
+  request->metrics = metrics;
+  request->response = buffer_init();
+
+  mbuf_remove(io, request_size);
+  client->request_pending = 1;
+  if (add_job(run_rpc_request_job, request, &g_rpc_job_group))
+  {
+    LOG_ERROR("Failed to queue rpc request!");
+    client->request_pending = 0;
+    free_rpc_request(request);
+    connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+  }
+}
+
+/*
+ * Sends the responses of the requests handled on the schedulers, on the main network loop.
+ */
+static void flush_rpc_responses(void)
+{
+  while (1)
+  {
+    vec_void_t completed_requests;
+    mtx_lock(&g_rpc_lock);
+    completed_requests = g_rpc_completed_requests;
+    vec_init(&g_rpc_completed_requests);
+    mtx_unlock(&g_rpc_lock);
+    if (completed_requests.length == 0)
+    {
+      vec_deinit(&completed_requests);
+      break;
+    }
+
+    void *value = NULL;
+    int index = 0;
+    vec_foreach(&completed_requests, value, index)
+    {
+      rpc_request_t *request = (rpc_request_t*)value;
+      assert(request != NULL);
+      rpc_client_t *client = request->client;
+      assert(client != NULL);
+      if (client->closed)
+      {
+        free(client);
+        free_rpc_request(request);
+        continue;
+      }
+
+      size_t response_size = buffer_get_size(request->response);
+      send_rpc_http_response(client->connection, response_size > 0 ? "200 OK" : "204 No Content",
+        request->metrics ? RPC_METRICS_CONTENT_TYPE : RPC_JSON_CONTENT_TYPE,
+        (const char*)buffer_get_data(request->response), response_size, request->keep_alive);
+
+      client->request_pending = 0;
+      free_rpc_request(request);
+      rpc_client_process(client);
+    }
+
+    vec_deinit(&completed_requests);
+  }
+}
+
+static void rpc_server_ev_handler(struct mg_connection *connection, int ev, void *p)
+{
+  assert(connection != NULL);
+  rpc_client_t *client = (rpc_client_t*)connection->user_data;
+  switch (ev)
+  {
+    case MG_EV_ACCEPT:
+      {
+        if (g_rpc_server_running == 0 || g_rpc_clients.length >= RPC_MAX_NUM_CLIENTS)
+        {
+          connection->user_data = NULL;
+          connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+          break;
+        }
+
+        client = malloc(sizeof(rpc_client_t));
+        assert(client != NULL);
+        client->connection = connection;
+        client->request_pending = 0;
+        client->closed = 0;
+        connection->user_data = client;
+        assert(vec_push(&g_rpc_clients, client) == 0);
+      }
+      break;
+    case MG_EV_RECV:
+      if (client != NULL)
+      {
+        rpc_client_process(client);
+        flush_rpc_responses();
+      }
+      else
+      {
+        mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+      }
+      break;
+    case MG_EV_CLOSE:
+      if (client != NULL)
+      {
+        vec_remove(&g_rpc_clients, client);
+        connection->user_data = NULL;
+        client->connection = NULL;
+        if (client->request_pending)
+        {
+          client->closed = 1;
+        }
+        else
+        {
+          free(client);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void rpc_wake_ev_handler(struct mg_connection *connection, int ev, void *p)
+{
+  assert(connection != NULL);
+  if (ev == MG_EV_RECV)
+  {
+    // the next job which completes wakes the loop again, even while these are flushed
+    mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+    atomic_store(&g_rpc_wake_pending, 0);
+    flush_rpc_responses();
+  }
+}
+
+int start_rpc_server(void)
+{
+  if (g_rpc_server_running)
+  {
+    return 1;
+  }
+
+  if (g_rpc_port == 0)
+  {
+    g_rpc_port = parameters_get_rpc_port();
+  }
+
+  char *bind_address = convert_to_addr_str(g_rpc_bind_address, g_rpc_port);
+  g_rpc_listener = mg_bind(get_net_mgr(), bind_address, rpc_server_ev_handler);
+  if (g_rpc_listener == NULL)
+  {
+    LOG_ERROR("Failed to bind rpc server on address: %s!", bind_address);
+    free(bind_address);
+    return 1;
+  }
+
+  if (mg_socketpair(g_rpc_wake_socks, SOCK_STREAM) == 0)
+  {
+    LOG_ERROR("Failed to create rpc server wake up sockets!");
+    g_rpc_listener->flags |= MG_F_CLOSE_IMMEDIATELY;
+    g_rpc_listener = NULL;
+    free(bind_address);
+    return 1;
+  }
+
+  g_rpc_wake_connection = mg_add_sock(get_net_mgr(), g_rpc_wake_socks[1], rpc_wake_ev_handler);
+  atomic_store(&g_rpc_wake_pending, 0);
+
+  LOG_INFO("Started rpc server on address: %s...", bind_address);
+  free(bind_address);
+
+  g_rpc_listener->user_data = NULL;
+  vec_init(&g_rpc_clients);
+  vec_init(&g_rpc_completed_requests);
+  mtx_init(&g_rpc_lock, mtx_plain);
+  init_job_group(&g_rpc_job_group);
+
+  g_rpc_server_running = 1;
+  return 0;
+}
+
+int stop_rpc_server(void)
+{
+  if (g_rpc_server_running == 0)
+  {
+    return 1;
+  }
+
+  wait_job_group(&g_rpc_job_group);
+  g_rpc_server_running = 0;
+  flush_rpc_responses();
+
+  // the connections are closed by the next poll of the network loop, or when it's free'd
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&g_rpc_clients, value, index)
+  {
+    rpc_client_t *client = (rpc_client_t*)value;
+    assert(client != NULL);
+    client->connection->user_data = NULL;
+    client->connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+    free(client);
+  }
+
+  // the connection closes the socket it's reading, the writing end is closed with it
+  g_rpc_listener->flags |= MG_F_CLOSE_IMMEDIATELY;
+  g_rpc_wake_connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+  closesocket(g_rpc_wake_socks[0]);
+  g_rpc_wake_socks[0] = INVALID_SOCKET;
+  g_rpc_wake_socks[1] = INVALID_SOCKET;
+  vec_deinit(&g_rpc_clients);
+  vec_deinit(&g_rpc_completed_requests);
+  free_job_group(&g_rpc_job_group);
+  mtx_destroy(&g_rpc_lock);
+
+  g_rpc_listener = NULL;
+  g_rpc_wake_connection = NULL;
+  return 0;
+}
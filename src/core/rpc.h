@@ -0,0 +1,102 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <mongoose.h>
+
+#include "common/buffer.h"
+#include "common/vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+/*
+ * The rpc server answers JSON-RPC 2.0 requests, single or batched, posted over
+ * keep-alive HTTP/1.1 connections bound to the main network loop. Requests are
+ * handled on the task schedulers against a published blockchain tip, every call of
+ * a batch reads the same tip. A client's pipelined requests are answered in order...
+ *
+ * The node's metrics are scraped from the same server with a GET of /metrics.
+ */
+#define RPC_DEFAULT_BIND_ADDRESS "127.0.0.1"
+
+#define RPC_JSON_CONTENT_TYPE "application/json"
+#define RPC_METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+
+#define RPC_MAX_HEADERS_SIZE (1024 * 8)
+#define RPC_MAX_REQUEST_SIZE (1024 * 1024) // 1mb
+#define RPC_MAX_BATCH_SIZE 1000
+#define RPC_MAX_NUM_CLIENTS 1024
+#define RPC_MAX_NUM_MEMPOOL_TX_IDS 10000
+#define RPC_MAX_NUM_PEERS 256
+
+typedef enum RpcErrorCode
+{
+  RPC_ERROR_PARSE = -32700,
+  RPC_ERROR_INVALID_REQUEST = -32600,
+  RPC_ERROR_METHOD_NOT_FOUND = -32601,
+  RPC_ERROR_INVALID_PARAMS = -32602,
+  RPC_ERROR_INTERNAL = -32603,
+  RPC_ERROR_NOT_FOUND = -32000
+} rpc_error_code_t;
+
+typedef struct RpcClient
+{
+  struct mg_connection *connection;
+  int request_pending;
+
+  // a client closed while it's request is handled is free'd once the request is done
+  int closed;
+} rpc_client_t;
+
+typedef struct RpcRequest
+{
+  rpc_client_t *client;
+  char *body;
+  size_t body_size;
+  int keep_alive;
+  int metrics;
+
+  buffer_t *response;
+} rpc_request_t;
+
+VULKAN_API void set_rpc_bind_address(const char *bind_address);
+VULKAN_API const char* get_rpc_bind_address(void);
+
+VULKAN_API void set_rpc_port(uint16_t port);
+VULKAN_API uint16_t get_rpc_port(void);
+
+VULKAN_API int get_is_rpc_server_running(void);
+VULKAN_API uint32_t get_rpc_server_num_clients(void);
+
+VULKAN_API int handle_rpc_request(const char *body, size_t body_size, buffer_t *response);
+
+VULKAN_API int start_rpc_server(void);
+VULKAN_API int stop_rpc_server(void);
+
+VULKAN_END_DECL
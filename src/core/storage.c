@@ -0,0 +1,2333 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(USE_LEVELDB)
+#include <leveldb/c.h>
+#elif defined(USE_LMDB)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <lmdb.h>
+
+#include "common/tinycthread.h"
+#else
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <rocksdb/c.h>
+#endif
+
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/util.h"
+
+#include "parameters.h"
+#include "storage.h"
+
+static const char *g_storage_get_results[] = {"hit", "miss"};
+
+// the puts are counted as they are staged, every staged batch is written
+static metric_t g_storage_gets_metric = METRIC_LABELED_COUNTER_INIT("vulkan_db_gets_total",
+  "Database reads by whether the key was found", "result", g_storage_get_results, 2);
+static metric_t g_storage_get_bytes_metric = METRIC_COUNTER_INIT("vulkan_db_get_bytes_total",
+  "Bytes of the values read from the database");
+static metric_t g_storage_puts_metric = METRIC_COUNTER_INIT("vulkan_db_puts_total",
+  "Database writes of a single key");
+static metric_t g_storage_put_bytes_metric = METRIC_COUNTER_INIT("vulkan_db_put_bytes_total",
+  "Bytes of the keys and values written to the database");
+
+void register_storage_metrics(void)
+{
+  register_metric(&g_storage_gets_metric);
+  register_metric(&g_storage_get_bytes_metric);
+  register_metric(&g_storage_puts_metric);
+  register_metric(&g_storage_put_bytes_metric);
+}
+
+uint64_t get_storage_put_bytes(void)
+{
+  return get_metric_counter_value(&g_storage_put_bytes_metric, 0);
+}
+
+static void record_storage_get(const uint8_t *value, size_t value_size)
+{
+  metric_counter_add(&g_storage_gets_metric, value != NULL ? 0 : 1, 1);
+  if (value != NULL)
+  {
+    metric_counter_add(&g_storage_get_bytes_metric, 0, value_size);
+  }
+}
+
+static void record_storage_put(size_t key_size, size_t value_size)
+{
+  metric_counter_add(&g_storage_puts_metric, 0, 1);
+  metric_counter_add(&g_storage_put_bytes_metric, 0, key_size + value_size);
+}
+
+void init_storage_options(storage_options_t *options)
+{
+  assert(options != NULL);
+  options->want_compression = 1;
+  options->compression_type = get_default_compression_type();
+  options->cache_size = 0;
+  options->bloom_bits_per_key = 0;
+  options->prefix_length = 0;
+  options->num_background_jobs = 0;
+  options->write_buffer_size = 0;
+  options->map_size = 0;
+}
+
+#if defined(USE_LEVELDB)
+
+struct Storage
+{
+  leveldb_t *db;
+  leveldb_readoptions_t *roptions;
+  leveldb_writeoptions_t *woptions;
+
+  // leveldb only holds on to the cache and filter policy set in it's
+  // options, so they must outlive the database opened with them...
+  leveldb_cache_t *cache;
+  leveldb_filterpolicy_t *filter_policy;
+};
+
+struct StorageBatch
+{
+  leveldb_writebatch_t *write_batch;
+};
+
+struct StorageIterator
+{
+  leveldb_readoptions_t *roptions;
+  leveldb_iterator_t *iterator;
+};
+
+struct StorageSnapshot
+{
+  const leveldb_snapshot_t *snapshot;
+  leveldb_readoptions_t *roptions;
+};
+
+struct StorageBackup
+{
+  storage_t *storage;
+};
+
+const char* get_storage_backend_str(void)
+{
+  return "leveldb";
+}
+
+int valid_compression_type(int compression_type)
+{
+  switch (compression_type)
+  {
+    case leveldb_snappy_compression:
+      return 1;
+    case leveldb_no_compression:
+    default:
+      return 0;
+  }
+}
+
+const char* get_compression_type_str(int compression_type)
+{
+  switch (compression_type)
+  {
+    case leveldb_snappy_compression:
+      return "snappy";
+    case leveldb_no_compression:
+    default:
+      return "unknown";
+  }
+}
+
+int get_compression_type_from_str(const char *compression_type_str)
+{
+  if (string_equals(compression_type_str, "snappy"))
+  {
+    return leveldb_snappy_compression;
+  }
+
+  return leveldb_no_compression;
+}
+
+int get_default_compression_type(void)
+{
+  return leveldb_snappy_compression;
+}
+
+storage_t* storage_open(const char *path, storage_options_t *options, char **err)
+{
+  assert(path != NULL);
+  assert(options != NULL);
+
+  storage_t *storage = malloc(sizeof(storage_t));
+  assert(storage != NULL);
+  storage->cache = NULL;
+  storage->filter_policy = NULL;
+
+  leveldb_options_t *db_options = leveldb_options_create();
+  leveldb_options_set_create_if_missing(db_options, 1);
+  if (options->cache_size > 0)
+  {
+    storage->cache = leveldb_cache_create_lru(options->cache_size);
+    leveldb_options_set_cache(db_options, storage->cache);
+  }
+
+  if (options->bloom_bits_per_key > 0)
+  {
+    storage->filter_policy = leveldb_filterpolicy_create_bloom(options->bloom_bits_per_key);
+    leveldb_options_set_filter_policy(db_options, storage->filter_policy);
+  }
+
+  if (options->write_buffer_size > 0)
+  {
+    leveldb_options_set_write_buffer_size(db_options, options->write_buffer_size);
+  }
+
+  if (options->want_compression)
+  {
+    leveldb_options_set_compression(db_options, options->compression_type);
+  }
+
+  storage->db = leveldb_open(db_options, path, err);
+  leveldb_options_destroy(db_options);
+  if (*err != NULL)
+  {
+    if (storage->cache != NULL)
+    {
+      leveldb_cache_destroy(storage->cache);
+    }
+
+    if (storage->filter_policy != NULL)
+    {
+      leveldb_filterpolicy_destroy(storage->filter_policy);
+    }
+
+    free(storage);
+    return NULL;
+  }
+
+  storage->roptions = leveldb_readoptions_create();
+  storage->woptions = leveldb_writeoptions_create();
+  return storage;
+}
+
+void storage_close(storage_t *storage)
+{
+  assert(storage != NULL);
+  leveldb_close(storage->db);
+  leveldb_readoptions_destroy(storage->roptions);
+  leveldb_writeoptions_destroy(storage->woptions);
+  if (storage->cache != NULL)
+  {
+    leveldb_cache_destroy(storage->cache);
+  }
+
+  if (storage->filter_policy != NULL)
+  {
+    leveldb_filterpolicy_destroy(storage->filter_policy);
+  }
+
+  free(storage);
+}
+
+void storage_destroy(const char *path, char **err)
+{
+  assert(path != NULL);
+  leveldb_options_t *options = leveldb_options_create();
+  leveldb_destroy_db(options, path, err);
+  leveldb_options_destroy(options);
+}
+
+void storage_repair(const char *path, char **err)
+{
+  assert(path != NULL);
+  leveldb_options_t *options = leveldb_options_create();
+  leveldb_options_set_create_if_missing(options, 1);
+  leveldb_repair_db(options, path, err);
+  leveldb_options_destroy(options);
+}
+
+void storage_free(void *ptr)
+{
+  leveldb_free(ptr);
+}
+
+uint8_t* storage_get(storage_t *storage, const uint8_t *key, size_t key_size, size_t *value_size, char **err)
+{
+  assert(storage != NULL);
+  uint8_t *value = (uint8_t*)leveldb_get(storage->db, storage->roptions, (const char*)key, key_size, value_size, err);
+  record_storage_get(value, *value_size);
+  return value;
+}
+
+void storage_put(storage_t *storage, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, char **err)
+{
+  assert(storage != NULL);
+  leveldb_put(storage->db, storage->woptions, (const char*)key, key_size, (const char*)value, value_size, err);
+  record_storage_put(key_size, value_size);
+}
+
+void storage_delete(storage_t *storage, const uint8_t *key, size_t key_size, char **err)
+{
+  assert(storage != NULL);
+  leveldb_delete(storage->db, storage->woptions, (const char*)key, key_size, err);
+}
+
+storage_batch_t* storage_batch_create(void)
+{
+  storage_batch_t *batch = malloc(sizeof(storage_batch_t));
+  assert(batch != NULL);
+  batch->write_batch = leveldb_writebatch_create();
+  return batch;
+}
+
+void storage_batch_put(storage_batch_t *batch, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size)
+{
+  assert(batch != NULL);
+  leveldb_writebatch_put(batch->write_batch, (const char*)key, key_size, (const char*)value, value_size);
+  record_storage_put(key_size, value_size);
+}
+
+void storage_batch_delete(storage_batch_t *batch, const uint8_t *key, size_t key_size)
+{
+  assert(batch != NULL);
+  leveldb_writebatch_delete(batch->write_batch, (const char*)key, key_size);
+}
+
+void storage_batch_clear(storage_batch_t *batch)
+{
+  assert(batch != NULL);
+  leveldb_writebatch_clear(batch->write_batch);
+}
+
+void storage_batch_destroy(storage_batch_t *batch)
+{
+  assert(batch != NULL);
+  leveldb_writebatch_destroy(batch->write_batch);
+  free(batch);
+}
+
+void storage_write(storage_t *storage, storage_batch_t *batch, char **err)
+{
+  assert(storage != NULL);
+  assert(batch != NULL);
+  leveldb_write(storage->db, storage->woptions, batch->write_batch, err);
+}
+
+void storage_set_sync(storage_t *storage, int sync)
+{
+  assert(storage != NULL);
+  leveldb_writeoptions_set_sync(storage->woptions, sync);
+}
+
+// a synced write syncs the log along with every write made before it
+int storage_sync(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
+  leveldb_writeoptions_set_sync(woptions, 1);
+  leveldb_writebatch_t *write_batch = leveldb_writebatch_create();
+  leveldb_write(storage->db, woptions, write_batch, err);
+  leveldb_writebatch_destroy(write_batch);
+  leveldb_writeoptions_destroy(woptions);
+  return *err != NULL;
+}
+
+// leveldb can not skip it's log, so a flush only has to sync it
+void storage_set_write_ahead_log(storage_t *storage, int enabled)
+{
+  assert(storage != NULL);
+}
+
+int storage_flush(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+  return storage_sync(storage, err);
+}
+
+storage_snapshot_t* storage_snapshot_create(storage_t *storage)
+{
+  assert(storage != NULL);
+  storage_snapshot_t *snapshot = malloc(sizeof(storage_snapshot_t));
+  assert(snapshot != NULL);
+  snapshot->snapshot = leveldb_create_snapshot(storage->db);
+  snapshot->roptions = leveldb_readoptions_create();
+  leveldb_readoptions_set_snapshot(snapshot->roptions, snapshot->snapshot);
+  return snapshot;
+}
+
+void storage_snapshot_release(storage_t *storage, storage_snapshot_t *snapshot)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  leveldb_readoptions_destroy(snapshot->roptions);
+  leveldb_release_snapshot(storage->db, snapshot->snapshot);
+  free(snapshot);
+}
+
+uint8_t* storage_snapshot_get(storage_t *storage, storage_snapshot_t *snapshot, const uint8_t *key, size_t key_size, size_t *value_size, char **err)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  uint8_t *value = (uint8_t*)leveldb_get(storage->db, snapshot->roptions, (const char*)key, key_size, value_size, err);
+  record_storage_get(value, *value_size);
+  return value;
+}
+
+storage_iterator_t* storage_iterator_create(storage_t *storage)
+{
+  assert(storage != NULL);
+  storage_iterator_t *iterator = malloc(sizeof(storage_iterator_t));
+  assert(iterator != NULL);
+  iterator->roptions = leveldb_readoptions_create();
+  iterator->iterator = leveldb_create_iterator(storage->db, iterator->roptions);
+  return iterator;
+}
+
+storage_iterator_t* storage_snapshot_iterator_create(storage_t *storage, storage_snapshot_t *snapshot)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  storage_iterator_t *iterator = malloc(sizeof(storage_iterator_t));
+  assert(iterator != NULL);
+  iterator->storage = storage;
+  iterator->snapshot = snapshot;
+  iterator->txn = NULL;
+  iterator->cursor = NULL;
+  iterator->valid = 0;
+
+  // the cursor reads through the snapshot's own read transaction
+  mtx_lock(&snapshot->lock);
+  if (mdb_cursor_open(snapshot->txn, storage->dbi, &iterator->cursor) != MDB_SUCCESS)
+  {
+    iterator->cursor = NULL;
+  }
+
+  return iterator;
+}
+
+storage_iterator_t* storage_snapshot_iterator_create(storage_t *storage, storage_snapshot_t *snapshot)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  storage_iterator_t *iterator = malloc(sizeof(storage_iterator_t));
+  assert(iterator != NULL);
+  iterator->roptions = leveldb_readoptions_create();
+  leveldb_readoptions_set_snapshot(iterator->roptions, snapshot->snapshot);
+  iterator->iterator = leveldb_create_iterator(storage->db, iterator->roptions);
+  return iterator;
+}
+
+void storage_iterator_seek_to_first(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  leveldb_iter_seek_to_first(iterator->iterator);
+}
+
+void storage_iterator_seek(storage_iterator_t *iterator, const uint8_t *key, size_t key_size)
+{
+  assert(iterator != NULL);
+  leveldb_iter_seek(iterator->iterator, (const char*)key, key_size);
+}
+
+int storage_iterator_valid(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  return leveldb_iter_valid(iterator->iterator) != 0;
+}
+
+void storage_iterator_next(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  leveldb_iter_next(iterator->iterator);
+}
+
+const uint8_t* storage_iterator_key(storage_iterator_t *iterator, size_t *key_size)
+{
+  assert(iterator != NULL);
+  return (const uint8_t*)leveldb_iter_key(iterator->iterator, key_size);
+}
+
+const uint8_t* storage_iterator_value(storage_iterator_t *iterator, size_t *value_size)
+{
+  assert(iterator != NULL);
+  return (const uint8_t*)leveldb_iter_value(iterator->iterator, value_size);
+}
+
+void storage_iterator_destroy(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  leveldb_iter_destroy(iterator->iterator);
+  leveldb_readoptions_destroy(iterator->roptions);
+  free(iterator);
+}
+
+#elif defined(USE_LMDB)
+
+// lmdb grows it's data file as pages are written, the map size only reserves address
+// space. Writes that still do not fit grow the map geometrically and are retried...
+#define LMDB_DEFAULT_MAP_SIZE (sizeof(size_t) > 4 ? ((size_t)1 << 36) : ((size_t)1 << 30))
+#define LMDB_DATA_FILENAME "data.mdb"
+#define LMDB_LOCK_FILENAME "lock.mdb"
+
+// the map can only be grown while no read transactions are open in this process,
+// so every read transaction is tracked by the storage it is reading from...
+struct Storage
+{
+  MDB_env *env;
+  MDB_dbi dbi;
+  char *path;
+  size_t map_size;
+  int sync;
+  int write_ahead_log;
+
+  mtx_t read_txns_lock;
+  cnd_t read_txns_cond;
+  int growing_map;
+  uint32_t num_read_txns;
+  uint32_t num_iterators;
+  storage_snapshot_t *snapshots;
+};
+
+typedef struct StorageBatchOp
+{
+  uint8_t *key;
+  size_t key_size;
+  uint8_t *value; // NULL for deletions
+  size_t value_size;
+} storage_batch_op_t;
+
+// lmdb has no write batches of it's own, the ops are applied
+// together in a single write transaction once written...
+struct StorageBatch
+{
+  storage_batch_op_t *ops;
+  size_t num_ops;
+  size_t capacity;
+};
+
+// the key and value of the iterator point directly into the memory map,
+// they are only valid until the iterator is moved or destroyed...
+struct StorageIterator
+{
+  storage_t *storage;
+  storage_snapshot_t *snapshot; // the snapshot is locked for as long as the iterator reads it
+  MDB_txn *txn;
+  MDB_cursor *cursor;
+  MDB_val key;
+  MDB_val value;
+  int valid;
+};
+
+// a lmdb read transaction only sees the commits made before it began, it may be used
+// from any thread since the environment is opened with MDB_NOTLS but only by one at a time...
+struct StorageSnapshot
+{
+  MDB_txn *txn;
+  mtx_t lock;
+  storage_snapshot_t *prev;
+  storage_snapshot_t *next;
+};
+
+struct StorageBackup
+{
+  char *path;
+};
+
+static void set_lmdb_error(char **err, int rc)
+{
+  if (err != NULL && *err == NULL)
+  {
+    const char *error_str = mdb_strerror(rc);
+    *err = malloc(strlen(error_str) + 1);
+    assert(*err != NULL);
+    strcpy(*err, error_str);
+  }
+}
+
+static char* get_lmdb_filepath(const char *path, const char *filename)
+{
+  size_t filepath_size = strlen(path) + strlen(filename) + 2;
+  char *filepath = malloc(filepath_size);
+  assert(filepath != NULL);
+  snprintf(filepath, filepath_size, "%s/%s", path, filename);
+  return filepath;
+}
+
+static int open_lmdb_env(storage_t *storage)
+{
+  assert(storage != NULL);
+  int rc = mdb_env_create(&storage->env);
+  if (rc != MDB_SUCCESS)
+  {
+    return rc;
+  }
+
+  rc = mdb_env_set_mapsize(storage->env, storage->map_size);
+  if (rc == MDB_SUCCESS)
+  {
+    rc = mdb_env_open(storage->env, storage->path, MDB_NOTLS | MDB_NORDAHEAD, 0664);
+  }
+
+  MDB_txn *txn = NULL;
+  if (rc == MDB_SUCCESS)
+  {
+    rc = mdb_txn_begin(storage->env, NULL, 0, &txn);
+  }
+
+  if (rc == MDB_SUCCESS)
+  {
+    rc = mdb_dbi_open(txn, NULL, 0, &storage->dbi);
+    if (rc == MDB_SUCCESS)
+    {
+      rc = mdb_txn_commit(txn);
+    }
+    else
+    {
+      mdb_txn_abort(txn);
+    }
+  }
+
+  if (rc != MDB_SUCCESS)
+  {
+    mdb_env_close(storage->env);
+    storage->env = NULL;
+  }
+
+  return rc;
+}
+
+/*
+ * Grows the map once the gets in flight have finished, the read transactions of the open
+ * snapshots are reset while the map grows and renewed afterwards. A renewed snapshot sees
+ * the commits made before the map grew, the write which did not fit was never committed.
+ * Iterators cannot be renewed without losing their position, and may be held by the
+ * thread writing, so the map is not grown while any iterators are open.
+ */
+static int grow_lmdb_map(storage_t *storage)
+{
+  assert(storage != NULL);
+  mtx_lock(&storage->read_txns_lock);
+  if (storage->num_iterators > 0)
+  {
+    mtx_unlock(&storage->read_txns_lock);
+    return MDB_MAP_FULL;
+  }
+
+  storage->growing_map = 1;
+  while (storage->num_read_txns > 0)
+  {
+    cnd_wait(&storage->read_txns_cond, &storage->read_txns_lock);
+  }
+
+  for (storage_snapshot_t *snapshot = storage->snapshots; snapshot != NULL; snapshot = snapshot->next)
+  {
+    mtx_lock(&snapshot->lock);
+    mdb_txn_reset(snapshot->txn);
+  }
+
+  int rc = mdb_env_set_mapsize(storage->env, storage->map_size * 2);
+  if (rc == MDB_SUCCESS)
+  {
+    storage->map_size *= 2;
+  }
+
+  for (storage_snapshot_t *snapshot = storage->snapshots; snapshot != NULL; snapshot = snapshot->next)
+  {
+    int renew_rc = mdb_txn_renew(snapshot->txn);
+    assert(renew_rc == MDB_SUCCESS);
+    mtx_unlock(&snapshot->lock);
+  }
+
+  storage->growing_map = 0;
+  cnd_broadcast(&storage->read_txns_cond);
+  mtx_unlock(&storage->read_txns_lock);
+  return rc;
+}
+
+/*
+ * Begins a read transaction, the caller must hold the read txns lock of the storage
+ * and have waited out any growth of the map in progress.
+ */
+static int begin_lmdb_read_txn_nolock(storage_t *storage, MDB_txn **txn)
+{
+  assert(storage != NULL);
+  assert(storage->growing_map == 0);
+  int rc = mdb_txn_begin(storage->env, NULL, MDB_RDONLY, txn);
+  if (rc == MDB_MAP_RESIZED)
+  {
+    // another process grew the map, adopt it's size before reading
+    rc = mdb_env_set_mapsize(storage->env, 0);
+    if (rc == MDB_SUCCESS)
+    {
+      rc = mdb_txn_begin(storage->env, NULL, MDB_RDONLY, txn);
+    }
+  }
+
+  return rc;
+}
+
+static void wait_for_lmdb_map_growth_nolock(storage_t *storage)
+{
+  assert(storage != NULL);
+  while (storage->growing_map)
+  {
+    cnd_wait(&storage->read_txns_cond, &storage->read_txns_lock);
+  }
+}
+
+static int begin_lmdb_read_txn(storage_t *storage, MDB_txn **txn)
+{
+  assert(storage != NULL);
+  mtx_lock(&storage->read_txns_lock);
+  wait_for_lmdb_map_growth_nolock(storage);
+  int rc = begin_lmdb_read_txn_nolock(storage, txn);
+  if (rc == MDB_SUCCESS)
+  {
+    storage->num_read_txns++;
+  }
+
+  mtx_unlock(&storage->read_txns_lock);
+  return rc;
+}
+
+static void end_lmdb_read_txn(storage_t *storage, MDB_txn *txn)
+{
+  assert(storage != NULL);
+  assert(txn != NULL);
+  mdb_txn_abort(txn);
+
+  mtx_lock(&storage->read_txns_lock);
+  assert(storage->num_read_txns > 0);
+  storage->num_read_txns--;
+  cnd_broadcast(&storage->read_txns_cond);
+  mtx_unlock(&storage->read_txns_lock);
+}
+
+static int apply_lmdb_batch(storage_t *storage, storage_batch_t *batch)
+{
+  assert(storage != NULL);
+  assert(batch != NULL);
+
+  int rc = MDB_SUCCESS;
+  do
+  {
+    MDB_txn *txn = NULL;
+    rc = mdb_txn_begin(storage->env, NULL, 0, &txn);
+    if (rc != MDB_SUCCESS)
+    {
+      return rc;
+    }
+
+    for (size_t i = 0; i < batch->num_ops && rc == MDB_SUCCESS; i++)
+    {
+      storage_batch_op_t *op = &batch->ops[i];
+      MDB_val key = {op->key_size, op->key};
+      if (op->value != NULL)
+      {
+        MDB_val value = {op->value_size, op->value};
+        rc = mdb_put(txn, storage->dbi, &key, &value, 0);
+      }
+      else
+      {
+        rc = mdb_del(txn, storage->dbi, &key, NULL);
+        if (rc == MDB_NOTFOUND)
+        {
+          rc = MDB_SUCCESS;
+        }
+      }
+    }
+
+    if (rc == MDB_SUCCESS)
+    {
+      rc = mdb_txn_commit(txn);
+    }
+    else
+    {
+      mdb_txn_abort(txn);
+    }
+
+    // the whole batch is retried once the map has grown
+    if (rc == MDB_MAP_FULL)
+    {
+      int grow_rc = grow_lmdb_map(storage);
+      if (grow_rc != MDB_SUCCESS)
+      {
+        return grow_rc;
+      }
+    }
+  } while (rc == MDB_MAP_FULL);
+
+  return rc;
+}
+
+const char* get_storage_backend_str(void)
+{
+  return "lmdb";
+}
+
+int valid_compression_type(int compression_type)
+{
+  return 0;
+}
+
+const char* get_compression_type_str(int compression_type)
+{
+  return "unknown";
+}
+
+int get_compression_type_from_str(const char *compression_type_str)
+{
+  return 0;
+}
+
+int get_default_compression_type(void)
+{
+  return 0;
+}
+
+storage_t* storage_open(const char *path, storage_options_t *options, char **err)
+{
+  assert(path != NULL);
+  assert(options != NULL);
+
+  // lmdb stores it's data and lock files inside of the directory
+  if (mkdir(path, 0775) != 0 && errno != EEXIST)
+  {
+    set_lmdb_error(err, errno);
+    return NULL;
+  }
+
+  storage_t *storage = malloc(sizeof(storage_t));
+  assert(storage != NULL);
+  storage->path = malloc(strlen(path) + 1);
+  assert(storage->path != NULL);
+  strcpy(storage->path, path);
+  storage->map_size = options->map_size > 0 ? options->map_size : LMDB_DEFAULT_MAP_SIZE;
+  storage->sync = 1;
+  storage->write_ahead_log = 1;
+
+  mtx_init(&storage->read_txns_lock, mtx_plain);
+  cnd_init(&storage->read_txns_cond);
+  storage->growing_map = 0;
+  storage->num_read_txns = 0;
+  storage->num_iterators = 0;
+  storage->snapshots = NULL;
+
+  int rc = open_lmdb_env(storage);
+  if (rc != MDB_SUCCESS)
+  {
+    set_lmdb_error(err, rc);
+    mtx_destroy(&storage->read_txns_lock);
+    cnd_destroy(&storage->read_txns_cond);
+    free(storage->path);
+    free(storage);
+    return NULL;
+  }
+
+  return storage;
+}
+
+void storage_close(storage_t *storage)
+{
+  assert(storage != NULL);
+  if (storage->env != NULL)
+  {
+    mdb_dbi_close(storage->env, storage->dbi);
+    mdb_env_close(storage->env);
+  }
+
+  mtx_destroy(&storage->read_txns_lock);
+  cnd_destroy(&storage->read_txns_cond);
+  free(storage->path);
+  free(storage);
+}
+
+void storage_destroy(const char *path, char **err)
+{
+  assert(path != NULL);
+  char *data_filepath = get_lmdb_filepath(path, LMDB_DATA_FILENAME);
+  char *lock_filepath = get_lmdb_filepath(path, LMDB_LOCK_FILENAME);
+  if ((unlink(data_filepath) != 0 && errno != ENOENT) ||
+      (unlink(lock_filepath) != 0 && errno != ENOENT) ||
+      (rmdir(path) != 0 && errno != ENOENT))
+  {
+    set_lmdb_error(err, errno);
+  }
+
+  free(data_filepath);
+  free(lock_filepath);
+}
+
+void storage_repair(const char *path, char **err)
+{
+  // lmdb's copy on write pages can not be left in a torn state, so there is never anything to repair
+  assert(path != NULL);
+}
+
+void storage_free(void *ptr)
+{
+  free(ptr);
+}
+
+uint8_t* storage_get(storage_t *storage, const uint8_t *key, size_t key_size, size_t *value_size, char **err)
+{
+  assert(storage != NULL);
+  MDB_txn *txn = NULL;
+  int rc = begin_lmdb_read_txn(storage, &txn);
+  if (rc != MDB_SUCCESS)
+  {
+    set_lmdb_error(err, rc);
+    return NULL;
+  }
+
+  MDB_val mdb_key = {key_size, (void*)key};
+  MDB_val mdb_value;
+  rc = mdb_get(txn, storage->dbi, &mdb_key, &mdb_value);
+  if (rc != MDB_SUCCESS)
+  {
+    end_lmdb_read_txn(storage, txn);
+    if (rc != MDB_NOTFOUND)
+    {
+      set_lmdb_error(err, rc);
+    }
+
+    *value_size = 0;
+    record_storage_get(NULL, 0);
+    return NULL;
+  }
+
+  // the value is only mapped for as long as the read transaction is open
+  uint8_t *value = malloc(mdb_value.mv_size > 0 ? mdb_value.mv_size : 1);
+  assert(value != NULL);
+  memcpy(value, mdb_value.mv_data, mdb_value.mv_size);
+  *value_size = mdb_value.mv_size;
+  record_storage_get(value, mdb_value.mv_size);
+  end_lmdb_read_txn(storage, txn);
+  return value;
+}
+
+void storage_put(storage_t *storage, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, char **err)
+{
+  storage_batch_t *batch = storage_batch_create();
+  storage_batch_put(batch, key, key_size, value, value_size);
+  storage_write(storage, batch, err);
+  storage_batch_destroy(batch);
+}
+
+void storage_delete(storage_t *storage, const uint8_t *key, size_t key_size, char **err)
+{
+  storage_batch_t *batch = storage_batch_create();
+  storage_batch_delete(batch, key, key_size);
+  storage_write(storage, batch, err);
+  storage_batch_destroy(batch);
+}
+
+storage_batch_t* storage_batch_create(void)
+{
+  storage_batch_t *batch = malloc(sizeof(storage_batch_t));
+  assert(batch != NULL);
+  batch->ops = NULL;
+  batch->num_ops = 0;
+  batch->capacity = 0;
+  return batch;
+}
+
+static storage_batch_op_t* add_storage_batch_op(storage_batch_t *batch, const uint8_t *key, size_t key_size)
+{
+  assert(batch != NULL);
+  if (batch->num_ops == batch->capacity)
+  {
+    batch->capacity = batch->capacity > 0 ? batch->capacity * 2 : 16;
+    batch->ops = realloc(batch->ops, sizeof(storage_batch_op_t) * batch->capacity);
+    assert(batch->ops != NULL);
+  }
+
+  storage_batch_op_t *op = &batch->ops[batch->num_ops++];
+  op->key = malloc(key_size);
+  assert(op->key != NULL);
+  memcpy(op->key, key, key_size);
+  op->key_size = key_size;
+  op->value = NULL;
+  op->value_size = 0;
+  return op;
+}
+
+void storage_batch_put(storage_batch_t *batch, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size)
+{
+  storage_batch_op_t *op = add_storage_batch_op(batch, key, key_size);
+  op->value = malloc(value_size > 0 ? value_size : 1);
+  assert(op->value != NULL);
+  memcpy(op->value, value, value_size);
+  op->value_size = value_size;
+  record_storage_put(key_size, value_size);
+}
+
+void storage_batch_delete(storage_batch_t *batch, const uint8_t *key, size_t key_size)
+{
+  add_storage_batch_op(batch, key, key_size);
+}
+
+void storage_batch_clear(storage_batch_t *batch)
+{
+  assert(batch != NULL);
+  for (size_t i = 0; i < batch->num_ops; i++)
+  {
+    free(batch->ops[i].key);
+    free(batch->ops[i].value);
+  }
+
+  batch->num_ops = 0;
+}
+
+void storage_batch_destroy(storage_batch_t *batch)
+{
+  assert(batch != NULL);
+  storage_batch_clear(batch);
+  free(batch->ops);
+  free(batch);
+}
+
+void storage_write(storage_t *storage, storage_batch_t *batch, char **err)
+{
+  int rc = apply_lmdb_batch(storage, batch);
+  if (rc != MDB_SUCCESS)
+  {
+    set_lmdb_error(err, rc);
+  }
+}
+
+// lmdb has no log, both settings decide whether each commit is synced to disk
+static void update_lmdb_sync_flags(storage_t *storage)
+{
+  assert(storage != NULL);
+  mdb_env_set_flags(storage->env, MDB_NOSYNC, storage->sync == 0 || storage->write_ahead_log == 0);
+}
+
+void storage_set_sync(storage_t *storage, int sync)
+{
+  assert(storage != NULL);
+  storage->sync = sync;
+  update_lmdb_sync_flags(storage);
+}
+
+int storage_sync(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+  int rc = mdb_env_sync(storage->env, 1);
+  if (rc != MDB_SUCCESS)
+  {
+    set_lmdb_error(err, rc);
+    return 1;
+  }
+
+  return 0;
+}
+
+void storage_set_write_ahead_log(storage_t *storage, int enabled)
+{
+  assert(storage != NULL);
+  storage->write_ahead_log = enabled;
+  update_lmdb_sync_flags(storage);
+}
+
+int storage_flush(storage_t *storage, char **err)
+{
+  return storage_sync(storage, err);
+}
+
+storage_snapshot_t* storage_snapshot_create(storage_t *storage)
+{
+  assert(storage != NULL);
+  storage_snapshot_t *snapshot = malloc(sizeof(storage_snapshot_t));
+  assert(snapshot != NULL);
+  snapshot->txn = NULL;
+
+  mtx_lock(&storage->read_txns_lock);
+  wait_for_lmdb_map_growth_nolock(storage);
+  if (begin_lmdb_read_txn_nolock(storage, &snapshot->txn) != MDB_SUCCESS)
+  {
+    mtx_unlock(&storage->read_txns_lock);
+    free(snapshot);
+    return NULL;
+  }
+
+  mtx_init(&snapshot->lock, mtx_plain);
+  snapshot->prev = NULL;
+  snapshot->next = storage->snapshots;
+  if (storage->snapshots != NULL)
+  {
+    storage->snapshots->prev = snapshot;
+  }
+
+  storage->snapshots = snapshot;
+  mtx_unlock(&storage->read_txns_lock);
+  return snapshot;
+}
+
+void storage_snapshot_release(storage_t *storage, storage_snapshot_t *snapshot)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  mtx_lock(&storage->read_txns_lock);
+  if (snapshot->prev != NULL)
+  {
+    snapshot->prev->next = snapshot->next;
+  }
+  else
+  {
+    storage->snapshots = snapshot->next;
+  }
+
+  if (snapshot->next != NULL)
+  {
+    snapshot->next->prev = snapshot->prev;
+  }
+
+  mdb_txn_abort(snapshot->txn);
+  mtx_unlock(&storage->read_txns_lock);
+
+  mtx_destroy(&snapshot->lock);
+  free(snapshot);
+}
+
+uint8_t* storage_snapshot_get(storage_t *storage, storage_snapshot_t *snapshot, const uint8_t *key, size_t key_size, size_t *value_size, char **err)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  MDB_val mdb_key = {key_size, (void*)key};
+  MDB_val mdb_value;
+
+  mtx_lock(&snapshot->lock);
+  int rc = mdb_get(snapshot->txn, storage->dbi, &mdb_key, &mdb_value);
+  if (rc != MDB_SUCCESS)
+  {
+    mtx_unlock(&snapshot->lock);
+    if (rc != MDB_NOTFOUND)
+    {
+      set_lmdb_error(err, rc);
+    }
+
+    *value_size = 0;
+    record_storage_get(NULL, 0);
+    return NULL;
+  }
+
+  uint8_t *value = malloc(mdb_value.mv_size > 0 ? mdb_value.mv_size : 1);
+  assert(value != NULL);
+  memcpy(value, mdb_value.mv_data, mdb_value.mv_size);
+  *value_size = mdb_value.mv_size;
+  record_storage_get(value, mdb_value.mv_size);
+  mtx_unlock(&snapshot->lock);
+  return value;
+}
+
+static void update_storage_iterator(storage_iterator_t *iterator, MDB_cursor_op op)
+{
+  assert(iterator != NULL);
+  iterator->valid = iterator->cursor != NULL &&
+    mdb_cursor_get(iterator->cursor, &iterator->key, &iterator->value, op) == MDB_SUCCESS;
+}
+
+storage_iterator_t* storage_iterator_create(storage_t *storage)
+{
+  assert(storage != NULL);
+  storage_iterator_t *iterator = malloc(sizeof(storage_iterator_t));
+  assert(iterator != NULL);
+  iterator->storage = storage;
+  iterator->snapshot = NULL;
+  iterator->txn = NULL;
+  iterator->cursor = NULL;
+  iterator->valid = 0;
+
+  mtx_lock(&storage->read_txns_lock);
+  wait_for_lmdb_map_growth_nolock(storage);
+  if (begin_lmdb_read_txn_nolock(storage, &iterator->txn) != MDB_SUCCESS)
+  {
+    mtx_unlock(&storage->read_txns_lock);
+    iterator->txn = NULL;
+    return iterator;
+  }
+
+  storage->num_iterators++;
+  mtx_unlock(&storage->read_txns_lock);
+
+  if (mdb_cursor_open(iterator->txn, storage->dbi, &iterator->cursor) != MDB_SUCCESS)
+  {
+    iterator->cursor = NULL;
+  }
+
+  return iterator;
+}
+
+void storage_iterator_seek_to_first(storage_iterator_t *iterator)
+{
+  update_storage_iterator(iterator, MDB_FIRST);
+}
+
+void storage_iterator_seek(storage_iterator_t *iterator, const uint8_t *key, size_t key_size)
+{
+  assert(iterator != NULL);
+  iterator->key.mv_size = key_size;
+  iterator->key.mv_data = (void*)key;
+  update_storage_iterator(iterator, MDB_SET_RANGE);
+}
+
+int storage_iterator_valid(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  return iterator->valid;
+}
+
+void storage_iterator_next(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  assert(iterator->valid);
+  update_storage_iterator(iterator, MDB_NEXT);
+}
+
+const uint8_t* storage_iterator_key(storage_iterator_t *iterator, size_t *key_size)
+{
+  assert(iterator != NULL);
+  assert(iterator->valid);
+  *key_size = iterator->key.mv_size;
+  return (const uint8_t*)iterator->key.mv_data;
+}
+
+const uint8_t* storage_iterator_value(storage_iterator_t *iterator, size_t *value_size)
+{
+  assert(iterator != NULL);
+  assert(iterator->valid);
+  *value_size = iterator->value.mv_size;
+  return (const uint8_t*)iterator->value.mv_data;
+}
+
+void storage_iterator_destroy(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  if (iterator->cursor != NULL)
+  {
+    mdb_cursor_close(iterator->cursor);
+  }
+
+  if (iterator->snapshot != NULL)
+  {
+    mtx_unlock(&iterator->snapshot->lock);
+  }
+
+  if (iterator->txn != NULL)
+  {
+    mdb_txn_abort(iterator->txn);
+
+    storage_t *storage = iterator->storage;
+    mtx_lock(&storage->read_txns_lock);
+    assert(storage->num_iterators > 0);
+    storage->num_iterators--;
+    mtx_unlock(&storage->read_txns_lock);
+  }
+
+  free(iterator);
+}
+
+#else
+
+struct Storage
+{
+  rocksdb_t *db;
+  rocksdb_readoptions_t *roptions;
+  rocksdb_writeoptions_t *woptions;
+  char *path;
+  storage_options_t options;
+};
+
+struct StorageBatch
+{
+  rocksdb_writebatch_t *write_batch;
+};
+
+struct StorageIterator
+{
+  rocksdb_readoptions_t *roptions;
+  rocksdb_iterator_t *iterator;
+};
+
+struct StorageSnapshot
+{
+  const rocksdb_snapshot_t *snapshot;
+  rocksdb_readoptions_t *roptions;
+};
+
+struct StorageBackup
+{
+  char *path;
+  char *checkpoint_dir;
+  storage_options_t options;
+};
+
+const char* get_storage_backend_str(void)
+{
+  return "rocksdb";
+}
+
+int valid_compression_type(int compression_type)
+{
+  switch (compression_type)
+  {
+    case rocksdb_snappy_compression:
+    case rocksdb_zlib_compression:
+    case rocksdb_bz2_compression:
+    case rocksdb_lz4_compression:
+    case rocksdb_lz4hc_compression:
+    case rocksdb_xpress_compression:
+    case rocksdb_zstd_compression:
+      return 1;
+    case rocksdb_no_compression:
+    default:
+      return 0;
+  }
+}
+
+const char* get_compression_type_str(int compression_type)
+{
+  switch (compression_type)
+  {
+    case rocksdb_snappy_compression:
+      return "snappy";
+    case rocksdb_zlib_compression:
+      return "zlib";
+    case rocksdb_bz2_compression:
+      return "bz2";
+    case rocksdb_lz4_compression:
+      return "lz4";
+    case rocksdb_lz4hc_compression:
+      return "lz4hc";
+    case rocksdb_xpress_compression:
+      return "xpress";
+    case rocksdb_zstd_compression:
+      return "zstandard";
+    case rocksdb_no_compression:
+    default:
+      return "unknown";
+  }
+}
+
+int get_compression_type_from_str(const char *compression_type_str)
+{
+  if (string_equals(compression_type_str, "snappy"))
+  {
+    return rocksdb_snappy_compression;
+  }
+  else if (string_equals(compression_type_str, "zlib"))
+  {
+    return rocksdb_zlib_compression;
+  }
+  else if (string_equals(compression_type_str, "bz2"))
+  {
+    return rocksdb_bz2_compression;
+  }
+  else if (string_equals(compression_type_str, "lz4"))
+  {
+    return rocksdb_lz4_compression;
+  }
+  else if (string_equals(compression_type_str, "lz4hc"))
+  {
+    return rocksdb_lz4hc_compression;
+  }
+  else if (string_equals(compression_type_str, "xpress"))
+  {
+    return rocksdb_xpress_compression;
+  }
+  else if (string_equals(compression_type_str, "zstandard"))
+  {
+    return rocksdb_zstd_compression;
+  }
+
+  return rocksdb_no_compression;
+}
+
+int get_default_compression_type(void)
+{
+  return rocksdb_lz4_compression;
+}
+
+static rocksdb_options_t* make_rocksdb_options(storage_options_t *options)
+{
+  assert(options != NULL);
+  rocksdb_options_t *db_options = rocksdb_options_create();
+
+  // set the parallelism based on the number of logical cores available:
+  int total_threads = MAX(get_num_logical_cores(), 1);
+  total_threads = total_threads > 1 ? total_threads / 2 : total_threads;
+  rocksdb_options_increase_parallelism(db_options, total_threads);
+
+  rocksdb_options_optimize_level_style_compaction(db_options, DEFAULT_COMPACTION_MEMTABLE_MEMORY_BUDGET);
+  rocksdb_options_set_create_if_missing(db_options, 1);
+  if (options->num_background_jobs > 0)
+  {
+    rocksdb_options_set_max_background_jobs(db_options, (int)options->num_background_jobs);
+  }
+
+  if (options->write_buffer_size > 0)
+  {
+    rocksdb_options_set_write_buffer_size(db_options, options->write_buffer_size);
+  }
+
+  // the table options copy the cache and take ownership of the filter policy
+  rocksdb_block_based_table_options_t *table_options = rocksdb_block_based_options_create();
+  if (options->cache_size > 0)
+  {
+    rocksdb_cache_t *cache = rocksdb_cache_create_lru(options->cache_size);
+    rocksdb_block_based_options_set_block_cache(table_options, cache);
+    rocksdb_cache_destroy(cache);
+  }
+
+  if (options->bloom_bits_per_key > 0)
+  {
+    rocksdb_block_based_options_set_filter_policy(table_options,
+      rocksdb_filterpolicy_create_bloom_full((double)options->bloom_bits_per_key));
+  }
+
+  rocksdb_options_set_block_based_table_factory(db_options, table_options);
+  rocksdb_block_based_options_destroy(table_options);
+
+  // keys shorter than the prefix are outside of it's domain and are always
+  // looked up in total order, so every prefix scan stays correct either way...
+  if (options->prefix_length > 0)
+  {
+    rocksdb_options_set_prefix_extractor(db_options,
+      rocksdb_slicetransform_create_fixed_prefix(options->prefix_length));
+    rocksdb_options_set_memtable_prefix_bloom_size_ratio(db_options, 0.1);
+  }
+
+  if (options->want_compression)
+  {
+    rocksdb_options_set_compression(db_options, options->compression_type);
+  }
+
+  return db_options;
+}
+
+storage_t* storage_open(const char *path, storage_options_t *options, char **err)
+{
+  assert(path != NULL);
+  assert(options != NULL);
+
+  rocksdb_options_t *db_options = make_rocksdb_options(options);
+  rocksdb_t *db = rocksdb_open(db_options, path, err);
+  rocksdb_options_destroy(db_options);
+  if (*err != NULL)
+  {
+    return NULL;
+  }
+
+  storage_t *storage = malloc(sizeof(storage_t));
+  assert(storage != NULL);
+  storage->db = db;
+  storage->roptions = rocksdb_readoptions_create();
+  storage->woptions = rocksdb_writeoptions_create();
+  storage->path = malloc(strlen(path) + 1);
+  assert(storage->path != NULL);
+  strcpy(storage->path, path);
+  storage->options = *options;
+  return storage;
+}
+
+void storage_close(storage_t *storage)
+{
+  assert(storage != NULL);
+  if (storage->db != NULL)
+  {
+    rocksdb_close(storage->db);
+  }
+
+  rocksdb_readoptions_destroy(storage->roptions);
+  rocksdb_writeoptions_destroy(storage->woptions);
+  free(storage->path);
+  free(storage);
+}
+
+void storage_destroy(const char *path, char **err)
+{
+  assert(path != NULL);
+  rocksdb_options_t *options = rocksdb_options_create();
+  rocksdb_destroy_db(options, path, err);
+  rocksdb_options_destroy(options);
+}
+
+void storage_repair(const char *path, char **err)
+{
+  assert(path != NULL);
+  rocksdb_options_t *options = rocksdb_options_create();
+  rocksdb_options_set_create_if_missing(options, 1);
+  rocksdb_repair_db(options, path, err);
+  rocksdb_options_destroy(options);
+}
+
+void storage_free(void *ptr)
+{
+  rocksdb_free(ptr);
+}
+
+uint8_t* storage_get(storage_t *storage, const uint8_t *key, size_t key_size, size_t *value_size, char **err)
+{
+  assert(storage != NULL);
+  TRACE_SPAN("storage_get");
+  uint8_t *value = (uint8_t*)rocksdb_get(storage->db, storage->roptions, (const char*)key, key_size, value_size, err);
+  record_storage_get(value, *value_size);
+  return value;
+}
+
+void storage_put(storage_t *storage, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, char **err)
+{
+  assert(storage != NULL);
+  TRACE_SPAN("storage_put");
+  rocksdb_put(storage->db, storage->woptions, (const char*)key, key_size, (const char*)value, value_size, err);
+  record_storage_put(key_size, value_size);
+}
+
+void storage_delete(storage_t *storage, const uint8_t *key, size_t key_size, char **err)
+{
+  assert(storage != NULL);
+  TRACE_SPAN("storage_delete");
+  rocksdb_delete(storage->db, storage->woptions, (const char*)key, key_size, err);
+}
+
+storage_batch_t* storage_batch_create(void)
+{
+  storage_batch_t *batch = malloc(sizeof(storage_batch_t));
+  assert(batch != NULL);
+  batch->write_batch = rocksdb_writebatch_create();
+  return batch;
+}
+
+void storage_batch_put(storage_batch_t *batch, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size)
+{
+  assert(batch != NULL);
+  rocksdb_writebatch_put(batch->write_batch, (const char*)key, key_size, (const char*)value, value_size);
+  record_storage_put(key_size, value_size);
+}
+
+void storage_batch_delete(storage_batch_t *batch, const uint8_t *key, size_t key_size)
+{
+  assert(batch != NULL);
+  rocksdb_writebatch_delete(batch->write_batch, (const char*)key, key_size);
+}
+
+void storage_batch_clear(storage_batch_t *batch)
+{
+  assert(batch != NULL);
+  rocksdb_writebatch_clear(batch->write_batch);
+}
+
+void storage_batch_destroy(storage_batch_t *batch)
+{
+  assert(batch != NULL);
+  rocksdb_writebatch_destroy(batch->write_batch);
+  free(batch);
+}
+
+void storage_write(storage_t *storage, storage_batch_t *batch, char **err)
+{
+  assert(storage != NULL);
+  assert(batch != NULL);
+  TRACE_SPAN("storage_write");
+  rocksdb_write(storage->db, storage->woptions, batch->write_batch, err);
+}
+
+void storage_set_sync(storage_t *storage, int sync)
+{
+  assert(storage != NULL);
+  rocksdb_writeoptions_set_sync(storage->woptions, sync);
+}
+
+int storage_sync(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+  TRACE_SPAN("storage_sync");
+  rocksdb_flush_wal(storage->db, 1, err);
+  return *err != NULL;
+}
+
+void storage_set_write_ahead_log(storage_t *storage, int enabled)
+{
+  assert(storage != NULL);
+  rocksdb_writeoptions_disable_WAL(storage->woptions, enabled == 0);
+}
+
+int storage_flush(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+  TRACE_SPAN("storage_flush");
+  rocksdb_flushoptions_t *flush_options = rocksdb_flushoptions_create();
+  rocksdb_flushoptions_set_wait(flush_options, 1);
+  rocksdb_flush(storage->db, flush_options, err);
+  rocksdb_flushoptions_destroy(flush_options);
+  return *err != NULL;
+}
+
+storage_snapshot_t* storage_snapshot_create(storage_t *storage)
+{
+  assert(storage != NULL);
+  storage_snapshot_t *snapshot = malloc(sizeof(storage_snapshot_t));
+  assert(snapshot != NULL);
+  snapshot->snapshot = rocksdb_create_snapshot(storage->db);
+  snapshot->roptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_snapshot(snapshot->roptions, snapshot->snapshot);
+  return snapshot;
+}
+
+void storage_snapshot_release(storage_t *storage, storage_snapshot_t *snapshot)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  rocksdb_readoptions_destroy(snapshot->roptions);
+  rocksdb_release_snapshot(storage->db, snapshot->snapshot);
+  free(snapshot);
+}
+
+uint8_t* storage_snapshot_get(storage_t *storage, storage_snapshot_t *snapshot, const uint8_t *key, size_t key_size, size_t *value_size, char **err)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  uint8_t *value = (uint8_t*)rocksdb_get(storage->db, snapshot->roptions, (const char*)key, key_size, value_size, err);
+  record_storage_get(value, *value_size);
+  return value;
+}
+
+storage_iterator_t* storage_iterator_create(storage_t *storage)
+{
+  assert(storage != NULL);
+  storage_iterator_t *iterator = malloc(sizeof(storage_iterator_t));
+  assert(iterator != NULL);
+  iterator->roptions = rocksdb_readoptions_create();
+  iterator->iterator = rocksdb_create_iterator(storage->db, iterator->roptions);
+  return iterator;
+}
+
+storage_iterator_t* storage_snapshot_iterator_create(storage_t *storage, storage_snapshot_t *snapshot)
+{
+  assert(storage != NULL);
+  assert(snapshot != NULL);
+  storage_iterator_t *iterator = malloc(sizeof(storage_iterator_t));
+  assert(iterator != NULL);
+  iterator->roptions = rocksdb_readoptions_create();
+  rocksdb_readoptions_set_snapshot(iterator->roptions, snapshot->snapshot);
+  iterator->iterator = rocksdb_create_iterator(storage->db, iterator->roptions);
+  return iterator;
+}
+
+void storage_iterator_seek_to_first(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  rocksdb_iter_seek_to_first(iterator->iterator);
+}
+
+void storage_iterator_seek(storage_iterator_t *iterator, const uint8_t *key, size_t key_size)
+{
+  assert(iterator != NULL);
+  rocksdb_iter_seek(iterator->iterator, (const char*)key, key_size);
+}
+
+int storage_iterator_valid(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  return rocksdb_iter_valid(iterator->iterator) != 0;
+}
+
+void storage_iterator_next(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  rocksdb_iter_next(iterator->iterator);
+}
+
+const uint8_t* storage_iterator_key(storage_iterator_t *iterator, size_t *key_size)
+{
+  assert(iterator != NULL);
+  return (const uint8_t*)rocksdb_iter_key(iterator->iterator, key_size);
+}
+
+const uint8_t* storage_iterator_value(storage_iterator_t *iterator, size_t *value_size)
+{
+  assert(iterator != NULL);
+  return (const uint8_t*)rocksdb_iter_value(iterator->iterator, value_size);
+}
+
+void storage_iterator_destroy(storage_iterator_t *iterator)
+{
+  assert(iterator != NULL);
+  rocksdb_iter_destroy(iterator->iterator);
+  rocksdb_readoptions_destroy(iterator->roptions);
+  free(iterator);
+}
+
+#endif
+
+/*
+ * Removes every entry in the storage within a single write,
+ * lmdb empties it's database without iterating it...
+ */
+int storage_purge(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+#ifdef USE_LMDB
+  MDB_txn *txn = NULL;
+  int rc = mdb_txn_begin(storage->env, NULL, 0, &txn);
+  if (rc == MDB_SUCCESS)
+  {
+    rc = mdb_drop(txn, storage->dbi, 0);
+    if (rc == MDB_SUCCESS)
+    {
+      rc = mdb_txn_commit(txn);
+    }
+    else
+    {
+      mdb_txn_abort(txn);
+    }
+  }
+
+  if (rc != MDB_SUCCESS)
+  {
+    set_lmdb_error(err, rc);
+    return 1;
+  }
+
+  return 0;
+#else
+  storage_batch_t *batch = storage_batch_create();
+  storage_iterator_t *iterator = storage_iterator_create(storage);
+  for (storage_iterator_seek_to_first(iterator);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
+  {
+    size_t key_size = 0;
+    const uint8_t *key = storage_iterator_key(iterator, &key_size);
+    assert(key != NULL);
+    storage_batch_delete(batch, key, key_size);
+  }
+
+  storage_iterator_destroy(iterator);
+  storage_write(storage, batch, err);
+  storage_batch_destroy(batch);
+  return *err != NULL;
+#endif
+}
+
+int storage_copy(storage_t *from_storage, storage_t *to_storage, char **err)
+{
+  assert(from_storage != NULL);
+  assert(to_storage != NULL);
+
+  storage_batch_t *batch = storage_batch_create();
+  storage_iterator_t *iterator = storage_iterator_create(from_storage);
+  for (storage_iterator_seek_to_first(iterator);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
+  {
+    size_t key_size = 0;
+    const uint8_t *key = storage_iterator_key(iterator, &key_size);
+    assert(key != NULL);
+
+    size_t value_size = 0;
+    const uint8_t *value = storage_iterator_value(iterator, &value_size);
+    assert(value != NULL);
+    storage_batch_put(batch, key, key_size, value, value_size);
+  }
+
+  storage_iterator_destroy(iterator);
+  storage_write(to_storage, batch, err);
+  storage_batch_destroy(batch);
+  return *err != NULL;
+}
+
+#if defined(USE_LEVELDB)
+
+/*
+ * The backup of a leveldb database is a second database holding
+ * a copy of every entry of the database it was made from...
+ */
+storage_backup_t* storage_backup_open(const char *path, storage_options_t *options, char **err)
+{
+  storage_t *storage = storage_open(path, options, err);
+  if (storage == NULL)
+  {
+    return NULL;
+  }
+
+  storage_backup_t *backup = malloc(sizeof(storage_backup_t));
+  assert(backup != NULL);
+  backup->storage = storage;
+  return backup;
+}
+
+void storage_backup_close(storage_backup_t *backup)
+{
+  assert(backup != NULL);
+  storage_close(backup->storage);
+  free(backup);
+}
+
+void storage_backup_destroy(const char *path, char **err)
+{
+  storage_destroy(path, err);
+}
+
+int storage_backup_create(storage_backup_t *backup, storage_t *storage, char **err)
+{
+  assert(backup != NULL);
+  assert(storage != NULL);
+  return storage_purge(backup->storage, err) || storage_copy(storage, backup->storage, err);
+}
+
+int storage_backup_restore(storage_backup_t *backup, storage_t *storage, char **err)
+{
+  assert(backup != NULL);
+  assert(storage != NULL);
+  return storage_purge(storage, err) || storage_copy(backup->storage, storage, err);
+}
+
+#elif defined(USE_LMDB)
+
+/*
+ * The backup of an lmdb database is a compacted copy of it's data file,
+ * restoring it copies the data file back while the database is closed...
+ */
+static int copy_lmdb_file(const char *from_filepath, const char *to_filepath)
+{
+  FILE *from_file = fopen(from_filepath, "rb");
+  if (from_file == NULL)
+  {
+    return errno;
+  }
+
+  FILE *to_file = fopen(to_filepath, "wb");
+  if (to_file == NULL)
+  {
+    int rc = errno;
+    fclose(from_file);
+    return rc;
+  }
+
+  int rc = MDB_SUCCESS;
+  uint8_t chunk[1024 * 64];
+  size_t chunk_size = 0;
+  while ((chunk_size = fread(chunk, 1, sizeof(chunk), from_file)) > 0)
+  {
+    if (fwrite(chunk, 1, chunk_size, to_file) != chunk_size)
+    {
+      rc = EIO;
+      break;
+    }
+  }
+
+  if (ferror(from_file))
+  {
+    rc = EIO;
+  }
+
+  fclose(from_file);
+  if (fclose(to_file) != 0 && rc == MDB_SUCCESS)
+  {
+    rc = EIO;
+  }
+
+  return rc;
+}
+
+storage_backup_t* storage_backup_open(const char *path, storage_options_t *options, char **err)
+{
+  assert(path != NULL);
+  if (mkdir(path, 0775) != 0 && errno != EEXIST)
+  {
+    set_lmdb_error(err, errno);
+    return NULL;
+  }
+
+  storage_backup_t *backup = malloc(sizeof(storage_backup_t));
+  assert(backup != NULL);
+  backup->path = malloc(strlen(path) + 1);
+  assert(backup->path != NULL);
+  strcpy(backup->path, path);
+  return backup;
+}
+
+void storage_backup_close(storage_backup_t *backup)
+{
+  assert(backup != NULL);
+  free(backup->path);
+  free(backup);
+}
+
+void storage_backup_destroy(const char *path, char **err)
+{
+  storage_destroy(path, err);
+}
+
+int storage_backup_create(storage_backup_t *backup, storage_t *storage, char **err)
+{
+  assert(backup != NULL);
+  assert(storage != NULL);
+
+  // lmdb refuses to copy over an existing data file
+  char *data_filepath = get_lmdb_filepath(backup->path, LMDB_DATA_FILENAME);
+  int rc = MDB_SUCCESS;
+  if (unlink(data_filepath) != 0 && errno != ENOENT)
+  {
+    rc = errno;
+  }
+
+  free(data_filepath);
+  if (rc == MDB_SUCCESS)
+  {
+    rc = mdb_env_copy2(storage->env, backup->path, MDB_CP_COMPACT);
+  }
+
+  if (rc != MDB_SUCCESS)
+  {
+    set_lmdb_error(err, rc);
+    return 1;
+  }
+
+  return 0;
+}
+
+int storage_backup_restore(storage_backup_t *backup, storage_t *storage, char **err)
+{
+  assert(backup != NULL);
+  assert(storage != NULL);
+
+  mdb_dbi_close(storage->env, storage->dbi);
+  mdb_env_close(storage->env);
+  storage->env = NULL;
+
+  char *from_filepath = get_lmdb_filepath(backup->path, LMDB_DATA_FILENAME);
+  char *to_filepath = get_lmdb_filepath(storage->path, LMDB_DATA_FILENAME);
+  int rc = copy_lmdb_file(from_filepath, to_filepath);
+  free(from_filepath);
+  free(to_filepath);
+
+  // the database is reopened even when the copy failed
+  int open_rc = open_lmdb_env(storage);
+  if (rc == MDB_SUCCESS)
+  {
+    rc = open_rc;
+  }
+
+  if (rc != MDB_SUCCESS)
+  {
+    set_lmdb_error(err, rc);
+    return 1;
+  }
+
+  return 0;
+}
+
+#else
+
+/*
+ * The backup of a rocksdb database is a checkpoint, it's table files are hard linked
+ * to the ones of the database instead of being copied. Creating or restoring a backup
+ * only costs the number of files in the database rather than the size of it...
+ */
+#define ROCKSDB_CHECKPOINT_DIRNAME "checkpoint"
+
+static char* get_rocksdb_checkpoint_dir(const char *path)
+{
+  size_t checkpoint_dir_size = strlen(path) + strlen(ROCKSDB_CHECKPOINT_DIRNAME) + 2;
+  char *checkpoint_dir = malloc(checkpoint_dir_size);
+  assert(checkpoint_dir != NULL);
+  snprintf(checkpoint_dir, checkpoint_dir_size, "%s/%s", path, ROCKSDB_CHECKPOINT_DIRNAME);
+  return checkpoint_dir;
+}
+
+static void create_rocksdb_checkpoint(rocksdb_t *db, const char *checkpoint_dir, char **err)
+{
+  assert(db != NULL);
+  assert(checkpoint_dir != NULL);
+
+  rocksdb_checkpoint_t *checkpoint = rocksdb_checkpoint_object_create(db, err);
+  if (*err != NULL)
+  {
+    return;
+  }
+
+  // a log size of 0 flushes the memtable so the checkpoint is made of table files only
+  rocksdb_checkpoint_create(checkpoint, checkpoint_dir, 0, err);
+  rocksdb_checkpoint_object_destroy(checkpoint);
+}
+
+storage_backup_t* storage_backup_open(const char *path, storage_options_t *options, char **err)
+{
+  assert(path != NULL);
+  assert(options != NULL);
+
+  // the checkpoint is made in a directory of it's own, rocksdb creates it
+  // and refuses to make a checkpoint over a directory that already exists...
+  if (mkdir(path, 0775) != 0 && errno != EEXIST)
+  {
+    const char *error_str = strerror(errno);
+    *err = malloc(strlen(error_str) + 1);
+    assert(*err != NULL);
+    strcpy(*err, error_str);
+    return NULL;
+  }
+
+  storage_backup_t *backup = malloc(sizeof(storage_backup_t));
+  assert(backup != NULL);
+  backup->path = malloc(strlen(path) + 1);
+  assert(backup->path != NULL);
+  strcpy(backup->path, path);
+  backup->checkpoint_dir = get_rocksdb_checkpoint_dir(path);
+  backup->options = *options;
+  return backup;
+}
+
+void storage_backup_close(storage_backup_t *backup)
+{
+  assert(backup != NULL);
+  free(backup->path);
+  free(backup->checkpoint_dir);
+  free(backup);
+}
+
+void storage_backup_destroy(const char *path, char **err)
+{
+  assert(path != NULL);
+  char *checkpoint_dir = get_rocksdb_checkpoint_dir(path);
+  storage_destroy(checkpoint_dir, err);
+  free(checkpoint_dir);
+  if (*err == NULL)
+  {
+    rmdir(path);
+  }
+}
+
+int storage_backup_create(storage_backup_t *backup, storage_t *storage, char **err)
+{
+  assert(backup != NULL);
+  assert(storage != NULL);
+
+  // only the latest backup is ever kept, the old checkpoint is removed first
+  storage_destroy(backup->checkpoint_dir, err);
+  if (*err != NULL)
+  {
+    return 1;
+  }
+
+  create_rocksdb_checkpoint(storage->db, backup->checkpoint_dir, err);
+  return *err != NULL;
+}
+
+int storage_backup_restore(storage_backup_t *backup, storage_t *storage, char **err)
+{
+  assert(backup != NULL);
+  assert(storage != NULL);
+
+  // open the checkpoint before touching the database, so a missing
+  // backup leaves the database the way it was...
+  rocksdb_options_t *db_options = make_rocksdb_options(&backup->options);
+  rocksdb_options_set_create_if_missing(db_options, 0);
+  rocksdb_t *checkpoint_db = rocksdb_open(db_options, backup->checkpoint_dir, err);
+  rocksdb_options_destroy(db_options);
+  if (*err != NULL)
+  {
+    return 1;
+  }
+
+  // the database is replaced by a checkpoint of the checkpoint
+  rocksdb_close(storage->db);
+  storage->db = NULL;
+
+  storage_destroy(storage->path, err);
+  if (*err == NULL)
+  {
+    create_rocksdb_checkpoint(checkpoint_db, storage->path, err);
+  }
+
+  rocksdb_close(checkpoint_db);
+
+  // the database is reopened even when the restore failed
+  char *open_err = NULL;
+  db_options = make_rocksdb_options(&storage->options);
+  storage->db = rocksdb_open(db_options, storage->path, &open_err);
+  rocksdb_options_destroy(db_options);
+  if (open_err != NULL)
+  {
+    if (*err == NULL)
+    {
+      *err = open_err;
+    }
+    else
+    {
+      rocksdb_free(open_err);
+    }
+  }
+
+  return *err != NULL;
+}
+
+#endif
+
+/*
+ * A bulk load writes a large number of entries whose keys are put in strictly
+ * ascending order, rocksdb writes them to a table file of it's own which is then
+ * ingested into the database without going through the memtable or write ahead log.
+ * leveldb and lmdb fall back to writing the entries in batches...
+ */
+#if defined(USE_LEVELDB) || defined(USE_LMDB)
+
+#define STORAGE_BULK_LOAD_MAX_BATCH_ENTRIES 10000
+
+struct StorageBulkLoad
+{
+  storage_t *storage;
+  storage_batch_t *batch;
+  size_t num_batch_entries;
+};
+
+storage_bulk_load_t* storage_bulk_load_create(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+  storage_bulk_load_t *bulk_load = malloc(sizeof(storage_bulk_load_t));
+  assert(bulk_load != NULL);
+  bulk_load->storage = storage;
+  bulk_load->batch = storage_batch_create();
+  bulk_load->num_batch_entries = 0;
+  return bulk_load;
+}
+
+void storage_bulk_load_put(storage_bulk_load_t *bulk_load, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, char **err)
+{
+  assert(bulk_load != NULL);
+  storage_batch_put(bulk_load->batch, key, key_size, value, value_size);
+  bulk_load->num_batch_entries++;
+  if (bulk_load->num_batch_entries >= STORAGE_BULK_LOAD_MAX_BATCH_ENTRIES)
+  {
+    storage_write(bulk_load->storage, bulk_load->batch, err);
+    storage_batch_clear(bulk_load->batch);
+    bulk_load->num_batch_entries = 0;
+  }
+}
+
+int storage_bulk_load_finish(storage_bulk_load_t *bulk_load, char **err)
+{
+  assert(bulk_load != NULL);
+  if (bulk_load->num_batch_entries > 0)
+  {
+    storage_write(bulk_load->storage, bulk_load->batch, err);
+    storage_batch_clear(bulk_load->batch);
+    bulk_load->num_batch_entries = 0;
+  }
+
+  return *err != NULL;
+}
+
+void storage_bulk_load_destroy(storage_bulk_load_t *bulk_load)
+{
+  assert(bulk_load != NULL);
+  storage_batch_destroy(bulk_load->batch);
+  free(bulk_load);
+}
+
+#else
+
+#define ROCKSDB_BULK_LOAD_FILENAME "bulk_load.sst"
+
+struct StorageBulkLoad
+{
+  storage_t *storage;
+  rocksdb_envoptions_t *env_options;
+  rocksdb_sstfilewriter_t *writer;
+  char *filepath;
+  size_t num_entries;
+};
+
+storage_bulk_load_t* storage_bulk_load_create(storage_t *storage, char **err)
+{
+  assert(storage != NULL);
+  size_t filepath_size = strlen(storage->path) + strlen(ROCKSDB_BULK_LOAD_FILENAME) + 2;
+  char *filepath = malloc(filepath_size);
+  assert(filepath != NULL);
+  snprintf(filepath, filepath_size, "%s/%s", storage->path, ROCKSDB_BULK_LOAD_FILENAME);
+
+  // the table file must be written with the options of the database it is ingested into
+  rocksdb_options_t *db_options = make_rocksdb_options(&storage->options);
+  rocksdb_envoptions_t *env_options = rocksdb_envoptions_create();
+  rocksdb_sstfilewriter_t *writer = rocksdb_sstfilewriter_create(env_options, db_options);
+  rocksdb_options_destroy(db_options);
+
+  rocksdb_sstfilewriter_open(writer, filepath, err);
+  if (*err != NULL)
+  {
+    rocksdb_sstfilewriter_destroy(writer);
+    rocksdb_envoptions_destroy(env_options);
+    free(filepath);
+    return NULL;
+  }
+
+  storage_bulk_load_t *bulk_load = malloc(sizeof(storage_bulk_load_t));
+  assert(bulk_load != NULL);
+  bulk_load->storage = storage;
+  bulk_load->env_options = env_options;
+  bulk_load->writer = writer;
+  bulk_load->filepath = filepath;
+  bulk_load->num_entries = 0;
+  return bulk_load;
+}
+
+void storage_bulk_load_put(storage_bulk_load_t *bulk_load, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, char **err)
+{
+  assert(bulk_load != NULL);
+  rocksdb_sstfilewriter_put(bulk_load->writer, (const char*)key, key_size, (const char*)value, value_size, err);
+  bulk_load->num_entries++;
+}
+
+int storage_bulk_load_finish(storage_bulk_load_t *bulk_load, char **err)
+{
+  assert(bulk_load != NULL);
+
+  // rocksdb refuses to finish a table file without any entries in it
+  if (bulk_load->num_entries == 0)
+  {
+    return 0;
+  }
+
+  rocksdb_sstfilewriter_finish(bulk_load->writer, err);
+  if (*err != NULL)
+  {
+    return 1;
+  }
+
+  // the table file is moved into the database rather than copied
+  const char *filepaths[1] = {bulk_load->filepath};
+  rocksdb_ingestexternalfileoptions_t *ingest_options = rocksdb_ingestexternalfileoptions_create();
+  rocksdb_ingestexternalfileoptions_set_move_files(ingest_options, 1);
+  rocksdb_ingest_external_file(bulk_load->storage->db, filepaths, 1, ingest_options, err);
+  rocksdb_ingestexternalfileoptions_destroy(ingest_options);
+  bulk_load->num_entries = 0;
+  return *err != NULL;
+}
+
+void storage_bulk_load_destroy(storage_bulk_load_t *bulk_load)
+{
+  assert(bulk_load != NULL);
+  rocksdb_sstfilewriter_destroy(bulk_load->writer);
+  rocksdb_envoptions_destroy(bulk_load->env_options);
+
+  // a table file that was never ingested is not left behind
+  unlink(bulk_load->filepath);
+  free(bulk_load->filepath);
+  free(bulk_load);
+}
+
+#endif
+
+/*
+ * Reads a number of keys at once, the value of each key is put at the same index of values
+ * and is NULL if the key was not found, each value is later to be free'd with `storage_free`.
+ * rocksdb looks the keys up together so the reads of keys which share a block are batched,
+ * leveldb and lmdb fall back to reading the keys one by one...
+ */
+#if defined(USE_LEVELDB) || defined(USE_LMDB)
+
+int storage_multi_get(storage_t *storage, size_t num_keys, const uint8_t **keys, const size_t *key_sizes, uint8_t **values, size_t *value_sizes, char **err)
+{
+  assert(storage != NULL);
+  assert(keys != NULL);
+  assert(key_sizes != NULL);
+  assert(values != NULL);
+  assert(value_sizes != NULL);
+  for (size_t i = 0; i < num_keys; i++)
+  {
+    char *key_err = NULL;
+    values[i] = storage_get(storage, keys[i], key_sizes[i], &value_sizes[i], &key_err);
+    if (key_err == NULL)
+    {
+      continue;
+    }
+
+    // only the first error is reported, the remaining keys are still read
+    if (*err == NULL)
+    {
+      *err = key_err;
+    }
+    else
+    {
+      storage_free(key_err);
+    }
+  }
+
+  return *err != NULL;
+}
+
+#else
+
+int storage_multi_get(storage_t *storage, size_t num_keys, const uint8_t **keys, const size_t *key_sizes, uint8_t **values, size_t *value_sizes, char **err)
+{
+  assert(storage != NULL);
+  assert(keys != NULL);
+  assert(key_sizes != NULL);
+  assert(values != NULL);
+  assert(value_sizes != NULL);
+  if (num_keys == 0)
+  {
+    return 0;
+  }
+
+  TRACE_SPAN("storage_multi_get");
+  char **errs = malloc(sizeof(char*) * num_keys);
+  assert(errs != NULL);
+
+  rocksdb_multi_get(storage->db, storage->roptions, num_keys, (const char* const*)keys, key_sizes, (char**)values, value_sizes, errs);
+  for (size_t i = 0; i < num_keys; i++)
+  {
+    if (errs[i] == NULL)
+    {
+      record_storage_get(values[i], value_sizes[i]);
+      continue;
+    }
+
+    // only the first error is reported, the values of the other keys are still returned
+    if (*err == NULL)
+    {
+      *err = errs[i];
+    }
+    else
+    {
+      storage_free(errs[i]);
+    }
+  }
+
+  free(errs);
+  return *err != NULL;
+}
+
+#endif
@@ -0,0 +1,133 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+// the storage interface hides the key value database the blockchain and wallet are stored in,
+// the backend is chosen at build time with USE_LEVELDB, USE_LMDB or otherwise RocksDB. Errors
+// are returned through the err out parameter and must later be free'd with `storage_free`...
+typedef struct Storage storage_t;
+typedef struct StorageBatch storage_batch_t;
+typedef struct StorageIterator storage_iterator_t;
+typedef struct StorageBackup storage_backup_t;
+typedef struct StorageBulkLoad storage_bulk_load_t;
+typedef struct StorageSnapshot storage_snapshot_t;
+
+// a cache size, bloom bits per key, background job count, write buffer size or map size
+// of 0 leaves the backend's own default in place, the options that a backend does not
+// support are ignored...
+typedef struct StorageOptions
+{
+  int want_compression;
+  int compression_type;
+  size_t cache_size;
+  uint32_t bloom_bits_per_key;
+  size_t prefix_length;
+  uint32_t num_background_jobs;
+  size_t write_buffer_size;
+  size_t map_size;
+} storage_options_t;
+
+VULKAN_API const char* get_storage_backend_str(void);
+
+VULKAN_API int valid_compression_type(int compression_type);
+VULKAN_API const char* get_compression_type_str(int compression_type);
+VULKAN_API int get_compression_type_from_str(const char *compression_type_str);
+VULKAN_API int get_default_compression_type(void);
+
+VULKAN_API void init_storage_options(storage_options_t *options);
+VULKAN_API void register_storage_metrics(void);
+VULKAN_API uint64_t get_storage_put_bytes(void);
+
+VULKAN_API storage_t* storage_open(const char *path, storage_options_t *options, char **err);
+VULKAN_API void storage_close(storage_t *storage);
+VULKAN_API void storage_destroy(const char *path, char **err);
+VULKAN_API void storage_repair(const char *path, char **err);
+VULKAN_API void storage_free(void *ptr);
+
+VULKAN_API uint8_t* storage_get(storage_t *storage, const uint8_t *key, size_t key_size, size_t *value_size, char **err);
+VULKAN_API void storage_put(storage_t *storage, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, char **err);
+VULKAN_API void storage_delete(storage_t *storage, const uint8_t *key, size_t key_size, char **err);
+VULKAN_API int storage_multi_get(storage_t *storage, size_t num_keys, const uint8_t **keys, const size_t *key_sizes, uint8_t **values, size_t *value_sizes, char **err);
+
+VULKAN_API storage_batch_t* storage_batch_create(void);
+VULKAN_API void storage_batch_put(storage_batch_t *batch, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size);
+VULKAN_API void storage_batch_delete(storage_batch_t *batch, const uint8_t *key, size_t key_size);
+VULKAN_API void storage_batch_clear(storage_batch_t *batch);
+VULKAN_API void storage_batch_destroy(storage_batch_t *batch);
+VULKAN_API void storage_write(storage_t *storage, storage_batch_t *batch, char **err);
+
+// writes are only synced to disk one by one when sync is enabled, otherwise the
+// writes made so far are synced with `storage_sync`...
+VULKAN_API void storage_set_sync(storage_t *storage, int sync);
+VULKAN_API int storage_sync(storage_t *storage, char **err);
+
+// writes made while the write ahead log is disabled can be lost on a crash
+// until they have been flushed to disk with `storage_flush`...
+VULKAN_API void storage_set_write_ahead_log(storage_t *storage, int enabled);
+VULKAN_API int storage_flush(storage_t *storage, char **err);
+
+// a snapshot reads the storage as it was when the snapshot was created, the storage can
+// be read through it from any thread while writes continue...
+VULKAN_API storage_snapshot_t* storage_snapshot_create(storage_t *storage);
+VULKAN_API void storage_snapshot_release(storage_t *storage, storage_snapshot_t *snapshot);
+VULKAN_API uint8_t* storage_snapshot_get(storage_t *storage, storage_snapshot_t *snapshot, const uint8_t *key, size_t key_size, size_t *value_size, char **err);
+
+VULKAN_API storage_iterator_t* storage_iterator_create(storage_t *storage);
+
+// an iterator over a snapshot must be destroyed before the snapshot is released
+VULKAN_API storage_iterator_t* storage_snapshot_iterator_create(storage_t *storage, storage_snapshot_t *snapshot);
+VULKAN_API void storage_iterator_seek_to_first(storage_iterator_t *iterator);
+VULKAN_API void storage_iterator_seek(storage_iterator_t *iterator, const uint8_t *key, size_t key_size);
+VULKAN_API int storage_iterator_valid(storage_iterator_t *iterator);
+VULKAN_API void storage_iterator_next(storage_iterator_t *iterator);
+VULKAN_API const uint8_t* storage_iterator_key(storage_iterator_t *iterator, size_t *key_size);
+VULKAN_API const uint8_t* storage_iterator_value(storage_iterator_t *iterator, size_t *value_size);
+VULKAN_API void storage_iterator_destroy(storage_iterator_t *iterator);
+
+VULKAN_API int storage_purge(storage_t *storage, char **err);
+VULKAN_API int storage_copy(storage_t *from_storage, storage_t *to_storage, char **err);
+
+VULKAN_API storage_backup_t* storage_backup_open(const char *path, storage_options_t *options, char **err);
+VULKAN_API void storage_backup_close(storage_backup_t *backup);
+VULKAN_API void storage_backup_destroy(const char *path, char **err);
+VULKAN_API int storage_backup_create(storage_backup_t *backup, storage_t *storage, char **err);
+VULKAN_API int storage_backup_restore(storage_backup_t *backup, storage_t *storage, char **err);
+
+// the keys of a bulk load must be put in strictly ascending order, the entries
+// are only guaranteed to be in the storage once `storage_bulk_load_finish` returned...
+VULKAN_API storage_bulk_load_t* storage_bulk_load_create(storage_t *storage, char **err);
+VULKAN_API void storage_bulk_load_put(storage_bulk_load_t *bulk_load, const uint8_t *key, size_t key_size, const uint8_t *value, size_t value_size, char **err);
+VULKAN_API int storage_bulk_load_finish(storage_bulk_load_t *bulk_load, char **err);
+VULKAN_API void storage_bulk_load_destroy(storage_bulk_load_t *bulk_load);
+
+VULKAN_END_DECL
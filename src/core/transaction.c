@@ -39,6 +39,7 @@
 #include "common/vec.h"
 
 #include "blockchain.h"
+#include "flat_transactions.h"
 #include "transaction.h"
 
 #include "crypto/cryptoutil.h"
@@ -57,22 +58,28 @@ static const uint8_t g_transaction_zero_hash[HASH_SIZE] = {
   0x00, 0x00, 0x00, 0x00
 };
 
-transaction_t* make_transaction(void)
+static void* alloc_tx_memory(arena_t *arena, size_t size)
 {
-  transaction_t *tx = malloc(sizeof(transaction_t));
-  assert(tx != NULL);
+  void *data = arena != NULL ? arena_alloc(arena, size) : malloc(size);
+  assert(data != NULL);
+  return data;
+}
+
+static transaction_t* make_transaction_in(arena_t *arena)
+{
+  transaction_t *tx = alloc_tx_memory(arena, sizeof(transaction_t));
   memset(tx->id, 0, HASH_SIZE);
   tx->txin_count = 0;
   tx->txout_count = 0;
   tx->txins = NULL;
   tx->txouts = NULL;
+  tx->has_cached_id = 0;
   return tx;
 }
 
-input_transaction_t* make_txin(void)
+static input_transaction_t* make_txin_in(arena_t *arena)
 {
-  input_transaction_t *txin = malloc(sizeof(input_transaction_t));
-  assert(txin != NULL);
+  input_transaction_t *txin = alloc_tx_memory(arena, sizeof(input_transaction_t));
   memset(txin->transaction, 0, HASH_SIZE);
   txin->txout_index = 0;
   memset(txin->signature, 0, crypto_sign_BYTES);
@@ -80,15 +87,29 @@ input_transaction_t* make_txin(void)
   return txin;
 }
 
-output_transaction_t* make_txout(void)
+static output_transaction_t* make_txout_in(arena_t *arena)
 {
-  output_transaction_t *txout = malloc(sizeof(output_transaction_t));
-  assert(txout != NULL);
+  output_transaction_t *txout = alloc_tx_memory(arena, sizeof(output_transaction_t));
   txout->amount = 0;
   memset(txout->address, 0, ADDRESS_SIZE);
   return txout;
 }
 
+transaction_t* make_transaction(void)
+{
+  return make_transaction_in(NULL);
+}
+
+input_transaction_t* make_txin(void)
+{
+  return make_txin_in(NULL);
+}
+
+output_transaction_t* make_txout(void)
+{
+  return make_txout_in(NULL);
+}
+
 unspent_output_transaction_t* make_unspent_txout(void)
 {
   unspent_output_transaction_t *unspent_txout = malloc(sizeof(unspent_output_transaction_t));
@@ -133,9 +154,64 @@ int sign_txin(input_transaction_t *txin, transaction_t *tx, uint8_t *public_key,
   crypto_sign_detached(txin->signature, NULL, header, header_size, secret_key);
 
   memcpy(txin->public_key, public_key, crypto_sign_PUBLICKEYBYTES);
+  tx->has_cached_id = 0;
   return 0;
 }
 
+/*
+ * Signs the txins from start txin index up to end txin index with the sign header of the tx,
+ * the sign header is computed once by the caller with `get_tx_sign_header` so that it is not
+ * rebuilt for every txin. The txins of a tx may be signed from several threads at once as long
+ * as their ranges do not overlap, the caller clears the tx's cached id once all are signed.
+ */
+int sign_txins_with_sign_header(transaction_t *tx, uint32_t start_txin_index, uint32_t end_txin_index,
+  const uint8_t *sign_header, uint32_t sign_header_size, uint8_t *public_key, uint8_t *secret_key)
+{
+  assert(tx != NULL);
+  assert(start_txin_index <= end_txin_index);
+  assert(end_txin_index <= tx->txin_count);
+  assert(sign_header != NULL);
+  assert(public_key != NULL);
+  assert(secret_key != NULL);
+
+  uint32_t header_size = TXIN_HEADER_SIZE + sign_header_size;
+  uint8_t *header = malloc(header_size);
+  assert(header != NULL);
+  memcpy(header + TXIN_HEADER_SIZE, sign_header, sign_header_size);
+
+  for (uint32_t txin_index = start_txin_index; txin_index < end_txin_index; txin_index++)
+  {
+    input_transaction_t *txin = tx->txins[txin_index];
+    assert(txin != NULL);
+
+    get_txin_header(header, txin);
+    crypto_sign_detached(txin->signature, NULL, header, header_size, secret_key);
+    memcpy(txin->public_key, public_key, crypto_sign_PUBLICKEYBYTES);
+  }
+
+  free(header);
+  return 0;
+}
+
+/*
+ * Signs every txin of the tx, the tx's sign header is only built once for all of them.
+ */
+int sign_txins(transaction_t *tx, uint8_t *public_key, uint8_t *secret_key)
+{
+  assert(tx != NULL);
+  uint32_t sign_header_size = get_tx_sign_header_size(tx);
+  uint8_t *sign_header = malloc(sign_header_size > 0 ? sign_header_size : 1);
+  assert(sign_header != NULL);
+  get_tx_sign_header(sign_header, tx);
+
+  int result = sign_txins_with_sign_header(tx, 0, tx->txin_count, sign_header,
+    sign_header_size, public_key, secret_key);
+
+  free(sign_header);
+  tx->has_cached_id = 0;
+  return result;
+}
+
 int validate_txin_signature(transaction_t *tx, input_transaction_t *txin)
 {
   assert(tx != NULL);
@@ -149,27 +225,167 @@ int validate_txin_signature(transaction_t *tx, input_transaction_t *txin)
 
   if (crypto_sign_verify_detached(txin->signature, header, header_size, txin->public_key) != 0)
   {
-    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-    char *public_key_str = bin2hex(txin->public_key, crypto_sign_PUBLICKEYBYTES);
-    LOG_ERROR("Failed to verify signature for transaction: %s with public key: %s!", tx_hash_str, public_key_str);
-    free(tx_hash_str);
-    free(public_key_str);
+    LOG_ERROR("Failed to verify signature for transaction: %s with public key: %s!", HASH2HEX_STR(tx->id), BIN2HEX_STR(txin->public_key, crypto_sign_PUBLICKEYBYTES));
     return 1;
   }
 
   return 0;
 }
 
+static void log_txin_signature_failure(transaction_t *tx, input_transaction_t *txin)
+{
+  LOG_ERROR("Failed to verify signature for transaction: %s with public key: %s!", HASH2HEX_STR(tx->id), BIN2HEX_STR(txin->public_key, crypto_sign_PUBLICKEYBYTES));
+}
+
 int validate_tx_signatures(transaction_t *tx)
 {
   assert(tx != NULL);
+  if (tx->txin_count == 0)
+  {
+    return 0;
+  }
+
+  // the sign header is the same for every txin, so build it once
+  // and only replace the txin header in front of it for each txin...
+  uint32_t header_size = get_tx_sign_header_size(tx) + TXIN_HEADER_SIZE;
+  uint8_t *header = malloc(header_size);
+  assert(header != NULL);
+  get_tx_sign_header(header + TXIN_HEADER_SIZE, tx);
+
   for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
   {
     input_transaction_t *txin = tx->txins[txin_index];
     assert(txin != NULL);
 
-    if (validate_txin_signature(tx, txin))
+    get_txin_header(header, txin);
+    if (crypto_sign_verify_detached(txin->signature, header, header_size, txin->public_key) != 0)
     {
+      log_txin_signature_failure(tx, txin);
+      free(header);
+      return 1;
+    }
+  }
+
+  free(header);
+  return 0;
+}
+
+size_t get_tx_signature_data_size(transaction_t *tx)
+{
+  assert(tx != NULL);
+  return (size_t)tx->txin_count * (TXIN_HEADER_SIZE + get_tx_sign_header_size(tx));
+}
+
+signature_batch_t* init_signature_batch(uint32_t max_checks, size_t max_message_data_size)
+{
+  signature_batch_t *signature_batch = malloc(sizeof(signature_batch_t));
+  assert(signature_batch != NULL);
+
+  signature_batch->checks = NULL;
+  signature_batch->message_data = NULL;
+  if (max_checks > 0)
+  {
+    signature_batch->checks = malloc(sizeof(txin_signature_check_t) * max_checks);
+    assert(signature_batch->checks != NULL);
+  }
+
+  if (max_message_data_size > 0)
+  {
+    signature_batch->message_data = malloc(max_message_data_size);
+    assert(signature_batch->message_data != NULL);
+  }
+
+  signature_batch->num_checks = 0;
+  signature_batch->max_checks = max_checks;
+  signature_batch->message_data_size = 0;
+  signature_batch->max_message_data_size = max_message_data_size;
+  return signature_batch;
+}
+
+void free_signature_batch(signature_batch_t *signature_batch)
+{
+  assert(signature_batch != NULL);
+  if (signature_batch->checks != NULL)
+  {
+    free(signature_batch->checks);
+  }
+
+  if (signature_batch->message_data != NULL)
+  {
+    free(signature_batch->message_data);
+  }
+
+  free(signature_batch);
+}
+
+/*
+ * Gathers a signature check for every txin of the tx, the sign header of
+ * the tx is only built once and copied after each txin header.
+ */
+int add_tx_to_signature_batch(signature_batch_t *signature_batch, transaction_t *tx)
+{
+  assert(signature_batch != NULL);
+  assert(tx != NULL);
+
+  if (signature_batch->num_checks + tx->txin_count > signature_batch->max_checks ||
+      signature_batch->message_data_size + get_tx_signature_data_size(tx) > signature_batch->max_message_data_size)
+  {
+    return 1;
+  }
+
+  uint32_t sign_header_size = get_tx_sign_header_size(tx);
+  uint32_t message_size = TXIN_HEADER_SIZE + sign_header_size;
+  uint8_t *sign_header = NULL;
+
+  for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
+  {
+    input_transaction_t *txin = tx->txins[txin_index];
+    assert(txin != NULL);
+
+    uint8_t *message = signature_batch->message_data + signature_batch->message_data_size;
+    get_txin_header(message, txin);
+    if (sign_header == NULL)
+    {
+      sign_header = message + TXIN_HEADER_SIZE;
+      get_tx_sign_header(sign_header, tx);
+    }
+    else
+    {
+      memcpy(message + TXIN_HEADER_SIZE, sign_header, sign_header_size);
+    }
+
+    txin_signature_check_t *check = &signature_batch->checks[signature_batch->num_checks];
+    check->tx = tx;
+    check->txin = txin;
+    check->message = message;
+    check->message_size = message_size;
+
+    signature_batch->num_checks++;
+    signature_batch->message_data_size += message_size;
+  }
+
+  return 0;
+}
+
+/*
+ * Verifies every signature check in the batch, returns 0 if all of them are valid.
+ * Libsodium does not provide a batch Ed25519 verifier, so each check is verified on
+ * it's own which also pinpoints the first invalid signature in the batch.
+ */
+int verify_signature_batch(signature_batch_t *signature_batch, uint32_t *failed_check_index)
+{
+  assert(signature_batch != NULL);
+  for (uint32_t i = 0; i < signature_batch->num_checks; i++)
+  {
+    txin_signature_check_t *check = &signature_batch->checks[i];
+    if (crypto_sign_verify_detached(check->txin->signature, check->message, check->message_size, check->txin->public_key) != 0)
+    {
+      log_txin_signature_failure(check->tx, check->txin);
+      if (failed_check_index != NULL)
+      {
+        *failed_check_index = i;
+      }
+
       return 1;
     }
   }
@@ -192,7 +408,7 @@ void get_txout_header(uint8_t *header, output_transaction_t *txout)
   assert(txout != NULL);
 
   memcpy(header, &txout->amount, 8);
-  memcpy(header, txout->address, ADDRESS_SIZE);
+  memcpy(header + 8, txout->address, ADDRESS_SIZE);
 }
 
 uint32_t get_tx_header_size(transaction_t *tx)
@@ -203,6 +419,19 @@ uint32_t get_tx_header_size(transaction_t *tx)
   return txin_header_sizes + txout_header_sizes;
 }
 
+/*
+ * Returns the memory allocated for the tx along with it's txins and txouts,
+ * this does not apply to txs which were deserialized into a block's arena.
+ */
+size_t get_tx_memory_size(transaction_t *tx)
+{
+  assert(tx != NULL);
+  size_t memory_size = sizeof(transaction_t);
+  memory_size += tx->txin_count * (sizeof(input_transaction_t*) + sizeof(input_transaction_t));
+  memory_size += tx->txout_count * (sizeof(output_transaction_t*) + sizeof(output_transaction_t));
+  return memory_size;
+}
+
 /*
  * The reason why sign header is different from full header is that
  * the signing header only contains TXOUTs. This is used in the context
@@ -370,14 +599,7 @@ void print_transaction(transaction_t *tx)
   }
 }
 
-/*
- * A transaction is valid if:
- * - It's header size is less than that of defined as MAX_TX_SIZE
- * - It is a generation tx
- * - It has TXINs that reference valid unspent TXOUTs
- * - Its combined TXIN UTXO values equal the combined amount of TXOUTs.
- */
-int valid_transaction(transaction_t *tx)
+int valid_transaction_header(transaction_t *tx)
 {
   assert(tx != NULL);
 
@@ -385,56 +607,112 @@ int valid_transaction(transaction_t *tx)
   // transaction, we can expect it to have zero tx inputs
   if (tx->txout_count == 0 || tx->txouts == NULL)
   {
-    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-    LOG_DEBUG("Failed to validate transaction: %s, transaction has no txouts!", tx_hash_str);
-    free(tx_hash_str);
+    LOG_DEBUG("Failed to validate transaction: %s, transaction has no txouts!", HASH2HEX_STR(tx->id));
     return 0;
   }
 
   uint32_t tx_header_size = get_tx_header_size(tx);
   if (tx_header_size > MAX_TX_SIZE)
   {
-    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-    LOG_DEBUG("Failed to validate transaction: %s, transaction has too big header blob size: %u!", tx_hash_str, tx_header_size);
-    free(tx_hash_str);
+    LOG_DEBUG("Failed to validate transaction: %s, transaction has too big header blob size: %u!", HASH2HEX_STR(tx->id), tx_header_size);
     return 0;
   }
 
-  // check signatures
-  if (validate_tx_signatures(tx))
-  {
-    return 0;
-  }
+  return 1;
+}
 
+static int valid_flat_transaction_txins(flat_transactions_t *flat_txs, uint32_t tx_index)
+{
   // check txins and txouts
-  if (do_txins_reference_unspent_txouts(tx) == 0)
+  if (do_flat_txins_reference_unspent_txouts(flat_txs, tx_index) == 0)
   {
-    char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-    LOG_DEBUG("Failed to validate transaction: %s, transaction does not have the appropriate corresponding txins and unspent txouts!", tx_hash_str);
-    free(tx_hash_str);
+    LOG_DEBUG("Failed to validate transaction: %s, transaction does not have the appropriate corresponding txins and unspent txouts!", HASH2HEX_STR(flat_txs->ids[tx_index]));
     return 0;
   }
 
   return 1;
 }
 
-int do_txins_reference_unspent_txouts(transaction_t *tx)
+int valid_transaction_txins(transaction_t *tx)
 {
   assert(tx != NULL);
-  if (is_coinbase_tx(tx))
+  flat_transactions_t *flat_txs = flatten_transactions(&tx, 1);
+  int result = valid_flat_transaction_txins(flat_txs, 0);
+  free_flat_transactions(flat_txs);
+  return result;
+}
+
+/*
+ * Checks that the txins of every tx reference unspent txouts, the txs are
+ * flattened once so the UTXO lookups and txout sums are linear scans.
+ * Returns 0 if invalid, 1 is valid.
+ */
+int valid_transactions_txins(transaction_t **transactions, uint32_t transaction_count)
+{
+  assert(transactions != NULL || transaction_count == 0);
+  flat_transactions_t *flat_txs = flatten_transactions(transactions, transaction_count);
+  int result = 1;
+  for (uint32_t tx_index = 0; tx_index < transaction_count; tx_index++)
   {
-    // coinbase transactions should never have any tx inputs
-    if (tx->txin_count > 0)
+    if (valid_flat_transaction_txins(flat_txs, tx_index) == 0)
     {
-      return 0;
+      result = 0;
+      break;
     }
+  }
 
-    return 1;
+  free_flat_transactions(flat_txs);
+  return result;
+}
+
+/*
+ * A transaction is valid if:
+ * - It's header size is less than that of defined as MAX_TX_SIZE
+ * - It is a generation tx
+ * - It has TXINs that reference valid unspent TXOUTs
+ * - Its combined TXIN UTXO values equal the combined amount of TXOUTs.
+ */
+int valid_transaction(transaction_t *tx)
+{
+  assert(tx != NULL);
+  if (valid_transaction_header(tx) == 0)
+  {
+    return 0;
+  }
+
+  // the signature and txin checks both walk every txin and txout,
+  // so flatten the tx once and do both checks against the copy...
+  flat_transactions_t *flat_txs = flatten_transactions(&tx, 1);
+  int result = (
+    validate_flat_transaction_signatures(flat_txs, 0, 1) == 0 &&
+    valid_flat_transaction_txins(flat_txs, 0));
+
+  free_flat_transactions(flat_txs);
+  return result;
+}
+
+int do_txins_reference_unspent_txouts(transaction_t *tx)
+{
+  assert(tx != NULL);
+  flat_transactions_t *flat_txs = flatten_transactions(&tx, 1);
+  int result = do_flat_txins_reference_unspent_txouts(flat_txs, 0);
+  free_flat_transactions(flat_txs);
+  return result;
+}
+
+/* Returns the amount the txins of the tx pay over the amount of it's
+ * txouts, txins referencing unknown or spent txouts are not counted...
+ */
+uint64_t get_tx_fee(transaction_t *tx)
+{
+  assert(tx != NULL);
+  if (is_coinbase_tx(tx))
+  {
+    return 0;
   }
 
-  uint32_t valid_txins = 0;
   uint64_t input_money = 0;
-  uint64_t required_money = 0;
+  uint64_t output_money = 0;
 
   for (uint32_t i = 0; i < tx->txin_count; i++)
   {
@@ -442,49 +720,36 @@ int do_txins_reference_unspent_txouts(transaction_t *tx)
     assert(txin != NULL);
 
     unspent_transaction_t *unspent_tx = get_unspent_tx_from_index(txin->transaction);
-    if (unspent_tx != NULL)
+    if (unspent_tx == NULL)
     {
-      if (((unspent_tx->unspent_txout_count - 1) < txin->txout_index) ||
-          (unspent_tx->unspent_txouts[txin->txout_index] == NULL))
-      {
-        char *tx_hash_str = bin2hex(unspent_tx->id, HASH_SIZE);
-        LOG_ERROR("Failed to validate txin referencing invalid unspent tx: %s with txout at index: %u!", tx_hash_str, txin->txout_index);
-        free(tx_hash_str);
-        return 0;
-      }
-      else
+      continue;
+    }
+
+    if (txin->txout_index < unspent_tx->unspent_txout_count)
+    {
+      unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[txin->txout_index];
+      if (unspent_txout != NULL && unspent_txout->spent == 0)
       {
-        unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[txin->txout_index];
-        assert(unspent_txout != NULL);
-
-        if (unspent_txout->spent == 0)
-        {
-          input_money += unspent_txout->amount;
-          valid_txins++;
-        }
+        input_money += unspent_txout->amount;
       }
-
-      free_unspent_transaction(unspent_tx);
     }
+
+    free_unspent_transaction(unspent_tx);
   }
 
   for (uint32_t i = 0; i < tx->txout_count; i++)
   {
     output_transaction_t *txout = tx->txouts[i];
     assert(txout != NULL);
+    output_money += txout->amount;
+  }
 
-    if (valid_address(txout->address) == 0)
-    {
-      char *tx_hash_str = bin2hex(tx->id, HASH_SIZE);
-      LOG_ERROR("Failed to validate txin: %s invalid txout address at index: %u", tx_hash_str, i);
-      free(tx_hash_str);
-      return 0;
-    }
-
-    required_money += txout->amount;
+  if (input_money <= output_money)
+  {
+    return 0;
   }
 
-  return (valid_txins == tx->txin_count) && (input_money == required_money);
+  return input_money - output_money;
 }
 
 int is_coinbase_tx(transaction_t *tx)
@@ -493,26 +758,48 @@ int is_coinbase_tx(transaction_t *tx)
   return (tx->txin_count == 0 && tx->txout_count == 1 && tx->txins == NULL && tx->txouts != NULL);
 }
 
+/*
+ * Computes the id of the tx from it's txins and txouts, the id is memoized on the tx
+ * so that computing the merkle root or branches of a block more than once only hashes
+ * each of it's txs once. The tx's own id field is never trusted as the cached id, since
+ * it may have been read from a peer rather than computed.
+ */
 int compute_tx_id(uint8_t *tx_id, transaction_t *tx)
 {
   assert(tx != NULL);
+  if (tx->has_cached_id)
+  {
+    memcpy(tx_id, tx->cached_id, HASH_SIZE);
+    return 0;
+  }
+
   uint32_t tx_header_size = get_tx_header_size(tx);
   assert(tx_header_size > 0);
 
-  buffer_t *buffer = buffer_init_size(0, tx_header_size);
-  serialize_transaction_header(buffer, tx);
+  buffer_t *buffer = buffer_acquire_scratch();
+  if (buffer_reserve(buffer, tx_header_size) || serialize_transaction_header(buffer, tx))
+  {
+    buffer_release_scratch(buffer);
+    return 1;
+  }
 
-  uint8_t header[tx_header_size];
-  memcpy(header, buffer->data, tx_header_size);
+  assert(buffer_get_size(buffer) == tx_header_size);
+  crypto_hash_sha256d(tx->cached_id, buffer->data, tx_header_size);
+  buffer_release_scratch(buffer);
 
-  buffer_free(buffer);
-  crypto_hash_sha256d(tx_id, header, tx_header_size);
+  tx->has_cached_id = 1;
+  memcpy(tx_id, tx->cached_id, HASH_SIZE);
   return 0;
 }
 
+/*
+ * Sets the tx's id, always hashing the tx rather than reading the memoized id so
+ * that a tx whose txins or txouts were changed in place has it's id brought up to date.
+ */
 int compute_self_tx_id(transaction_t *tx)
 {
   assert(tx != NULL);
+  tx->has_cached_id = 0;
   compute_tx_id(tx->id, tx);
   return 0;
 }
@@ -551,10 +838,55 @@ int serialize_txin(buffer_t *buffer, input_transaction_t *txin)
   return 0;
 }
 
-int deserialize_txin(buffer_iterator_t *buffer_iterator, input_transaction_t **txin_out)
+static int serialize_txin_v2(buffer_t *buffer, input_transaction_t *txin)
+{
+  assert(buffer != NULL);
+  assert(txin != NULL);
+
+  if (buffer_write(buffer, txin->transaction, HASH_SIZE) ||
+      buffer_write_varint(buffer, txin->txout_index) ||
+      buffer_write(buffer, txin->signature, crypto_sign_BYTES) ||
+      buffer_write(buffer, txin->public_key, crypto_sign_PUBLICKEYBYTES))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int deserialize_txin_v2(buffer_iterator_t *buffer_iterator, input_transaction_t *txin)
+{
+  assert(buffer_iterator != NULL);
+  assert(txin != NULL);
+
+  uint64_t txout_index = 0;
+  if (buffer_read_fixed(buffer_iterator, txin->transaction, HASH_SIZE) ||
+      buffer_read_varint(buffer_iterator, &txout_index) || txout_index > UINT32_MAX ||
+      buffer_read_fixed(buffer_iterator, txin->signature, crypto_sign_BYTES) ||
+      buffer_read_fixed(buffer_iterator, txin->public_key, crypto_sign_PUBLICKEYBYTES))
+  {
+    return 1;
+  }
+
+  txin->txout_index = (uint32_t)txout_index;
+  return 0;
+}
+
+static int deserialize_txin_in(buffer_iterator_t *buffer_iterator, arena_t *arena, encoding_version_t encoding_version, input_transaction_t **txin_out)
 {
   assert(buffer_iterator != NULL);
-  input_transaction_t *txin = make_txin();
+  input_transaction_t *txin = make_txin_in(arena);
+  if (encoding_version == ENCODING_VERSION_2)
+  {
+    if (deserialize_txin_v2(buffer_iterator, txin))
+    {
+      goto txin_deserialize_fail;
+    }
+
+    *txin_out = txin;
+    return 0;
+  }
+
   uint8_t *prev_tx_id = NULL;
   if (buffer_read_bytes32(buffer_iterator, &prev_tx_id))
   {
@@ -592,10 +924,19 @@ int deserialize_txin(buffer_iterator_t *buffer_iterator, input_transaction_t **t
   return 0;
 
 txin_deserialize_fail:
-  free(txin);
+  if (arena == NULL)
+  {
+    free(txin);
+  }
+
   return 1;
 }
 
+int deserialize_txin(buffer_iterator_t *buffer_iterator, input_transaction_t **txin_out)
+{
+  return deserialize_txin_in(buffer_iterator, NULL, ENCODING_VERSION_1, txin_out);
+}
+
 int serialize_txout_header(buffer_t *buffer, output_transaction_t *txout)
 {
   assert(buffer != NULL);
@@ -624,11 +965,37 @@ int serialize_txout(buffer_t *buffer, output_transaction_t *txout)
   return 0;
 }
 
-int deserialize_txout(buffer_iterator_t *buffer_iterator, output_transaction_t **txout_out)
+static int serialize_txout_v2(buffer_t *buffer, output_transaction_t *txout)
+{
+  assert(buffer != NULL);
+  assert(txout != NULL);
+
+  if (buffer_write_varint(buffer, txout->amount) ||
+      buffer_write(buffer, txout->address, ADDRESS_SIZE))
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+static int deserialize_txout_in(buffer_iterator_t *buffer_iterator, arena_t *arena, encoding_version_t encoding_version, output_transaction_t **txout_out)
 {
   assert(buffer_iterator != NULL);
-  output_transaction_t *txout = make_txout();
+  output_transaction_t *txout = make_txout_in(arena);
   txout->amount = 0;
+  if (encoding_version == ENCODING_VERSION_2)
+  {
+    if (buffer_read_varint(buffer_iterator, &txout->amount) ||
+        buffer_read_fixed(buffer_iterator, txout->address, ADDRESS_SIZE))
+    {
+      goto deserialize_txout_fail;
+    }
+
+    *txout_out = txout;
+    return 0;
+  }
+
   if (buffer_read_uint64(buffer_iterator, &txout->amount))
   {
     goto deserialize_txout_fail;
@@ -647,10 +1014,19 @@ int deserialize_txout(buffer_iterator_t *buffer_iterator, output_transaction_t *
   return 0;
 
 deserialize_txout_fail:
-  free(txout);
+  if (arena == NULL)
+  {
+    free(txout);
+  }
+
   return 1;
 }
 
+int deserialize_txout(buffer_iterator_t *buffer_iterator, output_transaction_t **txout_out)
+{
+  return deserialize_txout_in(buffer_iterator, NULL, ENCODING_VERSION_1, txout_out);
+}
+
 int serialize_transaction_header(buffer_t *buffer, transaction_t *tx)
 {
   assert(buffer != NULL);
@@ -684,10 +1060,57 @@ int serialize_transaction_header(buffer_t *buffer, transaction_t *tx)
 }
 
 int serialize_transaction(buffer_t *buffer, transaction_t *tx)
+{
+  return serialize_transaction_encoded(buffer, tx, ENCODING_VERSION_1);
+}
+
+static int serialize_transaction_v2(buffer_t *buffer, transaction_t *tx)
 {
   assert(buffer != NULL);
   assert(tx != NULL);
 
+  if (buffer_write(buffer, tx->id, HASH_SIZE) ||
+      buffer_write_varint(buffer, tx->txin_count) ||
+      buffer_write_varint(buffer, tx->txout_count))
+  {
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < tx->txin_count; i++)
+  {
+    input_transaction_t *txin = tx->txins[i];
+    assert(txin != NULL);
+
+    if (serialize_txin_v2(buffer, txin))
+    {
+      return 1;
+    }
+  }
+
+  for (uint32_t i = 0; i < tx->txout_count; i++)
+  {
+    output_transaction_t *txout = tx->txouts[i];
+    assert(txout != NULL);
+
+    if (serialize_txout_v2(buffer, txout))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int serialize_transaction_encoded(buffer_t *buffer, transaction_t *tx, encoding_version_t encoding_version)
+{
+  assert(buffer != NULL);
+  assert(tx != NULL);
+
+  if (encoding_version == ENCODING_VERSION_2)
+  {
+    return serialize_transaction_v2(buffer, tx);
+  }
+
   if (buffer_write_bytes32(buffer, tx->id, HASH_SIZE) ||
       buffer_write_uint32(buffer, tx->txin_count) ||
       buffer_write_uint32(buffer, tx->txout_count))
@@ -722,82 +1145,134 @@ int serialize_transaction(buffer_t *buffer, transaction_t *tx)
   return 0;
 }
 
-int deserialize_transaction(buffer_iterator_t *buffer_iterator, transaction_t **tx_out)
+static int deserialize_transaction_in(buffer_iterator_t *buffer_iterator, arena_t *arena, encoding_version_t encoding_version, transaction_t **tx_out)
 {
   assert(buffer_iterator != NULL);
-  transaction_t *tx = make_transaction();
-  uint8_t *id = NULL;
-  if (buffer_read_bytes32(buffer_iterator, &id))
+  transaction_t *tx = make_transaction_in(arena);
+  uint32_t txin_count = 0;
+  uint32_t txout_count = 0;
+  if (encoding_version == ENCODING_VERSION_2)
   {
-    goto deserialize_fail;
+    uint64_t txin_count_v2 = 0;
+    uint64_t txout_count_v2 = 0;
+    if (buffer_read_fixed(buffer_iterator, tx->id, HASH_SIZE) ||
+        buffer_read_varint(buffer_iterator, &txin_count_v2) || txin_count_v2 > UINT32_MAX ||
+        buffer_read_varint(buffer_iterator, &txout_count_v2) || txout_count_v2 > UINT32_MAX)
+    {
+      goto deserialize_fail;
+    }
+
+    txin_count = (uint32_t)txin_count_v2;
+    txout_count = (uint32_t)txout_count_v2;
   }
+  else
+  {
+    uint8_t *id = NULL;
+    if (buffer_read_bytes32(buffer_iterator, &id))
+    {
+      goto deserialize_fail;
+    }
 
-  memcpy(tx->id, id, HASH_SIZE);
-  free(id);
+    memcpy(tx->id, id, HASH_SIZE);
+    free(id);
 
-  uint32_t txin_count = 0;
-  if (buffer_read_uint32(buffer_iterator, &txin_count))
-  {
-    goto deserialize_fail;
+    if (buffer_read_uint32(buffer_iterator, &txin_count) ||
+        buffer_read_uint32(buffer_iterator, &txout_count))
+    {
+      goto deserialize_fail;
+    }
   }
 
-  uint32_t txout_count = 0;
-  if (buffer_read_uint32(buffer_iterator, &txout_count))
+  // every txin and txout takes up at least a byte, so the counts can be checked
+  // against the remaining data before the txin and txout arrays are allocated...
+  size_t remaining_size = buffer_get_remaining_size(buffer_iterator);
+  if (txin_count > remaining_size || txout_count > remaining_size - txin_count)
   {
     goto deserialize_fail;
   }
 
   // read txins
+  if (txin_count > 0)
+  {
+    tx->txins = alloc_tx_memory(arena, sizeof(input_transaction_t*) * txin_count);
+  }
+
   for (uint32_t i = 0; i < txin_count; i++)
   {
     input_transaction_t *txin = NULL;
-    if (deserialize_txin(buffer_iterator, &txin))
+    if (deserialize_txin_in(buffer_iterator, arena, encoding_version, &txin))
     {
       goto deserialize_fail;
     }
 
-    tx->txin_count++;
-    assert(i == tx->txin_count - 1);
-
-    tx->txins = realloc(tx->txins, sizeof(input_transaction_t) * tx->txin_count);
-    assert(tx->txins != NULL);
-
     tx->txins[i] = txin;
+    tx->txin_count++;
   }
 
   // read txouts
+  if (txout_count > 0)
+  {
+    tx->txouts = alloc_tx_memory(arena, sizeof(output_transaction_t*) * txout_count);
+  }
+
   for (uint32_t i = 0; i < txout_count; i++)
   {
     output_transaction_t *txout = NULL;
-    if (deserialize_txout(buffer_iterator, &txout))
+    if (deserialize_txout_in(buffer_iterator, arena, encoding_version, &txout))
     {
       goto deserialize_fail;
     }
 
-    tx->txout_count++;
-    assert(i == tx->txout_count - 1);
-
-    tx->txouts = realloc(tx->txouts, sizeof(output_transaction_t) * tx->txout_count);
-    assert(tx->txouts != NULL);
-
     tx->txouts[i] = txout;
+    tx->txout_count++;
   }
 
   *tx_out = tx;
   return 0;
 
 deserialize_fail:
-  free_transaction(tx);
+  if (arena == NULL)
+  {
+    free_transaction(tx);
+  }
+
   return 1;
 }
 
+int deserialize_transaction(buffer_iterator_t *buffer_iterator, transaction_t **tx_out)
+{
+  return deserialize_transaction_in(buffer_iterator, NULL, ENCODING_VERSION_1, tx_out);
+}
+
+/*
+ * Deserializes a transaction with the transaction and everything it owns allocated out of
+ * the arena, the transaction must never be free'd with free_transaction and only lives
+ * for as long as the arena does.
+ */
+int deserialize_transaction_in_arena(buffer_iterator_t *buffer_iterator, arena_t *arena, transaction_t **tx_out)
+{
+  assert(arena != NULL);
+  return deserialize_transaction_in(buffer_iterator, arena, ENCODING_VERSION_1, tx_out);
+}
+
+int deserialize_transaction_encoded(buffer_iterator_t *buffer_iterator, encoding_version_t encoding_version, transaction_t **tx_out)
+{
+  return deserialize_transaction_in(buffer_iterator, NULL, encoding_version, tx_out);
+}
+
+int deserialize_transaction_encoded_in_arena(buffer_iterator_t *buffer_iterator, arena_t *arena, encoding_version_t encoding_version, transaction_t **tx_out)
+{
+  assert(arena != NULL);
+  return deserialize_transaction_in(buffer_iterator, arena, encoding_version, tx_out);
+}
+
 int transaction_to_serialized(uint8_t **data, uint32_t *data_len, transaction_t *tx)
 {
   assert(tx != NULL);
-  buffer_t *buffer = buffer_init();
+  buffer_t *buffer = buffer_acquire_scratch();
   if (serialize_transaction(buffer, tx))
   {
-    buffer_free(buffer);
+    buffer_release_scratch(buffer);
     return 1;
   }
 
@@ -809,7 +1284,7 @@ int transaction_to_serialized(uint8_t **data, uint32_t *data_len, transaction_t
   *data_len = raw_data_len;
   *data = raw_data;
 
-  buffer_free(buffer);
+  buffer_release_scratch(buffer);
   return 0;
 }
 
@@ -879,11 +1354,54 @@ deserialize_unspent_txout_fail:
   return 1;
 }
 
+/*
+ * Unspent txs are always stored in the v2 encoding, the v1 encoding is
+ * only written for reading back unspent txs stored by older versions.
+ */
 int serialize_unspent_transaction(buffer_t *buffer, unspent_transaction_t *unspent_tx)
+{
+  return serialize_unspent_transaction_encoded(buffer, unspent_tx, ENCODING_VERSION_2);
+}
+
+static int serialize_unspent_transaction_v2(buffer_t *buffer, unspent_transaction_t *unspent_tx)
 {
   assert(buffer != NULL);
   assert(unspent_tx != NULL);
 
+  if (buffer_write_uint8(buffer, UNSPENT_TRANSACTION_V2_MARKER) ||
+      buffer_write(buffer, unspent_tx->id, HASH_SIZE) ||
+      buffer_write_uint8(buffer, unspent_tx->coinbase) ||
+      buffer_write_varint(buffer, unspent_tx->unspent_txout_count))
+  {
+    return 1;
+  }
+
+  for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
+  {
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+    assert(unspent_txout != NULL);
+
+    if (buffer_write_varint(buffer, unspent_txout->amount) ||
+        buffer_write(buffer, unspent_txout->address, ADDRESS_SIZE) ||
+        buffer_write_uint8(buffer, unspent_txout->spent))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int serialize_unspent_transaction_encoded(buffer_t *buffer, unspent_transaction_t *unspent_tx, encoding_version_t encoding_version)
+{
+  assert(buffer != NULL);
+  assert(unspent_tx != NULL);
+
+  if (encoding_version == ENCODING_VERSION_2)
+  {
+    return serialize_unspent_transaction_v2(buffer, unspent_tx);
+  }
+
   if (buffer_write_bytes32(buffer, unspent_tx->id, HASH_SIZE) ||
       buffer_write_uint8(buffer, unspent_tx->coinbase) ||
       buffer_write_uint32(buffer, unspent_tx->unspent_txout_count))
@@ -906,10 +1424,70 @@ int serialize_unspent_transaction(buffer_t *buffer, unspent_transaction_t *unspe
   return 0;
 }
 
+static int deserialize_unspent_transaction_v2(buffer_iterator_t *buffer_iterator, unspent_transaction_t *unspent_tx)
+{
+  assert(buffer_iterator != NULL);
+  assert(unspent_tx != NULL);
+
+  uint8_t marker = 0;
+  uint64_t unspent_txout_count = 0;
+  if (buffer_read_uint8(buffer_iterator, &marker) || marker != UNSPENT_TRANSACTION_V2_MARKER ||
+      buffer_read_fixed(buffer_iterator, unspent_tx->id, HASH_SIZE) ||
+      buffer_read_uint8(buffer_iterator, &unspent_tx->coinbase) ||
+      buffer_read_varint(buffer_iterator, &unspent_txout_count))
+  {
+    return 1;
+  }
+
+  // every unspent txout takes up more than a byte, so the count can be checked
+  // against the remaining data before the unspent txouts are allocated...
+  if (unspent_txout_count > buffer_get_remaining_size(buffer_iterator))
+  {
+    return 1;
+  }
+
+  if (unspent_txout_count > 0)
+  {
+    unspent_tx->unspent_txouts = malloc(sizeof(unspent_output_transaction_t*) * unspent_txout_count);
+    assert(unspent_tx->unspent_txouts != NULL);
+  }
+
+  for (uint32_t i = 0; i < unspent_txout_count; i++)
+  {
+    unspent_output_transaction_t *unspent_txout = make_unspent_txout();
+    if (buffer_read_varint(buffer_iterator, &unspent_txout->amount) ||
+        buffer_read_fixed(buffer_iterator, unspent_txout->address, ADDRESS_SIZE) ||
+        buffer_read_uint8(buffer_iterator, &unspent_txout->spent))
+    {
+      free(unspent_txout);
+      return 1;
+    }
+
+    unspent_tx->unspent_txouts[i] = unspent_txout;
+    unspent_tx->unspent_txout_count++;
+  }
+
+  return 0;
+}
+
 int deserialize_unspent_transaction(buffer_iterator_t *buffer_iterator, unspent_transaction_t **unspent_tx_out)
 {
   assert(buffer_iterator != NULL);
   unspent_transaction_t *unspent_tx = make_unspent_transaction();
+
+  // v1 unspent txs start with the size of their id rather than the marker
+  if (buffer_get_remaining_size(buffer_iterator) > 0 &&
+      buffer_get_remaining_data(buffer_iterator)[0] == UNSPENT_TRANSACTION_V2_MARKER)
+  {
+    if (deserialize_unspent_transaction_v2(buffer_iterator, unspent_tx))
+    {
+      goto unspent_tx_deserialize_fail;
+    }
+
+    *unspent_tx_out = unspent_tx;
+    return 0;
+  }
+
   uint8_t *id = NULL;
   if (buffer_read_bytes32(buffer_iterator, &id))
   {
@@ -996,10 +1574,10 @@ unspent_transaction_t* transaction_to_unspent_transaction(transaction_t *tx)
 int unspent_transaction_to_serialized(uint8_t **data, uint32_t *data_len, unspent_transaction_t *unspent_tx)
 {
   assert(unspent_tx != NULL);
-  buffer_t *buffer = buffer_init();
+  buffer_t *buffer = buffer_acquire_scratch();
   if (serialize_unspent_transaction(buffer, unspent_tx))
   {
-    buffer_free(buffer);
+    buffer_release_scratch(buffer);
     return 1;
   }
 
@@ -1007,7 +1585,7 @@ int unspent_transaction_to_serialized(uint8_t **data, uint32_t *data_len, unspen
   *data = malloc(*data_len);
   assert(*data != NULL);
   memcpy(*data, buffer->data, *data_len);
-  buffer_free(buffer);
+  buffer_release_scratch(buffer);
   return 0;
 }
 
@@ -1031,6 +1609,23 @@ unspent_transaction_t* unspent_transaction_from_serialized(uint8_t *data, uint32
   return unspent_tx;
 }
 
+int is_unspent_tx_spent(unspent_transaction_t *unspent_tx)
+{
+  assert(unspent_tx != NULL);
+  for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
+  {
+    unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+    assert(unspent_txout != NULL);
+
+    if (unspent_txout->spent == 0)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
 int get_unspent_txouts_from_unspent_tx(unspent_transaction_t *unspent_tx, vec_void_t *unspent_txouts, uint32_t *num_unspent_txouts)
 {
   assert(unspent_tx != NULL);
@@ -1065,6 +1660,7 @@ int add_txin_to_transaction(transaction_t *tx, input_transaction_t *txin, uint32
   assert(tx->txins != NULL);
 
   tx->txins[txin_index] = txin;
+  tx->has_cached_id = 0;
   return 0;
 }
 
@@ -1080,6 +1676,7 @@ int add_txout_to_transaction(transaction_t *tx, output_transaction_t *txout, uin
   assert(tx->txouts != NULL);
 
   tx->txouts[txout_index] = txout;
+  tx->has_cached_id = 0;
   return 0;
 }
 
@@ -1130,8 +1727,15 @@ int copy_transaction(transaction_t *tx, transaction_t *other_tx)
   free_txouts(other_tx);
 
   memcpy(other_tx->id, tx->id, HASH_SIZE);
-  if ((tx->txin_count > 0 && tx->txins != NULL) && (tx->txout_count > 0 && tx->txouts != NULL))
+  memcpy(other_tx->cached_id, tx->cached_id, HASH_SIZE);
+  other_tx->has_cached_id = tx->has_cached_id;
+
+  // coinbase txs have txouts but no txins, so each are copied on their own
+  if (tx->txin_count > 0 && tx->txins != NULL)
   {
+    other_tx->txins = malloc(sizeof(input_transaction_t*) * tx->txin_count);
+    assert(other_tx->txins != NULL);
+
     // copy the txins
     for (uint32_t i = 0; i < tx->txin_count; i++)
     {
@@ -1140,20 +1744,19 @@ int copy_transaction(transaction_t *tx, transaction_t *other_tx)
 
       input_transaction_t *other_txin = malloc(sizeof(input_transaction_t));
       assert(other_txin != NULL);
+      other_tx->txins[i] = other_txin;
+      other_tx->txin_count++;
       if (copy_txin(txin, other_txin))
       {
         return 1;
       }
-
-      assert(other_txin != NULL);
-      other_tx->txin_count++;
-      assert(i == other_tx->txin_count - 1);
-
-      other_tx->txins = realloc(other_tx->txins, sizeof(input_transaction_t) * other_tx->txin_count);
-      assert(other_tx->txins != NULL);
-
-      other_tx->txins[i] = other_txin;
     }
+  }
+
+  if (tx->txout_count > 0 && tx->txouts != NULL)
+  {
+    other_tx->txouts = malloc(sizeof(output_transaction_t*) * tx->txout_count);
+    assert(other_tx->txouts != NULL);
 
     // copy the txouts
     for (uint32_t i = 0; i < tx->txout_count; i++)
@@ -1163,19 +1766,12 @@ int copy_transaction(transaction_t *tx, transaction_t *other_tx)
 
       output_transaction_t *other_txout = malloc(sizeof(output_transaction_t));
       assert(other_txout != NULL);
+      other_tx->txouts[i] = other_txout;
+      other_tx->txout_count++;
       if (copy_txout(txout, other_txout))
       {
         return 1;
       }
-
-      assert(other_txout != NULL);
-      other_tx->txout_count++;
-      assert(i == other_tx->txout_count - 1);
-
-      other_tx->txouts = realloc(other_tx->txouts, sizeof(output_transaction_t) * other_tx->txout_count);
-      assert(other_tx->txouts != NULL);
-
-      other_tx->txouts[i] = other_txout;
     }
   }
 
@@ -1188,10 +1784,44 @@ int copy_transaction(transaction_t *tx, transaction_t *other_tx)
   return 0;
 }
 
+int copy_unspent_transaction(unspent_transaction_t *unspent_tx, unspent_transaction_t *other_unspent_tx)
+{
+  assert(unspent_tx != NULL);
+  assert(other_unspent_tx != NULL);
+
+  // free the unspent txouts for the unspent transaction we are copying to...
+  free_unspent_txouts(other_unspent_tx);
+
+  memcpy(other_unspent_tx->id, unspent_tx->id, HASH_SIZE);
+  other_unspent_tx->coinbase = unspent_tx->coinbase;
+  if (unspent_tx->unspent_txout_count > 0 && unspent_tx->unspent_txouts != NULL)
+  {
+    other_unspent_tx->unspent_txouts = malloc(sizeof(unspent_output_transaction_t*) * unspent_tx->unspent_txout_count);
+    assert(other_unspent_tx->unspent_txouts != NULL);
+
+    for (uint32_t i = 0; i < unspent_tx->unspent_txout_count; i++)
+    {
+      unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
+      assert(unspent_txout != NULL);
+
+      unspent_output_transaction_t *other_unspent_txout = make_unspent_txout();
+      other_unspent_txout->amount = unspent_txout->amount;
+      memcpy(other_unspent_txout->address, unspent_txout->address, ADDRESS_SIZE);
+      other_unspent_txout->spent = unspent_txout->spent;
+
+      other_unspent_tx->unspent_txouts[i] = other_unspent_txout;
+    }
+
+    other_unspent_tx->unspent_txout_count = unspent_tx->unspent_txout_count;
+  }
+
+  return 0;
+}
+
 void free_txins(transaction_t *tx)
 {
   assert(tx != NULL);
-  if (tx->txin_count > 0 && tx->txins != NULL)
+  if (tx->txins != NULL)
   {
     for (uint32_t i = 0; i < tx->txin_count; i++)
     {
@@ -1210,7 +1840,7 @@ void free_txins(transaction_t *tx)
 void free_txouts(transaction_t *tx)
 {
   assert(tx != NULL);
-  if (tx->txout_count > 0 && tx->txouts != NULL)
+  if (tx->txouts != NULL)
   {
     for (uint32_t i = 0; i < tx->txout_count; i++)
     {
@@ -29,6 +29,7 @@
 
 #include <sodium.h>
 
+#include "common/arena.h"
 #include "common/buffer_iterator.h"
 #include "common/buffer.h"
 #include "common/util.h"
@@ -63,6 +64,19 @@ VULKAN_BEGIN_DECL
 
 #define MAX_NUM_TX_ENTRIES 1024
 
+// the v2 encoding writes counts, indexes and amounts as varints and fixed size fields
+// without a length prefix. The tx id and block hash are always computed from the headers
+// which are the same for both encodings, so the encoding only changes what is sent or stored...
+typedef enum EncodingVersion
+{
+  ENCODING_VERSION_1 = 1,
+  ENCODING_VERSION_2
+} encoding_version_t;
+
+// unspent txs stored in the v2 encoding start with this byte, unspent txs stored in the
+// v1 encoding start with the size of their id so both can be read from the same keyspace...
+#define UNSPENT_TRANSACTION_V2_MARKER 0x02
+
 typedef struct InputTransaction
 {
   // --- Header
@@ -87,6 +101,11 @@ typedef struct Transaction
   uint32_t txout_count;
   input_transaction_t **txins;
   output_transaction_t **txouts;
+
+  // the id last computed from the tx's txins and txouts, it is only valid while
+  // has_cached_id is set which the calls changing the txins and txouts reset...
+  uint8_t cached_id[HASH_SIZE];
+  uint8_t has_cached_id;
 } transaction_t;
 
 typedef struct UnspentOutputTransaction
@@ -104,6 +123,28 @@ typedef struct UnspentTransaction
   unspent_output_transaction_t **unspent_txouts;
 } unspent_transaction_t;
 
+/* A batch of txin signatures gathered from one or more txs, each message
+ * is the txin header followed by the sign header of it's tx...
+ */
+typedef struct TxinSignatureCheck
+{
+  transaction_t *tx;
+  input_transaction_t *txin;
+  const uint8_t *message;
+  uint32_t message_size;
+} txin_signature_check_t;
+
+typedef struct SignatureBatch
+{
+  txin_signature_check_t *checks;
+  uint32_t num_checks;
+  uint32_t max_checks;
+
+  uint8_t *message_data;
+  size_t message_data_size;
+  size_t max_message_data_size;
+} signature_batch_t;
+
 VULKAN_API transaction_t* make_transaction(void);
 VULKAN_API input_transaction_t* make_txin(void);
 VULKAN_API output_transaction_t* make_txout(void);
@@ -111,12 +152,21 @@ VULKAN_API unspent_output_transaction_t* make_unspent_txout(void);
 VULKAN_API unspent_transaction_t* make_unspent_transaction(void);
 
 VULKAN_API int sign_txin(input_transaction_t *txin, transaction_t *tx, uint8_t *public_key, uint8_t *secret_key);
+VULKAN_API int sign_txins_with_sign_header(transaction_t *tx, uint32_t start_txin_index, uint32_t end_txin_index, const uint8_t *sign_header, uint32_t sign_header_size, uint8_t *public_key, uint8_t *secret_key);
+VULKAN_API int sign_txins(transaction_t *tx, uint8_t *public_key, uint8_t *secret_key);
 VULKAN_API int validate_txin_signature(transaction_t *tx, input_transaction_t *txin);
 VULKAN_API int validate_tx_signatures(transaction_t *tx);
+
+VULKAN_API size_t get_tx_signature_data_size(transaction_t *tx);
+VULKAN_API signature_batch_t* init_signature_batch(uint32_t max_checks, size_t max_message_data_size);
+VULKAN_API void free_signature_batch(signature_batch_t *signature_batch);
+VULKAN_API int add_tx_to_signature_batch(signature_batch_t *signature_batch, transaction_t *tx);
+VULKAN_API int verify_signature_batch(signature_batch_t *signature_batch, uint32_t *failed_check_index);
 VULKAN_API void get_txin_header(uint8_t *header, input_transaction_t *txin);
 VULKAN_API void get_txout_header(uint8_t *header, output_transaction_t *txout);
 VULKAN_API uint32_t get_tx_sign_header_size(transaction_t *tx);
 VULKAN_API uint32_t get_tx_header_size(transaction_t *tx);
+VULKAN_API size_t get_tx_memory_size(transaction_t *tx);
 VULKAN_API void get_tx_sign_header(uint8_t *header, transaction_t *tx);
 
 VULKAN_API int compare_txin(input_transaction_t *txin, input_transaction_t *other_txin);
@@ -130,8 +180,12 @@ VULKAN_API void print_txout(uint8_t txout_index, output_transaction_t *txout);
 VULKAN_API void print_transaction(transaction_t *tx);
 
 VULKAN_API int valid_transaction(transaction_t *tx);
+VULKAN_API int valid_transaction_header(transaction_t *tx);
+VULKAN_API int valid_transaction_txins(transaction_t *tx);
+VULKAN_API int valid_transactions_txins(transaction_t **transactions, uint32_t transaction_count);
 VULKAN_API int is_coinbase_tx(transaction_t *tx);
 VULKAN_API int do_txins_reference_unspent_txouts(transaction_t *tx);
+VULKAN_API uint64_t get_tx_fee(transaction_t *tx);
 
 VULKAN_API int compute_tx_id(uint8_t *tx_id, transaction_t *tx);
 VULKAN_API int compute_self_tx_id(transaction_t *tx);
@@ -147,6 +201,11 @@ VULKAN_API int deserialize_txout(buffer_iterator_t *buffer_iterator, output_tran
 VULKAN_API int serialize_transaction_header(buffer_t *buffer, transaction_t *tx);
 VULKAN_API int serialize_transaction(buffer_t *buffer, transaction_t *tx);
 VULKAN_API int deserialize_transaction(buffer_iterator_t *buffer_iterator, transaction_t **tx_out);
+VULKAN_API int deserialize_transaction_in_arena(buffer_iterator_t *buffer_iterator, arena_t *arena, transaction_t **tx_out);
+
+VULKAN_API int serialize_transaction_encoded(buffer_t *buffer, transaction_t *tx, encoding_version_t encoding_version);
+VULKAN_API int deserialize_transaction_encoded(buffer_iterator_t *buffer_iterator, encoding_version_t encoding_version, transaction_t **tx_out);
+VULKAN_API int deserialize_transaction_encoded_in_arena(buffer_iterator_t *buffer_iterator, arena_t *arena, encoding_version_t encoding_version, transaction_t **tx_out);
 
 VULKAN_API int transaction_to_serialized(uint8_t **data, uint32_t *data_len, transaction_t *tx);
 VULKAN_API transaction_t* transaction_from_serialized(uint8_t *data, uint32_t data_len);
@@ -155,12 +214,14 @@ VULKAN_API int serialize_unspent_txout(buffer_t *buffer, unspent_output_transact
 VULKAN_API int deserialize_unspent_txout(buffer_iterator_t *buffer_iterator, unspent_output_transaction_t **unspent_txout_out);
 
 VULKAN_API int serialize_unspent_transaction(buffer_t *buffer, unspent_transaction_t *unspent_tx);
+VULKAN_API int serialize_unspent_transaction_encoded(buffer_t *buffer, unspent_transaction_t *unspent_tx, encoding_version_t encoding_version);
 VULKAN_API int deserialize_unspent_transaction(buffer_iterator_t *buffer_iterator, unspent_transaction_t **unspent_tx_out);
 
 VULKAN_API unspent_output_transaction_t* txout_to_unspent_txout(output_transaction_t *txout);
 VULKAN_API unspent_transaction_t* transaction_to_unspent_transaction(transaction_t *tx);
 VULKAN_API int unspent_transaction_to_serialized(uint8_t **data, uint32_t *data_len, unspent_transaction_t *unspent_tx);
 VULKAN_API unspent_transaction_t* unspent_transaction_from_serialized(uint8_t *data, uint32_t data_len);
+VULKAN_API int is_unspent_tx_spent(unspent_transaction_t *unspent_tx);
 VULKAN_API int get_unspent_txouts_from_unspent_tx(unspent_transaction_t *unspent_tx, vec_void_t *unspent_txouts, uint32_t *num_unspent_txouts);
 
 VULKAN_API int add_txin_to_transaction(transaction_t *tx, input_transaction_t *txin, uint32_t txin_index);
@@ -169,6 +230,7 @@ VULKAN_API int add_txout_to_transaction(transaction_t *tx, output_transaction_t
 VULKAN_API int copy_txin(input_transaction_t *txin, input_transaction_t *other_txin);
 VULKAN_API int copy_txout(output_transaction_t *txout, output_transaction_t *other_txout);
 VULKAN_API int copy_transaction(transaction_t *tx, transaction_t *other_tx);
+VULKAN_API int copy_unspent_transaction(unspent_transaction_t *unspent_tx, unspent_transaction_t *other_unspent_tx);
 
 VULKAN_API void free_txins(transaction_t *tx);
 VULKAN_API void free_txouts(transaction_t *tx);
@@ -26,13 +26,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 #include <inttypes.h>
 
 #include "common/logger.h"
+#include "common/task.h"
 #include "common/util.h"
 
 #include "blockchain.h"
+#include "parameters.h"
 #include "transaction_builder.h"
 #include "transaction.h"
 
@@ -53,6 +56,160 @@ static uint64_t get_total_entries_amount(transaction_entries_t transaction_entri
   return total_amount;
 }
 
+/*
+ * Searches depth first for the set of amounts which adds up to the target exactly using
+ * the fewest amounts, so that no change txout is needed. The amounts are sorted from
+ * largest to smallest, each branch either includes or skips the next amount and is cut
+ * off once it overshoots, can no longer reach the target or can't beat the best set.
+ * Returns 1 if no exact set was found within the tries.
+ */
+static int select_coins_bnb(const uint64_t *amounts, uint32_t num_amounts, uint64_t target,
+  uint32_t max_selected, uint32_t *selected_indexes, uint32_t *num_selected_out)
+{
+  uint64_t *remaining_amounts = malloc(sizeof(uint64_t) * (num_amounts + 1));
+  assert(remaining_amounts != NULL);
+  remaining_amounts[num_amounts] = 0;
+  for (uint32_t i = num_amounts; i > 0; i--)
+  {
+    remaining_amounts[i - 1] = remaining_amounts[i] + amounts[i - 1];
+  }
+
+  uint8_t *included = calloc(num_amounts > 0 ? num_amounts : 1, sizeof(uint8_t));
+  assert(included != NULL);
+
+  uint32_t best_num_selected = UINT32_MAX;
+  uint32_t num_selected = 0;
+  uint32_t depth = 0;
+  uint64_t current_amount = 0;
+  for (uint32_t tries = 0; tries < COIN_SELECTION_BNB_MAX_TRIES; tries++)
+  {
+    int backtrack = 0;
+    if (current_amount > target || current_amount + remaining_amounts[depth] < target)
+    {
+      backtrack = 1;
+    }
+    else if (current_amount == target)
+    {
+      if (num_selected < best_num_selected)
+      {
+        best_num_selected = 0;
+        for (uint32_t i = 0; i < depth; i++)
+        {
+          if (included[i])
+          {
+            selected_indexes[best_num_selected] = i;
+            best_num_selected++;
+          }
+        }
+      }
+
+      backtrack = 1;
+    }
+    else if (num_selected >= max_selected || num_selected + 1 >= best_num_selected)
+    {
+      backtrack = 1;
+    }
+
+    if (backtrack)
+    {
+      // undo the deepest included amount and try the branch which skips it
+      while (depth > 0 && included[depth - 1] == 0)
+      {
+        depth--;
+      }
+
+      if (depth == 0)
+      {
+        break;
+      }
+
+      depth--;
+      included[depth] = 0;
+      current_amount -= amounts[depth];
+      num_selected--;
+      depth++;
+      continue;
+    }
+
+    // including an amount equal to one just skipped would only repeat that branch
+    if (depth > 0 && included[depth - 1] == 0 && amounts[depth] == amounts[depth - 1])
+    {
+      depth++;
+      continue;
+    }
+
+    included[depth] = 1;
+    current_amount += amounts[depth];
+    num_selected++;
+    depth++;
+  }
+
+  free(included);
+  free(remaining_amounts);
+  if (best_num_selected == UINT32_MAX)
+  {
+    return 1;
+  }
+
+  *num_selected_out = best_num_selected;
+  return 0;
+}
+
+/*
+ * Selects which of the amounts pay for the target, the amounts must be sorted from largest
+ * to smallest. A set which pays the target exactly is searched for first, otherwise the
+ * smallest single amount which covers the target is used, or else the largest amounts
+ * until the target is covered, so the tx spends as few outputs as it can.
+ * Returns 1 if the amounts can't cover the target with at most max selected of them.
+ */
+int select_coins(const uint64_t *amounts, uint32_t num_amounts, uint64_t target, uint32_t max_selected,
+  uint32_t *selected_indexes, uint32_t *num_selected_out, uint64_t *selected_amount_out)
+{
+  assert(amounts != NULL || num_amounts == 0);
+  assert(selected_indexes != NULL);
+  assert(num_selected_out != NULL);
+  assert(selected_amount_out != NULL);
+  if (target == 0 || max_selected == 0)
+  {
+    return 1;
+  }
+
+  if (select_coins_bnb(amounts, num_amounts, target, max_selected, selected_indexes, num_selected_out) == 0)
+  {
+    *selected_amount_out = target;
+    return 0;
+  }
+
+  for (uint32_t i = num_amounts; i > 0; i--)
+  {
+    if (amounts[i - 1] >= target)
+    {
+      selected_indexes[0] = i - 1;
+      *num_selected_out = 1;
+      *selected_amount_out = amounts[i - 1];
+      return 0;
+    }
+  }
+
+  uint64_t selected_amount = 0;
+  uint32_t num_selected = 0;
+  for (uint32_t i = 0; i < num_amounts && num_selected < max_selected && selected_amount < target; i++)
+  {
+    selected_indexes[num_selected] = i;
+    selected_amount += amounts[i];
+    num_selected++;
+  }
+
+  if (selected_amount < target)
+  {
+    return 1;
+  }
+
+  *num_selected_out = num_selected;
+  *selected_amount_out = selected_amount;
+  return 0;
+}
+
 int construct_spend_tx(transaction_t **out_tx, wallet_t *wallet, int check_available_money, transaction_entries_t transaction_entries)
 {
   assert(wallet != NULL);
@@ -62,7 +219,7 @@ int construct_spend_tx(transaction_t **out_tx, wallet_t *wallet, int check_avail
   if (check_available_money)
   {
     uint64_t money_required = get_total_entries_amount(transaction_entries);
-    uint64_t available_money = get_balance_for_address(wallet->address);
+    uint64_t available_money = get_wallet_balance(wallet);
     if (available_money < money_required)
     {
       LOG_ERROR("Cannot make transaction, wallet has insufficient funds: %" PRIu64 "!", money_required - available_money);
@@ -70,126 +227,76 @@ int construct_spend_tx(transaction_t **out_tx, wallet_t *wallet, int check_avail
     }
   }
 
-  vec_void_t unspent_txs;
-  vec_init(&unspent_txs);
+  vec_void_t unspent_outputs;
+  vec_init(&unspent_outputs);
 
-  uint32_t num_unspent_txs = 0;
-  assert(get_unspent_transactions_for_address(wallet->address, &unspent_txs, &num_unspent_txs) == 0);
+  uint32_t num_unspent_outputs = 0;
+  assert(get_wallet_unspent_outputs(wallet, &unspent_outputs, &num_unspent_outputs) == 0);
 
+  // each entry is paid for with the next of the wallet's unspent outputs,
+  // so that no output is spent twice, any change goes back to the wallet...
   transaction_t *tx = make_transaction();
+  uint32_t next_output_index = 0;
+  int tx_constructed = 1;
   for (uint16_t i = 0; i < transaction_entries.num_entries; i++)
   {
     transaction_entry_t *transaction_entry = transaction_entries.entries[i];
-
-    void *value = NULL;
-    int index = 0;
-
     uint64_t money_already_spent = 0;
-    int tx_constructed = 0;
-
-    vec_foreach(&unspent_txs, value, index)
+    while (money_already_spent < transaction_entry->amount && next_output_index < num_unspent_outputs)
     {
-      unspent_transaction_t *unspent_tx = (unspent_transaction_t*)value;
-      assert(unspent_tx != NULL);
-
-      for (uint32_t txout_index = 0; txout_index < unspent_tx->unspent_txout_count; txout_index++)
-      {
-        unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[i];
-        assert(unspent_txout != NULL);
-
-        if (unspent_txout->spent == 1)
-        {
-          continue;
-        }
-
-        if (unspent_txout->amount >= transaction_entry->amount)
-        {
-          // construct the txin
-          input_transaction_t *txin = make_txin();
-          memcpy(txin->transaction, unspent_tx->id, HASH_SIZE);
-          txin->txout_index = index;
-          assert(sign_txin(txin, tx, wallet->public_key, wallet->secret_key) == 0);
-          assert(add_txin_to_transaction(tx, txin, txout_index) == 0);
-
-          // construct the txout
-          output_transaction_t *txout = make_txout();
-          memcpy(txout->address, transaction_entry->address, ADDRESS_SIZE);
-          txout->amount = transaction_entry->amount;
-          assert(add_txout_to_transaction(tx, txout, txout_index) == 0);
-
-          // construct the change return txout if there is any change...
-          uint64_t change_leftover = unspent_txout->amount - transaction_entry->amount;
-          if (change_leftover > 0)
-          {
-            output_transaction_t *change_txout = make_txout();
-            memcpy(change_txout->address, wallet->address, ADDRESS_SIZE);
-            change_txout->amount = change_leftover;
-            assert(add_txout_to_transaction(tx, change_txout, txout_index + 1) == 0);
-          }
-
-          tx_constructed = 1;
-          break;
-        }
-        else
-        {
-          if (money_already_spent >= transaction_entry->amount)
-          {
-            tx_constructed = 1;
-            break;
-          }
-
-          // construct the txin
-          input_transaction_t *txin = make_txin();
-          memcpy(txin->transaction, unspent_tx->id, HASH_SIZE);
-          txin->txout_index = index;
-          assert(sign_txin(txin, tx, wallet->public_key, wallet->secret_key) == 0);
-          assert(add_txin_to_transaction(tx, txin, txout_index) == 0);
-
-          // construct the txout
-          output_transaction_t *txout = make_txout();
-          memcpy(txout->address, transaction_entry->address, ADDRESS_SIZE);
-          txout->amount = unspent_txout->amount;
-          assert(add_txout_to_transaction(tx, txout, txout_index) == 0);
-
-          // update the amount of money we've spent in total from out
-          // unspent available txouts...
-          money_already_spent += unspent_txout->amount;
-
-          // construct the change return txout if there is any change...
-          if (money_already_spent > transaction_entry->amount)
-          {
-            uint64_t change_leftover = money_already_spent - transaction_entry->amount;
-            assert(change_leftover > 0);
-
-            output_transaction_t *change_txout = make_txout();
-            memcpy(change_txout->address, wallet->address, ADDRESS_SIZE);
-            change_txout->amount = change_leftover;
-            assert(add_txout_to_transaction(tx, change_txout, txout_index + 1) == 0);
-
-            // since we had money left over, this transaction is now filled,
-            // mark the transaction as constructed.
-            tx_constructed = 1;
-            break;
-          }
-        }
-      }
+      wallet_output_t *output = (wallet_output_t*)unspent_outputs.data[next_output_index];
+      assert(output != NULL);
+      next_output_index++;
+
+      // construct the txin
+      input_transaction_t *txin = make_txin();
+      memcpy(txin->transaction, output->tx_id, HASH_SIZE);
+      txin->txout_index = output->txout_index;
+      assert(add_txin_to_transaction(tx, txin, tx->txin_count) == 0);
+      money_already_spent += output->amount;
+    }
 
-      free_unspent_transaction(unspent_tx);
-      if (tx_constructed)
-      {
-        break;
-      }
+    if (money_already_spent < transaction_entry->amount)
+    {
+      tx_constructed = 0;
+      break;
     }
 
-    if (tx_constructed == 0)
+    // construct the txout
+    output_transaction_t *txout = make_txout();
+    memcpy(txout->address, transaction_entry->address, ADDRESS_SIZE);
+    txout->amount = transaction_entry->amount;
+    assert(add_txout_to_transaction(tx, txout, tx->txout_count) == 0);
+
+    // construct the change return txout if there is any change...
+    uint64_t change_leftover = money_already_spent - transaction_entry->amount;
+    if (change_leftover > 0)
     {
-      LOG_ERROR("Cannot make transaction, could not construct transaction!");
-      free_transaction(tx);
-      return 1;
+      output_transaction_t *change_txout = make_txout();
+      memcpy(change_txout->address, wallet->address, ADDRESS_SIZE);
+      change_txout->amount = change_leftover;
+      assert(add_txout_to_transaction(tx, change_txout, tx->txout_count) == 0);
     }
   }
 
-  vec_deinit(&unspent_txs);
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&unspent_outputs, value, index)
+  {
+    free(value);
+  }
+
+  vec_deinit(&unspent_outputs);
+  if (tx_constructed == 0)
+  {
+    LOG_ERROR("Cannot make transaction, could not construct transaction!");
+    free_transaction(tx);
+    return 1;
+  }
+
+  // the txins sign the tx's txouts, so they can only be signed once all of them were added
+  assert(sign_txins(tx, wallet->public_key, wallet->secret_key) == 0);
+
   compute_self_tx_id(tx);
   *out_tx = tx;
   return 0;
@@ -210,3 +317,238 @@ int construct_coinbase_tx(transaction_t **out_tx, wallet_t *wallet, uint64_t blo
   *out_tx = tx;
   return 0;
 }
+
+typedef struct PayoutSigningJob
+{
+  transaction_t *tx;
+  uint32_t start_txin_index;
+  uint32_t end_txin_index;
+  const uint8_t *sign_header;
+  uint32_t sign_header_size;
+  wallet_t *wallet;
+} payout_signing_job_t;
+
+static void sign_payout_txins(void *arg)
+{
+  payout_signing_job_t *job = (payout_signing_job_t*)arg;
+  assert(job != NULL);
+  assert(sign_txins_with_sign_header(job->tx, job->start_txin_index, job->end_txin_index, job->sign_header,
+    job->sign_header_size, job->wallet->public_key, job->wallet->secret_key) == 0);
+}
+
+/*
+ * Signs the txins of all of the txs on the task schedulers, every tx's sign header
+ * is built once and shared by the jobs signing ranges of that tx's txins.
+ */
+static void sign_payout_txs(transaction_t **txs, uint32_t num_txs, wallet_t *wallet)
+{
+  uint32_t num_jobs = 0;
+  for (uint32_t i = 0; i < num_txs; i++)
+  {
+    num_jobs += (txs[i]->txin_count + TXINS_PER_SIGNING_JOB - 1) / TXINS_PER_SIGNING_JOB;
+  }
+
+  payout_signing_job_t *jobs = malloc(sizeof(payout_signing_job_t) * (num_jobs > 0 ? num_jobs : 1));
+  assert(jobs != NULL);
+  uint8_t **sign_headers = malloc(sizeof(uint8_t*) * num_txs);
+  assert(sign_headers != NULL);
+
+  job_group_t job_group;
+  init_job_group(&job_group);
+
+  uint32_t job_index = 0;
+  for (uint32_t i = 0; i < num_txs; i++)
+  {
+    transaction_t *tx = txs[i];
+    uint32_t sign_header_size = get_tx_sign_header_size(tx);
+    sign_headers[i] = malloc(sign_header_size > 0 ? sign_header_size : 1);
+    assert(sign_headers[i] != NULL);
+    get_tx_sign_header(sign_headers[i], tx);
+
+    for (uint32_t start_txin_index = 0; start_txin_index < tx->txin_count; start_txin_index += TXINS_PER_SIGNING_JOB)
+    {
+      payout_signing_job_t *job = &jobs[job_index];
+      job->tx = tx;
+      job->start_txin_index = start_txin_index;
+      job->end_txin_index = MIN(start_txin_index + TXINS_PER_SIGNING_JOB, tx->txin_count);
+      job->sign_header = sign_headers[i];
+      job->sign_header_size = sign_header_size;
+      job->wallet = wallet;
+      assert(add_job(sign_payout_txins, job, &job_group) == 0);
+      job_index++;
+    }
+  }
+
+  wait_job_group(&job_group);
+  free_job_group(&job_group);
+
+  for (uint32_t i = 0; i < num_txs; i++)
+  {
+    compute_self_tx_id(txs[i]);
+    free(sign_headers[i]);
+  }
+
+  free(sign_headers);
+  free(jobs);
+}
+
+static int compare_wallet_outputs_by_amount(const void *a, const void *b)
+{
+  const wallet_output_t *output = *(const wallet_output_t**)a;
+  const wallet_output_t *other_output = *(const wallet_output_t**)b;
+  if (output->amount != other_output->amount)
+  {
+    return output->amount > other_output->amount ? -1 : 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Builds the txs paying out to all of the payouts from a single pass over the wallet's
+ * unspent outputs. The payouts are split into txs of at most MAX_PAYOUT_TXOUTS_PER_TX txouts,
+ * the inputs of each tx are chosen with `select_coins` from the outputs which were not
+ * already spent by an earlier tx of the batch, any change goes back to the wallet.
+ * Returns 0 and the txs in out txs if every payout could be paid for, no txs are
+ * returned otherwise.
+ */
+int construct_payout_txs(transaction_t **out_txs, uint32_t max_txs, uint32_t *num_txs_out, wallet_t *wallet,
+  const transaction_entry_t *payouts, uint32_t num_payouts)
+{
+  assert(out_txs != NULL);
+  assert(num_txs_out != NULL);
+  assert(wallet != NULL);
+  assert(payouts != NULL);
+  if (num_payouts == 0)
+  {
+    *num_txs_out = 0;
+    return 0;
+  }
+
+  uint32_t num_txs = (num_payouts + MAX_PAYOUT_TXOUTS_PER_TX - 1) / MAX_PAYOUT_TXOUTS_PER_TX;
+  if (num_txs > max_txs)
+  {
+    LOG_ERROR("Cannot make payout, it needs %u transactions but only %u are allowed!", num_txs, max_txs);
+    return 1;
+  }
+
+  vec_void_t unspent_outputs;
+  vec_init(&unspent_outputs);
+
+  uint32_t num_unspent_outputs = 0;
+  assert(get_wallet_unspent_outputs(wallet, &unspent_outputs, &num_unspent_outputs) == 0);
+  if (num_unspent_outputs > 0)
+  {
+    qsort(unspent_outputs.data, num_unspent_outputs, sizeof(void*), compare_wallet_outputs_by_amount);
+  }
+
+  size_t max_outputs = num_unspent_outputs > 0 ? num_unspent_outputs : 1;
+  uint8_t *spent_outputs = calloc(max_outputs, sizeof(uint8_t));
+  uint64_t *amounts = malloc(sizeof(uint64_t) * max_outputs);
+  uint32_t *output_indexes = malloc(sizeof(uint32_t) * max_outputs);
+  uint32_t *selected_indexes = malloc(sizeof(uint32_t) * MAX_PAYOUT_TXINS_PER_TX);
+  assert(spent_outputs != NULL && amounts != NULL && output_indexes != NULL && selected_indexes != NULL);
+
+  int result = 0;
+  uint32_t num_constructed_txs = 0;
+  for (uint32_t tx_index = 0; tx_index < num_txs; tx_index++)
+  {
+    uint32_t start_payout_index = tx_index * MAX_PAYOUT_TXOUTS_PER_TX;
+    uint32_t end_payout_index = MIN(start_payout_index + MAX_PAYOUT_TXOUTS_PER_TX, num_payouts);
+
+    uint64_t target = 0;
+    for (uint32_t i = start_payout_index; i < end_payout_index; i++)
+    {
+      if (payouts[i].amount == 0 || payouts[i].amount > MAX_MONEY - target)
+      {
+        LOG_ERROR("Cannot make payout, invalid payout amount: %" PRIu64 "!", payouts[i].amount);
+        result = 1;
+        goto construct_payout_txs_cleanup;
+      }
+
+      target += payouts[i].amount;
+    }
+
+    // the outputs still unspent by the batch, kept sorted largest first
+    uint32_t num_amounts = 0;
+    for (uint32_t i = 0; i < num_unspent_outputs; i++)
+    {
+      if (spent_outputs[i] == 0)
+      {
+        amounts[num_amounts] = ((wallet_output_t*)unspent_outputs.data[i])->amount;
+        output_indexes[num_amounts] = i;
+        num_amounts++;
+      }
+    }
+
+    uint32_t num_selected = 0;
+    uint64_t selected_amount = 0;
+    if (select_coins(amounts, num_amounts, target, MAX_PAYOUT_TXINS_PER_TX, selected_indexes,
+      &num_selected, &selected_amount))
+    {
+      LOG_ERROR("Cannot make payout, wallet has insufficient funds for transaction: %u!", tx_index);
+      result = 1;
+      goto construct_payout_txs_cleanup;
+    }
+
+    transaction_t *tx = make_transaction();
+    for (uint32_t i = 0; i < num_selected; i++)
+    {
+      uint32_t output_index = output_indexes[selected_indexes[i]];
+      wallet_output_t *output = (wallet_output_t*)unspent_outputs.data[output_index];
+      spent_outputs[output_index] = 1;
+
+      input_transaction_t *txin = make_txin();
+      memcpy(txin->transaction, output->tx_id, HASH_SIZE);
+      txin->txout_index = output->txout_index;
+      assert(add_txin_to_transaction(tx, txin, tx->txin_count) == 0);
+    }
+
+    for (uint32_t i = start_payout_index; i < end_payout_index; i++)
+    {
+      output_transaction_t *txout = make_txout();
+      memcpy(txout->address, payouts[i].address, ADDRESS_SIZE);
+      txout->amount = payouts[i].amount;
+      assert(add_txout_to_transaction(tx, txout, tx->txout_count) == 0);
+    }
+
+    if (selected_amount > target)
+    {
+      output_transaction_t *change_txout = make_txout();
+      memcpy(change_txout->address, wallet->address, ADDRESS_SIZE);
+      change_txout->amount = selected_amount - target;
+      assert(add_txout_to_transaction(tx, change_txout, tx->txout_count) == 0);
+    }
+
+    out_txs[tx_index] = tx;
+    num_constructed_txs++;
+  }
+
+  // the txins sign the tx's txouts, so they can only be signed once all of them were added
+  sign_payout_txs(out_txs, num_constructed_txs, wallet);
+  *num_txs_out = num_constructed_txs;
+
+construct_payout_txs_cleanup:
+  if (result)
+  {
+    for (uint32_t i = 0; i < num_constructed_txs; i++)
+    {
+      free_transaction(out_txs[i]);
+      out_txs[i] = NULL;
+    }
+  }
+
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&unspent_outputs, value, index)
+  {
+    free(value);
+  }
+
+  vec_deinit(&unspent_outputs);
+  free(selected_indexes);
+  free(output_indexes);
+  free(amounts);
+  free(spent_outputs);
+  return result;
+}
@@ -40,6 +40,18 @@
 
 VULKAN_BEGIN_DECL
 
+// a payout is split across as many txs as it takes for each of them to stay under
+// these limits, one txout of every tx is kept for the change going back to the wallet...
+#define MAX_PAYOUT_TXOUTS_PER_TX (MAX_NUM_TX_ENTRIES - 1)
+#define MAX_PAYOUT_TXINS_PER_TX 1024
+
+// the most branches the branch and bound coin selection explores looking for
+// a set of outputs which pays the target exactly before falling back...
+#define COIN_SELECTION_BNB_MAX_TRIES 100000
+
+// the txins of the payout txs are signed on the task schedulers in jobs of this many txins
+#define TXINS_PER_SIGNING_JOB 64
+
 typedef struct TransactionEntry
 {
   uint8_t address[ADDRESS_SIZE];
@@ -52,7 +64,10 @@ typedef struct TransactionEntries
   transaction_entry_t *entries[MAX_NUM_TX_ENTRIES];
 } transaction_entries_t;
 
+VULKAN_API int select_coins(const uint64_t *amounts, uint32_t num_amounts, uint64_t target, uint32_t max_selected, uint32_t *selected_indexes, uint32_t *num_selected_out, uint64_t *selected_amount_out);
+
 VULKAN_API int construct_spend_tx(transaction_t **out_tx, wallet_t *wallet, int check_available_money, transaction_entries_t transaction_entries);
+VULKAN_API int construct_payout_txs(transaction_t **out_txs, uint32_t max_txs, uint32_t *num_txs_out, wallet_t *wallet, const transaction_entry_t *payouts, uint32_t num_payouts);
 VULKAN_API int construct_coinbase_tx(transaction_t **out_tx, wallet_t *wallet, uint64_t block_reward);
 
 VULKAN_END_DECL
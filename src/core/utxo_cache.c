@@ -0,0 +1,408 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <hashtable.h>
+
+#include "common/logger.h"
+#include "common/util.h"
+
+#include "blockchain.h"
+#include "parameters.h"
+#include "storage.h"
+#include "transaction.h"
+#include "utxo_cache.h"
+
+// the utxo cache is not locked on it's own, it is only ever
+// accessed by the blockchain while holding the blockchain lock...
+static int g_utxo_cache_initialized = 0;
+static HashTable *g_utxo_cache_table = NULL;
+
+static size_t g_utxo_cache_max_memory_size = DEFAULT_UTXO_CACHE_MAX_MEMORY_SIZE;
+static uint32_t g_utxo_cache_flush_interval = DEFAULT_UTXO_CACHE_FLUSH_INTERVAL;
+
+static size_t g_utxo_cache_memory_size = 0;
+static size_t g_utxo_cache_num_dirty_entries = 0;
+
+// bumped whenever the unspent index may have changed underneath the cache, entries
+// read from the unspent index without holding the blockchain lock are only added
+// while the generation they were read at is still the current one...
+static uint64_t g_utxo_cache_generation = 0;
+
+static int compare_utxo_cache_tx_id(const void *key1, const void *key2)
+{
+  return memcmp(key1, key2, HASH_SIZE);
+}
+
+static size_t get_utxo_cache_entry_memory_size(utxo_cache_entry_t *entry)
+{
+  assert(entry != NULL);
+  size_t memory_size = sizeof(utxo_cache_entry_t) + sizeof(TableEntry);
+  if (entry->unspent_tx != NULL)
+  {
+    memory_size += sizeof(unspent_transaction_t);
+    memory_size += entry->unspent_tx->unspent_txout_count *
+      (sizeof(unspent_output_transaction_t*) + sizeof(unspent_output_transaction_t));
+  }
+
+  return memory_size;
+}
+
+static void set_utxo_cache_entry_dirty(utxo_cache_entry_t *entry, int dirty)
+{
+  assert(entry != NULL);
+  if (entry->dirty == 0 && dirty)
+  {
+    g_utxo_cache_num_dirty_entries++;
+  }
+  else if (entry->dirty && dirty == 0)
+  {
+    g_utxo_cache_num_dirty_entries--;
+  }
+
+  entry->dirty = (dirty != 0);
+}
+
+static void set_utxo_cache_entry_unspent_tx(utxo_cache_entry_t *entry, unspent_transaction_t *unspent_tx)
+{
+  assert(entry != NULL);
+  if (entry->unspent_tx != NULL && entry->unspent_tx != unspent_tx)
+  {
+    free_unspent_transaction(entry->unspent_tx);
+  }
+
+  g_utxo_cache_memory_size -= entry->memory_size;
+  entry->unspent_tx = unspent_tx;
+  entry->memory_size = get_utxo_cache_entry_memory_size(entry);
+  g_utxo_cache_memory_size += entry->memory_size;
+}
+
+static utxo_cache_entry_t* add_utxo_cache_entry(uint8_t *tx_id)
+{
+  utxo_cache_entry_t *entry = get_utxo_cache_entry(tx_id);
+  if (entry != NULL)
+  {
+    return entry;
+  }
+
+  entry = malloc(sizeof(utxo_cache_entry_t));
+  assert(entry != NULL);
+  memcpy(entry->id, tx_id, HASH_SIZE);
+  entry->unspent_tx = NULL;
+  entry->dirty = 0;
+  entry->memory_size = get_utxo_cache_entry_memory_size(entry);
+
+  assert(hashtable_add(g_utxo_cache_table, entry->id, entry) == CC_OK);
+  g_utxo_cache_memory_size += entry->memory_size;
+  return entry;
+}
+
+static void free_utxo_cache_entry(utxo_cache_entry_t *entry)
+{
+  assert(entry != NULL);
+  set_utxo_cache_entry_dirty(entry, 0);
+  g_utxo_cache_memory_size -= entry->memory_size;
+  if (entry->unspent_tx != NULL)
+  {
+    free_unspent_transaction(entry->unspent_tx);
+  }
+
+  free(entry);
+}
+
+void set_utxo_cache_max_memory_size(size_t max_memory_size)
+{
+  g_utxo_cache_max_memory_size = max_memory_size;
+}
+
+size_t get_utxo_cache_max_memory_size(void)
+{
+  return g_utxo_cache_max_memory_size;
+}
+
+void set_utxo_cache_flush_interval(uint32_t flush_interval)
+{
+  g_utxo_cache_flush_interval = flush_interval;
+}
+
+uint32_t get_utxo_cache_flush_interval(void)
+{
+  return g_utxo_cache_flush_interval;
+}
+
+size_t get_utxo_cache_memory_size(void)
+{
+  return g_utxo_cache_memory_size;
+}
+
+size_t get_utxo_cache_num_entries(void)
+{
+  if (g_utxo_cache_table == NULL)
+  {
+    return 0;
+  }
+
+  return hashtable_size(g_utxo_cache_table);
+}
+
+uint64_t get_utxo_cache_generation(void)
+{
+  return g_utxo_cache_generation;
+}
+
+size_t get_utxo_cache_num_dirty_entries(void)
+{
+  return g_utxo_cache_num_dirty_entries;
+}
+
+utxo_cache_entry_t* get_utxo_cache_entry(uint8_t *tx_id)
+{
+  assert(tx_id != NULL);
+  assert(g_utxo_cache_table != NULL);
+
+  void *val = NULL;
+  if (hashtable_get(g_utxo_cache_table, tx_id, &val) != CC_OK)
+  {
+    return NULL;
+  }
+
+  return (utxo_cache_entry_t*)val;
+}
+
+/*
+ * Collects the dirty entries of the cache, these are the unspent txs whose changes the
+ * unspent and address indexes do not have yet. The entries remain owned by the cache.
+ */
+void get_utxo_cache_dirty_entries(vec_void_t *entries)
+{
+  assert(entries != NULL);
+  assert(g_utxo_cache_table != NULL);
+  if (g_utxo_cache_num_dirty_entries == 0)
+  {
+    return;
+  }
+
+  void *val = NULL;
+  HASHTABLE_FOREACH(val, g_utxo_cache_table,
+  {
+    utxo_cache_entry_t *entry = *(utxo_cache_entry_t**)val;
+    assert(entry != NULL);
+    if (entry->dirty)
+    {
+      assert(vec_push(entries, entry) == 0);
+    }
+  });
+}
+
+/* The utxo cache takes ownership of the unspent tx, dirty entries are
+ * changes that have not yet been flushed to the unspent index...
+ */
+int add_unspent_tx_to_utxo_cache(unspent_transaction_t *unspent_tx, int dirty)
+{
+  assert(unspent_tx != NULL);
+  utxo_cache_entry_t *entry = add_utxo_cache_entry(unspent_tx->id);
+  set_utxo_cache_entry_unspent_tx(entry, unspent_tx);
+  set_utxo_cache_entry_dirty(entry, entry->dirty || dirty);
+  return 0;
+}
+
+int add_spent_tx_to_utxo_cache(uint8_t *tx_id)
+{
+  assert(tx_id != NULL);
+  utxo_cache_entry_t *entry = add_utxo_cache_entry(tx_id);
+  set_utxo_cache_entry_unspent_tx(entry, NULL);
+  set_utxo_cache_entry_dirty(entry, 1);
+  return 0;
+}
+
+int remove_tx_from_utxo_cache(uint8_t *tx_id)
+{
+  assert(tx_id != NULL);
+  assert(g_utxo_cache_table != NULL);
+  g_utxo_cache_generation++;
+
+  void *val = NULL;
+  if (hashtable_remove(g_utxo_cache_table, tx_id, &val) != CC_OK)
+  {
+    return 1;
+  }
+
+  free_utxo_cache_entry((utxo_cache_entry_t*)val);
+  return 0;
+}
+
+int write_utxo_cache_to_write_batch(storage_batch_t *write_batch)
+{
+  assert(write_batch != NULL);
+  assert(g_utxo_cache_table != NULL);
+
+  void *val = NULL;
+  HASHTABLE_FOREACH(val, g_utxo_cache_table,
+  {
+    utxo_cache_entry_t *entry = *(utxo_cache_entry_t**)val;
+    assert(entry != NULL);
+    if (entry->dirty == 0)
+    {
+      continue;
+    }
+
+    if (entry->unspent_tx == NULL)
+    {
+      uint8_t key[HASH_SIZE + DB_KEY_PREFIX_SIZE_UNSPENT_TX];
+      get_unspent_tx_key(key, entry->id);
+
+      storage_batch_delete(write_batch, key, sizeof(key));
+      continue;
+    }
+
+    // this also keeps the address index in sync with the unspent tx
+    if (write_batch_put_unspent_tx(write_batch, entry->unspent_tx))
+    {
+      char *unspent_tx_hash_str = bin2hex(entry->id, HASH_SIZE);
+      LOG_ERROR("Could not flush utxo cache, failed to serialize unspent tx: %s!", unspent_tx_hash_str);
+      free(unspent_tx_hash_str);
+      return 1;
+    }
+  });
+
+  return 0;
+}
+
+/* Called once the dirty entries have been written to the unspent index,
+ * spent entries no longer need to be remembered after this point...
+ */
+void mark_utxo_cache_clean(void)
+{
+  assert(g_utxo_cache_table != NULL);
+
+  HashTableIter iter;
+  hashtable_iter_init(&iter, g_utxo_cache_table);
+
+  TableEntry *table_entry = NULL;
+  while (hashtable_iter_next(&iter, &table_entry) != CC_ITER_END)
+  {
+    utxo_cache_entry_t *entry = (utxo_cache_entry_t*)table_entry->value;
+    assert(entry != NULL);
+
+    set_utxo_cache_entry_dirty(entry, 0);
+    if (entry->unspent_tx == NULL || is_unspent_tx_spent(entry->unspent_tx))
+    {
+      assert(hashtable_iter_remove(&iter, NULL) == CC_OK);
+      free_utxo_cache_entry(entry);
+    }
+  }
+
+  assert(g_utxo_cache_num_dirty_entries == 0);
+  g_utxo_cache_generation++;
+}
+
+/* Evicts clean entries once the cache grows beyond it's memory budget,
+ * dirty entries must be flushed before they can be evicted.
+ */
+void trim_utxo_cache(void)
+{
+  assert(g_utxo_cache_table != NULL);
+  if (g_utxo_cache_memory_size <= g_utxo_cache_max_memory_size)
+  {
+    return;
+  }
+
+  // evict down to half of the budget so we don't trim again on the next lookup
+  size_t target_memory_size = g_utxo_cache_max_memory_size / 2;
+
+  HashTableIter iter;
+  hashtable_iter_init(&iter, g_utxo_cache_table);
+
+  TableEntry *table_entry = NULL;
+  while (g_utxo_cache_memory_size > target_memory_size &&
+    hashtable_iter_next(&iter, &table_entry) != CC_ITER_END)
+  {
+    utxo_cache_entry_t *entry = (utxo_cache_entry_t*)table_entry->value;
+    assert(entry != NULL);
+    if (entry->dirty)
+    {
+      continue;
+    }
+
+    assert(hashtable_iter_remove(&iter, NULL) == CC_OK);
+    free_utxo_cache_entry(entry);
+  }
+}
+
+void clear_utxo_cache(void)
+{
+  assert(g_utxo_cache_table != NULL);
+  void *val = NULL;
+  HASHTABLE_FOREACH(val, g_utxo_cache_table,
+  {
+    free_utxo_cache_entry(*(utxo_cache_entry_t**)val);
+  });
+
+  hashtable_remove_all(g_utxo_cache_table);
+  g_utxo_cache_memory_size = 0;
+  g_utxo_cache_num_dirty_entries = 0;
+  g_utxo_cache_generation++;
+}
+
+int init_utxo_cache(void)
+{
+  if (g_utxo_cache_initialized)
+  {
+    return 1;
+  }
+
+  HashTableConf utxo_cache_conf;
+  hashtable_conf_init(&utxo_cache_conf);
+  utxo_cache_conf.key_length = HASH_SIZE;
+  utxo_cache_conf.hash = GENERAL_HASH;
+  utxo_cache_conf.key_compare = compare_utxo_cache_tx_id;
+  if (hashtable_new_conf(&utxo_cache_conf, &g_utxo_cache_table) != CC_OK)
+  {
+    return 1;
+  }
+
+  g_utxo_cache_memory_size = 0;
+  g_utxo_cache_num_dirty_entries = 0;
+  g_utxo_cache_initialized = 1;
+  return 0;
+}
+
+int deinit_utxo_cache(void)
+{
+  if (g_utxo_cache_initialized == 0)
+  {
+    return 1;
+  }
+
+  clear_utxo_cache();
+  hashtable_destroy(g_utxo_cache_table);
+  g_utxo_cache_table = NULL;
+  g_utxo_cache_initialized = 0;
+  return 0;
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/vec.h"
+#include "common/vulkan.h"
+
+#include "storage.h"
+#include "transaction.h"
+
+VULKAN_BEGIN_DECL
+
+typedef struct UtxoCacheEntry
+{
+  uint8_t id[HASH_SIZE];
+  unspent_transaction_t *unspent_tx; // NULL once the unspent tx has been removed
+  uint8_t dirty;
+  size_t memory_size;
+} utxo_cache_entry_t;
+
+VULKAN_API void set_utxo_cache_max_memory_size(size_t max_memory_size);
+VULKAN_API size_t get_utxo_cache_max_memory_size(void);
+
+VULKAN_API void set_utxo_cache_flush_interval(uint32_t flush_interval);
+VULKAN_API uint32_t get_utxo_cache_flush_interval(void);
+
+VULKAN_API size_t get_utxo_cache_memory_size(void);
+VULKAN_API size_t get_utxo_cache_num_entries(void);
+VULKAN_API size_t get_utxo_cache_num_dirty_entries(void);
+VULKAN_API uint64_t get_utxo_cache_generation(void);
+
+VULKAN_API utxo_cache_entry_t* get_utxo_cache_entry(uint8_t *tx_id);
+VULKAN_API void get_utxo_cache_dirty_entries(vec_void_t *entries);
+
+VULKAN_API int add_unspent_tx_to_utxo_cache(unspent_transaction_t *unspent_tx, int dirty);
+VULKAN_API int add_spent_tx_to_utxo_cache(uint8_t *tx_id);
+VULKAN_API int remove_tx_from_utxo_cache(uint8_t *tx_id);
+
+VULKAN_API int write_utxo_cache_to_write_batch(storage_batch_t *write_batch);
+VULKAN_API void mark_utxo_cache_clean(void);
+
+VULKAN_API void trim_utxo_cache(void);
+VULKAN_API void clear_utxo_cache(void);
+
+VULKAN_API int init_utxo_cache(void);
+VULKAN_API int deinit_utxo_cache(void);
+
+VULKAN_END_DECL
@@ -0,0 +1,593 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sodium.h>
+
+#include "common/logger.h"
+#include "common/task.h"
+#include "common/util.h"
+
+#include "block.h"
+#include "blockchain.h"
+#include "utxo_snapshot.h"
+
+#include "crypto/cryptoutil.h"
+
+#define UTXO_SNAPSHOT_HEADER_SIZE (UTXO_SNAPSHOT_MAGIC_SIZE + sizeof(uint32_t) + sizeof(uint32_t) + HASH_SIZE)
+#define UTXO_SNAPSHOT_CHUNK_HEADER_SIZE (1 + sizeof(uint32_t) + sizeof(uint32_t))
+#define UTXO_SNAPSHOT_TRAILER_SIZE (sizeof(uint32_t) + sizeof(uint64_t) + HASH_SIZE)
+
+struct UtxoSnapshotWriter
+{
+  FILE *file;
+  utxo_snapshot_entry_type_t chunk_type;
+  uint8_t *chunk_data;
+  uint32_t chunk_size;
+  uint32_t chunk_num_entries;
+  uint32_t num_headers;
+  uint64_t num_unspent_txs;
+  crypto_hash_sha256_state snapshot_hash_state;
+};
+
+struct UtxoSnapshotReader
+{
+  FILE *file;
+  utxo_snapshot_entry_type_t chunk_type;
+  uint8_t *chunk_data;
+  uint32_t chunk_size;
+  uint32_t chunk_offset;
+  uint32_t chunk_num_entries;
+  uint32_t chunk_entry_index;
+  uint32_t num_headers;
+  uint64_t num_unspent_txs;
+  crypto_hash_sha256_state snapshot_hash_state;
+  uint8_t snapshot_hash[HASH_SIZE];
+  int finished;
+};
+
+static task_t *g_utxo_snapshot_verify_task = NULL;
+static uint32_t g_utxo_snapshot_verify_height = 0;
+
+static void pack_uint32(uint8_t *data, uint32_t value)
+{
+  data[0] = (uint8_t)(value >> 24);
+  data[1] = (uint8_t)(value >> 16);
+  data[2] = (uint8_t)(value >> 8);
+  data[3] = (uint8_t)value;
+}
+
+static uint32_t unpack_uint32(const uint8_t *data)
+{
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static void pack_uint64(uint8_t *data, uint64_t value)
+{
+  pack_uint32(data, (uint32_t)(value >> 32));
+  pack_uint32(data + sizeof(uint32_t), (uint32_t)value);
+}
+
+static uint64_t unpack_uint64(const uint8_t *data)
+{
+  return ((uint64_t)unpack_uint32(data) << 32) | (uint64_t)unpack_uint32(data + sizeof(uint32_t));
+}
+
+utxo_snapshot_writer_t* utxo_snapshot_writer_open(const char *filename, uint32_t height, uint8_t *block_hash)
+{
+  assert(filename != NULL);
+  assert(block_hash != NULL);
+
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL)
+  {
+    LOG_ERROR("Could not open UTXO snapshot: %s for writing!", filename);
+    return NULL;
+  }
+
+  uint8_t header[UTXO_SNAPSHOT_HEADER_SIZE];
+  memcpy(header, UTXO_SNAPSHOT_MAGIC, UTXO_SNAPSHOT_MAGIC_SIZE);
+  pack_uint32(header + UTXO_SNAPSHOT_MAGIC_SIZE, UTXO_SNAPSHOT_VERSION);
+  pack_uint32(header + UTXO_SNAPSHOT_MAGIC_SIZE + sizeof(uint32_t), height);
+  memcpy(header + UTXO_SNAPSHOT_MAGIC_SIZE + (sizeof(uint32_t) * 2), block_hash, HASH_SIZE);
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+  {
+    LOG_ERROR("Could not write UTXO snapshot: %s header!", filename);
+    fclose(file);
+    return NULL;
+  }
+
+  utxo_snapshot_writer_t *writer = malloc(sizeof(utxo_snapshot_writer_t));
+  assert(writer != NULL);
+  writer->file = file;
+  writer->chunk_type = UTXO_SNAPSHOT_ENTRY_END;
+  writer->chunk_data = malloc(UTXO_SNAPSHOT_MAX_CHUNK_SIZE);
+  assert(writer->chunk_data != NULL);
+  writer->chunk_size = 0;
+  writer->chunk_num_entries = 0;
+  writer->num_headers = 0;
+  writer->num_unspent_txs = 0;
+  crypto_hash_sha256_init(&writer->snapshot_hash_state);
+  return writer;
+}
+
+static int flush_utxo_snapshot_chunk(utxo_snapshot_writer_t *writer)
+{
+  assert(writer != NULL);
+  if (writer->chunk_num_entries == 0)
+  {
+    return 0;
+  }
+
+  uint8_t chunk_header[UTXO_SNAPSHOT_CHUNK_HEADER_SIZE];
+  chunk_header[0] = (uint8_t)writer->chunk_type;
+  pack_uint32(chunk_header + 1, writer->chunk_num_entries);
+  pack_uint32(chunk_header + 1 + sizeof(uint32_t), writer->chunk_size);
+
+  uint8_t chunk_hash[HASH_SIZE];
+  crypto_hash_sha256(chunk_hash, writer->chunk_data, writer->chunk_size);
+  if (writer->chunk_type == UTXO_SNAPSHOT_ENTRY_UNSPENT_TX)
+  {
+    crypto_hash_sha256_update(&writer->snapshot_hash_state, writer->chunk_data, writer->chunk_size);
+  }
+
+  if (fwrite(chunk_header, 1, sizeof(chunk_header), writer->file) != sizeof(chunk_header) ||
+    fwrite(writer->chunk_data, 1, writer->chunk_size, writer->file) != writer->chunk_size ||
+    fwrite(chunk_hash, 1, HASH_SIZE, writer->file) != HASH_SIZE)
+  {
+    LOG_ERROR("Could not write UTXO snapshot chunk!");
+    return 1;
+  }
+
+  writer->chunk_size = 0;
+  writer->chunk_num_entries = 0;
+  return 0;
+}
+
+int utxo_snapshot_write_entry(utxo_snapshot_writer_t *writer, utxo_snapshot_entry_type_t entry_type, const uint8_t *data, uint32_t data_size)
+{
+  assert(writer != NULL);
+  assert(data != NULL);
+  assert(entry_type == UTXO_SNAPSHOT_ENTRY_HEADER || entry_type == UTXO_SNAPSHOT_ENTRY_UNSPENT_TX);
+
+  // every entry is kept whole within a single chunk
+  uint32_t entry_size = sizeof(uint32_t) + data_size;
+  if (entry_size > UTXO_SNAPSHOT_MAX_CHUNK_SIZE)
+  {
+    LOG_ERROR("Could not write UTXO snapshot entry of size: %u, entry is too large!", data_size);
+    return 1;
+  }
+
+  if (writer->chunk_type != entry_type || writer->chunk_size + entry_size > UTXO_SNAPSHOT_MAX_CHUNK_SIZE)
+  {
+    if (flush_utxo_snapshot_chunk(writer))
+    {
+      return 1;
+    }
+
+    writer->chunk_type = entry_type;
+  }
+
+  pack_uint32(writer->chunk_data + writer->chunk_size, data_size);
+  memcpy(writer->chunk_data + writer->chunk_size + sizeof(uint32_t), data, data_size);
+  writer->chunk_size += entry_size;
+  writer->chunk_num_entries++;
+
+  if (entry_type == UTXO_SNAPSHOT_ENTRY_HEADER)
+  {
+    writer->num_headers++;
+  }
+  else
+  {
+    writer->num_unspent_txs++;
+  }
+
+  return 0;
+}
+
+int utxo_snapshot_writer_finish(utxo_snapshot_writer_t *writer, uint8_t *snapshot_hash)
+{
+  assert(writer != NULL);
+  assert(snapshot_hash != NULL);
+  if (flush_utxo_snapshot_chunk(writer))
+  {
+    return 1;
+  }
+
+  crypto_hash_sha256_final(&writer->snapshot_hash_state, snapshot_hash);
+
+  uint8_t trailer[1 + UTXO_SNAPSHOT_TRAILER_SIZE];
+  trailer[0] = (uint8_t)UTXO_SNAPSHOT_ENTRY_END;
+  pack_uint32(trailer + 1, writer->num_headers);
+  pack_uint64(trailer + 1 + sizeof(uint32_t), writer->num_unspent_txs);
+  memcpy(trailer + 1 + sizeof(uint32_t) + sizeof(uint64_t), snapshot_hash, HASH_SIZE);
+  if (fwrite(trailer, 1, sizeof(trailer), writer->file) != sizeof(trailer) || fflush(writer->file) != 0)
+  {
+    LOG_ERROR("Could not write UTXO snapshot trailer!");
+    return 1;
+  }
+
+  return 0;
+}
+
+void utxo_snapshot_writer_close(utxo_snapshot_writer_t *writer)
+{
+  assert(writer != NULL);
+  fclose(writer->file);
+  free(writer->chunk_data);
+  free(writer);
+}
+
+utxo_snapshot_reader_t* utxo_snapshot_reader_open(const char *filename, uint32_t *height, uint8_t *block_hash)
+{
+  assert(filename != NULL);
+  assert(height != NULL);
+  assert(block_hash != NULL);
+
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL)
+  {
+    LOG_ERROR("Could not open UTXO snapshot: %s for reading!", filename);
+    return NULL;
+  }
+
+  uint8_t header[UTXO_SNAPSHOT_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+    memcmp(header, UTXO_SNAPSHOT_MAGIC, UTXO_SNAPSHOT_MAGIC_SIZE) != 0)
+  {
+    LOG_ERROR("Could not read UTXO snapshot: %s, file is not a UTXO snapshot!", filename);
+    fclose(file);
+    return NULL;
+  }
+
+  uint32_t version = unpack_uint32(header + UTXO_SNAPSHOT_MAGIC_SIZE);
+  if (version != UTXO_SNAPSHOT_VERSION)
+  {
+    LOG_ERROR("Could not read UTXO snapshot: %s, unsupported version: %u!", filename, version);
+    fclose(file);
+    return NULL;
+  }
+
+  *height = unpack_uint32(header + UTXO_SNAPSHOT_MAGIC_SIZE + sizeof(uint32_t));
+  memcpy(block_hash, header + UTXO_SNAPSHOT_MAGIC_SIZE + (sizeof(uint32_t) * 2), HASH_SIZE);
+
+  utxo_snapshot_reader_t *reader = malloc(sizeof(utxo_snapshot_reader_t));
+  assert(reader != NULL);
+  reader->file = file;
+  reader->chunk_type = UTXO_SNAPSHOT_ENTRY_END;
+  reader->chunk_data = malloc(UTXO_SNAPSHOT_MAX_CHUNK_SIZE);
+  assert(reader->chunk_data != NULL);
+  reader->chunk_size = 0;
+  reader->chunk_offset = 0;
+  reader->chunk_num_entries = 0;
+  reader->chunk_entry_index = 0;
+  reader->num_headers = 0;
+  reader->num_unspent_txs = 0;
+  crypto_hash_sha256_init(&reader->snapshot_hash_state);
+  memset(reader->snapshot_hash, 0, HASH_SIZE);
+  reader->finished = 0;
+  return reader;
+}
+
+static int read_utxo_snapshot_trailer(utxo_snapshot_reader_t *reader)
+{
+  assert(reader != NULL);
+  uint8_t trailer[UTXO_SNAPSHOT_TRAILER_SIZE];
+  if (fread(trailer, 1, sizeof(trailer), reader->file) != sizeof(trailer))
+  {
+    LOG_ERROR("Could not read UTXO snapshot trailer!");
+    return 1;
+  }
+
+  // the counts and hash in the trailer must match the chunks that were read
+  uint32_t num_headers = unpack_uint32(trailer);
+  uint64_t num_unspent_txs = unpack_uint64(trailer + sizeof(uint32_t));
+  crypto_hash_sha256_final(&reader->snapshot_hash_state, reader->snapshot_hash);
+  if (num_headers != reader->num_headers || num_unspent_txs != reader->num_unspent_txs ||
+    compare_hash(reader->snapshot_hash, trailer + sizeof(uint32_t) + sizeof(uint64_t)) == 0)
+  {
+    LOG_ERROR("Could not read UTXO snapshot, trailer does not match it's contents!");
+    return 1;
+  }
+
+  reader->finished = 1;
+  return 0;
+}
+
+static int read_utxo_snapshot_chunk(utxo_snapshot_reader_t *reader)
+{
+  assert(reader != NULL);
+  uint8_t chunk_type = 0;
+  if (fread(&chunk_type, 1, 1, reader->file) != 1)
+  {
+    LOG_ERROR("Could not read UTXO snapshot, unexpected end of file!");
+    return 1;
+  }
+
+  if (chunk_type == UTXO_SNAPSHOT_ENTRY_END)
+  {
+    reader->chunk_type = UTXO_SNAPSHOT_ENTRY_END;
+    return read_utxo_snapshot_trailer(reader);
+  }
+
+  uint8_t chunk_header[UTXO_SNAPSHOT_CHUNK_HEADER_SIZE - 1];
+  if ((chunk_type != UTXO_SNAPSHOT_ENTRY_HEADER && chunk_type != UTXO_SNAPSHOT_ENTRY_UNSPENT_TX) ||
+    fread(chunk_header, 1, sizeof(chunk_header), reader->file) != sizeof(chunk_header))
+  {
+    LOG_ERROR("Could not read UTXO snapshot, invalid chunk header!");
+    return 1;
+  }
+
+  uint32_t chunk_num_entries = unpack_uint32(chunk_header);
+  uint32_t chunk_size = unpack_uint32(chunk_header + sizeof(uint32_t));
+  if (chunk_num_entries == 0 || chunk_size > UTXO_SNAPSHOT_MAX_CHUNK_SIZE)
+  {
+    LOG_ERROR("Could not read UTXO snapshot, invalid chunk of size: %u with %u entries!", chunk_size, chunk_num_entries);
+    return 1;
+  }
+
+  uint8_t chunk_hash[HASH_SIZE];
+  if (fread(reader->chunk_data, 1, chunk_size, reader->file) != chunk_size ||
+    fread(chunk_hash, 1, HASH_SIZE, reader->file) != HASH_SIZE)
+  {
+    LOG_ERROR("Could not read UTXO snapshot, unexpected end of file!");
+    return 1;
+  }
+
+  uint8_t expected_chunk_hash[HASH_SIZE];
+  crypto_hash_sha256(expected_chunk_hash, reader->chunk_data, chunk_size);
+  if (compare_hash(chunk_hash, expected_chunk_hash) == 0)
+  {
+    LOG_ERROR("Could not read UTXO snapshot, chunk hash does not match it's data!");
+    return 1;
+  }
+
+  if (chunk_type == UTXO_SNAPSHOT_ENTRY_UNSPENT_TX)
+  {
+    crypto_hash_sha256_update(&reader->snapshot_hash_state, reader->chunk_data, chunk_size);
+  }
+
+  reader->chunk_type = (utxo_snapshot_entry_type_t)chunk_type;
+  reader->chunk_size = chunk_size;
+  reader->chunk_offset = 0;
+  reader->chunk_num_entries = chunk_num_entries;
+  reader->chunk_entry_index = 0;
+  return 0;
+}
+
+/*
+ * Reads the next entry of the snapshot, the entry data points into the reader's
+ * chunk and is only valid until the next entry is read. Once every chunk has been
+ * read an entry of type UTXO_SNAPSHOT_ENTRY_END is returned...
+ */
+int utxo_snapshot_read_entry(utxo_snapshot_reader_t *reader, utxo_snapshot_entry_type_t *entry_type, const uint8_t **data, uint32_t *data_size)
+{
+  assert(reader != NULL);
+  assert(entry_type != NULL);
+  assert(data != NULL);
+  assert(data_size != NULL);
+
+  if (reader->finished)
+  {
+    *entry_type = UTXO_SNAPSHOT_ENTRY_END;
+    return 0;
+  }
+
+  if (reader->chunk_entry_index >= reader->chunk_num_entries)
+  {
+    // a chunk must not have any data left over after it's last entry
+    if (reader->chunk_offset != reader->chunk_size)
+    {
+      LOG_ERROR("Could not read UTXO snapshot, chunk has trailing data!");
+      return 1;
+    }
+
+    if (read_utxo_snapshot_chunk(reader))
+    {
+      return 1;
+    }
+
+    if (reader->finished)
+    {
+      *entry_type = UTXO_SNAPSHOT_ENTRY_END;
+      return 0;
+    }
+  }
+
+  uint32_t remaining_size = reader->chunk_size - reader->chunk_offset;
+  if (remaining_size < sizeof(uint32_t))
+  {
+    LOG_ERROR("Could not read UTXO snapshot, truncated chunk entry!");
+    return 1;
+  }
+
+  uint32_t entry_size = unpack_uint32(reader->chunk_data + reader->chunk_offset);
+  if (entry_size > remaining_size - sizeof(uint32_t))
+  {
+    LOG_ERROR("Could not read UTXO snapshot, truncated chunk entry!");
+    return 1;
+  }
+
+  *entry_type = reader->chunk_type;
+  *data = reader->chunk_data + reader->chunk_offset + sizeof(uint32_t);
+  *data_size = entry_size;
+  reader->chunk_offset += sizeof(uint32_t) + entry_size;
+  reader->chunk_entry_index++;
+
+  if (reader->chunk_type == UTXO_SNAPSHOT_ENTRY_HEADER)
+  {
+    reader->num_headers++;
+  }
+  else
+  {
+    reader->num_unspent_txs++;
+  }
+
+  return 0;
+}
+
+int utxo_snapshot_reader_get_hash(utxo_snapshot_reader_t *reader, uint8_t *snapshot_hash)
+{
+  assert(reader != NULL);
+  assert(snapshot_hash != NULL);
+  if (reader->finished == 0)
+  {
+    return 1;
+  }
+
+  memcpy(snapshot_hash, reader->snapshot_hash, HASH_SIZE);
+  return 0;
+}
+
+void utxo_snapshot_reader_close(utxo_snapshot_reader_t *reader)
+{
+  assert(reader != NULL);
+  fclose(reader->file);
+  free(reader->chunk_data);
+  free(reader);
+}
+
+/*
+ * Verifies the next few block headers of an imported snapshot, each header must
+ * build on the one before it, have the expected difficulty and a valid hash...
+ */
+static int verify_utxo_snapshot_headers(uint32_t snapshot_height)
+{
+  uint32_t end_height = g_utxo_snapshot_verify_height + UTXO_SNAPSHOT_VERIFY_HEADERS_PER_TASK;
+  if (end_height > snapshot_height + 1)
+  {
+    end_height = snapshot_height + 1;
+  }
+
+  for (; g_utxo_snapshot_verify_height < end_height; g_utxo_snapshot_verify_height++)
+  {
+    uint32_t height = g_utxo_snapshot_verify_height;
+    block_t *block = get_block_header_from_height(height);
+    if (block == NULL)
+    {
+      LOG_ERROR("Could not verify UTXO snapshot, unknown block at height: %u!", height);
+      return 1;
+    }
+
+    int valid_header = 0;
+    if (height == 0)
+    {
+      valid_header = is_genesis_block(block->hash);
+    }
+    else
+    {
+      block_t *previous_block = get_block_header_from_height(height - 1);
+      valid_header = previous_block != NULL &&
+        compare_hash(block->previous_hash, previous_block->hash) &&
+        block->bits == get_next_work_required(previous_block->hash) &&
+        valid_block_hash(block);
+
+      if (previous_block != NULL)
+      {
+        free_block(previous_block);
+      }
+    }
+
+    free_block(block);
+    if (valid_header == 0)
+    {
+      LOG_ERROR("Could not verify UTXO snapshot, invalid block header at height: %u!", height);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static task_result_t verify_utxo_snapshot(task_t *task, va_list args)
+{
+  uint32_t snapshot_height = get_utxo_snapshot_height();
+  if (snapshot_height == 0)
+  {
+    g_utxo_snapshot_verify_task = NULL;
+    return TASK_RESULT_DONE;
+  }
+
+  if (verify_utxo_snapshot_headers(snapshot_height))
+  {
+    LOG_ERROR("The imported UTXO snapshot failed verification, the blockchain should be removed and resynchronized!");
+    g_utxo_snapshot_verify_task = NULL;
+    return TASK_RESULT_DONE;
+  }
+
+  if (g_utxo_snapshot_verify_height <= snapshot_height)
+  {
+    return TASK_RESULT_WAIT;
+  }
+
+  if (set_utxo_snapshot_verified())
+  {
+    LOG_ERROR("Could not mark the imported UTXO snapshot as verified!");
+  }
+  else
+  {
+    LOG_INFO("Successfully verified the block headers of the imported UTXO snapshot at height: %u.", snapshot_height);
+  }
+
+  g_utxo_snapshot_verify_task = NULL;
+  return TASK_RESULT_DONE;
+}
+
+int start_utxo_snapshot_verification(void)
+{
+  if (g_utxo_snapshot_verify_task != NULL)
+  {
+    return 1;
+  }
+
+  // nothing to verify unless a snapshot was imported and not yet verified
+  uint32_t snapshot_height = get_utxo_snapshot_height();
+  if (snapshot_height == 0)
+  {
+    return 0;
+  }
+
+  LOG_INFO("Verifying the block headers of the imported UTXO snapshot at height: %u in the background...", snapshot_height);
+  g_utxo_snapshot_verify_height = 0;
+  g_utxo_snapshot_verify_task = add_task(verify_utxo_snapshot, UTXO_SNAPSHOT_VERIFY_TASK_DELAY);
+  return 0;
+}
+
+int stop_utxo_snapshot_verification(void)
+{
+  if (g_utxo_snapshot_verify_task == NULL)
+  {
+    return 0;
+  }
+
+  remove_task(g_utxo_snapshot_verify_task);
+  g_utxo_snapshot_verify_task = NULL;
+  return 0;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+#include "crypto/cryptoutil.h"
+
+VULKAN_BEGIN_DECL
+
+#define UTXO_SNAPSHOT_MAGIC "VKNUTXOS"
+#define UTXO_SNAPSHOT_MAGIC_SIZE 8
+#define UTXO_SNAPSHOT_VERSION 1
+
+// entries are written in chunks of at most this size, each chunk
+// carries a hash of it's data so corruption is caught chunk by chunk...
+#define UTXO_SNAPSHOT_MAX_CHUNK_SIZE (4 * 1024 * 1024)
+
+// the block headers of an imported snapshot are verified in the background,
+// this many headers at a time so the node keeps serving the network meanwhile...
+#define UTXO_SNAPSHOT_VERIFY_HEADERS_PER_TASK 1000
+#define UTXO_SNAPSHOT_VERIFY_TASK_DELAY 0.1
+
+/* A UTXO snapshot holds the block headers of the main chain from the genesis block up
+ * to the snapshot height followed by every unspent tx at that height in key order:
+ *
+ * magic, version, height, block hash
+ * chunk: type, number of entries, data size, data (size prefixed entries), chunk hash
+ * ...
+ * end: type, number of headers, number of unspent txs, snapshot hash
+ *
+ * The snapshot hash is the hash of the data of every unspent tx chunk, it only depends
+ * on the UTXO set at the snapshot height and is what the checkpoints vouch for...
+ */
+typedef enum UtxoSnapshotEntryType
+{
+  UTXO_SNAPSHOT_ENTRY_END = 0,
+  UTXO_SNAPSHOT_ENTRY_HEADER,
+  UTXO_SNAPSHOT_ENTRY_UNSPENT_TX
+} utxo_snapshot_entry_type_t;
+
+typedef struct UtxoSnapshotWriter utxo_snapshot_writer_t;
+typedef struct UtxoSnapshotReader utxo_snapshot_reader_t;
+
+VULKAN_API utxo_snapshot_writer_t* utxo_snapshot_writer_open(const char *filename, uint32_t height, uint8_t *block_hash);
+VULKAN_API int utxo_snapshot_write_entry(utxo_snapshot_writer_t *writer, utxo_snapshot_entry_type_t entry_type, const uint8_t *data, uint32_t data_size);
+VULKAN_API int utxo_snapshot_writer_finish(utxo_snapshot_writer_t *writer, uint8_t *snapshot_hash);
+VULKAN_API void utxo_snapshot_writer_close(utxo_snapshot_writer_t *writer);
+
+VULKAN_API utxo_snapshot_reader_t* utxo_snapshot_reader_open(const char *filename, uint32_t *height, uint8_t *block_hash);
+VULKAN_API int utxo_snapshot_read_entry(utxo_snapshot_reader_t *reader, utxo_snapshot_entry_type_t *entry_type, const uint8_t **data, uint32_t *data_size);
+VULKAN_API int utxo_snapshot_reader_get_hash(utxo_snapshot_reader_t *reader, uint8_t *snapshot_hash);
+VULKAN_API void utxo_snapshot_reader_close(utxo_snapshot_reader_t *reader);
+
+VULKAN_API int start_utxo_snapshot_verification(void);
+VULKAN_API int stop_utxo_snapshot_verification(void);
+
+VULKAN_END_DECL
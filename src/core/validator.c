@@ -0,0 +1,302 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "common/affinity.h"
+#include "common/logger.h"
+#include "common/tinycthread.h"
+#include "common/trace.h"
+#include "common/util.h"
+
+#include "block.h"
+#include "validator.h"
+
+static int g_validator_running = 0;
+
+// unless set, a thread is started per cpu leaving one for the network loop...
+static uint16_t g_num_validation_threads = 0;
+static uint16_t g_num_started_validation_threads = 0;
+static int g_validator_assume_valid = 1;
+static thrd_t g_validation_threads[MAX_NUM_VALIDATION_THREADS];
+
+// only one block is split across the validation threads at a time,
+// callers validating blocks concurrently wait on the submit lock...
+static mtx_t g_validator_submit_lock;
+static mtx_t g_validator_lock;
+static cnd_t g_validator_job_cond;
+static cnd_t g_validator_done_cond;
+
+static validation_job_t *g_validation_jobs = NULL;
+static uint32_t g_num_validation_jobs = 0;
+static uint32_t g_next_validation_job_index = 0;
+static uint32_t g_num_completed_validation_jobs = 0;
+static int g_validation_jobs_failed = 0;
+
+void set_num_validation_threads(uint16_t num_validation_threads)
+{
+  assert(num_validation_threads > 0);
+  assert(num_validation_threads <= (uint16_t)MAX_NUM_VALIDATION_THREADS);
+  g_num_validation_threads = num_validation_threads;
+}
+
+uint16_t get_num_validation_threads(void)
+{
+  if (g_num_validation_threads > 0)
+  {
+    return g_num_validation_threads;
+  }
+
+  uint16_t num_cores = get_num_logical_cores();
+  if (num_cores <= 1)
+  {
+    return 1;
+  }
+
+  return MIN(num_cores - 1, MAX_NUM_VALIDATION_THREADS);
+}
+
+void set_assume_valid(int assume_valid)
+{
+  g_validator_assume_valid = assume_valid;
+}
+
+int get_assume_valid(void)
+{
+  return g_validator_assume_valid;
+}
+
+int get_is_validator_running(void)
+{
+  return g_validator_running;
+}
+
+/*
+ * Takes the next pending job of the current block and runs it, once a job
+ * has failed the remaining jobs are marked completed without being run.
+ * Must be called holding the validator lock, returns 1 if a job was taken.
+ */
+static int run_next_validation_job_nolock(void)
+{
+  if (g_next_validation_job_index >= g_num_validation_jobs)
+  {
+    return 0;
+  }
+
+  validation_job_t *job = &g_validation_jobs[g_next_validation_job_index];
+  g_next_validation_job_index++;
+
+  if (g_validation_jobs_failed == 0)
+  {
+    mtx_unlock(&g_validator_lock);
+    int result = job->check_signatures ?
+      valid_block_txs(job->block, job->start_tx_index, job->end_tx_index) :
+      valid_block_tx_headers(job->block, job->start_tx_index, job->end_tx_index);
+    mtx_lock(&g_validator_lock);
+    if (result == 0)
+    {
+      g_validation_jobs_failed = 1;
+    }
+  }
+
+  g_num_completed_validation_jobs++;
+  if (g_num_completed_validation_jobs == g_num_validation_jobs)
+  {
+    cnd_broadcast(&g_validator_done_cond);
+  }
+
+  return 1;
+}
+
+static int validation_thread(void *arg)
+{
+  set_current_thread_affinity(THREAD_AFFINITY_CRITICAL, 0);
+  set_trace_thread_name("validation");
+  mtx_lock(&g_validator_lock);
+  while (g_validator_running)
+  {
+    if (run_next_validation_job_nolock())
+    {
+      continue;
+    }
+
+    cnd_wait(&g_validator_job_cond, &g_validator_lock);
+  }
+
+  mtx_unlock(&g_validator_lock);
+  return 0;
+}
+
+/*
+ * Checks the headers and signatures of all of the block's txs, splitting
+ * the txs into ranges which are checked across the validation threads,
+ * the calling thread checks ranges as well while it waits for the result.
+ * The signatures are skipped when check_signatures is 0.
+ * Returns 0 if invalid, 1 is valid.
+ */
+int valid_block_txs_parallel(block_t *block, int check_signatures)
+{
+  assert(block != NULL);
+  uint32_t num_jobs = block->transaction_count / MIN_TXS_PER_VALIDATION_JOB;
+  if (num_jobs > g_num_started_validation_threads + 1)
+  {
+    num_jobs = g_num_started_validation_threads + 1;
+  }
+
+  if (g_validator_running == 0 || num_jobs < 2)
+  {
+    return check_signatures ?
+      valid_block_txs(block, 0, block->transaction_count) :
+      valid_block_tx_headers(block, 0, block->transaction_count);
+  }
+
+  validation_job_t *jobs = malloc(sizeof(validation_job_t) * num_jobs);
+  assert(jobs != NULL);
+
+  uint32_t txs_per_job = (block->transaction_count + num_jobs - 1) / num_jobs;
+  uint32_t start_tx_index = 0;
+  for (uint32_t i = 0; i < num_jobs; i++)
+  {
+    uint32_t end_tx_index = start_tx_index + txs_per_job;
+    if (end_tx_index > block->transaction_count)
+    {
+      end_tx_index = block->transaction_count;
+    }
+
+    validation_job_t *job = &jobs[i];
+    job->block = block;
+    job->start_tx_index = start_tx_index;
+    job->end_tx_index = end_tx_index;
+    job->check_signatures = check_signatures;
+    start_tx_index = end_tx_index;
+  }
+
+  mtx_lock(&g_validator_submit_lock);
+  mtx_lock(&g_validator_lock);
+  g_validation_jobs = jobs;
+  g_num_validation_jobs = num_jobs;
+  g_next_validation_job_index = 0;
+  g_num_completed_validation_jobs = 0;
+  g_validation_jobs_failed = 0;
+  cnd_broadcast(&g_validator_job_cond);
+
+  while (run_next_validation_job_nolock());
+  while (g_num_completed_validation_jobs < g_num_validation_jobs)
+  {
+    cnd_wait(&g_validator_done_cond, &g_validator_lock);
+  }
+
+  int failed = g_validation_jobs_failed;
+  g_validation_jobs = NULL;
+  g_num_validation_jobs = 0;
+  g_next_validation_job_index = 0;
+  g_num_completed_validation_jobs = 0;
+  g_validation_jobs_failed = 0;
+  mtx_unlock(&g_validator_lock);
+  mtx_unlock(&g_validator_submit_lock);
+
+  free(jobs);
+  return failed == 0;
+}
+
+/*
+ * Runs all of the block checks that do not depend on the state of the blockchain,
+ * leaving only the checks against the UTXO set and the current chain tip to be
+ * done while holding the blockchain lock. The structure, merkle root and PoW checks
+ * always run, only the txin signatures are skipped for blocks assumed valid.
+ * Returns 0 if invalid, 1 is valid.
+ */
+int valid_block_stateless(block_t *block, int check_signatures)
+{
+  assert(block != NULL);
+  TRACE_SPAN("valid_block_stateless");
+  if (valid_block_structure(block) == 0)
+  {
+    return 0;
+  }
+
+  return valid_block_txs_parallel(block, check_signatures);
+}
+
+int start_validator(void)
+{
+  if (g_validator_running)
+  {
+    return 1;
+  }
+
+  mtx_init(&g_validator_submit_lock, mtx_plain);
+  mtx_init(&g_validator_lock, mtx_plain);
+  cnd_init(&g_validator_job_cond);
+  cnd_init(&g_validator_done_cond);
+
+  g_validator_running = 1;
+  g_num_started_validation_threads = 0;
+
+  // the thread validating a block checks txs as well,
+  // so start one thread less than requested...
+  uint16_t num_validation_threads = get_num_validation_threads();
+  for (uint16_t i = 0; i < num_validation_threads - 1; i++)
+  {
+    if (thrd_create(&g_validation_threads[i], validation_thread, NULL) != thrd_success)
+    {
+      LOG_ERROR("Failed to start validation thread: %hu!", i);
+      stop_validator();
+      return 1;
+    }
+
+    g_num_started_validation_threads++;
+  }
+
+  LOG_INFO("Started block validation on [%hu] threads...", num_validation_threads);
+  return 0;
+}
+
+int stop_validator(void)
+{
+  if (g_validator_running == 0)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_validator_lock);
+  g_validator_running = 0;
+  cnd_broadcast(&g_validator_job_cond);
+  mtx_unlock(&g_validator_lock);
+
+  for (uint16_t i = 0; i < g_num_started_validation_threads; i++)
+  {
+    thrd_join(g_validation_threads[i], NULL);
+  }
+
+  g_num_started_validation_threads = 0;
+  cnd_destroy(&g_validator_done_cond);
+  cnd_destroy(&g_validator_job_cond);
+  mtx_destroy(&g_validator_lock);
+  mtx_destroy(&g_validator_submit_lock);
+  return 0;
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "common/vulkan.h"
+
+#include "block.h"
+
+VULKAN_BEGIN_DECL
+
+#define MAX_NUM_VALIDATION_THREADS 256
+
+// the minimum number of txs a single validation job is given, blocks with
+// fewer txs than this per thread are split across fewer threads...
+#define MIN_TXS_PER_VALIDATION_JOB 16
+
+typedef struct ValidationJob
+{
+  block_t *block;
+  uint32_t start_tx_index;
+  uint32_t end_tx_index;
+  int check_signatures;
+} validation_job_t;
+
+VULKAN_API void set_num_validation_threads(uint16_t num_validation_threads);
+VULKAN_API uint16_t get_num_validation_threads(void);
+
+VULKAN_API void set_assume_valid(int assume_valid);
+VULKAN_API int get_assume_valid(void);
+
+VULKAN_API int get_is_validator_running(void);
+
+VULKAN_API int valid_block_txs_parallel(block_t *block, int check_signatures);
+VULKAN_API int valid_block_stateless(block_t *block, int check_signatures);
+
+VULKAN_API int start_validator(void);
+VULKAN_API int stop_validator(void);
+
+VULKAN_END_DECL
@@ -26,5 +26,5 @@
 #pragma once
 
 #define APPLICATION_NAME "vulkan"
-#define APPLICATION_VERSION "1.0.0"
+#define APPLICATION_VERSION "1.1.0"
 #define APPLICATION_RELEASE_NAME "electrum"
@@ -28,6 +28,8 @@
 
 #include <openssl/bn.h>
 
+#include "bignum_util.h"
+
 void bignum_set_compact(BIGNUM *bn, uint32_t n_compact)
 {
   uint32_t n_size = n_compact >> 24;
@@ -77,3 +79,262 @@ uint32_t bignum_get_compact(BIGNUM *bn)
 
   return n_compact;
 }
+
+void uint256_set_zero(uint256_t *n)
+{
+  memset(n->words, 0, sizeof(n->words));
+}
+
+int uint256_is_zero(const uint256_t *n)
+{
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    if (n->words[i] != 0)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * Returns -1, 0 or 1 when n is less than, equal to or greater than other_n.
+ */
+int uint256_compare(const uint256_t *n, const uint256_t *other_n)
+{
+  for (int i = UINT256_NUM_WORDS - 1; i >= 0; i--)
+  {
+    if (n->words[i] < other_n->words[i])
+    {
+      return -1;
+    }
+    else if (n->words[i] > other_n->words[i])
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+uint32_t uint256_get_num_bits(const uint256_t *n)
+{
+  for (int i = UINT256_NUM_WORDS - 1; i >= 0; i--)
+  {
+    if (n->words[i] == 0)
+    {
+      continue;
+    }
+
+    uint32_t num_bits = 32;
+    while ((n->words[i] & (1U << (num_bits - 1))) == 0)
+    {
+      num_bits--;
+    }
+
+    return (i * 32) + num_bits;
+  }
+
+  return 0;
+}
+
+void uint256_shift_left(uint256_t *n, uint32_t shift)
+{
+  uint256_t shifted;
+  uint256_set_zero(&shifted);
+
+  uint32_t word_shift = shift / 32;
+  uint32_t bit_shift = shift % 32;
+  for (uint32_t i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    if (i + word_shift < UINT256_NUM_WORDS)
+    {
+      shifted.words[i + word_shift] |= n->words[i] << bit_shift;
+    }
+
+    if (bit_shift > 0 && i + word_shift + 1 < UINT256_NUM_WORDS)
+    {
+      shifted.words[i + word_shift + 1] |= n->words[i] >> (32 - bit_shift);
+    }
+  }
+
+  *n = shifted;
+}
+
+void uint256_shift_right(uint256_t *n, uint32_t shift)
+{
+  uint256_t shifted;
+  uint256_set_zero(&shifted);
+
+  uint32_t word_shift = shift / 32;
+  uint32_t bit_shift = shift % 32;
+  for (uint32_t i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    if (i >= word_shift)
+    {
+      shifted.words[i - word_shift] |= n->words[i] >> bit_shift;
+    }
+
+    if (bit_shift > 0 && i >= word_shift + 1)
+    {
+      shifted.words[i - word_shift - 1] |= n->words[i] << (32 - bit_shift);
+    }
+  }
+
+  *n = shifted;
+}
+
+/*
+ * Adds and subtracts modulo 2^256, the same as unsigned integers wrap around.
+ */
+void uint256_add(uint256_t *n, const uint256_t *other_n)
+{
+  uint64_t carry = 0;
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    uint64_t sum = (uint64_t)n->words[i] + other_n->words[i] + carry;
+    n->words[i] = (uint32_t)sum;
+    carry = sum >> 32;
+  }
+}
+
+void uint256_subtract(uint256_t *n, const uint256_t *other_n)
+{
+  uint64_t borrow = 0;
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    uint64_t difference = (uint64_t)n->words[i] - other_n->words[i] - borrow;
+    n->words[i] = (uint32_t)difference;
+    borrow = (difference >> 32) & 1;
+  }
+}
+
+/*
+ * Binary long division, only as many steps as the difference in the
+ * number of bits of n and the divisor are computed...
+ */
+int uint256_divide(uint256_t *quotient, const uint256_t *n, const uint256_t *divisor)
+{
+  uint32_t n_num_bits = uint256_get_num_bits(n);
+  uint32_t divisor_num_bits = uint256_get_num_bits(divisor);
+  if (divisor_num_bits == 0)
+  {
+    return 1;
+  }
+
+  uint256_set_zero(quotient);
+  if (divisor_num_bits > n_num_bits)
+  {
+    return 0;
+  }
+
+  uint256_t remainder = *n;
+  uint256_t shifted_divisor = *divisor;
+  uint32_t shift = n_num_bits - divisor_num_bits;
+  uint256_shift_left(&shifted_divisor, shift);
+  for (int i = (int)shift; i >= 0; i--)
+  {
+    if (uint256_compare(&remainder, &shifted_divisor) >= 0)
+    {
+      uint256_subtract(&remainder, &shifted_divisor);
+      quotient->words[i / 32] |= 1U << (i % 32);
+    }
+
+    uint256_shift_right(&shifted_divisor, 1);
+  }
+
+  return 0;
+}
+
+/*
+ * Reads a 32 byte big endian number, such as a hash or a target.
+ */
+void uint256_from_bytes(uint256_t *n, const uint8_t *bytes)
+{
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    const uint8_t *word = bytes + (UINT256_SIZE - ((i + 1) * 4));
+    n->words[i] = ((uint32_t)word[0] << 24) | ((uint32_t)word[1] << 16) | ((uint32_t)word[2] << 8) | (uint32_t)word[3];
+  }
+}
+
+void uint256_to_bytes(uint8_t *bytes, const uint256_t *n)
+{
+  for (int i = 0; i < UINT256_NUM_WORDS; i++)
+  {
+    uint8_t *word = bytes + (UINT256_SIZE - ((i + 1) * 4));
+    word[0] = (n->words[i] >> 24) & 0xff;
+    word[1] = (n->words[i] >> 16) & 0xff;
+    word[2] = (n->words[i] >> 8) & 0xff;
+    word[3] = n->words[i] & 0xff;
+  }
+}
+
+/*
+ * Decodes the compact bits the same way as bignum_set_compact, the top bit of the
+ * mantissa is it's sign and a target that does not fit into 256 bits overflows.
+ */
+void uint256_set_compact(uint256_t *n, uint32_t n_compact, int *is_negative, int *is_overflow)
+{
+  uint32_t n_size = n_compact >> 24;
+  uint32_t n_word = n_compact & 0x007fffff;
+
+  uint256_set_zero(n);
+  if (n_size <= 3)
+  {
+    n_word >>= 8 * (3 - n_size);
+    n->words[0] = n_word;
+  }
+  else
+  {
+    n->words[0] = n_word;
+    if (n_size - 3 < UINT256_SIZE)
+    {
+      uint256_shift_left(n, 8 * (n_size - 3));
+    }
+    else
+    {
+      uint256_set_zero(n);
+    }
+  }
+
+  if (is_negative != NULL)
+  {
+    *is_negative = n_word != 0 && (n_compact & 0x00800000) != 0;
+  }
+
+  if (is_overflow != NULL)
+  {
+    *is_overflow = n_word != 0 && ((n_size > 34) ||
+                                   (n_word > 0xff && n_size > 33) ||
+                                   (n_word > 0xffff && n_size > 32));
+  }
+}
+
+uint32_t uint256_get_compact(const uint256_t *n)
+{
+  uint32_t n_size = (uint256_get_num_bits(n) + 7) / 8;
+  uint32_t n_compact = 0;
+  if (n_size <= 3)
+  {
+    n_compact = n->words[0] << (8 * (3 - n_size));
+  }
+  else
+  {
+    uint256_t shifted = *n;
+    uint256_shift_right(&shifted, 8 * (n_size - 3));
+    n_compact = shifted.words[0];
+  }
+
+  // the top bit of the mantissa is it's sign, so move
+  // the mantissa down a byte if it would be set...
+  if (n_compact & 0x00800000)
+  {
+    n_compact >>= 8;
+    n_size++;
+  }
+
+  n_compact |= n_size << 24;
+  return n_compact;
+}
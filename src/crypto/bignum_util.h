@@ -33,7 +33,36 @@
 
 VULKAN_BEGIN_DECL
 
+#define UINT256_NUM_WORDS 8
+#define UINT256_SIZE (UINT256_NUM_WORDS * 4)
+
+/* Fixed width unsigned 256-bit integer which lives entirely on the stack,
+ * the words are stored least significant first...
+ */
+typedef struct UInt256
+{
+  uint32_t words[UINT256_NUM_WORDS];
+} uint256_t;
+
 VULKAN_API void bignum_set_compact(BIGNUM *bn, uint32_t n_compact);
 VULKAN_API uint32_t bignum_get_compact(BIGNUM *bn);
 
+VULKAN_API void uint256_set_zero(uint256_t *n);
+VULKAN_API int uint256_is_zero(const uint256_t *n);
+VULKAN_API int uint256_compare(const uint256_t *n, const uint256_t *other_n);
+VULKAN_API uint32_t uint256_get_num_bits(const uint256_t *n);
+
+VULKAN_API void uint256_shift_left(uint256_t *n, uint32_t shift);
+VULKAN_API void uint256_shift_right(uint256_t *n, uint32_t shift);
+
+VULKAN_API void uint256_add(uint256_t *n, const uint256_t *other_n);
+VULKAN_API void uint256_subtract(uint256_t *n, const uint256_t *other_n);
+VULKAN_API int uint256_divide(uint256_t *quotient, const uint256_t *n, const uint256_t *divisor);
+
+VULKAN_API void uint256_from_bytes(uint256_t *n, const uint8_t *bytes);
+VULKAN_API void uint256_to_bytes(uint8_t *bytes, const uint256_t *n);
+
+VULKAN_API void uint256_set_compact(uint256_t *n, uint32_t n_compact, int *is_negative, int *is_overflow);
+VULKAN_API uint32_t uint256_get_compact(const uint256_t *n);
+
 VULKAN_END_DECL
@@ -0,0 +1,219 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sodium.h>
+
+#include <openssl/bn.h>
+
+#include "common/tinycthread.h"
+
+#include "muhash.h"
+
+static once_flag g_muhash_once = ONCE_FLAG_INIT;
+static BIGNUM *g_muhash_prime = NULL;
+
+static void init_muhash_prime(void)
+{
+  g_muhash_prime = BN_new();
+  assert(g_muhash_prime != NULL);
+  assert(BN_set_bit(g_muhash_prime, MUHASH_NUM_BITS) == 1);
+  assert(BN_sub_word(g_muhash_prime, MUHASH_PRIME_OFFSET) == 1);
+}
+
+static const BIGNUM* get_muhash_prime(void)
+{
+  call_once(&g_muhash_once, init_muhash_prime);
+  return g_muhash_prime;
+}
+
+/*
+ * Maps an element onto a number below the prime, the element's sha256 digest keys
+ * a chacha20 keystream which is read as a little endian 3072-bit number...
+ */
+static void muhash_element_to_bignum(BIGNUM *bn, const uint8_t *data, size_t size)
+{
+  uint8_t key[crypto_stream_chacha20_KEYBYTES];
+  crypto_hash_sha256(key, data, size);
+
+  uint8_t nonce[crypto_stream_chacha20_NONCEBYTES];
+  memset(nonce, 0, sizeof(nonce));
+
+  uint8_t bytes[MUHASH_SIZE];
+  crypto_stream_chacha20(bytes, sizeof(bytes), nonce, key);
+  assert(BN_lebin2bn(bytes, sizeof(bytes), bn) != NULL);
+
+  // the few numbers between the prime and 2^3072 wrap around
+  const BIGNUM *prime = get_muhash_prime();
+  if (BN_cmp(bn, prime) >= 0)
+  {
+    assert(BN_sub(bn, bn, prime) == 1);
+  }
+}
+
+static void muhash_multiply(BIGNUM *bn, const uint8_t *data, size_t size)
+{
+  BN_CTX *ctx = BN_CTX_new();
+  assert(ctx != NULL);
+
+  BIGNUM *element = BN_new();
+  assert(element != NULL);
+  muhash_element_to_bignum(element, data, size);
+  assert(BN_mod_mul(bn, bn, element, get_muhash_prime(), ctx) == 1);
+
+  BN_free(element);
+  BN_CTX_free(ctx);
+}
+
+/*
+ * Divides the denominator into the numerator, so the numerator alone is the
+ * hash of the multiset. This is far slower than inserting or removing an element.
+ */
+static int muhash_normalize(muhash_t *muhash)
+{
+  if (BN_is_one(muhash->denominator))
+  {
+    return 0;
+  }
+
+  BN_CTX *ctx = BN_CTX_new();
+  assert(ctx != NULL);
+
+  const BIGNUM *prime = get_muhash_prime();
+  BIGNUM *inverse = BN_mod_inverse(NULL, muhash->denominator, prime, ctx);
+  if (inverse == NULL)
+  {
+    BN_CTX_free(ctx);
+    return 1;
+  }
+
+  assert(BN_mod_mul(muhash->numerator, muhash->numerator, inverse, prime, ctx) == 1);
+  assert(BN_one(muhash->denominator) == 1);
+
+  BN_free(inverse);
+  BN_CTX_free(ctx);
+  return 0;
+}
+
+void muhash_init(muhash_t *muhash)
+{
+  assert(muhash != NULL);
+  muhash->numerator = BN_new();
+  muhash->denominator = BN_new();
+  assert(muhash->numerator != NULL);
+  assert(muhash->denominator != NULL);
+
+  // the empty multiset
+  assert(BN_one(muhash->numerator) == 1);
+  assert(BN_one(muhash->denominator) == 1);
+}
+
+void muhash_free(muhash_t *muhash)
+{
+  assert(muhash != NULL);
+  BN_free(muhash->numerator);
+  BN_free(muhash->denominator);
+  muhash->numerator = NULL;
+  muhash->denominator = NULL;
+}
+
+void muhash_copy(muhash_t *muhash, const muhash_t *other_muhash)
+{
+  assert(muhash != NULL);
+  assert(other_muhash != NULL);
+  assert(BN_copy(muhash->numerator, other_muhash->numerator) != NULL);
+  assert(BN_copy(muhash->denominator, other_muhash->denominator) != NULL);
+}
+
+void muhash_insert(muhash_t *muhash, const uint8_t *data, size_t size)
+{
+  assert(muhash != NULL);
+  assert(data != NULL);
+  muhash_multiply(muhash->numerator, data, size);
+}
+
+void muhash_remove(muhash_t *muhash, const uint8_t *data, size_t size)
+{
+  assert(muhash != NULL);
+  assert(data != NULL);
+  muhash_multiply(muhash->denominator, data, size);
+}
+
+void muhash_combine(muhash_t *muhash, const muhash_t *other_muhash)
+{
+  assert(muhash != NULL);
+  assert(other_muhash != NULL);
+
+  BN_CTX *ctx = BN_CTX_new();
+  assert(ctx != NULL);
+
+  const BIGNUM *prime = get_muhash_prime();
+  assert(BN_mod_mul(muhash->numerator, muhash->numerator, other_muhash->numerator, prime, ctx) == 1);
+  assert(BN_mod_mul(muhash->denominator, muhash->denominator, other_muhash->denominator, prime, ctx) == 1);
+  BN_CTX_free(ctx);
+}
+
+int muhash_to_bytes(muhash_t *muhash, uint8_t *bytes)
+{
+  assert(muhash != NULL);
+  assert(bytes != NULL);
+  if (muhash_normalize(muhash))
+  {
+    return 1;
+  }
+
+  return BN_bn2lebinpad(muhash->numerator, bytes, MUHASH_SIZE) != MUHASH_SIZE;
+}
+
+int muhash_from_bytes(muhash_t *muhash, const uint8_t *bytes)
+{
+  assert(muhash != NULL);
+  assert(bytes != NULL);
+  if (BN_lebin2bn(bytes, MUHASH_SIZE, muhash->numerator) == NULL)
+  {
+    return 1;
+  }
+
+  assert(BN_one(muhash->denominator) == 1);
+  return BN_is_zero(muhash->numerator) || BN_cmp(muhash->numerator, get_muhash_prime()) >= 0;
+}
+
+int muhash_finalize(muhash_t *muhash, uint8_t *digest)
+{
+  assert(muhash != NULL);
+  assert(digest != NULL);
+
+  uint8_t bytes[MUHASH_SIZE];
+  if (muhash_to_bytes(muhash, bytes))
+  {
+    return 1;
+  }
+
+  crypto_hash_sha256(digest, bytes, sizeof(bytes));
+  return 0;
+}
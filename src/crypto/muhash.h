@@ -0,0 +1,68 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openssl/bn.h>
+
+#include "common/vulkan.h"
+
+VULKAN_BEGIN_DECL
+
+// elements are mapped onto numbers modulo the prime 2^3072 - 1103717
+#define MUHASH_NUM_BITS 3072
+#define MUHASH_PRIME_OFFSET 1103717
+#define MUHASH_SIZE (MUHASH_NUM_BITS / 8)
+
+// the size of a muhash once it is finalized into a sha256 digest
+#define MUHASH_DIGEST_SIZE 32
+
+/* Rolling hash of a multiset, each element is hashed onto a number modulo a prime
+ * which is multiplied into the numerator when the element is inserted and into the
+ * denominator when it is removed. The order elements are inserted and removed in
+ * does not matter and the denominator is only divided out once the hash is read...
+ */
+typedef struct MuHash
+{
+  BIGNUM *numerator;
+  BIGNUM *denominator;
+} muhash_t;
+
+VULKAN_API void muhash_init(muhash_t *muhash);
+VULKAN_API void muhash_free(muhash_t *muhash);
+VULKAN_API void muhash_copy(muhash_t *muhash, const muhash_t *other_muhash);
+
+VULKAN_API void muhash_insert(muhash_t *muhash, const uint8_t *data, size_t size);
+VULKAN_API void muhash_remove(muhash_t *muhash, const uint8_t *data, size_t size);
+VULKAN_API void muhash_combine(muhash_t *muhash, const muhash_t *other_muhash);
+
+VULKAN_API int muhash_to_bytes(muhash_t *muhash, uint8_t *bytes);
+VULKAN_API int muhash_from_bytes(muhash_t *muhash, const uint8_t *bytes);
+VULKAN_API int muhash_finalize(muhash_t *muhash, uint8_t *digest);
+
+VULKAN_END_DECL
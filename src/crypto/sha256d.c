@@ -23,10 +23,18 @@
 // You should have received a copy of the MIT License
 // along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
 
+#include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <sodium.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 #include "sha256d.h"
 
 int crypto_hash_sha256d(unsigned char *out, const unsigned char *in, unsigned long long inlen)
@@ -44,3 +52,508 @@ int crypto_hash_sha256d(unsigned char *out, const unsigned char *in, unsigned lo
 
   return 0;
 }
+
+static const uint32_t g_sha256_iv[SHA256_STATE_WORDS] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint32_t g_sha256_k[SHA256_SCHEDULE_WORDS] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SHA256_SIGMA0(x) (SHA256_ROTR(x, 2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+#define SHA256_SIGMA1(x) (SHA256_ROTR(x, 6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+#define SHA256_GAMMA0(x) (SHA256_ROTR(x, 7) ^ SHA256_ROTR(x, 18) ^ ((x) >> 3))
+#define SHA256_GAMMA1(x) (SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+
+static inline uint32_t load_be32(const unsigned char *in)
+{
+  return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+         ((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
+
+static inline void store_be32(unsigned char *out, uint32_t value)
+{
+  out[0] = (unsigned char)(value >> 24);
+  out[1] = (unsigned char)(value >> 16);
+  out[2] = (unsigned char)(value >> 8);
+  out[3] = (unsigned char)value;
+}
+
+static inline size_t get_sha256_num_blocks(size_t inlen)
+{
+  // the message is followed by a 0x80 byte and it's 64 bit bit length
+  return (inlen + 9 + (SHA256_BLOCK_SIZE - 1)) / SHA256_BLOCK_SIZE;
+}
+
+static void get_sha256_padded_block(unsigned char *block, const unsigned char *in, size_t inlen, size_t block_index)
+{
+  size_t offset = block_index * SHA256_BLOCK_SIZE;
+  memset(block, 0, SHA256_BLOCK_SIZE);
+
+  if (offset < inlen)
+  {
+    size_t size = inlen - offset;
+    memcpy(block, in + offset, size < SHA256_BLOCK_SIZE ? size : SHA256_BLOCK_SIZE);
+  }
+
+  if (inlen >= offset && inlen < offset + SHA256_BLOCK_SIZE)
+  {
+    block[inlen - offset] = 0x80;
+  }
+
+  if (block_index == get_sha256_num_blocks(inlen) - 1)
+  {
+    uint64_t bit_length = (uint64_t)inlen * 8;
+    store_be32(block + 56, (uint32_t)(bit_length >> 32));
+    store_be32(block + 60, (uint32_t)bit_length);
+  }
+}
+
+void crypto_sha256_init_state(uint32_t *state)
+{
+  memcpy(state, g_sha256_iv, sizeof(g_sha256_iv));
+}
+
+void crypto_sha256_expand_schedule(uint32_t *schedule, const unsigned char *block)
+{
+  for (int i = 0; i < 16; i++)
+  {
+    schedule[i] = load_be32(block + (i * 4));
+  }
+
+  for (int i = 16; i < SHA256_SCHEDULE_WORDS; i++)
+  {
+    schedule[i] = SHA256_GAMMA1(schedule[i - 2]) + schedule[i - 7] +
+                  SHA256_GAMMA0(schedule[i - 15]) + schedule[i - 16];
+  }
+}
+
+void crypto_sha256_transform_schedule(uint32_t *state, const uint32_t *schedule)
+{
+  uint32_t a = state[0];
+  uint32_t b = state[1];
+  uint32_t c = state[2];
+  uint32_t d = state[3];
+  uint32_t e = state[4];
+  uint32_t f = state[5];
+  uint32_t g = state[6];
+  uint32_t h = state[7];
+
+  for (int i = 0; i < SHA256_SCHEDULE_WORDS; i++)
+  {
+    uint32_t t1 = h + SHA256_SIGMA1(e) + SHA256_CH(e, f, g) + g_sha256_k[i] + schedule[i];
+    uint32_t t2 = SHA256_SIGMA0(a) + SHA256_MAJ(a, b, c);
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+void crypto_sha256_transform(uint32_t *state, const unsigned char *block)
+{
+  uint32_t schedule[SHA256_SCHEDULE_WORDS];
+  crypto_sha256_expand_schedule(schedule, block);
+  crypto_sha256_transform_schedule(state, schedule);
+}
+
+int crypto_sha256d_header_init(sha256d_header_ctx_t *ctx, const unsigned char *header, size_t header_size)
+{
+  if (header_size <= SHA256_BLOCK_SIZE || header_size > SHA256D_MAX_HEADER_SIZE)
+  {
+    return 1;
+  }
+
+  memcpy(ctx->first_block, header, SHA256_BLOCK_SIZE);
+
+  // pad the remainder of the header into the second block
+  get_sha256_padded_block(ctx->second_block, header, header_size, 1);
+  crypto_sha256_expand_schedule(ctx->second_block_schedule, ctx->second_block);
+  return 0;
+}
+
+void crypto_sha256d_header_hash(unsigned char *out, const sha256d_header_ctx_t *ctx)
+{
+  uint32_t state[SHA256_STATE_WORDS];
+  crypto_sha256_init_state(state);
+  crypto_sha256_transform(state, ctx->first_block);
+  crypto_sha256_transform_schedule(state, ctx->second_block_schedule);
+
+  // the second hash is over a single padded block holding the 32 byte first hash,
+  // the words of the first hash can be used as the message directly...
+  uint32_t schedule[SHA256_SCHEDULE_WORDS];
+  memcpy(schedule, state, sizeof(state));
+  schedule[8] = 0x80000000;
+  for (int i = 9; i < 15; i++)
+  {
+    schedule[i] = 0;
+  }
+
+  schedule[15] = SHA256_STATE_WORDS * 32;
+  for (int i = 16; i < SHA256_SCHEDULE_WORDS; i++)
+  {
+    schedule[i] = SHA256_GAMMA1(schedule[i - 2]) + schedule[i - 7] +
+                  SHA256_GAMMA0(schedule[i - 15]) + schedule[i - 16];
+  }
+
+  crypto_sha256_init_state(state);
+  crypto_sha256_transform_schedule(state, schedule);
+
+  for (int i = 0; i < SHA256_STATE_WORDS; i++)
+  {
+    store_be32(out + (i * 4), state[i]);
+  }
+}
+
+typedef void (*sha256_transform_func_t)(uint32_t *state, const unsigned char *block);
+
+static void sha256d_finish(unsigned char *out, uint32_t *state, sha256_transform_func_t transform)
+{
+  unsigned char block[SHA256_BLOCK_SIZE];
+  for (int i = 0; i < SHA256_STATE_WORDS; i++)
+  {
+    store_be32(block + (i * 4), state[i]);
+  }
+
+  block[32] = 0x80;
+  memset(block + 33, 0, 29);
+  store_be32(block + 60, SHA256_STATE_WORDS * 32);
+
+  crypto_sha256_init_state(state);
+  transform(state, block);
+
+  for (int i = 0; i < SHA256_STATE_WORDS; i++)
+  {
+    store_be32(out + (i * 4), state[i]);
+  }
+}
+
+static void sha256d_single(unsigned char *out, const unsigned char *in, size_t inlen, sha256_transform_func_t transform)
+{
+  uint32_t state[SHA256_STATE_WORDS];
+  crypto_sha256_init_state(state);
+
+  unsigned char block[SHA256_BLOCK_SIZE];
+  size_t num_blocks = get_sha256_num_blocks(inlen);
+  for (size_t block_index = 0; block_index < num_blocks; block_index++)
+  {
+    get_sha256_padded_block(block, in, inlen, block_index);
+    transform(state, block);
+  }
+
+  sha256d_finish(out, state, transform);
+}
+
+static void sha256d_header_hash_single(unsigned char *out, const sha256d_header_ctx_t *ctx, size_t word_index, uint32_t word, sha256_transform_func_t transform)
+{
+  unsigned char first_block[SHA256_BLOCK_SIZE];
+  memcpy(first_block, ctx->first_block, SHA256_BLOCK_SIZE);
+  memcpy(first_block + (word_index * 4), &word, sizeof(uint32_t));
+
+  uint32_t state[SHA256_STATE_WORDS];
+  crypto_sha256_init_state(state);
+  transform(state, first_block);
+  transform(state, ctx->second_block);
+  sha256d_finish(out, state, transform);
+}
+
+static void sha256d_header_hash_scalar(unsigned char *out, const sha256d_header_ctx_t *ctx, size_t word_index, const uint32_t *words)
+{
+  sha256d_header_hash_single(out, ctx, word_index, words[0], crypto_sha256_transform);
+}
+
+static void sha256d_multi_scalar(unsigned char *out, const unsigned char *const *in, const size_t *inlen, size_t count)
+{
+  assert(count == 1);
+  crypto_hash_sha256d(out, in[0], inlen[0]);
+}
+
+static int is_scalar_supported(void)
+{
+  return 1;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256D_HAVE_X86_BACKENDS
+
+/* Single block transform using the x86 SHA extensions, the state is kept as
+ * ABEF/CDGH word pairs as required by the sha256rnds2 instruction...
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_transform_shani(uint32_t *state, const unsigned char *block)
+{
+  const __m128i byte_swap_mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+  __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xb1);
+  state1 = _mm_shuffle_epi32(state1, 0x1b);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  __m128i saved_state0 = state0;
+  __m128i saved_state1 = state1;
+
+  __m128i schedule[4];
+  for (int i = 0; i < 4; i++)
+  {
+    schedule[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + (i * 16))), byte_swap_mask);
+  }
+
+  // each iteration runs 4 rounds, the schedule is kept as a ring of the last 16 words
+  for (int i = 0; i < 16; i++)
+  {
+    if (i >= 4)
+    {
+      __m128i words = _mm_sha256msg1_epu32(schedule[i & 3], schedule[(i + 1) & 3]);
+      words = _mm_add_epi32(words, _mm_alignr_epi8(schedule[(i + 3) & 3], schedule[(i + 2) & 3], 4));
+      schedule[i & 3] = _mm_sha256msg2_epu32(words, schedule[(i + 3) & 3]);
+    }
+
+    __m128i msg = _mm_add_epi32(schedule[i & 3], _mm_loadu_si128((const __m128i*)&g_sha256_k[i * 4]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+  }
+
+  state0 = _mm_add_epi32(state0, saved_state0);
+  state1 = _mm_add_epi32(state1, saved_state1);
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+  _mm_storeu_si128((__m128i*)&state[0], state0);
+  _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+static void sha256d_header_hash_shani(unsigned char *out, const sha256d_header_ctx_t *ctx, size_t word_index, const uint32_t *words)
+{
+  sha256d_header_hash_single(out, ctx, word_index, words[0], sha256_transform_shani);
+}
+
+static void sha256d_multi_shani(unsigned char *out, const unsigned char *const *in, const size_t *inlen, size_t count)
+{
+  assert(count == 1);
+  sha256d_single(out, in[0], inlen[0], sha256_transform_shani);
+}
+
+static int is_shani_supported(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+  {
+    return 0;
+  }
+
+  __builtin_cpu_init();
+  return (ebx & (1 << 29)) != 0 && __builtin_cpu_supports("sse4.1");
+}
+
+static int is_sse41_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1");
+}
+
+static int is_avx2_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static int is_avx512_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+}
+
+#define SHA256D_LANES_SUFFIX sse41
+#define SHA256D_NUM_LANES 4
+#define SHA256D_LANES_TARGET __attribute__((target("sse4.1")))
+#include "sha256d_lanes.h"
+#undef SHA256D_LANES_SUFFIX
+#undef SHA256D_NUM_LANES
+#undef SHA256D_LANES_TARGET
+
+#define SHA256D_LANES_SUFFIX avx2
+#define SHA256D_NUM_LANES 8
+#define SHA256D_LANES_TARGET __attribute__((target("avx2")))
+#include "sha256d_lanes.h"
+#undef SHA256D_LANES_SUFFIX
+#undef SHA256D_NUM_LANES
+#undef SHA256D_LANES_TARGET
+
+#define SHA256D_LANES_SUFFIX avx512
+#define SHA256D_NUM_LANES 16
+#define SHA256D_LANES_TARGET __attribute__((target("avx512f")))
+#include "sha256d_lanes.h"
+#undef SHA256D_LANES_SUFFIX
+#undef SHA256D_NUM_LANES
+#undef SHA256D_LANES_TARGET
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define SHA256D_HAVE_NEON_BACKEND
+
+static int is_neon_supported(void)
+{
+  // neon is part of the baseline aarch64 instruction set
+  return 1;
+}
+
+#define SHA256D_LANES_SUFFIX neon
+#define SHA256D_NUM_LANES 4
+#define SHA256D_LANES_TARGET
+#include "sha256d_lanes.h"
+#undef SHA256D_LANES_SUFFIX
+#undef SHA256D_NUM_LANES
+#undef SHA256D_LANES_TARGET
+#endif
+
+typedef struct Sha256dBackend
+{
+  const char *name;
+  size_t num_lanes;
+  int (*is_supported)(void);
+
+  // hashes exactly num_lanes headers and at most num_lanes messages at once
+  void (*header_hash)(unsigned char *out, const sha256d_header_ctx_t *ctx, size_t word_index, const uint32_t *words);
+  void (*multi)(unsigned char *out, const unsigned char *const *in, const size_t *inlen, size_t count);
+} sha256d_backend_t;
+
+// backends are listed in order of preference, the scalar backend is always supported
+static const sha256d_backend_t g_sha256d_backends[] = {
+#ifdef SHA256D_HAVE_X86_BACKENDS
+  {"avx512", 16, is_avx512_supported, sha256d_header_hash_lanes_avx512, sha256d_multi_lanes_avx512},
+  {"avx2", 8, is_avx2_supported, sha256d_header_hash_lanes_avx2, sha256d_multi_lanes_avx2},
+  {"shani", 1, is_shani_supported, sha256d_header_hash_shani, sha256d_multi_shani},
+  {"sse41", 4, is_sse41_supported, sha256d_header_hash_lanes_sse41, sha256d_multi_lanes_sse41},
+#endif
+#ifdef SHA256D_HAVE_NEON_BACKEND
+  {"neon", 4, is_neon_supported, sha256d_header_hash_lanes_neon, sha256d_multi_lanes_neon},
+#endif
+  {"scalar", 1, is_scalar_supported, sha256d_header_hash_scalar, sha256d_multi_scalar}
+};
+
+#define NUM_SHA256D_BACKENDS (sizeof(g_sha256d_backends) / sizeof(sha256d_backend_t))
+
+static const sha256d_backend_t *g_sha256d_backend = NULL;
+
+static const sha256d_backend_t* get_sha256d_backend(void)
+{
+  if (g_sha256d_backend == NULL)
+  {
+    for (size_t i = 0; i < NUM_SHA256D_BACKENDS; i++)
+    {
+      if (g_sha256d_backends[i].is_supported())
+      {
+        g_sha256d_backend = &g_sha256d_backends[i];
+        break;
+      }
+    }
+  }
+
+  assert(g_sha256d_backend != NULL);
+  return g_sha256d_backend;
+}
+
+int crypto_sha256d_set_backend(const char *backend_name)
+{
+  assert(backend_name != NULL);
+  for (size_t i = 0; i < NUM_SHA256D_BACKENDS; i++)
+  {
+    const sha256d_backend_t *backend = &g_sha256d_backends[i];
+    if (strcmp(backend->name, backend_name) == 0)
+    {
+      if (backend->is_supported() == 0)
+      {
+        return 1;
+      }
+
+      g_sha256d_backend = backend;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+const char* crypto_sha256d_get_backend_name(void)
+{
+  return get_sha256d_backend()->name;
+}
+
+size_t crypto_sha256d_get_num_lanes(void)
+{
+  return get_sha256d_backend()->num_lanes;
+}
+
+void crypto_hash_sha256d_multi(unsigned char *out, const unsigned char *const *in, const size_t *inlen, size_t count)
+{
+  const sha256d_backend_t *backend = get_sha256d_backend();
+  for (size_t i = 0; i < count; i += backend->num_lanes)
+  {
+    size_t num_messages = count - i;
+    if (num_messages > backend->num_lanes)
+    {
+      num_messages = backend->num_lanes;
+    }
+
+    backend->multi(out + (i * 32), in + i, inlen + i, num_messages);
+  }
+}
+
+void crypto_sha256d_header_hash_multi(unsigned char *out, const sha256d_header_ctx_t *ctx, size_t word_offset, const uint32_t *words, size_t count)
+{
+  assert(word_offset % 4 == 0 && word_offset < SHA256_BLOCK_SIZE);
+  const sha256d_backend_t *backend = get_sha256d_backend();
+
+  size_t word_index = word_offset / 4;
+  size_t num_lanes = backend->num_lanes;
+  for (size_t i = 0; i < count; i += num_lanes)
+  {
+    if (count - i >= num_lanes)
+    {
+      backend->header_hash(out + (i * 32), ctx, word_index, words + i);
+      continue;
+    }
+
+    // fill the unused lanes of the last batch and drop their hashes
+    uint32_t batch_words[SHA256D_MAX_LANES];
+    unsigned char batch_out[SHA256D_MAX_LANES * 32];
+    for (size_t lane = 0; lane < num_lanes; lane++)
+    {
+      batch_words[lane] = words[i + lane < count ? i + lane : count - 1];
+    }
+
+    backend->header_hash(batch_out, ctx, word_index, batch_words);
+    memcpy(out + (i * 32), batch_out, (count - i) * 32);
+  }
+}
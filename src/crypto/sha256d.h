@@ -25,12 +25,50 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "common/vulkan.h"
 
 VULKAN_BEGIN_DECL
 
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_STATE_WORDS 8
+#define SHA256_SCHEDULE_WORDS 64
+
+// the widest backend hashes this many messages at once
+#define SHA256D_MAX_LANES 16
+
+// the largest message that fits into two padded sha256 blocks
+#define SHA256D_MAX_HEADER_SIZE ((SHA256_BLOCK_SIZE * 2) - 9)
+
+/* Hashing context for a message that spans two sha256 blocks where only
+ * the first block changes between hashes, such as a block header while
+ * searching for a nonce. The message schedule of the padded second block
+ * is computed once and the first block can be patched in place...
+ */
+typedef struct Sha256dHeaderCtx
+{
+  unsigned char first_block[SHA256_BLOCK_SIZE];
+  unsigned char second_block[SHA256_BLOCK_SIZE];
+  uint32_t second_block_schedule[SHA256_SCHEDULE_WORDS];
+} sha256d_header_ctx_t;
+
 VULKAN_API int crypto_hash_sha256d(unsigned char *out, const unsigned char *in, unsigned long long inlen);
 
+VULKAN_API void crypto_sha256_init_state(uint32_t *state);
+VULKAN_API void crypto_sha256_expand_schedule(uint32_t *schedule, const unsigned char *block);
+VULKAN_API void crypto_sha256_transform_schedule(uint32_t *state, const uint32_t *schedule);
+VULKAN_API void crypto_sha256_transform(uint32_t *state, const unsigned char *block);
+
+VULKAN_API int crypto_sha256d_header_init(sha256d_header_ctx_t *ctx, const unsigned char *header, size_t header_size);
+VULKAN_API void crypto_sha256d_header_hash(unsigned char *out, const sha256d_header_ctx_t *ctx);
+
+VULKAN_API int crypto_sha256d_set_backend(const char *backend_name);
+VULKAN_API const char* crypto_sha256d_get_backend_name(void);
+VULKAN_API size_t crypto_sha256d_get_num_lanes(void);
+
+VULKAN_API void crypto_hash_sha256d_multi(unsigned char *out, const unsigned char *const *in, const size_t *inlen, size_t count);
+VULKAN_API void crypto_sha256d_header_hash_multi(unsigned char *out, const sha256d_header_ctx_t *ctx, size_t word_offset, const uint32_t *words, size_t count);
+
 VULKAN_END_DECL
@@ -0,0 +1,221 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+/* Multi-lane sha256d kernels, this file is included by sha256d.c once for
+ * every vector width it supports and is not meant to be included elsewhere:
+ *
+ *   SHA256D_LANES_SUFFIX  - suffix appended to the names of the kernels
+ *   SHA256D_NUM_LANES     - number of 32 bit lanes in a vector
+ *   SHA256D_LANES_TARGET  - attributes enabling the instruction set to use
+ *
+ * The kernels are written with compiler vector extensions so the same code
+ * hashes 4, 8 or 16 independent messages at once depending on the width...
+ */
+
+#define SHA256D_LANES_CONCAT_INNER(name, suffix) name##_##suffix
+#define SHA256D_LANES_CONCAT(name, suffix) SHA256D_LANES_CONCAT_INNER(name, suffix)
+#define SHA256D_LANES_FN(name) SHA256D_LANES_CONCAT(name, SHA256D_LANES_SUFFIX)
+
+#define SHA256D_VEC SHA256D_LANES_FN(sha256_vec)
+
+typedef uint32_t SHA256D_VEC __attribute__((vector_size(SHA256D_NUM_LANES * 4)));
+
+SHA256D_LANES_TARGET
+static void SHA256D_LANES_FN(sha256_expand_lanes)(SHA256D_VEC *schedule)
+{
+  for (int i = 16; i < SHA256_SCHEDULE_WORDS; i++)
+  {
+    schedule[i] = SHA256_GAMMA1(schedule[i - 2]) + schedule[i - 7] +
+                  SHA256_GAMMA0(schedule[i - 15]) + schedule[i - 16];
+  }
+}
+
+SHA256D_LANES_TARGET
+static void SHA256D_LANES_FN(sha256_rounds_lanes)(SHA256D_VEC *state, const SHA256D_VEC *schedule)
+{
+  SHA256D_VEC a = state[0];
+  SHA256D_VEC b = state[1];
+  SHA256D_VEC c = state[2];
+  SHA256D_VEC d = state[3];
+  SHA256D_VEC e = state[4];
+  SHA256D_VEC f = state[5];
+  SHA256D_VEC g = state[6];
+  SHA256D_VEC h = state[7];
+
+  for (int i = 0; i < SHA256_SCHEDULE_WORDS; i++)
+  {
+    SHA256D_VEC t1 = h + SHA256_SIGMA1(e) + SHA256_CH(e, f, g) + g_sha256_k[i] + schedule[i];
+    SHA256D_VEC t2 = SHA256_SIGMA0(a) + SHA256_MAJ(a, b, c);
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+// hashes the first sha256 digest of every lane a second time and stores the results
+SHA256D_LANES_TARGET
+static void SHA256D_LANES_FN(sha256d_finish_lanes)(unsigned char *out, SHA256D_VEC *state, size_t count)
+{
+  SHA256D_VEC zero = {0};
+  SHA256D_VEC schedule[SHA256_SCHEDULE_WORDS];
+  for (int i = 0; i < SHA256_STATE_WORDS; i++)
+  {
+    schedule[i] = state[i];
+    state[i] = zero + g_sha256_iv[i];
+  }
+
+  schedule[8] = zero + 0x80000000;
+  for (int i = 9; i < 15; i++)
+  {
+    schedule[i] = zero;
+  }
+
+  schedule[15] = zero + (SHA256_STATE_WORDS * 32);
+  SHA256D_LANES_FN(sha256_expand_lanes)(schedule);
+  SHA256D_LANES_FN(sha256_rounds_lanes)(state, schedule);
+
+  for (size_t lane = 0; lane < count; lane++)
+  {
+    for (int i = 0; i < SHA256_STATE_WORDS; i++)
+    {
+      store_be32(out + (lane * 32) + (i * 4), state[i][lane]);
+    }
+  }
+}
+
+SHA256D_LANES_TARGET
+static void SHA256D_LANES_FN(sha256d_header_hash_lanes)(unsigned char *out, const sha256d_header_ctx_t *ctx, size_t word_index, const uint32_t *words)
+{
+  SHA256D_VEC zero = {0};
+  SHA256D_VEC state[SHA256_STATE_WORDS];
+  SHA256D_VEC schedule[SHA256_SCHEDULE_WORDS];
+
+  for (int i = 0; i < 16; i++)
+  {
+    schedule[i] = zero + load_be32(ctx->first_block + (i * 4));
+  }
+
+  // every lane hashes the first block with it's own word patched in
+  for (size_t lane = 0; lane < SHA256D_NUM_LANES; lane++)
+  {
+    schedule[word_index][lane] = load_be32((const unsigned char*)&words[lane]);
+  }
+
+  for (int i = 0; i < SHA256_STATE_WORDS; i++)
+  {
+    state[i] = zero + g_sha256_iv[i];
+  }
+
+  SHA256D_LANES_FN(sha256_expand_lanes)(schedule);
+  SHA256D_LANES_FN(sha256_rounds_lanes)(state, schedule);
+
+  for (int i = 0; i < SHA256_SCHEDULE_WORDS; i++)
+  {
+    schedule[i] = zero + ctx->second_block_schedule[i];
+  }
+
+  SHA256D_LANES_FN(sha256_rounds_lanes)(state, schedule);
+  SHA256D_LANES_FN(sha256d_finish_lanes)(out, state, SHA256D_NUM_LANES);
+}
+
+SHA256D_LANES_TARGET
+static void SHA256D_LANES_FN(sha256d_multi_lanes)(unsigned char *out, const unsigned char *const *in, const size_t *inlen, size_t count)
+{
+  SHA256D_VEC zero = {0};
+  SHA256D_VEC state[SHA256_STATE_WORDS];
+  SHA256D_VEC schedule[SHA256_SCHEDULE_WORDS];
+
+  size_t num_blocks[SHA256D_NUM_LANES];
+  size_t max_num_blocks = 0;
+  for (size_t lane = 0; lane < SHA256D_NUM_LANES; lane++)
+  {
+    num_blocks[lane] = lane < count ? get_sha256_num_blocks(inlen[lane]) : 0;
+    if (num_blocks[lane] > max_num_blocks)
+    {
+      max_num_blocks = num_blocks[lane];
+    }
+  }
+
+  for (int i = 0; i < SHA256_STATE_WORDS; i++)
+  {
+    state[i] = zero + g_sha256_iv[i];
+  }
+
+  // lanes with shorter messages keep their state once all of their blocks are hashed
+  unsigned char block[SHA256_BLOCK_SIZE];
+  for (size_t block_index = 0; block_index < max_num_blocks; block_index++)
+  {
+    SHA256D_VEC mask = zero;
+    for (size_t lane = 0; lane < SHA256D_NUM_LANES; lane++)
+    {
+      if (block_index < num_blocks[lane])
+      {
+        get_sha256_padded_block(block, in[lane], inlen[lane], block_index);
+        mask[lane] = 0xffffffff;
+      }
+      else
+      {
+        memset(block, 0, sizeof(block));
+      }
+
+      for (int i = 0; i < 16; i++)
+      {
+        schedule[i][lane] = load_be32(block + (i * 4));
+      }
+    }
+
+    SHA256D_VEC next_state[SHA256_STATE_WORDS];
+    memcpy(next_state, state, sizeof(state));
+
+    SHA256D_LANES_FN(sha256_expand_lanes)(schedule);
+    SHA256D_LANES_FN(sha256_rounds_lanes)(next_state, schedule);
+
+    for (int i = 0; i < SHA256_STATE_WORDS; i++)
+    {
+      state[i] = (state[i] & ~mask) | (next_state[i] & mask);
+    }
+  }
+
+  SHA256D_LANES_FN(sha256d_finish_lanes)(out, state, count);
+}
+
+#undef SHA256D_VEC
+#undef SHA256D_LANES_FN
+#undef SHA256D_LANES_CONCAT
+#undef SHA256D_LANES_CONCAT_INNER
@@ -32,27 +32,41 @@
 
 #include <sodium.h>
 
+#include "common/affinity.h"
 #include "common/argparse.h"
 #include "common/logger.h"
+#include "common/metrics.h"
 #include "common/task.h"
+#include "common/trace.h"
 
 #include "core/block.h"
+#include "core/block_cache.h"
+#include "core/block_file.h"
 #include "core/blockchain.h"
 #include "core/console.h"
 #include "core/parameters.h"
 #include "core/pow.h"
 #include "core/mempool.h"
+#include "core/mempool_ingress.h"
+#include "core/orphan_pool.h"
 #include "core/net.h"
 #include "core/p2p.h"
 #include "core/protocol.h"
+#include "core/rpc.h"
+#include "core/utxo_cache.h"
+#include "core/utxo_snapshot.h"
+#include "core/validator.h"
 #include "core/version.h"
 
 #include "miner/miner.h"
+#include "miner/mining_server.h"
 
 #include "wallet/wallet.h"
 
 static connection_entries_t g_connection_entries;
 static int g_enable_miner = 0;
+static int g_enable_mining_server = 0;
+static int g_enable_rpc_server = 0;
 
 static const char *g_blockchain_data_dir = "store-blockchain";
 static const char *g_wallet_dir = "store-wallet";
@@ -61,11 +75,19 @@ static const char *g_logger_log_filename = "daemon.log";
 static int g_repair_blockchain = 0;
 static int g_repair_wallet = 0;
 
+static const char *g_utxo_snapshot_export_filename = NULL;
+static const char *g_utxo_snapshot_import_filename = NULL;
+static const char *g_blocks_export_filename = NULL;
+static const char *g_blocks_import_filename = NULL;
+
 enum
 {
   CMD_ARG_HELP = 0,
   CMD_ARG_VERSION,
   CMD_ARG_LOGGING_FILENAME,
+  CMD_ARG_ASYNC_LOGGING,
+  CMD_ARG_LOG_LEVEL,
+  CMD_ARG_LOG_MODULE_LEVEL,
   CMD_ARG_DISABLE_PORT_MAPPING,
   CMD_ARG_BIND_ADDRESS,
   CMD_ARG_BIND_PORT,
@@ -75,21 +97,65 @@ enum
   CMD_ARG_CLEAR_BLOCKCHAIN,
   CMD_ARG_DISABLE_BLOCKCHAIN_COMPRESSION,
   CMD_ARG_BLOCKCHAIN_COMPRESSION_TYPE,
+  CMD_ARG_BLOCKCHAIN_DURABILITY,
+  CMD_ARG_BLOCKCHAIN_DURABILITY_BATCH_BLOCKS,
+  CMD_ARG_BLOCKCHAIN_DURABILITY_BATCH_INTERVAL,
+  CMD_ARG_BLOCKCHAIN_DB_CACHE_SIZE,
+  CMD_ARG_BLOCKCHAIN_DB_BLOOM_BITS,
+  CMD_ARG_BLOCKCHAIN_DB_PREFIX_LENGTH,
+  CMD_ARG_BLOCKCHAIN_DB_BACKGROUND_JOBS,
+  CMD_ARG_BLOCKCHAIN_DB_WRITE_BUFFER_SIZE,
+  CMD_ARG_PRUNE,
+  CMD_ARG_BLOCK_FILTERS,
+  CMD_ARG_TX_INDEX,
+  CMD_ARG_EXPORT_UTXO_SNAPSHOT,
+  CMD_ARG_IMPORT_UTXO_SNAPSHOT,
+  CMD_ARG_EXPORT_BLOCKS,
+  CMD_ARG_IMPORT_BLOCKS,
+  CMD_ARG_UTXO_CACHE_SIZE,
+  CMD_ARG_UTXO_CACHE_FLUSH_INTERVAL,
+  CMD_ARG_BLOCK_CACHE_SIZE,
+  CMD_ARG_ORPHAN_POOL_SIZE,
+  CMD_ARG_NUM_VALIDATION_THREADS,
   CMD_ARG_P2P_STORAGE_FILENAME,
+  CMD_ARG_MEMPOOL_STORAGE_FILENAME,
+  CMD_ARG_MEMPOOL_SIZE,
   CMD_ARG_WALLET_DIR,
   CMD_ARG_REPAIR_WALLET,
   CMD_ARG_CLEAR_WALLET,
   CMD_ARG_CREATE_GENESIS_BLOCK,
   CMD_ARG_FORCE_VERSION_CHECK,
+  CMD_ARG_DISABLE_HEADER_FIRST_SYNC,
+  CMD_ARG_DISABLE_ASSUME_VALID,
+  CMD_ARG_GROUPED_BLOCKS_BUDGET,
+  CMD_ARG_NUM_NET_IO_THREADS,
+  CMD_ARG_NET_SEND_QUEUE_HIGH_WATERMARK,
+  CMD_ARG_NET_SEND_QUEUE_LOW_WATERMARK,
+  CMD_ARG_NET_SEND_QUEUE_STALL_TIMEOUT,
+  CMD_ARG_NET_TARGET_OUTBOUND_PEERS,
+  CMD_ARG_DISABLE_NET_COMPRESSION,
+  CMD_ARG_DISABLE_NET_COMPACT_ENCODING,
   CMD_ARG_TESTNET,
   CMD_ARG_NUM_WORKER_THREADS,
-  CMD_ARG_MINE
+  CMD_ARG_NUM_TASK_THREADS,
+  CMD_ARG_THREAD_AFFINITY,
+  CMD_ARG_RESERVED_CPUS,
+  CMD_ARG_MINE,
+  CMD_ARG_MINING_SERVER,
+  CMD_ARG_MINING_SERVER_PORT,
+  CMD_ARG_RPC,
+  CMD_ARG_RPC_BIND_ADDRESS,
+  CMD_ARG_RPC_PORT,
+  CMD_ARG_DISABLE_TRACING
 };
 
 static const argument_map_t g_arguments_map[] = {
   {"help", CMD_ARG_HELP, "Shows the help information", "", 0},
   {"version", CMD_ARG_VERSION, "Shows the version information", "", 0},
   {"logging-filename", CMD_ARG_LOGGING_FILENAME, "Sets the logger output log filename", "<logger_filename>.log", 1},
+  {"async-logging", CMD_ARG_ASYNC_LOGGING, "Writes log messages from a background thread instead of flushing every message as it is logged", "", 0},
+  {"log-level", CMD_ARG_LOG_LEVEL, "Sets the most verbose level logged: info, warning, trace, debug or fatal (everything, default), errors are always logged", "<level>", 1},
+  {"log-module-level", CMD_ARG_LOG_MODULE_LEVEL, "Sets the log level of a single source module, e.g. protocol:debug", "<module>:<level>", 1},
   {"disable-port-mapping", CMD_ARG_DISABLE_PORT_MAPPING, "Disables UPnP port mapping", "", 0},
   {"bind-address", CMD_ARG_BIND_ADDRESS, "Sets the network bind address", "<bind_address>", 1},
   {"bind-port", CMD_ARG_BIND_PORT, "Sets the network bind port", "<bind_port>", 1},
@@ -100,20 +166,79 @@ static const argument_map_t g_arguments_map[] = {
   {"clear-blockchain", CMD_ARG_CLEAR_BLOCKCHAIN, "Clears the blockchain data on disk", "", 0},
   {"disable-blockchain-compression", CMD_ARG_DISABLE_BLOCKCHAIN_COMPRESSION, "Disables blockchain storage on disk compression", "", 0},
   {"blockchain-compression-type", CMD_ARG_BLOCKCHAIN_COMPRESSION_TYPE, "Sets the blockchain compression method to use", "<compression_method>", 1},
+  {"blockchain-durability", CMD_ARG_BLOCKCHAIN_DURABILITY, "Sets how block commits are synced to disk: sync (every block), batch (groups of blocks, default) or none (until shutdown)", "<durability>", 1},
+  {"blockchain-durability-batch-blocks", CMD_ARG_BLOCKCHAIN_DURABILITY_BATCH_BLOCKS, "Sets the number of block commits synced to disk together with the batch durability", "<num_blocks>", 1},
+  {"blockchain-durability-batch-interval", CMD_ARG_BLOCKCHAIN_DURABILITY_BATCH_INTERVAL, "Sets the milliseconds after which block commits are synced to disk with the batch durability", "<interval_ms>", 1},
+  {"blockchain-db-cache-size", CMD_ARG_BLOCKCHAIN_DB_CACHE_SIZE, "Sets the size in megabytes of the blockchain database block cache, 0 uses the database default", "<cache_size_mb>", 1},
+  {"blockchain-db-bloom-bits", CMD_ARG_BLOCKCHAIN_DB_BLOOM_BITS, "Sets the bloom filter bits per key of the blockchain database, 0 disables bloom filters", "<bits_per_key>", 1},
+  {"blockchain-db-prefix-length", CMD_ARG_BLOCKCHAIN_DB_PREFIX_LENGTH, "Sets the fixed key prefix length used for blockchain database prefix bloom filters (RocksDB only)", "<prefix_length>", 1},
+  {"blockchain-db-background-jobs", CMD_ARG_BLOCKCHAIN_DB_BACKGROUND_JOBS, "Sets the number of blockchain database background flush and compaction jobs (RocksDB only)", "<num_jobs>", 1},
+  {"blockchain-db-write-buffer-size", CMD_ARG_BLOCKCHAIN_DB_WRITE_BUFFER_SIZE, "Sets the size in megabytes of the blockchain database write buffer", "<buffer_size_mb>", 1},
+  {"prune", CMD_ARG_PRUNE, "Prunes the transactions and undo data of old blocks, keeping either the given number of most recent blocks or the given size in megabytes when suffixed with M", "<num_blocks|size_mbM>", 1},
+  {"block-filters", CMD_ARG_BLOCK_FILTERS, "Builds a compact filter of every block inserted, which lets wallets skip the blocks that do not concern them and is served to peers", "", 0},
+  {"txindex", CMD_ARG_TX_INDEX, "Indexes the block of every transaction so that confirmed transactions can be looked up by their id, blocks inserted without the index are indexed in the background", "", 0},
+  {"export-utxo-snapshot", CMD_ARG_EXPORT_UTXO_SNAPSHOT, "Exports a snapshot of the unspent transactions at the last checkpoint once the blockchain is loaded", "<snapshot_filename>", 1},
+  {"import-utxo-snapshot", CMD_ARG_IMPORT_UTXO_SNAPSHOT, "Bootstraps an empty blockchain from a snapshot of the unspent transactions at a checkpoint", "<snapshot_filename>", 1},
+  {"export-blocks", CMD_ARG_EXPORT_BLOCKS, "Exports every block of the blockchain into a flat block file once the blockchain is loaded", "<blocks_filename>", 1},
+  {"import-blocks", CMD_ARG_IMPORT_BLOCKS, "Imports and validates the blocks of a flat block file on top of the blockchain", "<blocks_filename>", 1},
+  {"utxo-cache-size", CMD_ARG_UTXO_CACHE_SIZE, "Sets the memory budget in megabytes of the unspent transaction cache", "<cache_size_mb>", 1},
+  {"utxo-cache-flush-interval", CMD_ARG_UTXO_CACHE_FLUSH_INTERVAL, "Sets the number of blocks between unspent transaction cache flushes", "<num_blocks>", 1},
+  {"block-cache-size", CMD_ARG_BLOCK_CACHE_SIZE, "Sets the memory budget in megabytes of the recently used block cache", "<cache_size_mb>", 1},
+  {"orphan-pool-size", CMD_ARG_ORPHAN_POOL_SIZE, "Sets the memory budget in megabytes of the blocks which arrived before their parent block", "<pool_size_mb>", 1},
+  {"validation-threads", CMD_ARG_NUM_VALIDATION_THREADS, "Sets the number of threads to use when validating blocks, defaults to the number of cpus minus one", "<num_threads>", 1},
   {"p2p-storage-filename", CMD_ARG_P2P_STORAGE_FILENAME, "Sets the p2p peerlist storage database filename", "<db_storage_filename>", 1},
+  {"mempool-storage-filename", CMD_ARG_MEMPOOL_STORAGE_FILENAME, "Sets the file the mempool is saved to on shutdown and reloaded from on startup", "<mempool_storage_filename>", 1},
+  {"mempool-size", CMD_ARG_MEMPOOL_SIZE, "Sets the memory budget in megabytes of the mempool, the lowest fee rate transactions are evicted past it", "<mempool_size_mb>", 1},
   {"wallet-dir", CMD_ARG_WALLET_DIR, "Change the wallet database output directory", "<wallet_dir>", 1},
   {"repair-wallet", CMD_ARG_REPAIR_WALLET, "Repair the wallet database directory in attempt to recover the data", "", 0},
   {"clear-wallet", CMD_ARG_CLEAR_WALLET, "Clears the wallet data on disk", "", 0},
   {"create-genesis-block", CMD_ARG_CREATE_GENESIS_BLOCK, "Creates and mine a new genesis block", "", 0},
   {"force-protocol-version-check", CMD_ARG_FORCE_VERSION_CHECK, "Forces protocol version check when accepting new incoming peer connections", "", 0},
+  {"disable-header-first-sync", CMD_ARG_DISABLE_HEADER_FIRST_SYNC, "Synchronizes one block at a time from a single peer instead of downloading blocks from all peers after their headers", "", 0},
+  {"disable-assume-valid", CMD_ARG_DISABLE_ASSUME_VALID, "Checks the txin signatures of every block instead of assuming the blocks leading up to a checkpoint are valid, always disabled on the testnet", "", 0},
+  {"grouped-blocks-budget", CMD_ARG_GROUPED_BLOCKS_BUDGET, "Sets the budget in kilobytes of full blocks sent per grouped blocks response, 0 disables full blocks", "<budget_kb>", 1},
+  {"net-io-threads", CMD_ARG_NUM_NET_IO_THREADS, "Sets the number of threads accepted peer connections are spread across, 0 runs all network io on the main thread", "<num_threads>", 1},
+  {"net-send-queue-high-watermark", CMD_ARG_NET_SEND_QUEUE_HIGH_WATERMARK, "Sets the size in megabytes of unsent data above which requests from and relays to a peer are paused", "<size_mb>", 1},
+  {"net-send-queue-low-watermark", CMD_ARG_NET_SEND_QUEUE_LOW_WATERMARK, "Sets the size in megabytes of unsent data below which a paused peer is resumed", "<size_mb>", 1},
+  {"net-send-queue-stall-timeout", CMD_ARG_NET_SEND_QUEUE_STALL_TIMEOUT, "Sets the number of seconds a peer may stay paused before it is disconnected", "<seconds>", 1},
+  {"net-target-outbound-peers", CMD_ARG_NET_TARGET_OUTBOUND_PEERS, "Sets the number of outbound peers the node keeps dialing until it is connected to", "<num_peers>", 1},
+  {"disable-net-compression", CMD_ARG_DISABLE_NET_COMPRESSION, "Disables compression of large packets sent to peers which support it", "", 0},
+  {"disable-net-compact-encoding", CMD_ARG_DISABLE_NET_COMPACT_ENCODING, "Disables the compact v2 encoding of txs and blocks sent to peers which support it", "", 0},
   {"worker-threads", CMD_ARG_NUM_WORKER_THREADS, "Sets the number of miner worker threads to use when mining blocks", "<num_workers>", 1},
-  {"mine", CMD_ARG_MINE, "Start mining for new blocks", "", 0}
+  {"task-threads", CMD_ARG_NUM_TASK_THREADS, "Sets the number of threads background jobs are run on, 0 runs jobs on the thread which adds them", "<num_threads>", 1},
+  {"thread-affinity", CMD_ARG_THREAD_AFFINITY, "Pins the network loop, validation threads and miner workers to cpus ordered by numa node", "", 0},
+  {"reserved-cpus", CMD_ARG_RESERVED_CPUS, "Sets the number of cpus reserved for the network loop and validation threads when thread affinity is enabled", "<num_cpus>", 1},
+  {"mine", CMD_ARG_MINE, "Start mining for new blocks", "", 0},
+  {"mining-server", CMD_ARG_MINING_SERVER, "Serves block templates to external hashers and accepts the blocks they find", "", 0},
+  {"mining-server-port", CMD_ARG_MINING_SERVER_PORT, "Sets the mining server bind port", "<port>", 1},
+  {"rpc", CMD_ARG_RPC, "Serves JSON-RPC queries of the blockchain, mempool and peers over HTTP", "", 0},
+  {"rpc-bind-address", CMD_ARG_RPC_BIND_ADDRESS, "Sets the rpc server bind address, defaults to the loopback address", "<bind_address>", 1},
+  {"rpc-port", CMD_ARG_RPC_PORT, "Sets the rpc server bind port", "<port>", 1},
+  {"disable-tracing", CMD_ARG_DISABLE_TRACING, "Disables recording of the trace spans around the sync and validation paths", "", 0}
 };
 
 #define NUM_ARGUMENTS (sizeof(g_arguments_map) / sizeof(argument_map_t))
 
 static void perform_shutdown(int sig)
 {
+  if (g_enable_rpc_server)
+  {
+    if (stop_rpc_server())
+    {
+      exit(1);
+      return;
+    }
+  }
+
+  if (g_enable_mining_server)
+  {
+    if (stop_mining_server())
+    {
+      exit(1);
+      return;
+    }
+  }
+
   if (g_enable_miner)
   {
     if (stop_mining())
@@ -135,12 +260,39 @@ static void perform_shutdown(int sig)
     return;
   }
 
+  if (get_is_mempool_ingress_running())
+  {
+    if (stop_mempool_ingress())
+    {
+      exit(1);
+      return;
+    }
+  }
+
   if (stop_mempool())
   {
     exit(1);
     return;
   }
 
+  if (get_is_validator_running())
+  {
+    if (stop_validator())
+    {
+      exit(1);
+      return;
+    }
+  }
+
+  if (get_is_utxo_prefetch_running())
+  {
+    if (stop_utxo_prefetch())
+    {
+      exit(1);
+      return;
+    }
+  }
+
   if (close_blockchain())
   {
     exit(1);
@@ -198,6 +350,44 @@ static int parse_commandline_args(int argc, char **argv)
         i++;
         g_logger_log_filename = (const char*)argv[i];
         break;
+      case CMD_ARG_ASYNC_LOGGING:
+        logger_set_async(1);
+        break;
+      case CMD_ARG_LOG_LEVEL:
+        {
+          i++;
+          logger_level_t level;
+          if (logger_get_level_from_str(argv[i], &level))
+          {
+            fprintf(stderr, "Unknown log level: %s!\n", argv[i]);
+            return 1;
+          }
+
+          log_set_level(level);
+        }
+        break;
+      case CMD_ARG_LOG_MODULE_LEVEL:
+        {
+          i++;
+          char module[LOGGER_MAX_MODULE_NAME_SIZE];
+          const char *separator = strchr(argv[i], ':');
+          logger_level_t level;
+          if (separator == NULL || (size_t)(separator - argv[i]) >= sizeof(module) ||
+            logger_get_level_from_str(separator + 1, &level))
+          {
+            fprintf(stderr, "Invalid module log level: %s, expected <module>:<level>!\n", argv[i]);
+            return 1;
+          }
+
+          memcpy(module, argv[i], separator - argv[i]);
+          module[separator - argv[i]] = '\0';
+          if (logger_set_module_level(module, level))
+          {
+            fprintf(stderr, "Could not set log level of module: %s!\n", module);
+            return 1;
+          }
+        }
+        break;
       case CMD_ARG_VERSION:
         printf("%s v%s-%s\n", APPLICATION_NAME, APPLICATION_VERSION, APPLICATION_RELEASE_NAME);
         return 1;
@@ -216,6 +406,7 @@ static int parse_commandline_args(int argc, char **argv)
         break;
       case CMD_ARG_TESTNET:
         parameters_set_use_testnet(1);
+        set_assume_valid(0);
         break;
       case CMD_ARG_CONNECT:
         {
@@ -266,10 +457,129 @@ static int parse_commandline_args(int argc, char **argv)
 
         set_blockchain_compression_type(compression_type);
         break;
+      case CMD_ARG_BLOCKCHAIN_DURABILITY:
+        i++;
+        const char *durability_str = (const char*)argv[i];
+        int durability = get_blockchain_durability_from_str(durability_str);
+        if (durability < 0)
+        {
+          fprintf(stderr, "Unknown blockchain durability: %s!\n", durability_str);
+          return 1;
+        }
+
+        set_blockchain_durability(durability);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DURABILITY_BATCH_BLOCKS:
+        i++;
+        uint32_t durability_batch_blocks = (uint32_t)atoi(argv[i]);
+        if (durability_batch_blocks == 0)
+        {
+          fprintf(stderr, "Blockchain durability batch blocks must be greater than 0!\n");
+          return 1;
+        }
+
+        set_blockchain_durability_batch_blocks(durability_batch_blocks);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DURABILITY_BATCH_INTERVAL:
+        i++;
+        uint32_t durability_batch_interval = (uint32_t)atoi(argv[i]);
+        set_blockchain_durability_batch_interval(durability_batch_interval);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DB_CACHE_SIZE:
+        i++;
+        size_t blockchain_db_cache_size = (size_t)strtoull(argv[i], NULL, 10);
+        set_blockchain_db_cache_size(blockchain_db_cache_size * 1024 * 1024);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DB_BLOOM_BITS:
+        i++;
+        uint32_t blockchain_db_bloom_bits = (uint32_t)atoi(argv[i]);
+        set_blockchain_db_bloom_bits_per_key(blockchain_db_bloom_bits);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DB_PREFIX_LENGTH:
+        i++;
+        size_t blockchain_db_prefix_length = (size_t)strtoull(argv[i], NULL, 10);
+        set_blockchain_db_prefix_length(blockchain_db_prefix_length);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DB_BACKGROUND_JOBS:
+        i++;
+        uint32_t blockchain_db_background_jobs = (uint32_t)atoi(argv[i]);
+        set_blockchain_db_num_background_jobs(blockchain_db_background_jobs);
+        break;
+      case CMD_ARG_BLOCKCHAIN_DB_WRITE_BUFFER_SIZE:
+        i++;
+        size_t blockchain_db_write_buffer_size = (size_t)strtoull(argv[i], NULL, 10);
+        set_blockchain_db_write_buffer_size(blockchain_db_write_buffer_size * 1024 * 1024);
+        break;
+      case CMD_ARG_UTXO_CACHE_SIZE:
+        i++;
+        size_t utxo_cache_size = (size_t)strtoull(argv[i], NULL, 10);
+        set_utxo_cache_max_memory_size(utxo_cache_size * 1024 * 1024);
+        break;
+      case CMD_ARG_PRUNE:
+        i++;
+        char *prune_end = NULL;
+        uint64_t prune_value = (uint64_t)strtoull(argv[i], &prune_end, 10);
+        if (*prune_end == 'M' || *prune_end == 'm')
+        {
+          set_blockchain_prune_target_size(prune_value * 1024 * 1024);
+        }
+        else
+        {
+          set_blockchain_prune_depth((uint32_t)prune_value);
+        }
+        break;
+      case CMD_ARG_BLOCK_FILTERS:
+        set_blockchain_block_filters_enabled(1);
+        break;
+      case CMD_ARG_TX_INDEX:
+        set_blockchain_tx_index_enabled(1);
+        break;
+      case CMD_ARG_EXPORT_UTXO_SNAPSHOT:
+        i++;
+        g_utxo_snapshot_export_filename = (const char*)argv[i];
+        break;
+      case CMD_ARG_IMPORT_UTXO_SNAPSHOT:
+        i++;
+        g_utxo_snapshot_import_filename = (const char*)argv[i];
+        break;
+      case CMD_ARG_EXPORT_BLOCKS:
+        i++;
+        g_blocks_export_filename = (const char*)argv[i];
+        break;
+      case CMD_ARG_IMPORT_BLOCKS:
+        i++;
+        g_blocks_import_filename = (const char*)argv[i];
+        break;
+      case CMD_ARG_UTXO_CACHE_FLUSH_INTERVAL:
+        i++;
+        uint32_t utxo_cache_flush_interval = (uint32_t)atoi(argv[i]);
+        set_utxo_cache_flush_interval(utxo_cache_flush_interval);
+        break;
+      case CMD_ARG_BLOCK_CACHE_SIZE:
+        i++;
+        size_t block_cache_size = (size_t)strtoull(argv[i], NULL, 10);
+        set_block_cache_max_memory_size(block_cache_size * 1024 * 1024);
+        break;
+      case CMD_ARG_ORPHAN_POOL_SIZE:
+        i++;
+        size_t orphan_pool_size = (size_t)strtoull(argv[i], NULL, 10);
+        set_orphan_pool_max_memory_size(orphan_pool_size * 1024 * 1024);
+        break;
       case CMD_ARG_P2P_STORAGE_FILENAME:
         i++;
         const char *p2p_storage_filename = (const char*)argv[i];
         set_p2p_storage_filename(p2p_storage_filename);
+        break;
+      case CMD_ARG_MEMPOOL_STORAGE_FILENAME:
+        i++;
+        const char *mempool_storage_filename = (const char*)argv[i];
+        set_mempool_storage_filename(mempool_storage_filename);
+        break;
+      case CMD_ARG_MEMPOOL_SIZE:
+        i++;
+        size_t mempool_size = (size_t)strtoull(argv[i], NULL, 10);
+        set_mempool_max_memory_size(mempool_size * 1024 * 1024);
+        break;
       case CMD_ARG_WALLET_DIR:
         i++;
         g_wallet_dir = (const char*)argv[i];
@@ -330,6 +640,65 @@ static int parse_commandline_args(int argc, char **argv)
       case CMD_ARG_FORCE_VERSION_CHECK:
         set_force_version_check(1);
         break;
+      case CMD_ARG_DISABLE_HEADER_FIRST_SYNC:
+        set_header_first_sync(0);
+        break;
+      case CMD_ARG_DISABLE_ASSUME_VALID:
+        set_assume_valid(0);
+        break;
+      case CMD_ARG_GROUPED_BLOCKS_BUDGET:
+        i++;
+        uint32_t grouped_blocks_budget_kb = (uint32_t)atoi(argv[i]);
+        set_grouped_blocks_budget_size(grouped_blocks_budget_kb * 1024);
+        break;
+      case CMD_ARG_NUM_NET_IO_THREADS:
+        i++;
+        int num_net_io_threads = atoi(argv[i]);
+        if (num_net_io_threads < 0 || num_net_io_threads > MAX_NUM_NET_IO_THREADS)
+        {
+          fprintf(stderr, "Number of network io threads must be between 0 and %d!\n", MAX_NUM_NET_IO_THREADS);
+          return 1;
+        }
+
+        set_net_num_io_threads((uint16_t)num_net_io_threads);
+        break;
+      case CMD_ARG_NET_SEND_QUEUE_HIGH_WATERMARK:
+        i++;
+        size_t send_queue_high_watermark_mb = (size_t)atoi(argv[i]);
+        set_net_send_queue_high_watermark(send_queue_high_watermark_mb * 1024 * 1024);
+        break;
+      case CMD_ARG_NET_SEND_QUEUE_LOW_WATERMARK:
+        i++;
+        size_t send_queue_low_watermark_mb = (size_t)atoi(argv[i]);
+        set_net_send_queue_low_watermark(send_queue_low_watermark_mb * 1024 * 1024);
+        break;
+      case CMD_ARG_NET_SEND_QUEUE_STALL_TIMEOUT:
+        i++;
+        uint32_t send_queue_stall_timeout = (uint32_t)atoi(argv[i]);
+        set_net_send_queue_stall_timeout(send_queue_stall_timeout);
+        break;
+      case CMD_ARG_NET_TARGET_OUTBOUND_PEERS:
+        i++;
+        uint16_t target_outbound_peers = (uint16_t)atoi(argv[i]);
+        set_net_target_outbound_peers(target_outbound_peers);
+        break;
+      case CMD_ARG_DISABLE_NET_COMPRESSION:
+        set_packet_compression(0);
+        break;
+      case CMD_ARG_DISABLE_NET_COMPACT_ENCODING:
+        set_compact_encoding(0);
+        break;
+      case CMD_ARG_NUM_VALIDATION_THREADS:
+        i++;
+        uint16_t num_validation_threads = (uint16_t)atoi(argv[i]);
+        if (num_validation_threads < 1 || num_validation_threads > MAX_NUM_VALIDATION_THREADS)
+        {
+          fprintf(stderr, "Number of validation threads must be between 1 and %d!\n", MAX_NUM_VALIDATION_THREADS);
+          return 1;
+        }
+
+        set_num_validation_threads(num_validation_threads);
+        break;
       case CMD_ARG_NUM_WORKER_THREADS:
         i++;
         uint16_t num_worker_threads = (uint16_t)atoi(argv[i]);
@@ -341,9 +710,58 @@ static int parse_commandline_args(int argc, char **argv)
 
         set_num_worker_threads(num_worker_threads);
         break;
+      case CMD_ARG_NUM_TASK_THREADS:
+        i++;
+        int num_task_threads = atoi(argv[i]);
+        if (num_task_threads < 0 || num_task_threads > MAX_NUM_TASK_SCHEDULERS)
+        {
+          fprintf(stderr, "Number of task threads must be between 0 and %d!\n", MAX_NUM_TASK_SCHEDULERS);
+          return 1;
+        }
+
+        set_num_task_schedulers((uint16_t)num_task_threads);
+        break;
+      case CMD_ARG_THREAD_AFFINITY:
+        set_thread_affinity_enabled(1);
+        break;
+      case CMD_ARG_RESERVED_CPUS:
+        i++;
+        int num_reserved_cpus = atoi(argv[i]);
+        if (num_reserved_cpus < 0 || num_reserved_cpus > MAX_NUM_AFFINITY_CPUS)
+        {
+          fprintf(stderr, "Number of reserved cpus must be between 0 and %d!\n", MAX_NUM_AFFINITY_CPUS);
+          return 1;
+        }
+
+        set_num_reserved_cpus((uint16_t)num_reserved_cpus);
+        break;
       case CMD_ARG_MINE:
         g_enable_miner = 1;
         break;
+      case CMD_ARG_MINING_SERVER:
+        g_enable_mining_server = 1;
+        break;
+      case CMD_ARG_MINING_SERVER_PORT:
+        i++;
+        uint16_t mining_server_port = (uint16_t)atoi(argv[i]);
+        set_mining_server_port(mining_server_port);
+        break;
+      case CMD_ARG_RPC:
+        g_enable_rpc_server = 1;
+        break;
+      case CMD_ARG_RPC_BIND_ADDRESS:
+        i++;
+        const char *rpc_bind_address = (const char*)argv[i];
+        set_rpc_bind_address(rpc_bind_address);
+        break;
+      case CMD_ARG_RPC_PORT:
+        i++;
+        uint16_t rpc_port = (uint16_t)atoi(argv[i]);
+        set_rpc_port(rpc_port);
+        break;
+      case CMD_ARG_DISABLE_TRACING:
+        set_tracing_enabled(0);
+        break;
       default:
         fprintf(stderr, "Unknown command line argument: %s\n", argv[i]);
         return 1;
@@ -377,6 +795,11 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  if (init_thread_affinity())
+  {
+    return 1;
+  }
+
   taskmgr_init();
   if (g_repair_blockchain)
   {
@@ -388,6 +811,16 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  if (start_mempool_ingress())
+  {
+    return 1;
+  }
+
+  if (start_validator())
+  {
+    return 1;
+  }
+
   if (init_blockchain(g_blockchain_data_dir, 1))
   {
     return 1;
@@ -403,8 +836,56 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  // the checkpoints a snapshot is checked against are loaded along with the network
+  if (g_utxo_snapshot_import_filename != NULL)
+  {
+    if (import_utxo_snapshot(g_utxo_snapshot_import_filename))
+    {
+      return 1;
+    }
+  }
+
+  if (g_utxo_snapshot_export_filename != NULL)
+  {
+    if (export_utxo_snapshot(g_utxo_snapshot_export_filename))
+    {
+      return 1;
+    }
+  }
+
+  if (g_blocks_import_filename != NULL)
+  {
+    if (import_blocks_from_file(g_blocks_import_filename))
+    {
+      return 1;
+    }
+  }
+
+  if (g_blocks_export_filename != NULL)
+  {
+    if (export_blocks_to_file(g_blocks_export_filename))
+    {
+      return 1;
+    }
+  }
+
+  if (start_utxo_snapshot_verification())
+  {
+    return 1;
+  }
+
+  if (start_tx_index_backfill())
+  {
+    return 1;
+  }
+
+  if (start_utxo_prefetch())
+  {
+    return 1;
+  }
+
   wallet_t *wallet = NULL;
-  if (g_enable_miner)
+  if (g_enable_miner || g_enable_mining_server)
   {
     if (g_repair_wallet)
     {
@@ -417,6 +898,14 @@ int main(int argc, char **argv)
     }
 
     assert(wallet != NULL);
+    if (load_wallet_outputs(wallet, g_wallet_dir) || set_blockchain_wallet(wallet))
+    {
+      return 1;
+    }
+  }
+
+  if (g_enable_miner)
+  {
     set_current_wallet(wallet);
     if (start_mining())
     {
@@ -424,6 +913,22 @@ int main(int argc, char **argv)
     }
   }
 
+  if (g_enable_mining_server)
+  {
+    if (start_mining_server(wallet))
+    {
+      return 1;
+    }
+  }
+
+  if (g_enable_rpc_server)
+  {
+    if (start_rpc_server())
+    {
+      return 1;
+    }
+  }
+
   if (init_console(wallet))
   {
     return 1;
@@ -434,6 +939,22 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  if (g_enable_rpc_server)
+  {
+    if (stop_rpc_server())
+    {
+      return 1;
+    }
+  }
+
+  if (g_enable_mining_server)
+  {
+    if (stop_mining_server())
+    {
+      return 1;
+    }
+  }
+
   if (deinit_console())
   {
     return 1;
@@ -441,6 +962,7 @@ int main(int argc, char **argv)
 
   if (wallet != NULL)
   {
+    assert(set_blockchain_wallet(NULL) == 0);
     free_wallet(wallet);
   }
 
@@ -449,11 +971,36 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  if (stop_mempool_ingress())
+  {
+    return 1;
+  }
+
   if (stop_mempool())
   {
     return 1;
   }
 
+  if (stop_validator())
+  {
+    return 1;
+  }
+
+  if (stop_utxo_snapshot_verification())
+  {
+    return 1;
+  }
+
+  if (stop_tx_index_backfill())
+  {
+    return 1;
+  }
+
+  if (stop_utxo_prefetch())
+  {
+    return 1;
+  }
+
   if (close_blockchain())
   {
     return 1;
@@ -473,6 +1020,9 @@ int main(int argc, char **argv)
     }
   }
 
+  free_metrics();
+  free_tracing();
+  deinit_thread_affinity();
   if (logger_close())
   {
     return 1;
@@ -24,25 +24,34 @@
 // along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
 
 #include <stdio.h>
+#include <math.h>
 #include <stdint.h>
 #include <time.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #include <sodium.h>
 
+#include "common/affinity.h"
+#include "common/byteorder.h"
 #include "common/logger.h"
+#include "common/metrics.h"
 #include "common/task.h"
 #include "common/tinycthread.h"
+#include "common/trace.h"
 #include "common/util.h"
 
 #include "core/block.h"
 #include "core/blockchain.h"
 #include "core/mempool.h"
 #include "core/net.h"
+#include "core/pow.h"
 #include "core/protocol.h"
 #include "core/transaction_builder.h"
 
+#include "crypto/sha256d.h"
+
 #include "miner.h"
 
 #include "wallet/wallet.h"
@@ -50,6 +59,7 @@
 static int g_miner_initialized = 0;
 static wallet_t *g_current_wallet = NULL;
 static task_t *g_miner_worker_status_task = NULL;
+static task_t *g_miner_worker_sample_task = NULL;
 
 static mtx_t g_miner_lock;
 static miner_worker_t *g_miner_workers[MAX_NUM_WORKER_THREADS];
@@ -57,6 +67,15 @@ static uint16_t g_num_worker_threads = 1;
 static int g_miner_workers_paused = 0;
 static int g_miner_generate_genesis = 0;
 
+// the block template shared by the workers, it's rebuilt once when the blockchain tip
+// or the mempool changes and the generation is bumped for the workers to notice...
+static block_t *g_miner_template = NULL;
+static uint8_t g_miner_template_previous_hash[HASH_SIZE];
+static uint64_t g_miner_template_mempool_generation = 0;
+static uint32_t g_miner_template_timestamp = 0;
+static atomic_uint g_miner_template_generation = 0;
+static int g_miner_template_initialized = 0;
+
 int get_is_miner_initialized(void)
 {
   return g_miner_initialized;
@@ -109,8 +128,18 @@ miner_worker_t* init_worker(void)
   assert(worker != NULL);
   worker->id = 0;
   worker->running = 0;
-  worker->last_timestamp = get_current_time();
-  worker->last_hashrate = 0;
+  atomic_init(&worker->num_hashes, 0);
+  atomic_init(&worker->num_blocks_found, 0);
+  atomic_init(&worker->num_stale_blocks, 0);
+  worker->last_sample_num_hashes = 0;
+  worker->last_sample_time = get_monotonic_time_ms();
+  worker->hashrate_sampled = 0;
+  worker->hashrate_10s = 0;
+  worker->hashrate_1m = 0;
+  worker->hashrate_15m = 0;
+  worker->nonce_start_offset = 0;
+  worker->nonce_range = MINER_NONCE_SPACE_SIZE;
+  worker->template_generation = 0;
   return worker;
 }
 
@@ -119,33 +148,109 @@ void free_worker(miner_worker_t *worker)
   assert(worker != NULL);
   worker->id = 0;
   worker->running = 0;
-  worker->last_timestamp = 0;
-  worker->last_hashrate = 0;
   free(worker);
 }
 
-static void update_worker_hashrate(miner_worker_t *worker)
+static double update_hashrate_average(double average, double hashrate, double elapsed, double window)
+{
+  double alpha = 1.0 - exp(-elapsed / window);
+  return average + (alpha * (hashrate - average));
+}
+
+/*
+ * Folds the hashes the worker computed since the last sample into it's averages,
+ * the current time is a monotonic time in milliseconds.
+ */
+void sample_worker_hashrate(miner_worker_t *worker, uint64_t current_time)
 {
   assert(worker != NULL);
-  uint32_t current_timestamp = get_current_time();
-  if (current_timestamp - worker->last_timestamp >= 1)
+  if (current_time <= worker->last_sample_time)
+  {
+    return;
+  }
+
+  uint64_t num_hashes = atomic_load_explicit(&worker->num_hashes, memory_order_relaxed);
+  double elapsed = (double)(current_time - worker->last_sample_time) / 1000.0;
+  double hashrate = (double)(num_hashes - worker->last_sample_num_hashes) / elapsed;
+
+  // the averages start out at the first sample instead of ramping up from zero
+  if (worker->hashrate_sampled == 0)
   {
-    worker->last_timestamp = current_timestamp;
-    worker->last_hashrate = 0;
+    worker->hashrate_10s = hashrate;
+    worker->hashrate_1m = hashrate;
+    worker->hashrate_15m = hashrate;
+    worker->hashrate_sampled = 1;
+  }
+  else
+  {
+    worker->hashrate_10s = update_hashrate_average(worker->hashrate_10s, hashrate, elapsed, WORKER_HASHRATE_WINDOW_10S);
+    worker->hashrate_1m = update_hashrate_average(worker->hashrate_1m, hashrate, elapsed, WORKER_HASHRATE_WINDOW_1M);
+    worker->hashrate_15m = update_hashrate_average(worker->hashrate_15m, hashrate, elapsed, WORKER_HASHRATE_WINDOW_15M);
   }
 
-  worker->last_hashrate++;
+  worker->last_sample_num_hashes = num_hashes;
+  worker->last_sample_time = current_time;
 }
 
-block_t* construct_computable_block(miner_worker_t *worker, wallet_t *wallet, block_t *previous_block)
+int get_miner_stats(miner_stats_t *stats)
+{
+  assert(stats != NULL);
+  memset(stats, 0, sizeof(miner_stats_t));
+  if (g_miner_initialized == 0)
+  {
+    return 1;
+  }
+
+  stats->num_workers = g_num_worker_threads;
+  for (uint16_t i = 0; i < g_num_worker_threads; i++)
+  {
+    miner_worker_t *worker = g_miner_workers[i];
+    assert(worker != NULL);
+
+    stats->num_hashes += atomic_load_explicit(&worker->num_hashes, memory_order_relaxed);
+    stats->num_blocks_found += atomic_load_explicit(&worker->num_blocks_found, memory_order_relaxed);
+    stats->num_stale_blocks += atomic_load_explicit(&worker->num_stale_blocks, memory_order_relaxed);
+    stats->hashrate_10s += worker->hashrate_10s;
+    stats->hashrate_1m += worker->hashrate_1m;
+    stats->hashrate_15m += worker->hashrate_15m;
+  }
+
+  return 0;
+}
+
+void print_miner_stats(void)
+{
+  miner_stats_t stats;
+  if (get_miner_stats(&stats))
+  {
+    LOG_INFO("Miner is not running.");
+    return;
+  }
+
+  for (uint16_t i = 0; i < g_num_worker_threads; i++)
+  {
+    miner_worker_t *worker = g_miner_workers[i];
+    assert(worker != NULL);
+    LOG_INFO("Worker[%hu]: [%.0f, %.0f, %.0f h/s], %u blocks found, %u stale.", worker->id,
+      worker->hashrate_10s, worker->hashrate_1m, worker->hashrate_15m,
+      atomic_load_explicit(&worker->num_blocks_found, memory_order_relaxed),
+      atomic_load_explicit(&worker->num_stale_blocks, memory_order_relaxed));
+  }
+
+  LOG_INFO("Miner: [%.0f, %.0f, %.0f h/s] (10s, 1m, 15m) across %hu workers, %llu hashes, %u blocks found, %u stale.",
+    stats.hashrate_10s, stats.hashrate_1m, stats.hashrate_15m, stats.num_workers,
+    (unsigned long long)stats.num_hashes, stats.num_blocks_found, stats.num_stale_blocks);
+}
+
+block_t* construct_computable_block(wallet_t *wallet, blockchain_tip_t *tip, block_t *previous_block)
 {
-  assert(worker != NULL);
   assert(wallet != NULL);
+  assert(tip != NULL);
   assert(previous_block != NULL);
 
   uint32_t nonce = randombytes_random();
   uint32_t current_time = get_current_time();
-  uint32_t current_block_height = get_block_height();
+  uint32_t current_block_height = tip->height;
 
   uint64_t cumulative_emission = previous_block->cumulative_emission;
   uint64_t block_reward = get_block_reward(current_block_height, cumulative_emission);
@@ -155,7 +260,7 @@ block_t* construct_computable_block(miner_worker_t *worker, wallet_t *wallet, bl
 
   block->timestamp = current_time;
   block->nonce = nonce;
-  block->bits = get_next_work_required(previous_block->hash);
+  block->bits = tip->next_work_required;
   block->cumulative_emission = cumulative_emission + block_reward;
 
   transaction_t *tx = NULL;
@@ -165,7 +270,7 @@ block_t* construct_computable_block(miner_worker_t *worker, wallet_t *wallet, bl
   assert(add_transaction_to_block(block, tx, 0) == 0);
   assert(fill_block_with_txs_from_mempool(block) == 0);
 
-  assert(compute_merkle_root(block->hash, block) == 0);
+  assert(compute_merkle_root(block->merkle_root, block) == 0);
   assert(compute_block_hash(block->hash, block) == 0);
   return block;
 }
@@ -188,29 +293,207 @@ block_t* construct_computable_genesis_block(wallet_t *wallet)
   assert(tx != NULL);
   assert(add_transaction_to_block(genesis_block, tx, 0) == 0);
 
-  assert(compute_merkle_root(genesis_block->hash, genesis_block) == 0);
+  assert(compute_merkle_root(genesis_block->merkle_root, genesis_block) == 0);
   assert(compute_block_hash(genesis_block->hash, genesis_block) == 0);
   return genesis_block;
 }
 
-int compute_block(miner_worker_t *worker, block_t *block)
+static int is_miner_template_stale(blockchain_tip_t *tip)
+{
+  if (g_miner_template == NULL || compare_hash(tip->hash, g_miner_template_previous_hash) == 0)
+  {
+    return 1;
+  }
+
+  return get_mempool_generation() != g_miner_template_mempool_generation &&
+    get_current_time() - g_miner_template_timestamp >= MINER_TEMPLATE_MEMPOOL_REFRESH_DELAY;
+}
+
+/*
+ * Rebuilds the shared block template if the blockchain tip or the mempool changed since
+ * it was built, the first worker to notice the change rebuilds it for all of them.
+ */
+int refresh_miner_template(void)
+{
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  if (tip == NULL)
+  {
+    return 1;
+  }
+
+  mtx_lock(&g_miner_lock);
+  if (is_miner_template_stale(tip) == 0)
+  {
+    mtx_unlock(&g_miner_lock);
+    release_blockchain_tip(tip);
+    return 0;
+  }
+
+  block_t *previous_block = get_block_header_from_hash_at_tip(tip, tip->hash);
+  if (previous_block == NULL)
+  {
+    mtx_unlock(&g_miner_lock);
+    release_blockchain_tip(tip);
+    return 1;
+  }
+
+  // txs added while the template is filled make it stale again right away
+  uint64_t mempool_generation = get_mempool_generation();
+  block_t *block = construct_computable_block(g_current_wallet, tip, previous_block);
+  assert(block != NULL);
+  free_block(previous_block);
+
+  if (g_miner_template != NULL)
+  {
+    free_block(g_miner_template);
+  }
+
+  g_miner_template = block;
+  memcpy(g_miner_template_previous_hash, tip->hash, HASH_SIZE);
+  g_miner_template_mempool_generation = mempool_generation;
+  g_miner_template_timestamp = get_current_time();
+  atomic_fetch_add(&g_miner_template_generation, 1);
+
+  mtx_unlock(&g_miner_lock);
+  release_blockchain_tip(tip);
+  return 0;
+}
+
+unsigned int get_miner_template_generation(void)
+{
+  return atomic_load(&g_miner_template_generation);
+}
+
+/*
+ * Copies the current block template for the worker to compute, starting at the
+ * beginning of the worker's own range of nonces. Later to be free'd with `free_block`.
+ */
+block_t* get_miner_work(miner_worker_t *worker)
+{
+  assert(worker != NULL);
+  assert(g_miner_template_initialized);
+  if (refresh_miner_template())
+  {
+    return NULL;
+  }
+
+  block_t *block = make_block();
+  mtx_lock(&g_miner_lock);
+  assert(g_miner_template != NULL);
+  assert(copy_block(g_miner_template, block) == 0);
+  worker->template_generation = atomic_load(&g_miner_template_generation);
+  mtx_unlock(&g_miner_lock);
+
+  block->nonce += worker->nonce_start_offset;
+  return block;
+}
+
+static inline void set_header_uint32(uint8_t *header, size_t offset, uint32_t value)
+{
+  // written the same way the header is serialized by buffer_write_uint32
+  uint32_t data = swap_le(value);
+  memcpy(header + offset, &data, sizeof(uint32_t));
+}
+
+/* Searches for a nonce that satisfies the block's proof-of-work target. The
+ * header is serialized once and only the nonce and timestamp are patched into
+ * the hashing context, the target is expanded once up front. Consecutive
+ * nonces are hashed in batches as wide as the selected sha256d backend...
+ *
+ * Workers only search their own range of nonces and give up on the block as
+ * soon as the template it was copied from has been replaced.
+ */
+compute_block_result_t compute_block(miner_worker_t *worker, block_t *block)
 {
   assert(block != NULL);
-  while (valid_block_hash(block) == 0)
+  uint8_t target[HASH_SIZE];
+  if (get_proof_of_work_target(target, block->bits))
   {
-    block->nonce++;
-    if (compute_block_hash(block->hash, block))
+    LOG_ERROR("Cannot compute block with invalid proof-of-work bits: %u!", block->bits);
+    return COMPUTE_BLOCK_FAILED;
+  }
+
+  uint8_t header[BLOCK_HEADER_SIZE];
+  if (get_block_header_data(header, block))
+  {
+    return COMPUTE_BLOCK_FAILED;
+  }
+
+  sha256d_header_ctx_t ctx;
+  if (crypto_sha256d_header_init(&ctx, header, BLOCK_HEADER_SIZE))
+  {
+    return COMPUTE_BLOCK_FAILED;
+  }
+
+  size_t num_lanes = crypto_sha256d_get_num_lanes();
+  assert(num_lanes <= SHA256D_MAX_LANES);
+
+  uint64_t nonce_range = worker != NULL ? worker->nonce_range : MINER_NONCE_SPACE_SIZE;
+  uint32_t nonce_start = block->nonce;
+  uint64_t nonce_offset = 0;
+  uint32_t num_unchecked_hashes = 0;
+
+  uint32_t nonces[SHA256D_MAX_LANES];
+  uint8_t hashes[SHA256D_MAX_LANES * HASH_SIZE];
+  while (1)
+  {
+    size_t num_hashes = (size_t)MIN((uint64_t)num_lanes, nonce_range - nonce_offset);
+    for (size_t i = 0; i < num_hashes; i++)
     {
-      return 1;
+      // written the same way the header is serialized by buffer_write_uint32
+      nonces[i] = swap_le((uint32_t)(nonce_start + nonce_offset + i));
     }
 
-    if (worker != NULL)
+    crypto_sha256d_header_hash_multi(hashes, &ctx, BLOCK_HEADER_NONCE_OFFSET, nonces, num_hashes);
+    num_unchecked_hashes += num_hashes;
+
+    for (size_t i = 0; i < num_hashes; i++)
     {
-      update_worker_hashrate(worker);
+      uint8_t *hash = hashes + (i * HASH_SIZE);
+      if (check_proof_of_work_target(hash, target))
+      {
+        if (worker != NULL)
+        {
+          atomic_fetch_add_explicit(&worker->num_hashes, num_unchecked_hashes, memory_order_relaxed);
+        }
+
+        block->nonce = (uint32_t)(nonce_start + nonce_offset + i);
+        memcpy(block->hash, hash, HASH_SIZE);
+        return COMPUTE_BLOCK_FOUND;
+      }
     }
-  }
 
-  return 0;
+    // refresh the timestamp once every nonce of the range has been tried
+    nonce_offset += num_hashes;
+    if (nonce_offset >= nonce_range)
+    {
+      block->timestamp = get_current_time();
+      set_header_uint32(ctx.first_block, BLOCK_HEADER_TIMESTAMP_OFFSET, block->timestamp);
+      nonce_offset = 0;
+    }
+
+    if (worker == NULL)
+    {
+      continue;
+    }
+
+    // the hashes are only published to the sampling task along with the template checks
+    if (num_unchecked_hashes >= MINER_TEMPLATE_CHECK_NUM_HASHES)
+    {
+      atomic_fetch_add_explicit(&worker->num_hashes, num_unchecked_hashes, memory_order_relaxed);
+      num_unchecked_hashes = 0;
+      if (worker->running == 0 || g_miner_workers_paused)
+      {
+        return COMPUTE_BLOCK_STALE;
+      }
+
+      refresh_miner_template();
+      if (get_miner_template_generation() != worker->template_generation)
+      {
+        return COMPUTE_BLOCK_STALE;
+      }
+    }
+  }
 }
 
 static int worker_mining_thread(void *arg)
@@ -219,6 +502,13 @@ static int worker_mining_thread(void *arg)
   miner_worker_t *worker = (miner_worker_t*)arg;
   assert(worker != NULL);
 
+  // pinned before the worker copies any block template of it's own
+  set_current_thread_affinity(THREAD_AFFINITY_MINER, worker->id);
+
+  char thread_name[TRACE_MAX_THREAD_NAME_SIZE];
+  snprintf(thread_name, sizeof(thread_name), "miner worker %hu", worker->id);
+  set_trace_thread_name(thread_name);
+
   if (g_miner_generate_genesis)
   {
     block_t *genesis_block = construct_computable_genesis_block(g_current_wallet);
@@ -247,10 +537,7 @@ static int worker_mining_thread(void *arg)
     exit(0);
   }
 
-  block_t *previous_block = NULL;
-  block_t *block = NULL;
-
-  while (g_miner_initialized)
+  while (g_miner_initialized && worker->running)
   {
     if (g_miner_workers_paused)
     {
@@ -258,27 +545,42 @@ static int worker_mining_thread(void *arg)
       continue;
     }
 
-    previous_block = get_current_block();
-    assert(previous_block != NULL);
-
-    block_t *block = construct_computable_block(worker, g_current_wallet, previous_block);
-    assert(block != NULL);
+    block_t *block = get_miner_work(worker);
+    if (block == NULL)
+    {
+      sleep(1);
+      continue;
+    }
 
-    if (compute_block(worker, block))
+    compute_block_result_t result = compute_block(worker, block);
+    if (result == COMPUTE_BLOCK_FAILED)
     {
       char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
       LOG_ERROR("Failed to compute newly constructed block: %s", block_hash_str);
       free(block_hash_str);
+      free_block(block);
       goto worker_thread_fail;
     }
 
-    if (validate_and_insert_block(block) == 0)
+    if (result == COMPUTE_BLOCK_FOUND)
     {
-      LOG_INFO("Worker[%hu]: found block at height: %u!", worker->id, get_block_height());
-      print_block(block);
+      if (validate_and_insert_block(block) == 0)
+      {
+        atomic_fetch_add_explicit(&worker->num_blocks_found, 1, memory_order_relaxed);
+        LOG_INFO("Worker[%hu]: found block at height: %u!", worker->id, get_block_height());
+        print_block(block);
+      }
+      else
+      {
+        // another block was connected on top of the same tip first
+        atomic_fetch_add_explicit(&worker->num_stale_blocks, 1, memory_order_relaxed);
+      }
+    }
+    else if (get_miner_template_generation() != worker->template_generation)
+    {
+      atomic_fetch_add_explicit(&worker->num_stale_blocks, 1, memory_order_relaxed);
     }
 
-    free_block(previous_block);
     free_block(block);
   }
 
@@ -289,23 +591,28 @@ worker_thread_fail:
   return 1;
 }
 
-static task_result_t report_worker_mining_status(task_t *task, va_list args)
+static task_result_t sample_worker_hashrates(task_t *task, va_list args)
 {
+  uint64_t current_time = get_monotonic_time_ms();
   for (int i = 0; i < g_num_worker_threads; i++)
   {
     miner_worker_t *worker = g_miner_workers[i];
     assert(worker != NULL);
+    sample_worker_hashrate(worker, current_time);
+  }
 
-    if (g_miner_workers_paused)
-    {
-      LOG_INFO("Worker[%u]: miner thread paused, waiting for resume...", worker->id);
-    }
-    else
-    {
-      LOG_INFO("Worker[%u]: miner thread running [%u h/s]", worker->id, worker->last_hashrate);
-    }
+  return TASK_RESULT_WAIT;
+}
+
+static task_result_t report_worker_mining_status(task_t *task, va_list args)
+{
+  if (g_miner_workers_paused)
+  {
+    LOG_INFO("Miner threads paused, waiting for resume...");
+    return TASK_RESULT_WAIT;
   }
 
+  print_miner_stats();
   return TASK_RESULT_WAIT;
 }
 
@@ -338,6 +645,63 @@ void wait_for_threads_to_stop(void)
   }
 }
 
+static void write_miner_metrics(buffer_t *buffer)
+{
+  miner_stats_t stats;
+  if (get_miner_stats(&stats))
+  {
+    return;
+  }
+
+  write_metric_header(buffer, "vulkan_miner_hashrate", "Hashes per second of the miner workers by moving average window", "gauge");
+  write_metric_value(buffer, "vulkan_miner_hashrate", "window", "10s", stats.hashrate_10s);
+  write_metric_value(buffer, "vulkan_miner_hashrate", "window", "1m", stats.hashrate_1m);
+  write_metric_value(buffer, "vulkan_miner_hashrate", "window", "15m", stats.hashrate_15m);
+  write_metric_header(buffer, "vulkan_miner_hashes_total", "Hashes computed by the miner workers", "counter");
+  write_metric_value(buffer, "vulkan_miner_hashes_total", NULL, NULL, (double)stats.num_hashes);
+  write_metric_header(buffer, "vulkan_miner_blocks_total", "Blocks found by the miner workers by whether they were inserted", "counter");
+  write_metric_value(buffer, "vulkan_miner_blocks_total", "result", "found", stats.num_blocks_found);
+  write_metric_value(buffer, "vulkan_miner_blocks_total", "result", "stale", stats.num_stale_blocks);
+}
+
+/*
+ * Sets up the block template shared by the workers, this is done by start_mining
+ * before any of the workers are started. The template is built from the current wallet.
+ */
+int init_miner_template(void)
+{
+  if (g_miner_template_initialized)
+  {
+    return 1;
+  }
+
+  mtx_init(&g_miner_lock, mtx_recursive);
+  g_miner_template = NULL;
+  memset(g_miner_template_previous_hash, 0, HASH_SIZE);
+  g_miner_template_mempool_generation = 0;
+  g_miner_template_timestamp = 0;
+  g_miner_template_initialized = 1;
+  return 0;
+}
+
+int deinit_miner_template(void)
+{
+  if (g_miner_template_initialized == 0)
+  {
+    return 1;
+  }
+
+  if (g_miner_template != NULL)
+  {
+    free_block(g_miner_template);
+    g_miner_template = NULL;
+  }
+
+  mtx_destroy(&g_miner_lock);
+  g_miner_template_initialized = 0;
+  return 0;
+}
+
 int start_mining(void)
 {
   assert(g_current_wallet != NULL);
@@ -346,21 +710,32 @@ int start_mining(void)
     return 1;
   }
 
-  mtx_init(&g_miner_lock, mtx_recursive);
+  if (init_miner_template())
+  {
+    return 1;
+  }
+
+  // select the sha256d backend before any of the worker threads use it
+  LOG_INFO("Mining with sha256d backend: %s (%zu lanes)", crypto_sha256d_get_backend_name(), crypto_sha256d_get_num_lanes());
 
   g_miner_initialized = 1;
   g_miner_worker_status_task = add_task(report_worker_mining_status, WORKER_STATUS_TASK_DELAY);
+  g_miner_worker_sample_task = add_task(sample_worker_hashrates, WORKER_HASHRATE_SAMPLE_DELAY);
 
   if (g_miner_generate_genesis)
   {
     LOG_INFO("Creating new genesis block, this may take a while...");
   }
 
+  // the workers split the nonces of the shared template between them
+  uint64_t nonce_range = MINER_NONCE_SPACE_SIZE / g_num_worker_threads;
   for (uint16_t i = 0; i < g_num_worker_threads; i++)
   {
     miner_worker_t *worker = init_worker();
     worker->id = i;
     worker->running = 1;
+    worker->nonce_start_offset = (uint32_t)(nonce_range * i);
+    worker->nonce_range = nonce_range;
     if (thrd_create(&worker->thread, worker_mining_thread, worker) != thrd_success)
     {
       LOG_ERROR("Failed to start mining thread: %hu!", i);
@@ -370,6 +745,7 @@ int start_mining(void)
     g_miner_workers[i] = worker;
   }
 
+  register_metrics_collector(write_miner_metrics);
   LOG_INFO("Started mining on [%hu] threads...", g_num_worker_threads);
   if (g_miner_generate_genesis)
   {
@@ -389,7 +765,9 @@ int stop_mining(void)
   }
 
   remove_task(g_miner_worker_status_task);
-  mtx_destroy(&g_miner_lock);
+  remove_task(g_miner_worker_sample_task);
+  unregister_metrics_collector(write_miner_metrics);
+  deinit_miner_template();
 
   for (int i = 0; i < g_num_worker_threads; i++)
   {
@@ -401,6 +779,7 @@ int stop_mining(void)
   g_miner_initialized = 0;
   g_current_wallet = NULL;
   g_miner_worker_status_task = NULL;
+  g_miner_worker_sample_task = NULL;
   g_num_worker_threads = 0;
   return 0;
 }
@@ -27,12 +27,14 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 #include "common/task.h"
 #include "common/util.h"
 #include "common/vulkan.h"
 
 #include "core/block.h"
+#include "core/blockchain.h"
 
 #include "wallet/wallet.h"
 
@@ -41,16 +43,66 @@ VULKAN_BEGIN_DECL
 #define MAX_NUM_WORKER_THREADS 1024
 #define WORKER_STATUS_TASK_DELAY 10
 
+// the hashes of the workers are sampled this often in seconds into
+// exponentially weighted averages over each of these windows...
+#define WORKER_HASHRATE_SAMPLE_DELAY 1
+#define WORKER_HASHRATE_WINDOW_10S 10
+#define WORKER_HASHRATE_WINDOW_1M 60
+#define WORKER_HASHRATE_WINDOW_15M (15 * 60)
+
+// the number of nonces that can be tried before the block's timestamp must change
+#define MINER_NONCE_SPACE_SIZE ((uint64_t)UINT32_MAX + 1)
+
+// workers look for a newer block template after every this many hashes, changes of
+// the mempool are only picked up once the template is at least this many seconds old...
+#define MINER_TEMPLATE_CHECK_NUM_HASHES (1 << 16)
+#define MINER_TEMPLATE_MEMPOOL_REFRESH_DELAY 1
+
+typedef enum ComputeBlockResult
+{
+  COMPUTE_BLOCK_FOUND = 0,
+  COMPUTE_BLOCK_FAILED,
+  COMPUTE_BLOCK_STALE
+} compute_block_result_t;
+
 typedef struct MinerWorker
 {
   thrd_t thread;
   uint16_t id;
   int running;
 
-  uint32_t last_timestamp;
-  uint32_t last_hashrate;
+  // counted by the worker without a lock and read by the sampling task
+  atomic_uint_fast64_t num_hashes;
+  atomic_uint num_blocks_found;
+  atomic_uint num_stale_blocks;
+
+  // only updated by the sampling task
+  uint64_t last_sample_num_hashes;
+  uint64_t last_sample_time;
+  int hashrate_sampled;
+  double hashrate_10s;
+  double hashrate_1m;
+  double hashrate_15m;
+
+  // the worker's own range of nonces of the shared block template,
+  // starting this far from the nonce the template was built with
+  uint32_t nonce_start_offset;
+  uint64_t nonce_range;
+  unsigned int template_generation;
 } miner_worker_t;
 
+typedef struct MinerStats
+{
+  uint16_t num_workers;
+  uint64_t num_hashes;
+  uint32_t num_blocks_found;
+  uint32_t num_stale_blocks;
+
+  double hashrate_10s;
+  double hashrate_1m;
+  double hashrate_15m;
+} miner_stats_t;
+
 VULKAN_API int get_is_miner_initialized(void);
 
 VULKAN_API void set_num_worker_threads(uint16_t num_worker_threads);
@@ -68,9 +120,21 @@ VULKAN_API int get_miner_generate_genesis(void);
 VULKAN_API miner_worker_t* init_worker(void);
 VULKAN_API void free_worker(miner_worker_t *worker);
 
-VULKAN_API block_t* construct_computable_block(miner_worker_t *worker, wallet_t *wallet, block_t *previous_block);
+VULKAN_API void sample_worker_hashrate(miner_worker_t *worker, uint64_t current_time);
+VULKAN_API int get_miner_stats(miner_stats_t *stats);
+VULKAN_API void print_miner_stats(void);
+
+VULKAN_API block_t* construct_computable_block(wallet_t *wallet, blockchain_tip_t *tip, block_t *previous_block);
 VULKAN_API block_t* construct_computable_genesis_block(wallet_t *wallet);
-VULKAN_API int compute_block(miner_worker_t *worker, block_t *block);
+
+VULKAN_API int init_miner_template(void);
+VULKAN_API int deinit_miner_template(void);
+
+VULKAN_API int refresh_miner_template(void);
+VULKAN_API unsigned int get_miner_template_generation(void);
+VULKAN_API block_t* get_miner_work(miner_worker_t *worker);
+
+VULKAN_API compute_block_result_t compute_block(miner_worker_t *worker, block_t *block);
 
 VULKAN_API void killall_threads(void);
 VULKAN_API void wait_for_threads_to_stop(void);
@@ -0,0 +1,588 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common/logger.h"
+#include "common/task.h"
+#include "common/util.h"
+#include "common/vec.h"
+
+#include "core/block.h"
+#include "core/blockchain.h"
+#include "core/mempool.h"
+#include "core/net.h"
+#include "core/parameters.h"
+#include "core/pow.h"
+
+#include "miner.h"
+#include "mining_server.h"
+
+#include "wallet/wallet.h"
+
+// the listener is bound to the main network loop's manager, so the client events
+// and the job refresh task are all handled on the same thread without a lock...
+static int g_mining_server_running = 0;
+static int g_mining_server_initialized = 0;
+static uint16_t g_mining_server_port = 0;
+static wallet_t *g_mining_server_wallet = NULL;
+static struct mg_connection *g_mining_server_listener = NULL;
+static task_t *g_mining_server_task = NULL;
+static vec_void_t g_mining_server_clients;
+
+// the most recent jobs, oldest first. Every job is built on top of the same tip...
+static mining_server_job_t g_mining_server_jobs[MINING_SERVER_MAX_NUM_JOBS];
+static uint32_t g_mining_server_num_jobs = 0;
+static uint32_t g_mining_server_next_job_id = 0;
+static uint8_t g_mining_server_previous_hash[HASH_SIZE];
+static uint64_t g_mining_server_mempool_generation = 0;
+static uint32_t g_mining_server_job_timestamp = 0;
+
+void set_mining_server_port(uint16_t port)
+{
+  g_mining_server_port = port;
+}
+
+uint16_t get_mining_server_port(void)
+{
+  return g_mining_server_port;
+}
+
+int get_is_mining_server_running(void)
+{
+  return g_mining_server_running;
+}
+
+uint32_t get_mining_server_num_clients(void)
+{
+  return g_mining_server_running ? (uint32_t)g_mining_server_clients.length : 0;
+}
+
+static void free_mining_server_jobs(void)
+{
+  for (uint32_t i = 0; i < g_mining_server_num_jobs; i++)
+  {
+    mining_server_job_t *job = &g_mining_server_jobs[i];
+    assert(job->block != NULL);
+    free_block(job->block);
+    job->block = NULL;
+  }
+
+  g_mining_server_num_jobs = 0;
+}
+
+static mining_server_job_t* get_mining_server_job(uint32_t job_id)
+{
+  for (uint32_t i = 0; i < g_mining_server_num_jobs; i++)
+  {
+    mining_server_job_t *job = &g_mining_server_jobs[i];
+    if (job->id == job_id)
+    {
+      return job;
+    }
+  }
+
+  return NULL;
+}
+
+mining_server_job_t* get_latest_mining_server_job(void)
+{
+  if (g_mining_server_num_jobs == 0)
+  {
+    return NULL;
+  }
+
+  return &g_mining_server_jobs[g_mining_server_num_jobs - 1];
+}
+
+static int send_mining_server_response(mining_server_client_t *client, const char *format, ...)
+{
+  assert(client != NULL);
+  char response[MINING_SERVER_MAX_RESPONSE_SIZE];
+  va_list args;
+  va_start(args, format);
+  int response_size = vsnprintf(response, sizeof(response) - 1, format, args);
+  va_end(args);
+  if (response_size < 0 || response_size >= (int)sizeof(response) - 1)
+  {
+    return 1;
+  }
+
+  response[response_size++] = '\n';
+  mg_send(client->connection, response, response_size);
+  return 0;
+}
+
+static int notify_mining_server_client(mining_server_client_t *client, mining_server_job_t *job, int clean)
+{
+  assert(client != NULL);
+  assert(job != NULL);
+
+  uint8_t header[BLOCK_HEADER_SIZE];
+  if (get_block_header_data(header, job->block))
+  {
+    return 1;
+  }
+
+  uint8_t target[HASH_SIZE];
+  if (get_proof_of_work_target(target, job->block->bits))
+  {
+    return 1;
+  }
+
+  char *header_str = bin2hex(header, BLOCK_HEADER_SIZE);
+  char *target_str = bin2hex(target, HASH_SIZE);
+  int result = send_mining_server_response(client, "notify %08x %d %s %s", job->id, clean, header_str, target_str);
+  free(header_str);
+  free(target_str);
+  return result;
+}
+
+static void notify_mining_server_clients(int clean)
+{
+  mining_server_job_t *job = get_latest_mining_server_job();
+  assert(job != NULL);
+
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&g_mining_server_clients, value, index)
+  {
+    mining_server_client_t *client = (mining_server_client_t*)value;
+    assert(client != NULL);
+    if (client->subscribed == 0)
+    {
+      continue;
+    }
+
+    if (notify_mining_server_client(client, job, clean))
+    {
+      LOG_WARNING("Failed to notify mining server client of job: %08x!", job->id);
+    }
+  }
+}
+
+static int add_mining_server_job(blockchain_tip_t *tip, int clean)
+{
+  assert(tip != NULL);
+  block_t *previous_block = get_block_header_from_hash_at_tip(tip, tip->hash);
+  if (previous_block == NULL)
+  {
+    return 1;
+  }
+
+  // txs added while the job is built make it stale again on the next refresh
+  uint64_t mempool_generation = get_mempool_generation();
+  block_t *block = construct_computable_block(g_mining_server_wallet, tip, previous_block);
+  free_block(previous_block);
+  if (block == NULL)
+  {
+    return 1;
+  }
+
+  // a new tip makes every earlier job stale, otherwise only the oldest job is dropped
+  if (clean)
+  {
+    free_mining_server_jobs();
+  }
+  else if (g_mining_server_num_jobs == MINING_SERVER_MAX_NUM_JOBS)
+  {
+    free_block(g_mining_server_jobs[0].block);
+    memmove(&g_mining_server_jobs[0], &g_mining_server_jobs[1], sizeof(mining_server_job_t) * (MINING_SERVER_MAX_NUM_JOBS - 1));
+    g_mining_server_num_jobs--;
+  }
+
+  mining_server_job_t *job = &g_mining_server_jobs[g_mining_server_num_jobs++];
+  job->id = g_mining_server_next_job_id++;
+  job->block = block;
+
+  memcpy(g_mining_server_previous_hash, tip->hash, HASH_SIZE);
+  g_mining_server_mempool_generation = mempool_generation;
+  g_mining_server_job_timestamp = get_current_time();
+  return 0;
+}
+
+/*
+ * Builds a new job and pushes it to the subscribed clients if the blockchain tip changed,
+ * or the mempool changed and the latest job has been handed out for long enough.
+ */
+int refresh_mining_server_jobs(void)
+{
+  if (g_mining_server_initialized == 0)
+  {
+    return 1;
+  }
+
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  if (tip == NULL)
+  {
+    return 1;
+  }
+
+  int clean = 0;
+  if (g_mining_server_num_jobs == 0 || compare_hash(tip->hash, g_mining_server_previous_hash) == 0)
+  {
+    clean = 1;
+  }
+  else if (get_mempool_generation() == g_mining_server_mempool_generation ||
+    get_current_time() - g_mining_server_job_timestamp < MINING_SERVER_MEMPOOL_REFRESH_DELAY)
+  {
+    release_blockchain_tip(tip);
+    return 0;
+  }
+
+  if (add_mining_server_job(tip, clean))
+  {
+    release_blockchain_tip(tip);
+    return 1;
+  }
+
+  release_blockchain_tip(tip);
+  notify_mining_server_clients(clean);
+  return 0;
+}
+
+const char* get_mining_server_submit_result_str(mining_server_submit_result_t result)
+{
+  switch (result)
+  {
+    case MINING_SERVER_SUBMIT_ACCEPTED:
+      return "accepted";
+    case MINING_SERVER_SUBMIT_MALFORMED:
+      return "malformed";
+    case MINING_SERVER_SUBMIT_STALE:
+      return "stale";
+    case MINING_SERVER_SUBMIT_INVALID_TIMESTAMP:
+      return "invalid-timestamp";
+    case MINING_SERVER_SUBMIT_LOW_DIFFICULTY:
+      return "low-difficulty";
+    default:
+      return "invalid-block";
+  }
+}
+
+/*
+ * Checks the work submitted for one of our jobs and inserts the block it completes,
+ * the args are the job id, timestamp and nonce of a submit request in hex.
+ */
+mining_server_submit_result_t submit_mining_server_work(const char *args, uint32_t *job_id_out)
+{
+  assert(args != NULL);
+  assert(job_id_out != NULL);
+
+  unsigned int job_id = 0;
+  unsigned int timestamp = 0;
+  unsigned int nonce = 0;
+  int num_args = sscanf(args, "%x %x %x", &job_id, &timestamp, &nonce);
+  *job_id_out = (uint32_t)job_id;
+  if (num_args != 3)
+  {
+    return MINING_SERVER_SUBMIT_MALFORMED;
+  }
+
+  mining_server_job_t *job = get_mining_server_job((uint32_t)job_id);
+  if (job == NULL)
+  {
+    return MINING_SERVER_SUBMIT_STALE;
+  }
+
+  // the timestamp may only be rolled forward, up to the furthest time a block is accepted at
+  if (timestamp < job->block->timestamp || timestamp > get_current_time() + MAX_FUTURE_BLOCK_TIME)
+  {
+    return MINING_SERVER_SUBMIT_INVALID_TIMESTAMP;
+  }
+
+  block_t *block = make_block();
+  assert(copy_block(job->block, block) == 0);
+  block->timestamp = (uint32_t)timestamp;
+  block->nonce = (uint32_t)nonce;
+  if (compute_block_hash(block->hash, block) || valid_block_hash(block) == 0)
+  {
+    free_block(block);
+    return MINING_SERVER_SUBMIT_LOW_DIFFICULTY;
+  }
+
+  if (validate_and_insert_block(block))
+  {
+    free_block(block);
+    return MINING_SERVER_SUBMIT_INVALID_BLOCK;
+  }
+
+  char *block_hash_str = bin2hex(block->hash, HASH_SIZE);
+  LOG_INFO("Mining server: accepted block %s at height: %u!", block_hash_str, get_block_height());
+  free(block_hash_str);
+  free_block(block);
+  return MINING_SERVER_SUBMIT_ACCEPTED;
+}
+
+static int handle_mining_server_submit(mining_server_client_t *client, const char *args)
+{
+  assert(client != NULL);
+  assert(args != NULL);
+
+  uint32_t job_id = 0;
+  mining_server_submit_result_t result = submit_mining_server_work(args, &job_id);
+  if (result != MINING_SERVER_SUBMIT_ACCEPTED)
+  {
+    client->num_rejected++;
+    return send_mining_server_response(client, "rejected %08x %s", job_id, get_mining_server_submit_result_str(result));
+  }
+
+  client->num_accepted++;
+  int response_result = send_mining_server_response(client, "accepted %08x", job_id);
+
+  // hand the job built on top of the new block out right away
+  refresh_mining_server_jobs();
+  return response_result;
+}
+
+static int handle_mining_server_request(mining_server_client_t *client, const char *request)
+{
+  assert(client != NULL);
+  assert(request != NULL);
+  if (strcmp(request, "subscribe") == 0)
+  {
+    client->subscribed = 1;
+    refresh_mining_server_jobs();
+
+    mining_server_job_t *job = get_latest_mining_server_job();
+    if (job == NULL)
+    {
+      return send_mining_server_response(client, "error no-work");
+    }
+
+    return notify_mining_server_client(client, job, 1);
+  }
+  else if (strncmp(request, "submit ", 7) == 0)
+  {
+    return handle_mining_server_submit(client, request + 7);
+  }
+
+  return send_mining_server_response(client, "error unknown-request");
+}
+
+static void mining_server_data_received(mining_server_client_t *client, struct mbuf *io)
+{
+  assert(client != NULL);
+  assert(io != NULL);
+
+  size_t offset = 0;
+  while (offset < io->len)
+  {
+    char *request_start = io->buf + offset;
+    char *request_end = memchr(request_start, '\n', io->len - offset);
+    if (request_end == NULL)
+    {
+      break;
+    }
+
+    size_t request_size = (size_t)(request_end - request_start);
+    offset += request_size + 1;
+    if (request_size > 0 && request_start[request_size - 1] == '\r')
+    {
+      request_size--;
+    }
+
+    if (request_size == 0)
+    {
+      continue;
+    }
+
+    if (request_size > MINING_SERVER_MAX_REQUEST_SIZE)
+    {
+      client->connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+      break;
+    }
+
+    char request[MINING_SERVER_MAX_REQUEST_SIZE + 1];
+    memcpy(request, request_start, request_size);
+    request[request_size] = '\0';
+    if (handle_mining_server_request(client, request))
+    {
+      LOG_WARNING("Failed to handle mining server request: %s!", request);
+    }
+  }
+
+  // drop clients which send a request that would never fit
+  if (io->len - offset > MINING_SERVER_MAX_REQUEST_SIZE)
+  {
+    client->connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+    offset = io->len;
+  }
+
+  mbuf_remove(io, offset);
+}
+
+static void mining_server_ev_handler(struct mg_connection *connection, int ev, void *p)
+{
+  assert(connection != NULL);
+  mining_server_client_t *client = (mining_server_client_t*)connection->user_data;
+  switch (ev)
+  {
+    case MG_EV_ACCEPT:
+      {
+        if (g_mining_server_running == 0 || g_mining_server_clients.length >= MINING_SERVER_MAX_NUM_CLIENTS)
+        {
+          connection->user_data = NULL;
+          connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+          break;
+        }
+
+        client = malloc(sizeof(mining_server_client_t));
+        assert(client != NULL);
+        client->connection = connection;
+        client->subscribed = 0;
+        client->num_accepted = 0;
+        client->num_rejected = 0;
+        connection->user_data = client;
+        assert(vec_push(&g_mining_server_clients, client) == 0);
+      }
+      break;
+    case MG_EV_RECV:
+      if (client != NULL)
+      {
+        mining_server_data_received(client, &connection->recv_mbuf);
+      }
+      else
+      {
+        mbuf_remove(&connection->recv_mbuf, connection->recv_mbuf.len);
+      }
+      break;
+    case MG_EV_CLOSE:
+      if (client != NULL)
+      {
+        vec_remove(&g_mining_server_clients, client);
+        connection->user_data = NULL;
+        free(client);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static task_result_t update_mining_server_jobs(task_t *task, va_list args)
+{
+  refresh_mining_server_jobs();
+  return TASK_RESULT_WAIT;
+}
+
+/*
+ * Sets up the jobs handed out to the clients, this is done by start_mining_server
+ * before the listener accepts any clients.
+ */
+int init_mining_server(wallet_t *wallet)
+{
+  assert(wallet != NULL);
+  if (g_mining_server_initialized)
+  {
+    return 1;
+  }
+
+  g_mining_server_wallet = wallet;
+  g_mining_server_num_jobs = 0;
+  g_mining_server_initialized = 1;
+  return 0;
+}
+
+int deinit_mining_server(void)
+{
+  if (g_mining_server_initialized == 0)
+  {
+    return 1;
+  }
+
+  free_mining_server_jobs();
+  g_mining_server_wallet = NULL;
+  g_mining_server_initialized = 0;
+  return 0;
+}
+
+int start_mining_server(wallet_t *wallet)
+{
+  assert(wallet != NULL);
+  if (g_mining_server_running)
+  {
+    return 1;
+  }
+
+  if (g_mining_server_port == 0)
+  {
+    g_mining_server_port = parameters_get_mining_port();
+  }
+
+  char *bind_address = convert_to_addr_str(get_net_host_address(), g_mining_server_port);
+  g_mining_server_listener = mg_bind(get_net_mgr(), bind_address, mining_server_ev_handler);
+  if (g_mining_server_listener == NULL)
+  {
+    LOG_ERROR("Failed to bind mining server on address: %s!", bind_address);
+    free(bind_address);
+    return 1;
+  }
+
+  LOG_INFO("Started mining server on address: %s...", bind_address);
+  free(bind_address);
+
+  g_mining_server_listener->user_data = NULL;
+  vec_init(&g_mining_server_clients);
+  init_mining_server(wallet);
+  g_mining_server_running = 1;
+  g_mining_server_task = add_task(update_mining_server_jobs, MINING_SERVER_TASK_DELAY);
+  return 0;
+}
+
+int stop_mining_server(void)
+{
+  if (g_mining_server_running == 0)
+  {
+    return 1;
+  }
+
+  remove_task(g_mining_server_task);
+
+  // the connections are closed by the next poll of the network loop, or when it's free'd
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&g_mining_server_clients, value, index)
+  {
+    mining_server_client_t *client = (mining_server_client_t*)value;
+    assert(client != NULL);
+    client->connection->user_data = NULL;
+    client->connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+    free(client);
+  }
+
+  g_mining_server_listener->flags |= MG_F_CLOSE_IMMEDIATELY;
+  vec_deinit(&g_mining_server_clients);
+  deinit_mining_server();
+
+  g_mining_server_running = 0;
+  g_mining_server_listener = NULL;
+  g_mining_server_task = NULL;
+  return 0;
+}
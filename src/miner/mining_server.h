@@ -0,0 +1,107 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <mongoose.h>
+
+#include "common/vulkan.h"
+
+#include "core/block.h"
+
+#include "wallet/wallet.h"
+
+VULKAN_BEGIN_DECL
+
+/*
+ * The mining server hands block header templates out to external hashers over
+ * newline terminated text requests on the main network loop, in the spirit of stratum:
+ *
+ *   client: subscribe
+ *   server: notify <job_id> <clean> <header_hex> <target_hex>
+ *   client: submit <job_id> <timestamp_hex> <nonce_hex>
+ *   server: accepted <job_id> | rejected <job_id> <reason>
+ *
+ * The header is hashed with sha256d, the timestamp and nonce are written little-endian
+ * at BLOCK_HEADER_TIMESTAMP_OFFSET and BLOCK_HEADER_NONCE_OFFSET. A clean notify means
+ * the tip changed and every earlier job is stale...
+ */
+#define MINING_SERVER_MAX_REQUEST_SIZE 256
+#define MINING_SERVER_MAX_RESPONSE_SIZE 512
+#define MINING_SERVER_MAX_NUM_JOBS 4
+#define MINING_SERVER_MAX_NUM_CLIENTS 256
+
+// the tip is checked for changes this often in seconds, mempool changes are only
+// handed out to the clients once the current job is at least this many seconds old...
+#define MINING_SERVER_TASK_DELAY 0.05
+#define MINING_SERVER_MEMPOOL_REFRESH_DELAY 5
+
+typedef enum MiningServerSubmitResult
+{
+  MINING_SERVER_SUBMIT_ACCEPTED = 0,
+  MINING_SERVER_SUBMIT_MALFORMED,
+  MINING_SERVER_SUBMIT_STALE,
+  MINING_SERVER_SUBMIT_INVALID_TIMESTAMP,
+  MINING_SERVER_SUBMIT_LOW_DIFFICULTY,
+  MINING_SERVER_SUBMIT_INVALID_BLOCK
+} mining_server_submit_result_t;
+
+typedef struct MiningServerJob
+{
+  uint32_t id;
+  block_t *block;
+} mining_server_job_t;
+
+typedef struct MiningServerClient
+{
+  struct mg_connection *connection;
+  int subscribed;
+
+  uint32_t num_accepted;
+  uint32_t num_rejected;
+} mining_server_client_t;
+
+VULKAN_API void set_mining_server_port(uint16_t port);
+VULKAN_API uint16_t get_mining_server_port(void);
+
+VULKAN_API int get_is_mining_server_running(void);
+VULKAN_API uint32_t get_mining_server_num_clients(void);
+
+VULKAN_API int refresh_mining_server_jobs(void);
+VULKAN_API mining_server_job_t* get_latest_mining_server_job(void);
+
+VULKAN_API const char* get_mining_server_submit_result_str(mining_server_submit_result_t result);
+VULKAN_API mining_server_submit_result_t submit_mining_server_work(const char *args, uint32_t *job_id_out);
+
+VULKAN_API int init_mining_server(wallet_t *wallet);
+VULKAN_API int deinit_mining_server(void);
+
+VULKAN_API int start_mining_server(wallet_t *wallet);
+VULKAN_API int stop_mining_server(void);
+
+VULKAN_END_DECL
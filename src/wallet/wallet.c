@@ -32,19 +32,15 @@
 
 #include <sodium.h>
 
-#ifdef USE_LEVELDB
-#include <leveldb/c.h>
-#else
-#include <rocksdb/c.h>
-#endif
-
 #include "common/buffer.h"
 #include "common/logger.h"
 #include "common/util.h"
 
+#include "core/block_filter.h"
 #include "core/blockchain.h"
 #include "core/mempool.h"
 #include "core/parameters.h"
+#include "core/storage.h"
 
 #include "crypto/sha256d.h"
 
@@ -55,12 +51,37 @@ wallet_t* make_wallet(void)
   wallet_t *wallet = malloc(sizeof(wallet_t));
   assert(wallet != NULL);
   wallet->balance = 0;
+  wallet->db = NULL;
+  vec_init(&wallet->outputs);
+  memset(wallet->synced_block_hash, 0, HASH_SIZE);
+  mtx_init(&wallet->lock, mtx_plain);
   return wallet;
 }
 
+static void free_wallet_outputs(wallet_t *wallet)
+{
+  assert(wallet != NULL);
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&wallet->outputs, value, index)
+  {
+    free(value);
+  }
+
+  vec_clear(&wallet->outputs);
+}
+
 void free_wallet(wallet_t *wallet)
 {
   assert(wallet != NULL);
+  free_wallet_outputs(wallet);
+  vec_deinit(&wallet->outputs);
+  if (wallet->db != NULL)
+  {
+    storage_close(wallet->db);
+  }
+
+  mtx_destroy(&wallet->lock);
   free(wallet);
 }
 
@@ -131,54 +152,46 @@ void get_data_key(uint8_t *buffer)
   memcpy(buffer, DB_KEY_PREFIX_DATA, DB_KEY_PREFIX_SIZE_DATA);
 }
 
-/*
- * open_wallet()
- * Opens a LevelDB instance for the wallet
- */
-#ifdef USE_LEVELDB
-leveldb_t* open_wallet(const char *wallet_dir, char *err)
+void get_output_key(uint8_t *buffer, uint8_t *tx_id, uint32_t txout_index)
 {
-  leveldb_t *db;
-  leveldb_options_t *options = leveldb_options_create();
-  leveldb_options_set_create_if_missing(options, 1);
-
-  db = leveldb_open(options, wallet_dir, &err);
-  leveldb_options_destroy(options);
-  return db;
+  assert(buffer != NULL);
+  assert(tx_id != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_OUTPUT, DB_KEY_PREFIX_SIZE_OUTPUT);
+  buffer += DB_KEY_PREFIX_SIZE_OUTPUT;
+  memcpy(buffer, tx_id, HASH_SIZE);
+  buffer += HASH_SIZE;
+
+  buffer[0] = (uint8_t)(txout_index >> 24);
+  buffer[1] = (uint8_t)(txout_index >> 16);
+  buffer[2] = (uint8_t)(txout_index >> 8);
+  buffer[3] = (uint8_t)txout_index;
 }
-#else
-rocksdb_t* open_wallet(const char *wallet_dir, char *err)
+
+void get_synced_block_key(uint8_t *buffer)
 {
-  rocksdb_t *db;
-  rocksdb_options_t *options = rocksdb_options_create();
-  rocksdb_options_set_create_if_missing(options, 1);
+  assert(buffer != NULL);
+  memcpy(buffer, DB_KEY_PREFIX_SYNCED_BLOCK, DB_KEY_PREFIX_SIZE_SYNCED_BLOCK);
+}
 
-  db = rocksdb_open(options, wallet_dir, &err);
-  rocksdb_options_destroy(options);
-  return db;
+/*
+ * open_wallet()
+ * Opens the storage instance for the wallet
+ */
+storage_t* open_wallet(const char *wallet_dir, char **err)
+{
+  storage_options_t options;
+  init_storage_options(&options);
+  return storage_open(wallet_dir, &options, err);
 }
-#endif
 
 int new_wallet(const char *wallet_dir, wallet_t **wallet_out)
 {
   char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_t *db = open_wallet(wallet_dir, err);
-#else
-  rocksdb_t *db = open_wallet(wallet_dir, err);
-#endif
-
+  storage_t *db = open_wallet(wallet_dir, &err);
   if (err != NULL)
   {
     LOG_ERROR("Could not open wallet: %s: %s", wallet_dir, err);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_close(db);
-  #else
-    rocksdb_free(err);
-    rocksdb_close(db);
-  #endif
+    storage_free(err);
     return 1;
   }
 
@@ -186,25 +199,12 @@ int new_wallet(const char *wallet_dir, wallet_t **wallet_out)
   get_data_key(key);
 
   size_t read_len;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  uint8_t *initialized = (uint8_t*)leveldb_get(db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  uint8_t *initialized = (uint8_t*)rocksdb_get(db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#endif
-
+  uint8_t *initialized = storage_get(db, key, sizeof(key), &read_len, &err);
   if (initialized != NULL)
   {
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_readoptions_destroy(roptions);
-    leveldb_close(db);
-  #else
-    rocksdb_free(err);
-    rocksdb_readoptions_destroy(roptions);
-    rocksdb_close(db);
-  #endif
+    storage_free(initialized);
+    storage_free(err);
+    storage_close(db);
     return 1;
   }
 
@@ -229,44 +229,19 @@ int new_wallet(const char *wallet_dir, wallet_t **wallet_out)
   const uint8_t *data = buffer_get_data(buffer);
   uint32_t data_len = buffer_get_size(buffer);
 
-#ifdef USE_LEVELDB
-  leveldb_writeoptions_t *woptions = leveldb_writeoptions_create();
-  leveldb_put(db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#else
-  rocksdb_writeoptions_t *woptions = rocksdb_writeoptions_create();
-  rocksdb_put(db, woptions, (char*)key, sizeof(key), (char*)data, data_len, &err);
-#endif
+  storage_put(db, key, sizeof(key), data, data_len, &err);
   buffer_free(buffer);
 
   if (err != NULL)
   {
     LOG_ERROR("Could not write to wallet database: %s: %s", wallet_dir, err);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_readoptions_destroy(roptions);
-    leveldb_writeoptions_destroy(woptions);
-    leveldb_close(db);
-  #else
-    rocksdb_free(err);
-    rocksdb_readoptions_destroy(roptions);
-    rocksdb_writeoptions_destroy(woptions);
-    rocksdb_close(db);
-  #endif
+    storage_free(err);
+    storage_close(db);
+    free_wallet(wallet);
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_writeoptions_destroy(woptions);
-  leveldb_close(db);
-#else
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_writeoptions_destroy(woptions);
-  rocksdb_close(db);
-#endif
+  storage_close(db);
 
   *wallet_out = wallet;
   LOG_INFO("Successfully created new wallet: %s", wallet_dir);
@@ -276,23 +251,11 @@ int new_wallet(const char *wallet_dir, wallet_t **wallet_out)
 int get_wallet(const char *wallet_dir, wallet_t **wallet_out)
 {
   char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_t *db = open_wallet(wallet_dir, err);
-#else
-  rocksdb_t *db = open_wallet(wallet_dir, err);
-#endif
-
+  storage_t *db = open_wallet(wallet_dir, &err);
   if (err != NULL)
   {
     LOG_ERROR("Could not open wallet database: %s: %s", wallet_dir, err);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_close(db);
-  #else
-    rocksdb_free(err);
-    rocksdb_close(db);
-  #endif
+    storage_free(err);
     return 1;
   }
 
@@ -300,14 +263,7 @@ int get_wallet(const char *wallet_dir, wallet_t **wallet_out)
   get_data_key(key);
 
   size_t read_len;
-#ifdef USE_LEVELDB
-  leveldb_readoptions_t *roptions = leveldb_readoptions_create();
-  uint8_t *wallet_data = (uint8_t*)leveldb_get(db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#else
-  rocksdb_readoptions_t *roptions = rocksdb_readoptions_create();
-  uint8_t *wallet_data = (uint8_t*)rocksdb_get(db, roptions, (char*)key, sizeof(key), &read_len, &err);
-#endif
-
+  uint8_t *wallet_data = storage_get(db, key, sizeof(key), &read_len, &err);
   if (err != NULL || wallet_data == NULL)
   {
     LOG_ERROR("Could not open wallet database: %s: %s", wallet_dir, err);
@@ -328,76 +284,31 @@ int get_wallet(const char *wallet_dir, wallet_t **wallet_out)
   buffer_iterator_free(buffer_iterator);
   buffer_free(buffer);
 
-#ifdef USE_LEVELDB
-  leveldb_free(wallet_data);
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_close(db);
-#else
-  rocksdb_free(wallet_data);
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_close(db);
-#endif
+  storage_free(wallet_data);
+  storage_close(db);
 
   *wallet_out = wallet;
   LOG_INFO("Successfully opened wallet: %s", wallet_dir);
   return 0;
 
 deserialize_wallet_fail:
-#ifdef USE_LEVELDB
-  leveldb_free(wallet_data);
-  leveldb_free(err);
-  leveldb_readoptions_destroy(roptions);
-  leveldb_close(db);
-#else
-  rocksdb_free(wallet_data);
-  rocksdb_free(err);
-  rocksdb_readoptions_destroy(roptions);
-  rocksdb_close(db);
-#endif
+  storage_free(wallet_data);
+  storage_free(err);
+  storage_close(db);
   return 1;
 }
 
 int repair_wallet(const char *wallet_dir)
 {
   char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_options_t *options = leveldb_options_create();
-  leveldb_options_set_create_if_missing(options, 1);
-#else
-  rocksdb_options_t *options = rocksdb_options_create();
-  rocksdb_options_set_create_if_missing(options, 1);
-#endif
-
-#ifdef USE_LEVELDB
-  leveldb_repair_db(options, wallet_dir, &err);
-#else
-  rocksdb_repair_db(options, wallet_dir, &err);
-#endif
-
+  storage_repair(wallet_dir, &err);
   if (err != NULL)
   {
     LOG_ERROR("Could not repair wallet database: %s: %s!", wallet_dir, err);
-
-  #ifdef USE_LEVELDB
-    leveldb_free(err);
-    leveldb_free(options);
-  #else
-    rocksdb_free(err);
-    rocksdb_options_destroy(options);
-  #endif
+    storage_free(err);
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_free(err);
-  leveldb_free(options);
-#else
-  rocksdb_free(err);
-  rocksdb_options_destroy(options);
-#endif
-
   LOG_INFO("Successfully repaired wallet database: %s", wallet_dir);
   return 0;
 }
@@ -425,31 +336,532 @@ int init_wallet(const char *wallet_dir, wallet_t **wallet_out)
 int remove_wallet(const char *wallet_dir)
 {
   char *err = NULL;
-#ifdef USE_LEVELDB
-  leveldb_options_t *options = leveldb_options_create();
-  leveldb_destroy_db(options, wallet_dir, &err);
-#else
-  rocksdb_options_t *options = rocksdb_options_create();
-  rocksdb_destroy_db(options, wallet_dir, &err);
-#endif
-
+  storage_destroy(wallet_dir, &err);
   if (err != NULL)
   {
     LOG_ERROR("Failed to remove wallet database: %s: %s", wallet_dir, err);
+    storage_free(err);
+    return 1;
+  }
+
+  return 0;
+}
+
+static wallet_output_t* get_wallet_output(wallet_t *wallet, uint8_t *tx_id, uint32_t txout_index)
+{
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&wallet->outputs, value, index)
+  {
+    wallet_output_t *output = (wallet_output_t*)value;
+    if (output->txout_index == txout_index && compare_hash(output->tx_id, tx_id))
+    {
+      return output;
+    }
+  }
+
+  return NULL;
+}
+
+static wallet_output_t* add_wallet_output(wallet_t *wallet, uint8_t *tx_id, uint32_t txout_index, uint64_t amount, uint8_t spent)
+{
+  wallet_output_t *output = malloc(sizeof(wallet_output_t));
+  assert(output != NULL);
+  memcpy(output->tx_id, tx_id, HASH_SIZE);
+  output->txout_index = txout_index;
+  output->amount = amount;
+  output->spent = spent;
+
+  assert(vec_push(&wallet->outputs, output) == 0);
+  return output;
+}
+
+static void put_wallet_output(storage_batch_t *batch, wallet_output_t *output)
+{
+  uint8_t key[DB_KEY_SIZE_OUTPUT];
+  get_output_key(key, output->tx_id, output->txout_index);
+
+  buffer_t *buffer = buffer_init();
+  assert(buffer_write_uint64(buffer, output->amount) == 0);
+  assert(buffer_write_uint8(buffer, output->spent) == 0);
+  storage_batch_put(batch, key, sizeof(key), buffer_get_data(buffer), buffer_get_size(buffer));
+  buffer_free(buffer);
+}
+
+static void delete_wallet_output(storage_batch_t *batch, wallet_output_t *output)
+{
+  uint8_t key[DB_KEY_SIZE_OUTPUT];
+  get_output_key(key, output->tx_id, output->txout_index);
+  storage_batch_delete(batch, key, sizeof(key));
+}
+
+/*
+ * Writes the changed outputs along with the block they are now synced to, wallets
+ * without an open database only keep their outputs in memory...
+ */
+static int write_wallet_outputs(wallet_t *wallet, storage_batch_t *batch, uint8_t *synced_block_hash)
+{
+  memcpy(wallet->synced_block_hash, synced_block_hash, HASH_SIZE);
+  if (wallet->db == NULL)
+  {
+    return 0;
+  }
+
+  uint8_t key[DB_KEY_PREFIX_SIZE_SYNCED_BLOCK];
+  get_synced_block_key(key);
+  storage_batch_put(batch, key, sizeof(key), synced_block_hash, HASH_SIZE);
+
+  char *err = NULL;
+  storage_write(wallet->db, batch, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not write wallet outputs: %s", err);
+    storage_free(err);
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * Opens the wallet database for the lifetime of the wallet and loads the outputs
+ * it has stored, they're kept up to date from then on once the wallet is given to
+ * the blockchain with `set_blockchain_wallet`.
+ */
+int load_wallet_outputs(wallet_t *wallet, const char *wallet_dir)
+{
+  assert(wallet != NULL);
+  assert(wallet->db == NULL);
+
+  char *err = NULL;
+  storage_t *db = open_wallet(wallet_dir, &err);
+  if (err != NULL)
+  {
+    LOG_ERROR("Could not open wallet database: %s: %s", wallet_dir, err);
+    storage_free(err);
+    return 1;
+  }
+
+  mtx_lock(&wallet->lock);
+  free_wallet_outputs(wallet);
+  wallet->balance = 0;
+
+  uint8_t key_prefix[DB_KEY_PREFIX_SIZE_OUTPUT];
+  memcpy(key_prefix, DB_KEY_PREFIX_OUTPUT, DB_KEY_PREFIX_SIZE_OUTPUT);
+
+  storage_iterator_t *iterator = storage_iterator_create(db);
+  for (storage_iterator_seek(iterator, key_prefix, sizeof(key_prefix));
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
+  {
+    size_t key_length;
+    size_t value_length;
+    const uint8_t *key = storage_iterator_key(iterator, &key_length);
+    const uint8_t *value = storage_iterator_value(iterator, &value_length);
+    if (key_length != DB_KEY_SIZE_OUTPUT || memcmp(key, key_prefix, sizeof(key_prefix)) != 0)
+    {
+      break;
+    }
+
+    const uint8_t *tx_id = key + DB_KEY_PREFIX_SIZE_OUTPUT;
+    const uint8_t *index_data = tx_id + HASH_SIZE;
+    uint32_t txout_index = ((uint32_t)index_data[0] << 24) | ((uint32_t)index_data[1] << 16) |
+      ((uint32_t)index_data[2] << 8) | (uint32_t)index_data[3];
+
+    buffer_t *buffer = buffer_init_data(0, value, value_length);
+    buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+
+    uint64_t amount = 0;
+    uint8_t spent = 0;
+    int result = (buffer_read_uint64(buffer_iterator, &amount) || buffer_read_uint8(buffer_iterator, &spent));
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+
+    if (result)
+    {
+      LOG_ERROR("Could not load wallet outputs, failed to read stored output!");
+      storage_iterator_destroy(iterator);
+      free_wallet_outputs(wallet);
+      mtx_unlock(&wallet->lock);
+      storage_close(db);
+      return 1;
+    }
+
+    add_wallet_output(wallet, (uint8_t*)tx_id, txout_index, amount, spent);
+    if (spent == 0)
+    {
+      wallet->balance += amount;
+    }
+  }
+
+  storage_iterator_destroy(iterator);
+
+  uint8_t key[DB_KEY_PREFIX_SIZE_SYNCED_BLOCK];
+  get_synced_block_key(key);
 
-  #ifdef USE_LEVELDB
-    leveldb_options_destroy(options);
-  #else
-    rocksdb_options_destroy(options);
-  #endif
+  size_t read_len;
+  uint8_t *synced_block_hash = storage_get(db, key, sizeof(key), &read_len, &err);
+  if (synced_block_hash != NULL && read_len == HASH_SIZE)
+  {
+    memcpy(wallet->synced_block_hash, synced_block_hash, HASH_SIZE);
+  }
+
+  storage_free(synced_block_hash);
+  storage_free(err);
+
+  wallet->db = db;
+  mtx_unlock(&wallet->lock);
+  return 0;
+}
+
+/*
+ * Rebuilds the wallet's outputs from the blockchain's address index, this is only
+ * needed when the wallet was not kept in sync with the blockchain it is given to.
+ * The spent outputs that were kept before the rescan are dropped along the way.
+ */
+int rescan_wallet_nolock(wallet_t *wallet)
+{
+  assert(wallet != NULL);
+  vec_void_t unspent_txs;
+  vec_init(&unspent_txs);
+
+  uint32_t num_unspent_txs = 0;
+  if (get_unspent_transactions_for_address_nolock(wallet->address, &unspent_txs, &num_unspent_txs))
+  {
+    vec_deinit(&unspent_txs);
     return 1;
   }
 
-#ifdef USE_LEVELDB
-  leveldb_options_destroy(options);
-#else
-  rocksdb_options_destroy(options);
-#endif
+  mtx_lock(&wallet->lock);
+  storage_batch_t *batch = storage_batch_create();
+
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&wallet->outputs, value, index)
+  {
+    delete_wallet_output(batch, (wallet_output_t*)value);
+  }
+
+  free_wallet_outputs(wallet);
+  wallet->balance = 0;
+
+  vec_foreach(&unspent_txs, value, index)
+  {
+    unspent_transaction_t *unspent_tx = (unspent_transaction_t*)value;
+    for (uint32_t txout_index = 0; txout_index < unspent_tx->unspent_txout_count; txout_index++)
+    {
+      unspent_output_transaction_t *unspent_txout = unspent_tx->unspent_txouts[txout_index];
+      assert(unspent_txout != NULL);
+      if (unspent_txout->spent || memcmp(unspent_txout->address, wallet->address, ADDRESS_SIZE) != 0)
+      {
+        continue;
+      }
+
+      wallet_output_t *output = add_wallet_output(wallet, unspent_tx->id, txout_index, unspent_txout->amount, 0);
+      put_wallet_output(batch, output);
+      wallet->balance += output->amount;
+    }
+
+    free_unspent_transaction(unspent_tx);
+  }
+
+  vec_deinit(&unspent_txs);
+
+  int result = write_wallet_outputs(wallet, batch, get_current_block_hash());
+  storage_batch_destroy(batch);
+
+  LOG_INFO("Rescanned wallet, found %d unspent outputs.", wallet->outputs.length);
+  mtx_unlock(&wallet->lock);
+  return result;
+}
+
+static int match_wallet_block_filter(wallet_t *wallet, uint8_t *block_hash, uint8_t *filter, size_t filter_size)
+{
+  assert(wallet != NULL);
+  assert(block_hash != NULL);
+  assert(filter != NULL);
+
+  // the wallet's address finds the outputs paid to it and the outpoints
+  // of it's unspent outputs find the blocks which spend them...
+  uint32_t num_items = 1;
+  uint32_t num_outputs = (uint32_t)wallet->outputs.length;
+  block_filter_item_t *items = malloc(sizeof(block_filter_item_t) * (num_outputs + 1));
+  assert(items != NULL);
+  uint8_t *outpoints = NULL;
+  if (num_outputs > 0)
+  {
+    outpoints = malloc(BLOCK_FILTER_OUTPOINT_SIZE * num_outputs);
+    assert(outpoints != NULL);
+  }
+
+  items[0].data = wallet->address;
+  items[0].size = ADDRESS_SIZE;
+
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&wallet->outputs, value, index)
+  {
+    wallet_output_t *output = (wallet_output_t*)value;
+    if (output->spent)
+    {
+      continue;
+    }
+
+    uint8_t *outpoint = outpoints + ((num_items - 1) * BLOCK_FILTER_OUTPOINT_SIZE);
+    get_block_filter_outpoint(outpoint, output->tx_id, output->txout_index);
+    items[num_items].data = outpoint;
+    items[num_items].size = BLOCK_FILTER_OUTPOINT_SIZE;
+    num_items++;
+  }
+
+  int matched = match_block_filter(block_hash, filter, filter_size, items, num_items);
+  free(outpoints);
+  free(items);
+  return matched;
+}
+
+/*
+ * Catches up a wallet which fell behind the blockchain by checking the filter of each
+ * block since the block it was synced to, only the blocks whose filter matches the wallet
+ * are read. Returns 1 when the synced block is no longer in the main chain or a block has no
+ * filter or was pruned, the wallet has to be rescanned instead.
+ */
+int sync_wallet_from_block_filters_nolock(wallet_t *wallet)
+{
+  assert(wallet != NULL);
+
+  // a wallet which was never synced has no block to catch up from
+  uint8_t empty_hash[HASH_SIZE] = {0};
+  if (compare_hash(wallet->synced_block_hash, empty_hash))
+  {
+    return 1;
+  }
+
+  int32_t synced_height = get_block_height_from_hash_nolock(wallet->synced_block_hash);
+  if (synced_height < 0)
+  {
+    return 1;
+  }
+
+  uint8_t *synced_block_hash = get_block_hash_from_height_nolock((uint32_t)synced_height);
+  if (synced_block_hash == NULL || compare_hash(synced_block_hash, wallet->synced_block_hash) == 0)
+  {
+    free(synced_block_hash);
+    return 1;
+  }
+
+  free(synced_block_hash);
+
+  uint32_t block_height = get_block_height_nolock();
+  uint32_t num_matched_blocks = 0;
+  for (uint32_t height = (uint32_t)synced_height + 1; height <= block_height; height++)
+  {
+    uint8_t *block_hash = get_block_hash_from_height_nolock(height);
+    if (block_hash == NULL)
+    {
+      return 1;
+    }
+
+    size_t filter_size = 0;
+    uint8_t *filter = get_block_filter_nolock(block_hash, &filter_size);
+    if (filter == NULL)
+    {
+      free(block_hash);
+      return 1;
+    }
+
+    mtx_lock(&wallet->lock);
+    int matched = match_wallet_block_filter(wallet, block_hash, filter, filter_size);
+    mtx_unlock(&wallet->lock);
+    free(filter);
+
+    if (matched == 0)
+    {
+      free(block_hash);
+      continue;
+    }
+
+    block_t *block = NULL;
+    if (is_block_pruned_nolock(block_hash) == 0)
+    {
+      block = acquire_block_from_hash_nolock(block_hash);
+    }
+
+    free(block_hash);
+    if (block == NULL)
+    {
+      return 1;
+    }
+
+    int result = connect_block_to_wallet(wallet, block);
+    release_block_nolock(block);
+    if (result)
+    {
+      return 1;
+    }
+
+    num_matched_blocks++;
+  }
+
+  mtx_lock(&wallet->lock);
+  storage_batch_t *batch = storage_batch_create();
+  int result = write_wallet_outputs(wallet, batch, get_current_block_hash());
+  storage_batch_destroy(batch);
+
+  LOG_INFO("Synced wallet from block filters, read %u of %u blocks.", num_matched_blocks, block_height - (uint32_t)synced_height);
+  mtx_unlock(&wallet->lock);
+  return result;
+}
+
+/*
+ * Updates the wallet's outputs for a block connected to the top of the blockchain,
+ * only the txins signed with the wallet's public key can spend one of it's outputs.
+ */
+int connect_block_to_wallet(wallet_t *wallet, block_t *block)
+{
+  assert(wallet != NULL);
+  assert(block != NULL);
+
+  mtx_lock(&wallet->lock);
+  storage_batch_t *batch = storage_batch_create();
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    assert(tx != NULL);
+
+    for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
+    {
+      input_transaction_t *txin = tx->txins[txin_index];
+      if (memcmp(txin->public_key, wallet->public_key, crypto_sign_PUBLICKEYBYTES) != 0)
+      {
+        continue;
+      }
+
+      wallet_output_t *output = get_wallet_output(wallet, txin->transaction, txin->txout_index);
+      if (output != NULL && output->spent == 0)
+      {
+        output->spent = 1;
+        wallet->balance -= output->amount;
+        put_wallet_output(batch, output);
+      }
+    }
+
+    for (uint32_t txout_index = 0; txout_index < tx->txout_count; txout_index++)
+    {
+      output_transaction_t *txout = tx->txouts[txout_index];
+      if (memcmp(txout->address, wallet->address, ADDRESS_SIZE) != 0 ||
+          get_wallet_output(wallet, tx->id, txout_index) != NULL)
+      {
+        continue;
+      }
+
+      wallet_output_t *output = add_wallet_output(wallet, tx->id, txout_index, txout->amount, 0);
+      wallet->balance += output->amount;
+      put_wallet_output(batch, output);
+    }
+  }
+
+  int result = write_wallet_outputs(wallet, batch, block->hash);
+  storage_batch_destroy(batch);
+  mtx_unlock(&wallet->lock);
+  return result;
+}
+
+/*
+ * Reverts `connect_block_to_wallet` for a block disconnected from the top of the
+ * blockchain, the block's txs are undone in the reverse order they were connected.
+ */
+int disconnect_block_from_wallet(wallet_t *wallet, block_t *block)
+{
+  assert(wallet != NULL);
+  assert(block != NULL);
+
+  mtx_lock(&wallet->lock);
+  storage_batch_t *batch = storage_batch_create();
+  for (uint32_t i = block->transaction_count; i > 0; i--)
+  {
+    transaction_t *tx = block->transactions[i - 1];
+    assert(tx != NULL);
+
+    for (uint32_t txout_index = 0; txout_index < tx->txout_count; txout_index++)
+    {
+      wallet_output_t *output = get_wallet_output(wallet, tx->id, txout_index);
+      if (output == NULL)
+      {
+        continue;
+      }
+
+      if (output->spent == 0)
+      {
+        wallet->balance -= output->amount;
+      }
+
+      delete_wallet_output(batch, output);
+      vec_remove(&wallet->outputs, output);
+      free(output);
+    }
+
+    for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
+    {
+      input_transaction_t *txin = tx->txins[txin_index];
+      if (memcmp(txin->public_key, wallet->public_key, crypto_sign_PUBLICKEYBYTES) != 0)
+      {
+        continue;
+      }
+
+      wallet_output_t *output = get_wallet_output(wallet, txin->transaction, txin->txout_index);
+      if (output != NULL && output->spent)
+      {
+        output->spent = 0;
+        wallet->balance += output->amount;
+        put_wallet_output(batch, output);
+      }
+    }
+  }
+
+  int result = write_wallet_outputs(wallet, batch, block->previous_hash);
+  storage_batch_destroy(batch);
+  mtx_unlock(&wallet->lock);
+  return result;
+}
+
+uint64_t get_wallet_balance(wallet_t *wallet)
+{
+  assert(wallet != NULL);
+  mtx_lock(&wallet->lock);
+  uint64_t balance = wallet->balance;
+  mtx_unlock(&wallet->lock);
+  return balance;
+}
+
+/*
+ * Copies each of the wallet's unspent outputs into the outputs vector,
+ * the copies are later to be free'd by the caller.
+ */
+int get_wallet_unspent_outputs(wallet_t *wallet, vec_void_t *outputs, uint32_t *num_outputs)
+{
+  assert(wallet != NULL);
+  assert(outputs != NULL);
+  assert(num_outputs != NULL);
+
+  mtx_lock(&wallet->lock);
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&wallet->outputs, value, index)
+  {
+    wallet_output_t *output = (wallet_output_t*)value;
+    if (output->spent)
+    {
+      continue;
+    }
+
+    wallet_output_t *output_copy = malloc(sizeof(wallet_output_t));
+    assert(output_copy != NULL);
+    memcpy(output_copy, output, sizeof(wallet_output_t));
+    assert(vec_push(outputs, output_copy) == 0);
+    *num_outputs += 1;
+  }
+
+  mtx_unlock(&wallet->lock);
   return 0;
 }
 
@@ -473,7 +885,7 @@ void print_wallet(wallet_t *wallet)
   printf("  Public Address: %s\n", public_address_str);
   free(public_address_str);
 
-  uint64_t balance = get_balance_for_address(wallet->address) / COIN;
+  uint64_t balance = get_wallet_balance(wallet) / COIN;
   printf("  Balance: %" PRIu64 "\n", balance);
 }
 
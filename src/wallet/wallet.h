@@ -30,23 +30,41 @@
 
 #include <sodium.h>
 
-#ifdef USE_LEVELDB
-#include <leveldb/c.h>
-#else
-#include <rocksdb/c.h>
-#endif
-
 #include "common/buffer.h"
 #include "common/buffer_iterator.h"
+#include "common/tinycthread.h"
 #include "common/util.h"
+#include "common/vec.h"
 #include "common/vulkan.h"
 
 #include "core/parameters.h"
+#include "core/storage.h"
 
 VULKAN_BEGIN_DECL
 
 #define DB_KEY_PREFIX_DATA "d"
+#define DB_KEY_PREFIX_OUTPUT "o"
+#define DB_KEY_PREFIX_SYNCED_BLOCK "s"
+
 #define DB_KEY_PREFIX_SIZE_DATA 1
+#define DB_KEY_PREFIX_SIZE_OUTPUT 1
+#define DB_KEY_PREFIX_SIZE_SYNCED_BLOCK 1
+
+#define DB_KEY_SIZE_OUTPUT (DB_KEY_PREFIX_SIZE_OUTPUT + HASH_SIZE + sizeof(uint32_t))
+
+typedef struct Block block_t;
+
+/*
+ * An output paid to the wallet's address, spent outputs are kept so that
+ * they can be given back when the block that spent them is disconnected.
+ */
+typedef struct WalletOutput
+{
+  uint8_t tx_id[HASH_SIZE];
+  uint32_t txout_index;
+  uint64_t amount;
+  uint8_t spent;
+} wallet_output_t;
 
 typedef struct Wallet
 {
@@ -54,6 +72,13 @@ typedef struct Wallet
   uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
   uint8_t address[ADDRESS_SIZE];
   uint64_t balance;
+
+  // the outputs are kept up to date as blocks are connected and disconnected,
+  // the synced block is the blockchain top block they were last updated for...
+  storage_t *db;
+  vec_void_t outputs;
+  uint8_t synced_block_hash[HASH_SIZE];
+  mtx_t lock;
 } wallet_t;
 
 VULKAN_API wallet_t* make_wallet(void);
@@ -63,12 +88,10 @@ VULKAN_API int serialize_wallet(buffer_t *buffer, wallet_t* wallet);
 VULKAN_API int deserialize_wallet(buffer_iterator_t *buffer_iterator, wallet_t **wallet_out);
 
 VULKAN_API void get_data_key(uint8_t *buffer);
+VULKAN_API void get_output_key(uint8_t *buffer, uint8_t *tx_id, uint32_t txout_index);
+VULKAN_API void get_synced_block_key(uint8_t *buffer);
 
-#ifdef USE_LEVELDB
-VULKAN_API leveldb_t* open_wallet(const char *wallet_dir, char *err);
-#else
-VULKAN_API rocksdb_t* open_wallet(const char *wallet_dir, char *err);
-#endif
+VULKAN_API storage_t* open_wallet(const char *wallet_dir, char **err);
 
 VULKAN_API int new_wallet(const char *wallet_dir, wallet_t **wallet_out);
 VULKAN_API int get_wallet(const char *wallet_dir, wallet_t **wallet_out);
@@ -76,6 +99,15 @@ VULKAN_API int repair_wallet(const char *wallet_dir);
 VULKAN_API int init_wallet(const char *wallet_dir, wallet_t **wallet_out);
 VULKAN_API int remove_wallet(const char *wallet_dir);
 
+VULKAN_API int load_wallet_outputs(wallet_t *wallet, const char *wallet_dir);
+VULKAN_API int rescan_wallet_nolock(wallet_t *wallet);
+VULKAN_API int sync_wallet_from_block_filters_nolock(wallet_t *wallet);
+VULKAN_API int connect_block_to_wallet(wallet_t *wallet, block_t *block);
+VULKAN_API int disconnect_block_from_wallet(wallet_t *wallet, block_t *block);
+
+VULKAN_API uint64_t get_wallet_balance(wallet_t *wallet);
+VULKAN_API int get_wallet_unspent_outputs(wallet_t *wallet, vec_void_t *outputs, uint32_t *num_outputs);
+
 VULKAN_API void print_wallet(wallet_t* wallet);
 VULKAN_API void print_public_key(wallet_t *wallet);
 VULKAN_API void print_secret_key(wallet_t *wallet);
@@ -26,18 +26,204 @@
 #include <stdint.h>
 #include <sodium.h>
 
+#include "common/buffer_iterator.h"
+#include "common/buffer.h"
 #include "common/greatest.h"
 #include "common/util.h"
 
 #include "core/block.h"
+#include "core/block_filter.h"
 #include "core/parameters.h"
 #include "core/transaction.h"
+#include "core/validator.h"
 
 #include "crypto/cryptoutil.h"
 
 SUITE(block_suite);
 
-GREATEST_SUITE(block_suite)
+TEST can_validate_block_txs_across_validation_threads(void)
 {
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  block_t *block = make_block();
+  for (uint32_t i = 0; i < 100; i++)
+  {
+    transaction_t *tx = make_transaction();
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    randombytes_buf(txout->address, ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, 0);
+
+    input_transaction_t *txin = make_txin();
+    randombytes_buf(txin->transaction, HASH_SIZE);
+    txin->txout_index = i;
+    add_txin_to_transaction(tx, txin, 0);
+    ASSERT(sign_txin(txin, tx, public_key, secret_key) == 0);
+    ASSERT(add_transaction_to_block(block, tx, i) == 0);
+  }
+
+  // unless set, a validation thread is started per cpu but one
+  uint16_t num_cores = get_num_logical_cores();
+  ASSERT_EQ(get_num_validation_threads(), num_cores > 1 ? num_cores - 1 : 1);
+
+  set_num_validation_threads(4);
+  ASSERT(start_validator() == 0);
+  ASSERT(valid_block_txs_parallel(block, 1) == 1);
+
+  // an invalid signature in any one of the ranges invalidates the block
+  block->transactions[77]->txins[0]->signature[0] ^= 0xff;
+  ASSERT(valid_block_txs_parallel(block, 1) == 0);
+  ASSERT(valid_block_txs(block, 0, block->transaction_count) == 0);
+  ASSERT(valid_block_txs(block, 0, 77) == 1);
+
+  // blocks assumed valid only have their tx headers checked
+  ASSERT(valid_block_txs_parallel(block, 0) == 1);
+  ASSERT(valid_block_tx_headers(block, 0, block->transaction_count) == 1);
+
+  ASSERT(stop_validator() == 0);
+  set_num_validation_threads(1);
+
+  // without the validation threads the txs are checked inline
+  ASSERT(valid_block_txs_parallel(block, 1) == 0);
+
+  free_block(block);
+  PASS();
+}
+
+TEST can_deserialize_block_transactions_in_arena(void)
+{
+  block_t *block = make_block();
+  for (uint32_t i = 0; i < 50; i++)
+  {
+    transaction_t *tx = make_transaction();
+    for (uint32_t j = 0; j < 3; j++)
+    {
+      output_transaction_t *txout = make_txout();
+      txout->amount = randombytes_random();
+      randombytes_buf(txout->address, ADDRESS_SIZE);
+      add_txout_to_transaction(tx, txout, j);
+
+      input_transaction_t *txin = make_txin();
+      randombytes_buf(txin->transaction, HASH_SIZE);
+      txin->txout_index = j;
+      add_txin_to_transaction(tx, txin, j);
+    }
+
+    ASSERT(compute_tx_id(tx->id, tx) == 0);
+    ASSERT(add_transaction_to_block(block, tx, i) == 0);
+  }
+
+  buffer_t *buffer = buffer_init();
+  ASSERT(serialize_block(buffer, block) == 0);
+  ASSERT(serialize_transactions_from_block(buffer, block) == 0);
+
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  block_t *arena_block = NULL;
+  ASSERT(deserialize_block(buffer_iterator, &arena_block) == 0);
+  ASSERT(deserialize_transactions_to_block_in_arena(buffer_iterator, arena_block) == 0);
+  ASSERT(arena_block->arena != NULL);
+  ASSERT_EQ(arena_block->transaction_count, block->transaction_count);
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    ASSERT(compare_transaction(block->transactions[i], arena_block->transactions[i]) == 1);
+  }
+
+  free_block_transactions(arena_block);
+  ASSERT(arena_block->arena == NULL);
+  ASSERT(arena_block->transactions == NULL);
+  free_block(arena_block);
+  buffer_iterator_free(buffer_iterator);
+
+  // a truncated block leaves only the txs that were deserialized,
+  // all of which are free'd along with the arena...
+  buffer_t *truncated_buffer = buffer_init_data(0, buffer_get_data(buffer), buffer_get_size(buffer) - 1);
+  buffer_iterator = buffer_iterator_init(truncated_buffer);
+  arena_block = NULL;
+  ASSERT(deserialize_block(buffer_iterator, &arena_block) == 0);
+  ASSERT(deserialize_transactions_to_block_in_arena(buffer_iterator, arena_block) == 1);
+  ASSERT(arena_block->transaction_count < block->transaction_count);
 
+  free_block(arena_block);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(truncated_buffer);
+  buffer_free(buffer);
+  free_block(block);
+  PASS();
+}
+
+TEST can_match_block_filters(void)
+{
+  block_t *block = make_block();
+  randombytes_buf(block->hash, HASH_SIZE);
+  for (uint32_t i = 0; i < 200; i++)
+  {
+    transaction_t *tx = make_transaction();
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    randombytes_buf(txout->address, ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, 0);
+
+    input_transaction_t *txin = make_txin();
+    randombytes_buf(txin->transaction, HASH_SIZE);
+    txin->txout_index = i;
+    add_txin_to_transaction(tx, txin, 0);
+    ASSERT(add_transaction_to_block(block, tx, i) == 0);
+  }
+
+  buffer_t *buffer = buffer_init();
+  ASSERT(serialize_block_filter(buffer, block) == 0);
+
+  const uint8_t *filter = buffer_get_data(buffer);
+  size_t filter_size = buffer_get_size(buffer);
+
+  // every address paid and every outpoint spent matches the block's filter
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    transaction_t *tx = block->transactions[i];
+    uint8_t outpoint[BLOCK_FILTER_OUTPOINT_SIZE];
+    get_block_filter_outpoint(outpoint, tx->txins[0]->transaction, tx->txins[0]->txout_index);
+
+    block_filter_item_t items[2] = {
+      {tx->txouts[0]->address, ADDRESS_SIZE},
+      {outpoint, sizeof(outpoint)}
+    };
+
+    ASSERT(match_block_filter(block->hash, filter, filter_size, &items[0], 1) == 1);
+    ASSERT(match_block_filter(block->hash, filter, filter_size, &items[1], 1) == 1);
+  }
+
+  // an address which is not in the block only matches with the filter's false positive rate
+  uint8_t addresses[16][ADDRESS_SIZE];
+  block_filter_item_t items[16];
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    randombytes_buf(addresses[i], ADDRESS_SIZE);
+    items[i].data = addresses[i];
+    items[i].size = ADDRESS_SIZE;
+  }
+
+  ASSERT(match_block_filter(block->hash, filter, filter_size, items, 16) == 0);
+  ASSERT(match_block_filter(block->hash, filter, filter_size, items, 0) == 0);
+
+  // the filter is keyed by the block's hash
+  uint8_t other_block_hash[HASH_SIZE];
+  randombytes_buf(other_block_hash, HASH_SIZE);
+  block_filter_item_t paid_item = {block->transactions[0]->txouts[0]->address, ADDRESS_SIZE};
+  ASSERT(match_block_filter(other_block_hash, filter, filter_size, &paid_item, 1) == 0);
+
+  // a truncated filter is treated as matching everything
+  ASSERT(match_block_filter(block->hash, filter, filter_size / 2, items, 16) == 1);
+
+  buffer_free(buffer);
+  free_block(block);
+  PASS();
+}
+
+GREATEST_SUITE(block_suite)
+{
+  RUN_TEST(can_validate_block_txs_across_validation_threads);
+  RUN_TEST(can_deserialize_block_transactions_in_arena);
+  RUN_TEST(can_match_block_filters);
 }
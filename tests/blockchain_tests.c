@@ -23,19 +23,1573 @@
 // You should have received a copy of the MIT License
 // along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
 
+#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <sodium.h>
+
+#include "common/buffer_iterator.h"
+#include "common/buffer.h"
 #include "common/greatest.h"
 #include "common/util.h"
 
 #include "core/block.h"
+#include "core/block_file.h"
+#include "core/block_cache.h"
+#include "core/block_filter.h"
+#include "core/block_view.h"
 #include "core/blockchain.h"
+#include "core/checkpoint.h"
+#include "core/genesis.h"
+#include "core/header_index.h"
+#include "core/orphan_pool.h"
+#include "core/storage.h"
+#include "core/transaction.h"
+#include "core/utxo_cache.h"
+#include "core/utxo_snapshot.h"
 
 #include "crypto/cryptoutil.h"
 
+#include "wallet/wallet.h"
+
 SUITE(blockchain_suite);
 
-GREATEST_SUITE(blockchain_suite)
+static block_t* make_test_block(uint8_t *previous_hash)
+{
+  block_t *block = make_block();
+  memcpy(block->previous_hash, previous_hash, HASH_SIZE);
+  block->timestamp = get_current_time();
+  block->nonce = randombytes_random();
+
+  transaction_t *tx = make_transaction();
+  output_transaction_t *txout = make_txout();
+  txout->amount = block->nonce;
+  add_txout_to_transaction(tx, txout, 0);
+  compute_self_tx_id(tx);
+  add_transaction_to_block(block, tx, 0);
+
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  return block;
+}
+
+TEST can_lookup_blocks_by_height(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  uint8_t block_hashes[4][HASH_SIZE];
+  memcpy(block_hashes[0], genesis_block->hash, HASH_SIZE);
+
+  for (uint32_t i = 1; i < 4; i++)
+  {
+    block_t *block = make_test_block(block_hashes[i - 1]);
+    ASSERT(insert_block(block, 0) == 0);
+    memcpy(block_hashes[i], block->hash, HASH_SIZE);
+    free_block(block);
+  }
+
+  ASSERT_EQ(get_block_height(), 3);
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    uint8_t *block_hash = get_block_hash_from_height(i);
+    ASSERT(block_hash != NULL);
+    ASSERT(compare_hash(block_hash, block_hashes[i]));
+    free(block_hash);
+
+    block_t *block = get_block_from_height(i);
+    ASSERT(block != NULL);
+    ASSERT(compare_hash(block->hash, block_hashes[i]));
+    free_block(block);
+
+    ASSERT_EQ(get_block_height_from_hash(block_hashes[i]), i);
+  }
+
+  ASSERT(has_block_by_height(4) == 0);
+
+  // rolling back the blockchain should also remove the height index entries
+  ASSERT(rollback_blockchain(2) == 0);
+  ASSERT(has_block_by_height(2) == 1);
+  ASSERT(has_block_by_height(3) == 0);
+
+  // the tip height is stored next to the top block and follows the rollback
+  uint32_t top_block_height = 0;
+  ASSERT(get_top_block_height_noblock(&top_block_height) == 0);
+  ASSERT_EQ(top_block_height, 2);
+  ASSERT_EQ(get_block_height(), 2);
+  ASSERT(compare_hash(get_current_block_hash(), block_hashes[2]));
+
+  ASSERT(reset_blockchain() == 0);
+  ASSERT_EQ(get_block_height(), 0);
+  PASS();
+}
+
+TEST header_index_follows_inserts_and_rollbacks(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  uint8_t block_hashes[4][HASH_SIZE];
+  memcpy(block_hashes[0], genesis_block->hash, HASH_SIZE);
+
+  for (uint32_t i = 1; i < 4; i++)
+  {
+    block_t *block = make_test_block(block_hashes[i - 1]);
+    block->bits = genesis_block->bits;
+    ASSERT(insert_block(block, 0) == 0);
+    memcpy(block_hashes[i], block->hash, HASH_SIZE);
+    free_block(block);
+  }
+
+  ASSERT_EQ(get_header_index_num_entries(), 4);
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    header_index_entry_t *entry = get_header_index_entry(i);
+    ASSERT(entry != NULL);
+    ASSERT_EQ(entry->height, i);
+    ASSERT(compare_hash(entry->hash, block_hashes[i]));
+    ASSERT(get_header_index_entry_from_hash(block_hashes[i]) == entry);
+
+    // every block adds the same amount of work to the chain
+    if (i > 0)
+    {
+      uint256_t work = entry->cumulative_work;
+      uint256_subtract(&work, &get_header_index_entry(i - 1)->cumulative_work);
+      ASSERT_EQ(uint256_compare(&work, &get_header_index_entry(0)->cumulative_work), 0);
+    }
+  }
+
+  ASSERT_EQ(get_next_work_required(block_hashes[3]), genesis_block->bits);
+
+  // a block which does not extend our top block is refused before anything is changed
+  block_t *unlinked_block = make_test_block(block_hashes[1]);
+  unlinked_block->bits = genesis_block->bits;
+  ASSERT(insert_block(unlinked_block, 0) == 1);
+  ASSERT(push_header_index_entry(4, unlinked_block) == 1);
+  ASSERT(push_header_index_entry(3, unlinked_block) == 1);
+  ASSERT(has_block_by_hash(unlinked_block->hash) == 0);
+  ASSERT_EQ(get_block_height(), 3);
+  ASSERT_EQ(get_header_index_num_entries(), 4);
+  ASSERT(compare_hash(get_header_index_top_entry()->hash, block_hashes[3]));
+  free_block(unlinked_block);
+
+  // rolled back blocks are dropped from the index
+  ASSERT(rollback_blockchain(2) == 0);
+  ASSERT_EQ(get_header_index_num_entries(), 3);
+  ASSERT(get_header_index_entry(3) == NULL);
+  ASSERT(get_header_index_entry_from_hash(block_hashes[3]) == NULL);
+  ASSERT_EQ(get_block_height_from_hash(block_hashes[3]), -1);
+
+  // the index is loaded back from storage the same way
+  ASSERT(load_header_index() == 0);
+  ASSERT_EQ(get_header_index_num_entries(), 3);
+  ASSERT(compare_hash(get_header_index_top_entry()->hash, block_hashes[2]));
+  ASSERT_EQ(get_block_height_from_hash(block_hashes[2]), 2);
+
+  ASSERT(reset_blockchain() == 0);
+  ASSERT_EQ(get_header_index_num_entries(), 0);
+  PASS();
+}
+
+TEST header_index_can_lookup_many_blocks(void)
+{
+  // fill the index with unlinked blocks well past it's initial capacity
+  const uint32_t num_of_blocks = 5000;
+  clear_header_index();
+
+  uint8_t previous_hash[HASH_SIZE];
+  memset(previous_hash, 0, HASH_SIZE);
+  for (uint32_t i = 0; i < num_of_blocks; i++)
+  {
+    block_t *block = make_block();
+    memcpy(block->previous_hash, previous_hash, HASH_SIZE);
+    randombytes_buf(block->hash, HASH_SIZE);
+    block->bits = 0x1d00ffff;
+    ASSERT(push_header_index_entry(i, block) == 0);
+    memcpy(previous_hash, block->hash, HASH_SIZE);
+    free_block(block);
+  }
+
+  // truncating the index must not break lookups of the remaining entries
+  truncate_header_index(num_of_blocks / 3);
+  ASSERT_EQ(get_header_index_num_entries(), (num_of_blocks / 3) + 1);
+  for (uint32_t i = 0; i < get_header_index_num_entries(); i++)
+  {
+    header_index_entry_t *entry = get_header_index_entry(i);
+    ASSERT(entry != NULL);
+    ASSERT(get_header_index_entry_from_hash(entry->hash) == entry);
+  }
+
+  // blocks must build on top of the index
+  block_t *block = make_block();
+  randombytes_buf(block->hash, HASH_SIZE);
+  ASSERT(push_header_index_entry(get_header_index_num_entries(), block) == 1);
+  free_block(block);
+
+  ASSERT(load_header_index() == 0);
+  PASS();
+}
+
+TEST can_restore_chain_state_from_manifest(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, genesis_block->hash, HASH_SIZE);
+  for (int i = 0; i < 3; i++)
+  {
+    block_t *block = make_test_block(previous_hash);
+    block->bits = genesis_block->bits;
+    ASSERT(insert_block(block, 0) == 0);
+    memcpy(previous_hash, block->hash, HASH_SIZE);
+    free_block(block);
+  }
+
+  ASSERT(flush_blockchain() == 0);
+  header_index_entry_t top_entry = *get_header_index_top_entry();
+  uint64_t cumulative_emission = get_cumulative_emission();
+  ASSERT_EQ(top_entry.cumulative_emission, cumulative_emission);
+
+  // the header index is restored from the manifest without reading any blocks
+  ASSERT(write_chain_state_manifest() == 0);
+  clear_header_index();
+  ASSERT(load_chain_state_manifest() == 0);
+  ASSERT_EQ(get_header_index_num_entries(), 4);
+  ASSERT_MEM_EQ(get_header_index_top_entry(), &top_entry, sizeof(header_index_entry_t));
+  ASSERT(get_header_index_entry_from_hash(previous_hash) == get_header_index_top_entry());
+  ASSERT_EQ(get_cumulative_emission(), cumulative_emission);
+
+  // the manifest is removed once read
+  ASSERT(load_chain_state_manifest() == 1);
+
+  // a corrupt manifest is discarded and the index is loaded from storage instead
+  ASSERT(write_chain_state_manifest() == 0);
+  const char *manifest_filename = get_chain_state_manifest_filename(get_blockchain_dir());
+  FILE *fp = fopen(manifest_filename, "r+b");
+  ASSERT(fp != NULL);
+  fseek(fp, CHAIN_STATE_MANIFEST_HEADER_SIZE + HEADER_INDEX_ENTRY_SIZE + 8, SEEK_SET);
+  fputc(0xff, fp);
+  fclose(fp);
+  ASSERT(load_chain_state_manifest() == 1);
+  ASSERT(load_header_index() == 0);
+  ASSERT_MEM_EQ(get_header_index_top_entry(), &top_entry, sizeof(header_index_entry_t));
+
+  // as is a manifest written before the top block changed
+  ASSERT(write_chain_state_manifest() == 0);
+  block_t *block = make_test_block(previous_hash);
+  block->bits = genesis_block->bits;
+  ASSERT(insert_block(block, 0) == 0);
+  ASSERT(load_chain_state_manifest() == 1);
+  ASSERT(compare_hash(get_header_index_top_entry()->hash, block->hash));
+  free_block(block);
+
+  free((char*)manifest_filename);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_load_block_transactions_on_demand(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  ASSERT(insert_block(block, 0) == 0);
+
+  // reading the header leaves the block's transactions in storage
+  block_t *header_block = get_block_header_from_height(1);
+  ASSERT(header_block != NULL);
+  ASSERT(compare_hash(header_block->hash, block->hash));
+  ASSERT_EQ(header_block->transaction_count, block->transaction_count);
+  ASSERT(header_block->transactions == NULL);
+
+  ASSERT(load_block_transactions(header_block) == 0);
+  ASSERT(header_block->transactions != NULL);
+  for (uint32_t i = 0; i < block->transaction_count; i++)
+  {
+    ASSERT(compare_hash(header_block->transactions[i]->id, block->transactions[i]->id));
+  }
+
+  ASSERT(valid_merkle_root(header_block));
+  free_block(header_block);
+
+  // rolled back blocks lose their transactions as well
+  uint8_t block_hash[HASH_SIZE];
+  memcpy(block_hash, block->hash, HASH_SIZE);
+  free_block(block);
+
+  ASSERT(rollback_blockchain(0) == 0);
+  ASSERT(get_block_header_from_hash(block_hash) == NULL);
+  ASSERT(get_block_from_hash(block_hash) == NULL);
+
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_read_stored_block_views(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  for (uint32_t i = 1; i < 3; i++)
+  {
+    transaction_t *tx = make_transaction();
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    add_txout_to_transaction(tx, txout, 0);
+    compute_self_tx_id(tx);
+    add_transaction_to_block(block, tx, i);
+  }
+
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  ASSERT(insert_block(block, 0) == 0);
+
+  stored_block_t *stored_block = get_stored_block_from_hash(block->hash, 1);
+  ASSERT(stored_block != NULL);
+  ASSERT(compare_hash((uint8_t*)stored_block->view.hash, block->hash));
+  ASSERT(compare_hash((uint8_t*)stored_block->view.merkle_root, block->merkle_root));
+  ASSERT_EQ(stored_block->view.nonce, block->nonce);
+  ASSERT_EQ(stored_block->view.transaction_count, 3);
+
+  // the stored bytes are exactly what the block serializes to
+  buffer_t *buffer = buffer_init();
+  ASSERT(serialize_block(buffer, block) == 0);
+  ASSERT_EQ(stored_block->view.size, buffer_get_size(buffer));
+  ASSERT(memcmp(stored_block->view.data, buffer_get_data(buffer), stored_block->view.size) == 0);
+  buffer_free(buffer);
+
+  size_t offsets[4];
+  ASSERT(get_transaction_view_offsets(offsets, stored_block->txs_data, stored_block->txs_size, 3) == 0);
+  ASSERT_EQ(offsets[0], 0);
+  ASSERT_EQ(offsets[3], stored_block->txs_size);
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    transaction_view_t tx_view;
+    ASSERT(get_transaction_view_at(&tx_view, stored_block->txs_data, stored_block->txs_size, i) == 0);
+    ASSERT(compare_hash((uint8_t*)tx_view.id, block->transactions[i]->id));
+    ASSERT(tx_view.data == stored_block->txs_data + offsets[i]);
+    ASSERT_EQ(tx_view.size, offsets[i + 1] - offsets[i]);
+  }
+
+  transaction_view_t tx_view;
+  ASSERT(get_transaction_view_at(&tx_view, stored_block->txs_data, stored_block->txs_size, 3) == 1);
+
+  free_stored_block(stored_block);
+  free_block(block);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_cache_recently_used_blocks(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  block->bits = genesis_block->bits;
+  ASSERT(insert_block(block, 0) == 0);
+
+  uint64_t num_hits = get_block_cache_num_hits();
+  uint64_t num_misses = get_block_cache_num_misses();
+
+  block_t *cached_block = acquire_block_from_hash(block->hash);
+  ASSERT(cached_block != NULL);
+  ASSERT(compare_block(block, cached_block) == 1);
+  ASSERT_EQ(get_block_cache_num_misses(), num_misses + 1);
+  ASSERT_EQ(get_block_cache_num_entries(), 1);
+
+  // the same block is shared with every caller holding it
+  block_t *other_cached_block = acquire_block_from_hash(block->hash);
+  ASSERT(other_cached_block == cached_block);
+  ASSERT_EQ(get_block_cache_num_hits(), num_hits + 1);
+  release_block(other_cached_block);
+
+  // rolled back blocks are dropped from the cache, but stay
+  // valid for the callers still holding them until released
+  ASSERT(rollback_blockchain(0) == 0);
+  ASSERT_EQ(get_block_cache_num_entries(), 0);
+  ASSERT(compare_block(block, cached_block) == 1);
+  release_block(cached_block);
+  ASSERT(acquire_block_from_hash(block->hash) == NULL);
+
+  // blocks which are no longer referenced are evicted once over budget
+  size_t max_memory_size = get_block_cache_max_memory_size();
+  set_block_cache_max_memory_size(0);
+  cached_block = acquire_block_from_hash(genesis_block->hash);
+  ASSERT(cached_block != NULL);
+  ASSERT_EQ(get_block_cache_num_entries(), 1);
+  release_block(cached_block);
+  ASSERT_EQ(get_block_cache_num_entries(), 0);
+  ASSERT_EQ(get_block_cache_memory_size(), 0);
+  set_block_cache_max_memory_size(max_memory_size);
+
+  free_block(block);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_hold_orphan_blocks(void)
+{
+  uint8_t unknown_hash[HASH_SIZE];
+  randombytes_buf(unknown_hash, HASH_SIZE);
+  block_t *block = make_test_block(unknown_hash);
+  block_t *child_block = make_test_block(block->hash);
+  block_t *sibling_block = make_test_block(block->hash);
+  ASSERT(add_orphan_block(block) == 0);
+  ASSERT(add_orphan_block(child_block) == 0);
+  ASSERT(add_orphan_block(sibling_block) == 0);
+  ASSERT(add_orphan_block(child_block) == 1);
+  ASSERT_EQ(get_num_orphan_blocks(), 3);
+
+  // the orphans waiting on a block are found by it's hash
+  ASSERT(take_orphan_block_from_previous_hash(child_block->hash) == NULL);
+  block_t *orphan_block = take_orphan_block_from_previous_hash(block->hash);
+  ASSERT(orphan_block == child_block || orphan_block == sibling_block);
+  free_block(orphan_block);
+
+  orphan_block = take_orphan_block_from_previous_hash(block->hash);
+  ASSERT(orphan_block == child_block || orphan_block == sibling_block);
+  free_block(orphan_block);
+  ASSERT(take_orphan_block_from_previous_hash(block->hash) == NULL);
+
+  ASSERT(has_orphan_block(block->hash) == 1);
+  ASSERT(take_orphan_block(block->hash) == block);
+  ASSERT(has_orphan_block(block->hash) == 0);
+  ASSERT_EQ(get_num_orphan_blocks(), 0);
+  ASSERT_EQ(get_orphan_pool_memory_size(), 0);
+
+  // the oldest orphans are evicted once the pool is over it's budget,
+  // and orphans expire once they have been waiting for too long, the evicted
+  // block is free'd by the pool so only it's hash is kept around...
+  uint8_t evicted_hash[HASH_SIZE];
+  memcpy(evicted_hash, block->hash, HASH_SIZE);
+  ASSERT(add_orphan_block(block) == 0);
+  size_t max_memory_size = get_orphan_pool_max_memory_size();
+  set_orphan_pool_max_memory_size(get_orphan_pool_memory_size());
+  block_t *other_block = make_test_block(unknown_hash);
+  ASSERT(add_orphan_block(other_block) == 0);
+  ASSERT(has_orphan_block(evicted_hash) == 0);
+  ASSERT(has_orphan_block(other_block->hash) == 1);
+  set_orphan_pool_max_memory_size(max_memory_size);
+
+  ASSERT_EQ(expire_orphan_blocks(get_current_time()), 0);
+  ASSERT_EQ(expire_orphan_blocks(get_current_time() + ORPHAN_BLOCK_EXPIRE_TIME + 1), 1);
+  ASSERT_EQ(get_num_orphan_blocks(), 0);
+  PASS();
+}
+
+static transaction_t* make_test_spend_tx(uint8_t *tx_id, uint32_t txout_index, uint32_t txout_count)
+{
+  transaction_t *tx = make_transaction();
+  input_transaction_t *txin = make_txin();
+  memcpy(txin->transaction, tx_id, HASH_SIZE);
+  txin->txout_index = txout_index;
+  add_txin_to_transaction(tx, txin, 0);
+
+  for (uint32_t i = 0; i < txout_count; i++)
+  {
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    add_txout_to_transaction(tx, txout, i);
+  }
+
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+TEST can_commit_block_spending_txs_from_same_block(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  // each tx spends the previous tx in the same block, this requires the
+  // block commit to see the unspent txs it staged before they are written
+  block_t *block = make_test_block(genesis_block->hash);
+  transaction_t *coinbase_tx = block->transactions[0];
+
+  transaction_t *spend_tx = make_test_spend_tx(coinbase_tx->id, 0, 2);
+  add_transaction_to_block(block, spend_tx, 1);
+
+  transaction_t *other_spend_tx = make_test_spend_tx(spend_tx->id, 1, 1);
+  add_transaction_to_block(block, other_spend_tx, 2);
+
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  ASSERT(insert_block(block, 1) == 0);
+
+  // the coinbase tx had it's only txout spent so it was removed
+  ASSERT(get_unspent_tx_from_index(coinbase_tx->id) == NULL);
+
+  unspent_transaction_t *unspent_tx = get_unspent_tx_from_index(spend_tx->id);
+  ASSERT(unspent_tx != NULL);
+  ASSERT_EQ(unspent_tx->unspent_txout_count, 2);
+  ASSERT_EQ(unspent_tx->unspent_txouts[0]->spent, 0);
+  ASSERT_EQ(unspent_tx->unspent_txouts[1]->spent, 1);
+  free_unspent_transaction(unspent_tx);
+
+  unspent_tx = get_unspent_tx_from_index(other_spend_tx->id);
+  ASSERT(unspent_tx != NULL);
+  ASSERT_EQ(unspent_tx->unspent_txouts[0]->spent, 0);
+  free_unspent_transaction(unspent_tx);
+
+  ASSERT_EQ(get_block_height(), 1);
+  free_block(block);
+
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST utxo_cache_defers_unspent_index_writes(void)
+{
+  uint32_t flush_interval = get_utxo_cache_flush_interval();
+  set_utxo_cache_flush_interval(100);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+  ASSERT_EQ(get_top_unspent_tx_height(), 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  transaction_t *coinbase_tx = block->transactions[0];
+  ASSERT(insert_block(block, 1) == 0);
+
+  // the new unspent tx is only held by the utxo cache until it is flushed
+  ASSERT(get_unspent_tx_from_storage_nolock(coinbase_tx->id) == NULL);
+  ASSERT(get_utxo_cache_num_dirty_entries() > 0);
+
+  unspent_transaction_t *unspent_tx = get_unspent_tx_from_index(coinbase_tx->id);
+  ASSERT(unspent_tx != NULL);
+  free_unspent_transaction(unspent_tx);
+  ASSERT_EQ(get_top_unspent_tx_height(), 0);
+
+  ASSERT(flush_utxo_cache() == 0);
+  ASSERT_EQ(get_utxo_cache_num_dirty_entries(), 0);
+  ASSERT_EQ(get_top_unspent_tx_height(), 1);
+
+  unspent_tx = get_unspent_tx_from_storage_nolock(coinbase_tx->id);
+  ASSERT(unspent_tx != NULL);
+  free_unspent_transaction(unspent_tx);
+
+  // rolling back flushes and drops the utxo cache before removing the block
+  ASSERT(rollback_blockchain(0) == 0);
+  ASSERT_EQ(get_utxo_cache_num_entries(), 0);
+  ASSERT(get_unspent_tx_from_index(coinbase_tx->id) == NULL);
+  ASSERT_EQ(get_top_unspent_tx_height(), 0);
+
+  free_block(block);
+  set_utxo_cache_flush_interval(flush_interval);
+
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_prefetch_unspent_txs_into_utxo_cache(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  transaction_t *coinbase_tx = block->transactions[0];
+  ASSERT(insert_block(block, 1) == 0);
+  ASSERT(flush_utxo_cache() == 0);
+  clear_utxo_cache();
+
+  // only the tx ids with an unspent tx in the unspent index get a cache entry
+  uint8_t tx_ids[HASH_SIZE * 2];
+  memcpy(tx_ids, coinbase_tx->id, HASH_SIZE);
+  memset(tx_ids + HASH_SIZE, 0xab, HASH_SIZE);
+  ASSERT(prefetch_unspent_txs(tx_ids, 2) == 0);
+  ASSERT_EQ(get_utxo_cache_num_entries(), 1);
+  ASSERT_EQ(get_utxo_cache_num_dirty_entries(), 0);
+
+  utxo_cache_entry_t *entry = get_utxo_cache_entry(coinbase_tx->id);
+  ASSERT(entry != NULL);
+  ASSERT(entry->unspent_tx != NULL);
+
+  // tx ids which already have a cache entry are not read again
+  ASSERT(prefetch_unspent_txs(tx_ids, 1) == 0);
+  ASSERT(get_utxo_cache_entry(coinbase_tx->id) == entry);
+
+  free_block(block);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_query_unspent_txouts_by_address(void)
+{
+  uint8_t address[ADDRESS_SIZE];
+  uint8_t other_address[ADDRESS_SIZE];
+  randombytes_buf(address, ADDRESS_SIZE);
+  randombytes_buf(other_address, ADDRESS_SIZE);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  transaction_t *coinbase_tx = block->transactions[0];
+  memcpy(coinbase_tx->txouts[0]->address, address, ADDRESS_SIZE);
+  compute_self_tx_id(coinbase_tx);
+
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  ASSERT(insert_block(block, 1) == 0);
+  ASSERT_EQ(get_balance_for_address(address), coinbase_tx->txouts[0]->amount);
+
+  // spend the coinbase txout to both addresses
+  block_t *next_block = make_test_block(block->hash);
+  transaction_t *spend_tx = make_test_spend_tx(coinbase_tx->id, 0, 2);
+  memcpy(spend_tx->txouts[0]->address, address, ADDRESS_SIZE);
+  memcpy(spend_tx->txouts[1]->address, other_address, ADDRESS_SIZE);
+  compute_self_tx_id(spend_tx);
+  add_transaction_to_block(next_block, spend_tx, 1);
+
+  compute_merkle_root(next_block->merkle_root, next_block);
+  compute_block_hash(next_block->hash, next_block);
+  ASSERT(insert_block(next_block, 1) == 0);
+
+  // the unflushed changes of the utxo cache are read through, without flushing them
+  size_t num_dirty_entries = get_utxo_cache_num_dirty_entries();
+  ASSERT(num_dirty_entries > 0);
+  ASSERT_EQ(get_balance_for_address(address), spend_tx->txouts[0]->amount);
+  ASSERT_EQ(get_balance_for_address(other_address), spend_tx->txouts[1]->amount);
+
+  vec_void_t unspent_txs;
+  vec_init(&unspent_txs);
+  uint32_t num_unspent_txs = 0;
+  ASSERT(get_unspent_transactions_for_address(address, &unspent_txs, &num_unspent_txs) == 0);
+  ASSERT_EQ(num_unspent_txs, 1);
+
+  unspent_transaction_t *unspent_tx = unspent_txs.data[0];
+  ASSERT(compare_hash(unspent_tx->id, spend_tx->id));
+  free_unspent_transaction(unspent_tx);
+  vec_deinit(&unspent_txs);
+  ASSERT_EQ(get_utxo_cache_num_dirty_entries(), num_dirty_entries);
+
+  // and once flushed the same txouts are read from the address index
+  ASSERT(flush_utxo_cache() == 0);
+  ASSERT_EQ(get_utxo_cache_num_dirty_entries(), 0);
+  ASSERT_EQ(get_balance_for_address(address), spend_tx->txouts[0]->amount);
+  ASSERT_EQ(get_balance_for_address(other_address), spend_tx->txouts[1]->amount);
+
+  // the tip reads the flushed address index from it's snapshot, as of the flushed height
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  ASSERT(tip != NULL);
+  ASSERT_EQ(tip->unspent_height, 2);
+  ASSERT_EQ(get_balance_for_address_at_tip(tip, address), spend_tx->txouts[0]->amount);
+  ASSERT_EQ(get_balance_for_address_at_tip(tip, other_address), spend_tx->txouts[1]->amount);
+  release_blockchain_tip(tip);
+
+  free_block(block);
+  free_block(next_block);
+
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_disconnect_blocks_with_undo_records(void)
+{
+  uint8_t address[ADDRESS_SIZE];
+  randombytes_buf(address, ADDRESS_SIZE);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  transaction_t *coinbase_tx = block->transactions[0];
+  memcpy(coinbase_tx->txouts[0]->address, address, ADDRESS_SIZE);
+  compute_self_tx_id(coinbase_tx);
+
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  ASSERT(insert_block(block, 1) == 0);
+
+  block_t *next_block = make_test_block(block->hash);
+  transaction_t *spend_tx = make_test_spend_tx(coinbase_tx->id, 0, 1);
+  add_transaction_to_block(next_block, spend_tx, 1);
+
+  compute_merkle_root(next_block->merkle_root, next_block);
+  compute_block_hash(next_block->hash, next_block);
+  ASSERT(insert_block(next_block, 1) == 0);
+  ASSERT(get_unspent_tx_from_index(coinbase_tx->id) == NULL);
+  ASSERT_EQ(get_balance_for_address(address), 0);
+
+  // disconnecting the block restores the txout it spent from it's undo record
+  block_t *disconnected_block = NULL;
+  ASSERT(disconnect_top_block(&disconnected_block) == 0);
+  ASSERT(disconnected_block != NULL);
+  ASSERT(compare_hash(disconnected_block->hash, next_block->hash));
+  free_block(disconnected_block);
+
+  ASSERT_EQ(get_block_height(), 1);
+  ASSERT(get_unspent_tx_from_index(spend_tx->id) == NULL);
+  ASSERT_EQ(get_balance_for_address(address), coinbase_tx->txouts[0]->amount);
+
+  unspent_transaction_t *unspent_tx = get_unspent_tx_from_index(coinbase_tx->id);
+  ASSERT(unspent_tx != NULL);
+  ASSERT_EQ(unspent_tx->unspent_txouts[0]->spent, 0);
+  free_unspent_transaction(unspent_tx);
+
+  // connecting a new branch and aborting the reorg reconnects our blocks
+  ASSERT(insert_block(next_block, 1) == 0);
+  ASSERT(begin_blockchain_reorg(1) == 0);
+  ASSERT(get_blockchain_reorg_active());
+  ASSERT_EQ(get_block_height(), 1);
+
+  block_t *other_block = make_test_block(block->hash);
+  ASSERT(insert_block(other_block, 1) == 0);
+  ASSERT(abort_blockchain_reorg() == 0);
+  ASSERT_FALSE(get_blockchain_reorg_active());
+
+  ASSERT_EQ(get_block_height(), 2);
+  ASSERT(compare_hash(get_current_block_hash(), next_block->hash));
+  ASSERT(has_block_by_hash(other_block->hash) == 0);
+  ASSERT(get_unspent_tx_from_index(coinbase_tx->id) == NULL);
+  ASSERT(get_unspent_tx_from_index(other_block->transactions[0]->id) == NULL);
+
+  unspent_tx = get_unspent_tx_from_index(spend_tx->id);
+  ASSERT(unspent_tx != NULL);
+  free_unspent_transaction(unspent_tx);
+
+  free_block(block);
+  free_block(next_block);
+  free_block(other_block);
+
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_bound_blockchain_reorg_depth(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, genesis_block->hash, HASH_SIZE);
+  for (uint32_t i = 0; i < MAX_REORG_BLOCK_DEPTH + 1; i++)
+  {
+    block_t *block = make_test_block(previous_hash);
+    ASSERT(insert_block(block, 0) == 0);
+    memcpy(previous_hash, block->hash, HASH_SIZE);
+    free_block(block);
+  }
+
+  // the disconnected blocks of a reorg are held in memory, so a fork this deep is refused
+  ASSERT(begin_blockchain_reorg(0) == 1);
+  ASSERT_FALSE(get_blockchain_reorg_active());
+  ASSERT_EQ(get_block_height(), MAX_REORG_BLOCK_DEPTH + 1);
+
+  ASSERT(begin_blockchain_reorg(1) == 0);
+  ASSERT_EQ(get_block_height(), 1);
+  ASSERT(abort_blockchain_reorg() == 0);
+  ASSERT_EQ(get_block_height(), MAX_REORG_BLOCK_DEPTH + 1);
+  ASSERT(compare_hash(get_current_block_hash(), previous_hash));
+
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST wallet_outputs_follow_connected_blocks(void)
+{
+  wallet_t *wallet = make_wallet();
+  crypto_sign_keypair(wallet->public_key, wallet->secret_key);
+  public_key_to_address(wallet->address, wallet->public_key);
+  ASSERT(set_blockchain_wallet(wallet) == 0);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+  ASSERT_EQ(get_wallet_balance(wallet), 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  transaction_t *coinbase_tx = block->transactions[0];
+  memcpy(coinbase_tx->txouts[0]->address, wallet->address, ADDRESS_SIZE);
+  compute_self_tx_id(coinbase_tx);
+
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  ASSERT(insert_block(block, 1) == 0);
+
+  uint64_t amount = coinbase_tx->txouts[0]->amount;
+  ASSERT_EQ(get_wallet_balance(wallet), amount);
+  ASSERT(compare_hash(wallet->synced_block_hash, block->hash));
+
+  block_t *next_block = make_test_block(block->hash);
+  transaction_t *spend_tx = make_test_spend_tx(coinbase_tx->id, 0, 1);
+  memcpy(spend_tx->txins[0]->public_key, wallet->public_key, crypto_sign_PUBLICKEYBYTES);
+  compute_self_tx_id(spend_tx);
+  add_transaction_to_block(next_block, spend_tx, 1);
+
+  compute_merkle_root(next_block->merkle_root, next_block);
+  compute_block_hash(next_block->hash, next_block);
+  ASSERT(insert_block(next_block, 1) == 0);
+  ASSERT_EQ(get_wallet_balance(wallet), 0);
+
+  vec_void_t outputs;
+  vec_init(&outputs);
+  uint32_t num_outputs = 0;
+  ASSERT(get_wallet_unspent_outputs(wallet, &outputs, &num_outputs) == 0);
+  ASSERT_EQ(num_outputs, 0);
+
+  // disconnecting the block gives the wallet back the output it spent
+  ASSERT(disconnect_top_block(NULL) == 0);
+  ASSERT_EQ(get_wallet_balance(wallet), amount);
+  ASSERT(compare_hash(wallet->synced_block_hash, block->hash));
+
+  ASSERT(get_wallet_unspent_outputs(wallet, &outputs, &num_outputs) == 0);
+  ASSERT_EQ(num_outputs, 1);
+  wallet_output_t *output = (wallet_output_t*)outputs.data[0];
+  ASSERT(compare_hash(output->tx_id, coinbase_tx->id));
+  ASSERT_EQ(output->txout_index, 0);
+  free(output);
+  vec_deinit(&outputs);
+
+  // a wallet synced to another top block is rescanned when it's given to the blockchain
+  ASSERT(set_blockchain_wallet(NULL) == 0);
+  memset(wallet->synced_block_hash, 0, HASH_SIZE);
+  wallet->balance = 0;
+  ASSERT(set_blockchain_wallet(wallet) == 0);
+  ASSERT_EQ(get_wallet_balance(wallet), amount);
+
+  ASSERT(reset_blockchain() == 0);
+  ASSERT_EQ(get_wallet_balance(wallet), 0);
+  ASSERT(set_blockchain_wallet(NULL) == 0);
+
+  free_block(block);
+  free_block(next_block);
+  free_wallet(wallet);
+  PASS();
+}
+
+TEST wallet_catches_up_from_block_filters(void)
+{
+  set_blockchain_block_filters_enabled(1);
+  wallet_t *wallet = make_wallet();
+  crypto_sign_keypair(wallet->public_key, wallet->secret_key);
+  public_key_to_address(wallet->address, wallet->public_key);
+  ASSERT(set_blockchain_wallet(wallet) == 0);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  transaction_t *coinbase_tx = block->transactions[0];
+  memcpy(coinbase_tx->txouts[0]->address, wallet->address, ADDRESS_SIZE);
+  compute_self_tx_id(coinbase_tx);
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  ASSERT(insert_block(block, 1) == 0);
+  ASSERT(compare_hash(wallet->synced_block_hash, block->hash));
+
+  // the wallet falls behind while the output it has is spent
+  // and a block that does not concern it is connected...
+  ASSERT(set_blockchain_wallet(NULL) == 0);
+  block_t *spend_block = make_test_block(block->hash);
+  transaction_t *spend_tx = make_test_spend_tx(coinbase_tx->id, 0, 1);
+  memcpy(spend_tx->txins[0]->public_key, wallet->public_key, crypto_sign_PUBLICKEYBYTES);
+  compute_self_tx_id(spend_tx);
+  add_transaction_to_block(spend_block, spend_tx, 1);
+  compute_merkle_root(spend_block->merkle_root, spend_block);
+  compute_block_hash(spend_block->hash, spend_block);
+  ASSERT(insert_block(spend_block, 1) == 0);
+
+  block_t *other_block = make_test_block(spend_block->hash);
+  ASSERT(insert_block(other_block, 1) == 0);
+
+  size_t filter_size = 0;
+  uint8_t *filter = get_block_filter(other_block->hash, &filter_size);
+  ASSERT(filter != NULL);
+
+  uint8_t outpoint[BLOCK_FILTER_OUTPOINT_SIZE];
+  get_block_filter_outpoint(outpoint, coinbase_tx->id, 0);
+  block_filter_item_t items[2] = {{wallet->address, ADDRESS_SIZE}, {outpoint, sizeof(outpoint)}};
+  ASSERT(match_block_filter(other_block->hash, filter, filter_size, items, 2) == 0);
+  free(filter);
+
+  ASSERT(set_blockchain_wallet(wallet) == 0);
+  ASSERT_EQ(get_wallet_balance(wallet), 0);
+  ASSERT(compare_hash(wallet->synced_block_hash, other_block->hash));
+
+  // a disconnected block takes it's filter with it
+  ASSERT(set_blockchain_wallet(NULL) == 0);
+  ASSERT(disconnect_top_block(NULL) == 0);
+  ASSERT(get_block_filter(other_block->hash, &filter_size) == NULL);
+
+  ASSERT(reset_blockchain() == 0);
+  set_blockchain_block_filters_enabled(0);
+
+  free_block(block);
+  free_block(spend_block);
+  free_block(other_block);
+  free_wallet(wallet);
+  PASS();
+}
+
+TEST can_store_received_block_filters(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  // blocks inserted while the filters are disabled have no filter of their own
+  block_t *block = make_test_block(genesis_block->hash);
+  ASSERT(insert_block(block, 1) == 0);
+  set_blockchain_block_filters_enabled(1);
+
+  size_t filter_size = 0;
+  ASSERT(get_block_filter(block->hash, &filter_size) == NULL);
+
+  buffer_t *filter_buffer = buffer_init();
+  ASSERT(serialize_block_filter(filter_buffer, block) == 0);
+  uint8_t *filter = buffer_get_data(filter_buffer);
+  size_t expected_filter_size = buffer_get_size(filter_buffer);
+
+  // a received filter is checked against the block while it's txs are stored
+  filter[0] ^= 0xff;
+  ASSERT(store_block_filter(block->hash, filter, expected_filter_size) == 1);
+  filter[0] ^= 0xff;
+  ASSERT(store_block_filter(block->hash, filter, expected_filter_size) == 0);
+
+  uint8_t *stored_filter = get_block_filter(block->hash, &filter_size);
+  ASSERT(stored_filter != NULL);
+  ASSERT_EQ(filter_size, expected_filter_size);
+  ASSERT_MEM_EQ(stored_filter, filter, filter_size);
+  free(stored_filter);
+
+  // the stored filter is never replaced, the filters of unknown blocks are never stored
+  ASSERT(store_block_filter(block->hash, filter, expected_filter_size) == 0);
+  ASSERT(store_block_filter(block->hash, filter, expected_filter_size - 1) == 1);
+
+  uint8_t unknown_block_hash[HASH_SIZE];
+  randombytes_buf(unknown_block_hash, HASH_SIZE);
+  ASSERT(store_block_filter(unknown_block_hash, filter, expected_filter_size) == 1);
+
+  buffer_free(filter_buffer);
+  ASSERT(reset_blockchain() == 0);
+  set_blockchain_block_filters_enabled(0);
+  free_block(block);
+  PASS();
+}
+
+TEST can_build_tx_index_in_background(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, genesis_block->hash, HASH_SIZE);
+  block_t *blocks[3];
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    blocks[i] = make_test_block(previous_hash);
+    ASSERT(insert_block(blocks[i], 1) == 0);
+    memcpy(previous_hash, blocks[i]->hash, HASH_SIZE);
+  }
+
+  // blocks inserted while the tx index is disabled are not indexed
+  ASSERT_EQ(get_blockchain_tx_index_height(), 0);
+  ASSERT(get_block_hash_from_tx_id(blocks[0]->transactions[0]->id) == NULL);
+
+  set_blockchain_tx_index_enabled(1);
+  ASSERT(backfill_tx_index(2) == 0);
+  ASSERT_EQ(get_blockchain_tx_index_height(), 2);
+  ASSERT(backfill_tx_index(2) == 0);
+  ASSERT_EQ(get_blockchain_tx_index_height(), 4);
+
+  uint8_t *block_hash = get_block_hash_from_tx_id(blocks[2]->transactions[0]->id);
+  ASSERT(block_hash != NULL);
+  ASSERT(compare_hash(block_hash, blocks[2]->hash));
+  free(block_hash);
+
+  // once it has caught up the tx index follows the top block
+  block_t *block = make_test_block(previous_hash);
+  ASSERT(insert_block(block, 1) == 0);
+  ASSERT_EQ(get_blockchain_tx_index_height(), 5);
+
+  block_t *tx_block = get_block_from_tx_id(block->transactions[0]->id);
+  ASSERT(tx_block != NULL);
+  ASSERT(compare_hash(tx_block->hash, block->hash));
+  free_block(tx_block);
+
+  ASSERT(disconnect_top_block(NULL) == 0);
+  ASSERT_EQ(get_blockchain_tx_index_height(), 4);
+  ASSERT(get_block_hash_from_tx_id(block->transactions[0]->id) == NULL);
+
+  ASSERT(reset_blockchain() == 0);
+  set_blockchain_tx_index_enabled(0);
+
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    free_block(blocks[i]);
+  }
+
+  free_block(block);
+  PASS();
+}
+
+TEST utxo_commitment_follows_connected_blocks(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_test_block(genesis_block->hash);
+  ASSERT(insert_block(block, 1) == 0);
+
+  uint8_t utxo_commitment[MUHASH_DIGEST_SIZE];
+  uint32_t block_height = 0;
+  ASSERT(get_utxo_commitment(utxo_commitment, &block_height) == 0);
+  ASSERT_EQ(block_height, 1);
+
+  block_t *spend_block = make_test_block(block->hash);
+  transaction_t *spend_tx = make_test_spend_tx(block->transactions[0]->id, 0, 2);
+  add_transaction_to_block(spend_block, spend_tx, 1);
+  compute_merkle_root(spend_block->merkle_root, spend_block);
+  compute_block_hash(spend_block->hash, spend_block);
+  ASSERT(insert_block(spend_block, 1) == 0);
+
+  // the commitment kept up to date block by block matches the unspent index
+  uint8_t spend_utxo_commitment[MUHASH_DIGEST_SIZE];
+  ASSERT(get_utxo_commitment(spend_utxo_commitment, &block_height) == 0);
+  ASSERT_EQ(block_height, 2);
+  ASSERT(memcmp(utxo_commitment, spend_utxo_commitment, MUHASH_DIGEST_SIZE) != 0);
+  ASSERT(verify_utxo_commitment() == 0);
+
+  // disconnecting the block brings back the commitment of the block before it
+  ASSERT(disconnect_top_block(NULL) == 0);
+  ASSERT(get_utxo_commitment(spend_utxo_commitment, &block_height) == 0);
+  ASSERT_EQ(block_height, 1);
+  ASSERT_MEM_EQ(utxo_commitment, spend_utxo_commitment, MUHASH_DIGEST_SIZE);
+  ASSERT(verify_utxo_commitment() == 0);
+
+  ASSERT(reset_blockchain() == 0);
+  free_block(block);
+  free_block(spend_block);
+  PASS();
+}
+
+TEST can_prune_old_block_bodies(void)
+{
+  // the prune depth is raised to the minimum depth that is kept for reorgs
+  const uint32_t num_of_blocks = PRUNE_MIN_BLOCK_DEPTH + 12;
+  set_blockchain_prune_depth(1);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, genesis_block->hash, HASH_SIZE);
+  for (uint32_t i = 1; i <= num_of_blocks; i++)
+  {
+    block_t *block = make_test_block(previous_hash);
+    ASSERT(insert_block(block, 0) == 0);
+    memcpy(previous_hash, block->hash, HASH_SIZE);
+    free_block(block);
+  }
+
+  ASSERT_EQ(get_blockchain_pruned_height(), 12);
+
+  // pruned blocks keep their header, but their transactions are gone
+  block_t *block = get_block_header_from_height(12);
+  ASSERT(block != NULL);
+  ASSERT(has_block_by_hash(block->hash));
+  ASSERT(is_block_pruned(block->hash));
+  free_block(block);
+  ASSERT(get_block_from_height(12) == NULL);
+
+  block = get_block_from_height(13);
+  ASSERT(block != NULL);
+  ASSERT(block->transactions != NULL);
+  ASSERT_FALSE(is_block_pruned(block->hash));
+  free_block(block);
+
+  // the pruned blocks can no longer be disconnected
+  ASSERT(rollback_blockchain(11) == 1);
+  ASSERT(rollback_blockchain(12) == 0);
+  ASSERT_EQ(get_block_height(), 12);
+  ASSERT(disconnect_top_block(NULL) == 1);
+
+  set_blockchain_prune_depth(0);
+  ASSERT(reset_blockchain() == 0);
+  ASSERT_EQ(get_blockchain_pruned_height(), 0);
+  PASS();
+}
+
+TEST can_keep_blocks_within_prune_depth(void)
 {
+  const uint32_t prune_depth = PRUNE_MIN_BLOCK_DEPTH + 20;
+  set_blockchain_prune_depth(prune_depth);
 
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  // a blockchain past the min depth but not yet past the prune depth keeps all of it's blocks
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, genesis_block->hash, HASH_SIZE);
+  for (uint32_t i = 1; i <= prune_depth + 2; i++)
+  {
+    block_t *block = make_test_block(previous_hash);
+    ASSERT(insert_block(block, 0) == 0);
+    memcpy(previous_hash, block->hash, HASH_SIZE);
+    free_block(block);
+
+    if (i == prune_depth)
+    {
+      ASSERT_EQ(get_blockchain_pruned_height(), 0);
+    }
+  }
+
+  ASSERT_EQ(get_blockchain_pruned_height(), 2);
+  block_t *block = get_block_from_height(3);
+  ASSERT(block != NULL);
+  ASSERT_FALSE(is_block_pruned(block->hash));
+  free_block(block);
+
+  set_blockchain_prune_depth(0);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_export_and_import_block_files(void)
+{
+  const char *block_filename = "block_file_tests.dat";
+  const char *truncated_block_filename = "block_file_tests_truncated.dat";
+  const uint32_t num_of_blocks = 3;
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  uint8_t block_hashes[num_of_blocks + 1][HASH_SIZE];
+  memcpy(block_hashes[0], genesis_block->hash, HASH_SIZE);
+  for (uint32_t i = 1; i <= num_of_blocks; i++)
+  {
+    block_t *block = make_test_block(block_hashes[i - 1]);
+    ASSERT(insert_block(block, 1) == 0);
+    memcpy(block_hashes[i], block->hash, HASH_SIZE);
+    free_block(block);
+  }
+
+  ASSERT(export_blocks_to_file(block_filename) == 0);
+
+  // every block is written in height order, prefixed by it's big endian size
+  FILE *fp = fopen(block_filename, "rb");
+  ASSERT(fp != NULL);
+  fseek(fp, 0L, SEEK_END);
+  long file_size = ftell(fp);
+  fseek(fp, 0L, SEEK_SET);
+  ASSERT(file_size > 0);
+
+  uint8_t *file_data = malloc(file_size);
+  ASSERT(file_data != NULL);
+  ASSERT_EQ(fread(file_data, 1, file_size, fp), (size_t)file_size);
+  fclose(fp);
+
+  long offset = 0;
+  uint32_t num_records = 0;
+  while (offset < file_size)
+  {
+    ASSERT(offset + (long)sizeof(uint32_t) <= file_size);
+    uint32_t data_len = ((uint32_t)file_data[offset] << 24) | ((uint32_t)file_data[offset + 1] << 16) |
+      ((uint32_t)file_data[offset + 2] << 8) | (uint32_t)file_data[offset + 3];
+    offset += sizeof(uint32_t);
+    ASSERT(data_len > 0 && offset + (long)data_len <= file_size);
+
+    buffer_t *buffer = buffer_init_data(0, file_data + offset, data_len);
+    buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+    block_t *block = NULL;
+    ASSERT(deserialize_block(buffer_iterator, &block) == 0);
+    ASSERT(num_records <= num_of_blocks);
+    ASSERT(compare_hash(block->hash, block_hashes[num_records]));
+    free_block(block);
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+
+    offset += data_len;
+    num_records++;
+  }
+
+  ASSERT_EQ(num_records, num_of_blocks + 1);
+
+  // the blocks we already have are skipped
+  ASSERT(init_checkpoints() == 0);
+  ASSERT(import_blocks_from_file(block_filename) == 0);
+  ASSERT_EQ(get_block_height(), num_of_blocks);
+  ASSERT(compare_hash(get_current_block_hash(), block_hashes[num_of_blocks]));
+
+  // a file which ends part of the way through a block is rejected
+  fp = fopen(truncated_block_filename, "wb");
+  ASSERT(fp != NULL);
+  ASSERT_EQ(fwrite(file_data, 1, file_size - 1, fp), (size_t)(file_size - 1));
+  fclose(fp);
+
+  ASSERT(import_blocks_from_file(truncated_block_filename) == 1);
+  ASSERT_EQ(get_block_height(), num_of_blocks);
+
+  // as is one which ends part of the way through a block's size
+  fp = fopen(truncated_block_filename, "wb");
+  ASSERT(fp != NULL);
+  ASSERT_EQ(fwrite(file_data, 1, file_size, fp), (size_t)file_size);
+  ASSERT_EQ(fwrite(file_data, 1, 2, fp), 2);
+  fclose(fp);
+
+  ASSERT(import_blocks_from_file(truncated_block_filename) == 1);
+  ASSERT_EQ(get_block_height(), num_of_blocks);
+
+  free(file_data);
+  remove(block_filename);
+  remove(truncated_block_filename);
+  ASSERT(deinit_checkpoints() == 0);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_bootstrap_from_utxo_snapshot(void)
+{
+  const char *snapshot_filename = "utxo_snapshot_tests.dat";
+  const uint32_t num_of_blocks = 4;
+  const uint32_t snapshot_height = 3;
+  uint8_t address[ADDRESS_SIZE];
+  randombytes_buf(address, ADDRESS_SIZE);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  block_t *blocks[num_of_blocks + 1];
+  uint8_t previous_hash[HASH_SIZE];
+  memcpy(previous_hash, genesis_block->hash, HASH_SIZE);
+  for (uint32_t i = 1; i <= num_of_blocks; i++)
+  {
+    block_t *block = make_test_block(previous_hash);
+    transaction_t *coinbase_tx = block->transactions[0];
+    memcpy(coinbase_tx->txouts[0]->address, address, ADDRESS_SIZE);
+    compute_self_tx_id(coinbase_tx);
+
+    compute_merkle_root(block->merkle_root, block);
+    compute_block_hash(block->hash, block);
+    ASSERT(insert_block(block, 1) == 0);
+    memcpy(previous_hash, block->hash, HASH_SIZE);
+    blocks[i] = block;
+  }
+
+  // the snapshot is taken at the checkpoint below our top block
+  ASSERT(init_checkpoints() == 0);
+  ASSERT(add_checkpoint(snapshot_height, blocks[snapshot_height]->hash) == 0);
+  ASSERT(export_utxo_snapshot(snapshot_filename) == 0);
+  ASSERT_EQ(get_block_height(), num_of_blocks);
+  ASSERT(compare_hash(get_current_block_hash(), blocks[num_of_blocks]->hash));
+
+  uint32_t height = 0;
+  uint8_t block_hash[HASH_SIZE];
+  utxo_snapshot_reader_t *reader = utxo_snapshot_reader_open(snapshot_filename, &height, block_hash);
+  ASSERT(reader != NULL);
+  ASSERT_EQ(height, snapshot_height);
+  ASSERT(compare_hash(block_hash, blocks[snapshot_height]->hash));
+
+  uint32_t num_headers = 0;
+  uint32_t num_unspent_txs = 0;
+  utxo_snapshot_entry_type_t entry_type = UTXO_SNAPSHOT_ENTRY_HEADER;
+  while (entry_type != UTXO_SNAPSHOT_ENTRY_END)
+  {
+    const uint8_t *data = NULL;
+    uint32_t data_size = 0;
+    ASSERT(utxo_snapshot_read_entry(reader, &entry_type, &data, &data_size) == 0);
+    num_headers += entry_type == UTXO_SNAPSHOT_ENTRY_HEADER;
+    num_unspent_txs += entry_type == UTXO_SNAPSHOT_ENTRY_UNSPENT_TX;
+  }
+
+  uint8_t snapshot_hash[HASH_SIZE];
+  ASSERT(utxo_snapshot_reader_get_hash(reader, snapshot_hash) == 0);
+  utxo_snapshot_reader_close(reader);
+  ASSERT_EQ(num_headers, snapshot_height + 1);
+  ASSERT_EQ(num_unspent_txs, snapshot_height);
+
+  // a snapshot is only imported once the checkpoint vouches for it's hash
+  ASSERT(reset_blockchain() == 0);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+  ASSERT(import_utxo_snapshot(snapshot_filename) == 1);
+  ASSERT_EQ(get_block_height(), 0);
+
+  ASSERT(set_checkpoint_utxo_snapshot_hash(snapshot_height, snapshot_hash) == 0);
+  ASSERT(import_utxo_snapshot(snapshot_filename) == 0);
+  ASSERT_EQ(get_block_height(), snapshot_height);
+  ASSERT(compare_hash(get_current_block_hash(), blocks[snapshot_height]->hash));
+  ASSERT_EQ(get_blockchain_pruned_height(), snapshot_height);
+  ASSERT_EQ(get_utxo_snapshot_height(), snapshot_height);
+
+  // the headers are stored without their bodies and the address index was rebuilt
+  ASSERT(has_block_by_hash(blocks[1]->hash));
+  ASSERT(is_block_pruned(blocks[1]->hash));
+  ASSERT(get_block_from_height(1) == NULL);
+  ASSERT_EQ(get_balance_for_address(address), blocks[1]->transactions[0]->txouts[0]->amount +
+    blocks[2]->transactions[0]->txouts[0]->amount + blocks[3]->transactions[0]->txouts[0]->amount);
+
+  unspent_transaction_t *unspent_tx = get_unspent_tx_from_index(blocks[2]->transactions[0]->id);
+  ASSERT(unspent_tx != NULL);
+  free_unspent_transaction(unspent_tx);
+  ASSERT(get_unspent_tx_from_index(blocks[num_of_blocks]->transactions[0]->id) == NULL);
+
+  // new blocks build on top of the snapshot
+  ASSERT(insert_block(blocks[num_of_blocks], 1) == 0);
+  ASSERT_EQ(get_block_height(), num_of_blocks);
+  unspent_tx = get_unspent_tx_from_index(blocks[num_of_blocks]->transactions[0]->id);
+  ASSERT(unspent_tx != NULL);
+  free_unspent_transaction(unspent_tx);
+
+  ASSERT(set_utxo_snapshot_verified() == 0);
+  ASSERT_EQ(get_utxo_snapshot_height(), 0);
+
+  for (uint32_t i = 1; i <= num_of_blocks; i++)
+  {
+    free_block(blocks[i]);
+  }
+
+  remove(snapshot_filename);
+  ASSERT(deinit_checkpoints() == 0);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_commit_blocks_with_each_durability(void)
+{
+  ASSERT_EQ(get_blockchain_durability_from_str("sync"), BLOCKCHAIN_DURABILITY_SYNC);
+  ASSERT_EQ(get_blockchain_durability_from_str("batch"), BLOCKCHAIN_DURABILITY_BATCH);
+  ASSERT_EQ(get_blockchain_durability_from_str("none"), BLOCKCHAIN_DURABILITY_NONE);
+  ASSERT_EQ(get_blockchain_durability_from_str("fast"), -1);
+
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  // switching durabilities syncs what was committed before the switch
+  int durabilities[] = {BLOCKCHAIN_DURABILITY_SYNC, BLOCKCHAIN_DURABILITY_NONE, BLOCKCHAIN_DURABILITY_BATCH};
+  set_blockchain_durability_batch_blocks(2);
+  block_t *blocks[3];
+  uint8_t *previous_hash = genesis_block->hash;
+  for (int i = 0; i < 3; i++)
+  {
+    ASSERT(set_blockchain_durability(durabilities[i]) == 0);
+    ASSERT_EQ(get_blockchain_durability(), durabilities[i]);
+
+    blocks[i] = make_test_block(previous_hash);
+    ASSERT(insert_block(blocks[i], 1) == 0);
+    previous_hash = blocks[i]->hash;
+  }
+
+  ASSERT(flush_blockchain() == 0);
+  ASSERT_EQ(get_block_height(), 3);
+  for (int i = 0; i < 3; i++)
+  {
+    ASSERT(has_block_by_hash(blocks[i]->hash));
+    free_block(blocks[i]);
+  }
+
+  set_blockchain_durability_batch_blocks(DEFAULT_BLOCKCHAIN_DURABILITY_BATCH_BLOCKS);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST tips_keep_reading_the_blockchain_they_were_published_with(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  blockchain_tip_t *tip = acquire_blockchain_tip();
+  ASSERT(tip != NULL);
+  ASSERT_EQ(tip->height, 0);
+  ASSERT(compare_hash(tip->hash, genesis_block->hash));
+
+  // the new block is stored but is not part of the tip acquired before it
+  block_t *block = make_test_block(genesis_block->hash);
+  ASSERT(insert_block(block, 1) == 0);
+  ASSERT(get_block_hash_from_height_at_tip(tip, 1) == NULL);
+  ASSERT(get_block_header_from_hash_at_tip(tip, block->hash) == NULL);
+
+  blockchain_tip_t *next_tip = acquire_blockchain_tip();
+  ASSERT(next_tip != NULL);
+  ASSERT_EQ(next_tip->height, 1);
+  ASSERT(compare_hash(next_tip->hash, block->hash));
+
+  block_t *tip_block = get_block_from_height_at_tip(next_tip, 1);
+  ASSERT(tip_block != NULL);
+  ASSERT(compare_hash(tip_block->hash, block->hash));
+  ASSERT_EQ(tip_block->transaction_count, block->transaction_count);
+  free_block(tip_block);
+
+  release_blockchain_tip(next_tip);
+  release_blockchain_tip(tip);
+  free_block(block);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_iterate_storage_in_key_order(void)
+{
+  char *err = NULL;
+  storage_options_t options;
+  init_storage_options(&options);
+
+  const char *storage_dir = "storage_tests";
+  storage_destroy(storage_dir, &err);
+  ASSERT(err == NULL);
+
+  storage_t *storage = storage_open(storage_dir, &options, &err);
+  ASSERT(storage != NULL);
+  ASSERT(err == NULL);
+
+  // the keys are written out of order in a single batch
+  const char *keys[] = {"c1", "b2", "a1", "b1"};
+  storage_batch_t *batch = storage_batch_create();
+  for (int i = 0; i < 4; i++)
+  {
+    storage_batch_put(batch, (const uint8_t*)keys[i], 2, (const uint8_t*)keys[i], 2);
+  }
+
+  storage_write(storage, batch, &err);
+  storage_batch_destroy(batch);
+  ASSERT(err == NULL);
+
+  // seeking to a prefix visits every key after it in order
+  const char *expected_keys[] = {"b1", "b2", "c1"};
+  int num_keys = 0;
+  storage_iterator_t *iterator = storage_iterator_create(storage);
+  for (storage_iterator_seek(iterator, (const uint8_t*)"b", 1);
+    storage_iterator_valid(iterator); storage_iterator_next(iterator))
+  {
+    size_t key_size = 0;
+    const uint8_t *key = storage_iterator_key(iterator, &key_size);
+    ASSERT(num_keys < 3);
+    ASSERT_EQ(key_size, 2);
+    ASSERT_MEM_EQ(key, expected_keys[num_keys], 2);
+    num_keys++;
+  }
+
+  storage_iterator_destroy(iterator);
+  ASSERT_EQ(num_keys, 3);
+
+  size_t value_size = 0;
+  storage_delete(storage, (const uint8_t*)"b1", 2, &err);
+  ASSERT(err == NULL);
+  ASSERT(storage_get(storage, (const uint8_t*)"b1", 2, &value_size, &err) == NULL);
+
+  uint8_t *value = storage_get(storage, (const uint8_t*)"b2", 2, &value_size, &err);
+  ASSERT(value != NULL);
+  ASSERT_EQ(value_size, 2);
+  ASSERT_MEM_EQ(value, "b2", 2);
+  storage_free(value);
+
+  ASSERT(storage_purge(storage, &err) == 0);
+  iterator = storage_iterator_create(storage);
+  storage_iterator_seek_to_first(iterator);
+  ASSERT_FALSE(storage_iterator_valid(iterator));
+  storage_iterator_destroy(iterator);
+
+  storage_close(storage);
+  storage_destroy(storage_dir, &err);
+  ASSERT(err == NULL);
+  PASS();
+}
+
+TEST can_restore_storage_from_backup(void)
+{
+  char *err = NULL;
+  storage_options_t options;
+  init_storage_options(&options);
+
+  const char *storage_dir = "storage_tests";
+  const char *storage_backup_dir = "storage_backup_tests";
+  storage_destroy(storage_dir, &err);
+  ASSERT(err == NULL);
+  storage_backup_destroy(storage_backup_dir, &err);
+  ASSERT(err == NULL);
+
+  storage_t *storage = storage_open(storage_dir, &options, &err);
+  ASSERT(storage != NULL);
+  storage_backup_t *backup = storage_backup_open(storage_backup_dir, &options, &err);
+  ASSERT(backup != NULL);
+  ASSERT(err == NULL);
+
+  storage_put(storage, (const uint8_t*)"a1", 2, (const uint8_t*)"a1", 2, &err);
+  ASSERT(err == NULL);
+  ASSERT(storage_backup_create(backup, storage, &err) == 0);
+
+  // taking a second backup replaces the first one
+  storage_put(storage, (const uint8_t*)"b1", 2, (const uint8_t*)"b1", 2, &err);
+  ASSERT(err == NULL);
+  ASSERT(storage_backup_create(backup, storage, &err) == 0);
+
+  storage_delete(storage, (const uint8_t*)"a1", 2, &err);
+  storage_put(storage, (const uint8_t*)"c1", 2, (const uint8_t*)"c1", 2, &err);
+  ASSERT(err == NULL);
+
+  // restoring brings back the entries of the latest backup only
+  ASSERT(storage_backup_restore(backup, storage, &err) == 0);
+
+  size_t value_size = 0;
+  uint8_t *value = storage_get(storage, (const uint8_t*)"a1", 2, &value_size, &err);
+  ASSERT(value != NULL);
+  storage_free(value);
+  value = storage_get(storage, (const uint8_t*)"b1", 2, &value_size, &err);
+  ASSERT(value != NULL);
+  storage_free(value);
+  ASSERT(storage_get(storage, (const uint8_t*)"c1", 2, &value_size, &err) == NULL);
+
+  storage_backup_close(backup);
+  storage_close(storage);
+  storage_backup_destroy(storage_backup_dir, &err);
+  ASSERT(err == NULL);
+  storage_destroy(storage_dir, &err);
+  ASSERT(err == NULL);
+  PASS();
+}
+
+GREATEST_SUITE(blockchain_suite)
+{
+  RUN_TEST(can_lookup_blocks_by_height);
+  RUN_TEST(header_index_follows_inserts_and_rollbacks);
+  RUN_TEST(header_index_can_lookup_many_blocks);
+  RUN_TEST(can_restore_chain_state_from_manifest);
+  RUN_TEST(can_load_block_transactions_on_demand);
+  RUN_TEST(can_read_stored_block_views);
+  RUN_TEST(can_cache_recently_used_blocks);
+  RUN_TEST(can_hold_orphan_blocks);
+  RUN_TEST(can_commit_block_spending_txs_from_same_block);
+  RUN_TEST(utxo_cache_defers_unspent_index_writes);
+  RUN_TEST(can_prefetch_unspent_txs_into_utxo_cache);
+  RUN_TEST(can_query_unspent_txouts_by_address);
+  RUN_TEST(can_disconnect_blocks_with_undo_records);
+  RUN_TEST(can_bound_blockchain_reorg_depth);
+  RUN_TEST(wallet_outputs_follow_connected_blocks);
+  RUN_TEST(wallet_catches_up_from_block_filters);
+  RUN_TEST(can_store_received_block_filters);
+  RUN_TEST(can_build_tx_index_in_background);
+  RUN_TEST(utxo_commitment_follows_connected_blocks);
+  RUN_TEST(can_prune_old_block_bodies);
+  RUN_TEST(can_keep_blocks_within_prune_depth);
+  RUN_TEST(can_export_and_import_block_files);
+  RUN_TEST(can_bootstrap_from_utxo_snapshot);
+  RUN_TEST(can_commit_blocks_with_each_durability);
+  RUN_TEST(tips_keep_reading_the_blockchain_they_were_published_with);
+  RUN_TEST(can_iterate_storage_in_key_order);
+  RUN_TEST(can_restore_storage_from_backup);
 }
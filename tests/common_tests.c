@@ -26,12 +26,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
+#ifdef __linux__
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+#include "common/affinity.h"
 #include "common/buffer_iterator.h"
 #include "common/buffer.h"
+#include "common/buffer_pool.h"
 #include "common/buffer_storage.h"
 #include "common/greatest.h"
+#include "common/json.h"
+#include "common/logger.h"
+#include "common/metrics.h"
 #include "common/task.h"
+#include "common/trace.h"
 #include "common/util.h"
 
 SUITE(common_suite);
@@ -48,6 +60,35 @@ static task_result_t task2_func(task_t *task)
   return TASK_RESULT_CONT;
 }
 
+static int g_delayed_task_num_runs = 0;
+
+static task_result_t delayed_task_func(task_t *task)
+{
+  g_delayed_task_num_runs++;
+  return TASK_RESULT_DONE;
+}
+
+#define NUM_TEST_PARENT_JOBS 32
+#define NUM_TEST_CHILD_JOBS 4
+
+static job_group_t g_test_job_group;
+static int g_test_job_results[NUM_TEST_PARENT_JOBS * NUM_TEST_CHILD_JOBS];
+
+static void child_job_func(void *arg)
+{
+  int *result = (int*)arg;
+  (*result)++;
+}
+
+static void parent_job_func(void *arg)
+{
+  int parent_index = *(int*)arg;
+  for (int i = 0; i < NUM_TEST_CHILD_JOBS; i++)
+  {
+    add_job(child_job_func, &g_test_job_results[(parent_index * NUM_TEST_CHILD_JOBS) + i], &g_test_job_group);
+  }
+}
+
 TEST buffer_common_tests(void)
 {
   buffer_t *buffer = buffer_init();
@@ -229,6 +270,33 @@ TEST buffer_common_tests(void)
   PASS();
 }
 
+TEST buffer_pool_common_tests(void)
+{
+  ASSERT(init_buffer_pool() == 0);
+
+  // released buffers are handed out again for sizes of the same class
+  uint8_t *data = buffer_pool_acquire(100);
+  ASSERT(data != NULL);
+  memset(data, 0xff, 100);
+  buffer_pool_release(data);
+  ASSERT_EQ(get_buffer_pool_num_free(), 1);
+
+  uint8_t *reused_data = buffer_pool_acquire(BUFFER_POOL_MIN_CLASS_SIZE * 2);
+  ASSERT_EQ(reused_data, data);
+  ASSERT_EQ(get_buffer_pool_num_free(), 0);
+
+  // buffers larger than the largest class are never pooled
+  uint8_t *large_data = buffer_pool_acquire(BUFFER_POOL_MAX_CLASS_SIZE + 1);
+  ASSERT(large_data != NULL);
+  large_data[BUFFER_POOL_MAX_CLASS_SIZE] = 1;
+  buffer_pool_release(large_data);
+  ASSERT_EQ(get_buffer_pool_num_free(), 0);
+
+  buffer_pool_release(reused_data);
+  ASSERT(deinit_buffer_pool() == 0);
+  PASS();
+}
+
 TEST buffer_storage_common_tests(void)
 {
   char *err = NULL;
@@ -318,6 +386,81 @@ TEST buffer_storage_common_tests(void)
   PASS();
 }
 
+TEST can_read_and_write_varints(void)
+{
+  const uint64_t values[] = {0, 1, 127, 128, 16383, 16384, UINT32_MAX, UINT64_MAX};
+  const size_t sizes[] = {1, 1, 1, 2, 2, 3, 5, BUFFER_MAX_VARINT_SIZE};
+
+  buffer_t *buffer = buffer_init();
+  for (size_t i = 0; i < sizeof(values) / sizeof(uint64_t); i++)
+  {
+    size_t size = buffer_get_size(buffer);
+    ASSERT(buffer_write_varint(buffer, values[i]) == 0);
+    ASSERT_EQ(buffer_get_size(buffer) - size, sizes[i]);
+  }
+
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  for (size_t i = 0; i < sizeof(values) / sizeof(uint64_t); i++)
+  {
+    uint64_t value = 0;
+    ASSERT(buffer_read_varint(buffer_iterator, &value) == 0);
+    ASSERT(value == values[i]);
+  }
+
+  ASSERT_EQ(buffer_get_remaining_size(buffer_iterator), 0);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+
+  // truncated values and values with trailing zero groups are rejected
+  const uint8_t truncated[] = {0x80};
+  const uint8_t non_canonical[] = {0x81, 0x00};
+  buffer_t truncated_buffer = {(uint8_t*)truncated, sizeof(truncated), 0, 0};
+  buffer_t non_canonical_buffer = {(uint8_t*)non_canonical, sizeof(non_canonical), 0, 0};
+  buffer_iterator_t truncated_iterator = {&truncated_buffer, 0};
+  buffer_iterator_t non_canonical_iterator = {&non_canonical_buffer, 0};
+
+  uint64_t value = 0;
+  ASSERT(buffer_read_varint(&truncated_iterator, &value) == 1);
+  ASSERT(buffer_read_varint(&non_canonical_iterator, &value) == 1);
+  PASS();
+}
+
+TEST can_reuse_buffer_allocation(void)
+{
+  buffer_t *buffer = buffer_init();
+  for (uint32_t i = 0; i < 1000; i++)
+  {
+    ASSERT_EQ(buffer_write_uint32(buffer, i), 0);
+  }
+
+  // the allocation grows geometrically rather than once per write
+  ASSERT_EQ(buffer_get_size(buffer), 4000);
+  ASSERT(buffer_get_capacity(buffer) >= 4000);
+  ASSERT(buffer_get_capacity(buffer) < 8000);
+
+  uint8_t *data = buffer_get_data(buffer);
+  size_t capacity = buffer_get_capacity(buffer);
+  buffer_reset(buffer);
+  ASSERT_EQ(buffer_get_size(buffer), 0);
+  ASSERT_EQ(buffer_get_offset(buffer), 0);
+  ASSERT_EQ(buffer_get_capacity(buffer), capacity);
+
+  ASSERT_EQ(buffer_write_uint32(buffer, 1), 0);
+  ASSERT_EQ(buffer_get_data(buffer), data);
+  buffer_free(buffer);
+
+  // scratch buffers given back are handed out again empty
+  buffer_t *scratch_buffer = buffer_acquire_scratch();
+  ASSERT_EQ(buffer_write_uint64(scratch_buffer, 1), 0);
+  buffer_release_scratch(scratch_buffer);
+
+  buffer_t *other_scratch_buffer = buffer_acquire_scratch();
+  ASSERT_EQ(other_scratch_buffer, scratch_buffer);
+  ASSERT_EQ(buffer_get_size(other_scratch_buffer), 0);
+  buffer_release_scratch(other_scratch_buffer);
+  PASS();
+}
+
 TEST task_common_tests(void)
 {
   task_t *task1 = add_task(task1_func, 0);
@@ -348,9 +491,425 @@ TEST task_common_tests(void)
   PASS();
 }
 
+TEST can_run_task_once_due(void)
+{
+  g_delayed_task_num_runs = 0;
+  task_t *task = add_task(delayed_task_func, 0.05);
+  ASSERT(task != NULL);
+
+  // the task is not run before it's deadline, and the task
+  // manager sleeps until the deadline instead of spinning...
+  ASSERT_EQ(taskmgr_tick(), 0);
+  ASSERT_EQ(g_delayed_task_num_runs, 0);
+  ASSERT(taskmgr_get_next_task_delay(1000) <= 50);
+
+  for (int i = 0; i < 100 && g_delayed_task_num_runs == 0; i++)
+  {
+    ASSERT_EQ(taskmgr_wait(), 0);
+    ASSERT_EQ(taskmgr_tick(), 0);
+  }
+
+  ASSERT_EQ(g_delayed_task_num_runs, 1);
+  PASS();
+}
+
+TEST can_run_jobs_in_job_group(void)
+{
+  int parent_indexes[NUM_TEST_PARENT_JOBS];
+  memset(g_test_job_results, 0, sizeof(g_test_job_results));
+  ASSERT_EQ(init_job_group(&g_test_job_group), 0);
+
+  // jobs added by a job are counted in the same job group, so waiting
+  // on the group also waits on all of the child jobs...
+  for (int i = 0; i < NUM_TEST_PARENT_JOBS; i++)
+  {
+    parent_indexes[i] = i;
+    ASSERT_EQ(add_job(parent_job_func, &parent_indexes[i], &g_test_job_group), 0);
+  }
+
+  ASSERT_EQ(wait_job_group(&g_test_job_group), 0);
+  ASSERT_EQ(g_test_job_group.num_pending_jobs, 0);
+  for (int i = 0; i < NUM_TEST_PARENT_JOBS * NUM_TEST_CHILD_JOBS; i++)
+  {
+    ASSERT_EQ(g_test_job_results[i], 1);
+  }
+
+  free_job_group(&g_test_job_group);
+  PASS();
+}
+
+static const char *g_test_metric_label_values[] = {"a", "b"};
+static metric_t g_test_counter_metric = METRIC_LABELED_COUNTER_INIT("vulkan_test_total",
+  "Test counter", "label", g_test_metric_label_values, 2);
+static metric_t g_test_histogram_metric = METRIC_HISTOGRAM_INIT("vulkan_test_seconds", "Test histogram");
+static metric_t g_test_unregistered_metric = METRIC_COUNTER_INIT("vulkan_test_unregistered_total", "Test counter");
+
+#define NUM_TEST_METRIC_JOBS 64
+
+static void metric_job_func(void *arg)
+{
+  metric_counter_add(&g_test_counter_metric, 1, 2);
+  metric_histogram_observe(&g_test_histogram_metric, 0, 300);
+}
+
+TEST can_record_sharded_metrics(void)
+{
+  ASSERT_EQ(register_metric(&g_test_counter_metric), 0);
+  ASSERT_EQ(register_metric(&g_test_counter_metric), 0);
+  ASSERT_EQ(register_metric(&g_test_histogram_metric), 0);
+
+  // recording into a metric which was never registered does nothing
+  metric_counter_add(&g_test_unregistered_metric, 0, 1);
+  ASSERT_EQ(get_metric_counter_value(&g_test_unregistered_metric, 0), 0);
+
+  job_group_t job_group;
+  ASSERT_EQ(init_job_group(&job_group), 0);
+  for (int i = 0; i < NUM_TEST_METRIC_JOBS; i++)
+  {
+    ASSERT_EQ(add_job(metric_job_func, NULL, &job_group), 0);
+  }
+
+  ASSERT_EQ(wait_job_group(&job_group), 0);
+  free_job_group(&job_group);
+
+  metric_counter_add(&g_test_counter_metric, 0, 5);
+  ASSERT_EQ(get_metric_counter_value(&g_test_counter_metric, 0), 5);
+  ASSERT_EQ(get_metric_counter_value(&g_test_counter_metric, 1), NUM_TEST_METRIC_JOBS * 2);
+  ASSERT_EQ(get_metric_histogram_count(&g_test_histogram_metric, 0), NUM_TEST_METRIC_JOBS);
+
+  buffer_t *buffer = buffer_init();
+  ASSERT_EQ(write_metrics(buffer), 0);
+  buffer_write_uint8(buffer, 0);
+
+  const char *text = (const char*)buffer_get_data(buffer);
+  ASSERT(strstr(text, "# TYPE vulkan_test_total counter\n") != NULL);
+  ASSERT(strstr(text, "vulkan_test_total{label=\"b\"} 128\n") != NULL);
+  ASSERT(strstr(text, "vulkan_test_seconds_bucket{le=\"0.0001\"} 0\n") != NULL);
+  ASSERT(strstr(text, "vulkan_test_seconds_bucket{le=\"0.0005\"} 64\n") != NULL);
+  ASSERT(strstr(text, "vulkan_test_seconds_count 64\n") != NULL);
+  buffer_free(buffer);
+  PASS();
+}
+
+TEST can_dump_trace_spans(void)
+{
+  const char *trace_filename = "trace_tests.json";
+  set_tracing_enabled(1);
+  if (get_tracing_enabled() == 0)
+  {
+    SKIP();
+  }
+
+  set_trace_thread_name("trace tests");
+
+  trace_span_t span = begin_trace_span("test_span");
+  ASSERT(span.start_time > 0);
+  end_trace_span(&span);
+  ASSERT_EQ(dump_trace(trace_filename), 0);
+
+  FILE *file = fopen(trace_filename, "rb");
+  ASSERT(file != NULL);
+
+  char text[1024 * 64];
+  size_t size = fread(text, 1, sizeof(text) - 1, file);
+  text[size] = '\0';
+  fclose(file);
+  remove(trace_filename);
+
+  ASSERT(strstr(text, "\"traceEvents\":[") != NULL);
+  ASSERT(strstr(text, "\"args\":{\"name\":\"trace tests\"}") != NULL);
+  ASSERT(strstr(text, "{\"name\":\"test_span\",\"ph\":\"X\"") != NULL);
+
+  // spans which began while tracing is disabled are never recorded
+  set_tracing_enabled(0);
+  span = begin_trace_span("test_span");
+  ASSERT_EQ(span.start_time, 0);
+  ASSERT(dump_trace(trace_filename) != 0);
+  set_tracing_enabled(1);
+  PASS();
+}
+
+TEST can_write_async_log_messages(void)
+{
+  const char *log_filename = "async_logger_tests.log";
+  logger_set_log_filename(log_filename);
+  logger_set_async(1);
+  ASSERT_EQ(logger_open(), 0);
+  logger_set_quiet(1);
+
+  for (int i = 0; i < 100; i++)
+  {
+    ASSERT_EQ(LOG_INFO("Async log message: %d", i), 0);
+  }
+
+  // an error is written out right away after the messages before it
+  ASSERT_EQ(LOG_ERROR("Async log error"), 0);
+  ASSERT_EQ(logger_get_num_dropped_messages(), 0);
+  ASSERT_EQ(logger_close(), 0);
+  logger_set_async(0);
+  logger_set_quiet(0);
+
+  FILE *fp = fopen(log_filename, "r");
+  ASSERT(fp != NULL);
+
+  int num_lines = 0;
+  int last_line_is_error = 0;
+  char line[LOGGER_MAX_MESSAGE_SIZE * 2];
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    last_line_is_error = strstr(line, "Async log error") != NULL;
+    num_lines++;
+  }
+
+  fclose(fp);
+  remove(log_filename);
+
+  // the opened log file message, the info messages and the error
+  ASSERT_EQ(num_lines, 102);
+  ASSERT(last_line_is_error);
+  PASS();
+}
+
+static int g_lazy_log_num_formats = 0;
+
+static const char* get_lazy_log_arg(void)
+{
+  g_lazy_log_num_formats++;
+  return "arg";
+}
+
+TEST can_gate_log_messages_by_module(void)
+{
+  const char *log_filename = "module_logger_tests.log";
+  logger_set_log_filename(log_filename);
+  ASSERT_EQ(logger_open(), 0);
+  logger_set_quiet(1);
+
+  log_set_level(LOG_LEVEL_WARNING);
+  ASSERT_EQ(logger_set_module_level("protocol", LOG_LEVEL_DEBUG), 0);
+
+  logger_level_t level;
+  ASSERT_EQ(logger_get_module_level("protocol", &level), 0);
+  ASSERT_EQ(level, LOG_LEVEL_DEBUG);
+  ASSERT_EQ(logger_get_module_level("blockchain", &level), 1);
+  ASSERT_EQ(level, LOG_LEVEL_WARNING);
+
+  ASSERT(logger_is_enabled(LOG_LEVEL_DEBUG, "src/core/protocol.c"));
+  ASSERT(logger_is_enabled(LOG_LEVEL_DEBUG, "src/core/blockchain.c") == 0);
+  ASSERT(logger_is_enabled(LOG_LEVEL_WARNING, "src/core/blockchain.c"));
+  ASSERT(logger_is_enabled(LOG_LEVEL_ERROR, "src/core/blockchain.c"));
+
+  // the arguments of a disabled message are never evaluated
+  g_lazy_log_num_formats = 0;
+  LOG_DEBUG("Lazy log message: %s", get_lazy_log_arg());
+  ASSERT_EQ(g_lazy_log_num_formats, 0);
+  LOG_WARNING("Lazy log message: %s", get_lazy_log_arg());
+  ASSERT_EQ(g_lazy_log_num_formats, 1);
+
+  ASSERT_EQ(logger_get_level_from_str("debug", &level), 0);
+  ASSERT_EQ(level, LOG_LEVEL_DEBUG);
+  ASSERT_EQ(logger_get_level_from_str("verbose", &level), 1);
+
+  uint8_t hash[HASH_SIZE];
+  memset(hash, 0xab, sizeof(hash));
+  char *hash_str = bin2hex(hash, sizeof(hash));
+  ASSERT_STR_EQ(HASH2HEX_STR(hash), hash_str);
+  free(hash_str);
+
+  ASSERT_EQ(logger_set_module_level("protocol", LOG_LEVEL_FATAL), 0);
+  log_set_level(LOG_LEVEL_FATAL);
+  ASSERT_EQ(logger_close(), 0);
+  logger_set_quiet(0);
+  remove(log_filename);
+  PASS();
+}
+
+TEST can_parse_json_values(void)
+{
+  const char *data = " {\"id\": 7, \"method\" : \"get\\u00e9\\ud83d\\ude00\\n\", \"params\":[true, false, null, -1.5e3, {}, []]} ";
+  json_value_t *value = parse_json(data, strlen(data));
+  ASSERT(value != NULL);
+  ASSERT_EQ(value->type, JSON_TYPE_OBJECT);
+  ASSERT_EQ(value->num_values, 3);
+
+  uint64_t id = 0;
+  ASSERT_EQ(get_json_uint64(get_json_object_value(value, "id"), &id), 0);
+  ASSERT_EQ(id, 7);
+
+  // escapes are decoded, surrogate pairs into a single code point
+  json_value_t *method = get_json_object_value(value, "method");
+  ASSERT(method != NULL);
+  ASSERT_EQ(method->type, JSON_TYPE_STRING);
+  ASSERT_EQ(method->string_size, 10);
+  ASSERT_MEM_EQ(method->string, "get\xc3\xa9\xf0\x9f\x98\x80\n", 10);
+
+  json_value_t *params = get_json_object_value(value, "params");
+  ASSERT(params != NULL);
+  ASSERT_EQ(params->type, JSON_TYPE_ARRAY);
+  ASSERT_EQ(params->num_values, 6);
+  ASSERT_EQ(params->values[0]->type, JSON_TYPE_BOOL);
+  ASSERT_EQ(params->values[0]->boolean, 1);
+  ASSERT_EQ(params->values[1]->boolean, 0);
+  ASSERT_EQ(params->values[2]->type, JSON_TYPE_NULL);
+  ASSERT_EQ(params->values[3]->type, JSON_TYPE_NUMBER);
+  ASSERT_STR_EQ(params->values[3]->string, "-1.5e3");
+  ASSERT_EQ(params->values[4]->type, JSON_TYPE_OBJECT);
+  ASSERT_EQ(params->values[4]->num_values, 0);
+  ASSERT_EQ(params->values[5]->type, JSON_TYPE_ARRAY);
+  ASSERT_EQ(params->values[5]->num_values, 0);
+  ASSERT(get_json_object_value(value, "missing") == NULL);
+  ASSERT(get_json_object_value(params, "id") == NULL);
+
+  // only unsigned integers fit a uint64
+  ASSERT_EQ(get_json_uint64(params->values[3], &id), 1);
+  ASSERT_EQ(get_json_uint64(params->values[0], &id), 1);
+
+  // values are written back out as they were parsed, numbers keep their text
+  buffer_t *buffer = buffer_init();
+  ASSERT_EQ(json_write_value(buffer, params), 0);
+  const char *expected = "[true,false,null,-1.5e3,{},[]]";
+  ASSERT_EQ(buffer_get_size(buffer), strlen(expected));
+  ASSERT_MEM_EQ(buffer_get_data(buffer), expected, strlen(expected));
+  buffer_free(buffer);
+
+  free_json_value(value);
+  PASS();
+}
+
+TEST can_reject_invalid_json(void)
+{
+  const char *invalid_documents[] = {
+    "",
+    "{\"id\":1",
+    "{\"id\" 1}",
+    "{id:1}",
+    "[1,]",
+    "[1 2]",
+    "{\"id\":1} 2",
+    "\"unterminated",
+    "\"bad \\x escape\"",
+    "\"raw \n control\"",
+    "\"\\u12\"",
+    "1.2.3",
+    "-",
+    "tru",
+    "nul"
+  };
+
+  for (size_t i = 0; i < sizeof(invalid_documents) / sizeof(invalid_documents[0]); i++)
+  {
+    ASSERT(parse_json(invalid_documents[i], strlen(invalid_documents[i])) == NULL);
+  }
+
+  // containers may only be nested up to the max depth
+  char nested[JSON_MAX_DEPTH * 2 + 2];
+  memset(nested, '[', JSON_MAX_DEPTH);
+  memset(nested + JSON_MAX_DEPTH, ']', JSON_MAX_DEPTH);
+  json_value_t *value = parse_json(nested, JSON_MAX_DEPTH * 2);
+  ASSERT(value != NULL);
+  free_json_value(value);
+
+  memset(nested, '[', JSON_MAX_DEPTH + 1);
+  memset(nested + JSON_MAX_DEPTH + 1, ']', JSON_MAX_DEPTH + 1);
+  ASSERT(parse_json(nested, JSON_MAX_DEPTH * 2 + 2) == NULL);
+
+  // a number too large for a uint64 is still valid json
+  const char *large_number = "18446744073709551616";
+  value = parse_json(large_number, strlen(large_number));
+  ASSERT(value != NULL);
+  uint64_t number = 0;
+  ASSERT_EQ(get_json_uint64(value, &number), 1);
+  free_json_value(value);
+  PASS();
+}
+
+TEST can_parse_affinity_cpu_list(void)
+{
+  uint16_t cpus[MAX_NUM_AFFINITY_CPUS];
+  uint16_t num_cpus = 0;
+  ASSERT_EQ(parse_affinity_cpu_list("0-3,8,10-11\n", cpus, MAX_NUM_AFFINITY_CPUS, &num_cpus), 0);
+
+  const uint16_t expected_cpus[] = {0, 1, 2, 3, 8, 10, 11};
+  ASSERT_EQ(num_cpus, sizeof(expected_cpus) / sizeof(expected_cpus[0]));
+  for (uint16_t i = 0; i < num_cpus; i++)
+  {
+    ASSERT_EQ(cpus[i], expected_cpus[i]);
+  }
+
+  // a numa node without any cpus of it's own has an empty list
+  ASSERT_EQ(parse_affinity_cpu_list("\n", cpus, MAX_NUM_AFFINITY_CPUS, &num_cpus), 0);
+  ASSERT_EQ(num_cpus, 0);
+
+  ASSERT_EQ(parse_affinity_cpu_list("0-", cpus, MAX_NUM_AFFINITY_CPUS, &num_cpus), 1);
+  ASSERT_EQ(parse_affinity_cpu_list("3-1", cpus, MAX_NUM_AFFINITY_CPUS, &num_cpus), 1);
+  ASSERT_EQ(parse_affinity_cpu_list("0,a", cpus, MAX_NUM_AFFINITY_CPUS, &num_cpus), 1);
+  ASSERT_EQ(parse_affinity_cpu_list("0-7", cpus, 4, &num_cpus), 1);
+  PASS();
+}
+
+TEST can_fall_back_without_numa_nodes(void)
+{
+  // threads are not pinned when the node directories are missing
+  set_thread_affinity_enabled(1);
+  set_thread_affinity_sysfs_root("affinity_tests_missing");
+  ASSERT_EQ(init_thread_affinity(), 0);
+  ASSERT_EQ(get_thread_affinity_enabled(), 0);
+  ASSERT_EQ(get_num_affinity_cpus(), 0);
+  ASSERT_EQ(set_current_thread_affinity(THREAD_AFFINITY_MINER, 0), 0);
+  deinit_thread_affinity();
+
+#ifdef __linux__
+  // every cpu the process may run on is named by the single node's cpu list
+  const char *sysfs_root = "affinity_tests";
+  ASSERT_EQ(mkdir(sysfs_root, 0755), 0);
+  ASSERT_EQ(mkdir("affinity_tests/node", 0755), 0);
+  ASSERT_EQ(mkdir("affinity_tests/node/node0", 0755), 0);
+
+  FILE *fp = fopen("affinity_tests/node/node0/cpulist", "w");
+  ASSERT(fp != NULL);
+  fputs("0-1023\n", fp);
+  fclose(fp);
+
+  set_thread_affinity_enabled(1);
+  set_thread_affinity_sysfs_root(sysfs_root);
+  int result = init_thread_affinity();
+  int enabled = get_thread_affinity_enabled();
+  uint16_t num_cpus = get_num_affinity_cpus();
+  uint16_t num_nodes = get_num_numa_nodes();
+
+  remove("affinity_tests/node/node0/cpulist");
+  rmdir("affinity_tests/node/node0");
+  rmdir("affinity_tests/node");
+  rmdir(sysfs_root);
+  deinit_thread_affinity();
+
+  ASSERT_EQ(result, 0);
+  ASSERT_EQ(enabled, 1);
+  ASSERT(num_cpus > 0);
+  ASSERT_EQ(num_nodes, 1);
+#endif
+
+  set_thread_affinity_enabled(0);
+  set_thread_affinity_sysfs_root(AFFINITY_SYSFS_ROOT);
+  PASS();
+}
+
 GREATEST_SUITE(common_suite)
 {
   RUN_TEST(buffer_common_tests);
+  RUN_TEST(buffer_pool_common_tests);
   RUN_TEST(buffer_storage_common_tests);
+  RUN_TEST(can_reuse_buffer_allocation);
+  RUN_TEST(can_read_and_write_varints);
   RUN_TEST(task_common_tests);
+  RUN_TEST(can_run_task_once_due);
+  RUN_TEST(can_run_jobs_in_job_group);
+  RUN_TEST(can_record_sharded_metrics);
+  RUN_TEST(can_dump_trace_spans);
+  RUN_TEST(can_write_async_log_messages);
+  RUN_TEST(can_gate_log_messages_by_module);
+  RUN_TEST(can_parse_json_values);
+  RUN_TEST(can_reject_invalid_json);
+  RUN_TEST(can_parse_affinity_cpu_list);
+  RUN_TEST(can_fall_back_without_numa_nodes);
 }
@@ -36,6 +36,7 @@
 
 #include "crypto/bignum_util.h"
 #include "crypto/cryptoutil.h"
+#include "crypto/muhash.h"
 #include "crypto/sha256d.h"
 
 #include "core/pow.h"
@@ -146,6 +147,73 @@ TEST bignum_compact_tests(void)
   PASS();
 }
 
+TEST uint256_compact_tests(void)
+{
+  const uint32_t compact_values[] = {
+    0, 0x00123456, 0x01003456, 0x02000056, 0x03000000, 0x04000000, 0x00923456, 0x01803456,
+    0x02800056, 0x03800000, 0x04800000, 0x01123456, 0x01fedcba, 0x02123456, 0x03123456,
+    0x04123456, 0x05009234, 0x20123456, 0x1d00ffff, 0x1b04864c, 0x1715a35c
+  };
+
+  BIGNUM *num = BN_new();
+  for (uint32_t i = 0; i < 1024; i++)
+  {
+    uint32_t n_compact = 0;
+    if (i < sizeof(compact_values) / sizeof(uint32_t))
+    {
+      n_compact = compact_values[i];
+    }
+    else
+    {
+      // random positive targets which fit into 256 bits
+      n_compact = ((randombytes_uniform(32) + 1) << 24) | (randombytes_random() & 0x007fffff);
+    }
+
+    int is_negative = 0;
+    int is_overflow = 0;
+    uint256_t n;
+    uint256_set_compact(&n, n_compact, &is_negative, &is_overflow);
+    ASSERT_FALSE(is_overflow);
+
+    bignum_set_compact(num, n_compact);
+    ASSERT_EQ(is_negative, BN_is_negative(num) && !BN_is_zero(num));
+    if (is_negative)
+    {
+      continue;
+    }
+
+    ASSERT_EQ(uint256_get_compact(&n), bignum_get_compact(num));
+
+    uint8_t bytes[UINT256_SIZE];
+    uint8_t expected_bytes[UINT256_SIZE];
+    uint256_to_bytes(bytes, &n);
+    ASSERT(BN_bn2binpad(num, expected_bytes, UINT256_SIZE) == UINT256_SIZE);
+    ASSERT_MEM_EQ(bytes, expected_bytes, UINT256_SIZE);
+
+    uint256_t other_n;
+    uint256_from_bytes(&other_n, bytes);
+    ASSERT_EQ(uint256_compare(&n, &other_n), 0);
+  }
+
+  int is_negative = 0;
+  int is_overflow = 0;
+  uint256_t n;
+  uint256_set_compact(&n, 0x23123456, &is_negative, &is_overflow);
+  ASSERT(is_overflow);
+
+  // the work of the bitcoin genesis block's target
+  ASSERT(get_proof_of_work(&n, 0x1d00ffff) == 0);
+  ASSERT_EQ(n.words[0], 0x00010001U);
+  ASSERT_EQ(n.words[1], 0x00000001U);
+  for (int i = 2; i < UINT256_NUM_WORDS; i++)
+  {
+    ASSERT_EQ(n.words[i], 0U);
+  }
+
+  BN_clear_free(num);
+  PASS();
+}
+
 TEST pow_validation_tests(void)
 {
   size_t out_size = 0;
@@ -198,9 +266,204 @@ TEST pow_validation_tests(void)
   PASS();
 }
 
+TEST sha256d_header_hash_tests(void)
+{
+  unsigned char header[100];
+  randombytes_buf(header, sizeof(header));
+
+  sha256d_header_ctx_t ctx;
+  ASSERT(crypto_sha256d_header_init(&ctx, header, sizeof(header)) == 0);
+
+  // patching the first block should hash the same as the patched header
+  for (int i = 0; i < 4; i++)
+  {
+    header[8 + i] ^= 0xff;
+    ctx.first_block[8 + i] ^= 0xff;
+
+    unsigned char expected_hash[crypto_hash_sha256_BYTES];
+    crypto_hash_sha256d(expected_hash, header, sizeof(header));
+
+    unsigned char hash[crypto_hash_sha256_BYTES];
+    crypto_sha256d_header_hash(hash, &ctx);
+    ASSERT_MEM_EQ(hash, expected_hash, crypto_hash_sha256_BYTES);
+  }
+
+  ASSERT(crypto_sha256d_header_init(&ctx, header, 64) == 1);
+  ASSERT(crypto_sha256d_header_init(&ctx, header, SHA256D_MAX_HEADER_SIZE + 1) == 1);
+  PASS();
+}
+
+TEST sha256d_backend_tests(void)
+{
+  const char *backend_names[] = {"avx512", "shani", "avx2", "sse41", "neon", "scalar"};
+  const char *default_backend_name = crypto_sha256d_get_backend_name();
+
+  unsigned char header[100];
+  randombytes_buf(header, sizeof(header));
+
+  sha256d_header_ctx_t ctx;
+  ASSERT(crypto_sha256d_header_init(&ctx, header, sizeof(header)) == 0);
+
+  // messages of different lengths cover the padding edge cases of the lanes
+  const size_t message_sizes[] = {0, 1, 55, 56, 63, 64, 65, 119, 120, 200, 32, 64, 64, 300, 7, 128, 129};
+  const size_t num_messages = sizeof(message_sizes) / sizeof(size_t);
+
+  unsigned char message_data[num_messages][300];
+  const unsigned char *messages[num_messages];
+  for (size_t i = 0; i < num_messages; i++)
+  {
+    randombytes_buf(message_data[i], sizeof(message_data[i]));
+    messages[i] = message_data[i];
+  }
+
+  uint32_t words[19];
+  for (int i = 0; i < 19; i++)
+  {
+    words[i] = randombytes_random();
+  }
+
+  for (size_t i = 0; i < sizeof(backend_names) / sizeof(char*); i++)
+  {
+    if (crypto_sha256d_set_backend(backend_names[i]))
+    {
+      continue;
+    }
+
+    unsigned char hashes[19 * crypto_hash_sha256_BYTES];
+    crypto_sha256d_header_hash_multi(hashes, &ctx, 8, words, 19);
+    for (int j = 0; j < 19; j++)
+    {
+      unsigned char patched_header[100];
+      memcpy(patched_header, header, sizeof(header));
+      memcpy(patched_header + 8, &words[j], sizeof(uint32_t));
+
+      unsigned char expected_hash[crypto_hash_sha256_BYTES];
+      crypto_hash_sha256d(expected_hash, patched_header, sizeof(patched_header));
+      ASSERT_MEM_EQ(hashes + (j * crypto_hash_sha256_BYTES), expected_hash, crypto_hash_sha256_BYTES);
+    }
+
+    unsigned char message_hashes[num_messages * crypto_hash_sha256_BYTES];
+    crypto_hash_sha256d_multi(message_hashes, messages, message_sizes, num_messages);
+    for (size_t j = 0; j < num_messages; j++)
+    {
+      unsigned char expected_hash[crypto_hash_sha256_BYTES];
+      crypto_hash_sha256d(expected_hash, messages[j], message_sizes[j]);
+      ASSERT_MEM_EQ(message_hashes + (j * crypto_hash_sha256_BYTES), expected_hash, crypto_hash_sha256_BYTES);
+    }
+  }
+
+  ASSERT(crypto_sha256d_set_backend("unknown") == 1);
+  ASSERT(crypto_sha256d_set_backend(default_backend_name) == 0);
+  PASS();
+}
+
+TEST pow_target_tests(void)
+{
+  const char *hash_strs[] = {
+    "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f",
+    "000000000003ba27aa200b1cecaad478d2b00432346c3f1f3986da1afd33e506",
+    "000000000000000004ec466ce4732fe6f1ed1cddc2ed4b328fff5224276e3f6f"
+  };
+
+  const uint32_t bits[] = {0x1d00ffff, 0x1b04864c, 0x1806b99f};
+
+  for (int i = 0; i < 3; i++)
+  {
+    size_t out_size = 0;
+    uint8_t *hash = hex2bin(hash_strs[i], &out_size);
+    ASSERT(out_size == HASH_SIZE);
+
+    // the hashes only satisfy the targets up to their own difficulty
+    for (int j = 0; j < 3; j++)
+    {
+      uint8_t target[HASH_SIZE];
+      ASSERT(get_proof_of_work_target(target, bits[j]) == 0);
+      ASSERT_EQ(check_proof_of_work_target(hash, target), check_proof_of_work(hash, bits[j]));
+      ASSERT_EQ(check_proof_of_work_target(hash, target), j <= i);
+    }
+
+    free(hash);
+  }
+
+  // targets above the proof-of-work limit are rejected
+  uint8_t target[HASH_SIZE];
+  ASSERT(get_proof_of_work_target(target, 0x1e00ffff) == 1);
+  ASSERT(get_proof_of_work_target(target, 0) == 1);
+  PASS();
+}
+
+TEST muhash_tests(void)
+{
+  const uint8_t elements[3][4] = {{1, 2, 3, 4}, {5, 6, 7, 8}, {9, 10, 11, 12}};
+
+  muhash_t empty_muhash;
+  muhash_init(&empty_muhash);
+  uint8_t empty_digest[MUHASH_DIGEST_SIZE];
+  ASSERT(muhash_finalize(&empty_muhash, empty_digest) == 0);
+
+  // the order the elements are inserted in does not matter
+  muhash_t muhash;
+  muhash_init(&muhash);
+  muhash_insert(&muhash, elements[0], 4);
+  muhash_insert(&muhash, elements[1], 4);
+  muhash_insert(&muhash, elements[2], 4);
+
+  muhash_t other_muhash;
+  muhash_init(&other_muhash);
+  muhash_insert(&other_muhash, elements[2], 4);
+  muhash_insert(&other_muhash, elements[0], 4);
+  muhash_insert(&other_muhash, elements[1], 4);
+
+  uint8_t digest[MUHASH_DIGEST_SIZE];
+  uint8_t other_digest[MUHASH_DIGEST_SIZE];
+  ASSERT(muhash_finalize(&muhash, digest) == 0);
+  ASSERT(muhash_finalize(&other_muhash, other_digest) == 0);
+  ASSERT_MEM_EQ(digest, other_digest, MUHASH_DIGEST_SIZE);
+  ASSERT(memcmp(digest, empty_digest, MUHASH_DIGEST_SIZE) != 0);
+
+  // removing an element undoes inserting it, even before it was inserted
+  muhash_t partial_muhash;
+  muhash_init(&partial_muhash);
+  muhash_remove(&partial_muhash, elements[1], 4);
+  muhash_insert(&partial_muhash, elements[0], 4);
+  muhash_insert(&partial_muhash, elements[1], 4);
+  muhash_insert(&partial_muhash, elements[1], 4);
+  muhash_insert(&partial_muhash, elements[2], 4);
+  ASSERT(muhash_finalize(&partial_muhash, other_digest) == 0);
+  ASSERT_MEM_EQ(digest, other_digest, MUHASH_DIGEST_SIZE);
+
+  // combining two hashes is the hash of both multisets, and survives a round trip
+  muhash_t combined_muhash;
+  muhash_init(&combined_muhash);
+  muhash_insert(&combined_muhash, elements[0], 4);
+  muhash_free(&other_muhash);
+  muhash_init(&other_muhash);
+  muhash_insert(&other_muhash, elements[1], 4);
+  muhash_insert(&other_muhash, elements[2], 4);
+  muhash_combine(&combined_muhash, &other_muhash);
+
+  uint8_t bytes[MUHASH_SIZE];
+  ASSERT(muhash_to_bytes(&combined_muhash, bytes) == 0);
+  ASSERT(muhash_from_bytes(&other_muhash, bytes) == 0);
+  ASSERT(muhash_finalize(&other_muhash, other_digest) == 0);
+  ASSERT_MEM_EQ(digest, other_digest, MUHASH_DIGEST_SIZE);
+
+  muhash_free(&empty_muhash);
+  muhash_free(&muhash);
+  muhash_free(&other_muhash);
+  muhash_free(&partial_muhash);
+  muhash_free(&combined_muhash);
+  PASS();
+}
+
 GREATEST_SUITE(crypto_suite)
 {
   RUN_TEST(sha256_hash_tests);
   RUN_TEST(bignum_compact_tests);
+  RUN_TEST(uint256_compact_tests);
   RUN_TEST(pow_validation_tests);
+  RUN_TEST(sha256d_header_hash_tests);
+  RUN_TEST(sha256d_backend_tests);
+  RUN_TEST(pow_target_tests);
+  RUN_TEST(muhash_tests);
 }
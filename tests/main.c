@@ -46,6 +46,7 @@ SUITE_EXTERN(blockchain_suite);
 SUITE_EXTERN(transaction_suite);
 SUITE_EXTERN(merkle_suite);
 SUITE_EXTERN(mempool_suite);
+SUITE_EXTERN(miner_suite);
 SUITE_EXTERN(protocol_suite);
 
 GREATEST_MAIN_DEFS();
@@ -138,6 +139,9 @@ int main(int argc, char **argv)
   RUN_SUITE(mempool_suite);
   RUN_SUITE(transaction_suite);
 
+  // Mining:
+  RUN_SUITE(miner_suite);
+
   // P2P:
   RUN_SUITE(protocol_suite);
   GREATEST_MAIN_END();
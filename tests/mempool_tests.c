@@ -23,20 +23,593 @@
 // You should have received a copy of the MIT License
 // along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
 
+#include <assert.h>
+#include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <sodium.h>
+
+#include "common/buffer.h"
+#include "common/buffer_iterator.h"
 #include "common/greatest.h"
 #include "common/task.h"
 #include "common/util.h"
 
+#include "core/block.h"
+#include "core/blockchain.h"
+#include "core/genesis.h"
 #include "core/mempool.h"
+#include "core/mempool_ingress.h"
 #include "core/transaction.h"
 
 #include "crypto/cryptoutil.h"
 
+#include "wallet/wallet.h"
+
 SUITE(mempool_suite);
 
-GREATEST_SUITE(mempool_suite)
+static transaction_t* make_test_tx(void)
+{
+  transaction_t *tx = make_transaction();
+  output_transaction_t *txout = make_txout();
+  txout->amount = randombytes_random();
+  add_txout_to_transaction(tx, txout, 0);
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+TEST can_add_and_remove_txs_from_mempool(void)
+{
+  transaction_t *txs[3];
+  for (int i = 0; i < 3; i++)
+  {
+    txs[i] = make_test_tx();
+    ASSERT(add_tx_to_mempool(txs[i]) == 0);
+  }
+
+  ASSERT_EQ(get_num_txs_in_mempool(), 3);
+  ASSERT(add_tx_to_mempool(txs[1]) == 1);
+  ASSERT(get_tx_from_mempool(txs[2]->id) == txs[2]);
+
+  ASSERT(remove_tx_from_mempool(txs[1]) == 0);
+  ASSERT(remove_tx_from_mempool(txs[1]) == 1);
+  ASSERT(is_tx_in_mempool(txs[1]) == 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 2);
+
+  // txs are popped in the order they were received in
+  ASSERT(pop_tx_from_mempool() == txs[0]);
+  ASSERT(pop_tx_from_mempool() == txs[2]);
+  ASSERT_EQ(get_num_txs_in_mempool(), 0);
+
+  for (int i = 0; i < 3; i++)
+  {
+    free_transaction(txs[i]);
+  }
+
+  PASS();
+}
+
+static transaction_t* make_test_spend_tx(uint8_t *previous_tx_hash, uint32_t txout_index)
 {
+  transaction_t *tx = make_transaction();
+  input_transaction_t *txin = make_txin();
+  memcpy(txin->transaction, previous_tx_hash, HASH_SIZE);
+  txin->txout_index = txout_index;
+  add_txin_to_transaction(tx, txin, 0);
+
+  output_transaction_t *txout = make_txout();
+  txout->amount = randombytes_random();
+  add_txout_to_transaction(tx, txout, 0);
+  compute_self_tx_id(tx);
+  return tx;
+}
 
+TEST can_detect_double_spends_in_mempool(void)
+{
+  uint8_t previous_tx_hash[HASH_SIZE];
+  randombytes_buf(previous_tx_hash, HASH_SIZE);
+
+  transaction_t *tx = make_test_spend_tx(previous_tx_hash, 0);
+  transaction_t *other_tx = make_test_spend_tx(previous_tx_hash, 1);
+  ASSERT(add_tx_to_mempool(tx) == 0);
+  ASSERT(add_tx_to_mempool(other_tx) == 0);
+
+  mempool_entry_t *mempool_entry = get_mempool_entry_from_outpoint(previous_tx_hash, 0);
+  ASSERT(mempool_entry != NULL);
+  ASSERT(mempool_entry->tx == tx);
+  ASSERT(get_mempool_entry_from_outpoint(previous_tx_hash, 2) == NULL);
+
+  // a tx spending a txout which is already spent in the mempool is rejected
+  transaction_t *double_spend_tx = make_test_spend_tx(previous_tx_hash, 0);
+  ASSERT(add_tx_to_mempool(double_spend_tx) == 1);
+  ASSERT_EQ(get_num_txs_in_mempool(), 2);
+
+  // a block spending the same txout evicts the conflicting mempool tx
+  block_t *block = make_block();
+  ASSERT(add_transaction_to_block(block, double_spend_tx, 0) == 0);
+  ASSERT(clear_txs_in_mempool_from_block(block) == 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 1);
+  ASSERT(get_mempool_entry_from_outpoint(previous_tx_hash, 0) == NULL);
+  ASSERT(get_mempool_entry_from_outpoint(previous_tx_hash, 1) != NULL);
+
+  ASSERT(remove_tx_from_mempool(other_tx) == 0);
+  ASSERT(get_mempool_entry_from_outpoint(previous_tx_hash, 1) == NULL);
+
+  free_transaction(other_tx);
+  free_block(block);
+  PASS();
+}
+
+TEST can_queue_txs_in_mempool_ingress(void)
+{
+  ASSERT(start_mempool_ingress() == 0);
+  int source = 0;
+
+  // txs which are already in the mempool are never queued
+  transaction_t *tx = make_test_tx();
+  ASSERT(add_tx_to_mempool(tx) == 0);
+  ASSERT(queue_mempool_ingress_tx(&source, tx) == 1);
+
+  // the ingress owns a queued tx, a tx spending unknown txouts never makes it into the mempool
+  uint8_t previous_tx_hash[HASH_SIZE];
+  randombytes_buf(previous_tx_hash, HASH_SIZE);
+  transaction_t *invalid_tx = make_test_spend_tx(previous_tx_hash, 0);
+  uint8_t invalid_tx_id[HASH_SIZE];
+  memcpy(invalid_tx_id, invalid_tx->id, HASH_SIZE);
+  ASSERT(queue_mempool_ingress_tx(&source, invalid_tx) == 0);
+
+  ASSERT(stop_mempool_ingress() == 0);
+  ASSERT(get_tx_from_mempool(invalid_tx_id) == NULL);
+  ASSERT(queue_mempool_ingress_tx(&source, tx) == 1);
+
+  ASSERT(remove_tx_from_mempool(tx) == 0);
+  free_transaction(tx);
+  PASS();
+}
+
+TEST can_serialize_mempool(void)
+{
+  uint8_t previous_tx_hash[HASH_SIZE];
+  randombytes_buf(previous_tx_hash, HASH_SIZE);
+  transaction_t *tx = make_test_spend_tx(previous_tx_hash, 0);
+  ASSERT(add_tx_to_mempool(tx) == 0);
+
+  set_mempool_storage_filename("mempool_storage_tests.dat");
+  ASSERT(save_mempool_storage() == 0);
+
+  buffer_t *buffer = buffer_make();
+  ASSERT(serialize_mempool(buffer) == 0);
+  ASSERT(remove_tx_from_mempool(tx) == 0);
+  ASSERT(load_mempool_storage() == 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 0);
+  remove(get_mempool_storage_filename());
+
+  // the stored tx spends a txout which is not in the UTXO set, so it is dropped on reload
+  uint32_t num_loaded_txs = 0;
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  ASSERT(deserialize_mempool(buffer_iterator, &num_loaded_txs) == 0);
+  ASSERT_EQ(num_loaded_txs, 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 0);
+  buffer_iterator_free(buffer_iterator);
+
+  // a truncated storage file stops the reload
+  buffer_t *truncated_buffer = buffer_init_data(0, buffer_get_data(buffer), buffer_get_size(buffer) - 1);
+  buffer_iterator = buffer_iterator_init(truncated_buffer);
+  ASSERT(deserialize_mempool(buffer_iterator, &num_loaded_txs) == 1);
+  buffer_iterator_free(buffer_iterator);
+
+  buffer_free(truncated_buffer);
+  buffer_free(buffer);
+  free_transaction(tx);
+  PASS();
+}
+
+TEST can_fill_block_with_txs_from_mempool(void)
+{
+  transaction_t *txs[2];
+  for (int i = 0; i < 2; i++)
+  {
+    txs[i] = make_test_tx();
+    ASSERT(add_tx_to_mempool(txs[i]) == 0);
+  }
+
+  // txs paying the same fee rate are selected in the order they were received in
+  block_t *block = make_block();
+  transaction_t *coinbase_tx = make_test_tx();
+  ASSERT(add_transaction_to_block(block, coinbase_tx, 0) == 0);
+  ASSERT(fill_block_with_txs_from_mempool(block) == 0);
+
+  ASSERT_EQ(block->transaction_count, 3);
+  ASSERT(block->transactions[0] == coinbase_tx);
+  ASSERT(block->transactions[1] != txs[0]);
+  ASSERT(compare_transaction(block->transactions[1], txs[0]));
+  ASSERT(compare_transaction(block->transactions[2], txs[1]));
+
+  // the block owns copies of the txs, clearing them frees the mempool's own txs
+  ASSERT(clear_txs_in_mempool_from_block(block) == 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 0);
+
+  free_block(block);
+  PASS();
+}
+
+/*
+ * Inserts a block on top of the genesis block whose coinbase tx
+ * has num txouts of the given amount for the test txs to spend.
+ */
+static transaction_t* insert_test_funding_block(uint32_t num_txouts, uint64_t amount)
+{
+  block_t *genesis_block = get_genesis_block();
+  assert(genesis_block != NULL);
+  assert(insert_block(genesis_block, 0) == 0);
+
+  block_t *block = make_block();
+  memcpy(block->previous_hash, genesis_block->hash, HASH_SIZE);
+  block->timestamp = get_current_time();
+  block->nonce = randombytes_random();
+
+  transaction_t *tx = make_transaction();
+  for (uint32_t i = 0; i < num_txouts; i++)
+  {
+    output_transaction_t *txout = make_txout();
+    txout->amount = amount;
+    add_txout_to_transaction(tx, txout, i);
+  }
+
+  compute_self_tx_id(tx);
+  add_transaction_to_block(block, tx, 0);
+  compute_merkle_root(block->merkle_root, block);
+  compute_block_hash(block->hash, block);
+  assert(insert_block(block, 1) == 0);
+
+  transaction_t *funding_tx = make_transaction();
+  assert(copy_transaction(tx, funding_tx) == 0);
+  free_block(block);
+  return funding_tx;
+}
+
+static transaction_t* make_test_fee_tx(transaction_t *funding_tx, uint32_t txout_index, uint64_t fee)
+{
+  transaction_t *tx = make_test_spend_tx(funding_tx->id, txout_index);
+  tx->txouts[0]->amount = funding_tx->txouts[txout_index]->amount - fee;
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+/*
+ * Makes a tx which passes validation, it spends the whole txout of the funding tx
+ * to the address of the public key it is signed with.
+ */
+static transaction_t* make_test_signed_tx(transaction_t *funding_tx, uint32_t txout_index, uint8_t *public_key, uint8_t *secret_key)
+{
+  transaction_t *tx = make_test_fee_tx(funding_tx, txout_index, 0);
+  public_key_to_address(tx->txouts[0]->address, public_key);
+  assert(sign_txin(tx->txins[0], tx, public_key, secret_key) == 0);
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+/*
+ * Makes a tx spending num txouts of the funding tx from the start index onwards,
+ * paying the fee out of the first txout it spends.
+ */
+static transaction_t* make_test_replacement_tx(transaction_t *funding_tx, uint32_t start_index,
+  uint32_t num_txouts, uint64_t fee)
+{
+  transaction_t *tx = make_transaction();
+  uint64_t amount = 0;
+  for (uint32_t i = 0; i < num_txouts; i++)
+  {
+    input_transaction_t *txin = make_txin();
+    memcpy(txin->transaction, funding_tx->id, HASH_SIZE);
+    txin->txout_index = start_index + i;
+    add_txin_to_transaction(tx, txin, i);
+    amount += funding_tx->txouts[start_index + i]->amount;
+  }
+
+  output_transaction_t *txout = make_txout();
+  txout->amount = amount - fee;
+  add_txout_to_transaction(tx, txout, 0);
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+TEST can_evict_txs_from_full_mempool(void)
+{
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  transaction_t *funding_tx = insert_test_funding_block(5, COIN);
+  size_t max_memory_size = get_mempool_max_memory_size();
+  size_t peak_memory_size = get_mempool_peak_memory_size();
+  uint64_t num_evicted_txs = get_mempool_num_evicted_txs();
+
+  // consensus makes every tx pay a zero fee, so the mempool only ever fills up with equal fee rates
+  transaction_t *txs[5];
+  for (uint32_t i = 0; i < 5; i++)
+  {
+    txs[i] = make_test_signed_tx(funding_tx, i, public_key, secret_key);
+  }
+
+  // every tx spends one txout to one txout, so each takes up the same memory
+  ASSERT(validate_and_add_tx_to_mempool(txs[0]) == 0);
+  size_t tx_memory_size = get_mempool_memory_size();
+  ASSERT(tx_memory_size > get_tx_memory_size(txs[0]));
+  set_mempool_max_memory_size(tx_memory_size * 3);
+
+  ASSERT(validate_and_add_tx_to_mempool(txs[1]) == 0);
+  ASSERT(validate_and_add_tx_to_mempool(txs[2]) == 0);
+  ASSERT_EQ(get_mempool_memory_size(), tx_memory_size * 3);
+  ASSERT(get_mempool_peak_memory_size() >= tx_memory_size * 3);
+
+  // a full mempool keeps taking in new txs by evicting the oldest of the same fee rate,
+  // the mempool owns it's txs so the evicted txs are free'd along the way...
+  uint8_t evicted_tx_ids[2][HASH_SIZE];
+  for (uint32_t i = 0; i < 2; i++)
+  {
+    memcpy(evicted_tx_ids[i], txs[i]->id, HASH_SIZE);
+    txs[i] = NULL;
+    ASSERT(validate_and_add_tx_to_mempool(txs[i + 3]) == 0);
+    ASSERT_EQ(get_mempool_num_evicted_txs(), num_evicted_txs + i + 1);
+    ASSERT_EQ(get_num_txs_in_mempool(), 3);
+    ASSERT_EQ(get_mempool_memory_size(), tx_memory_size * 3);
+    ASSERT(get_tx_from_mempool(evicted_tx_ids[i]) == NULL);
+    ASSERT(get_mempool_entry_from_outpoint(funding_tx->id, i) == NULL);
+  }
+
+  for (uint32_t i = 2; i < 5; i++)
+  {
+    ASSERT(get_tx_from_mempool(txs[i]->id) == txs[i]);
+  }
+
+  // a tx which would not fit into an empty mempool does not evict anything
+  transaction_t *large_tx = make_test_replacement_tx(funding_tx, 0, 2, 0);
+  set_mempool_max_memory_size(tx_memory_size);
+  ASSERT(add_tx_to_mempool(large_tx) == 1);
+  ASSERT_EQ(get_mempool_num_evicted_txs(), num_evicted_txs + 2);
+  ASSERT_EQ(get_num_txs_in_mempool(), 3);
+
+  for (uint32_t i = 2; i < 5; i++)
+  {
+    ASSERT(remove_tx_from_mempool(txs[i]) == 0);
+  }
+
+  ASSERT_EQ(get_mempool_memory_size(), 0);
+  ASSERT(get_mempool_peak_memory_size() >= MAX(peak_memory_size, tx_memory_size * 3));
+
+  set_mempool_max_memory_size(max_memory_size);
+  for (uint32_t i = 2; i < 5; i++)
+  {
+    free_transaction(txs[i]);
+  }
+
+  free_transaction(large_tx);
+  free_transaction(funding_tx);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_replace_txs_in_mempool(void)
+{
+  uint32_t num_txouts = MEMPOOL_MAX_REPLACED_TXS + 2;
+  transaction_t *funding_tx = insert_test_funding_block(num_txouts, COIN);
+
+  // the txs are added as if they were validated against the current block generation
+  uint64_t block_generation = get_mempool_block_generation();
+  transaction_t *tx = make_test_replacement_tx(funding_tx, 0, 1, 20000);
+  ASSERT(add_validated_tx_to_mempool(tx, block_generation) == 0);
+
+  // a double spend paying a lower or the same fee rate does not replace the tx
+  transaction_t *lower_fee_tx = make_test_replacement_tx(funding_tx, 0, 1, 10000);
+  transaction_t *same_fee_tx = make_test_replacement_tx(funding_tx, 0, 1, 20000);
+  same_fee_tx->txouts[0]->address[0] ^= 0xff;
+  compute_self_tx_id(same_fee_tx);
+  ASSERT(add_validated_tx_to_mempool(lower_fee_tx, block_generation) == 1);
+  ASSERT(add_validated_tx_to_mempool(same_fee_tx, block_generation) == 1);
+  ASSERT(get_mempool_entry_from_outpoint(funding_tx->id, 0)->tx == tx);
+
+  // a double spend paying a higher fee rate and fee replaces it, the mempool frees the replaced tx
+  transaction_t *higher_fee_tx = make_test_replacement_tx(funding_tx, 0, 1, 40000);
+  ASSERT(add_validated_tx_to_mempool(higher_fee_tx, block_generation) == 0);
+  tx = NULL;
+  ASSERT_EQ(get_num_txs_in_mempool(), 1);
+  ASSERT(get_mempool_entry_from_outpoint(funding_tx->id, 0)->tx == higher_fee_tx);
+
+  transaction_t *txs[MEMPOOL_MAX_REPLACED_TXS + 1];
+  for (uint32_t i = 0; i < MEMPOOL_MAX_REPLACED_TXS + 1; i++)
+  {
+    txs[i] = make_test_replacement_tx(funding_tx, i + 1, 1, 20000);
+    ASSERT(add_validated_tx_to_mempool(txs[i], block_generation) == 0);
+  }
+
+  // a tx conflicting with more than the max replaced txs is never added, no matter the fee
+  transaction_t *too_many_conflicts_tx = make_test_replacement_tx(funding_tx, 1, MEMPOOL_MAX_REPLACED_TXS + 1, COIN / 2);
+  ASSERT(add_validated_tx_to_mempool(too_many_conflicts_tx, block_generation) == 1);
+  ASSERT_EQ(get_num_txs_in_mempool(), MEMPOOL_MAX_REPLACED_TXS + 2);
+
+  // replacing the most txs a tx may replace still has to outbid each of them
+  transaction_t *low_total_fee_tx = make_test_replacement_tx(funding_tx, 1, MEMPOOL_MAX_REPLACED_TXS, 30000);
+  ASSERT(add_validated_tx_to_mempool(low_total_fee_tx, block_generation) == 1);
+
+  transaction_t *replacement_tx = make_test_replacement_tx(funding_tx, 1, MEMPOOL_MAX_REPLACED_TXS, COIN / 2);
+  ASSERT(add_validated_tx_to_mempool(replacement_tx, block_generation) == 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 3);
+  ASSERT(get_mempool_entry_from_outpoint(funding_tx->id, 1)->tx == replacement_tx);
+  ASSERT(get_tx_from_mempool(txs[MEMPOOL_MAX_REPLACED_TXS]->id) == txs[MEMPOOL_MAX_REPLACED_TXS]);
+
+  ASSERT(remove_tx_from_mempool(higher_fee_tx) == 0);
+  ASSERT(remove_tx_from_mempool(replacement_tx) == 0);
+  ASSERT(remove_tx_from_mempool(txs[MEMPOOL_MAX_REPLACED_TXS]) == 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 0);
+
+  free_transaction(lower_fee_tx);
+  free_transaction(same_fee_tx);
+  free_transaction(higher_fee_tx);
+  free_transaction(too_many_conflicts_tx);
+  free_transaction(low_total_fee_tx);
+  free_transaction(replacement_tx);
+  free_transaction(txs[MEMPOOL_MAX_REPLACED_TXS]);
+  free_transaction(funding_tx);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_replace_txs_in_full_mempool(void)
+{
+  transaction_t *funding_tx = insert_test_funding_block(2, COIN);
+  size_t max_memory_size = get_mempool_max_memory_size();
+  uint64_t num_evicted_txs = get_mempool_num_evicted_txs();
+  uint64_t block_generation = get_mempool_block_generation();
+
+  transaction_t *tx = make_test_replacement_tx(funding_tx, 0, 1, 20000);
+  ASSERT(add_validated_tx_to_mempool(tx, block_generation) == 0);
+  size_t tx_memory_size = get_mempool_memory_size();
+  set_mempool_max_memory_size(tx_memory_size);
+
+  // a replacement which would not fit even once the tx it replaces is gone leaves the tx in the mempool
+  transaction_t *large_tx = make_test_replacement_tx(funding_tx, 0, 2, 60000);
+  ASSERT(add_validated_tx_to_mempool(large_tx, block_generation) == 1);
+  ASSERT(get_mempool_entry_from_outpoint(funding_tx->id, 0)->tx == tx);
+  ASSERT(get_mempool_entry_from_outpoint(funding_tx->id, 1) == NULL);
+  ASSERT_EQ(get_mempool_memory_size(), tx_memory_size);
+
+  // the replaced tx's memory counts as free'd, so replacing it in a full mempool evicts nothing
+  transaction_t *higher_fee_tx = make_test_replacement_tx(funding_tx, 0, 1, 40000);
+  ASSERT(add_validated_tx_to_mempool(higher_fee_tx, block_generation) == 0);
+  tx = NULL;
+  ASSERT(get_mempool_entry_from_outpoint(funding_tx->id, 0)->tx == higher_fee_tx);
+  ASSERT_EQ(get_mempool_num_evicted_txs(), num_evicted_txs);
+  ASSERT_EQ(get_num_txs_in_mempool(), 1);
+  ASSERT_EQ(get_mempool_memory_size(), tx_memory_size);
+
+  ASSERT(remove_tx_from_mempool(higher_fee_tx) == 0);
+  set_mempool_max_memory_size(max_memory_size);
+
+  free_transaction(large_tx);
+  free_transaction(higher_fee_tx);
+  free_transaction(funding_tx);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_reload_valid_txs_from_mempool_storage(void)
+{
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  // a reloaded tx is validated again
+  transaction_t *funding_tx = insert_test_funding_block(1, COIN);
+  transaction_t *tx = make_test_signed_tx(funding_tx, 0, public_key, secret_key);
+  ASSERT(valid_transaction(tx));
+
+  uint8_t tx_id[HASH_SIZE];
+  memcpy(tx_id, tx->id, HASH_SIZE);
+  ASSERT(add_tx_to_mempool(tx) == 0);
+
+  uint32_t received_ts = get_current_time() - 60;
+  get_mempool_entry_from_mempool(tx_id)->received_ts = received_ts;
+
+  set_mempool_storage_filename("mempool_storage_tests.dat");
+  ASSERT(save_mempool_storage() == 0);
+  ASSERT(remove_tx_from_mempool(tx) == 0);
+  free_transaction(tx);
+  ASSERT_EQ(get_num_txs_in_mempool(), 0);
+
+  // the tx comes back with the time it was first received at, not the time it was reloaded at
+  ASSERT(load_mempool_storage() == 0);
+  remove(get_mempool_storage_filename());
+  ASSERT_EQ(get_num_txs_in_mempool(), 1);
+
+  mempool_entry_t *mempool_entry = get_mempool_entry_from_mempool(tx_id);
+  ASSERT(mempool_entry != NULL);
+  ASSERT_MEM_EQ(mempool_entry->tx->id, tx_id, HASH_SIZE);
+  ASSERT_EQ(mempool_entry->received_ts, received_ts);
+
+  // the mempool owns the reloaded tx
+  transaction_t *loaded_tx = mempool_entry->tx;
+  ASSERT(remove_tx_from_mempool(loaded_tx) == 0);
+  free_transaction(loaded_tx);
+  free_transaction(funding_tx);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_admit_txs_fairly_in_mempool_ingress(void)
+{
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  transaction_t *funding_tx = insert_test_funding_block(4, COIN);
+  ASSERT(start_mempool_ingress() == 0);
+
+  // a valid tx is validated by an admission job and handed back to be announced
+  int sources[2];
+  transaction_t *tx = make_test_signed_tx(funding_tx, 0, public_key, secret_key);
+  uint8_t tx_ids[4 * HASH_SIZE];
+  memcpy(tx_ids, tx->id, HASH_SIZE);
+  ASSERT(queue_mempool_ingress_tx(&sources[0], tx) == 0);
+  ASSERT(wait_mempool_ingress() == 0);
+  ASSERT(is_tx_id_in_mempool(tx_ids));
+
+  uint8_t admitted_tx_ids[4 * HASH_SIZE];
+  const void *admitted_sources[4];
+  ASSERT_EQ(take_admitted_mempool_ingress_txs(admitted_tx_ids, admitted_sources, 4), 1);
+  ASSERT_MEM_EQ(admitted_tx_ids, tx_ids, HASH_SIZE);
+  ASSERT(admitted_sources[0] == &sources[0]);
+
+  // the first source queues two txs before the second source queues one, the
+  // second source still gets it's tx admitted before the first source's second tx
+  ASSERT(pause_mempool_ingress() == 0);
+  const void *queued_sources[3] = {&sources[0], &sources[0], &sources[1]};
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    tx = make_test_signed_tx(funding_tx, i + 1, public_key, secret_key);
+    memcpy(tx_ids + ((i + 1) * HASH_SIZE), tx->id, HASH_SIZE);
+    ASSERT(queue_mempool_ingress_tx(queued_sources[i], tx) == 0);
+  }
+
+  ASSERT_EQ(get_num_queued_mempool_ingress_txs(), 3);
+  ASSERT(resume_mempool_ingress() == 0);
+  ASSERT(wait_mempool_ingress() == 0);
+  ASSERT_EQ(get_num_queued_mempool_ingress_txs(), 0);
+
+  ASSERT_EQ(take_admitted_mempool_ingress_txs(admitted_tx_ids, admitted_sources, 4), 3);
+  ASSERT_MEM_EQ(admitted_tx_ids, tx_ids + HASH_SIZE, HASH_SIZE);
+  ASSERT_MEM_EQ(admitted_tx_ids + HASH_SIZE, tx_ids + (3 * HASH_SIZE), HASH_SIZE);
+  ASSERT_MEM_EQ(admitted_tx_ids + (2 * HASH_SIZE), tx_ids + (2 * HASH_SIZE), HASH_SIZE);
+  ASSERT(admitted_sources[0] == &sources[0]);
+  ASSERT(admitted_sources[1] == &sources[1]);
+  ASSERT(admitted_sources[2] == &sources[0]);
+
+  ASSERT(stop_mempool_ingress() == 0);
+  ASSERT_EQ(get_num_txs_in_mempool(), 4);
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    transaction_t *admitted_tx = get_tx_from_mempool(tx_ids + (i * HASH_SIZE));
+    ASSERT(admitted_tx != NULL);
+    ASSERT(remove_tx_from_mempool(admitted_tx) == 0);
+    free_transaction(admitted_tx);
+  }
+
+  free_transaction(funding_tx);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+GREATEST_SUITE(mempool_suite)
+{
+  RUN_TEST(can_add_and_remove_txs_from_mempool);
+  RUN_TEST(can_fill_block_with_txs_from_mempool);
+  RUN_TEST(can_detect_double_spends_in_mempool);
+  RUN_TEST(can_queue_txs_in_mempool_ingress);
+  RUN_TEST(can_serialize_mempool);
+  RUN_TEST(can_evict_txs_from_full_mempool);
+  RUN_TEST(can_replace_txs_in_mempool);
+  RUN_TEST(can_replace_txs_in_full_mempool);
+  RUN_TEST(can_reload_valid_txs_from_mempool_storage);
+  RUN_TEST(can_admit_txs_fairly_in_mempool_ingress);
 }
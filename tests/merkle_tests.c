@@ -128,7 +128,68 @@ TEST can_construct_merkle_tree(void)
   PASS();
 }
 
+TEST can_compute_merkle_root_from_hashes(void)
+{
+  // cover odd levels and levels wider than a single batch of lanes
+  for (uint32_t number_of_hashes = 1; number_of_hashes <= (SHA256D_MAX_LANES * 4) + 1; number_of_hashes++)
+  {
+    uint8_t *hash_region = malloc(HASH_SIZE * number_of_hashes);
+    randombytes_buf(hash_region, HASH_SIZE * number_of_hashes);
+
+    merkle_tree_t *tree = construct_merkle_tree_from_leaves(hash_region, number_of_hashes);
+    ASSERT(tree != NULL);
+
+    uint8_t merkle_root[HASH_SIZE];
+    ASSERT(compute_merkle_root_from_hashes(merkle_root, hash_region, number_of_hashes) == 0);
+    ASSERT_MEM_EQ(tree->root->hash, merkle_root, HASH_SIZE);
+
+    free_merkle_tree(tree);
+    free(hash_region);
+  }
+
+  PASS();
+}
+
+TEST can_verify_merkle_branch(void)
+{
+  for (uint32_t number_of_hashes = 1; number_of_hashes <= (SHA256D_MAX_LANES * 2) + 1; number_of_hashes++)
+  {
+    uint8_t *hash_region = malloc(HASH_SIZE * number_of_hashes);
+    uint8_t *scratch_region = malloc(HASH_SIZE * number_of_hashes);
+    randombytes_buf(hash_region, HASH_SIZE * number_of_hashes);
+
+    uint8_t merkle_root[HASH_SIZE];
+    memcpy(scratch_region, hash_region, HASH_SIZE * number_of_hashes);
+    ASSERT(compute_merkle_root_from_hashes(merkle_root, scratch_region, number_of_hashes) == 0);
+
+    for (uint32_t index = 0; index < number_of_hashes; index++)
+    {
+      uint8_t branch[HASH_SIZE * MAX_MERKLE_BRANCH_LENGTH];
+      uint32_t branch_length = 0;
+      memcpy(scratch_region, hash_region, HASH_SIZE * number_of_hashes);
+      ASSERT(compute_merkle_branch_from_hashes(branch, &branch_length, scratch_region, number_of_hashes, index) == 0);
+
+      uint8_t *leaf_hash = &hash_region[index * HASH_SIZE];
+      ASSERT(valid_merkle_branch(merkle_root, leaf_hash, branch, branch_length, index) == 1);
+
+      // the branch only proves the leaf at it's own index, unless it is
+      // an odd leaf at the end of the tree which is paired with itself
+      if ((index ^ 1) < number_of_hashes)
+      {
+        ASSERT(valid_merkle_branch(merkle_root, leaf_hash, branch, branch_length, index ^ 1) == 0);
+      }
+    }
+
+    free(hash_region);
+    free(scratch_region);
+  }
+
+  PASS();
+}
+
 GREATEST_SUITE(merkle_suite)
 {
   RUN_TEST(can_construct_merkle_tree);
+  RUN_TEST(can_compute_merkle_root_from_hashes);
+  RUN_TEST(can_verify_merkle_branch);
 }
@@ -0,0 +1,298 @@
+// Copyright (c) 2019-2022, The Vulkan Developers.
+//
+// This file is part of Vulkan.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+// You should have received a copy of the MIT License
+// along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sodium.h>
+
+#include "common/greatest.h"
+#include "common/util.h"
+
+#include "core/block.h"
+#include "core/blockchain.h"
+#include "core/genesis.h"
+#include "core/mempool.h"
+#include "core/parameters.h"
+#include "core/pow.h"
+#include "core/transaction.h"
+
+#include "miner/miner.h"
+#include "miner/mining_server.h"
+
+#include "wallet/wallet.h"
+
+SUITE(miner_suite);
+
+static transaction_t* make_test_tx(void)
+{
+  transaction_t *tx = make_transaction();
+  output_transaction_t *txout = make_txout();
+  txout->amount = randombytes_random();
+  add_txout_to_transaction(tx, txout, 0);
+  compute_self_tx_id(tx);
+  return tx;
+}
+
+static wallet_t* make_test_wallet(void)
+{
+  wallet_t *wallet = make_wallet();
+  crypto_sign_keypair(wallet->public_key, wallet->secret_key);
+  public_key_to_address(wallet->address, wallet->public_key);
+  return wallet;
+}
+
+TEST can_get_miner_work(void)
+{
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  transaction_t *tx = make_test_tx();
+  ASSERT(add_tx_to_mempool(tx) == 0);
+
+  wallet_t *wallet = make_test_wallet();
+  set_current_wallet(wallet);
+  ASSERT(init_miner_template() == 0);
+
+  // every worker gets it's own copy of the shared template
+  miner_worker_t *worker = init_worker();
+  worker->nonce_start_offset = 7;
+  block_t *block = get_miner_work(worker);
+  ASSERT(block != NULL);
+  ASSERT_EQ(worker->template_generation, get_miner_template_generation());
+  ASSERT(compare_hash(block->previous_hash, genesis_block->hash));
+  ASSERT_EQ(block->transaction_count, 2);
+  ASSERT(is_coinbase_tx(block->transactions[0]));
+  ASSERT(block->transactions[1] != tx);
+  ASSERT(compare_transaction(block->transactions[1], tx));
+
+  block_t *other_block = get_miner_work(worker);
+  ASSERT(other_block != NULL);
+  ASSERT(other_block->transactions[0] != block->transactions[0]);
+  ASSERT(compare_transaction(other_block->transactions[0], block->transactions[0]));
+  ASSERT_EQ(other_block->nonce, block->nonce);
+
+  // the template owns copies of the mempool's txs, so the mempool can free them
+  ASSERT(remove_tx_from_mempool(tx) == 0);
+  free_transaction(tx);
+  free_block(block);
+  free_block(other_block);
+
+  ASSERT(deinit_miner_template() == 0);
+  set_current_wallet(NULL);
+  free_worker(worker);
+  free_wallet(wallet);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_refresh_miner_template(void)
+{
+  parameters_set_use_trivial_difficulty(1);
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  wallet_t *wallet = make_test_wallet();
+  set_current_wallet(wallet);
+  ASSERT(init_miner_template() == 0);
+
+  // the template is only rebuilt once the tip or the mempool changed
+  miner_worker_t *worker = init_worker();
+  block_t *block = get_miner_work(worker);
+  ASSERT(block != NULL);
+  unsigned int template_generation = worker->template_generation;
+  ASSERT(refresh_miner_template() == 0);
+  ASSERT_EQ(get_miner_template_generation(), template_generation);
+
+  ASSERT_EQ(compute_block(NULL, block), COMPUTE_BLOCK_FOUND);
+  ASSERT(insert_block(block, 1) == 0);
+
+  block_t *next_block = get_miner_work(worker);
+  ASSERT(next_block != NULL);
+  ASSERT(worker->template_generation != template_generation);
+  ASSERT(compare_hash(next_block->previous_hash, block->hash));
+
+  // a worker still computing a block of the replaced template gives up on it at
+  // it's next template check, the block's target is too hard to be met before then...
+  worker->running = 1;
+  worker->template_generation = template_generation;
+  next_block->bits = 0x1d00ffff;
+  ASSERT_EQ(compute_block(worker, next_block), COMPUTE_BLOCK_STALE);
+  ASSERT_EQ(atomic_load(&worker->num_hashes), MINER_TEMPLATE_CHECK_NUM_HASHES);
+
+  worker->template_generation = get_miner_template_generation();
+  set_workers_paused(1);
+  ASSERT_EQ(compute_block(worker, next_block), COMPUTE_BLOCK_STALE);
+  set_workers_paused(0);
+
+  worker->running = 0;
+  ASSERT_EQ(compute_block(worker, next_block), COMPUTE_BLOCK_STALE);
+  ASSERT_EQ(atomic_load(&worker->num_hashes), MINER_TEMPLATE_CHECK_NUM_HASHES * 3);
+
+  free_block(block);
+  free_block(next_block);
+  ASSERT(deinit_miner_template() == 0);
+  set_current_wallet(NULL);
+  free_worker(worker);
+  free_wallet(wallet);
+  parameters_set_use_trivial_difficulty(0);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+TEST can_sample_worker_hashrate(void)
+{
+  miner_worker_t *worker = init_worker();
+  worker->last_sample_time = 1000;
+
+  // the first sample is taken as is by every average
+  atomic_store(&worker->num_hashes, 5000);
+  sample_worker_hashrate(worker, 2000);
+  ASSERT_IN_RANGE(5000.0, worker->hashrate_10s, 0.001);
+  ASSERT_IN_RANGE(5000.0, worker->hashrate_1m, 0.001);
+  ASSERT_IN_RANGE(5000.0, worker->hashrate_15m, 0.001);
+
+  // a sample taken at the same time as the last one is ignored
+  atomic_store(&worker->num_hashes, 6000);
+  sample_worker_hashrate(worker, 2000);
+  ASSERT_EQ(worker->last_sample_num_hashes, 5000);
+
+  // the shorter windows follow a change of the hashrate faster, here 5000 * e^(-elapsed / window)
+  atomic_store(&worker->num_hashes, 5000);
+  sample_worker_hashrate(worker, 3000);
+  ASSERT_IN_RANGE(4524.187, worker->hashrate_10s, 0.01);
+  ASSERT_IN_RANGE(4917.357, worker->hashrate_1m, 0.01);
+  ASSERT_IN_RANGE(4994.447, worker->hashrate_15m, 0.01);
+  ASSERT_EQ(worker->last_sample_time, 3000);
+
+  free_worker(worker);
+  PASS();
+}
+
+static mining_server_submit_result_t submit_test_work(uint32_t job_id, uint32_t timestamp, uint32_t nonce)
+{
+  char args[64];
+  snprintf(args, sizeof(args), "%08x %08x %08x", job_id, timestamp, nonce);
+
+  uint32_t job_id_out = 0;
+  mining_server_submit_result_t result = submit_mining_server_work(args, &job_id_out);
+  assert(job_id_out == job_id);
+  return result;
+}
+
+/*
+ * Finds a nonce for the job's block which either meets or misses the block's target,
+ * with the trivial difficulty about every other hash meets it.
+ */
+static uint32_t find_test_nonce(block_t *job_block, int valid)
+{
+  block_t *block = make_block();
+  assert(copy_block(job_block, block) == 0);
+
+  uint32_t nonce = 0;
+  for (;; nonce++)
+  {
+    block->nonce = nonce;
+    assert(compute_block_hash(block->hash, block) == 0);
+    if (check_proof_of_work(block->hash, block->bits) == valid)
+    {
+      break;
+    }
+  }
+
+  free_block(block);
+  return nonce;
+}
+
+TEST can_submit_mining_server_work(void)
+{
+  parameters_set_use_trivial_difficulty(1);
+  block_t *genesis_block = get_genesis_block();
+  ASSERT(genesis_block != NULL);
+  ASSERT(insert_block(genesis_block, 0) == 0);
+
+  wallet_t *wallet = make_test_wallet();
+  ASSERT(init_mining_server(wallet) == 0);
+  ASSERT(init_mining_server(wallet) == 1);
+  ASSERT(refresh_mining_server_jobs() == 0);
+
+  mining_server_job_t *job = get_latest_mining_server_job();
+  ASSERT(job != NULL);
+  ASSERT(compare_hash(job->block->previous_hash, genesis_block->hash));
+  uint32_t job_id = job->id;
+  uint32_t timestamp = job->block->timestamp;
+
+  // the submit request needs a job id, timestamp and nonce
+  uint32_t job_id_out = 0;
+  ASSERT_EQ(submit_mining_server_work("", &job_id_out), MINING_SERVER_SUBMIT_MALFORMED);
+  ASSERT_EQ(submit_mining_server_work("zz 1 2", &job_id_out), MINING_SERVER_SUBMIT_MALFORMED);
+  ASSERT_EQ(submit_mining_server_work("1 2", &job_id_out), MINING_SERVER_SUBMIT_MALFORMED);
+
+  // jobs which were never handed out
+  ASSERT_EQ(submit_test_work(job_id + 1, timestamp, 0), MINING_SERVER_SUBMIT_STALE);
+
+  // the timestamp can only be rolled forward and not too far into the future
+  ASSERT_EQ(submit_test_work(job_id, timestamp - 1, 0), MINING_SERVER_SUBMIT_INVALID_TIMESTAMP);
+  ASSERT_EQ(submit_test_work(job_id, get_current_time() + MAX_FUTURE_BLOCK_TIME + 60, 0),
+    MINING_SERVER_SUBMIT_INVALID_TIMESTAMP);
+
+  uint32_t low_nonce = find_test_nonce(job->block, 0);
+  ASSERT_EQ(submit_test_work(job_id, timestamp, low_nonce), MINING_SERVER_SUBMIT_LOW_DIFFICULTY);
+  ASSERT_EQ(get_block_height(), 0);
+
+  uint32_t nonce = find_test_nonce(job->block, 1);
+  ASSERT_EQ(submit_test_work(job_id, timestamp, nonce), MINING_SERVER_SUBMIT_ACCEPTED);
+  ASSERT_EQ(get_block_height(), 1);
+
+  // the job is built on a tip which is no longer the best block, so it can not be inserted again
+  ASSERT_EQ(submit_test_work(job_id, timestamp, nonce), MINING_SERVER_SUBMIT_INVALID_BLOCK);
+
+  // the next refresh hands out a job for the new tip and drops the stale ones
+  ASSERT(refresh_mining_server_jobs() == 0);
+  job = get_latest_mining_server_job();
+  ASSERT(job != NULL);
+  ASSERT(job->id != job_id);
+  ASSERT_FALSE(compare_hash(job->block->previous_hash, genesis_block->hash));
+  ASSERT_EQ(submit_test_work(job_id, timestamp, nonce), MINING_SERVER_SUBMIT_STALE);
+
+  ASSERT(deinit_mining_server() == 0);
+  ASSERT(deinit_mining_server() == 1);
+  free_wallet(wallet);
+  parameters_set_use_trivial_difficulty(0);
+  ASSERT(reset_blockchain() == 0);
+  PASS();
+}
+
+GREATEST_SUITE(miner_suite)
+{
+  RUN_TEST(can_get_miner_work);
+  RUN_TEST(can_refresh_miner_template);
+  RUN_TEST(can_sample_worker_hashrate);
+  RUN_TEST(can_submit_mining_server_work);
+}
@@ -24,26 +24,1156 @@
 // along with Vulkan. If not, see <https://opensource.org/licenses/MIT>.
 
 #include <stdint.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <string.h>
 #include <sodium.h>
 
 #include <mongoose.h>
 
 #include "common/buffer_iterator.h"
 #include "common/buffer.h"
+#include "common/buffer_pool.h"
+#include "common/compression.h"
 #include "common/greatest.h"
+#include "common/json.h"
+#include "common/tinycthread.h"
 #include "common/util.h"
 
 #include "core/block.h"
+#include "core/mempool.h"
+#include "core/merkle.h"
 #include "core/net.h"
 #include "core/p2p.h"
+#include "core/parameters.h"
+#include "core/peer_table.h"
 #include "core/protocol.h"
+#include "core/rpc.h"
 #include "core/transaction.h"
+#include "core/version.h"
 
 #include "crypto/cryptoutil.h"
 
 SUITE(protocol_suite);
 
-GREATEST_SUITE(protocol_suite)
+static const char *g_peer_table_filename = "peer_table_tests.dat";
+
+static int serialize_test_message(packet_t **packet, uint32_t packet_id, ...)
+{
+  va_list args;
+  va_start(args, packet_id);
+  int result = serialize_message(packet, packet_id, args);
+  va_end(args);
+  return result;
+}
+
+static void ignore_test_connection_event(struct mg_connection *connection, int ev, void *p)
+{
+
+}
+
+/*
+ * Starts the network without dialing any peers, the tests add their
+ * own connections on a socket pair so nothing goes out on the network.
+ */
+static int init_test_net(uint16_t num_io_threads)
+{
+  set_net_disable_port_mapping(1);
+  set_net_target_outbound_peers(0);
+  set_net_num_io_threads(num_io_threads);
+
+  connection_entries_t connection_entries;
+  memset(&connection_entries, 0, sizeof(connection_entries_t));
+  return init_net(connection_entries);
+}
+
+static void deinit_test_net(void)
+{
+  assert(deinit_net() == 0);
+  set_net_num_io_threads(0);
+  set_net_target_outbound_peers(NET_TARGET_OUTBOUND_PEERS);
+  set_net_disable_port_mapping(0);
+}
+
+static net_connection_t* make_test_net_connection(sock_t *remote_sock)
+{
+  sock_t socks[2];
+  assert(mg_socketpair(socks, SOCK_STREAM) == 1);
+
+  struct mg_connection *connection = mg_add_sock(get_net_mgr(), socks[0], ignore_test_connection_event);
+  assert(connection != NULL);
+
+  net_connection_t *net_connection = init_net_connection(connection);
+  net_connection->anonymous = 0;
+  assert(add_net_connection(net_connection) == 0);
+  *remote_sock = socks[1];
+  return net_connection;
+}
+
+static void free_test_net_connection(net_connection_t *net_connection, sock_t remote_sock)
+{
+  assert(remove_net_connection(net_connection) == 0);
+  net_connection->connection->flags |= MG_F_CLOSE_IMMEDIATELY;
+  free_net_connection(net_connection);
+  closesocket(remote_sock);
+}
+
+static void sleep_test_net(void)
+{
+  struct timespec duration = {.tv_sec = 0, .tv_nsec = 1000000};
+  thrd_sleep(&duration, NULL);
+}
+
+static int send_test_packet(sock_t sock, uint32_t packet_id, ...)
+{
+  va_list args;
+  va_start(args, packet_id);
+  packet_t *packet = NULL;
+  int result = serialize_message(&packet, packet_id, args);
+  va_end(args);
+  if (result)
+  {
+    return 1;
+  }
+
+  buffer_t *buffer = buffer_init();
+  assert(serialize_packet(buffer, packet) == 0);
+  ssize_t sent_size = send(sock, buffer_get_data(buffer), buffer_get_size(buffer), 0);
+  result = sent_size == (ssize_t)buffer_get_size(buffer) ? 0 : 1;
+
+  buffer_free(buffer);
+  free_packet(packet);
+  return result;
+}
+
+/*
+ * Dispatches the packets received on the io threads until the remote end of a connection
+ * has been sent the number of packets wanted, the packets are read into the buffer in order.
+ */
+static int receive_test_packets(sock_t sock, buffer_t *buffer, uint16_t num_packets)
+{
+  for (int i = 0; i < 5000; i++)
+  {
+    assert(dispatch_net_packets() == 0);
+
+    uint8_t data[4096];
+    ssize_t data_size = recv(sock, data, sizeof(data), MSG_DONTWAIT);
+    if (data_size > 0)
+    {
+      assert(buffer_write(buffer, data, data_size) == 0);
+    }
+
+    // count the packets that have been received in full
+    uint16_t num_received_packets = 0;
+    size_t offset = 0;
+    while (buffer_get_size(buffer) - offset >= PACKET_HEADER_MIN_SIZE)
+    {
+      packet_t header_packet;
+      size_t header_size = MIN(PACKET_HEADER_SIZE, buffer_get_size(buffer) - offset);
+      if (deserialize_packet_header(&header_packet, buffer_get_data(buffer) + offset, header_size))
+      {
+        break;
+      }
+
+      size_t packet_size = header_packet.size > 0 ? PACKET_HEADER_SIZE + header_packet.size : PACKET_HEADER_MIN_SIZE;
+      if (buffer_get_size(buffer) - offset < packet_size)
+      {
+        break;
+      }
+
+      offset += packet_size;
+      num_received_packets++;
+    }
+
+    if (num_received_packets >= num_packets)
+    {
+      return 0;
+    }
+
+    sleep_test_net();
+  }
+
+  return 1;
+}
+
+TEST can_serialize_full_block_message(void)
+{
+  block_t *block = make_block();
+  randombytes_buf(block->hash, HASH_SIZE);
+  block->timestamp = 1234;
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    transaction_t *tx = make_transaction();
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    randombytes_buf(txout->address, ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, 0);
+    ASSERT(compute_self_tx_id(tx) == 0);
+    ASSERT(add_transaction_to_block(block, tx, i) == 0);
+  }
+
+  ASSERT(compute_merkle_root(block->merkle_root, block) == 0);
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP, block) == 0);
+  ASSERT(packet != NULL);
+
+  get_full_block_by_hash_response_t *message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&message) == 0);
+  ASSERT(message != NULL);
+
+  // the block arrives with all of it's txs in a single message
+  block_t *received_block = message->block;
+  ASSERT(compare_hash(received_block->hash, block->hash));
+  ASSERT_EQ(received_block->transaction_count, 3);
+  ASSERT(valid_merkle_root(received_block) == 1);
+  ASSERT(compare_block(received_block, block) == 1);
+
+  free_message(PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP, 1, message);
+  free_packet(packet);
+  free_block(block);
+  PASS();
+}
+
+TEST can_serialize_grouped_blocks_from_hash_message(void)
+{
+  uint8_t hash[HASH_SIZE];
+  randombytes_buf(hash, HASH_SIZE);
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ, hash, 1) == 0);
+  ASSERT(packet != NULL);
+
+  get_grouped_blocks_from_hash_request_t *message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&message) == 0);
+  ASSERT(message != NULL);
+  ASSERT(compare_hash(message->hash, hash));
+  ASSERT_EQ(message->include_transactions, 1);
+
+  free_message(PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ, 1, message);
+  free_packet(packet);
+  PASS();
+}
+
+TEST can_reject_mismatched_header_data_size(void)
+{
+  uint8_t header_data[64];
+  randombytes_buf(header_data, sizeof(header_data));
+  buffer_t *header_data_buffer = buffer_init_data(0, header_data, sizeof(header_data));
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP, 7, 1, header_data_buffer) == 0);
+  ASSERT(packet != NULL);
+
+  get_block_headers_from_height_response_t *message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&message) == 0);
+  ASSERT(message != NULL);
+  ASSERT_EQ(message->header_data_size, sizeof(header_data));
+  ASSERT_MEM_EQ(message->header_data, header_data, sizeof(header_data));
+  free_message(PKT_TYPE_GET_BLOCK_HEADERS_FROM_HEIGHT_RESP, 1, message);
+
+  // the header data size follows the height and headers count, a size which does
+  // not match the length of the header data that was sent is rejected...
+  packet->data[sizeof(uint32_t) * 2] ^= 0xff;
+  message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&message) == 1);
+
+  free_packet(packet);
+  buffer_free(header_data_buffer);
+  PASS();
+}
+
+TEST can_reject_mismatched_block_data_size(void)
+{
+  uint8_t block_data[64];
+  randombytes_buf(block_data, sizeof(block_data));
+  buffer_t *block_data_buffer = buffer_init_data(0, block_data, sizeof(block_data));
+
+  uint32_t packet_ids[2] = {PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_RESP, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP};
+  for (int i = 0; i < 2; i++)
+  {
+    packet_t *packet = NULL;
+    ASSERT(serialize_test_message(&packet, packet_ids[i], block_data_buffer) == 0);
+    ASSERT(packet != NULL);
+
+    // both responses share the same layout, so the height response is read through the hash response
+    get_grouped_blocks_from_hash_response_t *message = NULL;
+    ASSERT(deserialize_message(packet, (void**)&message) == 0);
+    ASSERT(message != NULL);
+    ASSERT_EQ(message->block_data_size, sizeof(block_data));
+    ASSERT_MEM_EQ(message->block_data, block_data, sizeof(block_data));
+    free_message(packet_ids[i], 1, message);
+
+    // the block data size leads the message, a size which does not match
+    // the length of the block data that was sent is rejected...
+    packet->data[0] ^= 0xff;
+    message = NULL;
+    ASSERT(deserialize_message(packet, (void**)&message) == 1);
+    free_packet(packet);
+  }
+
+  buffer_free(block_data_buffer);
+  PASS();
+}
+
+TEST can_negotiate_handshake_extensions(void)
 {
+  ASSERT(compare_version_numbers("1.0.0", PROTOCOL_HANDSHAKE_EXTENSIONS_VERSION) < 0);
+  ASSERT(compare_version_numbers("1.10.0", "1.9.0") > 0);
+  ASSERT(compare_version_numbers(APPLICATION_VERSION, PROTOCOL_HANDSHAKE_EXTENSIONS_VERSION) >= 0);
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_CONNECT_ESTABLISH_REQ, 6789, 0) == 0);
+  ASSERT(packet != NULL);
+
+  connect_establish_req_t *req_message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&req_message) == 0);
+  ASSERT(req_message != NULL);
+  ASSERT_EQ(req_message->host_port, 6789);
+  ASSERT_EQ(req_message->grouped_blocks_budget_size, get_grouped_blocks_budget_size());
+  ASSERT_EQ(req_message->capabilities, get_protocol_capabilities());
+  free_message(PKT_TYPE_CONNECT_ESTABLISH_REQ, 1, req_message);
+
+  // a legacy peer's request carries an older version and no extensions, the version
+  // number follows the host port and it's length prefix...
+  ASSERT(packet->data[sizeof(uint32_t) * 2 + 2] == '1');
+  packet->data[sizeof(uint32_t) * 2 + 2] = '0';
+  packet->size -= sizeof(uint32_t) * 2;
+  req_message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&req_message) == 0);
+  ASSERT(req_message != NULL);
+  ASSERT_EQ(req_message->grouped_blocks_budget_size, 0);
+  ASSERT_EQ(req_message->capabilities, 0);
+  free_message(PKT_TYPE_CONNECT_ESTABLISH_REQ, 1, req_message);
+  free_packet(packet);
+
+  // legacy peers are answered with an empty response
+  packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_CONNECT_ESTABLISH_RESP, 0) == 0);
+  ASSERT_EQ(packet->size, 0);
+
+  connect_establish_resp_t *resp_message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&resp_message) == 0);
+  ASSERT(resp_message != NULL);
+  ASSERT_EQ(resp_message->capabilities, 0);
+  free_message(PKT_TYPE_CONNECT_ESTABLISH_RESP, 1, resp_message);
+  free_packet(packet);
+
+  packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_CONNECT_ESTABLISH_RESP, 1) == 0);
+  resp_message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&resp_message) == 0);
+  ASSERT(resp_message != NULL);
+  ASSERT_EQ(resp_message->grouped_blocks_budget_size, get_grouped_blocks_budget_size());
+  ASSERT_EQ(resp_message->capabilities, get_protocol_capabilities());
+  free_message(PKT_TYPE_CONNECT_ESTABLISH_RESP, 1, resp_message);
+  free_packet(packet);
+  PASS();
+}
+
+TEST can_encode_packet_in_place(void)
+{
+  uint8_t hash[HASH_SIZE];
+  randombytes_buf(hash, HASH_SIZE);
+
+  buffer_t *buffer = init_packet_buffer(PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ);
+  ASSERT(buffer != NULL);
+  ASSERT(encode_hash_message(buffer, hash) == 0);
+  ASSERT(finish_packet_buffer(buffer) == 0);
+
+  // the packet is framed exactly like a packet serialized through a packet_t
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ, hash) == 0);
+  buffer_t *expected_buffer = buffer_init();
+  ASSERT(serialize_packet(expected_buffer, packet) == 0);
+  ASSERT(buffer_compare(buffer, expected_buffer) == 1);
+
+  // the message is decoded into storage provided by the caller
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  packet_t *deserialized_packet = make_packet();
+  ASSERT(deserialize_packet(deserialized_packet, buffer_iterator) == 0);
+
+  protocol_message_t message;
+  ASSERT(decode_message(deserialized_packet, ENCODING_VERSION_1, &message) == 0);
+  ASSERT(compare_hash(message.get_full_block_by_hash_request.hash, hash));
+  release_message(PKT_TYPE_GET_FULL_BLOCK_BY_HASH_REQ, 1, &message);
+
+  // packets without a payload only have the short header
+  buffer_t *empty_buffer = init_packet_buffer(PKT_TYPE_GET_PEERLIST_REQ);
+  ASSERT(finish_packet_buffer(empty_buffer) == 0);
+  ASSERT_EQ(buffer_get_size(empty_buffer), PACKET_HEADER_MIN_SIZE);
+
+  buffer_free(empty_buffer);
+  free_packet(deserialized_packet);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(expected_buffer);
+  free_packet(packet);
+  buffer_free(buffer);
+  PASS();
+}
+
+TEST can_deserialize_packet_header(void)
+{
+  uint8_t hash[HASH_SIZE];
+  randombytes_buf(hash, HASH_SIZE);
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HASH_REQ, hash, 1) == 0);
+  ASSERT(packet != NULL);
+
+  buffer_t *buffer = buffer_init();
+  ASSERT(serialize_packet(buffer, packet) == 0);
+  ASSERT_EQ(buffer_get_size(buffer), PACKET_HEADER_SIZE + packet->size);
+
+  // the header alone is enough to frame the packet's payload
+  packet_t header_packet;
+  ASSERT(deserialize_packet_header(&header_packet, buffer_get_data(buffer), PACKET_HEADER_MIN_SIZE) == 0);
+  ASSERT(deserialize_packet_header(&header_packet, buffer_get_data(buffer), PACKET_HEADER_SIZE) == 0);
+  ASSERT_EQ(header_packet.id, packet->id);
+  ASSERT_EQ(header_packet.size, packet->size);
+
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  packet_t *deserialized_packet = make_packet();
+  ASSERT(deserialize_packet(deserialized_packet, buffer_iterator) == 0);
+  ASSERT_EQ(deserialized_packet->size, packet->size);
+  ASSERT_MEM_EQ(deserialized_packet->data, packet->data, packet->size);
+  ASSERT_EQ(buffer_get_remaining_size(buffer_iterator), 0);
+
+  // a payload size that disagrees with the packet size is rejected
+  uint8_t *header = buffer_get_data(buffer);
+  header[PACKET_HEADER_MIN_SIZE]++;
+  ASSERT(deserialize_packet_header(&header_packet, header, PACKET_HEADER_SIZE) == 1);
+
+  free_packet(deserialized_packet);
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+  free_packet(packet);
+  PASS();
+}
+
+TEST can_serialize_transaction_merkle_branch_message(void)
+{
+  block_t *block = make_block();
+  randombytes_buf(block->hash, HASH_SIZE);
+  for (uint32_t i = 0; i < 5; i++)
+  {
+    transaction_t *tx = make_transaction();
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    randombytes_buf(txout->address, ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, 0);
+    ASSERT(compute_self_tx_id(tx) == 0);
+    ASSERT(add_transaction_to_block(block, tx, i) == 0);
+  }
+
+  ASSERT(compute_merkle_root(block->merkle_root, block) == 0);
+
+  uint32_t tx_index = 3;
+  uint8_t branch[HASH_SIZE * MAX_MERKLE_BRANCH_LENGTH];
+  uint32_t branch_length = 0;
+  ASSERT(compute_block_merkle_branch(branch, &branch_length, block, tx_index) == 0);
+  ASSERT_EQ(branch_length, 3);
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP,
+    block, tx_index, block->transactions[tx_index], branch_length, branch) == 0);
+  ASSERT(packet != NULL);
+
+  get_transaction_merkle_branch_response_t *message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&message) == 0);
+  ASSERT(message != NULL);
+
+  // only the header of the block is received along with the tx
+  ASSERT(message->block->transactions == NULL);
+  ASSERT(valid_block_merkle_branch(message->block, message->transaction, message->tx_index,
+    message->branch, message->branch_length) == 1);
+  ASSERT(valid_block_merkle_branch(message->block, message->transaction, message->tx_index - 1,
+    message->branch, message->branch_length) == 0);
+
+  free_message(PKT_TYPE_GET_TRANSACTION_MERKLE_BRANCH_RESP, 0, message);
+  free_packet(packet);
+  free_block(block);
+  PASS();
+}
+
+TEST can_serialize_compact_block_message(void)
+{
+  block_t *block = make_block();
+  randombytes_buf(block->hash, HASH_SIZE);
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    transaction_t *tx = make_transaction();
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    randombytes_buf(txout->address, ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, 0);
+    ASSERT(compute_self_tx_id(tx) == 0);
+    ASSERT(add_transaction_to_block(block, tx, i) == 0);
+  }
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP, block) == 0);
+  ASSERT(packet != NULL);
+
+  get_compact_block_by_hash_response_t *message = NULL;
+  ASSERT(deserialize_message(packet, (void**)&message) == 0);
+  ASSERT(message != NULL);
+
+  // only the generation tx is sent in full, the rest are sent as short ids
+  ASSERT(compare_hash(message->block->hash, block->hash) == 1);
+  ASSERT_EQ(message->block->transaction_count, block->transaction_count);
+  ASSERT(compare_transaction(message->block->transactions[0], block->transactions[0]) == 1);
+  for (uint32_t i = 1; i < block->transaction_count; i++)
+  {
+    ASSERT_MEM_EQ(message->short_ids + ((i - 1) * COMPACT_BLOCK_SHORT_ID_SIZE),
+      block->transactions[i]->id, COMPACT_BLOCK_SHORT_ID_SIZE);
+  }
+
+  // an unrequested block is not taken while we are not syncing, so it is released
+  net_connection_t net_connection;
+  memset(&net_connection, 0, sizeof(net_connection_t));
+  ASSERT(handle_packet(&net_connection, PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP, message) == 1);
+
+  free_message(PKT_TYPE_GET_COMPACT_BLOCK_BY_HASH_RESP, 1, message);
+  free_packet(packet);
+  free_block(block);
+  PASS();
+}
+
+TEST can_evict_oldest_known_inventory(void)
+{
+  inventory_t *inventory = make_inventory();
+  uint8_t first_tx_id[HASH_SIZE];
+  randombytes_buf(first_tx_id, HASH_SIZE);
+  ASSERT(add_known_inventory(inventory, first_tx_id) == 0);
+  ASSERT(add_known_inventory(inventory, first_tx_id) == 1);
+
+  uint8_t last_tx_id[HASH_SIZE];
+  for (uint32_t i = 1; i < MAX_KNOWN_INVENTORY_SIZE; i++)
+  {
+    randombytes_buf(last_tx_id, HASH_SIZE);
+    ASSERT(add_known_inventory(inventory, last_tx_id) == 0);
+  }
+
+  ASSERT(has_known_inventory(inventory, first_tx_id) == 1);
+
+  // the ring is full, so the oldest tx id is forgotten first
+  uint8_t tx_id[HASH_SIZE];
+  randombytes_buf(tx_id, HASH_SIZE);
+  ASSERT(add_known_inventory(inventory, tx_id) == 0);
+  ASSERT(has_known_inventory(inventory, first_tx_id) == 0);
+  ASSERT(has_known_inventory(inventory, last_tx_id) == 1);
+  ASSERT(has_known_inventory(inventory, tx_id) == 1);
+  ASSERT_EQ(inventory->known_tx_ids_count, MAX_KNOWN_INVENTORY_SIZE);
+
+  free_inventory(inventory);
+  PASS();
+}
+
+TEST can_request_inventory_txs_once(void)
+{
+  uint8_t tx_id[HASH_SIZE];
+  randombytes_buf(tx_id, HASH_SIZE);
+  uint64_t request_time_ms = get_current_time_ms();
+
+  // only the first peer announcing the tx is asked for it, until that request times out
+  ASSERT(request_transaction_id(tx_id, request_time_ms) == 0);
+  ASSERT(request_transaction_id(tx_id, request_time_ms + 1) == 1);
+  ASSERT(request_transaction_id(tx_id, request_time_ms + (TX_INVENTORY_REQUEST_TIMEOUT * 1000)) == 1);
+  ASSERT(request_transaction_id(tx_id, request_time_ms + (TX_INVENTORY_REQUEST_TIMEOUT * 1000) + 1) == 0);
+  ASSERT(request_transaction_id(tx_id, request_time_ms + (TX_INVENTORY_REQUEST_TIMEOUT * 1000) + 2) == 1);
 
+  uint8_t other_tx_id[HASH_SIZE];
+  randombytes_buf(other_tx_id, HASH_SIZE);
+  ASSERT(request_transaction_id(other_tx_id, request_time_ms) == 0);
+
+  // peers are told to expect announcements, the peers which predate them are sent full txs
+  ASSERT(get_protocol_capabilities() & PROTOCOL_CAPABILITY_TX_INVENTORY);
+
+  clear_requested_transaction_ids();
+  ASSERT(request_transaction_id(tx_id, request_time_ms) == 0);
+  clear_requested_transaction_ids();
+  PASS();
+}
+
+TEST can_score_peer_latency(void)
+{
+  net_connection_t net_connection;
+  memset(&net_connection, 0, sizeof(net_connection_t));
+  peer_t *peer = init_peer(0, &net_connection);
+  ASSERT_EQ(peer->score, PEER_INITIAL_SCORE);
+  ASSERT_EQ(get_peer_latency(peer), PEER_DEFAULT_LATENCY_MS);
+
+  // the first measurement is taken as is, later ones are smoothed
+  record_peer_rtt(peer, 400);
+  ASSERT_EQ(get_peer_latency(peer), 400);
+  record_peer_rtt(peer, 1200);
+  ASSERT_EQ(get_peer_latency(peer), 500);
+
+  // measured block deliveries are preferred over the ping round trip time
+  record_peer_block_delivery(peer, 800);
+  ASSERT_EQ(get_peer_latency(peer), 800);
+  ASSERT_EQ(peer->score, PEER_INITIAL_SCORE + PEER_DELIVERY_REWARD);
+
+  record_peer_failure(peer);
+  record_peer_misbehavior(peer);
+  ASSERT_EQ(peer->score, PEER_INITIAL_SCORE + PEER_DELIVERY_REWARD - PEER_TIMEOUT_PENALTY - PEER_MISBEHAVIOR_PENALTY);
+  ASSERT_EQ(peer->num_failures, 1);
+  ASSERT_EQ(peer->num_misbehaviors, 1);
+
+  free_peer(peer);
+  PASS();
+}
+
+TEST can_lookup_peers(void)
+{
+  net_connection_t net_connections[2];
+  memset(net_connections, 0, sizeof(net_connections));
+  peer_t *peer1 = init_peer(concatenate(convert_str_to_ip("198.51.100.7"), 9899), &net_connections[0]);
+  peer_t *peer2 = init_peer(concatenate(convert_str_to_ip("198.51.100.7"), 9898), &net_connections[1]);
+  ASSERT(add_peer(peer1) == 0);
+  ASSERT(add_peer(peer2) == 0);
+  ASSERT(add_peer(peer1) == 1);
+
+  // the peers are found by their id and by their net connection
+  ASSERT_EQ(get_peer(peer1->id), peer1);
+  ASSERT_EQ(get_peer(peer2->id), peer2);
+  ASSERT_EQ(get_peer_from_net_connection(&net_connections[0]), peer1);
+  ASSERT_EQ(get_peer_from_net_connection(&net_connections[1]), peer2);
+
+  ASSERT(remove_peer(peer1) == 0);
+  ASSERT(remove_peer(peer1) == 1);
+  ASSERT(has_peer(peer1->id) == 0);
+  ASSERT(get_peer_from_net_connection(&net_connections[0]) == NULL);
+  ASSERT_EQ(get_peer_from_net_connection(&net_connections[1]), peer2);
+
+  ASSERT(remove_peer(peer2) == 0);
+  ASSERT_EQ(get_num_peers(), 0);
+  free_peer(peer1);
+  free_peer(peer2);
+  PASS();
+}
+
+TEST can_persist_peer_table(void)
+{
+  // the daemon's peer table is swapped out for the duration of the test
+  ASSERT(deinit_peer_table() == 0);
+  remove(g_peer_table_filename);
+  ASSERT(init_peer_table(g_peer_table_filename) == 0);
+  ASSERT_EQ(get_num_peer_addresses(), 0);
+
+  uint32_t heard_ip = convert_str_to_ip("93.184.216.34");
+  uint32_t connected_ip = convert_str_to_ip("198.51.100.7");
+  ASSERT(add_peer_address(heard_ip, 9899) == 0);
+  ASSERT(mark_peer_address_attempt(heard_ip, 9899) == 0);
+  ASSERT(mark_peer_address_success(connected_ip, 9899) == 0);
+  ASSERT(mark_peer_address_attempt(connected_ip, 9898) == 1);
+  ASSERT_EQ(get_num_peer_addresses(), 2);
+  ASSERT(deinit_peer_table() == 0);
+
+  // a record torn part of the way through is dropped when the table is loaded
+  FILE *fp = fopen(g_peer_table_filename, "ab");
+  ASSERT(fp != NULL);
+  ASSERT_EQ(fputc(0xff, fp), 0xff);
+  ASSERT(fclose(fp) == 0);
+
+  ASSERT(init_peer_table(g_peer_table_filename) == 0);
+  ASSERT_EQ(get_num_peer_addresses(), 2);
+
+  peer_address_t address;
+  ASSERT(get_peer_address(heard_ip, 9899, &address) == 0);
+  ASSERT_EQ(address.tried, 0);
+  ASSERT_EQ(address.num_attempts, 1);
+  ASSERT(get_peer_address(connected_ip, 9899, &address) == 0);
+  ASSERT_EQ(address.tried, 1);
+  ASSERT_EQ(address.num_attempts, 0);
+
+  // the address we just tried to connect to is not selected again right away
+  peer_address_t addresses[MAX_P2P_PEERS_COUNT];
+  ASSERT_EQ(select_peer_addresses(addresses, MAX_P2P_PEERS_COUNT), 1);
+  ASSERT_EQ(addresses[0].ip, connected_ip);
+
+  ASSERT(deinit_peer_table() == 0);
+  ASSERT(remove(g_peer_table_filename) == 0);
+  ASSERT(init_peer_table(get_p2p_storage_filename()) == 0);
+  PASS();
+}
+
+TEST can_compress_packet(void)
+{
+  if (get_compression_supported() == 0)
+  {
+    SKIP();
+  }
+
+  block_t *block = make_block();
+  for (uint32_t i = 0; i < 64; i++)
+  {
+    transaction_t *tx = make_transaction();
+    output_transaction_t *txout = make_txout();
+    txout->amount = i;
+    add_txout_to_transaction(tx, txout, 0);
+    ASSERT(compute_self_tx_id(tx) == 0);
+    ASSERT(add_transaction_to_block(block, tx, i) == 0);
+  }
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_GET_FULL_BLOCK_BY_HASH_RESP, block) == 0);
+  ASSERT(packet != NULL);
+  ASSERT(packet->size >= COMPRESSED_PACKET_MIN_SIZE);
+
+  packet_t *compressed_packet = NULL;
+  ASSERT(compress_packet(packet, &compressed_packet) == 0);
+  ASSERT_EQ(compressed_packet->id, PKT_TYPE_COMPRESSED_PACKET);
+  ASSERT(compressed_packet->size < packet->size);
+
+  packet_t *decompressed_packet = NULL;
+  ASSERT(decompress_packet(compressed_packet, &decompressed_packet) == 0);
+  ASSERT_EQ(decompressed_packet->id, packet->id);
+  ASSERT_EQ(decompressed_packet->size, packet->size);
+  ASSERT_MEM_EQ(decompressed_packet->data, packet->data, packet->size);
+
+  // a corrupted payload must not decompress
+  compressed_packet->data[compressed_packet->size - 1] ^= 0xff;
+  packet_t *corrupted_packet = NULL;
+  ASSERT(decompress_packet(compressed_packet, &corrupted_packet) == 1);
+
+  free_packet(decompressed_packet);
+  free_packet(compressed_packet);
+  free_packet(packet);
+  free_block(block);
+  PASS();
+}
+
+TEST can_bound_decompressed_packet_size(void)
+{
+  if (get_compression_supported() == 0)
+  {
+    SKIP();
+  }
+
+  // a payload many times the initial decompression buffer size grows it as it inflates
+  packet_t *packet = make_packet();
+  packet->id = PKT_TYPE_GET_GROUPED_BLOCKS_FROM_HEIGHT_RESP;
+  packet->size = DECOMPRESS_INITIAL_SIZE * 5 + 7;
+  packet->data = buffer_pool_acquire(packet->size);
+  memset(packet->data, 0, packet->size);
+  randombytes_buf(packet->data, 1024);
+
+  packet_t *compressed_packet = NULL;
+  ASSERT(compress_packet(packet, &compressed_packet) == 0);
+
+  packet_t *decompressed_packet = NULL;
+  ASSERT(decompress_packet(compressed_packet, &decompressed_packet) == 0);
+  ASSERT_EQ(decompressed_packet->size, packet->size);
+  ASSERT_MEM_EQ(decompressed_packet->data, packet->data, packet->size);
+  free_packet(decompressed_packet);
+
+  // the declared size follows the packet id, a payload which does not inflate
+  // to the size it declares is rejected...
+  uint32_t *declared_size = (uint32_t*)(compressed_packet->data + sizeof(uint32_t));
+  const uint32_t packet_size = *declared_size;
+  *declared_size = packet_size + 1;
+  decompressed_packet = NULL;
+  ASSERT(decompress_packet(compressed_packet, &decompressed_packet) == 1);
+
+  *declared_size = packet_size - 1;
+  ASSERT(decompress_packet(compressed_packet, &decompressed_packet) == 1);
+
+  // as is a declared size which the payload could not possibly inflate to
+  uint32_t compressed_size = compressed_packet->size - COMPRESSED_PACKET_HEADER_SIZE;
+  *declared_size = compressed_size * DECOMPRESS_MAX_RATIO + 1;
+  ASSERT(decompress_packet(compressed_packet, &decompressed_packet) == 1);
+
+  free_packet(compressed_packet);
+  free_packet(packet);
+  PASS();
+}
+
+TEST can_handle_rpc_request(void)
+{
+  const char *request = "{\"jsonrpc\":\"2.0\",\"id\":7,\"method\":\"get_height\"}";
+  buffer_t *response = buffer_init();
+  ASSERT(handle_rpc_request(request, strlen(request), response) == 0);
+
+  json_value_t *value = parse_json((const char*)buffer_get_data(response), buffer_get_size(response));
+  ASSERT(value != NULL);
+  uint64_t id = 0;
+  ASSERT(get_json_uint64(get_json_object_value(value, "id"), &id) == 0);
+  ASSERT_EQ(id, 7);
+  ASSERT(get_json_object_value(get_json_object_value(value, "result"), "height") != NULL);
+  free_json_value(value);
+
+  // notifications are not answered, every other call of a batch is answered in order
+  const char *batch_request = "[{\"jsonrpc\":\"2.0\",\"method\":\"get_height\"},"
+    "{\"jsonrpc\":\"2.0\",\"id\":\"a\",\"method\":\"get_mempool\"},"
+    "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"unknown\"}]";
+  buffer_clear(response);
+  ASSERT(handle_rpc_request(batch_request, strlen(batch_request), response) == 0);
+
+  value = parse_json((const char*)buffer_get_data(response), buffer_get_size(response));
+  ASSERT(value != NULL);
+  ASSERT_EQ(value->type, JSON_TYPE_ARRAY);
+  ASSERT_EQ(value->num_values, 2);
+  ASSERT(get_json_object_value(value->values[0], "result") != NULL);
+  json_value_t *error = get_json_object_value(value->values[1], "error");
+  ASSERT(error != NULL);
+  ASSERT_STR_EQ(get_json_object_value(error, "code")->string, "-32601");
+  free_json_value(value);
+
+  const char *invalid_request = "{\"id\":1,";
+  buffer_clear(response);
+  ASSERT(handle_rpc_request(invalid_request, strlen(invalid_request), response) == 0);
+
+  value = parse_json((const char*)buffer_get_data(response), buffer_get_size(response));
+  ASSERT(value != NULL);
+  ASSERT_STR_EQ(get_json_object_value(get_json_object_value(value, "error"), "code")->string, "-32700");
+  free_json_value(value);
+
+  buffer_free(response);
+  PASS();
+}
+
+TEST can_defer_requests_of_paused_connection(void)
+{
+  ASSERT(init_test_net(0) == 0);
+  set_net_send_queue_high_watermark(1024);
+  set_net_send_queue_low_watermark(256);
+
+  sock_t remote_sock = INVALID_SOCKET;
+  net_connection_t *net_connection = make_test_net_connection(&remote_sock);
+  ASSERT(is_net_connection_send_paused(net_connection) == 0);
+
+  buffer_t *request_buffer = init_packet_buffer(PKT_TYPE_GET_PEERLIST_REQ);
+  ASSERT(finish_packet_buffer(request_buffer) == 0);
+
+  // going over the high watermark pauses the connection
+  uint8_t data[2048];
+  memset(data, 0, sizeof(data));
+  ASSERT(send_data(net_connection, data, 512) == 0);
+  ASSERT(is_net_connection_send_paused(net_connection) == 0);
+  ASSERT(send_data(net_connection, data, sizeof(data)) == 0);
+  ASSERT(is_net_connection_send_paused(net_connection) == 1);
+
+  // data requests are deferred rather than answered while paused
+  size_t pending_send_size = get_net_connection_pending_send_size(net_connection);
+  data_received(net_connection, buffer_get_data(request_buffer), buffer_get_size(request_buffer));
+  data_received(net_connection, buffer_get_data(request_buffer), buffer_get_size(request_buffer));
+  ASSERT_EQ(get_net_connection_num_deferred_packets(net_connection), 2);
+  ASSERT_EQ(get_net_connection_pending_send_size(net_connection), pending_send_size);
+
+  // the connection stays paused until it drains below the low watermark
+  ASSERT(flush_send_queue(net_connection) == 0);
+  struct mbuf *send_mbuf = &net_connection->connection->send_mbuf;
+  mbuf_remove(send_mbuf, send_mbuf->len - 512);
+  ASSERT(check_net_send_queues() == 0);
+  ASSERT(is_net_connection_send_paused(net_connection) == 1);
+  ASSERT_EQ(get_net_connection_num_deferred_packets(net_connection), 2);
+
+  // once resumed, the deferred requests are answered in order
+  mbuf_remove(send_mbuf, send_mbuf->len);
+  ASSERT(check_net_send_queues() == 0);
+  ASSERT(is_net_connection_send_paused(net_connection) == 0);
+  ASSERT_EQ(get_net_connection_num_deferred_packets(net_connection), 0);
+  ASSERT(get_net_connection_pending_send_size(net_connection) > 0);
+
+  // a connection that stays paused past the stall timeout is disconnected
+  ASSERT(send_data(net_connection, data, sizeof(data)) == 0);
+  ASSERT(is_net_connection_send_paused(net_connection) == 1);
+  ASSERT(check_net_send_queues() == 0);
+  ASSERT((net_connection->connection->flags & MG_F_CLOSE_IMMEDIATELY) == 0);
+
+  set_net_send_queue_stall_timeout(1);
+  net_connection->send_paused_ts -= 2;
+  ASSERT(check_net_send_queues() == 0);
+  ASSERT(net_connection->connection->flags & MG_F_CLOSE_IMMEDIATELY);
+
+  buffer_free(request_buffer);
+  free_test_net_connection(net_connection, remote_sock);
+  set_net_send_queue_stall_timeout(NET_SEND_QUEUE_STALL_TIMEOUT);
+  set_net_send_queue_low_watermark(NET_SEND_QUEUE_LOW_WATERMARK);
+  set_net_send_queue_high_watermark(NET_SEND_QUEUE_HIGH_WATERMARK);
+  deinit_test_net();
+  PASS();
+}
+
+TEST can_dispatch_io_thread_packets_in_order(void)
+{
+  ASSERT(init_test_net(1) == 0);
+  int num_net_connections = get_num_net_connections();
+  uint16_t num_peers = get_num_peers();
+
+  sock_t socks[2];
+  ASSERT(mg_socketpair(socks, SOCK_STREAM) == 1);
+
+  // the accepted connection is handed to the io thread without closing it's socket
+  struct mg_connection *connection = mg_add_sock(get_net_mgr(), socks[0], ignore_test_connection_event);
+  ASSERT(connection != NULL);
+  hand_off_net_connection(connection);
+  ASSERT_EQ(connection->sock, INVALID_SOCKET);
+  ASSERT(connection->flags & MG_F_CLOSE_IMMEDIATELY);
+
+  // the packets received on the io thread are handled on this thread in the order they
+  // were received, which is the order their responses are sent back in...
+  ASSERT(send_test_packet(socks[1], PKT_TYPE_CONNECT_ESTABLISH_REQ, 6789, parameters_get_use_testnet()) == 0);
+  ASSERT(send_test_packet(socks[1], PKT_TYPE_CONNECT_PING_REQ, (uint64_t)1) == 0);
+  ASSERT(send_test_packet(socks[1], PKT_TYPE_CONNECT_PING_REQ, (uint64_t)2) == 0);
+
+  buffer_t *buffer = buffer_init();
+  ASSERT(receive_test_packets(socks[1], buffer, 3) == 0);
+  ASSERT_EQ(get_num_net_connections(), num_net_connections + 1);
+  ASSERT_EQ(get_num_peers(), num_peers + 1);
+
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+  uint32_t expected_packet_ids[3] = {PKT_TYPE_CONNECT_ESTABLISH_RESP, PKT_TYPE_CONNECT_PING_RESP, PKT_TYPE_CONNECT_PING_RESP};
+  for (int i = 0; i < 3; i++)
+  {
+    packet_t *packet = make_packet();
+    ASSERT(deserialize_packet(packet, buffer_iterator) == 0);
+    ASSERT_EQ(packet->id, expected_packet_ids[i]);
+    if (packet->id == PKT_TYPE_CONNECT_PING_RESP)
+    {
+      connect_ping_resp_t *message = NULL;
+      ASSERT(deserialize_message(packet, (void**)&message) == 0);
+      ASSERT_EQ(message->nonce, (uint64_t)i);
+      free_message(packet->id, 1, message);
+    }
+
+    free_packet(packet);
+  }
+
+  buffer_iterator_free(buffer_iterator);
+  buffer_free(buffer);
+
+  // packets received before the connection was closed are still handled before it is torn
+  // down, their responses are dropped and the connection is only free'd once...
+  ASSERT(send_test_packet(socks[1], PKT_TYPE_CONNECT_PING_REQ, (uint64_t)3) == 0);
+  ASSERT(send_test_packet(socks[1], PKT_TYPE_GET_BLOCK_HEIGHT_REQ) == 0);
+  closesocket(socks[1]);
+
+  for (int i = 0; i < 5000 && get_num_net_connections() > num_net_connections; i++)
+  {
+    sleep_test_net();
+    ASSERT(dispatch_net_packets() == 0);
+  }
+
+  ASSERT_EQ(get_num_net_connections(), num_net_connections);
+  ASSERT_EQ(get_num_peers(), num_peers);
+  ASSERT(dispatch_net_packets() == 0);
+  ASSERT_EQ(get_num_net_connections(), num_net_connections);
+
+  deinit_test_net();
+  PASS();
+}
+
+/*
+ * Hands a connection to the io threads and completes it's handshake, the peer added
+ * for the connection is looked up by the loopback address it was given.
+ */
+static net_connection_t* make_test_io_net_connection(uint32_t host_port, sock_t *remote_sock)
+{
+  sock_t socks[2];
+  assert(mg_socketpair(socks, SOCK_STREAM) == 1);
+
+  struct mg_connection *connection = mg_add_sock(get_net_mgr(), socks[0], ignore_test_connection_event);
+  assert(connection != NULL);
+  connection->sa.sin.sin_family = AF_INET;
+  connection->sa.sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  hand_off_net_connection(connection);
+
+  assert(send_test_packet(socks[1], PKT_TYPE_CONNECT_ESTABLISH_REQ, host_port, parameters_get_use_testnet()) == 0);
+  buffer_t *buffer = buffer_init();
+  assert(receive_test_packets(socks[1], buffer, 1) == 0);
+  buffer_free(buffer);
+
+  peer_t *peer = get_peer(concatenate(INADDR_LOOPBACK, host_port));
+  assert(peer != NULL);
+  *remote_sock = socks[1];
+  return peer->net_connection;
+}
+
+TEST can_share_payload_between_send_queues(void)
+{
+  ASSERT(init_test_net(1) == 0);
+
+  net_connection_t *net_connections[3];
+  sock_t remote_socks[3];
+  for (int i = 0; i < 3; i++)
+  {
+    net_connections[i] = make_test_io_net_connection(7000 + i, &remote_socks[i]);
+    ASSERT(net_connections[i]->io_thread != NULL);
+  }
+
+  packet_t *packet = NULL;
+  ASSERT(serialize_test_message(&packet, PKT_TYPE_CONNECT_PING_REQ, (uint64_t)42) == 0);
+  buffer_t *packet_buffer = buffer_init();
+  ASSERT(serialize_packet(packet_buffer, packet) == 0);
+  free_packet(packet);
+
+  // every send queue takes a reference to the one payload, so it outlives the
+  // caller's reference until the last of the io threads has flushed it...
+  net_payload_t *payload = make_net_payload(packet_buffer);
+  for (int i = 0; i < 3; i++)
+  {
+    ASSERT(send_payload(net_connections[i], payload) == 0);
+  }
+
+  release_net_payload(payload);
+  for (int i = 0; i < 3; i++)
+  {
+    buffer_t *buffer = buffer_init();
+    ASSERT(receive_test_packets(remote_socks[i], buffer, 1) == 0);
+
+    buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer);
+    packet_t *received_packet = make_packet();
+    ASSERT(deserialize_packet(received_packet, buffer_iterator) == 0);
+    ASSERT_EQ(received_packet->id, PKT_TYPE_CONNECT_PING_REQ);
+
+    connect_ping_req_t *message = NULL;
+    ASSERT(deserialize_message(received_packet, (void**)&message) == 0);
+    ASSERT_EQ(message->nonce, 42);
+    ASSERT_EQ(buffer_get_remaining_size(buffer_iterator), 0);
+    free_message(PKT_TYPE_CONNECT_PING_REQ, 1, message);
+
+    free_packet(received_packet);
+    buffer_iterator_free(buffer_iterator);
+    buffer_free(buffer);
+  }
+
+  deinit_test_net();
+  for (int i = 0; i < 3; i++)
+  {
+    closesocket(remote_socks[i]);
+  }
+
+  PASS();
+}
+
+static int has_test_net_connection_port(net_connection_t **net_connections, uint16_t num_net_connections, uint32_t host_port)
+{
+  for (uint16_t i = 0; i < num_net_connections; i++)
+  {
+    if (net_connections[i]->host_port == host_port)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+TEST can_cap_and_back_off_pending_dials(void)
+{
+  ASSERT(init_test_net(0) == 0);
+
+  // the daemon's peer table is swapped out for the duration of the test
+  ASSERT(deinit_peer_table() == 0);
+  remove(g_peer_table_filename);
+  ASSERT(init_peer_table(g_peer_table_filename) == 0);
+
+  const uint16_t num_addresses = NET_MAX_PENDING_DIALS + 4;
+  for (uint16_t i = 0; i < num_addresses; i++)
+  {
+    char address_str[32];
+    snprintf(address_str, sizeof(address_str), "198.51.100.%u", 20 + i);
+    ASSERT(add_peer_address(convert_str_to_ip(address_str), 9000 + i) == 0);
+  }
+
+  // no more than the max pending dials are in flight at once, even when
+  // we are further than that from the target number of outbound peers...
+  uint16_t num_peers = get_num_peers();
+  set_net_target_outbound_peers(num_addresses);
+  ASSERT(manage_net_connections() == 0);
+  ASSERT_EQ(get_num_peers(), num_peers + NET_MAX_PENDING_DIALS);
+  ASSERT(manage_net_connections() == 0);
+  ASSERT_EQ(get_num_peers(), num_peers + NET_MAX_PENDING_DIALS);
+
+  net_connection_t *dialed_net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_dialed_net_connections = get_peer_net_connections(dialed_net_connections, MAX_P2P_PEERS_COUNT);
+  uint32_t dialed_ports[NET_MAX_PENDING_DIALS];
+  uint16_t num_dialed_ports = 0;
+  for (uint16_t i = 0; i < num_dialed_net_connections; i++)
+  {
+    net_connection_t *net_connection = dialed_net_connections[i];
+    if (net_connection->outbound == 0)
+    {
+      continue;
+    }
+
+    ASSERT(net_connection->anonymous);
+    ASSERT(num_dialed_ports < NET_MAX_PENDING_DIALS);
+    dialed_ports[num_dialed_ports++] = net_connection->host_port;
+    net_connection->dial_ts -= NET_DIAL_TIMEOUT + 1;
+  }
+
+  ASSERT_EQ(num_dialed_ports, NET_MAX_PENDING_DIALS);
+
+  // dials which have not completed their handshake in time are closed
+  ASSERT(manage_net_connections() == 0);
+  for (uint16_t i = 0; i < num_dialed_net_connections; i++)
+  {
+    net_connection_t *net_connection = dialed_net_connections[i];
+    if (net_connection->outbound)
+    {
+      ASSERT(net_connection->connection->flags & MG_F_CLOSE_IMMEDIATELY);
+    }
+  }
+
+  mg_mgr_poll(get_net_mgr(), 0);
+  ASSERT_EQ(get_num_peers(), num_peers);
+
+  // the failed addresses are backed off, only the addresses that were
+  // not dialed yet are dialed next...
+  for (uint16_t i = 0; i < num_dialed_ports; i++)
+  {
+    char address_str[32];
+    snprintf(address_str, sizeof(address_str), "198.51.100.%u", 20 + (dialed_ports[i] - 9000));
+
+    peer_address_t address;
+    ASSERT(get_peer_address(convert_str_to_ip(address_str), dialed_ports[i], &address) == 0);
+    ASSERT_EQ(address.num_attempts, 1);
+  }
+
+  ASSERT(manage_net_connections() == 0);
+  ASSERT_EQ(get_num_peers(), num_peers + num_addresses - NET_MAX_PENDING_DIALS);
+
+  net_connection_t *net_connections[MAX_P2P_PEERS_COUNT];
+  uint16_t num_net_connections = get_peer_net_connections(net_connections, MAX_P2P_PEERS_COUNT);
+  for (uint16_t i = 0; i < num_dialed_ports; i++)
+  {
+    ASSERT(has_test_net_connection_port(net_connections, num_net_connections, dialed_ports[i]) == 0);
+  }
+
+  deinit_test_net();
+  ASSERT_EQ(get_num_peers(), num_peers);
+
+  ASSERT(deinit_peer_table() == 0);
+  ASSERT(remove(g_peer_table_filename) == 0);
+  ASSERT(init_peer_table(get_p2p_storage_filename()) == 0);
+  PASS();
+}
+
+GREATEST_SUITE(protocol_suite)
+{
+  RUN_TEST(can_serialize_full_block_message);
+  RUN_TEST(can_serialize_grouped_blocks_from_hash_message);
+  RUN_TEST(can_reject_mismatched_header_data_size);
+  RUN_TEST(can_reject_mismatched_block_data_size);
+  RUN_TEST(can_negotiate_handshake_extensions);
+  RUN_TEST(can_serialize_transaction_merkle_branch_message);
+  RUN_TEST(can_serialize_compact_block_message);
+  RUN_TEST(can_evict_oldest_known_inventory);
+  RUN_TEST(can_request_inventory_txs_once);
+  RUN_TEST(can_score_peer_latency);
+  RUN_TEST(can_lookup_peers);
+  RUN_TEST(can_persist_peer_table);
+  RUN_TEST(can_compress_packet);
+  RUN_TEST(can_bound_decompressed_packet_size);
+  RUN_TEST(can_deserialize_packet_header);
+  RUN_TEST(can_encode_packet_in_place);
+  RUN_TEST(can_handle_rpc_request);
+  RUN_TEST(can_defer_requests_of_paused_connection);
+  RUN_TEST(can_dispatch_io_thread_packets_in_order);
+  RUN_TEST(can_share_payload_between_send_queues);
+  RUN_TEST(can_cap_and_back_off_pending_dials);
 }
@@ -25,12 +25,15 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sodium.h>
 
 #include "common/greatest.h"
 #include "common/util.h"
 
+#include "core/flat_transactions.h"
 #include "core/transaction.h"
+#include "core/transaction_builder.h"
 
 #include "crypto/cryptoutil.h"
 
@@ -43,7 +46,396 @@ TEST try_double_spend_tx(void)
   PASS();
 }
 
+TEST can_verify_signature_batch(void)
+{
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  transaction_t *tx = make_transaction();
+  for (uint32_t i = 0; i < 2; i++)
+  {
+    output_transaction_t *txout = make_txout();
+    txout->amount = randombytes_random();
+    randombytes_buf(txout->address, ADDRESS_SIZE);
+    add_txout_to_transaction(tx, txout, i);
+  }
+
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    input_transaction_t *txin = make_txin();
+    randombytes_buf(txin->transaction, HASH_SIZE);
+    txin->txout_index = i;
+    add_txin_to_transaction(tx, txin, i);
+    ASSERT(sign_txin(txin, tx, public_key, secret_key) == 0);
+  }
+
+  ASSERT(validate_tx_signatures(tx) == 0);
+
+  signature_batch_t *signature_batch = init_signature_batch(tx->txin_count, get_tx_signature_data_size(tx));
+  ASSERT(add_tx_to_signature_batch(signature_batch, tx) == 0);
+  ASSERT_EQ(signature_batch->num_checks, 3);
+  ASSERT(verify_signature_batch(signature_batch, NULL) == 0);
+
+  // the batch is full, the tx should not fit a second time
+  ASSERT(add_tx_to_signature_batch(signature_batch, tx) == 1);
+
+  // an invalid signature is pinpointed to it's txin
+  tx->txins[1]->signature[0] ^= 0xff;
+  uint32_t failed_check_index = 0;
+  ASSERT(verify_signature_batch(signature_batch, &failed_check_index) == 1);
+  ASSERT_EQ(failed_check_index, 1);
+  ASSERT(validate_tx_signatures(tx) == 1);
+
+  free_signature_batch(signature_batch);
+  free_transaction(tx);
+  PASS();
+}
+
+TEST can_flatten_transactions(void)
+{
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  // the first tx has no txins, the others have one more txin than the last
+  transaction_t *transactions[3];
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    transaction_t *tx = make_transaction();
+    randombytes_buf(tx->id, HASH_SIZE);
+    for (uint32_t j = 0; j < 2; j++)
+    {
+      output_transaction_t *txout = make_txout();
+      txout->amount = randombytes_random();
+      randombytes_buf(txout->address, ADDRESS_SIZE);
+      add_txout_to_transaction(tx, txout, j);
+    }
+
+    for (uint32_t j = 0; j < i; j++)
+    {
+      input_transaction_t *txin = make_txin();
+      randombytes_buf(txin->transaction, HASH_SIZE);
+      txin->txout_index = j;
+      add_txin_to_transaction(tx, txin, j);
+      ASSERT(sign_txin(txin, tx, public_key, secret_key) == 0);
+    }
+
+    transactions[i] = tx;
+  }
+
+  flat_transactions_t *flat_txs = flatten_transactions(transactions, 3);
+  ASSERT_EQ(flat_txs->transaction_count, 3);
+  ASSERT_EQ(flat_txs->txin_count, 3);
+  ASSERT_EQ(flat_txs->txout_count, 6);
+  ASSERT_EQ(get_flat_tx_txin_count(flat_txs, 0), 0);
+  ASSERT_EQ(get_flat_tx_txin_count(flat_txs, 2), 2);
+  ASSERT_EQ(flat_txs->txin_offsets[2], 1);
+  ASSERT_EQ(flat_txs->txout_offsets[2], 4);
+  ASSERT(valid_flat_transaction_header(flat_txs, 1) == 1);
+  ASSERT(validate_flat_transaction_signatures(flat_txs, 0, 3) == 0);
+
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    transaction_t *tx = unflatten_transaction(flat_txs, i);
+    ASSERT(compare_transaction(transactions[i], tx) == 1);
+    free_transaction(tx);
+  }
+
+  // an invalid signature only fails the range it is in
+  flat_txs->txin_signatures[2][0] ^= 0xff;
+  ASSERT(validate_flat_transaction_signatures(flat_txs, 0, 2) == 0);
+  ASSERT(validate_flat_transaction_signatures(flat_txs, 0, 3) == 1);
+
+  free_flat_transactions(flat_txs);
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    free_transaction(transactions[i]);
+  }
+
+  PASS();
+}
+
+TEST can_cache_transaction_id(void)
+{
+  transaction_t *tx = make_transaction();
+  output_transaction_t *txout = make_txout();
+  txout->amount = randombytes_random();
+  randombytes_buf(txout->address, ADDRESS_SIZE);
+  add_txout_to_transaction(tx, txout, 0);
+
+  uint8_t tx_id[HASH_SIZE];
+  compute_tx_id(tx_id, tx);
+  ASSERT(tx->has_cached_id == 1);
+
+  uint8_t cached_tx_id[HASH_SIZE];
+  compute_tx_id(cached_tx_id, tx);
+  ASSERT_MEM_EQ(tx_id, cached_tx_id, HASH_SIZE);
+
+  // changing the tx's contents must invalidate the cached id
+  output_transaction_t *other_txout = make_txout();
+  other_txout->amount = txout->amount + 1;
+  randombytes_buf(other_txout->address, ADDRESS_SIZE);
+  add_txout_to_transaction(tx, other_txout, 1);
+  ASSERT(tx->has_cached_id == 0);
+
+  compute_tx_id(cached_tx_id, tx);
+  ASSERT(memcmp(tx_id, cached_tx_id, HASH_SIZE) != 0);
+
+  // a txout changed in place is only picked up when the tx's own id is recomputed
+  compute_self_tx_id(tx);
+  memcpy(tx_id, tx->id, HASH_SIZE);
+  other_txout->address[0] ^= 0xff;
+  compute_tx_id(cached_tx_id, tx);
+  ASSERT_MEM_EQ(tx_id, cached_tx_id, HASH_SIZE);
+  compute_self_tx_id(tx);
+  ASSERT(memcmp(tx_id, tx->id, HASH_SIZE) != 0);
+
+  free_transaction(tx);
+  PASS();
+}
+
+TEST can_encode_transaction_v2(void)
+{
+  transaction_t *tx = make_transaction();
+  input_transaction_t *txin = make_txin();
+  randombytes_buf(txin->transaction, HASH_SIZE);
+  txin->txout_index = 3;
+  randombytes_buf(txin->signature, crypto_sign_BYTES);
+  randombytes_buf(txin->public_key, crypto_sign_PUBLICKEYBYTES);
+  add_txin_to_transaction(tx, txin, 0);
+
+  output_transaction_t *txout = make_txout();
+  txout->amount = 5000;
+  randombytes_buf(txout->address, ADDRESS_SIZE);
+  add_txout_to_transaction(tx, txout, 0);
+  ASSERT(compute_self_tx_id(tx) == 0);
+
+  buffer_t *buffer = buffer_init();
+  buffer_t *buffer_v2 = buffer_init();
+  ASSERT(serialize_transaction(buffer, tx) == 0);
+  ASSERT(serialize_transaction_encoded(buffer_v2, tx, ENCODING_VERSION_2) == 0);
+  ASSERT(buffer_get_size(buffer_v2) < buffer_get_size(buffer));
+
+  // the tx id does not depend on the encoding the tx was received in
+  buffer_iterator_t *buffer_iterator = buffer_iterator_init(buffer_v2);
+  transaction_t *decoded_tx = NULL;
+  ASSERT(deserialize_transaction_encoded(buffer_iterator, ENCODING_VERSION_2, &decoded_tx) == 0);
+  ASSERT_EQ(buffer_get_remaining_size(buffer_iterator), 0);
+  ASSERT(compare_transaction(decoded_tx, tx) == 1);
+  uint8_t decoded_tx_id[HASH_SIZE];
+  compute_tx_id(decoded_tx_id, decoded_tx);
+  ASSERT_MEM_EQ(decoded_tx_id, tx->id, HASH_SIZE);
+  buffer_iterator_free(buffer_iterator);
+
+  // unspent txs are stored in the v2 encoding, but v1 records can still be read
+  unspent_transaction_t *unspent_tx = transaction_to_unspent_transaction(tx);
+  for (int i = 0; i < 2; i++)
+  {
+    buffer_t *unspent_buffer = buffer_init();
+    ASSERT(serialize_unspent_transaction_encoded(unspent_buffer, unspent_tx, i == 0 ? ENCODING_VERSION_1 : ENCODING_VERSION_2) == 0);
+
+    buffer_iterator_t *unspent_buffer_iterator = buffer_iterator_init(unspent_buffer);
+    unspent_transaction_t *decoded_unspent_tx = NULL;
+    ASSERT(deserialize_unspent_transaction(unspent_buffer_iterator, &decoded_unspent_tx) == 0);
+    ASSERT_EQ(buffer_get_remaining_size(unspent_buffer_iterator), 0);
+    ASSERT_MEM_EQ(decoded_unspent_tx->id, unspent_tx->id, HASH_SIZE);
+    ASSERT_EQ(decoded_unspent_tx->unspent_txout_count, 1);
+    ASSERT_EQ(decoded_unspent_tx->unspent_txouts[0]->amount, 5000);
+    ASSERT_MEM_EQ(decoded_unspent_tx->unspent_txouts[0]->address, txout->address, ADDRESS_SIZE);
+
+    free_unspent_transaction(decoded_unspent_tx);
+    buffer_iterator_free(unspent_buffer_iterator);
+    buffer_free(unspent_buffer);
+  }
+
+  free_unspent_transaction(unspent_tx);
+  free_transaction(decoded_tx);
+  buffer_free(buffer_v2);
+  buffer_free(buffer);
+  free_transaction(tx);
+  PASS();
+}
+
+TEST can_sign_txins_with_sign_header(void)
+{
+  uint8_t public_key[crypto_sign_PUBLICKEYBYTES];
+  uint8_t secret_key[crypto_sign_SECRETKEYBYTES];
+  crypto_sign_keypair(public_key, secret_key);
+
+  transaction_t *tx = make_transaction();
+  output_transaction_t *txout = make_txout();
+  txout->amount = randombytes_random();
+  randombytes_buf(txout->address, ADDRESS_SIZE);
+  add_txout_to_transaction(tx, txout, 0);
+
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    input_transaction_t *txin = make_txin();
+    randombytes_buf(txin->transaction, HASH_SIZE);
+    txin->txout_index = i;
+    add_txin_to_transaction(tx, txin, i);
+  }
+
+  ASSERT(sign_txins(tx, public_key, secret_key) == 0);
+  ASSERT(validate_tx_signatures(tx) == 0);
+  free_transaction(tx);
+  PASS();
+}
+
+TEST can_select_coins(void)
+{
+  const uint64_t amounts[4] = {50, 30, 20, 10};
+  uint32_t selected_indexes[4];
+  uint32_t num_selected = 0;
+  uint64_t selected_amount = 0;
+
+  // an exact match needs no change and uses the fewest outputs
+  ASSERT(select_coins(amounts, 4, 40, 4, selected_indexes, &num_selected, &selected_amount) == 0);
+  ASSERT_EQ(num_selected, 2);
+  ASSERT_EQ(selected_amount, 40);
+  ASSERT_EQ(amounts[selected_indexes[0]] + amounts[selected_indexes[1]], 40);
+
+  // without an exact match the smallest output covering the target is used
+  ASSERT(select_coins(amounts, 4, 45, 4, selected_indexes, &num_selected, &selected_amount) == 0);
+  ASSERT_EQ(num_selected, 1);
+  ASSERT_EQ(selected_amount, 50);
+
+  // otherwise the largest outputs are used until the target is covered
+  ASSERT(select_coins(amounts, 4, 105, 4, selected_indexes, &num_selected, &selected_amount) == 0);
+  ASSERT_EQ(num_selected, 4);
+  ASSERT_EQ(selected_amount, 110);
+
+  ASSERT(select_coins(amounts, 4, 105, 3, selected_indexes, &num_selected, &selected_amount) == 1);
+  ASSERT(select_coins(amounts, 4, 200, 4, selected_indexes, &num_selected, &selected_amount) == 1);
+  PASS();
+}
+
+static int get_test_wallet_output_amount(wallet_t *wallet, input_transaction_t *txin, uint64_t *amount)
+{
+  void *value = NULL;
+  int index = 0;
+  vec_foreach(&wallet->outputs, value, index)
+  {
+    wallet_output_t *output = (wallet_output_t*)value;
+    if (compare_hash(output->tx_id, txin->transaction) && output->txout_index == txin->txout_index)
+    {
+      *amount = output->amount;
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+TEST can_construct_payout_txs(void)
+{
+  wallet_t *wallet = make_wallet();
+  crypto_sign_keypair(wallet->public_key, wallet->secret_key);
+  public_key_to_address(wallet->address, wallet->public_key);
+
+  // the last output pays the second tx of the batch exactly
+  const uint32_t num_payouts = MAX_PAYOUT_TXOUTS_PER_TX + 10;
+  const uint64_t payout_amount = 100;
+  const uint64_t output_amounts[4] = {1000000, 1000000, 1000000, 10 * payout_amount};
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    wallet_output_t *output = malloc(sizeof(wallet_output_t));
+    ASSERT(output != NULL);
+    randombytes_buf(output->tx_id, HASH_SIZE);
+    output->txout_index = i;
+    output->amount = output_amounts[i];
+    output->spent = 0;
+    ASSERT(vec_push(&wallet->outputs, output) == 0);
+  }
+
+  transaction_entry_t *payouts = malloc(sizeof(transaction_entry_t) * num_payouts);
+  ASSERT(payouts != NULL);
+  for (uint32_t i = 0; i < num_payouts; i++)
+  {
+    randombytes_buf(payouts[i].address, ADDRESS_SIZE);
+    payouts[i].amount = payout_amount;
+  }
+
+  // the batch needs two txs, more than allowed here
+  transaction_t *txs[2] = {NULL, NULL};
+  uint32_t num_txs = 0;
+  ASSERT(construct_payout_txs(txs, 1, &num_txs, wallet, payouts, num_payouts) == 1);
+  ASSERT(txs[0] == NULL);
+
+  ASSERT(construct_payout_txs(txs, 2, &num_txs, wallet, payouts, num_payouts) == 0);
+  ASSERT_EQ(num_txs, 2);
+  for (uint32_t i = 0; i < num_txs; i++)
+  {
+    // every tx was signed across the schedulers and has it's id computed afterwards
+    transaction_t *tx = txs[i];
+    ASSERT(validate_tx_signatures(tx) == 0);
+    uint8_t tx_id[HASH_SIZE];
+    memcpy(tx_id, tx->id, HASH_SIZE);
+    ASSERT(compute_self_tx_id(tx) == 0);
+    ASSERT_MEM_EQ(tx_id, tx->id, HASH_SIZE);
+
+    uint64_t input_amount = 0;
+    for (uint32_t txin_index = 0; txin_index < tx->txin_count; txin_index++)
+    {
+      uint64_t amount = 0;
+      ASSERT(get_test_wallet_output_amount(wallet, tx->txins[txin_index], &amount) == 0);
+      input_amount += amount;
+
+      // no output is spent by both txs of the batch
+      transaction_t *other_tx = txs[1 - i];
+      for (uint32_t other_txin_index = 0; other_txin_index < other_tx->txin_count; other_txin_index++)
+      {
+        input_transaction_t *other_txin = other_tx->txins[other_txin_index];
+        ASSERT(compare_hash(tx->txins[txin_index]->transaction, other_txin->transaction) == 0 ||
+          tx->txins[txin_index]->txout_index != other_txin->txout_index);
+      }
+    }
+
+    uint64_t output_amount = 0;
+    for (uint32_t txout_index = 0; txout_index < tx->txout_count; txout_index++)
+    {
+      output_amount += tx->txouts[txout_index]->amount;
+    }
+
+    ASSERT_EQ(input_amount, output_amount);
+  }
+
+  // the first tx sends it's change back to the wallet, the second needs none
+  transaction_t *tx = txs[0];
+  ASSERT_EQ(tx->txout_count, MAX_PAYOUT_TXOUTS_PER_TX + 1);
+  output_transaction_t *change_txout = tx->txouts[tx->txout_count - 1];
+  ASSERT_MEM_EQ(change_txout->address, wallet->address, ADDRESS_SIZE);
+  ASSERT_EQ(change_txout->amount, output_amounts[0] - (MAX_PAYOUT_TXOUTS_PER_TX * payout_amount));
+  ASSERT_MEM_EQ(tx->txouts[0]->address, payouts[0].address, ADDRESS_SIZE);
+
+  tx = txs[1];
+  ASSERT_EQ(tx->txin_count, 1);
+  ASSERT_EQ(tx->txout_count, 10);
+  ASSERT_MEM_EQ(tx->txouts[9]->address, payouts[num_payouts - 1].address, ADDRESS_SIZE);
+
+  free_transaction(txs[0]);
+  free_transaction(txs[1]);
+
+  // the wallet can not pay for a payout larger than all of it's outputs
+  txs[0] = NULL;
+  payouts[num_payouts - 1].amount = 3000000;
+  ASSERT(construct_payout_txs(txs, 2, &num_txs, wallet, payouts, num_payouts) == 1);
+  ASSERT(txs[0] == NULL);
+
+  free(payouts);
+  free_wallet(wallet);
+  PASS();
+}
+
 GREATEST_SUITE(transaction_suite)
 {
   RUN_TEST(try_double_spend_tx);
+  RUN_TEST(can_verify_signature_batch);
+  RUN_TEST(can_flatten_transactions);
+  RUN_TEST(can_cache_transaction_id);
+  RUN_TEST(can_encode_transaction_v2);
+  RUN_TEST(can_sign_txins_with_sign_header);
+  RUN_TEST(can_select_coins);
+  RUN_TEST(can_construct_payout_txs);
 }